@@ -2,6 +2,36 @@ dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
   
+  if test "$ioloop" = "uring"; then
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_uring_works,[
+      AC_TRY_RUN([
+        #include <string.h>
+        #include <unistd.h>
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+
+        int main()
+        {
+  	struct io_uring_params p;
+  	memset(&p, 0, sizeof(p));
+  	if (syscall(__NR_io_uring_setup, 4, &p) < 0)
+  	  return 1;
+  	return (p.features & IORING_FEAT_EXT_ARG) == 0;
+        }
+      ], [
+        i_cv_uring_works=yes
+      ], [
+        i_cv_uring_works=no
+      ])
+    ])
+    if test $i_cv_uring_works = yes; then
+      AC_DEFINE(IOLOOP_URING,, [Implement I/O loop with Linux io_uring])
+      have_ioloop=yes
+    else
+      AC_MSG_ERROR([uring ioloop requested but io_uring_setup() is not available])
+    fi
+  fi
+
   if test "$ioloop" = "best" || test "$ioloop" = "epoll"; then
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
       AC_TRY_RUN([
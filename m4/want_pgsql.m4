@@ -31,6 +31,9 @@ AC_DEFUN([DOVECOT_WANT_PGSQL], [
   	  AC_CHECK_LIB(pq, PQescapeStringConn, [
   		  AC_DEFINE(HAVE_PQESCAPE_STRING_CONN,, [Define if libpq has PQescapeStringConn function])
   	  ])
+  	  AC_CHECK_LIB(pq, PQsetSingleRowMode, [
+  		  AC_DEFINE(HAVE_PQSETSINGLEROWMODE,, [Define if libpq has PQsetSingleRowMode function])
+  	  ])
   	  old_CPPFLAGS=$CPPFLAGS
   	  if test "$PGSQL_INCLUDE" != ""; then
   		  CPPFLAGS="$CPPFLAGS -I$PGSQL_INCLUDE"
@@ -58,7 +58,7 @@ anvil_connection_request(struct anvil_connection *conn,
 			*error_r = "CONNECT: Not enough parameters";
 			return -1;
 		}
-		if (str_to_pid(args[0], &pid) < 0) {
+		if (str_to_pid(args[0], &pid) < 0 || pid == 0) {
 			*error_r = "CONNECT: Invalid pid";
 			return -1;
 		}
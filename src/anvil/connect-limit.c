@@ -2,12 +2,16 @@
 
 #include "common.h"
 #include "hash.h"
+#include "llist.h"
 #include "str.h"
 #include "strescape.h"
 #include "ostream.h"
 #include "connect-limit.h"
 
 struct ident_pid {
+	/* linked list of all the idents for the same pid */
+	struct ident_pid *prev, *next;
+
 	/* ident string points to ident_hash keys */
 	const char *ident;
 	pid_t pid;
@@ -19,6 +23,8 @@ struct connect_limit {
 	HASH_TABLE(char *, void *) ident_hash;
 	/* struct ident_pid => struct ident_pid */
 	HASH_TABLE(struct ident_pid *, struct ident_pid *) ident_pid_hash;
+	/* pid => struct ident_pid list */
+	HASH_TABLE(void *, struct ident_pid *) pid_hash;
 };
 
 static unsigned int ident_pid_hash(const struct ident_pid *i)
@@ -44,6 +50,7 @@ struct connect_limit *connect_limit_init(void)
 	hash_table_create(&limit->ident_hash, default_pool, 0, str_hash, strcmp);
 	hash_table_create(&limit->ident_pid_hash, default_pool, 0,
 			  ident_pid_hash, ident_pid_cmp);
+	hash_table_create_direct(&limit->pid_hash, default_pool, 0);
 	return limit;
 }
 
@@ -54,6 +61,7 @@ void connect_limit_deinit(struct connect_limit **_limit)
 	*_limit = NULL;
 	hash_table_destroy(&limit->ident_hash);
 	hash_table_destroy(&limit->ident_pid_hash);
+	hash_table_destroy(&limit->pid_hash);
 	i_free(limit);
 }
 
@@ -66,6 +74,29 @@ unsigned int connect_limit_lookup(struct connect_limit *limit,
 	return POINTER_CAST_TO(value, unsigned int);
 }
 
+static void
+connect_limit_pid_link(struct connect_limit *limit, struct ident_pid *i)
+{
+	struct ident_pid *first;
+
+	first = hash_table_lookup(limit->pid_hash, POINTER_CAST(i->pid));
+	DLLIST_PREPEND(&first, i);
+	hash_table_update(limit->pid_hash, POINTER_CAST(i->pid), first);
+}
+
+static void
+connect_limit_pid_unlink(struct connect_limit *limit, struct ident_pid *i)
+{
+	struct ident_pid *first;
+
+	first = hash_table_lookup(limit->pid_hash, POINTER_CAST(i->pid));
+	DLLIST_REMOVE(&first, i);
+	if (first != NULL)
+		hash_table_update(limit->pid_hash, POINTER_CAST(i->pid), first);
+	else
+		hash_table_remove(limit->pid_hash, POINTER_CAST(i->pid));
+}
+
 void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 			   const char *ident)
 {
@@ -92,6 +123,7 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 		i->pid = pid;
 		i->refcount = 1;
 		hash_table_insert(limit->ident_pid_hash, i, i);
+		connect_limit_pid_link(limit, i);
 	} else {
 		i->refcount++;
 	}
@@ -134,6 +166,7 @@ void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
 
 	if (--i->refcount == 0) {
 		hash_table_remove(limit->ident_pid_hash, i);
+		connect_limit_pid_unlink(limit, i);
 		i_free(i);
 	}
 
@@ -142,21 +175,20 @@ void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
 
 void connect_limit_disconnect_pid(struct connect_limit *limit, pid_t pid)
 {
-	struct hash_iterate_context *iter;
-	struct ident_pid *i, *value;
+	struct ident_pid *i, *next;
 
-	/* this should happen rarely (or never), so this slow implementation
-	   should be fine. */
-	iter = hash_table_iterate_init(limit->ident_pid_hash);
-	while (hash_table_iterate(iter, limit->ident_pid_hash, &i, &value)) {
-		if (i->pid == pid) {
-			hash_table_remove(limit->ident_pid_hash, i);
-			for (; i->refcount > 0; i->refcount--)
-				connect_limit_ident_hash_unref(limit, i->ident);
-			i_free(i);
-		}
+	i = hash_table_lookup(limit->pid_hash, POINTER_CAST(pid));
+	if (i == NULL)
+		return;
+	hash_table_remove(limit->pid_hash, POINTER_CAST(pid));
+
+	for (; i != NULL; i = next) {
+		next = i->next;
+		hash_table_remove(limit->ident_pid_hash, i);
+		for (; i->refcount > 0; i->refcount--)
+			connect_limit_ident_hash_unref(limit, i->ident);
+		i_free(i);
 	}
-	hash_table_iterate_deinit(&iter);
 }
 
 void connect_limit_dump(struct connect_limit *limit, struct ostream *output)
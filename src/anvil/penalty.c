@@ -21,12 +21,15 @@
 #define CHECKSUM_VALUE_PTR_COUNT 10
 
 #define LAST_UPDATE_BITS 15
+/* Maximum number of records to expire at once. If there are more, continue
+   expiring them after the pending requests have been handled, so a burst
+   of expiring records doesn't block anvil. */
+#define PENALTY_EXPIRE_MAX_BATCH 10000
 
 struct penalty_rec {
 	/* ordered by last_update */
 	struct penalty_rec *prev, *next;
 
-	char *ident;
 	unsigned int last_penalty;
 
 	unsigned int penalty:16;
@@ -38,11 +41,14 @@ struct penalty_rec {
 		unsigned int value[CHECKSUM_VALUE_COUNT];
 		unsigned int *value_ptr;
 	} checksum;
+	/* allocated together with the record, so each record costs only a
+	   single allocation. */
+	char ident[];
 };
 
 struct penalty {
-	/* ident => penalty_rec */
-	HASH_TABLE(char *, struct penalty_rec *) hash;
+	/* penalty_rec.ident => penalty_rec */
+	HASH_TABLE(const char *, struct penalty_rec *) hash;
 	struct penalty_rec *oldest, *newest;
 
 	unsigned int expire_secs;
@@ -64,7 +70,6 @@ static void penalty_rec_free(struct penalty *penalty, struct penalty_rec *rec)
 	DLLIST2_REMOVE(&penalty->oldest, &penalty->newest, rec);
 	if (rec->checksum_is_pointer)
 		i_free(rec->checksum.value_ptr);
-	i_free(rec->ident);
 	i_free(rec);
 }
 
@@ -162,7 +167,7 @@ static void penalty_timeout(struct penalty *penalty)
 {
 	struct penalty_rec *rec;
 	time_t rec_last_update, expire_time;
-	unsigned int diff;
+	unsigned int diff, count = 0;
 
 	timeout_remove(&penalty->to);
 
@@ -170,6 +175,12 @@ static void penalty_timeout(struct penalty *penalty)
 	while (penalty->oldest != NULL) {
 		rec = penalty->oldest;
 
+		if (++count > PENALTY_EXPIRE_MAX_BATCH) {
+			penalty->to = timeout_add_short(0, penalty_timeout,
+							penalty);
+			break;
+		}
+
 		rec_last_update = rec->last_penalty + rec->last_update;
 		if (rec_last_update > expire_time) {
 			diff = rec_last_update - expire_time;
@@ -177,7 +188,7 @@ static void penalty_timeout(struct penalty *penalty)
 						  penalty_timeout, penalty);
 			break;
 		}
-		hash_table_remove(penalty->hash, rec->ident);
+		hash_table_remove(penalty->hash, (const char *)rec->ident);
 		penalty_rec_free(penalty, rec);
 	}
 }
@@ -193,9 +204,11 @@ void penalty_inc(struct penalty *penalty, const char *ident,
 
 	rec = hash_table_lookup(penalty->hash, ident);
 	if (rec == NULL) {
-		rec = i_new(struct penalty_rec, 1);
-		rec->ident = i_strdup(ident);
-		hash_table_insert(penalty->hash, rec->ident, rec);
+		size_t ident_size = strlen(ident) + 1;
+
+		rec = i_malloc(MALLOC_ADD(sizeof(*rec), ident_size));
+		memcpy(rec->ident, ident, ident_size);
+		hash_table_insert(penalty->hash, (const char *)rec->ident, rec);
 	} else {
 		DLLIST2_REMOVE(&penalty->oldest, &penalty->newest, rec);
 	}
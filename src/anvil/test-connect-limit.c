@@ -0,0 +1,47 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "connect-limit.h"
+#include "test-common.h"
+
+static void test_connect_limit(void)
+{
+	struct connect_limit *limit;
+
+	test_begin("connect limit");
+	limit = connect_limit_init();
+
+	connect_limit_connect(limit, 501, "ident1");
+	connect_limit_connect(limit, 501, "ident1");
+	connect_limit_connect(limit, 501, "ident2");
+	connect_limit_connect(limit, 502, "ident1");
+	test_assert(connect_limit_lookup(limit, "ident1") == 3);
+	test_assert(connect_limit_lookup(limit, "ident2") == 1);
+	test_assert(connect_limit_lookup(limit, "ident3") == 0);
+
+	connect_limit_disconnect(limit, 501, "ident1");
+	test_assert(connect_limit_lookup(limit, "ident1") == 2);
+	connect_limit_disconnect(limit, 502, "ident1");
+	test_assert(connect_limit_lookup(limit, "ident1") == 1);
+
+	/* kill the pid with the remaining connections */
+	connect_limit_connect(limit, 503, "ident2");
+	connect_limit_disconnect_pid(limit, 501);
+	test_assert(connect_limit_lookup(limit, "ident1") == 0);
+	test_assert(connect_limit_lookup(limit, "ident2") == 1);
+	connect_limit_disconnect_pid(limit, 501);
+	connect_limit_disconnect_pid(limit, 503);
+	test_assert(connect_limit_lookup(limit, "ident2") == 0);
+
+	connect_limit_deinit(&limit);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_connect_limit,
+		NULL
+	};
+	return test_run(test_functions);
+}
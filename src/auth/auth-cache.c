@@ -2,14 +2,27 @@
 
 #include "auth-common.h"
 #include "lib-signals.h"
+#include "ioloop.h"
+#include "hostpid.h"
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
+#include "strnum.h"
+#include "istream.h"
+#include "ostream.h"
 #include "var-expand.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 
+#include <stdio.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define AUTH_CACHE_FILE_HEADER "auth-cache\t1"
+/* How often to save a changed persistent cache */
+#define AUTH_CACHE_SAVE_INTERVAL_MSECS (60*1000)
 
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
@@ -18,6 +31,11 @@ struct auth_cache {
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
+	/* Persistent cache file, NULL if not used */
+	char *path, *db_hash;
+	struct timeout *to_save;
+	bool changed;
+
 	unsigned int hit_count, miss_count;
 	unsigned int pos_entries, neg_entries;
 	unsigned long long pos_size, neg_size;
@@ -185,6 +203,7 @@ auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
 	cache->size_left += node->alloc_size;
 	hash_table_remove(cache->hash, key);
 	i_free(node);
+	cache->changed = TRUE;
 }
 
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
@@ -252,8 +271,15 @@ void auth_cache_free(struct auth_cache **_cache)
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
+	if (cache->path != NULL) {
+		timeout_remove(&cache->to_save);
+		if (cache->changed)
+			(void)auth_cache_save(cache);
+	}
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
+	i_free(cache->path);
+	i_free(cache->db_hash);
 	i_free(cache);
 }
 
@@ -404,6 +430,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		if (node != cache->head) {
 			auth_cache_node_unlink(cache, node);
 			auth_cache_node_link_head(cache, node);
+			cache->changed = TRUE;
 		}
 		cache->hit_count++;
 	}
@@ -416,30 +443,16 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	return value;
 }
 
-void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
-		       const char *key, const char *value, bool last_success)
+static size_t
+auth_cache_insert_node(struct auth_cache *cache, const char *key,
+		       const char *value, time_t created, bool last_success)
 {
-        struct auth_cache_node *node;
-	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	const char *cache_username;
+	struct auth_cache_node *node;
+	size_t data_size, alloc_size, key_len, value_len;
 	char *hash_key;
 
-	if (*value == '\0' && cache->neg_ttl_secs == 0) {
-		/* we're not caching negative entries */
-		return;
-	}
-
-	/* store into cache using the translated username, except if we're doing
-	   a master user login */
-	cache_username = request->fields.user;
-	if (request->fields.translated_username != NULL &&
-	    request->fields.requested_login_user == NULL &&
-	    request->fields.master_user == NULL)
-		cache_username = request->fields.translated_username;
-
-	key = auth_request_expand_cache_key(request, key, cache_username);
 	key_len = strlen(key);
-
+	value_len = strlen(value);
 	data_size = key_len + 1 + value_len + 1;
 	alloc_size = sizeof(struct auth_cache_node) + data_size;
 
@@ -455,7 +468,7 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 
 	/* @UNSAFE */
 	node = i_malloc(alloc_size);
-	node->created = time(NULL);
+	node->created = created;
 	node->alloc_size = alloc_size;
 	node->last_success = last_success;
 	memcpy(node->data, key, key_len);
@@ -466,6 +479,32 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	cache->size_left -= alloc_size;
 	hash_key = node->data;
 	hash_table_insert(cache->hash, hash_key, node);
+	cache->changed = TRUE;
+	return alloc_size;
+}
+
+void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
+		       const char *key, const char *value, bool last_success)
+{
+	size_t alloc_size;
+	const char *cache_username;
+
+	if (*value == '\0' && cache->neg_ttl_secs == 0) {
+		/* we're not caching negative entries */
+		return;
+	}
+
+	/* store into cache using the translated username, except if we're doing
+	   a master user login */
+	cache_username = request->fields.user;
+	if (request->fields.translated_username != NULL &&
+	    request->fields.requested_login_user == NULL &&
+	    request->fields.master_user == NULL)
+		cache_username = request->fields.translated_username;
+
+	key = auth_request_expand_cache_key(request, key, cache_username);
+	alloc_size = auth_cache_insert_node(cache, key, value,
+					    time(NULL), last_success);
 
 	if (*value != '\0') {
 		cache->pos_entries++;
@@ -488,3 +527,181 @@ void auth_cache_remove(struct auth_cache *cache,
 
 	auth_cache_node_destroy(cache, node);
 }
+
+static bool
+auth_cache_file_is_secure(int fd, const char *path)
+{
+	struct stat st, lst;
+
+	if (fstat(fd, &st) < 0) {
+		i_error("fstat(%s) failed: %m", path);
+		return FALSE;
+	}
+	if (lstat(path, &lst) < 0) {
+		i_error("lstat(%s) failed: %m", path);
+		return FALSE;
+	}
+	/* the file contains password hashes, so make sure nobody else could
+	   have written or read it */
+	if ((st.st_mode & 07777) != 0600 ||
+	    st.st_uid != geteuid() || st.st_nlink > 1 ||
+	    !S_ISREG(st.st_mode) || !S_ISREG(lst.st_mode) ||
+	    st.st_ino != lst.st_ino || !CMP_DEV_T(st.st_dev, lst.st_dev)) {
+		i_error("Insecure auth cache file, ignoring: %s", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int
+auth_cache_load_line(struct auth_cache *cache, const char *line)
+{
+	const char *const *args = t_strsplit_tabescaped(line);
+	time_t created;
+
+	/* <created> <last_success> <key> <value> */
+	if (str_array_length(args) != 4 ||
+	    str_to_time(args[0], &created) < 0 ||
+	    (strcmp(args[1], "0") != 0 && strcmp(args[1], "1") != 0) ||
+	    args[2][0] == '\0')
+		return -1;
+
+	(void)auth_cache_insert_node(cache, args[2], args[3], created,
+				     args[1][0] == '1');
+	return 0;
+}
+
+static int auth_cache_load(struct auth_cache *cache)
+{
+	struct istream *input;
+	const char *line;
+	unsigned int count = 0;
+	int fd, ret = 0;
+
+	fd = open(cache->path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		i_error("open(%s) failed: %m", cache->path);
+		return -1;
+	}
+	if (!auth_cache_file_is_secure(fd, cache->path)) {
+		i_close_fd(&fd);
+		return -1;
+	}
+
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+	line = i_stream_read_next_line(input);
+	if (line == NULL || strcmp(line, t_strconcat(AUTH_CACHE_FILE_HEADER,
+						     "\t", cache->db_hash,
+						     NULL)) != 0) {
+		/* empty, unknown version or passdbs/userdbs have changed.
+		   The cache keys refer to the passdbs and userdbs by their
+		   IDs, so the old entries can't be used. */
+		i_stream_unref(&input);
+		return 0;
+	}
+	/* the entries are saved from the oldest to the newest, so the LRU
+	   order is preserved and the size limit drops the oldest ones */
+	while (ret == 0 && (line = i_stream_read_next_line(input)) != NULL) {
+		T_BEGIN {
+			ret = auth_cache_load_line(cache, line);
+		} T_END;
+		if (ret < 0) {
+			i_error("Corrupted auth cache file %s line %u",
+				cache->path, count + 2);
+		} else {
+			count++;
+		}
+	}
+	if (input->stream_errno != 0) {
+		i_error("read(%s) failed: %s", cache->path,
+			i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_unref(&input);
+
+	if (ret < 0)
+		auth_cache_clear(cache);
+	else if (count > 0)
+		e_debug(auth_event, "Loaded %u auth cache entries from %s",
+			count, cache->path);
+	return ret;
+}
+
+int auth_cache_save(struct auth_cache *cache)
+{
+	struct auth_cache_node *node;
+	struct ostream *output;
+	const char *temp_path, *value;
+	string_t *str;
+	mode_t old_mask;
+	int fd, ret = 0;
+
+	i_assert(cache->path != NULL);
+
+	temp_path = t_strdup_printf("%s.%s.tmp", cache->path, my_pid);
+	old_mask = umask(0);
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	umask(old_mask);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", temp_path);
+		return -1;
+	}
+
+	output = o_stream_create_fd_autoclose(&fd, IO_BLOCK_SIZE);
+	o_stream_cork(output);
+	o_stream_nsend_str(output, t_strconcat(AUTH_CACHE_FILE_HEADER, "\t",
+					       cache->db_hash, "\n", NULL));
+	str = t_str_new(256);
+	for (node = cache->tail; node != NULL; node = node->next) {
+		value = node->data + strlen(node->data) + 1;
+
+		str_truncate(str, 0);
+		str_printfa(str, "%s\t%c\t", dec2str(node->created),
+			    node->last_success ? '1' : '0');
+		str_append_tabescaped(str, node->data);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, value);
+		str_append_c(str, '\n');
+		o_stream_nsend(output, str_data(str), str_len(str));
+	}
+	if (o_stream_finish(output) < 0) {
+		i_error("write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (ret == 0 && rename(temp_path, cache->path) < 0) {
+		i_error("rename(%s, %s) failed: %m", temp_path, cache->path);
+		ret = -1;
+	}
+	if (ret < 0) {
+		i_unlink_if_exists(temp_path);
+		return -1;
+	}
+	cache->changed = FALSE;
+	return 0;
+}
+
+static void auth_cache_save_timeout(struct auth_cache *cache)
+{
+	if (cache->changed)
+		(void)auth_cache_save(cache);
+}
+
+void auth_cache_set_persistent(struct auth_cache *cache, const char *path,
+			       const char *db_hash)
+{
+	i_assert(cache->path == NULL);
+
+	cache->path = i_strdup(path);
+	cache->db_hash = i_strdup(db_hash);
+	if (auth_cache_load(cache) == 0) {
+		/* nothing has changed compared to the file */
+		cache->changed = FALSE;
+	}
+	cache->to_save = timeout_add(AUTH_CACHE_SAVE_INTERVAL_MSECS,
+				     auth_cache_save_timeout, cache);
+}
@@ -28,6 +28,16 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs);
 void auth_cache_free(struct auth_cache **cache);
 
+/* Keep the cache over process restarts by saving it to the given path.
+   The previously saved entries are loaded immediately if they were saved
+   with the same db_hash, which should identify the passdb and userdb
+   configuration. Afterwards the cache is saved periodically when it has
+   changed and when it's freed. */
+void auth_cache_set_persistent(struct auth_cache *cache, const char *path,
+			       const char *db_hash);
+/* Save the persistent cache now. Returns 0 if ok, -1 if failed. */
+int auth_cache_save(struct auth_cache *cache);
+
 /* Clear the cache. Returns how many entries were removed. */
 unsigned int ATTR_NOWARN_UNUSED_RESULT
 auth_cache_clear(struct auth_cache *cache);
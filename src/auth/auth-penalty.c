@@ -33,7 +33,8 @@ struct auth_penalty *auth_penalty_init(const char *path)
 
 	penalty = i_new(struct auth_penalty, 1);
 	penalty->client = anvil_client_init(path, NULL,
-					    ANVIL_CLIENT_FLAG_HIDE_ENOENT);
+					    ANVIL_CLIENT_FLAG_HIDE_ENOENT |
+					    ANVIL_CLIENT_FLAG_BATCH);
 	if (anvil_client_connect(penalty->client, TRUE) < 0)
 		penalty->disabled = TRUE;
 	else {
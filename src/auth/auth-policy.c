@@ -1,6 +1,9 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "llist.h"
 #include "net.h"
 #include "str.h"
 #include "istream.h"
@@ -21,6 +24,8 @@
 #include "iostream-ssl.h"
 
 #define AUTH_POLICY_DNS_SOCKET_PATH "dns-client"
+/* Maximum number of policy check results to keep in cache */
+#define AUTH_POLICY_CACHE_MAX_ENTRIES 10000
 
 static struct http_client_settings http_client_set = {
 	.dns_client_socket_path = AUTH_POLICY_DNS_SOCKET_PATH,
@@ -35,6 +40,23 @@ static char *auth_policy_json_template;
 
 static struct http_client *http_client;
 
+struct policy_lookup_waiter {
+	struct auth_request *request;
+	struct event *event;
+	auth_policy_callback_t callback;
+	void *callback_context;
+};
+
+struct policy_cache_entry {
+	/* ordered by expire time */
+	struct policy_cache_entry *prev, *next;
+
+	char *key;
+	time_t expires;
+	int result;
+	char *message;
+};
+
 struct policy_lookup_ctx {
 	pool_t pool;
 	string_t *json;
@@ -49,6 +71,12 @@ struct policy_lookup_ctx {
 	auth_policy_callback_t callback;
 	void *callback_context;
 
+	/* Key used for caching and coalescing identical policy checks.
+	   NULL if policy_cache_ttl is disabled. */
+	const char *cache_key;
+	/* Other requests waiting for the result of this lookup */
+	ARRAY(struct policy_lookup_waiter) waiters;
+
 	struct istream *payload;
 	struct io *io;
 	struct event *event;
@@ -60,6 +88,10 @@ struct policy_lookup_ctx {
 	} parse_state;
 
 	bool parse_error;
+	/* Policy server returned a successfully parsed result */
+	bool result_valid;
+	/* The lookup is in policy_lookups hash */
+	bool in_flight;
 };
 
 struct policy_template_keyvalue {
@@ -67,6 +99,13 @@ struct policy_template_keyvalue {
 	const char *value;
 };
 
+/* cache_key => struct policy_cache_entry */
+static HASH_TABLE(char *, struct policy_cache_entry *) policy_cache;
+static struct policy_cache_entry *policy_cache_oldest, *policy_cache_newest;
+static unsigned int policy_cache_count;
+/* cache_key => in-flight struct policy_lookup_ctx */
+static HASH_TABLE(const char *, struct policy_lookup_ctx *) policy_lookups;
+
 static
 int auth_policy_attribute_comparator(const struct policy_template_keyvalue *a,
 	const struct policy_template_keyvalue *b)
@@ -228,12 +267,60 @@ void auth_policy_init(void)
 	if (global_auth_settings->policy_log_only)
 		i_warning("auth-policy: Currently in log-only mode. Ignoring "
 			  "tarpit and disconnect instructions from policy server");
+
+	hash_table_create(&policy_cache, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&policy_lookups, default_pool, 0, str_hash, strcmp);
+}
+
+static void auth_policy_cache_free(struct policy_cache_entry *entry)
+{
+	hash_table_remove(policy_cache, entry->key);
+	DLLIST2_REMOVE(&policy_cache_oldest, &policy_cache_newest, entry);
+	policy_cache_count--;
+	i_free(entry->key);
+	i_free(entry->message);
+	i_free(entry);
+}
+
+static void auth_policy_cache_expire(void)
+{
+	while (policy_cache_oldest != NULL &&
+	       policy_cache_oldest->expires <= ioloop_time)
+		auth_policy_cache_free(policy_cache_oldest);
+}
+
+static void
+auth_policy_cache_add(const char *key, unsigned int ttl_secs, int result,
+		      const char *message)
+{
+	struct policy_cache_entry *entry;
+
+	entry = hash_table_lookup(policy_cache, key);
+	if (entry != NULL)
+		auth_policy_cache_free(entry);
+	else if (policy_cache_count >= AUTH_POLICY_CACHE_MAX_ENTRIES)
+		auth_policy_cache_free(policy_cache_oldest);
+
+	entry = i_new(struct policy_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->expires = ioloop_time + ttl_secs;
+	entry->result = result;
+	entry->message = i_strdup(message);
+	hash_table_insert(policy_cache, entry->key, entry);
+	DLLIST2_APPEND(&policy_cache_oldest, &policy_cache_newest, entry);
+	policy_cache_count++;
 }
 
 void auth_policy_deinit(void)
 {
 	if (http_client != NULL)
 		http_client_deinit(&http_client);
+	i_assert(!hash_table_is_created(policy_lookups) ||
+		 hash_table_count(policy_lookups) == 0);
+	while (policy_cache_oldest != NULL)
+		auth_policy_cache_free(policy_cache_oldest);
+	hash_table_destroy(&policy_cache);
+	hash_table_destroy(&policy_lookups);
 	i_free(auth_policy_json_template);
 }
 
@@ -266,9 +353,70 @@ void auth_policy_log_result(struct policy_lookup_ctx *context)
 			action);
 }
 
+static void
+auth_policy_apply_result(struct auth_request *request, struct event *event,
+			 int result, const char *message)
+{
+	request->policy_refusal = FALSE;
+
+	if (result < 0) {
+		if (message != NULL) {
+			/* set message here */
+			e_debug(event,
+				"Policy response %d with message: %s",
+				result, message);
+			auth_request_set_field(request, "reason", message, NULL);
+		}
+		request->policy_refusal = TRUE;
+	} else {
+		e_debug(event, "Policy response %d", result);
+	}
+
+	if (request->policy_refusal == TRUE && request->set->verbose == TRUE) {
+		e_info(event, "Authentication failure due to policy server refusal%s%s",
+		       (message!=NULL?": ":""),
+		       (message!=NULL?message:""));
+	}
+}
+
+static
+void auth_policy_lookup_finished(struct policy_lookup_ctx *context)
+{
+	struct policy_lookup_waiter *waiter;
+
+	if (!context->in_flight)
+		return;
+	context->in_flight = FALSE;
+	hash_table_remove(policy_lookups, context->cache_key);
+
+	if (context->result_valid) {
+		auth_policy_cache_add(context->cache_key,
+				      context->set->policy_cache_ttl,
+				      context->result, context->message);
+	}
+	if (!array_is_created(&context->waiters))
+		return;
+
+	array_foreach_modifiable(&context->waiters, waiter) {
+		if (context->result_valid) {
+			auth_policy_apply_result(waiter->request, waiter->event,
+						 context->result,
+						 context->message);
+		}
+		e_debug(waiter->event,
+			"Policy response %d from a concurrent identical lookup",
+			context->result);
+		waiter->callback(context->result, waiter->callback_context);
+		event_unref(&waiter->event);
+		auth_request_unref(&waiter->request);
+	}
+	array_clear(&context->waiters);
+}
+
 static
 void auth_policy_finish(struct policy_lookup_ctx *context)
 {
+	auth_policy_lookup_finished(context);
 	if (context->parser != NULL) {
 		const char *error ATTR_UNUSED;
 		(void)json_parser_deinit(&context->parser, &error);
@@ -287,6 +435,7 @@ void auth_policy_callback(struct policy_lookup_ctx *context)
 		context->callback(context->result, context->callback_context);
 	if (context->event != NULL)
 		auth_policy_log_result(context);
+	auth_policy_lookup_finished(context);
 }
 
 static
@@ -349,30 +498,12 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 
 	if (context->parse_error) {
 		context->result = (context->set->policy_reject_on_fail ? -1 : 0);
-	}
-
-	context->request->policy_refusal = FALSE;
-
-	if (context->result < 0) {
-		if (context->message != NULL) {
-			/* set message here */
-			e_debug(context->event,
-				"Policy response %d with message: %s",
-				context->result, context->message);
-			auth_request_set_field(context->request, "reason", context->message, NULL);
-		}
-		context->request->policy_refusal = TRUE;
 	} else {
-		e_debug(context->event,
-			"Policy response %d", context->result);
-	}
-
-	if (context->request->policy_refusal == TRUE && context->set->verbose == TRUE) {
-		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
-		       (context->message!=NULL?": ":""),
-		       (context->message!=NULL?context->message:""));
+		context->result_valid = TRUE;
 	}
 
+	auth_policy_apply_result(context->request, context->event,
+				 context->result, context->message);
 	auth_policy_callback(context);
 	i_stream_unref(&context->payload);
 }
@@ -547,6 +678,66 @@ void auth_policy_create_json(struct policy_lookup_ctx *context,
 	str_append_c(context->json, '}');
 	e_debug(context->event,
 		"Policy server request JSON: %s", str_c(context->json));
+
+	if (!include_success && context->set->policy_cache_ttl > 0) {
+		string_t *key = t_str_new(128);
+
+		if (auth_request_var_expand_with_table(key,
+				context->set->policy_cache_key,
+				context->request, var_table, NULL,
+				&error) <= 0) {
+			e_error(context->event,
+				"Failed to expand auth_policy_cache_key=%s: %s",
+				context->set->policy_cache_key, error);
+		} else {
+			str_printfa(key, "\t%d",
+				    context->request->fields.secured ==
+				    AUTH_REQUEST_SECURED_TLS ? 1 : 0);
+			context->cache_key = p_strdup(context->pool,
+						      str_c(key));
+		}
+	}
+}
+
+static bool auth_policy_check_cached(struct policy_lookup_ctx *context)
+{
+	struct policy_lookup_ctx *lookup;
+	struct policy_cache_entry *entry;
+	struct policy_lookup_waiter *waiter;
+
+	auth_policy_cache_expire();
+	entry = hash_table_lookup(policy_cache, context->cache_key);
+	if (entry != NULL) {
+		e_debug(context->event, "Policy response found from cache");
+		context->result = entry->result;
+		auth_policy_apply_result(context->request, context->event,
+					 entry->result, entry->message);
+		auth_policy_log_result(context);
+		context->callback(entry->result, context->callback_context);
+		return TRUE;
+	}
+
+	lookup = hash_table_lookup(policy_lookups, context->cache_key);
+	if (lookup != NULL) {
+		/* an identical lookup is already in progress - wait for its
+		   result instead of sending another request */
+		e_debug(context->event,
+			"Waiting for a concurrent identical policy request");
+		if (!array_is_created(&lookup->waiters))
+			p_array_init(&lookup->waiters, lookup->pool, 4);
+		waiter = array_append_space(&lookup->waiters);
+		waiter->request = context->request;
+		auth_request_ref(waiter->request);
+		waiter->event = context->event;
+		event_ref(waiter->event);
+		waiter->callback = context->callback;
+		waiter->callback_context = context->callback_context;
+		return TRUE;
+	}
+
+	hash_table_insert(policy_lookups, context->cache_key, context);
+	context->in_flight = TRUE;
+	return FALSE;
 }
 
 static
@@ -592,6 +783,11 @@ void auth_policy_check(struct auth_request *request, const char *password,
 	T_BEGIN {
 		auth_policy_create_json(ctx, password, FALSE);
 	} T_END;
+	if (ctx->cache_key != NULL && auth_policy_check_cached(ctx)) {
+		event_unref(&ctx->event);
+		pool_unref(&ctx->pool);
+		return;
+	}
 	auth_policy_send_request(ctx);
 }
 
@@ -36,6 +36,8 @@
 #define AUTH_DNS_SOCKET_PATH "dns-client"
 #define AUTH_DNS_DEFAULT_TIMEOUT_MSECS (1000*10)
 #define AUTH_DNS_WARN_MSECS 500
+/* proxy host names are typically looked up over and over again */
+#define AUTH_DNS_CACHE_TTL_SECS 5
 #define AUTH_REQUEST_MAX_DELAY_SECS (60*5)
 #define CACHED_PASSWORD_SCHEME "SHA1"
 
@@ -2146,6 +2148,7 @@ static int auth_request_proxy_host_lookup(struct auth_request *request,
 	i_zero(&dns_set);
 	dns_set.dns_client_socket_path = AUTH_DNS_SOCKET_PATH;
 	dns_set.timeout_msecs = AUTH_DNS_DEFAULT_TIMEOUT_MSECS;
+	dns_set.cache_ttl_secs = AUTH_DNS_CACHE_TTL_SECS;
 	dns_set.event_parent = request->event;
 	value = auth_fields_find(request->fields.extra_fields, "proxy_timeout");
 	if (value != NULL) {
@@ -233,6 +233,8 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
 	DEF(BOOL, cache_verify_password_with_worker),
+	DEF(BOOL, cache_verify_slow_password_with_worker),
+	DEF(BOOL, cache_persistent),
 	DEF(STR, username_chars),
 	DEF(STR, username_translation),
 	DEF(STR, username_format),
@@ -256,6 +258,8 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(BOOL, policy_report_after_auth),
 	DEF(BOOL, policy_log_only),
 	DEF(UINT, policy_hash_truncate),
+	DEF(TIME, policy_cache_ttl),
+	DEF(STR, policy_cache_key),
 
 	DEF(BOOL, stats),
 	DEF(BOOL, verbose),
@@ -292,6 +296,8 @@ static const struct auth_settings auth_default_settings = {
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
 	.cache_verify_password_with_worker = FALSE,
+	.cache_verify_slow_password_with_worker = FALSE,
+	.cache_persistent = FALSE,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%Lu",
@@ -315,6 +321,8 @@ static const struct auth_settings auth_default_settings = {
 	.policy_report_after_auth = TRUE,
 	.policy_log_only = FALSE,
 	.policy_hash_truncate = 12,
+	.policy_cache_ttl = 0,
+	.policy_cache_key = "%s %{rip} %{hashed_password}",
 
 	.stats = FALSE,
 	.verbose = FALSE,
@@ -45,6 +45,8 @@ struct auth_settings {
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
 	bool cache_verify_password_with_worker;
+	bool cache_verify_slow_password_with_worker;
+	bool cache_persistent;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -68,6 +70,8 @@ struct auth_settings {
 	bool policy_report_after_auth;
 	bool policy_log_only;
 	unsigned int policy_hash_truncate;
+	unsigned int policy_cache_ttl;
+	const char *policy_cache_key;
 
 	bool stats;
 	bool verbose, debug, debug_passwords;
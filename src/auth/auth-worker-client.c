@@ -319,16 +319,27 @@ auth_worker_handle_passw(struct auth_worker_command *cmd,
 	}
 	password = args[1];
 	crypted = args[2];
-	scheme = password_get_scheme(&crypted);
-	if (scheme == NULL) {
-		*error_r = "BUG: Auth worker server sent us invalid PASSW (scheme is NULL)";
-		return FALSE;
-	}
 
 	if (!auth_worker_auth_request_new(cmd, id, args + 3, &request)) {
 		*error_r = "BUG: PASSW had missing parameters";
 		return FALSE;
 	}
+
+	scheme = password_get_scheme(&crypted);
+	if (scheme == NULL) {
+		/* no {SCHEME} prefix - use the passdb's default scheme */
+		struct auth_passdb *passdb = request->passdb;
+
+		while (passdb != NULL && passdb->passdb->id != passdb_id)
+			passdb = passdb->next;
+		if (passdb != NULL)
+			scheme = passdb->passdb->default_pass_scheme;
+	}
+	if (scheme == NULL) {
+		*error_r = "BUG: Auth worker server sent us invalid PASSW (scheme is NULL)";
+		auth_request_unref(&request);
+		return FALSE;
+	}
 	request->mech_password =
 		p_strdup(request->pool, password);
 
@@ -124,6 +124,7 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(connections),
 
 	{ 0, NULL, 0 }
 };
@@ -160,7 +161,8 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.connections = 1
 };
 
 static struct ldap_connection *ldap_connections = NULL;
@@ -411,6 +413,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	if (ret > 0) {
 		/* success */
 		i_assert(request->msgid != -1);
+		request->send_timeval = ioloop_timeval;
 		conn->pending_count++;
 		return TRUE;
 	} else if (ret < 0) {
@@ -445,13 +448,60 @@ db_ldap_check_hanging(struct ldap_connection *conn, struct ldap_request *request
 	}
 }
 
+static unsigned int
+db_ldap_conn_request_cost(struct ldap_connection *conn,
+			  const struct ldap_request *request)
+{
+	/* the number of sent and queued requests */
+	unsigned int cost = aqueue_count(conn->request_queue) * 2;
+
+	if (request->type == LDAP_REQUEST_TYPE_BIND) {
+		/* binds have to wait for the pending requests to finish */
+		if (conn->pending_count > 0)
+			cost++;
+	} else if (conn->conn_state == LDAP_CONN_STATE_BOUND_AUTH) {
+		/* searches have to rebind to the default dn first */
+		cost++;
+	}
+	/* prefer the connections that are already open */
+	if (conn->conn_state == LDAP_CONN_STATE_DISCONNECTED)
+		cost++;
+	return cost;
+}
+
+static struct ldap_connection *
+db_ldap_pool_get_conn(struct ldap_connection *conn,
+		      const struct ldap_request *request)
+{
+	struct ldap_connection *const *connp, *best_conn;
+	unsigned int cost, best_cost;
+
+	if (conn->parent != NULL)
+		conn = conn->parent;
+	if (!array_is_created(&conn->pool_conns))
+		return conn;
+
+	best_conn = conn;
+	best_cost = db_ldap_conn_request_cost(conn, request);
+	array_foreach(&conn->pool_conns, connp) {
+		cost = db_ldap_conn_request_cost(*connp, request);
+		if (cost < best_cost) {
+			best_conn = *connp;
+			best_cost = cost;
+		}
+	}
+	return best_conn;
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
 	i_assert(request->auth_request != NULL);
 
+	conn = db_ldap_pool_get_conn(conn, request);
 	request->msgid = -1;
 	request->create_time = ioloop_time;
+	request->queue_timeval = ioloop_timeval;
 
 	db_ldap_check_hanging(conn, request);
 
@@ -740,6 +790,29 @@ static int db_ldap_search_next_subsearch(struct ldap_connection *conn,
 	return 0;
 }
 
+static void
+db_ldap_request_finished(struct ldap_request *request, bool success)
+{
+	int queue_msecs, reply_msecs;
+
+	queue_msecs = timeval_diff_msecs(&request->send_timeval,
+					 &request->queue_timeval);
+	reply_msecs = timeval_diff_msecs(&ioloop_timeval,
+					 &request->send_timeval);
+
+	struct event_passthrough *e =
+		event_create_passthrough(authdb_event(request->auth_request))->
+		set_name("ldap_request_finished")->
+		add_str("type", request->type == LDAP_REQUEST_TYPE_BIND ?
+			"bind" : "search")->
+		add_int("queue_msecs", queue_msecs)->
+		add_int("reply_msecs", reply_msecs);
+	if (!success)
+		e->add_str("error", "failed");
+	e_debug(e->event(), "ldap: Request finished in %d ms "
+		"(%d ms in queue)", queue_msecs + reply_msecs, queue_msecs);
+}
+
 static bool
 db_ldap_handle_request_result(struct ldap_connection *conn,
 			      struct ldap_request *request, unsigned int idx,
@@ -830,6 +903,7 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 	if (final_result) {
 		conn->pending_count--;
 		aqueue_delete(conn->request_queue, idx);
+		db_ldap_request_finished(request, res != NULL);
 	}
 
 	T_BEGIN {
@@ -1864,10 +1938,54 @@ static struct ldap_connection *ldap_conn_find(const char *config_path)
 	return NULL;
 }
 
+static void
+db_ldap_pool_conn_add(struct ldap_connection *parent, unsigned int idx)
+{
+	struct ldap_connection *conn;
+
+	conn = p_new(parent->pool, struct ldap_connection, 1);
+	conn->pool = parent->pool;
+	conn->refcount = 1;
+	conn->parent = parent;
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+	conn->config_path = parent->config_path;
+	conn->set = parent->set;
+
+	conn->event = event_create(auth_event);
+	event_set_append_log_prefix(conn->event, t_strdup_printf(
+		"ldap(%s #%u): ", conn->config_path, idx + 1));
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+
+	/* the LDAP handle is created on the first connect */
+	if (!array_is_created(&parent->pool_conns)) {
+		p_array_init(&parent->pool_conns, parent->pool,
+			     parent->set.connections - 1);
+	}
+	array_push_back(&parent->pool_conns, &conn);
+}
+
+static void db_ldap_conn_free(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	event_unref(&conn->event);
+}
+
 struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 {
 	struct ldap_connection *conn;
 	const char *str, *error;
+	unsigned int i;
 	pool_t pool;
 
 	/* see if it already exists */
@@ -1901,6 +2019,8 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 
 	if (conn->set.uris == NULL && conn->set.hosts == NULL)
 		i_fatal("LDAP %s: No uris or hosts set", config_path);
+	if (conn->set.connections == 0)
+		i_fatal("LDAP %s: connections must be at least 1", config_path);
 #ifndef LDAP_HAVE_INITIALIZE
 	if (conn->set.uris != NULL) {
 		i_fatal("LDAP %s: uris set, but Dovecot compiled without support for LDAP uris "
@@ -1956,13 +2076,15 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
         ldap_connections = conn;
 
 	db_ldap_init_ld(conn);
+	for (i = 1; i < conn->set.connections; i++)
+		db_ldap_pool_conn_add(conn, i);
 	return conn;
 }
 
 void db_ldap_unref(struct ldap_connection **_conn)
 {
         struct ldap_connection *conn = *_conn;
-	struct ldap_connection **p;
+	struct ldap_connection **p, *const *connp;
 
 	*_conn = NULL;
 	i_assert(conn->refcount >= 0);
@@ -1976,15 +2098,12 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
-
-	event_unref(&conn->event);
+	i_assert(conn->parent == NULL);
+	if (array_is_created(&conn->pool_conns)) {
+		array_foreach(&conn->pool_conns, connp)
+			db_ldap_conn_free(*connp);
+	}
+	db_ldap_conn_free(conn);
 	pool_unref(&conn->pool);
 }
 
@@ -67,6 +67,7 @@ struct ldap_settings {
 	const char *default_pass_scheme;
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
+	unsigned int connections;
 
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
@@ -103,6 +104,8 @@ struct ldap_request {
 	int msgid;
 	/* timestamp when request was created */
 	time_t create_time;
+	/* when the request was queued and sent, for the latency metrics */
+	struct timeval queue_timeval, send_timeval;
 
 	bool failed:1;
 	/* This is to prevent double logging the result */
@@ -152,6 +155,12 @@ enum ldap_connection_state {
 
 struct ldap_connection {
 	struct ldap_connection *next;
+	/* With connections>1 the connection returned by db_ldap_init() is
+	   the parent of the other connections to the same LDAP server.
+	   Requests given to any of them are sent via the connection that
+	   has the least outstanding requests. */
+	struct ldap_connection *parent;
+	ARRAY(struct ldap_connection *) pool_conns;
 
 	pool_t pool;
 	int refcount;
@@ -2,7 +2,10 @@
 
 #include "auth-common.h"
 #include "array.h"
+#include "hash.h"
+#include "ioloop.h"
 #include "str.h"
+#include "strnum.h"
 #include "var-expand.h"
 #include "env-util.h"
 #include "var-expand.h"
@@ -22,6 +25,8 @@
 
 #include <stddef.h>
 
+#define DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES 10000
+
 struct passdb_oauth2_settings {
 	/* tokeninfo endpoint, format https://endpoint/somewhere?token= */
 	const char *tokeninfo_url;
@@ -79,6 +84,9 @@ struct passdb_oauth2_settings {
 	unsigned int max_pipelined_requests;
 	bool tls_allow_invalid_cert;
 
+	/* How long token validation results are cached, 0 = disabled */
+	unsigned int token_cache_ttl_secs;
+
 	bool debug;
 	/* Should introspection be done even if not necessary */
 	bool force_introspection;
@@ -87,6 +95,14 @@ struct passdb_oauth2_settings {
 	bool use_grant_password;
 };
 
+struct db_oauth2_token_cache_entry {
+	pool_t pool;
+	const char *token;
+	time_t expire_time;
+	/* name, value pairs of the fields returned by validation */
+	ARRAY_TYPE(const_string) fields;
+};
+
 struct db_oauth2 {
 	struct db_oauth2 *prev,*next;
 
@@ -99,6 +115,10 @@ struct db_oauth2 {
 	struct oauth2_settings oauth2_set;
 
 	struct db_oauth2_request *head;
+	/* token -> request currently validating it */
+	HASH_TABLE(const char *, struct db_oauth2_request *) validating;
+	/* token -> struct db_oauth2_token_cache_entry */
+	HASH_TABLE(const char *, struct db_oauth2_token_cache_entry *) token_cache;
 
 	unsigned int refcount;
 };
@@ -134,6 +154,7 @@ static struct setting_def setting_defs[] = {
 	DEF_INT(max_idle_time_msecs),
 	DEF_INT(max_parallel_connections),
 	DEF_INT(max_pipelined_requests),
+	DEF_INT(token_cache_ttl_secs),
 	DEF_BOOL(send_auth_headers),
 	DEF_BOOL(use_grant_password),
 
@@ -173,6 +194,7 @@ static struct passdb_oauth2_settings default_oauth2_settings = {
 	.max_idle_time_msecs = 60000,
 	.max_parallel_connections = 10,
 	.max_pipelined_requests = 1,
+	.token_cache_ttl_secs = 0,
 	.tls_ca_cert_file = NULL,
 	.tls_ca_cert_dir = NULL,
 	.tls_cert_file = NULL,
@@ -321,11 +343,116 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 		}
 	}
 
+	hash_table_create(&db->validating, default_pool, 0, str_hash, strcmp);
+	if (db->set.token_cache_ttl_secs > 0) {
+		hash_table_create(&db->token_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+
 	DLLIST_PREPEND(&db_oauth2_head, db);
 
 	return db;
 }
 
+static void
+db_oauth2_token_cache_remove(struct db_oauth2 *db,
+			     struct db_oauth2_token_cache_entry *entry)
+{
+	hash_table_remove(db->token_cache, entry->token);
+	pool_unref(&entry->pool);
+}
+
+static void db_oauth2_token_cache_clear(struct db_oauth2 *db, bool only_expired)
+{
+	struct hash_iterate_context *iter;
+	struct db_oauth2_token_cache_entry *entry;
+	const char *token;
+
+	iter = hash_table_iterate_init(db->token_cache);
+	while (hash_table_iterate(iter, db->token_cache, &token, &entry)) {
+		if (!only_expired || entry->expire_time <= ioloop_time)
+			db_oauth2_token_cache_remove(db, entry);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static void db_oauth2_token_cache_add(struct db_oauth2_request *req)
+{
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_token_cache_entry *entry;
+	const ARRAY_TYPE(auth_field) *fields;
+	const struct auth_field *field;
+	const char *exp_str;
+	time_t expire_time, exp;
+	pool_t pool;
+
+	if (!hash_table_is_created(db->token_cache) || req->fields == NULL)
+		return;
+
+	/* never cache the result for longer than the token is valid */
+	expire_time = ioloop_time + db->set.token_cache_ttl_secs;
+	exp_str = auth_fields_find(req->fields, "exp");
+	if (exp_str != NULL && str_to_time(exp_str, &exp) == 0 &&
+	    exp < expire_time)
+		expire_time = exp;
+	if (expire_time <= ioloop_time)
+		return;
+
+	entry = hash_table_lookup(db->token_cache, req->token);
+	if (entry != NULL)
+		db_oauth2_token_cache_remove(db, entry);
+	else if (hash_table_count(db->token_cache) >=
+		 DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES) {
+		db_oauth2_token_cache_clear(db, TRUE);
+		if (hash_table_count(db->token_cache) >=
+		    DB_OAUTH2_TOKEN_CACHE_MAX_ENTRIES)
+			db_oauth2_token_cache_clear(db, FALSE);
+	}
+
+	pool = pool_alloconly_create("oauth2 token cache entry", 512);
+	entry = p_new(pool, struct db_oauth2_token_cache_entry, 1);
+	entry->pool = pool;
+	entry->token = p_strdup(pool, req->token);
+	entry->expire_time = expire_time;
+	p_array_init(&entry->fields, pool, 16);
+	fields = auth_fields_export(req->fields);
+	array_foreach(fields, field) {
+		const char *name = p_strdup(pool, field->key);
+		const char *value = p_strdup(pool, field->value);
+
+		array_push_back(&entry->fields, &name);
+		array_push_back(&entry->fields, &value);
+	}
+	hash_table_insert(db->token_cache, entry->token, entry);
+}
+
+static bool db_oauth2_token_cache_lookup(struct db_oauth2_request *req)
+{
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_token_cache_entry *entry;
+	const char *const *fields;
+	unsigned int i, count;
+
+	if (!hash_table_is_created(db->token_cache))
+		return FALSE;
+	entry = hash_table_lookup(db->token_cache, req->token);
+	if (entry == NULL)
+		return FALSE;
+	if (entry->expire_time <= ioloop_time) {
+		db_oauth2_token_cache_remove(db, entry);
+		return FALSE;
+	}
+
+	e_debug(authdb_event(req->auth_request),
+		"Using cached token validation result");
+	if (req->fields == NULL)
+		req->fields = auth_fields_init(req->pool);
+	fields = array_get(&entry->fields, &count);
+	for (i = 0; i < count; i += 2)
+		auth_fields_add(req->fields, fields[i], fields[i+1], 0);
+	return TRUE;
+}
+
 void db_oauth2_ref(struct db_oauth2 *db)
 {
 	i_assert(db->refcount > 0);
@@ -356,6 +483,11 @@ void db_oauth2_unref(struct db_oauth2 **_db)
 	if (db->oauth2_set.key_dict != NULL)
 		dict_deinit(&db->oauth2_set.key_dict);
 	oauth2_validation_key_cache_deinit(&db->oauth2_set.key_cache);
+	if (hash_table_is_created(db->token_cache)) {
+		db_oauth2_token_cache_clear(db, FALSE);
+		hash_table_destroy(&db->token_cache);
+	}
+	hash_table_destroy(&db->validating);
 	pool_unref(&db->pool);
 }
 
@@ -530,6 +662,57 @@ db_oauth2_field_find(const ARRAY_TYPE(oauth2_field) *fields, const char *name)
 	return NULL;
 }
 
+static void db_oauth2_process_fields(struct db_oauth2_request *req,
+				     enum passdb_result *result_r,
+				     const char **error_r);
+
+static void db_oauth2_callback(struct db_oauth2_request *req,
+			       enum passdb_result result,
+			       const char *error_prefix, const char *error);
+
+static void db_oauth2_token_validated(struct db_oauth2_request *req)
+{
+	if (!req->validating)
+		return;
+	req->validated = TRUE;
+	db_oauth2_token_cache_add(req);
+}
+
+static void
+db_oauth2_waiters_finish(struct db_oauth2_request *req,
+			 enum passdb_result result,
+			 const char *error_prefix, const char *error)
+{
+	struct db_oauth2_request *waiter, *next;
+	const ARRAY_TYPE(auth_field) *fields = NULL;
+	const struct auth_field *field;
+	enum passdb_result waiter_result;
+	const char *waiter_error;
+
+	if (req->validated)
+		fields = auth_fields_export(req->fields);
+	waiter = req->waiters;
+	req->waiters = NULL;
+	for (; waiter != NULL; waiter = next) {
+		next = waiter->next_waiter;
+		if (!req->validated) {
+			/* the token itself couldn't be validated */
+			db_oauth2_callback(waiter, result, error_prefix, error);
+			continue;
+		}
+		/* the token is valid, but e.g. the username may differ */
+		if (waiter->fields == NULL)
+			waiter->fields = auth_fields_init(waiter->pool);
+		array_foreach(fields, field) {
+			auth_fields_add(waiter->fields, field->key,
+					field->value, 0);
+		}
+		db_oauth2_process_fields(waiter, &waiter_result, &waiter_error);
+		db_oauth2_callback(waiter, waiter_result, error_prefix,
+				   waiter_error);
+	}
+}
+
 static void db_oauth2_callback(struct db_oauth2_request *req,
 			       enum passdb_result result,
 			       const char *error_prefix, const char *error)
@@ -539,6 +722,14 @@ static void db_oauth2_callback(struct db_oauth2_request *req,
 
 	i_assert(result == PASSDB_RESULT_OK || error != NULL);
 
+	if (req->validating) {
+		/* finish the requests waiting for the same token before the
+		   callback frees this request */
+		hash_table_remove(req->db->validating, req->token);
+		req->validating = FALSE;
+		db_oauth2_waiters_finish(req, result, error_prefix, error);
+	}
+
 	if (result != PASSDB_RESULT_OK)
 		db_oauth2_add_openid_config_url(req);
 
@@ -675,6 +866,7 @@ db_oauth2_introspect_continue(struct oauth2_request_result *result,
 		e_debug(authdb_event(req->auth_request),
 			"Introspection succeeded");
 		db_oauth2_fields_merge(req, result->fields);
+		db_oauth2_token_validated(req);
 		db_oauth2_process_fields(req, &passdb_result, &error);
 	}
 	db_oauth2_callback(req, passdb_result, "Introspection failed: ", error);
@@ -716,6 +908,7 @@ static void db_oauth2_local_validation(struct db_oauth2_request *req,
 		passdb_result = PASSDB_RESULT_PASSWORD_MISMATCH;
 	} else {
 		db_oauth2_fields_merge(req, &fields);
+		db_oauth2_token_validated(req);
 		db_oauth2_process_fields(req, &passdb_result, &error);
 	}
 	if (passdb_result == PASSDB_RESULT_OK) {
@@ -745,6 +938,7 @@ db_oauth2_lookup_continue_valid(struct db_oauth2_request *req,
 		db_oauth2_local_validation(req, req->token);
 		return;
 	} else if (!db_oauth2_user_is_enabled(req, &passdb_result, &error)) {
+		db_oauth2_token_validated(req);
 		db_oauth2_callback(req, passdb_result,
 				   "Token is not valid: ", error);
 		return;
@@ -752,6 +946,7 @@ db_oauth2_lookup_continue_valid(struct db_oauth2_request *req,
 		db_oauth2_lookup_introspect(req);
 		return;
 	}
+	db_oauth2_token_validated(req);
 	db_oauth2_process_fields(req, &passdb_result, &error);
 	db_oauth2_callback(req, passdb_result, error_prefix, error);
 }
@@ -825,6 +1020,9 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 		      db_oauth2_lookup_callback_t *callback, void *context)
 {
 	struct oauth2_request_input input;
+	struct db_oauth2_request *validating_req;
+	enum passdb_result passdb_result;
+	const char *error;
 	i_zero(&input);
 
 	req->db = db;
@@ -849,10 +1047,31 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 		/* try to validate token locally */
 		e_debug(authdb_event(req->auth_request),
 			"Attempting to locally validate token");
+		DLLIST_PREPEND(&db->head, req);
 		db_oauth2_local_validation(req, request->mech_password);
 		return;
 
 	}
+	if (!db->oauth2_set.use_grant_password) {
+		if (db_oauth2_token_cache_lookup(req)) {
+			DLLIST_PREPEND(&db->head, req);
+			db_oauth2_process_fields(req, &passdb_result, &error);
+			db_oauth2_callback(req, passdb_result,
+					   "Token validation failed: ", error);
+			return;
+		}
+		/* Clients often reconnect with the same token in parallel.
+		   Validate it only once and let the others wait for it. */
+		validating_req = hash_table_lookup(db->validating, req->token);
+		if (validating_req != NULL) {
+			e_debug(authdb_event(req->auth_request),
+				"Waiting for validation of the same token");
+			req->next_waiter = validating_req->waiters;
+			validating_req->waiters = req;
+			DLLIST_PREPEND(&db->head, req);
+			return;
+		}
+	}
 	if (db->oauth2_set.use_grant_password) {
 		e_debug(authdb_event(req->auth_request),
 			"Making grant url request to %s",
@@ -876,6 +1095,10 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 							 db_oauth2_lookup_continue, req);
 	}
 	i_assert(req->req != NULL);
+	if (req->token != NULL) {
+		req->validating = TRUE;
+		hash_table_insert(db->validating, req->token, req);
+	}
 	DLLIST_PREPEND(&db->head, req);
 }
 
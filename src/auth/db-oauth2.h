@@ -27,6 +27,14 @@ struct db_oauth2_request {
 	db_oauth2_lookup_callback_t *callback;
 	void *context;
 	verify_plain_callback_t *verify_callback;
+
+	/* Requests waiting for this request to validate the same token */
+	struct db_oauth2_request *waiters, *next_waiter;
+
+	/* This request is validating the token for the waiters */
+	bool validating:1;
+	/* The token was found valid and the fields are filled */
+	bool validated:1;
 };
 
 
@@ -4,6 +4,8 @@
 
 #if defined(PASSDB_SQL) || defined(USERDB_SQL)
 
+#include "array.h"
+#include "str.h"
 #include "settings.h"
 #include "auth-request.h"
 #include "auth-worker-client.h"
@@ -39,6 +41,16 @@ static struct db_sql_settings default_db_sql_settings = {
 	.userdb_warning_disable = FALSE
 };
 
+struct db_sql_query {
+	struct db_sql_connection *conn;
+	const char *query_template;
+
+	/* NULL if the query can't be run as a prepared statement */
+	struct sql_prepared_statement *prep_stmt;
+	/* templates for the prepared statement's parameters */
+	ARRAY_TYPE(const_string) args;
+};
+
 static struct db_sql_connection *connections = NULL;
 
 static struct db_sql_connection *sql_conn_find(const char *config_path)
@@ -114,6 +126,10 @@ struct db_sql_connection *db_sql_init(const char *config_path, bool userdb)
 	if (sql_init_full(&set, &conn->db, &error) < 0) {
 		i_fatal("sql: %s", error);
 	}
+	p_array_init(&conn->queries, pool, 4);
+	conn->password_query = db_sql_query_get(conn, conn->set.password_query);
+	conn->user_query = db_sql_query_get(conn, conn->set.user_query);
+	conn->iterate_query = db_sql_query_get(conn, conn->set.iterate_query);
 
 	conn->next = connections;
 	connections = conn;
@@ -123,6 +139,7 @@ struct db_sql_connection *db_sql_init(const char *config_path, bool userdb)
 void db_sql_unref(struct db_sql_connection **_conn)
 {
         struct db_sql_connection *conn = *_conn;
+	struct db_sql_query *const *queryp;
 
 	/* abort all pending auth requests before setting conn to NULL,
 	   so that callbacks can still access it */
@@ -132,6 +149,10 @@ void db_sql_unref(struct db_sql_connection **_conn)
 	if (--conn->refcount > 0)
 		return;
 
+	array_foreach(&conn->queries, queryp) {
+		if ((*queryp)->prep_stmt != NULL)
+			sql_prepared_statement_unref(&(*queryp)->prep_stmt);
+	}
 	sql_unref(&conn->db);
 	pool_unref(&conn->pool);
 }
@@ -175,4 +196,122 @@ void db_sql_check_userdb_warning(struct db_sql_connection *conn)
 	}
 }
 
+static bool
+db_sql_query_parse(pool_t pool, const char *query, string_t *template,
+		   ARRAY_TYPE(const_string) *args)
+{
+	const char *p, *end, *value;
+
+	for (p = query; *p != '\0'; p++) {
+		switch (*p) {
+		case '?':
+			/* would be confused with the placeholders */
+			return FALSE;
+		case '%':
+			/* %variable outside quoted string */
+			return FALSE;
+		case '\'':
+		case '"':
+			end = strchr(p + 1, *p);
+			if (end == NULL)
+				return FALSE;
+			value = t_strdup_until(p + 1, end);
+			if (strchr(value, '%') == NULL) {
+				if (strchr(value, '?') != NULL)
+					return FALSE;
+				str_append_data(template, p, end - p + 1);
+				p = end;
+				break;
+			}
+			/* only simple '...' strings can be parameters -
+			   leave the escaping and identifiers to the
+			   expand-everything path */
+			if (*p != '\'' || end[1] == '\'' ||
+			    (p > query && p[-1] == '\'') ||
+			    strchr(value, '\\') != NULL)
+				return FALSE;
+			value = p_strdup(pool, value);
+			array_push_back(args, &value);
+			str_append_c(template, '?');
+			p = end;
+			break;
+		default:
+			str_append_c(template, *p);
+			break;
+		}
+	}
+	return TRUE;
+}
+
+struct db_sql_query *
+db_sql_query_get(struct db_sql_connection *conn, const char *query_template)
+{
+	struct db_sql_query *const *queryp, *query;
+	string_t *template;
+
+	array_foreach(&conn->queries, queryp) {
+		if (strcmp((*queryp)->query_template, query_template) == 0)
+			return *queryp;
+	}
+
+	query = p_new(conn->pool, struct db_sql_query, 1);
+	query->conn = conn;
+	query->query_template = p_strdup(conn->pool, query_template);
+	p_array_init(&query->args, conn->pool, 4);
+	T_BEGIN {
+		template = t_str_new(256);
+		if (db_sql_query_parse(conn->pool, query_template,
+				       template, &query->args)) {
+			query->prep_stmt =
+				sql_prepared_statement_init(conn->db,
+							    str_c(template));
+		} else {
+			array_clear(&query->args);
+		}
+	} T_END;
+	array_push_back(&conn->queries, &query);
+	return query;
+}
+
+/* The callback was already type-checked by the db_sql_query_run() macro. */
+#undef db_sql_query_run
+#undef sql_query
+#undef sql_statement_query
+int db_sql_query_run(struct db_sql_query *query,
+		     struct auth_request *auth_request,
+		     auth_request_escape_func_t *escape_func,
+		     sql_query_callback_t *callback, void *context,
+		     const char **error_r)
+{
+	struct sql_statement *stmt;
+	const char *const *args, *value;
+	unsigned int i, count;
+
+	if (query->prep_stmt == NULL) {
+		if (t_auth_request_var_expand(query->query_template,
+					      auth_request, escape_func,
+					      &value, error_r) <= 0)
+			return -1;
+		e_debug(authdb_event(auth_request), "query: %s", value);
+		sql_query(query->conn->db, value, callback, context);
+		return 0;
+	}
+
+	stmt = sql_statement_init_prepared(query->prep_stmt);
+	args = array_get(&query->args, &count);
+	for (i = 0; i < count; i++) {
+		/* the value is escaped by the SQL driver */
+		if (t_auth_request_var_expand(args[i], auth_request, NULL,
+					      &value, error_r) <= 0) {
+			sql_statement_abort(&stmt);
+			return -1;
+		}
+		sql_statement_bind_str(stmt, i, value);
+	}
+	e_debug(authdb_event(auth_request), "query: %s",
+		sql_statement_get_query(stmt));
+	sql_statement_query(&stmt, callback, context);
+	return 0;
+}
+
 #endif
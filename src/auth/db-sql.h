@@ -2,6 +2,7 @@
 #define DB_SQL_H
 
 #include "sql-api.h"
+#include "auth-request-var-expand.h"
 
 struct db_sql_settings {
 	const char *driver;
@@ -23,6 +24,8 @@ struct db_sql_connection {
 	char *config_path;
 	struct db_sql_settings set;
 	struct sql_db *db;
+	struct db_sql_query *password_query, *user_query, *iterate_query;
+	ARRAY(struct db_sql_query *) queries;
 
 	bool default_password_query:1;
 	bool default_user_query:1;
@@ -39,4 +42,24 @@ void db_sql_success(struct db_sql_connection *conn);
 
 void db_sql_check_userdb_warning(struct db_sql_connection *conn);
 
+/* Returns a query for the given query template. If all the %variables in
+   the template are inside quoted strings, the query is run as a prepared
+   statement with the strings as bound parameters. Otherwise the whole query
+   is expanded and escaped for each request. */
+struct db_sql_query *
+db_sql_query_get(struct db_sql_connection *conn, const char *query_template);
+/* Expand the query for the auth_request and run it. Returns 0 if the query
+   was sent, -1 if the expansion failed. */
+int db_sql_query_run(struct db_sql_query *query,
+		     struct auth_request *auth_request,
+		     auth_request_escape_func_t *escape_func,
+		     sql_query_callback_t *callback, void *context,
+		     const char **error_r);
+#define db_sql_query_run(query, auth_request, escape_func, \
+			 callback, context, error_r) \
+	db_sql_query_run(query, auth_request, escape_func, \
+		(sql_query_callback_t *)callback, TRUE ? context : \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct sql_result *, typeof(context))), error_r)
+
 #endif
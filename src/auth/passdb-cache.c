@@ -2,6 +2,9 @@
 
 #include "auth-common.h"
 #include "str.h"
+#include "base64.h"
+#include "hex-binary.h"
+#include "sha2.h"
 #include "strescape.h"
 #include "restrict-process-size.h"
 #include "auth-request-stats.h"
@@ -11,6 +14,19 @@
 #include "passdb-cache.h"
 #include "passdb-blocking.h"
 
+#define AUTH_CACHE_FNAME "auth-cache.dat"
+
+/* Credentials generated from plaintext passwords are cached with a key that
+   can't conflict with the passdb cache keys, since \001 is always escaped
+   in the expanded %variables. */
+#define PASSDB_CACHE_GENERATED_KEY_PREFIX "%u\t\001"
+
+/* Schemes that are expensive enough to generate that it's worth caching
+   the generated credentials. */
+static const char *const passdb_cache_generated_schemes[] = {
+	"SCRAM-SHA-1", "SCRAM-SHA-256", "CRAM-MD5", NULL
+};
+
 struct auth_cache *passdb_cache = NULL;
 
 static void
@@ -66,6 +82,25 @@ static bool passdb_cache_verify_plain_callback(const char *reply, void *context)
 	return TRUE;
 }
 
+static bool
+passdb_cache_verify_with_worker(struct auth_request *request,
+				const char *cached_pw)
+{
+	const char *scheme;
+
+	if (request->set->cache_verify_password_with_worker)
+		return TRUE;
+	if (!request->set->cache_verify_slow_password_with_worker)
+		return FALSE;
+
+	/* verifying a slow scheme could take long enough to delay all the
+	   other requests in this process */
+	scheme = password_get_scheme(&cached_pw);
+	if (scheme == NULL)
+		scheme = request->passdb->passdb->default_pass_scheme;
+	return scheme != NULL && password_scheme_is_slow(scheme);
+}
+
 bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			       const char *password,
 			       enum passdb_result *result_r, bool use_expired)
@@ -98,13 +133,18 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 		e_info(authdb_event(request),
 		       "Cached NULL password access");
 		ret = 1;
-	} else if (request->set->cache_verify_password_with_worker) {
+	} else if (passdb_cache_verify_with_worker(request, cached_pw)) {
 		string_t *str;
 
 		str = t_str_new(128);
 		str_printfa(str, "PASSW\t%u\t", request->passdb->passdb->id);
 		str_append_tabescaped(str, password);
 		str_append_c(str, '\t');
+		if (*cached_pw != '{') {
+			/* the worker requires a scheme prefix */
+			str_printfa(str, "{%s}",
+				request->passdb->passdb->default_pass_scheme);
+		}
 		str_append_tabescaped(str, cached_pw);
 		str_append_c(str, '\t');
 		auth_request_export(request, str);
@@ -184,6 +224,83 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 	return TRUE;
 }
 
+static const char *
+passdb_cache_generated_key(struct auth_request *request, const char *scheme)
+{
+	if (passdb_cache == NULL || request->passdb == NULL ||
+	    request->passdb->cache_key == NULL)
+		return NULL;
+	if (!str_array_icase_find(passdb_cache_generated_schemes, scheme))
+		return NULL;
+	return t_strconcat(PASSDB_CACHE_GENERATED_KEY_PREFIX,
+			   t_str_ucase(scheme), NULL);
+}
+
+static const char *passdb_cache_plaintext_hash(const char *plaintext)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+
+	sha256_get_digest(plaintext, strlen(plaintext), digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+bool passdb_cache_lookup_generated(struct auth_request *request,
+				   const char *plaintext, const char *scheme,
+				   const unsigned char **credentials_r,
+				   size_t *size_r)
+{
+	const char *key, *value, *hash;
+	bool expired, neg_expired;
+	buffer_t *buf;
+	size_t hash_len;
+
+	key = passdb_cache_generated_key(request, scheme);
+	if (key == NULL)
+		return FALSE;
+
+	/* value = sha256(plaintext) \t base64(credentials) */
+	value = auth_cache_lookup(passdb_cache, request, key, NULL,
+				  &expired, &neg_expired);
+	if (value == NULL || expired)
+		return FALSE;
+
+	hash = passdb_cache_plaintext_hash(plaintext);
+	hash_len = strlen(hash);
+	if (strncmp(value, hash, hash_len) != 0 || value[hash_len] != '\t') {
+		/* password has changed */
+		return FALSE;
+	}
+	value += hash_len + 1;
+	buf = t_buffer_create(MAX_BASE64_DECODED_SIZE(strlen(value)));
+	if (base64_decode(value, strlen(value), NULL, buf) < 0)
+		return FALSE;
+
+	e_debug(authdb_event(request),
+		"cache hit: generated %s credentials", scheme);
+	*credentials_r = buf->data;
+	*size_r = buf->used;
+	return TRUE;
+}
+
+void passdb_cache_insert_generated(struct auth_request *request,
+				   const char *plaintext, const char *scheme,
+				   const unsigned char *credentials,
+				   size_t size)
+{
+	const char *key;
+	string_t *str;
+
+	key = passdb_cache_generated_key(request, scheme);
+	if (key == NULL)
+		return;
+
+	str = t_str_new(SHA256_RESULTLEN*2 + 1 + MAX_BASE64_ENCODED_SIZE(size));
+	str_append(str, passdb_cache_plaintext_hash(plaintext));
+	str_append_c(str, '\t');
+	base64_encode(credentials, size, str);
+	auth_cache_insert(passdb_cache, request, key, str_c(str), TRUE);
+}
+
 void passdb_cache_init(const struct auth_settings *set)
 {
 	rlim_t limit;
@@ -200,6 +317,20 @@ void passdb_cache_init(const struct auth_settings *set)
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
 				      set->cache_negative_ttl);
+	if (set->cache_persistent) {
+		unsigned char passdb_md5[MD5_RESULTLEN];
+		unsigned char userdb_md5[MD5_RESULTLEN];
+		string_t *db_hash = t_str_new(MD5_RESULTLEN*4 + 1);
+
+		passdbs_generate_md5(passdb_md5);
+		userdbs_generate_md5(userdb_md5);
+		binary_to_hex_append(db_hash, passdb_md5, sizeof(passdb_md5));
+		str_append_c(db_hash, '.');
+		binary_to_hex_append(db_hash, userdb_md5, sizeof(userdb_md5));
+		auth_cache_set_persistent(passdb_cache,
+			t_strconcat(set->base_dir, "/"AUTH_CACHE_FNAME, NULL),
+			str_c(db_hash));
+	}
 }
 
 void passdb_cache_deinit(void)
@@ -14,6 +14,18 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 				     const char **scheme_r,
 				     enum passdb_result *result_r,
 				     bool use_expired);
+/* Look up credentials that were earlier generated in the wanted scheme from
+   the same plaintext password. Returns TRUE if found. */
+bool passdb_cache_lookup_generated(struct auth_request *request,
+				   const char *plaintext, const char *scheme,
+				   const unsigned char **credentials_r,
+				   size_t *size_r);
+/* Cache credentials generated from the plaintext password, if the scheme is
+   expensive enough to generate. */
+void passdb_cache_insert_generated(struct auth_request *request,
+				   const char *plaintext, const char *scheme,
+				   const unsigned char *credentials,
+				   size_t size);
 
 void passdb_cache_init(const struct auth_settings *set);
 void passdb_cache_deinit(void);
@@ -153,25 +153,21 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 	struct passdb_module *_module =
 		sql_request->auth_request->passdb->passdb;
 	struct sql_passdb_module *module = (struct sql_passdb_module *)_module;
-	const char *query, *error;
-
-	if (t_auth_request_var_expand(module->conn->set.password_query,
-				      sql_request->auth_request,
-				      passdb_sql_escape, &query, &error) <= 0) {
-		e_debug(authdb_event(sql_request->auth_request),
+	struct auth_request *auth_request = sql_request->auth_request;
+	const char *error;
+
+	/* the callback may be called immediately */
+	auth_request_ref(auth_request);
+	if (db_sql_query_run(module->conn->password_query, auth_request,
+			     passdb_sql_escape, sql_query_callback,
+			     sql_request, &error) < 0) {
+		e_debug(authdb_event(auth_request),
 			"Failed to expand password_query=%s: %s",
 			module->conn->set.password_query, error);
 		sql_request->callback.verify_plain(PASSDB_RESULT_INTERNAL_FAILURE,
-						   sql_request->auth_request);
-		return;
+						   auth_request);
+		auth_request_unref(&auth_request);
 	}
-
-	e_debug(authdb_event(sql_request->auth_request),
-		"query: %s", query);
-
-	auth_request_ref(sql_request->auth_request);
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
 }
 
 static void sql_verify_plain(struct auth_request *request,
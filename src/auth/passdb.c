@@ -5,6 +5,7 @@
 #include "password-scheme.h"
 #include "auth-worker-server.h"
 #include "passdb.h"
+#include "passdb-cache.h"
 
 static ARRAY(struct passdb_module_interface *) passdb_interfaces;
 static ARRAY(struct passdb_module *) passdb_modules;
@@ -121,12 +122,19 @@ bool passdb_get_credentials(struct auth_request *auth_request,
 				"Generating %s from user '%s', password '%s'",
 				wanted_scheme, pwd_gen_params.user, plaintext);
 		}
+		if (passdb_cache_lookup_generated(auth_request, plaintext,
+						  wanted_scheme,
+						  credentials_r, size_r))
+			return TRUE;
 		if (!password_generate(plaintext, &pwd_gen_params,
 				       wanted_scheme, credentials_r, size_r)) {
 			e_error(authdb_event(auth_request),
 				"Requested unknown scheme %s", wanted_scheme);
 			return FALSE;
 		}
+		passdb_cache_insert_generated(auth_request, plaintext,
+					      wanted_scheme,
+					      *credentials_r, *size_r);
 	}
 
 	return TRUE;
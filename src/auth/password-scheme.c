@@ -253,6 +253,21 @@ const char *password_generate_salt(size_t len)
 	return salt;
 }
 
+bool password_scheme_is_slow(const char *scheme)
+{
+	/* schemes that use a large number of rounds or memory by design */
+	static const char *const slow_schemes[] = {
+		"ARGON2I", "ARGON2ID", "BLF-CRYPT", "CRYPT", "PBKDF2",
+		"SCRAM-SHA-1", "SCRAM-SHA-256", "SHA256-CRYPT", "SHA512-CRYPT",
+		NULL
+	};
+	const char *p = strchr(scheme, '.');
+
+	if (p != NULL)
+		scheme = t_strdup_until(scheme, p);
+	return str_array_icase_find(slow_schemes, scheme);
+}
+
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2)
 {
 	const struct password_scheme *s1 = NULL, *s2 = NULL;
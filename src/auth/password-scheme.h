@@ -70,6 +70,10 @@ bool password_generate_encoded(const char *plaintext,
 			       const struct password_generate_params *params,
 			       const char *scheme, const char **password_r);
 
+/* Returns TRUE if the scheme is intentionally slow to verify, e.g. it uses
+   a large number of rounds. */
+bool password_scheme_is_slow(const char *scheme);
+
 /* Returns TRUE if schemes are equivalent. */
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2);
 
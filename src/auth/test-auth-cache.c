@@ -1,11 +1,16 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
+#define AUTH_REQUEST_FIELDS_CONST
+
 #include "lib.h"
+#include "ioloop.h"
 #include "str.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 #include "test-common.h"
 
+struct event *auth_event;
+
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 	/* these 3 must be in this order */
@@ -21,20 +26,28 @@ auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 
 struct var_expand_table *
 auth_request_get_var_expand_table_full(const struct auth_request *auth_request ATTR_UNUSED,
-				       const char *username ATTR_UNUSED,
+				       const char *username,
 				       auth_request_escape_func_t *escape_func ATTR_UNUSED,
 				       unsigned int *count ATTR_UNUSED)
 {
-	i_unreached();
+	struct var_expand_table *tab = t_new(struct var_expand_table, 3);
+
+	tab[0].key = 'u';
+	tab[0].value = username;
+	tab[0].long_key = "user";
+	tab[1].key = '!';
+	tab[1].value = "1";
+	return tab;
 }
 
 int auth_request_var_expand_with_table(string_t *dest, const char *str,
 				       const struct auth_request *auth_request ATTR_UNUSED,
-				       const struct var_expand_table *table ATTR_UNUSED,
+				       const struct var_expand_table *table,
 				       auth_request_escape_func_t *escape_func ATTR_UNUSED,
 				       const char **error_r ATTR_UNUSED)
 {
-	return var_expand(dest, str, auth_request_var_expand_static_tab, error_r);
+	return var_expand(dest, str, table == NULL ?
+			  auth_request_var_expand_static_tab : table, error_r);
 }
 
 static void test_auth_cache_parse_key(void)
@@ -72,10 +85,96 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static const char *
+test_auth_cache_lookup(struct auth_cache *cache, const char *user,
+		       bool *last_success_r)
+{
+	struct auth_request request;
+	struct auth_cache_node *node;
+	const char *value;
+	bool expired, neg_expired;
+
+	i_zero(&request);
+	request.fields.user = t_strdup_noconst(user);
+	value = auth_cache_lookup(cache, &request, "%u", &node,
+				  &expired, &neg_expired);
+	if (value != NULL) {
+		test_assert(!expired);
+		*last_success_r = node->last_success;
+	}
+	return value;
+}
+
+static void test_auth_cache_persistent(void)
+{
+	const char *path = ".test-auth-cache.dat";
+	struct ioloop *ioloop;
+	struct auth_cache *cache;
+	struct auth_request request;
+	const char *value;
+	bool last_success;
+
+	test_begin("auth cache persistent");
+	ioloop = io_loop_create();
+	auth_event = event_create(NULL);
+	i_unlink_if_exists(path);
+
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	auth_cache_set_persistent(cache, path, "hash1");
+	i_zero(&request);
+	request.fields.user = "user1";
+	auth_cache_insert(cache, &request, "%u", "pass1\tfoo=b\001ar", TRUE);
+	request.fields.user = "user\t2";
+	auth_cache_insert(cache, &request, "%u", "", FALSE);
+	request.fields.user = "user3";
+	auth_cache_insert(cache, &request, "%u", "pass3", FALSE);
+	auth_cache_free(&cache);
+
+	/* the entries are preserved */
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	auth_cache_set_persistent(cache, path, "hash1");
+	value = test_auth_cache_lookup(cache, "user1", &last_success);
+	test_assert(null_strcmp(value, "pass1\tfoo=b\001ar") == 0);
+	test_assert(last_success);
+	value = test_auth_cache_lookup(cache, "user\t2", &last_success);
+	test_assert(null_strcmp(value, "") == 0);
+	test_assert(!last_success);
+	value = test_auth_cache_lookup(cache, "user3", &last_success);
+	test_assert(null_strcmp(value, "pass3") == 0);
+	test_assert(!last_success);
+	test_assert(test_auth_cache_lookup(cache, "user4",
+					   &last_success) == NULL);
+	/* make user1 the most recently used */
+	(void)test_auth_cache_lookup(cache, "user1", &last_success);
+	auth_cache_free(&cache);
+
+	/* the size limit drops the least recently used entries */
+	cache = auth_cache_new(sizeof(struct auth_cache_node) + 64, 3600, 3600);
+	auth_cache_set_persistent(cache, path, "hash1");
+	test_assert(test_auth_cache_lookup(cache, "user3",
+					   &last_success) == NULL);
+	value = test_auth_cache_lookup(cache, "user1", &last_success);
+	test_assert(null_strcmp(value, "pass1\tfoo=b\001ar") == 0);
+	auth_cache_free(&cache);
+
+	/* changed passdb/userdb configuration drops the entries */
+	cache = auth_cache_new(1024*1024, 3600, 3600);
+	auth_cache_set_persistent(cache, path, "hash2");
+	test_assert(test_auth_cache_lookup(cache, "user1",
+					   &last_success) == NULL);
+	auth_cache_free(&cache);
+
+	i_unlink(path);
+	event_unref(&auth_event);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_persistent,
 		NULL
 	};
 	return test_run(test_functions);
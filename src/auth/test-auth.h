@@ -15,6 +15,7 @@ extern struct auth_passdb_settings mock_passdb_set;
 void test_auth_request_var_expand(void);
 void test_auth_request_fields(void);
 void test_db_dict_parse_cache_key(void);
+void test_db_sql_query(void);
 void test_username_filter(void);
 void test_db_lua(void);
 struct auth_passdb *passdb_mock(void);
@@ -0,0 +1,133 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+
+#if defined(PASSDB_SQL) || defined(USERDB_SQL)
+#include "auth-common.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "db-sql.h"
+#include "driver-test.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define TEST_DB_SQL_CONFIG_PATH ".test-db-sql.conf"
+
+static struct auth_settings test_db_sql_auth_set = {
+	.master_user_separator = "",
+	.default_realm = "",
+	.username_format = "",
+};
+
+static struct db_sql_connection *test_conn;
+static unsigned int test_query_count;
+
+static const char *
+test_db_sql_escape(const char *str,
+		   const struct auth_request *auth_request ATTR_UNUSED)
+{
+	return sql_escape_string(test_conn->db, str);
+}
+
+static void test_db_sql_query_callback(struct sql_result *result,
+				       void *context ATTR_UNUSED)
+{
+	/* driver-test already verified the query */
+	test_query_count++;
+	sql_result_unref(result);
+}
+
+static void
+test_db_sql_query_expect(struct auth_request *req, const char *query_template,
+			 const char *expected_query)
+{
+	const char *queries[] = { expected_query };
+	struct test_driver_result result = {
+		.nqueries = 1,
+		.queries = queries,
+	};
+	struct db_sql_query *query;
+	const char *error;
+
+	sql_driver_test_add_expected_result(test_conn->db, &result);
+	query = db_sql_query_get(test_conn, query_template);
+	test_assert(db_sql_query_get(test_conn, query_template) == query);
+	test_query_count = 0;
+	test_assert(db_sql_query_run(query, req, test_db_sql_escape,
+				     test_db_sql_query_callback, NULL,
+				     &error) == 0);
+	test_assert(test_query_count == 1);
+	sql_driver_test_clear_expected_results(test_conn->db);
+}
+
+void test_db_sql_query(void)
+{
+	static const struct {
+		const char *template, *user, *query;
+	} tests[] = {
+		/* prepared statements */
+		{ "SELECT password FROM users WHERE userid = '%u'",
+		  "user@example.com",
+		  "SELECT password FROM users WHERE userid = 'user@example.com'" },
+		{ "SELECT password FROM users WHERE username = '%n' AND domain = '%d'",
+		  "us'er@example.com",
+		  "SELECT password FROM users WHERE username = 'us\\'er' AND domain = 'example.com'" },
+		{ "SELECT password FROM users WHERE userid = '%n@%d' AND active = 'Y'",
+		  "a?b@example.com",
+		  "SELECT password FROM users WHERE userid = 'a?b@example.com' AND active = 'Y'" },
+		{ "SELECT username, domain FROM users",
+		  "user",
+		  "SELECT username, domain FROM users" },
+		/* not preparable - expanded as a whole */
+		{ "SELECT password FROM users WHERE uid = %n",
+		  "us'er",
+		  "SELECT password FROM users WHERE uid = us\\'er" },
+		{ "SELECT password FROM users WHERE userid = '%u' AND note = '?'",
+		  "a?b",
+		  "SELECT password FROM users WHERE userid = 'a?b' AND note = '?'" },
+		{ "SELECT password FROM users WHERE userid = 'x''%u'",
+		  "user",
+		  "SELECT password FROM users WHERE userid = 'x''user'" },
+		{ "SELECT password FROM \"%d\".users WHERE userid = '%n'",
+		  "user@example",
+		  "SELECT password FROM \"example\".users WHERE userid = 'user'" },
+	};
+	struct auth_request *req;
+	const char *error;
+	unsigned int i;
+	FILE *f;
+
+	test_begin("db sql query");
+	memset(test_db_sql_auth_set.username_chars_map, 0xff,
+	       sizeof(test_db_sql_auth_set.username_chars_map));
+	global_auth_settings = &test_db_sql_auth_set;
+
+	f = fopen(TEST_DB_SQL_CONFIG_PATH, "w");
+	if (f == NULL)
+		i_fatal("fopen(%s) failed: %m", TEST_DB_SQL_CONFIG_PATH);
+	fprintf(f, "driver = mysql\nconnect = test\n");
+	if (fclose(f) < 0)
+		i_fatal("fclose(%s) failed: %m", TEST_DB_SQL_CONFIG_PATH);
+
+	sql_drivers_init();
+	sql_driver_test_register();
+	test_conn = db_sql_init(TEST_DB_SQL_CONFIG_PATH, TRUE);
+	i_unlink(TEST_DB_SQL_CONFIG_PATH);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		req = auth_request_new_dummy(NULL);
+		req->fields.service = "test";
+		test_assert_idx(auth_request_set_username(req, tests[i].user,
+							  &error), i);
+		test_db_sql_query_expect(req, tests[i].template,
+					 tests[i].query);
+		auth_request_unref(&req);
+	}
+
+	db_sql_unref(&test_conn);
+	sql_driver_test_unregister();
+	sql_drivers_deinit();
+	test_end();
+}
+#endif
@@ -125,11 +125,27 @@ static void test_password_schemes(void)
 }
 
 
+static void test_password_scheme_is_slow(void)
+{
+	test_begin("password scheme is slow");
+	test_assert(password_scheme_is_slow("BLF-CRYPT"));
+	test_assert(password_scheme_is_slow("sha512-crypt"));
+	test_assert(password_scheme_is_slow("PBKDF2"));
+	test_assert(password_scheme_is_slow("SCRAM-SHA-256"));
+	test_assert(password_scheme_is_slow("ARGON2ID"));
+	test_assert(!password_scheme_is_slow("PLAIN"));
+	test_assert(!password_scheme_is_slow("SSHA512"));
+	test_assert(!password_scheme_is_slow("SHA256.hex"));
+	test_assert(!password_scheme_is_slow("NOSUCHSCHEME"));
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_password_schemes,
 		test_password_failures,
+		test_password_scheme_is_slow,
 		NULL
 	};
 	password_schemes_init();
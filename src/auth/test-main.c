@@ -15,6 +15,9 @@ int main(int argc, const char *argv[])
 		TEST_NAMED(test_auth_request_var_expand)
 		TEST_NAMED(test_auth_request_fields)
 		TEST_NAMED(test_db_dict_parse_cache_key)
+#if defined(PASSDB_SQL) || defined(USERDB_SQL)
+		TEST_NAMED(test_db_sql_query)
+#endif
 		TEST_NAMED(test_username_filter)
 #if defined(BUILTIN_LUA)
 		TEST_NAMED(test_db_lua)
@@ -189,8 +189,12 @@ static void userdb_ldap_iterate_callback(struct ldap_connection *conn,
 		}
 	}
 	db_ldap_result_iterate_deinit(&ldap_iter);
-	if (!ctx->continued)
+	if (!ctx->continued) {
+		/* this may be a different connection than the one the
+		   iteration was started with */
+		ctx->conn = conn;
 		db_ldap_enable_input(conn, FALSE);
+	}
 	ctx->in_callback = FALSE;
 }
 
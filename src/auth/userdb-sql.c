@@ -105,27 +105,23 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
 	struct userdb_sql_request *sql_request;
-	const char *query, *error;
-
-	if (t_auth_request_var_expand(module->conn->set.user_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
-		e_error(authdb_event(auth_request),
-			"Failed to expand user_query=%s: %s",
-			module->conn->set.user_query, error);
-		callback(USERDB_RESULT_INTERNAL_FAILURE, auth_request);
-		return;
-	}
+	const char *error;
 
 	auth_request_ref(auth_request);
 	sql_request = i_new(struct userdb_sql_request, 1);
 	sql_request->callback = callback;
 	sql_request->auth_request = auth_request;
 
-	e_debug(authdb_event(auth_request), "%s", query);
-
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
+	if (db_sql_query_run(module->conn->user_query, auth_request,
+			     userdb_sql_escape, sql_query_callback,
+			     sql_request, &error) < 0) {
+		e_error(authdb_event(auth_request),
+			"Failed to expand user_query=%s: %s",
+			module->conn->set.user_query, error);
+		i_free(sql_request);
+		callback(USERDB_RESULT_INTERNAL_FAILURE, auth_request);
+		auth_request_unref(&auth_request);
+	}
 }
 
 static void sql_iter_query_callback(struct sql_result *sql_result,
@@ -148,15 +144,7 @@ userdb_sql_iterate_init(struct auth_request *auth_request,
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
 	struct sql_userdb_iterate_context *ctx;
-	const char *query, *error;
-
-	if (t_auth_request_var_expand(module->conn->set.iterate_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
-		e_error(authdb_event(auth_request),
-			"Failed to expand iterate_query=%s: %s",
-			module->conn->set.iterate_query, error);
-	}
+	const char *error;
 
 	ctx = i_new(struct sql_userdb_iterate_context, 1);
 	ctx->ctx.auth_request = auth_request;
@@ -164,9 +152,14 @@ userdb_sql_iterate_init(struct auth_request *auth_request,
 	ctx->ctx.context = context;
 	auth_request_ref(auth_request);
 
-	sql_query(module->conn->db, query,
-		  sql_iter_query_callback, ctx);
-	e_debug(authdb_event(auth_request), "%s", query);
+	if (db_sql_query_run(module->conn->iterate_query, auth_request,
+			     userdb_sql_escape, sql_iter_query_callback,
+			     ctx, &error) < 0) {
+		e_error(authdb_event(auth_request),
+			"Failed to expand iterate_query=%s: %s",
+			module->conn->set.iterate_query, error);
+		ctx->ctx.failed = TRUE;
+	}
 	return &ctx->ctx;
 }
 
@@ -210,12 +203,23 @@ static void userdb_sql_iterate_next(struct userdb_iterate_context *_ctx)
 	int ret;
 
 	if (ctx->result == NULL) {
+		if (_ctx->failed) {
+			/* query couldn't be sent */
+			_ctx->callback(NULL, _ctx->context);
+			return;
+		}
 		/* query not finished yet */
 		ctx->call_iter = TRUE;
 		return;
 	}
 
 	ret = sql_result_next_row(ctx->result);
+	if (ret == SQL_RESULT_NEXT_MORE) {
+		/* the driver returns the results in pages */
+		ctx->call_iter = TRUE;
+		sql_result_more(&ctx->result, sql_iter_query_callback, ctx);
+		return;
+	}
 	if (ret >= 0)
 		db_sql_success(module->conn);
 	if (ret > 0) {
@@ -253,8 +257,10 @@ static int userdb_sql_iterate_deinit(struct userdb_iterate_context *_ctx)
 		(struct sql_userdb_iterate_context *)_ctx;
 	int ret = _ctx->failed ? -1 : 0;
 
-	auth_request_unref(&_ctx->auth_request);
-	if (ctx->result == NULL) {
+	/* the second call comes from sql_iter_query_callback() */
+	if (_ctx->auth_request != NULL)
+		auth_request_unref(&_ctx->auth_request);
+	if (ctx->result == NULL && !_ctx->failed) {
 		/* sql query hasn't finished yet */
 		ctx->freed = TRUE;
 	} else {
@@ -3,10 +3,17 @@
 #include "lib.h"
 #include "array.h"
 #include "llist.h"
+#include "fd-util.h"
+#include "hash.h"
+#include "str.h"
+#include "fdpass.h"
+#include "write-full.h"
+#include "safe-mkstemp.h"
 #include "istream.h"
 #include "ostream.h"
 #include "strescape.h"
 #include "settings-parser.h"
+#include "settings-binary.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "config-request.h"
@@ -14,8 +21,14 @@
 #include "config-connection.h"
 
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_MEMFD_CREATE
+#  include <sys/mman.h>
+#endif
 
 #define MAX_INBUF_SIZE 1024
+/* Forget all the cached snapshots when there are this many */
+#define CONFIG_SNAPSHOT_CACHE_MAX_COUNT 128
 
 #define CONFIG_CLIENT_PROTOCOL_MAJOR_VERSION 2
 #define CONFIG_CLIENT_PROTOCOL_MINOR_VERSION 0
@@ -32,7 +45,41 @@ struct config_connection {
 	bool handshaked:1;
 };
 
+struct config_request_args {
+	struct config_filter filter;
+	const char *const *modules;
+	const char *const *exclude_settings;
+	bool is_master;
+};
+
+struct config_snapshot {
+	int fd;
+	size_t size;
+};
+
 static struct config_connection *config_connections = NULL;
+/* "service<TAB>modules<TAB>excludes<TAB>filter match key" =>
+   struct config_snapshot */
+static HASH_TABLE(char *, struct config_snapshot *) config_snapshots;
+
+static void config_snapshots_clear(void)
+{
+	struct hash_iterate_context *iter;
+	struct config_snapshot *snapshot;
+	char *key;
+
+	if (!hash_table_is_created(config_snapshots))
+		return;
+
+	iter = hash_table_iterate_init(config_snapshots);
+	while (hash_table_iterate(iter, config_snapshots, &key, &snapshot)) {
+		i_close_fd(&snapshot->fd);
+		i_free(snapshot);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(config_snapshots, FALSE);
+}
 
 static const char *const *
 config_connection_next_line(struct config_connection *conn)
@@ -64,72 +111,88 @@ config_request_output(const char *key, const char *value,
 	o_stream_nsend_str(output, "\n");
 }
 
-static int config_connection_request(struct config_connection *conn,
-				     const char *const *args)
+static void
+config_request_parse_args(const char *const *args,
+			  struct config_request_args *req_r)
 {
-	struct config_export_context *ctx;
-	struct master_service_settings_output output;
-	struct config_filter filter;
-	const char *path, *error, *module, *const *wanted_modules;
 	ARRAY(const char *) modules;
 	ARRAY(const char *) exclude_settings;
-	bool is_master = FALSE;
+	const char *module;
 
 	/* [<args>] */
 	t_array_init(&modules, 4);
 	t_array_init(&exclude_settings, 4);
-	i_zero(&filter);
+	i_zero(req_r);
 	for (; *args != NULL; args++) {
 		if (str_begins(*args, "service="))
-			filter.service = *args + 8;
+			req_r->filter.service = *args + 8;
 		else if (str_begins(*args, "module=")) {
 			module = *args + 7;
 			if (strcmp(module, "master") == 0)
-				is_master = TRUE;
+				req_r->is_master = TRUE;
 			array_push_back(&modules, &module);
 		} else if (str_begins(*args, "exclude=")) {
 			const char *value = *args + 8;
 			array_push_back(&exclude_settings, &value);
 		} else if (str_begins(*args, "lname="))
-			filter.local_name = *args + 6;
+			req_r->filter.local_name = *args + 6;
 		else if (str_begins(*args, "lip=")) {
-			if (net_addr2ip(*args + 4, &filter.local_net) == 0) {
-				filter.local_bits =
-					IPADDR_IS_V4(&filter.local_net) ?
+			if (net_addr2ip(*args + 4, &req_r->filter.local_net) == 0) {
+				req_r->filter.local_bits =
+					IPADDR_IS_V4(&req_r->filter.local_net) ?
 					32 : 128;
 			}
 		} else if (str_begins(*args, "rip=")) {
-			if (net_addr2ip(*args + 4, &filter.remote_net) == 0) {
-				filter.remote_bits =
-					IPADDR_IS_V4(&filter.remote_net) ?
+			if (net_addr2ip(*args + 4, &req_r->filter.remote_net) == 0) {
+				req_r->filter.remote_bits =
+					IPADDR_IS_V4(&req_r->filter.remote_net) ?
 					32 : 128;
 			}
 		}
 	}
 	array_append_zero(&modules);
-	wanted_modules = array_count(&modules) == 1 ? NULL :
+	req_r->modules = array_count(&modules) == 1 ? NULL :
 		array_front(&modules);
 	array_append_zero(&exclude_settings);
+	req_r->exclude_settings = array_count(&exclude_settings) == 1 ? NULL :
+		array_front(&exclude_settings);
+}
 
-	if (is_master) {
-		/* master reads configuration only when reloading settings */
-		path = master_service_get_config_path(master_service);
-		if (config_parse_file(path, TRUE, NULL, &error) <= 0) {
-			o_stream_nsend_str(conn->output,
-				t_strconcat("\nERROR ", error, "\n", NULL));
-			config_connection_destroy(conn);
+static int config_connection_reload(struct config_connection *conn)
+{
+	const char *path, *error;
+
+	/* master reads configuration only when reloading settings */
+	path = master_service_get_config_path(master_service);
+	if (config_parse_file(path, TRUE, NULL, &error) <= 0) {
+		o_stream_nsend_str(conn->output,
+			t_strconcat("\nERROR ", error, "\n", NULL));
+		config_connection_destroy(conn);
+		return -1;
+	}
+	config_snapshots_clear();
+	return 0;
+}
+
+static int config_connection_request(struct config_connection *conn,
+				     const char *const *args)
+{
+	struct config_export_context *ctx;
+	struct master_service_settings_output output;
+	struct config_request_args req;
+
+	config_request_parse_args(args, &req);
+	if (req.is_master) {
+		if (config_connection_reload(conn) < 0)
 			return -1;
-		}
 	}
 
 	o_stream_cork(conn->output);
 
-	ctx = config_export_init(wanted_modules,
-				 array_count(&exclude_settings) == 1 ? NULL :
-				 array_front(&exclude_settings),
+	ctx = config_export_init(req.modules, req.exclude_settings,
 				 CONFIG_DUMP_SCOPE_SET, 0,
 				 config_request_output, conn->output);
-	config_export_by_filter(ctx, &filter);
+	config_export_by_filter(ctx, &req.filter);
 	config_export_get_output(ctx, &output);
 
 	if (output.specific_services != NULL) {
@@ -159,6 +222,172 @@ static int config_connection_request(struct config_connection *conn,
 	return 0;
 }
 
+static void
+config_request_binary_output(const char *key, const char *value,
+			     enum config_key_type type ATTR_UNUSED,
+			     void *context)
+{
+	struct settings_binary_writer *writer = context;
+
+	settings_binary_writer_add(writer, key, value);
+}
+
+static int config_snapshot_create_fd(const buffer_t *buf)
+{
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("dovecot-config", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		i_error("memfd_create() failed: %m");
+		return -1;
+	}
+	if (write_full(fd, buf->data, buf->used) < 0) {
+		i_error("write(config snapshot) failed: %m");
+		i_close_fd(&fd);
+		return -1;
+	}
+	/* the fd is shared with all the processes - make sure none of them
+	   can modify it */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK |
+		  F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		i_error("fcntl(config snapshot, F_ADD_SEALS) failed: %m");
+		i_close_fd(&fd);
+		return -1;
+	}
+	return fd;
+#else
+	string_t *path = t_str_new(128);
+	int ro_fd;
+
+	str_append(path, "/tmp/dovecot-config-snapshot.");
+	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
+		return -1;
+	}
+	ro_fd = -1;
+	if (write_full(fd, buf->data, buf->used) < 0)
+		i_error("write(%s) failed: %m", str_c(path));
+	else if ((ro_fd = open(str_c(path), O_RDONLY)) == -1)
+		i_error("open(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	i_close_fd(&fd);
+	/* the fd is shared with all the processes - make sure none of them
+	   can modify it */
+	if (ro_fd != -1)
+		fd_close_on_exec(ro_fd, TRUE);
+	return ro_fd;
+#endif
+}
+
+static struct config_snapshot *
+config_snapshot_create(const struct config_request_args *req)
+{
+	struct config_export_context *ctx;
+	struct master_service_settings_output output;
+	struct settings_binary_writer *writer;
+	struct config_snapshot *snapshot;
+	enum settings_binary_flags flags = 0;
+	buffer_t *buf;
+	int fd;
+
+	writer = settings_binary_writer_init();
+	ctx = config_export_init(req->modules, req->exclude_settings,
+				 CONFIG_DUMP_SCOPE_SET, 0,
+				 config_request_binary_output, writer);
+	config_export_by_filter(ctx, &req->filter);
+	config_export_get_output(ctx, &output);
+
+	if (output.specific_services != NULL) {
+		const char *const *s;
+
+		for (s = output.specific_services; *s != NULL; s++)
+			settings_binary_writer_add_service(writer, *s);
+	}
+	if (output.service_uses_local)
+		flags |= SETTINGS_BINARY_FLAG_SERVICE_USES_LOCAL;
+	if (output.service_uses_remote)
+		flags |= SETTINGS_BINARY_FLAG_SERVICE_USES_REMOTE;
+	if (output.used_local)
+		flags |= SETTINGS_BINARY_FLAG_USED_LOCAL;
+	if (output.used_remote)
+		flags |= SETTINGS_BINARY_FLAG_USED_REMOTE;
+	settings_binary_writer_add_flags(writer, flags);
+
+	if (config_export_finish(&ctx) < 0) {
+		settings_binary_writer_deinit(&writer);
+		return NULL;
+	}
+	buf = t_buffer_create(8192);
+	settings_binary_writer_finish(&writer, buf);
+	if ((fd = config_snapshot_create_fd(buf)) == -1)
+		return NULL;
+
+	snapshot = i_new(struct config_snapshot, 1);
+	snapshot->fd = fd;
+	snapshot->size = buf->used;
+	return snapshot;
+}
+
+static int config_connection_binary_request(struct config_connection *conn,
+					    const char *const *args)
+{
+	struct config_snapshot *snapshot;
+	struct config_request_args req;
+	const char *key, *reply;
+	ssize_t ret;
+
+	config_request_parse_args(args, &req);
+	if (req.is_master) {
+		if (config_connection_reload(conn) < 0)
+			return -1;
+	}
+
+	/* Lookups that match the same filters get the same settings, so the
+	   snapshots can be shared even if e.g. the remote IPs are different. */
+	key = t_strdup_printf("%s\t%s\t%s\t%s",
+		req.filter.service == NULL ? "" : req.filter.service,
+		req.modules == NULL ? "" : t_strarray_join(req.modules, ","),
+		req.exclude_settings == NULL ? "" :
+		t_strarray_join(req.exclude_settings, ","),
+		config_filter_get_match_key(config_filter, &req.filter));
+	if (!hash_table_is_created(config_snapshots))
+		hash_table_create(&config_snapshots, default_pool, 0,
+				  str_hash, strcmp);
+	snapshot = hash_table_lookup(config_snapshots, key);
+	if (snapshot == NULL) {
+		snapshot = config_snapshot_create(&req);
+		if (snapshot == NULL) {
+			config_connection_destroy(conn);
+			return -1;
+		}
+		if (hash_table_count(config_snapshots) >=
+		    CONFIG_SNAPSHOT_CACHE_MAX_COUNT)
+			config_snapshots_clear();
+		hash_table_insert(config_snapshots, i_strdup(key), snapshot);
+	}
+
+	/* the reply must not get mixed with anything buffered earlier */
+	if (o_stream_flush(conn->output) <= 0 ||
+	    o_stream_get_buffer_used_size(conn->output) > 0) {
+		i_error("Config client connection is stuck");
+		config_connection_destroy(conn);
+		return -1;
+	}
+	reply = t_strdup_printf("BIN\t%zu\n", snapshot->size);
+	ret = fd_send(conn->fd, snapshot->fd, reply, strlen(reply));
+	if (ret != (ssize_t)strlen(reply)) {
+		if (ret < 0 && errno != EPIPE)
+			i_error("fd_send(config snapshot) failed: %m");
+		else if (ret >= 0)
+			i_error("fd_send(config snapshot) sent partial reply");
+		config_connection_destroy(conn);
+		return -1;
+	}
+	return 0;
+}
+
 static int config_filters_request(struct config_connection *conn)
 {
 	struct config_filter_parser *const *filters = config_filter_get_all(config_filter);
@@ -222,8 +451,15 @@ static void config_connection_input(struct config_connection *conn)
 		if (args[0] == NULL)
 			continue;
 		if (strcmp(args[0], "REQ") == 0) {
-			if (config_connection_request(conn, args + 1) < 0)
-				break;
+			/* "binary" asks for the settings snapshot fd. old
+			   config processes ignore it and reply with text. */
+			if (str_array_find(args + 1, "binary")) {
+				if (config_connection_binary_request(conn, args + 1) < 0)
+					break;
+			} else {
+				if (config_connection_request(conn, args + 1) < 0)
+					break;
+			}
 		}
 		if (strcmp(args[0], "FILTERS") == 0) {
 			if (config_filters_request(conn) < 0)
@@ -264,4 +500,8 @@ void config_connections_destroy_all(void)
 {
 	while (config_connections != NULL)
 		config_connection_destroy(config_connections);
+	if (hash_table_is_created(config_snapshots)) {
+		config_snapshots_clear();
+		hash_table_destroy(&config_snapshots);
+	}
 }
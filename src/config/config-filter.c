@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "str.h"
 #include "settings-parser.h"
 #include "master-service-settings.h"
 #include "config-parser.h"
@@ -253,6 +254,23 @@ config_filter_find_all(struct config_filter_context *ctx, pool_t pool,
 	return array_front(&matches);
 }
 
+const char *
+config_filter_get_match_key(struct config_filter_context *ctx,
+			    const struct config_filter *filter)
+{
+	string_t *str = t_str_new(64);
+	unsigned int i;
+
+	for (i = 0; ctx->parsers[i] != NULL; i++) {
+		const struct config_filter *mask = &ctx->parsers[i]->filter;
+
+		if (config_filter_match_service(mask, filter) &&
+		    config_filter_match_rest(mask, filter))
+			str_printfa(str, "%u,", i);
+	}
+	return str_c(str);
+}
+
 struct config_filter_parser *const *
 config_filter_get_all(struct config_filter_context *ctx)
 {
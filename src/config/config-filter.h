@@ -45,6 +45,13 @@ struct config_filter_parser *const *
 config_filter_find_subset(struct config_filter_context *ctx,
 			  const struct config_filter *filter);
 
+/* Returns a string identifying the filters that match the given filter.
+   Lookups for the same service with the same match key return the same
+   settings, even if their IPs differ. */
+const char *
+config_filter_get_match_key(struct config_filter_context *ctx,
+			    const struct config_filter *filter);
+
 struct config_filter_parser *const *
 config_filter_get_all(struct config_filter_context *ctx);
 
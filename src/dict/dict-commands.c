@@ -12,6 +12,7 @@
 #include "dict-settings.h"
 #include "dict-connection.h"
 #include "dict-commands.h"
+#include "dict-value-cache.h"
 #include "main.h"
 
 #define DICT_CLIENT_PROTOCOL_TIMINGS_MIN_VERSION 1
@@ -37,6 +38,11 @@ struct dict_connection_cmd {
 	unsigned int trans_id; /* obsolete */
 	unsigned int rows;
 
+	/* Value cache generation when the lookup was started */
+	unsigned int cache_generation;
+	const char **lookup_keys;
+	char *lookup_username;
+
 	bool uncork_pending;
 };
 
@@ -53,6 +59,8 @@ static void dict_connection_cmd_free(struct dict_connection_cmd *cmd)
 	if (dict_iterate_deinit(&cmd->iter, &error) < 0)
 		e_error(cmd->event, "dict_iterate() failed: %s", error);
 	i_free(cmd->reply);
+	i_free(cmd->lookup_username);
+	i_free(cmd->lookup_keys);
 	if (cmd->uncork_pending)
 		o_stream_uncork(cmd->conn->conn.output);
 
@@ -168,6 +176,38 @@ dict_cmd_reply_handle_stats(struct dict_connection_cmd *cmd,
 		    (unsigned int)ioloop_timeval.tv_usec);
 }
 
+static const char *
+dict_value_cache_username(const char *key, const char *username)
+{
+	/* shared keys are the same for all users */
+	if (str_begins(key, DICT_PATH_SHARED))
+		return NULL;
+	return username;
+}
+
+static void
+cmd_lookup_cache_start(struct dict_connection_cmd *cmd,
+		       const char *username, const char *const *keys)
+{
+	if (cmd->conn->value_cache == NULL)
+		return;
+	cmd->cache_generation =
+		dict_value_cache_get_generation(cmd->conn->value_cache);
+	cmd->lookup_username = i_strdup(username);
+	cmd->lookup_keys = p_strarray_dup(default_pool, keys);
+}
+
+static void
+cmd_lookup_cache_add(struct dict_connection_cmd *cmd, unsigned int idx,
+		     const char *const *values)
+{
+	const char *key = cmd->lookup_keys[idx];
+
+	dict_value_cache_add(cmd->conn->value_cache, cmd->cache_generation,
+		dict_value_cache_username(key, cmd->lookup_username),
+		key, values);
+}
+
 static void
 cmd_lookup_write_reply(struct dict_connection_cmd *cmd,
 		       const char *const *values, string_t *str)
@@ -199,6 +239,11 @@ cmd_lookup_callback(const struct dict_lookup_result *result,
 {
 	string_t *str = t_str_new(128);
 
+	if (cmd->lookup_keys != NULL && result->ret >= 0) {
+		cmd_lookup_cache_add(cmd, 0,
+				     result->ret > 0 ? result->values : NULL);
+	}
+
 	event_set_name(cmd->event, "dict_server_lookup_finished");
 	if (result->ret > 0) {
 		cmd_lookup_write_reply(cmd, result->values, str);
@@ -220,6 +265,30 @@ cmd_lookup_callback(const struct dict_lookup_result *result,
 	dict_connection_cmd_try_flush(&cmd);
 }
 
+static bool
+cmd_lookup_try_cache(struct dict_connection_cmd *cmd, const char *username,
+		     const char *key)
+{
+	struct dict_lookup_result result;
+	int ret;
+
+	if (cmd->conn->value_cache == NULL)
+		return FALSE;
+
+	i_zero(&result);
+	ret = dict_value_cache_lookup(cmd->conn->value_cache,
+			dict_value_cache_username(key, username), key,
+			&result.values);
+	if (ret < 0)
+		return FALSE;
+	event_add_str(cmd->event, "cache_hit", "yes");
+	if (ret > 0)
+		result.value = result.values[0];
+	result.ret = ret;
+	cmd_lookup_callback(&result, cmd);
+	return TRUE;
+}
+
 static int cmd_lookup(struct dict_connection_cmd *cmd, const char *const *args)
 {
 	const char *username;
@@ -234,13 +303,125 @@ static int cmd_lookup(struct dict_connection_cmd *cmd, const char *const *args)
 	dict_connection_cmd_async(cmd);
 	event_add_str(cmd->event, "key", args[0]);
 	event_add_str(cmd->event, "user", username);
+	if (cmd_lookup_try_cache(cmd, username, args[0]))
+		return 1;
+
 	const struct dict_op_settings set = {
 		.username = username,
 	};
+	const char *keys[] = { args[0], NULL };
+	cmd_lookup_cache_start(cmd, username, keys);
 	dict_lookup_async(cmd->conn->dict, &set, args[0], cmd_lookup_callback, cmd);
 	return 1;
 }
 
+static void
+cmd_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+			  struct dict_connection_cmd *cmd)
+{
+	string_t *str = t_str_new(128), *tmp;
+
+	if (cmd->lookup_keys != NULL && result->ret >= 0) {
+		for (unsigned int i = 0; i < result->values_count; i++) {
+			const char *values[] = { result->values[i], NULL };
+			cmd_lookup_cache_add(cmd, i, result->values[i] == NULL ?
+					     NULL : values);
+		}
+	}
+
+	event_set_name(cmd->event, "dict_server_lookup_finished");
+	if (result->ret >= 0) {
+		if (result->ret == 0)
+			event_add_str(cmd->event, "key_not_found", "yes");
+		/* the results get double-tabescaped so they end up becoming
+		   a single parameter */
+		tmp = t_str_new(128);
+		for (unsigned int i = 0; i < result->values_count; i++) {
+			if (i > 0)
+				str_append_c(tmp, '\t');
+			if (result->values[i] == NULL)
+				str_append_c(tmp, DICT_PROTOCOL_REPLY_NOTFOUND);
+			else {
+				str_append_c(tmp, DICT_PROTOCOL_REPLY_OK);
+				str_append_tabescaped(tmp, result->values[i]);
+			}
+		}
+		str_append_c(str, DICT_PROTOCOL_REPLY_OK);
+		str_append_tabescaped(str, str_c(tmp));
+		e_debug(cmd->event, "Lookup finished");
+	} else {
+		event_add_str(cmd->event, "error", result->error);
+		e_error(cmd->event, "Lookup failed: %s", result->error);
+		str_append_c(str, DICT_PROTOCOL_REPLY_FAIL);
+		str_append_tabescaped(str, result->error);
+	}
+	dict_cmd_reply_handle_stats(cmd, str, cmd_stats.lookups);
+	str_append_c(str, '\n');
+
+	cmd->reply = i_strdup(str_c(str));
+	dict_connection_cmd_try_flush(&cmd);
+}
+
+static bool
+cmd_lookup_multi_try_cache(struct dict_connection_cmd *cmd,
+			   const char *username, const char *const *keys)
+{
+	struct dict_lookup_multi_result result;
+	const char **values, *const *key_values;
+	unsigned int i, count = str_array_length(keys);
+	int ret;
+
+	if (cmd->conn->value_cache == NULL)
+		return FALSE;
+
+	/* the lookup is answered from cache only if all of the keys are
+	   found there. Otherwise a single backend lookup is done for all of
+	   them. */
+	i_zero(&result);
+	values = t_new(const char *, count + 1);
+	for (i = 0; i < count; i++) {
+		ret = dict_value_cache_lookup(cmd->conn->value_cache,
+				dict_value_cache_username(keys[i], username),
+				keys[i], &key_values);
+		if (ret < 0)
+			return FALSE;
+		if (ret > 0) {
+			values[i] = key_values[0];
+			result.ret = 1;
+		}
+	}
+	event_add_str(cmd->event, "cache_hit", "yes");
+	result.values = values;
+	result.values_count = count;
+	cmd_lookup_multi_callback(&result, cmd);
+	return TRUE;
+}
+
+static int
+cmd_lookup_multi(struct dict_connection_cmd *cmd, const char *const *args)
+{
+	/* <username> <key> [<key> ...] */
+	if (str_array_length(args) < 2) {
+		e_error(cmd->event, "LOOKUP_MULTI: broken input");
+		return -1;
+	}
+
+	dict_connection_cmd_async(cmd);
+	event_add_str(cmd->event, "key", args[1]);
+	event_add_int(cmd->event, "keys_count", str_array_length(args + 1));
+	event_add_str(cmd->event, "user", args[0]);
+	if (cmd_lookup_multi_try_cache(cmd, args[0], args + 1))
+		return 1;
+
+	const struct dict_op_settings set = {
+		.username = args[0],
+	};
+	cmd_lookup_cache_start(cmd, args[0], args + 1);
+	dict_lookup_multi_async(cmd->conn->dict, &set, args + 1,
+				cmd_lookup_multi_callback, cmd);
+	return 1;
+}
+
 static bool dict_connection_flush_if_full(struct dict_connection *conn)
 {
 	if (o_stream_get_buffer_used_size(conn->conn.output) >
@@ -405,13 +586,14 @@ static void
 dict_connection_transaction_array_remove(struct dict_connection *conn,
 					 unsigned int id)
 {
-	const struct dict_connection_transaction *transactions;
+	struct dict_connection_transaction *transactions;
 	unsigned int i, count;
 
-	transactions = array_get(&conn->transactions, &count);
+	transactions = array_get_modifiable(&conn->transactions, &count);
 	for (i = 0; i < count; i++) {
 		if (transactions[i].id == id) {
 			i_assert(transactions[i].ctx == NULL);
+			pool_unref(&transactions[i].pool);
 			array_delete(&conn->transactions, i, 1);
 			return;
 		}
@@ -451,9 +633,44 @@ static int cmd_begin(struct dict_connection_cmd *cmd, const char *const *args)
 	trans->id = id;
 	trans->conn = cmd->conn;
 	trans->ctx = dict_transaction_begin(cmd->conn->dict, &set);
+	if (cmd->conn->value_cache != NULL) {
+		trans->pool = pool_alloconly_create("dict transaction", 256);
+		trans->username = p_strdup(trans->pool, username);
+		p_array_init(&trans->changed_keys, trans->pool, 8);
+	}
 	return 0;
 }
 
+static void
+dict_connection_transaction_key_changed(struct dict_connection_transaction *trans,
+					const char *key)
+{
+	if (trans->pool == NULL)
+		return;
+	key = p_strdup(trans->pool, key);
+	array_push_back(&trans->changed_keys, &key);
+}
+
+static void
+dict_connection_transaction_invalidate(struct dict_connection *conn,
+				       unsigned int id)
+{
+	struct dict_connection_transaction *trans;
+	const char *key;
+
+	if (conn->value_cache == NULL)
+		return;
+	trans = dict_connection_transaction_lookup(conn, id);
+	i_assert(trans != NULL);
+
+	/* Invalidate the keys even if the commit failed, because the write
+	   may have still happened. */
+	array_foreach_elem(&trans->changed_keys, key) {
+		dict_value_cache_invalidate(conn->value_cache,
+			dict_value_cache_username(key, trans->username), key);
+	}
+}
+
 static int
 dict_connection_transaction_lookup_parse(struct dict_connection *conn,
 					 const char *id_str,
@@ -518,6 +735,7 @@ cmd_commit_finish(struct dict_connection_cmd *cmd,
 		e_debug(cmd->event, "Transaction finished: %s", result->error);
 	else
 		e_debug(cmd->event, "Transaction finished");
+	dict_connection_transaction_invalidate(cmd->conn, cmd->trans_id);
 	dict_connection_transaction_array_remove(cmd->conn, cmd->trans_id);
 	dict_connection_cmd_try_flush(&cmd);
 }
@@ -592,6 +810,7 @@ static int cmd_set(struct dict_connection_cmd *cmd, const char *const *args)
 		return -1;
 	event_add_str(cmd->event, "user", trans->ctx->set.username);
         dict_set(trans->ctx, args[1], args[2]);
+	dict_connection_transaction_key_changed(trans, args[1]);
 	return 0;
 }
 
@@ -608,6 +827,7 @@ static int cmd_unset(struct dict_connection_cmd *cmd, const char *const *args)
 	if (dict_connection_transaction_lookup_parse(cmd->conn, args[0], &trans) < 0)
 		return -1;
         dict_unset(trans->ctx, args[1]);
+	dict_connection_transaction_key_changed(trans, args[1]);
 	return 0;
 }
 
@@ -628,6 +848,7 @@ cmd_atomic_inc(struct dict_connection_cmd *cmd, const char *const *args)
 		return -1;
 
         dict_atomic_inc(trans->ctx, args[1], diff);
+	dict_connection_transaction_key_changed(trans, args[1]);
 	return 0;
 }
 
@@ -658,6 +879,7 @@ static int cmd_timestamp(struct dict_connection_cmd *cmd, const char *const *arg
 
 static const struct dict_cmd_func cmds[] = {
 	{ DICT_PROTOCOL_CMD_LOOKUP, cmd_lookup },
+	{ DICT_PROTOCOL_CMD_LOOKUP_MULTI, cmd_lookup_multi },
 	{ DICT_PROTOCOL_CMD_ITERATE, cmd_iterate },
 	{ DICT_PROTOCOL_CMD_BEGIN, cmd_begin },
 	{ DICT_PROTOCOL_CMD_COMMIT, cmd_commit },
@@ -10,6 +10,7 @@
 #include "master-service.h"
 #include "dict-client.h"
 #include "dict-settings.h"
+#include "dict-value-cache.h"
 #include "dict-commands.h"
 #include "dict-connection.h"
 #include "dict-init-cache.h"
@@ -102,6 +103,7 @@ static int dict_connection_dict_init(struct dict_connection *conn)
 			conn->name, error);
 		return -1;
 	}
+	conn->value_cache = dict_value_cache_get(conn->name);
 	return 0;
 }
 
@@ -158,8 +160,10 @@ bool dict_connection_unref(struct dict_connection *conn)
 	/* we should have only transactions that haven't been committed or
 	   rollbacked yet. close those before dict is deinitialized. */
 	if (array_is_created(&conn->transactions)) {
-		array_foreach_modifiable(&conn->transactions, transaction)
+		array_foreach_modifiable(&conn->transactions, transaction) {
 			dict_transaction_rollback(&transaction->ctx);
+			pool_unref(&transaction->pool);
+		}
 	}
 
 	if (conn->dict != NULL)
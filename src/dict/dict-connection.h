@@ -8,6 +8,13 @@ struct dict_connection_transaction {
 	unsigned int id;
 	struct dict_connection *conn;
 	struct dict_transaction_context *ctx;
+
+	/* Keys changed by the transaction. They're invalidated from the
+	   value cache after the commit finishes. Allocated only when the
+	   value cache is enabled. */
+	pool_t pool;
+	const char *username;
+	ARRAY_TYPE(const_string) changed_keys;
 };
 
 struct dict_connection {
@@ -18,6 +25,8 @@ struct dict_connection {
 
 	char *name;
 	struct dict *dict;
+	/* NULL if caching isn't enabled for this dict */
+	struct dict_value_cache *value_cache;
 	enum dict_data_type value_type;
 
 	struct timeout *to_unref;
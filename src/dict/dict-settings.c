@@ -92,6 +92,11 @@ static const struct setting_define dict_setting_defines[] = {
 	{ .type = SET_STRLIST, .key = "dict",
 	  .offset = offsetof(struct dict_server_settings, dicts) },
 
+	DEF(STR, dict_cache_dicts),
+	DEF(TIME, dict_cache_ttl),
+	DEF(TIME, dict_cache_negative_ttl),
+	DEF(SIZE, dict_cache_max_size),
+
 	SETTING_DEFINE_LIST_END
 };
 
@@ -100,7 +105,12 @@ const struct dict_server_settings dict_default_settings = {
 	.verbose_proctitle = FALSE,
 
 	.dict_db_config = "",
-	.dicts = ARRAY_INIT
+	.dicts = ARRAY_INIT,
+
+	.dict_cache_dicts = "",
+	.dict_cache_ttl = 60,
+	.dict_cache_negative_ttl = 10,
+	.dict_cache_max_size = 16*1024*1024
 };
 
 const struct setting_parser_info dict_setting_parser_info = {
@@ -7,6 +7,11 @@ struct dict_server_settings {
 
 	const char *dict_db_config;
 	ARRAY(const char *) dicts;
+
+	const char *dict_cache_dicts;
+	unsigned int dict_cache_ttl;
+	unsigned int dict_cache_negative_ttl;
+	uoff_t dict_cache_max_size;
 };
 
 extern const struct setting_parser_info dict_setting_parser_info;
@@ -0,0 +1,241 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "llist.h"
+#include "str.h"
+#include "dict-settings.h"
+#include "dict-value-cache.h"
+
+struct dict_value_cache_entry {
+	struct dict_value_cache_entry *prev, *next;
+
+	/* username is NULL for shared keys */
+	char *username;
+	char *key;
+	/* NULL if the key doesn't exist */
+	const char **values;
+
+	time_t expire_time;
+	size_t size;
+};
+
+struct dict_value_cache {
+	char *dict_name;
+	HASH_TABLE(struct dict_value_cache_entry *,
+		   struct dict_value_cache_entry *) entries;
+	/* LRU: head is the oldest */
+	struct dict_value_cache_entry *head, *tail;
+
+	/* Incremented for each invalidation. Lookups that started before it
+	   may have returned stale values, so they aren't cached. */
+	unsigned int generation;
+	uoff_t size;
+};
+
+static HASH_TABLE(char *, struct dict_value_cache *) value_caches;
+static struct dict_value_cache_stats value_cache_stats;
+
+static unsigned int
+dict_value_cache_entry_hash(const struct dict_value_cache_entry *entry)
+{
+	unsigned int hash = str_hash(entry->key);
+
+	if (entry->username != NULL)
+		hash ^= str_hash(entry->username);
+	return hash;
+}
+
+static int
+dict_value_cache_entry_cmp(const struct dict_value_cache_entry *entry1,
+			   const struct dict_value_cache_entry *entry2)
+{
+	int ret;
+
+	if ((ret = null_strcmp(entry1->username, entry2->username)) != 0)
+		return ret;
+	return strcmp(entry1->key, entry2->key);
+}
+
+static bool dict_value_cache_is_enabled(const char *dict_name)
+{
+	const char *const *names;
+
+	if (dict_settings->dict_cache_dicts[0] == '\0')
+		return FALSE;
+	names = t_strsplit_spaces(dict_settings->dict_cache_dicts, " ");
+	return str_array_find(names, dict_name);
+}
+
+struct dict_value_cache *dict_value_cache_get(const char *dict_name)
+{
+	struct dict_value_cache *cache;
+	bool enabled;
+
+	if (hash_table_is_created(value_caches)) {
+		cache = hash_table_lookup(value_caches, dict_name);
+		if (cache != NULL)
+			return cache;
+	}
+	T_BEGIN {
+		enabled = dict_value_cache_is_enabled(dict_name);
+	} T_END;
+	if (!enabled)
+		return NULL;
+
+	if (!hash_table_is_created(value_caches))
+		hash_table_create(&value_caches, default_pool, 0, str_hash, strcmp);
+	cache = i_new(struct dict_value_cache, 1);
+	cache->dict_name = i_strdup(dict_name);
+	hash_table_create(&cache->entries, default_pool, 0,
+			  dict_value_cache_entry_hash,
+			  dict_value_cache_entry_cmp);
+	hash_table_insert(value_caches, cache->dict_name, cache);
+	return cache;
+}
+
+static void
+dict_value_cache_entry_free(struct dict_value_cache *cache,
+			    struct dict_value_cache_entry *entry)
+{
+	hash_table_remove(cache->entries, entry);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	i_assert(cache->size >= entry->size);
+	cache->size -= entry->size;
+
+	i_free(entry->values);
+	i_free(entry->username);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static struct dict_value_cache_entry *
+dict_value_cache_find(struct dict_value_cache *cache,
+		      const char *username, const char *key)
+{
+	struct dict_value_cache_entry lookup_entry;
+
+	i_zero(&lookup_entry);
+	lookup_entry.username = (char *)username;
+	lookup_entry.key = (char *)key;
+	return hash_table_lookup(cache->entries, &lookup_entry);
+}
+
+int dict_value_cache_lookup(struct dict_value_cache *cache,
+			    const char *username, const char *key,
+			    const char *const **values_r)
+{
+	struct dict_value_cache_entry *entry;
+
+	*values_r = NULL;
+	entry = dict_value_cache_find(cache, username, key);
+	if (entry == NULL) {
+		value_cache_stats.misses++;
+		return -1;
+	}
+	if (entry->expire_time <= ioloop_time) {
+		dict_value_cache_entry_free(cache, entry);
+		value_cache_stats.misses++;
+		return -1;
+	}
+	/* move to the end of LRU */
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	DLLIST2_APPEND(&cache->head, &cache->tail, entry);
+
+	if (entry->values == NULL) {
+		value_cache_stats.negative_hits++;
+		return 0;
+	}
+	value_cache_stats.hits++;
+	*values_r = entry->values;
+	return 1;
+}
+
+unsigned int dict_value_cache_get_generation(struct dict_value_cache *cache)
+{
+	return cache->generation;
+}
+
+void dict_value_cache_add(struct dict_value_cache *cache,
+			  unsigned int generation, const char *username,
+			  const char *key, const char *const *values)
+{
+	struct dict_value_cache_entry *entry;
+	unsigned int ttl;
+	size_t size;
+
+	if (generation != cache->generation)
+		return;
+	ttl = values != NULL ? dict_settings->dict_cache_ttl :
+		dict_settings->dict_cache_negative_ttl;
+	if (ttl == 0)
+		return;
+
+	size = sizeof(*entry) + strlen(key) + 1 +
+		(username == NULL ? 0 : strlen(username) + 1);
+	for (unsigned int i = 0; values != NULL && values[i] != NULL; i++)
+		size += sizeof(values[i]) + strlen(values[i]) + 1;
+	if (size > dict_settings->dict_cache_max_size)
+		return;
+
+	entry = dict_value_cache_find(cache, username, key);
+	if (entry != NULL)
+		dict_value_cache_entry_free(cache, entry);
+	while (cache->size + size > dict_settings->dict_cache_max_size)
+		dict_value_cache_entry_free(cache, cache->head);
+
+	entry = i_new(struct dict_value_cache_entry, 1);
+	entry->username = i_strdup(username);
+	entry->key = i_strdup(key);
+	if (values != NULL)
+		entry->values = p_strarray_dup(default_pool, values);
+	entry->expire_time = ioloop_time + ttl;
+	entry->size = size;
+
+	hash_table_insert(cache->entries, entry, entry);
+	DLLIST2_APPEND(&cache->head, &cache->tail, entry);
+	cache->size += size;
+}
+
+void dict_value_cache_invalidate(struct dict_value_cache *cache,
+				 const char *username, const char *key)
+{
+	struct dict_value_cache_entry *entry;
+
+	cache->generation++;
+	entry = dict_value_cache_find(cache, username, key);
+	if (entry != NULL)
+		dict_value_cache_entry_free(cache, entry);
+}
+
+void dict_value_caches_get_stats(struct dict_value_cache_stats *stats_r)
+{
+	*stats_r = value_cache_stats;
+	i_zero(&value_cache_stats);
+}
+
+static void dict_value_cache_destroy(struct dict_value_cache *cache)
+{
+	while (cache->head != NULL)
+		dict_value_cache_entry_free(cache, cache->head);
+	hash_table_destroy(&cache->entries);
+	i_free(cache->dict_name);
+	i_free(cache);
+}
+
+void dict_value_caches_destroy_all(void)
+{
+	struct hash_iterate_context *iter;
+	char *name;
+	struct dict_value_cache *cache;
+
+	if (!hash_table_is_created(value_caches))
+		return;
+
+	iter = hash_table_iterate_init(value_caches);
+	while (hash_table_iterate(iter, value_caches, &name, &cache))
+		dict_value_cache_destroy(cache);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&value_caches);
+}
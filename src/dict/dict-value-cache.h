@@ -0,0 +1,36 @@
+#ifndef DICT_VALUE_CACHE_H
+#define DICT_VALUE_CACHE_H
+
+struct dict_value_cache_stats {
+	uint64_t hits, negative_hits, misses;
+};
+
+/* Returns the value cache for the named dict, or NULL if values of this
+   dict aren't cached. */
+struct dict_value_cache *dict_value_cache_get(const char *dict_name);
+
+/* Returns 1 if the key was found from cache, 0 if it's cached as nonexistent
+   and -1 if it's not cached. The returned values are valid until the cache
+   is modified. */
+int dict_value_cache_lookup(struct dict_value_cache *cache,
+			    const char *username, const char *key,
+			    const char *const **values_r);
+/* Returns the cache's current generation. It needs to be given to
+   dict_value_cache_add() to make sure no writes happened while the lookup
+   was running. */
+unsigned int dict_value_cache_get_generation(struct dict_value_cache *cache);
+/* Add the key to cache. values=NULL caches the key as nonexistent. Nothing
+   is added if the cache was invalidated after the generation was gotten. */
+void dict_value_cache_add(struct dict_value_cache *cache,
+			  unsigned int generation, const char *username,
+			  const char *key, const char *const *values);
+/* Drop the key from cache after it was modified. */
+void dict_value_cache_invalidate(struct dict_value_cache *cache,
+				 const char *username, const char *key);
+
+/* Get the combined statistics of all caches and reset them. */
+void dict_value_caches_get_stats(struct dict_value_cache_stats *stats_r);
+
+void dict_value_caches_destroy_all(void);
+
+#endif
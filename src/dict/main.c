@@ -18,6 +18,7 @@
 #include "dict-connection.h"
 #include "dict-settings.h"
 #include "dict-init-cache.h"
+#include "dict-value-cache.h"
 #include "main.h"
 
 #include <math.h>
@@ -57,6 +58,14 @@ static void dict_proctitle_update(void *context ATTR_UNUSED)
 	add_stats_string(str, cmd_stats.lookups, "lookups");
 	add_stats_string(str, cmd_stats.iterations, "iters");
 	add_stats_string(str, cmd_stats.commits, "commits");
+	if (dict_settings->dict_cache_dicts[0] != '\0') {
+		struct dict_value_cache_stats cache_stats;
+
+		dict_value_caches_get_stats(&cache_stats);
+		str_printfa(str, ", cache:%"PRIu64"/%"PRIu64"/%"PRIu64,
+			    cache_stats.hits, cache_stats.negative_hits,
+			    cache_stats.misses);
+	}
 	str_append_c(str, ']');
 
 	process_title_set(str_c(str));
@@ -136,6 +145,7 @@ static void main_deinit(void)
 	/* connections should no longer have any extra refcounts */
 	dict_connections_destroy_all();
 	dict_init_cache_destroy_all();
+	dict_value_caches_destroy_all();
 
 	dict_drivers_unregister_all();
 	dict_commands_deinit();
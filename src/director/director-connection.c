@@ -20,7 +20,7 @@
    HOST-HAND-START
    [0..n] HOST
    HOST-HAND-END
-   [0..n] USER
+   [0..n] USER (or U, or UB with a batch of users)
    <possibly other non-handshake commands between USERs>
    DONE
    <wait for DONE from remote>
@@ -36,6 +36,8 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "base64.h"
+#include "numpack.h"
 #include "time-util.h"
 #include "master-service.h"
 #include "mail-host.h"
@@ -89,6 +91,10 @@
 /* How many USER entries to send during handshake before going back to ioloop
    to see if there's other work to be done as well. */
 #define DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH 10000
+/* How many users to pack into a single UB command during handshake. */
+#define DIRECTOR_HANDSHAKE_USER_BATCH_SIZE 1000
+/* Maximum number of different hosts in a single UB command. */
+#define DIRECTOR_HANDSHAKE_USER_BATCH_MAX_HOSTS 256
 
 #define CMD_IS_USER_HANDSHAKE(minor_version, args) \
 	((minor_version) < DIRECTOR_VERSION_HANDSHAKE_U_CMD && \
@@ -770,33 +776,15 @@ director_user_refresh(struct director_connection *conn,
 	return ret ? 1 : 0;
 }
 
-static bool
-director_handshake_cmd_user(struct director_connection *conn,
-			    const char *const *args)
+static void
+director_handshake_user(struct director_connection *conn,
+			unsigned int username_hash, struct mail_host *host,
+			unsigned int timestamp, bool weak)
 {
-	unsigned int username_hash, timestamp;
-	struct ip_addr ip;
-	struct mail_host *host;
 	struct user *user;
-	bool weak, forced;
+	bool forced;
 
-	if (str_array_length(args) < 3 ||
-	    str_to_uint(args[0], &username_hash) < 0 ||
-	    net_addr2ip(args[1], &ip) < 0 ||
-	    str_to_uint(args[2], &timestamp) < 0) {
-		director_cmd_error(conn, "Invalid parameters");
-		return FALSE;
-	}
-	weak = args[3] != NULL && args[3][0] == 'w';
 	conn->handshake_users_received++;
-
-	host = mail_host_lookup(conn->dir->mail_hosts, &ip);
-	if (host == NULL) {
-		e_error(conn->event, "USER used unknown host %s in handshake",
-			args[1]);
-		return FALSE;
-	}
-
 	if ((time_t)timestamp > ioloop_time) {
 		/* The other director's clock seems to be into the future
 		   compared to us. Don't set any of our users' timestamps into
@@ -807,7 +795,7 @@ director_handshake_cmd_user(struct director_connection *conn,
 	if (director_user_refresh(conn, username_hash, host,
 				  timestamp, weak, &forced, &user) < 0) {
 		/* user expired - ignore */
-		return TRUE;
+		return;
 	}
 	/* Possibilities:
 
@@ -829,6 +817,107 @@ director_handshake_cmd_user(struct director_connection *conn,
 	/* always sort users after handshaking to make sure the order
 	   is correct */
 	conn->users_unsorted = TRUE;
+}
+
+static bool
+director_handshake_cmd_user(struct director_connection *conn,
+			    const char *const *args)
+{
+	unsigned int username_hash, timestamp;
+	struct ip_addr ip;
+	struct mail_host *host;
+	bool weak;
+
+	if (str_array_length(args) < 3 ||
+	    str_to_uint(args[0], &username_hash) < 0 ||
+	    net_addr2ip(args[1], &ip) < 0 ||
+	    str_to_uint(args[2], &timestamp) < 0) {
+		director_cmd_error(conn, "Invalid parameters");
+		return FALSE;
+	}
+	weak = args[3] != NULL && args[3][0] == 'w';
+
+	host = mail_host_lookup(conn->dir->mail_hosts, &ip);
+	if (host == NULL) {
+		e_error(conn->event, "USER used unknown host %s in handshake",
+			args[1]);
+		return FALSE;
+	}
+	director_handshake_user(conn, username_hash, host, timestamp, weak);
+	return TRUE;
+}
+
+static bool
+director_handshake_cmd_user_batch(struct director_connection *conn,
+				  const char *const *args)
+{
+	ARRAY(struct mail_host *) hosts;
+	const char *const *ips;
+	const uint8_t *p, *end;
+	struct ip_addr ip;
+	unsigned int base_timestamp;
+	uint32_t host_weak, username_hash, timestamp_diff;
+	buffer_t *data;
+	unsigned int i;
+
+	/* UB <base timestamp> <host ip>[,<host ip>...] <base64 records>
+
+	   Each record is:
+	   numpack(host index << 1 | weak)
+	   32bit big-endian username hash
+	   numpack(base timestamp - timestamp) */
+	if (str_array_length(args) < 3 ||
+	    str_to_uint(args[0], &base_timestamp) < 0) {
+		director_cmd_error(conn, "Invalid parameters");
+		return FALSE;
+	}
+	ips = t_strsplit(args[1], ",");
+	t_array_init(&hosts, str_array_length(ips));
+	for (i = 0; ips[i] != NULL; i++) {
+		if (net_addr2ip(ips[i], &ip) < 0) {
+			director_cmd_error(conn, "Invalid host IP");
+			return FALSE;
+		}
+		struct mail_host *host =
+			mail_host_lookup(conn->dir->mail_hosts, &ip);
+		if (host == NULL) {
+			e_error(conn->event,
+				"USER used unknown host %s in handshake",
+				ips[i]);
+			return FALSE;
+		}
+		array_push_back(&hosts, &host);
+	}
+
+	data = t_buffer_create(strlen(args[2]) / 4 * 3 + 3);
+	if (base64_decode(args[2], strlen(args[2]), NULL, data) < 0) {
+		director_cmd_error(conn, "Invalid user batch");
+		return FALSE;
+	}
+	p = data->data;
+	end = p + data->used;
+	while (p < end) {
+		if (numpack_decode32(&p, end, &host_weak) < 0 ||
+		    end - p < 4) {
+			director_cmd_error(conn, "Truncated user batch");
+			return FALSE;
+		}
+		username_hash = be32_to_cpu_unaligned(p);
+		p += 4;
+		if (numpack_decode32(&p, end, &timestamp_diff) < 0 ||
+		    timestamp_diff > base_timestamp) {
+			director_cmd_error(conn, "Invalid user batch timestamp");
+			return FALSE;
+		}
+		if ((host_weak >> 1) >= array_count(&hosts)) {
+			director_cmd_error(conn, "Invalid user batch host");
+			return FALSE;
+		}
+		director_handshake_user(conn, username_hash,
+					array_idx_elem(&hosts, host_weak >> 1),
+					base_timestamp - timestamp_diff,
+					(host_weak & 1) != 0);
+	}
 	return TRUE;
 }
 
@@ -1568,6 +1657,8 @@ director_connection_handle_handshake(struct director_connection *conn,
 	     (strcmp(cmd, "USER") == 0 &&
 	      CMD_IS_USER_HANDSHAKE(conn->minor_version, args))))
 		return director_handshake_cmd_user(conn, args) ? 1 : -1;
+	if (conn->in && strcmp(cmd, "UB") == 0)
+		return director_handshake_cmd_user_batch(conn, args) ? 1 : -1;
 
 	/* both get DONE */
 	if (strcmp(cmd, "DONE") == 0)
@@ -2201,6 +2292,56 @@ static int director_connection_send_done(struct director_connection *conn)
 	return 0;
 }
 
+static void
+director_connection_send_user_batch(struct director_connection *conn,
+				    ARRAY_TYPE(mail_host) *hosts,
+				    buffer_t *records)
+{
+	struct mail_host *host;
+	string_t *str;
+
+	if (records->used == 0)
+		return;
+
+	str = t_str_new(MAX_BASE64_ENCODED_SIZE(records->used) + 128);
+	str_printfa(str, "UB\t%ld\t", (long)ioloop_time);
+	array_foreach_elem(hosts, host) {
+		str_append(str, host->ip_str);
+		str_append_c(str, ',');
+	}
+	str_truncate(str, str_len(str) - 1);
+	str_append_c(str, '\t');
+	base64_encode(records->data, records->used, str);
+	str_append_c(str, '\n');
+	director_connection_send(conn, str_c(str));
+
+	array_clear(hosts);
+	buffer_set_used_size(records, 0);
+}
+
+static void
+director_connection_add_user_batch(ARRAY_TYPE(mail_host) *hosts,
+				   buffer_t *records, struct user *user)
+{
+	struct mail_host *const *hostp;
+	unsigned int host_idx, count;
+	uint8_t hash[4];
+
+	hostp = array_get(hosts, &count);
+	for (host_idx = 0; host_idx < count; host_idx++) {
+		if (hostp[host_idx] == user->host)
+			break;
+	}
+	if (host_idx == count)
+		array_push_back(hosts, &user->host);
+
+	numpack_encode(records, (host_idx << 1) | (user->weak ? 1 : 0));
+	cpu32_to_be_unaligned(user->username_hash, hash);
+	buffer_append(records, hash, sizeof(hash));
+	numpack_encode(records, user->timestamp > ioloop_time ? 0 :
+		       ioloop_time - user->timestamp);
+}
+
 static int director_connection_send_users(struct director_connection *conn)
 {
 	struct user *user;
@@ -2219,20 +2360,49 @@ static int director_connection_send_users(struct director_connection *conn)
 	else
 		str_append(str, "USER\t");
 	size_t cmd_prefix_len = str_len(str);
-	while ((user = director_iterate_users_next(conn->user_iter)) != NULL) {
-		str_truncate(str, cmd_prefix_len);
-		str_append(str, dec2str_buf(dec_buf, user->username_hash));
-		str_append_c(str, '\t');
-		str_append(str, user->host->ip_str);
-		str_append_c(str, '\t');
-		str_append(str, dec2str_buf(dec_buf, user->timestamp));
-		if (user->weak)
-			str_append(str, "\tw");
-		str_append_c(str, '\n');
+	bool batch = director_connection_get_minor_version(conn) >=
+		DIRECTOR_VERSION_HANDSHAKE_USER_BATCH;
+	ARRAY_TYPE(mail_host) batch_hosts;
+	buffer_t *batch_records = NULL;
+	unsigned int batch_count = 0;
 
+	if (batch) {
+		t_array_init(&batch_hosts, 16);
+		batch_records = t_buffer_create(
+			DIRECTOR_HANDSHAKE_USER_BATCH_SIZE * 10);
+	}
+	while ((user = director_iterate_users_next(conn->user_iter)) != NULL) {
 		conn->handshake_users_sent++;
-		director_connection_send(conn, str_c(str));
-		if (++sent_count >= DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH) {
+		sent_count++;
+		if (batch) {
+			if (array_count(&batch_hosts) >=
+			    DIRECTOR_HANDSHAKE_USER_BATCH_MAX_HOSTS) {
+				director_connection_send_user_batch(conn,
+					&batch_hosts, batch_records);
+				batch_count = 0;
+			}
+			director_connection_add_user_batch(&batch_hosts,
+							   batch_records, user);
+			if (++batch_count < DIRECTOR_HANDSHAKE_USER_BATCH_SIZE &&
+			    sent_count < DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH)
+				continue;
+			director_connection_send_user_batch(conn,
+				&batch_hosts, batch_records);
+			batch_count = 0;
+		} else {
+			str_truncate(str, cmd_prefix_len);
+			str_append(str, dec2str_buf(dec_buf, user->username_hash));
+			str_append_c(str, '\t');
+			str_append(str, user->host->ip_str);
+			str_append_c(str, '\t');
+			str_append(str, dec2str_buf(dec_buf, user->timestamp));
+			if (user->weak)
+				str_append(str, "\tw");
+			str_append_c(str, '\n');
+			director_connection_send(conn, str_c(str));
+		}
+
+		if (sent_count >= DIRECTOR_HANDSHAKE_MAX_USERS_SENT_PER_FLUSH) {
 			/* Don't send too much at once to avoid hangs */
 			timeout_reset(conn->to_ping);
 			return 0;
@@ -2246,6 +2416,10 @@ static int director_connection_send_users(struct director_connection *conn)
 			}
 		}
 	}
+	if (batch) {
+		director_connection_send_user_batch(conn, &batch_hosts,
+						    batch_records);
+	}
 	director_iterate_users_deinit(&conn->user_iter);
 	if (director_connection_send_done(conn) < 0)
 		return -1;
@@ -76,6 +76,7 @@ static const struct setting_define director_setting_defines[] = {
 	DEF(TIME, director_user_kick_delay),
 	DEF(UINT, director_max_parallel_moves),
 	DEF(UINT, director_max_parallel_kicks),
+	DEF(UINT, director_host_load_factor),
 	DEF(SIZE, director_output_buffer_size),
 
 	SETTING_DEFINE_LIST_END
@@ -94,6 +95,7 @@ const struct director_settings director_default_settings = {
 	.director_user_kick_delay = 2,
 	.director_max_parallel_moves = 100,
 	.director_max_parallel_kicks = 100,
+	.director_host_load_factor = 0,
 	.director_output_buffer_size = 10 * 1024 * 1024,
 };
 
@@ -120,6 +122,11 @@ director_settings_verify(void *_set, pool_t pool ATTR_UNUSED, const char **error
 		*error_r = "director_user_expire is too low";
 		return FALSE;
 	}
+	if (set->director_host_load_factor != 0 &&
+	    set->director_host_load_factor < 100) {
+		*error_r = "director_host_load_factor must be 0 or at least 100";
+		return FALSE;
+	}
 	return TRUE;
 }
 /* </settings checks> */
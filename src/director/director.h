@@ -6,7 +6,7 @@
 
 #define DIRECTOR_VERSION_NAME "director"
 #define DIRECTOR_VERSION_MAJOR 1
-#define DIRECTOR_VERSION_MINOR 9
+#define DIRECTOR_VERSION_MINOR 10
 
 /* weak users supported in protocol */
 #define DIRECTOR_VERSION_WEAK_USERS 1
@@ -30,6 +30,8 @@
 #define DIRECTOR_VERSION_HANDSHAKE_U_CMD 9
 /* USER event with timestamp supported */
 #define DIRECTOR_VERSION_USER_TIMESTAMP 9
+/* Users are sent in batches as binary "UB" command in handshake */
+#define DIRECTOR_VERSION_HANDSHAKE_USER_BATCH 10
 
 /* Minimum time between even attempting to communicate with a director that
    failed due to a protocol error. */
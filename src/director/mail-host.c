@@ -51,30 +51,49 @@ mail_vhost_hash_cmp(const unsigned int *hash, const struct mail_vhost *vhost)
 		return 0;
 }
 
-static void mail_vhost_add(struct mail_tag *tag, struct mail_host *host)
+static void mail_host_update_vhost_hashes(struct mail_host *host)
 {
-	struct mail_vhost *vhost;
 	struct md5_context md5_ctx, md5_ctx2;
 	unsigned char md5[MD5_RESULTLEN];
 	char num_str[MAX_INT_STRLEN];
-	unsigned int i, j;
+	unsigned int i, j, hash;
 
-	if (host->down || host->tag != tag)
+	if (!array_is_created(&host->vhost_hashes))
+		i_array_init(&host->vhost_hashes, host->vhost_count);
+	if (array_count(&host->vhost_hashes) >= host->vhost_count)
 		return;
 
 	md5_init(&md5_ctx);
 	md5_update(&md5_ctx, host->ip_str, strlen(host->ip_str));
 
-	for (i = 0; i < host->vhost_count; i++) {
+	for (i = array_count(&host->vhost_hashes); i < host->vhost_count; i++) {
 		md5_ctx2 = md5_ctx;
 		i_snprintf(num_str, sizeof(num_str), "-%u", i);
 		md5_update(&md5_ctx2, num_str, strlen(num_str));
 		md5_final(&md5_ctx2, md5);
 
+		hash = 0;
+		for (j = 0; j < sizeof(hash); j++)
+			hash = (hash << CHAR_BIT) | md5[j];
+		array_push_back(&host->vhost_hashes, &hash);
+	}
+}
+
+static void mail_vhost_add(struct mail_tag *tag, struct mail_host *host)
+{
+	struct mail_vhost *vhost;
+	const unsigned int *hashes;
+	unsigned int i;
+
+	if (host->down || host->tag != tag)
+		return;
+
+	mail_host_update_vhost_hashes(host);
+	hashes = array_front(&host->vhost_hashes);
+	for (i = 0; i < host->vhost_count; i++) {
 		vhost = array_append_space(&tag->vhosts);
 		vhost->host = host;
-		for (j = 0; j < sizeof(vhost->hash); j++)
-			vhost->hash = (vhost->hash << CHAR_BIT) | md5[j];
+		vhost->hash = hashes[i];
 	}
 }
 
@@ -364,6 +383,7 @@ void mail_host_set_vhost_count(struct mail_host *host, unsigned int vhost_count,
 
 static void mail_host_free(struct mail_host *host)
 {
+	array_free(&host->vhost_hashes);
 	i_free(host->hostname);
 	i_free(host->ip_str);
 	i_free(host);
@@ -401,11 +421,27 @@ mail_host_lookup(struct mail_host_list *list, const struct ip_addr *ip)
 	return NULL;
 }
 
+static bool
+mail_host_is_overloaded(struct mail_tag *tag, const struct mail_host *host,
+			unsigned int load_factor)
+{
+	uint64_t users, vhosts, max_users;
+
+	/* The maximum is load_factor percent of the average load weighted by
+	   the host's vhost count, including the user about to be added. */
+	users = user_directory_count(tag->users) + 1;
+	vhosts = array_count(&tag->vhosts);
+	max_users = (users * load_factor * host->vhost_count +
+		     vhosts * 100 - 1) / (vhosts * 100);
+	return host->user_count >= max_users;
+}
+
 static struct mail_host *
-mail_host_get_by_hash_ring(struct mail_tag *tag, unsigned int hash)
+mail_host_get_by_hash_ring(struct mail_tag *tag, unsigned int hash,
+			   unsigned int load_factor)
 {
 	const struct mail_vhost *vhosts;
-	unsigned int count, idx;
+	unsigned int i, count, idx;
 
 	vhosts = array_get(&tag->vhosts, &count);
 	(void)array_bsearch_insert_pos(&tag->vhosts, &hash,
@@ -416,7 +452,22 @@ mail_host_get_by_hash_ring(struct mail_tag *tag, unsigned int hash)
 			return NULL;
 		idx = 0;
 	}
-	return vhosts[idx % count].host;
+	if (load_factor == 0)
+		return vhosts[idx].host;
+
+	/* Consistent hashing with bounded loads: use the first host in the
+	   ring that isn't already full. Removing or adding a host moves only
+	   the users whose position in the ring changes, and the ones that
+	   overflowed from full hosts. */
+	for (i = 0; i < count; i++) {
+		if (!mail_host_is_overloaded(tag, vhosts[idx].host,
+					     load_factor))
+			return vhosts[idx].host;
+		if (++idx == count)
+			idx = 0;
+	}
+	/* can't really happen, since not all hosts can be above average */
+	return vhosts[idx].host;
 }
 
 struct mail_host *
@@ -432,7 +483,8 @@ mail_host_get_by_hash(struct mail_host_list *list, unsigned int hash,
 	if (tag == NULL)
 		return NULL;
 
-	return mail_host_get_by_hash_ring(tag, hash);
+	return mail_host_get_by_hash_ring(tag, hash,
+		list->dir->set->director_host_load_factor);
 }
 
 void mail_hosts_set_synced(struct mail_host_list *list)
@@ -526,6 +578,7 @@ mail_host_dup(struct mail_host_list *dest_list, const struct mail_host *src)
 
 	dest = i_new(struct mail_host, 1);
 	*dest = *src;
+	i_zero(&dest->vhost_hashes);
 	dest->tag = mail_tag_get(dest_list, src->tag->name);
 	dest->ip_str = i_strdup(src->ip_str);
 	dest->hostname = i_strdup(src->hostname);
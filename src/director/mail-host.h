@@ -37,6 +37,10 @@ struct mail_host {
 	char *ip_str;
 	char *hostname;
 	struct mail_tag *tag;
+	/* Cached vhost hashes. The hash of each vhost depends only on the IP
+	   and the vhost's index, so they don't need to be recalculated when
+	   the ring changes. */
+	ARRAY(unsigned int) vhost_hashes;
 
 	/* host was recently changed and ring hasn't synced yet since */
 	bool desynced:1;
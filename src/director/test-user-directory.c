@@ -21,21 +21,19 @@ static void
 verify_user_directory(struct user_directory *dir, unsigned int user_count)
 {
 	struct user_directory_iter *iter;
-	struct user *user, *prev = NULL;
+	struct user *user;
 	unsigned int prev_stamp = 0, iter_count = 0;
 
 	iter = user_directory_iter_init(dir, FALSE);
 	while ((user = user_directory_iter_next(iter)) != NULL) {
 		test_assert(prev_stamp <= user->timestamp);
-		test_assert(user->prev == prev);
-		test_assert(prev == NULL || user->prev->next == user);
+		test_assert(user_directory_lookup(dir, user->username_hash) == user);
 
 		iter_count++;
-		prev = user;
 	}
-	test_assert(prev == NULL || prev->next == NULL);
 	user_directory_iter_deinit(&iter);
 	test_assert(iter_count == user_count);
+	test_assert(user_directory_count(dir) == user_count);
 }
 
 static void test_user_directory_ascending(void)
@@ -94,12 +92,63 @@ static void test_user_directory_random(void)
 	test_end();
 }
 
+static void test_user_directory_remove_host(void)
+{
+	const unsigned int count = 5000;
+	struct user_directory *dir;
+	struct mail_host *host1 = t_new(struct mail_host, 1);
+	struct mail_host *host2 = t_new(struct mail_host, 1);
+	struct user *user;
+	unsigned int i;
+
+	test_begin("user directory remove host");
+	dir = user_directory_init(NULL, USER_DIR_TIMEOUT, NULL);
+	for (i = 0; i < count; i++) {
+		unsigned int username_hash = i_rand();
+
+		if (user_directory_lookup(dir, username_hash) == NULL) {
+			(void)user_directory_add(dir, username_hash,
+						 i % 3 == 0 ? host1 : host2,
+						 ioloop_time - count + i);
+		}
+	}
+	/* add users with colliding index positions */
+	for (i = 0; i < count; i++) {
+		if (user_directory_lookup(dir, i << 16) == NULL) {
+			(void)user_directory_add(dir, i << 16,
+						 i % 2 == 0 ? host1 : host2,
+						 ioloop_time);
+		}
+	}
+	verify_user_directory(dir, host1->user_count + host2->user_count);
+
+	user_directory_remove_host(dir, host1);
+	test_assert(host1->user_count == 0);
+	verify_user_directory(dir, host2->user_count);
+
+	/* freed records are reused */
+	for (i = 0; i < count; i++) {
+		if (user_directory_lookup(dir, i << 16) == NULL) {
+			user = user_directory_add(dir, i << 16, host1,
+						  ioloop_time);
+			test_assert(user->host == host1);
+		}
+	}
+	verify_user_directory(dir, host1->user_count + host2->user_count);
+	user_directory_remove_host(dir, host2);
+	verify_user_directory(dir, host1->user_count);
+	user_directory_deinit(&dir);
+	test_assert(host1->user_count == 0);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_user_directory_ascending,
 		test_user_directory_descending,
 		test_user_directory_random,
+		test_user_directory_remove_host,
 		NULL
 	};
 	struct ioloop *ioloop = io_loop_create();
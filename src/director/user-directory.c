@@ -3,8 +3,6 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
-#include "hash.h"
-#include "llist.h"
 #include "mail-host.h"
 #include "director.h"
 
@@ -16,6 +14,14 @@
 /* This shouldn't matter what it is exactly, just try it sometimes later. */
 #define USER_BEING_KILLED_EXPIRE_RETRY_SECS 60
 
+/* Users are stored in fixed size blocks of records, so the records never
+   move and there's no per-user allocation overhead. */
+#define USER_BLOCK_SHIFT 10
+#define USER_BLOCK_COUNT (1U << USER_BLOCK_SHIFT)
+#define USER_IDX_NONE 0
+
+#define USER_INDEX_INITIAL_SIZE 64
+
 struct user_directory_iter {
 	struct user_directory *dir;
 	struct user *pos, *stop_after_tail;
@@ -24,10 +30,22 @@ struct user_directory_iter {
 struct user_directory {
 	struct director *director;
 
-	/* unsigned int username_hash => user */
-	HASH_TABLE(void *, struct user *) hash;
+	/* Blocks of USER_BLOCK_COUNT user records. The record index 0 is
+	   never used, so it can mean "none". */
+	ARRAY(struct user *) blocks;
+	/* Number of records used from the last block */
+	unsigned int last_block_used;
+	/* Freed records, linked via next_idx */
+	uint32_t free_head;
+
+	/* Open addressing hash of username_hash => record index, using
+	   linear probing. 0 = empty slot. */
+	uint32_t *index;
+	unsigned int index_size;
+	unsigned int users_count;
+
 	/* sorted by time. may be unsorted while handshakes are going on. */
-	struct user *head, *tail;
+	uint32_t head, tail;
 
 	ARRAY(struct user_directory_iter *) iters;
 	user_free_hook_t *user_free_hook;
@@ -42,22 +60,151 @@ struct user_directory {
 	bool sort_pending;
 };
 
+static inline struct user *
+user_idx(struct user_directory *dir, uint32_t idx)
+{
+	if (idx == USER_IDX_NONE)
+		return NULL;
+	return array_idx_elem(&dir->blocks, idx >> USER_BLOCK_SHIFT) +
+		(idx & (USER_BLOCK_COUNT - 1));
+}
+
+static uint32_t user_get_idx(struct user_directory *dir, struct user *user)
+{
+	/* the previous user (or the list head) points to this user */
+	return user->prev_idx == USER_IDX_NONE ? dir->head :
+		user_idx(dir, user->prev_idx)->next_idx;
+}
+
+static uint32_t user_record_alloc(struct user_directory *dir)
+{
+	struct user *block;
+	uint32_t idx;
+
+	if (dir->free_head != USER_IDX_NONE) {
+		idx = dir->free_head;
+		dir->free_head = user_idx(dir, idx)->next_idx;
+		i_zero(user_idx(dir, idx));
+		return idx;
+	}
+	if (array_count(&dir->blocks) == 0 ||
+	    dir->last_block_used == USER_BLOCK_COUNT) {
+		block = i_new(struct user, USER_BLOCK_COUNT);
+		array_push_back(&dir->blocks, &block);
+		/* skip the unused record index 0 */
+		dir->last_block_used = array_count(&dir->blocks) == 1 ? 1 : 0;
+	}
+	idx = ((array_count(&dir->blocks) - 1) << USER_BLOCK_SHIFT) +
+		dir->last_block_used++;
+	return idx;
+}
+
+static void user_record_free(struct user_directory *dir, uint32_t idx)
+{
+	struct user *user = user_idx(dir, idx);
+
+	i_zero(user);
+	user->next_idx = dir->free_head;
+	dir->free_head = idx;
+}
+
+static void user_list_append(struct user_directory *dir, uint32_t idx)
+{
+	struct user *user = user_idx(dir, idx);
+
+	user->prev_idx = dir->tail;
+	user->next_idx = USER_IDX_NONE;
+	if (dir->tail == USER_IDX_NONE)
+		dir->head = idx;
+	else
+		user_idx(dir, dir->tail)->next_idx = idx;
+	dir->tail = idx;
+}
+
+static void user_list_remove(struct user_directory *dir, struct user *user)
+{
+	if (user->prev_idx == USER_IDX_NONE)
+		dir->head = user->next_idx;
+	else
+		user_idx(dir, user->prev_idx)->next_idx = user->next_idx;
+	if (user->next_idx == USER_IDX_NONE)
+		dir->tail = user->prev_idx;
+	else
+		user_idx(dir, user->next_idx)->prev_idx = user->prev_idx;
+	user->prev_idx = user->next_idx = USER_IDX_NONE;
+}
+
+static unsigned int
+user_index_find_slot(struct user_directory *dir, unsigned int username_hash)
+{
+	unsigned int mask = dir->index_size - 1;
+	unsigned int slot = username_hash & mask;
+
+	while (dir->index[slot] != USER_IDX_NONE &&
+	       user_idx(dir, dir->index[slot])->username_hash != username_hash)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+static void user_index_resize(struct user_directory *dir)
+{
+	uint32_t *old_index = dir->index;
+	unsigned int i, old_size = dir->index_size;
+
+	dir->index_size = old_size * 2;
+	dir->index = i_new(uint32_t, dir->index_size);
+	for (i = 0; i < old_size; i++) {
+		if (old_index[i] == USER_IDX_NONE)
+			continue;
+		struct user *user = user_idx(dir, old_index[i]);
+		dir->index[user_index_find_slot(dir, user->username_hash)] =
+			old_index[i];
+	}
+	i_free(old_index);
+}
+
+static void user_index_remove(struct user_directory *dir, struct user *user)
+{
+	unsigned int mask = dir->index_size - 1;
+	unsigned int slot, next, wanted;
+
+	slot = user_index_find_slot(dir, user->username_hash);
+	i_assert(dir->index[slot] != USER_IDX_NONE);
+	dir->index[slot] = USER_IDX_NONE;
+
+	/* move the following entries of the probe sequence back, so that
+	   lookups don't stop at the emptied slot */
+	for (next = (slot + 1) & mask; dir->index[next] != USER_IDX_NONE;
+	     next = (next + 1) & mask) {
+		wanted = user_idx(dir, dir->index[next])->username_hash & mask;
+		if (((next - wanted) & mask) >= ((next - slot) & mask)) {
+			dir->index[slot] = dir->index[next];
+			dir->index[next] = USER_IDX_NONE;
+			slot = next;
+		}
+	}
+}
+
 static void user_move_iters(struct user_directory *dir, struct user *user)
 {
 	struct user_directory_iter *iter;
 
 	array_foreach_elem(&dir->iters, iter) {
 		if (iter->pos == user)
-			iter->pos = user->next;
+			iter->pos = user_idx(dir, user->next_idx);
 		if (iter->stop_after_tail == user) {
 			iter->stop_after_tail =
-				user->prev != NULL ? user->prev : user->next;
+				user->prev_idx != USER_IDX_NONE ?
+				user_idx(dir, user->prev_idx) :
+				user_idx(dir, user->next_idx);
 		}
 	}
 }
 
 static void user_free(struct user_directory *dir, struct user *user)
 {
+	uint32_t idx = user_get_idx(dir, user);
+
 	i_assert(user->host->user_count > 0);
 	user->host->user_count--;
 
@@ -65,9 +212,11 @@ static void user_free(struct user_directory *dir, struct user *user)
 		dir->user_free_hook(user);
 	user_move_iters(dir, user);
 
-	hash_table_remove(dir->hash, POINTER_CAST(user->username_hash));
-	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
-	i_free(user);
+	user_index_remove(dir, user);
+	i_assert(dir->users_count > 0);
+	dir->users_count--;
+	user_list_remove(dir, user);
+	user_record_free(dir, idx);
 }
 
 static bool user_directory_user_has_connections(struct user_directory *dir,
@@ -106,9 +255,10 @@ static void user_directory_drop_expired(struct user_directory *dir)
 {
 	time_t expire_timestamp = 0;
 
-	while (dir->head != NULL &&
-	       !user_directory_user_has_connections(dir, dir->head, &expire_timestamp)) {
-		user_free(dir, dir->head);
+	while (dir->head != USER_IDX_NONE &&
+	       !user_directory_user_has_connections(dir,
+			user_idx(dir, dir->head), &expire_timestamp)) {
+		user_free(dir, user_idx(dir, dir->head));
 		expire_timestamp = 0;
 	}
 	i_assert(expire_timestamp > ioloop_time || expire_timestamp == 0);
@@ -126,7 +276,7 @@ static void user_directory_drop_expired(struct user_directory *dir)
 
 unsigned int user_directory_count(struct user_directory *dir)
 {
-	return hash_table_count(dir->hash);
+	return dir->users_count;
 }
 
 struct user *user_directory_lookup(struct user_directory *dir,
@@ -136,7 +286,7 @@ struct user *user_directory_lookup(struct user_directory *dir,
 	time_t expire_timestamp;
 
 	user_directory_drop_expired(dir);
-	user = hash_table_lookup(dir->hash, POINTER_CAST(username_hash));
+	user = user_idx(dir, dir->index[user_index_find_slot(dir, username_hash)]);
 	if (user != NULL && !user_directory_user_has_connections(dir, user, &expire_timestamp)) {
 		user_free(dir, user);
 		user = NULL;
@@ -149,34 +299,44 @@ user_directory_add(struct user_directory *dir, unsigned int username_hash,
 		   struct mail_host *host, time_t timestamp)
 {
 	struct user *user;
+	uint32_t idx;
 
 	/* make sure we don't add timestamps higher than ioloop time */
 	if (timestamp > ioloop_time)
 		timestamp = ioloop_time;
 
-	user = i_new(struct user, 1);
+	if ((dir->users_count + 1) * 2 > dir->index_size)
+		user_index_resize(dir);
+
+	idx = user_record_alloc(dir);
+	user = user_idx(dir, idx);
 	user->username_hash = username_hash;
 	user->host = host;
 	user->host->user_count++;
 	user->timestamp = timestamp;
-	DLLIST2_APPEND(&dir->head, &dir->tail, user);
+	user_list_append(dir, idx);
 
 	if (dir->to_expire == NULL) {
 		struct timeval tv = { .tv_sec = ioloop_time + dir->timeout_secs };
 		dir->to_expire_timestamp = tv.tv_sec;
 		dir->to_expire = timeout_add_absolute(&tv, user_directory_drop_expired, dir);
 	}
-	hash_table_insert(dir->hash, POINTER_CAST(user->username_hash), user);
+	unsigned int slot = user_index_find_slot(dir, username_hash);
+	i_assert(dir->index[slot] == USER_IDX_NONE);
+	dir->index[slot] = idx;
+	dir->users_count++;
 	return user;
 }
 
 void user_directory_refresh(struct user_directory *dir, struct user *user)
 {
+	uint32_t idx = user_get_idx(dir, user);
+
 	user_move_iters(dir, user);
 
 	user->timestamp = ioloop_time;
-	DLLIST2_REMOVE(&dir->head, &dir->tail, user);
-	DLLIST2_APPEND(&dir->head, &dir->tail, user);
+	user_list_remove(dir, user);
+	user_list_append(dir, idx);
 }
 
 void user_directory_remove_host(struct user_directory *dir,
@@ -184,34 +344,38 @@ void user_directory_remove_host(struct user_directory *dir,
 {
 	struct user *user, *next;
 
-	for (user = dir->head; user != NULL; user = next) {
-		next = user->next;
+	for (user = user_idx(dir, dir->head); user != NULL; user = next) {
+		next = user_idx(dir, user->next_idx);
 
 		if (user->host == host)
 			user_free(dir, user);
 	}
 }
 
-static int user_timestamp_cmp(struct user *const *user1,
-			      struct user *const *user2)
+static struct user_directory *user_sort_dir;
+
+static int user_timestamp_cmp(const uint32_t *idx1, const uint32_t *idx2)
 {
-	if ((*user1)->timestamp < (*user2)->timestamp)
+	const struct user *user1 = user_idx(user_sort_dir, *idx1);
+	const struct user *user2 = user_idx(user_sort_dir, *idx2);
+
+	if (user1->timestamp < user2->timestamp)
 		return -1;
-	if ((*user1)->timestamp > (*user2)->timestamp)
+	if (user1->timestamp > user2->timestamp)
 		return 1;
 	return 0;
 }
 
 void user_directory_sort(struct user_directory *dir)
 {
-	ARRAY(struct user *) users;
-	struct user *user;
-	unsigned int i, users_count = hash_table_count(dir->hash);
+	ARRAY(uint32_t) users;
+	uint32_t idx;
+	unsigned int i, users_count = dir->users_count;
 
 	dir->sort_pending = FALSE;
 
 	if (users_count == 0) {
-		i_assert(dir->head == NULL);
+		i_assert(dir->head == USER_IDX_NONE);
 		return;
 	}
 
@@ -225,18 +389,23 @@ void user_directory_sort(struct user_directory *dir)
 
 	/* place all users into array and sort it */
 	i_array_init(&users, users_count);
-	user = dir->head;
-	for (i = 0; i < users_count; i++, user = user->next)
-		array_push_back(&users, &user);
-	i_assert(user == NULL);
+	idx = dir->head;
+	for (i = 0; i < users_count; i++) {
+		array_push_back(&users, &idx);
+		idx = user_idx(dir, idx)->next_idx;
+	}
+	i_assert(idx == USER_IDX_NONE);
+	user_sort_dir = dir;
 	array_sort(&users, user_timestamp_cmp);
+	user_sort_dir = NULL;
 
 	/* recreate the linked list */
-	dir->head = dir->tail = NULL;
-	array_foreach_elem(&users, user)
-		DLLIST2_APPEND(&dir->head, &dir->tail, user);
-	i_assert(dir->head != NULL &&
-		 dir->head->timestamp <= dir->tail->timestamp);
+	dir->head = dir->tail = USER_IDX_NONE;
+	array_foreach_elem(&users, idx)
+		user_list_append(dir, idx);
+	i_assert(dir->head != USER_IDX_NONE &&
+		 user_idx(dir, dir->head)->timestamp <=
+		 user_idx(dir, dir->tail)->timestamp);
 	array_free(&users);
 }
 
@@ -276,7 +445,9 @@ user_directory_init(struct director *director, unsigned int timeout_secs,
 	i_assert(dir->timeout_secs/2 > dir->user_near_expiring_secs);
 
 	dir->user_free_hook = user_free_hook;
-	hash_table_create_direct(&dir->hash, default_pool, 0);
+	i_array_init(&dir->blocks, 8);
+	dir->index_size = USER_INDEX_INITIAL_SIZE;
+	dir->index = i_new(uint32_t, dir->index_size);
 	i_array_init(&dir->iters, 8);
 	return dir;
 }
@@ -289,10 +460,15 @@ void user_directory_deinit(struct user_directory **_dir)
 
 	i_assert(array_count(&dir->iters) == 0);
 
-	while (dir->head != NULL)
-		user_free(dir, dir->head);
+	struct user *block;
+
+	while (dir->head != USER_IDX_NONE)
+		user_free(dir, user_idx(dir, dir->head));
 	timeout_remove(&dir->to_expire);
-	hash_table_destroy(&dir->hash);
+	array_foreach_elem(&dir->blocks, block)
+		i_free(block);
+	array_free(&dir->blocks);
+	i_free(dir->index);
 	array_free(&dir->iters);
 	i_free(dir);
 }
@@ -305,8 +481,9 @@ user_directory_iter_init(struct user_directory *dir,
 
 	iter = i_new(struct user_directory_iter, 1);
 	iter->dir = dir;
-	iter->pos = dir->head;
-	iter->stop_after_tail = iter_until_current_tail ? dir->tail : NULL;
+	iter->pos = user_idx(dir, dir->head);
+	iter->stop_after_tail = iter_until_current_tail ?
+		user_idx(dir, dir->tail) : NULL;
 	array_push_back(&dir->iters, &iter);
 	user_directory_drop_expired(dir);
 	return iter;
@@ -320,7 +497,7 @@ struct user *user_directory_iter_next(struct user_directory_iter *iter)
 	if (user == NULL)
 		return NULL;
 
-	iter->pos = user->next;
+	iter->pos = user_idx(iter->dir, user->next_idx);
 	if (user == iter->stop_after_tail) {
 		/* this is the last user we want to iterate */
 		iter->pos = NULL;
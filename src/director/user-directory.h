@@ -9,8 +9,9 @@ struct director;
 struct user {
 	/* Approximately sorted by time (except during handshaking).
 	   The sorting order may be constantly wrong a few seconds here and
-	   there. */
-	struct user *prev, *next;
+	   there. These are indexes to the user directory's record blocks,
+	   0 means none. Use the iterators instead of accessing these. */
+	uint32_t prev_idx, next_idx;
 
 	/* first 32 bits of MD5(username). collisions are quite unlikely, but
 	   even if they happen it doesn't matter - the users are just
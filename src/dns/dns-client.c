@@ -8,22 +8,66 @@
 #include "connection.h"
 #include "restrict-access.h"
 #include "master-service.h"
+#include "dns-cache.h"
 
 #include <unistd.h>
 
+/* getaddrinfo() doesn't return the TTLs, so keep the results only for a
+   short time. This is mainly to avoid repeating the same lookups for
+   proxies and auth reverse lookups in a busy server. */
+#define DNS_CLIENT_CACHE_TTL_SECS 10
+#define DNS_CLIENT_CACHE_MAX_ENTRIES 1000
+
 static struct event_category event_category_dns = {
 	.name = "dns-worker"
 };
 
 static struct connection_list *dns_clients = NULL;
+static struct dns_cache *dns_cache = NULL;
 
-static int dns_client_input_args(struct connection *client, const char *const *args)
+static void
+dns_client_resolve_ip(const char *host, struct dns_lookup_result *result_r)
+{
+	struct ip_addr *ips;
+	unsigned int ips_count;
+	int ret;
+
+	i_zero(result_r);
+	ret = net_gethostbyname(host, &ips, &ips_count);
+	if (ret == 0 && ips_count == 0) {
+		/* shouldn't happen, but fix it anyway.. */
+		ret = EAI_NONAME;
+	}
+	result_r->ret = ret;
+	if (ret != 0)
+		result_r->error = net_gethosterror(ret);
+	else {
+		result_r->ips = ips;
+		result_r->ips_count = ips_count;
+	}
+}
+
+static void
+dns_client_resolve_name(const struct ip_addr *ip,
+			struct dns_lookup_result *result_r)
 {
-	struct ip_addr *ips, ip;
 	const char *name;
-	struct event *event;
-	unsigned int i, ips_count;
 	int ret;
+
+	i_zero(result_r);
+	ret = net_gethostbyaddr(ip, &name);
+	result_r->ret = ret;
+	if (ret != 0)
+		result_r->error = net_gethosterror(ret);
+	else
+		result_r->name = name;
+}
+
+static int dns_client_input_args(struct connection *client, const char *const *args)
+{
+	struct ip_addr ip;
+	struct event *event;
+	unsigned int i;
 	struct event_passthrough *e;
 
 	if (strcmp(args[0], "QUIT") == 0) {
@@ -46,27 +90,32 @@ static int dns_client_input_args(struct connection *client, const char *const *a
 		add_str("name", args[1]);
 
 	if (strcmp(args[0], "IP") == 0) {
-		ret = net_gethostbyname(args[1], &ips, &ips_count);
-		if (ret == 0 && ips_count == 0) {
-			/* shouldn't happen, but fix it anyway.. */
-			ret = EAI_NONAME;
+		struct dns_lookup_result result;
+
+		if (dns_cache_lookup(dns_cache, FALSE, args[1],
+				     pool_datastack_create(), &result))
+			e->add_str("cached", "yes");
+		else {
+			dns_client_resolve_ip(args[1], &result);
+			dns_cache_add(dns_cache, FALSE, args[1], &result,
+				      DNS_CLIENT_CACHE_TTL_SECS);
 		}
 		/* update timestamp after hostname lookup so the event duration
 		   field gets set correctly */
 		io_loop_time_refresh();
-		if (ret != 0) {
-			const char *err = net_gethosterror(ret);
-			e->add_int("error_code", ret);
-			e->add_str("error", err);
-			e_debug(e->event(), "Resolve failed: %s", err);
+		if (result.ret != 0) {
+			e->add_int("error_code", result.ret);
+			e->add_str("error", result.error);
+			e_debug(e->event(), "Resolve failed: %s", result.error);
 			o_stream_nsend_str(client->output,
-				t_strdup_printf("%d\t%s\n", ret, err));
+				t_strdup_printf("%d\t%s\n", result.ret,
+						result.error));
 		} else {
 			ARRAY_TYPE(const_string) tmp;
-			t_array_init(&tmp, ips_count);
+			t_array_init(&tmp, result.ips_count);
 			o_stream_nsend_str(client->output, "0\t");
-			for (i = 0; i < ips_count; i++) {
-				const char *ip = net_ip2addr(&ips[i]);
+			for (i = 0; i < result.ips_count; i++) {
+				const char *ip = net_ip2addr(&result.ips[i]);
 				array_push_back(&tmp, &ip);
 			}
 			array_append_zero(&tmp);
@@ -77,22 +126,36 @@ static int dns_client_input_args(struct connection *client, const char *const *a
 			o_stream_nsend_str(client->output, "\n");
 		}
 	} else if (strcmp(args[0], "NAME") == 0) {
+		struct dns_lookup_result result;
+
 		if (net_addr2ip(args[1], &ip) < 0) {
 			e->add_int("error_code", EAI_FAIL);
 			e->add_str("error", "Not an IP");
 			e_debug(e->event(), "Resolve failed: Not an IP");
 			o_stream_nsend_str(client->output, "-1\tNot an IP\n");
-		} else if ((ret = net_gethostbyaddr(&ip, &name)) != 0) {
-			const char *err = net_gethosterror(ret);
-			e->add_int("error_code", ret);
-			e->add_str("error", err);
-			e_debug(e->event(), "Resolve failed: %s", err);
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("%d\t%s\n", ret, err));
 		} else {
-			e_debug(e->event(), "Resolve success: %s", name);
-			o_stream_nsend_str(client->output,
-				t_strdup_printf("0\t%s\n", name));
+			if (dns_cache_lookup(dns_cache, TRUE, args[1],
+					     pool_datastack_create(), &result))
+				e->add_str("cached", "yes");
+			else {
+				dns_client_resolve_name(&ip, &result);
+				dns_cache_add(dns_cache, TRUE, args[1], &result,
+					      DNS_CLIENT_CACHE_TTL_SECS);
+			}
+			if (result.ret != 0) {
+				e->add_int("error_code", result.ret);
+				e->add_str("error", result.error);
+				e_debug(e->event(), "Resolve failed: %s",
+					result.error);
+				o_stream_nsend_str(client->output,
+					t_strdup_printf("%d\t%s\n", result.ret,
+							result.error));
+			} else {
+				e_debug(e->event(), "Resolve success: %s",
+					result.name);
+				o_stream_nsend_str(client->output,
+					t_strdup_printf("0\t%s\n", result.name));
+			}
 		}
 	} else {
 		e->add_str("error", "Unknown command");
@@ -149,12 +212,14 @@ int main(int argc, char *argv[])
 
 	/* setup connection list */
 	dns_clients = connection_list_init(&dns_client_set, &dns_client_vfuncs);
+	dns_cache = dns_cache_init(DNS_CLIENT_CACHE_MAX_ENTRIES);
 
 	master_service_init_finish(master_service);
 	master_service_run(master_service, client_connected);
 
 	/* disconnect all clients */
 	connection_list_deinit(&dns_clients);
+	dns_cache_deinit(&dns_cache);
 
 	master_service_deinit(&master_service);
         return 0;
@@ -67,6 +67,10 @@ struct client_request_http {
 	char *method_id;
 	bool first_row;
 	bool value_is_array;
+	/* response is being sent while the commands are executed */
+	bool streaming;
+	/* request was found to be invalid after streaming had started */
+	bool stream_failed;
 
 	enum client_request_parse_state parse_state;
 };
@@ -167,6 +171,61 @@ static void doveadm_http_server_json_success(void *context, struct istream *resu
 	o_stream_nsend_str(output, "\"]");
 }
 
+static void ATTR_FORMAT(2, 3)
+doveadm_http_server_request_fail_text(struct client_request_http *req,
+				      const char *format, ...)
+{
+	const char *error;
+	va_list args;
+
+	va_start(args, format);
+	error = t_strdup_vprintf(format, args);
+	va_end(args);
+
+	if (!req->streaming) {
+		http_server_request_fail_text(req->http_request,
+			400, "Bad Request", "%s", error);
+		return;
+	}
+	/* the results of the earlier commands have already been sent, so
+	   the error can only be reported within the response */
+	i_info("Invalid request: %s", error);
+	req->stream_failed = TRUE;
+}
+
+static void
+doveadm_http_server_stream_response(struct client_request_http *req)
+{
+	struct http_server_response *http_resp;
+	struct ostream *output;
+	struct istream *input;
+
+	if (req->streaming)
+		return;
+
+	/* Start sending the response, so the client gets each command's
+	   result as soon as it's finished instead of only after all of them.
+	   The payload output is blocking, so the commands won't get
+	   executed faster than the client reads the results. */
+	http_resp = http_server_response_create(req->http_request, 200, "OK");
+	http_server_response_add_header(http_resp, "Content-Type",
+		"application/json; charset=utf-8");
+	output = http_server_response_get_payload_output(http_resp,
+							 IO_BLOCK_SIZE, TRUE);
+
+	/* send what was already written */
+	if (o_stream_finish(req->output) < 0) {
+		i_info("error writing output: %s",
+		       o_stream_get_error(req->output));
+	}
+	input = iostream_temp_finish(&req->output, IO_BLOCK_SIZE);
+	o_stream_nsend_istream(output, input);
+	i_stream_unref(&input);
+
+	req->output = output;
+	req->streaming = TRUE;
+}
+
 static void
 doveadm_http_server_command_execute(struct client_request_http *req)
 {
@@ -240,6 +299,7 @@ doveadm_http_server_command_execute(struct client_request_http *req)
 
 	is = iostream_temp_finish(&doveadm_print_ostream, 4096);
 
+	doveadm_http_server_stream_response(req);
 	if (req->first_row == TRUE)
 		req->first_row = FALSE;
 	else
@@ -258,7 +318,6 @@ doveadm_http_server_command_execute(struct client_request_http *req)
 static int
 request_json_parse_init(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -267,8 +326,7 @@ request_json_parse_init(struct client_request_http *req)
 		return ret;
 	if (type != JSON_TYPE_ARRAY) {
 		/* request must be a JSON array */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Request must be a JSON array");
 		return -1;
 	}
@@ -283,7 +341,6 @@ request_json_parse_init(struct client_request_http *req)
 static int
 request_json_parse_cmd(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -297,8 +354,7 @@ request_json_parse_cmd(struct client_request_http *req)
 	}
 	if (type != JSON_TYPE_ARRAY) {
 		/* command must be an array */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Command must be a JSON array");
 		return -1;
 	}
@@ -315,7 +371,6 @@ request_json_parse_cmd(struct client_request_http *req)
 static int
 request_json_parse_cmd_name(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	const struct doveadm_cmd_ver2 *ccmd;
@@ -327,8 +382,7 @@ request_json_parse_cmd_name(struct client_request_http *req)
 		return ret;
 	if (type != JSON_TYPE_STRING) {
 		/* command name must be a string */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Command name must be a string");
 		return -1;
 	}
@@ -365,7 +419,6 @@ request_json_parse_cmd_name(struct client_request_http *req)
 static int
 request_json_parse_cmd_params(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -379,8 +432,7 @@ request_json_parse_cmd_params(struct client_request_http *req)
 	}
 	if (type != JSON_TYPE_OBJECT) {
 		/* parameters must be contained in an object */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Parameters must be contained in a JSON object");
 		return -1;
 	}
@@ -393,7 +445,6 @@ request_json_parse_cmd_params(struct client_request_http *req)
 static int
 request_json_parse_cmd_param_key(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	struct doveadm_cmd_param *par;
@@ -419,8 +470,7 @@ request_json_parse_cmd_param_key(struct client_request_http *req)
 	}
 	if (found && req->cmd_param->value_set) {
 		/* it's already set, cannot have same key twice in json */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Parameter `%s' is duplicated",
 			req->cmd_param->name);
 		return -1;
@@ -442,7 +492,6 @@ request_json_parse_cmd_param_key(struct client_request_http *req)
 static int
 request_json_parse_param_value(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -484,8 +533,7 @@ request_json_parse_param_value(struct client_request_http *req)
 		/* singular value */
 		if (type != JSON_TYPE_STRING) {
 			/* FIXME: should handle other than string too */
-			http_server_request_fail_text(http_sreq,
-				400, "Bad Request",
+			doveadm_http_server_request_fail_text(req,
 				"Parameter `%s' must be string or array",
 				req->cmd_param->name);
 			return -1;
@@ -529,7 +577,6 @@ request_json_parse_param_value(struct client_request_http *req)
 static int
 request_json_parse_param_array(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -543,8 +590,7 @@ request_json_parse_param_array(struct client_request_http *req)
 	}
 	if (type != JSON_TYPE_STRING) {
 		/* array items must be string */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Command parameter array can only contain"
 			"string values");
 		return -1;
@@ -561,7 +607,6 @@ request_json_parse_param_array(struct client_request_http *req)
 static int
 request_json_parse_param_istream(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	struct istream *v_input = req->cmd_param->value.v_istream;
 	const unsigned char *data;
 	size_t size;
@@ -579,8 +624,7 @@ request_json_parse_param_istream(struct client_request_http *req)
 			i_stream_get_error(v_input));
 		req->method_err = 400;
 		if (req->input->stream_errno == 0) {
-			http_server_request_fail_text(http_sreq,
-				400, "Bad Request",
+			doveadm_http_server_request_fail_text(req,
 				"Failed to read command parameter data");
 		}
 		return -1;
@@ -594,7 +638,6 @@ request_json_parse_param_istream(struct client_request_http *req)
 static int
 request_json_parse_cmd_id(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -603,8 +646,7 @@ request_json_parse_cmd_id(struct client_request_http *req)
 		return ret;
 	if (type != JSON_TYPE_STRING) {
 		/* command ID must be a string */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Command ID must be a string");
 		return -1;
 	}
@@ -618,7 +660,6 @@ request_json_parse_cmd_id(struct client_request_http *req)
 static int
 request_json_parse_cmd_done(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -627,8 +668,7 @@ request_json_parse_cmd_done(struct client_request_http *req)
 		return ret;
 	if (type != JSON_TYPE_ARRAY_END) {
 		/* command array must end here */
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"Unexpected JSON element at end of command");
 		return -1;
 	}
@@ -644,7 +684,6 @@ request_json_parse_cmd_done(struct client_request_http *req)
 static int
 request_json_parse_done(struct client_request_http *req)
 {
-	struct http_server_request *http_sreq = req->http_request;
 	enum json_type type;
 	const char *value;
 	int ret;
@@ -652,8 +691,7 @@ request_json_parse_done(struct client_request_http *req)
 	if ((ret=json_parse_next(req->json_parser, &type, &value)) <= 0)
 		return ret;
 	/* only gets here when there is spurious additional JSON */
-	http_server_request_fail_text(http_sreq,
-		400, "Bad Request",
+	doveadm_http_server_request_fail_text(req,
 		"Unexpected JSON element in input");
 	return -1;
 }
@@ -702,6 +740,18 @@ doveadm_http_server_json_parse_v1(struct client_request_http *req)
 	i_unreached();
 }
 
+static void
+doveadm_http_server_stream_failed(struct client_request_http *req)
+{
+	/* finish the partially sent response with an error */
+	i_stream_destroy(&req->input);
+	if (!req->first_row)
+		o_stream_nsend_str(req->output, ",");
+	doveadm_http_server_json_error(req, "invalidRequest");
+	o_stream_nsend_str(req->output, "]");
+	doveadm_http_server_send_response(req);
+}
+
 static void
 doveadm_http_server_read_request_v1(struct client_request_http *req)
 {
@@ -716,31 +766,45 @@ doveadm_http_server_read_request_v1(struct client_request_http *req)
 
 	while ((ret=doveadm_http_server_json_parse_v1(req)) > 0);
 
-	if (http_server_request_get_response(http_sreq) != NULL) {
+	if (!req->streaming &&
+	    http_server_request_get_response(http_sreq) != NULL) {
 		/* already responded */
 		io_remove(&req->io);
 		i_stream_destroy(&req->input);
 		return;
 	}
-	if (!req->input->eof && ret == 0)
+	if (!req->stream_failed && !req->input->eof && ret == 0)
 		return;
 	io_remove(&req->io);
 
 	doveadm_cmd_params_clean(&req->pargv);
 
+	if (req->stream_failed) {
+		doveadm_http_server_stream_failed(req);
+		return;
+	}
+
 	if (req->input->stream_errno != 0) {
-		http_server_request_fail_close(http_sreq,
-			400, "Client disconnected");
 		i_info("read(%s) failed: %s",
 		       i_stream_get_name(req->input),
 		       i_stream_get_error(req->input));
+		if (req->streaming) {
+			/* the client is gone, so there's no point in
+			   finishing the response */
+			o_stream_abort(req->output);
+			i_stream_destroy(&req->input);
+			return;
+		}
+		http_server_request_fail_close(http_sreq,
+			400, "Client disconnected");
 		return;
 	}
 
 	if (json_parser_deinit(&req->json_parser, &error) != 0) {
-		http_server_request_fail_text(http_sreq,
-			400, "Bad Request",
+		doveadm_http_server_request_fail_text(req,
 			"JSON parse error: %s", error);
+		if (req->stream_failed)
+			doveadm_http_server_stream_failed(req);
 		return;
 	}
 
@@ -891,6 +955,20 @@ static void doveadm_http_server_send_response(struct client_request_http *req)
 	struct http_server_response *http_resp;
 	struct istream *payload = NULL;
 
+	if (req->streaming) {
+		struct ostream *output = req->output;
+
+		/* The request may get destroyed once the payload is
+		   finished, so don't access it afterwards. */
+		o_stream_ref(output);
+		if (o_stream_finish(output) < 0) {
+			i_info("error writing output: %s",
+			       o_stream_get_error(output));
+		}
+		o_stream_unref(&output);
+		return;
+	}
+
 	if (req->output != NULL) {
 		if (o_stream_finish(req->output) == -1) {
 			i_info("error writing output: %s",
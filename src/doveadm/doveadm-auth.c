@@ -59,36 +59,25 @@ doveadm_get_auth_master_conn(const char *auth_socket_path)
 }
 
 static int
-cmd_user_input(struct auth_master_connection *conn,
-	       const struct authtest_input *input,
-	       const char *show_field, bool userdb)
+cmd_user_input_print(const char *username, int ret,
+		     const char *updated_username, const char *const *fields,
+		     const char *show_field, bool userdb)
 {
 	const char *lookup_name = userdb ? "userdb lookup" : "passdb lookup";
-	pool_t pool;
-	const char *updated_username = NULL, *const *fields, *p;
-	int ret;
-
-	pool = pool_alloconly_create("auth master lookup", 1024);
+	const char *p;
 
-	if (userdb) {
-		ret = auth_master_user_lookup(conn, input->username, &input->info,
-					      pool, &updated_username, &fields);
-	} else {
-		ret = auth_master_pass_lookup(conn, input->username, &input->info,
-					      pool, &fields);
-	}
 	if (ret < 0) {
 		if (fields[0] == NULL)
-			i_error("%s failed for %s", lookup_name, input->username);
+			i_error("%s failed for %s", lookup_name, username);
 		else {
 			i_error("%s failed for %s: %s", lookup_name,
-				input->username, fields[0]);
+				username, fields[0]);
 		}
 		ret = -1;
 	} else if (ret == 0) {
 		fprintf(show_field == NULL ? stdout : stderr,
 			"%s: user %s doesn't exist\n", lookup_name,
-			input->username);
+			username);
 	} else if (show_field != NULL) {
 		size_t show_field_len = strlen(show_field);
 
@@ -98,7 +87,7 @@ cmd_user_input(struct auth_master_connection *conn,
 				printf("%s\n", *fields + show_field_len + 1);
 		}
 	} else {
-		printf("%s: %s\n", userdb ? "userdb" : "passdb", input->username);
+		printf("%s: %s\n", userdb ? "userdb" : "passdb", username);
 
 		if (updated_username != NULL)
 			printf("  %-10s: %s\n", "user", updated_username);
@@ -112,10 +101,64 @@ cmd_user_input(struct auth_master_connection *conn,
 			}
 		}
 	}
+	return ret;
+}
+
+static int
+cmd_user_input(struct auth_master_connection *conn,
+	       const struct authtest_input *input,
+	       const char *show_field, bool userdb)
+{
+	pool_t pool;
+	const char *updated_username = NULL, *const *fields;
+	int ret;
+
+	pool = pool_alloconly_create("auth master lookup", 1024);
+
+	if (userdb) {
+		ret = auth_master_user_lookup(conn, input->username, &input->info,
+					      pool, &updated_username, &fields);
+	} else {
+		ret = auth_master_pass_lookup(conn, input->username, &input->info,
+					      pool, &fields);
+	}
+	ret = cmd_user_input_print(input->username, ret, updated_username,
+				   fields, show_field, userdb);
 	pool_unref(&pool);
 	return ret;
 }
 
+static void
+cmd_user_input_multi(struct auth_master_connection *conn,
+		     const struct authtest_input *input,
+		     const char *const *users, const char *show_field)
+{
+	struct auth_master_user_lookup_result *results;
+	unsigned int i;
+	pool_t pool;
+	int ret;
+
+	pool = pool_alloconly_create("auth master multi lookup", 1024);
+	auth_master_user_lookup_multi(conn, users, &input->info,
+				      pool, &results);
+	for (i = 0; results[i].user != NULL; i++) {
+		if (i > 0)
+			putchar('\n');
+		ret = cmd_user_input_print(results[i].user, results[i].ret,
+					   results[i].username,
+					   results[i].fields, show_field, TRUE);
+		switch (ret) {
+		case -1:
+			doveadm_exit_code = EX_TEMPFAIL;
+			break;
+		case 0:
+			doveadm_exit_code = EX_NOUSER;
+			break;
+		}
+	}
+	pool_unref(&pool);
+}
+
 static void
 auth_callback(struct auth_client_request *request ATTR_UNUSED,
 	      enum auth_request_status status,
@@ -663,6 +706,12 @@ static void cmd_user(struct doveadm_cmd_context *cctx)
 		auth_master_deinit(&conn);
 		return;
 	}
+	if (userdb_only && user_masks[1] != NULL) {
+		/* pipeline the lookups instead of doing them one by one */
+		cmd_user_input_multi(conn, &input, user_masks, show_field);
+		auth_master_deinit(&conn);
+		return;
+	}
 
 	if (!userdb_only) {
 		storage_service = mail_storage_service_init(master_service, NULL,
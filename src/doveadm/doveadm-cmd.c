@@ -19,6 +19,7 @@ static struct doveadm_cmd_ver2 *doveadm_commands_ver2[] = {
 	&doveadm_cmd_sis_deduplicate,
 	&doveadm_cmd_sis_find,
 	&doveadm_cmd_process_status_ver2,
+	&doveadm_cmd_process_profile_ver2,
 	&doveadm_cmd_stop_ver2,
 	&doveadm_cmd_reload_ver2,
 	&doveadm_cmd_stats_dump_ver2,
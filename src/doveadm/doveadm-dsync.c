@@ -16,6 +16,7 @@
 #include "process-title.h"
 #include "settings-parser.h"
 #include "imap-util.h"
+#include "compression.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "master-service-ssl-settings.h"
@@ -519,6 +520,9 @@ static struct dsync_ibc *
 cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 			  const char *name, const char *temp_prefix)
 {
+	const struct compression_handler *handler;
+	struct dsync_ibc *ibc;
+
 	if (ctx->input == NULL) {
 		fd_set_nonblock(ctx->fd_in, TRUE);
 		fd_set_nonblock(ctx->fd_out, TRUE);
@@ -537,8 +541,17 @@ cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 		iostream_rawlog_create_path(ctx->rawlog_path,
 					    &ctx->input, &ctx->output);
 	}
-	return dsync_ibc_init_stream(ctx->input, ctx->output,
-				     name, temp_prefix, ctx->io_timeout_secs);
+	ibc = dsync_ibc_init_stream(ctx->input, ctx->output,
+				    name, temp_prefix, ctx->io_timeout_secs);
+	if (doveadm_settings->dsync_compression[0] != '\0') {
+		if (compression_lookup_handler(doveadm_settings->dsync_compression,
+					       &handler) <= 0) {
+			i_fatal("dsync_compression: Unsupported compression: %s",
+				doveadm_settings->dsync_compression);
+		}
+		dsync_ibc_stream_set_compression(ibc, handler);
+	}
+	return ibc;
 }
 
 static void
@@ -628,6 +641,7 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	memcpy(set.sync_box_guid, ctx->mailbox_guid, sizeof(set.sync_box_guid));
 	set.lock_timeout_secs = ctx->lock_timeout;
 	set.import_commit_msgs_interval = ctx->import_commit_msgs_interval;
+	set.mailbox_concurrency = doveadm_settings->dsync_mailbox_concurrency;
 	set.state = ctx->state_input;
 	set.mailbox_alt_char = doveadm_settings->dsync_alt_char[0];
 	if (*doveadm_settings->dsync_hashed_headers == '\0') {
@@ -4,6 +4,7 @@
 #include "str.h"
 #include "strescape.h"
 #include "net.h"
+#include "time-util.h"
 #include "write-full.h"
 #include "mail-namespace.h"
 #include "mail-storage.h"
@@ -22,13 +23,29 @@ struct index_cmd_context {
 
 	int queue_fd;
 	unsigned int max_recent_msgs;
+
+	/* statistics for the precaching done by this command */
+	unsigned int cached_mailboxes, cached_mails;
+	uint64_t cache_usecs;
+
 	bool queue:1;
 	bool have_wildcards:1;
 };
 
-static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
+static void
+cmd_index_report(const char *name, unsigned int mails, uint64_t usecs)
+{
+	i_info("%s: Cached %u mails in %u.%03u secs (%u mails/sec)",
+	       name, mails, (unsigned int)(usecs / 1000000),
+	       (unsigned int)(usecs % 1000000) / 1000,
+	       usecs == 0 ? mails :
+	       (unsigned int)((uint64_t)mails * 1000000 / usecs));
+}
+
+static int cmd_index_box_precache(struct index_cmd_context *ictx,
 				  struct mailbox *box)
 {
+	struct doveadm_mail_cmd_context *dctx = &ictx->ctx;
 	struct mailbox_status status;
 	struct mailbox_transaction_context *trans;
 	struct mail_search_args *search_args;
@@ -37,6 +54,7 @@ static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
 	struct mailbox_metadata metadata;
 	uint32_t seq;
 	unsigned int counter = 0, max;
+	uint64_t start_usecs, usecs;
 	int ret = 0;
 
 	if (mailbox_get_metadata(box, MAILBOX_METADATA_PRECACHE_FIELDS,
@@ -75,6 +93,7 @@ static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
 	mail_search_args_unref(&search_args);
 
 	max = status.messages - seq + 1;
+	start_usecs = i_microseconds();
 	while (mailbox_search_next(ctx, &mail)) {
 		if (mail_precache(mail) < 0) {
 			i_error("Mailbox %s: Precache for UID=%u failed: %s",
@@ -83,13 +102,19 @@ static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
 			ret = -1;
 			break;
 		}
-		if (doveadm_verbose && ++counter % 100 == 0) {
+		if (++counter % 100 == 0 && doveadm_verbose) {
 			printf("\r%u/%u", counter, max);
 			fflush(stdout);
 		}
 	}
-	if (doveadm_verbose)
+	usecs = i_microseconds() - start_usecs;
+	ictx->cached_mailboxes++;
+	ictx->cached_mails += counter;
+	ictx->cache_usecs += usecs;
+	if (doveadm_verbose) {
 		printf("\r%u/%u\n", counter, max);
+		cmd_index_report(mailbox_get_vname(box), counter, usecs);
+	}
 	if (mailbox_search_deinit(&ctx) < 0) {
 		i_error("Mailbox %s: Mail search failed: %s",
 			mailbox_get_vname(box),
@@ -113,7 +138,8 @@ cmd_index_box(struct index_cmd_context *ctx, const struct mailbox_info *info)
 	int ret = 0;
 
 	box = mailbox_alloc(info->ns->list, info->vname,
-			    MAILBOX_FLAG_IGNORE_ACLS);
+			    MAILBOX_FLAG_IGNORE_ACLS |
+			    MAILBOX_FLAG_BACKGROUND_SESSION);
 	if (ctx->max_recent_msgs != 0) {
 		/* index only if there aren't too many recent messages.
 		   don't bother syncing the mailbox, that alone can take a
@@ -139,7 +165,7 @@ cmd_index_box(struct index_cmd_context *ctx, const struct mailbox_info *info)
 		doveadm_mail_failed_mailbox(&ctx->ctx, box);
 		ret = -1;
 	} else {
-		if (cmd_index_box_precache(&ctx->ctx, box) < 0) {
+		if (cmd_index_box_precache(ctx, box) < 0) {
 			doveadm_mail_failed_mailbox(&ctx->ctx, box);
 			ret = -1;
 		}
@@ -250,6 +276,11 @@ static void cmd_index_deinit(struct doveadm_mail_cmd_context *_ctx)
 		net_disconnect(ctx->queue_fd);
 		ctx->queue_fd = -1;
 	}
+	if (doveadm_verbose && ctx->cached_mailboxes > 1) {
+		cmd_index_report(t_strdup_printf("Total of %u mailboxes",
+						 ctx->cached_mailboxes),
+				 ctx->cached_mails, ctx->cache_usecs);
+	}
 }
 
 static bool
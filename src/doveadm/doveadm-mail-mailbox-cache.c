@@ -7,6 +7,7 @@
 #include "mail-cache-private.h"
 #include "mail-namespace.h"
 #include "mail-storage-private.h"
+#include "mailbox-cache-decisions.h"
 #include "doveadm-print.h"
 #include "doveadm-mail-iter.h"
 #include "doveadm-mailbox-list-iter.h"
@@ -368,6 +369,47 @@ static void cmd_mailbox_cache_purge_init(struct doveadm_mail_cmd_context *_ctx,
 	ctx->boxes = args;
 }
 
+static int cmd_mailbox_cache_report_run(struct doveadm_mail_cmd_context *_ctx,
+					struct mail_user *user)
+{
+	ARRAY_TYPE(mailbox_cache_learned_field) fields;
+	const struct mailbox_cache_learned_field *field;
+	const char *error;
+	uint64_t lookups;
+
+	t_array_init(&fields, 32);
+	if (mailbox_cache_decisions_read(user, pool_datastack_create(),
+					 &fields, &error) < 0) {
+		i_error("Failed to read learned cache decisions: %s", error);
+		doveadm_mail_failed_error(_ctx, MAIL_ERROR_TEMP);
+		return -1;
+	}
+	array_foreach(&fields, field) {
+		lookups = field->lookup_hits + field->lookup_misses;
+		doveadm_print(field->name);
+		doveadm_print(cmd_mailbox_cache_decision_to_str(field->decision));
+		doveadm_print_num(field->lookup_hits);
+		doveadm_print_num(field->lookup_misses);
+		doveadm_print(lookups == 0 ? "-" : t_strdup_printf("%"PRIu64"%%",
+			field->lookup_hits * 100 / lookups));
+	}
+	return 0;
+}
+
+static void
+cmd_mailbox_cache_report_init(struct doveadm_mail_cmd_context *_ctx ATTR_UNUSED,
+			      const char *const args[])
+{
+	if (args[0] != NULL)
+		doveadm_mail_help_name("mailbox cache report");
+
+	doveadm_print_header_simple("field");
+	doveadm_print_header_simple("decision");
+	doveadm_print_header_simple("hits");
+	doveadm_print_header_simple("misses");
+	doveadm_print_header_simple("hit-ratio");
+}
+
 static struct doveadm_mail_cmd_context *cmd_mailbox_cache_decision_alloc(void)
 {
 	struct mailbox_cache_cmd_context *ctx =
@@ -403,6 +445,17 @@ static struct doveadm_mail_cmd_context *cmd_mailbox_cache_purge_alloc(void)
 	return &ctx->ctx;
 }
 
+static struct doveadm_mail_cmd_context *cmd_mailbox_cache_report_alloc(void)
+{
+	struct mailbox_cache_cmd_context *ctx =
+		doveadm_mail_cmd_alloc(struct mailbox_cache_cmd_context);
+	ctx->ctx.v.init = cmd_mailbox_cache_report_init;
+	ctx->ctx.v.run = cmd_mailbox_cache_report_run;
+	ctx->ctx.getopt_args = "";
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	return &ctx->ctx;
+}
+
 struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_decision = {
 	.name = "mailbox cache decision",
 	.mail_cmd = cmd_mailbox_cache_decision_alloc,
@@ -438,3 +491,12 @@ DOVEADM_CMD_MAIL_COMMON
 DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_report = {
+	.name = "mailbox cache report",
+	.mail_cmd = cmd_mailbox_cache_report_alloc,
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX,
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAMS_END
+};
@@ -540,6 +540,9 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		} T_END;
 		if (ret == -1)
 			break;
+		/* show each user's results as soon as they're available,
+		   instead of only when the output buffer becomes full */
+		doveadm_print_flush_output();
 		if (doveadm_verbose) {
 			if (++user_idx % 100 == 0) {
 				printf("\r%d", user_idx);
@@ -772,6 +775,7 @@ static struct doveadm_cmd_ver2 *mail_commands_ver2[] = {
 	&doveadm_cmd_mailbox_cache_decision,
 	&doveadm_cmd_mailbox_cache_remove,
 	&doveadm_cmd_mailbox_cache_purge,
+	&doveadm_cmd_mailbox_cache_report,
 	&doveadm_cmd_rebuild_attachments,
 };
 
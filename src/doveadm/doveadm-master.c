@@ -1,6 +1,7 @@
 /* Copyright (c) 2010-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "strescape.h"
 #include "istream.h"
@@ -134,15 +135,9 @@ master_service_send_cmd_with_args(const char *cmd, const char *const *args)
 	return master_service_send_cmd(str_c(str));
 }
 
-static void cmd_service_stop(struct doveadm_cmd_context *cctx)
+static void master_service_read_reply(struct istream *input)
 {
-	const char *line, *const *services;
-
-	if (!doveadm_cmd_param_array(cctx, "service", &services))
-		i_fatal("service parameter missing");
-
-	struct istream *input =
-		master_service_send_cmd_with_args("STOP", services);
+	const char *line;
 
 	alarm(5);
 	if ((line = i_stream_read_next_line(input)) == NULL) {
@@ -161,6 +156,17 @@ static void cmd_service_stop(struct doveadm_cmd_context *cctx)
 	i_stream_destroy(&input);
 }
 
+static void cmd_service_stop(struct doveadm_cmd_context *cctx)
+{
+	const char *const *services;
+
+	if (!doveadm_cmd_param_array(cctx, "service", &services))
+		i_fatal("service parameter missing");
+
+	master_service_read_reply(
+		master_service_send_cmd_with_args("STOP", services));
+}
+
 static void cmd_service_status(struct doveadm_cmd_context *cctx)
 {
 	const char *line, *const *services;
@@ -253,6 +259,30 @@ static void cmd_process_status(struct doveadm_cmd_context *cctx)
 	i_stream_destroy(&input);
 }
 
+static void cmd_process_profile(struct doveadm_cmd_context *cctx)
+{
+	ARRAY_TYPE(const_string) args;
+	const char *state, *const *services;
+
+	if (!doveadm_cmd_param_str(cctx, "state", &state) ||
+	    (strcmp(state, "on") != 0 && strcmp(state, "off") != 0)) {
+		doveadm_exit_code = EX_USAGE;
+		i_error("process profile: Specify on or off");
+		return;
+	}
+
+	t_array_init(&args, 8);
+	array_push_back(&args, &state);
+	if (doveadm_cmd_param_array(cctx, "service", &services)) {
+		for (unsigned int i = 0; services[i] != NULL; i++)
+			array_push_back(&args, &services[i]);
+	}
+	array_append_zero(&args);
+
+	master_service_read_reply(master_service_send_cmd_with_args("PROFILE",
+		array_front(&args)));
+}
+
 struct doveadm_cmd_ver2 doveadm_cmd_stop_ver2 = {
 	.cmd = cmd_stop,
 	.name = "stop",
@@ -295,3 +325,13 @@ DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+struct doveadm_cmd_ver2 doveadm_cmd_process_profile_ver2 = {
+	.cmd = cmd_process_profile,
+	.name = "process profile",
+	.usage = "on|off [<service> [...]]",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_PARAM('\0', "state", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAM('\0', "service", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
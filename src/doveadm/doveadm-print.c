@@ -154,6 +154,14 @@ void doveadm_print_flush(void)
 	o_stream_cork(doveadm_print_ostream);
 }
 
+void doveadm_print_flush_output(void)
+{
+	if (doveadm_print_ostream == NULL)
+		return;
+	o_stream_uncork(doveadm_print_ostream);
+	o_stream_cork(doveadm_print_ostream);
+}
+
 void doveadm_print_unstick_headers(void)
 {
 	struct doveadm_print_header_context *hdr;
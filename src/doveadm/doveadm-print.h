@@ -38,6 +38,9 @@ void doveadm_print_stream(const void *value, size_t size);
 int doveadm_print_istream(struct istream *input);
 void doveadm_print_sticky(const char *key, const char *value);
 void doveadm_print_flush(void);
+/* Send the output written so far, without finishing the formatter's output.
+   This allows showing the results while the command is still running. */
+void doveadm_print_flush_output(void);
 void doveadm_print_unstick_headers(void);
 
 void doveadm_print_init(const char *name);
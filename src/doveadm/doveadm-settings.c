@@ -83,8 +83,10 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(STR, doveadm_api_key),
 	DEF(STR, dsync_features),
 	DEF(UINT, dsync_commit_msgs_interval),
+	DEF(UINT, dsync_mailbox_concurrency),
 	DEF(STR, doveadm_http_rawlog_dir),
 	DEF(STR, dsync_hashed_headers),
+	DEF(STR, dsync_compression),
 
 	{ .type = SET_STRLIST, .key = "plugin",
 	  .offset = offsetof(struct doveadm_settings, plugin_envs) },
@@ -112,6 +114,8 @@ const struct doveadm_settings doveadm_default_settings = {
 	.dsync_features = "",
 	.dsync_hashed_headers = "Date Message-ID",
 	.dsync_commit_msgs_interval = 100,
+	.dsync_mailbox_concurrency = 1,
+	.dsync_compression = "",
 	.director_username_hash = "%Lu",
 	.doveadm_api_key = "",
 	.doveadm_http_rawlog_dir = "",
@@ -202,6 +206,10 @@ static bool doveadm_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		*error_r = "dsync_alt_char must not be empty";
 		return FALSE;
 	}
+	if (set->dsync_mailbox_concurrency == 0) {
+		*error_r = "dsync_mailbox_concurrency must not be 0";
+		return FALSE;
+	}
 	if (dsync_settings_parse_features(set, error_r) != 0)
 		return FALSE;
 	return TRUE;
@@ -32,7 +32,9 @@ struct doveadm_settings {
 	const char *doveadm_api_key;
 	const char *dsync_features;
 	const char *dsync_hashed_headers;
+	const char *dsync_compression;
 	unsigned int dsync_commit_msgs_interval;
+	unsigned int dsync_mailbox_concurrency;
 	const char *doveadm_http_rawlog_dir;
 	enum dsync_features parsed_features;
 	ARRAY(const char *) plugin_envs;
@@ -104,93 +104,97 @@ dsync_mailbox_state_remove(struct dsync_brain *brain,
 		hash_table_remove(brain->mailbox_states, guid_p);
 }
 
-void dsync_brain_sync_init_box_states(struct dsync_brain *brain)
+void dsync_brain_sync_init_box_states(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
+
 	if (brain->backup_send) {
 		/* we have an exporter, but no importer. */
-		brain->box_send_state = DSYNC_BOX_STATE_ATTRIBUTES;
-		brain->box_recv_state = brain->mail_requests ?
+		bbox->box_send_state = DSYNC_BOX_STATE_ATTRIBUTES;
+		bbox->box_recv_state = brain->mail_requests ?
 			DSYNC_BOX_STATE_MAIL_REQUESTS :
 			DSYNC_BOX_STATE_RECV_LAST_COMMON;
 	} else if (brain->backup_recv) {
 		/* we have an importer, but no exporter */
-		brain->box_send_state = brain->mail_requests ?
+		bbox->box_send_state = brain->mail_requests ?
 			DSYNC_BOX_STATE_MAIL_REQUESTS :
 			DSYNC_BOX_STATE_DONE;
-		brain->box_recv_state = DSYNC_BOX_STATE_ATTRIBUTES;
+		bbox->box_recv_state = DSYNC_BOX_STATE_ATTRIBUTES;
 	} else {
-		brain->box_send_state = DSYNC_BOX_STATE_ATTRIBUTES;
-		brain->box_recv_state = DSYNC_BOX_STATE_ATTRIBUTES;
+		bbox->box_send_state = DSYNC_BOX_STATE_ATTRIBUTES;
+		bbox->box_recv_state = DSYNC_BOX_STATE_ATTRIBUTES;
 	}
 }
 
-static void
+static struct dsync_brain_mailbox *
 dsync_brain_sync_mailbox_init(struct dsync_brain *brain,
 			      struct mailbox *box,
 			      struct file_lock *lock,
 			      const struct dsync_mailbox *local_dsync_box,
-			      bool wait_for_remote_box)
+			      bool wait_for_remote_box, unsigned int channel)
 {
+	struct dsync_brain_mailbox *bbox;
 	const struct dsync_mailbox_state *state;
+	pool_t pool;
 
-	i_assert(brain->box_importer == NULL);
-	i_assert(brain->box_exporter == NULL);
 	i_assert(box->synced);
 
-	brain->box = box;
-	brain->box_lock = lock;
-	brain->pre_box_state = brain->state;
+	pool = pool_alloconly_create(MEMPOOL_GROWING"dsync brain box pool", 2048);
+	bbox = p_new(pool, struct dsync_brain_mailbox, 1);
+	bbox->pool = pool;
+	bbox->brain = brain;
+	bbox->channel = channel;
+	bbox->box = box;
+	bbox->box_lock = lock;
+	if (array_count(&brain->boxes) == 0)
+		brain->pre_box_state = brain->state;
+	array_push_back(&brain->boxes, &bbox);
+
 	if (wait_for_remote_box) {
-		brain->box_send_state = DSYNC_BOX_STATE_MAILBOX;
-		brain->box_recv_state = DSYNC_BOX_STATE_MAILBOX;
+		bbox->box_send_state = DSYNC_BOX_STATE_MAILBOX;
+		bbox->box_recv_state = DSYNC_BOX_STATE_MAILBOX;
 	} else {
-		dsync_brain_sync_init_box_states(brain);
-	}
-	brain->local_dsync_box = *local_dsync_box;
-	if (brain->dsync_box_pool != NULL)
-		p_clear(brain->dsync_box_pool);
-	else {
-		brain->dsync_box_pool =
-			pool_alloconly_create(MEMPOOL_GROWING"dsync brain box pool", 2048);
+		dsync_brain_sync_init_box_states(bbox);
 	}
-	dsync_mailbox_cache_field_dup(&brain->local_dsync_box.cache_fields,
+	bbox->local_dsync_box = *local_dsync_box;
+	dsync_mailbox_cache_field_dup(&bbox->local_dsync_box.cache_fields,
 				      &local_dsync_box->cache_fields,
-				      brain->dsync_box_pool);
-	i_zero(&brain->remote_dsync_box);
+				      bbox->pool);
 
 	state = dsync_mailbox_state_find(brain, local_dsync_box->mailbox_guid);
 	if (state != NULL)
-		brain->mailbox_state = *state;
+		bbox->mailbox_state = *state;
 	else {
-		i_zero(&brain->mailbox_state);
-		memcpy(brain->mailbox_state.mailbox_guid,
+		memcpy(bbox->mailbox_state.mailbox_guid,
 		       local_dsync_box->mailbox_guid,
-		       sizeof(brain->mailbox_state.mailbox_guid));
-		brain->mailbox_state.last_uidvalidity =
+		       sizeof(bbox->mailbox_state.mailbox_guid));
+		bbox->mailbox_state.last_uidvalidity =
 			local_dsync_box->uid_validity;
 	}
+	return bbox;
 }
 
 static void
-dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
+dsync_brain_sync_mailbox_init_remote(struct dsync_brain_mailbox *bbox,
 				     const struct dsync_mailbox *remote_dsync_box)
 {
+	struct dsync_brain *brain = bbox->brain;
 	enum dsync_mailbox_import_flags import_flags = 0;
 	const struct dsync_mailbox_state *state;
 	uint32_t last_common_uid;
 	uint64_t last_common_modseq, last_common_pvt_modseq;
 
-	i_assert(brain->box_importer == NULL);
-	i_assert(brain->log_scan != NULL);
+	i_assert(bbox->box_importer == NULL);
+	i_assert(bbox->log_scan != NULL);
 
-	i_assert(memcmp(brain->local_dsync_box.mailbox_guid,
+	i_assert(memcmp(bbox->local_dsync_box.mailbox_guid,
 			remote_dsync_box->mailbox_guid,
 			sizeof(remote_dsync_box->mailbox_guid)) == 0);
 
-	brain->remote_dsync_box = *remote_dsync_box;
-	dsync_mailbox_cache_field_dup(&brain->remote_dsync_box.cache_fields,
+	bbox->remote_dsync_box = *remote_dsync_box;
+	dsync_mailbox_cache_field_dup(&bbox->remote_dsync_box.cache_fields,
 				      &remote_dsync_box->cache_fields,
-				      brain->dsync_box_pool);
+				      bbox->pool);
 
 	state = dsync_mailbox_state_find(brain, remote_dsync_box->mailbox_guid);
 	if (state != NULL) {
@@ -211,11 +215,11 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_REVERT_LOCAL_CHANGES;
 	if (brain->debug)
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_DEBUG;
-	if (brain->local_dsync_box.have_save_guids &&
+	if (bbox->local_dsync_box.have_save_guids &&
 	    (remote_dsync_box->have_save_guids ||
 	     (brain->backup_recv && remote_dsync_box->have_guids)))
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_MAILS_HAVE_GUIDS;
-	if (brain->local_dsync_box.have_only_guid128 ||
+	if (bbox->local_dsync_box.have_only_guid128 ||
 	    remote_dsync_box->have_only_guid128)
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_MAILS_USE_GUID128;
 	if (brain->no_notify)
@@ -223,9 +227,10 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 	if (brain->empty_hdr_workaround)
 		import_flags |= DSYNC_MAILBOX_IMPORT_FLAG_EMPTY_HDR_WORKAROUND;
 
-	brain->box_importer = brain->backup_send ? NULL :
-		dsync_mailbox_import_init(brain->box, brain->virtual_all_box,
-					  brain->log_scan,
+	bbox->box_importer = brain->backup_send ? NULL :
+		dsync_mailbox_import_init(bbox->box, brain->virtual_all_box,
+					  brain->import_dedup,
+					  bbox->log_scan,
 					  last_common_uid, last_common_modseq,
 					  last_common_pvt_modseq,
 					  remote_dsync_box->uid_next,
@@ -241,9 +246,10 @@ dsync_brain_sync_mailbox_init_remote(struct dsync_brain *brain,
 					  brain->hashed_headers);
 }
 
-int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
+int dsync_brain_sync_mailbox_open(struct dsync_brain_mailbox *bbox,
 				  const struct dsync_mailbox *remote_dsync_box)
 {
+	struct dsync_brain *brain = bbox->brain;
 	struct mailbox_status status;
 	enum dsync_mailbox_exporter_flags exporter_flags = 0;
 	uint32_t last_common_uid, highest_wanted_uid;
@@ -252,28 +258,28 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	bool pvt_too_old;
 	int ret;
 
-	i_assert(brain->log_scan == NULL);
-	i_assert(brain->box_exporter == NULL);
+	i_assert(bbox->log_scan == NULL);
+	i_assert(bbox->box_exporter == NULL);
 
-	last_common_uid = brain->mailbox_state.last_common_uid;
-	last_common_modseq = brain->mailbox_state.last_common_modseq;
-	last_common_pvt_modseq = brain->mailbox_state.last_common_pvt_modseq;
+	last_common_uid = bbox->mailbox_state.last_common_uid;
+	last_common_modseq = bbox->mailbox_state.last_common_modseq;
+	last_common_pvt_modseq = bbox->mailbox_state.last_common_pvt_modseq;
 	highest_wanted_uid = last_common_uid == 0 ?
 		(uint32_t)-1 : last_common_uid;
-	ret = dsync_transaction_log_scan_init(brain->box->view,
-					      brain->box->view_pvt,
+	ret = dsync_transaction_log_scan_init(bbox->box->view,
+					      bbox->box->view_pvt,
 					      highest_wanted_uid,
 					      last_common_modseq,
 					      last_common_pvt_modseq,
-					      &brain->log_scan, &pvt_too_old);
+					      &bbox->log_scan, &pvt_too_old);
 	if (ret < 0) {
 		i_error("Failed to read transaction log for mailbox %s",
-			mailbox_get_vname(brain->box));
+			mailbox_get_vname(bbox->box));
 		brain->failed = TRUE;
 		return -1;
 	}
 
-	mailbox_get_open_status(brain->box, STATUS_UIDNEXT |
+	mailbox_get_open_status(bbox->box, STATUS_UIDNEXT |
 				STATUS_HIGHESTMODSEQ |
 				STATUS_HIGHESTPVTMODSEQ, &status);
 	if (ret == 0) {
@@ -315,7 +321,7 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	if (ret == 0) {
 		i_warning("Failed to do incremental sync for mailbox %s, "
 			  "retry with a full sync (%s)",
-			  mailbox_get_vname(brain->box), desync_reason);
+			  mailbox_get_vname(bbox->box), desync_reason);
 		dsync_brain_set_changes_during_sync(brain, t_strdup_printf(
 			"Incremental sync failed: %s", desync_reason));
 		brain->require_full_resync = TRUE;
@@ -325,8 +331,8 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 	if (!brain->mail_requests)
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_AUTO_EXPORT_MAILS;
 	if (remote_dsync_box->have_save_guids &&
-	    (brain->local_dsync_box.have_save_guids ||
-	     (brain->backup_send && brain->local_dsync_box.have_guids)))
+	    (bbox->local_dsync_box.have_save_guids ||
+	     (brain->backup_send && bbox->local_dsync_box.have_guids)))
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_MAILS_HAVE_GUIDS;
 	if (brain->no_mail_prefetch)
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_MINIMAL_DMAIL_FILL;
@@ -342,40 +348,42 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 		exporter_flags |= DSYNC_MAILBOX_EXPORTER_FLAG_NO_HDR_HASHES;
 	}
 
-	brain->box_exporter = brain->backup_recv ? NULL :
-		dsync_mailbox_export_init(brain->box, brain->log_scan,
+	bbox->box_exporter = brain->backup_recv ? NULL :
+		dsync_mailbox_export_init(bbox->box, bbox->log_scan,
 					  last_common_uid,
 					  exporter_flags,
 					  brain->hdr_hash_version,
 					  brain->hashed_headers);
-	dsync_brain_sync_mailbox_init_remote(brain, remote_dsync_box);
+	dsync_brain_sync_mailbox_init_remote(bbox, remote_dsync_box);
 	return 1;
 }
 
-void dsync_brain_sync_mailbox_deinit(struct dsync_brain *brain)
+void dsync_brain_sync_mailbox_deinit(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
+	struct dsync_brain_mailbox *const *bboxes;
 	enum mail_error error;
+	unsigned int i, count;
+	pool_t pool;
 
-	i_assert(brain->box != NULL);
-
-	array_push_back(&brain->remote_mailbox_states, &brain->mailbox_state);
-	if (brain->box_exporter != NULL) {
+	array_push_back(&brain->remote_mailbox_states, &bbox->mailbox_state);
+	if (bbox->box_exporter != NULL) {
 		const char *errstr;
 
 		i_assert(brain->failed || brain->require_full_resync ||
 			 brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_CHANGED);
-		if (dsync_mailbox_export_deinit(&brain->box_exporter,
+		if (dsync_mailbox_export_deinit(&bbox->box_exporter,
 						&errstr, &error) < 0)
 			i_error("Mailbox export failed: %s", errstr);
 	}
-	if (brain->box_importer != NULL) {
+	if (bbox->box_importer != NULL) {
 		uint32_t last_common_uid, last_messages_count;
 		uint64_t last_common_modseq, last_common_pvt_modseq;
 		const char *changes_during_sync;
 		bool require_full_resync;
 
 		i_assert(brain->failed);
-		(void)dsync_mailbox_import_deinit(&brain->box_importer,
+		(void)dsync_mailbox_import_deinit(&bbox->box_importer,
 						  FALSE,
 						  &last_common_uid,
 						  &last_common_modseq,
@@ -387,12 +395,24 @@ void dsync_brain_sync_mailbox_deinit(struct dsync_brain *brain)
 		if (require_full_resync)
 			brain->require_full_resync = TRUE;
 	}
-	if (brain->log_scan != NULL)
-		dsync_transaction_log_scan_deinit(&brain->log_scan);
-	file_lock_free(&brain->box_lock);
-	mailbox_free(&brain->box);
+	if (bbox->log_scan != NULL)
+		dsync_transaction_log_scan_deinit(&bbox->log_scan);
+	file_lock_free(&bbox->box_lock);
+	mailbox_free(&bbox->box);
 
-	brain->state = brain->pre_box_state;
+	bboxes = array_get(&brain->boxes, &count);
+	for (i = 0; i < count; i++) {
+		if (bboxes[i] == bbox) {
+			array_delete(&brain->boxes, i, 1);
+			break;
+		}
+	}
+	i_assert(i < count);
+	pool = bbox->pool;
+	pool_unref(&pool);
+
+	if (array_count(&brain->boxes) == 0)
+		brain->state = brain->pre_box_state;
 }
 
 static int dsync_box_get(struct mailbox *box, struct dsync_mailbox *dsync_box_r,
@@ -565,7 +585,7 @@ dsync_brain_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 {
 	int ret;
 
-	if (brain->no_mail_sync)
+	if (brain->no_mail_sync || brain->local_tree_iter == NULL)
 		return FALSE;
 
 	while ((ret = dsync_brain_try_next_mailbox(brain, box_r, lock_r, dsync_box_r)) == 0)
@@ -578,19 +598,31 @@ void dsync_brain_master_send_mailbox(struct dsync_brain *brain)
 	struct dsync_mailbox dsync_box;
 	struct mailbox *box;
 	struct file_lock *lock;
+	unsigned int channel;
 
 	i_assert(brain->master_brain);
-	i_assert(brain->box == NULL);
+	i_assert(array_count(&brain->boxes) < brain->mailbox_concurrency);
 
 	if (!dsync_brain_next_mailbox(brain, &box, &lock, &dsync_box)) {
+		if (array_count(&brain->boxes) > 0) {
+			/* finish after the remaining mailboxes are synced */
+			return;
+		}
 		brain->state = DSYNC_STATE_FINISH;
+		dsync_ibc_set_send_channel(brain->ibc, 0);
 		dsync_ibc_send_end_of_list(brain->ibc, DSYNC_IBC_EOL_MAILBOX);
 		return;
 	}
 
+	/* channel 0 is used for non-mailbox items, so with concurrency the
+	   mailboxes use channels 1.. */
+	channel = brain->mailbox_concurrency == 1 ? 0 : ++brain->last_channel;
+
 	/* start exporting this mailbox (wait for remote to start importing) */
+	dsync_ibc_set_send_channel(brain->ibc, channel);
 	dsync_ibc_send_mailbox(brain->ibc, &dsync_box);
-	dsync_brain_sync_mailbox_init(brain, box, lock, &dsync_box, TRUE);
+	(void)dsync_brain_sync_mailbox_init(brain, box, lock, &dsync_box,
+					    TRUE, channel);
 	brain->state = DSYNC_STATE_SYNC_MAILS;
 }
 
@@ -768,24 +800,35 @@ dsync_brain_slave_send_mailbox_lost(struct dsync_brain *brain,
 
 bool dsync_brain_slave_recv_mailbox(struct dsync_brain *brain)
 {
+	struct dsync_brain_mailbox *bbox;
 	const struct dsync_mailbox *dsync_box;
 	struct dsync_mailbox local_dsync_box;
 	struct mailbox *box;
 	struct file_lock *lock;
 	const char *errstr, *resync_reason;
 	enum mail_error error;
+	unsigned int channel;
 	int ret;
 	bool resync;
 
 	i_assert(!brain->master_brain);
-	i_assert(brain->box == NULL);
 
+	if (dsync_ibc_recv_channel(brain->ibc, &channel) == 0)
+		return FALSE;
 	if ((ret = dsync_ibc_recv_mailbox(brain->ibc, &dsync_box)) == 0)
 		return FALSE;
 	if (ret < 0) {
+		if (array_count(&brain->boxes) > 0) {
+			i_error("Remote sent end-of-list while mailboxes "
+				"were still being synced");
+			brain->failed = TRUE;
+			return TRUE;
+		}
 		brain->state = DSYNC_STATE_FINISH;
 		return TRUE;
 	}
+	/* reply in the same channel */
+	dsync_ibc_set_send_channel(brain->ibc, channel);
 
 	if (dsync_brain_mailbox_alloc(brain, dsync_box->mailbox_guid,
 				      &box, &errstr, &error) < 0) {
@@ -868,14 +911,15 @@ bool dsync_brain_slave_recv_mailbox(struct dsync_brain *brain)
 	}
 
 	/* start export/import */
-	dsync_brain_sync_mailbox_init(brain, box, lock, &local_dsync_box, FALSE);
-	if ((ret = dsync_brain_sync_mailbox_open(brain, dsync_box)) < 0)
+	bbox = dsync_brain_sync_mailbox_init(brain, box, lock, &local_dsync_box,
+					     FALSE, channel);
+	if ((ret = dsync_brain_sync_mailbox_open(bbox, dsync_box)) < 0)
 		return TRUE;
 	if (resync)
 		dsync_brain_set_changes_during_sync(brain, resync_reason);
 	if (ret == 0 || resync) {
 		brain->require_full_resync = TRUE;
-		dsync_brain_sync_mailbox_deinit(brain);
+		dsync_brain_sync_mailbox_deinit(bbox);
 		dsync_brain_slave_send_mailbox_lost(brain, dsync_box, FALSE);
 		return TRUE;
 	}
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "istream.h"
 #include "dsync-ibc.h"
 #include "dsync-mail.h"
@@ -18,8 +19,10 @@ const char *dsync_box_state_names[DSYNC_BOX_STATE_DONE+1] = {
 	"done"
 };
 
-static bool dsync_brain_master_sync_recv_mailbox(struct dsync_brain *brain)
+static bool
+dsync_brain_master_sync_recv_mailbox(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mailbox *dsync_box;
 	const char *resync_reason;
 	enum dsync_ibc_recv_ret ret;
@@ -34,7 +37,7 @@ static bool dsync_brain_master_sync_recv_mailbox(struct dsync_brain *brain)
 		brain->failed = TRUE;
 		return TRUE;
 	}
-	if (memcmp(dsync_box->mailbox_guid, brain->local_dsync_box.mailbox_guid,
+	if (memcmp(dsync_box->mailbox_guid, bbox->local_dsync_box.mailbox_guid,
 		   sizeof(dsync_box->mailbox_guid)) != 0) {
 		i_error("Remote sent mailbox with a wrong GUID");
 		brain->failed = TRUE;
@@ -47,7 +50,7 @@ static bool dsync_brain_master_sync_recv_mailbox(struct dsync_brain *brain)
 			i_debug("brain %c: Ignoring missing remote box GUID %s",
 				brain->master_brain ? 'M' : 'S',
 			        guid_128_to_string(dsync_box->mailbox_guid));
-		dsync_brain_sync_mailbox_deinit(brain);
+		dsync_brain_sync_mailbox_deinit(bbox);
 		return TRUE;
 	}
 	if (dsync_box->mailbox_lost) {
@@ -57,34 +60,35 @@ static bool dsync_brain_master_sync_recv_mailbox(struct dsync_brain *brain)
 			"Remote lost mailbox GUID %s (maybe it was just deleted?)",
 			guid_128_to_string(dsync_box->mailbox_guid)));
 		brain->require_full_resync = TRUE;
-		dsync_brain_sync_mailbox_deinit(brain);
+		dsync_brain_sync_mailbox_deinit(bbox);
 		return TRUE;
 	}
-	resync = !dsync_brain_mailbox_update_pre(brain, brain->box,
-						 &brain->local_dsync_box,
+	resync = !dsync_brain_mailbox_update_pre(brain, bbox->box,
+						 &bbox->local_dsync_box,
 						 dsync_box, &resync_reason);
 
-	if (!dsync_boxes_need_sync(brain, &brain->local_dsync_box, dsync_box)) {
+	if (!dsync_boxes_need_sync(brain, &bbox->local_dsync_box, dsync_box)) {
 		/* no fields appear to have changed, skip this mailbox */
-		dsync_brain_sync_mailbox_deinit(brain);
+		dsync_brain_sync_mailbox_deinit(bbox);
 		return TRUE;
 	}
-	if ((ret = dsync_brain_sync_mailbox_open(brain, dsync_box)) < 0)
+	if ((ret = dsync_brain_sync_mailbox_open(bbox, dsync_box)) < 0)
 		return TRUE;
 	if (resync)
 		dsync_brain_set_changes_during_sync(brain, resync_reason);
 	if (ret == 0 || resync) {
 		brain->require_full_resync = TRUE;
 		brain->failed = TRUE;
-		dsync_brain_sync_mailbox_deinit(brain);
+		dsync_brain_sync_mailbox_deinit(bbox);
 		return TRUE;
 	}
-	dsync_brain_sync_init_box_states(brain);
+	dsync_brain_sync_init_box_states(bbox);
 	return TRUE;
 }
 
-static bool dsync_brain_recv_mailbox_attribute(struct dsync_brain *brain)
+static bool dsync_brain_recv_mailbox_attribute(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mailbox_attribute *attr;
 	struct istream *input;
 	enum dsync_ibc_recv_ret ret;
@@ -92,10 +96,10 @@ static bool dsync_brain_recv_mailbox_attribute(struct dsync_brain *brain)
 	if ((ret = dsync_ibc_recv_mailbox_attribute(brain->ibc, &attr)) == 0)
 		return FALSE;
 	if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
-		brain->box_recv_state = DSYNC_BOX_STATE_CHANGES;
+		bbox->box_recv_state = DSYNC_BOX_STATE_CHANGES;
 		return TRUE;
 	}
-	if (dsync_mailbox_import_attribute(brain->box_importer, attr) < 0)
+	if (dsync_mailbox_import_attribute(bbox->box_importer, attr) < 0)
 		brain->failed = TRUE;
 	input = attr->value_stream;
 	i_stream_unref(&input);
@@ -109,15 +113,16 @@ static void dsync_brain_send_end_of_list(struct dsync_brain *brain,
 	dsync_ibc_send_end_of_list(brain->ibc, type);
 }
 
-static int dsync_brain_export_deinit(struct dsync_brain *brain)
+static int dsync_brain_export_deinit(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const char *errstr;
 	enum mail_error error;
 
-	if (dsync_mailbox_export_deinit(&brain->box_exporter,
+	if (dsync_mailbox_export_deinit(&bbox->box_exporter,
 					&errstr, &error) < 0) {
 		i_error("Exporting mailbox %s failed: %s",
-			mailbox_get_vname(brain->box), errstr);
+			mailbox_get_vname(bbox->box), errstr);
 		brain->mail_error = error;
 		brain->failed = TRUE;
 		return -1;
@@ -125,135 +130,141 @@ static int dsync_brain_export_deinit(struct dsync_brain *brain)
 	return 0;
 }
 
-static void dsync_brain_send_mailbox_attribute(struct dsync_brain *brain)
+static void dsync_brain_send_mailbox_attribute(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mailbox_attribute *attr;
 	int ret;
 
-	while ((ret = dsync_mailbox_export_next_attr(brain->box_exporter, &attr)) > 0) {
+	while ((ret = dsync_mailbox_export_next_attr(bbox->box_exporter, &attr)) > 0) {
 		if (dsync_ibc_send_mailbox_attribute(brain->ibc, attr) == 0)
 			return;
 	}
 	if (ret < 0) {
-		if (dsync_brain_export_deinit(brain) == 0)
+		if (dsync_brain_export_deinit(bbox) == 0)
 			i_unreached();
 		return;
 	}
 	dsync_brain_send_end_of_list(brain, DSYNC_IBC_EOL_MAILBOX_ATTRIBUTE);
-	brain->box_send_state = DSYNC_BOX_STATE_CHANGES;
+	bbox->box_send_state = DSYNC_BOX_STATE_CHANGES;
 }
 
-static bool dsync_brain_recv_mail_change(struct dsync_brain *brain)
+static bool dsync_brain_recv_mail_change(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mail_change *change;
 	enum dsync_ibc_recv_ret ret;
 
 	if ((ret = dsync_ibc_recv_change(brain->ibc, &change)) == 0)
 		return FALSE;
 	if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
-		if (dsync_mailbox_import_changes_finish(brain->box_importer) < 0)
+		if (dsync_mailbox_import_changes_finish(bbox->box_importer) < 0)
 			brain->failed = TRUE;
-		if (brain->mail_requests && brain->box_exporter != NULL)
-			brain->box_recv_state = DSYNC_BOX_STATE_MAIL_REQUESTS;
+		if (brain->mail_requests && bbox->box_exporter != NULL)
+			bbox->box_recv_state = DSYNC_BOX_STATE_MAIL_REQUESTS;
 		else
-			brain->box_recv_state = DSYNC_BOX_STATE_MAILS;
+			bbox->box_recv_state = DSYNC_BOX_STATE_MAILS;
 		return TRUE;
 	}
-	if (dsync_mailbox_import_change(brain->box_importer, change) < 0)
+	if (dsync_mailbox_import_change(bbox->box_importer, change) < 0)
 		brain->failed = TRUE;
 	return TRUE;
 }
 
-static void dsync_brain_send_mail_change(struct dsync_brain *brain)
+static void dsync_brain_send_mail_change(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mail_change *change;
 	int ret;
 
-	while ((ret = dsync_mailbox_export_next(brain->box_exporter, &change)) > 0) {
+	while ((ret = dsync_mailbox_export_next(bbox->box_exporter, &change)) > 0) {
 		if (dsync_ibc_send_change(brain->ibc, change) == 0)
 			return;
 	}
 	if (ret < 0) {
-		if (dsync_brain_export_deinit(brain) == 0)
+		if (dsync_brain_export_deinit(bbox) == 0)
 			i_unreached();
 		return;
 	}
 	dsync_brain_send_end_of_list(brain, DSYNC_IBC_EOL_MAIL_CHANGES);
-	if (brain->mail_requests && brain->box_importer != NULL)
-		brain->box_send_state = DSYNC_BOX_STATE_MAIL_REQUESTS;
+	if (brain->mail_requests && bbox->box_importer != NULL)
+		bbox->box_send_state = DSYNC_BOX_STATE_MAIL_REQUESTS;
 	else
-		brain->box_send_state = DSYNC_BOX_STATE_MAILS;
+		bbox->box_send_state = DSYNC_BOX_STATE_MAILS;
 }
 
-static bool dsync_brain_recv_mail_request(struct dsync_brain *brain)
+static bool dsync_brain_recv_mail_request(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mail_request *request;
 	enum dsync_ibc_recv_ret ret;
 
 	i_assert(brain->mail_requests);
-	i_assert(brain->box_exporter != NULL);
+	i_assert(bbox->box_exporter != NULL);
 
 	if ((ret = dsync_ibc_recv_mail_request(brain->ibc, &request)) == 0)
 		return FALSE;
 	if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
-		brain->box_recv_state = brain->box_importer != NULL ?
+		bbox->box_recv_state = bbox->box_importer != NULL ?
 			DSYNC_BOX_STATE_MAILS :
 			DSYNC_BOX_STATE_RECV_LAST_COMMON;
 		return TRUE;
 	}
-	dsync_mailbox_export_want_mail(brain->box_exporter, request);
+	dsync_mailbox_export_want_mail(bbox->box_exporter, request);
 	return TRUE;
 }
 
-static bool dsync_brain_send_mail_request(struct dsync_brain *brain)
+static bool dsync_brain_send_mail_request(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mail_request *request;
 
 	i_assert(brain->mail_requests);
 
-	while ((request = dsync_mailbox_import_next_request(brain->box_importer)) != NULL) {
+	while ((request = dsync_mailbox_import_next_request(bbox->box_importer)) != NULL) {
 		if (dsync_ibc_send_mail_request(brain->ibc, request) == 0)
 			return TRUE;
 	}
-	if (brain->box_recv_state < DSYNC_BOX_STATE_MAIL_REQUESTS)
+	if (bbox->box_recv_state < DSYNC_BOX_STATE_MAIL_REQUESTS)
 		return FALSE;
 
 	dsync_brain_send_end_of_list(brain, DSYNC_IBC_EOL_MAIL_REQUESTS);
-	if (brain->box_exporter != NULL)
-		brain->box_send_state = DSYNC_BOX_STATE_MAILS;
+	if (bbox->box_exporter != NULL)
+		bbox->box_send_state = DSYNC_BOX_STATE_MAILS;
 	else {
-		i_assert(brain->box_recv_state != DSYNC_BOX_STATE_DONE);
-		brain->box_send_state = DSYNC_BOX_STATE_DONE;
+		i_assert(bbox->box_recv_state != DSYNC_BOX_STATE_DONE);
+		bbox->box_send_state = DSYNC_BOX_STATE_DONE;
 	}
 	return TRUE;
 }
 
-static void dsync_brain_sync_half_finished(struct dsync_brain *brain)
+static void dsync_brain_sync_half_finished(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	struct dsync_mailbox_state state;
 	const char *changes_during_sync;
 	bool require_full_resync;
 
-	if (brain->box_recv_state < DSYNC_BOX_STATE_RECV_LAST_COMMON ||
-	    brain->box_send_state < DSYNC_BOX_STATE_RECV_LAST_COMMON)
+	if (bbox->box_recv_state < DSYNC_BOX_STATE_RECV_LAST_COMMON ||
+	    bbox->box_send_state < DSYNC_BOX_STATE_RECV_LAST_COMMON)
 		return;
 
 	/* finished with this mailbox */
 	i_zero(&state);
-	memcpy(state.mailbox_guid, brain->local_dsync_box.mailbox_guid,
+	memcpy(state.mailbox_guid, bbox->local_dsync_box.mailbox_guid,
 	       sizeof(state.mailbox_guid));
-	state.last_uidvalidity = brain->local_dsync_box.uid_validity;
-	if (brain->box_importer == NULL) {
+	state.last_uidvalidity = bbox->local_dsync_box.uid_validity;
+	if (bbox->box_importer == NULL) {
 		/* this mailbox didn't exist on remote */
-		state.last_common_uid = brain->local_dsync_box.uid_next-1;
+		state.last_common_uid = bbox->local_dsync_box.uid_next-1;
 		state.last_common_modseq =
-			brain->local_dsync_box.highest_modseq;
+			bbox->local_dsync_box.highest_modseq;
 		state.last_common_pvt_modseq =
-			brain->local_dsync_box.highest_pvt_modseq;
+			bbox->local_dsync_box.highest_pvt_modseq;
 		state.last_messages_count =
-			brain->local_dsync_box.messages_count;
+			bbox->local_dsync_box.messages_count;
 	} else {
-		if (dsync_mailbox_import_deinit(&brain->box_importer,
+		if (dsync_mailbox_import_deinit(&bbox->box_importer,
 						!brain->failed,
 						&state.last_common_uid,
 						&state.last_common_modseq,
@@ -281,43 +292,45 @@ static void dsync_brain_sync_half_finished(struct dsync_brain *brain)
 		state.last_uidvalidity = 0;
 		state.changes_during_sync = TRUE;
 	}
-	brain->mailbox_state = state;
+	bbox->mailbox_state = state;
 	dsync_ibc_send_mailbox_state(brain->ibc, &state);
 }
 
-static bool dsync_brain_recv_mail(struct dsync_brain *brain)
+static bool dsync_brain_recv_mail(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	struct dsync_mail *mail;
 	enum dsync_ibc_recv_ret ret;
 
 	if ((ret = dsync_ibc_recv_mail(brain->ibc, &mail)) == 0)
 		return FALSE;
 	if (ret == DSYNC_IBC_RECV_RET_FINISHED) {
-		brain->box_recv_state = DSYNC_BOX_STATE_RECV_LAST_COMMON;
-		if (brain->box_exporter != NULL &&
-		    brain->box_send_state >= DSYNC_BOX_STATE_RECV_LAST_COMMON) {
-			if (dsync_brain_export_deinit(brain) < 0)
+		bbox->box_recv_state = DSYNC_BOX_STATE_RECV_LAST_COMMON;
+		if (bbox->box_exporter != NULL &&
+		    bbox->box_send_state >= DSYNC_BOX_STATE_RECV_LAST_COMMON) {
+			if (dsync_brain_export_deinit(bbox) < 0)
 				return TRUE;
 		}
-		dsync_brain_sync_half_finished(brain);
+		dsync_brain_sync_half_finished(bbox);
 		return TRUE;
 	}
 	if (brain->debug) {
 		i_debug("brain %c: import mail uid %u guid %s",
 			brain->master_brain ? 'M' : 'S', mail->uid, mail->guid);
 	}
-	if (dsync_mailbox_import_mail(brain->box_importer, mail) < 0)
+	if (dsync_mailbox_import_mail(bbox->box_importer, mail) < 0)
 		brain->failed = TRUE;
 	i_stream_unref(&mail->input);
 	return TRUE;
 }
 
-static bool dsync_brain_send_mail(struct dsync_brain *brain)
+static bool dsync_brain_send_mail(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	const struct dsync_mail *mail;
 
 	if (brain->mail_requests &&
-	    brain->box_recv_state < DSYNC_BOX_STATE_MAILS) {
+	    bbox->box_recv_state < DSYNC_BOX_STATE_MAILS) {
 		/* wait for mail requests to finish. we could already start
 		   exporting, but then we're going to do quite a lot of
 		   separate searches. especially with pipe backend we'd do
@@ -325,23 +338,24 @@ static bool dsync_brain_send_mail(struct dsync_brain *brain)
 		return FALSE;
 	}
 
-	while (dsync_mailbox_export_next_mail(brain->box_exporter, &mail) > 0) {
+	while (dsync_mailbox_export_next_mail(bbox->box_exporter, &mail) > 0) {
 		if (dsync_ibc_send_mail(brain->ibc, mail) == 0)
 			return TRUE;
 	}
 
-	if (dsync_brain_export_deinit(brain) < 0)
+	if (dsync_brain_export_deinit(bbox) < 0)
 		return TRUE;
 
-	brain->box_send_state = DSYNC_BOX_STATE_DONE;
+	bbox->box_send_state = DSYNC_BOX_STATE_DONE;
 	dsync_brain_send_end_of_list(brain, DSYNC_IBC_EOL_MAILS);
 
-	dsync_brain_sync_half_finished(brain);
+	dsync_brain_sync_half_finished(bbox);
 	return TRUE;
 }
 
-static bool dsync_brain_recv_last_common(struct dsync_brain *brain)
+static bool dsync_brain_recv_last_common(struct dsync_brain_mailbox *bbox)
 {
+	struct dsync_brain *brain = bbox->brain;
 	enum dsync_ibc_recv_ret ret;
 	struct dsync_mailbox_state state;
 
@@ -352,81 +366,155 @@ static bool dsync_brain_recv_last_common(struct dsync_brain *brain)
 		brain->failed = TRUE;
 		return TRUE;
 	}
-	i_assert(brain->box_send_state == DSYNC_BOX_STATE_DONE);
-	i_assert(memcmp(state.mailbox_guid, brain->local_dsync_box.mailbox_guid,
+	i_assert(bbox->box_send_state == DSYNC_BOX_STATE_DONE);
+	i_assert(memcmp(state.mailbox_guid, bbox->local_dsync_box.mailbox_guid,
 			sizeof(state.mailbox_guid)) == 0);
 
 	/* normally the last_common_* values should be the same in local and
 	   remote, but during unexpected changes they may differ. use the
 	   values that are lower as the final state. */
-	if (brain->mailbox_state.last_common_uid > state.last_common_uid)
-		brain->mailbox_state.last_common_uid = state.last_common_uid;
-	if (brain->mailbox_state.last_common_modseq > state.last_common_modseq)
-		brain->mailbox_state.last_common_modseq = state.last_common_modseq;
-	if (brain->mailbox_state.last_common_pvt_modseq > state.last_common_pvt_modseq)
-		brain->mailbox_state.last_common_pvt_modseq = state.last_common_pvt_modseq;
+	if (bbox->mailbox_state.last_common_uid > state.last_common_uid)
+		bbox->mailbox_state.last_common_uid = state.last_common_uid;
+	if (bbox->mailbox_state.last_common_modseq > state.last_common_modseq)
+		bbox->mailbox_state.last_common_modseq = state.last_common_modseq;
+	if (bbox->mailbox_state.last_common_pvt_modseq > state.last_common_pvt_modseq)
+		bbox->mailbox_state.last_common_pvt_modseq = state.last_common_pvt_modseq;
 	if (state.changes_during_sync)
 		brain->changes_during_remote_sync = TRUE;
 
-	dsync_brain_sync_mailbox_deinit(brain);
+	dsync_brain_sync_mailbox_deinit(bbox);
 	return TRUE;
 }
 
-bool dsync_brain_sync_mails(struct dsync_brain *brain)
+static struct dsync_brain_mailbox *
+dsync_brain_mailbox_find_channel(struct dsync_brain *brain,
+				 unsigned int channel)
+{
+	struct dsync_brain_mailbox *bbox;
+
+	array_foreach_elem(&brain->boxes, bbox) {
+		if (bbox->channel == channel)
+			return bbox;
+	}
+	return NULL;
+}
+
+static bool dsync_brain_mailbox_recv(struct dsync_brain_mailbox *bbox)
 {
 	bool changed = FALSE;
 
-	i_assert(brain->box != NULL);
+	/* anything sent while handling the input belongs to this mailbox */
+	dsync_ibc_set_send_channel(bbox->brain->ibc, bbox->channel);
 
-	switch (brain->box_recv_state) {
+	switch (bbox->box_recv_state) {
 	case DSYNC_BOX_STATE_MAILBOX:
-		changed = dsync_brain_master_sync_recv_mailbox(brain);
+		changed = dsync_brain_master_sync_recv_mailbox(bbox);
 		break;
 	case DSYNC_BOX_STATE_ATTRIBUTES:
-		changed = dsync_brain_recv_mailbox_attribute(brain);
+		changed = dsync_brain_recv_mailbox_attribute(bbox);
 		break;
 	case DSYNC_BOX_STATE_CHANGES:
-		changed = dsync_brain_recv_mail_change(brain);
+		changed = dsync_brain_recv_mail_change(bbox);
 		break;
 	case DSYNC_BOX_STATE_MAIL_REQUESTS:
-		changed = dsync_brain_recv_mail_request(brain);
+		changed = dsync_brain_recv_mail_request(bbox);
 		break;
 	case DSYNC_BOX_STATE_MAILS:
-		changed = dsync_brain_recv_mail(brain);
+		changed = dsync_brain_recv_mail(bbox);
 		break;
 	case DSYNC_BOX_STATE_RECV_LAST_COMMON:
-		changed = dsync_brain_recv_last_common(brain);
+		changed = dsync_brain_recv_last_common(bbox);
 		break;
 	case DSYNC_BOX_STATE_DONE:
 		break;
 	}
+	return changed;
+}
 
-	if (!dsync_ibc_is_send_queue_full(brain->ibc) && !brain->failed) {
-		switch (brain->box_send_state) {
-		case DSYNC_BOX_STATE_MAILBOX:
-			/* wait for mailbox to be received first */
-			break;
-		case DSYNC_BOX_STATE_ATTRIBUTES:
-			dsync_brain_send_mailbox_attribute(brain);
+static bool dsync_brain_mailbox_send(struct dsync_brain_mailbox *bbox)
+{
+	bool changed = FALSE;
+
+	dsync_ibc_set_send_channel(bbox->brain->ibc, bbox->channel);
+
+	switch (bbox->box_send_state) {
+	case DSYNC_BOX_STATE_MAILBOX:
+		/* wait for mailbox to be received first */
+		break;
+	case DSYNC_BOX_STATE_ATTRIBUTES:
+		dsync_brain_send_mailbox_attribute(bbox);
+		changed = TRUE;
+		break;
+	case DSYNC_BOX_STATE_CHANGES:
+		dsync_brain_send_mail_change(bbox);
+		changed = TRUE;
+		break;
+	case DSYNC_BOX_STATE_MAIL_REQUESTS:
+		if (dsync_brain_send_mail_request(bbox))
 			changed = TRUE;
-			break;
-		case DSYNC_BOX_STATE_CHANGES:
-			dsync_brain_send_mail_change(brain);
+		break;
+	case DSYNC_BOX_STATE_MAILS:
+		if (dsync_brain_send_mail(bbox))
 			changed = TRUE;
+		break;
+	case DSYNC_BOX_STATE_RECV_LAST_COMMON:
+		i_unreached();
+	case DSYNC_BOX_STATE_DONE:
+		break;
+	}
+	return changed;
+}
+
+static bool dsync_brain_sync_mails_recv(struct dsync_brain *brain)
+{
+	struct dsync_brain_mailbox *bbox;
+	unsigned int channel;
+
+	if (dsync_ibc_recv_channel(brain->ibc, &channel) == 0)
+		return FALSE;
+
+	bbox = dsync_brain_mailbox_find_channel(brain, channel);
+	if (bbox != NULL)
+		return dsync_brain_mailbox_recv(bbox);
+	if (!brain->master_brain) {
+		/* master started syncing another mailbox */
+		return dsync_brain_slave_recv_mailbox(brain);
+	}
+	i_error("Remote sent input for unknown channel %u", channel);
+	brain->failed = TRUE;
+	return TRUE;
+}
+
+bool dsync_brain_sync_mails(struct dsync_brain *brain)
+{
+	struct dsync_brain_mailbox *const *bboxes, *bbox;
+	unsigned int i, count;
+	bool changed;
+
+	i_assert(array_count(&brain->boxes) > 0);
+
+	changed = dsync_brain_sync_mails_recv(brain);
+
+	if (brain->master_brain && !brain->failed &&
+	    brain->state == DSYNC_STATE_SYNC_MAILS &&
+	    array_count(&brain->boxes) < brain->mailbox_concurrency &&
+	    brain->local_tree_iter != NULL) {
+		/* start syncing the next mailbox while waiting for the
+		   remote to reply for the previous ones */
+		dsync_brain_master_send_mailbox(brain);
+		changed = TRUE;
+	}
+
+	/* rotate the mailbox that gets to send first, so one large mailbox
+	   doesn't keep the send queue full for all the others */
+	bboxes = array_get(&brain->boxes, &count);
+	for (i = 0; i < count; i++) {
+		bbox = bboxes[(brain->box_send_idx + i) % count];
+		if (dsync_ibc_is_send_queue_full(brain->ibc) || brain->failed)
 			break;
-		case DSYNC_BOX_STATE_MAIL_REQUESTS:
-			if (dsync_brain_send_mail_request(brain))
-				changed = TRUE;
-			break;
-		case DSYNC_BOX_STATE_MAILS:
-			if (dsync_brain_send_mail(brain))
-				changed = TRUE;
-			break;
-		case DSYNC_BOX_STATE_RECV_LAST_COMMON:
-			i_unreached();
-		case DSYNC_BOX_STATE_DONE:
-			break;
-		}
+		if (dsync_brain_mailbox_send(bbox))
+			changed = TRUE;
 	}
+	brain->box_send_idx++;
 	return changed;
 }
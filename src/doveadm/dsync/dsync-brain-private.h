@@ -31,7 +31,9 @@ enum dsync_state {
 	DSYNC_STATE_MASTER_SEND_MAILBOX,
 	DSYNC_STATE_SLAVE_RECV_MAILBOX,
 	/* once mailbox is selected, the mails inside it are synced.
-	   after the mails are synced, another mailbox is synced. */
+	   after the mails are synced, another mailbox is synced. if the
+	   remote supports ibc channels, master may select more mailboxes
+	   while the previous ones are still being synced. */
 	DSYNC_STATE_SYNC_MAILS,
 
 	DSYNC_STATE_FINISH,
@@ -48,6 +50,27 @@ enum dsync_box_state {
 	DSYNC_BOX_STATE_DONE
 };
 
+/* A mailbox that is currently being synced */
+struct dsync_brain_mailbox {
+	pool_t pool;
+	struct dsync_brain *brain;
+	/* ibc channel used for this mailbox's items */
+	unsigned int channel;
+
+	enum dsync_box_state box_recv_state;
+	enum dsync_box_state box_send_state;
+
+	struct dsync_transaction_log_scan *log_scan;
+	struct dsync_mailbox_importer *box_importer;
+	struct dsync_mailbox_exporter *box_exporter;
+
+	struct mailbox *box;
+	struct file_lock *box_lock;
+	struct dsync_mailbox local_dsync_box, remote_dsync_box;
+	/* state of the mailbox, changed at init and deinit */
+	struct dsync_mailbox_state mailbox_state;
+};
+
 struct dsync_brain {
 	pool_t pool;
 	struct mail_user *user;
@@ -56,6 +79,7 @@ struct dsync_brain {
 	ARRAY(struct mail_namespace *) sync_namespaces;
 	const char *sync_box;
 	struct mailbox *virtual_all_box;
+	struct dsync_mailbox_import_dedup *import_dedup;
 	guid_128_t sync_box_guid;
 	const char *const *exclude_mailboxes;
 	enum dsync_brain_sync_type sync_type;
@@ -78,28 +102,23 @@ struct dsync_brain {
 	struct dsync_mailbox_tree_iter *local_tree_iter;
 
 	enum dsync_state state, pre_box_state;
-	enum dsync_box_state box_recv_state;
-	enum dsync_box_state box_send_state;
 	unsigned int proctitle_update_counter;
 
-	struct dsync_transaction_log_scan *log_scan;
-	struct dsync_mailbox_importer *box_importer;
-	struct dsync_mailbox_exporter *box_exporter;
+	/* mailboxes currently being synced */
+	ARRAY(struct dsync_brain_mailbox *) boxes;
+	/* maximum number of mailboxes synced at the same time */
+	unsigned int mailbox_concurrency;
+	unsigned int last_channel;
+	/* box index where the next sending round starts */
+	unsigned int box_send_idx;
 
-	struct mailbox *box;
-	struct file_lock *box_lock;
 	unsigned int mailbox_lock_timeout_secs;
-	struct dsync_mailbox local_dsync_box, remote_dsync_box;
-	pool_t dsync_box_pool;
 	/* list of mailbox states
 	   for master brain: given to brain at init and
 	   for slave brain: received from DSYNC_STATE_SLAVE_RECV_LAST_COMMON */
 	HASH_TABLE_TYPE(dsync_mailbox_state) mailbox_states;
 	/* DSYNC_STATE_MASTER_SEND_LAST_COMMON: current send position */
 	struct hash_iterate_context *mailbox_states_iter;
-	/* state of the mailbox we're currently syncing, changed at
-	   init and deinit */
-	struct dsync_mailbox_state mailbox_state;
 	/* new states for synced mailboxes */
 	ARRAY_TYPE(dsync_mailbox_state) remote_mailbox_states;
 
@@ -138,7 +157,7 @@ int dsync_brain_mailbox_tree_sync_change(struct dsync_brain *brain,
 			const struct dsync_mailbox_tree_sync_change *change,
 			enum mail_error *error_r);
 
-void dsync_brain_sync_mailbox_deinit(struct dsync_brain *brain);
+void dsync_brain_sync_mailbox_deinit(struct dsync_brain_mailbox *bbox);
 int dsync_brain_mailbox_alloc(struct dsync_brain *brain, const guid_128_t guid,
 			      struct mailbox **box_r, const char **errstr_r,
 			      enum mail_error *error_r);
@@ -150,13 +169,13 @@ bool dsync_brain_mailbox_update_pre(struct dsync_brain *brain,
 bool dsync_boxes_need_sync(struct dsync_brain *brain,
 			   const struct dsync_mailbox *box1,
 			   const struct dsync_mailbox *box2);
-void dsync_brain_sync_init_box_states(struct dsync_brain *brain);
+void dsync_brain_sync_init_box_states(struct dsync_brain_mailbox *bbox);
 void dsync_brain_set_changes_during_sync(struct dsync_brain *brain,
 					 const char *reason);
 
 void dsync_brain_master_send_mailbox(struct dsync_brain *brain);
 bool dsync_brain_slave_recv_mailbox(struct dsync_brain *brain);
-int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
+int dsync_brain_sync_mailbox_open(struct dsync_brain_mailbox *bbox,
 				  const struct dsync_mailbox *remote_dsync_box);
 bool dsync_brain_sync_mails(struct dsync_brain *brain);
 
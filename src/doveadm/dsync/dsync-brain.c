@@ -47,26 +47,32 @@ dsync_brain_get_proctitle_full(struct dsync_brain *brain,
 			       enum dsync_brain_title title)
 {
 	string_t *str = t_str_new(128);
+	struct dsync_brain_mailbox *bbox;
 	const char *import_title, *export_title;
 
 	str_append_c(str, '[');
 	if (brain->process_title_prefix != NULL)
 		str_append(str, brain->process_title_prefix);
 	str_append(str, brain->user->username);
-	if (brain->box == NULL) {
+	if (array_count(&brain->boxes) == 0) {
 		str_append_c(str, ' ');
 		str_append(str, dsync_state_names[brain->state]);
+	} else if (array_count(&brain->boxes) > 1) {
+		str_printfa(str, " %s (%u mailboxes)",
+			    dsync_state_names[brain->state],
+			    array_count(&brain->boxes));
 	} else {
+		bbox = array_idx_elem(&brain->boxes, 0);
 		str_append_c(str, ' ');
-		str_append(str, mailbox_get_vname(brain->box));
-		import_title = brain->box_importer == NULL ? "" :
-			dsync_mailbox_import_get_proctitle(brain->box_importer);
-		export_title = brain->box_exporter == NULL ? "" :
-			dsync_mailbox_export_get_proctitle(brain->box_exporter);
+		str_append(str, mailbox_get_vname(bbox->box));
+		import_title = bbox->box_importer == NULL ? "" :
+			dsync_mailbox_import_get_proctitle(bbox->box_importer);
+		export_title = bbox->box_exporter == NULL ? "" :
+			dsync_mailbox_export_get_proctitle(bbox->box_exporter);
 		if (import_title[0] == '\0' && export_title[0] == '\0') {
 			str_printfa(str, " send:%s recv:%s",
-				    dsync_box_state_names[brain->box_send_state],
-				    dsync_box_state_names[brain->box_recv_state]);
+				    dsync_box_state_names[bbox->box_send_state],
+				    dsync_box_state_names[bbox->box_recv_state]);
 		} else {
 			if (import_title[0] != '\0') {
 				str_append(str, " import:");
@@ -139,9 +145,12 @@ dsync_brain_common_init(struct mail_user *user, struct dsync_ibc *ibc)
 	brain->sync_type = DSYNC_BRAIN_SYNC_TYPE_UNKNOWN;
 	brain->lock_fd = -1;
 	brain->verbose_proctitle = service_set->verbose_proctitle;
+	brain->mailbox_concurrency = 1;
+	p_array_init(&brain->boxes, pool, 4);
 	hash_table_create(&brain->mailbox_states, pool, 0,
 			  guid_128_hash, guid_128_cmp);
 	p_array_init(&brain->remote_mailbox_states, pool, 64);
+	brain->import_dedup = dsync_mailbox_import_dedup_init();
 	return brain;
 }
 
@@ -227,6 +236,8 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 		brain->mailbox_lock_timeout_secs =
 			DSYNC_MAILBOX_DEFAULT_LOCK_TIMEOUT_SECS;
 	brain->import_commit_msgs_interval = set->import_commit_msgs_interval;
+	if (set->mailbox_concurrency > 1)
+		brain->mailbox_concurrency = set->mailbox_concurrency;
 	brain->master_brain = TRUE;
 	brain->hashed_headers =
 		(const char*const*)p_strarray_dup(brain->pool, set->hashed_headers);
@@ -338,9 +349,23 @@ static void dsync_brain_purge(struct dsync_brain *brain)
 	}
 }
 
+static const char *dsync_brain_get_box_states(struct dsync_brain *brain)
+{
+	string_t *str = t_str_new(64);
+	struct dsync_brain_mailbox *bbox;
+
+	array_foreach_elem(&brain->boxes, bbox) {
+		str_printfa(str, " (send=%s recv=%s)",
+			    dsync_box_state_names[bbox->box_send_state],
+			    dsync_box_state_names[bbox->box_recv_state]);
+	}
+	return str_c(str);
+}
+
 int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 {
 	struct dsync_brain *brain = *_brain;
+	struct dsync_brain_mailbox *bbox;
 	int ret;
 
 	*_brain = NULL;
@@ -349,9 +374,7 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 		i_error("Timeout during state=%s%s",
 			dsync_state_names[brain->state],
 			brain->state != DSYNC_STATE_SYNC_MAILS ? "" :
-			t_strdup_printf(" (send=%s recv=%s)",
-				dsync_box_state_names[brain->box_send_state],
-				dsync_box_state_names[brain->box_recv_state]));
+			dsync_brain_get_box_states(brain));
 	}
 	if (dsync_ibc_has_failed(brain->ibc) ||
 	    brain->state != DSYNC_STATE_DONE)
@@ -361,10 +384,13 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 	if (brain->purge && !brain->failed)
 		dsync_brain_purge(brain);
 
-	if (brain->box != NULL)
-		dsync_brain_sync_mailbox_deinit(brain);
+	while (array_count(&brain->boxes) > 0) {
+		bbox = array_idx_elem(&brain->boxes, 0);
+		dsync_brain_sync_mailbox_deinit(bbox);
+	}
 	if (brain->virtual_all_box != NULL)
 		mailbox_free(&brain->virtual_all_box);
+	dsync_mailbox_import_dedup_deinit(&brain->import_dedup);
 	if (brain->local_tree_iter != NULL)
 		dsync_mailbox_tree_iter_deinit(&brain->local_tree_iter);
 	if (brain->local_mailbox_tree != NULL)
@@ -374,8 +400,6 @@ int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 	hash_table_iterate_deinit(&brain->mailbox_states_iter);
 	hash_table_destroy(&brain->mailbox_states);
 
-	pool_unref(&brain->dsync_box_pool);
-
 	if (brain->lock_fd != -1) {
 		/* unlink the lock file before it gets unlocked */
 		i_unlink(brain->lock_path);
@@ -495,6 +519,15 @@ static bool dsync_brain_master_recv_handshake(struct dsync_brain *brain)
 		}
 	}
 	dsync_brain_set_hdr_hash_version(brain, ibc_set);
+	if (brain->mailbox_concurrency > 1 &&
+	    !dsync_ibc_have_channels(brain->ibc)) {
+		if (brain->debug) {
+			i_debug("brain %c: Remote doesn't support syncing "
+				"mailboxes concurrently",
+				brain->master_brain ? 'M' : 'S');
+		}
+		brain->mailbox_concurrency = 1;
+	}
 
 	brain->state = brain->sync_type == DSYNC_BRAIN_SYNC_TYPE_STATE ?
 		DSYNC_STATE_MASTER_SEND_LAST_COMMON :
@@ -645,6 +678,7 @@ static bool dsync_brain_finish(struct dsync_brain *brain)
 	enum dsync_ibc_recv_ret ret;
 
 	if (!brain->master_brain) {
+		dsync_ibc_set_send_channel(brain->ibc, 0);
 		dsync_ibc_send_finish(brain->ibc,
 				      brain->failed ? "dsync failed" : NULL,
 				      brain->mail_error,
@@ -669,13 +703,33 @@ static bool dsync_brain_finish(struct dsync_brain *brain)
 	return TRUE;
 }
 
+static void
+dsync_brain_get_first_box_states(struct dsync_brain *brain,
+				 enum dsync_box_state *recv_state_r,
+				 enum dsync_box_state *send_state_r)
+{
+	struct dsync_brain_mailbox *bbox;
+
+	if (array_count(&brain->boxes) == 0) {
+		*recv_state_r = *send_state_r = DSYNC_BOX_STATE_DONE;
+		return;
+	}
+	bbox = array_idx_elem(&brain->boxes, 0);
+	*recv_state_r = bbox->box_recv_state;
+	*send_state_r = bbox->box_send_state;
+}
+
 static bool dsync_brain_run_real(struct dsync_brain *brain, bool *changed_r)
 {
 	enum dsync_state orig_state = brain->state;
-	enum dsync_box_state orig_box_recv_state = brain->box_recv_state;
-	enum dsync_box_state orig_box_send_state = brain->box_send_state;
+	unsigned int orig_box_count = array_count(&brain->boxes);
+	enum dsync_box_state orig_box_recv_state, orig_box_send_state;
+	enum dsync_box_state box_recv_state, box_send_state;
 	bool changed = FALSE, ret = TRUE;
 
+	dsync_brain_get_first_box_states(brain, &orig_box_recv_state,
+					 &orig_box_send_state);
+
 	if (brain->failed)
 		return FALSE;
 
@@ -726,9 +780,12 @@ static bool dsync_brain_run_real(struct dsync_brain *brain, bool *changed_r)
 		break;
 	}
 	if (brain->verbose_proctitle) {
+		dsync_brain_get_first_box_states(brain, &box_recv_state,
+						 &box_send_state);
 		if (orig_state != brain->state ||
-		    orig_box_recv_state != brain->box_recv_state ||
-		    orig_box_send_state != brain->box_send_state ||
+		    orig_box_count != array_count(&brain->boxes) ||
+		    orig_box_recv_state != box_recv_state ||
+		    orig_box_send_state != box_send_state ||
 		    ++brain->proctitle_update_counter % 100 == 0)
 			process_title_set(dsync_brain_get_proctitle(brain));
 	}
@@ -84,6 +84,9 @@ struct dsync_brain_settings {
 	/* If non-zero, importing will attempt to commit transaction after
 	   saving this many messages. */
 	unsigned int import_commit_msgs_interval;
+	/* Sync up to this many mailboxes at the same time. Values above 1 are
+	   used only if the remote supports it. */
+	unsigned int mailbox_concurrency;
 	/* Input state for DSYNC_BRAIN_SYNC_TYPE_STATE */
 	const char *state;
 };
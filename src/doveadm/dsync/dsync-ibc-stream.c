@@ -10,6 +10,8 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "http-transfer.h"
+#include "compression.h"
 #include "master-service.h"
 #include "mail-cache.h"
 #include "mail-storage-private.h"
@@ -25,14 +27,26 @@
 #define DSYNC_IBC_STREAM_OUTBUF_THROTTLE_SIZE (1024*128)
 
 #define DSYNC_PROTOCOL_VERSION_MAJOR 3
-#define DSYNC_PROTOCOL_VERSION_MINOR 5
-#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t5\n"
+#define DSYNC_PROTOCOL_VERSION_MINOR 7
+#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t7\n"
 
 #define DSYNC_PROTOCOL_MINOR_HAVE_ATTRIBUTES 1
 #define DSYNC_PROTOCOL_MINOR_HAVE_SAVE_GUID 2
 #define DSYNC_PROTOCOL_MINOR_HAVE_FINISH 3
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2 4
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3 5
+#define DSYNC_PROTOCOL_MINOR_HAVE_CHANNELS 6
+/* Mail/attribute streams are sent with chunked transfer encoding instead of
+   dot-escaping, and "Z" can be used to start compressing the stream. */
+#define DSYNC_PROTOCOL_MINOR_HAVE_CHUNKED_STREAMS 7
+#define DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION 7
+
+/* "Z<tab><compression handler>" switches the rest of the stream to be
+   compressed. It can be sent between any items. */
+#define COMPRESSION_LINE_PREFIX "Z\t"
+/* "L<tab><channel>" means that the following items belong to the given
+   channel. It's sent only when the channel changes. */
+#define CHANNEL_LINE_PREFIX "L\t"
 
 enum item_type {
 	ITEM_NONE,
@@ -149,6 +163,7 @@ struct dsync_ibc_stream {
 	struct ostream *output;
 	struct io *io;
 	struct timeout *to;
+	const struct compression_handler *compress_handler;
 
 	unsigned int minor_version;
 	struct dsync_serializer *serializers[ITEM_END_OF_LIST];
@@ -162,9 +177,16 @@ struct dsync_ibc_stream {
 	struct dsync_mailbox_attribute *cur_attr;
 	char value_output_last;
 
+	/* send_channel is what the brain wants to use, sent_channel is what
+	   was last sent to remote. */
+	unsigned int send_channel, sent_channel, recv_channel;
+	/* line read by dsync_ibc_stream_recv_channel(), but not yet handled */
+	string_t *peek_line;
+
 	enum item_type last_recv_item, last_sent_item;
 	bool last_recv_item_eol:1;
 	bool last_sent_item_eol:1;
+	bool have_peek_line:1;
 
 	bool version_received:1;
 	bool handshake_received:1;
@@ -172,6 +194,8 @@ struct dsync_ibc_stream {
 	bool finish_received:1;
 	bool done_received:1;
 	bool stopped:1;
+	bool output_compressed:1;
+	bool input_compressed:1;
 };
 
 static const char *dsync_ibc_stream_get_state(struct dsync_ibc_stream *ibc)
@@ -233,7 +257,49 @@ static void dsync_ibc_stream_input(struct dsync_ibc_stream *ibc)
 	o_stream_uncork(ibc->output);
 }
 
-static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
+static int dsync_ibc_stream_flush_value_stream(struct dsync_ibc_stream *ibc)
+{
+	int ret;
+
+	if (o_stream_get_buffer_used_size(ibc->output) < 4096)
+		return 1;
+
+	if ((ret = o_stream_flush(ibc->output)) < 0) {
+		dsync_ibc_stream_stop(ibc);
+		return -1;
+	}
+	if (ret == 0) {
+		/* continue later */
+		o_stream_set_flush_pending(ibc->output, TRUE);
+		return 0;
+	}
+	return 1;
+}
+
+static int
+dsync_ibc_stream_send_value_stream_chunks(struct dsync_ibc_stream *ibc)
+{
+	const unsigned char *data;
+	char chunk_hdr[MAX_INT_STRLEN + 3];
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(ibc->value_output, &data, &size)) > 0) {
+		i_snprintf(chunk_hdr, sizeof(chunk_hdr), "%zx\r\n", size);
+		o_stream_nsend_str(ibc->output, chunk_hdr);
+		o_stream_nsend(ibc->output, data, size);
+		o_stream_nsend(ibc->output, "\r\n", 2);
+		i_stream_skip(ibc->value_output, size);
+
+		if ((ret = dsync_ibc_stream_flush_value_stream(ibc)) <= 0)
+			return ret;
+	}
+	i_assert(ret == -1);
+	return 1;
+}
+
+static int
+dsync_ibc_stream_send_value_stream_dots(struct dsync_ibc_stream *ibc)
 {
 	const unsigned char *data;
 	unsigned char add;
@@ -258,17 +324,8 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 			i_stream_skip(ibc->value_output, i);
 		}
 
-		if (o_stream_get_buffer_used_size(ibc->output) >= 4096) {
-			if ((ret = o_stream_flush(ibc->output)) < 0) {
-				dsync_ibc_stream_stop(ibc);
-				return -1;
-			}
-			if (ret == 0) {
-				/* continue later */
-				o_stream_set_flush_pending(ibc->output, TRUE);
-				return 0;
-			}
-		}
+		if ((ret = dsync_ibc_stream_flush_value_stream(ibc)) <= 0)
+			return ret;
 
 		if (add != '\0') {
 			o_stream_nsend(ibc->output, &add, 1);
@@ -276,6 +333,21 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 		}
 	}
 	i_assert(ret == -1);
+	return 1;
+}
+
+static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
+{
+	bool chunked = ibc->minor_version >=
+		DSYNC_PROTOCOL_MINOR_HAVE_CHUNKED_STREAMS;
+	int ret;
+
+	if (chunked)
+		ret = dsync_ibc_stream_send_value_stream_chunks(ibc);
+	else
+		ret = dsync_ibc_stream_send_value_stream_dots(ibc);
+	if (ret <= 0)
+		return ret;
 
 	if (ibc->value_output->stream_errno != 0) {
 		i_error("dsync(%s): read(%s) failed: %s (%s)",
@@ -286,9 +358,14 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 		return -1;
 	}
 
-	/* finished sending the stream. use "CRLF." instead of "LF." just in
-	   case we're sending binary data that ends with CR. */
-	o_stream_nsend_str(ibc->output, "\r\n.\r\n");
+	if (chunked) {
+		/* last chunk */
+		o_stream_nsend_str(ibc->output, "0\r\n\r\n");
+	} else {
+		/* finished sending the stream. use "CRLF." instead of "LF."
+		   just in case we're sending binary data that ends with CR. */
+		o_stream_nsend_str(ibc->output, "\r\n.\r\n");
+	}
 	i_stream_unref(&ibc->value_output);
 	return 1;
 }
@@ -311,6 +388,30 @@ static int dsync_ibc_stream_output(struct dsync_ibc_stream *ibc)
 	return ret;
 }
 
+static void
+dsync_ibc_stream_compress_output(struct dsync_ibc_stream *ibc,
+				 const struct compression_handler *handler)
+{
+	struct ostream *output;
+	bool corked = o_stream_is_corked(ibc->output);
+
+	i_assert(!ibc->output_compressed);
+	i_assert(ibc->value_output == NULL);
+
+	o_stream_nsend_str(ibc->output, t_strdup_printf(
+		COMPRESSION_LINE_PREFIX"%s\n", handler->name));
+	if (corked)
+		o_stream_uncork(ibc->output);
+	output = handler->create_ostream(ibc->output,
+					 handler->get_default_level());
+	o_stream_unref(&ibc->output);
+	ibc->output = output;
+	o_stream_set_flush_callback(ibc->output, dsync_ibc_stream_output, ibc);
+	if (corked)
+		o_stream_cork(ibc->output);
+	ibc->output_compressed = TRUE;
+}
+
 static void dsync_ibc_stream_timeout(struct dsync_ibc_stream *ibc)
 {
 	i_error("dsync(%s): I/O has stalled, no activity for %u seconds (%s)",
@@ -393,12 +494,13 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 	i_stream_destroy(&ibc->input);
 	o_stream_destroy(&ibc->output);
 	pool_unref(&ibc->ret_pool);
+	str_free(&ibc->peek_line);
 	i_free(ibc->temp_path_prefix);
 	i_free(ibc->name);
 	i_free(ibc);
 }
 
-static int dsync_ibc_stream_next_line(struct dsync_ibc_stream *ibc,
+static int dsync_ibc_stream_read_line(struct dsync_ibc_stream *ibc,
 				      const char **line_r)
 {
 	string_t *error;
@@ -458,11 +560,85 @@ dsync_ibc_input_error(struct dsync_ibc_stream *ibc,
 	dsync_ibc_stream_stop(ibc);
 }
 
+static int
+dsync_ibc_stream_decompress_input(struct dsync_ibc_stream *ibc,
+				  const char *handler_name)
+{
+	const struct compression_handler *handler;
+	struct istream *input;
+
+	if (ibc->input_compressed) {
+		dsync_ibc_input_error(ibc, NULL,
+			"Remote enabled compression twice");
+		return -1;
+	}
+	if (compression_lookup_handler(handler_name, &handler) <= 0) {
+		dsync_ibc_input_error(ibc, NULL,
+			"Remote uses unsupported compression: %s",
+			handler_name);
+		return -1;
+	}
+
+	/* the rest of the already buffered input is read via the
+	   decompression stream */
+	input = handler->create_istream(ibc->input);
+	i_stream_unref(&ibc->input);
+	ibc->input = input;
+	io_remove(&ibc->io);
+	ibc->io = io_add_istream(ibc->input, dsync_ibc_stream_input, ibc);
+	ibc->input_compressed = TRUE;
+
+	/* compress our output as well with the same handler */
+	if (!ibc->output_compressed)
+		dsync_ibc_stream_compress_output(ibc, handler);
+	return 0;
+}
+
+static int dsync_ibc_stream_next_line(struct dsync_ibc_stream *ibc,
+				      const char **line_r)
+{
+	unsigned int minor = ibc->minor_version;
+	const char *value;
+	int ret;
+
+	while ((ret = dsync_ibc_stream_read_line(ibc, line_r)) > 0) {
+		if (minor >= DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION &&
+		    str_begins(*line_r, COMPRESSION_LINE_PREFIX)) {
+			value = *line_r + strlen(COMPRESSION_LINE_PREFIX);
+			if (dsync_ibc_stream_decompress_input(ibc, value) < 0)
+				return -1;
+		} else if (minor >= DSYNC_PROTOCOL_MINOR_HAVE_CHANNELS &&
+			   str_begins(*line_r, CHANNEL_LINE_PREFIX)) {
+			value = *line_r + strlen(CHANNEL_LINE_PREFIX);
+			if (str_to_uint(value, &ibc->recv_channel) < 0) {
+				dsync_ibc_input_error(ibc, NULL,
+					"Invalid channel: %s", value);
+				return -1;
+			}
+		} else {
+			break;
+		}
+	}
+	return ret;
+}
+
+static void dsync_ibc_stream_send_channel(struct dsync_ibc_stream *ibc)
+{
+	if (ibc->send_channel == ibc->sent_channel)
+		return;
+
+	i_assert(ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_CHANNELS);
+	o_stream_nsend_str(ibc->output, t_strdup_printf(
+		CHANNEL_LINE_PREFIX"%u\n", ibc->send_channel));
+	ibc->sent_channel = ibc->send_channel;
+}
+
 static void
 dsync_ibc_stream_send_string(struct dsync_ibc_stream *ibc,
 			     const string_t *str)
 {
 	i_assert(ibc->value_output == NULL);
+	dsync_ibc_stream_send_channel(ibc);
 	o_stream_nsend(ibc->output, str_data(str), str_len(str));
 }
 
@@ -496,7 +672,10 @@ dsync_ibc_stream_input_stream(struct dsync_ibc_stream *ibc)
 {
 	struct istream *inputs[2];
 
-	inputs[0] = i_stream_create_dot(ibc->input, FALSE);
+	if (ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_CHUNKED_STREAMS)
+		inputs[0] = http_transfer_chunked_istream_create(ibc->input, 0);
+	else
+		inputs[0] = i_stream_create_dot(ibc->input, FALSE);
 	inputs[1] = NULL;
 	ibc->value_input = i_stream_create_seekable(inputs, MAIL_READ_FULL_BLOCK_SIZE,
 						    seekable_fd_callback, ibc);
@@ -544,6 +723,10 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 			return DSYNC_IBC_RECV_RET_TRYAGAIN;
 		}
 		ibc->version_received = TRUE;
+		if (ibc->compress_handler != NULL &&
+		    !ibc->output_compressed &&
+		    ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION)
+			dsync_ibc_stream_compress_output(ibc, ibc->compress_handler);
 		return FALSE;
 	}
 
@@ -579,6 +762,17 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 	return FALSE;
 }
 
+static int
+dsync_ibc_stream_next_item_line(struct dsync_ibc_stream *ibc,
+				const char **line_r)
+{
+	do {
+		if (dsync_ibc_stream_next_line(ibc, line_r) <= 0)
+			return -1;
+	} while (!dsync_ibc_stream_handshake(ibc, *line_r));
+	return 1;
+}
+
 static enum dsync_ibc_recv_ret
 dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 			    struct dsync_deserializer_decoder **decoder_r)
@@ -591,10 +785,11 @@ dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 
 	timeout_reset(ibc->to);
 
-	do {
-		if (dsync_ibc_stream_next_line(ibc, &line) <= 0)
-			return DSYNC_IBC_RECV_RET_TRYAGAIN;
-	} while (!dsync_ibc_stream_handshake(ibc, line));
+	if (ibc->have_peek_line) {
+		line = str_c(ibc->peek_line);
+		ibc->have_peek_line = FALSE;
+	} else if (dsync_ibc_stream_next_item_line(ibc, &line) <= 0)
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
 
 	ibc->last_recv_item = item;
 	ibc->last_recv_item_eol = FALSE;
@@ -923,6 +1118,7 @@ dsync_ibc_stream_send_end_of_list(struct dsync_ibc *_ibc,
 	}
 
 	ibc->last_sent_item_eol = TRUE;
+	dsync_ibc_stream_send_channel(ibc);
 	o_stream_nsend_str(ibc->output, END_OF_LIST_LINE"\n");
 }
 
@@ -2075,7 +2271,49 @@ static bool dsync_ibc_stream_has_pending_data(struct dsync_ibc *_ibc)
 {
 	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
 
-	return ibc->has_pending_data;
+	return ibc->has_pending_data || ibc->have_peek_line;
+}
+
+static bool dsync_ibc_stream_have_channels(struct dsync_ibc *_ibc)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+
+	i_assert(ibc->version_received);
+	return ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_CHANNELS;
+}
+
+static void
+dsync_ibc_stream_set_send_channel(struct dsync_ibc *_ibc, unsigned int channel)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+
+	/* the channel line is sent only before the next item */
+	ibc->send_channel = channel;
+}
+
+static enum dsync_ibc_recv_ret
+dsync_ibc_stream_recv_channel(struct dsync_ibc *_ibc, unsigned int *channel_r)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+	const char *line;
+
+	if (ibc->value_input != NULL) {
+		/* wait until the mail's stream has been read */
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
+	}
+	if (ibc->cur_mail == NULL && ibc->cur_attr == NULL &&
+	    !ibc->have_peek_line) {
+		/* read the next item line to find out its channel. keep it
+		   until dsync_ibc_stream_input_next() handles it. */
+		timeout_reset(ibc->to);
+		if (dsync_ibc_stream_next_item_line(ibc, &line) <= 0)
+			return DSYNC_IBC_RECV_RET_TRYAGAIN;
+		str_truncate(ibc->peek_line, 0);
+		str_append(ibc->peek_line, line);
+		ibc->have_peek_line = TRUE;
+	}
+	*channel_r = ibc->recv_channel;
+	return DSYNC_IBC_RECV_RET_OK;
 }
 
 static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
@@ -2103,7 +2341,10 @@ static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
 	dsync_ibc_stream_recv_finish,
 	dsync_ibc_stream_close_mail_streams,
 	dsync_ibc_stream_is_send_queue_full,
-	dsync_ibc_stream_has_pending_data
+	dsync_ibc_stream_has_pending_data,
+	dsync_ibc_stream_have_channels,
+	dsync_ibc_stream_set_send_channel,
+	dsync_ibc_stream_recv_channel
 };
 
 struct dsync_ibc *
@@ -2123,6 +2364,16 @@ dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 	ibc->temp_path_prefix = i_strdup(temp_path_prefix);
 	ibc->timeout_secs = timeout_secs;
 	ibc->ret_pool = pool_alloconly_create("ibc stream data", 2048);
+	ibc->peek_line = str_new(default_pool, 256);
 	dsync_ibc_stream_init(ibc);
 	return &ibc->ibc;
 }
+
+void dsync_ibc_stream_set_compression(struct dsync_ibc *_ibc,
+				      const struct compression_handler *handler)
+{
+	struct dsync_ibc_stream *ibc = (struct dsync_ibc_stream *)_ibc;
+
+	i_assert(!ibc->version_received);
+	ibc->compress_handler = handler;
+}
@@ -216,6 +216,29 @@ void dsync_ibc_close_mail_streams(struct dsync_ibc *ibc)
 	ibc->v.close_mail_streams(ibc);
 }
 
+bool dsync_ibc_have_channels(struct dsync_ibc *ibc)
+{
+	return ibc->v.have_channels != NULL && ibc->v.have_channels(ibc);
+}
+
+void dsync_ibc_set_send_channel(struct dsync_ibc *ibc, unsigned int channel)
+{
+	if (ibc->v.set_send_channel == NULL)
+		i_assert(channel == 0);
+	else
+		ibc->v.set_send_channel(ibc, channel);
+}
+
+enum dsync_ibc_recv_ret
+dsync_ibc_recv_channel(struct dsync_ibc *ibc, unsigned int *channel_r)
+{
+	if (ibc->v.recv_channel == NULL) {
+		*channel_r = 0;
+		return DSYNC_IBC_RECV_RET_OK;
+	}
+	return ibc->v.recv_channel(ibc, channel_r);
+}
+
 bool dsync_ibc_has_failed(struct dsync_ibc *ibc)
 {
 	return ibc->failed;
@@ -16,6 +16,7 @@ struct dsync_mailbox_attribute;
 struct dsync_mail;
 struct dsync_mail_change;
 struct dsync_mail_request;
+struct compression_handler;
 
 enum dsync_ibc_send_ret {
 	DSYNC_IBC_SEND_RET_OK	= 1,
@@ -82,6 +83,11 @@ struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
 		      unsigned int timeout_secs);
+/* Compress the stream with the given handler if the remote supports it. The
+   remote then compresses its output with the same handler. This must be
+   called immediately after dsync_ibc_init_stream(). */
+void dsync_ibc_stream_set_compression(struct dsync_ibc *ibc,
+				      const struct compression_handler *handler);
 void dsync_ibc_deinit(struct dsync_ibc **ibc);
 
 /* I/O callback is called whenever new data is available. It's also called on
@@ -168,6 +174,17 @@ dsync_ibc_recv_finish(struct dsync_ibc *ibc, const char **error_r,
    before the mail is attempted to be freed (usually on error conditions). */
 void dsync_ibc_close_mail_streams(struct dsync_ibc *ibc);
 
+/* Mailboxes can be synced concurrently by sending their items in separate
+   channels. Channel 0 is used for everything that isn't mailbox-specific.
+   Returns TRUE if the remote supports channels. This is known only after the
+   handshake has been received. */
+bool dsync_ibc_have_channels(struct dsync_ibc *ibc);
+/* Send the following items in the given channel. */
+void dsync_ibc_set_send_channel(struct dsync_ibc *ibc, unsigned int channel);
+/* Get the channel of the next item that is going to be received. */
+enum dsync_ibc_recv_ret
+dsync_ibc_recv_channel(struct dsync_ibc *ibc, unsigned int *channel_r);
+
 bool dsync_ibc_has_failed(struct dsync_ibc *ibc);
 bool dsync_ibc_has_timed_out(struct dsync_ibc *ibc);
 bool dsync_ibc_is_send_queue_full(struct dsync_ibc *ibc);
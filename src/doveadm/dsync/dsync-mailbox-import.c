@@ -54,6 +54,31 @@ struct importer_new_mail {
 HASH_TABLE_DEFINE_TYPE(guid_new_mail, const char *, struct importer_new_mail *);
 HASH_TABLE_DEFINE_TYPE(uid_new_mail, void *, struct importer_new_mail *);
 
+/* Don't remember more saved mails than this for deduplication */
+#define DSYNC_IMPORT_DEDUP_MAX_MAILS 200000
+/* Don't keep more than this many other mailboxes open for copying */
+#define DSYNC_IMPORT_DEDUP_MAX_OPEN_BOXES 8
+
+struct dsync_import_dedup_mail {
+	guid_128_t mailbox_guid;
+	uint32_t uid;
+};
+HASH_TABLE_DEFINE_TYPE(dedup_mail, const char *,
+		       struct dsync_import_dedup_mail *);
+
+struct dsync_mailbox_import_dedup {
+	pool_t pool;
+	/* GUID or header hash => mail saved earlier during this sync */
+	HASH_TABLE_TYPE(dedup_mail) mails;
+};
+
+struct importer_dedup_box {
+	guid_128_t guid;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+};
+
 struct dsync_mailbox_importer {
 	pool_t pool;
 	struct mailbox *box;
@@ -83,6 +108,10 @@ struct dsync_mailbox_importer {
 	struct mailbox_transaction_context *virtual_trans;
 	struct mail *virtual_mail;
 
+	struct dsync_mailbox_import_dedup *dedup;
+	guid_128_t box_guid;
+	ARRAY(struct importer_dedup_box) dedup_boxes;
+
 	struct mail *cur_mail;
 	const char *cur_guid;
 	const char *cur_hdr_hash;
@@ -217,6 +246,7 @@ dsync_mailbox_import_transaction_begin(struct dsync_mailbox_importer *importer)
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
 			  struct mailbox *virtual_all_box,
+			  struct dsync_mailbox_import_dedup *dedup,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
@@ -236,6 +266,7 @@ dsync_mailbox_import_init(struct mailbox *box,
 {
 	struct dsync_mailbox_importer *importer;
 	struct mailbox_status status;
+	struct mailbox_metadata metadata;
 	pool_t pool;
 
 	pool = pool_alloconly_create(MEMPOOL_GROWING"dsync mailbox importer",
@@ -244,6 +275,12 @@ dsync_mailbox_import_init(struct mailbox *box,
 	importer->pool = pool;
 	importer->box = box;
 	importer->virtual_all_box = virtual_all_box;
+	if (dedup != NULL &&
+	    mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) == 0) {
+		importer->dedup = dedup;
+		guid_128_copy(importer->box_guid, metadata.guid);
+		p_array_init(&importer->dedup_boxes, pool, 4);
+	}
 	importer->last_common_uid = last_common_uid;
 	importer->last_common_modseq = last_common_modseq;
 	importer->last_common_pvt_modseq = last_common_pvt_modseq;
@@ -1947,11 +1984,51 @@ dsync_mailbox_import_update_first_saved(struct dsync_mailbox_importer *importer)
 	}
 }
 
+static const char *
+importer_newmail_dedup_key(struct dsync_mailbox_importer *importer,
+			   const struct importer_new_mail *newmail)
+{
+	const char *key;
+
+	if (newmail->change == NULL)
+		return NULL;
+	if (importer->mails_have_guids)
+		key = newmail->change->guid;
+	else {
+		key = newmail->change->hdr_hash;
+		if (key != NULL && dsync_mail_hdr_hash_is_empty(key))
+			return NULL;
+	}
+	return key == NULL || *key == '\0' ? NULL : key;
+}
+
+static void
+dsync_mailbox_import_dedup_add(struct dsync_mailbox_importer *importer,
+			       struct importer_new_mail *newmail)
+{
+	struct dsync_mailbox_import_dedup *dedup = importer->dedup;
+	struct dsync_import_dedup_mail *dmail;
+	const char *key;
+
+	if (dedup == NULL ||
+	    hash_table_count(dedup->mails) >= DSYNC_IMPORT_DEDUP_MAX_MAILS)
+		return;
+	key = importer_newmail_dedup_key(importer, newmail);
+	if (key == NULL || hash_table_lookup(dedup->mails, key) != NULL)
+		return;
+
+	dmail = p_new(dedup->pool, struct dsync_import_dedup_mail, 1);
+	guid_128_copy(dmail->mailbox_guid, importer->box_guid);
+	dmail->uid = newmail->final_uid;
+	hash_table_insert(dedup->mails, p_strdup(dedup->pool, key), dmail);
+}
+
 static void
 dsync_mailbox_import_saved_newmail(struct dsync_mailbox_importer *importer,
 				   struct importer_new_mail *newmail)
 {
 	dsync_mailbox_import_saved_uid(importer, newmail->final_uid);
+	dsync_mailbox_import_dedup_add(importer, newmail);
 	newmail->saved = TRUE;
 
 	dsync_mailbox_import_update_first_saved(importer);
@@ -2131,6 +2208,104 @@ dsync_mailbox_import_try_virtual_all(struct dsync_mailbox_importer *importer,
 	return FALSE;
 }
 
+static struct mail *
+dsync_mailbox_import_dedup_get_mail(struct dsync_mailbox_importer *importer,
+				    const guid_128_t guid)
+{
+	struct importer_dedup_box *dbox;
+
+	array_foreach_modifiable(&importer->dedup_boxes, dbox) {
+		if (guid_128_equals(dbox->guid, guid))
+			return dbox->mail;
+	}
+	if (array_count(&importer->dedup_boxes) >=
+	    DSYNC_IMPORT_DEDUP_MAX_OPEN_BOXES)
+		return NULL;
+
+	/* remember also failed opens, so they're not retried */
+	dbox = array_append_space(&importer->dedup_boxes);
+	guid_128_copy(dbox->guid, guid);
+	dbox->box = mailbox_alloc_guid(importer->box->list, guid,
+				       MAILBOX_FLAG_READONLY);
+	if (mailbox_open(dbox->box) < 0) {
+		imp_debug(importer, "Can't open mailbox %s for deduplication: %s",
+			  mailbox_get_vname(dbox->box),
+			  mailbox_get_last_internal_error(dbox->box, NULL));
+		mailbox_free(&dbox->box);
+		return NULL;
+	}
+	dbox->trans = mailbox_transaction_begin(dbox->box, 0, __func__);
+	dbox->mail = mail_alloc(dbox->trans, MAIL_FETCH_GUID, NULL);
+	return dbox->mail;
+}
+
+static void
+dsync_mailbox_import_dedup_free_boxes(struct dsync_mailbox_importer *importer)
+{
+	struct importer_dedup_box *dbox;
+
+	if (!array_is_created(&importer->dedup_boxes))
+		return;
+	array_foreach_modifiable(&importer->dedup_boxes, dbox) {
+		if (dbox->box == NULL)
+			continue;
+		mail_free(&dbox->mail);
+		(void)mailbox_transaction_commit(&dbox->trans);
+		mailbox_free(&dbox->box);
+	}
+	array_clear(&importer->dedup_boxes);
+}
+
+static bool
+dsync_mailbox_import_try_dedup(struct dsync_mailbox_importer *importer,
+			       struct importer_new_mail *all_newmails)
+{
+	const struct dsync_import_dedup_mail *saved;
+	struct importer_new_mail *newmail;
+	struct dsync_mail dmail;
+	struct mail *mail;
+	const char *key = NULL, *value;
+
+	if (importer->dedup == NULL)
+		return FALSE;
+	for (newmail = all_newmails; newmail != NULL; newmail = newmail->next) {
+		if ((key = importer_newmail_dedup_key(importer, newmail)) != NULL)
+			break;
+	}
+	if (key == NULL)
+		return FALSE;
+	saved = hash_table_lookup(importer->dedup->mails, key);
+	if (saved == NULL ||
+	    guid_128_equals(saved->mailbox_guid, importer->box_guid))
+		return FALSE;
+	if ((mail = dsync_mailbox_import_dedup_get_mail(importer,
+					saved->mailbox_guid)) == NULL)
+		return FALSE;
+
+	/* The mail may have been expunged or replaced since it was saved, so
+	   verify that it's still the same before copying it. */
+	if (!mail_set_uid(mail, saved->uid))
+		return FALSE;
+	if (importer->mails_have_guids) {
+		if (mail_get_special(mail, MAIL_FETCH_GUID, &value) < 0 ||
+		    strcmp(value, key) != 0)
+			return FALSE;
+	} else {
+		if (dsync_mail_get_hdr_hash(mail, importer->hdr_hash_version,
+					    importer->hashed_headers,
+					    &value) < 0 ||
+		    strcmp(value, key) != 0)
+			return FALSE;
+	}
+	if (dsync_mailbox_import_local_uid(importer, mail, saved->uid, "",
+					   &dmail) <= 0)
+		return FALSE;
+	imp_debug(importer, "Copying %s from mailbox %s UID=%u",
+		  key, mailbox_get_vname(mail->box), saved->uid);
+	return dsync_mailbox_save_newmails(importer, &dmail, all_newmails,
+					   FALSE);
+}
+
 static bool
 dsync_mailbox_import_handle_mail(struct dsync_mailbox_importer *importer,
 				 struct importer_new_mail *all_newmails)
@@ -2164,7 +2339,8 @@ dsync_mailbox_import_handle_mail(struct dsync_mailbox_importer *importer,
 
 	if (!dsync_mailbox_import_try_local(importer, all_newmails,
 					    &local_uids, &wanted_uids) &&
-	    !dsync_mailbox_import_try_virtual_all(importer, all_newmails)) {
+	    !dsync_mailbox_import_try_virtual_all(importer, all_newmails) &&
+	    !dsync_mailbox_import_try_dedup(importer, all_newmails)) {
 		/* no local instance. request from remote */
 		IMPORTER_DEBUG_CHANGE(importer);
 		if (importer->want_mail_requests) {
@@ -2942,6 +3118,7 @@ int dsync_mailbox_import_deinit(struct dsync_mailbox_importer **_importer,
 		mail_free(&importer->virtual_mail);
 	if (importer->virtual_trans != NULL)
 		(void)mailbox_transaction_commit(&importer->virtual_trans);
+	dsync_mailbox_import_dedup_free_boxes(importer);
 
 	hash_table_destroy(&importer->import_guids);
 	hash_table_destroy(&importer->import_uids);
@@ -2986,6 +3163,28 @@ int dsync_mailbox_import_deinit(struct dsync_mailbox_importer **_importer,
 	return ret;
 }
 
+struct dsync_mailbox_import_dedup *dsync_mailbox_import_dedup_init(void)
+{
+	struct dsync_mailbox_import_dedup *dedup;
+	pool_t pool;
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"dsync import dedup",
+				     4096);
+	dedup = p_new(pool, struct dsync_mailbox_import_dedup, 1);
+	dedup->pool = pool;
+	hash_table_create(&dedup->mails, pool, 0, str_hash, strcmp);
+	return dedup;
+}
+
+void dsync_mailbox_import_dedup_deinit(struct dsync_mailbox_import_dedup **_dedup)
+{
+	struct dsync_mailbox_import_dedup *dedup = *_dedup;
+
+	*_dedup = NULL;
+	hash_table_destroy(&dedup->mails);
+	pool_unref(&dedup->pool);
+}
+
 const char *dsync_mailbox_import_get_proctitle(struct dsync_mailbox_importer *importer)
 {
 	if (importer->search_ctx != NULL)
@@ -19,10 +19,16 @@ struct dsync_mailbox_attribute;
 struct dsync_mail;
 struct dsync_mail_change;
 struct dsync_transaction_log_scan;
+struct dsync_mailbox_import_dedup;
 
+/* If dedup is non-NULL, mails saved by the importer are remembered in it and
+   later importers try to copy identical mails from the other mailboxes
+   instead of requesting them from the remote. The mails are matched by their
+   GUID, or by the header hash if the mails don't have GUIDs. */
 struct dsync_mailbox_importer *
 dsync_mailbox_import_init(struct mailbox *box,
 			  struct mailbox *virtual_all_box,
+			  struct dsync_mailbox_import_dedup *dedup,
 			  struct dsync_transaction_log_scan *log_scan,
 			  uint32_t last_common_uid,
 			  uint64_t last_common_modseq,
@@ -58,6 +64,9 @@ int dsync_mailbox_import_deinit(struct dsync_mailbox_importer **importer,
 				bool *require_full_resync_r,
 				enum mail_error *error_r);
 
+struct dsync_mailbox_import_dedup *dsync_mailbox_import_dedup_init(void);
+void dsync_mailbox_import_dedup_deinit(struct dsync_mailbox_import_dedup **dedup);
+
 const char *dsync_mailbox_import_get_proctitle(struct dsync_mailbox_importer *importer);
 
 #endif
@@ -61,13 +61,22 @@ export_change_get(struct dsync_transaction_log_scan *ctx, uint32_t uid,
 	return TRUE;
 }
 
+static inline uint32_t
+log_scan_last_uid(struct dsync_transaction_log_scan *ctx, uint32_t uid2)
+{
+	/* changes for UIDs above highest_wanted_uid are ignored, so don't
+	   even iterate through them. A large flag change could otherwise
+	   cause a lookup for every UID in the range. */
+	return I_MIN(uid2, ctx->highest_wanted_uid);
+}
+
 static void
 log_add_expunge(struct dsync_transaction_log_scan *ctx, const void *data,
 		const struct mail_transaction_header *hdr)
 {
 	const struct mail_transaction_expunge *rec = data, *end;
 	struct dsync_mail_change *change;
-	uint32_t uid;
+	uint32_t uid, last_uid;
 
 	if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0) {
 		/* this is simply a request for expunge */
@@ -75,7 +84,8 @@ log_add_expunge(struct dsync_transaction_log_scan *ctx, const void *data,
 	}
 	end = CONST_PTR_OFFSET(data, hdr->size);
 	for (; rec != end; rec++) {
-		for (uid = rec->uid1; uid <= rec->uid2; uid++) {
+		last_uid = log_scan_last_uid(ctx, rec->uid2);
+		for (uid = rec->uid1; uid <= last_uid; uid++) {
 			export_change_get(ctx, uid,
 					  DSYNC_MAIL_CHANGE_TYPE_EXPUNGE,
 					  &change);
@@ -168,11 +178,12 @@ log_add_flag_update(struct dsync_transaction_log_scan *ctx, const void *data,
 {
 	const struct mail_transaction_flag_update *rec = data, *end;
 	struct dsync_mail_change *change;
-	uint32_t uid;
+	uint32_t uid, last_uid;
 
 	end = CONST_PTR_OFFSET(data, hdr->size);
 	for (; rec != end; rec++) {
-		for (uid = rec->uid1; uid <= rec->uid2; uid++) {
+		last_uid = log_scan_last_uid(ctx, rec->uid2);
+		for (uid = rec->uid1; uid <= last_uid; uid++) {
 			if (export_change_get(ctx, uid,
 					DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE,
 					&change)) {
@@ -191,11 +202,12 @@ log_add_keyword_reset(struct dsync_transaction_log_scan *ctx, const void *data,
 {
 	const struct mail_transaction_keyword_reset *rec = data, *end;
 	struct dsync_mail_change *change;
-	uint32_t uid;
+	uint32_t uid, last_uid;
 
 	end = CONST_PTR_OFFSET(data, hdr->size);
 	for (; rec != end; rec++) {
-		for (uid = rec->uid1; uid <= rec->uid2; uid++) {
+		last_uid = log_scan_last_uid(ctx, rec->uid2);
+		for (uid = rec->uid1; uid <= last_uid; uid++) {
 			if (!export_change_get(ctx, uid,
 					DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE,
 					&change))
@@ -232,7 +244,7 @@ log_add_keyword_update(struct dsync_transaction_log_scan *ctx, const void *data,
 	const char *kw_name, *change_str;
 	const uint32_t *uids, *end;
 	unsigned int uids_offset;
-	uint32_t uid;
+	uint32_t uid, last_uid;
 
 	uids_offset = sizeof(*rec) + rec->name_size;
 	if ((uids_offset % 4) != 0)
@@ -256,7 +268,8 @@ log_add_keyword_update(struct dsync_transaction_log_scan *ctx, const void *data,
 	end = CONST_PTR_OFFSET(rec, hdr->size);
 
 	for (; uids < end; uids += 2) {
-		for (uid = uids[0]; uid <= uids[1]; uid++) {
+		last_uid = log_scan_last_uid(ctx, uids[1]);
+		for (uid = uids[0]; uid <= last_uid; uid++) {
 			if (!export_change_get(ctx, uid,
 					DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE,
 					&change))
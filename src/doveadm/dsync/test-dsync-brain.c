@@ -0,0 +1,310 @@
+/* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "array.h"
+#include "fd-util.h"
+#include "istream.h"
+#include "ostream.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "test-mail-storage-common.h"
+#include "dsync-ibc.h"
+#include "dsync-brain-private.h"
+#include "test-common.h"
+
+#include <sys/socket.h>
+
+#define TEST_MAILBOX_COUNT 5
+
+struct test_brain_run {
+	struct dsync_brain *master, *slave;
+	bool master_running, slave_running;
+	unsigned int max_boxes;
+};
+
+static const char *test_mailbox_names[TEST_MAILBOX_COUNT] = {
+	"INBOX", "box1", "box2", "box3", "box4"
+};
+
+static void test_save_mail(struct mailbox *box, unsigned int n)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *data;
+	int ret;
+
+	data = t_strdup_printf("From: sender@example.com\r\n"
+			       "Message-ID: <%s.%u@example.com>\r\n"
+			       "Subject: mail %u\r\n"
+			       "\r\n"
+			       "body %u\r\n", mailbox_get_vname(box), n, n, n);
+	input = i_stream_create_from_data(data, strlen(data));
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	while ((ret = i_stream_read(input)) > 0)
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	test_assert(ret == -1);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	i_stream_unref(&input);
+}
+
+static void test_fill_user(struct mail_user *user)
+{
+	struct mailbox *box;
+	unsigned int i, j;
+
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++) {
+		box = mailbox_alloc(user->namespaces->list,
+				    test_mailbox_names[i], 0);
+		if (i > 0)
+			test_assert(mailbox_create(box, NULL, FALSE) == 0);
+		for (j = 0; j <= i; j++)
+			test_save_mail(box, j);
+		mailbox_free(&box);
+	}
+}
+
+static void test_check_user(struct mail_user *user)
+{
+	struct mailbox *box;
+	struct mailbox_status status;
+	unsigned int i;
+
+	for (i = 0; i < TEST_MAILBOX_COUNT; i++) {
+		box = mailbox_alloc(user->namespaces->list,
+				    test_mailbox_names[i], 0);
+		test_assert_idx(mailbox_get_status(box, STATUS_MESSAGES,
+						   &status) == 0, i);
+		test_assert_idx(status.messages == i + 1, i);
+		mailbox_free(&box);
+	}
+}
+
+static void test_brain_run_io(void *context)
+{
+	struct test_brain_run *run = context;
+	bool changed, try_pending;
+
+	if (dsync_brain_has_failed(run->master) ||
+	    dsync_brain_has_failed(run->slave)) {
+		io_loop_stop(current_ioloop);
+		return;
+	}
+
+	/* same as dsync_brain_run_io(), but for both brains */
+	try_pending = TRUE;
+	do {
+		changed = FALSE;
+		if (run->master_running) {
+			run->master_running =
+				dsync_brain_run(run->master, &changed);
+		}
+		run->max_boxes = I_MAX(run->max_boxes,
+				       array_count(&run->master->boxes));
+		if (run->slave_running) {
+			bool slave_changed;
+
+			run->slave_running =
+				dsync_brain_run(run->slave, &slave_changed);
+			changed = changed || slave_changed;
+		}
+		if (!run->master_running && !run->slave_running) {
+			io_loop_stop(current_ioloop);
+			return;
+		}
+		if (changed)
+			try_pending = TRUE;
+		else if (try_pending) {
+			if (dsync_ibc_has_pending_data(run->master->ibc) ||
+			    dsync_ibc_has_pending_data(run->slave->ibc))
+				changed = TRUE;
+			try_pending = FALSE;
+		}
+	} while (changed);
+}
+
+static void test_brain_timeout(struct test_brain_run *run ATTR_UNUSED)
+{
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+}
+
+static void
+test_dsync_brain_sync(struct mail_user *user1, struct mail_user *user2,
+		      struct dsync_ibc *ibc1, struct dsync_ibc *ibc2,
+		      bool local, struct test_brain_run *run_r)
+{
+	struct dsync_brain_settings set;
+	struct timeout *to;
+	enum mail_error error;
+	bool changed;
+
+	i_zero(&set);
+	set.process_title_prefix = "";
+	set.mailbox_alt_char = '_';
+	set.mailbox_concurrency = 2;
+	t_array_init(&set.sync_namespaces, 1);
+
+	i_zero(run_r);
+	run_r->master = dsync_brain_master_init(user1, ibc1,
+		DSYNC_BRAIN_SYNC_TYPE_FULL,
+		DSYNC_BRAIN_FLAG_SEND_MAIL_REQUESTS, &set);
+	run_r->slave = dsync_brain_slave_init(user2, ibc2, local, "", '_');
+	run_r->master_running = run_r->slave_running = TRUE;
+
+	if (local) {
+		/* same loop as doveadm uses for local syncs */
+		while (run_r->master_running || run_r->slave_running) {
+			if (dsync_brain_has_failed(run_r->master) ||
+			    dsync_brain_has_failed(run_r->slave))
+				break;
+			run_r->master_running =
+				dsync_brain_run(run_r->master, &changed);
+			run_r->max_boxes = I_MAX(run_r->max_boxes,
+				array_count(&run_r->master->boxes));
+			run_r->slave_running =
+				dsync_brain_run(run_r->slave, &changed);
+		}
+	} else {
+		dsync_ibc_set_io_callback(ibc1, test_brain_run_io, run_r);
+		dsync_ibc_set_io_callback(ibc2, test_brain_run_io, run_r);
+		to = timeout_add(30*1000, test_brain_timeout, run_r);
+		io_loop_run(current_ioloop);
+		timeout_remove(&to);
+	}
+	test_assert(!run_r->master_running && !run_r->slave_running);
+	test_assert(dsync_brain_deinit(&run_r->slave, &error) == 0);
+	test_assert(dsync_brain_deinit(&run_r->master, &error) == 0);
+}
+
+static void
+test_dsync_brain_init_users(struct test_mail_storage_ctx *ctx,
+			    struct mail_user **user1_r,
+			    struct mail_storage_service_user **service_user1_r)
+{
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.hierarchy_sep = "/",
+	};
+
+	set.username = "user1";
+	test_mail_storage_init_user(ctx, &set);
+	*user1_r = ctx->user;
+	*service_user1_r = ctx->service_user;
+	set.username = "user2";
+	test_mail_storage_init_user(ctx, &set);
+
+	(*user1_r)->dsyncing = TRUE;
+	ctx->user->dsyncing = TRUE;
+	test_fill_user(*user1_r);
+}
+
+static void
+test_dsync_brain_deinit_users(struct test_mail_storage_ctx *ctx,
+			      struct mail_user *user1,
+			      struct mail_storage_service_user *service_user1)
+{
+	test_mail_storage_deinit_user(ctx);
+	ctx->user = user1;
+	ctx->service_user = service_user1;
+	test_mail_storage_deinit_user(ctx);
+}
+
+static void test_dsync_brain_concurrency(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mail_storage_service_user *service_user1;
+	struct mail_user *user1;
+	struct dsync_ibc *ibc1, *ibc2;
+	struct istream *input1, *input2;
+	struct ostream *output1, *output2;
+	struct test_brain_run run;
+	const char *temp_prefix;
+	int fd[2];
+
+	test_begin("dsync brain mailbox concurrency");
+	ctx = test_mail_storage_init();
+	test_dsync_brain_init_users(ctx, &user1, &service_user1);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+	input1 = i_stream_create_fd(fd[0], SIZE_MAX);
+	output1 = o_stream_create_fd(fd[0], SIZE_MAX);
+	input2 = i_stream_create_fd(fd[1], SIZE_MAX);
+	output2 = o_stream_create_fd(fd[1], SIZE_MAX);
+	temp_prefix = t_strconcat(ctx->home_root, "dsync.", NULL);
+	ibc1 = dsync_ibc_init_stream(input1, output1, "user2", temp_prefix, 10);
+	ibc2 = dsync_ibc_init_stream(input2, output2, "user1", temp_prefix, 10);
+
+	test_dsync_brain_sync(user1, ctx->user, ibc1, ibc2, FALSE, &run);
+	/* the remote supports channels, so two mailboxes were synced
+	   at the same time */
+	test_assert(run.max_boxes == 2);
+	test_check_user(ctx->user);
+
+	dsync_ibc_deinit(&ibc1);
+	dsync_ibc_deinit(&ibc2);
+	i_stream_unref(&input1);
+	o_stream_unref(&output1);
+	i_stream_unref(&input2);
+	o_stream_unref(&output2);
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+
+	test_dsync_brain_deinit_users(ctx, user1, service_user1);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_dsync_brain_concurrency_fallback(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mail_storage_service_user *service_user1;
+	struct mail_user *user1;
+	struct dsync_ibc *ibc1, *ibc2;
+	struct test_brain_run run;
+
+	test_begin("dsync brain mailbox concurrency without channels");
+	ctx = test_mail_storage_init();
+	test_dsync_brain_init_users(ctx, &user1, &service_user1);
+
+	dsync_ibc_init_pipe(&ibc1, &ibc2);
+	test_dsync_brain_sync(user1, ctx->user, ibc1, ibc2, TRUE, &run);
+	/* pipe ibc doesn't support channels */
+	test_assert(run.max_boxes == 1);
+	test_check_user(ctx->user);
+	dsync_ibc_deinit(&ibc1);
+	dsync_ibc_deinit(&ibc2);
+
+	test_dsync_brain_deinit_users(ctx, user1, service_user1);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_dsync_brain_concurrency,
+		test_dsync_brain_concurrency_fallback,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-dsync-brain",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(tests);
+	master_service_deinit(&master_service);
+	return ret;
+}
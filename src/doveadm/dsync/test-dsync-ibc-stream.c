@@ -0,0 +1,311 @@
+/* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "fd-util.h"
+#include "write-full.h"
+#include "str.h"
+#include "istream.h"
+#include "ostream.h"
+#include "dsync-mailbox-state.h"
+#include "dsync-ibc.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define TEST_TEMP_PREFIX ".test-dsync-ibc-stream."
+#define TEST_VERSION_CURRENT "VERSION\tdsync\t3\t7\n"
+
+struct test_ibc_peer {
+	struct dsync_ibc *ibc;
+	struct istream *input;
+	struct ostream *output;
+	bool handshake_received;
+};
+
+struct test_channel_item {
+	unsigned int channel;
+	enum dsync_ibc_recv_ret ret;
+	unsigned int id;
+};
+
+static struct test_ibc_peer peer_a, peer_b;
+static unsigned int test_recv_idx, test_recv_channel;
+static bool test_items_sent;
+
+static const struct test_channel_item test_channel_items[] = {
+	{ 3, DSYNC_IBC_RECV_RET_OK, 1 },
+	{ 5, DSYNC_IBC_RECV_RET_OK, 2 },
+	{ 5, DSYNC_IBC_RECV_RET_FINISHED, 0 },
+	{ 0, DSYNC_IBC_RECV_RET_OK, 3 },
+};
+
+static void test_ibc_peer_init(struct test_ibc_peer *peer, int fd,
+			       const char *name)
+{
+	i_zero(peer);
+	fd_set_nonblock(fd, TRUE);
+	peer->input = i_stream_create_fd(fd, SIZE_MAX);
+	peer->output = o_stream_create_fd(fd, SIZE_MAX);
+	peer->ibc = dsync_ibc_init_stream(peer->input, peer->output, name,
+					  TEST_TEMP_PREFIX, 10);
+}
+
+static void test_ibc_peer_deinit(struct test_ibc_peer *peer)
+{
+	dsync_ibc_deinit(&peer->ibc);
+	i_stream_unref(&peer->input);
+	o_stream_unref(&peer->output);
+}
+
+static void test_ibc_send_handshake(struct test_ibc_peer *peer)
+{
+	struct dsync_ibc_settings set;
+
+	i_zero(&set);
+	set.hostname = "localhost";
+	set.sync_type = DSYNC_BRAIN_SYNC_TYPE_FULL;
+	dsync_ibc_send_handshake(peer->ibc, &set);
+}
+
+static bool test_ibc_recv_handshake(struct test_ibc_peer *peer)
+{
+	const struct dsync_ibc_settings *set;
+
+	if (!peer->handshake_received) {
+		if (dsync_ibc_recv_handshake(peer->ibc, &set) == 0)
+			return FALSE;
+		peer->handshake_received = TRUE;
+	}
+	return TRUE;
+}
+
+static void test_send_state(struct dsync_ibc *ibc, unsigned int id)
+{
+	struct dsync_mailbox_state state;
+
+	i_zero(&state);
+	state.mailbox_guid[0] = id;
+	state.last_uidvalidity = id;
+	dsync_ibc_send_mailbox_state(ibc, &state);
+}
+
+static void test_io_timeout(void *context ATTR_UNUSED)
+{
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_channels_sender(void *context ATTR_UNUSED)
+{
+	if (!test_ibc_recv_handshake(&peer_a) || test_items_sent)
+		return;
+
+	test_assert(dsync_ibc_have_channels(peer_a.ibc));
+	dsync_ibc_set_send_channel(peer_a.ibc, 3);
+	test_send_state(peer_a.ibc, 1);
+	dsync_ibc_set_send_channel(peer_a.ibc, 5);
+	test_send_state(peer_a.ibc, 2);
+	dsync_ibc_send_end_of_list(peer_a.ibc, DSYNC_IBC_EOL_MAILBOX_STATE);
+	dsync_ibc_set_send_channel(peer_a.ibc, 0);
+	test_send_state(peer_a.ibc, 3);
+	test_items_sent = TRUE;
+}
+
+static void test_channels_receiver(void *context ATTR_UNUSED)
+{
+	const struct test_channel_item *item;
+	struct dsync_mailbox_state state;
+	enum dsync_ibc_recv_ret ret;
+	unsigned int channel, channel2;
+
+	if (!test_ibc_recv_handshake(&peer_b))
+		return;
+
+	while (test_recv_idx < N_ELEMENTS(test_channel_items)) {
+		item = &test_channel_items[test_recv_idx];
+		if (dsync_ibc_recv_channel(peer_b.ibc, &channel) == 0)
+			return;
+		/* peeking is idempotent and keeps the item pending */
+		test_assert_idx(dsync_ibc_recv_channel(peer_b.ibc, &channel2) ==
+				DSYNC_IBC_RECV_RET_OK, test_recv_idx);
+		test_assert_idx(channel == channel2, test_recv_idx);
+		test_assert_idx(dsync_ibc_has_pending_data(peer_b.ibc),
+				test_recv_idx);
+		test_assert_idx(channel == item->channel, test_recv_idx);
+
+		ret = dsync_ibc_recv_mailbox_state(peer_b.ibc, &state);
+		test_assert_idx(ret == item->ret, test_recv_idx);
+		if (ret == DSYNC_IBC_RECV_RET_OK)
+			test_assert_idx(state.mailbox_guid[0] == item->id,
+					test_recv_idx);
+		test_recv_idx++;
+	}
+	io_loop_stop(current_ioloop);
+}
+
+static void test_dsync_ibc_stream_channels(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	unsigned int channel;
+	int fd[2];
+
+	test_begin("dsync ibc stream channels");
+	ioloop = io_loop_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	test_ibc_peer_init(&peer_a, fd[0], "a");
+	test_ibc_peer_init(&peer_b, fd[1], "b");
+	dsync_ibc_set_io_callback(peer_a.ibc, test_channels_sender, NULL);
+	dsync_ibc_set_io_callback(peer_b.ibc, test_channels_receiver, NULL);
+	test_recv_idx = 0;
+	test_items_sent = FALSE;
+
+	test_ibc_send_handshake(&peer_a);
+	test_ibc_send_handshake(&peer_b);
+	to = timeout_add(5000, test_io_timeout, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(test_recv_idx == N_ELEMENTS(test_channel_items));
+	test_assert(dsync_ibc_recv_channel(peer_b.ibc, &channel) ==
+		    DSYNC_IBC_RECV_RET_TRYAGAIN);
+	test_assert(!dsync_ibc_has_pending_data(peer_b.ibc));
+	test_assert(!dsync_ibc_has_failed(peer_a.ibc));
+	test_assert(!dsync_ibc_has_failed(peer_b.ibc));
+
+	test_ibc_peer_deinit(&peer_a);
+	test_ibc_peer_deinit(&peer_b);
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_read_raw(int fd, string_t *dest)
+{
+	unsigned char buf[1024];
+	ssize_t ret;
+
+	while ((ret = read(fd, buf, sizeof(buf))) > 0)
+		str_append_data(dest, buf, ret);
+	if (ret < 0 && errno != EAGAIN)
+		i_fatal("read() failed: %m");
+}
+
+static void test_write_raw(int fd, const string_t *data)
+{
+	if (write_full(fd, str_data(data), str_len(data)) < 0)
+		i_fatal("write() failed: %m");
+}
+
+static void test_old_peer_handshake(void *context ATTR_UNUSED)
+{
+	if (test_ibc_recv_handshake(&peer_a))
+		io_loop_stop(current_ioloop);
+}
+
+static void test_old_peer_receiver(void *context ATTR_UNUSED)
+{
+	struct dsync_mailbox_state state;
+	enum dsync_ibc_recv_ret ret;
+	unsigned int channel;
+
+	while (test_recv_idx < 2) {
+		if (dsync_ibc_recv_channel(peer_a.ibc, &channel) == 0)
+			return;
+		test_assert_idx(channel == test_recv_channel, test_recv_idx);
+		ret = dsync_ibc_recv_mailbox_state(peer_a.ibc, &state);
+		if (test_recv_idx == 0) {
+			test_assert(ret == DSYNC_IBC_RECV_RET_OK);
+			test_assert(state.mailbox_guid[0] == 7);
+		} else {
+			test_assert(ret == DSYNC_IBC_RECV_RET_FINISHED);
+		}
+		test_recv_idx++;
+	}
+	io_loop_stop(current_ioloop);
+}
+
+static void test_dsync_ibc_stream_old_peer(unsigned int minor_version)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	string_t *data;
+	bool have_channels = minor_version >= 6;
+	int fd[2];
+
+	test_begin(t_strdup_printf(
+		"dsync ibc stream with minor version %u peer", minor_version));
+	ioloop = io_loop_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	test_ibc_peer_init(&peer_a, fd[0], "a");
+	fd_set_nonblock(fd[1], TRUE);
+	dsync_ibc_set_io_callback(peer_a.ibc, test_old_peer_handshake, NULL);
+	test_recv_idx = 0;
+	test_recv_channel = have_channels ? 2 : 0;
+
+	/* act as an older peer: send back our own handshake with the minor
+	   version downgraded */
+	test_ibc_send_handshake(&peer_a);
+	data = t_str_new(1024);
+	test_read_raw(fd[1], data);
+	test_assert(str_begins(str_c(data), TEST_VERSION_CURRENT));
+	str_delete(data, 0, strlen(TEST_VERSION_CURRENT));
+	str_insert(data, 0, t_strdup_printf("VERSION\tdsync\t3\t%u\n",
+					    minor_version));
+	test_write_raw(fd[1], data);
+
+	to = timeout_add(5000, test_io_timeout, NULL);
+	io_loop_run(ioloop);
+	test_assert(peer_a.handshake_received);
+	test_assert(dsync_ibc_have_channels(peer_a.ibc) == have_channels);
+
+	/* channel lines are sent only if the peer understands them */
+	dsync_ibc_set_send_channel(peer_a.ibc, test_recv_channel);
+	test_send_state(peer_a.ibc, 7);
+	dsync_ibc_send_end_of_list(peer_a.ibc, DSYNC_IBC_EOL_MAILBOX_STATE);
+	str_truncate(data, 0);
+	test_read_raw(fd[1], data);
+	test_assert(str_len(data) > 0);
+	if (have_channels)
+		test_assert(str_begins(str_c(data), "L\t2\n"));
+	else
+		test_assert(!str_begins(str_c(data), "L\t"));
+	test_assert(strstr(str_c(data), "\nL\t") == NULL);
+
+	/* without channels everything from the peer arrives in channel 0 */
+	dsync_ibc_set_io_callback(peer_a.ibc, test_old_peer_receiver, NULL);
+	test_write_raw(fd[1], data);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	test_assert(test_recv_idx == 2);
+	test_assert(!dsync_ibc_has_failed(peer_a.ibc));
+
+	test_ibc_peer_deinit(&peer_a);
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_dsync_ibc_stream_old_peers(void)
+{
+	/* 3.5 doesn't support channels, 3.6 supports channels but not
+	   chunked streams or compression */
+	test_dsync_ibc_stream_old_peer(5);
+	test_dsync_ibc_stream_old_peer(6);
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_dsync_ibc_stream_channels,
+		test_dsync_ibc_stream_old_peers,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -12,12 +12,14 @@
 #include "llist.h"
 #include "priorityq.h"
 #include "base64.h"
+#include "buffer.h"
 #include "str.h"
 #include "strescape.h"
 #include "time-util.h"
 #include "var-expand.h"
 #include "master-service.h"
 #include "master-service-settings.h"
+#include "compression.h"
 #include "imap-keepalive.h"
 #include "imap-master-connection.h"
 #include "imap-client.h"
@@ -40,6 +42,10 @@
 /* How often to try to unhibernate clients. */
 #define IMAP_UNHIBERNATE_RETRY_MSECS 100
 
+/* Keep the exported client state compressed while the client is hibernated
+   if it's at least this large. */
+#define IMAP_CLIENT_STATE_COMPRESS_MIN_SIZE 256
+
 #define IMAP_CLIENT_BUFFER_FULL_ERROR "Client output buffer is full"
 #define IMAP_CLIENT_UNHIBERNATE_ERROR "Failed to unhibernate client"
 
@@ -80,6 +86,7 @@ struct imap_client {
 	bool bad_done, idle_done;
 	bool unhibernate_queued;
 	bool input_pending;
+	bool state_compressed;
 };
 
 static struct imap_client *imap_clients;
@@ -146,6 +153,79 @@ imap_client_parse_userdb_fields(struct imap_client *client,
 	}
 }
 
+static bool
+imap_client_state_compress(struct imap_client *client,
+			   const unsigned char *data, size_t size)
+{
+	const struct compression_handler *handler;
+	struct ostream *output, *zoutput;
+	buffer_t *buf;
+	int ret;
+
+	if (size < IMAP_CLIENT_STATE_COMPRESS_MIN_SIZE ||
+	    compression_lookup_handler("deflate", &handler) <= 0)
+		return FALSE;
+
+	buf = t_buffer_create(size);
+	output = o_stream_create_buffer(buf);
+	zoutput = handler->create_ostream(output,
+					  handler->get_default_level());
+	o_stream_nsend(zoutput, data, size);
+	ret = o_stream_finish(zoutput);
+	o_stream_unref(&zoutput);
+	o_stream_unref(&output);
+	if (ret < 0 || buf->used >= size)
+		return FALSE;
+
+	client->state.state = p_memdup(client->pool, buf->data, buf->used);
+	client->state.state_size = buf->used;
+	client->state_compressed = TRUE;
+	return TRUE;
+}
+
+static int
+imap_client_state_get(struct imap_client *client,
+		      const unsigned char **data_r, size_t *size_r,
+		      const char **error_r)
+{
+	const struct compression_handler *handler;
+	struct istream *input, *zinput;
+	const unsigned char *data;
+	buffer_t *buf;
+	size_t size;
+	int ret;
+
+	if (!client->state_compressed) {
+		*data_r = client->state.state;
+		*size_r = client->state.state_size;
+		return 0;
+	}
+	if (compression_lookup_handler("deflate", &handler) <= 0)
+		i_unreached();
+
+	buf = t_buffer_create(client->state.state_size * 4);
+	input = i_stream_create_from_data(client->state.state,
+					  client->state.state_size);
+	zinput = handler->create_istream(input);
+	while ((ret = i_stream_read_more(zinput, &data, &size)) > 0) {
+		buffer_append(buf, data, size);
+		i_stream_skip(zinput, size);
+	}
+	i_assert(ret == -1);
+	if (zinput->stream_errno != 0) {
+		*error_r = t_strdup_printf(
+			"Failed to decompress client state: %s",
+			i_stream_get_error(zinput));
+	}
+	ret = zinput->stream_errno != 0 ? -1 : 0;
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+
+	*data_r = buf->data;
+	*size_r = buf->used;
+	return ret;
+}
+
 static void
 imap_client_move_back_send_callback(void *context, struct ostream *output)
 {
@@ -153,10 +233,17 @@ imap_client_move_back_send_callback(void *context, struct ostream *output)
 	const struct imap_client_state *state = &client->state;
 	string_t *str = t_str_new(256);
 	struct timeval created;
-	const unsigned char *input_data;
-	size_t input_size;
+	const unsigned char *input_data, *state_data;
+	size_t input_size, state_size;
+	const char *error;
 	ssize_t ret;
 
+	if (imap_client_state_get(client, &state_data, &state_size,
+				  &error) < 0) {
+		imap_client_unhibernate_failed(&client, error);
+		return;
+	}
+
 	str_append_tabescaped(str, state->username);
 	event_get_create_time(client->event, &created);
 	str_printfa(str, "\thibernation_started=%"PRIdTIME_T".%06u",
@@ -191,9 +278,9 @@ imap_client_move_back_send_callback(void *context, struct ostream *output)
 	}
 	if (state->peer_ino != 0)
 		str_printfa(str, "\tpeer_ino=%llu", (unsigned long long)state->peer_ino);
-	if (state->state_size > 0) {
+	if (state_size > 0) {
 		str_append(str, "\tstate=");
-		base64_encode(state->state, state->state_size, str);
+		base64_encode(state_data, state_size, str);
 	}
 	input_data = i_stream_get_data(client->input, &input_size);
 	if (input_size > 0) {
@@ -618,11 +705,15 @@ imap_client_create(int fd, const struct imap_client_state *state)
 	if (state->remote_port != 0)
 		event_add_int(client->event, "remote_port", state->remote_port);
 
-	if (state->state_size > 0) {
-		client->state.state = statebuf = p_malloc(pool, state->state_size);
-		memcpy(statebuf, state->state, state->state_size);
-		client->state.state_size = state->state_size;
-	}
+	T_BEGIN {
+		if (state->state_size > 0 &&
+		    !imap_client_state_compress(client, state->state,
+						state->state_size)) {
+			client->state.state = statebuf =
+				p_malloc(pool, state->state_size);
+			memcpy(statebuf, state->state, state->state_size);
+		}
+	} T_END;
 	T_BEGIN {
 		string_t *str;
 		char **fields = p_strsplit_tabescaped(unsafe_data_stack_pool,
@@ -285,6 +285,9 @@ select_open(struct imap_select_context *ctx, const char *mailbox, bool readonly)
 	ctx->box = mailbox_alloc(ctx->ns->list, mailbox, flags);
 	event_add_str(ctx->cmd->global_event, "mailbox",
 		      mailbox_get_vname(ctx->box));
+	/* the index files are read right away by the open and sync. let the
+	   kernel read them in parallel instead of one at a time. */
+	mailbox_prefetch_index_files(ctx->box);
 	if (mailbox_open(ctx->box) < 0) {
 		client_send_box_error(ctx->cmd, ctx->box);
 		mailbox_free(&ctx->box);
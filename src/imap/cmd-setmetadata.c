@@ -194,17 +194,12 @@ cmd_setmetadata_entry(struct imap_setmetadata_context *ctx,
 		}
 		return 1;
 	case IMAP_ARG_LITERAL_SIZE:
-		o_stream_nsend(ctx->cmd->client->output, "+ OK\r\n", 6);
-		o_stream_uncork(ctx->cmd->client->output);
-		o_stream_cork(ctx->cmd->client->output);
-		/* fall through */
 	case IMAP_ARG_LITERAL_SIZE_NONSYNC:
 		i_free(ctx->entry_name);
 		ctx->entry_name = i_strdup(entry_name);
 		ctx->entry_value_len = imap_arg_as_literal_size(entry_value);
 
-		inputs[0] = i_stream_create_limit(ctx->cmd->client->input,
-						  ctx->entry_value_len);
+		inputs[0] = imap_parser_read_last_literal_stream(ctx->parser);
 		inputs[1] = NULL;
 
 		path = t_str_new(128);
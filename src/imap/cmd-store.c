@@ -119,15 +119,64 @@ store_parse_args(struct imap_store_context *ctx, const struct imap_arg *args)
 	return TRUE;
 }
 
+static const ARRAY_TYPE(seq_range) *
+store_get_seqset(struct imap_store_context *ctx,
+		 struct mail_search_args *search_args, bool update_deletes)
+{
+	const struct mail_search_arg *arg = search_args->args;
+
+	/* UNCHANGEDSINCE needs to check each mail's modseq and the \Deleted
+	   counting needs each mail's old flags */
+	if (ctx->max_modseq < (uint64_t)-1 || update_deletes)
+		return NULL;
+	if (arg->next != NULL || arg->type != SEARCH_SEQSET || arg->match_not)
+		return NULL;
+	return &arg->value.seqset;
+}
+
+static int
+store_search_update(struct imap_store_context *ctx,
+		    struct mailbox_transaction_context *t,
+		    struct mail_search_args *search_args,
+		    ARRAY_TYPE(seq_range) *modified_set, bool update_deletes,
+		    unsigned int *deleted_count_r)
+{
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+
+	search_ctx = mailbox_search_init(t, search_args, NULL,
+					 MAIL_FETCH_FLAGS, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (ctx->max_modseq < (uint64_t)-1) {
+			/* check early so there's less work for transaction
+			   commit if something has to be cancelled */
+			if (mail_get_modseq(mail) > ctx->max_modseq) {
+				seq_range_array_add(modified_set, mail->seq);
+				continue;
+			}
+		}
+		if (update_deletes) {
+			if ((mail_get_flags(mail) & MAIL_DELETED) == 0)
+				(*deleted_count_r)++;
+		}
+		if (ctx->modify_type == MODIFY_REPLACE || ctx->flags != 0)
+			mail_update_flags(mail, ctx->modify_type, ctx->flags);
+		if (ctx->modify_type == MODIFY_REPLACE || ctx->keywords != NULL) {
+			mail_update_keywords(mail, ctx->modify_type,
+					     ctx->keywords);
+		}
+	}
+	return mailbox_search_deinit(&search_ctx);
+}
+
 bool cmd_store(struct client_command_context *cmd)
 {
 	struct client *client = cmd->client;
 	const struct imap_arg *args;
 	struct mail_search_args *search_args;
-	struct mail_search_context *search_ctx;
         struct mailbox_transaction_context *t;
-	struct mail *mail;
 	struct imap_store_context ctx;
+	const ARRAY_TYPE(seq_range) *seqs;
 	ARRAY_TYPE(seq_range) modified_set, uids;
 	enum mailbox_transaction_flags flags = 0;
 	enum imap_sync_flags imap_sync_flags = 0;
@@ -179,10 +228,6 @@ bool cmd_store(struct client_command_context *cmd)
 	t = mailbox_transaction_begin(client->mailbox, flags,
 				      imap_client_command_get_reason(cmd));
 
-	search_ctx = mailbox_search_init(t, search_args, NULL,
-					 MAIL_FETCH_FLAGS, NULL);
-	mail_search_args_unref(&search_args);
-
 	i_array_init(&modified_set, 64);
 	if (ctx.max_modseq < (uint64_t)-1) {
 		/* STORE UNCHANGEDSINCE is being used */
@@ -193,31 +238,22 @@ bool cmd_store(struct client_command_context *cmd)
 	update_deletes = (ctx.flags & MAIL_DELETED) != 0 &&
 		ctx.modify_type != MODIFY_REMOVE;
 	deleted_count = 0;
-	while (mailbox_search_next(search_ctx, &mail)) {
-		if (ctx.max_modseq < (uint64_t)-1) {
-			/* check early so there's less work for transaction
-			   commit if something has to be cancelled */
-			if (mail_get_modseq(mail) > ctx.max_modseq) {
-				seq_range_array_add(&modified_set, mail->seq);
-				continue;
-			}
-		}
-		if (update_deletes) {
-			if ((mail_get_flags(mail) & MAIL_DELETED) == 0)
-				deleted_count++;
-		}
-		if (ctx.modify_type == MODIFY_REPLACE || ctx.flags != 0)
-			mail_update_flags(mail, ctx.modify_type, ctx.flags);
-		if (ctx.modify_type == MODIFY_REPLACE || ctx.keywords != NULL) {
-			mail_update_keywords(mail, ctx.modify_type,
-					     ctx.keywords);
-		}
+	seqs = store_get_seqset(&ctx, search_args, update_deletes);
+	if (seqs != NULL) {
+		/* plain sequence set - update the flags for the whole ranges
+		   without looking up the mails */
+		mailbox_update_flags_range(t, seqs, ctx.modify_type,
+					   ctx.flags, ctx.keywords);
+		ret = 0;
+	} else {
+		ret = store_search_update(&ctx, t, search_args, &modified_set,
+					  update_deletes, &deleted_count);
 	}
+	mail_search_args_unref(&search_args);
 
 	if (ctx.keywords != NULL)
 		mailbox_keywords_unref(&ctx.keywords);
 
-	ret = mailbox_search_deinit(&search_ctx);
 	if (ret < 0)
 		mailbox_transaction_rollback(&t);
 	 else
@@ -144,6 +144,10 @@ struct client *client_create(int fd_in, int fd_out,
 	o_stream_set_name(client->output, "<imap client>");
 
 	o_stream_set_flush_callback(client->output, client_output, client);
+	/* Output sent by callbacks outside the normal input/output handlers
+	   (notifications, timeouts, storage callbacks) is collected and
+	   written once at the end of the ioloop run. */
+	o_stream_set_auto_cork(client->output, TRUE);
 
 	p_array_init(&client->module_contexts, client->pool, 5);
         client->last_input = ioloop_time;
@@ -501,6 +505,10 @@ static void client_default_destroy(struct client *client, const char *reason)
 
 	if (client->free_parser != NULL)
 		imap_parser_unref(&client->free_parser);
+	if (client->deferred_output != NULL) {
+		o_stream_destroy(&client->deferred_output);
+		buffer_free(&client->deferred_output_buf);
+	}
 	io_remove(&client->io);
 	timeout_remove(&client->to_idle_output);
 	timeout_remove(&client->to_idle);
@@ -591,6 +599,19 @@ void client_add_capability(struct client *client, const char *capability)
 	str_append(client->capability_string, capability);
 }
 
+static bool client_output_is_deferred(struct client *client)
+{
+	struct client_command_context *cmd;
+
+	if (client->deferred_output == NULL)
+		return FALSE;
+	for (cmd = client->command_queue; cmd != NULL; cmd = cmd->next) {
+		if (cmd->executing)
+			return cmd->output_deferred;
+	}
+	return FALSE;
+}
+
 void client_send_line(struct client *client, const char *data)
 {
 	(void)client_send_line_next(client, data);
@@ -608,6 +629,13 @@ int client_send_line_next(struct client *client, const char *data)
 	iov[1].iov_base = "\r\n";
 	iov[1].iov_len = 2;
 
+	if (client_output_is_deferred(client)) {
+		o_stream_nsendv(client->deferred_output, iov, 2);
+		/* stop the command if too much is buffered. it continues
+		   after the output lock is released. */
+		return client->deferred_output_buf->used >=
+			CLIENT_OUTPUT_OPTIMAL_SIZE ? 0 : 1;
+	}
 	if (o_stream_sendv(client->output, iov, 2) < 0)
 		return -1;
 	client->last_output = ioloop_time;
@@ -677,7 +705,8 @@ client_default_send_tagline(struct client_command_context *cmd, const char *data
 		str_printfa(str, "%s %s", tag, data);
 		client_cmd_append_timing_stats(cmd, str);
 		str_append(str, "\r\n");
-		o_stream_nsend(client->output, str_data(str), str_len(str));
+		o_stream_nsend(cmd->output_deferred ? client->deferred_output :
+			       client->output, str_data(str), str_len(str));
 	} T_END;
 
 	client->last_output = ioloop_time;
@@ -859,6 +888,12 @@ static bool client_command_is_ambiguous(struct client_command_context *cmd)
 	    !imap_sync_is_allowed(cmd->client))
 		return TRUE;
 
+	if (cmd->output_deferred &&
+	    (cmd->cmd_flags & COMMAND_FLAG_DEFERRABLE_OUTPUT) == 0) {
+		/* wait until the output lock is released */
+		return TRUE;
+	}
+
 	if (cmd->search_save_result_used) {
 		/* if there are pending commands that update the search
 		   save result, wait */
@@ -957,9 +992,48 @@ client_command_new(struct client *client)
 		if (client->set->imap_literal_minus)
 			imap_parser_enable_literal_minus(cmd->parser);
 	}
+	if (client->output_cmd_lock != NULL) {
+		/* another command is in the middle of sending its output.
+		   buffer this command's output, including any literal
+		   continuation replies. */
+		if (client->deferred_output == NULL) {
+			client->deferred_output_buf =
+				buffer_create_dynamic(default_pool, 1024);
+			client->deferred_output =
+				o_stream_create_buffer(client->deferred_output_buf);
+		}
+		cmd->output_deferred = TRUE;
+		imap_parser_set_streams(cmd->parser, client->input,
+					client->deferred_output);
+	}
 	return cmd;
 }
 
+static void client_flush_deferred_output(struct client *client)
+{
+	struct client_command_context *cmd;
+
+	if (client->deferred_output == NULL ||
+	    client->output_cmd_lock != NULL)
+		return;
+
+	for (cmd = client->command_queue; cmd != NULL; cmd = cmd->next) {
+		if (!cmd->output_deferred)
+			continue;
+		cmd->output_deferred = FALSE;
+		if (cmd->parser != NULL) {
+			imap_parser_set_streams(cmd->parser, client->input,
+						client->output);
+		}
+	}
+	if (client->deferred_output_buf->used > 0) {
+		o_stream_nsend(client->output, client->deferred_output_buf->data,
+			       client->deferred_output_buf->used);
+		buffer_set_used_size(client->deferred_output_buf, 0);
+		client->last_output = ioloop_time;
+	}
+}
+
 void client_add_missing_io(struct client *client)
 {
 	if (client->io == NULL && !client->disconnected)
@@ -1011,6 +1085,15 @@ void client_command_free(struct client_command_context **_cmd)
 	event_add_int(cmd->event, "lock_wait_usecs", cmd->stats.lock_wait_usecs);
 	event_add_int(cmd->event, "bytes_in", cmd->stats.bytes_in);
 	event_add_int(cmd->event, "bytes_out", cmd->stats.bytes_out);
+	event_add_int(cmd->event, "ioloop_wait_usecs",
+		      io_loop_get_wait_usecs(current_ioloop) -
+		      cmd->stats.start_ioloop_wait_usecs);
+	event_add_int(cmd->event, "user_cpu_usecs", cmd->stats.user_cpu_usecs);
+	event_add_int(cmd->event, "sys_cpu_usecs", cmd->stats.sys_cpu_usecs);
+	event_add_int(cmd->event, "disk_read_bytes",
+		      cmd->stats.disk_read_bytes);
+	event_add_int(cmd->event, "cache_hits", cmd->stats.cache_hits);
+	event_add_int(cmd->event, "cache_misses", cmd->stats.cache_misses);
 
 	e_debug(cmd->event, "Command finished: %s %s", cmd->name,
 		cmd->human_args != NULL ? cmd->human_args : "");
@@ -1018,6 +1101,10 @@ void client_command_free(struct client_command_context **_cmd)
 	event_unref(&cmd->global_event);
 
 	if (cmd->parser != NULL) {
+		if (cmd->output_deferred) {
+			imap_parser_set_streams(cmd->parser, client->input,
+						client->output);
+		}
 		if (client->free_parser == NULL) {
 			imap_parser_reset(cmd->parser);
 			client->free_parser = cmd->parser;
@@ -1053,6 +1140,12 @@ static void client_check_command_hangs(struct client *client)
 	struct client_command_context *cmd;
 	unsigned int unfinished_count = 0;
 	bool have_wait_unfinished = FALSE;
+	/* A corked ostream has no IO_WRITE handler. It's added back when the
+	   output is auto-uncorked at the end of the ioloop run, if there is
+	   still output pending or a flush is wanted. If client->output is
+	   a wrapper stream (e.g. COMPRESS), it must be the auto-corked one,
+	   so that the fd ostream is corked only when it's corked too. */
+	bool output_corked = o_stream_is_corked(client->output);
 
 	for (cmd = client->command_queue; cmd != NULL; cmd = cmd->next) {
 		switch (cmd->state) {
@@ -1068,7 +1161,8 @@ static void client_check_command_hangs(struct client *client)
 			unfinished_count++;
 			break;
 		case CLIENT_COMMAND_STATE_WAIT_OUTPUT:
-			i_assert((io_loop_find_fd_conditions(current_ioloop, client->fd_out) & IO_WRITE) != 0);
+			i_assert(output_corked ||
+				 (io_loop_find_fd_conditions(current_ioloop, client->fd_out) & IO_WRITE) != 0);
 			unfinished_count++;
 			break;
 		case CLIENT_COMMAND_STATE_WAIT_EXTERNAL:
@@ -1078,7 +1172,9 @@ static void client_check_command_hangs(struct client *client)
 			have_wait_unfinished = TRUE;
 			break;
 		case CLIENT_COMMAND_STATE_WAIT_SYNC:
-			if ((io_loop_find_fd_conditions(current_ioloop, client->fd_out) & IO_WRITE) == 0)
+			if (output_corked) {
+				/* can't know yet */
+			} else if ((io_loop_find_fd_conditions(current_ioloop, client->fd_out) & IO_WRITE) == 0)
 				have_wait_unfinished = TRUE;
 			else {
 				/* we have an output callback, which will be
@@ -1127,6 +1223,7 @@ void client_continue_pending_input(struct client *client)
 
 	/* this function is called at the end of I/O callbacks (and only there).
 	   fix up the command states and verify that they're correct. */
+	client_flush_deferred_output(client);
 	while (client_remove_pending_unambiguity(client)) {
 		client_add_missing_io(client);
 
@@ -1311,9 +1408,10 @@ static bool client_handle_next_command(struct client *client, bool *remove_io_r)
 		if (client->input_lock->state ==
 		    CLIENT_COMMAND_STATE_WAIT_UNAMBIGUITY ||
 		    /* we can't send literal "+ OK" replies if output is
-		       locked by another command. */
+		       locked by another command, unless they're deferred */
 		    (client->output_cmd_lock != NULL &&
-		     client->output_cmd_lock != client->input_lock)) {
+		     client->output_cmd_lock != client->input_lock &&
+		     !client->input_lock->output_deferred)) {
 			*remove_io_r = TRUE;
 			return FALSE;
 		}
@@ -1332,9 +1430,9 @@ static bool client_handle_next_command(struct client *client, bool *remove_io_r)
 	if (i_stream_get_data_size(client->input) == 0)
 		return FALSE;
 
-	/* beginning a new command */
-	if (client->command_queue_size >= CLIENT_COMMAND_QUEUE_MAX_SIZE ||
-	    client->output_cmd_lock != NULL) {
+	/* beginning a new command. if another command has locked the output,
+	   the new command's output is deferred. */
+	if (client->command_queue_size >= CLIENT_COMMAND_QUEUE_MAX_SIZE) {
 		/* wait for some of the commands to finish */
 		*remove_io_r = TRUE;
 		return FALSE;
@@ -1446,6 +1544,9 @@ static void client_output_commands(struct client *client)
 		client_output_cmd(client->output_cmd_lock);
 	}
 	while (client->output_cmd_lock == NULL) {
+		/* send the output of commands that finished while the
+		   output was locked */
+		client_flush_deferred_output(client);
 		/* go through the entire commands list every time in case
 		   multiple commands were freed. temp_executed keeps track of
 		   which messages we've called so far */
@@ -67,12 +67,21 @@ struct client_command_stats {
 	uint64_t lock_wait_usecs;
 	/* how many bytes of client input/output command has used */
 	uint64_t bytes_in, bytes_out;
+	/* how many usecs of user/system CPU this command has used */
+	uint64_t user_cpu_usecs, sys_cpu_usecs;
+	/* how many bytes this command has read from files */
+	uint64_t disk_read_bytes;
+	/* how many mail cache field lookups were found/not found */
+	uint64_t cache_hits, cache_misses;
 };
 
 struct client_command_stats_start {
 	struct timeval timeval;
 	uint64_t lock_wait_usecs;
 	uint64_t bytes_in, bytes_out;
+	struct timeval user_cpu, sys_cpu;
+	uint64_t disk_read_bytes;
+	uint64_t cache_hits, cache_misses;
 };
 
 struct client_command_context {
@@ -120,6 +129,9 @@ struct client_command_context {
 	bool temp_executed:1; /* temporary execution state tracking */
 	bool tagline_sent:1;
 	bool executing:1;
+	/* command was started while another command had locked the output.
+	   its output goes to client->deferred_output. */
+	bool output_deferred:1;
 };
 
 struct imap_client_vfuncs {
@@ -214,6 +226,10 @@ struct client {
 	/* client input/output is locked by this command */
 	struct client_command_context *input_lock;
 	struct client_command_context *output_cmd_lock;
+	/* output of commands that were run while another command had locked
+	   the output. it's sent after the lock is released. */
+	buffer_t *deferred_output_buf;
+	struct ostream *deferred_output;
 	/* command changing the mailbox */
 	struct client_command_context *mailbox_change_lock;
 
@@ -7,8 +7,11 @@
 #include "istream.h"
 #include "ostream.h"
 #include "time-util.h"
+#include "mail-cache.h"
+#include "master-service-profile.h"
 #include "imap-commands.h"
 
+#include <sys/resource.h>
 
 struct command_hook {
 	command_hook_callback_t *pre;
@@ -30,10 +33,10 @@ static const struct command imap4rev1_commands[] = {
 	{ "DELETE",		cmd_delete,      COMMAND_FLAG_BREAKS_MAILBOX |
 						 COMMAND_FLAG_USE_NONEXISTENT },
 	{ "RENAME",		cmd_rename,      COMMAND_FLAG_USE_NONEXISTENT },
-	{ "LIST",		cmd_list,        0 },
-	{ "LSUB",		cmd_lsub,        0 },
+	{ "LIST",		cmd_list,        COMMAND_FLAG_DEFERRABLE_OUTPUT },
+	{ "LSUB",		cmd_lsub,        COMMAND_FLAG_DEFERRABLE_OUTPUT },
 	{ "SELECT",		cmd_select,      COMMAND_FLAG_BREAKS_MAILBOX },
-	{ "STATUS",		cmd_status,      0 },
+	{ "STATUS",		cmd_status,      COMMAND_FLAG_DEFERRABLE_OUTPUT },
 	{ "SUBSCRIBE",		cmd_subscribe,   0 },
 	{ "UNSUBSCRIBE",	cmd_unsubscribe, COMMAND_FLAG_USE_NONEXISTENT },
 
@@ -65,7 +68,7 @@ static const struct command imap_ext_commands[] = {
 						 COMMAND_FLAG_BREAKS_MAILBOX },
 	{ "GETMETADATA",	cmd_getmetadata, 0 },
 	{ "SETMETADATA",	cmd_setmetadata, 0 },
-	{ "NAMESPACE",		cmd_namespace,   0 },
+	{ "NAMESPACE",		cmd_namespace,   COMMAND_FLAG_DEFERRABLE_OUTPUT },
 	{ "NOTIFY",		cmd_notify,      COMMAND_FLAG_BREAKS_SEQS },
 	{ "SORT",		cmd_sort,        COMMAND_FLAG_USES_SEQS },
 	{ "THREAD",		cmd_thread,      COMMAND_FLAG_USES_SEQS },
@@ -78,7 +81,7 @@ static const struct command imap_ext_commands[] = {
 	{ "UNSELECT",		cmd_unselect,    COMMAND_FLAG_BREAKS_MAILBOX },
 	{ "X-CANCEL",		cmd_x_cancel,    0 },
 	{ "X-STATE",		cmd_x_state,     COMMAND_FLAG_REQUIRES_SYNC },
-	{ "XLIST",		cmd_list,        0 },
+	{ "XLIST",		cmd_list,        COMMAND_FLAG_DEFERRABLE_OUTPUT },
 	/* IMAP URLAUTH (RFC4467): */
 	{ "GENURLAUTH",		cmd_genurlauth,  0 },
 	{ "RESETKEY",		cmd_resetkey,    0 },
@@ -160,16 +163,34 @@ void command_hook_unregister(command_hook_callback_t *pre,
 	i_panic("command_hook_unregister(): hook not registered");
 }
 
+static void command_stats_get_rusage(struct rusage *ru_r)
+{
+	if (getrusage(RUSAGE_SELF, ru_r) < 0)
+		i_fatal("getrusage() failed: %m");
+}
+
 void command_stats_start(struct client_command_context *cmd)
 {
+	struct rusage ru;
+
 	cmd->stats_start.timeval = ioloop_timeval;
 	cmd->stats_start.lock_wait_usecs = file_lock_wait_get_total_usecs();
 	cmd->stats_start.bytes_in = i_stream_get_absolute_offset(cmd->client->input);
 	cmd->stats_start.bytes_out = cmd->client->output->offset;
+	command_stats_get_rusage(&ru);
+	cmd->stats_start.user_cpu = ru.ru_utime;
+	cmd->stats_start.sys_cpu = ru.ru_stime;
+	cmd->stats_start.disk_read_bytes = i_stream_file_get_total_read_bytes();
+	mail_cache_get_lookup_counters(&cmd->stats_start.cache_hits,
+				       &cmd->stats_start.cache_misses);
 }
 
 void command_stats_flush(struct client_command_context *cmd)
 {
+	struct rusage ru;
+	uint64_t cache_hits, cache_misses;
+	long long diff;
+
 	io_loop_time_refresh();
 	cmd->stats.running_usecs +=
 		timeval_diff_usecs(&ioloop_timeval, &cmd->stats_start.timeval);
@@ -180,6 +201,19 @@ void command_stats_flush(struct client_command_context *cmd)
 		cmd->stats_start.bytes_in;
 	cmd->stats.bytes_out += cmd->client->output->offset -
 		cmd->stats_start.bytes_out;
+
+	command_stats_get_rusage(&ru);
+	diff = timeval_diff_usecs(&ru.ru_utime, &cmd->stats_start.user_cpu);
+	if (diff > 0)
+		cmd->stats.user_cpu_usecs += diff;
+	diff = timeval_diff_usecs(&ru.ru_stime, &cmd->stats_start.sys_cpu);
+	if (diff > 0)
+		cmd->stats.sys_cpu_usecs += diff;
+	cmd->stats.disk_read_bytes += i_stream_file_get_total_read_bytes() -
+		cmd->stats_start.disk_read_bytes;
+	mail_cache_get_lookup_counters(&cache_hits, &cache_misses);
+	cmd->stats.cache_hits += cache_hits - cmd->stats_start.cache_hits;
+	cmd->stats.cache_misses += cache_misses - cmd->stats_start.cache_misses;
 	/* allow flushing multiple times */
 	command_stats_start(cmd);
 }
@@ -195,6 +229,7 @@ bool command_exec(struct client_command_context *cmd)
 	command_stats_start(cmd);
 
 	event_push_global(cmd->global_event);
+	master_service_profile_set_label(cmd->name);
 	cmd->executing = TRUE;
 	array_foreach(&command_hooks, hook)
 		hook->pre(cmd);
@@ -202,6 +237,7 @@ bool command_exec(struct client_command_context *cmd)
 	array_foreach(&command_hooks, hook)
 		hook->post(cmd);
 	cmd->executing = FALSE;
+	master_service_profile_set_label(NULL);
 	event_pop_global(cmd->global_event);
 	if (cmd->state == CLIENT_COMMAND_STATE_DONE)
 		finished = TRUE;
@@ -30,7 +30,12 @@ enum command_flags {
 	   Dovecot internally returns it for all kinds of commands,
 	   but unfortunately RFC 5530 specifies it only for "delete something"
 	   operations. */
-	COMMAND_FLAG_USE_NONEXISTENT	= 0x10
+	COMMAND_FLAG_USE_NONEXISTENT	= 0x10,
+	/* Command doesn't use the selected mailbox and sends all of its
+	   output with client_send_line*() and client_send_tagline(). It can
+	   be run while another command has locked the output. The output is
+	   then buffered until the lock is released. */
+	COMMAND_FLAG_DEFERRABLE_OUTPUT	= 0x20
 };
 
 struct command {
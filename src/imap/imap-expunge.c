@@ -1,6 +1,7 @@
 /* Copyright (c) 2003-2018 Dovecot authors, see the included COPYING file */
 
 #include "imap-common.h"
+#include "seq-range-array.h"
 #include "mail-storage.h"
 #include "mail-search-build.h"
 #include "imap-search-args.h"
@@ -53,7 +54,7 @@ int imap_expunge(struct mailbox *box, struct mail_search_arg *next_search_arg,
 	struct mail_search_args *search_args;
 	struct mailbox_status status;
 	bool expunges = FALSE;
-	int ret;
+	int ret = 0;
 
 	if (mailbox_is_readonly(box)) {
 		/* silently ignore */
@@ -77,28 +78,23 @@ int imap_expunge(struct mailbox *box, struct mail_search_arg *next_search_arg,
 						   IMAP_EXPUNGE_BATCH_SIZE);
 
 	do {
+		const ARRAY_TYPE(seq_range) *seqs =
+			&search_args->args->value.seqset;
 		struct mailbox_transaction_context *t;
-		struct mail_search_context *ctx;
-		struct mail *mail;
 
-		t = mailbox_transaction_begin(box, 0, "EXPUNGE");
-		ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
+		if (array_count(seqs) == 0)
+			break;
 
-		while (mailbox_search_next(ctx, &mail)) {
-			*expunged_count += 1;
-			mail_expunge(mail);
-			expunges = TRUE;
-		}
+		/* the seqset was already looked up from the same view, so
+		   there's no need to search the messages again */
+		t = mailbox_transaction_begin(box, 0, "EXPUNGE");
+		mailbox_expunge_range(t, seqs);
+		*expunged_count += seq_range_count(seqs);
+		expunges = TRUE;
 
-		ret = mailbox_search_deinit(&ctx);
-		if (ret < 0) {
-			mailbox_transaction_rollback(&t);
+		ret = mailbox_transaction_commit(&t);
+		if (ret < 0)
 			break;
-		} else {
-			ret = mailbox_transaction_commit(&t);
-			if (ret < 0)
-				break;
-		}
 	} while (imap_search_seqset_iter_next(seqset_iter));
 
 	imap_search_seqset_iter_deinit(&seqset_iter);
@@ -618,8 +618,11 @@ int imap_fetch_more(struct imap_fetch_context *ctx,
 	if (ret < 0)
 		ctx->state.failed = TRUE;
 	if (ctx->state.line_partial) {
-		/* nothing can be sent until FETCH is finished */
+		/* nothing can be sent until the FETCH reply is finished */
 		ctx->client->output_cmd_lock = cmd;
+	} else if (ctx->client->output_cmd_lock == cmd) {
+		/* between messages - let the other commands' output be sent */
+		ctx->client->output_cmd_lock = NULL;
 	}
 	if (cmd->cancel && ctx->client->output_cmd_lock != NULL) {
 		/* canceling didn't really work. we must not output
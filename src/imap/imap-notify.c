@@ -54,7 +54,6 @@ static int imap_notify_status(struct imap_notify_namespace *notify_ns,
 	if (client_has_enabled(client, imap_feature_condstore))
 		items.flags |= IMAP_STATUS_ITEM_HIGHESTMODSEQ;
 
-	box = mailbox_alloc(notify_ns->ns->list, rec->vname, 0);
 	if ((rec->events & MAILBOX_LIST_NOTIFY_UIDVALIDITY) != 0) {
 		items.flags |= IMAP_STATUS_ITEM_UIDVALIDITY |
 			IMAP_STATUS_ITEM_UIDNEXT | IMAP_STATUS_ITEM_MESSAGES |
@@ -71,7 +70,19 @@ static int imap_notify_status(struct imap_notify_namespace *notify_ns,
 	}
 	if (imap_status_items_is_empty(&items)) {
 		/* don't send anything */
-	} else if (imap_status_get_result(client, box, &items, &result) < 0) {
+		return 1;
+	}
+	if (rec->status != NULL &&
+	    notify_ns->ns->type == MAIL_NAMESPACE_TYPE_PRIVATE) {
+		/* all the wanted items were already looked up while finding
+		   the change. no need to open the mailbox. */
+		i_zero(&result);
+		result.status = *rec->status;
+		return imap_status_send(client, rec->vname, &items, &result);
+	}
+
+	box = mailbox_alloc(notify_ns->ns->list, rec->vname, 0);
+	if (imap_status_get_result(client, box, &items, &result) < 0) {
 		/* hide permission errors from client. we don't want to leak
 		   information about existence of mailboxes where user doesn't
 		   have access to */
@@ -354,9 +365,8 @@ void imap_client_notify_finished(struct client *client)
 static void notify_callback(struct imap_notify_namespace *notify_ns)
 {
 	struct event_reason *reason = event_reason_begin("imap:notify_update");
-	o_stream_cork(notify_ns->ctx->client->output);
+	/* the output is auto-corked */
 	imap_client_notify_ns(notify_ns);
-	o_stream_uncork(notify_ns->ctx->client->output);
 	event_reason_end(&reason);
 }
 
@@ -472,10 +472,8 @@ static void cmd_search_more_callback(struct client_command_context *cmd)
 	struct client *client = cmd->client;
 	bool finished;
 
-	o_stream_cork(client->output);
+	/* the output is auto-corked */
 	finished = command_exec(cmd);
-	o_stream_uncork(client->output);
-
 	if (!finished)
 		(void)client_handle_unfinished_cmd(cmd);
 	else
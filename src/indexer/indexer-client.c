@@ -65,9 +65,14 @@ indexer_client_request_queue(struct indexer_client *client, bool append,
 		indexer_client_ref(client);
 	}
 
-	indexer_queue_append(client->queue, append, args[1], args[2],
-			     session_id, max_recent_msgs, ctx);
+	bool queued = indexer_queue_append(client->queue, append,
+					   args[1], args[2], session_id,
+					   max_recent_msgs, ctx);
 	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\tOK\n", tag));
+	if (!queued && ctx != NULL) {
+		/* the queue is full */
+		indexer_client_status_callback(-1, ctx);
+	}
 	return 0;
 }
 
@@ -95,8 +100,13 @@ indexer_client_request_optimize(struct indexer_client *client,
 		indexer_client_ref(client);
 	}
 
-	indexer_queue_append_optimize(client->queue, args[1], args[2], ctx);
+	bool queued = indexer_queue_append_optimize(client->queue,
+						    args[1], args[2], ctx);
 	o_stream_nsend_str(client->conn.output, t_strdup_printf("%u\tOK\n", tag));
+	if (!queued && ctx != NULL) {
+		/* the queue is full */
+		indexer_client_status_callback(-1, ctx);
+	}
 	return 0;
 }
 
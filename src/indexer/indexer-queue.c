@@ -4,15 +4,58 @@
 #include "array.h"
 #include "llist.h"
 #include "hash.h"
+#include "ioloop.h"
+#include "time-util.h"
 #include "indexer-queue.h"
 
+/* Let one bulk request through after this many interactive requests, so
+   that a constant stream of searches doesn't stop background indexing
+   completely. */
+#define INDEXER_QUEUE_INTERACTIVE_WEIGHT 4
+
+struct indexer_queue_user {
+	/* round-robin list of the lane's users */
+	struct indexer_queue_user *prev, *next;
+
+	char *username;
+	enum indexer_queue_lane lane;
+	/* the user's queued requests in this lane */
+	struct indexer_request *head, *tail;
+};
+
+struct indexer_lane {
+	/* username -> indexer_queue_user */
+	HASH_TABLE(char *, struct indexer_queue_user *) users;
+	/* users that have queued requests. The user at the head is served
+	   first, and then moved to the tail. */
+	struct indexer_queue_user *head, *tail;
+	unsigned int count;
+};
+
 struct indexer_queue {
 	indexer_queue_callback_t *callback;
 	void (*listen_callback)(struct indexer_queue *);
+	struct event *event;
 
 	/* username+mailbox -> indexer_request */
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
-	struct indexer_request *head, *tail;
+	struct indexer_lane lanes[INDEXER_QUEUE_LANE_COUNT];
+
+	unsigned int max_queued_requests;
+	/* number of interactive requests started since the last bulk
+	   request */
+	unsigned int interactive_streak;
+
+	bool full_warned:1;
+};
+
+static struct event_category event_category_indexer = {
+	.name = "indexer",
+};
+
+static const char *const indexer_queue_lane_names[] = {
+	"interactive",
+	"bulk",
 };
 
 static unsigned int
@@ -29,26 +72,39 @@ static int indexer_request_cmp(const struct indexer_request *r1,
 }
 
 struct indexer_queue *
-indexer_queue_init(indexer_queue_callback_t *callback)
+indexer_queue_init(indexer_queue_callback_t *callback,
+		   unsigned int max_queued_requests)
 {
 	struct indexer_queue *queue;
-	
+	unsigned int i;
+
 	queue = i_new(struct indexer_queue, 1);
 	queue->callback = callback;
+	queue->max_queued_requests = max_queued_requests;
+	queue->event = event_create(NULL);
+	event_add_category(queue->event, &event_category_indexer);
 	hash_table_create(&queue->requests, default_pool, 0,
 			  indexer_request_hash, indexer_request_cmp);
+	for (i = 0; i < INDEXER_QUEUE_LANE_COUNT; i++) {
+		hash_table_create(&queue->lanes[i].users, default_pool, 0,
+				  str_hash, strcmp);
+	}
 	return queue;
 }
 
 void indexer_queue_deinit(struct indexer_queue **_queue)
 {
 	struct indexer_queue *queue = *_queue;
+	unsigned int i;
 
 	*_queue = NULL;
 
 	i_assert(indexer_queue_is_empty(queue));
 
+	for (i = 0; i < INDEXER_QUEUE_LANE_COUNT; i++)
+		hash_table_destroy(&queue->lanes[i].users);
 	hash_table_destroy(&queue->requests);
+	event_unref(&queue->event);
 	i_free(queue);
 }
 
@@ -58,6 +114,64 @@ void indexer_queue_set_listen_callback(struct indexer_queue *queue,
 	queue->listen_callback = callback;
 }
 
+static unsigned int indexer_queue_queued_count(struct indexer_queue *queue)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < INDEXER_QUEUE_LANE_COUNT; i++)
+		count += queue->lanes[i].count;
+	return count;
+}
+
+static void
+indexer_queue_request_enqueue(struct indexer_queue *queue,
+			      struct indexer_request *request,
+			      enum indexer_queue_lane lane_idx, bool append)
+{
+	struct indexer_lane *lane = &queue->lanes[lane_idx];
+	struct indexer_queue_user *user;
+
+	i_assert(request->queue_user == NULL);
+
+	user = hash_table_lookup(lane->users, request->username);
+	if (user == NULL) {
+		user = i_new(struct indexer_queue_user, 1);
+		user->username = i_strdup(request->username);
+		user->lane = lane_idx;
+		hash_table_insert(lane->users, user->username, user);
+		DLLIST2_APPEND(&lane->head, &lane->tail, user);
+	}
+	if (append)
+		DLLIST2_APPEND(&user->head, &user->tail, request);
+	else
+		DLLIST2_PREPEND(&user->head, &user->tail, request);
+	request->queue_user = user;
+	lane->count++;
+}
+
+static void
+indexer_queue_request_dequeue(struct indexer_queue *queue,
+			      struct indexer_request *request)
+{
+	struct indexer_queue_user *user = request->queue_user;
+	struct indexer_lane *lane = &queue->lanes[user->lane];
+
+	DLLIST2_REMOVE(&user->head, &user->tail, request);
+	request->queue_user = NULL;
+	i_assert(lane->count > 0);
+	lane->count--;
+
+	if (user->head == NULL) {
+		hash_table_remove(lane->users, user->username);
+		DLLIST2_REMOVE(&lane->head, &lane->tail, user);
+		i_free(user->username);
+		i_free(user);
+	}
+	if (queue->max_queued_requests > 0 &&
+	    indexer_queue_queued_count(queue) < queue->max_queued_requests)
+		queue->full_warned = FALSE;
+}
+
 static struct indexer_request *
 indexer_queue_lookup(struct indexer_queue *queue,
 		     const char *username, const char *mailbox)
@@ -79,6 +193,33 @@ static void request_add_context(struct indexer_request *request, void *context)
 	array_push_back(&request->contexts, &context);
 }
 
+static bool
+indexer_queue_is_full(struct indexer_queue *queue,
+		      const char *username, const char *mailbox)
+{
+	unsigned int count;
+
+	if (queue->max_queued_requests == 0)
+		return FALSE;
+	count = indexer_queue_queued_count(queue);
+	if (count < queue->max_queued_requests)
+		return FALSE;
+
+	e_debug(event_create_passthrough(queue->event)->
+		set_name("indexer_request_rejected")->
+		add_str("user", username)->
+		add_str("mailbox", mailbox)->event(),
+		"Queue is full - rejecting request for %s: %s",
+		username, mailbox);
+	if (!queue->full_warned) {
+		i_warning("Indexer queue is full (%u requests) - "
+			  "rejecting new background indexing requests "
+			  "(see indexer_max_queued_requests)", count);
+		queue->full_warned = TRUE;
+	}
+	return TRUE;
+}
+
 static struct indexer_request *
 indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			     const char *username, const char *mailbox,
@@ -89,11 +230,16 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 
 	request = indexer_queue_lookup(queue, username, mailbox);
 	if (request == NULL) {
+		/* Only the bulk requests are rejected. Interactive ones
+		   have someone waiting for them. */
+		if (append && indexer_queue_is_full(queue, username, mailbox))
+			return NULL;
 		request = i_new(struct indexer_request, 1);
 		request->username = i_strdup(username);
 		request->mailbox = i_strdup(mailbox);
 		request->session_id = i_strdup(session_id);
 		request->max_recent_msgs = max_recent_msgs;
+		request->queued_time = ioloop_timeval;
 		request_add_context(request, context);
 		hash_table_insert(queue->requests, request, request);
 	} else {
@@ -112,14 +258,14 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			/* keep the request in its old position */
 			return request;
 		}
-		/* move request to beginning of the queue */
-		DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+		/* move request to beginning of the user's interactive
+		   queue */
+		indexer_queue_request_dequeue(queue, request);
 	}
 
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	indexer_queue_request_enqueue(queue, request,
+				      append ? INDEXER_QUEUE_LANE_BULK :
+				      INDEXER_QUEUE_LANE_INTERACTIVE, append);
 	return request;
 }
 
@@ -130,7 +276,7 @@ static void indexer_queue_append_finish(struct indexer_queue *queue)
 	indexer_refresh_proctitle();
 }
 
-void indexer_queue_append(struct indexer_queue *queue, bool append,
+bool indexer_queue_append(struct indexer_queue *queue, bool append,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context)
@@ -140,11 +286,14 @@ void indexer_queue_append(struct indexer_queue *queue, bool append,
 	request = indexer_queue_append_request(queue, append, username, mailbox,
 					       session_id, max_recent_msgs,
 					       context);
+	if (request == NULL)
+		return FALSE;
 	request->index = TRUE;
 	indexer_queue_append_finish(queue);
+	return TRUE;
 }
 
-void indexer_queue_append_optimize(struct indexer_queue *queue,
+bool indexer_queue_append_optimize(struct indexer_queue *queue,
 				   const char *username, const char *mailbox,
 				   void *context)
 {
@@ -152,22 +301,69 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 
 	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
 					       NULL, 0, context);
+	if (request == NULL)
+		return FALSE;
 	request->optimize = TRUE;
 	indexer_queue_append_finish(queue);
+	return TRUE;
 }
 
-struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
+static struct indexer_request *
+indexer_queue_lane_next(struct indexer_lane *lane,
+			indexer_queue_user_busy_callback_t *busy_callback,
+			void *context)
 {
-	return queue->head;
+	struct indexer_queue_user *user;
+
+	for (user = lane->head; user != NULL; user = user->next) {
+		if (!busy_callback(user->username, context))
+			return user->head;
+	}
+	return NULL;
 }
 
-void indexer_queue_request_remove(struct indexer_queue *queue)
+struct indexer_request *
+indexer_queue_request_next(struct indexer_queue *queue,
+			   indexer_queue_user_busy_callback_t *busy_callback,
+			   void *context)
 {
-	struct indexer_request *request = queue->head;
+	struct indexer_lane *first, *second;
+	struct indexer_request *request;
 
-	i_assert(request != NULL);
+	if (queue->interactive_streak < INDEXER_QUEUE_INTERACTIVE_WEIGHT) {
+		first = &queue->lanes[INDEXER_QUEUE_LANE_INTERACTIVE];
+		second = &queue->lanes[INDEXER_QUEUE_LANE_BULK];
+	} else {
+		first = &queue->lanes[INDEXER_QUEUE_LANE_BULK];
+		second = &queue->lanes[INDEXER_QUEUE_LANE_INTERACTIVE];
+	}
+	request = indexer_queue_lane_next(first, busy_callback, context);
+	if (request == NULL)
+		request = indexer_queue_lane_next(second, busy_callback, context);
+	return request;
+}
+
+void indexer_queue_request_remove(struct indexer_queue *queue,
+				  struct indexer_request *request)
+{
+	struct indexer_queue_user *user = request->queue_user;
+	struct indexer_lane *lane;
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	i_assert(user != NULL);
+
+	lane = &queue->lanes[user->lane];
+	if (user->lane == INDEXER_QUEUE_LANE_INTERACTIVE)
+		queue->interactive_streak++;
+	else
+		queue->interactive_streak = 0;
+	request->lane = user->lane;
+
+	/* the user was served - give the other users a turn first */
+	if (user->next != NULL) {
+		DLLIST2_REMOVE(&lane->head, &lane->tail, user);
+		DLLIST2_APPEND(&lane->head, &lane->tail, user);
+	}
+	indexer_queue_request_dequeue(queue, request);
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -192,14 +388,6 @@ void indexer_queue_request_status(struct indexer_queue *queue,
 	indexer_queue_request_status_int(queue, request, percentage);
 }
 
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
-{
-	struct indexer_request *request = queue->head;
-
-	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
-}
-
 void indexer_queue_request_work(struct indexer_request *request)
 {
 	request->working = TRUE;
@@ -208,6 +396,37 @@ void indexer_queue_request_work(struct indexer_request *request)
 		array_count(&request->contexts);
 }
 
+static void
+indexer_queue_request_finished_event(struct indexer_queue *queue,
+				     struct indexer_request *request,
+				     bool success)
+{
+	struct event_passthrough *e;
+
+	if (!request->working) {
+		/* cancelled before it was started */
+		return;
+	}
+	e = event_create_passthrough(queue->event)->
+		set_name("indexer_request_finished")->
+		add_str("user", request->username)->
+		add_str("mailbox", request->mailbox)->
+		add_str("lane", indexer_queue_lane_names[request->lane])->
+		add_int("queue_msecs",
+			timeval_diff_msecs(&ioloop_timeval,
+					   &request->queued_time))->
+		add_int("interactive_queue_size",
+			queue->lanes[INDEXER_QUEUE_LANE_INTERACTIVE].count)->
+		add_int("bulk_queue_size",
+			queue->lanes[INDEXER_QUEUE_LANE_BULK].count);
+	if (!success)
+		e->add_str("error", "Indexing failed");
+	e_debug(e->event(), "Finished %s request for %s: %s (%s)",
+		indexer_queue_lane_names[request->lane],
+		request->username, request->mailbox,
+		success ? "success" : "failed");
+}
+
 void indexer_queue_request_finish(struct indexer_queue *queue,
 				  struct indexer_request **_request,
 				  bool success)
@@ -217,8 +436,11 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 	*_request = NULL;
 
 	indexer_queue_request_status_int(queue, request, success ? 100 : -1);
+	indexer_queue_request_finished_event(queue, request, success);
 
 	if (request->reindex_head || request->reindex_tail) {
+		bool reindex_head = request->reindex_head;
+
 		i_assert(request->working);
 		request->working = FALSE;
 		request->reindex_head = FALSE;
@@ -227,10 +449,10 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		request->queued_time = ioloop_timeval;
+		indexer_queue_request_enqueue(queue, request,
+			reindex_head ? INDEXER_QUEUE_LANE_INTERACTIVE :
+			INDEXER_QUEUE_LANE_BULK, !reindex_head);
 		return;
 	}
 
@@ -239,11 +461,19 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 		array_free(&request->contexts);
 	i_free(request->username);
 	i_free(request->mailbox);
+	i_free(request->session_id);
 	i_free(request);
 
 	indexer_refresh_proctitle();
 }
 
+static bool
+indexer_queue_user_never_busy(const char *username ATTR_UNUSED,
+			      void *context ATTR_UNUSED)
+{
+	return FALSE;
+}
+
 void indexer_queue_cancel_all(struct indexer_queue *queue)
 {
 	struct indexer_request *request;
@@ -257,18 +487,26 @@ void indexer_queue_cancel_all(struct indexer_queue *queue)
 		request->reindex_head = request->reindex_tail = FALSE;
 	hash_table_iterate_deinit(&iter);
 
-	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		indexer_queue_request_remove(queue);
+	while ((request = indexer_queue_request_next(queue,
+			indexer_queue_user_never_busy, NULL)) != NULL) {
+		indexer_queue_request_remove(queue, request);
 		indexer_queue_request_finish(queue, &request, FALSE);
 	}
 }
 
 bool indexer_queue_is_empty(struct indexer_queue *queue)
 {
-	return queue->head == NULL;
+	return indexer_queue_queued_count(queue) == 0;
 }
 
 unsigned int indexer_queue_count(struct indexer_queue *queue)
 {
 	return hash_table_count(queue->requests);
 }
+
+unsigned int indexer_queue_lane_count(struct indexer_queue *queue,
+				      enum indexer_queue_lane lane)
+{
+	i_assert(lane < INDEXER_QUEUE_LANE_COUNT);
+	return queue->lanes[lane].count;
+}
@@ -4,14 +4,32 @@
 #include "indexer.h"
 
 typedef void indexer_queue_callback_t(int status, void *context);
+/* Returns TRUE if requests for the user can't be started right now. */
+typedef bool indexer_queue_user_busy_callback_t(const char *username,
+						void *context);
+
+enum indexer_queue_lane {
+	/* Someone is waiting for the indexing to finish (PREPEND) */
+	INDEXER_QUEUE_LANE_INTERACTIVE = 0,
+	/* Background indexing and optimizing (APPEND, OPTIMIZE) */
+	INDEXER_QUEUE_LANE_BULK,
+
+	INDEXER_QUEUE_LANE_COUNT
+};
 
 struct indexer_request {
 	struct indexer_request *prev, *next;
+	/* The user's queue, or NULL if the request isn't queued. */
+	struct indexer_queue_user *queue_user;
 
 	char *username;
 	char *mailbox;
 	char *session_id;
 	unsigned int max_recent_msgs;
+	/* when the request was (re)added to the queue */
+	struct timeval queued_time;
+	/* the lane where the request was started from */
+	enum indexer_queue_lane lane;
 
 	/* index messages in this mailbox */
 	bool index:1;
@@ -32,36 +50,52 @@ struct indexer_request {
 	ARRAY(void *) contexts;
 };
 
-struct indexer_queue *indexer_queue_init(indexer_queue_callback_t *callback);
+/* Requests are queued per user into the interactive and bulk lanes. The
+   users within a lane are served round-robin, so a single user's mass
+   indexing can't starve the others. The interactive lane is preferred, but
+   every INDEXER_QUEUE_INTERACTIVE_WEIGHT interactive requests one bulk
+   request is let through. If max_queued_requests is non-zero, new bulk
+   requests are rejected when that many requests are already queued. */
+struct indexer_queue *indexer_queue_init(indexer_queue_callback_t *callback,
+					 unsigned int max_queued_requests);
 void indexer_queue_deinit(struct indexer_queue **queue);
 
 /* The callback is called whenever a new request is added to the queue. */
 void indexer_queue_set_listen_callback(struct indexer_queue *queue,
 				       void (*callback)(struct indexer_queue *));
 	
-void indexer_queue_append(struct indexer_queue *queue, bool append,
+/* Returns FALSE if the request was rejected because the queue is full.
+   The context isn't used in that case. */
+bool indexer_queue_append(struct indexer_queue *queue, bool append,
 			  const char *username, const char *mailbox,
 			  const char *session_id, unsigned int max_recent_msgs,
 			  void *context);
-void indexer_queue_append_optimize(struct indexer_queue *queue,
+bool indexer_queue_append_optimize(struct indexer_queue *queue,
 				   const char *username, const char *mailbox,
 				   void *context);
 void indexer_queue_cancel_all(struct indexer_queue *queue);
 
 bool indexer_queue_is_empty(struct indexer_queue *queue);
+/* Returns the number of requests, including the ones being worked on. */
 unsigned int indexer_queue_count(struct indexer_queue *queue);
+/* Returns the number of requests waiting in the lane. */
+unsigned int indexer_queue_lane_count(struct indexer_queue *queue,
+				      enum indexer_queue_lane lane);
 
-/* Return the next request from the queue, without removing it. */
-struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
-/* Remove the next request from the queue. You must call
+/* Return the next request that should be worked on, without removing it
+   from the queue. Users for which busy_callback returns TRUE are skipped. */
+struct indexer_request *
+indexer_queue_request_next(struct indexer_queue *queue,
+			   indexer_queue_user_busy_callback_t *busy_callback,
+			   void *context);
+/* Remove the request from the queue. You must call
    indexer_queue_request_finish() to free its memory. */
-void indexer_queue_request_remove(struct indexer_queue *queue);
+void indexer_queue_request_remove(struct indexer_queue *queue,
+				  struct indexer_request *request);
 /* Give a status update about how far the indexing is going on. */
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  int percentage);
-/* Move the next request to the end of the queue. */
-void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
 /* Start working on a request */
 void indexer_queue_request_work(struct indexer_request *request);
 /* Finish the request and free its memory. */
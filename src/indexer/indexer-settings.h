@@ -0,0 +1,12 @@
+#ifndef INDEXER_SETTINGS_H
+#define INDEXER_SETTINGS_H
+
+struct indexer_settings {
+	/* Reject new background indexing requests when this many requests
+	   are queued. 0 = unlimited. */
+	unsigned int indexer_max_queued_requests;
+};
+
+extern const struct setting_parser_info indexer_setting_parser_info;
+
+#endif
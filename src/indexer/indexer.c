@@ -8,6 +8,7 @@
 #include "master-service-settings.h"
 #include "indexer-client.h"
 #include "indexer-queue.h"
+#include "indexer-settings.h"
 #include "worker-pool.h"
 #include "worker-connection.h"
 
@@ -25,9 +26,11 @@ void indexer_refresh_proctitle(void)
 	if (!set->verbose_proctitle)
 		return;
 
-	process_title_set(t_strdup_printf("[%u clients, %u requests]",
-					  indexer_clients_get_count(),
-					  indexer_queue_count(queue)));
+	process_title_set(t_strdup_printf(
+		"[%u clients, %u requests: %u interactive + %u bulk queued]",
+		indexer_clients_get_count(), indexer_queue_count(queue),
+		indexer_queue_lane_count(queue, INDEXER_QUEUE_LANE_INTERACTIVE),
+		indexer_queue_lane_count(queue, INDEXER_QUEUE_LANE_BULK)));
 }
 
 static bool idle_die(void)
@@ -55,34 +58,26 @@ static void worker_send_request(struct connection *conn,
 	worker_connection_request(conn, request, wrequest);
 }
 
+static bool
+queue_user_busy(const char *username, void *context ATTR_UNUSED)
+{
+	/* There is already a connection handling a request for this user.
+	   Handle requests from other users first. */
+	return worker_pool_find_username_connection(worker_pool,
+						    username) != NULL;
+}
+
 static void queue_try_send_more(struct indexer_queue *queue)
 {
 	struct connection *conn;
-	struct indexer_request *request, *first_moved_request = NULL;
-
-	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		conn = worker_pool_find_username_connection(worker_pool,
-							    request->username);
-		if (conn != NULL) {
-			/* There is already a connection handling a request
-			 * for this user. Move the request to the back of the
-			 * queue and handle requests from other users.
-			 * Terminate if we went through all requests. */
-			if (request == first_moved_request) {
-				/* all requests are waiting for existing users
-				   to finish. */
-				break;
-			}
-			if (first_moved_request == NULL)
-				first_moved_request = request;
-			indexer_queue_move_head_to_tail(queue);
-			continue;
-		} else {
-			/* create a new connection to a worker */
-			if (!worker_pool_get_connection(worker_pool, &conn))
-				break;
-		}
-		indexer_queue_request_remove(queue);
+	struct indexer_request *request;
+
+	while ((request = indexer_queue_request_next(queue, queue_user_busy,
+						      NULL)) != NULL) {
+		/* create a new connection to a worker */
+		if (!worker_pool_get_connection(worker_pool, &conn))
+			break;
+		indexer_queue_request_remove(queue, request);
 		worker_send_request(conn, request);
 	}
 }
@@ -113,23 +108,30 @@ static void worker_avail_callback(void)
 
 int main(int argc, char *argv[])
 {
+	const struct setting_parser_info *set_roots[] = {
+		&indexer_setting_parser_info,
+		NULL
+	};
+	const struct indexer_settings *indexer_set;
 	const char *error;
 
 	master_service = master_service_init("indexer", 0, &argc, &argv, "");
 	if (master_getopt(master_service) > 0)
 		return FATAL_DEFAULT;
 
-	if (master_service_settings_read_simple(master_service, NULL,
+	if (master_service_settings_read_simple(master_service, set_roots,
 						&error) < 0)
 		i_fatal("Error reading configuration: %s", error);
 	set = master_service_settings_get(master_service);
+	indexer_set = master_service_settings_get_others(master_service)[0];
 
 	master_service_init_log(master_service);
 	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
 	restrict_access_allow_coredumps(TRUE);
 	master_service_set_idle_die_callback(master_service, idle_die);
 
-	queue = indexer_queue_init(indexer_client_status_callback);
+	queue = indexer_queue_init(indexer_client_status_callback,
+				   indexer_set->indexer_max_queued_requests);
 	indexer_queue_set_listen_callback(queue, queue_listen_callback);
 	worker_pool = worker_pool_init("indexer-worker",
 				       worker_status_callback,
@@ -13,6 +13,7 @@
 #include "mail-storage-private.h"
 #include "mail-storage-service.h"
 #include "mail-search-build.h"
+#include "mail-autoexpunge.h"
 #include "master-connection.h"
 
 #include <unistd.h>
@@ -188,7 +189,7 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 	int ret;
 
 	ns = mail_namespace_find(user->namespaces, mailbox);
-	box = mailbox_alloc(ns->list, mailbox, 0);
+	box = mailbox_alloc(ns->list, mailbox, MAILBOX_FLAG_BACKGROUND_SESSION);
 	ret = mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX, &path);
 	if (ret < 0) {
 		errstr = mailbox_get_last_internal_error(box, &error);
@@ -234,8 +235,12 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 			e_debug(box->event, "Syncing failed: %s", errstr);
 		}
 		ret = -1;
-	} else if (strchr(what, 'i') != NULL) {
-		if (index_mailbox_precache(conn, box) < 0)
+	} else {
+		/* expunge before precaching, so the expunged mails won't
+		   get cached needlessly */
+		(void)mailbox_autoexpunge_background(box);
+		if (strchr(what, 'i') != NULL &&
+		    index_mailbox_precache(conn, box) < 0)
 			ret = -1;
 	}
 	mailbox_free(&box);
@@ -10,6 +10,7 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "strnum.h"
 #include "connection.h"
 #include "master-interface.h"
 #include "auth-client-private.h"
@@ -25,6 +26,10 @@
 #define MAX_INBUF_SIZE 8192
 #define MAX_OUTBUF_SIZE 1024
 
+/* Maximum number of USER requests that auth_master_user_lookup_multi()
+   keeps pending in the auth server at the same time. */
+#define AUTH_MASTER_MULTI_MAX_PENDING 100
+
 struct auth_master_connection {
 	struct connection conn;
 	struct connection_list *clist;
@@ -37,6 +42,10 @@ struct auth_master_connection {
 	struct timeout *to;
 
 	unsigned int request_counter;
+	/* If non-zero, replies are accepted for all the request IDs between
+	   this and request_counter. reply_id is the ID of the reply that is
+	   being processed. */
+	unsigned int reply_id_min, reply_id;
 
 	bool (*reply_callback)(const char *cmd, const char *const *args,
 			       void *context);
@@ -59,6 +68,16 @@ struct auth_master_lookup_ctx {
 	const char **fields;
 };
 
+struct auth_master_multi_lookup_ctx {
+	struct auth_master_connection *conn;
+	const char *const *users;
+	const struct auth_user_info *info;
+	pool_t pool;
+
+	unsigned int count, sent, received;
+	struct auth_master_user_lookup_result *results;
+};
+
 struct auth_master_user_list_ctx {
 	struct auth_master_connection *conn;
 	string_t *username;
@@ -275,14 +294,12 @@ static const char *const *args_hide_passwords(const char *const *args)
 	return array_front(&new_args);
 }
 
-static bool auth_lookup_reply_callback(const char *cmd, const char *const *args,
-				       void *context)
+static void
+auth_lookup_reply_parse(struct auth_master_lookup_ctx *ctx, const char *cmd,
+			const char *const *args)
 {
-	struct auth_master_lookup_ctx *ctx = context;
 	unsigned int i, len;
 
-	io_loop_stop(ctx->conn->ioloop);
-
 	ctx->return_value = parse_reply(ctx, cmd, args);
 
 	len = str_array_length(args);
@@ -305,6 +322,15 @@ static bool auth_lookup_reply_callback(const char *cmd, const char *const *args,
 	args = args_hide_passwords(args);
 	e_debug(ctx->conn->event, "auth %s input: %s",
 		ctx->expected_reply, t_strarray_join(args, " "));
+}
+
+static bool auth_lookup_reply_callback(const char *cmd, const char *const *args,
+				       void *context)
+{
+	struct auth_master_lookup_ctx *ctx = context;
+
+	io_loop_stop(ctx->conn->ioloop);
+	auth_lookup_reply_parse(ctx, cmd, args);
 	return TRUE;
 }
 
@@ -325,7 +351,15 @@ auth_master_input_args(struct connection *_conn, const char *const *args)
 	}
 
 	wanted_id = dec2str(conn->request_counter);
-	if (strcmp(id, wanted_id) == 0) {
+	if (conn->reply_id_min != 0) {
+		if (str_to_uint(id, &conn->reply_id) == 0 &&
+		    conn->reply_id >= conn->reply_id_min &&
+		    conn->reply_id <= conn->request_counter) {
+			return (conn->reply_callback(cmd, args,
+						     conn->reply_context) ?
+				0 : 1);
+		}
+	} else if (strcmp(id, wanted_id) == 0) {
 		return (conn->reply_callback(cmd, args, conn->reply_context) ?
 			0 : 1);
 	}
@@ -714,6 +748,157 @@ int auth_master_user_lookup(struct auth_master_connection *conn,
 	return ctx.return_value;
 }
 
+static void
+auth_master_multi_lookup_send(struct auth_master_multi_lookup_ctx *ctx,
+			      string_t *str)
+{
+	struct auth_master_connection *conn = ctx->conn;
+	const char *user;
+
+	while (ctx->sent < ctx->count &&
+	       ctx->sent - ctx->received < AUTH_MASTER_MULTI_MAX_PENDING) {
+		user = ctx->users[ctx->sent];
+		if (!is_valid_string(user)) {
+			/* non-allowed characters, the user can't exist */
+			ctx->results[ctx->sent].ret = 0;
+			ctx->received++;
+		} else {
+			str_printfa(str, "USER\t%u\t%s",
+				    conn->reply_id_min + ctx->sent, user);
+			auth_user_info_export(str, ctx->info);
+			str_append_c(str, '\n');
+		}
+		ctx->sent++;
+	}
+}
+
+static bool
+auth_multi_lookup_reply_callback(const char *cmd, const char *const *args,
+				 void *context)
+{
+	struct auth_master_multi_lookup_ctx *ctx = context;
+	struct auth_master_connection *conn = ctx->conn;
+	struct auth_master_user_lookup_result *result;
+	struct auth_master_lookup_ctx lookup_ctx;
+	string_t *str;
+
+	result = &ctx->results[conn->reply_id - conn->reply_id_min];
+	if (result->fields != NULL) {
+		e_error(conn->event, "BUG: Duplicate reply for user %s",
+			result->user);
+		auth_request_lookup_abort(conn);
+		return TRUE;
+	}
+
+	i_zero(&lookup_ctx);
+	lookup_ctx.conn = conn;
+	lookup_ctx.pool = ctx->pool;
+	lookup_ctx.expected_reply = "USER";
+	lookup_ctx.user = result->user;
+	auth_lookup_reply_parse(&lookup_ctx, cmd, args);
+
+	result->ret = lookup_ctx.return_value;
+	if (result->ret > 0 && lookup_ctx.fields[0] == NULL) {
+		e_error(conn->event, "Userdb lookup for %s failed: "
+			"Lookup didn't return username", result->user);
+		result->ret = -2;
+	}
+	if (result->ret > 0) {
+		result->username = lookup_ctx.fields[0];
+		result->fields = lookup_ctx.fields + 1;
+	} else {
+		result->fields = lookup_ctx.fields;
+	}
+	ctx->received++;
+	timeout_reset(conn->to);
+
+	str = t_str_new(256);
+	auth_master_multi_lookup_send(ctx, str);
+	o_stream_nsend(conn->conn.output, str_data(str), str_len(str));
+
+	if (ctx->received < ctx->count)
+		return FALSE;
+	io_loop_stop(conn->ioloop);
+	return TRUE;
+}
+
+void auth_master_user_lookup_multi(struct auth_master_connection *conn,
+				   const char *const *users,
+				   const struct auth_user_info *info,
+				   pool_t pool,
+				   struct auth_master_user_lookup_result **results_r)
+{
+	struct auth_master_multi_lookup_ctx ctx;
+	unsigned int i;
+	string_t *str;
+
+	i_zero(&ctx);
+	ctx.conn = conn;
+	ctx.users = users;
+	ctx.info = info;
+	ctx.pool = pool;
+	ctx.count = str_array_length(users);
+	ctx.results = p_new(pool, struct auth_master_user_lookup_result,
+			    ctx.count + 1);
+	for (i = 0; i < ctx.count; i++) {
+		ctx.results[i].user = p_strdup(pool, users[i]);
+		ctx.results[i].ret = -1;
+	}
+	*results_r = ctx.results;
+	if (ctx.count == 0)
+		return;
+	if (!is_valid_string(info->service)) {
+		for (i = 0; i < ctx.count; i++)
+			ctx.results[i].ret = 0;
+		return;
+	}
+
+	/* reserve a request ID for each user */
+	if (conn->request_counter >= UINT_MAX - ctx.count)
+		conn->request_counter = 0;
+	conn->reply_id_min = conn->request_counter + 1;
+	conn->request_counter += ctx.count;
+
+	conn->reply_callback = auth_multi_lookup_reply_callback;
+	conn->reply_context = &ctx;
+
+	auth_master_user_event_create(conn, "userdb lookup: ", info);
+	e_debug(conn->event, "Started userdb lookups for %u users", ctx.count);
+
+	str = t_str_new(1024);
+	auth_master_multi_lookup_send(&ctx, str);
+	if (str_len(str) > 0 && auth_master_run_cmd_pre(conn, "") == 0) {
+		/* the pending requests are limited by
+		   AUTH_MASTER_MULTI_MAX_PENDING, so it's safe to buffer all
+		   of them. */
+		o_stream_set_max_buffer_size(conn->conn.output, SIZE_MAX);
+		o_stream_nsend(conn->conn.output, str_data(str), str_len(str));
+		if (o_stream_flush(conn->conn.output) < 0) {
+			e_error(conn->event, "write(auth socket) failed: %s",
+				o_stream_get_error(conn->conn.output));
+			auth_master_unset_io(conn);
+			auth_connection_close(conn);
+		} else {
+			io_loop_run(conn->ioloop);
+			if (conn->conn.output != NULL) {
+				o_stream_set_max_buffer_size(conn->conn.output,
+							     MAX_OUTBUF_SIZE);
+			}
+			(void)auth_master_run_cmd_post(conn);
+		}
+	}
+	e_debug(conn->event, "Finished userdb lookups for %u users (%u replies)",
+		ctx.count, ctx.received);
+	auth_master_event_finish(conn);
+
+	for (i = 0; i < ctx.count; i++) {
+		if (ctx.results[i].fields == NULL)
+			ctx.results[i].fields = p_new(pool, const char *, 1);
+	}
+	conn->reply_id_min = 0;
+	conn->reply_context = NULL;
+}
+
 void auth_user_fields_parse(const char *const *fields, pool_t pool,
 			    struct auth_user_reply *reply_r)
 {
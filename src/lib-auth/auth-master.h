@@ -47,6 +47,24 @@ int auth_master_user_lookup(struct auth_master_connection *conn,
 			    const char *user, const struct auth_user_info *info,
 			    pool_t pool, const char **username_r,
 			    const char *const **fields_r);
+
+struct auth_master_user_lookup_result {
+	const char *user;
+	/* Same as auth_master_user_lookup()'s return value, username_r and
+	   fields_r. */
+	int ret;
+	const char *username;
+	const char *const *fields;
+};
+/* Do USER lookups for all the given users. The lookups are pipelined, so
+   the auth server can run them in parallel instead of waiting for each
+   reply before sending the next request. results_r contains a result for
+   each user in the same order. */
+void auth_master_user_lookup_multi(struct auth_master_connection *conn,
+				   const char *const *users,
+				   const struct auth_user_info *info,
+				   pool_t pool,
+				   struct auth_master_user_lookup_result **results_r);
 /* Do a PASS lookup (the actual password isn't returned). */
 int auth_master_pass_lookup(struct auth_master_connection *conn,
 			    const char *user, const struct auth_user_info *info,
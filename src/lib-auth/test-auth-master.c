@@ -1,11 +1,21 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "write-full.h"
+#include "strescape.h"
 #include "auth-master.h"
 #include "net.h"
 #include "test-common.h"
+#include "test-subprocess.h"
 #include "str.h"
 
+#include <unistd.h>
+
+#define TEST_SOCKET_PATH ".test-auth-master.sock"
+
 static void test_auth_user_info_export(void)
 {
 	string_t *str;
@@ -64,11 +74,115 @@ static void test_auth_user_info_export(void)
 	test_end();
 }
 
+static int test_multi_lookup_server(int *listen_fd)
+{
+	ARRAY_TYPE(const_string) requests;
+	struct istream *input;
+	const char *line, *const *args, *reply;
+	unsigned int i, count;
+	int fd;
+
+	fd = net_accept(*listen_fd, NULL, NULL);
+	if (fd < 0)
+		i_fatal("net_accept() failed: %m");
+	if (write_full(fd, "VERSION\t1\t0\nSPID\t1\n", 19) < 0)
+		i_fatal("write() failed: %m");
+
+	/* read all the pipelined requests before replying to any of them */
+	t_array_init(&requests, 8);
+	input = i_stream_create_fd(fd, 1024);
+	while (array_count(&requests) < 4 &&
+	       (line = i_stream_read_next_line(input)) != NULL) {
+		if (str_begins(line, "USER\t")) {
+			line = t_strdup(line);
+			array_push_back(&requests, &line);
+		}
+	}
+
+	/* reply in reverse order */
+	count = array_count(&requests);
+	for (i = count; i > 0; i--) {
+		line = array_idx_elem(&requests, i - 1);
+		args = t_strsplit_tabescaped(line);
+		if (strcmp(args[2], "notfound") == 0)
+			reply = t_strdup_printf("NOTFOUND\t%s\n", args[1]);
+		else if (strcmp(args[2], "fail") == 0) {
+			reply = t_strdup_printf("FAIL\t%s\treason=temp\n",
+						args[1]);
+		} else {
+			reply = t_strdup_printf("USER\t%s\t%s\tuid=%s\n",
+						args[1], args[2], args[1]);
+		}
+		if (write_full(fd, reply, strlen(reply)) < 0)
+			i_fatal("write() failed: %m");
+	}
+	/* wait for the client to disconnect */
+	while (i_stream_read_next_line(input) != NULL) ;
+	i_stream_unref(&input);
+	i_close_fd(&fd);
+	return 0;
+}
+
+static void test_auth_master_user_lookup_multi(void)
+{
+	const char *const users[] = {
+		"user1", "notfound", "inva\nlid", "fail", "user2", NULL
+	};
+	struct auth_master_user_lookup_result *results;
+	struct auth_master_connection *conn;
+	struct auth_user_info info;
+	struct ioloop *ioloop;
+	pool_t pool;
+	int fd;
+
+	test_begin("auth_master_user_lookup_multi()");
+	i_unlink_if_exists(TEST_SOCKET_PATH);
+	fd = net_listen_unix(TEST_SOCKET_PATH, 1);
+	if (fd < 0)
+		i_fatal("net_listen_unix(%s) failed: %m", TEST_SOCKET_PATH);
+	test_subprocess_fork(test_multi_lookup_server, &fd, FALSE);
+	i_close_fd(&fd);
+
+	ioloop = io_loop_create();
+	pool = pool_alloconly_create("test multi lookup", 1024);
+	i_zero(&info);
+	info.service = "test";
+	conn = auth_master_init(TEST_SOCKET_PATH, 0);
+	auth_master_user_lookup_multi(conn, users, &info, pool, &results);
+	auth_master_deinit(&conn);
+
+	test_assert(results[0].ret == 1);
+	test_assert_strcmp(results[0].user, "user1");
+	test_assert_strcmp(results[0].username, "user1");
+	test_assert_strcmp(results[0].fields[0], "uid=1");
+	test_assert(results[0].fields[1] == NULL);
+	test_assert(results[1].ret == 0);
+	test_assert(results[2].ret == 0);
+	test_assert(results[3].ret == -2);
+	test_assert_strcmp(results[3].fields[0], "temp");
+	test_assert(results[4].ret == 1);
+	test_assert_strcmp(results[4].username, "user2");
+	test_assert_strcmp(results[4].fields[0], "uid=5");
+	test_assert(results[5].user == NULL);
+
+	pool_unref(&pool);
+	io_loop_destroy(&ioloop);
+	test_subprocess_kill_all(10);
+	i_unlink(TEST_SOCKET_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_auth_user_info_export,
+		test_auth_master_user_lookup_multi,
 		NULL
 	};
-	return test_run(test_functions);
+	int ret;
+
+	test_subprocesses_init(FALSE);
+	ret = test_run(test_functions);
+	test_subprocesses_deinit();
+	return ret;
 }
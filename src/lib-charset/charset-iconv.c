@@ -1,6 +1,7 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "charset-utf8-private.h"
 
@@ -9,11 +10,76 @@
 #include <iconv.h>
 #include <ctype.h>
 
+/* Maximum number of unused iconv handles to keep open. Messages typically
+   use only a few different charsets, but iconv_open() is rather expensive
+   compared to converting a short header. */
+#define CHARSET_ICONV_MAX_CACHED_HANDLES 16
+
 struct charset_translation {
 	iconv_t cd;
+	char *charset;
 	normalizer_func_t *normalizer;
 };
 
+struct charset_iconv_cached {
+	char *charset;
+	iconv_t cd;
+};
+
+static ARRAY(struct charset_iconv_cached) iconv_cache = ARRAY_INIT;
+
+static void charset_iconv_cache_free(void)
+{
+	struct charset_iconv_cached *cached;
+
+	array_foreach_modifiable(&iconv_cache, cached) {
+		iconv_close(cached->cd);
+		i_free(cached->charset);
+	}
+	array_free(&iconv_cache);
+}
+
+static iconv_t charset_iconv_open(const char *charset)
+{
+	struct charset_iconv_cached *cached;
+	iconv_t cd;
+
+	if (array_is_created(&iconv_cache)) {
+		array_foreach_modifiable(&iconv_cache, cached) {
+			if (strcasecmp(cached->charset, charset) == 0) {
+				cd = cached->cd;
+				i_free(cached->charset);
+				array_delete(&iconv_cache,
+					array_foreach_idx(&iconv_cache, cached), 1);
+				return cd;
+			}
+		}
+	}
+	return iconv_open("UTF-8", charset);
+}
+
+static void charset_iconv_close(const char *charset, iconv_t cd)
+{
+	struct charset_iconv_cached *cached;
+
+	if (!array_is_created(&iconv_cache)) {
+		i_array_init(&iconv_cache, CHARSET_ICONV_MAX_CACHED_HANDLES);
+		lib_atexit(charset_iconv_cache_free);
+	} else if (array_count(&iconv_cache) >=
+		   CHARSET_ICONV_MAX_CACHED_HANDLES) {
+		/* drop the least recently used handle */
+		cached = array_idx_modifiable(&iconv_cache, 0);
+		iconv_close(cached->cd);
+		i_free(cached->charset);
+		array_pop_front(&iconv_cache);
+	}
+	/* the next user must start from the initial shift state */
+	(void)iconv(cd, NULL, NULL, NULL, NULL);
+	cached = array_append_space(&iconv_cache);
+	cached->charset = i_strdup(charset);
+	cached->cd = cd;
+}
+
 static int
 iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 			    struct charset_translation **t_r)
@@ -26,13 +92,15 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 	else {
 		if (strcmp(charset, "UTF-8//TEST") == 0)
 			charset = "UTF-8";
-		cd = iconv_open("UTF-8", charset);
+		cd = charset_iconv_open(charset);
 		if (cd == (iconv_t)-1)
 			return -1;
 	}
 
 	t = i_new(struct charset_translation, 1);
 	t->cd = cd;
+	if (cd != (iconv_t)-1)
+		t->charset = i_strdup(charset);
 	t->normalizer = normalizer;
 	*t_r = t;
 	return 0;
@@ -41,7 +109,8 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 static void iconv_charset_to_utf8_end(struct charset_translation *t)
 {
 	if (t->cd != (iconv_t)-1)
-		iconv_close(t->cd);
+		charset_iconv_close(t->charset, t->cd);
+	i_free(t->charset);
 	i_free(t);
 }
 
@@ -7,6 +7,9 @@
 
 #include <ctype.h>
 
+/* uni_utf8_char_bytes() returns at most this many bytes */
+#define CHARSET_UTF8_MAX_CHAR_BYTES 6
+
 #ifdef HAVE_ICONV
 const struct charset_utf8_vfuncs *charset_utf8_vfuncs = &charset_iconv;
 #else
@@ -47,6 +50,27 @@ charset_utf8_to_utf8_begin(normalizer_func_t *normalizer)
 	return trans;
 }
 
+static size_t
+charset_utf8_valid_partial_pos(const unsigned char *src, size_t size)
+{
+	size_t start, min_start;
+
+	/* Find the beginning of the last character. This gives the same
+	   result as walking through the whole input with
+	   uni_utf8_partial_strlen_n() only when the data before it is valid
+	   UTF-8, so the caller must still verify that. */
+	min_start = size < CHARSET_UTF8_MAX_CHAR_BYTES ? 0 :
+		size - CHARSET_UTF8_MAX_CHAR_BYTES;
+	for (start = size; start > min_start; ) {
+		start--;
+		if ((src[start] & 0xc0) != 0x80)
+			break;
+	}
+	if (start < size && start + uni_utf8_char_bytes(src[start]) > size)
+		return start;
+	return size;
+}
+
 enum charset_result
 charset_utf8_to_utf8(normalizer_func_t *normalizer,
 		     const unsigned char *src, size_t *src_size, buffer_t *dest)
@@ -54,6 +78,23 @@ charset_utf8_to_utf8(normalizer_func_t *normalizer,
 	enum charset_result res = CHARSET_RET_OK;
 	size_t pos;
 
+	if (normalizer == NULL) {
+		/* Fast path for the common case of valid input: find the
+		   trailing partial character by looking only at the end of
+		   the data and validate the rest in a single pass. */
+		pos = charset_utf8_valid_partial_pos(src, *src_size);
+		if (uni_utf8_data_is_valid(src, pos)) {
+			if (pos < *src_size) {
+				i_assert(*src_size - pos <=
+					 CHARSET_MAX_PENDING_BUF_SIZE);
+				*src_size = pos;
+				res = CHARSET_RET_INCOMPLETE_INPUT;
+			}
+			buffer_append(dest, src, pos);
+			return res;
+		}
+	}
+
 	uni_utf8_partial_strlen_n(src, *src_size, &pos);
 	if (pos < *src_size) {
 		i_assert(*src_size - pos <= CHARSET_MAX_PENDING_BUF_SIZE);
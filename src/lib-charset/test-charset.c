@@ -155,6 +155,40 @@ static void test_charset_iconv_utf7_state(void)
 	charset_to_utf8_end(&trans);
 	test_end();
 }
+
+static void test_charset_iconv_reuse(void)
+{
+	struct charset_translation *trans;
+	string_t *str = t_str_new(32);
+	enum charset_result result;
+	unsigned int i;
+	size_t size;
+
+	test_begin("charset iconv reuse");
+	/* leave the iconv handle in the middle of a shift sequence */
+	test_assert(charset_to_utf8_begin("UTF-7", NULL, &trans) == 0);
+	size = 4;
+	(void)charset_to_utf8(trans, (const void *)"+AOQ", &size, str);
+	charset_to_utf8_end(&trans);
+
+	/* the reused handle must start from the initial state */
+	str_truncate(str, 0);
+	test_assert(charset_to_utf8_begin("utf-7", NULL, &trans) == 0);
+	size = 3;
+	test_assert(charset_to_utf8(trans, (const void *)"abc", &size, str) == CHARSET_RET_OK);
+	test_assert_strcmp(str_c(str), "abc");
+	charset_to_utf8_end(&trans);
+
+	/* more charsets than there are cached handles */
+	for (i = 0; i < 40; i++) {
+		str_truncate(str, 0);
+		test_assert_idx(charset_to_utf8_str(i % 2 == 0 ? "ISO-8859-1" :
+			t_strdup_printf("CP%u", 1250 + i % 9), NULL,
+			"p\xE4", str, &result) == 0, i);
+		test_assert_idx(result == CHARSET_RET_OK, i);
+	}
+	test_end();
+}
 #endif
 
 static int convert(const char *charset, const char *path)
@@ -219,6 +253,7 @@ int main(int argc, char *argv[])
 		test_charset_iconv,
 		test_charset_iconv_crashes,
 		test_charset_iconv_utf7_state,
+		test_charset_iconv_reuse,
 #endif
 		NULL
 	};
@@ -1,168 +1,456 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
 #include "istream.h"
 #include "ostream.h"
 #include "randgen.h"
-#include "time-util.h"
 #include "strnum.h"
 #include "compression.h"
+#include "test-bench.h"
 
 #include <stdio.h>
 #include <unistd.h>
-#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /**
  * Generates semi-compressible data in blocks of given size, to mimic emails
  * remotely and then compresses and decompresses it using each algorithm.
- * It measures the time spent on this giving some estimate how well the data
- * compressed and how long it took.
+ *
+ * With -c the input is instead a real mail corpus: a maildir (or any
+ * directory of mail files) or an mbox file. Each mail is compressed and
+ * decompressed separately, the same way the zlib plugin does it. Space
+ * saving for small mails, memory used per stream and the cost of seeking
+ * backwards are reported also.
  */
 
-static void bench_compression_speed(const struct compression_handler *handler,
-				    unsigned int level, unsigned long block_count)
+/* Mails smaller than this are reported separately */
+#define BENCH_SMALL_MAIL_SIZE 4096
+/* Seek cost is measured only for mails at least this large */
+#define BENCH_SEEK_MIN_MAIL_SIZE (64*1024)
+/* How many streams to keep open at the same time when measuring memory */
+#define BENCH_MEMORY_STREAM_COUNT 256
+
+struct bench_compression_context {
+	const struct compression_handler *handler;
+	int level;
+	/* temporary file used as the compression ostream's parent */
+	int fd;
+
+	const struct test_bench_corpus *corpus;
+	/* corpus items compressed */
+	ARRAY(buffer_t *) compressed;
+};
+
+/* Compress the data to the file. A buffer ostream can't be used as the
+   parent, because it's not blocking and the compression ostreams won't add
+   more than IO_BLOCK_SIZE of data to non-blocking parents. Returns the
+   compressed size. */
+static uoff_t
+bench_compress_data(struct bench_compression_context *ctx,
+		    const void *data, size_t size)
 {
-	struct istream *is = i_stream_create_file("decompressed.bin", 1024);
-	struct ostream *os = o_stream_create_file("compressed.bin", 0, 0644, 0);
-	struct ostream *os_compressed = handler->create_ostream(os, level);
-	o_stream_unref(&os);
+	struct ostream *output, *zoutput;
+	uoff_t compressed_size;
+
+	if (ftruncate(ctx->fd, 0) < 0)
+		i_fatal("ftruncate() failed: %m");
+	if (lseek(ctx->fd, 0, SEEK_SET) < 0)
+		i_fatal("lseek() failed: %m");
+	output = o_stream_create_fd_file(ctx->fd, 0, FALSE);
+	zoutput = ctx->handler->create_ostream(output, ctx->level);
+	o_stream_nsend(zoutput, data, size);
+	if (o_stream_finish(zoutput) < 0)
+		i_fatal("%s", o_stream_get_error(zoutput));
+	compressed_size = output->offset;
+	o_stream_unref(&zoutput);
+	o_stream_unref(&output);
+	return compressed_size;
+}
 
-	const unsigned char *data;
-	uint64_t ts_0, ts_1;
-	size_t siz;
-	double compression_speed, decompression_speed;
+static buffer_t *
+bench_compress_buffer(struct bench_compression_context *ctx,
+		      const buffer_t *data)
+{
+	uoff_t compressed_size = bench_compress_data(ctx, data->data,
+						     data->used);
+	buffer_t *compressed;
+	ssize_t ret;
+
+	compressed = buffer_create_dynamic(default_pool, compressed_size);
+	ret = pread(ctx->fd, buffer_append_space_unsafe(compressed,
+							compressed_size),
+		    compressed_size, 0);
+	if (ret < 0)
+		i_fatal("pread() failed: %m");
+	i_assert((uoff_t)ret == compressed_size);
+	return compressed;
+}
 
-	ts_0 = i_nanoseconds();
+static void bench_compress(struct bench_compression_context *ctx)
+{
+	buffer_t *buf;
 
-	while (i_stream_read_more(is, &data, &siz) > 0) {
-		o_stream_nsend(os_compressed, data, siz);
-		i_stream_skip(is, siz);
-	}
+	array_foreach_elem(&ctx->corpus->items, buf)
+		(void)bench_compress_data(ctx, buf->data, buf->used);
+}
 
-	if (is->stream_errno != 0)
-		printf("Error: %s\n", i_stream_get_error(is));
+static struct istream *
+bench_create_decompress_istream(struct bench_compression_context *ctx,
+				const buffer_t *compressed)
+{
+	struct istream *input, *zinput;
 
-	i_assert(o_stream_finish(os_compressed) == 1);
-	o_stream_unref(&os_compressed);
-	i_stream_unref(&is);
+	input = i_stream_create_from_data(compressed->data, compressed->used);
+	input->blocking = TRUE;
+	zinput = ctx->handler->create_istream(input);
+	i_stream_unref(&input);
+	return zinput;
+}
 
-	ts_1 = i_nanoseconds();
+static void bench_decompress(struct bench_compression_context *ctx)
+{
+	struct istream *zinput;
+	const unsigned char *data;
+	buffer_t *compressed;
+	size_t size;
+
+	array_foreach_elem(&ctx->compressed, compressed) {
+		zinput = bench_create_decompress_istream(ctx, compressed);
+		while (i_stream_read_more(zinput, &data, &size) > 0)
+			i_stream_skip(zinput, size);
+		if (zinput->stream_errno != 0)
+			i_fatal("%s", i_stream_get_error(zinput));
+		i_stream_unref(&zinput);
+	}
+}
 
-	/* check ratio */
-	struct stat st_1, st_2;
-	if (stat("decompressed.bin", &st_1) != 0)
-		i_fatal("stat(decompressed.bin): %m");
-	if (stat("compressed.bin", &st_2) != 0)
-		i_fatal("stat(compressed.bin): %m");
+static void bench_seek(struct bench_compression_context *ctx)
+{
+	struct istream *zinput;
+	const unsigned char *data;
+	buffer_t *const *compressed;
+	const buffer_t *mail;
+	size_t size;
+
+	/* partial FETCH after the mail was already read */
+	compressed = array_front(&ctx->compressed);
+	array_foreach_elem(&ctx->corpus->items, mail) {
+		if (mail->used >= BENCH_SEEK_MIN_MAIL_SIZE) {
+			zinput = bench_create_decompress_istream(ctx,
+								 *compressed);
+			while (i_stream_read_more(zinput, &data, &size) > 0)
+				i_stream_skip(zinput, size);
+			i_stream_seek(zinput, mail->used / 2);
+			if (i_stream_read_more(zinput, &data, &size) <= 0) {
+				i_fatal("seek failed: %s",
+					i_stream_get_error(zinput));
+			}
+			i_stream_unref(&zinput);
+		}
+		compressed++;
+	}
+}
 
-	double ratio = (double)st_2.st_size / (double)st_1.st_size;
+static void
+bench_compression_verify(struct bench_compression_context *ctx)
+{
+	struct istream *zinput;
+	const unsigned char *data;
+	const buffer_t *mail;
+	buffer_t *const *compressed;
+	size_t size;
+	uoff_t offset;
+
+	compressed = array_front(&ctx->compressed);
+	array_foreach_elem(&ctx->corpus->items, mail) {
+		zinput = bench_create_decompress_istream(ctx, *compressed);
+		offset = 0;
+		while (i_stream_read_more(zinput, &data, &size) > 0) {
+			i_assert(offset + size <= mail->used &&
+				 memcmp(data, CONST_PTR_OFFSET(mail->data,
+							       offset),
+					size) == 0);
+			offset += size;
+			i_stream_skip(zinput, size);
+		}
+		if (zinput->stream_errno != 0)
+			i_fatal("%s", i_stream_get_error(zinput));
+		i_assert(offset == mail->used);
+		i_stream_unref(&zinput);
+		compressed++;
+	}
+}
 
-	compression_speed = ((double)(ts_1-ts_0))/((double)block_count);
-	compression_speed /= 1000.0L;
+static long bench_get_rss_kb(void)
+{
+	FILE *f;
+	long size, rss;
+
+	if ((f = fopen("/proc/self/statm", "r")) == NULL)
+		return -1;
+	if (fscanf(f, "%ld %ld", &size, &rss) != 2)
+		rss = -1;
+	fclose(f);
+	return rss < 0 ? -1 : rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
 
-	is = i_stream_create_file("compressed.bin", 1024);
-	os = o_stream_create_file("decompressed.bin", 0, 0644, 0);
-	struct istream *is_decompressed = handler->create_istream(is);
-	i_stream_unref(&is);
+static void bench_memory(struct bench_compression_context *ctx)
+{
+	const struct compression_handler *handler = ctx->handler;
+	const buffer_t *mail = array_idx_elem(&ctx->corpus->items, 0);
+	const buffer_t *compressed = array_idx_elem(&ctx->compressed, 0);
+	struct ostream *outputs[BENCH_MEMORY_STREAM_COUNT];
+	struct istream *inputs[BENCH_MEMORY_STREAM_COUNT];
+	buffer_t *bufs[BENCH_MEMORY_STREAM_COUNT];
+	const unsigned char *data;
+	size_t size;
+	long rss_0, rss_1, rss_2;
+	unsigned int i;
+
+	/* Streams that have processed one mail, but aren't finished yet -
+	   this is how many streams there are in parallel in a busy
+	   server. */
+	rss_0 = bench_get_rss_kb();
+	for (i = 0; i < BENCH_MEMORY_STREAM_COUNT; i++) {
+		bufs[i] = buffer_create_dynamic(default_pool, 128);
+		struct ostream *output = o_stream_create_buffer(bufs[i]);
+		outputs[i] = handler->create_ostream(output, ctx->level);
+		o_stream_unref(&output);
+		o_stream_nsend(outputs[i], mail->data, mail->used);
+	}
+	rss_1 = bench_get_rss_kb();
+	for (i = 0; i < BENCH_MEMORY_STREAM_COUNT; i++) {
+		struct istream *input =
+			i_stream_create_from_data(compressed->data,
+						  compressed->used);
+		inputs[i] = handler->create_istream(input);
+		i_stream_unref(&input);
+		(void)i_stream_read_more(inputs[i], &data, &size);
+	}
+	rss_2 = bench_get_rss_kb();
 
-	ts_0 = i_nanoseconds();
+	if (rss_0 >= 0 && rss_1 >= 0 && rss_2 >= 0) {
+		printf("%s level %d memory: %ld kB per ostream, "
+		       "%ld kB per istream\n", handler->name, ctx->level,
+		       (rss_1 - rss_0) / BENCH_MEMORY_STREAM_COUNT,
+		       (rss_2 - rss_1) / BENCH_MEMORY_STREAM_COUNT);
+	}
+	for (i = 0; i < BENCH_MEMORY_STREAM_COUNT; i++) {
+		o_stream_abort(outputs[i]);
+		o_stream_unref(&outputs[i]);
+		buffer_free(&bufs[i]);
+		i_stream_unref(&inputs[i]);
+	}
+}
 
-	while (i_stream_read_more(is_decompressed, &data, &siz) > 0) {
-		o_stream_nsend(os, data, siz);
-		i_stream_skip(is_decompressed, siz);
+static void
+bench_compression(const struct compression_handler *handler, int level,
+		  int fd, const struct test_bench_corpus *corpus, bool mails)
+{
+	struct bench_compression_context ctx = {
+		.handler = handler,
+		.level = level,
+		.fd = fd,
+		.corpus = corpus,
+	};
+	const buffer_t *mail;
+	buffer_t *compressed, **bufp;
+	uoff_t compressed_size = 0, small_size = 0, small_compressed = 0;
+	bool have_seek_mails = FALSE;
+	const char *name;
+
+	i_array_init(&ctx.compressed, array_count(&corpus->items));
+	array_foreach_elem(&corpus->items, mail) {
+		compressed = bench_compress_buffer(&ctx, mail);
+		array_push_back(&ctx.compressed, &compressed);
+		compressed_size += compressed->used;
+		if (mail->used < BENCH_SMALL_MAIL_SIZE) {
+			small_size += mail->used;
+			small_compressed += compressed->used;
+		}
+		if (mail->used >= BENCH_SEEK_MIN_MAIL_SIZE)
+			have_seek_mails = TRUE;
+	}
+	bench_compression_verify(&ctx);
+
+	name = t_strdup_printf("%s level %d", handler->name, level);
+	printf("%s space saving: %0.02lf%%", name, corpus->size == 0 ? 0.0 :
+	       (1.0 - (double)compressed_size / corpus->size) * 100.0);
+	if (small_size > 0) {
+		printf(" (mails < %u bytes: %0.02lf%%)", BENCH_SMALL_MAIL_SIZE,
+		       (1.0 - (double)small_compressed / small_size) * 100.0);
+	}
+	printf("\n");
+	test_bench_run(t_strconcat(name, " compress", NULL), corpus->size,
+		       bench_compress, &ctx, NULL);
+	test_bench_run(t_strconcat(name, " decompress", NULL), corpus->size,
+		       bench_decompress, &ctx, NULL);
+	if (mails) {
+		if (have_seek_mails) {
+			test_bench_run(t_strconcat(name, " read+seek back",
+						   NULL), 0,
+				       bench_seek, &ctx, NULL);
+		}
+		bench_memory(&ctx);
 	}
 
-	if (is_decompressed->stream_errno != 0)
-		printf("Error: %s\n", i_stream_get_error(is_decompressed));
+	array_foreach_modifiable(&ctx.compressed, bufp)
+		buffer_free(bufp);
+	array_free(&ctx.compressed);
+}
 
-	i_assert(o_stream_finish(os) == 1);
-	o_stream_unref(&os);
-	i_stream_unref(&is_decompressed);
+static bool
+bench_get_level(const struct compression_handler *handler,
+		const char *level_str, int *level_r)
+{
+	/* the default level can be -1, so it's not checked against the
+	   min/max */
+	if (level_str == NULL) {
+		*level_r = handler->get_default_level();
+		return TRUE;
+	}
+	if (str_to_int(level_str, level_r) < 0)
+		i_fatal("Invalid level: %s", level_str);
+	if (*level_r < handler->get_min_level() ||
+	    *level_r > handler->get_max_level()) {
+		printf("%s: level must be between %d..%d\n", handler->name,
+		       handler->get_min_level(), handler->get_max_level());
+		return FALSE;
+	}
+	return TRUE;
+}
 
-	ts_1 = i_nanoseconds();
+static void
+bench_compression_handlers(const struct test_bench_corpus *corpus, bool mails,
+			   const char *handler_name, const char *level_str)
+{
+	int fd, level;
+
+	fd = open("compressed.bin", O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(compressed.bin) failed: %m");
+	i_unlink("compressed.bin");
 
-	decompression_speed = ((double)(ts_1 - ts_0))/((double)block_count);
-	decompression_speed /= 1000.0L;
+	for (unsigned int i = 0; compression_handlers[i].name != NULL; i++) T_BEGIN {
+		const struct compression_handler *handler =
+			&compression_handlers[i];
+
+		if (handler->create_istream != NULL &&
+		    handler->create_ostream != NULL &&
+		    (handler_name == NULL ||
+		     strcmp(handler->name, handler_name) == 0) &&
+		    bench_get_level(handler, level_str, &level))
+			bench_compression(handler, level, fd, corpus, mails);
+	} T_END;
+	i_close_fd(&fd);
+}
 
-	printf("%s\n", handler->name);
-	printf("\tCompression: %0.02lf us/block\n\tSpace Saving: %0.02lf%%\n",
-	       compression_speed, (1.0-ratio)*100.0);
-	printf("\tDecompression: %0.02lf us/block\n\n", decompression_speed);
+static void bench_add_blocks(struct test_bench_corpus *corpus,
+			     unsigned long block_size,
+			     unsigned long block_count)
+{
+	buffer_t *data = buffer_create_dynamic(default_pool,
+					       block_size * block_count);
+	unsigned char *p;
 
+	for (unsigned long r = 0; r < block_count; r++) {
+		p = buffer_append_space_unsafe(data, block_size);
+		for (size_t i = 0; i < block_size; i++) {
+			if (i_rand_limit(3) == 0)
+				p[i] = i_rand_limit(4);
+			else
+				p[i] = i;
+		}
+	}
+	test_bench_corpus_add(corpus, data);
 }
 
 static void print_usage(const char *prog)
 {
-	fprintf(stderr, "Usage: %s block_size count level\n", prog);
-	fprintf(stderr, "Runs with 1000 8k blocks using level 6 if nothing given\n");
+	fprintf(stderr, "Usage: %s [-l level] [-H handler] [block_size count]\n", prog);
+	fprintf(stderr, "Runs with 1000 8k blocks if nothing given\n");
+	fprintf(stderr, "Usage: %s -c <maildir|mbox> [-l level] [-H handler]\n", prog);
+	fprintf(stderr, "Uses each handler's default level if no level is given\n");
 	lib_exit(1);
 }
 
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
-	unsigned int level = 6;
-	lib_init();
-
+	struct test_bench_corpus corpus;
+	const char *prog = argv[0];
+	const char *corpus_path = NULL, *handler_name = NULL;
+	const char *level_str = NULL;
 	unsigned long block_size = 8192UL;
 	unsigned long block_count = 1000UL;
+	struct stat st;
+	const buffer_t *mail;
+	unsigned int small_count = 0;
+	int c;
 
-	if (argc >= 3) {
-		if (str_to_ulong(argv[1], &block_size) < 0 ||
-		    str_to_ulong(argv[2], &block_count) < 0) {
-			fprintf(stderr, "Invalid parameters\n");
-			print_usage(argv[0]);
-		}
-		if (argc == 4 &&
-		    str_to_uint(argv[3], &level) < 0) {
-			fprintf(stderr, "Invalid parameters\n");
-			print_usage(argv[0]);
-		}
-		if (argc > 4) {
-			print_usage(argv[0]);
+	lib_init();
+
+	while ((c = getopt(argc, argv, "c:l:H:")) > 0) {
+		switch (c) {
+		case 'c':
+			corpus_path = optarg;
+			break;
+		case 'l':
+			level_str = optarg;
+			break;
+		case 'H':
+			handler_name = optarg;
+			break;
+		default:
+			print_usage(prog);
 		}
-	} else if (argc != 1) {
-		print_usage(argv[0]);
 	}
-
-	unsigned char buf[block_size];
-	printf("Input data is %lu blocks of %lu bytes\n\n", block_count, block_size);
-
-	time_t t0 = time(NULL);
-
-	/* create plaintext file */
-	struct ostream *os = o_stream_create_file("decompressed.bin", 0, 0644, 0);
-	for (unsigned long r = 0; r < block_count; r++) {
-		time_t t1 = time(NULL);
-		if (t1 - t0 >= 1) {
-			printf("Building block %8lu / %-8lu\r", r, block_count);
-			fflush(stdout);
-			t0 = t1;
+	argv += optind;
+	argc -= optind;
+
+	test_bench_corpus_init(&corpus);
+	if (corpus_path != NULL) {
+		if (argc != 0)
+			print_usage(prog);
+		if (stat(corpus_path, &st) < 0)
+			i_fatal("stat(%s) failed: %m", corpus_path);
+		if (S_ISDIR(st.st_mode))
+			(void)test_bench_corpus_add_path(&corpus, corpus_path,
+							 FALSE);
+		else
+			test_bench_corpus_add_mbox(&corpus, corpus_path);
+		if (array_count(&corpus.items) == 0)
+			i_fatal("%s: No mails found", corpus_path);
+
+		array_foreach_elem(&corpus.items, mail) {
+			if (mail->used < BENCH_SMALL_MAIL_SIZE)
+				small_count++;
 		}
-		for (size_t i = 0; i < sizeof(buf); i++) {
-			if (i_rand_limit(3) == 0)
-				buf[i] = i_rand_limit(4);
-			else
-				buf[i] = i;
+		printf("Input data is %u mails, %"PRIuUOFF_T" bytes "
+		       "(%u mails < %u bytes)\n", array_count(&corpus.items),
+		       corpus.size, small_count, BENCH_SMALL_MAIL_SIZE);
+	} else {
+		if (argc == 2) {
+			if (str_to_ulong(argv[0], &block_size) < 0 ||
+			    str_to_ulong(argv[1], &block_count) < 0 ||
+			    block_size == 0 || block_count == 0) {
+				fprintf(stderr, "Invalid parameters\n");
+				print_usage(prog);
+			}
+		} else if (argc != 0) {
+			print_usage(prog);
 		}
-		o_stream_nsend(os, buf, sizeof(buf));
+		bench_add_blocks(&corpus, block_size, block_count);
+		printf("Input data is %lu blocks of %lu bytes\n",
+		       block_count, block_size);
 	}
 
-	i_assert(o_stream_finish(os) == 1);
-	o_stream_unref(&os);
-
-	printf("Input data constructed          \n");
-
-	for (unsigned int i = 0; compression_handlers[i].name != NULL; i++) T_BEGIN {
-		if (compression_handlers[i].create_istream != NULL &&
-		    compression_handlers[i].create_ostream != NULL) {
-			bench_compression_speed(&compression_handlers[i], level,
-						block_count);
-		}
-	} T_END;
-
-	i_unlink("decompressed.bin");
-	i_unlink("compressed.bin");
+	bench_compression_handlers(&corpus, corpus_path != NULL,
+				   handler_name, level_str);
 
+	test_bench_corpus_deinit(&corpus);
 	lib_deinit();
+	return 0;
 }
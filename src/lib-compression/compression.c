@@ -5,6 +5,7 @@
 #include "istream-zlib.h"
 #include "ostream-zlib.h"
 #include "iostream-lz4.h"
+#include "iostream-deflate-blocks.h"
 #include "compression.h"
 
 #ifndef HAVE_ZLIB
@@ -12,6 +13,8 @@
 #  define o_stream_create_gz NULL
 #  define i_stream_create_deflate NULL
 #  define o_stream_create_deflate NULL
+#  define i_stream_create_deflate_blocks NULL
+#  define o_stream_create_deflate_blocks NULL
 #  define compression_get_min_level_gz NULL
 #  define compression_get_default_level_gz NULL
 #  define compression_get_max_level_gz NULL
@@ -95,6 +98,18 @@ static bool is_compressed_lz4(struct istream *input)
 	return memcmp(data, IOSTREAM_LZ4_MAGIC, IOSTREAM_LZ4_MAGIC_LEN) == 0;
 }
 
+static bool is_compressed_deflate_blocks(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (i_stream_read_bytes(input, &data, &size,
+				IOSTREAM_DEFLATE_BLOCKS_MAGIC_LEN) <= 0)
+		return FALSE;
+	return memcmp(data, IOSTREAM_DEFLATE_BLOCKS_MAGIC,
+		      IOSTREAM_DEFLATE_BLOCKS_MAGIC_LEN) == 0;
+}
+
 #define ZSTD_MAGICNUMBER            0xFD2FB528    /* valid since v0.8.0 */
 static bool is_compressed_zstd(struct istream *input)
 {
@@ -241,6 +256,17 @@ const struct compression_handler compression_handlers[] = {
 		.get_default_level = compression_get_default_level_zstd,
 		.get_max_level = compression_get_max_level_zstd,
 	},
+	{
+		.name = "deflate-blocks",
+		.ext = ".dblk",
+		.is_compressed = is_compressed_deflate_blocks,
+		.create_istream = i_stream_create_deflate_blocks,
+		.create_ostream = o_stream_create_deflate_blocks,
+		.get_min_level = compression_get_min_level_gz,
+		.get_default_level = compression_get_default_level_gz,
+		.get_max_level = compression_get_max_level_gz,
+		.seekable = TRUE,
+	},
 	{
 		.name = "unsupported",
 	},
@@ -25,6 +25,9 @@ struct compression_handler {
 	int (*get_default_level)(void);
 	/* returns maximum level */
 	int (*get_max_level)(void);
+	/* The istream can seek to any offset without decompressing the data
+	   before it, as long as the parent istream is seekable. */
+	bool seekable;
 };
 
 extern const struct compression_handler compression_handlers[];
@@ -0,0 +1,57 @@
+#ifndef IOSTREAM_DEFLATE_BLOCKS_H
+#define IOSTREAM_DEFLATE_BLOCKS_H
+
+/*
+   Dovecot's seekable deflate-blocks files contain:
+
+   IOSTREAM_DEFLATE_BLOCKS_HEADER
+   n x (4 byte big-endian: compressed block length, raw deflate block)
+   4 byte big-endian 0: end of blocks
+   n x struct iostream_deflate_blocks_index_record
+   struct iostream_deflate_blocks_footer
+
+   Each block is compressed independently of the others, so decompression
+   can start at any block. The index at the end of the file maps the
+   blocks' uncompressed offsets to their compressed offsets, which allows
+   seeking to any offset by decompressing at most one block. The blocks
+   can be read sequentially also without the index, so non-seekable
+   streams work as well.
+*/
+
+#define IOSTREAM_DEFLATE_BLOCKS_MAGIC "Dovecot-DBLK\x0d\x2a\x9b\xc5"
+#define IOSTREAM_DEFLATE_BLOCKS_MAGIC_LEN \
+	(sizeof(IOSTREAM_DEFLATE_BLOCKS_MAGIC)-1)
+#define IOSTREAM_DEFLATE_BLOCKS_FOOTER_MAGIC "DBLK"
+
+struct iostream_deflate_blocks_header {
+	unsigned char magic[IOSTREAM_DEFLATE_BLOCKS_MAGIC_LEN];
+	/* Maximum uncompressed size of a block in big-endian */
+	unsigned char max_uncompressed_block_size[4];
+};
+
+struct iostream_deflate_blocks_index_record {
+	/* Offset of the block's length prefix from the beginning of the
+	   header in big-endian */
+	unsigned char compressed_offset[8];
+	/* Offset of the block's first byte in the uncompressed data in
+	   big-endian */
+	unsigned char uncompressed_offset[8];
+};
+
+struct iostream_deflate_blocks_footer {
+	/* Offset of the first index record in big-endian */
+	unsigned char index_offset[8];
+	unsigned char uncompressed_size[8];
+	unsigned char block_count[4];
+	unsigned char magic[4];
+};
+
+/* How large blocks we're buffering into memory before compressing them.
+   This is also the granularity for seeking. */
+#define OSTREAM_DEFLATE_BLOCKS_BLOCK_SIZE (1024*64)
+/* How large blocks we allow in input data before returning a failure. */
+#define ISTREAM_DEFLATE_BLOCKS_MAX_BLOCK_SIZE (1024*1024)
+
+#define IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN 4 /* big-endian size of block */
+
+#endif
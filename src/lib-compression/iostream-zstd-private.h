@@ -1,6 +1,21 @@
 #ifndef IOSTREAM_ZSTD_PRIVATE_H
 #define IOSTREAM_ZSTD_PRIVATE_H 1
 
+/* ZSTD_CCtx_refCDict() and ZSTD_DCtx_refDDict() became stable in v1.4.0 */
+#if ZSTD_VERSION_NUMBER >= 10400
+#  define HAVE_ZSTD_DICT
+
+/* Returns dictionaries registered with zstd_dict_register(), or NULL if
+   the dictionary ID isn't registered. */
+const ZSTD_DDict *zstd_dict_get_ddict(unsigned int id);
+const ZSTD_CDict *zstd_dict_get_cdict(unsigned int id, int level);
+
+/* ZSTD_c_nbWorkers is usable also when ZSTD_STATIC_LINKING_ONLY isn't
+   defined since v1.4.0. It still requires libzstd to be built with
+   multithreading support. */
+#  define HAVE_ZSTD_WORKERS
+#endif
+
 /* a horrible hack to fix issues when the installed libzstd is lot
    newer than what we were compiled against. */
 static inline ZSTD_ErrorCode zstd_version_errcode(ZSTD_ErrorCode err)
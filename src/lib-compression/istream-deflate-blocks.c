@@ -0,0 +1,565 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+
+#ifdef HAVE_ZLIB
+
+#include "array.h"
+#include "buffer.h"
+#include "istream-private.h"
+#include "istream-zlib.h"
+#include "iostream-deflate-blocks.h"
+#include <zlib.h>
+
+struct deflate_blocks_index_entry {
+	uoff_t compressed_offset;
+	uoff_t uncompressed_offset;
+};
+
+struct deflate_blocks_istream {
+	struct istream_private istream;
+	int (*super_stat)(struct istream_private *stream, bool exact);
+
+	z_stream zs;
+	struct stat last_parent_statbuf;
+
+	buffer_t *block_buf;
+	uint32_t block_size, block_left, max_uncompressed_block_size;
+
+	/* Created only if the index was successfully read */
+	ARRAY(struct deflate_blocks_index_entry) index;
+	uoff_t uncompressed_size;
+
+	bool marked:1;
+	bool header_read:1;
+	bool index_read:1;
+	bool end_of_blocks:1;
+};
+
+static void i_stream_deflate_blocks_close(struct iostream_private *stream,
+					  bool close_parent)
+{
+	struct istream_private *_istream =
+		container_of(stream, struct istream_private, iostream);
+	struct deflate_blocks_istream *zstream =
+		container_of(_istream, struct deflate_blocks_istream, istream);
+
+	(void)inflateEnd(&zstream->zs);
+	buffer_free(&zstream->block_buf);
+	array_free(&zstream->index);
+	if (close_parent)
+		i_stream_close(zstream->istream.parent);
+}
+
+static void
+deflate_blocks_read_error(struct deflate_blocks_istream *zstream,
+			  const char *error)
+{
+	io_stream_set_error(&zstream->istream.iostream,
+			    "deflate-blocks.read(%s): %s at %"PRIuUOFF_T,
+			    i_stream_get_name(&zstream->istream.istream), error,
+			    i_stream_get_absolute_offset(&zstream->istream.istream));
+}
+
+static int
+i_stream_deflate_blocks_read_header(struct deflate_blocks_istream *zstream)
+{
+	const struct iostream_deflate_blocks_header *hdr;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	ret = i_stream_read_bytes(zstream->istream.parent, &data,
+				  &size, sizeof(*hdr));
+	size = I_MIN(size, sizeof(*hdr) - zstream->block_buf->used);
+	buffer_append(zstream->block_buf, data, size);
+	i_stream_skip(zstream->istream.parent, size);
+	if (ret < 0 || (ret == 0 && zstream->istream.istream.eof)) {
+		i_assert(ret != -2);
+		if (zstream->istream.parent->stream_errno == 0) {
+			deflate_blocks_read_error(zstream,
+				"missing header (not deflate-blocks file?)");
+			zstream->istream.istream.stream_errno = EINVAL;
+		} else {
+			zstream->istream.istream.stream_errno =
+				zstream->istream.parent->stream_errno;
+		}
+		return -1;
+	}
+	if (zstream->block_buf->used < sizeof(*hdr)) {
+		i_assert(!zstream->istream.istream.blocking);
+		return 0;
+	}
+
+	hdr = zstream->block_buf->data;
+	if (memcmp(hdr->magic, IOSTREAM_DEFLATE_BLOCKS_MAGIC,
+		   IOSTREAM_DEFLATE_BLOCKS_MAGIC_LEN) != 0) {
+		deflate_blocks_read_error(zstream,
+			"wrong magic in header (not deflate-blocks file?)");
+		zstream->istream.istream.stream_errno = EINVAL;
+		return -1;
+	}
+	zstream->max_uncompressed_block_size =
+		be32_to_cpu_unaligned(hdr->max_uncompressed_block_size);
+	buffer_set_used_size(zstream->block_buf, 0);
+	if (zstream->max_uncompressed_block_size == 0 ||
+	    zstream->max_uncompressed_block_size >
+	    ISTREAM_DEFLATE_BLOCKS_MAX_BLOCK_SIZE) {
+		deflate_blocks_read_error(zstream, t_strdup_printf(
+			"invalid max block size %u",
+			zstream->max_uncompressed_block_size));
+		zstream->istream.istream.stream_errno = EINVAL;
+		return -1;
+	}
+	zstream->header_read = TRUE;
+	return 1;
+}
+
+static int
+i_stream_deflate_blocks_read_block_prefix(struct deflate_blocks_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	i_assert(zstream->block_buf->used < IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN);
+	ret = i_stream_read_more(stream->parent, &data, &size);
+	size = I_MIN(size, IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN -
+		     zstream->block_buf->used);
+	buffer_append(zstream->block_buf, data, size);
+	i_stream_skip(stream->parent, size);
+	if (ret < 0) {
+		i_assert(ret != -2);
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		if (stream->istream.stream_errno == 0) {
+			deflate_blocks_read_error(zstream,
+				"missing end of blocks marker");
+			stream->istream.stream_errno = EPIPE;
+		}
+		return -1;
+	}
+	if (zstream->block_buf->used < IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN) {
+		i_assert(!stream->istream.blocking);
+		return 0;
+	}
+	zstream->block_size = zstream->block_left =
+		be32_to_cpu_unaligned(zstream->block_buf->data);
+	buffer_set_used_size(zstream->block_buf, 0);
+	if (zstream->block_size == 0) {
+		/* end of blocks - the index follows */
+		zstream->end_of_blocks = TRUE;
+		stream->istream.eof = TRUE;
+		stream->cached_stream_size =
+			stream->istream.v_offset + stream->pos - stream->skip;
+		return -1;
+	}
+	if (zstream->block_size >
+	    compressBound(zstream->max_uncompressed_block_size)) {
+		deflate_blocks_read_error(zstream, t_strdup_printf(
+			"invalid block size: %u", zstream->block_size));
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	}
+	return 1;
+}
+
+static int
+i_stream_deflate_blocks_uncompress(struct deflate_blocks_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	uint32_t max_size = zstream->max_uncompressed_block_size;
+	size_t size;
+	int ret;
+
+	/* allocate enough space for the old data and the new uncompressed
+	   block. the original size isn't stored in the block, so allocate
+	   the max amount of memory. */
+	if (inflateReset(&zstream->zs) != Z_OK)
+		i_unreached();
+	zstream->zs.next_in = (void *)zstream->block_buf->data;
+	zstream->zs.avail_in = zstream->block_buf->used;
+	zstream->zs.next_out = i_stream_alloc(stream, max_size);
+	zstream->zs.avail_out = max_size;
+
+	ret = inflate(&zstream->zs, Z_FINISH);
+	buffer_set_used_size(zstream->block_buf, 0);
+	switch (ret) {
+	case Z_STREAM_END:
+		break;
+	case Z_MEM_ERROR:
+		i_fatal_status(FATAL_OUTOFMEM, "deflate-blocks.read(%s): "
+			       "Out of memory", i_stream_get_name(&stream->istream));
+	default:
+		deflate_blocks_read_error(zstream, "corrupted block");
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	}
+	size = max_size - zstream->zs.avail_out;
+	if (zstream->zs.avail_in != 0 || size == 0) {
+		deflate_blocks_read_error(zstream, "corrupted block");
+		stream->istream.stream_errno = EINVAL;
+		return -1;
+	}
+	stream->pos += size;
+	i_assert(stream->pos <= stream->buffer_size);
+	return size;
+}
+
+static ssize_t i_stream_deflate_blocks_read(struct istream_private *stream)
+{
+	struct deflate_blocks_istream *zstream =
+		container_of(stream, struct deflate_blocks_istream, istream);
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	/* if we already have max_buffer_size amount of data, fail here */
+	if (stream->pos - stream->skip >=
+	    i_stream_get_max_buffer_size(&stream->istream))
+		return -2;
+
+	if (zstream->end_of_blocks) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+	if (!zstream->header_read) {
+		if ((ret = i_stream_deflate_blocks_read_header(zstream)) <= 0) {
+			if (ret < 0)
+				stream->istream.eof = TRUE;
+			return ret;
+		}
+	}
+
+	if (zstream->block_left == 0) {
+		while ((ret = i_stream_deflate_blocks_read_block_prefix(zstream)) == 0) {
+			if (!stream->istream.blocking)
+				return 0;
+		}
+		if (ret < 0)
+			return -1;
+	}
+
+	/* read the whole compressed block into memory */
+	while (zstream->block_left > 0 &&
+	       (ret = i_stream_read_more(stream->parent, &data, &size)) > 0) {
+		if (size > zstream->block_left)
+			size = zstream->block_left;
+		buffer_append(zstream->block_buf, data, size);
+		i_stream_skip(stream->parent, size);
+		zstream->block_left -= size;
+	}
+	if (zstream->block_left > 0) {
+		if (ret == -1 && stream->parent->stream_errno == 0) {
+			deflate_blocks_read_error(zstream, "truncated block");
+			stream->istream.stream_errno = EPIPE;
+			return -1;
+		}
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		i_assert(ret != 0 || !stream->istream.blocking);
+		return ret;
+	}
+	if (i_stream_get_data_size(stream->parent) > 0) {
+		/* Parent stream was only partially consumed. Set the stream's
+		   IO as pending to avoid hangs. */
+		i_stream_set_input_pending(&stream->istream, TRUE);
+	}
+	return i_stream_deflate_blocks_uncompress(zstream);
+}
+
+static int
+i_stream_deflate_blocks_index_corrupted(struct deflate_blocks_istream *zstream,
+					const char *error)
+{
+	array_free(&zstream->index);
+	deflate_blocks_read_error(zstream, t_strdup_printf(
+		"Corrupted index: %s", error));
+	zstream->istream.istream.stream_errno = EINVAL;
+	return -1;
+}
+
+static int
+i_stream_deflate_blocks_read_index_int(struct deflate_blocks_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	struct istream *parent = stream->parent;
+	const struct iostream_deflate_blocks_footer *footer;
+	const struct iostream_deflate_blocks_index_record *rec;
+	struct deflate_blocks_index_entry *entry, *prev = NULL;
+	const unsigned char *data;
+	uoff_t size, index_offset;
+	uint32_t i, count;
+	size_t data_size;
+	int ret;
+
+	if ((ret = i_stream_get_size(parent, TRUE, &size)) <= 0) {
+		if (ret < 0)
+			stream->istream.stream_errno = parent->stream_errno;
+		return ret;
+	}
+	if (!zstream->header_read) {
+		/* nothing has been read yet, so continue reading the blocks
+		   after the header. */
+		i_stream_seek(parent, stream->parent_start_offset);
+		if (i_stream_deflate_blocks_read_header(zstream) < 0)
+			return -1;
+		stream->parent_expected_offset = parent->v_offset;
+	}
+
+	if (size < stream->parent_start_offset +
+	    sizeof(struct iostream_deflate_blocks_header) + sizeof(*footer))
+		return i_stream_deflate_blocks_index_corrupted(zstream,
+			"File too small");
+	size -= stream->parent_start_offset;
+	i_stream_seek(parent, stream->parent_start_offset +
+		      size - sizeof(*footer));
+	if (i_stream_read_bytes(parent, &data, &data_size,
+				sizeof(*footer)) <= 0) {
+		stream->istream.stream_errno = parent->stream_errno;
+		return parent->stream_errno != 0 ? -1 :
+			i_stream_deflate_blocks_index_corrupted(zstream,
+				"Truncated footer");
+	}
+	footer = (const void *)data;
+	if (memcmp(footer->magic, IOSTREAM_DEFLATE_BLOCKS_FOOTER_MAGIC,
+		   sizeof(footer->magic)) != 0)
+		return i_stream_deflate_blocks_index_corrupted(zstream,
+			"Wrong magic in footer");
+	index_offset = be64_to_cpu_unaligned(footer->index_offset);
+	zstream->uncompressed_size =
+		be64_to_cpu_unaligned(footer->uncompressed_size);
+	count = be32_to_cpu_unaligned(footer->block_count);
+	if (index_offset > size ||
+	    size - index_offset != (uoff_t)count * sizeof(*rec) +
+	    sizeof(*footer))
+		return i_stream_deflate_blocks_index_corrupted(zstream,
+			"Invalid index size");
+
+	i_stream_seek(parent, stream->parent_start_offset + index_offset);
+	i_array_init(&zstream->index, I_MAX(count, 1));
+	for (i = 0; i < count; i++) {
+		if (i_stream_read_bytes(parent, &data, &data_size,
+					sizeof(*rec)) <= 0) {
+			array_free(&zstream->index);
+			stream->istream.stream_errno = parent->stream_errno;
+			return parent->stream_errno != 0 ? -1 :
+				i_stream_deflate_blocks_index_corrupted(
+					zstream, "Truncated index");
+		}
+		rec = (const void *)data;
+		entry = array_append_space(&zstream->index);
+		entry->compressed_offset =
+			be64_to_cpu_unaligned(rec->compressed_offset);
+		entry->uncompressed_offset =
+			be64_to_cpu_unaligned(rec->uncompressed_offset);
+		i_stream_skip(parent, sizeof(*rec));
+
+		if (entry->compressed_offset >= index_offset ||
+		    entry->uncompressed_offset >= zstream->uncompressed_size ||
+		    (prev == NULL ?
+		     entry->uncompressed_offset != 0 :
+		     (entry->compressed_offset <= prev->compressed_offset ||
+		      entry->uncompressed_offset <= prev->uncompressed_offset)))
+			return i_stream_deflate_blocks_index_corrupted(zstream,
+				t_strdup_printf("Invalid record %u", i));
+		prev = entry;
+	}
+	stream->cached_stream_size = zstream->uncompressed_size;
+	return 1;
+}
+
+static int
+i_stream_deflate_blocks_read_index(struct deflate_blocks_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	int ret;
+
+	if (zstream->index_read)
+		return array_is_created(&zstream->index) ? 1 : 0;
+	zstream->index_read = TRUE;
+
+	/* The index is used only when it can be read without waiting. */
+	if (!stream->parent->seekable || !stream->parent->blocking)
+		return 0;
+	ret = i_stream_deflate_blocks_read_index_int(zstream);
+	/* continue reading the blocks from where we were */
+	i_stream_seek(stream->parent, stream->parent_expected_offset);
+	return ret;
+}
+
+static const struct deflate_blocks_index_entry *
+i_stream_deflate_blocks_find_block(struct deflate_blocks_istream *zstream,
+				   uoff_t v_offset)
+{
+	const struct deflate_blocks_index_entry *entries;
+	unsigned int idx, left_idx, right_idx, count;
+
+	entries = array_get(&zstream->index, &count);
+	if (count == 0)
+		return NULL;
+
+	/* find the last block that begins at or before v_offset */
+	left_idx = 0; right_idx = count;
+	while (left_idx + 1 < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (entries[idx].uncompressed_offset <= v_offset)
+			left_idx = idx;
+		else
+			right_idx = idx;
+	}
+	return &entries[left_idx];
+}
+
+static void
+i_stream_deflate_blocks_reset(struct deflate_blocks_istream *zstream,
+			      bool keep_index)
+{
+	struct istream_private *stream = &zstream->istream;
+
+	i_stream_seek(stream->parent, stream->parent_start_offset);
+	zstream->header_read = FALSE;
+	zstream->end_of_blocks = FALSE;
+	zstream->block_size = zstream->block_left = 0;
+	if (!keep_index) {
+		array_free(&zstream->index);
+		zstream->index_read = FALSE;
+	}
+
+	stream->parent_expected_offset = stream->parent_start_offset;
+	stream->skip = stream->pos = 0;
+	stream->istream.v_offset = 0;
+	stream->high_pos = 0;
+	buffer_set_used_size(zstream->block_buf, 0);
+}
+
+static bool
+i_stream_deflate_blocks_seek_block(struct deflate_blocks_istream *zstream,
+				   uoff_t v_offset)
+{
+	struct istream_private *stream = &zstream->istream;
+	const struct deflate_blocks_index_entry *entry;
+	uoff_t start_offset = stream->istream.v_offset - stream->skip;
+
+	if (v_offset >= start_offset && v_offset <= start_offset + stream->pos) {
+		/* already in the buffer */
+		return FALSE;
+	}
+	if (i_stream_deflate_blocks_read_index(zstream) <= 0)
+		return FALSE;
+	entry = i_stream_deflate_blocks_find_block(zstream, v_offset);
+	if (entry == NULL)
+		return FALSE;
+	if (v_offset > start_offset &&
+	    entry->uncompressed_offset <= start_offset + stream->pos) {
+		/* the block was already (partially) read - continue reading
+		   it forward */
+		return FALSE;
+	}
+
+	i_assert(zstream->header_read);
+	stream->parent_expected_offset =
+		stream->parent_start_offset + entry->compressed_offset;
+	i_stream_seek(stream->parent, stream->parent_expected_offset);
+	zstream->end_of_blocks = FALSE;
+	zstream->block_size = zstream->block_left = 0;
+	buffer_set_used_size(zstream->block_buf, 0);
+
+	stream->skip = stream->pos = 0;
+	stream->istream.v_offset = entry->uncompressed_offset;
+	stream->high_pos = 0;
+	return TRUE;
+}
+
+static void
+i_stream_deflate_blocks_seek(struct istream_private *stream,
+			     uoff_t v_offset, bool mark)
+{
+	struct deflate_blocks_istream *zstream =
+		container_of(stream, struct deflate_blocks_istream, istream);
+
+	if (i_stream_deflate_blocks_seek_block(zstream, v_offset)) {
+		if (!i_stream_nonseekable_try_seek(stream, v_offset))
+			i_unreached();
+	} else if (stream->istream.stream_errno != 0) {
+		/* reading the index failed */
+		return;
+	} else if (!i_stream_nonseekable_try_seek(stream, v_offset)) {
+		/* have to seek backwards without the index - reset state and
+		   retry */
+		i_stream_deflate_blocks_reset(zstream, TRUE);
+		if (!i_stream_nonseekable_try_seek(stream, v_offset))
+			i_unreached();
+	}
+
+	if (mark)
+		zstream->marked = TRUE;
+}
+
+static void i_stream_deflate_blocks_sync(struct istream_private *stream)
+{
+	struct deflate_blocks_istream *zstream =
+		container_of(stream, struct deflate_blocks_istream, istream);
+	const struct stat *st;
+
+	if (i_stream_stat(stream->parent, FALSE, &st) == 0) {
+		if (memcmp(&zstream->last_parent_statbuf,
+			   st, sizeof(*st)) == 0) {
+			/* a compressed file doesn't change unexpectedly,
+			   don't clear our caches unnecessarily */
+			return;
+		}
+		zstream->last_parent_statbuf = *st;
+	}
+	i_stream_deflate_blocks_reset(zstream, FALSE);
+}
+
+static int
+i_stream_deflate_blocks_stat(struct istream_private *stream, bool exact)
+{
+	struct deflate_blocks_istream *zstream =
+		container_of(stream, struct deflate_blocks_istream, istream);
+
+	/* The index has the uncompressed size, so the stream doesn't need
+	   to be read through to find it out. */
+	if (exact && i_stream_deflate_blocks_read_index(zstream) < 0)
+		return -1;
+	return zstream->super_stat(stream, exact);
+}
+
+struct istream *i_stream_create_deflate_blocks(struct istream *input)
+{
+	struct deflate_blocks_istream *zstream;
+	struct istream *ret;
+
+	zstream = i_new(struct deflate_blocks_istream, 1);
+	switch (inflateInit2(&zstream->zs, -15)) {
+	case Z_OK:
+		break;
+	case Z_MEM_ERROR:
+		i_fatal_status(FATAL_OUTOFMEM, "deflate-blocks: Out of memory");
+	case Z_VERSION_ERROR:
+		i_fatal("Wrong zlib library version (broken compilation)");
+	case Z_STREAM_ERROR:
+		i_fatal("deflate-blocks: Invalid parameters");
+	default:
+		i_fatal("inflateInit() failed");
+	}
+
+	zstream->istream.iostream.close = i_stream_deflate_blocks_close;
+	zstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	zstream->istream.read = i_stream_deflate_blocks_read;
+	zstream->istream.seek = i_stream_deflate_blocks_seek;
+	zstream->istream.sync = i_stream_deflate_blocks_sync;
+
+	zstream->istream.istream.readable_fd = FALSE;
+	zstream->istream.istream.blocking = input->blocking;
+	zstream->istream.istream.seekable = input->seekable;
+	zstream->block_buf = buffer_create_dynamic(default_pool, 1024);
+
+	ret = i_stream_create(&zstream->istream, input,
+			      i_stream_get_fd(input), 0);
+	zstream->super_stat = zstream->istream.stat;
+	zstream->istream.stat = i_stream_deflate_blocks_stat;
+	return ret;
+}
+#endif
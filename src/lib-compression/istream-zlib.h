@@ -3,6 +3,8 @@
 
 struct istream *i_stream_create_gz(struct istream *input);
 struct istream *i_stream_create_deflate(struct istream *input);
+/* Seekable format, see iostream-deflate-blocks.h */
+struct istream *i_stream_create_deflate_blocks(struct istream *input);
 struct istream *i_stream_create_bz2(struct istream *input);
 struct istream *i_stream_create_lzma(struct istream *input);
 struct istream *i_stream_create_lz4(struct istream *input);
@@ -41,6 +41,8 @@ struct zstd_istream {
 	buffer_t *data_buffer;
 
 	bool hdr_read:1;
+	/* the dictionary ID in the frame header has been checked */
+	bool dict_checked:1;
 	bool marked:1;
 	bool zs_closed:1;
 	/* is there data remaining */
@@ -63,6 +65,7 @@ static void i_stream_zstd_init(struct zstd_istream *zstream)
 	else
 		buffer_set_used_size(zstream->data_buffer, 0);
 	zstream->zs_closed = FALSE;
+	zstream->dict_checked = FALSE;
 }
 
 static void i_stream_zstd_deinit(struct zstd_istream *zstream, bool reuse_buffers)
@@ -115,6 +118,36 @@ static void i_stream_zstd_read_error(struct zstd_istream *zstream, size_t err)
 			    i_stream_get_absolute_offset(&zstream->istream.istream));
 }
 
+static int i_stream_zstd_ref_dict(struct zstd_istream *zstream)
+{
+	unsigned int dict_id;
+
+	zstream->dict_checked = TRUE;
+	/* The frame header is at the beginning of the first read. Only the
+	   first frame's dictionary is used. */
+	dict_id = ZSTD_getDictID_fromFrame(zstream->input.src,
+					   zstream->input.size);
+	if (dict_id == 0)
+		return 0;
+#ifdef HAVE_ZSTD_DICT
+	const ZSTD_DDict *ddict = zstd_dict_get_ddict(dict_id);
+	if (ddict != NULL) {
+		size_t ret = ZSTD_DCtx_refDDict(zstream->dstream, ddict);
+		if (ZSTD_isError(ret) != 0) {
+			i_stream_zstd_read_error(zstream, ret);
+			return -1;
+		}
+		return 0;
+	}
+#endif
+	zstream->istream.istream.stream_errno = EINVAL;
+	io_stream_set_error(&zstream->istream.iostream,
+			    "zstd.read(%s): Unknown dictionary ID %u",
+			    i_stream_get_name(&zstream->istream.istream),
+			    dict_id);
+	return -1;
+}
+
 static ssize_t i_stream_zstd_read(struct istream_private *stream)
 {
 	struct zstd_istream *zstream =
@@ -175,6 +208,10 @@ static ssize_t i_stream_zstd_read(struct istream_private *stream)
 		zstream->output.pos = 0;
 		zstream->output.size = ZSTD_DStreamOutSize();
 
+		if (!zstream->dict_checked &&
+		    i_stream_zstd_ref_dict(zstream) < 0)
+			return -1;
+
 		size_t zret = ZSTD_decompressStream(zstream->dstream, &zstream->output,
 						    &zstream->input);
 		if (ZSTD_isError(zret) != 0) {
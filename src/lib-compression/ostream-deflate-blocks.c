@@ -0,0 +1,288 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+
+#ifdef HAVE_ZLIB
+
+#include "buffer.h"
+#include "ostream-private.h"
+#include "ostream-zlib.h"
+#include "iostream-deflate-blocks.h"
+#include <zlib.h>
+
+#define BLOCK_SIZE OSTREAM_DEFLATE_BLOCKS_BLOCK_SIZE
+
+struct deflate_blocks_ostream {
+	struct ostream_private ostream;
+	z_stream zs;
+
+	/* uncompressed data of the current block */
+	buffer_t *blockbuf;
+	/* compressed data that is waiting to be sent to the parent */
+	buffer_t *outbuf;
+	size_t outbuf_offset;
+	/* offset of the next compressed byte added to outbuf */
+	uoff_t compressed_offset;
+
+	/* struct iostream_deflate_blocks_index_record for each block */
+	buffer_t *index;
+
+	bool index_written:1;
+};
+
+static void o_stream_deflate_blocks_close(struct iostream_private *stream,
+					  bool close_parent)
+{
+	struct ostream_private *_ostream =
+		container_of(stream, struct ostream_private, iostream);
+	struct deflate_blocks_ostream *zstream =
+		container_of(_ostream, struct deflate_blocks_ostream, ostream);
+
+	(void)deflateEnd(&zstream->zs);
+	buffer_free(&zstream->blockbuf);
+	buffer_free(&zstream->outbuf);
+	buffer_free(&zstream->index);
+	if (close_parent)
+		o_stream_close(zstream->ostream.parent);
+}
+
+static int
+o_stream_deflate_blocks_send_outbuf(struct deflate_blocks_ostream *zstream)
+{
+	ssize_t ret;
+	size_t size;
+
+	size = zstream->outbuf->used - zstream->outbuf_offset;
+	if (size == 0)
+		return 1;
+
+	ret = o_stream_send(zstream->ostream.parent,
+			    CONST_PTR_OFFSET(zstream->outbuf->data,
+					     zstream->outbuf_offset), size);
+	if (ret < 0) {
+		o_stream_copy_error_from_parent(&zstream->ostream);
+		return -1;
+	}
+	if ((size_t)ret != size) {
+		zstream->outbuf_offset += ret;
+		return 0;
+	}
+	zstream->outbuf_offset = 0;
+	buffer_set_used_size(zstream->outbuf, 0);
+	return 1;
+}
+
+static void o_stream_deflate_blocks_append(struct deflate_blocks_ostream *zstream,
+					   const void *data, size_t size)
+{
+	buffer_append(zstream->outbuf, data, size);
+	zstream->compressed_offset += size;
+}
+
+static void
+o_stream_deflate_blocks_compress(struct deflate_blocks_ostream *zstream)
+{
+	struct iostream_deflate_blocks_index_record rec;
+	unsigned char *dest;
+	size_t prefix_pos, bound, block_size;
+	int ret;
+
+	if (zstream->blockbuf->used == 0)
+		return;
+
+	cpu64_to_be_unaligned(zstream->compressed_offset,
+			      rec.compressed_offset);
+	cpu64_to_be_unaligned(zstream->ostream.ostream.offset -
+			      zstream->blockbuf->used,
+			      rec.uncompressed_offset);
+	buffer_append(zstream->index, &rec, sizeof(rec));
+
+	ret = deflateReset(&zstream->zs);
+	i_assert(ret == Z_OK);
+	bound = deflateBound(&zstream->zs, zstream->blockbuf->used);
+	prefix_pos = zstream->outbuf->used;
+	dest = buffer_append_space_unsafe(zstream->outbuf,
+		IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN + bound);
+
+	zstream->zs.next_in = (void *)zstream->blockbuf->data;
+	zstream->zs.avail_in = zstream->blockbuf->used;
+	zstream->zs.next_out = dest + IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN;
+	zstream->zs.avail_out = bound;
+	ret = deflate(&zstream->zs, Z_FINISH);
+	i_assert(ret == Z_STREAM_END);
+	i_assert(zstream->zs.avail_in == 0);
+
+	block_size = bound - zstream->zs.avail_out;
+	cpu32_to_be_unaligned(block_size, dest);
+	buffer_set_used_size(zstream->outbuf, prefix_pos +
+			     IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN + block_size);
+	zstream->compressed_offset +=
+		IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN + block_size;
+	buffer_set_used_size(zstream->blockbuf, 0);
+}
+
+static void
+o_stream_deflate_blocks_write_index(struct deflate_blocks_ostream *zstream)
+{
+	struct iostream_deflate_blocks_footer footer;
+	unsigned char end_of_blocks[IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN] = { 0, };
+
+	o_stream_deflate_blocks_append(zstream, end_of_blocks,
+				       sizeof(end_of_blocks));
+	cpu64_to_be_unaligned(zstream->compressed_offset, footer.index_offset);
+	cpu64_to_be_unaligned(zstream->ostream.ostream.offset,
+			      footer.uncompressed_size);
+	cpu32_to_be_unaligned(zstream->index->used /
+			      sizeof(struct iostream_deflate_blocks_index_record),
+			      footer.block_count);
+	memcpy(footer.magic, IOSTREAM_DEFLATE_BLOCKS_FOOTER_MAGIC,
+	       sizeof(footer.magic));
+
+	o_stream_deflate_blocks_append(zstream, zstream->index->data,
+				       zstream->index->used);
+	o_stream_deflate_blocks_append(zstream, &footer, sizeof(footer));
+	zstream->index_written = TRUE;
+}
+
+static int o_stream_deflate_blocks_flush(struct ostream_private *stream)
+{
+	struct deflate_blocks_ostream *zstream =
+		container_of(stream, struct deflate_blocks_ostream, ostream);
+	int ret;
+
+	if (!zstream->index_written) {
+		o_stream_deflate_blocks_compress(zstream);
+		if (stream->finished)
+			o_stream_deflate_blocks_write_index(zstream);
+	}
+	if ((ret = o_stream_deflate_blocks_send_outbuf(zstream)) <= 0)
+		return ret;
+	return o_stream_flush_parent(stream);
+}
+
+static size_t
+o_stream_deflate_blocks_get_buffer_used_size(const struct ostream_private *stream)
+{
+	const struct deflate_blocks_ostream *zstream =
+		container_of(stream, const struct deflate_blocks_ostream, ostream);
+
+	/* outbuf has already compressed data that we're trying to send to the
+	   parent stream. blockbuf isn't included in the return value,
+	   because it needs to be filled up or flushed. */
+	return (zstream->outbuf->used - zstream->outbuf_offset) +
+		o_stream_get_buffer_used_size(stream->parent);
+}
+
+static size_t
+o_stream_deflate_blocks_get_buffer_avail_size(const struct ostream_private *stream)
+{
+	const struct deflate_blocks_ostream *zstream =
+		container_of(stream, const struct deflate_blocks_ostream, ostream);
+
+	/* We're only guaranteed to accept data to blockbuf. */
+	return BLOCK_SIZE - zstream->blockbuf->used;
+}
+
+static ssize_t
+o_stream_deflate_blocks_send_block(struct deflate_blocks_ostream *zstream,
+				   const void *data, size_t size)
+{
+	size_t max_size;
+	ssize_t added_bytes = 0;
+	int ret;
+
+	do {
+		max_size = I_MIN(size, BLOCK_SIZE - zstream->blockbuf->used);
+		buffer_append(zstream->blockbuf, data, max_size);
+		data = CONST_PTR_OFFSET(data, max_size);
+		size -= max_size;
+		added_bytes += max_size;
+		zstream->ostream.ostream.offset += max_size;
+
+		if (zstream->blockbuf->used == BLOCK_SIZE) {
+			o_stream_deflate_blocks_compress(zstream);
+			ret = o_stream_deflate_blocks_send_outbuf(zstream);
+			if (ret < 0)
+				return -1;
+			if (ret == 0)
+				break;
+		}
+	} while (size > 0);
+
+	return added_bytes;
+}
+
+static ssize_t
+o_stream_deflate_blocks_sendv(struct ostream_private *stream,
+			      const struct const_iovec *iov,
+			      unsigned int iov_count)
+{
+	struct deflate_blocks_ostream *zstream =
+		container_of(stream, struct deflate_blocks_ostream, ostream);
+	ssize_t ret, bytes = 0;
+	unsigned int i;
+
+	if ((ret = o_stream_deflate_blocks_send_outbuf(zstream)) <= 0) {
+		/* error / we still couldn't flush existing data to
+		   parent stream. */
+		return ret;
+	}
+
+	for (i = 0; i < iov_count; i++) {
+		ret = o_stream_deflate_blocks_send_block(zstream,
+			iov[i].iov_base, iov[i].iov_len);
+		if (ret < 0)
+			return -1;
+		bytes += ret;
+		if ((size_t)ret != iov[i].iov_len)
+			break;
+	}
+	return bytes;
+}
+
+struct ostream *
+o_stream_create_deflate_blocks(struct ostream *output, int level)
+{
+	struct iostream_deflate_blocks_header hdr;
+	struct deflate_blocks_ostream *zstream;
+	int ret;
+
+	i_assert(level >= -1 && level <= 9);
+
+	zstream = i_new(struct deflate_blocks_ostream, 1);
+	zstream->ostream.sendv = o_stream_deflate_blocks_sendv;
+	zstream->ostream.flush = o_stream_deflate_blocks_flush;
+	zstream->ostream.get_buffer_used_size =
+		o_stream_deflate_blocks_get_buffer_used_size;
+	zstream->ostream.get_buffer_avail_size =
+		o_stream_deflate_blocks_get_buffer_avail_size;
+	zstream->ostream.iostream.close = o_stream_deflate_blocks_close;
+
+	ret = deflateInit2(&zstream->zs, level, Z_DEFLATED, -15, 8,
+			   Z_DEFAULT_STRATEGY);
+	switch (ret) {
+	case Z_OK:
+		break;
+	case Z_MEM_ERROR:
+		i_fatal_status(FATAL_OUTOFMEM, "deflate-blocks: Out of memory");
+	case Z_VERSION_ERROR:
+		i_fatal("Wrong zlib library version (broken compilation)");
+	case Z_STREAM_ERROR:
+		i_fatal("Invalid compression level %d", level);
+	default:
+		i_fatal("deflateInit() failed with %d", ret);
+	}
+
+	zstream->blockbuf = buffer_create_dynamic(default_pool, BLOCK_SIZE);
+	zstream->outbuf = buffer_create_dynamic(default_pool,
+						compressBound(BLOCK_SIZE) +
+						IOSTREAM_DEFLATE_BLOCKS_PREFIX_LEN);
+	zstream->index = buffer_create_dynamic(default_pool, 256);
+
+	memcpy(hdr.magic, IOSTREAM_DEFLATE_BLOCKS_MAGIC, sizeof(hdr.magic));
+	cpu32_to_be_unaligned(BLOCK_SIZE, hdr.max_uncompressed_block_size);
+	o_stream_deflate_blocks_append(zstream, &hdr, sizeof(hdr));
+	return o_stream_create(&zstream->ostream, output,
+			       o_stream_get_fd(output));
+}
+#endif
@@ -5,6 +5,7 @@
 #ifdef HAVE_ZLIB
 
 #include "crc32.h"
+#include "time-util.h"
 #include "ostream-private.h"
 #include "ostream-zlib.h"
 #include <zlib.h>
@@ -22,9 +23,12 @@ struct zlib_ostream {
 	unsigned int header_bytes_left;
 
 	uint32_t crc, bytes32;
+	int level, new_level;
+	uint64_t compress_usecs;
 
 	bool gz:1;
 	bool flushed:1;
+	bool flush_deferred:1;
 };
 
 int compression_get_min_level_gz(void)
@@ -128,11 +132,36 @@ static int o_stream_zlib_send_outbuf(struct zlib_ostream *zstream)
 	return 1;
 }
 
+static void
+o_stream_zlib_add_usecs(struct zlib_ostream *zstream,
+			const struct timeval *start_time)
+{
+	struct timeval now;
+	long long diff;
+
+	i_gettimeofday(&now);
+	diff = timeval_diff_usecs(&now, start_time);
+	if (diff > 0)
+		zstream->compress_usecs += diff;
+}
+
+static void o_stream_zlib_update_level(struct zlib_ostream *zstream)
+{
+	/* everything has been flushed, so the level can be changed without
+	   it affecting any earlier data */
+	i_assert(zstream->zs.avail_in == 0);
+
+	if (deflateParams(&zstream->zs, zstream->new_level,
+			  Z_DEFAULT_STRATEGY) == Z_OK)
+		zstream->level = zstream->new_level;
+}
+
 static ssize_t
 o_stream_zlib_send_chunk(struct zlib_ostream *zstream,
 			 const void *data, size_t size)
 {
 	z_stream *zs = &zstream->zs;
+	struct timeval start_time;
 	int ret, flush;
 
 	i_assert(zstream->outbuf_used == 0);
@@ -145,6 +174,7 @@ o_stream_zlib_send_chunk(struct zlib_ostream *zstream,
 			return ret;
 	}
 
+	i_gettimeofday(&start_time);
 	zs->next_in = (void *)data;
 	zs->avail_in = size;
 	while (zs->avail_in > 0) {
@@ -180,6 +210,7 @@ o_stream_zlib_send_chunk(struct zlib_ostream *zstream,
 		}
 	}
 	size -= zs->avail_in;
+	o_stream_zlib_add_usecs(zstream, &start_time);
 
 	zstream->crc = crc32_data_more(zstream->crc, data, size);
 	zstream->bytes32 += size;
@@ -191,6 +222,7 @@ static int
 o_stream_zlib_send_flush(struct zlib_ostream *zstream, bool final)
 {
 	z_stream *zs = &zstream->zs;
+	struct timeval start_time;
 	size_t len;
 	bool done = FALSE;
 	int ret, flush;
@@ -211,11 +243,17 @@ o_stream_zlib_send_flush(struct zlib_ostream *zstream, bool final)
 
 	if ((ret = o_stream_zlib_send_outbuf(zstream)) <= 0)
 		return ret;
+	if (zstream->flush_deferred && !final) {
+		/* leave the data buffered in zlib until flushing is no
+		   longer deferred */
+		return 1;
+	}
 
 	flush = final ? Z_FINISH :
 		(!zstream->gz ? Z_SYNC_FLUSH : Z_NO_FLUSH);
 
 	i_assert(zstream->outbuf_used == 0);
+	i_gettimeofday(&start_time);
 	do {
 		len = sizeof(zstream->outbuf) - zs->avail_out;
 		if (len != 0) {
@@ -242,7 +280,10 @@ o_stream_zlib_send_flush(struct zlib_ostream *zstream, bool final)
 			i_unreached();
 		}
 	} while (zs->avail_out != sizeof(zstream->outbuf));
+	o_stream_zlib_add_usecs(zstream, &start_time);
 
+	if (!final && zstream->new_level != zstream->level)
+		o_stream_zlib_update_level(zstream);
 	if (final) {
 		if (o_stream_zlib_send_gz_trailer(zstream) < 0)
 			return -1;
@@ -355,6 +396,8 @@ o_stream_create_zlib(struct ostream *output, int level, bool gz)
 		o_stream_zlib_get_buffer_avail_size;
 	zstream->ostream.iostream.close = o_stream_zlib_close;
 	zstream->crc = 0;
+	zstream->level = level;
+	zstream->new_level = level;
 	zstream->gz = gz;
 	if (gz)
 		zstream->header_bytes_left = sizeof(zstream->gz_header);
@@ -389,4 +432,59 @@ struct ostream *o_stream_create_deflate(struct ostream *output, int level)
 {
 	return o_stream_create_zlib(output, level, FALSE);
 }
+
+static struct zlib_ostream *o_stream_get_deflate(struct ostream *output)
+{
+	struct ostream_private *stream = output->real_stream;
+	struct zlib_ostream *zstream = (struct zlib_ostream *)stream;
+
+	if (stream->sendv != o_stream_zlib_sendv || zstream->gz)
+		return NULL;
+	return zstream;
+}
+
+bool o_stream_zlib_set_level(struct ostream *output, int level)
+{
+	struct zlib_ostream *zstream = o_stream_get_deflate(output);
+
+	i_assert(level >= -1 && level <= 9);
+
+	if (zstream == NULL)
+		return FALSE;
+	zstream->new_level = level;
+	return TRUE;
+}
+
+void o_stream_zlib_set_flush_deferred(struct ostream *output, bool set)
+{
+	struct zlib_ostream *zstream = o_stream_get_deflate(output);
+
+	if (zstream != NULL)
+		zstream->flush_deferred = set;
+}
+
+uint64_t o_stream_zlib_get_compress_usecs(struct ostream *output)
+{
+	struct zlib_ostream *zstream = o_stream_get_deflate(output);
+
+	return zstream == NULL ? 0 : zstream->compress_usecs;
+}
+#else
+#include "ostream-zlib.h"
+
+bool o_stream_zlib_set_level(struct ostream *output ATTR_UNUSED,
+			     int level ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+void o_stream_zlib_set_flush_deferred(struct ostream *output ATTR_UNUSED,
+				      bool set ATTR_UNUSED)
+{
+}
+
+uint64_t o_stream_zlib_get_compress_usecs(struct ostream *output ATTR_UNUSED)
+{
+	return 0;
+}
 #endif
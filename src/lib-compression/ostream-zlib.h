@@ -3,9 +3,34 @@
 
 struct ostream *o_stream_create_gz(struct ostream *output, int level);
 struct ostream *o_stream_create_deflate(struct ostream *output, int level);
+struct ostream *
+o_stream_create_deflate_blocks(struct ostream *output, int level);
 struct ostream *o_stream_create_bz2(struct ostream *output, int level);
 struct ostream *o_stream_create_lz4(struct ostream *output, int level);
 struct ostream *o_stream_create_zstd(struct ostream *output, int level);
+/* Compress using a dictionary registered with zstd_dict_register(). */
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  unsigned int dict_id);
+/* Compress using the given number of zstd worker threads. This also works
+   with dict_id=0. If libzstd doesn't support multithreading, compression
+   is silently done in the calling thread. */
+struct ostream *
+o_stream_create_zstd_workers(struct ostream *output, int level,
+			     unsigned int dict_id, unsigned int workers);
+
+/* Change the compression level of a deflate ostream. The new level is used
+   for data sent after the next flush. Returns FALSE if output isn't a
+   deflate ostream. */
+bool o_stream_zlib_set_level(struct ostream *output, int level);
+/* When set, flushing a deflate ostream doesn't force out the data that zlib
+   is still buffering. This avoids the overhead of sync flushes while
+   sending a large response. The data is sent once enough of it has been
+   compressed, or by the first flush after this is unset again. */
+void o_stream_zlib_set_flush_deferred(struct ostream *output, bool set);
+/* Returns how many microseconds have been spent compressing data in a
+   deflate ostream. */
+uint64_t o_stream_zlib_get_compress_usecs(struct ostream *output);
 
 int compression_get_min_level_gz(void);
 int compression_get_default_level_gz(void);
@@ -139,6 +139,7 @@ o_stream_zstd_sendv(struct ostream_private *stream,
 
 static int o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
 {
+	size_t zret;
 	int ret;
 
 	if (zstream->flushed) {
@@ -158,18 +159,20 @@ static int o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
 	if (!final)
 		return 1;
 
-	if (!zstream->finished) {
-		ret = ZSTD_endStream(zstream->cstream, &zstream->output);
-		if (ZSTD_isError(ret) != 0) {
-			o_stream_zstd_write_error(zstream, ret);
+	while (!zstream->finished) {
+		/* With worker threads there may be more compressed data
+		   pending than fits into outbuf. */
+		zret = ZSTD_endStream(zstream->cstream, &zstream->output);
+		if (ZSTD_isError(zret) != 0) {
+			o_stream_zstd_write_error(zstream, zret);
 			return -1;
 		}
-		zstream->finished = TRUE;
+		if (zret == 0)
+			zstream->finished = TRUE;
+		if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
+			return ret;
 	}
 
-	if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
-		return ret;
-
 	if (final)
 		zstream->flushed = TRUE;
 	i_assert(zstream->output.pos == 0);
@@ -210,8 +213,9 @@ static void o_stream_zstd_close(struct iostream_private *stream,
 		o_stream_close(zstream->ostream.parent);
 }
 
-struct ostream *
-o_stream_create_zstd(struct ostream *output, int level)
+static struct ostream *
+o_stream_create_zstd_int(struct ostream *output, int level,
+			 unsigned int dict_id, unsigned int workers)
 {
 	struct zstd_ostream *zstream;
 	size_t ret;
@@ -229,6 +233,26 @@ o_stream_create_zstd(struct ostream *output, int level)
 	if (zstream->cstream == NULL)
 		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
 	ret = ZSTD_initCStream(zstream->cstream, level);
+#ifdef HAVE_ZSTD_DICT
+	if (dict_id != 0 && ZSTD_isError(ret) == 0) {
+		const ZSTD_CDict *cdict = zstd_dict_get_cdict(dict_id, level);
+
+		i_assert(cdict != NULL);
+		ret = ZSTD_CCtx_refCDict(zstream->cstream, cdict);
+	}
+#else
+	i_assert(dict_id == 0);
+#endif
+#ifdef HAVE_ZSTD_WORKERS
+	if (workers > 0 && ZSTD_isError(ret) == 0) {
+		/* fails if libzstd was built without multithreading -
+		   just compress without workers then. */
+		(void)ZSTD_CCtx_setParameter(zstream->cstream,
+					     ZSTD_c_nbWorkers, workers);
+	}
+#else
+	(void)workers;
+#endif
 	if (ZSTD_isError(ret) != 0)
 		o_stream_zstd_write_error(zstream, ret);
 	else {
@@ -240,4 +264,24 @@ o_stream_create_zstd(struct ostream *output, int level)
 			       o_stream_get_fd(output));
 }
 
+struct ostream *
+o_stream_create_zstd(struct ostream *output, int level)
+{
+	return o_stream_create_zstd_int(output, level, 0, 0);
+}
+
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  unsigned int dict_id)
+{
+	return o_stream_create_zstd_int(output, level, dict_id, 0);
+}
+
+struct ostream *
+o_stream_create_zstd_workers(struct ostream *output, int level,
+			     unsigned int dict_id, unsigned int workers)
+{
+	return o_stream_create_zstd_int(output, level, dict_id, workers);
+}
+
 #endif
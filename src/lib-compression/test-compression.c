@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "buffer.h"
+#include "str.h"
 #include "istream.h"
 #include "iostream-temp.h"
 #include "ostream.h"
@@ -10,12 +11,23 @@
 #include "test-common.h"
 #include "compression.h"
 #include "iostream-lz4.h"
+#include "iostream-deflate-blocks.h"
+#include "istream-zlib.h"
+#include "ostream-zlib.h"
+#include "zstd-dict.h"
 
 #include "hex-binary.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef HAVE_ZSTD
+#  include "zstd.h"
+#  include "zstd_errors.h"
+#  include "zdict.h"
+#  include "iostream-zstd-private.h"
+#endif
+
 static void test_compression_handler_detect(const struct compression_handler *handler)
 {
 	const unsigned char test_data[] = {'h','e','l','l','o',' ',
@@ -1080,6 +1092,126 @@ static void test_compress_file(const char *in_path, const char *out_path)
 	i_close_fd(&fd_out);
 }
 
+#ifdef HAVE_ZLIB
+static void test_deflate_blocks_seek(void)
+{
+	const size_t data_size = OSTREAM_DEFLATE_BLOCKS_BLOCK_SIZE * 8 + 1234;
+	struct iostream_deflate_blocks_footer *footer;
+	buffer_t *compressed = t_buffer_create(1024*64);
+	unsigned char *data = t_malloc_no0(data_size);
+	const unsigned char *rdata;
+	struct ostream *output, *zoutput;
+	struct istream *input, *zinput;
+	uoff_t offset, size;
+	size_t rsize;
+	unsigned int i;
+
+	test_begin("deflate-blocks seek");
+	for (i = 0; i < data_size; i++)
+		data[i] = i_rand_limit(3) == 0 ? i_rand_limit(256) : i % 251;
+
+	output = o_stream_create_buffer(compressed);
+	zoutput = o_stream_create_deflate_blocks(output, 6);
+	/* a flush in the middle causes a short block */
+	o_stream_nsend(zoutput, data, 1000);
+	test_assert(o_stream_flush(zoutput) > 0);
+	o_stream_nsend(zoutput, data + 1000, data_size - 1000);
+	test_assert(o_stream_finish(zoutput) > 0);
+	o_stream_destroy(&zoutput);
+	o_stream_destroy(&output);
+
+	input = test_istream_create_data(compressed->data, compressed->used);
+	/* the index is used only with blocking parents */
+	input->blocking = TRUE;
+	zinput = i_stream_create_deflate_blocks(input);
+	/* the size comes from the index without reading the blocks */
+	test_assert(i_stream_get_size(zinput, TRUE, &size) == 1);
+	test_assert(size == data_size);
+	test_assert(zinput->v_offset == 0);
+
+	for (i = 0; i < 200; i++) {
+		offset = i_rand_limit(data_size);
+		i_stream_seek(zinput, offset);
+		test_assert_idx(i_stream_read_more(zinput, &rdata, &rsize) > 0, i);
+		rsize = I_MIN(rsize, 100);
+		test_assert_idx(memcmp(rdata, data + offset, rsize) == 0, i);
+	}
+	i_stream_seek(zinput, data_size);
+	test_assert(i_stream_read(zinput) == -1 && zinput->stream_errno == 0);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+
+	/* corrupted index fails instead of silently reading everything */
+	footer = buffer_get_space_unsafe(compressed, compressed->used -
+					 sizeof(*footer), sizeof(*footer));
+	footer->block_count[3] ^= 1;
+	input = test_istream_create_data(compressed->data, compressed->used);
+	input->blocking = TRUE;
+	zinput = i_stream_create_deflate_blocks(input);
+	test_assert(i_stream_get_size(zinput, TRUE, &size) < 0);
+	test_assert(zinput->stream_errno == EINVAL);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+	test_end();
+}
+
+static void test_deflate_adaptive(void)
+{
+	buffer_t *compressed = t_buffer_create(1024);
+	string_t *data = t_str_new(1024);
+	struct ostream *output, *zoutput, *gzoutput;
+	struct istream *input, *zinput;
+	const unsigned char *rdata;
+	size_t rsize, used;
+	unsigned int i;
+
+	test_begin("deflate adaptive level and deferred flush");
+	output = o_stream_create_buffer(t_buffer_create(64));
+	gzoutput = o_stream_create_gz(output, 6);
+	test_assert(!o_stream_zlib_set_level(gzoutput, 1));
+	test_assert(o_stream_finish(gzoutput) > 0);
+	o_stream_destroy(&gzoutput);
+	o_stream_destroy(&output);
+
+	output = o_stream_create_buffer(compressed);
+	zoutput = o_stream_create_deflate(output, 1);
+	o_stream_nsend_str(zoutput, "hello ");
+	str_append(data, "hello ");
+	test_assert(o_stream_flush(zoutput) > 0);
+	test_assert(compressed->used > 0);
+
+	/* level change happens at the next flush */
+	test_assert(o_stream_zlib_set_level(zoutput, 9));
+	o_stream_zlib_set_flush_deferred(zoutput, TRUE);
+	for (i = 0; i < 100; i++) {
+		str_printfa(data, "line %u ", i);
+		o_stream_nsend_str(zoutput, t_strdup_printf("line %u ", i));
+	}
+	used = compressed->used;
+	test_assert(o_stream_flush(zoutput) > 0);
+	test_assert(compressed->used == used);
+
+	o_stream_zlib_set_flush_deferred(zoutput, FALSE);
+	test_assert(o_stream_flush(zoutput) > 0);
+	test_assert(compressed->used > used);
+	o_stream_nsend_str(zoutput, "world");
+	str_append(data, "world");
+	test_assert(o_stream_finish(zoutput) > 0);
+	o_stream_destroy(&zoutput);
+	o_stream_destroy(&output);
+
+	input = test_istream_create_data(compressed->data, compressed->used);
+	zinput = i_stream_create_deflate(input);
+	test_assert(i_stream_read_bytes(zinput, &rdata, &rsize,
+					str_len(data)) > 0);
+	test_assert(rsize == str_len(data) &&
+		    memcmp(rdata, str_data(data), rsize) == 0);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+	test_end();
+}
+#endif
+
 static void test_compression_ext(void)
 {
 	const struct compression_handler *handler;
@@ -1097,6 +1229,86 @@ static void test_compression_ext(void)
 	test_end();
 }
 
+#ifdef HAVE_ZSTD_DICT
+static void test_zstd_dict_roundtrip(void)
+{
+#define TEST_ZSTD_DICT_SAMPLE_COUNT 500
+	size_t sample_sizes[TEST_ZSTD_DICT_SAMPLE_COUNT];
+	string_t *samples = t_str_new(1024*64);
+	unsigned char dict[4096];
+	const unsigned char *data;
+	const char *error;
+	size_t dict_size, size, len;
+	buffer_t *compressed;
+	struct ostream *output, *zoutput;
+	struct istream *input, *zinput;
+	unsigned int i, dict_id;
+
+	for (i = 0; i < TEST_ZSTD_DICT_SAMPLE_COUNT; i++) {
+		len = str_len(samples);
+		str_printfa(samples,
+			"Return-Path: <user%u@example.com>\r\n"
+			"Delivered-To: recipient%u@example.org\r\n"
+			"Received: from mx%u.example.com by mail.example.org\r\n"
+			"Message-ID: <%u.%u@example.com>\r\n"
+			"Subject: Meeting number %u\r\n"
+			"Content-Type: text/plain; charset=utf-8\r\n\r\n"
+			"Hello, see you in the meeting %u.\r\n",
+			i, i % 7, i % 3, i * 7919, i, i, i * 3);
+		sample_sizes[i] = str_len(samples) - len;
+	}
+	dict_size = ZDICT_trainFromBuffer(dict, sizeof(dict),
+					  str_data(samples), sample_sizes,
+					  TEST_ZSTD_DICT_SAMPLE_COUNT);
+	if (ZDICT_isError(dict_size) != 0) {
+		i_error("ZDICT_trainFromBuffer() failed: %s",
+			ZDICT_getErrorName(dict_size));
+		test_assert(FALSE);
+		return;
+	}
+	dict_id = zstd_dict_register(dict, dict_size, &error);
+	test_assert(dict_id != 0);
+	/* registering twice is a no-op */
+	test_assert(zstd_dict_register(dict, dict_size, &error) == dict_id);
+
+	compressed = t_buffer_create(1024);
+	output = o_stream_create_buffer(compressed);
+	zoutput = o_stream_create_zstd_dict(output, 3, dict_id);
+	o_stream_nsend(zoutput, str_data(samples), sample_sizes[0]);
+	test_assert(o_stream_finish(zoutput) > 0);
+	o_stream_destroy(&zoutput);
+	o_stream_destroy(&output);
+	test_assert(ZSTD_getDictID_fromFrame(compressed->data,
+					     compressed->used) == dict_id);
+
+	input = test_istream_create_data(compressed->data, compressed->used);
+	zinput = i_stream_create_zstd(input);
+	i_stream_unref(&input);
+	test_assert(i_stream_read_bytes(zinput, &data, &size,
+					sample_sizes[0]) > 0);
+	test_assert(size == sample_sizes[0] &&
+		    memcmp(data, str_data(samples), size) == 0);
+	i_stream_skip(zinput, size);
+	test_assert(i_stream_read(zinput) == -1 && zinput->stream_errno == 0);
+	i_stream_unref(&zinput);
+}
+#endif
+
+static void test_zstd_dict(void)
+{
+	unsigned int dict_id;
+	const char *error;
+
+	test_begin("zstd dictionary");
+	test_assert(zstd_dict_register("not a dictionary", 16, &error) == 0);
+	test_assert(zstd_dict_register_file(".nonexistent", &dict_id,
+					    &error) < 0);
+#ifdef HAVE_ZSTD_DICT
+	test_zstd_dict_roundtrip();
+#endif
+	test_end();
+}
+
 int main(int argc, char *argv[])
 {
 	static void (*const test_functions[])(void) = {
@@ -1108,6 +1320,11 @@ int main(int argc, char *argv[])
 		test_gz_large_header,
 		test_lz4_small_header,
 		test_compression_ext,
+#ifdef HAVE_ZLIB
+		test_deflate_blocks_seek,
+		test_deflate_adaptive,
+#endif
+		test_zstd_dict,
 		NULL
 	};
 	if (argc == 2) {
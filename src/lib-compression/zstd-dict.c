@@ -0,0 +1,169 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "zstd-dict.h"
+
+/* Dictionaries won't be larger than this in practice. "zstd --train"
+   creates 110 kB dictionaries by default. */
+#define ZSTD_DICT_MAX_FILE_SIZE (16*1024*1024)
+
+#ifdef HAVE_ZSTD
+#  include "zstd.h"
+#  include "zstd_errors.h"
+#  include "iostream-zstd-private.h"
+#endif
+
+#ifdef HAVE_ZSTD_DICT
+
+struct zstd_dict {
+	unsigned int id;
+	void *data;
+	size_t size;
+
+	ZSTD_DDict *ddict;
+	/* Digested for the last compression level that was used */
+	ZSTD_CDict *cdict;
+	int cdict_level;
+};
+
+static ARRAY(struct zstd_dict *) zstd_dicts = ARRAY_INIT;
+
+static void zstd_dicts_free(void)
+{
+	struct zstd_dict *dict;
+
+	array_foreach_elem(&zstd_dicts, dict) {
+		if (dict->cdict != NULL)
+			(void)ZSTD_freeCDict(dict->cdict);
+		(void)ZSTD_freeDDict(dict->ddict);
+		i_free(dict->data);
+		i_free(dict);
+	}
+	array_free(&zstd_dicts);
+}
+
+static struct zstd_dict *zstd_dict_find(unsigned int id)
+{
+	struct zstd_dict *dict;
+
+	if (!array_is_created(&zstd_dicts))
+		return NULL;
+	array_foreach_elem(&zstd_dicts, dict) {
+		if (dict->id == id)
+			return dict;
+	}
+	return NULL;
+}
+
+unsigned int zstd_dict_register(const void *data, size_t size,
+				const char **error_r)
+{
+	struct zstd_dict *dict;
+	unsigned int id;
+
+	id = ZSTD_getDictID_fromDict(data, size);
+	if (id == 0) {
+		*error_r = "Not a zstd dictionary (raw content dictionaries "
+			"without an ID aren't supported)";
+		return 0;
+	}
+	if (zstd_dict_find(id) != NULL)
+		return id;
+
+	dict = i_new(struct zstd_dict, 1);
+	dict->id = id;
+	dict->data = i_malloc(size);
+	memcpy(dict->data, data, size);
+	dict->size = size;
+	dict->ddict = ZSTD_createDDict(dict->data, dict->size);
+	if (dict->ddict == NULL) {
+		*error_r = "Invalid zstd dictionary";
+		i_free(dict->data);
+		i_free(dict);
+		return 0;
+	}
+
+	if (!array_is_created(&zstd_dicts)) {
+		i_array_init(&zstd_dicts, 4);
+		lib_atexit(zstd_dicts_free);
+	}
+	array_push_back(&zstd_dicts, &dict);
+	return id;
+}
+
+const ZSTD_DDict *zstd_dict_get_ddict(unsigned int id)
+{
+	struct zstd_dict *dict = zstd_dict_find(id);
+
+	return dict == NULL ? NULL : dict->ddict;
+}
+
+const ZSTD_CDict *zstd_dict_get_cdict(unsigned int id, int level)
+{
+	struct zstd_dict *dict = zstd_dict_find(id);
+
+	if (dict == NULL)
+		return NULL;
+	if (dict->cdict != NULL && dict->cdict_level != level) {
+		(void)ZSTD_freeCDict(dict->cdict);
+		dict->cdict = NULL;
+	}
+	if (dict->cdict == NULL) {
+		dict->cdict = ZSTD_createCDict(dict->data, dict->size, level);
+		if (dict->cdict == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
+		dict->cdict_level = level;
+	}
+	return dict->cdict;
+}
+
+#else
+
+unsigned int zstd_dict_register(const void *data ATTR_UNUSED,
+				size_t size ATTR_UNUSED, const char **error_r)
+{
+#ifdef HAVE_ZSTD
+	*error_r = "zstd dictionaries require zstd v1.4.0 or later";
+#else
+	*error_r = "Support not compiled in for handler: zstd";
+#endif
+	return 0;
+}
+
+#endif
+
+int zstd_dict_register_file(const char *path, unsigned int *dict_id_r,
+			    const char **error_r)
+{
+	buffer_t *buf;
+	const char *error;
+	int ret = 0;
+
+	buf = buffer_create_dynamic(default_pool, 1024*128);
+	switch (buffer_append_full_file(buf, path, ZSTD_DICT_MAX_FILE_SIZE,
+					&error)) {
+	case BUFFER_APPEND_OK:
+		break;
+	case BUFFER_APPEND_READ_MAX_SIZE:
+		*error_r = t_strdup_printf("%s: File is too large", path);
+		ret = -1;
+		break;
+	case BUFFER_APPEND_READ_ERROR:
+		*error_r = t_strdup_printf("%s: %s", path, error);
+		ret = -1;
+		break;
+	case BUFFER_APPEND_READ_MORE:
+		i_unreached();
+	}
+	if (ret == 0) {
+		*dict_id_r = zstd_dict_register(buf->data, buf->used, &error);
+		if (*dict_id_r == 0) {
+			*error_r = t_strdup_printf("%s: %s", path, error);
+			ret = -1;
+		}
+	}
+	buffer_free(&buf);
+	return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef ZSTD_DICT_H
+#define ZSTD_DICT_H
+
+/* Register a zstd dictionary, e.g. one created with "zstd --train" from
+   sample mails. The dictionary can then be used for compression with
+   o_stream_create_zstd_dict(). The compressed frames contain the
+   dictionary ID, which i_stream_create_zstd() uses to find the
+   registered dictionary when decompressing. Registering the same
+   dictionary ID again is a no-op.
+
+   Returns the dictionary ID (never 0) on success, 0 and error_r on
+   failure. */
+unsigned int zstd_dict_register(const void *data, size_t size,
+				const char **error_r);
+/* Same as zstd_dict_register(), but read the dictionary from a file. */
+int zstd_dict_register_file(const char *path, unsigned int *dict_id_r,
+			    const char **error_r);
+
+#endif
@@ -30,6 +30,10 @@
 
 #define IO_STREAM_ENCRYPT_SEED_SIZE 32
 #define IO_STREAM_ENCRYPT_ROUNDS 2048
+/* Amount of plaintext given to the cipher at once. The per-call overhead of
+   EVP and the parent ostream is significant with small chunks, while
+   hardware accelerated AES-GCM gets faster with larger inputs. */
+#define IO_STREAM_ENCRYPT_CHUNK_SIZE (64*1024)
 
 struct encrypt_ostream {
 	struct ostream_private ostream;
@@ -46,6 +50,8 @@ struct encrypt_ostream {
 	buffer_t *cipher_oid;
 	buffer_t *mac_oid;
 	size_t block_size;
+	/* buffer for encrypted data */
+	buffer_t *ciphertext;
 
 	bool finalized;
 	bool failed;
@@ -498,23 +504,24 @@ o_stream_encrypt_sendv(struct ostream_private *stream,
 		}
 	}
 
-	/* buffer for encrypted data */
-	unsigned char ciphertext[IO_BLOCK_SIZE];
-	buffer_t buf;
-	buffer_create_from_data(&buf, ciphertext, sizeof(ciphertext));
+	/* update can emit up to a block more than its input */
+	if (estream->ciphertext == NULL) {
+		estream->ciphertext = buffer_create_dynamic(default_pool,
+			IO_STREAM_ENCRYPT_CHUNK_SIZE +
+			dcrypt_ctx_sym_get_block_size(estream->ctx_sym));
+	}
+	buffer_t *buf = estream->ciphertext;
 
-	/* encrypt & send all blocks of data at max ciphertext buffer's
-	   length */
+	/* encrypt & send all blocks of data at max chunk size */
 	for(unsigned int i = 0; i < iov_count; i++) {
 		size_t bl, off = 0, len = iov[i].iov_len;
 		const unsigned char *ptr = iov[i].iov_base;
 		while(len > 0) {
-			buffer_set_used_size(&buf, 0);
-			/* update can emite twice the size of input */
-			bl = I_MIN(sizeof(ciphertext)/2, len);
+			buffer_set_used_size(buf, 0);
+			bl = I_MIN(IO_STREAM_ENCRYPT_CHUNK_SIZE, len);
 
 			if (!dcrypt_ctx_sym_update(estream->ctx_sym, ptr + off,
-						   bl, &buf, &error)) {
+						   bl, buf, &error)) {
 				io_stream_set_error(&stream->iostream,
 						    "Encryption failure: %s",
 						    error);
@@ -524,7 +531,7 @@ o_stream_encrypt_sendv(struct ostream_private *stream,
 				IO_STREAM_ENC_INTEGRITY_HMAC) {
 				/* update mac */
 				if (!dcrypt_ctx_hmac_update(estream->ctx_mac,
-					buf.data, buf.used, &error)) {
+					buf->data, buf->used, &error)) {
 					io_stream_set_error(&stream->iostream,
 						"MAC failure: %s", error);
 					return -1;
@@ -532,7 +539,7 @@ o_stream_encrypt_sendv(struct ostream_private *stream,
 			}
 
 			/* hopefully upstream can accommodate */
-			if (o_stream_encrypt_send(estream, buf.data, buf.used) < 0) {
+			if (o_stream_encrypt_send(estream, buf->data, buf->used) < 0) {
 				return -1;
 			}
 
@@ -650,6 +657,7 @@ o_stream_encrypt_destroy(struct iostream_private *stream)
 		buffer_free(&estream->cipher_oid);
 	if (estream->mac_oid != NULL)
 		buffer_free(&estream->mac_oid);
+	buffer_free(&estream->ciphertext);
 	if (estream->pub != NULL)
 		dcrypt_key_unref_public(&estream->pub);
 	o_stream_unref(&estream->ostream.parent);
@@ -7,6 +7,11 @@ struct sql_dict {
 	pool_t pool;
 	struct sql_db *db;
 	const struct dict_sql_settings *set;
+
+	/* Committed sets and incs waiting to be written, when
+	   write_behind_msecs is set */
+	struct sql_dict_transaction_context *write_behind_ctx;
+	struct timeout *to_write_behind;
 };
 
 #endif
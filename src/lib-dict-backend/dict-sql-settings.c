@@ -210,6 +210,11 @@ parse_setting(const char *key, const char *value,
 			ctx->set->connect = p_strdup(ctx->pool, value);
 			return NULL;
 		}
+		if (strcmp(key, "write_behind_msecs") == 0) {
+			if (str_to_uint(value, &ctx->set->write_behind_msecs) < 0)
+				return "Invalid write_behind_msecs";
+			return NULL;
+		}
 		break;
 	case SECTION_MAP:
 		return parse_setting_from_defs(ctx->pool,
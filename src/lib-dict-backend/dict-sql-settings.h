@@ -34,6 +34,9 @@ struct dict_sql_map {
 
 struct dict_sql_settings {
 	const char *connect;
+	/* If non-zero, transactions containing only sets and incs are
+	   coalesced and written asynchronously after this many msecs. */
+	unsigned int write_behind_msecs;
 
 	unsigned int max_pattern_fields_count;
 	ARRAY(struct dict_sql_map) maps;
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "istream.h"
 #include "hex-binary.h"
 #include "hash.h"
@@ -17,6 +18,8 @@
 #include <fcntl.h>
 
 #define DICT_SQL_MAX_UNUSED_CONNECTIONS 10
+/* Maximum number of rows in a single multi-row INSERT */
+#define DICT_SQL_MAX_UPSERT_ROWS 100
 
 enum sql_recurse_type {
 	SQL_DICT_RECURSE_NONE,
@@ -67,6 +70,18 @@ struct sql_dict_prev {
 	} value;
 };
 
+/* Pending sets or incs to a single SQL row. The row is identified by the
+   table, the pattern values and the username for private keys. */
+struct sql_dict_prev_row {
+	const char *table;
+	const char **pattern_values;
+	char *username;
+	bool private_key;
+
+	ARRAY(struct sql_dict_prev) fields;
+};
+ARRAY_DEFINE_TYPE(sql_dict_prev_row, struct sql_dict_prev_row);
+
 struct sql_dict_transaction_context {
 	struct dict_transaction_context ctx;
 
@@ -75,8 +90,13 @@ struct sql_dict_transaction_context {
 	pool_t inc_row_pool;
 	struct sql_dict_inc_row *inc_row;
 
-	ARRAY(struct sql_dict_prev) prev_inc;
-	ARRAY(struct sql_dict_prev) prev_set;
+	/* Sets and incs are coalesced into rows until they're flushed */
+	ARRAY_TYPE(sql_dict_prev_row) prev_inc;
+	ARRAY_TYPE(sql_dict_prev_row) prev_set;
+	/* Statements have already been added to sql_ctx */
+	bool stmts_added;
+	/* This is the dict's write-behind transaction */
+	bool write_behind;
 
 	dict_transaction_commit_callback_t *async_callback;
 	void *async_context;
@@ -88,6 +108,9 @@ static struct sql_db_cache *dict_sql_db_cache;
 
 static void sql_dict_prev_inc_flush(struct sql_dict_transaction_context *ctx);
 static void sql_dict_prev_set_flush(struct sql_dict_transaction_context *ctx);
+static void sql_dict_prev_inc_free(struct sql_dict_transaction_context *ctx);
+static void sql_dict_prev_set_free(struct sql_dict_transaction_context *ctx);
+static void sql_dict_write_behind_flush(struct sql_dict *dict);
 
 static int
 sql_dict_init(struct dict *driver, const char *uri,
@@ -125,6 +148,10 @@ static void sql_dict_deinit(struct dict *_dict)
 {
 	struct sql_dict *dict = (struct sql_dict *)_dict;
 
+	if (dict->write_behind_ctx != NULL) {
+		sql_dict_write_behind_flush(dict);
+		sql_wait(dict->db);
+	}
 	sql_unref(&dict->db);
 	pool_unref(&dict->pool);
 }
@@ -132,6 +159,8 @@ static void sql_dict_deinit(struct dict *_dict)
 static void sql_dict_wait(struct dict *_dict)
 {
 	struct sql_dict *dict = (struct sql_dict *)_dict;
+
+	sql_dict_write_behind_flush(dict);
 	sql_wait(dict->db);
 }
 
@@ -614,6 +643,196 @@ sql_dict_lookup_async(struct dict *_dict,
 	}
 }
 
+static bool
+sql_dict_lookup_multi_can_group(const struct dict_sql_map *map,
+				const ARRAY_TYPE(const_string) *pattern_values,
+				const struct dict_sql_map *map2,
+				const ARRAY_TYPE(const_string) *pattern_values2,
+				bool priv, const char *key2)
+{
+	const char *const *values, *const *values2;
+	unsigned int i, count, count2;
+
+	if (map != map2 || priv != (key2[0] == DICT_PATH_PRIVATE[0]))
+		return FALSE;
+	values = array_get(pattern_values, &count);
+	values2 = array_get(pattern_values2, &count2);
+	if (count != count2)
+		return FALSE;
+	/* all except the last pattern field must be the same */
+	for (i = 0; i + 1 < count; i++) {
+		if (strcmp(values[i], values2[i]) != 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static int
+sql_dict_lookup_multi_group(struct sql_dict *dict,
+			    const struct dict_op_settings *set, pool_t pool,
+			    const struct dict_sql_map *map,
+			    const ARRAY_TYPE(const_string) *pattern_values,
+			    bool priv, const char *const *keys,
+			    const ARRAY_TYPE(uint) *key_indexes,
+			    const char **values, const char **error_r)
+{
+	const struct dict_sql_field *pattern_fields;
+	const char *const *pvalues, *const *last_values, *field_value;
+	ARRAY_TYPE(const_string) last_values_arr;
+	ARRAY_TYPE(sql_dict_param) params;
+	struct sql_statement *stmt;
+	struct sql_result *result;
+	const unsigned int *idxp;
+	unsigned int i, count, last_count;
+	string_t *query;
+	const char *error;
+	int ret;
+
+	pattern_fields = array_get(&map->pattern_fields, &count);
+	pvalues = array_front(pattern_values);
+	i_assert(count > 0);
+
+	t_array_init(&last_values_arr, array_count(key_indexes));
+	array_foreach(key_indexes, idxp) {
+		ARRAY_TYPE(const_string) key_pattern_values;
+
+		(void)sql_dict_find_map(dict, keys[*idxp], &key_pattern_values);
+		array_push_back(&last_values_arr,
+				array_idx(&key_pattern_values, count-1));
+	}
+	last_values = array_get(&last_values_arr, &last_count);
+
+	query = t_str_new(256);
+	t_array_init(&params, count + last_count);
+	str_printfa(query, "SELECT %s,%s FROM %s WHERE", map->value_field,
+		    pattern_fields[count-1].name, map->table);
+	for (i = 0; i + 1 < count; i++) {
+		str_printfa(query, " %s = ? AND", pattern_fields[i].name);
+		if (sql_dict_field_get_value(map, &pattern_fields[i],
+					     pvalues[i], "", &params,
+					     &error) < 0) {
+			*error_r = t_strdup_printf(
+				"sql dict lookup: Failed to lookup key %s: %s",
+				keys[array_idx_elem(key_indexes, 0)], error);
+			return -1;
+		}
+	}
+	str_printfa(query, " %s IN (", pattern_fields[count-1].name);
+	for (i = 0; i < last_count; i++) {
+		if (i > 0)
+			str_append_c(query, ',');
+		str_append_c(query, '?');
+		if (sql_dict_field_get_value(map, &pattern_fields[count-1],
+					     last_values[i], "", &params,
+					     &error) < 0) {
+			*error_r = t_strdup_printf(
+				"sql dict lookup: Failed to lookup key %s: %s",
+				keys[array_idx_elem(key_indexes, i)], error);
+			return -1;
+		}
+	}
+	str_append_c(query, ')');
+	if (priv) {
+		struct sql_dict_param *param = array_append_space(&params);
+		str_printfa(query, " AND %s = ?", map->username_field);
+		param->value_type = DICT_SQL_TYPE_STRING;
+		param->value_str = t_strdup(set->username);
+	}
+
+	stmt = sql_dict_statement_init(dict, str_c(query), &params);
+	result = sql_statement_query_s(&stmt);
+	while ((ret = sql_result_next_row(result)) > 0) {
+		/* map the row back to the key using the last pattern field.
+		   Only string fields are grouped, so the value is returned
+		   the same way as it was given. */
+		field_value = sql_result_get_field_value(result,
+							 map->values_count);
+		if (field_value == NULL)
+			continue;
+		for (i = 0; i < last_count; i++) {
+			unsigned int idx = array_idx_elem(key_indexes, i);
+
+			if (values[idx] == NULL &&
+			    strcmp(last_values[i], field_value) == 0) {
+				values[idx] = sql_dict_result_unescape_value(
+					map, pool, result);
+			}
+		}
+	}
+	if (ret < 0) {
+		*error_r = t_strdup_printf("dict sql lookup failed: %s",
+					   sql_result_get_error(result));
+	}
+	sql_result_unref(result);
+	return ret;
+}
+
+static int
+sql_dict_lookup_multi(struct dict *_dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char **values, const char **error_r)
+{
+	struct sql_dict *dict = (struct sql_dict *)_dict;
+	const struct dict_sql_map *map, *map2;
+	const struct dict_sql_field *last_field;
+	ARRAY_TYPE(const_string) pattern_values, pattern_values2;
+	ARRAY_TYPE(uint) key_indexes;
+	unsigned int i, j, count = str_array_length(keys);
+	bool *handled, priv;
+	int ret, found = 0;
+
+	/* Keys that differ only by the last pattern field of the same map
+	   are looked up with a single "IN (...)" query. Other keys are looked
+	   up one by one. */
+	handled = t_new(bool, count);
+	for (i = 0; i < count; i++) {
+		if (handled[i])
+			continue;
+		handled[i] = TRUE;
+
+		map = sql_dict_find_map(dict, keys[i], &pattern_values);
+		priv = keys[i][0] == DICT_PATH_PRIVATE[0];
+		t_array_init(&key_indexes, 8);
+		array_push_back(&key_indexes, &i);
+		if (map != NULL && array_count(&map->pattern_fields) > 0)
+			last_field = array_back(&map->pattern_fields);
+		else
+			last_field = NULL;
+		if (last_field != NULL &&
+		    last_field->value_type == DICT_SQL_TYPE_STRING) {
+			for (j = i + 1; j < count; j++) {
+				if (handled[j])
+					continue;
+				map2 = sql_dict_find_map(dict, keys[j],
+							 &pattern_values2);
+				if (sql_dict_lookup_multi_can_group(map,
+						&pattern_values, map2,
+						&pattern_values2, priv,
+						keys[j])) {
+					array_push_back(&key_indexes, &j);
+					handled[j] = TRUE;
+				}
+			}
+		}
+
+		if (array_count(&key_indexes) == 1) {
+			ret = sql_dict_lookup(_dict, set, pool, keys[i],
+					      &values[i], error_r);
+		} else {
+			ret = sql_dict_lookup_multi_group(dict, set, pool,
+				map, &pattern_values, priv, keys,
+				&key_indexes, values, error_r);
+		}
+		if (ret < 0)
+			return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (values[i] != NULL)
+			found = 1;
+	}
+	return found;
+}
+
 static const struct dict_sql_map *
 sql_dict_iterate_find_next_map(struct sql_dict_iterate_context *ctx,
 			       ARRAY_TYPE(const_string) *pattern_values)
@@ -968,6 +1187,99 @@ sql_dict_transaction_commit_callback(const struct sql_commit_result *sql_result,
 	sql_dict_transaction_free(ctx);
 }
 
+static void
+sql_dict_write_behind_commit_callback(const struct dict_commit_result *result,
+				      void *context)
+{
+	struct sql_dict *dict = context;
+
+	if (result->ret < 0) {
+		e_error(dict->dict.event, "Write-behind commit failed: %s",
+			result->error);
+	}
+}
+
+static void sql_dict_transaction_commit(struct dict_transaction_context *_ctx,
+					bool async,
+					dict_transaction_commit_callback_t *callback,
+					void *context);
+
+/* Commit the pending write-behind transaction asynchronously */
+static void sql_dict_write_behind_flush(struct sql_dict *dict)
+{
+	struct sql_dict_transaction_context *ctx = dict->write_behind_ctx;
+
+	timeout_remove(&dict->to_write_behind);
+	if (ctx == NULL)
+		return;
+	dict->write_behind_ctx = NULL;
+
+	sql_dict_transaction_commit(&ctx->ctx, TRUE,
+				    sql_dict_write_behind_commit_callback, dict);
+}
+
+static void
+sql_dict_set_full(struct sql_dict_transaction_context *ctx,
+		  const char *username, const char *key, const char *value);
+static void
+sql_dict_atomic_inc_full(struct sql_dict_transaction_context *ctx,
+			 const char *username, const char *key,
+			 long long diff);
+
+static bool
+sql_dict_transaction_can_write_behind(struct sql_dict_transaction_context *ctx)
+{
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
+
+	/* Only transactions containing nothing but sets and incs can be
+	   coalesced. Everything else is written immediately. */
+	return dict->set->write_behind_msecs > 0 && !ctx->write_behind &&
+		ctx->error == NULL &&
+		ctx->ctx.changed && !ctx->stmts_added &&
+		(array_is_created(&ctx->prev_set) ||
+		 array_is_created(&ctx->prev_inc));
+}
+
+/* Move the transaction's pending sets and incs into the dict's write-behind
+   transaction, where they are coalesced with the previously committed ones. */
+static void
+sql_dict_transaction_write_behind(struct sql_dict_transaction_context *ctx)
+{
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
+	struct sql_dict_transaction_context *wctx;
+	const struct sql_dict_prev_row *row;
+	const struct sql_dict_prev *prev;
+
+	if (dict->write_behind_ctx == NULL) {
+		dict->write_behind_ctx = (struct sql_dict_transaction_context *)
+			sql_dict_transaction_init(&dict->dict);
+		dict->write_behind_ctx->ctx.changed = TRUE;
+		dict->write_behind_ctx->write_behind = TRUE;
+		dict->to_write_behind =
+			timeout_add(dict->set->write_behind_msecs,
+				    sql_dict_write_behind_flush, dict);
+	}
+	wctx = dict->write_behind_ctx;
+
+	if (array_is_created(&ctx->prev_inc)) {
+		array_foreach(&ctx->prev_inc, row) {
+			array_foreach(&row->fields, prev) {
+				sql_dict_atomic_inc_full(wctx, row->username,
+							 prev->key,
+							 prev->value.diff);
+			}
+		}
+	}
+	if (array_is_created(&ctx->prev_set)) {
+		array_foreach(&ctx->prev_set, row) {
+			array_foreach(&row->fields, prev) {
+				sql_dict_set_full(wctx, row->username,
+						  prev->key, prev->value.str);
+			}
+		}
+	}
+}
+
 static void
 sql_dict_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 			    dict_transaction_commit_callback_t *callback,
@@ -978,6 +1290,21 @@ sql_dict_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 	const char *error;
 	struct dict_commit_result result;
 
+	if (sql_dict_transaction_can_write_behind(ctx)) {
+		/* The changes are written later. Nonexistent rows can't be
+		   reported for incs anymore. */
+		sql_dict_transaction_write_behind(ctx);
+		sql_dict_prev_inc_free(ctx);
+		sql_dict_prev_set_free(ctx);
+		sql_transaction_rollback(&ctx->sql_ctx);
+		sql_dict_transaction_free(ctx);
+
+		i_zero(&result);
+		result.ret = DICT_COMMIT_RET_OK;
+		callback(&result, context);
+		return;
+	}
+
 	/* flush any pending set/inc */
 	if (array_is_created(&ctx->prev_inc))
 		sql_dict_prev_inc_flush(ctx);
@@ -1020,6 +1347,10 @@ static void sql_dict_transaction_rollback(struct dict_transaction_context *_ctx)
 	struct sql_dict_transaction_context *ctx =
 		(struct sql_dict_transaction_context *)_ctx;
 
+	if (array_is_created(&ctx->prev_inc))
+		sql_dict_prev_inc_free(ctx);
+	if (array_is_created(&ctx->prev_set))
+		sql_dict_prev_set_free(ctx);
 	sql_transaction_rollback(&ctx->sql_ctx);
 	sql_dict_transaction_free(ctx);
 }
@@ -1035,6 +1366,7 @@ sql_dict_transaction_stmt_init(struct sql_dict_transaction_context *ctx,
 
 	if (ctx->ctx.timestamp.tv_sec != 0)
 		sql_statement_set_timestamp(stmt, &ctx->ctx.timestamp);
+	ctx->stmts_added = TRUE;
 	return stmt;
 }
 
@@ -1048,56 +1380,39 @@ struct dict_sql_build_query {
 
 	ARRAY(struct dict_sql_build_query_field) fields;
 	const ARRAY_TYPE(const_string) *pattern_values;
+	const char *username;
 	bool add_username;
 };
 
-static int sql_dict_set_query(struct sql_dict_transaction_context *ctx,
-			      const struct dict_sql_build_query *build,
-			      struct sql_statement **stmt_r,
-			      const char **error_r)
+static int
+sql_dict_set_query_values(const struct dict_sql_build_query *build,
+			  string_t *query, ARRAY_TYPE(sql_dict_param) *params,
+			  const char **error_r)
 {
-	struct sql_dict *dict = build->dict;
 	const struct dict_sql_build_query_field *fields;
 	const struct dict_sql_field *pattern_fields;
-	ARRAY_TYPE(sql_dict_param) params;
 	const char *const *pattern_values;
 	unsigned int i, field_count, count, count2;
-	string_t *prefix, *suffix;
 
 	fields = array_get(&build->fields, &field_count);
-	i_assert(field_count > 0);
-
-	t_array_init(&params, 4);
-	prefix = t_str_new(64);
-	suffix = t_str_new(256);
-	/* SQL table is guaranteed to be the same for all fields.
-	   Build all the SQL field names into prefix and '?' placeholders for
-	   each value into the suffix. The actual field values will be added
-	   into params[]. */
-	str_printfa(prefix, "INSERT INTO %s", fields[0].map->table);
-	str_append(prefix, " (");
-	str_append(suffix, ") VALUES (");
+	str_append_c(query, '(');
 	for (i = 0; i < field_count; i++) {
-		if (i > 0) {
-			str_append_c(prefix, ',');
-			str_append_c(suffix, ',');
-		}
-		str_append(prefix, t_strcut(fields[i].map->value_field, ','));
+		if (i > 0)
+			str_append_c(query, ',');
 
 		enum dict_sql_type value_type =
 			fields[i].map->value_types[0];
-		str_append_c(suffix, '?');
+		str_append_c(query, '?');
 		if (sql_dict_value_get(fields[i].map,
 				       value_type, "value", fields[i].value,
-				       "", &params, error_r) < 0)
+				       "", params, error_r) < 0)
 			return -1;
 	}
 	if (build->add_username) {
-		struct sql_dict_param *param = array_append_space(&params);
-		str_printfa(prefix, ",%s", fields[0].map->username_field);
-		str_append(suffix, ",?");
+		struct sql_dict_param *param = array_append_space(params);
+		str_append(query, ",?");
 		param->value_type = DICT_SQL_TYPE_STRING;
-		param->value_str = ctx->ctx.set.username;
+		param->value_str = build->username;
 	}
 
 	/* add the variable fields that were parsed from the path */
@@ -1105,35 +1420,81 @@ static int sql_dict_set_query(struct sql_dict_transaction_context *ctx,
 	pattern_values = array_get(build->pattern_values, &count2);
 	i_assert(count == count2);
 	for (i = 0; i < count; i++) {
-		str_printfa(prefix, ",%s", pattern_fields[i].name);
-		str_append(suffix, ",?");
+		str_append(query, ",?");
 		if (sql_dict_field_get_value(fields[0].map, &pattern_fields[i],
 					     pattern_values[i], "",
-					     &params, error_r) < 0)
+					     params, error_r) < 0)
 			return -1;
 	}
+	str_append_c(query, ')');
+	return 0;
+}
 
-	str_append_str(prefix, suffix);
-	str_append_c(prefix, ')');
+/* Build an INSERT (or upsert) for the rows in builds[]. All of them must have
+   the same fields. */
+static int sql_dict_set_query(struct sql_dict_transaction_context *ctx,
+			      const struct dict_sql_build_query *builds,
+			      unsigned int build_count,
+			      struct sql_statement **stmt_r,
+			      const char **error_r)
+{
+	struct sql_dict *dict = builds[0].dict;
+	const struct dict_sql_build_query_field *fields;
+	const struct dict_sql_field *pattern_fields;
+	ARRAY_TYPE(sql_dict_param) params;
+	unsigned int i, field_count, count;
+	string_t *query;
+
+	fields = array_get(&builds[0].fields, &field_count);
+	i_assert(field_count > 0);
+
+	t_array_init(&params, 4);
+	query = t_str_new(256);
+	/* SQL table is guaranteed to be the same for all fields.
+	   Build all the SQL field names first and then the '?' placeholders
+	   for each row's values. The actual field values will be added
+	   into params[]. */
+	str_printfa(query, "INSERT INTO %s", fields[0].map->table);
+	str_append(query, " (");
+	for (i = 0; i < field_count; i++) {
+		if (i > 0)
+			str_append_c(query, ',');
+		str_append(query, t_strcut(fields[i].map->value_field, ','));
+	}
+	if (builds[0].add_username)
+		str_printfa(query, ",%s", fields[0].map->username_field);
+	pattern_fields = array_get(&fields[0].map->pattern_fields, &count);
+	for (i = 0; i < count; i++)
+		str_printfa(query, ",%s", pattern_fields[i].name);
+	str_append(query, ") VALUES ");
+
+	for (i = 0; i < build_count; i++) {
+		if (i > 0)
+			str_append_c(query, ',');
+		if (sql_dict_set_query_values(&builds[i], query, &params,
+					      error_r) < 0)
+			return -1;
+	}
 
 	enum sql_db_flags flags = sql_get_flags(dict->db);
 	if ((flags & SQL_DB_FLAG_ON_DUPLICATE_KEY) != 0)
-		str_append(prefix, " ON DUPLICATE KEY UPDATE ");
+		str_append(query, " ON DUPLICATE KEY UPDATE ");
 	else if ((flags & SQL_DB_FLAG_ON_CONFLICT_DO) != 0) {
-		str_append(prefix, " ON CONFLICT (");
+		str_append(query, " ON CONFLICT (");
 		for (i = 0; i < count; i++) {
 			if (i > 0)
-				str_append_c(prefix, ',');
-			str_append(prefix, pattern_fields[i].name);
+				str_append_c(query, ',');
+			str_append(query, pattern_fields[i].name);
 		}
-		if (build->add_username) {
+		if (builds[0].add_username) {
 			if (count > 0)
-				str_append_c(prefix, ',');
-			str_append(prefix, fields[0].map->username_field);
+				str_append_c(query, ',');
+			str_append(query, fields[0].map->username_field);
 		}
-		str_append(prefix, ") DO UPDATE SET ");
+		str_append(query, ") DO UPDATE SET ");
 	} else {
-		*stmt_r = sql_dict_transaction_stmt_init(ctx, str_c(prefix), &params);
+		i_assert(build_count == 1);
+		*stmt_r = sql_dict_transaction_stmt_init(ctx, str_c(query), &params);
 		return 0;
 	}
 
@@ -1144,25 +1505,36 @@ static int sql_dict_set_query(struct sql_dict_transaction_context *ctx,
 		const char *first_value_field =
 			t_strcut(fields[i].map->value_field, ',');
 		if (i > 0)
-			str_append_c(prefix, ',');
-		str_append(prefix, first_value_field);
-		str_append_c(prefix, '=');
+			str_append_c(query, ',');
+		str_append(query, first_value_field);
+		str_append_c(query, '=');
+
+		if (build_count > 1) {
+			/* use the value from each row's own VALUES */
+			if ((flags & SQL_DB_FLAG_ON_DUPLICATE_KEY) != 0) {
+				str_printfa(query, "VALUES(%s)",
+					    first_value_field);
+			} else {
+				str_printfa(query, "excluded.%s",
+					    first_value_field);
+			}
+			continue;
+		}
 
 		enum dict_sql_type value_type =
 			fields[i].map->value_types[0];
-		str_append_c(prefix, '?');
+		str_append_c(query, '?');
 		if (sql_dict_value_get(fields[i].map,
 				       value_type, "value", fields[i].value,
 				       "", &params, error_r) < 0)
 			return -1;
 	}
-	*stmt_r = sql_dict_transaction_stmt_init(ctx, str_c(prefix), &params);
+	*stmt_r = sql_dict_transaction_stmt_init(ctx, str_c(query), &params);
 	return 0;
 }
 
 static int
 sql_dict_update_query(const struct dict_sql_build_query *build,
-		      const struct dict_op_settings_private *set,
 		      const char **query_r, ARRAY_TYPE(sql_dict_param) *params,
 		      const char **error_r)
 {
@@ -1184,77 +1556,155 @@ sql_dict_update_query(const struct dict_sql_build_query *build,
 			    first_value_field);
 	}
 
-	if (sql_dict_where_build(set->username, fields[0].map, build->pattern_values,
-				 build->add_username, SQL_DICT_RECURSE_NONE,
-				 query, params, error_r) < 0)
+	if (sql_dict_where_build(build->username, fields[0].map,
+				 build->pattern_values, build->add_username,
+				 SQL_DICT_RECURSE_NONE, query, params,
+				 error_r) < 0)
 		return -1;
 	*query_r = str_c(query);
 	return 0;
 }
 
-static void sql_dict_prev_set_free(struct sql_dict_transaction_context *ctx)
+static void
+sql_dict_prev_rows_free(ARRAY_TYPE(sql_dict_prev_row) *rows, bool values)
 {
-	struct sql_dict_prev *prev_set;
-
-	array_foreach_modifiable(&ctx->prev_set, prev_set) {
-		i_free(prev_set->value.str);
-		i_free(prev_set->key);
+	struct sql_dict_prev_row *row;
+	struct sql_dict_prev *prev;
+
+	array_foreach_modifiable(rows, row) {
+		array_foreach_modifiable(&row->fields, prev) {
+			if (values)
+				i_free(prev->value.str);
+			i_free(prev->key);
+		}
+		array_free(&row->fields);
+		i_free(row->pattern_values);
+		i_free(row->username);
 	}
-	array_free(&ctx->prev_set);
+	array_free(rows);
 }
 
-static void sql_dict_prev_set_flush(struct sql_dict_transaction_context *ctx)
+static void sql_dict_prev_set_free(struct sql_dict_transaction_context *ctx)
 {
-	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
-	const struct sql_dict_prev *prev_sets;
-	unsigned int count;
-	struct sql_statement *stmt;
-	ARRAY_TYPE(const_string) pattern_values;
-	struct dict_sql_build_query build;
-	struct dict_sql_build_query_field *field;
-	const char *error;
-
-	i_assert(array_is_created(&ctx->prev_set));
+	if (array_is_created(&ctx->prev_set))
+		sql_dict_prev_rows_free(&ctx->prev_set, TRUE);
+}
 
-	if (ctx->error != NULL) {
-		sql_dict_prev_set_free(ctx);
-		return;
-	}
+static void
+sql_dict_prev_row_build_init(struct sql_dict *dict,
+			     const struct sql_dict_prev_row *row,
+			     bool set_values,
+			     struct dict_sql_build_query *build,
+			     ARRAY_TYPE(const_string) *pattern_values)
+{
+	const struct sql_dict_prev *prevs;
+	struct dict_sql_build_query_field *field;
+	unsigned int i, count;
 
-	prev_sets = array_get(&ctx->prev_set, &count);
+	prevs = array_get(&row->fields, &count);
 	i_assert(count > 0);
 
 	/* Get the variable values from the dict path. We already verified that
-	   these are all exactly the same for everything in prev_sets. */
-	if (sql_dict_find_map(dict, prev_sets[0].key, &pattern_values) == NULL)
+	   these are all exactly the same for everything in the row. */
+	if (sql_dict_find_map(dict, prevs[0].key, pattern_values) == NULL)
 		i_unreached(); /* this was already checked */
 
-	i_zero(&build);
-	build.dict = dict;
-	build.pattern_values = &pattern_values;
-	build.add_username = (prev_sets[0].key[0] == DICT_PATH_PRIVATE[0]);
+	i_zero(build);
+	build->dict = dict;
+	build->pattern_values = pattern_values;
+	build->username = row->username;
+	build->add_username = row->private_key;
 
 	/* build.fields[] is used to get the map { value_field } for the
-	   SQL field names, as well as the values for them.
+	   SQL field names, as well as the values for them (for sets). */
+	t_array_init(&build->fields, count);
+	for (i = 0; i < count; i++) {
+		field = array_append_space(&build->fields);
+		field->map = prevs[i].map;
+		field->value = set_values ? prevs[i].value.str : NULL;
+	}
+}
+
+static bool
+sql_dict_prev_rows_have_same_fields(const struct sql_dict_prev_row *row1,
+				    const struct sql_dict_prev_row *row2)
+{
+	const struct sql_dict_prev *prevs1, *prevs2;
+	unsigned int i, count1, count2;
+
+	if (row1->private_key != row2->private_key)
+		return FALSE;
+	prevs1 = array_get(&row1->fields, &count1);
+	prevs2 = array_get(&row2->fields, &count2);
+	if (count1 != count2)
+		return FALSE;
+	for (i = 0; i < count1; i++) {
+		if (prevs1[i].map != prevs2[i].map)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+sql_dict_prev_set_flush_rows(struct sql_dict_transaction_context *ctx,
+			     const struct sql_dict_prev_row *rows,
+			     unsigned int count)
+{
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
+	struct dict_sql_build_query *builds;
+	ARRAY_TYPE(const_string) *pattern_values;
+	const struct sql_dict_prev *first = array_front(&rows[0].fields);
+	struct sql_statement *stmt;
+	const char *error;
+	unsigned int i;
 
-	   Example: INSERT INTO ... (build.fields[0].map->value_field,
-	   ...[1], ...) VALUES (build.fields[0].value, ...[1], ...) */
-	t_array_init(&build.fields, count);
-	for (unsigned int i = 0; i < count; i++) {
-		i_assert(build.add_username ==
-			 (prev_sets[i].key[0] == DICT_PATH_PRIVATE[0]));
-		field = array_append_space(&build.fields);
-		field->map = prev_sets[i].map;
-		field->value = prev_sets[i].value.str;
+	builds = t_new(struct dict_sql_build_query, count);
+	pattern_values = t_new(ARRAY_TYPE(const_string), count);
+	for (i = 0; i < count; i++) {
+		sql_dict_prev_row_build_init(dict, &rows[i], TRUE, &builds[i],
+					     &pattern_values[i]);
 	}
 
-	if (sql_dict_set_query(ctx, &build, &stmt, &error) < 0) {
+	if (sql_dict_set_query(ctx, builds, count, &stmt, &error) < 0) {
 		ctx->error = i_strdup_printf(
-			"dict-sql: Failed to set %u fields (first %s): %s",
-			count, prev_sets[0].key, error);
+			"dict-sql: Failed to set %u fields in %u rows (first %s): %s",
+			array_count(&rows[0].fields), count,
+			first->key, error);
 	} else {
 		sql_update_stmt(ctx->sql_ctx, &stmt);
 	}
+}
+
+static void sql_dict_prev_set_flush(struct sql_dict_transaction_context *ctx)
+{
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
+	const struct sql_dict_prev_row *rows;
+	unsigned int i, j, count;
+	bool multi_row;
+
+	i_assert(array_is_created(&ctx->prev_set));
+
+	if (ctx->error != NULL) {
+		sql_dict_prev_set_free(ctx);
+		return;
+	}
+
+	/* Rows that have the same fields are written with a single multi-row
+	   INSERT, if the database supports upserting them. */
+	multi_row = (sql_get_flags(dict->db) &
+		     (SQL_DB_FLAG_ON_DUPLICATE_KEY |
+		      SQL_DB_FLAG_ON_CONFLICT_DO)) != 0;
+	rows = array_get(&ctx->prev_set, &count);
+	i_assert(count > 0);
+	for (i = 0; i < count && ctx->error == NULL; i = j) {
+		for (j = i + 1; multi_row && j < count; j++) {
+			if (j - i >= DICT_SQL_MAX_UPSERT_ROWS ||
+			    !sql_dict_prev_rows_have_same_fields(&rows[i],
+								 &rows[j]))
+				break;
+		}
+		sql_dict_prev_set_flush_rows(ctx, rows + i, j - i);
+	}
 	sql_dict_prev_set_free(ctx);
 }
 
@@ -1320,118 +1770,154 @@ sql_dict_next_inc_row(struct sql_dict_transaction_context *ctx)
 
 static void sql_dict_prev_inc_free(struct sql_dict_transaction_context *ctx)
 {
-	struct sql_dict_prev *prev_inc;
-
-	array_foreach_modifiable(&ctx->prev_inc, prev_inc)
-		i_free(prev_inc->key);
-	array_free(&ctx->prev_inc);
+	if (array_is_created(&ctx->prev_inc))
+		sql_dict_prev_rows_free(&ctx->prev_inc, FALSE);
 }
 
-static void sql_dict_prev_inc_flush(struct sql_dict_transaction_context *ctx)
+static void
+sql_dict_prev_inc_flush_row(struct sql_dict_transaction_context *ctx,
+			    const struct sql_dict_prev_row *row)
 {
 	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
-	const struct dict_op_settings_private *set = &ctx->ctx.set;
-	const struct sql_dict_prev *prev_incs;
-	unsigned int count;
+	const struct sql_dict_prev *prev, *first = array_front(&row->fields);
 	ARRAY_TYPE(const_string) pattern_values;
 	struct dict_sql_build_query build;
-	struct dict_sql_build_query_field *field;
 	ARRAY_TYPE(sql_dict_param) params;
 	struct sql_dict_param *param;
 	const char *query, *error;
 
-	i_assert(array_is_created(&ctx->prev_inc));
-
-	if (ctx->error != NULL) {
-		sql_dict_prev_inc_free(ctx);
-		return;
-	}
-
-	prev_incs = array_get(&ctx->prev_inc, &count);
-	i_assert(count > 0);
-
-	/* Get the variable values from the dict path. We already verified that
-	   these are all exactly the same for everything in prev_incs. */
-	if (sql_dict_find_map(dict, prev_incs[0].key, &pattern_values) == NULL)
-		i_unreached(); /* this was already checked */
-
-	i_zero(&build);
-	build.dict = dict;
-	build.pattern_values = &pattern_values;
-	build.add_username = (prev_incs[0].key[0] == DICT_PATH_PRIVATE[0]);
+	sql_dict_prev_row_build_init(dict, row, FALSE, &build, &pattern_values);
 
-	/* build.fields[] is an array of maps, which are used to get the
-	   map { value_field } for the SQL field names.
-
-	   params[] specifies the list of values to use for each field.
+	/* params[] specifies the list of values to use for each field.
 
 	   Example: UPDATE .. SET build.fields[0].map->value_field =
 	   ...->value_field + params[0]->value_int64, ...[1]... */
-	t_array_init(&build.fields, count);
-	t_array_init(&params, count);
-	for (unsigned int i = 0; i < count; i++) {
-		i_assert(build.add_username ==
-			 (prev_incs[i].key[0] == DICT_PATH_PRIVATE[0]));
-		field = array_append_space(&build.fields);
-		field->map = prev_incs[i].map;
-		field->value = NULL; /* unused */
-
+	t_array_init(&params, array_count(&row->fields));
+	array_foreach(&row->fields, prev) {
 		param = array_append_space(&params);
 		param->value_type = DICT_SQL_TYPE_INT;
-		param->value_int64 = prev_incs[i].value.diff;
+		param->value_int64 = prev->value.diff;
 	}
 
-	if (sql_dict_update_query(&build, set, &query, &params, &error) < 0) {
+	if (sql_dict_update_query(&build, &query, &params, &error) < 0) {
 		ctx->error = i_strdup_printf(
 			"dict-sql: Failed to increase %u fields (first %s): %s",
-			count, prev_incs[0].key, error);
+			array_count(&row->fields), first->key, error);
 	} else {
 		struct sql_statement *stmt =
 			sql_dict_transaction_stmt_init(ctx, query, &params);
 		sql_update_stmt_get_rows(ctx->sql_ctx, &stmt,
 					 sql_dict_next_inc_row(ctx));
 	}
+}
+
+static void sql_dict_prev_inc_flush(struct sql_dict_transaction_context *ctx)
+{
+	const struct sql_dict_prev_row *row;
+
+	i_assert(array_is_created(&ctx->prev_inc));
+
+	/* Each row is updated with a single UPDATE. Multiple rows can't be
+	   merged, because the number of updated rows is needed to find out
+	   if some of them didn't exist. */
+	array_foreach(&ctx->prev_inc, row) {
+		if (ctx->error != NULL)
+			break;
+		sql_dict_prev_inc_flush_row(ctx, row);
+	}
 	sql_dict_prev_inc_free(ctx);
 }
 
 static bool
-sql_dict_maps_are_mergeable(struct sql_dict *dict,
-			    const struct sql_dict_prev *prev1,
-			    const struct dict_sql_map *map2,
-			    const char *map2_key,
-			    const ARRAY_TYPE(const_string) *map2_pattern_values)
+sql_dict_prev_row_matches(const struct sql_dict_prev_row *row,
+			  const struct dict_sql_map *map,
+			  const char *key, const char *username,
+			  const ARRAY_TYPE(const_string) *pattern_values)
 {
-	const struct dict_sql_map *map3;
-	ARRAY_TYPE(const_string) map1_pattern_values;
+	const char *const *values;
+	unsigned int i, count;
 
 	/* sql table names must equal */
-	if (strcmp(prev1->map->table, map2->table) != 0)
+	if (strcmp(row->table, map->table) != 0)
 		return FALSE;
 	/* private vs shared prefix must equal */
-	if (prev1->key[0] != map2_key[0])
+	if (row->private_key != (key[0] == DICT_PATH_PRIVATE[0]))
 		return FALSE;
-	if (prev1->key[0] == DICT_PATH_PRIVATE[0]) {
+	if (row->private_key) {
+		const struct sql_dict_prev *first = array_front(&row->fields);
+
 		/* for private keys, username must equal */
-		if (strcmp(prev1->map->username_field, map2->username_field) != 0)
+		if (strcmp(first->map->username_field,
+			   map->username_field) != 0 ||
+		    strcmp(row->username, username) != 0)
 			return FALSE;
 	}
 
 	/* variable values in the paths must equal exactly */
-	map3 = sql_dict_find_map(dict, prev1->key, &map1_pattern_values);
-	i_assert(map3 == prev1->map);
+	values = array_get(pattern_values, &count);
+	for (i = 0; i < count; i++) {
+		if (row->pattern_values[i] == NULL ||
+		    strcmp(row->pattern_values[i], values[i]) != 0)
+			return FALSE;
+	}
+	return row->pattern_values[i] == NULL;
+}
 
-	return array_equal_fn(&map1_pattern_values, map2_pattern_values,
-			      i_strcmp_p);
+/* Find the pending row where key belongs to, or create a new one. Returns
+   the existing field for the key or a new one. */
+static struct sql_dict_prev *
+sql_dict_prev_row_get_field(ARRAY_TYPE(sql_dict_prev_row) *rows,
+			    const struct dict_sql_map *map,
+			    const char *key, const char *username,
+			    ARRAY_TYPE(const_string) *pattern_values,
+			    bool *existing_r)
+{
+	struct sql_dict_prev_row *row;
+	struct sql_dict_prev *prev;
+	bool found = FALSE;
+
+	*existing_r = FALSE;
+	if (!array_is_created(rows))
+		i_array_init(rows, 4);
+	array_foreach_modifiable(rows, row) {
+		if (!sql_dict_prev_row_matches(row, map, key, username,
+					       pattern_values))
+			continue;
+		array_foreach_modifiable(&row->fields, prev) {
+			if (strcmp(prev->key, key) == 0) {
+				*existing_r = TRUE;
+				return prev;
+			}
+		}
+		found = TRUE;
+		break;
+	}
+	if (!found) {
+		row = array_append_space(rows);
+		row->table = map->table;
+		row->private_key = key[0] == DICT_PATH_PRIVATE[0];
+		row->username = i_strdup(row->private_key ? username : "");
+		array_append_zero(pattern_values);
+		row->pattern_values =
+			p_strarray_dup(default_pool, array_front(pattern_values));
+		array_pop_back(pattern_values);
+		i_array_init(&row->fields, 4);
+	}
+	prev = array_append_space(&row->fields);
+	prev->map = map;
+	prev->key = i_strdup(key);
+	return prev;
 }
 
-static void sql_dict_set(struct dict_transaction_context *_ctx,
-			 const char *key, const char *value)
+static void
+sql_dict_set_full(struct sql_dict_transaction_context *ctx,
+		  const char *username, const char *key, const char *value)
 {
-	struct sql_dict_transaction_context *ctx =
-		(struct sql_dict_transaction_context *)_ctx;
-	struct sql_dict *dict = (struct sql_dict *)_ctx->dict;
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
 	const struct dict_sql_map *map;
 	ARRAY_TYPE(const_string) pattern_values;
+	struct sql_dict_prev *prev_set;
+	bool existing;
 
 	if (ctx->error != NULL)
 		return;
@@ -1448,31 +1934,35 @@ static void sql_dict_set(struct dict_transaction_context *_ctx,
 		return;
 	}
 
-	if (array_is_created(&ctx->prev_set) &&
-	    !sql_dict_maps_are_mergeable(dict, array_front(&ctx->prev_set),
-					 map, key, &pattern_values)) {
-		/* couldn't merge to the previous set - flush it */
-		sql_dict_prev_set_flush(ctx);
-	}
-
-	if (!array_is_created(&ctx->prev_set))
-		i_array_init(&ctx->prev_set, 4);
-	/* Either this is the first set, or this can be merged with the
-	   previous set. */
-	struct sql_dict_prev *prev_set = array_append_space(&ctx->prev_set);
-	prev_set->map = map;
-	prev_set->key = i_strdup(key);
+	/* Sets to the same row are merged into a single INSERT. Setting the
+	   same key again just replaces the previous value. */
+	prev_set = sql_dict_prev_row_get_field(&ctx->prev_set, map, key,
+					       username, &pattern_values,
+					       &existing);
+	if (existing)
+		i_free(prev_set->value.str);
 	prev_set->value.str = i_strdup(value);
 }
 
-static void sql_dict_atomic_inc(struct dict_transaction_context *_ctx,
-				const char *key, long long diff)
+static void sql_dict_set(struct dict_transaction_context *_ctx,
+			 const char *key, const char *value)
 {
 	struct sql_dict_transaction_context *ctx =
 		(struct sql_dict_transaction_context *)_ctx;
-	struct sql_dict *dict = (struct sql_dict *)_ctx->dict;
+
+	sql_dict_set_full(ctx, _ctx->set.username, key, value);
+}
+
+static void
+sql_dict_atomic_inc_full(struct sql_dict_transaction_context *ctx,
+			 const char *username, const char *key,
+			 long long diff)
+{
+	struct sql_dict *dict = (struct sql_dict *)ctx->ctx.dict;
 	const struct dict_sql_map *map;
 	ARRAY_TYPE(const_string) pattern_values;
+	struct sql_dict_prev *prev_inc;
+	bool existing;
 
 	if (ctx->error != NULL)
 		return;
@@ -1489,21 +1979,34 @@ static void sql_dict_atomic_inc(struct dict_transaction_context *_ctx,
 		return;
 	}
 
-	if (array_is_created(&ctx->prev_inc) &&
-	    !sql_dict_maps_are_mergeable(dict, array_front(&ctx->prev_inc),
-					 map, key, &pattern_values)) {
-		/* couldn't merge to the previous inc - flush it */
-		sql_dict_prev_inc_flush(ctx);
-	}
+	/* Incs to the same row are merged into a single UPDATE. Increasing
+	   the same key again just adds to the previous diff. */
+	prev_inc = sql_dict_prev_row_get_field(&ctx->prev_inc, map, key,
+					       username, &pattern_values,
+					       &existing);
+	if (existing)
+		prev_inc->value.diff += diff;
+	else
+		prev_inc->value.diff = diff;
+}
 
-	if (!array_is_created(&ctx->prev_inc))
-		i_array_init(&ctx->prev_inc, 4);
-	/* Either this is the first inc, or this can be merged with the
-	   previous inc. */
-	struct sql_dict_prev *prev_inc = array_append_space(&ctx->prev_inc);
-	prev_inc->map = map;
-	prev_inc->key = i_strdup(key);
-	prev_inc->value.diff = diff;
+static void sql_dict_atomic_inc(struct dict_transaction_context *_ctx,
+				const char *key, long long diff)
+{
+	struct sql_dict_transaction_context *ctx =
+		(struct sql_dict_transaction_context *)_ctx;
+
+	sql_dict_atomic_inc_full(ctx, _ctx->set.username, key, diff);
+}
+
+static bool sql_dict_switch_ioloop(struct dict *_dict)
+{
+	struct sql_dict *dict = (struct sql_dict *)_dict;
+
+	if (dict->to_write_behind == NULL)
+		return FALSE;
+	dict->to_write_behind = io_loop_move_timeout(&dict->to_write_behind);
+	return TRUE;
 }
 
 static struct dict sql_dict = {
@@ -1514,6 +2017,7 @@ static struct dict sql_dict = {
 		.deinit = sql_dict_deinit,
 		.wait = sql_dict_wait,
 		.lookup = sql_dict_lookup,
+		.lookup_multi = sql_dict_lookup_multi,
 		.iterate_init = sql_dict_iterate_init,
 		.iterate = sql_dict_iterate,
 		.iterate_deinit = sql_dict_iterate_deinit,
@@ -1524,6 +2028,7 @@ static struct dict sql_dict = {
 		.unset = sql_dict_unset,
 		.atomic_inc = sql_dict_atomic_inc,
 		.lookup_async = sql_dict_lookup_async,
+		.switch_ioloop = sql_dict_switch_ioloop,
 	}
 };
 
@@ -178,6 +178,69 @@ static void test_set(void)
 	test_end();
 }
 
+static void test_atomic_inc_coalesce(void)
+{
+	const char *error;
+	struct test_driver_result res = {
+		.nqueries = 2,
+		.queries = (const char *[]){
+			"UPDATE quota SET bytes=bytes+130,count=count+1 WHERE username = 'testuser'",
+			"UPDATE counters SET value=value+1 WHERE class = 'global' AND name = 'counter'",
+			NULL},
+		.result = NULL,
+	};
+	struct dict *dict;
+
+	test_begin("dict atomic inc coalesce");
+	test_setup(&dict);
+
+	test_set_expected(dict, &res);
+
+	/* incs to the same row are merged even when they're not consecutive */
+	struct dict_transaction_context *ctx = dict_transaction_begin(dict, &dict_op_settings);
+	dict_atomic_inc(ctx, "priv/quota/bytes", 128);
+	dict_atomic_inc(ctx, "shared/counters/global/counter", 1);
+	dict_atomic_inc(ctx, "priv/quota/bytes", 2);
+	dict_atomic_inc(ctx, "priv/quota/count", 1);
+	test_assert(dict_transaction_commit(&ctx, &error) == 0);
+	if (error != NULL)
+		i_error("dict_transaction_commit failed: %s", error);
+	test_teardown(&dict);
+	test_end();
+}
+
+static void test_set_multi_row(void)
+{
+	const char *error;
+	struct test_driver_result res = {
+		.affected_rows = 1,
+		.nqueries = 2,
+		.queries = (const char *[]){
+			"INSERT INTO counters (value,class,name) VALUES (3,'global','counter'),(129,'global','counter2') ON DUPLICATE KEY UPDATE value=VALUES(value)",
+			"INSERT INTO quota (bytes,username) VALUES (128,'testuser') ON DUPLICATE KEY UPDATE bytes=128",
+			NULL},
+		.result = NULL,
+	};
+	struct dict *dict;
+
+	test_begin("dict set multi row");
+	test_setup(&dict);
+
+	test_set_expected(dict, &res);
+
+	struct dict_transaction_context *ctx = dict_transaction_begin(dict, &dict_op_settings);
+	dict_set(ctx, "shared/counters/global/counter", "1");
+	dict_set(ctx, "shared/counters/global/counter2", "129");
+	dict_set(ctx, "priv/quota/bytes", "128");
+	/* setting the same key again replaces the value */
+	dict_set(ctx, "shared/counters/global/counter", "3");
+	test_assert(dict_transaction_commit(&ctx, &error) == 1);
+	if (error != NULL)
+		i_error("dict_transaction_commit failed: %s", error);
+	test_teardown(&dict);
+	test_end();
+}
+
 static void test_unset(void)
 {
 	const char *error;
@@ -299,6 +362,8 @@ int main(void) {
 		test_lookup_one,
 		test_atomic_inc,
 		test_set,
+		test_atomic_inc_coalesce,
+		test_set_multi_row,
 		test_unset,
 		test_iterate,
 		NULL
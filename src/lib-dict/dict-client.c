@@ -56,8 +56,12 @@ struct client_dict_cmd {
         struct client_dict_iterate_context *iter;
 	struct client_dict_transaction_context *trans;
 
+	/* number of keys in LOOKUP_MULTI */
+	unsigned int lookup_keys_count;
+
 	struct {
 		dict_lookup_callback_t *lookup;
+		dict_lookup_multi_callback_t *lookup_multi;
 		dict_transaction_commit_callback_t *commit;
 		void *context;
 	} api_callback;
@@ -65,32 +69,45 @@ struct client_dict_cmd {
 
 struct dict_client_connection {
 	struct connection conn;
-	struct client_dict *dict;
-};
-
-struct client_dict {
-	struct dict dict;
-	struct dict_client_connection conn;
+	int refcount;
 
 	char *uri;
 	enum dict_data_type value_type;
-	unsigned warn_slow_msecs;
+	/* The connection may be used by multiple dicts in this process */
+	bool shared;
 
 	time_t last_failed_connect;
 	char *last_connect_error;
 
-	struct io_wait_timer *wait_timer;
-	uint64_t last_timer_switch_usecs;
 	struct timeout *to_requests;
 	struct timeout *to_idle;
 	unsigned int idle_msecs;
 
+	/* Commands of all the dicts using this connection in the order they
+	   were sent */
 	ARRAY(struct client_dict_cmd *) cmds;
-	struct client_dict_transaction_context *transactions;
+	struct client_dict *dicts;
+	/* Deinitialized dicts that still have background commands running */
+	struct client_dict *deinit_dicts;
+	/* Dict currently in client_dict_wait() */
+	struct client_dict *waiting_dict;
 
 	unsigned int transaction_id_counter;
 };
 
+struct client_dict {
+	struct dict dict;
+	struct client_dict *prev, *next;
+	struct dict_client_connection *conn;
+
+	unsigned warn_slow_msecs;
+
+	struct io_wait_timer *wait_timer;
+	uint64_t last_timer_switch_usecs;
+
+	struct client_dict_transaction_context *transactions;
+};
+
 struct client_dict_iter_result {
 	const char *key, *const *values;
 };
@@ -127,10 +144,14 @@ struct client_dict_transaction_context {
 
 static struct connection_list *dict_connections;
 
-static int client_dict_connect(struct client_dict *dict, const char **error_r);
-static int client_dict_reconnect(struct client_dict *dict, const char *reason,
-				 const char **error_r);
-static void client_dict_disconnect(struct client_dict *dict, const char *reason);
+static int client_dict_connect(struct dict_client_connection *conn,
+			       const char **error_r);
+static int client_dict_reconnect(struct dict_client_connection *conn,
+				 const char *reason, const char **error_r);
+static void client_dict_disconnect(struct dict_client_connection *conn,
+				   const char *reason);
+static void
+dict_client_connection_switch_ioloop(struct dict_client_connection *conn);
 static const char *dict_wait_warnings(const struct client_dict_cmd *cmd);
 
 static struct client_dict_cmd *
@@ -170,9 +191,37 @@ static bool client_dict_cmd_unref(struct client_dict_cmd *cmd)
 	return FALSE;
 }
 
+static struct ioloop *client_dict_cmd_callback_pre(struct client_dict_cmd *cmd)
+{
+	struct client_dict *waiting_dict = cmd->dict->conn->waiting_dict;
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	if (waiting_dict == NULL || waiting_dict == cmd->dict)
+		return NULL;
+	/* Another dict sharing the connection is waiting for its own
+	   commands. Don't let this callback see the waiting dict's internal
+	   ioloop. */
+	io_loop_set_current(waiting_dict->dict.prev_ioloop);
+	return prev_ioloop;
+}
+
+static void
+client_dict_cmd_callback_post(struct dict_client_connection *conn,
+			      struct ioloop *prev_ioloop)
+{
+	if (prev_ioloop == NULL)
+		return;
+	io_loop_set_current(prev_ioloop);
+	/* the callback may have waited for its own dict, which moved the
+	   connection to another ioloop */
+	dict_client_connection_switch_ioloop(conn);
+}
+
 static bool
 dict_cmd_callback_line(struct client_dict_cmd *cmd, const char *const *args)
 {
+	struct dict_client_connection *conn = cmd->dict->conn;
+	struct ioloop *prev_ioloop;
 	const char *value = args[0];
 	enum dict_protocol_reply reply;
 
@@ -186,7 +235,9 @@ dict_cmd_callback_line(struct client_dict_cmd *cmd, const char *const *args)
 	}
 
 	cmd->unfinished = FALSE;
+	prev_ioloop = client_dict_cmd_callback_pre(cmd);
 	cmd->callback(cmd, reply, value, args, NULL, FALSE);
+	client_dict_cmd_callback_post(conn, prev_ioloop);
 	return !cmd->unfinished;
 }
 
@@ -194,23 +245,27 @@ static void
 dict_cmd_callback_error(struct client_dict_cmd *cmd, const char *error,
 			bool disconnected)
 {
+	struct dict_client_connection *conn = cmd->dict->conn;
+	struct ioloop *prev_ioloop;
 	const char *null_arg = NULL;
 
 	cmd->unfinished = FALSE;
 	if (cmd->callback != NULL) {
+		prev_ioloop = client_dict_cmd_callback_pre(cmd);
 		cmd->callback(cmd, DICT_PROTOCOL_REPLY_ERROR,
 			      "", &null_arg, error, disconnected);
+		client_dict_cmd_callback_post(conn, prev_ioloop);
 	}
 	i_assert(!cmd->unfinished);
 }
 
 static struct client_dict_cmd *
-client_dict_cmd_first_nonbg(struct client_dict *dict)
+client_dict_cmd_first_nonbg(struct dict_client_connection *conn)
 {
 	struct client_dict_cmd *const *cmds;
 	unsigned int i, count;
 
-	cmds = array_get(&dict->cmds, &count);
+	cmds = array_get(&conn->cmds, &count);
 	for (i = 0; i < count; i++) {
 		if (!cmds[i]->background)
 			return cmds[i];
@@ -218,7 +273,19 @@ client_dict_cmd_first_nonbg(struct client_dict *dict)
 	return NULL;
 }
 
-static void client_dict_input_timeout(struct client_dict *dict)
+static unsigned int client_dict_cmds_count(struct client_dict *dict)
+{
+	struct client_dict_cmd *cmd;
+	unsigned int count = 0;
+
+	array_foreach_elem(&dict->conn->cmds, cmd) {
+		if (cmd->dict == dict)
+			count++;
+	}
+	return count;
+}
+
+static void client_dict_input_timeout(struct dict_client_connection *conn)
 {
 	struct client_dict_cmd *cmd;
 	const char *error;
@@ -226,7 +293,7 @@ static void client_dict_input_timeout(struct client_dict *dict)
 	int cmd_diff;
 
 	/* find the first non-background command. there must be at least one. */
-	cmd = client_dict_cmd_first_nonbg(dict);
+	cmd = client_dict_cmd_first_nonbg(conn);
 	i_assert(cmd != NULL);
 
 	cmd_diff = timeval_diff_msecs(&ioloop_timeval, &cmd->start_time);
@@ -234,10 +301,10 @@ static void client_dict_input_timeout(struct client_dict *dict)
 		/* need to re-create this timeout. the currently-oldest
 		   command was added when another command was still
 		   running with an older timeout. */
-		timeout_remove(&dict->to_requests);
-		dict->to_requests =
+		timeout_remove(&conn->to_requests);
+		conn->to_requests =
 			timeout_add(DICT_CLIENT_REQUEST_TIMEOUT_MSECS - cmd_diff,
-				    client_dict_input_timeout, dict);
+				    client_dict_input_timeout, conn);
 		return;
 	}
 
@@ -245,28 +312,29 @@ static void client_dict_input_timeout(struct client_dict *dict)
 	   or locks, make sure there's a bit of time waiting for the dict
 	   ioloop as well. There's a good chance that the reply can be read. */
 	msecs_in_last_dict_ioloop_wait =
-		(io_wait_timer_get_usecs(dict->wait_timer) -
-		 dict->last_timer_switch_usecs + 999) / 1000;
+		(io_wait_timer_get_usecs(cmd->dict->wait_timer) -
+		 cmd->dict->last_timer_switch_usecs + 999) / 1000;
 	if (msecs_in_last_dict_ioloop_wait < DICT_CLIENT_REQUEST_TIMEOUT_MIN_LAST_IOLOOP_WAIT_MSECS) {
-		timeout_remove(&dict->to_requests);
-		dict->to_requests =
+		timeout_remove(&conn->to_requests);
+		conn->to_requests =
 			timeout_add(DICT_CLIENT_REQUEST_TIMEOUT_MIN_LAST_IOLOOP_WAIT_MSECS -
 				    msecs_in_last_dict_ioloop_wait,
-				    client_dict_input_timeout, dict);
+				    client_dict_input_timeout, conn);
 		return;
 	}
 
-	(void)client_dict_reconnect(dict, t_strdup_printf(
+	(void)client_dict_reconnect(conn, t_strdup_printf(
 		"Dict server timeout: %s "
 		"(%u commands pending, oldest sent %u.%03u secs ago: %s, %s)",
-		connection_input_timeout_reason(&dict->conn.conn),
-		array_count(&dict->cmds),
+		connection_input_timeout_reason(&conn->conn),
+		array_count(&conn->cmds),
 		cmd_diff/1000, cmd_diff%1000, cmd->query,
 		dict_wait_warnings(cmd)), &error);
 }
 
 static int
-client_dict_cmd_query_send(struct client_dict *dict, const char *query)
+client_dict_cmd_query_send(struct dict_client_connection *conn,
+			   const char *query)
 {
 	struct const_iovec iov[2];
 	ssize_t ret;
@@ -275,7 +343,7 @@ client_dict_cmd_query_send(struct client_dict *dict, const char *query)
 	iov[0].iov_len = strlen(query);
 	iov[1].iov_base = "\n";
 	iov[1].iov_len = 1;
-	ret = o_stream_sendv(dict->conn.conn.output, iov, 2);
+	ret = o_stream_sendv(conn->conn.output, iov, 2);
 	if (ret < 0)
 		return -1;
 	i_assert((size_t)ret == iov[0].iov_len + 1);
@@ -286,6 +354,7 @@ static bool
 client_dict_cmd_send(struct client_dict *dict, struct client_dict_cmd **_cmd,
 		     const char **error_r)
 {
+	struct dict_client_connection *conn = dict->conn;
 	struct client_dict_cmd *cmd = *_cmd;
 	const char *error = NULL;
 	bool retry = cmd->retry_errors;
@@ -295,25 +364,25 @@ client_dict_cmd_send(struct client_dict *dict, struct client_dict_cmd **_cmd,
 
 	/* we're no longer idling. even with no_replies=TRUE we're going to
 	   wait for COMMIT/ROLLBACK. */
-	timeout_remove(&dict->to_idle);
+	timeout_remove(&conn->to_idle);
 
-	if (client_dict_connect(dict, &error) < 0) {
+	if (client_dict_connect(conn, &error) < 0) {
 		retry = FALSE;
 		ret = -1;
 	} else {
-		ret = client_dict_cmd_query_send(dict, cmd->query);
+		ret = client_dict_cmd_query_send(conn, cmd->query);
 		if (ret < 0) {
-			error = t_strdup_printf("write(%s) failed: %s", dict->conn.conn.name,
-					o_stream_get_error(dict->conn.conn.output));
+			error = t_strdup_printf("write(%s) failed: %s", conn->conn.name,
+					o_stream_get_error(conn->conn.output));
 		}
 	}
 	if (ret < 0 && retry) {
 		/* Reconnect and try again. */
-		if (client_dict_reconnect(dict, error, &error) < 0)
+		if (client_dict_reconnect(conn, error, &error) < 0)
 			;
-		else if (client_dict_cmd_query_send(dict, cmd->query) < 0) {
-			error = t_strdup_printf("write(%s) failed: %s", dict->conn.conn.name,
-				o_stream_get_error(dict->conn.conn.output));
+		else if (client_dict_cmd_query_send(conn, cmd->query) < 0) {
+			error = t_strdup_printf("write(%s) failed: %s", conn->conn.name,
+				o_stream_get_error(conn->conn.output));
 		} else {
 			ret = 0;
 		}
@@ -332,12 +401,12 @@ client_dict_cmd_send(struct client_dict *dict, struct client_dict_cmd **_cmd,
 			*error_r = error;
 		return FALSE;
 	} else {
-		if (dict->to_requests == NULL && !cmd->background) {
-			dict->to_requests =
+		if (conn->to_requests == NULL && !cmd->background) {
+			conn->to_requests =
 				timeout_add(DICT_CLIENT_REQUEST_TIMEOUT_MSECS,
-					    client_dict_input_timeout, dict);
+					    client_dict_input_timeout, conn);
 		}
-		array_push_back(&dict->cmds, &cmd);
+		array_push_back(&conn->cmds, &cmd);
 		return TRUE;
 	}
 }
@@ -395,56 +464,77 @@ client_dict_send_transaction_query(struct client_dict_transaction_context *ctx,
 		ctx->error = i_strdup(error);
 }
 
-static bool client_dict_is_finished(struct client_dict *dict)
+static bool client_dict_is_finished(struct dict_client_connection *conn)
 {
-	return dict->transactions == NULL && array_count(&dict->cmds) == 0;
+	struct client_dict *dict;
+
+	if (array_count(&conn->cmds) > 0)
+		return FALSE;
+	for (dict = conn->dicts; dict != NULL; dict = dict->next) {
+		if (dict->transactions != NULL)
+			return FALSE;
+	}
+	return TRUE;
 }
 
-static void client_dict_timeout(struct client_dict *dict)
+static bool
+client_dict_have_transactions(struct dict_client_connection *conn)
 {
-	if (client_dict_is_finished(dict))
-		client_dict_disconnect(dict, "Idle disconnection");
+	struct client_dict *dict;
+
+	for (dict = conn->dicts; dict != NULL; dict = dict->next) {
+		if (dict->transactions != NULL)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void client_dict_timeout(struct dict_client_connection *conn)
+{
+	if (client_dict_is_finished(conn))
+		client_dict_disconnect(conn, "Idle disconnection");
 	else
-		timeout_remove(&dict->to_idle);
+		timeout_remove(&conn->to_idle);
 }
 
-static bool client_dict_have_nonbackground_cmds(struct client_dict *dict)
+static bool
+client_dict_have_nonbackground_cmds(struct dict_client_connection *conn)
 {
 	struct client_dict_cmd *cmd;
 
-	array_foreach_elem(&dict->cmds, cmd) {
+	array_foreach_elem(&conn->cmds, cmd) {
 		if (!cmd->background)
 			return TRUE;
 	}
 	return FALSE;
 }
 
-static void client_dict_add_timeout(struct client_dict *dict)
+static void client_dict_add_timeout(struct dict_client_connection *conn)
 {
-	if (dict->to_idle != NULL) {
-		if (dict->idle_msecs > 0)
-			timeout_reset(dict->to_idle);
-	} else if (client_dict_is_finished(dict)) {
-		dict->to_idle = timeout_add(dict->idle_msecs,
-					    client_dict_timeout, dict);
-		timeout_remove(&dict->to_requests);
-	} else if (dict->transactions == NULL &&
-		   !client_dict_have_nonbackground_cmds(dict)) {
+	if (conn->to_idle != NULL) {
+		if (conn->idle_msecs > 0)
+			timeout_reset(conn->to_idle);
+	} else if (client_dict_is_finished(conn)) {
+		conn->to_idle = timeout_add(conn->idle_msecs,
+					    client_dict_timeout, conn);
+		timeout_remove(&conn->to_requests);
+	} else if (!client_dict_have_transactions(conn) &&
+		   !client_dict_have_nonbackground_cmds(conn)) {
 		/* we had non-background commands, but now we're back to
 		   having only background commands. remove timeouts. */
-		timeout_remove(&dict->to_requests);
+		timeout_remove(&conn->to_requests);
 	}
 }
 
-static void client_dict_cmd_backgrounded(struct client_dict *dict)
+static void client_dict_cmd_backgrounded(struct dict_client_connection *conn)
 {
-	if (dict->to_requests == NULL)
+	if (conn->to_requests == NULL)
 		return;
 
-	if (!client_dict_have_nonbackground_cmds(dict)) {
+	if (!client_dict_have_nonbackground_cmds(conn)) {
 		/* we only have background-commands.
 		   remove the request timeout. */
-		timeout_remove(&dict->to_requests);
+		timeout_remove(&conn->to_requests);
 	}
 }
 
@@ -462,7 +552,7 @@ dict_conn_assign_next_async_id(struct dict_client_connection *conn,
 			line);
 		return -1;
 	}
-	cmds = array_get(&conn->dict->cmds, &count);
+	cmds = array_get(&conn->cmds, &count);
 	for (i = 0; i < count; i++) {
 		if (cmds[i]->async_id == 0) {
 			cmds[i]->async_id = async_id;
@@ -491,7 +581,7 @@ static int dict_conn_find_async_id(struct dict_client_connection *conn,
 		return -1;
 	}
 
-	cmds = array_get(&conn->dict->cmds, &count);
+	cmds = array_get(&conn->cmds, &count);
 	for (i = 0; i < count; i++) {
 		if (cmds[i]->async_id == async_id) {
 			*idx_r = i;
@@ -503,23 +593,45 @@ static int dict_conn_find_async_id(struct dict_client_connection *conn,
 	return -1;
 }
 
+static void client_dict_free(struct client_dict *dict)
+{
+	struct ioloop *old_ioloop = current_ioloop;
+
+	io_wait_timer_remove(&dict->wait_timer);
+	io_loop_set_current(dict->dict.ioloop);
+	io_loop_destroy(&dict->dict.ioloop);
+	io_loop_set_current(old_ioloop);
+	i_free(dict);
+}
+
+static void
+client_dict_free_deinitialized(struct dict_client_connection *conn)
+{
+	struct client_dict *dict;
+
+	while (conn->deinit_dicts != NULL) {
+		dict = conn->deinit_dicts;
+		DLLIST_REMOVE(&conn->deinit_dicts, dict);
+		client_dict_free(dict);
+	}
+}
+
 static int dict_conn_input_line(struct connection *_conn, const char *line)
 {
 	struct dict_client_connection *conn =
 		(struct dict_client_connection *)_conn;
-	struct client_dict *dict = conn->dict;
-	struct client_dict_cmd *const *cmds;
+	struct client_dict_cmd *const *cmds, *cmd;
 	const char *const *args;
 	unsigned int i, count;
 	bool finished;
 
-	if (dict->to_requests != NULL)
-		timeout_reset(dict->to_requests);
+	if (conn->to_requests != NULL)
+		timeout_reset(conn->to_requests);
 
 	if (line[0] == DICT_PROTOCOL_REPLY_ASYNC_ID)
 		return dict_conn_assign_next_async_id(conn, line) < 0 ? -1 : 1;
 
-	cmds = array_get(&conn->dict->cmds, &count);
+	cmds = array_get(&conn->cmds, &count);
 	if (count == 0) {
 		e_error(conn->conn.event, "Received reply without pending commands: %s",
 			line);
@@ -536,9 +648,10 @@ static int dict_conn_input_line(struct connection *_conn, const char *line)
 	}
 	i_assert(!cmds[i]->no_replies);
 
-	client_dict_cmd_ref(cmds[i]);
-	finished = dict_cmd_callback_line(cmds[i], args);
-	if (!client_dict_cmd_unref(cmds[i])) {
+	cmd = cmds[i];
+	client_dict_cmd_ref(cmd);
+	finished = dict_cmd_callback_line(cmd, args);
+	if (!client_dict_cmd_unref(cmd)) {
 		/* disconnected during command handling */
 		return -1;
 	}
@@ -546,36 +659,47 @@ static int dict_conn_input_line(struct connection *_conn, const char *line)
 		/* more lines needed for this command */
 		return 1;
 	}
-	client_dict_cmd_unref(cmds[i]);
-	array_delete(&dict->cmds, i, 1);
+	/* the callback may have handled other replies, so the command's
+	   position may have changed */
+	cmds = array_get(&conn->cmds, &count);
+	for (i = 0; i < count; i++) {
+		if (cmds[i] == cmd)
+			break;
+	}
+	i_assert(i < count);
+	client_dict_cmd_unref(cmd);
+	array_delete(&conn->cmds, i, 1);
 
-	client_dict_add_timeout(dict);
+	if (array_count(&conn->cmds) == 0)
+		client_dict_free_deinitialized(conn);
+	client_dict_add_timeout(conn);
 	return 1;
 }
 
-static int client_dict_connect(struct client_dict *dict, const char **error_r)
+static int
+client_dict_connect(struct dict_client_connection *conn, const char **error_r)
 {
 	const char *query, *error;
 
-	if (dict->conn.conn.fd_in != -1)
+	if (conn->conn.fd_in != -1)
 		return 0;
-	if (dict->last_failed_connect == ioloop_time) {
+	if (conn->last_failed_connect == ioloop_time) {
 		/* Try again later */
-		*error_r = dict->last_connect_error;
+		*error_r = conn->last_connect_error;
 		return -1;
 	}
 
-	if (connection_client_connect(&dict->conn.conn) < 0) {
-		dict->last_failed_connect = ioloop_time;
+	if (connection_client_connect(&conn->conn) < 0) {
+		conn->last_failed_connect = ioloop_time;
 		if (errno == EACCES) {
 			error = eacces_error_get("net_connect_unix",
-						 dict->conn.conn.name);
+						 conn->conn.name);
 		} else {
 			error = t_strdup_printf(
-				"net_connect_unix(%s) failed: %m", dict->conn.conn.name);
+				"net_connect_unix(%s) failed: %m", conn->conn.name);
 		}
-		i_free(dict->last_connect_error);
-		dict->last_connect_error = i_strdup(error);
+		i_free(conn->last_connect_error);
+		conn->last_connect_error = i_strdup(error);
 		*error_r = error;
 		return -1;
 	}
@@ -584,24 +708,25 @@ static int client_dict_connect(struct client_dict *dict, const char **error_r)
 				DICT_PROTOCOL_CMD_HELLO,
 				DICT_CLIENT_PROTOCOL_MAJOR_VERSION,
 				DICT_CLIENT_PROTOCOL_MINOR_VERSION,
-				dict->value_type,
+				conn->value_type,
 				"",
-				str_tabescape(dict->uri));
-	o_stream_nsend_str(dict->conn.conn.output, query);
-	client_dict_add_timeout(dict);
+				str_tabescape(conn->uri));
+	o_stream_nsend_str(conn->conn.output, query);
+	client_dict_add_timeout(conn);
 	return 0;
 }
 
 static void
-client_dict_abort_commands(struct client_dict *dict, const char *reason)
+client_dict_abort_commands(struct dict_client_connection *conn,
+			   const char *reason)
 {
 	ARRAY(struct client_dict_cmd *) cmds_copy;
 	struct client_dict_cmd *cmd;
 
 	/* abort all commands */
-	t_array_init(&cmds_copy, array_count(&dict->cmds));
-	array_append_array(&cmds_copy, &dict->cmds);
-	array_clear(&dict->cmds);
+	t_array_init(&cmds_copy, array_count(&conn->cmds));
+	array_append_array(&cmds_copy, &conn->cmds);
+	array_clear(&conn->cmds);
 
 	array_foreach_elem(&cmds_copy, cmd) {
 		dict_cmd_callback_error(cmd, reason, TRUE);
@@ -609,35 +734,40 @@ client_dict_abort_commands(struct client_dict *dict, const char *reason)
 	}
 }
 
-static void client_dict_disconnect(struct client_dict *dict, const char *reason)
+static void
+client_dict_disconnect(struct dict_client_connection *conn, const char *reason)
 {
 	struct client_dict_transaction_context *ctx, *next;
+	struct client_dict *dict;
 
-	client_dict_abort_commands(dict, reason);
+	client_dict_abort_commands(conn, reason);
 
 	/* all transactions that have sent BEGIN are no longer valid */
-	for (ctx = dict->transactions; ctx != NULL; ctx = next) {
-		next = ctx->next;
-		if (ctx->sent_begin && ctx->error == NULL)
-			ctx->error = i_strdup(reason);
+	for (dict = conn->dicts; dict != NULL; dict = dict->next) {
+		for (ctx = dict->transactions; ctx != NULL; ctx = next) {
+			next = ctx->next;
+			if (ctx->sent_begin && ctx->error == NULL)
+				ctx->error = i_strdup(reason);
+		}
 	}
 
-	timeout_remove(&dict->to_idle);
-	timeout_remove(&dict->to_requests);
-	connection_disconnect(&dict->conn.conn);
+	timeout_remove(&conn->to_idle);
+	timeout_remove(&conn->to_requests);
+	connection_disconnect(&conn->conn);
 }
 
-static int client_dict_reconnect(struct client_dict *dict, const char *reason,
-				 const char **error_r)
+static int
+client_dict_reconnect(struct dict_client_connection *conn, const char *reason,
+		      const char **error_r)
 {
 	ARRAY(struct client_dict_cmd *) retry_cmds;
 	struct client_dict_cmd *cmd;
 	const char *error;
 	int ret;
 
-	t_array_init(&retry_cmds, array_count(&dict->cmds));
-	for (unsigned int i = 0; i < array_count(&dict->cmds); ) {
-		cmd = array_idx_elem(&dict->cmds, i);
+	t_array_init(&retry_cmds, array_count(&conn->cmds));
+	for (unsigned int i = 0; i < array_count(&conn->cmds); ) {
+		cmd = array_idx_elem(&conn->cmds, i);
 		if (!cmd->retry_errors) {
 			i++;
 		} else if (cmd->iter != NULL &&
@@ -648,11 +778,11 @@ static int client_dict_reconnect(struct client_dict *dict, const char *reason,
 			i++;
 		} else {
 			array_push_back(&retry_cmds, &cmd);
-			array_delete(&dict->cmds, i, 1);
+			array_delete(&conn->cmds, i, 1);
 		}
 	}
-	client_dict_disconnect(dict, reason);
-	if (client_dict_connect(dict, error_r) < 0) {
+	client_dict_disconnect(conn, reason);
+	if (client_dict_connect(conn, error_r) < 0) {
 		reason = t_strdup_printf("%s - reconnect failed: %s",
 					 reason, *error_r);
 		array_foreach_elem(&retry_cmds, cmd) {
@@ -663,7 +793,7 @@ static int client_dict_reconnect(struct client_dict *dict, const char *reason,
 	}
 	if (array_count(&retry_cmds) == 0)
 		return 0;
-	e_warning(dict->conn.conn.event, "%s - reconnected", reason);
+	e_warning(conn->conn.event, "%s - reconnected", reason);
 
 	ret = 0; error = "";
 	array_foreach_elem(&retry_cmds, cmd) {
@@ -674,7 +804,7 @@ static int client_dict_reconnect(struct client_dict *dict, const char *reason,
 		if (ret < 0) {
 			dict_cmd_callback_error(cmd, error, TRUE);
 			client_dict_cmd_unref(cmd);
-		} else if (!client_dict_cmd_send(dict, &cmd, &error))
+		} else if (!client_dict_cmd_send(cmd->dict, &cmd, &error))
 			ret = -1;
 	}
 	return ret;
@@ -685,7 +815,7 @@ static void dict_conn_destroy(struct connection *_conn)
 	struct dict_client_connection *conn =
 		(struct dict_client_connection *)_conn;
 
-	client_dict_disconnect(conn->dict, connection_disconnect_reason(_conn));
+	client_dict_disconnect(conn, connection_disconnect_reason(_conn));
 }
 
 static const struct connection_settings dict_conn_set = {
@@ -700,6 +830,85 @@ static const struct connection_vfuncs dict_conn_vfuncs = {
 	.input_line = dict_conn_input_line
 };
 
+static struct dict_client_connection *
+dict_client_connection_find_shared(const char *path, const char *uri)
+{
+	struct connection *_conn;
+	struct dict_client_connection *conn;
+
+	for (_conn = dict_connections->connections; _conn != NULL;
+	     _conn = _conn->next) {
+		conn = (struct dict_client_connection *)_conn;
+		if (conn->shared && strcmp(conn->conn.name, path) == 0 &&
+		    strcmp(conn->uri, uri) == 0)
+			return conn;
+	}
+	return NULL;
+}
+
+static struct dict_client_connection *
+dict_client_connection_get(const char *path, const char *uri, bool shared,
+			   unsigned int idle_msecs,
+			   const struct dict_settings *set)
+{
+	struct dict_client_connection *conn;
+
+	if (shared) {
+		conn = dict_client_connection_find_shared(path, uri);
+		if (conn != NULL) {
+			conn->refcount++;
+			/* use the longest idle timeout any of the dicts want */
+			conn->idle_msecs = I_MAX(conn->idle_msecs, idle_msecs);
+			return conn;
+		}
+	}
+
+	conn = i_new(struct dict_client_connection, 1);
+	conn->refcount = 1;
+	conn->shared = shared;
+	conn->idle_msecs = idle_msecs;
+	/* a shared connection isn't specific to any user, so don't inherit
+	   the first dict's event */
+	if (!shared)
+		conn->conn.event_parent = set->event_parent;
+	i_array_init(&conn->cmds, 32);
+	connection_init_client_unix(dict_connections, &conn->conn, path);
+	conn->uri = i_strdup(uri);
+	return conn;
+}
+
+static void dict_client_connection_unref(struct dict_client_connection **_conn)
+{
+	struct dict_client_connection *conn = *_conn;
+
+	*_conn = NULL;
+	i_assert(conn->refcount > 0);
+	if (--conn->refcount > 0)
+		return;
+
+	client_dict_disconnect(conn, "Deinit");
+	connection_deinit(&conn->conn);
+	client_dict_free_deinitialized(conn);
+
+	i_assert(conn->dicts == NULL);
+	i_assert(array_count(&conn->cmds) == 0);
+
+	array_free(&conn->cmds);
+	i_free(conn->last_connect_error);
+	i_free(conn->uri);
+	i_free(conn);
+}
+
+static void
+dict_client_connection_switch_ioloop(struct dict_client_connection *conn)
+{
+	if (conn->to_idle != NULL)
+		conn->to_idle = io_loop_move_timeout(&conn->to_idle);
+	if (conn->to_requests != NULL)
+		conn->to_requests = io_loop_move_timeout(&conn->to_requests);
+	connection_switch_ioloop(&conn->conn);
+}
+
 static int
 client_dict_init(struct dict *driver, const char *uri,
 		 const struct dict_settings *set,
@@ -710,8 +919,10 @@ client_dict_init(struct dict *driver, const char *uri,
 	const char *p, *dest_uri, *path;
 	unsigned int idle_msecs = DICT_CLIENT_DEFAULT_TIMEOUT_MSECS;
 	unsigned int warn_slow_msecs = DICT_CLIENT_DEFAULT_WARN_SLOW_MSECS;
+	bool shared = FALSE;
 
-	/* uri = [idle_msecs=<n>:] [warn_slow_msecs=<n>:] [<path>] ":" <uri> */
+	/* uri = [idle_msecs=<n>:] [warn_slow_msecs=<n>:] [shared=yes|no:]
+	         [<path>] ":" <uri> */
 	for (;;) {
 		if (str_begins(uri, "idle_msecs=")) {
 			p = strchr(uri+11, ':');
@@ -735,6 +946,22 @@ client_dict_init(struct dict *driver, const char *uri,
 				return -1;
 			}
 			uri = p+1;
+		} else if (str_begins(uri, "shared=")) {
+			p = strchr(uri+7, ':');
+			if (p == NULL) {
+				*error_r = t_strdup_printf("Invalid URI: %s", uri);
+				return -1;
+			}
+			const char *value = t_strdup_until(uri+7, p);
+			if (strcmp(value, "yes") == 0)
+				shared = TRUE;
+			else if (strcmp(value, "no") == 0)
+				shared = FALSE;
+			else {
+				*error_r = "Invalid shared";
+				return -1;
+			}
+			uri = p+1;
 		} else {
 			break;
 		}
@@ -750,14 +977,6 @@ client_dict_init(struct dict *driver, const char *uri,
 							&dict_conn_vfuncs);
 	}
 
-	dict = i_new(struct client_dict, 1);
-	dict->dict = *driver;
-	dict->conn.dict = dict;
-	dict->conn.conn.event_parent = set->event_parent;
-	dict->idle_msecs = idle_msecs;
-	dict->warn_slow_msecs = warn_slow_msecs;
-	i_array_init(&dict->cmds, 32);
-
 	if (uri[0] == ':') {
 		/* default path */
 		path = t_strconcat(set->base_dir,
@@ -770,8 +989,13 @@ client_dict_init(struct dict *driver, const char *uri,
 		path = t_strconcat(set->base_dir, "/",
 			t_strdup_until(uri, dest_uri), NULL);
 	}
-	connection_init_client_unix(dict_connections, &dict->conn.conn, path);
-	dict->uri = i_strdup(dest_uri + 1);
+
+	dict = i_new(struct client_dict, 1);
+	dict->dict = *driver;
+	dict->warn_slow_msecs = warn_slow_msecs;
+	dict->conn = dict_client_connection_get(path, dest_uri + 1, shared,
+						idle_msecs, set);
+	DLLIST_PREPEND(&dict->conn->dicts, dict);
 
 	dict->dict.ioloop = io_loop_create();
 	dict->wait_timer = io_wait_timer_add();
@@ -783,23 +1007,21 @@ client_dict_init(struct dict *driver, const char *uri,
 static void client_dict_deinit(struct dict *_dict)
 {
 	struct client_dict *dict = (struct client_dict *)_dict;
-	struct ioloop *old_ioloop = current_ioloop;
-
-	client_dict_disconnect(dict, "Deinit");
-	connection_deinit(&dict->conn.conn);
-	io_wait_timer_remove(&dict->wait_timer);
+	struct dict_client_connection *conn = dict->conn;
 
 	i_assert(dict->transactions == NULL);
-	i_assert(array_count(&dict->cmds) == 0);
-
-	io_loop_set_current(dict->dict.ioloop);
-	io_loop_destroy(&dict->dict.ioloop);
-	io_loop_set_current(old_ioloop);
 
-	array_free(&dict->cmds);
-	i_free(dict->last_connect_error);
-	i_free(dict->uri);
-	i_free(dict);
+	DLLIST_REMOVE(&conn->dicts, dict);
+	if (conn->refcount > 1 && client_dict_cmds_count(dict) > 0) {
+		/* Other dicts are still using the shared connection. Let our
+		   remaining background commands finish and free the dict
+		   only after that. */
+		DLLIST_PREPEND(&conn->deinit_dicts, dict);
+		dict_client_connection_unref(&conn);
+		return;
+	}
+	dict_client_connection_unref(&conn);
+	client_dict_free(dict);
 
 	if (dict_connections->connections == NULL)
 		connection_list_deinit(&dict_connections);
@@ -808,19 +1030,26 @@ static void client_dict_deinit(struct dict *_dict)
 static void client_dict_wait(struct dict *_dict)
 {
 	struct client_dict *dict = (struct client_dict *)_dict;
+	struct dict_client_connection *conn = dict->conn;
+	struct client_dict *prev_waiting_dict;
 
-	if (array_count(&dict->cmds) == 0)
+	if (client_dict_cmds_count(dict) == 0)
 		return;
 
 	i_assert(io_loop_is_empty(dict->dict.ioloop));
 	dict->dict.prev_ioloop = current_ioloop;
+	prev_waiting_dict = conn->waiting_dict;
+	conn->waiting_dict = dict;
 	io_loop_set_current(dict->dict.ioloop);
 	dict_switch_ioloop(_dict);
-	while (array_count(&dict->cmds) > 0)
+	/* with a shared connection, replies to the other dicts' commands
+	   are handled here as well, but we only wait for our own ones */
+	while (client_dict_cmds_count(dict) > 0)
 		io_loop_run(dict->dict.ioloop);
 
 	io_loop_set_current(dict->dict.prev_ioloop);
 	dict->dict.prev_ioloop = NULL;
+	conn->waiting_dict = prev_waiting_dict;
 
 	dict_switch_ioloop(_dict);
 	i_assert(io_loop_is_empty(dict->dict.ioloop));
@@ -833,12 +1062,8 @@ static bool client_dict_switch_ioloop(struct dict *_dict)
 	dict->last_timer_switch_usecs =
 		io_wait_timer_get_usecs(dict->wait_timer);
 	dict->wait_timer = io_wait_timer_move(&dict->wait_timer);
-	if (dict->to_idle != NULL)
-		dict->to_idle = io_loop_move_timeout(&dict->to_idle);
-	if (dict->to_requests != NULL)
-		dict->to_requests = io_loop_move_timeout(&dict->to_requests);
-	connection_switch_ioloop(&dict->conn.conn);
-	return array_count(&dict->cmds) > 0;
+	dict_client_connection_switch_ioloop(dict->conn);
+	return client_dict_cmds_count(dict) > 0;
 }
 
 static const char *dict_wait_warnings(const struct client_dict_cmd *cmd)
@@ -871,7 +1096,7 @@ dict_warnings_sec(const struct client_dict_cmd *cmd, int msecs,
 	if (cmd->reconnected) {
 		int reconnected_msecs =
 			timeval_diff_msecs(&ioloop_timeval,
-				&cmd->dict->conn.conn.connect_started);
+				&cmd->dict->conn->conn.connect_started);
 		str_printfa(str, ", reconnected %u.%03u secs ago",
 			    reconnected_msecs/1000, reconnected_msecs%1000);
 	}
@@ -943,7 +1168,7 @@ client_dict_lookup_async_callback(struct client_dict_cmd *cmd,
 		result.error = t_strdup_printf(
 			"dict-client: Invalid lookup '%s' reply: %c%s",
 			cmd->query, reply, value);
-		client_dict_disconnect(dict, result.error);
+		client_dict_disconnect(dict->conn, result.error);
 		result.ret = -1;
 		break;
 	}
@@ -955,7 +1180,7 @@ client_dict_lookup_async_callback(struct client_dict_cmd *cmd,
 			result.error, dict_warnings_sec(cmd, diff, extra_args));
 	} else if (!cmd->background &&
 		   diff >= (int)dict->warn_slow_msecs) {
-		e_warning(dict->conn.conn.event, "dict lookup took %s: %s",
+		e_warning(dict->conn->conn.event, "dict lookup took %s: %s",
 			  dict_warnings_sec(cmd, diff, extra_args),
 			  cmd->query);
 	}
@@ -1033,6 +1258,176 @@ static int client_dict_lookup(struct dict *_dict,
 	i_unreached();
 }
 
+static int
+client_dict_parse_lookup_multi_reply(const char *value, unsigned int count,
+				     const char *const **values_r)
+{
+	const char **values;
+	const char *const *args;
+	unsigned int i;
+	int ret = 0;
+
+	args = t_strsplit_tabescaped(value);
+	if (str_array_length(args) != count)
+		return -1;
+
+	values = t_new(const char *, count + 1);
+	for (i = 0; i < count; i++) {
+		switch (args[i][0]) {
+		case DICT_PROTOCOL_REPLY_OK:
+			values[i] = args[i] + 1;
+			ret = 1;
+			break;
+		case DICT_PROTOCOL_REPLY_NOTFOUND:
+			if (args[i][1] != '\0')
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+	}
+	*values_r = values;
+	return ret;
+}
+
+static void
+client_dict_lookup_multi_async_callback(struct client_dict_cmd *cmd,
+					enum dict_protocol_reply reply,
+					const char *value,
+					const char *const *extra_args,
+					const char *error,
+					bool disconnected ATTR_UNUSED)
+{
+	struct client_dict *dict = cmd->dict;
+	struct dict_lookup_multi_result result;
+
+	i_zero(&result);
+	if (error != NULL) {
+		result.ret = -1;
+		result.error = error;
+	} else switch (reply) {
+	case DICT_PROTOCOL_REPLY_OK:
+		result.ret = client_dict_parse_lookup_multi_reply(value,
+			cmd->lookup_keys_count, &result.values);
+		if (result.ret >= 0) {
+			result.values_count = cmd->lookup_keys_count;
+			break;
+		}
+		/* fall through */
+	default:
+		result.error = t_strdup_printf(
+			"dict-client: Invalid lookup '%s' reply: %c%s",
+			cmd->query, reply, value);
+		client_dict_disconnect(dict->conn, result.error);
+		result.ret = -1;
+		break;
+	case DICT_PROTOCOL_REPLY_FAIL:
+		result.error = value[0] == '\0' ? "dict-server returned failure" :
+			t_strdup_printf("dict-server returned failure: %s",
+			value);
+		result.ret = -1;
+		break;
+	}
+
+	int diff = timeval_diff_msecs(&ioloop_timeval, &cmd->start_time);
+	if (result.error != NULL) {
+		/* include timing info always in error messages */
+		result.error = t_strdup_printf("%s (reply took %s)",
+			result.error, dict_warnings_sec(cmd, diff, extra_args));
+	} else if (!cmd->background &&
+		   diff >= (int)dict->warn_slow_msecs) {
+		e_warning(dict->conn->conn.event, "dict lookup took %s: %s",
+			  dict_warnings_sec(cmd, diff, extra_args),
+			  cmd->query);
+	}
+
+	dict_pre_api_callback(&dict->dict);
+	cmd->api_callback.lookup_multi(&result, cmd->api_callback.context);
+	dict_post_api_callback(&dict->dict);
+}
+
+static void
+client_dict_lookup_multi_async(struct dict *_dict,
+			       const struct dict_op_settings *set,
+			       const char *const *keys,
+			       dict_lookup_multi_callback_t *callback,
+			       void *context)
+{
+	struct client_dict *dict = (struct client_dict *)_dict;
+	struct client_dict_cmd *cmd;
+	string_t *query = t_str_new(128);
+
+	str_append_c(query, DICT_PROTOCOL_CMD_LOOKUP_MULTI);
+	if (set->username != NULL)
+		str_append_tabescaped(query, set->username);
+	for (unsigned int i = 0; keys[i] != NULL; i++) {
+		str_append_c(query, '\t');
+		str_append_tabescaped(query, keys[i]);
+	}
+	cmd = client_dict_cmd_init(dict, str_c(query));
+	cmd->callback = client_dict_lookup_multi_async_callback;
+	cmd->lookup_keys_count = str_array_length(keys);
+	cmd->api_callback.lookup_multi = callback;
+	cmd->api_callback.context = context;
+	cmd->retry_errors = TRUE;
+
+	client_dict_cmd_send(dict, &cmd, NULL);
+}
+
+struct client_dict_sync_lookup_multi {
+	char *error;
+	ARRAY(char *) values;
+	int ret;
+};
+
+static void
+client_dict_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+				  struct client_dict_sync_lookup_multi *lookup)
+{
+	lookup->ret = result->ret;
+	if (result->ret == -1) {
+		lookup->error = i_strdup(result->error);
+		return;
+	}
+	i_array_init(&lookup->values, result->values_count);
+	for (unsigned int i = 0; i < result->values_count; i++) {
+		char *value = i_strdup(result->values[i]);
+		array_push_back(&lookup->values, &value);
+	}
+}
+
+static int client_dict_lookup_multi(struct dict *_dict,
+				    const struct dict_op_settings *set,
+				    pool_t pool, const char *const *keys,
+				    const char **values, const char **error_r)
+{
+	struct client_dict_sync_lookup_multi lookup;
+	char **lookup_values;
+	unsigned int i, count;
+
+	i_zero(&lookup);
+	lookup.ret = -2;
+
+	dict_lookup_multi_async(_dict, set, keys,
+				client_dict_lookup_multi_callback, &lookup);
+	if (lookup.ret == -2)
+		client_dict_wait(_dict);
+
+	if (lookup.ret == -1) {
+		*error_r = t_strdup(lookup.error);
+		i_free(lookup.error);
+		return -1;
+	}
+	i_assert(lookup.ret >= 0);
+	lookup_values = array_get_modifiable(&lookup.values, &count);
+	for (i = 0; i < count; i++) {
+		values[i] = p_strdup(pool, lookup_values[i]);
+		i_free(lookup_values[i]);
+	}
+	array_free(&lookup.values);
+	return lookup.ret;
+}
+
 static void client_dict_iterate_unref(struct client_dict_iterate_context *ctx)
 {
 	i_assert(ctx->refcount > 0);
@@ -1065,7 +1460,7 @@ client_dict_iter_api_callback(struct client_dict_iterate_context *ctx,
 			ctx->error = new_error;
 		} else if (!cmd->background &&
 			   diff >= (int)dict->warn_slow_msecs) {
-			e_warning(dict->conn.conn.event, "dict iteration took %s: %s",
+			e_warning(dict->conn->conn.event, "dict iteration took %s: %s",
 				  dict_warnings_sec(cmd, diff, extra_args),
 				  cmd->query);
 		}
@@ -1095,7 +1490,7 @@ client_dict_iter_async_callback(struct client_dict_cmd *cmd,
 
 	if (ctx->deinit) {
 		cmd->background = TRUE;
-		client_dict_cmd_backgrounded(dict);
+		client_dict_cmd_backgrounded(dict->conn);
 	}
 
 	if (error != NULL) {
@@ -1123,8 +1518,8 @@ client_dict_iter_async_callback(struct client_dict_cmd *cmd,
 	if ((iter_values == NULL || iter_values[0] == NULL) && error == NULL) {
 		/* broken protocol */
 		error = t_strdup_printf("dict client (%s) sent broken iterate reply: %c%s",
-			dict->conn.conn.name, reply, value);
-		client_dict_disconnect(dict, error);
+			dict->conn->conn.name, reply, value);
+		client_dict_disconnect(dict->conn, error);
 	}
 
 	if (error != NULL) {
@@ -1249,7 +1644,7 @@ static int client_dict_iterate_deinit(struct dict_iterate_context *_ctx,
 	i_free(ctx->path);
 	client_dict_iterate_unref(ctx);
 
-	client_dict_add_timeout(dict);
+	client_dict_add_timeout(dict->conn);
 	return ret;
 }
 
@@ -1261,7 +1656,7 @@ client_dict_transaction_init(struct dict *_dict)
 
 	ctx = i_new(struct client_dict_transaction_context, 1);
 	ctx->ctx.dict = _dict;
-	ctx->id = ++dict->transaction_id_counter;
+	ctx->id = ++dict->conn->transaction_id_counter;
 
 	DLLIST_PREPEND(&dict->transactions, ctx);
 	return &ctx->ctx;
@@ -1322,7 +1717,7 @@ client_dict_transaction_commit_callback(struct client_dict_cmd *cmd,
 		result.error = t_strdup_printf(
 			"dict-client: Invalid commit reply: %c%s",
 			reply, value);
-		client_dict_disconnect(dict, result.error);
+		client_dict_disconnect(dict->conn, result.error);
 		break;
 	}
 
@@ -1333,7 +1728,7 @@ client_dict_transaction_commit_callback(struct client_dict_cmd *cmd,
 			result.error, dict_warnings_sec(cmd, diff, extra_args));
 	} else if (!cmd->background && !cmd->trans->ctx.no_slowness_warning &&
 		   diff >= (int)dict->warn_slow_msecs) {
-		e_warning(dict->conn.conn.event, "dict commit took %s: "
+		e_warning(dict->conn->conn.event, "dict commit took %s: "
 			  "%s (%u commands, first: %s)",
 			  dict_warnings_sec(cmd, diff, extra_args),
 			  cmd->query, cmd->trans->query_count,
@@ -1391,7 +1786,7 @@ client_dict_transaction_commit(struct dict_transaction_context *_ctx,
 		client_dict_transaction_free(&ctx);
 	}
 
-	client_dict_add_timeout(dict);
+	client_dict_add_timeout(dict->conn);
 }
 
 static void
@@ -1411,7 +1806,7 @@ client_dict_transaction_rollback(struct dict_transaction_context *_ctx)
 
 	DLLIST_REMOVE(&dict->transactions, ctx);
 	client_dict_transaction_free(&ctx);
-	client_dict_add_timeout(dict);
+	client_dict_add_timeout(dict->conn);
 }
 
 static void client_dict_set(struct dict_transaction_context *_ctx,
@@ -1488,5 +1883,7 @@ struct dict dict_driver_client = {
 		.lookup_async = client_dict_lookup_async,
 		.switch_ioloop = client_dict_switch_ioloop,
 		.set_timestamp = client_dict_set_timestamp,
+		.lookup_multi = client_dict_lookup_multi,
+		.lookup_multi_async = client_dict_lookup_multi_async,
 	}
 };
@@ -6,9 +6,10 @@
 #define DEFAULT_DICT_SERVER_SOCKET_FNAME "dict"
 
 #define DICT_CLIENT_PROTOCOL_MAJOR_VERSION 3
-#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 2
+#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 3
 
 #define DICT_CLIENT_PROTOCOL_VERSION_MIN_MULTI_OK 2
+#define DICT_CLIENT_PROTOCOL_VERSION_MIN_LOOKUP_MULTI 3
 
 #define DICT_CLIENT_MAX_LINE_LENGTH (64*1024)
 
@@ -17,6 +18,8 @@ enum dict_protocol_cmd {
 	DICT_PROTOCOL_CMD_HELLO = 'H',
 
 	DICT_PROTOCOL_CMD_LOOKUP = 'L', /* <key> */
+	/* protocol v3.3+: <username> <key> [<key> ...] */
+	DICT_PROTOCOL_CMD_LOOKUP_MULTI = 'M',
 	DICT_PROTOCOL_CMD_ITERATE = 'I', /* <flags> <path> */
 
 	DICT_PROTOCOL_CMD_BEGIN = 'B', /* <id> */
@@ -33,7 +36,9 @@ enum dict_protocol_cmd {
 enum dict_protocol_reply {
 	DICT_PROTOCOL_REPLY_ERROR = -1,
 
-	DICT_PROTOCOL_REPLY_OK = 'O', /* <value> */
+	/* <value>, or for LOOKUP_MULTI a single double-tabescaped parameter
+	   with "O<value>" or "N" for each key */
+	DICT_PROTOCOL_REPLY_OK = 'O',
 	DICT_PROTOCOL_REPLY_MULTI_OK = 'M', /* protocol v2.2+ */
 	DICT_PROTOCOL_REPLY_NOTFOUND = 'N',
 	DICT_PROTOCOL_REPLY_FAIL = 'F',
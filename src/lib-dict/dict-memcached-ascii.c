@@ -14,7 +14,7 @@
 #define DICT_USERNAME_SEPARATOR '/'
 
 enum memcached_ascii_input_state {
-	/* GET: expecting VALUE or END */
+	/* GET: expecting VALUE(s) or END */
 	MEMCACHED_INPUT_STATE_GET,
 	/* SET: expecting STORED / NOT_STORED */
 	MEMCACHED_INPUT_STATE_STORED,
@@ -30,6 +30,8 @@ struct memcached_ascii_connection {
 
 	string_t *reply_str;
 	unsigned int reply_bytes_left;
+	/* lookup_multi() key index of the VALUE being read */
+	unsigned int reply_multi_idx;
 	bool value_received;
 	bool value_waiting_end;
 };
@@ -55,12 +57,22 @@ struct memcached_ascii_dict {
 	char *key_prefix;
 	in_port_t port;
 	unsigned int timeout_msecs;
+	/* Send writes with noreply and don't wait for them. */
+	bool noreply;
 
 	struct timeout *to;
 	struct memcached_ascii_connection conn;
 
 	ARRAY(enum memcached_ascii_input_state) input_states;
 	ARRAY(struct memcached_ascii_dict_reply) replies;
+
+	/* Multi-key GET sent by lookup_multi(). The VALUE replies are
+	   matched to the keys by their names. */
+	struct {
+		char **keys;
+		char **values;
+		unsigned int count;
+	} multi;
 };
 
 static struct connection_list *memcached_ascii_connections;
@@ -132,6 +144,44 @@ static bool memcached_ascii_input_value(struct memcached_ascii_connection *conn)
 	return TRUE;
 }
 
+static int
+memcached_ascii_multi_find_key(struct memcached_ascii_dict *dict,
+			       const char *key, size_t key_len)
+{
+	unsigned int i;
+	int idx = -1;
+
+	for (i = 0; i < dict->multi.count; i++) {
+		if (strncmp(dict->multi.keys[i], key, key_len) != 0 ||
+		    dict->multi.keys[i][key_len] != '\0')
+			continue;
+		/* the same key may have been requested multiple times */
+		if (dict->multi.values[i] == NULL)
+			return i;
+		if (idx == -1)
+			idx = i;
+	}
+	return idx;
+}
+
+static bool
+memcached_ascii_input_multi_value(struct memcached_ascii_dict *dict,
+				  const char *line)
+{
+	const char *key = line + 6, *p;
+	int idx;
+
+	/* VALUE <key> <flags> <bytes> */
+	p = strchr(key, ' ');
+	if (p == NULL)
+		return FALSE;
+	idx = memcached_ascii_multi_find_key(dict, key, p - key);
+	if (idx < 0)
+		return FALSE;
+	dict->conn.reply_multi_idx = idx;
+	return TRUE;
+}
+
 static int memcached_ascii_input_reply_read(struct memcached_ascii_dict *dict,
 					    const char **error_r)
 {
@@ -146,6 +196,12 @@ static int memcached_ascii_input_reply_read(struct memcached_ascii_dict *dict,
 		if (!memcached_ascii_input_value(conn))
 			return 0;
 		conn->value_waiting_end = TRUE;
+		if (dict->multi.count > 0) {
+			i_free(dict->multi.values[conn->reply_multi_idx]);
+			dict->multi.values[conn->reply_multi_idx] =
+				i_strdup(str_c(conn->reply_str));
+			str_truncate(conn->reply_str, 0);
+		}
 	} else if (conn->value_waiting_end) {
 		conn->value_waiting_end = FALSE;
 	} else {
@@ -168,6 +224,9 @@ static int memcached_ascii_input_reply_read(struct memcached_ascii_dict *dict,
 		/* VALUE <key> <flags> <bytes>
 		   END */
 		if (str_begins(line, "VALUE ")) {
+			if (dict->multi.count > 0 &&
+			    !memcached_ascii_input_multi_value(dict, line))
+				break;
 			p = strrchr(line, ' ');
 			if (str_to_uint(p+1, &conn->reply_bytes_left) < 0)
 				break;
@@ -419,6 +478,18 @@ memcached_ascii_dict_init(struct dict *driver, const char *uri,
 					"Invalid timeout_msecs: %s", *args+14);
 				ret = -1;
 			}
+		} else if (str_begins(*args, "noreply=")) {
+			const char *value = *args + 8;
+
+			if (strcmp(value, "yes") == 0)
+				dict->noreply = TRUE;
+			else if (strcmp(value, "no") == 0)
+				dict->noreply = FALSE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid noreply value: %s", value);
+				ret = -1;
+			}
 		} else {
 			*error_r = t_strdup_printf("Unknown parameter: %s",
 						   *args);
@@ -545,6 +616,72 @@ memcached_ascii_dict_lookup(struct dict *_dict,
 	return dict->conn.value_received ? 1 : 0;
 }
 
+static void memcached_ascii_multi_free(struct memcached_ascii_dict *dict)
+{
+	unsigned int i;
+
+	for (i = 0; i < dict->multi.count; i++) {
+		i_free(dict->multi.keys[i]);
+		i_free(dict->multi.values[i]);
+	}
+	i_free(dict->multi.keys);
+	i_free(dict->multi.values);
+	dict->multi.count = 0;
+}
+
+static int
+memcached_ascii_dict_lookup_multi(struct dict *_dict,
+				  const struct dict_op_settings *set,
+				  pool_t pool, const char *const *keys,
+				  const char **values, const char **error_r)
+{
+	struct memcached_ascii_dict *dict = (struct memcached_ascii_dict *)_dict;
+	struct memcached_ascii_dict_reply *reply;
+	enum memcached_ascii_input_state state = MEMCACHED_INPUT_STATE_GET;
+	unsigned int i, count = str_array_length(keys);
+	string_t *cmd;
+	int ret = 0;
+
+	if (memcached_ascii_connect(dict, error_r) < 0)
+		return -1;
+
+	/* get <key1> <key2> ... returns VALUE for each found key,
+	   followed by END */
+	i_assert(dict->multi.count == 0);
+	dict->multi.keys = i_new(char *, count);
+	dict->multi.values = i_new(char *, count);
+	dict->multi.count = count;
+
+	cmd = t_str_new(128);
+	str_append(cmd, "get");
+	for (i = 0; i < count; i++) {
+		dict->multi.keys[i] = i_strdup(
+			memcached_ascii_dict_get_full_key(dict, set->username,
+							  keys[i]));
+		str_printfa(cmd, " %s", dict->multi.keys[i]);
+	}
+	str_append(cmd, "\r\n");
+	o_stream_nsend(dict->conn.conn.output, str_data(cmd), str_len(cmd));
+	array_push_back(&dict->input_states, &state);
+
+	reply = array_append_space(&dict->replies);
+	reply->reply_count = 1;
+
+	if (memcached_ascii_wait(dict, error_r) < 0)
+		ret = -1;
+	else {
+		for (i = 0; i < count; i++) {
+			if (dict->multi.values[i] != NULL) {
+				values[i] = p_strdup(pool,
+						     dict->multi.values[i]);
+				ret = 1;
+			}
+		}
+	}
+	memcached_ascii_multi_free(dict);
+	return ret;
+}
+
 static struct dict_transaction_context *
 memcached_ascii_transaction_init(struct dict *_dict)
 {
@@ -564,6 +701,8 @@ memcached_send_change(struct dict_memcached_ascii_commit_ctx *ctx,
 {
 	enum memcached_ascii_input_state state;
 	const char *key, *value;
+	/* with noreply the server doesn't send any replies */
+	const char *noreply = ctx->dict->noreply ? " noreply" : "";
 
 	key = memcached_ascii_dict_get_full_key(ctx->dict, set->username,
 						change->key);
@@ -572,30 +711,34 @@ memcached_send_change(struct dict_memcached_ascii_commit_ctx *ctx,
 	switch (change->type) {
 	case DICT_CHANGE_TYPE_SET:
 		state = MEMCACHED_INPUT_STATE_STORED;
-		str_printfa(ctx->str, "set %s 0 0 %zu\r\n%s\r\n",
-			    key, strlen(change->value.str), change->value.str);
+		str_printfa(ctx->str, "set %s 0 0 %zu%s\r\n%s\r\n",
+			    key, strlen(change->value.str), noreply,
+			    change->value.str);
 		break;
 	case DICT_CHANGE_TYPE_UNSET:
 		state = MEMCACHED_INPUT_STATE_DELETED;
-		str_printfa(ctx->str, "delete %s\r\n", key);
+		str_printfa(ctx->str, "delete %s%s\r\n", key, noreply);
 		break;
 	case DICT_CHANGE_TYPE_INC:
 		state = MEMCACHED_INPUT_STATE_INCRDECR;
 		if (change->value.diff > 0) {
-			str_printfa(ctx->str, "incr %s %lld\r\n",
-				    key, change->value.diff);
-			array_push_back(&ctx->dict->input_states, &state);
+			str_printfa(ctx->str, "incr %s %lld%s\r\n",
+				    key, change->value.diff, noreply);
+			if (!ctx->dict->noreply)
+				array_push_back(&ctx->dict->input_states, &state);
 			/* same kludge as with append */
 			value = t_strdup_printf("%lld", change->value.diff);
-			str_printfa(ctx->str, "add %s 0 0 %u\r\n%s\r\n",
-				    key, (unsigned int)strlen(value), value);
+			str_printfa(ctx->str, "add %s 0 0 %u%s\r\n%s\r\n",
+				    key, (unsigned int)strlen(value), noreply,
+				    value);
 		} else {
-			str_printfa(ctx->str, "decr %s %lld\r\n",
-				    key, -change->value.diff);
+			str_printfa(ctx->str, "decr %s %lld%s\r\n",
+				    key, -change->value.diff, noreply);
 		}
 		break;
 	}
-	array_push_back(&ctx->dict->input_states, &state);
+	if (!ctx->dict->noreply)
+		array_push_back(&ctx->dict->input_states, &state);
 	o_stream_nsend(ctx->dict->conn.conn.output,
 		       str_data(ctx->str), str_len(ctx->str));
 }
@@ -623,6 +766,10 @@ memcached_ascii_transaction_send(struct dict_memcached_ascii_commit_ctx *ctx,
 	} T_END;
 	o_stream_uncork(dict->conn.conn.output);
 
+	if (dict->noreply) {
+		/* fire and forget */
+		return 0;
+	}
 	reply = array_append_space(&dict->replies);
 	reply->callback = ctx->callback;
 	reply->context = ctx->context;
@@ -652,18 +799,19 @@ memcached_ascii_transaction_commit(struct dict_transaction_context *_ctx,
 		commit_ctx.context = context;
 		commit_ctx.str = str_new(default_pool, 128);
 
-		result.ret = memcached_ascii_transaction_send(&commit_ctx, set, &result.error);
+		if (memcached_ascii_transaction_send(&commit_ctx, set,
+						     &result.error) < 0)
+			result.ret = DICT_COMMIT_RET_FAILED;
 		str_free(&commit_ctx.str);
 
-		if (async && result.ret == 0) {
+		if (result.ret == DICT_COMMIT_RET_OK && !dict->noreply) {
+			/* the callback is called when the replies are
+			   received (or the connection fails) */
+			if (!async)
+				(void)memcached_ascii_wait(dict, &result.error);
 			pool_unref(&ctx->pool);
 			return;
 		}
-
-		if (result.ret == 0) {
-			if (memcached_ascii_wait(dict, &result.error) < 0)
-				result.ret = -1;
-		}
 	}
 	callback(&result, context);
 	pool_unref(&ctx->pool);
@@ -681,5 +829,6 @@ struct dict dict_driver_memcached_ascii = {
 		.set = dict_transaction_memory_set,
 		.unset = dict_transaction_memory_unset,
 		.atomic_inc = dict_transaction_memory_atomic_inc,
+		.lookup_multi = memcached_ascii_dict_lookup_multi,
 	}
 };
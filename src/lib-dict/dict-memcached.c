@@ -3,9 +3,11 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "byteorder.h"
 #include "istream.h"
 #include "ostream.h"
 #include "connection.h"
+#include "dict-transaction-memory.h"
 #include "dict-private.h"
 
 #define MEMCACHED_DEFAULT_PORT 11211
@@ -20,6 +22,16 @@
 #define MEMCACHED_REPLY_HDR_LENGTH 24
 
 #define MEMCACHED_CMD_GET 0x00
+#define MEMCACHED_CMD_NOOP 0x0a
+#define MEMCACHED_CMD_GETKQ 0x0d
+#define MEMCACHED_CMD_SETQ 0x11
+#define MEMCACHED_CMD_DELETEQ 0x14
+#define MEMCACHED_CMD_INCREMENTQ 0x15
+#define MEMCACHED_CMD_DECREMENTQ 0x16
+
+/* INCREMENT/DECREMENT expiration that makes the command fail if the key
+   doesn't exist yet */
+#define MEMCACHED_INCRDECR_NO_CREATE 0xffffffff
 
 #define MEMCACHED_DATA_TYPE_RAW 0x00
 
@@ -31,29 +43,57 @@ enum memcached_response {
 	MEMCACHED_RESPONSE_TEMPFAILURE	= 0x0086,
 };
 
+enum memcached_request_type {
+	MEMCACHED_REQUEST_NONE = 0,
+	/* single GET */
+	MEMCACHED_REQUEST_GET,
+	/* GETKQs followed by NOOP */
+	MEMCACHED_REQUEST_MULTI,
+	/* quiet writes followed by NOOP */
+	MEMCACHED_REQUEST_WRITE,
+};
+
+/* The connections are shared by all the dicts using the same server.
+   The requests are synchronous, so there is only a single request waiting
+   for a reply at a time. The only exception are the noreply writes, whose
+   failure replies may arrive at any time. */
 struct memcached_connection {
 	struct connection conn;
+	int refcount;
+	/* dict currently waiting for a reply, or NULL */
 	struct memcached_dict *dict;
 
 	buffer_t *cmd;
+	enum memcached_request_type request;
 	struct {
 		const unsigned char *value;
 		size_t value_len;
 		uint16_t status; /* enum memcached_response */
 		bool reply_received;
 	} reply;
+	/* GETKQs sent by lookup_multi(). The opaque field in the request
+	   contains the key's index. Only the found keys are replied to. */
+	struct {
+		/* the input callback runs in a different data stack frame than
+		   the caller, so the values are i_strdup()ed */
+		char **values;
+		unsigned int count;
+	} multi;
+	/* first status other than OK or NOTFOUND for the current
+	   MULTI/WRITE request */
+	uint16_t error_status;
+
+	bool connected;
 };
 
 struct memcached_dict {
 	struct dict dict;
-	struct ip_addr ip;
 	char *key_prefix;
-	in_port_t port;
 	unsigned int timeout_msecs;
+	/* Don't wait for write replies. Failures are only logged. */
+	bool noreply;
 
-	struct memcached_connection conn;
-
-	bool connected;
+	struct memcached_connection *conn;
 };
 
 static struct connection_list *memcached_connections;
@@ -62,20 +102,79 @@ static void memcached_conn_destroy(struct connection *_conn)
 {
 	struct memcached_connection *conn = (struct memcached_connection *)_conn;
 
-	conn->dict->connected = FALSE;
+	conn->connected = FALSE;
 	connection_disconnect(_conn);
 
-	if (conn->dict->dict.ioloop != NULL)
+	if (conn->dict != NULL && conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
 }
 
+static const char *memcached_status_error(uint16_t status)
+{
+	switch (status) {
+	case MEMCACHED_RESPONSE_INTERNALERROR:
+		return "Internal error";
+	case MEMCACHED_RESPONSE_BUSY:
+		return "Busy";
+	case MEMCACHED_RESPONSE_TEMPFAILURE:
+		return "Temporary failure";
+	}
+	return t_strdup_printf("Error code=%u", status);
+}
+
+static void
+memcached_input_get_multi(struct memcached_connection *conn,
+			  const unsigned char *data, uint32_t value_pos,
+			  uint32_t body_len, uint16_t status)
+{
+	uint32_t opaque;
+
+	/* the opaque is returned back as-is, so byte order doesn't matter */
+	memcpy(&opaque, data+12, 4);
+	if (opaque >= conn->multi.count) {
+		e_error(conn->conn.event, "Reply has invalid opaque %u",
+			opaque);
+		if (conn->error_status == MEMCACHED_RESPONSE_OK)
+			conn->error_status = MEMCACHED_RESPONSE_INTERNALERROR;
+	} else if (status == MEMCACHED_RESPONSE_OK) {
+		i_free(conn->multi.values[opaque]);
+		conn->multi.values[opaque] =
+			i_strndup(data + value_pos, body_len - value_pos);
+	} else if (status != MEMCACHED_RESPONSE_NOTFOUND &&
+		   conn->error_status == MEMCACHED_RESPONSE_OK) {
+		conn->error_status = status;
+	}
+}
+
+static void
+memcached_input_write_failed(struct memcached_connection *conn,
+			     uint8_t opcode, uint16_t status)
+{
+	if (status == MEMCACHED_RESPONSE_NOTFOUND &&
+	    (opcode == MEMCACHED_CMD_DELETEQ ||
+	     opcode == MEMCACHED_CMD_DECREMENTQ)) {
+		/* deleting or decrementing a nonexistent key is fine */
+		return;
+	}
+	if (conn->request == MEMCACHED_REQUEST_WRITE) {
+		if (conn->error_status == MEMCACHED_RESPONSE_OK)
+			conn->error_status = status;
+	} else {
+		/* noreply write failed - nobody is waiting for it */
+		e_error(conn->conn.event, "Write failed: %s",
+			memcached_status_error(status));
+	}
+}
+
+/* Returns 1 if more replies are expected, 0 if more input is needed or the
+   request was finished, -1 on error. */
 static int memcached_input_get(struct memcached_connection *conn)
 {
 	const unsigned char *data;
 	size_t size;
 	uint32_t body_len, value_pos;
 	uint16_t key_len, key_pos, status;
-	uint8_t extras_len, data_type;
+	uint8_t opcode, extras_len, data_type;
 
 	data = i_stream_get_data(conn->conn.input, &size);
 	if (size < MEMCACHED_REPLY_HDR_LENGTH)
@@ -93,6 +192,7 @@ static int memcached_input_get(struct memcached_connection *conn)
 		return 0;
 	}
 
+	opcode = data[1];
 	memcpy(&key_len, data+2, 2); key_len = ntohs(key_len);
 	extras_len = data[4];
 	data_type = data[5];
@@ -109,21 +209,57 @@ static int memcached_input_get(struct memcached_connection *conn)
 		e_error(conn->conn.event, "Invalid key/extras lengths");
 		return -1;
 	}
-	conn->reply.value = data + value_pos;
-	conn->reply.value_len = body_len - value_pos;
-	conn->reply.status = status;
-
-	i_stream_skip(conn->conn.input, body_len);
-	conn->reply.reply_received = TRUE;
 
-	if (conn->dict->dict.ioloop != NULL)
-		io_loop_stop(conn->dict->dict.ioloop);
-	return 1;
+	switch (opcode) {
+	case MEMCACHED_CMD_SETQ:
+	case MEMCACHED_CMD_DELETEQ:
+	case MEMCACHED_CMD_INCREMENTQ:
+	case MEMCACHED_CMD_DECREMENTQ:
+		/* quiet writes reply only on failure */
+		memcached_input_write_failed(conn, opcode, status);
+		i_stream_skip(conn->conn.input, body_len);
+		return 1;
+	case MEMCACHED_CMD_GETKQ:
+		if (conn->request != MEMCACHED_REQUEST_MULTI)
+			break;
+		memcached_input_get_multi(conn, data, value_pos,
+					  body_len, status);
+		i_stream_skip(conn->conn.input, body_len);
+		return 1;
+	case MEMCACHED_CMD_NOOP:
+		if (conn->request != MEMCACHED_REQUEST_MULTI &&
+		    conn->request != MEMCACHED_REQUEST_WRITE)
+			break;
+		/* all the replies before the NOOP have been received */
+		i_stream_skip(conn->conn.input, body_len);
+		conn->reply.reply_received = TRUE;
+		conn->request = MEMCACHED_REQUEST_NONE;
+		if (conn->dict != NULL && conn->dict->dict.ioloop != NULL)
+			io_loop_stop(conn->dict->dict.ioloop);
+		return 0;
+	case MEMCACHED_CMD_GET:
+		if (conn->request != MEMCACHED_REQUEST_GET)
+			break;
+		conn->reply.value = data + value_pos;
+		conn->reply.value_len = body_len - value_pos;
+		conn->reply.status = status;
+
+		i_stream_skip(conn->conn.input, body_len);
+		conn->reply.reply_received = TRUE;
+		conn->request = MEMCACHED_REQUEST_NONE;
+		if (conn->dict != NULL && conn->dict->dict.ioloop != NULL)
+			io_loop_stop(conn->dict->dict.ioloop);
+		return 0;
+	}
+	e_error(conn->conn.event, "Unexpected reply with opcode 0x%02x",
+		opcode);
+	return -1;
 }
 
 static void memcached_conn_input(struct connection *_conn)
 {
 	struct memcached_connection *conn = (struct memcached_connection *)_conn;
+	int ret;
 
 	switch (i_stream_read(_conn->input)) {
 	case 0:
@@ -135,7 +271,8 @@ static void memcached_conn_input(struct connection *_conn)
 		break;
 	}
 
-	if (memcached_input_get(conn) < 0)
+	while ((ret = memcached_input_get(conn)) > 0) ;
+	if (ret < 0)
 		memcached_conn_destroy(_conn);
 }
 
@@ -147,9 +284,9 @@ static void memcached_conn_connected(struct connection *_conn, bool success)
 	if (!success) {
 		e_error(conn->conn.event, "connect() failed: %m");
 	} else {
-		conn->dict->connected = TRUE;
+		conn->connected = TRUE;
 	}
-	if (conn->dict->dict.ioloop != NULL)
+	if (conn->dict != NULL && conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
 }
 
@@ -165,6 +302,47 @@ static const struct connection_vfuncs memcached_conn_vfuncs = {
 	.client_connected = memcached_conn_connected
 };
 
+static struct memcached_connection *
+memcached_conn_get(const struct ip_addr *ip, in_port_t port,
+		   struct event *event_parent)
+{
+	struct memcached_connection *conn;
+	struct connection *_conn;
+
+	for (_conn = memcached_connections->connections; _conn != NULL;
+	     _conn = _conn->next) {
+		if (_conn->remote_port == port &&
+		    net_ip_compare(&_conn->remote_ip, ip)) {
+			conn = (struct memcached_connection *)_conn;
+			conn->refcount++;
+			return conn;
+		}
+	}
+
+	conn = i_new(struct memcached_connection, 1);
+	conn->refcount = 1;
+	conn->conn.event_parent = event_parent;
+	connection_init_client_ip(memcached_connections, &conn->conn,
+				  NULL, ip, port);
+	event_set_append_log_prefix(conn->conn.event, "memcached: ");
+	conn->cmd = buffer_create_dynamic(default_pool, 256);
+	return conn;
+}
+
+static void memcached_conn_unref(struct memcached_connection **_conn)
+{
+	struct memcached_connection *conn = *_conn;
+
+	*_conn = NULL;
+	i_assert(conn->refcount > 0);
+	if (--conn->refcount > 0)
+		return;
+
+	connection_deinit(&conn->conn);
+	buffer_free(&conn->cmd);
+	i_free(conn);
+}
+
 static int
 memcached_dict_init(struct dict *driver, const char *uri,
 		    const struct dict_settings *set,
@@ -172,6 +350,8 @@ memcached_dict_init(struct dict *driver, const char *uri,
 {
 	struct memcached_dict *dict;
 	const char *const *args;
+	struct ip_addr ip;
+	in_port_t port = MEMCACHED_DEFAULT_PORT;
 	int ret = 0;
 
 	if (memcached_connections == NULL) {
@@ -181,22 +361,21 @@ memcached_dict_init(struct dict *driver, const char *uri,
 	}
 
 	dict = i_new(struct memcached_dict, 1);
-	if (net_addr2ip("127.0.0.1", &dict->ip) < 0)
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
 		i_unreached();
-	dict->port = MEMCACHED_DEFAULT_PORT;
 	dict->timeout_msecs = MEMCACHED_DEFAULT_LOOKUP_TIMEOUT_MSECS;
 	dict->key_prefix = i_strdup("");
 
 	args = t_strsplit(uri, ":");
 	for (; *args != NULL; args++) {
 		if (str_begins(*args, "host=")) {
-			if (net_addr2ip(*args+5, &dict->ip) < 0) {
+			if (net_addr2ip(*args+5, &ip) < 0) {
 				*error_r = t_strdup_printf("Invalid IP: %s",
 							   *args+5);
 				ret = -1;
 			}
 		} else if (str_begins(*args, "port=")) {
-			if (net_str2port(*args+5, &dict->port) < 0) {
+			if (net_str2port(*args+5, &port) < 0) {
 				*error_r = t_strdup_printf("Invalid port: %s",
 							   *args+5);
 				ret = -1;
@@ -210,6 +389,18 @@ memcached_dict_init(struct dict *driver, const char *uri,
 					"Invalid timeout_msecs: %s", *args+14);
 				ret = -1;
 			}
+		} else if (str_begins(*args, "noreply=")) {
+			const char *value = *args + 8;
+
+			if (strcmp(value, "yes") == 0)
+				dict->noreply = TRUE;
+			else if (strcmp(value, "no") == 0)
+				dict->noreply = FALSE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid noreply value: %s", value);
+				ret = -1;
+			}
 		} else {
 			*error_r = t_strdup_printf("Unknown parameter: %s",
 						   *args);
@@ -219,17 +410,13 @@ memcached_dict_init(struct dict *driver, const char *uri,
 	if (ret < 0) {
 		i_free(dict->key_prefix);
 		i_free(dict);
+		if (memcached_connections->connections == NULL)
+			connection_list_deinit(&memcached_connections);
 		return -1;
 	}
 
-	dict->conn.conn.event_parent = set->event_parent;
-
-	connection_init_client_ip(memcached_connections, &dict->conn.conn,
-				  NULL, &dict->ip, dict->port);
-	event_set_append_log_prefix(dict->conn.conn.event, "memcached: ");
+	dict->conn = memcached_conn_get(&ip, port, set->event_parent);
 	dict->dict = *driver;
-	dict->conn.cmd = buffer_create_dynamic(default_pool, 256);
-	dict->conn.dict = dict;
 	*dict_r = &dict->dict;
 	return 0;
 }
@@ -238,8 +425,8 @@ static void memcached_dict_deinit(struct dict *_dict)
 {
 	struct memcached_dict *dict = (struct memcached_dict *)_dict;
 
-	connection_deinit(&dict->conn.conn);
-	buffer_free(&dict->conn.cmd);
+	i_assert(dict->conn->dict != dict);
+	memcached_conn_unref(&dict->conn);
 	i_free(dict->key_prefix);
 	i_free(dict);
 
@@ -249,37 +436,37 @@ static void memcached_dict_deinit(struct dict *_dict)
 
 static void memcached_dict_lookup_timeout(struct memcached_dict *dict)
 {
-	e_error(dict->dict.event, "Lookup timed out in %u.%03u secs",
+	e_error(dict->dict.event, "Request timed out in %u.%03u secs",
 		dict->timeout_msecs/1000, dict->timeout_msecs%1000);
 	io_loop_stop(dict->dict.ioloop);
 }
 
-static void memcached_add_header(buffer_t *buf, unsigned int key_len)
+static void
+memcached_add_header(buffer_t *buf, uint8_t opcode, unsigned int key_len,
+		     uint8_t extras_len, size_t value_len, uint32_t opaque)
 {
-	uint32_t body_len = htonl(key_len);
+	uint32_t body_len = htonl(extras_len + key_len + value_len);
+	size_t start_pos = buf->used;
 
 	i_assert(key_len <= 0xffff);
 
 	buffer_append_c(buf, MEMCACHED_REQUEST_HDR_MAGIC);
-	buffer_append_c(buf, MEMCACHED_CMD_GET);
+	buffer_append_c(buf, opcode);
 	buffer_append_c(buf, (key_len >> 8) & 0xff);
 	buffer_append_c(buf, key_len & 0xff);
-	buffer_append_c(buf, 0); /* extras length */
+	buffer_append_c(buf, extras_len);
 	buffer_append_c(buf, MEMCACHED_DATA_TYPE_RAW);
 	buffer_append_zero(buf, 2); /* vbucket id - we probably don't care? */
 	buffer_append(buf, &body_len, sizeof(body_len));
-	buffer_append_zero(buf, 4+8); /* opaque + cas */
-	i_assert(buf->used == MEMCACHED_REQUEST_HDR_LENGTH);
+	buffer_append(buf, &opaque, sizeof(opaque));
+	buffer_append_zero(buf, 8); /* cas */
+	i_assert(buf->used - start_pos == MEMCACHED_REQUEST_HDR_LENGTH);
 }
 
 static int
-memcached_dict_lookup(struct dict *_dict, const struct dict_op_settings *set ATTR_UNUSED,
-		      pool_t pool, const char *key, const char **value_r,
-		      const char **error_r)
+memcached_dict_get_full_key(struct memcached_dict *dict, const char *key,
+			    const char **key_r, const char **error_r)
 {
-	struct memcached_dict *dict = (struct memcached_dict *)_dict;
-	struct ioloop *prev_ioloop = current_ioloop;
-	struct timeout *to;
 	size_t key_len;
 
 	if (str_begins(key, DICT_PATH_SHARED))
@@ -296,71 +483,281 @@ memcached_dict_lookup(struct dict *_dict, const struct dict_op_settings *set ATT
 			"memcached: Key is too long (%zu bytes): %s", key_len, key);
 		return -1;
 	}
+	*key_r = key;
+	return 0;
+}
+
+static void
+memcached_add_key_cmd(buffer_t *buf, uint8_t opcode, const char *key,
+		      uint32_t opaque)
+{
+	size_t key_len = strlen(key);
+
+	memcached_add_header(buf, opcode, key_len, 0, 0, opaque);
+	buffer_append(buf, key, key_len);
+}
+
+static void memcached_add_noop(buffer_t *buf)
+{
+	memcached_add_header(buf, MEMCACHED_CMD_NOOP, 0, 0, 0, 0);
+}
+
+/* Send the command in conn->cmd and wait until the reply is received
+   or the request times out. If request is MEMCACHED_REQUEST_NONE, no reply
+   is expected and this only waits for the connection to be established. */
+static void
+memcached_dict_send_and_wait(struct memcached_dict *dict,
+			     enum memcached_request_type request)
+{
+	struct memcached_connection *conn = dict->conn;
+	struct ioloop *prev_ioloop = current_ioloop;
+	struct timeout *to;
 
 	i_assert(dict->dict.ioloop == NULL);
+	i_assert(conn->dict == NULL);
 
+	conn->dict = dict;
 	dict->dict.ioloop = io_loop_create();
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&conn->conn);
 
-	if (dict->conn.conn.fd_in == -1 &&
-	    connection_client_connect(&dict->conn.conn) < 0) {
-		e_error(dict->conn.conn.event, "Couldn't connect");
+	if (conn->conn.fd_in == -1 &&
+	    connection_client_connect(&conn->conn) < 0) {
+		e_error(conn->conn.event, "Couldn't connect");
 	} else {
 		to = timeout_add(dict->timeout_msecs,
 				 memcached_dict_lookup_timeout, dict);
-		if (!dict->connected) {
+		if (!conn->connected) {
 			/* wait for connection */
 			io_loop_run(dict->dict.ioloop);
 		}
 
-		if (dict->connected) {
-			buffer_set_used_size(dict->conn.cmd, 0);
-			memcached_add_header(dict->conn.cmd, key_len);
-			buffer_append(dict->conn.cmd, key, key_len);
-
-			o_stream_nsend(dict->conn.conn.output,
-				       dict->conn.cmd->data,
-				       dict->conn.cmd->used);
-
-			i_zero(&dict->conn.reply);
-			io_loop_run(dict->dict.ioloop);
+		if (conn->connected) {
+			i_zero(&conn->reply);
+			conn->error_status = MEMCACHED_RESPONSE_OK;
+			conn->request = request;
+			o_stream_nsend(conn->conn.output,
+				       conn->cmd->data, conn->cmd->used);
+			if (request != MEMCACHED_REQUEST_NONE)
+				io_loop_run(dict->dict.ioloop);
 		}
 		timeout_remove(&to);
 	}
 
 	io_loop_set_current(prev_ioloop);
-	connection_switch_ioloop(&dict->conn.conn);
+	connection_switch_ioloop(&conn->conn);
 	io_loop_set_current(dict->dict.ioloop);
 	io_loop_destroy(&dict->dict.ioloop);
+	conn->dict = NULL;
+}
+
+static int
+memcached_dict_request_failed(struct memcached_dict *dict,
+			      const char **error_r)
+{
+	/* we failed in some way. make sure we disconnect since the
+	   connection state isn't known anymore */
+	dict->conn->request = MEMCACHED_REQUEST_NONE;
+	memcached_conn_destroy(&dict->conn->conn);
+	*error_r = "Communication failure";
+	return -1;
+}
+
+static int
+memcached_dict_lookup(struct dict *_dict, const struct dict_op_settings *set ATTR_UNUSED,
+		      pool_t pool, const char *key, const char **value_r,
+		      const char **error_r)
+{
+	struct memcached_dict *dict = (struct memcached_dict *)_dict;
+	struct memcached_connection *conn = dict->conn;
 
-	if (!dict->conn.reply.reply_received) {
-		/* we failed in some way. make sure we disconnect since the
-		   connection state isn't known anymore */
-		memcached_conn_destroy(&dict->conn.conn);
-		*error_r = "Communication failure";
+	if (memcached_dict_get_full_key(dict, key, &key, error_r) < 0)
 		return -1;
-	}
-	switch (dict->conn.reply.status) {
+
+	buffer_set_used_size(conn->cmd, 0);
+	memcached_add_key_cmd(conn->cmd, MEMCACHED_CMD_GET, key, 0);
+	memcached_dict_send_and_wait(dict, MEMCACHED_REQUEST_GET);
+
+	if (!conn->reply.reply_received)
+		return memcached_dict_request_failed(dict, error_r);
+	switch (conn->reply.status) {
 	case MEMCACHED_RESPONSE_OK:
-		*value_r = p_strndup(pool, dict->conn.reply.value,
-				     dict->conn.reply.value_len);
+		*value_r = p_strndup(pool, conn->reply.value,
+				     conn->reply.value_len);
 		return 1;
 	case MEMCACHED_RESPONSE_NOTFOUND:
 		return 0;
-	case MEMCACHED_RESPONSE_INTERNALERROR:
-		*error_r = "Lookup failed: Internal error";
-		return -1;
-	case MEMCACHED_RESPONSE_BUSY:
-		*error_r = "Lookup failed: Busy";
+	}
+	*error_r = t_strconcat("Lookup failed: ",
+		memcached_status_error(conn->reply.status), NULL);
+	return -1;
+}
+
+static int
+memcached_dict_lookup_multi(struct dict *_dict,
+			    const struct dict_op_settings *set ATTR_UNUSED,
+			    pool_t pool, const char *const *keys,
+			    const char **values, const char **error_r)
+{
+	struct memcached_dict *dict = (struct memcached_dict *)_dict;
+	struct memcached_connection *conn = dict->conn;
+	const char *key;
+	unsigned int i, count = str_array_length(keys);
+	int ret = 0;
+
+	/* Send all the keys as quiet GETKQs. Only the found keys are
+	   replied to, and the final NOOP reply tells that all the replies
+	   have been received. */
+	buffer_set_used_size(conn->cmd, 0);
+	for (i = 0; i < count; i++) {
+		if (memcached_dict_get_full_key(dict, keys[i], &key,
+						error_r) < 0)
+			return -1;
+		memcached_add_key_cmd(conn->cmd, MEMCACHED_CMD_GETKQ, key, i);
+	}
+	memcached_add_noop(conn->cmd);
+
+	conn->multi.values = i_new(char *, count);
+	conn->multi.count = count;
+	memcached_dict_send_and_wait(dict, MEMCACHED_REQUEST_MULTI);
+
+	if (!conn->reply.reply_received)
+		ret = memcached_dict_request_failed(dict, error_r);
+	else if (conn->error_status != MEMCACHED_RESPONSE_OK) {
+		*error_r = t_strconcat("Lookup failed: ",
+			memcached_status_error(conn->error_status), NULL);
+		ret = -1;
+	} else {
+		for (i = 0; i < count; i++) {
+			if (conn->multi.values[i] != NULL) {
+				values[i] = p_strdup(pool, conn->multi.values[i]);
+				ret = 1;
+			}
+		}
+	}
+	for (i = 0; i < count; i++)
+		i_free(conn->multi.values[i]);
+	i_free(conn->multi.values);
+	conn->multi.count = 0;
+	return ret;
+}
+
+static struct dict_transaction_context *
+memcached_transaction_init(struct dict *_dict)
+{
+	struct dict_transaction_memory_context *ctx;
+	pool_t pool;
+
+	pool = pool_alloconly_create("memcached dict transaction", 2048);
+	ctx = p_new(pool, struct dict_transaction_memory_context, 1);
+	dict_transaction_memory_init(ctx, _dict, pool);
+	return &ctx->ctx;
+}
+
+static int
+memcached_add_change(struct memcached_dict *dict, buffer_t *buf,
+		     const struct dict_transaction_memory_change *change,
+		     uint32_t opaque, const char **error_r)
+{
+	const char *key;
+	size_t key_len, value_len;
+	uint64_t num;
+	uint32_t num32;
+
+	if (memcached_dict_get_full_key(dict, change->key, &key, error_r) < 0)
 		return -1;
-	case MEMCACHED_RESPONSE_TEMPFAILURE:
-		*error_r = "Lookup failed: Temporary failure";
+	key_len = strlen(key);
+
+	switch (change->type) {
+	case DICT_CHANGE_TYPE_SET:
+		value_len = strlen(change->value.str);
+		/* extras: flags + expiration */
+		memcached_add_header(buf, MEMCACHED_CMD_SETQ, key_len, 8,
+				     value_len, opaque);
+		buffer_append_zero(buf, 8);
+		buffer_append(buf, key, key_len);
+		buffer_append(buf, change->value.str, value_len);
+		break;
+	case DICT_CHANGE_TYPE_UNSET:
+		memcached_add_key_cmd(buf, MEMCACHED_CMD_DELETEQ, key, opaque);
+		break;
+	case DICT_CHANGE_TYPE_INC:
+		/* extras: delta + initial value + expiration. Incrementing
+		   a nonexistent key creates it with the delta as its value.
+		   Decrementing it is a no-op. */
+		memcached_add_header(buf, change->value.diff >= 0 ?
+				     MEMCACHED_CMD_INCREMENTQ :
+				     MEMCACHED_CMD_DECREMENTQ,
+				     key_len, 20, 0, opaque);
+		num = change->value.diff >= 0 ?
+			(uint64_t)change->value.diff :
+			(uint64_t)-change->value.diff;
+		num = cpu64_to_be(num);
+		buffer_append(buf, &num, sizeof(num));
+		num = change->value.diff >= 0 ?
+			cpu64_to_be((uint64_t)change->value.diff) : 0;
+		buffer_append(buf, &num, sizeof(num));
+		num32 = change->value.diff >= 0 ? 0 :
+			cpu32_to_be(MEMCACHED_INCRDECR_NO_CREATE);
+		buffer_append(buf, &num32, sizeof(num32));
+		buffer_append(buf, key, key_len);
+		break;
+	}
+	return 0;
+}
+
+static int
+memcached_transaction_send(struct memcached_dict *dict,
+			   struct dict_transaction_memory_context *ctx,
+			   const char **error_r)
+{
+	struct memcached_connection *conn = dict->conn;
+	const struct dict_transaction_memory_change *change;
+
+	buffer_set_used_size(conn->cmd, 0);
+	array_foreach(&ctx->changes, change) {
+		if (memcached_add_change(dict, conn->cmd, change,
+					 array_foreach_idx(&ctx->changes, change),
+					 error_r) < 0)
+			return -1;
+	}
+	if (dict->noreply) {
+		/* fire and forget - failures are logged when they arrive */
+		memcached_dict_send_and_wait(dict, MEMCACHED_REQUEST_NONE);
+		if (!conn->connected)
+			return memcached_dict_request_failed(dict, error_r);
+		return 0;
+	}
+
+	memcached_add_noop(conn->cmd);
+	memcached_dict_send_and_wait(dict, MEMCACHED_REQUEST_WRITE);
+	if (!conn->reply.reply_received)
+		return memcached_dict_request_failed(dict, error_r);
+	if (conn->error_status != MEMCACHED_RESPONSE_OK) {
+		*error_r = t_strconcat("Write failed: ",
+			memcached_status_error(conn->error_status), NULL);
 		return -1;
 	}
+	return 0;
+}
 
-	*error_r = t_strdup_printf("Lookup failed: Error code=%u",
-				   dict->conn.reply.status);
-	return -1;
+static void
+memcached_transaction_commit(struct dict_transaction_context *_ctx,
+			     bool async ATTR_UNUSED,
+			     dict_transaction_commit_callback_t *callback,
+			     void *context)
+{
+	struct dict_transaction_memory_context *ctx =
+		(struct dict_transaction_memory_context *)_ctx;
+	struct memcached_dict *dict = (struct memcached_dict *)_ctx->dict;
+	struct dict_commit_result result = { DICT_COMMIT_RET_OK, NULL };
+
+	/* the writes are always done synchronously, except with noreply
+	   they don't wait for the replies */
+	if (_ctx->changed &&
+	    memcached_transaction_send(dict, ctx, &result.error) < 0)
+		result.ret = DICT_COMMIT_RET_FAILED;
+	callback(&result, context);
+	pool_unref(&ctx->pool);
 }
 
 struct dict dict_driver_memcached = {
@@ -369,5 +766,12 @@ struct dict dict_driver_memcached = {
 		.init = memcached_dict_init,
 		.deinit = memcached_dict_deinit,
 		.lookup = memcached_dict_lookup,
+		.transaction_init = memcached_transaction_init,
+		.transaction_commit = memcached_transaction_commit,
+		.transaction_rollback = dict_transaction_memory_rollback,
+		.set = dict_transaction_memory_set,
+		.unset = dict_transaction_memory_unset,
+		.atomic_inc = dict_transaction_memory_atomic_inc,
+		.lookup_multi = memcached_dict_lookup_multi,
 	}
 };
@@ -48,6 +48,18 @@ struct dict_vfuncs {
 	bool (*switch_ioloop)(struct dict *dict);
 	void (*set_timestamp)(struct dict_transaction_context *ctx,
 			      const struct timespec *ts);
+
+	/* values has space for all the keys. If these aren't implemented,
+	   the keys are looked up one by one. */
+	int (*lookup_multi)(struct dict *dict,
+			    const struct dict_op_settings *set, pool_t pool,
+			    const char *const *keys, const char **values,
+			    const char **error_r);
+	void (*lookup_multi_async)(struct dict *dict,
+				   const struct dict_op_settings *set,
+				   const char *const *keys,
+				   dict_lookup_multi_callback_t *callback,
+				   void *context);
 };
 
 struct dict_commit_callback_ctx;
@@ -10,6 +10,9 @@
 
 #define REDIS_DEFAULT_PORT 6379
 #define REDIS_DEFAULT_LOOKUP_TIMEOUT_MSECS (1000*30)
+#define REDIS_DEFAULT_MAX_CONNECTIONS 4
+#define REDIS_CLUSTER_SLOTS_COUNT 16384
+#define REDIS_CLUSTER_MAX_REDIRECTS 5
 #define DICT_USERNAME_SEPARATOR '/'
 
 enum redis_input_state {
@@ -17,8 +20,14 @@ enum redis_input_state {
 	REDIS_INPUT_STATE_AUTH,
 	/* expecting +OK reply for SELECT */
 	REDIS_INPUT_STATE_SELECT,
+	/* expecting +OK reply for ASKING */
+	REDIS_INPUT_STATE_ASKING,
 	/* expecting $-1 / $<size> followed by GET reply */
 	REDIS_INPUT_STATE_GET,
+	/* expecting *<nreplies> for MGET */
+	REDIS_INPUT_STATE_MGET,
+	/* expecting $-1 / $<size> followed by one of the MGET values */
+	REDIS_INPUT_STATE_MGET_VALUE,
 	/* expecting +QUEUED */
 	REDIS_INPUT_STATE_MULTI,
 	/* expecting +OK reply for DISCARD */
@@ -26,17 +35,25 @@ enum redis_input_state {
 	/* expecting *<nreplies> */
 	REDIS_INPUT_STATE_EXEC,
 	/* expecting EXEC reply */
-	REDIS_INPUT_STATE_EXEC_REPLY
+	REDIS_INPUT_STATE_EXEC_REPLY,
+	/* expecting reply to a write command sent in cluster mode */
+	REDIS_INPUT_STATE_CLUSTER_WRITE
 };
 
-struct redis_connection {
-	struct connection conn;
+struct redis_dict_lookup {
 	struct redis_dict *dict;
+	/* Full key of a GET. Used for resending it after a cluster
+	   redirect. */
+	char *key;
+	unsigned int redirect_count;
 
-	string_t *last_reply;
-	unsigned int bytes_left;
-	bool value_not_found;
-	bool value_received;
+	/* MGET values are i_strdup()ed directly to mget_values */
+	char **mget_values;
+	unsigned int mget_count, mget_received;
+	bool mget_found;
+
+	dict_lookup_callback_t *callback;
+	void *context;
 };
 
 struct redis_dict_reply {
@@ -45,49 +62,221 @@ struct redis_dict_reply {
 	void *context;
 };
 
-struct redis_dict {
-	struct dict dict;
-	char *password, *key_prefix, *expire_value;
-	unsigned int timeout_msecs, db_id;
+/* In cluster mode transactions can't be used, because the keys are usually
+   in different nodes. The commands are sent separately to the nodes and the
+   commit finishes after all of them have replied. */
+struct redis_dict_cluster_commit {
+	unsigned int pending_count;
+	enum dict_commit_ret ret;
+	char *error;
+
+	dict_transaction_commit_callback_t *callback;
+	void *context;
+};
+
+struct redis_cluster_write {
+	struct redis_dict_cluster_commit *commit;
+	char *key, *cmd;
+	unsigned int redirect_count;
+};
+
+struct redis_connection {
+	struct connection conn;
+	struct redis_dict *dict;
+
+	string_t *last_reply;
+	unsigned int bytes_left;
+	bool value_not_found;
 
-	struct redis_connection conn;
+	/* Commands sent before the connection was established */
+	string_t *delayed_output;
 
+	/* Expected replies for all the commands sent to this connection.
+	   The lookups, replies and cluster_writes arrays contain the extra
+	   information for the matching states in the same order. */
 	ARRAY(enum redis_input_state) input_states;
+	ARRAY(struct redis_dict_lookup *) lookups;
 	ARRAY(struct redis_dict_reply) replies;
+	ARRAY(struct redis_cluster_write) cluster_writes;
 
 	bool connected;
+	/* MULTI is (about to be) sent, but not EXEC or DISCARD yet */
 	bool transaction_open;
-	bool db_id_set;
+	/* Connection was lost while transaction was open */
+	bool transaction_disconnected;
+};
+
+struct redis_node {
+	struct ip_addr ip;
+	in_port_t port;
+	/* Connection pool - created as needed up to max_connections */
+	ARRAY(struct redis_connection *) conns;
+};
+
+struct redis_dict {
+	struct dict dict;
+	char *password, *key_prefix, *expire_value, *unix_path;
+	unsigned int timeout_msecs, db_id, max_connections;
+
+	/* The first node is the one configured in the URI. Other nodes are
+	   added when they're seen in cluster redirects. */
+	ARRAY(struct redis_node *) nodes;
+	/* Cluster mode: Hash slot -> node. NULL slots are sent to the first
+	   node, which redirects them to the right node. */
+	struct redis_node **slots;
+
+	bool transaction_open;
+	bool waiting_lookup;
 };
 
 struct redis_dict_transaction_context {
 	struct dict_transaction_context ctx;
+	/* Connection where the transaction is running (non-cluster mode) */
+	struct redis_connection *conn;
 	unsigned int cmd_count;
+	/* Cluster mode: Writes are buffered until commit */
+	ARRAY(struct redis_cluster_write) cluster_writes;
+	char *error;
+};
+
+/* The callbacks are called with a different data stack frame, so the values
+   are i_strdup()ed first and copied to the caller's pool at the end. */
+struct redis_dict_sync_lookup {
+	pool_t pool;
+	char **values;
+	unsigned int values_count;
+	unsigned int pending_count;
+	int ret;
 	char *error;
+	bool done;
+};
+
+struct redis_dict_sync_lookup_key {
+	struct redis_dict_sync_lookup *ctx;
+	unsigned int idx;
 };
 
 static struct connection_list *redis_connections;
 
 static void
-redis_input_state_add(struct redis_dict *dict, enum redis_input_state state)
+redis_dict_lookup_send(struct redis_dict *dict, struct redis_node *node,
+		       struct redis_dict_lookup *lookup, bool asking);
+static void
+redis_cluster_write_send(struct redis_dict *dict, struct redis_node *node,
+			 struct redis_cluster_write *write, bool asking);
+
+static void
+redis_input_state_add(struct redis_connection *conn,
+		      enum redis_input_state state)
+{
+	array_push_back(&conn->input_states, &state);
+}
+
+static void redis_input_state_remove(struct redis_connection *conn)
 {
-	array_push_back(&dict->input_states, &state);
+	array_pop_front(&conn->input_states);
 }
 
-static void redis_input_state_remove(struct redis_dict *dict)
+#define REDIS_DICT_FOREACH_CONN(dict, node, conn) \
+	array_foreach_elem(&(dict)->nodes, node) \
+		array_foreach_elem(&(node)->conns, conn)
+
+static bool redis_dict_have_pending(struct redis_dict *dict)
 {
-	array_pop_front(&dict->input_states);
+	struct redis_node *node;
+	struct redis_connection *conn;
+
+	REDIS_DICT_FOREACH_CONN(dict, node, conn) {
+		if (array_count(&conn->input_states) > 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void redis_dict_switch_conns_ioloop(struct redis_dict *dict)
+{
+	struct redis_node *node;
+	struct redis_connection *conn;
+
+	REDIS_DICT_FOREACH_CONN(dict, node, conn)
+		connection_switch_ioloop(&conn->conn);
+}
+
+static void redis_callback_ioloop_begin(struct redis_dict *dict)
+{
+	if (dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(dict->dict.prev_ioloop);
+}
+
+static void redis_callback_ioloop_end(struct redis_dict *dict)
+{
+	if (dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(dict->dict.ioloop);
 }
 
 static void redis_reply_callback(struct redis_connection *conn,
 				 const struct redis_dict_reply *reply,
 				 const struct dict_commit_result *result)
 {
-	if (conn->dict->dict.prev_ioloop != NULL)
-		io_loop_set_current(conn->dict->dict.prev_ioloop);
+	redis_callback_ioloop_begin(conn->dict);
 	reply->callback(result, reply->context);
-	if (conn->dict->dict.prev_ioloop != NULL)
-		io_loop_set_current(conn->dict->dict.ioloop);
+	redis_callback_ioloop_end(conn->dict);
+}
+
+static void
+redis_dict_lookup_finish(struct redis_dict_lookup **_lookup,
+			 const struct dict_lookup_result *result)
+{
+	struct redis_dict_lookup *lookup = *_lookup;
+
+	*_lookup = NULL;
+	redis_callback_ioloop_begin(lookup->dict);
+	lookup->callback(result, lookup->context);
+	redis_callback_ioloop_end(lookup->dict);
+	i_free(lookup->key);
+	i_free(lookup);
+}
+
+static void
+redis_dict_lookup_fail(struct redis_dict_lookup **lookup, const char *error)
+{
+	struct dict_lookup_result result = {
+		.ret = -1,
+		.error = error,
+	};
+	redis_dict_lookup_finish(lookup, &result);
+}
+
+static void
+redis_cluster_commit_finished(struct redis_dict *dict,
+			      struct redis_dict_cluster_commit *commit,
+			      const char *error)
+{
+	if (error != NULL && commit->ret == DICT_COMMIT_RET_OK) {
+		commit->ret = DICT_COMMIT_RET_FAILED;
+		commit->error = i_strdup(error);
+	}
+	i_assert(commit->pending_count > 0);
+	if (--commit->pending_count > 0)
+		return;
+
+	const struct dict_commit_result result = {
+		commit->ret, commit->error
+	};
+	redis_callback_ioloop_begin(dict);
+	commit->callback(&result, commit->context);
+	redis_callback_ioloop_end(dict);
+	i_free(commit->error);
+	i_free(commit);
+}
+
+static void
+redis_cluster_write_finish(struct redis_dict *dict,
+			   struct redis_cluster_write *write, const char *error)
+{
+	i_free(write->key);
+	i_free(write->cmd);
+	redis_cluster_commit_finished(dict, write->commit, error);
 }
 
 static void
@@ -96,16 +285,42 @@ redis_disconnected(struct redis_connection *conn, const char *reason)
 	const struct dict_commit_result result = {
 		DICT_COMMIT_RET_FAILED, reason
 	};
+	ARRAY(struct redis_dict_lookup *) lookups;
+	ARRAY(struct redis_dict_reply) replies;
+	ARRAY(struct redis_cluster_write) cluster_writes;
+	struct redis_dict_lookup *lookup;
 	const struct redis_dict_reply *reply;
+	struct redis_cluster_write *write;
 
-	conn->dict->db_id_set = FALSE;
-	conn->dict->connected = FALSE;
+	conn->connected = FALSE;
+	if (conn->transaction_open)
+		conn->transaction_disconnected = TRUE;
 	connection_disconnect(&conn->conn);
-
-	array_foreach(&conn->dict->replies, reply)
-		redis_reply_callback(conn, reply, &result);
-	array_clear(&conn->dict->replies);
-	array_clear(&conn->dict->input_states);
+	str_truncate(conn->delayed_output, 0);
+	conn->bytes_left = 0;
+	conn->value_not_found = FALSE;
+	array_clear(&conn->input_states);
+
+	/* the callbacks may send new commands to this connection, so move
+	   the pending requests away first */
+	t_array_init(&lookups, array_count(&conn->lookups) + 1);
+	array_append_array(&lookups, &conn->lookups);
+	array_clear(&conn->lookups);
+	t_array_init(&replies, array_count(&conn->replies) + 1);
+	array_append_array(&replies, &conn->replies);
+	array_clear(&conn->replies);
+	t_array_init(&cluster_writes, array_count(&conn->cluster_writes) + 1);
+	array_append_array(&cluster_writes, &conn->cluster_writes);
+	array_clear(&conn->cluster_writes);
+
+	array_foreach_elem(&lookups, lookup)
+		redis_dict_lookup_fail(&lookup, reason);
+	array_foreach(&replies, reply) {
+		if (reply->callback != NULL)
+			redis_reply_callback(conn, reply, &result);
+	}
+	array_foreach_modifiable(&cluster_writes, write)
+		redis_cluster_write_finish(conn->dict, write, reason);
 
 	if (conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
@@ -120,13 +335,23 @@ static void redis_conn_destroy(struct connection *_conn)
 
 static void redis_dict_wait_timeout(struct redis_dict *dict)
 {
+	struct redis_node *node;
+	struct redis_connection *conn;
 	const char *reason = t_strdup_printf(
-		"redis: Commit timed out in %u.%03u secs",
+		"redis: %s timed out in %u.%03u secs",
+		dict->waiting_lookup ? "Lookup" : "Commit",
 		dict->timeout_msecs/1000, dict->timeout_msecs%1000);
-	redis_disconnected(&dict->conn, reason);
+
+	REDIS_DICT_FOREACH_CONN(dict, node, conn) {
+		if (array_count(&conn->input_states) > 0)
+			redis_disconnected(conn, reason);
+	}
+	io_loop_stop(dict->dict.ioloop);
 }
 
-static void redis_wait(struct redis_dict *dict)
+/* Wait until *done is TRUE, or if done is NULL until there are no more
+   pending replies. */
+static void redis_wait(struct redis_dict *dict, const bool *done)
 {
 	struct timeout *to;
 
@@ -134,22 +359,181 @@ static void redis_wait(struct redis_dict *dict)
 
 	dict->dict.prev_ioloop = current_ioloop;
 	dict->dict.ioloop = io_loop_create();
+	dict->waiting_lookup = done != NULL;
 	to = timeout_add(dict->timeout_msecs, redis_dict_wait_timeout, dict);
-	connection_switch_ioloop(&dict->conn.conn);
+	redis_dict_switch_conns_ioloop(dict);
 
-	do {
+	while (done != NULL ? !*done : redis_dict_have_pending(dict))
 		io_loop_run(dict->dict.ioloop);
-	} while (array_count(&dict->input_states) > 0);
 
 	timeout_remove(&to);
 	io_loop_set_current(dict->dict.prev_ioloop);
-	connection_switch_ioloop(&dict->conn.conn);
+	redis_dict_switch_conns_ioloop(dict);
 	io_loop_set_current(dict->dict.ioloop);
 	io_loop_destroy(&dict->dict.ioloop);
 	dict->dict.prev_ioloop = NULL;
 }
 
-static int redis_input_get(struct redis_connection *conn, const char **error_r)
+static uint16_t redis_crc16(const unsigned char *data, size_t size)
+{
+	/* CRC16-CCITT (XMODEM), as used by Redis Cluster */
+	uint16_t crc = 0;
+	unsigned int i;
+
+	for (; size > 0; size--, data++) {
+		crc ^= *data << 8;
+		for (i = 0; i < 8; i++) {
+			if ((crc & 0x8000) != 0)
+				crc = (crc << 1) ^ 0x1021;
+			else
+				crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+static unsigned int redis_key_hash_slot(const char *key)
+{
+	const char *start, *end;
+	size_t len = strlen(key);
+
+	/* If the key contains a non-empty {hashtag}, only it is hashed */
+	start = strchr(key, '{');
+	if (start != NULL) {
+		end = strchr(start + 1, '}');
+		if (end != NULL && end != start + 1) {
+			key = start + 1;
+			len = end - key;
+		}
+	}
+	return redis_crc16((const unsigned char *)key, len) %
+		REDIS_CLUSTER_SLOTS_COUNT;
+}
+
+static struct redis_node *
+redis_dict_node_get(struct redis_dict *dict, const struct ip_addr *ip,
+		    in_port_t port)
+{
+	struct redis_node *node;
+
+	array_foreach_elem(&dict->nodes, node) {
+		if (node->port == port && net_ip_compare(&node->ip, ip))
+			return node;
+	}
+	node = i_new(struct redis_node, 1);
+	node->ip = *ip;
+	node->port = port;
+	i_array_init(&node->conns, dict->max_connections);
+	array_push_back(&dict->nodes, &node);
+	return node;
+}
+
+static struct redis_node *
+redis_dict_key_get_node(struct redis_dict *dict, const char *key)
+{
+	struct redis_node *node = NULL;
+
+	if (dict->slots != NULL)
+		node = dict->slots[redis_key_hash_slot(key)];
+	if (node == NULL)
+		node = array_idx_elem(&dict->nodes, 0);
+	return node;
+}
+
+/* Parse -MOVED or -ASK error. Returns TRUE if the command should be resent
+   to the returned node. */
+static bool
+redis_cluster_parse_redirect(struct redis_dict *dict, const char *line,
+			     struct redis_node **node_r, bool *asking_r)
+{
+	const char *const *args, *p, *host;
+	struct ip_addr ip;
+	in_port_t port;
+	unsigned int slot;
+
+	if (dict->slots == NULL)
+		return FALSE;
+
+	/* MOVED|ASK <slot> <ip>:<port> */
+	args = t_strsplit(line, " ");
+	if (str_array_length(args) != 3)
+		return FALSE;
+	if (strcmp(args[0], "MOVED") == 0)
+		*asking_r = FALSE;
+	else if (strcmp(args[0], "ASK") == 0)
+		*asking_r = TRUE;
+	else
+		return FALSE;
+	if (str_to_uint(args[1], &slot) < 0 ||
+	    slot >= REDIS_CLUSTER_SLOTS_COUNT)
+		return FALSE;
+	p = strrchr(args[2], ':');
+	if (p == NULL || net_str2port(p + 1, &port) < 0)
+		return FALSE;
+	host = t_strdup_until(args[2], p);
+	if (host[0] == '\0') {
+		/* unknown endpoint - it's the same host as the first node */
+		ip = array_idx_elem(&dict->nodes, 0)->ip;
+	} else if (net_addr2ip(host, &ip) < 0) {
+		return FALSE;
+	}
+
+	*node_r = redis_dict_node_get(dict, &ip, port);
+	if (!*asking_r)
+		dict->slots[slot] = *node_r;
+	return TRUE;
+}
+
+static void redis_input_get_finished(struct redis_connection *conn, bool mget)
+{
+	struct redis_dict_lookup *lookup =
+		array_idx_elem(&conn->lookups, 0);
+	struct dict_lookup_result result;
+	const char *values[2] = { NULL, NULL };
+
+	redis_input_state_remove(conn);
+	i_zero(&result);
+	if (mget) {
+		if (!conn->value_not_found) {
+			lookup->mget_values[lookup->mget_received] =
+				i_strdup(str_c(conn->last_reply));
+			lookup->mget_found = TRUE;
+		}
+		if (++lookup->mget_received < lookup->mget_count)
+			return;
+		result.ret = lookup->mget_found ? 1 : 0;
+	} else if (!conn->value_not_found) {
+		values[0] = str_c(conn->last_reply);
+		result.ret = 1;
+	}
+	result.value = values[0];
+	result.values = values;
+	array_pop_front(&conn->lookups);
+	redis_dict_lookup_finish(&lookup, &result);
+}
+
+static void redis_input_get_error(struct redis_connection *conn,
+				  const char *line)
+{
+	struct redis_dict_lookup *lookup =
+		array_idx_elem(&conn->lookups, 0);
+	struct redis_node *node;
+	bool asking;
+
+	redis_input_state_remove(conn);
+	array_pop_front(&conn->lookups);
+
+	if (redis_cluster_parse_redirect(conn->dict, line, &node, &asking) &&
+	    ++lookup->redirect_count <= REDIS_CLUSTER_MAX_REDIRECTS)
+		redis_dict_lookup_send(conn->dict, node, lookup, asking);
+	else {
+		redis_dict_lookup_fail(&lookup, t_strdup_printf(
+			"redis: GET failed: %s", line));
+	}
+}
+
+static int redis_input_get(struct redis_connection *conn, bool mget,
+			   const char **error_r)
 {
 	const unsigned char *data;
 	size_t size;
@@ -160,12 +544,15 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		line = i_stream_next_line(conn->conn.input);
 		if (line == NULL)
 			return 0;
+		str_truncate(conn->last_reply, 0);
+		conn->value_not_found = FALSE;
 		if (strcmp(line, "$-1") == 0) {
-			conn->value_received = TRUE;
 			conn->value_not_found = TRUE;
-			if (conn->dict->dict.ioloop != NULL)
-				io_loop_stop(conn->dict->dict.ioloop);
-			redis_input_state_remove(conn->dict);
+			redis_input_get_finished(conn, mget);
+			return 1;
+		}
+		if (line[0] == '-' && !mget) {
+			redis_input_get_error(conn, line + 1);
 			return 1;
 		}
 		if (line[0] != '$' || str_to_uint(line+1, &conn->bytes_left) < 0) {
@@ -188,26 +575,44 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		return 0;
 
 	/* reply fully read - drop trailing CRLF */
-	conn->value_received = TRUE;
 	str_truncate(conn->last_reply, str_len(conn->last_reply)-2);
-
-	if (conn->dict->dict.ioloop != NULL)
-		io_loop_stop(conn->dict->dict.ioloop);
-	redis_input_state_remove(conn->dict);
+	redis_input_get_finished(conn, mget);
 	return 1;
 }
 
+static void
+redis_input_cluster_write(struct redis_connection *conn, const char *line)
+{
+	struct redis_cluster_write write = *array_front(&conn->cluster_writes);
+	struct redis_node *node;
+	bool asking;
+
+	array_pop_front(&conn->cluster_writes);
+	if (*line == '+' || *line == ':') {
+		/* success, just ignore the actual reply */
+		redis_cluster_write_finish(conn->dict, &write, NULL);
+	} else if (*line == '-' &&
+		   redis_cluster_parse_redirect(conn->dict, line + 1,
+						&node, &asking) &&
+		   ++write.redirect_count <= REDIS_CLUSTER_MAX_REDIRECTS) {
+		redis_cluster_write_send(conn->dict, node, &write, asking);
+	} else {
+		redis_cluster_write_finish(conn->dict, &write,
+			t_strdup_printf("redis: Write failed: %s", line));
+	}
+}
+
 static int
 redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 {
-	struct redis_dict *dict = conn->dict;
 	struct redis_dict_reply *reply;
+	struct redis_dict_lookup *lookup;
 	const enum redis_input_state *states;
 	enum redis_input_state state;
 	unsigned int count, num_replies;
 	const char *line;
 
-	states = array_get(&dict->input_states, &count);
+	states = array_get(&conn->input_states, &count);
 	if (count == 0) {
 		line = i_stream_next_line(conn->conn.input);
 		if (line == NULL)
@@ -218,18 +623,33 @@ redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 	}
 	state = states[0];
 	if (state == REDIS_INPUT_STATE_GET)
-		return redis_input_get(conn, error_r);
+		return redis_input_get(conn, FALSE, error_r);
+	if (state == REDIS_INPUT_STATE_MGET_VALUE)
+		return redis_input_get(conn, TRUE, error_r);
 
 	line = i_stream_next_line(conn->conn.input);
 	if (line == NULL)
 		return 0;
 
-	redis_input_state_remove(dict);
+	redis_input_state_remove(conn);
 	switch (state) {
 	case REDIS_INPUT_STATE_GET:
+	case REDIS_INPUT_STATE_MGET_VALUE:
 		i_unreached();
+	case REDIS_INPUT_STATE_MGET:
+		if (line[0] != '*' || str_to_uint(line+1, &num_replies) < 0)
+			break;
+		lookup = array_idx_elem(&conn->lookups, 0);
+		if (lookup->mget_count != num_replies) {
+			*error_r = t_strdup_printf(
+				"redis: MGET expected %u replies, not %u",
+				lookup->mget_count, num_replies);
+			return -1;
+		}
+		return 1;
 	case REDIS_INPUT_STATE_AUTH:
 	case REDIS_INPUT_STATE_SELECT:
+	case REDIS_INPUT_STATE_ASKING:
 	case REDIS_INPUT_STATE_MULTI:
 	case REDIS_INPUT_STATE_DISCARD:
 		if (line[0] != '+')
@@ -239,7 +659,7 @@ redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 		if (line[0] != '*' || str_to_uint(line+1, &num_replies) < 0)
 			break;
 
-		reply = array_front_modifiable(&dict->replies);
+		reply = array_front_modifiable(&conn->replies);
 		i_assert(reply->reply_count > 0);
 		if (reply->reply_count != num_replies) {
 			*error_r = t_strdup_printf(
@@ -252,24 +672,24 @@ redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 		if (*line != '+' && *line != ':')
 			break;
 		/* success, just ignore the actual reply */
-		reply = array_front_modifiable(&dict->replies);
+		reply = array_front_modifiable(&conn->replies);
 		i_assert(reply->reply_count > 0);
 		if (--reply->reply_count == 0) {
 			const struct dict_commit_result result = {
 				DICT_COMMIT_RET_OK, NULL
 			};
-			redis_reply_callback(conn, reply, &result);
-			array_pop_front(&dict->replies);
-			/* if we're running in a dict-ioloop, we're handling a
-			   synchronous commit and need to stop now */
-			if (array_count(&dict->replies) == 0 &&
-			    conn->dict->dict.ioloop != NULL)
-				io_loop_stop(conn->dict->dict.ioloop);
+			struct redis_dict_reply reply_copy = *reply;
+
+			array_pop_front(&conn->replies);
+			redis_reply_callback(conn, &reply_copy, &result);
 		}
 		return 1;
+	case REDIS_INPUT_STATE_CLUSTER_WRITE:
+		redis_input_cluster_write(conn, line);
+		return 1;
 	}
-	str_truncate(dict->conn.last_reply, 0);
-	str_append(dict->conn.last_reply, line);
+	str_truncate(conn->last_reply, 0);
+	str_append(conn->last_reply, line);
 	*error_r = t_strdup_printf("redis: Unexpected input (state=%d): %s", state, line);
 	return -1;
 }
@@ -295,6 +715,9 @@ static void redis_conn_input(struct connection *_conn)
 		i_assert(error != NULL);
 		redis_disconnected(conn, error);
 	}
+	/* if we're running in a dict-ioloop, check if the wait is over */
+	if (conn->dict->dict.ioloop != NULL)
+		io_loop_stop(conn->dict->dict.ioloop);
 }
 
 static void redis_conn_connected(struct connection *_conn, bool success)
@@ -304,7 +727,11 @@ static void redis_conn_connected(struct connection *_conn, bool success)
 	if (!success) {
 		e_error(conn->conn.event, "connect() failed: %m");
 	} else {
-		conn->dict->connected = TRUE;
+		conn->connected = TRUE;
+		o_stream_nsend(conn->conn.output,
+			       str_data(conn->delayed_output),
+			       str_len(conn->delayed_output));
+		str_truncate(conn->delayed_output, 0);
 	}
 	if (conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
@@ -322,6 +749,145 @@ static const struct connection_vfuncs redis_conn_vfuncs = {
 	.client_connected = redis_conn_connected
 };
 
+static struct redis_connection *
+redis_conn_create(struct redis_dict *dict, struct redis_node *node)
+{
+	struct redis_connection *conn;
+
+	conn = i_new(struct redis_connection, 1);
+	conn->dict = dict;
+	conn->conn.event_parent = dict->dict.event;
+	if (dict->unix_path != NULL) {
+		connection_init_client_unix(redis_connections, &conn->conn,
+					    dict->unix_path);
+	} else {
+		connection_init_client_ip(redis_connections, &conn->conn,
+					  NULL, &node->ip, node->port);
+	}
+	event_set_append_log_prefix(conn->conn.event, "redis: ");
+	conn->last_reply = str_new(default_pool, 256);
+	conn->delayed_output = str_new(default_pool, 128);
+	i_array_init(&conn->input_states, 4);
+	i_array_init(&conn->lookups, 4);
+	i_array_init(&conn->replies, 4);
+	i_array_init(&conn->cluster_writes, 4);
+	array_push_back(&node->conns, &conn);
+	return conn;
+}
+
+static void redis_conn_free(struct redis_connection **_conn)
+{
+	struct redis_connection *conn = *_conn;
+
+	*_conn = NULL;
+	if (array_count(&conn->input_states) > 0)
+		redis_disconnected(conn, "redis: Dict deinitialized");
+	connection_deinit(&conn->conn);
+	str_free(&conn->last_reply);
+	str_free(&conn->delayed_output);
+	array_free(&conn->input_states);
+	array_free(&conn->lookups);
+	array_free(&conn->replies);
+	array_free(&conn->cluster_writes);
+	i_free(conn);
+}
+
+static void
+redis_conn_send(struct redis_connection *conn, const void *data, size_t size)
+{
+	if (conn->connected)
+		o_stream_nsend(conn->conn.output, data, size);
+	else
+		str_append_data(conn->delayed_output, data, size);
+}
+
+static void redis_conn_send_str(struct redis_connection *conn, const char *str)
+{
+	redis_conn_send(conn, str, strlen(str));
+}
+
+/* Returns the connection that should be used for the next command to the
+   node. Writes and the lookups after them are kept in the same connection,
+   so the lookups see the written values. Otherwise an idle connection is
+   preferred, and a new one is created if there are none. */
+static struct redis_connection *
+redis_node_get_conn(struct redis_dict *dict, struct redis_node *node)
+{
+	struct redis_connection *conn, *best = NULL;
+
+	array_foreach_elem(&node->conns, conn) {
+		if (conn->transaction_open)
+			continue;
+		if (array_count(&conn->replies) > 0 ||
+		    array_count(&conn->cluster_writes) > 0)
+			return conn;
+		if (best == NULL ||
+		    array_count(&conn->input_states) <
+		    array_count(&best->input_states))
+			best = conn;
+	}
+	if ((best == NULL || array_count(&best->input_states) > 0) &&
+	    array_count(&node->conns) < dict->max_connections)
+		return redis_conn_create(dict, node);
+	if (best == NULL) {
+		/* all the connections have an open transaction */
+		best = array_idx_elem(&node->conns, 0);
+	}
+	return best;
+}
+
+static void redis_conn_auth(struct redis_connection *conn)
+{
+	const char *cmd, *password = conn->dict->password;
+
+	if (*password == '\0')
+		return;
+
+	cmd = t_strdup_printf("*2\r\n$4\r\nAUTH\r\n$%d\r\n%s\r\n",
+	                      (int)strlen(password), password);
+	redis_conn_send_str(conn, cmd);
+	redis_input_state_add(conn, REDIS_INPUT_STATE_AUTH);
+}
+
+static void redis_conn_select_db(struct redis_connection *conn)
+{
+	const char *cmd, *db_str;
+
+	if (conn->dict->db_id == 0) {
+		/* 0 is the default */
+		return;
+	}
+	db_str = dec2str(conn->dict->db_id);
+	cmd = t_strdup_printf("*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",
+			      (int)strlen(db_str), db_str);
+	redis_conn_send_str(conn, cmd);
+	redis_input_state_add(conn, REDIS_INPUT_STATE_SELECT);
+}
+
+/* Start connecting if we're not connected yet. Commands can be sent
+   immediately afterwards - they're delayed until the connection is
+   established. */
+static int redis_conn_start(struct redis_connection *conn, const char **error_r)
+{
+	if (conn->conn.fd_in != -1)
+		return 0;
+	if (connection_client_connect(&conn->conn) < 0) {
+		*error_r = t_strdup_printf("redis: Couldn't connect to %s: %m",
+					   conn->conn.name);
+		return -1;
+	}
+	/* AUTH and SELECT are always the first commands */
+	redis_conn_auth(conn);
+	redis_conn_select_db(conn);
+	return 0;
+}
+
+static void redis_conn_send_asking(struct redis_connection *conn)
+{
+	redis_conn_send_str(conn, "*1\r\n$6\r\nASKING\r\n");
+	redis_input_state_add(conn, REDIS_INPUT_STATE_ASKING);
+}
+
 static const char *redis_escape_username(const char *username)
 {
 	const char *p;
@@ -344,14 +910,15 @@ static const char *redis_escape_username(const char *username)
 
 static int
 redis_dict_init(struct dict *driver, const char *uri,
-		const struct dict_settings *set,
+		const struct dict_settings *set ATTR_UNUSED,
 		struct dict **dict_r, const char **error_r)
 {
 	struct redis_dict *dict;
 	struct ip_addr ip;
 	unsigned int secs;
 	in_port_t port = REDIS_DEFAULT_PORT;
-	const char *const *args, *unix_path = NULL;
+	const char *const *args;
+	bool cluster = FALSE;
 	int ret = 0;
 
 	if (redis_connections == NULL) {
@@ -364,13 +931,15 @@ redis_dict_init(struct dict *driver, const char *uri,
 	if (net_addr2ip("127.0.0.1", &ip) < 0)
 		i_unreached();
 	dict->timeout_msecs = REDIS_DEFAULT_LOOKUP_TIMEOUT_MSECS;
+	dict->max_connections = REDIS_DEFAULT_MAX_CONNECTIONS;
 	dict->key_prefix = i_strdup("");
 	dict->password   = i_strdup("");
 
 	args = t_strsplit(uri, ":");
 	for (; *args != NULL; args++) {
 		if (str_begins(*args, "path=")) {
-			unix_path = *args + 5;
+			i_free(dict->unix_path);
+			dict->unix_path = i_strdup(*args + 5);
 		} else if (str_begins(*args, "host=")) {
 			if (net_addr2ip(*args+5, &ip) < 0) {
 				*error_r = t_strdup_printf("Invalid IP: %s",
@@ -408,6 +977,25 @@ redis_dict_init(struct dict *driver, const char *uri,
 					"Invalid timeout_msecs: %s", *args+14);
 				ret = -1;
 			}
+		} else if (str_begins(*args, "max_connections=")) {
+			if (str_to_uint(*args+16, &dict->max_connections) < 0 ||
+			    dict->max_connections == 0) {
+				*error_r = t_strdup_printf(
+					"Invalid max_connections: %s", *args+16);
+				ret = -1;
+			}
+		} else if (str_begins(*args, "cluster=")) {
+			const char *value = *args + 8;
+
+			if (strcmp(value, "yes") == 0)
+				cluster = TRUE;
+			else if (strcmp(value, "no") == 0)
+				cluster = FALSE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid cluster value: %s", value);
+				ret = -1;
+			}
 		} else if (str_begins(*args, "password=")) {
 			i_free(dict->password);
 			dict->password = i_strdup(*args + 9);
@@ -417,30 +1005,33 @@ redis_dict_init(struct dict *driver, const char *uri,
 			ret = -1;
 		}
 	}
+	if (ret == 0 && cluster) {
+		if (dict->unix_path != NULL) {
+			*error_r = "cluster=yes can't be used with path";
+			ret = -1;
+		} else if (dict->db_id != 0) {
+			*error_r = "cluster=yes supports only db=0";
+			ret = -1;
+		}
+	}
 	if (ret < 0) {
+		i_free(dict->unix_path);
+		i_free(dict->expire_value);
 		i_free(dict->password);
 		i_free(dict->key_prefix);
 		i_free(dict);
 		return -1;
 	}
 
-	dict->conn.conn.event_parent = set->event_parent;
-
-	if (unix_path != NULL) {
-		connection_init_client_unix(redis_connections, &dict->conn.conn,
-					    unix_path);
-	} else {
-		connection_init_client_ip(redis_connections, &dict->conn.conn,
-					  NULL, &ip, port);
-	}
-	event_set_append_log_prefix(dict->conn.conn.event, "redis: ");
 	dict->dict = *driver;
-	dict->conn.last_reply = str_new(default_pool, 256);
-	dict->conn.dict = dict;
-
-	i_array_init(&dict->input_states, 4);
-	i_array_init(&dict->replies, 4);
+	i_array_init(&dict->nodes, 4);
+	(void)redis_dict_node_get(dict, &ip, port);
+	if (cluster) {
+		dict->slots = i_new(struct redis_node *,
+				    REDIS_CLUSTER_SLOTS_COUNT);
+	}
 
+	/* connections are created when they're needed */
 	*dict_r = &dict->dict;
 	return 0;
 }
@@ -448,15 +1039,20 @@ redis_dict_init(struct dict *driver, const char *uri,
 static void redis_dict_deinit(struct dict *_dict)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
-
-	if (array_count(&dict->input_states) > 0) {
-		i_assert(dict->connected);
-		redis_wait(dict);
+	struct redis_node *node;
+	struct redis_connection *conn;
+
+	if (redis_dict_have_pending(dict))
+		redis_wait(dict, NULL);
+	array_foreach_elem(&dict->nodes, node) {
+		array_foreach_elem(&node->conns, conn)
+			redis_conn_free(&conn);
+		array_free(&node->conns);
+		i_free(node);
 	}
-	connection_deinit(&dict->conn.conn);
-	str_free(&dict->conn.last_reply);
-	array_free(&dict->replies);
-	array_free(&dict->input_states);
+	array_free(&dict->nodes);
+	i_free(dict->slots);
+	i_free(dict->unix_path);
 	i_free(dict->expire_value);
 	i_free(dict->key_prefix);
 	i_free(dict->password);
@@ -470,16 +1066,16 @@ static void redis_dict_wait(struct dict *_dict)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
 
-	if (array_count(&dict->input_states) > 0)
-		redis_wait(dict);
+	if (redis_dict_have_pending(dict))
+		redis_wait(dict, NULL);
 }
 
-static void redis_dict_lookup_timeout(struct redis_dict *dict)
+static bool redis_dict_switch_ioloop(struct dict *_dict)
 {
-	const char *reason = t_strdup_printf(
-		"redis: Lookup timed out in %u.%03u secs",
-		dict->timeout_msecs/1000, dict->timeout_msecs%1000);
-	redis_disconnected(&dict->conn, reason);
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+
+	redis_dict_switch_conns_ioloop(dict);
+	return redis_dict_have_pending(dict);
 }
 
 static const char *
@@ -504,35 +1100,92 @@ redis_dict_get_full_key(struct redis_dict *dict, const char *username,
 	return key;
 }
 
-static void redis_dict_auth(struct redis_dict *dict)
+static void
+redis_dict_lookup_send(struct redis_dict *dict, struct redis_node *node,
+		       struct redis_dict_lookup *lookup, bool asking)
 {
-	const char *cmd;
+	struct redis_connection *conn;
+	const char *cmd, *error;
 
-	if (*dict->password == '\0')
+	conn = redis_node_get_conn(dict, node);
+	if (redis_conn_start(conn, &error) < 0) {
+		redis_dict_lookup_fail(&lookup, error);
 		return;
+	}
+	if (asking)
+		redis_conn_send_asking(conn);
+	cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
+			      (int)strlen(lookup->key), lookup->key);
+	redis_conn_send_str(conn, cmd);
+	redis_input_state_add(conn, REDIS_INPUT_STATE_GET);
+	array_push_back(&conn->lookups, &lookup);
+}
 
-	cmd = t_strdup_printf("*2\r\n$4\r\nAUTH\r\n$%d\r\n%s\r\n",
-	                      (int)strlen(dict->password), dict->password);
-	o_stream_nsend_str(dict->conn.conn.output, cmd);
-	redis_input_state_add(dict, REDIS_INPUT_STATE_AUTH);
+static void
+redis_dict_lookup_start(struct redis_dict *dict, const char *key,
+			dict_lookup_callback_t *callback, void *context)
+{
+	struct redis_dict_lookup *lookup;
+
+	lookup = i_new(struct redis_dict_lookup, 1);
+	lookup->dict = dict;
+	lookup->key = i_strdup(key);
+	lookup->callback = callback;
+	lookup->context = context;
+	redis_dict_lookup_send(dict, redis_dict_key_get_node(dict, key),
+			       lookup, FALSE);
 }
 
-static void redis_dict_select_db(struct redis_dict *dict)
+static void
+redis_dict_sync_lookup_callback(const struct dict_lookup_result *result,
+				struct redis_dict_sync_lookup_key *key_ctx)
 {
-	const char *cmd, *db_str;
+	struct redis_dict_sync_lookup *ctx = key_ctx->ctx;
 
-	if (dict->db_id_set)
-		return;
-	dict->db_id_set = TRUE;
-	if (dict->db_id == 0) {
-		/* 0 is the default */
-		return;
+	if (result->ret < 0) {
+		if (ctx->ret >= 0) {
+			ctx->ret = -1;
+			ctx->error = i_strdup(result->error);
+		}
+	} else if (result->ret > 0) {
+		ctx->values[key_ctx->idx] = i_strdup(result->value);
+		if (ctx->ret == 0)
+			ctx->ret = 1;
 	}
-	db_str = dec2str(dict->db_id);
-	cmd = t_strdup_printf("*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",
-			      (int)strlen(db_str), db_str);
-	o_stream_nsend_str(dict->conn.conn.output, cmd);
-	redis_input_state_add(dict, REDIS_INPUT_STATE_SELECT);
+	i_assert(ctx->pending_count > 0);
+	if (--ctx->pending_count == 0)
+		ctx->done = TRUE;
+}
+
+static void
+redis_dict_sync_lookup_mget_callback(const struct dict_lookup_result *result,
+				     struct redis_dict_sync_lookup *ctx)
+{
+	/* the values were already written to ctx->values */
+	ctx->ret = result->ret;
+	ctx->error = i_strdup(result->error);
+	ctx->pending_count = 0;
+	ctx->done = TRUE;
+}
+
+static int
+redis_dict_sync_lookup_wait(struct redis_dict *dict,
+			    struct redis_dict_sync_lookup *ctx,
+			    const char **values, const char **error_r)
+{
+	unsigned int i;
+
+	if (!ctx->done)
+		redis_wait(dict, &ctx->done);
+	i_assert(ctx->done);
+	for (i = 0; i < ctx->values_count; i++) {
+		values[i] = p_strdup(ctx->pool, ctx->values[i]);
+		i_free(ctx->values[i]);
+	}
+	if (ctx->ret < 0)
+		*error_r = t_strdup(ctx->error);
+	i_free(ctx->error);
+	return ctx->ret;
 }
 
 static int redis_dict_lookup(struct dict *_dict,
@@ -541,67 +1194,104 @@ static int redis_dict_lookup(struct dict *_dict,
 			     const char **value_r, const char **error_r)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
-	struct timeout *to;
-	const char *cmd;
+	struct redis_dict_sync_lookup ctx;
+	struct redis_dict_sync_lookup_key key_ctx;
+	char *tmp_value = NULL;
+	const char *value;
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.values = &tmp_value;
+	ctx.values_count = 1;
+	ctx.pending_count = 1;
+	key_ctx.ctx = &ctx;
+	key_ctx.idx = 0;
 
 	key = redis_dict_get_full_key(dict, set->username, key);
+	redis_dict_lookup_start(dict, key, (dict_lookup_callback_t *)
+				redis_dict_sync_lookup_callback, &key_ctx);
+	if (redis_dict_sync_lookup_wait(dict, &ctx, &value, error_r) <= 0)
+		return ctx.ret;
+	*value_r = value;
+	return 1;
+}
 
-	dict->conn.value_received = FALSE;
-	dict->conn.value_not_found = FALSE;
-
-	i_assert(dict->dict.ioloop == NULL);
-
-	dict->dict.prev_ioloop = current_ioloop;
-	dict->dict.ioloop = io_loop_create();
-	connection_switch_ioloop(&dict->conn.conn);
+static void
+redis_dict_lookup_async(struct dict *_dict, const struct dict_op_settings *set,
+			const char *key, dict_lookup_callback_t *callback,
+			void *context)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
 
-	if (dict->conn.conn.fd_in == -1 &&
-	    connection_client_connect(&dict->conn.conn) < 0) {
-		e_error(dict->conn.conn.event, "Couldn't connect");
-	} else {
-		to = timeout_add(dict->timeout_msecs,
-				 redis_dict_lookup_timeout, dict);
-		if (!dict->connected) {
-			/* wait for connection */
-			io_loop_run(dict->dict.ioloop);
-			if (dict->connected)
-				redis_dict_auth(dict);
-		}
+	/* the lookups are pipelined - the command is sent immediately
+	   without waiting for the previous replies */
+	key = redis_dict_get_full_key(dict, set->username, key);
+	redis_dict_lookup_start(dict, key, callback, context);
+}
 
-		if (dict->connected) {
-			redis_dict_select_db(dict);
-			cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
-					      (int)strlen(key), key);
-			o_stream_nsend_str(dict->conn.conn.output, cmd);
-
-			str_truncate(dict->conn.last_reply, 0);
-			redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
-			do {
-				io_loop_run(dict->dict.ioloop);
-			} while (array_count(&dict->input_states) > 0);
+static int redis_dict_lookup_multi(struct dict *_dict,
+				   const struct dict_op_settings *set,
+				   pool_t pool, const char *const *keys,
+				   const char **values, const char **error_r)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	struct redis_dict_sync_lookup ctx;
+	struct redis_dict_sync_lookup_key *key_ctxs;
+	struct redis_dict_lookup *lookup;
+	struct redis_connection *conn;
+	string_t *cmd;
+	const char *key, *error;
+	unsigned int i, count = str_array_length(keys);
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.values = t_new(char *, count);
+	ctx.values_count = count;
+
+	if (dict->slots != NULL) {
+		/* cluster mode: the keys are most likely in different slots,
+		   which MGET doesn't allow. Send pipelined GETs instead. */
+		ctx.pending_count = count;
+		key_ctxs = t_new(struct redis_dict_sync_lookup_key, count);
+		for (i = 0; i < count; i++) {
+			key_ctxs[i].ctx = &ctx;
+			key_ctxs[i].idx = i;
+			key = redis_dict_get_full_key(dict, set->username,
+						      keys[i]);
+			redis_dict_lookup_start(dict, key,
+				(dict_lookup_callback_t *)
+				redis_dict_sync_lookup_callback, &key_ctxs[i]);
 		}
-		timeout_remove(&to);
+		return redis_dict_sync_lookup_wait(dict, &ctx, values, error_r);
 	}
 
-	io_loop_set_current(dict->dict.prev_ioloop);
-	connection_switch_ioloop(&dict->conn.conn);
-	io_loop_set_current(dict->dict.ioloop);
-	io_loop_destroy(&dict->dict.ioloop);
-	dict->dict.prev_ioloop = NULL;
-
-	if (!dict->conn.value_received) {
-		/* we failed in some way. make sure we disconnect since the
-		   connection state isn't known anymore */
-		*error_r = t_strdup_printf("redis: Communication failure (last reply: %s)",
-					   str_c(dict->conn.last_reply));
-		redis_disconnected(&dict->conn, *error_r);
-		return -1;
+	cmd = t_str_new(128);
+	str_printfa(cmd, "*%u\r\n$4\r\nMGET\r\n", count + 1);
+	for (i = 0; i < count; i++) {
+		key = redis_dict_get_full_key(dict, set->username, keys[i]);
+		str_printfa(cmd, "$%zu\r\n%s\r\n", strlen(key), key);
 	}
-	if (dict->conn.value_not_found)
-		return 0;
 
-	*value_r = p_strdup(pool, str_c(dict->conn.last_reply));
-	return 1;
+	lookup = i_new(struct redis_dict_lookup, 1);
+	lookup->dict = dict;
+	lookup->mget_values = ctx.values;
+	lookup->mget_count = count;
+	lookup->callback = (dict_lookup_callback_t *)
+		redis_dict_sync_lookup_mget_callback;
+	lookup->context = &ctx;
+	ctx.pending_count = 1;
+
+	conn = redis_node_get_conn(dict, array_idx_elem(&dict->nodes, 0));
+	if (redis_conn_start(conn, &error) < 0)
+		redis_dict_lookup_fail(&lookup, error);
+	else {
+		redis_conn_send(conn, str_data(cmd), str_len(cmd));
+		redis_input_state_add(conn, REDIS_INPUT_STATE_MGET);
+		for (i = 0; i < count; i++)
+			redis_input_state_add(conn, REDIS_INPUT_STATE_MGET_VALUE);
+		array_push_back(&conn->lookups, &lookup);
+	}
+	return redis_dict_sync_lookup_wait(dict, &ctx, values, error_r);
 }
 
 static struct dict_transaction_context *
@@ -609,6 +1299,7 @@ redis_transaction_init(struct dict *_dict)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
 	struct redis_dict_transaction_context *ctx;
+	const char *error;
 
 	i_assert(!dict->transaction_open);
 	dict->transaction_open = TRUE;
@@ -616,20 +1307,84 @@ redis_transaction_init(struct dict *_dict)
 	ctx = i_new(struct redis_dict_transaction_context, 1);
 	ctx->ctx.dict = _dict;
 
-	if (dict->conn.conn.fd_in == -1 &&
-	    connection_client_connect(&dict->conn.conn) < 0) {
-		e_error(dict->conn.conn.event, "Couldn't connect");
-	} else if (!dict->connected) {
-		/* wait for connection */
-		redis_wait(dict);
-		if (dict->connected)
-			redis_dict_auth(dict);
-	}
-	if (dict->connected)
-		redis_dict_select_db(dict);
+	if (dict->slots != NULL) {
+		i_array_init(&ctx->cluster_writes, 8);
+		return &ctx->ctx;
+	}
+
+	ctx->conn = redis_node_get_conn(dict, array_idx_elem(&dict->nodes, 0));
+	ctx->conn->transaction_open = TRUE;
+	ctx->conn->transaction_disconnected = FALSE;
+	if (redis_conn_start(ctx->conn, &error) < 0)
+		ctx->error = i_strdup(error);
 	return &ctx->ctx;
 }
 
+static void
+redis_transaction_free(struct redis_dict_transaction_context *ctx)
+{
+	struct redis_cluster_write *write;
+
+	if (array_is_created(&ctx->cluster_writes)) {
+		array_foreach_modifiable(&ctx->cluster_writes, write) {
+			i_free(write->key);
+			i_free(write->cmd);
+		}
+		array_free(&ctx->cluster_writes);
+	}
+	i_free(ctx->error);
+	i_free(ctx);
+}
+
+static void
+redis_cluster_write_send(struct redis_dict *dict, struct redis_node *node,
+			 struct redis_cluster_write *write, bool asking)
+{
+	struct redis_connection *conn;
+	const char *error;
+
+	conn = redis_node_get_conn(dict, node);
+	if (redis_conn_start(conn, &error) < 0) {
+		redis_cluster_write_finish(dict, write, error);
+		return;
+	}
+	if (asking)
+		redis_conn_send_asking(conn);
+	redis_conn_send_str(conn, write->cmd);
+	redis_input_state_add(conn, REDIS_INPUT_STATE_CLUSTER_WRITE);
+	array_push_back(&conn->cluster_writes, write);
+}
+
+static void
+redis_transaction_commit_cluster(struct redis_dict_transaction_context *ctx,
+				 bool async,
+				 dict_transaction_commit_callback_t *callback,
+				 void *context)
+{
+	struct redis_dict *dict = (struct redis_dict *)ctx->ctx.dict;
+	struct redis_dict_cluster_commit *commit;
+	struct redis_cluster_write *write;
+
+	commit = i_new(struct redis_dict_cluster_commit, 1);
+	commit->ret = DICT_COMMIT_RET_OK;
+	commit->callback = callback;
+	commit->context = context;
+	/* keep the commit referenced until all the writes are sent */
+	commit->pending_count = array_count(&ctx->cluster_writes) + 1;
+
+	array_foreach_modifiable(&ctx->cluster_writes, write) {
+		write->commit = commit;
+		redis_cluster_write_send(dict,
+			redis_dict_key_get_node(dict, write->key), write, FALSE);
+	}
+	array_clear(&ctx->cluster_writes);
+	redis_transaction_free(ctx);
+
+	redis_cluster_commit_finished(dict, commit, NULL);
+	if (!async)
+		redis_wait(dict, NULL);
+}
+
 static void
 redis_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 			 dict_transaction_commit_callback_t *callback,
@@ -638,6 +1393,7 @@ redis_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 	struct redis_dict_transaction_context *ctx =
 		(struct redis_dict_transaction_context *)_ctx;
 	struct redis_dict *dict = (struct redis_dict *)_ctx->dict;
+	struct redis_connection *conn = ctx->conn;
 	struct redis_dict_reply *reply;
 	unsigned int i;
 	struct dict_commit_result result = { .ret = DICT_COMMIT_RET_OK };
@@ -645,32 +1401,38 @@ redis_transaction_commit(struct dict_transaction_context *_ctx, bool async,
 	i_assert(dict->transaction_open);
 	dict->transaction_open = FALSE;
 
+	if (dict->slots != NULL) {
+		redis_transaction_commit_cluster(ctx, async, callback, context);
+		return;
+	}
+
+	conn->transaction_open = FALSE;
+	if (ctx->error == NULL && conn->transaction_disconnected)
+		ctx->error = i_strdup("Disconnected during transaction");
 	if (ctx->error != NULL) {
 		/* make sure we're disconnected */
-		redis_disconnected(&dict->conn, ctx->error);
+		if (!conn->transaction_disconnected)
+			redis_disconnected(conn, ctx->error);
 		result.ret = -1;
 		result.error = ctx->error;
 	} else if (_ctx->changed) {
 		i_assert(ctx->cmd_count > 0);
 
-		o_stream_nsend_str(dict->conn.conn.output,
-				   "*1\r\n$4\r\nEXEC\r\n");
-		reply = array_append_space(&dict->replies);
+		redis_conn_send_str(conn, "*1\r\n$4\r\nEXEC\r\n");
+		reply = array_append_space(&conn->replies);
 		reply->callback = callback;
 		reply->context = context;
 		reply->reply_count = ctx->cmd_count;
-		redis_input_state_add(dict, REDIS_INPUT_STATE_EXEC);
+		redis_input_state_add(conn, REDIS_INPUT_STATE_EXEC);
 		for (i = 0; i < ctx->cmd_count; i++)
-			redis_input_state_add(dict, REDIS_INPUT_STATE_EXEC_REPLY);
-		if (async) {
-			i_free(ctx);
-			return;
-		}
-		redis_wait(dict);
+			redis_input_state_add(conn, REDIS_INPUT_STATE_EXEC_REPLY);
+		redis_transaction_free(ctx);
+		if (!async)
+			redis_wait(dict, NULL);
+		return;
 	}
 	callback(&result, context);
-	i_free(ctx->error);
-	i_free(ctx);
+	redis_transaction_free(ctx);
 }
 
 static void redis_transaction_rollback(struct dict_transaction_context *_ctx)
@@ -678,63 +1440,77 @@ static void redis_transaction_rollback(struct dict_transaction_context *_ctx)
 	struct redis_dict_transaction_context *ctx =
 		(struct redis_dict_transaction_context *)_ctx;
 	struct redis_dict *dict = (struct redis_dict *)_ctx->dict;
-	struct redis_dict_reply *reply;
+	struct redis_connection *conn = ctx->conn;
 
 	i_assert(dict->transaction_open);
 	dict->transaction_open = FALSE;
 
-	if (ctx->error != NULL) {
+	if (conn == NULL) {
+		/* cluster mode - nothing was sent yet */
+	} else if (ctx->error != NULL) {
+		conn->transaction_open = FALSE;
 		/* make sure we're disconnected */
-		redis_disconnected(&dict->conn, ctx->error);
-	} else if (_ctx->changed) {
-		o_stream_nsend_str(dict->conn.conn.output,
-				   "*1\r\n$7\r\nDISCARD\r\n");
-		reply = array_append_space(&dict->replies);
-		reply->reply_count = 1;
-		redis_input_state_add(dict, REDIS_INPUT_STATE_DISCARD);
+		if (!conn->transaction_disconnected)
+			redis_disconnected(conn, ctx->error);
+	} else {
+		conn->transaction_open = FALSE;
+		if (_ctx->changed && !conn->transaction_disconnected) {
+			redis_conn_send_str(conn, "*1\r\n$7\r\nDISCARD\r\n");
+			redis_input_state_add(conn, REDIS_INPUT_STATE_DISCARD);
+		}
 	}
-	i_free(ctx->error);
-	i_free(ctx);
+	redis_transaction_free(ctx);
 }
 
 static int redis_check_transaction(struct redis_dict_transaction_context *ctx)
 {
-	struct redis_dict *dict = (struct redis_dict *)ctx->ctx.dict;
-
 	if (ctx->error != NULL)
 		return -1;
-	if (!dict->connected) {
+	if (ctx->conn->transaction_disconnected) {
 		ctx->error = i_strdup("Disconnected during transaction");
 		return -1;
 	}
 	if (ctx->ctx.changed)
 		return 0;
 
-	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	if (o_stream_send_str(dict->conn.conn.output,
-			      "*1\r\n$5\r\nMULTI\r\n") < 0) {
-		ctx->error = i_strdup_printf("write() failed: %s",
-			o_stream_get_error(dict->conn.conn.output));
-		return -1;
-	}
+	redis_input_state_add(ctx->conn, REDIS_INPUT_STATE_MULTI);
+	redis_conn_send_str(ctx->conn, "*1\r\n$5\r\nMULTI\r\n");
 	return 0;
 }
 
+static void
+redis_transaction_add_cmd(struct redis_dict_transaction_context *ctx,
+			  const char *key, string_t *cmd)
+{
+	struct redis_cluster_write *write;
+
+	if (ctx->conn != NULL) {
+		redis_input_state_add(ctx->conn, REDIS_INPUT_STATE_MULTI);
+		redis_conn_send(ctx->conn, str_data(cmd), str_len(cmd));
+	} else {
+		write = array_append_space(&ctx->cluster_writes);
+		write->key = i_strdup(key);
+		write->cmd = i_strdup(str_c(cmd));
+	}
+	ctx->cmd_count++;
+}
+
 static void
 redis_append_expire(struct redis_dict_transaction_context *ctx,
-		    string_t *cmd, const char *key)
+		    const char *key)
 {
 	struct redis_dict *dict = (struct redis_dict *)ctx->ctx.dict;
+	string_t *cmd;
 
 	if (dict->expire_value == NULL)
 		return;
 
+	cmd = t_str_new(128);
 	str_printfa(cmd, "*3\r\n$6\r\nEXPIRE\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 		    (unsigned int)strlen(key), key,
 		    (unsigned int)strlen(dict->expire_value),
 		    dict->expire_value);
-	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	ctx->cmd_count++;
+	redis_transaction_add_cmd(ctx, key, cmd);
 }
 
 static void redis_set(struct dict_transaction_context *_ctx,
@@ -746,7 +1522,7 @@ static void redis_set(struct dict_transaction_context *_ctx,
 	const struct dict_op_settings_private *set = &_ctx->set;
 	string_t *cmd;
 
-	if (redis_check_transaction(ctx) < 0)
+	if (ctx->conn != NULL && redis_check_transaction(ctx) < 0)
 		return;
 
 	key = redis_dict_get_full_key(dict, set->username, key);
@@ -754,13 +1530,8 @@ static void redis_set(struct dict_transaction_context *_ctx,
 	str_printfa(cmd, "*3\r\n$3\r\nSET\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 		    (unsigned int)strlen(key), key,
 		    (unsigned int)strlen(value), value);
-	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	ctx->cmd_count++;
-	redis_append_expire(ctx, cmd, key);
-	if (o_stream_send(dict->conn.conn.output, str_data(cmd), str_len(cmd)) < 0) {
-		ctx->error = i_strdup_printf("write() failed: %s",
-			o_stream_get_error(dict->conn.conn.output));
-	}
+	redis_transaction_add_cmd(ctx, key, cmd);
+	redis_append_expire(ctx, key);
 }
 
 static void redis_unset(struct dict_transaction_context *_ctx,
@@ -770,20 +1541,16 @@ static void redis_unset(struct dict_transaction_context *_ctx,
 		(struct redis_dict_transaction_context *)_ctx;
 	struct redis_dict *dict = (struct redis_dict *)_ctx->dict;
 	const struct dict_op_settings_private *set = &_ctx->set;
-	const char *cmd;
+	string_t *cmd;
 
-	if (redis_check_transaction(ctx) < 0)
+	if (ctx->conn != NULL && redis_check_transaction(ctx) < 0)
 		return;
 
 	key = redis_dict_get_full_key(dict, set->username, key);
-	cmd = t_strdup_printf("*2\r\n$3\r\nDEL\r\n$%u\r\n%s\r\n",
-			      (unsigned int)strlen(key), key);
-	if (o_stream_send_str(dict->conn.conn.output, cmd) < 0) {
-		ctx->error = i_strdup_printf("write() failed: %s",
-			o_stream_get_error(dict->conn.conn.output));
-	}
-	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	ctx->cmd_count++;
+	cmd = t_str_new(128);
+	str_printfa(cmd, "*2\r\n$3\r\nDEL\r\n$%u\r\n%s\r\n",
+		    (unsigned int)strlen(key), key);
+	redis_transaction_add_cmd(ctx, key, cmd);
 }
 
 static void redis_atomic_inc(struct dict_transaction_context *_ctx,
@@ -796,7 +1563,7 @@ static void redis_atomic_inc(struct dict_transaction_context *_ctx,
 	const char *diffstr;
 	string_t *cmd;
 
-	if (redis_check_transaction(ctx) < 0)
+	if (ctx->conn != NULL && redis_check_transaction(ctx) < 0)
 		return;
 
 	key = redis_dict_get_full_key(dict, set->username, key);
@@ -805,13 +1572,8 @@ static void redis_atomic_inc(struct dict_transaction_context *_ctx,
 	str_printfa(cmd, "*3\r\n$6\r\nINCRBY\r\n$%u\r\n%s\r\n$%u\r\n%s\r\n",
 		    (unsigned int)strlen(key), key,
 		    (unsigned int)strlen(diffstr), diffstr);
-	redis_input_state_add(dict, REDIS_INPUT_STATE_MULTI);
-	ctx->cmd_count++;
-	redis_append_expire(ctx, cmd, key);
-	if (o_stream_send(dict->conn.conn.output, str_data(cmd), str_len(cmd)) < 0) {
-		ctx->error = i_strdup_printf("write() failed: %s",
-			o_stream_get_error(dict->conn.conn.output));
-	}
+	redis_transaction_add_cmd(ctx, key, cmd);
+	redis_append_expire(ctx, key);
 }
 
 struct dict dict_driver_redis = {
@@ -821,11 +1583,14 @@ struct dict dict_driver_redis = {
 		.deinit = redis_dict_deinit,
 		.wait = redis_dict_wait,
 		.lookup = redis_dict_lookup,
+		.lookup_multi = redis_dict_lookup_multi,
 		.transaction_init = redis_transaction_init,
 		.transaction_commit = redis_transaction_commit,
 		.transaction_rollback = redis_transaction_rollback,
 		.set = redis_set,
 		.unset = redis_unset,
 		.atomic_inc = redis_atomic_inc,
+		.lookup_async = redis_dict_lookup_async,
+		.switch_ioloop = redis_dict_switch_ioloop,
 	}
 };
@@ -29,6 +29,26 @@ struct dict_lookup_callback_ctx {
 	void *context;
 };
 
+struct dict_lookup_multi_callback_ctx {
+	pool_t pool;
+	struct dict *dict;
+	struct event *event;
+	dict_lookup_multi_callback_t *callback;
+	void *context;
+	unsigned int keys_count;
+
+	/* for lookups done with lookup_async() one key at a time: */
+	const char **values;
+	unsigned int pending_count;
+	int ret;
+	const char *error;
+};
+
+struct dict_lookup_multi_key_ctx {
+	struct dict_lookup_multi_callback_ctx *ctx;
+	unsigned int idx;
+};
+
 static ARRAY(struct dict *) dict_drivers;
 
 static void
@@ -235,6 +255,20 @@ static void dict_lookup_finished(struct event *event, int ret, const char *error
 			"not found");
 }
 
+static void
+dict_lookup_multi_finished(struct event *event, unsigned int count, int ret,
+			   const char *error)
+{
+	i_assert(ret >= 0 || error != NULL);
+	if (ret < 0)
+		event_add_str(event, "error", error);
+	else if (ret == 0)
+		event_add_str(event, "key_not_found", "yes");
+	event_set_name(event, "dict_lookup_finished");
+	e_debug(event, "Lookup finished for %u keys: %s", count,
+		ret > 0 ? "found" : "not found");
+}
+
 static void dict_transaction_finished(struct event *event, enum dict_commit_ret ret,
 				      bool rollback, const char *error)
 {
@@ -357,6 +391,189 @@ void dict_lookup_async(struct dict *dict, const struct dict_op_settings *set,
 	dict->v.lookup_async(dict, set, key, dict_lookup_callback, lctx);
 }
 
+static struct event *
+dict_lookup_multi_event_create(struct dict *dict,
+			       const struct dict_op_settings *set,
+			       const char *const *keys)
+{
+	struct event *event = dict_event_create(dict, set);
+	unsigned int count = str_array_length(keys);
+
+	for (unsigned int i = 0; i < count; i++)
+		i_assert(dict_key_prefix_is_valid(keys[i], set->username));
+	event_add_int(event, "keys_count", count);
+	if (count > 0)
+		event_add_str(event, "key", keys[0]);
+	return event;
+}
+
+static int
+dict_lookup_multi_one_by_one(struct dict *dict,
+			     const struct dict_op_settings *set, pool_t pool,
+			     const char *const *keys, const char **values,
+			     const char **error_r)
+{
+	int ret, ret2 = 0;
+
+	for (unsigned int i = 0; keys[i] != NULL; i++) {
+		ret = dict->v.lookup(dict, set, pool, keys[i],
+				     &values[i], error_r);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+			ret2 = 1;
+		else
+			values[i] = NULL;
+	}
+	return ret2;
+}
+
+int dict_lookup_multi(struct dict *dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char *const **values_r, const char **error_r)
+{
+	struct event *event;
+	const char **values;
+	unsigned int count = str_array_length(keys);
+	int ret;
+
+	event = dict_lookup_multi_event_create(dict, set, keys);
+	e_debug(event, "Looking up %u keys", count);
+	values = p_new(pool, const char *, count + 1);
+	*error_r = NULL;
+	if (count == 0)
+		ret = 0;
+	else if (dict->v.lookup_multi != NULL) {
+		ret = dict->v.lookup_multi(dict, set, pool, keys,
+					   values, error_r);
+	} else {
+		ret = dict_lookup_multi_one_by_one(dict, set, pool, keys,
+						   values, error_r);
+	}
+	dict_lookup_multi_finished(event, count, ret, *error_r);
+	event_unref(&event);
+	*values_r = values;
+	return ret;
+}
+
+static void
+dict_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+			   void *context)
+{
+	struct dict_lookup_multi_callback_ctx *ctx = context;
+
+	dict_pre_api_callback(ctx->dict);
+	ctx->callback(result, ctx->context);
+	dict_post_api_callback(ctx->dict);
+	dict_lookup_multi_finished(ctx->event, ctx->keys_count,
+				   result->ret, result->error);
+	event_unref(&ctx->event);
+
+	dict_unref(&ctx->dict);
+	pool_unref(&ctx->pool);
+}
+
+static void
+dict_lookup_multi_key_finished(struct dict_lookup_multi_callback_ctx *ctx)
+{
+	struct dict_lookup_multi_result result;
+
+	i_assert(ctx->pending_count > 0);
+	if (--ctx->pending_count > 0)
+		return;
+
+	i_zero(&result);
+	result.ret = ctx->ret;
+	result.error = ctx->error;
+	if (ctx->ret >= 0) {
+		result.values = ctx->values;
+		result.values_count = ctx->keys_count;
+	}
+	dict_lookup_multi_callback(&result, ctx);
+}
+
+static void
+dict_lookup_multi_key_callback(const struct dict_lookup_result *result,
+			       void *context)
+{
+	struct dict_lookup_multi_key_ctx *key_ctx = context;
+	struct dict_lookup_multi_callback_ctx *ctx = key_ctx->ctx;
+
+	if (result->ret < 0) {
+		if (ctx->ret >= 0) {
+			ctx->ret = -1;
+			ctx->error = p_strdup(ctx->pool, result->error);
+		}
+	} else if (result->ret > 0) {
+		ctx->values[key_ctx->idx] = p_strdup(ctx->pool, result->value);
+		if (ctx->ret == 0)
+			ctx->ret = 1;
+	}
+	dict_lookup_multi_key_finished(ctx);
+}
+
+#undef dict_lookup_multi_async
+void dict_lookup_multi_async(struct dict *dict,
+			     const struct dict_op_settings *set,
+			     const char *const *keys,
+			     dict_lookup_multi_callback_t *callback,
+			     void *context)
+{
+	struct dict_lookup_multi_callback_ctx *ctx;
+	struct dict_lookup_multi_key_ctx *key_ctxs;
+	unsigned int i, count = str_array_length(keys);
+
+	if (count == 0 ||
+	    (dict->v.lookup_multi_async == NULL &&
+	     dict->v.lookup_async == NULL)) {
+		struct dict_lookup_multi_result result;
+
+		i_zero(&result);
+		/* event is going to be sent by dict_lookup_multi */
+		result.ret = dict_lookup_multi(dict, set,
+					       pool_datastack_create(), keys,
+					       &result.values, &result.error);
+		if (result.ret >= 0)
+			result.values_count = count;
+		else
+			result.values = NULL;
+		callback(&result, context);
+		return;
+	}
+
+	pool_t pool = pool_alloconly_create("dict lookup multi", 256);
+	ctx = p_new(pool, struct dict_lookup_multi_callback_ctx, 1);
+	ctx->pool = pool;
+	ctx->dict = dict;
+	dict_ref(ctx->dict);
+	ctx->callback = callback;
+	ctx->context = context;
+	ctx->keys_count = count;
+	ctx->event = dict_lookup_multi_event_create(dict, set, keys);
+	e_debug(ctx->event, "Looking up (async) %u keys", count);
+
+	if (dict->v.lookup_multi_async != NULL) {
+		dict->v.lookup_multi_async(dict, set, keys,
+					   dict_lookup_multi_callback, ctx);
+		return;
+	}
+
+	/* the backend doesn't support multi-lookups, but it can do async
+	   lookups. do them all in parallel. */
+	ctx->values = p_new(pool, const char *, count + 1);
+	key_ctxs = p_new(pool, struct dict_lookup_multi_key_ctx, count);
+	/* don't finish while the lookups are still being started */
+	ctx->pending_count = count + 1;
+	for (i = 0; i < count; i++) {
+		key_ctxs[i].ctx = ctx;
+		key_ctxs[i].idx = i;
+		dict->v.lookup_async(dict, set, keys[i],
+				     dict_lookup_multi_key_callback,
+				     &key_ctxs[i]);
+	}
+	dict_lookup_multi_key_finished(ctx);
+}
+
 struct dict_iterate_context *
 dict_iterate_init(struct dict *dict, const struct dict_op_settings *set,
 		  const char *path, enum dict_iterate_flags flags)
@@ -55,6 +55,21 @@ struct dict_lookup_result {
 	const char *error;
 };
 
+struct dict_lookup_multi_result {
+	/* 1 if at least one of the keys was found, 0 if none were found,
+	   -1 if the lookup failed. */
+	int ret;
+
+	/* Values in the same order as the looked up keys, NULL for keys
+	   that weren't found (ret >= 0). Only the first value is returned
+	   for keys that have multiple values. */
+	const char *const *values;
+	unsigned int values_count;
+
+	/* Error message for a failed lookup (ret < 0) */
+	const char *error;
+};
+
 enum dict_commit_ret {
 	DICT_COMMIT_RET_OK = 1,
 	DICT_COMMIT_RET_NOTFOUND = 0,
@@ -71,6 +86,9 @@ struct dict_commit_result {
 
 typedef void dict_lookup_callback_t(const struct dict_lookup_result *result,
 				    void *context);
+typedef void
+dict_lookup_multi_callback_t(const struct dict_lookup_multi_result *result,
+			     void *context);
 typedef void dict_iterate_callback_t(void *context);
 typedef void
 dict_transaction_commit_callback_t(const struct dict_commit_result *result,
@@ -111,6 +129,26 @@ void dict_lookup_async(struct dict *dict, const struct dict_op_settings *set,
 		CALLBACK_TYPECHECK(callback, \
 			void (*)(const struct dict_lookup_result *, typeof(context))))
 
+/* Lookup values for multiple keys. The lookups are done with as few requests
+   as the backend allows. keys is a NULL-terminated list. values_r[i] is set
+   to the value of keys[i], or NULL if it's not found. Returns 1 if at least
+   one of the keys was found, 0 if none were found and -1 if lookup failed. */
+int dict_lookup_multi(struct dict *dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char *const **values_r, const char **error_r);
+void dict_lookup_multi_async(struct dict *dict,
+			     const struct dict_op_settings *set,
+			     const char *const *keys,
+			     dict_lookup_multi_callback_t *callback,
+			     void *context);
+#define dict_lookup_multi_async(dict, set, keys, callback, context) \
+	dict_lookup_multi_async(dict, set, keys, \
+		(dict_lookup_multi_callback_t *)(callback), \
+		1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, \
+			void (*)(const struct dict_lookup_multi_result *, \
+				 typeof(context))))
+
 /* Iterate through all values in a path. flag indicates how iteration
    is carried out */
 struct dict_iterate_context *
@@ -36,10 +36,170 @@ static void test_dict_escape(void)
 	test_end();
 }
 
+static int test_dict_init(struct dict *dict_driver, const char *uri ATTR_UNUSED,
+			  const struct dict_settings *set ATTR_UNUSED,
+			  struct dict **dict_r, const char **error_r ATTR_UNUSED)
+{
+	struct dict *dict = i_new(struct dict, 1);
+
+	*dict = *dict_driver;
+	*dict_r = dict;
+	return 0;
+}
+
+static void test_dict_deinit(struct dict *dict)
+{
+	i_free(dict);
+}
+
+static int test_dict_lookup(struct dict *dict ATTR_UNUSED,
+			    const struct dict_op_settings *set ATTR_UNUSED,
+			    pool_t pool, const char *key, const char **value_r,
+			    const char **error_r)
+{
+	if (strcmp(key, "shared/fail") == 0) {
+		*error_r = "test failure";
+		return -1;
+	}
+	if (!str_begins(key, "shared/found-")) {
+		*value_r = NULL;
+		return 0;
+	}
+	*value_r = p_strdup(pool, key + strlen("shared/found-"));
+	return 1;
+}
+
+static void
+test_dict_lookup_async(struct dict *dict, const struct dict_op_settings *set,
+		       const char *key, dict_lookup_callback_t *callback,
+		       void *context)
+{
+	struct dict_lookup_result result;
+	const char *values[2] = { NULL, NULL };
+
+	i_zero(&result);
+	result.ret = test_dict_lookup(dict, set, pool_datastack_create(), key,
+				      &values[0], &result.error);
+	result.value = values[0];
+	result.values = values;
+	callback(&result, context);
+}
+
+static struct dict dict_driver_test = {
+	.name = "test",
+	{
+		.init = test_dict_init,
+		.deinit = test_dict_deinit,
+		.lookup = test_dict_lookup,
+	}
+};
+
+struct test_lookup_multi_result {
+	int ret;
+	unsigned int values_count;
+	char *values[3];
+	char *error;
+};
+
+static void
+test_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+			   struct test_lookup_multi_result *result_r)
+{
+	unsigned int i;
+
+	result_r->ret = result->ret;
+	result_r->values_count = result->values_count;
+	for (i = 0; i < result->values_count && i < N_ELEMENTS(result_r->values); i++)
+		result_r->values[i] = i_strdup(result->values[i]);
+	result_r->error = i_strdup(result->error);
+}
+
+static void test_lookup_multi_result_free(struct test_lookup_multi_result *result)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(result->values); i++)
+		i_free(result->values[i]);
+	i_free(result->error);
+}
+
+static void test_dict_lookup_multi_run(void)
+{
+	static const char *keys[] = {
+		"shared/found-1", "shared/missing", "shared/found-2", NULL
+	};
+	static const char *missing_keys[] = {
+		"shared/missing", "shared/missing2", NULL
+	};
+	static const char *fail_keys[] = {
+		"shared/found-1", "shared/fail", NULL
+	};
+	struct dict_settings set = { .base_dir = "" };
+	struct dict_op_settings op_set = { .username = "" };
+	struct test_lookup_multi_result result;
+	struct dict *dict;
+	const char *const *values, *error;
+
+	test_assert(dict_init("test:", &set, &dict, &error) == 0);
+
+	test_assert(dict_lookup_multi(dict, &op_set, pool_datastack_create(),
+				      keys, &values, &error) == 1);
+	test_assert_strcmp(values[0], "1");
+	test_assert(values[1] == NULL);
+	test_assert_strcmp(values[2], "2");
+	test_assert(values[3] == NULL);
+
+	test_assert(dict_lookup_multi(dict, &op_set, pool_datastack_create(),
+				      missing_keys, &values, &error) == 0);
+	test_assert(values[0] == NULL && values[1] == NULL);
+	test_assert(dict_lookup_multi(dict, &op_set, pool_datastack_create(),
+				      fail_keys, &values, &error) == -1);
+	test_assert_strcmp(error, "test failure");
+
+	i_zero(&result);
+	dict_lookup_multi_async(dict, &op_set, keys,
+				test_lookup_multi_callback, &result);
+	test_assert(result.ret == 1);
+	test_assert(result.values_count == 3);
+	if (result.values_count == 3) {
+		test_assert_strcmp(result.values[0], "1");
+		test_assert(result.values[1] == NULL);
+		test_assert_strcmp(result.values[2], "2");
+	}
+	test_lookup_multi_result_free(&result);
+
+	i_zero(&result);
+	dict_lookup_multi_async(dict, &op_set, fail_keys,
+				test_lookup_multi_callback, &result);
+	test_assert(result.ret == -1);
+	test_assert_strcmp(result.error, "test failure");
+	test_lookup_multi_result_free(&result);
+
+	dict_deinit(&dict);
+}
+
+static void test_dict_lookup_multi(void)
+{
+	test_begin("dict lookup multi");
+	dict_driver_register(&dict_driver_test);
+	test_dict_lookup_multi_run();
+	dict_driver_unregister(&dict_driver_test);
+	test_end();
+
+	test_begin("dict lookup multi async");
+	dict_driver_test.v.lookup_async = test_dict_lookup_async;
+	dict_driver_register(&dict_driver_test);
+	test_dict_lookup_multi_run();
+	dict_driver_unregister(&dict_driver_test);
+	dict_driver_test.v.lookup_async = NULL;
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_dict_escape,
+		test_dict_lookup_multi,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,152 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "net.h"
+#include "dns-cache.h"
+
+struct dns_cache_entry {
+	char *key;
+	time_t expire_time;
+
+	int ret;
+	char *error;
+	char *name;
+	unsigned int ips_count;
+	struct ip_addr *ips;
+};
+
+struct dns_cache {
+	unsigned int max_entries;
+	HASH_TABLE(char *, struct dns_cache_entry *) entries;
+};
+
+struct dns_cache *dns_cache_init(unsigned int max_entries)
+{
+	struct dns_cache *cache;
+
+	i_assert(max_entries > 0);
+
+	cache = i_new(struct dns_cache, 1);
+	cache->max_entries = max_entries;
+	hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	return cache;
+}
+
+static void dns_cache_entry_free(struct dns_cache_entry *entry)
+{
+	i_free(entry->key);
+	i_free(entry->error);
+	i_free(entry->name);
+	i_free(entry->ips);
+	i_free(entry);
+}
+
+static void dns_cache_remove(struct dns_cache *cache,
+			     struct dns_cache_entry *entry)
+{
+	hash_table_remove(cache->entries, entry->key);
+	dns_cache_entry_free(entry);
+}
+
+static void dns_cache_clear(struct dns_cache *cache, bool only_expired)
+{
+	struct hash_iterate_context *iter;
+	struct dns_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(cache->entries);
+	while (hash_table_iterate(iter, cache->entries, &key, &entry)) {
+		if (!only_expired || entry->expire_time <= ioloop_time)
+			dns_cache_remove(cache, entry);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+void dns_cache_deinit(struct dns_cache **_cache)
+{
+	struct dns_cache *cache = *_cache;
+
+	*_cache = NULL;
+	dns_cache_clear(cache, FALSE);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+}
+
+static const char *dns_cache_key(bool ptr_lookup, const char *param)
+{
+	/* host names are case-insensitive */
+	return ptr_lookup ? t_strconcat("N", param, NULL) :
+		t_strconcat("I", t_str_lcase(param), NULL);
+}
+
+bool dns_cache_lookup(struct dns_cache *cache, bool ptr_lookup,
+		      const char *param, pool_t pool,
+		      struct dns_lookup_result *result_r)
+{
+	struct dns_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->entries,
+				  dns_cache_key(ptr_lookup, param));
+	if (entry == NULL)
+		return FALSE;
+	if (entry->expire_time <= ioloop_time) {
+		dns_cache_remove(cache, entry);
+		return FALSE;
+	}
+
+	i_zero(result_r);
+	result_r->ret = entry->ret;
+	result_r->error = p_strdup(pool, entry->error);
+	result_r->name = p_strdup(pool, entry->name);
+	if (entry->ips_count > 0) {
+		result_r->ips = p_memdup(pool, entry->ips,
+			sizeof(*entry->ips) * entry->ips_count);
+		result_r->ips_count = entry->ips_count;
+	}
+	return TRUE;
+}
+
+void dns_cache_add(struct dns_cache *cache, bool ptr_lookup,
+		   const char *param, const struct dns_lookup_result *result,
+		   unsigned int ttl_secs)
+{
+	struct dns_cache_entry *entry;
+	const char *key;
+
+	if (result->ret != 0) {
+		if (net_hosterror_notfound(result->ret) == 0)
+			return;
+		ttl_secs = I_MIN(ttl_secs, DNS_CACHE_NEGATIVE_TTL_SECS);
+	}
+	if (ttl_secs == 0)
+		return;
+
+	key = dns_cache_key(ptr_lookup, param);
+	entry = hash_table_lookup(cache->entries, key);
+	if (entry != NULL)
+		dns_cache_remove(cache, entry);
+	else if (hash_table_count(cache->entries) >= cache->max_entries) {
+		dns_cache_clear(cache, TRUE);
+		if (hash_table_count(cache->entries) >= cache->max_entries) {
+			/* Simply start from scratch. This should happen only
+			   if there are lots of different names, in which case
+			   the cache isn't very useful anyway. */
+			dns_cache_clear(cache, FALSE);
+		}
+	}
+
+	entry = i_new(struct dns_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->expire_time = ioloop_time + ttl_secs;
+	entry->ret = result->ret;
+	entry->error = i_strdup(result->error);
+	entry->name = i_strdup(result->name);
+	if (result->ips_count > 0) {
+		entry->ips = i_memdup(result->ips,
+				      sizeof(*result->ips) * result->ips_count);
+		entry->ips_count = result->ips_count;
+	}
+	hash_table_insert(cache->entries, entry->key, entry);
+}
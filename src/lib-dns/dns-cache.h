@@ -0,0 +1,31 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include "dns-lookup.h"
+
+/* Not-found results are cached for at most this many seconds, since a newly
+   added name shouldn't stay unresolvable for long. */
+#define DNS_CACHE_NEGATIVE_TTL_SECS 5
+
+struct dns_cache;
+
+/* Create a cache of DNS lookup results. When there are max_entries in the
+   cache, the expired entries are dropped and if that isn't enough the cache
+   is emptied. */
+struct dns_cache *dns_cache_init(unsigned int max_entries);
+void dns_cache_deinit(struct dns_cache **cache);
+
+/* Look up a cached result for the IP (ptr_lookup=FALSE) or PTR
+   (ptr_lookup=TRUE) lookup of param. The result is allocated from pool.
+   Returns TRUE if found, FALSE if not cached or the entry had expired. */
+bool dns_cache_lookup(struct dns_cache *cache, bool ptr_lookup,
+		      const char *param, pool_t pool,
+		      struct dns_lookup_result *result_r);
+/* Add the lookup result to the cache with the given TTL. Only successful
+   and not-found results are cached. Other failures are likely temporary,
+   so they're not cached. */
+void dns_cache_add(struct dns_cache *cache, bool ptr_lookup,
+		   const char *param, const struct dns_lookup_result *result,
+		   unsigned int ttl_secs);
+
+#endif
@@ -11,12 +11,14 @@
 #include "istream.h"
 #include "write-full.h"
 #include "time-util.h"
+#include "dns-cache.h"
 #include "dns-lookup.h"
 
 #include <stdio.h>
 #include <unistd.h>
 
 #define MAX_INBUF_SIZE 512
+#define DNS_LOOKUP_CACHE_MAX_ENTRIES 1000
 
 static struct event_category event_category_dns = {
 	.name = "dns"
@@ -26,7 +28,11 @@ struct dns_lookup {
 	struct dns_lookup *prev, *next;
 	struct dns_client *client;
 	pool_t pool;
+	const char *param;
 	bool ptr_lookup;
+	/* result came from the cache - the lookup isn't in the client's
+	   request queue */
+	bool cached;
 
 	struct timeout *to;
 
@@ -44,12 +50,14 @@ struct dns_client {
 	struct connection conn;
 	struct connection_list *clist;
 	struct dns_lookup *head, *tail;
+	struct dns_lookup *cached_head, *cached_tail;
 	struct timeout *to_idle;
 	struct ioloop *ioloop;
 	char *path;
 
 	unsigned int timeout_msecs;
 	unsigned int idle_timeout_msecs;
+	unsigned int cache_ttl_secs;
 
 	bool connected:1;
 	bool deinit_client_at_free:1;
@@ -60,6 +68,9 @@ struct dns_client {
 #undef dns_client_lookup
 #undef dns_client_lookup_ptr
 
+/* Shared by all the clients in the process that have caching enabled */
+static struct dns_cache *dns_lookup_cache = NULL;
+
 static void dns_lookup_free(struct dns_lookup **_lookup);
 
 static void dns_lookup_save_msecs(struct dns_lookup *lookup);
@@ -75,11 +86,14 @@ static void dns_lookup_callback(struct dns_lookup *lookup)
 	if (lookup->result.ret != 0) {
 		e->add_int("error_code", lookup->result.ret);
 		e->add_str("error", lookup->result.error);
-		e_debug(e->event(), "Lookup failed after %u msecs: %s",
-			lookup->result.msecs, lookup->result.error);
+		e_debug(e->event(), "Lookup failed after %u msecs%s: %s",
+			lookup->result.msecs,
+			lookup->cached ? " (cached)" : "",
+			lookup->result.error);
 	} else {
-		e_debug(e->event(), "Lookup successful after %u msecs",
-			lookup->result.msecs);
+		e_debug(e->event(), "Lookup successful after %u msecs%s",
+			lookup->result.msecs,
+			lookup->cached ? " (cached)" : "");
 	}
 	lookup->callback(&lookup->result, lookup->context);
 }
@@ -178,6 +192,11 @@ static int dns_client_input_args(struct connection *conn, const char *const *arg
 			"Invalid input from %s", conn->name));
 		return -1;
 	} else if (ret > 0) {
+		if (client->cache_ttl_secs > 0) {
+			dns_cache_add(dns_lookup_cache, lookup->ptr_lookup,
+				      lookup->param, &lookup->result,
+				      client->cache_ttl_secs);
+		}
 		dns_lookup_callback(lookup);
 		retry = !lookup->client->deinit_client_at_free;
 		dns_lookup_free(&lookup);
@@ -235,11 +254,17 @@ static void dns_lookup_free(struct dns_lookup **_lookup)
 
 	*_lookup = NULL;
 
-	DLLIST2_REMOVE(&client->head, &client->tail, lookup);
+	if (lookup->cached) {
+		DLLIST2_REMOVE(&client->cached_head, &client->cached_tail,
+			       lookup);
+	} else {
+		DLLIST2_REMOVE(&client->head, &client->tail, lookup);
+	}
 	timeout_remove(&lookup->to);
 	if (client->deinit_client_at_free)
 		dns_client_deinit(&client);
-	else if (client->head == NULL && client->connected) {
+	else if (!lookup->cached && client->head == NULL &&
+		 client->connected) {
 		client->to_idle = timeout_add_to(client->ioloop,
 						 client->idle_timeout_msecs,
 						 dns_client_idle_timeout, client);
@@ -292,6 +317,11 @@ static const struct connection_settings dns_client_set = {
 	.client = TRUE,
 };
 
+static void dns_lookup_cache_free(void)
+{
+	dns_cache_deinit(&dns_lookup_cache);
+}
+
 struct dns_client *dns_client_init(const struct dns_lookup_settings *set)
 {
 	struct dns_client *client;
@@ -299,6 +329,11 @@ struct dns_client *dns_client_init(const struct dns_lookup_settings *set)
 	client = i_new(struct dns_client, 1);
 	client->timeout_msecs = set->timeout_msecs;
 	client->idle_timeout_msecs = set->idle_timeout_msecs;
+	client->cache_ttl_secs = set->cache_ttl_secs;
+	if (client->cache_ttl_secs > 0 && dns_lookup_cache == NULL) {
+		dns_lookup_cache = dns_cache_init(DNS_LOOKUP_CACHE_MAX_ENTRIES);
+		lib_atexit(dns_lookup_cache_free);
+	}
 	client->clist = connection_list_init(&dns_client_set, &dns_client_vfuncs);
 	client->ioloop = set->ioloop == NULL ? current_ioloop : set->ioloop;
 	client->path = i_strdup(set->dns_client_socket_path);
@@ -314,6 +349,7 @@ void dns_client_deinit(struct dns_client **_client)
 	*_client = NULL;
 
 	i_assert(client->head == NULL);
+	i_assert(client->cached_head == NULL);
 
 	dns_client_disconnect(client, "deinit");
 	connection_list_deinit(&clist);
@@ -355,6 +391,12 @@ dns_client_send_request(struct dns_client *client, const char *cmd,
 	return ret;
 }
 
+static void dns_lookup_cached_callback(struct dns_lookup *lookup)
+{
+	dns_lookup_callback(lookup);
+	dns_lookup_free(&lookup);
+}
+
 static int
 dns_client_lookup_common(struct dns_client *client,
 			 const char *cmd, const char *param, bool ptr_lookup,
@@ -376,6 +418,7 @@ dns_client_lookup_common(struct dns_client *client,
 	lookup->client = client;
 	lookup->callback = callback;
 	lookup->context = context;
+	lookup->param = p_strdup(pool, param);
 	lookup->ptr_lookup = ptr_lookup;
 	lookup->result.ret = EAI_FAIL;
 	lookup->event = event_create(client->conn.event);
@@ -385,6 +428,20 @@ dns_client_lookup_common(struct dns_client *client,
 		set_name("dns_request_started");
 	e_debug(e->event(), "Lookup started");
 
+	if (client->cache_ttl_secs > 0 &&
+	    dns_cache_lookup(dns_lookup_cache, ptr_lookup, param,
+			     pool, &lookup->result)) {
+		/* the callback must not be called before returning */
+		lookup->cached = TRUE;
+		lookup->to = timeout_add_short_to(client->ioloop, 0,
+						  dns_lookup_cached_callback,
+						  lookup);
+		DLLIST2_APPEND(&client->cached_head, &client->cached_tail,
+			       lookup);
+		*lookup_r = lookup;
+		return 0;
+	}
+
 	if ((ret = dns_client_send_request(client, cmd, &lookup->result.error)) <= 0) {
 		if (ret == 0) {
 			/* retry once */
@@ -435,4 +492,6 @@ void dns_client_switch_ioloop(struct dns_client *client)
 
 	for (lookup = client->head; lookup != NULL; lookup = lookup->next)
 		dns_lookup_switch_ioloop_real(lookup);
+	for (lookup = client->cached_head; lookup != NULL; lookup = lookup->next)
+		dns_lookup_switch_ioloop_real(lookup);
 }
@@ -11,6 +11,11 @@ struct dns_lookup_settings {
 	/* the idle_timeout_msecs works only with the dns_client_* API.
 	   0 = disconnect immediately */
 	unsigned int idle_timeout_msecs;
+	/* Cache the lookup results in this process for this many seconds.
+	   The cache is shared by all the lookups in the process that enable
+	   it. Not-found results are cached for a shorter time.
+	   0 = no caching */
+	unsigned int cache_ttl_secs;
 
 	/* ioloop to run the lookup on (defaults to current_ioloop) */
 	struct ioloop *ioloop;
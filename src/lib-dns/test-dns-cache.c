@@ -0,0 +1,164 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "test-common.h"
+#include "dns-cache.h"
+
+#include <netdb.h>
+
+static void test_dns_cache_ip(void)
+{
+	struct dns_cache *cache;
+	struct dns_lookup_result result, cached;
+	struct ip_addr ips[2];
+
+	test_begin("dns cache ip");
+	ioloop_time = 1000;
+	cache = dns_cache_init(10);
+
+	test_assert(!dns_cache_lookup(cache, FALSE, "host.example.com",
+				      pool_datastack_create(), &cached));
+
+	i_zero(&result);
+	test_assert(net_addr2ip("192.168.0.1", &ips[0]) == 0);
+	test_assert(net_addr2ip("::1", &ips[1]) == 0);
+	result.ips = ips;
+	result.ips_count = N_ELEMENTS(ips);
+	dns_cache_add(cache, FALSE, "Host.Example.COM", &result, 10);
+
+	/* host names are case-insensitive */
+	test_assert(dns_cache_lookup(cache, FALSE, "host.example.com",
+				     pool_datastack_create(), &cached));
+	test_assert(cached.ret == 0);
+	test_assert(cached.ips_count == 2);
+	test_assert(net_ip_compare(&cached.ips[0], &ips[0]));
+	test_assert(net_ip_compare(&cached.ips[1], &ips[1]));
+	/* PTR lookups are separate */
+	test_assert(!dns_cache_lookup(cache, TRUE, "host.example.com",
+				      pool_datastack_create(), &cached));
+
+	/* expires */
+	ioloop_time += 9;
+	test_assert(dns_cache_lookup(cache, FALSE, "host.example.com",
+				     pool_datastack_create(), &cached));
+	ioloop_time++;
+	test_assert(!dns_cache_lookup(cache, FALSE, "host.example.com",
+				      pool_datastack_create(), &cached));
+
+	/* TTL 0 isn't cached */
+	dns_cache_add(cache, FALSE, "host.example.com", &result, 0);
+	test_assert(!dns_cache_lookup(cache, FALSE, "host.example.com",
+				      pool_datastack_create(), &cached));
+	dns_cache_deinit(&cache);
+	test_assert(cache == NULL);
+	test_end();
+}
+
+static void test_dns_cache_ptr(void)
+{
+	struct dns_cache *cache;
+	struct dns_lookup_result result, cached;
+
+	test_begin("dns cache ptr");
+	ioloop_time = 1000;
+	cache = dns_cache_init(10);
+
+	i_zero(&result);
+	result.name = "host.example.com";
+	dns_cache_add(cache, TRUE, "192.168.0.1", &result, 10);
+	test_assert(dns_cache_lookup(cache, TRUE, "192.168.0.1",
+				     pool_datastack_create(), &cached));
+	test_assert(cached.ret == 0);
+	test_assert_strcmp(cached.name, "host.example.com");
+	test_assert(cached.ips_count == 0);
+
+	/* replacing */
+	result.name = "host2.example.com";
+	dns_cache_add(cache, TRUE, "192.168.0.1", &result, 10);
+	test_assert(dns_cache_lookup(cache, TRUE, "192.168.0.1",
+				     pool_datastack_create(), &cached));
+	test_assert_strcmp(cached.name, "host2.example.com");
+	dns_cache_deinit(&cache);
+	test_end();
+}
+
+static void test_dns_cache_negative(void)
+{
+	struct dns_cache *cache;
+	struct dns_lookup_result result, cached;
+
+	test_begin("dns cache negative");
+	ioloop_time = 1000;
+	cache = dns_cache_init(10);
+
+	/* not found is cached with a shorter TTL */
+	i_zero(&result);
+	result.ret = EAI_NONAME;
+	result.error = net_gethosterror(EAI_NONAME);
+	dns_cache_add(cache, FALSE, "nonexistent.example.com", &result, 60);
+	test_assert(dns_cache_lookup(cache, FALSE, "nonexistent.example.com",
+				     pool_datastack_create(), &cached));
+	test_assert(cached.ret == EAI_NONAME);
+	test_assert_strcmp(cached.error, result.error);
+	ioloop_time += DNS_CACHE_NEGATIVE_TTL_SECS;
+	test_assert(!dns_cache_lookup(cache, FALSE, "nonexistent.example.com",
+				      pool_datastack_create(), &cached));
+
+	/* temporary failures aren't cached */
+	result.ret = EAI_AGAIN;
+	result.error = net_gethosterror(EAI_AGAIN);
+	dns_cache_add(cache, FALSE, "temp.example.com", &result, 60);
+	test_assert(!dns_cache_lookup(cache, FALSE, "temp.example.com",
+				      pool_datastack_create(), &cached));
+	dns_cache_deinit(&cache);
+	test_end();
+}
+
+static void test_dns_cache_full(void)
+{
+	struct dns_cache *cache;
+	struct dns_lookup_result result, cached;
+	unsigned int i;
+
+	test_begin("dns cache full");
+	ioloop_time = 1000;
+	cache = dns_cache_init(3);
+
+	i_zero(&result);
+	result.name = "host.example.com";
+	dns_cache_add(cache, TRUE, "10.0.0.1", &result, 1);
+	for (i = 2; i <= 3; i++) {
+		dns_cache_add(cache, TRUE, t_strdup_printf("10.0.0.%u", i),
+			      &result, 10);
+	}
+	/* the expired entry is dropped to make space */
+	ioloop_time++;
+	dns_cache_add(cache, TRUE, "10.0.0.4", &result, 10);
+	for (i = 2; i <= 4; i++) {
+		test_assert_idx(dns_cache_lookup(cache, TRUE,
+			t_strdup_printf("10.0.0.%u", i),
+			pool_datastack_create(), &cached), i);
+	}
+	/* nothing has expired - the cache is emptied */
+	dns_cache_add(cache, TRUE, "10.0.0.5", &result, 10);
+	test_assert(!dns_cache_lookup(cache, TRUE, "10.0.0.2",
+				      pool_datastack_create(), &cached));
+	test_assert(dns_cache_lookup(cache, TRUE, "10.0.0.5",
+				     pool_datastack_create(), &cached));
+	dns_cache_deinit(&cache);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_dns_cache_ip,
+		test_dns_cache_ptr,
+		test_dns_cache_negative,
+		test_dns_cache_full,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -14,6 +14,33 @@
 #include "istream-fs-stats.h"
 #include "fs-api-private.h"
 
+#define FS_BATCH_DEFAULT_MAX_PARALLEL 16
+
+enum fs_batch_op_type {
+	FS_BATCH_OP_DELETE,
+	FS_BATCH_OP_STAT,
+	FS_BATCH_OP_READ,
+};
+
+struct fs_batch_op {
+	enum fs_batch_op_type type;
+	const char *path;
+	fs_batch_callback_t *callback;
+	void *context;
+
+	struct fs_file *file;
+};
+
+struct fs_batch {
+	pool_t pool;
+	struct fs *fs;
+	unsigned int max_parallel;
+
+	ARRAY(struct fs_batch_op) ops;
+	const char *first_error;
+	bool running;
+};
+
 static struct event_category event_category_fs = {
 	.name = "fs"
 };
@@ -84,6 +111,7 @@ static void fs_classes_deinit(void)
 static void fs_classes_init(void)
 {
 	i_array_init(&fs_classes, 8);
+	fs_class_register(&fs_class_cache);
 	fs_class_register(&fs_class_dict);
 	fs_class_register(&fs_class_posix);
 	fs_class_register(&fs_class_randomfail);
@@ -1327,6 +1355,161 @@ bool fs_iter_have_more(struct fs_iter *iter)
 	return iter->async_have_more;
 }
 
+static void
+fs_batch_add(struct fs_batch *batch, enum fs_batch_op_type type,
+	     const char *path, fs_batch_callback_t *callback, void *context)
+{
+	struct fs_batch_op *op;
+
+	i_assert(!batch->running);
+	i_assert(callback != NULL);
+
+	op = array_append_space(&batch->ops);
+	op->type = type;
+	op->path = p_strdup(batch->pool, path);
+	op->callback = callback;
+	op->context = context;
+}
+
+struct fs_batch *fs_batch_begin(struct fs *fs, unsigned int max_parallel)
+{
+	struct fs_batch *batch;
+	pool_t pool;
+
+	pool = pool_alloconly_create("fs batch", 1024);
+	batch = p_new(pool, struct fs_batch, 1);
+	batch->pool = pool;
+	batch->fs = fs;
+	batch->max_parallel = max_parallel != 0 ? max_parallel :
+		FS_BATCH_DEFAULT_MAX_PARALLEL;
+	p_array_init(&batch->ops, pool, 16);
+	return batch;
+}
+
+#undef fs_batch_delete
+void fs_batch_delete(struct fs_batch *batch, const char *path,
+		     fs_batch_callback_t *callback, void *context)
+{
+	fs_batch_add(batch, FS_BATCH_OP_DELETE, path, callback, context);
+}
+
+#undef fs_batch_stat
+void fs_batch_stat(struct fs_batch *batch, const char *path,
+		   fs_batch_callback_t *callback, void *context)
+{
+	fs_batch_add(batch, FS_BATCH_OP_STAT, path, callback, context);
+}
+
+#undef fs_batch_read
+void fs_batch_read(struct fs_batch *batch, const char *path,
+		   fs_batch_callback_t *callback, void *context)
+{
+	fs_batch_add(batch, FS_BATCH_OP_READ, path, callback, context);
+}
+
+static void fs_batch_op_start(struct fs_batch *batch, struct fs_batch_op *op)
+{
+	if (op->type == FS_BATCH_OP_READ) {
+		/* the file is read by the callback, which doesn't want to
+		   handle async streams */
+		op->file = fs_file_init(batch->fs, op->path,
+					FS_OPEN_MODE_READONLY);
+		(void)fs_prefetch(op->file, 0);
+	} else {
+		op->file = fs_file_init(batch->fs, op->path,
+					FS_OPEN_MODE_READONLY |
+					FS_OPEN_FLAG_ASYNC);
+	}
+}
+
+/* Returns TRUE if the operation is finished, FALSE if it's still waiting
+   for async I/O. */
+static bool fs_batch_op_try_finish(struct fs_batch *batch,
+				   struct fs_batch_op *op)
+{
+	struct fs_batch_result result;
+	struct stat st;
+
+	i_zero(&result);
+	result.path = op->path;
+	result.file = op->file;
+	switch (op->type) {
+	case FS_BATCH_OP_DELETE:
+		result.ret = fs_delete(op->file);
+		break;
+	case FS_BATCH_OP_STAT:
+		result.ret = fs_stat(op->file, &st);
+		if (result.ret == 0)
+			result.st = &st;
+		break;
+	case FS_BATCH_OP_READ:
+		break;
+	}
+	if (result.ret < 0) {
+		if (errno == EAGAIN)
+			return FALSE;
+		result.error_errno = errno;
+		result.error = fs_file_last_error(op->file);
+		if (batch->first_error == NULL)
+			batch->first_error = p_strdup(batch->pool, result.error);
+	}
+	op->callback(&result, op->context);
+	fs_file_deinit(&op->file);
+	return TRUE;
+}
+
+int fs_batch_end(struct fs_batch **_batch, const char **error_r)
+{
+	struct fs_batch *batch = *_batch;
+	ARRAY(struct fs_batch_op *) pending;
+	struct fs_batch_op *ops, *op;
+	unsigned int i, next = 0, count;
+	bool progress;
+	int ret;
+
+	*_batch = NULL;
+	batch->running = TRUE;
+
+	ops = array_get_modifiable(&batch->ops, &count);
+	p_array_init(&pending, batch->pool, batch->max_parallel);
+	while (next < count || array_count(&pending) > 0) {
+		while (next < count &&
+		       array_count(&pending) < batch->max_parallel) {
+			op = &ops[next++];
+			fs_batch_op_start(batch, op);
+			array_push_back(&pending, &op);
+		}
+
+		progress = FALSE;
+		for (i = 0; i < array_count(&pending); ) {
+			op = array_idx_elem(&pending, i);
+			if (!fs_batch_op_try_finish(batch, op)) {
+				i++;
+				continue;
+			}
+			array_delete(&pending, i, 1);
+			progress = TRUE;
+			/* keep max_parallel operations running */
+			if (next < count) {
+				op = &ops[next++];
+				fs_batch_op_start(batch, op);
+				array_push_back(&pending, &op);
+			}
+		}
+		if (!progress)
+			fs_wait_async(batch->fs);
+	}
+
+	if (batch->first_error == NULL)
+		ret = 0;
+	else {
+		*error_r = t_strdup(batch->first_error);
+		ret = -1;
+	}
+	pool_unref(&batch->pool);
+	return ret;
+}
+
 const struct fs_stats *fs_get_stats(struct fs *fs)
 {
 	return &fs->stats;
@@ -4,6 +4,7 @@
 struct stat;
 struct fs;
 struct fs_file;
+struct fs_batch;
 struct fs_lock;
 struct hash_method;
 
@@ -385,6 +386,58 @@ void fs_iter_set_async_callback(struct fs_iter *iter,
    function to determine if you should wait for more data or finish up. */
 bool fs_iter_have_more(struct fs_iter *iter);
 
+/* Batched operations: Queue operations for many files and run them with
+   fs_batch_end(). The operations use async I/O so that with remote
+   filesystems up to max_parallel of them are in progress at the same time.
+   With synchronous filesystems they're simply run one after another. */
+struct fs_batch_result {
+	const char *path;
+	/* The file the operation was done on. It's freed after the callback
+	   returns. */
+	struct fs_file *file;
+	/* 0 if ok, -1 if error. The error and errno are in error and
+	   error_errno. */
+	int ret;
+	int error_errno;
+	const char *error;
+	/* fs_batch_stat() result, NULL for other operations or on error */
+	const struct stat *st;
+};
+typedef void fs_batch_callback_t(const struct fs_batch_result *result,
+				 void *context);
+
+/* Begin a new batch. max_parallel=0 uses the default. */
+struct fs_batch *fs_batch_begin(struct fs *fs, unsigned int max_parallel);
+/* Queue deleting the path. */
+void fs_batch_delete(struct fs_batch *batch, const char *path,
+		     fs_batch_callback_t *callback, void *context);
+#define fs_batch_delete(batch, path, callback, context) \
+	fs_batch_delete(batch, path, (fs_batch_callback_t *)(callback), \
+		1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct fs_batch_result *, typeof(context))))
+/* Queue stat()ing the path. */
+void fs_batch_stat(struct fs_batch *batch, const char *path,
+		   fs_batch_callback_t *callback, void *context);
+#define fs_batch_stat(batch, path, callback, context) \
+	fs_batch_stat(batch, path, (fs_batch_callback_t *)(callback), \
+		1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct fs_batch_result *, typeof(context))))
+/* Queue reading the path. The next max_parallel files are prefetched while
+   the callback is reading the current one with fs_read_stream(). The
+   callbacks are called in the order the reads were queued. */
+void fs_batch_read(struct fs_batch *batch, const char *path,
+		   fs_batch_callback_t *callback, void *context);
+#define fs_batch_read(batch, path, callback, context) \
+	fs_batch_read(batch, path, (fs_batch_callback_t *)(callback), \
+		1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct fs_batch_result *, typeof(context))))
+/* Run all the queued operations and free the batch. Returns 0 if all of
+   them succeeded, -1 if any failed. error_r is set to the first error. */
+int fs_batch_end(struct fs_batch **batch, const char **error_r);
+
 /* Return the filesystem's fs_stats. Note that each wrapper filesystem keeps
    track of its own fs_stats calls. You can use fs_get_parent() to get to the
    filesystem whose stats you want to see. */
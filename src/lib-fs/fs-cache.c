@@ -0,0 +1,566 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "strnum.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "mkdir-parents.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "istream-private.h"
+#include "fs-api-private.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+/* When the cache becomes full, evict files until it's at most this
+   percentage of the max size. This way the cache directory doesn't need to
+   be scanned again for each newly cached file. */
+#define FS_CACHE_EVICT_TARGET_PERCENTAGE 90
+/* Temporary files older than this are leftovers from crashed processes */
+#define FS_CACHE_TEMP_FILE_MAX_AGE_SECS (60*60)
+#define FS_CACHE_TEMP_PREFIX ".temp."
+
+struct cache_fs {
+	struct fs fs;
+	char *cache_dir;
+	uoff_t max_size;
+	/* Estimated size of the cache directory. Other processes may be
+	   adding files to it also, so this is only updated by scanning the
+	   directory whenever the estimate grows over max_size. */
+	uoff_t cur_size;
+	bool cur_size_known;
+};
+
+struct cache_fs_file {
+	struct fs_file file;
+	struct cache_fs *fs;
+	struct fs_file *super_read;
+	enum fs_open_mode open_mode;
+};
+
+struct cache_istream {
+	struct istream_private istream;
+	struct cache_fs *fs;
+	char *temp_path, *cache_path;
+
+	/* temp_path, or -1 if the stream isn't being cached */
+	int fd;
+	/* number of bytes written to fd */
+	uoff_t cache_offset;
+};
+
+struct fs_cache_entry {
+	const char *path;
+	time_t mtime;
+	uoff_t size;
+};
+
+#define CACHE_FS(ptr)	container_of((ptr), struct cache_fs, fs)
+#define CACHE_FILE(ptr)	container_of((ptr), struct cache_fs_file, file)
+
+static struct fs *fs_cache_alloc(void)
+{
+	struct cache_fs *fs;
+
+	fs = i_new(struct cache_fs, 1);
+	fs->fs = fs_class_cache;
+	return &fs->fs;
+}
+
+static int fs_cache_parse_size(const char *str, uoff_t *size_r)
+{
+	const char *suffix;
+
+	if (str_parse_uoff(str, size_r, &suffix) < 0)
+		return -1;
+	switch (*suffix) {
+	case '\0':
+		return 0;
+	case 'k':
+	case 'K':
+		*size_r *= 1024;
+		break;
+	case 'M':
+		*size_r *= 1024*1024;
+		break;
+	case 'G':
+		*size_r *= 1024*1024*1024ULL;
+		break;
+	default:
+		return -1;
+	}
+	return suffix[1] == '\0' ? 0 : -1;
+}
+
+static int
+fs_cache_init(struct fs *_fs, const char *args,
+	      const struct fs_settings *set, const char **error_r)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+	const char *p, *size_str, *parent_name, *parent_args;
+
+	/* <max size>:<cache dir>:<parent fs>[:<args>] */
+	p = strchr(args, ':');
+	if (p == NULL) {
+		*error_r = "Cache size not given as parameter";
+		return -1;
+	}
+	size_str = t_strdup_until(args, p++);
+	if (fs_cache_parse_size(size_str, &fs->max_size) < 0 ||
+	    fs->max_size == 0) {
+		*error_r = t_strdup_printf("Invalid cache size: %s", size_str);
+		return -1;
+	}
+	args = p;
+
+	p = strchr(args, ':');
+	if (p == NULL || p == args) {
+		*error_r = "Cache directory not given as parameter";
+		return -1;
+	}
+	if (p[1] == '\0') {
+		*error_r = "Parent filesystem not given as parameter";
+		return -1;
+	}
+	fs->cache_dir = i_strdup_until(args, p);
+	parent_name = p + 1;
+
+	parent_args = strchr(parent_name, ':');
+	if (parent_args == NULL)
+		parent_args = "";
+	else
+		parent_name = t_strdup_until(parent_name, parent_args++);
+	return fs_init(parent_name, parent_args, set, &_fs->parent, error_r);
+}
+
+static void fs_cache_free(struct fs *_fs)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+
+	i_free(fs->cache_dir);
+	i_free(fs);
+}
+
+static const char *fs_cache_get_path(struct cache_fs *fs, const char *path)
+{
+	unsigned char digest[SHA1_RESULTLEN];
+
+	sha1_get_digest(path, strlen(path), digest);
+	return t_strdup_printf("%s/%s", fs->cache_dir,
+			       binary_to_hex(digest, sizeof(digest)));
+}
+
+static int fs_cache_entry_cmp(const struct fs_cache_entry *e1,
+			      const struct fs_cache_entry *e2)
+{
+	if (e1->mtime < e2->mtime)
+		return -1;
+	if (e1->mtime > e2->mtime)
+		return 1;
+	return 0;
+}
+
+static void fs_cache_evict(struct cache_fs *fs)
+{
+	ARRAY(struct fs_cache_entry) entries;
+	struct fs_cache_entry *entry;
+	struct dirent *d;
+	struct stat st;
+	const char *path;
+	uoff_t total_size = 0, target_size;
+	time_t now = time(NULL);
+	DIR *dir;
+
+	dir = opendir(fs->cache_dir);
+	if (dir == NULL) {
+		if (errno != ENOENT) {
+			e_error(fs->fs.event, "opendir(%s) failed: %m",
+				fs->cache_dir);
+		}
+		return;
+	}
+
+	t_array_init(&entries, 128);
+	while ((d = readdir(dir)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+
+		path = t_strconcat(fs->cache_dir, "/", d->d_name, NULL);
+		if (stat(path, &st) < 0) {
+			if (errno != ENOENT)
+				e_error(fs->fs.event, "stat(%s) failed: %m", path);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode))
+			continue;
+		if (str_begins(d->d_name, FS_CACHE_TEMP_PREFIX)) {
+			if (st.st_mtime < now - FS_CACHE_TEMP_FILE_MAX_AGE_SECS)
+				i_unlink_if_exists(path);
+			continue;
+		}
+		entry = array_append_space(&entries);
+		entry->path = path;
+		entry->mtime = st.st_mtime;
+		entry->size = st.st_size;
+		total_size += st.st_size;
+	}
+	if (closedir(dir) < 0)
+		e_error(fs->fs.event, "closedir(%s) failed: %m", fs->cache_dir);
+
+	if (total_size > fs->max_size) {
+		/* remove the least recently used files */
+		target_size = fs->max_size / 100 *
+			FS_CACHE_EVICT_TARGET_PERCENTAGE;
+		array_sort(&entries, fs_cache_entry_cmp);
+		array_foreach_modifiable(&entries, entry) {
+			if (total_size <= target_size)
+				break;
+			if (unlink(entry->path) < 0 && errno != ENOENT) {
+				e_error(fs->fs.event, "unlink(%s) failed: %m",
+					entry->path);
+				continue;
+			}
+			total_size -= entry->size;
+		}
+	}
+	fs->cur_size = total_size;
+	fs->cur_size_known = TRUE;
+}
+
+static void fs_cache_added(struct cache_fs *fs, uoff_t size)
+{
+	fs->cur_size += size;
+	if (!fs->cur_size_known || fs->cur_size > fs->max_size) T_BEGIN {
+		fs_cache_evict(fs);
+	} T_END;
+}
+
+static void fs_cache_invalidate(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	const char *cache_path;
+
+	cache_path = fs_cache_get_path(file->fs, fs_file_path(_file));
+	if (unlink(cache_path) < 0 && errno != ENOENT)
+		e_error(_file->event, "unlink(%s) failed: %m", cache_path);
+}
+
+static void i_stream_fs_cache_abort(struct cache_istream *cstream)
+{
+	if (cstream->fd == -1)
+		return;
+	i_close_fd_path(&cstream->fd, cstream->temp_path);
+	i_unlink_if_exists(cstream->temp_path);
+}
+
+static void i_stream_fs_cache_finish(struct cache_istream *cstream)
+{
+	struct cache_fs *fs = cstream->fs;
+
+	if (close(cstream->fd) < 0) {
+		e_error(fs->fs.event, "close(%s) failed: %m",
+			cstream->temp_path);
+		cstream->fd = -1;
+		i_unlink_if_exists(cstream->temp_path);
+		return;
+	}
+	cstream->fd = -1;
+	if (rename(cstream->temp_path, cstream->cache_path) < 0) {
+		e_error(fs->fs.event, "rename(%s, %s) failed: %m",
+			cstream->temp_path, cstream->cache_path);
+		i_unlink_if_exists(cstream->temp_path);
+		return;
+	}
+	fs_cache_added(fs, cstream->cache_offset);
+}
+
+static void i_stream_fs_cache_write(struct cache_istream *cstream,
+				    size_t size)
+{
+	struct istream_private *stream = &cstream->istream;
+	const unsigned char *data = stream->buffer + stream->pos - size;
+	uoff_t offset = stream->istream.v_offset + stream->pos - size;
+	size_t skip;
+
+	if (offset > cstream->cache_offset) {
+		/* seeked forward - the cache file would have a hole */
+		i_stream_fs_cache_abort(cstream);
+		return;
+	}
+	if (offset + size <= cstream->cache_offset) {
+		/* seeked backwards and this was already written */
+		return;
+	}
+	skip = cstream->cache_offset - offset;
+	if (write_full(cstream->fd, data + skip, size - skip) < 0) {
+		e_error(cstream->fs->fs.event, "write(%s) failed: %m",
+			cstream->temp_path);
+		i_stream_fs_cache_abort(cstream);
+		return;
+	}
+	cstream->cache_offset += size - skip;
+}
+
+static ssize_t i_stream_fs_cache_read(struct istream_private *stream)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream);
+	ssize_t ret;
+
+	i_stream_seek(stream->parent, stream->parent_start_offset +
+		      stream->istream.v_offset);
+
+	ret = i_stream_read_copy_from_parent(&stream->istream);
+	if (cstream->fd == -1)
+		;
+	else if (ret > 0)
+		i_stream_fs_cache_write(cstream, ret);
+	else if (ret == -1 && stream->istream.stream_errno == 0)
+		i_stream_fs_cache_finish(cstream);
+	else if (ret == -1)
+		i_stream_fs_cache_abort(cstream);
+	return ret;
+}
+
+static void i_stream_fs_cache_destroy(struct iostream_private *stream)
+{
+	struct cache_istream *cstream =
+		container_of(stream, struct cache_istream, istream.iostream);
+
+	i_stream_fs_cache_abort(cstream);
+	i_free(cstream->temp_path);
+	i_free(cstream->cache_path);
+	i_stream_unref(&cstream->istream.parent);
+}
+
+static struct istream *
+i_stream_create_fs_cache(struct cache_fs *fs, struct istream *input,
+			 const char *cache_path)
+{
+	struct cache_istream *cstream;
+	string_t *temp_path;
+	int fd;
+
+	temp_path = t_str_new(256);
+	str_printfa(temp_path, "%s/"FS_CACHE_TEMP_PREFIX, fs->cache_dir);
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(fs->cache_dir, 0700) < 0 && errno != EEXIST) {
+			e_error(fs->fs.event, "mkdir_parents(%s) failed: %m",
+				fs->cache_dir);
+		} else {
+			str_truncate(temp_path, 0);
+			str_printfa(temp_path, "%s/"FS_CACHE_TEMP_PREFIX,
+				    fs->cache_dir);
+			fd = safe_mkstemp_hostpid(temp_path, 0600,
+						  (uid_t)-1, (gid_t)-1);
+		}
+	}
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(fs->fs.event, "safe_mkstemp(%s) failed: %m",
+				str_c(temp_path));
+		}
+		/* just don't cache it */
+		i_stream_ref(input);
+		return input;
+	}
+
+	cstream = i_new(struct cache_istream, 1);
+	cstream->fs = fs;
+	cstream->fd = fd;
+	cstream->temp_path = i_strdup(str_c(temp_path));
+	cstream->cache_path = i_strdup(cache_path);
+	cstream->istream.iostream.destroy = i_stream_fs_cache_destroy;
+	cstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	cstream->istream.stream_size_passthrough = TRUE;
+	cstream->istream.read = i_stream_fs_cache_read;
+	cstream->istream.istream.blocking = input->blocking;
+	cstream->istream.istream.seekable = input->seekable;
+	return i_stream_create(&cstream->istream, input,
+			       i_stream_get_fd(input), 0);
+}
+
+static struct fs_file *fs_cache_file_alloc(void)
+{
+	struct cache_fs_file *file = i_new(struct cache_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_cache_file_init(struct fs_file *_file, const char *path,
+		   enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	file->file.path = i_strdup(path);
+	file->fs = CACHE_FS(_file->fs);
+	file->open_mode = mode;
+
+	/* avoid unnecessarily creating two seekable streams */
+	flags &= ENUM_NEGATE(FS_OPEN_FLAG_SEEKABLE);
+
+	file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+	if (mode == FS_OPEN_MODE_READONLY &&
+	    (flags & FS_OPEN_FLAG_ASYNC) == 0) {
+		/* use async stream for parent, so fs_read_stream() won't create
+		   another seekable stream needlessly */
+		file->super_read = fs_file_init_parent(_file, path,
+			mode, flags | FS_OPEN_FLAG_ASYNC |
+			FS_OPEN_FLAG_ASYNC_NOQUEUE);
+	} else {
+		file->super_read = file->file.parent;
+	}
+}
+
+static void fs_cache_file_deinit(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	if (file->super_read != _file->parent)
+		fs_file_deinit(&file->super_read);
+	fs_file_free(_file);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static void fs_cache_file_close(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	fs_file_close(file->super_read);
+	fs_file_close(_file->parent);
+}
+
+static bool fs_cache_prefetch(struct fs_file *_file, uoff_t length)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	const char *cache_path;
+
+	cache_path = fs_cache_get_path(file->fs, fs_file_path(_file));
+	if (file->open_mode == FS_OPEN_MODE_READONLY &&
+	    access(cache_path, R_OK) == 0)
+		return TRUE;
+	return fs_prefetch(file->super_read, length);
+}
+
+static struct istream *
+fs_cache_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct istream *input, *cinput;
+	const char *cache_path;
+	int fd;
+
+	if (file->open_mode != FS_OPEN_MODE_READONLY)
+		return fs_read_stream(file->super_read, max_buffer_size);
+
+	cache_path = fs_cache_get_path(file->fs, fs_file_path(_file));
+	fd = open(cache_path, O_RDONLY);
+	if (fd != -1) {
+		/* the mtime is used for finding the least recently used
+		   files */
+		if (utime(cache_path, NULL) < 0 && errno != ENOENT)
+			e_error(_file->event, "utime(%s) failed: %m", cache_path);
+		e_debug(_file->event, "Reading from cache file %s", cache_path);
+		input = i_stream_create_fd_autoclose(&fd, max_buffer_size);
+		i_stream_set_name(input, cache_path);
+		return input;
+	}
+	if (errno != ENOENT)
+		e_error(_file->event, "open(%s) failed: %m", cache_path);
+
+	input = fs_read_stream(file->super_read, max_buffer_size);
+	if (input->stream_errno != 0)
+		return input;
+	cinput = i_stream_create_fs_cache(file->fs, input, cache_path);
+	i_stream_unref(&input);
+	return cinput;
+}
+
+static int fs_cache_write_stream_finish(struct fs_file *_file, bool success)
+{
+	int ret;
+
+	ret = fs_wrapper_write_stream_finish(_file, success);
+	if (ret > 0)
+		fs_cache_invalidate(_file);
+	return ret;
+}
+
+static int fs_cache_copy(struct fs_file *src, struct fs_file *dest)
+{
+	int ret;
+
+	ret = fs_wrapper_copy(src, dest);
+	if (ret == 0)
+		fs_cache_invalidate(dest);
+	return ret;
+}
+
+static int fs_cache_rename(struct fs_file *src, struct fs_file *dest)
+{
+	int ret;
+
+	ret = fs_wrapper_rename(src, dest);
+	if (ret == 0) {
+		fs_cache_invalidate(src);
+		fs_cache_invalidate(dest);
+	}
+	return ret;
+}
+
+static int fs_cache_delete(struct fs_file *_file)
+{
+	/* invalidate even if the delete fails. the object may have been
+	   deleted already. */
+	fs_cache_invalidate(_file);
+	return fs_wrapper_delete(_file);
+}
+
+const struct fs fs_class_cache = {
+	.name = "cache",
+	.v = {
+		fs_cache_alloc,
+		fs_cache_init,
+		NULL,
+		fs_cache_free,
+		fs_wrapper_get_properties,
+		fs_cache_file_alloc,
+		fs_cache_file_init,
+		fs_cache_file_deinit,
+		fs_cache_file_close,
+		fs_wrapper_file_get_path,
+		fs_wrapper_set_async_callback,
+		fs_wrapper_wait_async,
+		fs_wrapper_set_metadata,
+		fs_wrapper_get_metadata,
+		fs_cache_prefetch,
+		fs_read_via_stream,
+		fs_cache_read_stream,
+		fs_write_via_stream,
+		fs_wrapper_write_stream,
+		fs_cache_write_stream_finish,
+		fs_wrapper_lock,
+		fs_wrapper_unlock,
+		fs_wrapper_exists,
+		fs_wrapper_stat,
+		fs_cache_copy,
+		fs_cache_rename,
+		fs_cache_delete,
+		fs_wrapper_iter_alloc,
+		fs_wrapper_iter_init,
+		fs_wrapper_iter_next,
+		fs_wrapper_iter_deinit,
+		NULL,
+		fs_wrapper_get_nlinks
+	}
+};
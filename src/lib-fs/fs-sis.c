@@ -5,13 +5,17 @@
 #include "istream.h"
 #include "ostream.h"
 #include "ostream-cmp.h"
+#include "dict.h"
 #include "fs-sis-common.h"
 
 #define FS_SIS_REQUIRED_PROPS \
 	(FS_PROPERTY_FASTCOPY | FS_PROPERTY_STAT)
+#define FS_SIS_INDEX_KEY_PREFIX DICT_PATH_SHARED"sis/"
 
 struct sis_fs {
 	struct fs fs;
+	/* hashes/ path -> reference count, or NULL if not used */
+	struct dict *index_dict;
 };
 
 struct sis_fs_file {
@@ -23,8 +27,10 @@ struct sis_fs_file {
 	struct istream *hash_input;
 	struct ostream *fs_output;
 
-	char *hash, *hash_path;
+	char *hash, *hash_path, *index_key;
 	bool opened;
+	/* index says that hashes/ file exists and is referenced */
+	bool indexed;
 };
 
 #define SIS_FS(ptr)	container_of((ptr), struct sis_fs, fs)
@@ -39,12 +45,45 @@ static struct fs *fs_sis_alloc(void)
 	return &fs->fs;
 }
 
+static int
+fs_sis_init_index(struct sis_fs *fs, const char *uri,
+		  const struct fs_settings *set, const char **error_r)
+{
+	struct dict_settings dict_set;
+	const char *error;
+
+	i_zero(&dict_set);
+	dict_set.base_dir = set->base_dir;
+	dict_set.event_parent = set->event_parent;
+
+	if (dict_init(uri, &dict_set, &fs->index_dict, &error) < 0) {
+		*error_r = t_strdup_printf("dict_init(%s) failed: %s",
+					   uri, error);
+		return -1;
+	}
+	return 0;
+}
+
 static int
 fs_sis_init(struct fs *_fs, const char *args, const struct fs_settings *set,
 	    const char **error_r)
 {
+	struct sis_fs *fs = SIS_FS(_fs);
 	enum fs_properties props;
-	const char *parent_name, *parent_args;
+	const char *p, *parent_name, *parent_args;
+
+	/* [index=<dict uri> ]<parent fs>[:<args>] */
+	if (str_begins(args, "index=")) {
+		p = strchr(args, ' ');
+		if (p == NULL) {
+			*error_r = "Parent filesystem not given as parameter";
+			return -1;
+		}
+		if (fs_sis_init_index(fs, t_strdup_until(args + 6, p),
+				      set, error_r) < 0)
+			return -1;
+		args = p + 1;
+	}
 
 	if (*args == '\0') {
 		*error_r = "Parent filesystem not given as parameter";
@@ -74,9 +113,96 @@ static void fs_sis_free(struct fs *_fs)
 {
 	struct sis_fs *fs = SIS_FS(_fs);
 
+	if (fs->index_dict != NULL)
+		dict_deinit(&fs->index_dict);
 	i_free(fs);
 }
 
+static int
+fs_sis_index_get_refcount(struct sis_fs_file *file, long long *refcount_r)
+{
+	struct dict_op_settings set;
+	const char *value, *error;
+	int ret;
+
+	i_zero(&set);
+	ret = dict_lookup(file->fs->index_dict, &set, pool_datastack_create(),
+			  file->index_key, &value, &error);
+	if (ret < 0) {
+		e_error(file->file.event, "dict_lookup(%s) failed: %s",
+			file->index_key, error);
+		return -1;
+	}
+	if (ret == 0)
+		*refcount_r = 0;
+	else if (str_to_llong(value, refcount_r) < 0) {
+		e_error(file->file.event, "Index key %s has invalid value: %s",
+			file->index_key, value);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_sis_index_ref(struct sis_fs_file *file)
+{
+	struct dict_transaction_context *trans;
+	struct dict_op_settings set;
+	const char *error;
+	int ret;
+
+	i_zero(&set);
+	trans = dict_transaction_begin(file->fs->index_dict, &set);
+	dict_atomic_inc(trans, file->index_key, 1);
+	ret = dict_transaction_commit(&trans, &error);
+	if (ret == 0) {
+		/* the first reference */
+		trans = dict_transaction_begin(file->fs->index_dict, &set);
+		dict_set(trans, file->index_key, "1");
+		ret = dict_transaction_commit(&trans, &error);
+	}
+	if (ret < 0) {
+		e_error(file->file.event, "dict_transaction_commit(%s) failed: %s",
+			file->index_key, error);
+	}
+}
+
+/* Drop a reference to the hashes/ file and delete it if it was the last one. */
+static void fs_sis_index_unref(struct sis_fs_file *file)
+{
+	struct dict_transaction_context *trans;
+	struct dict_op_settings set;
+	const char *error;
+	long long refcount;
+	int ret;
+
+	i_zero(&set);
+	trans = dict_transaction_begin(file->fs->index_dict, &set);
+	dict_atomic_inc(trans, file->index_key, -1);
+	ret = dict_transaction_commit(&trans, &error);
+	if (ret < 0) {
+		e_error(file->file.event, "dict_transaction_commit(%s) failed: %s",
+			file->index_key, error);
+		return;
+	}
+	if (ret == 0 || fs_sis_index_get_refcount(file, &refcount) < 0 ||
+	    refcount > 0)
+		return;
+
+	/* the last reference is gone. the users' files are links of their
+	   own, so racing with a new reference at worst loses deduplication
+	   for it. */
+	trans = dict_transaction_begin(file->fs->index_dict, &set);
+	dict_unset(trans, file->index_key);
+	if (dict_transaction_commit(&trans, &error) < 0) {
+		e_error(file->file.event, "dict_transaction_commit(%s) failed: %s",
+			file->index_key, error);
+	}
+	if (fs_delete(file->hash_file) < 0 && errno != ENOENT) {
+		e_error(file->file.event, "%s",
+			fs_file_last_error(file->hash_file));
+	}
+}
+
 static struct fs_file *fs_sis_file_alloc(void)
 {
 	struct sis_fs_file *file = i_new(struct sis_fs_file, 1);
@@ -107,6 +233,21 @@ fs_sis_file_init(struct fs_file *_file, const char *path,
 	file->hash_file = fs_file_init_parent(_file, file->hash_path,
 					      FS_OPEN_MODE_READONLY, 0);
 
+	if (fs->index_dict != NULL) {
+		/* the index tells whether the hashes/ file exists. its
+		   contents are trusted to match the hash, so there's no
+		   need to read it. */
+		long long refcount;
+
+		file->index_key = i_strconcat(FS_SIS_INDEX_KEY_PREFIX,
+			dict_escape_string(file->hash_path), NULL);
+		if (mode != FS_OPEN_MODE_READONLY &&
+		    fs_sis_index_get_refcount(file, &refcount) == 0)
+			file->indexed = refcount > 0;
+		file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+		return;
+	}
+
 	file->hash_input = fs_read_stream(file->hash_file, IO_BLOCK_SIZE);
 	if (i_stream_read(file->hash_input) == -1) {
 		/* doesn't exist */
@@ -128,6 +269,7 @@ static void fs_sis_file_deinit(struct fs_file *_file)
 	fs_file_free(_file);
 	i_free(file->hash);
 	i_free(file->hash_path);
+	i_free(file->index_key);
 	i_free(file->file.path);
 	i_free(file);
 }
@@ -178,7 +320,22 @@ static bool fs_sis_try_link(struct sis_fs_file *file)
 	return TRUE;
 }
 
-static void fs_sis_replace_hash_file(struct sis_fs_file *file)
+static bool fs_sis_try_link_indexed(struct sis_fs_file *file)
+{
+	if (fs_copy(file->hash_file, file->file.parent) < 0) {
+		if (errno != ENOENT && errno != EMLINK) {
+			e_error(file->file.event, "%s",
+				fs_file_last_error(file->hash_file));
+		}
+		/* stale index or too many links - write a new file */
+		return FALSE;
+	}
+	fs_sis_index_ref(file);
+	return TRUE;
+}
+
+/* Returns TRUE if hashes/ file is now a link to the written file. */
+static bool fs_sis_replace_hash_file(struct sis_fs_file *file)
 {
 	struct fs *super_fs = file->file.parent->fs;
 	struct fs_file *temp_file;
@@ -189,17 +346,21 @@ static void fs_sis_replace_hash_file(struct sis_fs_file *file)
 	if (file->hash_input == NULL) {
 		/* hash file didn't exist previously. we should be able to
 		   create it with link() */
-		if (fs_copy(file->file.parent, file->hash_file) < 0) {
-			if (errno == EEXIST) {
-				/* the file was just created. it's probably
-				   a duplicate, but it's too much trouble
-				   trying to deduplicate it anymore */
-			} else {
-				e_error(file->file.event, "%s",
-					fs_file_last_error(file->hash_file));
-			}
+		if (fs_copy(file->file.parent, file->hash_file) == 0)
+			return TRUE;
+		if (errno != EEXIST) {
+			e_error(file->file.event, "%s",
+				fs_file_last_error(file->hash_file));
+			return FALSE;
 		}
-		return;
+		if (file->fs->index_dict == NULL) {
+			/* the file was just created. it's probably
+			   a duplicate, but it's too much trouble
+			   trying to deduplicate it anymore */
+			return FALSE;
+		}
+		/* the hashes/ file isn't referenced by the index, so it's
+		   a leftover that can be replaced */
 	}
 
 	temp_path = t_str_new(256);
@@ -229,7 +390,7 @@ static void fs_sis_replace_hash_file(struct sis_fs_file *file)
 	if (ret < 0) {
 		e_error(file->file.event, "%s", fs_file_last_error(temp_file));
 		fs_file_deinit(&temp_file);
-		return;
+		return FALSE;
 	}
 
 	if (fs_rename(temp_file, file->hash_file) < 0) {
@@ -240,8 +401,17 @@ static void fs_sis_replace_hash_file(struct sis_fs_file *file)
 				fs_file_last_error(file->hash_file));
 		}
 		(void)fs_delete(temp_file);
+		fs_file_deinit(&temp_file);
+		return FALSE;
 	}
 	fs_file_deinit(&temp_file);
+	return TRUE;
+}
+
+static void fs_sis_update_hash_file(struct sis_fs_file *file)
+{
+	if (fs_sis_replace_hash_file(file) && file->fs->index_dict != NULL)
+		fs_sis_index_ref(file);
 }
 
 static int fs_sis_write(struct fs_file *_file, const void *data, size_t size)
@@ -251,7 +421,10 @@ static int fs_sis_write(struct fs_file *_file, const void *data, size_t size)
 	if (_file->parent == NULL)
 		return -1;
 
-	if (file->hash_input != NULL &&
+	if (file->indexed) {
+		if (fs_sis_try_link_indexed(file))
+			return 0;
+	} else if (file->hash_input != NULL &&
 	    stream_cmp_block(file->hash_input, data, size) &&
 	    i_stream_read_eof(file->hash_input)) {
 		/* try to use existing file */
@@ -262,7 +435,7 @@ static int fs_sis_write(struct fs_file *_file, const void *data, size_t size)
 	if (fs_write(_file->parent, data, size) < 0)
 		return -1;
 	T_BEGIN {
-		fs_sis_replace_hash_file(file);
+		fs_sis_update_hash_file(file);
 	} T_END;
 	return 0;
 }
@@ -301,9 +474,15 @@ static int fs_sis_write_stream_finish(struct fs_file *_file, bool success)
 		return -1;
 	}
 
-	if (file->hash_input != NULL &&
-	    o_stream_cmp_equals(_file->output) &&
-	    i_stream_read_eof(file->hash_input)) {
+	if (file->indexed) {
+		o_stream_unref(&_file->output);
+		if (fs_sis_try_link_indexed(file)) {
+			fs_write_stream_abort_parent(_file, &file->fs_output);
+			return 1;
+		}
+	} else if (file->hash_input != NULL &&
+		   o_stream_cmp_equals(_file->output) &&
+		   i_stream_read_eof(file->hash_input)) {
 		o_stream_unref(&_file->output);
 		if (fs_sis_try_link(file)) {
 			fs_write_stream_abort_parent(_file, &file->fs_output);
@@ -316,13 +495,32 @@ static int fs_sis_write_stream_finish(struct fs_file *_file, bool success)
 	if (fs_write_stream_finish(_file->parent, &file->fs_output) < 0)
 		return -1;
 	T_BEGIN {
-		fs_sis_replace_hash_file(file);
+		fs_sis_update_hash_file(file);
 	} T_END;
 	return 1;
 }
 
 static int fs_sis_delete(struct fs_file *_file)
 {
+	struct sis_fs_file *file = SIS_FILE(_file);
+	long long refcount;
+	int ret = -1;
+
+	if (file->index_key != NULL) {
+		T_BEGIN {
+			ret = fs_sis_index_get_refcount(file, &refcount);
+		} T_END;
+		if (ret == 0 && refcount > 0) {
+			if (fs_delete(_file->parent) < 0)
+				return -1;
+			T_BEGIN {
+				fs_sis_index_unref(file);
+			} T_END;
+			return 0;
+		}
+		/* not in the index - created before it was enabled */
+	}
+
 	T_BEGIN {
 		fs_sis_try_unlink_hash_file(_file, _file->parent);
 	} T_END;
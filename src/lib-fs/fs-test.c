@@ -93,8 +93,16 @@ fs_test_set_async_callback(struct fs_file *_file,
 	file->async_context = context;
 }
 
-static void fs_test_wait_async(struct fs *_fs ATTR_UNUSED)
+static void fs_test_wait_async(struct fs *_fs)
 {
+	struct fs_file *_file;
+
+	/* finish all the pending async operations */
+	for (_file = _fs->files; _file != NULL; _file = _file->next) {
+		struct test_fs_file *file = (struct test_fs_file *)_file;
+
+		file->wait_async = FALSE;
+	}
 }
 
 static void
@@ -0,0 +1,139 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "fs-test.h"
+#include "test-common.h"
+#include "unlink-directory.h"
+
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-batch"
+#define TEST_FILE_COUNT 20
+#define TEST_MAX_PARALLEL 4
+
+static const struct fs_settings fs_set;
+
+struct test_fs_batch_context {
+	struct fs *fs;
+	unsigned int callback_count;
+	unsigned int failure_count;
+	unsigned int max_open_count;
+	unsigned int next_read_idx;
+};
+
+static void
+test_fs_batch_callback(const struct fs_batch_result *result,
+		       struct test_fs_batch_context *ctx)
+{
+	if (ctx->fs->files_open_count > ctx->max_open_count)
+		ctx->max_open_count = ctx->fs->files_open_count;
+	ctx->callback_count++;
+	if (result->ret < 0)
+		ctx->failure_count++;
+}
+
+static void
+test_fs_batch_stat_callback(const struct fs_batch_result *result,
+			    struct test_fs_batch_context *ctx)
+{
+	test_assert(result->ret == 0 && result->st != NULL);
+	test_fs_batch_callback(result, ctx);
+}
+
+static void
+test_fs_batch_read_callback(const struct fs_batch_result *result,
+			    struct test_fs_batch_context *ctx)
+{
+	struct test_fs_file *file =
+		container_of(result->file, struct test_fs_file, file);
+
+	/* reads are finished in order */
+	test_assert_strcmp(result->path,
+			   t_strdup_printf("file%u", ctx->next_read_idx++));
+	test_assert(file->prefetched);
+	test_fs_batch_callback(result, ctx);
+}
+
+static void test_fs_batch_parallel(void)
+{
+	struct test_fs_batch_context ctx;
+	struct fs_batch *batch;
+	const char *error;
+	unsigned int i;
+
+	test_begin("fs batch parallel");
+	i_zero(&ctx);
+	if (fs_init("test", "", &fs_set, &ctx.fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	batch = fs_batch_begin(ctx.fs, TEST_MAX_PARALLEL);
+	for (i = 0; i < TEST_FILE_COUNT; i++) {
+		const char *path = t_strdup_printf("file%u", i);
+
+		fs_batch_delete(batch, path, test_fs_batch_callback, &ctx);
+		fs_batch_stat(batch, path, test_fs_batch_stat_callback, &ctx);
+		fs_batch_read(batch, path, test_fs_batch_read_callback, &ctx);
+	}
+	test_assert(fs_batch_end(&batch, &error) == 0);
+	test_assert(batch == NULL);
+	test_assert(ctx.callback_count == TEST_FILE_COUNT*3);
+	test_assert(ctx.failure_count == 0);
+	test_assert(ctx.next_read_idx == TEST_FILE_COUNT);
+	test_assert(ctx.max_open_count == TEST_MAX_PARALLEL);
+	test_assert(ctx.fs->files_open_count == 0);
+
+	fs_deinit(&ctx.fs);
+	test_end();
+}
+
+static void test_fs_batch_errors(void)
+{
+	struct test_fs_batch_context ctx;
+	struct fs_batch *batch;
+	struct fs_file *file;
+	const char *error, *unlink_err;
+
+	test_begin("fs batch errors");
+	i_zero(&ctx);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	if (fs_init("posix", "prefix="TEST_DIR"/", &fs_set,
+		    &ctx.fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	file = fs_file_init(ctx.fs, "exists", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, "hello", 5) == 0);
+	fs_file_deinit(&file);
+
+	batch = fs_batch_begin(ctx.fs, 0);
+	fs_batch_delete(batch, "nonexistent", test_fs_batch_callback, &ctx);
+	fs_batch_delete(batch, "exists", test_fs_batch_callback, &ctx);
+	fs_batch_delete(batch, "nonexistent2", test_fs_batch_callback, &ctx);
+	test_assert(fs_batch_end(&batch, &error) < 0);
+	test_assert(strstr(error, "nonexistent") != NULL &&
+		    strstr(error, "nonexistent2") == NULL);
+	test_assert(ctx.callback_count == 3 && ctx.failure_count == 2);
+
+	file = fs_file_init(ctx.fs, "exists", FS_OPEN_MODE_READONLY);
+	test_assert(fs_exists(file) == 0);
+	fs_file_deinit(&file);
+
+	fs_deinit(&ctx.fs);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_batch_parallel,
+		test_fs_batch_errors,
+		NULL
+	};
+	return test_run(test_functions);
+}
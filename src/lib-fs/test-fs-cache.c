@@ -0,0 +1,188 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "fs-api.h"
+#include "test-common.h"
+#include "unlink-directory.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-cache"
+#define TEST_CACHE_DIR TEST_DIR"/cache"
+#define TEST_DATA_DIR TEST_DIR"/data"
+#define TEST_CACHE_MAX_SIZE 100
+
+static const struct fs_settings fs_set;
+
+static void test_fs_cache_write(struct fs *fs, const char *path,
+				const char *data)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data, strlen(data)) == 0);
+	fs_file_deinit(&file);
+}
+
+static const char *test_fs_cache_read(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	string_t *str = t_str_new(128);
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		str_append_data(str, data, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	return str_c(str);
+}
+
+static void test_fs_cache_write_data_file(const char *path, const char *data)
+{
+	int fd;
+
+	fd = open(t_strconcat(TEST_DATA_DIR"/", path, NULL),
+		  O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write(fd, data, strlen(data)) != (ssize_t)strlen(data))
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void
+test_fs_cache_dir_get_usage(unsigned int *count_r, uoff_t *size_r)
+{
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	*count_r = 0;
+	*size_r = 0;
+	dir = opendir(TEST_CACHE_DIR);
+	if (dir == NULL)
+		return;
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		if (stat(t_strconcat(TEST_CACHE_DIR"/", d->d_name, NULL),
+			 &st) == 0) {
+			*count_r += 1;
+			*size_r += st.st_size;
+		}
+	}
+	(void)closedir(dir);
+}
+
+static void test_fs_cache(void)
+{
+	struct fs *fs;
+	struct fs_file *file;
+	const char *error, *unlink_err;
+	unsigned int i, count;
+	uoff_t size;
+
+	test_begin("fs cache");
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	if (mkdir(TEST_DIR, 0700) < 0 || mkdir(TEST_DATA_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DATA_DIR);
+
+	if (fs_init("cache", t_strdup_printf("%d:%s:posix:prefix=%s/",
+					     TEST_CACHE_MAX_SIZE,
+					     TEST_CACHE_DIR, TEST_DATA_DIR),
+		    &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	/* the first read is cached */
+	test_fs_cache_write(fs, "foo", "hello");
+	test_assert_strcmp(test_fs_cache_read(fs, "foo"), "hello");
+	test_fs_cache_dir_get_usage(&count, &size);
+	test_assert(count == 1 && size == 5);
+
+	/* the following reads are served from the cache */
+	test_fs_cache_write_data_file("foo", "world");
+	test_assert_strcmp(test_fs_cache_read(fs, "foo"), "hello");
+
+	/* writing invalidates the cache */
+	test_fs_cache_write(fs, "foo", "abcde");
+	test_fs_cache_dir_get_usage(&count, &size);
+	test_assert(count == 0);
+	test_assert_strcmp(test_fs_cache_read(fs, "foo"), "abcde");
+
+	/* deleting invalidates the cache */
+	file = fs_file_init(fs, "foo", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+	test_fs_cache_dir_get_usage(&count, &size);
+	test_assert(count == 0);
+	test_fs_cache_write_data_file("foo", "12345");
+	test_assert_strcmp(test_fs_cache_read(fs, "foo"), "12345");
+
+	/* the cache size stays under the limit */
+	for (i = 0; i < 10; i++) {
+		const char *path = t_strdup_printf("file%u", i);
+		const char *data = t_strdup_printf("%040u", i);
+
+		test_fs_cache_write(fs, path, data);
+		test_assert_strcmp_idx(test_fs_cache_read(fs, path), data, i);
+		test_fs_cache_dir_get_usage(&count, &size);
+		test_assert_idx(size <= TEST_CACHE_MAX_SIZE, i);
+	}
+	test_assert(count > 0);
+
+	fs_deinit(&fs);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	test_end();
+}
+
+static void test_fs_cache_init_errors(void)
+{
+	static const char *const invalid_args[] = {
+		"",
+		"100",
+		"abc:dir:posix",
+		"0:dir:posix",
+		"100::posix",
+		"100:dir",
+		"100:dir:",
+	};
+	struct fs *fs;
+	const char *error;
+	unsigned int i;
+
+	test_begin("fs cache init errors");
+	for (i = 0; i < N_ELEMENTS(invalid_args); i++) {
+		test_assert_idx(fs_init("cache", invalid_args[i], &fs_set,
+					&fs, &error) < 0, i);
+	}
+	test_assert(fs_init("cache", "10M:dir:posix", &fs_set,
+			    &fs, &error) == 0);
+	fs_deinit(&fs);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_cache,
+		test_fs_cache_init_errors,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,183 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "ostream.h"
+#include "dict.h"
+#include "dict-private.h"
+#include "fs-api.h"
+#include "test-common.h"
+#include "unlink-directory.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-sis"
+#define TEST_INDEX_DICT "file:"TEST_DIR"/index"
+#define TEST_HASH_PATH TEST_DIR"/hashes/abc"
+
+static const struct fs_settings fs_set;
+
+static void test_fs_sis_write(struct fs *fs, const char *path,
+			      const char *data)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, data, strlen(data)) == 0);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_sis_write_stream(struct fs *fs, const char *path,
+				     const char *data)
+{
+	struct fs_file *file;
+	struct ostream *output;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	output = fs_write_stream(file);
+	o_stream_nsend_str(output, data);
+	test_assert(fs_write_stream_finish(file, &output) > 0);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_sis_delete(struct fs *fs, const char *path)
+{
+	struct fs_file *file;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+}
+
+static const char *test_fs_sis_read(const char *path)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	string_t *str = t_str_new(64);
+
+	input = i_stream_create_file(t_strconcat(TEST_DIR"/", path, NULL),
+				     IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		str_append_data(str, data, size);
+		i_stream_skip(input, size);
+	}
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+	return str_c(str);
+}
+
+static ino_t test_fs_sis_ino(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+static const char *test_fs_sis_index_lookup(void)
+{
+	struct dict_settings dict_set;
+	struct dict_op_settings op_set;
+	struct dict *dict;
+	const char *value, *error;
+	int ret;
+
+	i_zero(&dict_set);
+	i_zero(&op_set);
+	if (dict_init(TEST_INDEX_DICT, &dict_set, &dict, &error) < 0)
+		i_fatal("dict_init() failed: %s", error);
+	ret = dict_lookup(dict, &op_set, pool_datastack_create(),
+			  t_strconcat(DICT_PATH_SHARED"sis/",
+				      dict_escape_string(TEST_HASH_PATH), NULL),
+			  &value, &error);
+	test_assert(ret >= 0);
+	dict_deinit(&dict);
+	return ret > 0 ? value : NULL;
+}
+
+static void test_fs_sis_index(void)
+{
+	struct fs *fs;
+	const char *error, *unlink_err;
+	ino_t ino;
+
+	test_begin("fs sis index");
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	if (fs_init("sis", "index="TEST_INDEX_DICT" posix", &fs_set,
+		    &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	/* the first write creates the hashes/ file */
+	test_fs_sis_write(fs, TEST_DIR"/abc-1", "hello");
+	ino = test_fs_sis_ino(TEST_HASH_PATH);
+	test_assert(ino != 0 && ino == test_fs_sis_ino(TEST_DIR"/abc-1"));
+	test_assert_strcmp(test_fs_sis_index_lookup(), "1");
+
+	/* the following writes link to it without comparing the contents */
+	test_fs_sis_write(fs, TEST_DIR"/abc-2", "world");
+	test_assert(test_fs_sis_ino(TEST_DIR"/abc-2") == ino);
+	test_assert_strcmp(test_fs_sis_read("abc-2"), "hello");
+	test_fs_sis_write_stream(fs, TEST_DIR"/abc-3", "hello");
+	test_assert(test_fs_sis_ino(TEST_DIR"/abc-3") == ino);
+	test_assert_strcmp(test_fs_sis_index_lookup(), "3");
+
+	/* the hashes/ file is deleted with the last reference */
+	test_fs_sis_delete(fs, TEST_DIR"/abc-1");
+	test_fs_sis_delete(fs, TEST_DIR"/abc-2");
+	test_assert_strcmp(test_fs_sis_index_lookup(), "1");
+	test_assert(test_fs_sis_ino(TEST_HASH_PATH) == ino);
+	test_fs_sis_delete(fs, TEST_DIR"/abc-3");
+	test_assert(test_fs_sis_index_lookup() == NULL);
+	test_assert(test_fs_sis_ino(TEST_HASH_PATH) == 0);
+
+	/* a stale index entry falls back to writing a new file */
+	test_fs_sis_write(fs, TEST_DIR"/abc-4", "hello");
+	i_unlink(TEST_HASH_PATH);
+	test_fs_sis_write_stream(fs, TEST_DIR"/abc-5", "hello");
+	test_assert_strcmp(test_fs_sis_read("abc-5"), "hello");
+	ino = test_fs_sis_ino(TEST_DIR"/abc-5");
+	test_assert(ino != 0 && ino == test_fs_sis_ino(TEST_HASH_PATH));
+	test_assert_strcmp(test_fs_sis_index_lookup(), "2");
+
+	fs_deinit(&fs);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &unlink_err) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, unlink_err);
+	test_end();
+}
+
+static void test_fs_sis_init_errors(void)
+{
+	struct fs *fs;
+	const char *error;
+
+	test_begin("fs sis init errors");
+	test_assert(fs_init("sis", "", &fs_set, &fs, &error) < 0);
+	test_assert(fs_init("sis", "index=file:foo", &fs_set, &fs, &error) < 0);
+	test_assert(fs_init("sis", "index=nonexistent posix", &fs_set,
+			    &fs, &error) < 0);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_sis_index,
+		test_fs_sis_init_errors,
+		NULL
+	};
+	int ret;
+
+	dict_driver_register(&dict_driver_file);
+	ret = test_run(test_functions);
+	dict_driver_unregister(&dict_driver_file);
+	return ret;
+}
@@ -0,0 +1,226 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "fts-language.h"
+#include "fts-tokenizer.h"
+#include "fts-filter.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* The generic tokenizer and a filter chain are run over the given text files
+   or, by default, synthetic paragraphs in several languages and scripts
+   together with the French UDHR text. The filter chain is run both through
+   fts_filter_filter(), which copies each token, and through
+   fts_filter_filter_buf(), which filters the tokens in-place in a reused
+   buffer. */
+
+#define BENCH_SYNTHETIC_REPEAT 200
+
+enum bench_mode {
+	BENCH_MODE_TOKENIZE,
+	BENCH_MODE_FILTER,
+	BENCH_MODE_FILTER_BUF,
+};
+
+static const char *const bench_paragraphs[] = {
+	"The quick brown fox's friends didn't jump over the LAZY dogs, "
+	"but they were looking at them for a very long time.\n",
+	"L'homme est n\xC3\xA9 libre, et partout il est dans les fers. "
+	"Qu'il soit \xC3\x89TUDIANT ou ouvrier, c'est l'\xC3\xA9galit\xC3\xA9 "
+	"qui compte.\n",
+	"Die Stra\xC3\x9F" "enbahn f\xC3\xA4hrt \xC3\xBC" "ber die Br\xC3\xBC"
+	"cke, und die Kinder sp\xC3\xB6ttelten \xC3\xBC" "ber den Regen.\n",
+	"Kaikki ihmiset syntyv\xC3\xA4t vapaina ja tasavertaisina "
+	"arvoltaan ja oikeuksiltaan.\n",
+	"\xD0\x92\xD1\x81\xD0\xB5 \xD0\xBB\xD1\x8E\xD0\xB4\xD0\xB8 "
+	"\xD1\x80\xD0\xBE\xD0\xB6\xD0\xB4\xD0\xB0\xD1\x8E\xD1\x82\xD1\x81"
+	"\xD1\x8F \xD1\x81\xD0\xB2\xD0\xBE\xD0\xB1\xD0\xBE\xD0\xB4\xD0\xBD"
+	"\xD1\x8B\xD0\xBC\xD0\xB8.\n",
+	"\xCE\x8C\xCE\xBB\xCE\xBF\xCE\xB9 \xCE\xBF\xCE\xB9 \xCE\xAC\xCE\xBD"
+	"\xCE\xB8\xCF\x81\xCF\x89\xCF\x80\xCE\xBF\xCE\xB9 \xCE\xB3\xCE\xB5"
+	"\xCE\xBD\xCE\xBD\xCE\xB9\xCE\xBF\xCF\x8D\xCE\xBD\xCF\x84\xCE\xB1"
+	"\xCE\xB9 \xCE\xB5\xCE\xBB\xCE\xB5\xCF\x8D\xCE\xB8\xCE\xB5\xCF\x81"
+	"\xCE\xBF\xCE\xB9.\n",
+	"Contact <user@example.com> or visit https://www.example.com/path "
+	"for 12345 more details, ref #A-42.\n",
+};
+
+struct bench_fts_context {
+	struct fts_tokenizer *tok;
+	struct fts_filter *filter;
+	enum bench_mode mode;
+	string_t *token_buf;
+	/* Token bytes produced by the last run */
+	uoff_t token_bytes;
+};
+
+static struct test_bench_corpus corpus;
+
+static void bench_add_synthetic_text(void)
+{
+	string_t *str = str_new(default_pool, 1024*64);
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_SYNTHETIC_REPEAT; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_paragraphs); j++)
+			str_append(str, bench_paragraphs[j]);
+	}
+	test_bench_corpus_add(&corpus, str);
+}
+
+static void
+bench_token(struct fts_filter *filter, enum bench_mode mode,
+	    string_t *token_buf, const char *token, uoff_t *token_bytes)
+{
+	const char *error;
+	int ret;
+
+	switch (mode) {
+	case BENCH_MODE_TOKENIZE:
+		*token_bytes += strlen(token);
+		return;
+	case BENCH_MODE_FILTER:
+		ret = fts_filter_filter(filter, &token, &error);
+		if (ret < 0)
+			i_fatal("fts_filter_filter() failed: %s", error);
+		if (ret > 0)
+			*token_bytes += strlen(token);
+		return;
+	case BENCH_MODE_FILTER_BUF:
+		str_truncate(token_buf, 0);
+		str_append(token_buf, token);
+		ret = fts_filter_filter_buf(filter, token_buf, &error);
+		if (ret < 0)
+			i_fatal("fts_filter_filter_buf() failed: %s", error);
+		*token_bytes += str_len(token_buf);
+		return;
+	}
+	i_unreached();
+}
+
+static void bench_fts_run(struct bench_fts_context *ctx)
+{
+	buffer_t *buf;
+	const char *token, *error;
+	int ret;
+
+	ctx->token_bytes = 0;
+	array_foreach_elem(&corpus.items, buf) T_BEGIN {
+		while ((ret = fts_tokenizer_next(ctx->tok, buf->data, buf->used,
+						 &token, &error)) > 0) {
+			bench_token(ctx->filter, ctx->mode, ctx->token_buf,
+				    token, &ctx->token_bytes);
+		}
+		while (ret >= 0 &&
+		       (ret = fts_tokenizer_final(ctx->tok, &token,
+						  &error)) > 0) {
+			bench_token(ctx->filter, ctx->mode, ctx->token_buf,
+				    token, &ctx->token_bytes);
+		}
+		if (ret < 0)
+			i_fatal("fts_tokenizer_next() failed: %s", error);
+	} T_END;
+}
+
+static void
+bench_fts(const char *name, struct fts_tokenizer *tok,
+	  struct fts_filter *filter, enum bench_mode mode)
+{
+	struct bench_fts_context ctx = {
+		.tok = tok,
+		.filter = filter,
+		.mode = mode,
+	};
+
+	ctx.token_buf = str_new(default_pool, 128);
+	test_bench_run(name, corpus.size, bench_fts_run, &ctx, NULL);
+	printf("%s: %"PRIuUOFF_T" token bytes\n", name, ctx.token_bytes);
+	str_free(&ctx.token_buf);
+}
+
+static struct fts_filter *bench_filter_create(void)
+{
+	static const struct fts_language english = { .name = "en" };
+	static const char *const stopword_settings[] = {
+		"stopwords_dir", TEST_STOPWORDS_DIR, NULL
+	};
+	struct fts_filter *filter, *parent;
+	const char *error;
+
+	if (fts_filter_create(fts_filter_lowercase, NULL, &english,
+			      NULL, &parent, &error) < 0)
+		i_fatal("lowercase filter: %s", error);
+#ifdef HAVE_LIBICU
+	if (fts_filter_create(fts_filter_normalizer_icu, parent, &english,
+			      NULL, &filter, &error) < 0)
+		i_fatal("normalizer-icu filter: %s", error);
+	fts_filter_unref(&parent);
+	parent = filter;
+#endif
+	if (fts_filter_create(fts_filter_english_possessive, parent, &english,
+			      NULL, &filter, &error) < 0)
+		i_fatal("english-possessive filter: %s", error);
+	fts_filter_unref(&parent);
+	parent = filter;
+	if (fts_filter_create(fts_filter_stopwords, parent, &english,
+			      stopword_settings, &filter, &error) < 0)
+		i_fatal("stopwords filter: %s", error);
+	fts_filter_unref(&parent);
+	return filter;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *const tr29_settings[] = {
+		"algorithm", "tr29", NULL
+	};
+	struct fts_tokenizer *tok;
+	struct fts_filter *filter;
+	const char *error;
+	unsigned int i;
+	uint64_t cache_hits, cache_misses;
+
+	lib_init();
+	fts_tokenizers_init();
+	fts_filters_init();
+
+	if (argc > 1 && argv[1][0] == '-')
+		i_fatal("Usage: %s [<text files>]", argv[0]);
+	argv++;
+
+	test_bench_corpus_init(&corpus);
+	if (argv[0] == NULL) {
+		bench_add_synthetic_text();
+		(void)test_bench_corpus_add_path(&corpus,
+						 UDHRDIR"/udhr_fra.txt", TRUE);
+	} else {
+		for (i = 0; argv[i] != NULL; i++)
+			(void)test_bench_corpus_add_path(&corpus, argv[i], FALSE);
+	}
+	printf("%u texts, %"PRIuUOFF_T" bytes\n",
+	       array_count(&corpus.items), corpus.size);
+
+	if (fts_tokenizer_create(fts_tokenizer_generic, NULL, tr29_settings,
+				 &tok, &error) < 0)
+		i_fatal("tokenizer: %s", error);
+	filter = bench_filter_create();
+
+	bench_fts("tokenizer", tok, NULL, BENCH_MODE_TOKENIZE);
+	bench_fts("tokenizer+filter", tok, filter, BENCH_MODE_FILTER);
+	bench_fts("tokenizer+filter_buf", tok, filter, BENCH_MODE_FILTER_BUF);
+	fts_filter_get_cache_stats(filter, &cache_hits, &cache_misses);
+	printf("filter cache: %"PRIu64" hits, %"PRIu64" misses\n",
+	       cache_hits, cache_misses);
+
+	fts_filter_unref(&filter);
+	fts_tokenizer_unref(&tok);
+	test_bench_corpus_deinit(&corpus);
+	fts_filters_deinit();
+	fts_tokenizers_deinit();
+	lib_deinit();
+	return 0;
+}
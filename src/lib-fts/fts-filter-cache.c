@@ -0,0 +1,128 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "hash.h"
+#include "llist.h"
+#include "fts-filter-cache.h"
+
+struct fts_filter_cache_entry {
+	/* LRU list: head is the most recently used */
+	struct fts_filter_cache_entry *prev, *next;
+
+	int ret;
+	size_t output_len;
+	const char *key;
+	const char *output;
+	/* key and output strings follow */
+};
+
+struct fts_filter_cache {
+	HASH_TABLE(const char *, struct fts_filter_cache_entry *) entries;
+	struct fts_filter_cache_entry *head, *tail;
+	unsigned int count, max_entries;
+
+	/* input token of the last failed lookup */
+	string_t *lookup_key;
+	uint64_t hits, misses;
+};
+
+struct fts_filter_cache *fts_filter_cache_init(unsigned int max_entries)
+{
+	struct fts_filter_cache *cache;
+
+	i_assert(max_entries > 0);
+
+	cache = i_new(struct fts_filter_cache, 1);
+	cache->max_entries = max_entries;
+	cache->lookup_key = str_new(default_pool, 64);
+	hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	return cache;
+}
+
+void fts_filter_cache_deinit(struct fts_filter_cache **_cache)
+{
+	struct fts_filter_cache *cache = *_cache;
+	struct fts_filter_cache_entry *entry, *next;
+
+	*_cache = NULL;
+
+	for (entry = cache->head; entry != NULL; entry = next) {
+		next = entry->next;
+		i_free(entry);
+	}
+	hash_table_destroy(&cache->entries);
+	str_free(&cache->lookup_key);
+	i_free(cache);
+}
+
+bool fts_filter_cache_lookup(struct fts_filter_cache *cache, string_t *token,
+			     int *ret_r)
+{
+	struct fts_filter_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->entries, str_c(token));
+	if (entry == NULL) {
+		cache->misses++;
+		str_truncate(cache->lookup_key, 0);
+		str_append_str(cache->lookup_key, token);
+		return FALSE;
+	}
+	cache->hits++;
+	if (cache->head != entry) {
+		DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+		DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	}
+	str_truncate(token, 0);
+	str_append_data(token, entry->output, entry->output_len);
+	*ret_r = entry->ret;
+	return TRUE;
+}
+
+static void fts_filter_cache_evict(struct fts_filter_cache *cache)
+{
+	struct fts_filter_cache_entry *entry = cache->tail;
+
+	hash_table_remove(cache->entries, entry->key);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->count--;
+	i_free(entry);
+}
+
+void fts_filter_cache_add(struct fts_filter_cache *cache,
+			  const string_t *token, int ret)
+{
+	struct fts_filter_cache_entry *entry;
+	size_t key_len = str_len(cache->lookup_key);
+	size_t output_len = ret > 0 ? str_len(token) : 0;
+	char *key, *output;
+
+	i_assert(key_len > 0);
+
+	if (cache->count >= cache->max_entries)
+		fts_filter_cache_evict(cache);
+
+	entry = i_malloc(MALLOC_ADD(sizeof(*entry),
+				    MALLOC_ADD(key_len, output_len + 2)));
+	key = (char *)(entry + 1);
+	memcpy(key, str_data(cache->lookup_key), key_len);
+	output = key + key_len + 1;
+	if (output_len > 0)
+		memcpy(output, str_data(token), output_len);
+	entry->key = key;
+	entry->output = output;
+	entry->output_len = output_len;
+	entry->ret = ret;
+
+	hash_table_insert(cache->entries, entry->key, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->count++;
+	str_truncate(cache->lookup_key, 0);
+}
+
+void fts_filter_cache_get_stats(struct fts_filter_cache *cache,
+				uint64_t *hits_r, uint64_t *misses_r)
+{
+	*hits_r = cache->hits;
+	*misses_r = cache->misses;
+}
@@ -0,0 +1,27 @@
+#ifndef FTS_FILTER_CACHE_H
+#define FTS_FILTER_CACHE_H
+
+/* Bounded LRU cache of filter input token -> filtered token. Used by the
+   expensive filters, so that common words don't need to be stemmed or
+   normalized again every time they're seen. */
+
+#define FTS_FILTER_CACHE_DEFAULT_SIZE 1024
+
+struct fts_filter_cache *fts_filter_cache_init(unsigned int max_entries);
+void fts_filter_cache_deinit(struct fts_filter_cache **cache);
+
+/* Look up the token. If found, the token is replaced with the cached
+   output, *ret_r is set to the filter's return value and TRUE is returned.
+   Otherwise the token is remembered for the following
+   fts_filter_cache_add() call. */
+bool fts_filter_cache_lookup(struct fts_filter_cache *cache, string_t *token,
+			     int *ret_r);
+/* Add the filter's output for the token given to the previous failed
+   fts_filter_cache_lookup(). */
+void fts_filter_cache_add(struct fts_filter_cache *cache,
+			  const string_t *token, int ret);
+
+void fts_filter_cache_get_stats(struct fts_filter_cache *cache,
+				uint64_t *hits_r, uint64_t *misses_r);
+
+#endif
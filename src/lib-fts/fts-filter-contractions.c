@@ -33,12 +33,12 @@ fts_filter_contractions_create(const struct fts_language *lang,
 
 static int
 fts_filter_contractions_filter(struct fts_filter *filter ATTR_UNUSED,
-			    const char **_token,
+			    string_t *_token,
 			    const char **error_r ATTR_UNUSED)
 {
 	int char_size, pos = 0;
 	unichar_t apostrophe;
-	const char *token = *_token;
+	const char *token = str_c(_token);
 
 	switch (token[pos]) {
 	case 'q':
@@ -61,10 +61,10 @@ fts_filter_contractions_filter(struct fts_filter *filter ATTR_UNUSED,
 		i_assert(char_size > 0);
 		if (IS_APOSTROPHE(apostrophe)) {
 			pos += char_size;
-			*_token = token + pos;
+			if (token[pos] == '\0') /* nothing left */
+				return 0;
+			str_delete(_token, 0, pos);
 		}
-		if (token[pos] == '\0') /* nothing left */
-			return 0;
 		break;
 	default:
 		/* do nothing */
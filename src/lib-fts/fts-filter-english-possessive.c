@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "unichar.h"
 #include "fts-common.h"
 #include "fts-filter-private.h"
@@ -20,17 +21,18 @@ static unichar_t get_ending_utf8_char(const char *str, size_t *end_pos)
 
 static int
 fts_filter_english_possessive_filter(struct fts_filter *filter ATTR_UNUSED,
-				     const char **token,
+				     string_t *token,
 				     const char **error_r ATTR_UNUSED)
 {
-	size_t len = strlen(*token);
+	const char *data = str_c(token);
+	size_t len = str_len(token);
 	unichar_t c;
 
-	if (len > 1 && ((*token)[len-1] == 's' || (*token)[len-1] == 'S')) {
+	if (len > 1 && (data[len-1] == 's' || data[len-1] == 'S')) {
 		len -= 2;
-		c = get_ending_utf8_char(*token, &len);
+		c = get_ending_utf8_char(data, &len);
 		if (IS_APOSTROPHE(c))
-			*token = t_strndup(*token, len);
+			str_truncate(token, len);
 	}
 	return 1;
 }
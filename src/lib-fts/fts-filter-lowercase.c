@@ -43,18 +43,43 @@ fts_filter_lowercase_create(const struct fts_language *lang ATTR_UNUSED,
 	return 0;
 }
 
+static bool fts_filter_lowercase_ascii(string_t *token)
+{
+	unsigned char *data = buffer_get_modifiable_data(token, NULL);
+	size_t i, size = str_len(token);
+
+	for (i = 0; i < size; i++) {
+		if ((data[i] & 0x80) != 0)
+			return FALSE;
+		if (data[i] >= 'A' && data[i] <= 'Z')
+			data[i] += 'a' - 'A';
+	}
+	return TRUE;
+}
+
 static int
 fts_filter_lowercase_filter(struct fts_filter *filter ATTR_UNUSED,
-                            const char **token,
+                            string_t *token,
                             const char **error_r ATTR_UNUSED)
 {
+	/* Most tokens are plain ASCII, which can be lowercased in-place.
+	   If a non-ASCII character is found, the already lowercased ASCII
+	   prefix doesn't matter for the full lowercasing. */
+	if (!fts_filter_lowercase_ascii(token)) {
 #ifdef HAVE_LIBICU
-	str_truncate(filter->token, 0);
-	fts_icu_lcase(filter->token, *token);
-	fts_filter_truncate_token(filter->token, filter->max_length);
-	*token = str_c(filter->token);
+		str_truncate(filter->token, 0);
+		fts_icu_lcase(filter->token, str_c(token));
+		str_truncate(token, 0);
+		str_append_str(token, filter->token);
 #else
-	*token = t_str_lcase(*token);
+		const char *lcase = t_str_lcase(str_c(token));
+
+		str_truncate(token, 0);
+		str_append(token, lcase);
+#endif
+	}
+#ifdef HAVE_LIBICU
+	fts_filter_truncate_token(token, filter->max_length);
 #endif
 	return 1;
 }
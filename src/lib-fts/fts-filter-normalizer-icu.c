@@ -6,6 +6,7 @@
 #include "unichar.h" /* unicode replacement char */
 #include "fts-filter-common.h"
 #include "fts-filter-private.h"
+#include "fts-filter-cache.h"
 #include "fts-language.h"
 
 #ifdef HAVE_LIBICU
@@ -18,7 +19,6 @@ struct fts_filter_normalizer_icu {
 
 	UTransliterator *transliterator;
 	ARRAY_TYPE(icu_utf16) utf16_token, trans_token;
-	string_t *utf8_token;
 };
 
 static void fts_filter_normalizer_icu_destroy(struct fts_filter *filter)
@@ -40,6 +40,7 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	struct fts_filter_normalizer_icu *np;
 	pool_t pp;
 	unsigned int i, max_length = 250;
+	unsigned int cache_size = FTS_FILTER_CACHE_DEFAULT_SIZE;
 	const char *id = "Any-Lower; NFKD; [: Nonspacing Mark :] Remove; NFC; [\\x20] Remove";
 
 	for (i = 0; settings[i] != NULL; i += 2) {
@@ -53,6 +54,11 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 				*error_r = t_strdup_printf("Invalid icu maxlen setting: %s", value);
 				return -1;
 			}
+		} else if (strcmp(key, "cache_size") == 0) {
+			if (str_to_uint(value, &cache_size) < 0) {
+				*error_r = t_strdup_printf("Invalid icu cache_size setting: %s", value);
+				return -1;
+			}
 		} else {
 			*error_r = t_strdup_printf("Unknown setting: %s", key);
 			return -1;
@@ -67,14 +73,15 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	np->transliterator_id = p_strdup(pp, id);
 	p_array_init(&np->utf16_token, pp, 64);
 	p_array_init(&np->trans_token, pp, 64);
-	np->utf8_token = buffer_create_dynamic(pp, 128);
 	np->filter.max_length = max_length;
+	if (cache_size > 0)
+		np->filter.cache = fts_filter_cache_init(cache_size);
 	*filter_r = &np->filter;
 	return 0;
 }
 
 static int
-fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
+fts_filter_normalizer_icu_filter(struct fts_filter *filter, string_t *token,
 				 const char **error_r)
 {
 	struct fts_filter_normalizer_icu *np =
@@ -86,7 +93,7 @@ fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 		                                  error_r) < 0)
 			return -1;
 
-	fts_icu_utf8_to_utf16(&np->utf16_token, *token);
+	fts_icu_utf8_to_utf16(&np->utf16_token, str_c(token));
 	array_append_zero(&np->utf16_token);
 	array_pop_back(&np->utf16_token);
 	array_clear(&np->trans_token);
@@ -98,10 +105,9 @@ fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 	if (array_count(&np->trans_token) == 0)
 		return 0;
 
-	fts_icu_utf16_to_utf8(np->utf8_token, array_front(&np->trans_token),
+	fts_icu_utf16_to_utf8(token, array_front(&np->trans_token),
 			      array_count(&np->trans_token));
-	fts_filter_truncate_token(np->utf8_token, np->filter.max_length);
-	*token = str_c(np->utf8_token);
+	fts_filter_truncate_token(token, np->filter.max_length);
 	return 1;
 }
 
@@ -119,7 +125,7 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 
 static int
 fts_filter_normalizer_icu_filter(struct fts_filter *filter ATTR_UNUSED,
-				 const char **token ATTR_UNUSED,
+				 string_t *token ATTR_UNUSED,
 				 const char **error_r ATTR_UNUSED)
 {
 	return -1;
@@ -9,7 +9,9 @@
  API that stemming providers (classes) must provide: The create()
  function is called to get an instance of a registered filter class.
  The filter() function is called with tokens for the specific filter.
- The destroy function is called to destroy an instance of a filter.
+ It modifies the token in-place. The token is never empty, and it must
+ not be left empty if 1 is returned. The destroy function is called to
+ destroy an instance of a filter.
 
 */
 struct fts_filter_vfuncs {
@@ -17,7 +19,7 @@ struct fts_filter_vfuncs {
 	              const char *const *settings,
 	              struct fts_filter **filter_r,
 	              const char **error_r);
-	int (*filter)(struct fts_filter *filter, const char **token,
+	int (*filter)(struct fts_filter *filter, string_t *token,
 		      const char **error_r);
 
 	void (*destroy)(struct fts_filter *filter);
@@ -28,6 +30,11 @@ struct fts_filter {
 	struct fts_filter_vfuncs v;
 	struct fts_filter *parent;
 	string_t *token;
+	/* token buffer used by fts_filter_filter() */
+	string_t *filter_token;
+	/* If non-NULL, filter() results are cached here. Set by the
+	   filter's create() if it wants its results cached. */
+	struct fts_filter_cache *cache;
 	size_t max_length;
 	int refcount;
 };
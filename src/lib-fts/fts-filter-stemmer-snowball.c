@@ -1,8 +1,10 @@
 /* Copyright (c) 2014-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "str.h"
 #include "fts-language.h"
 #include "fts-filter-private.h"
+#include "fts-filter-cache.h"
 
 #ifdef HAVE_FTS_STEMMER
 
@@ -32,13 +34,23 @@ fts_filter_stemmer_snowball_create(const struct fts_language *lang,
                                    const char **error_r)
 {
 	struct fts_filter_stemmer_snowball *sp;
+	unsigned int i, cache_size = FTS_FILTER_CACHE_DEFAULT_SIZE;
 	pool_t pp;
 
 	*filter_r = NULL;
 
-	if (settings[0] != NULL) {
-		*error_r = t_strdup_printf("Unknown setting: %s", settings[0]);
-		return -1;
+	for (i = 0; settings[i] != NULL; i += 2) {
+		const char *key = settings[i], *value = settings[i+1];
+
+		if (strcmp(key, "cache_size") == 0) {
+			if (str_to_uint(value, &cache_size) < 0) {
+				*error_r = t_strdup_printf("Invalid snowball cache_size setting: %s", value);
+				return -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Unknown setting: %s", key);
+			return -1;
+		}
 	}
 	pp = pool_alloconly_create(MEMPOOL_GROWING"fts_filter_stemmer_snowball",
 	                           sizeof(struct fts_filter));
@@ -47,6 +59,8 @@ fts_filter_stemmer_snowball_create(const struct fts_language *lang,
 	sp->filter = *fts_filter_stemmer_snowball;
 	sp->lang = p_malloc(sp->pool, sizeof(struct fts_language));
 	sp->lang->name = p_strdup(sp->pool, lang->name);
+	if (cache_size > 0)
+		sp->filter.cache = fts_filter_cache_init(cache_size);
 	*filter_r = &sp->filter;
 	return 0;
 }
@@ -68,7 +82,7 @@ fts_filter_stemmer_snowball_create_stemmer(struct fts_filter_stemmer_snowball *s
 
 static int
 fts_filter_stemmer_snowball_filter(struct fts_filter *filter,
-                                   const char **token, const char **error_r)
+                                   string_t *token, const char **error_r)
 {
 	struct fts_filter_stemmer_snowball *sp =
 		(struct fts_filter_stemmer_snowball *) filter;
@@ -79,15 +93,16 @@ fts_filter_stemmer_snowball_filter(struct fts_filter *filter,
 			return -1;
 	}
 
-	base = sb_stemmer_stem(sp->stemmer, (const unsigned char *)*token, strlen(*token));
+	base = sb_stemmer_stem(sp->stemmer, str_data(token), str_len(token));
 	if (base == NULL) {
 		/* the only reason why this could fail is because of
 		   out of memory. */
 		i_fatal_status(FATAL_OUTOFMEM,
 			       "sb_stemmer_stem(len=%zu) failed: Out of memory",
-			       strlen(*token));
+			       str_len(token));
 	}
-	*token = t_strndup(base, sb_stemmer_length(sp->stemmer));
+	str_truncate(token, 0);
+	str_append_data(token, base, sb_stemmer_length(sp->stemmer));
 	return 1;
 }
 
@@ -109,7 +124,7 @@ fts_filter_stemmer_snowball_destroy(struct fts_filter *stemmer ATTR_UNUSED)
 
 static int
 fts_filter_stemmer_snowball_filter(struct fts_filter *filter ATTR_UNUSED,
-				   const char **token ATTR_UNUSED,
+				   string_t *token ATTR_UNUSED,
 				   const char **error_r ATTR_UNUSED)
 {
 	return -1;
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "istream.h"
+#include "str.h"
 #include "strfuncs.h"
 #include "hash.h"
 #include "unichar.h"
@@ -102,7 +103,7 @@ fts_filter_stopwords_create(const struct fts_language *lang,
 }
 
 static int
-fts_filter_stopwords_filter(struct fts_filter *filter, const char **token,
+fts_filter_stopwords_filter(struct fts_filter *filter, string_t *token,
 			    const char **error_r)
 {
 	struct fts_filter_stopwords *sp =
@@ -113,7 +114,7 @@ fts_filter_stopwords_filter(struct fts_filter *filter, const char **token,
 		if (fts_filter_stopwords_read_list(sp, error_r) < 0)
 			return -1;
 	}
-	return hash_table_lookup(sp->stopwords, *token) == NULL ? 1 : 0;
+	return hash_table_lookup(sp->stopwords, str_c(token)) == NULL ? 1 : 0;
 }
 
 const struct fts_filter fts_filter_stopwords_real = {
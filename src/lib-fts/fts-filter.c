@@ -5,6 +5,7 @@
 #include "str.h"
 #include "fts-language.h"
 #include "fts-filter-private.h"
+#include "fts-filter-cache.h"
 
 #ifdef HAVE_LIBICU
 #  include "fts-icu.h"
@@ -106,6 +107,10 @@ void fts_filter_unref(struct fts_filter **_fpp)
 
 	if (fp->parent != NULL)
 		fts_filter_unref(&fp->parent);
+	if (fp->filter_token != NULL)
+		str_free(&fp->filter_token);
+	if (fp->cache != NULL)
+		fts_filter_cache_deinit(&fp->cache);
 	if (fp->v.destroy != NULL)
 		fp->v.destroy(fp);
 	else {
@@ -115,26 +120,64 @@ void fts_filter_unref(struct fts_filter **_fpp)
 	}
 }
 
-int fts_filter_filter(struct fts_filter *filter, const char **token,
-		      const char **error_r)
+int fts_filter_filter_buf(struct fts_filter *filter, string_t *token,
+			  const char **error_r)
 {
 	int ret = 0;
 
-	i_assert((*token)[0] != '\0');
+	i_assert(str_len(token) > 0);
 
 	/* Recurse to parent. */
 	if (filter->parent != NULL)
-		ret = fts_filter_filter(filter->parent, token, error_r);
+		ret = fts_filter_filter_buf(filter->parent, token, error_r);
 
 	/* Parent returned token or no parent. */
-	if (ret > 0 || filter->parent == NULL)
-		ret = filter->v.filter(filter, token, error_r);
+	if (ret > 0 || filter->parent == NULL) {
+		if (filter->cache == NULL)
+			ret = filter->v.filter(filter, token, error_r);
+		else if (!fts_filter_cache_lookup(filter->cache, token, &ret)) {
+			ret = filter->v.filter(filter, token, error_r);
+			if (ret >= 0)
+				fts_filter_cache_add(filter->cache, token, ret);
+		}
+	}
 
 	if (ret <= 0)
-		*token = NULL;
-	else {
-		i_assert(*token != NULL);
-		i_assert((*token)[0] != '\0');
+		str_truncate(token, 0);
+	else
+		i_assert(str_len(token) > 0);
+	return ret;
+}
+
+void fts_filter_get_cache_stats(struct fts_filter *filter,
+				uint64_t *hits_r, uint64_t *misses_r)
+{
+	uint64_t hits, misses;
+
+	*hits_r = *misses_r = 0;
+	for (; filter != NULL; filter = filter->parent) {
+		if (filter->cache != NULL) {
+			fts_filter_cache_get_stats(filter->cache,
+						   &hits, &misses);
+			*hits_r += hits;
+			*misses_r += misses;
+		}
 	}
+}
+
+int fts_filter_filter(struct fts_filter *filter, const char **token,
+		      const char **error_r)
+{
+	int ret;
+
+	i_assert((*token)[0] != '\0');
+
+	if (filter->filter_token == NULL)
+		filter->filter_token = str_new(default_pool, 64);
+	str_truncate(filter->filter_token, 0);
+	str_append(filter->filter_token, *token);
+
+	ret = fts_filter_filter_buf(filter, filter->filter_token, error_r);
+	*token = ret <= 0 ? NULL : str_c(filter->filter_token);
 	return ret;
 }
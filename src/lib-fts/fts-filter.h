@@ -17,6 +17,9 @@ extern const struct fts_filter *fts_filter_stopwords;
 
 /*
  Settings: "lang", language of the stemmed language.
+
+ "cache_size", number of recently stemmed tokens to cache. 0 disables
+  the cache. Defaults to 1024.
  */
 extern const struct fts_filter *fts_filter_stemmer_snowball;
 
@@ -28,6 +31,9 @@ extern const struct fts_filter *fts_filter_stemmer_snowball;
 
  "maxlen", maximum length of tokens that ICU normalizer will output.
   Defaults to 250.
+
+ "cache_size", number of recently normalized tokens to cache. 0 disables
+  the cache. Defaults to 1024.
  */
 extern const struct fts_filter *fts_filter_normalizer_icu;
 
@@ -63,9 +69,20 @@ void fts_filter_unref(struct fts_filter **filter);
 
 /* Returns 1 if token is returned in *token, 0 if token was filtered
    out (*token is also set to NULL) and -1 on error.
-   Input is also given via *token.
+   Input is also given via *token. The returned token is valid until the
+   next call.
 */
 int fts_filter_filter(struct fts_filter *filter, const char **token,
 		      const char **error_r);
+/* Same as fts_filter_filter(), but the token is modified in-place. This
+   avoids copying the token when the caller already has it in a reusable
+   buffer. If the token was filtered out, it's truncated to empty. */
+int fts_filter_filter_buf(struct fts_filter *filter, string_t *token,
+			  const char **error_r);
+
+/* Return the filter result cache hits and misses summed for the filter and
+   all its parents. */
+void fts_filter_get_cache_stats(struct fts_filter *filter,
+				uint64_t *hits_r, uint64_t *misses_r);
 
 #endif
@@ -748,6 +748,59 @@ static void test_fts_filter_normalizer_truncation(void)
 	test_end();
 }
 
+static void test_fts_filter_normalizer_cache(void)
+{
+	static const struct {
+		const char *input;
+		const char *output;
+	} tests[] = {
+		{ "\xC3\x85ngstr\xC3\xB6m", "angstrom" },
+		{ "\xC2\xAF", NULL },
+		{ "Foo", "foo" },
+		{ "\xC3\x85ngstr\xC3\xB6m", "angstrom" },
+		{ "\xC2\xAF", NULL },
+		{ "bar", "bar" },
+		{ "Foo", "foo" },
+		/* the least recently used token was dropped */
+		{ "\xC3\x85ngstr\xC3\xB6m", "angstrom" },
+	};
+	const char *const settings[] = { "cache_size", "3", NULL };
+	const char *const no_cache_settings[] = { "cache_size", "0", NULL };
+	struct fts_filter *norm;
+	const char *error, *token;
+	uint64_t hits, misses;
+	unsigned int i;
+	int ret;
+
+	test_begin("fts filter normalizer cache");
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL, settings, &norm, &error) == 0);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		token = tests[i].input;
+		ret = fts_filter_filter(norm, &token, &error);
+		if (tests[i].output == NULL)
+			test_assert_idx(ret == 0 && token == NULL, i);
+		else {
+			test_assert_idx(ret > 0, i);
+			test_assert_strcmp_idx(token, tests[i].output, i);
+		}
+	}
+	fts_filter_get_cache_stats(norm, &hits, &misses);
+	test_assert(hits == 2);
+	test_assert(misses == 6);
+	fts_filter_unref(&norm);
+
+	/* cache can be disabled */
+	test_assert(fts_filter_create(fts_filter_normalizer_icu, NULL, NULL, no_cache_settings, &norm, &error) == 0);
+	token = "Foo";
+	test_assert(fts_filter_filter(norm, &token, &error) > 0);
+	token = "Foo";
+	test_assert(fts_filter_filter(norm, &token, &error) > 0);
+	fts_filter_get_cache_stats(norm, &hits, &misses);
+	test_assert(hits == 0 && misses == 0);
+	fts_filter_unref(&norm);
+	test_end();
+}
+
 #ifdef HAVE_FTS_STEMMER
 static void test_fts_filter_normalizer_stopwords_stemmer_eng(void)
 {
@@ -973,6 +1026,47 @@ static void test_fts_filter_english_possessive(void)
 	test_end();
 }
 
+static void test_fts_filter_buf_chain(void)
+{
+	static const struct {
+		const char *input;
+		const char *output;
+	} tests[] = {
+		{ "Foo", "foo" },
+		{ "L'Homme", "homme" },
+		{ "QU'", NULL },
+		{ "J'ADORE", "adore" },
+#ifdef HAVE_LIBICU
+		{ "L'\xC3\x89T\xC3\x89", "\xC3\xA9t\xC3\xA9" },
+		{ "ABC\xC3\x85", "abc\xC3\xA5" },
+#endif
+	};
+	struct fts_filter *lcase, *filter;
+	string_t *token = t_str_new(8);
+	const char *error;
+	unsigned int i;
+	int ret;
+
+	test_begin("fts filter chain with token buffer");
+	test_assert(fts_filter_create(fts_filter_lowercase, NULL, &french_language, NULL, &lcase, &error) == 0);
+	test_assert(fts_filter_create(fts_filter_contractions, lcase, &french_language, NULL, &filter, &error) == 0);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		str_truncate(token, 0);
+		str_append(token, tests[i].input);
+		ret = fts_filter_filter_buf(filter, token, &error);
+		if (tests[i].output == NULL)
+			test_assert_idx(ret == 0 && str_len(token) == 0, i);
+		else {
+			test_assert_idx(ret > 0, i);
+			test_assert_strcmp_idx(str_c(token), tests[i].output, i);
+		}
+	}
+	fts_filter_unref(&filter);
+	fts_filter_unref(&lcase);
+	test_end();
+}
+
 /* TODO: Functions to test 1. ref-unref pairs 2. multiple registers +
   an unregister + find */
 
@@ -1007,6 +1101,7 @@ int main(void)
 		test_fts_filter_normalizer_invalid_id,
 		test_fts_filter_normalizer_oversized,
 		test_fts_filter_normalizer_truncation,
+		test_fts_filter_normalizer_cache,
 #ifdef HAVE_FTS_STEMMER
 		test_fts_filter_normalizer_stopwords_stemmer_eng,
 		test_fts_filter_stopwords_normalizer_stemmer_no,
@@ -1014,6 +1109,7 @@ int main(void)
 #endif
 #endif
 		test_fts_filter_english_possessive,
+		test_fts_filter_buf_chain,
 		NULL
 	};
 	int ret;
@@ -0,0 +1,512 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "imapc-client.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * End-to-end IMAP load generator. Starts a number of concurrent sessions
+ * against a running server. Each session logs in and SELECTs the mailbox.
+ * After that it keeps running commands picked randomly from a weighted mix
+ * until the benchmark time is up. For each command type it reports the
+ * count, failures and latency percentiles, and at the end the total
+ * command throughput.
+ *
+ * The mix is given as a comma-separated list of <command>=<weight>, e.g.
+ * "fetch=10,search=2,append=1,idle=1". The available commands are select,
+ * fetch, search, append and idle. FETCH reads the headers, flags and sizes
+ * of a random range of -f messages. SEARCH is a SUBJECT search. APPEND
+ * saves a small message. IDLE idles for -i milliseconds; only its count
+ * is reported, since the DONE is included in the following command's
+ * latency. When the mailbox is empty, APPEND is done instead of FETCH.
+ *
+ * "%n" in the username is replaced with the session number (1..clients),
+ * so that the sessions can be spread over many users.
+ */
+
+#define BENCH_DEFAULT_MIX "select=1,fetch=10,search=2,append=1,idle=1"
+#define BENCH_DEFAULT_CLIENTS 10
+#define BENCH_DEFAULT_SECS 10
+#define BENCH_DEFAULT_FETCH_COUNT 10
+#define BENCH_DEFAULT_IDLE_MSECS 2000
+
+enum bench_op {
+	BENCH_OP_LOGIN,
+	BENCH_OP_SELECT,
+	BENCH_OP_FETCH,
+	BENCH_OP_SEARCH,
+	BENCH_OP_APPEND,
+	BENCH_OP_IDLE,
+
+	BENCH_OP_COUNT
+};
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+	"login", "select", "fetch", "search", "append", "idle"
+};
+
+struct bench_op_stats {
+	unsigned int weight;
+	unsigned int count, failures;
+	/* command latencies in microseconds */
+	ARRAY(uint64_t) latencies;
+};
+
+struct bench_session {
+	unsigned int idx;
+	struct imapc_client *client;
+	struct imapc_client_mailbox *box;
+	struct timeout *to;
+
+	enum bench_op op;
+	uint64_t op_start_usecs;
+	uint32_t exists;
+};
+
+static struct bench_op_stats stats[BENCH_OP_COUNT];
+static unsigned int total_weight;
+static ARRAY(struct bench_session *) sessions;
+static bool stopping;
+
+static const char *mailbox = "INBOX";
+static unsigned int fetch_count = BENCH_DEFAULT_FETCH_COUNT;
+static unsigned int idle_msecs = BENCH_DEFAULT_IDLE_MSECS;
+static unsigned int delay_msecs = 0;
+
+static const char bench_message[] =
+"From: bench@example.com\r\n"
+"To: bench@example.com\r\n"
+"Subject: bench-imap message\r\n"
+"Message-ID: <bench-imap@example.com>\r\n"
+"\r\n"
+"This message was saved by bench-imap.\r\n";
+
+static void bench_session_next(struct bench_session *session);
+
+static void bench_op_begin(struct bench_session *session, enum bench_op op)
+{
+	session->op = op;
+	session->op_start_usecs = i_microseconds();
+}
+
+static void
+bench_op_end(struct bench_session *session,
+	     const struct imapc_command_reply *reply)
+{
+	struct bench_op_stats *op_stats = &stats[session->op];
+	uint64_t usecs = i_microseconds() - session->op_start_usecs;
+
+	if (reply->state != IMAPC_COMMAND_STATE_OK) {
+		op_stats->failures++;
+		i_error("session %u: %s failed: %s", session->idx,
+			bench_op_names[session->op], reply->text_full);
+		return;
+	}
+	op_stats->count++;
+	array_push_back(&op_stats->latencies, &usecs);
+}
+
+static void bench_session_select(struct bench_session *session);
+
+static void
+bench_command_callback(const struct imapc_command_reply *reply, void *context)
+{
+	struct bench_session *session = context;
+
+	if (stopping)
+		return;
+	bench_op_end(session, reply);
+	if (reply->state == IMAPC_COMMAND_STATE_DISCONNECTED) {
+		/* the session is done */
+		return;
+	}
+	if (session->op == BENCH_OP_SELECT &&
+	    reply->state != IMAPC_COMMAND_STATE_OK) {
+		/* can't continue without a selected mailbox */
+		return;
+	}
+
+	if (delay_msecs == 0)
+		bench_session_next(session);
+	else {
+		session->to = timeout_add(delay_msecs,
+					  bench_session_next, session);
+	}
+}
+
+static void
+bench_login_callback(const struct imapc_command_reply *reply, void *context)
+{
+	struct bench_session *session = context;
+
+	if (stopping)
+		return;
+	bench_op_end(session, reply);
+	if (reply->state == IMAPC_COMMAND_STATE_OK)
+		bench_session_select(session);
+}
+
+static void
+bench_untagged_callback(const struct imapc_untagged_reply *reply,
+			void *context)
+{
+	struct bench_session *session = context;
+
+	if (strcasecmp(reply->name, "EXISTS") == 0)
+		session->exists = reply->num;
+}
+
+static void bench_session_select(struct bench_session *session)
+{
+	struct imapc_command *cmd;
+
+	if (session->box == NULL) {
+		session->box = imapc_client_mailbox_open(session->client,
+							 session);
+	}
+	bench_op_begin(session, BENCH_OP_SELECT);
+	cmd = imapc_client_mailbox_cmd(session->box, bench_command_callback,
+				       session);
+	imapc_command_set_flags(cmd, IMAPC_COMMAND_FLAG_SELECT);
+	imapc_command_sendf(cmd, "SELECT %s", mailbox);
+}
+
+static void bench_session_append(struct bench_session *session)
+{
+	struct imapc_command *cmd;
+	struct istream *input;
+
+	bench_op_begin(session, BENCH_OP_APPEND);
+	input = i_stream_create_from_data(bench_message,
+					  sizeof(bench_message)-1);
+	cmd = imapc_client_mailbox_cmd(session->box, bench_command_callback,
+				       session);
+	imapc_command_sendf(cmd, "APPEND %s %p", mailbox, input);
+	i_stream_unref(&input);
+}
+
+static void bench_session_fetch(struct bench_session *session)
+{
+	struct imapc_command *cmd;
+	uint32_t seq1, seq2;
+
+	seq1 = i_rand_minmax(1, session->exists);
+	seq2 = I_MIN(session->exists, seq1 + fetch_count - 1);
+
+	bench_op_begin(session, BENCH_OP_FETCH);
+	cmd = imapc_client_mailbox_cmd(session->box, bench_command_callback,
+				       session);
+	imapc_command_sendf(cmd, "FETCH %u:%u (UID FLAGS RFC822.SIZE "
+			    "INTERNALDATE BODY.PEEK[HEADER])", seq1, seq2);
+}
+
+static void bench_session_search(struct bench_session *session)
+{
+	struct imapc_command *cmd;
+
+	bench_op_begin(session, BENCH_OP_SEARCH);
+	cmd = imapc_client_mailbox_cmd(session->box, bench_command_callback,
+				       session);
+	imapc_command_send(cmd, "UID SEARCH SUBJECT bench");
+}
+
+static void bench_session_idle_done(struct bench_session *session)
+{
+	timeout_remove(&session->to);
+	stats[BENCH_OP_IDLE].count++;
+	/* the next command ends the IDLE */
+	bench_session_next(session);
+}
+
+static enum bench_op bench_pick_op(void)
+{
+	unsigned int n = i_rand_limit(total_weight);
+	enum bench_op op;
+
+	for (op = BENCH_OP_SELECT;; op++) {
+		i_assert(op < BENCH_OP_COUNT);
+		if (n < stats[op].weight)
+			return op;
+		n -= stats[op].weight;
+	}
+}
+
+static void bench_session_next(struct bench_session *session)
+{
+	enum bench_op op = bench_pick_op();
+
+	timeout_remove(&session->to);
+	if (op == BENCH_OP_FETCH && session->exists == 0)
+		op = BENCH_OP_APPEND;
+
+	switch (op) {
+	case BENCH_OP_SELECT:
+		bench_session_select(session);
+		break;
+	case BENCH_OP_FETCH:
+		bench_session_fetch(session);
+		break;
+	case BENCH_OP_SEARCH:
+		bench_session_search(session);
+		break;
+	case BENCH_OP_APPEND:
+		bench_session_append(session);
+		break;
+	case BENCH_OP_IDLE:
+		imapc_client_mailbox_idle(session->box);
+		session->to = timeout_add(idle_msecs,
+					  bench_session_idle_done, session);
+		break;
+	case BENCH_OP_LOGIN:
+	case BENCH_OP_COUNT:
+		i_unreached();
+	}
+}
+
+static const char *
+bench_get_username(const char *username_template, unsigned int idx)
+{
+	const char *p = strstr(username_template, "%n");
+
+	if (p == NULL)
+		return username_template;
+	return t_strdup_printf("%s%u%s",
+			       t_strdup_until(username_template, p), idx, p + 2);
+}
+
+static void
+bench_session_start(const struct imapc_client_settings *set,
+		    const char *username_template, unsigned int idx)
+{
+	struct imapc_client_settings session_set = *set;
+	struct bench_session *session;
+
+	session = i_new(struct bench_session, 1);
+	session->idx = idx;
+	array_push_back(&sessions, &session);
+
+	session_set.username = bench_get_username(username_template, idx);
+	session->client = imapc_client_init(&session_set, NULL);
+	imapc_client_register_untagged(session->client,
+				       bench_untagged_callback, session);
+	imapc_client_set_login_callback(session->client,
+					bench_login_callback, session);
+	bench_op_begin(session, BENCH_OP_LOGIN);
+	imapc_client_login(session->client);
+}
+
+static void bench_session_free(struct bench_session *session)
+{
+	timeout_remove(&session->to);
+	if (session->box != NULL)
+		imapc_client_mailbox_close(&session->box);
+	imapc_client_deinit(&session->client);
+	i_free(session);
+}
+
+static void bench_parse_mix(const char *mix)
+{
+	const char *const *items, *value;
+	enum bench_op op;
+
+	for (items = t_strsplit(mix, ","); *items != NULL; items++) {
+		value = strchr(*items, '=');
+		if (value == NULL)
+			i_fatal("Invalid mix item (not command=weight): %s",
+				*items);
+		for (op = BENCH_OP_SELECT; op < BENCH_OP_COUNT; op++) {
+			if (strncmp(*items, bench_op_names[op],
+				    value - *items) == 0 &&
+			    bench_op_names[op][value - *items] == '\0')
+				break;
+		}
+		if (op == BENCH_OP_COUNT)
+			i_fatal("Unknown command in mix: %s", *items);
+		if (str_to_uint(value + 1, &stats[op].weight) < 0)
+			i_fatal("Invalid weight in mix: %s", *items);
+	}
+	for (op = BENCH_OP_SELECT; op < BENCH_OP_COUNT; op++)
+		total_weight += stats[op].weight;
+	if (total_weight == 0)
+		i_fatal("The mix has no commands");
+}
+
+static int uint64_cmp(const uint64_t *u1, const uint64_t *u2)
+{
+	if (*u1 < *u2)
+		return -1;
+	if (*u1 > *u2)
+		return 1;
+	return 0;
+}
+
+static double bench_percentile(const uint64_t *latencies, unsigned int count,
+			       unsigned int percent)
+{
+	unsigned int idx = (count * percent + 99) / 100;
+
+	return latencies[idx == 0 ? 0 : idx - 1] / 1000.0;
+}
+
+static void bench_print_results(uint64_t usecs)
+{
+	const uint64_t *latencies;
+	unsigned int i, count, total_count = 0;
+	uint64_t sum;
+	enum bench_op op;
+
+	printf("%-8s %8s %8s %10s %10s %10s %10s %10s\n", "command",
+	       "count", "failed", "avg ms", "p50 ms", "p90 ms", "p99 ms",
+	       "max ms");
+	for (op = 0; op < BENCH_OP_COUNT; op++) {
+		struct bench_op_stats *op_stats = &stats[op];
+
+		if (op_stats->count == 0 && op_stats->failures == 0)
+			continue;
+		printf("%-8s %8u %8u", bench_op_names[op],
+		       op_stats->count, op_stats->failures);
+		total_count += op_stats->count;
+
+		array_sort(&op_stats->latencies, uint64_cmp);
+		latencies = array_get(&op_stats->latencies, &count);
+		if (count == 0) {
+			printf("\n");
+			continue;
+		}
+		sum = 0;
+		for (i = 0; i < count; i++)
+			sum += latencies[i];
+		printf(" %10.03f %10.03f %10.03f %10.03f %10.03f\n",
+		       (double)sum / count / 1000.0,
+		       bench_percentile(latencies, count, 50),
+		       bench_percentile(latencies, count, 90),
+		       bench_percentile(latencies, count, 99),
+		       latencies[count-1] / 1000.0);
+	}
+	printf("%u sessions, %u commands in %.03f secs: %.0f commands/s\n",
+	       array_count(&sessions), total_count, usecs / 1000000.0,
+	       total_count / (usecs / 1000000.0));
+}
+
+static void bench_stop(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static void ATTR_NORETURN bench_usage(void)
+{
+	i_fatal("Usage: bench-imap [-h host] [-p port] [-u username] "
+		"[-w password] [-m mailbox] [-c clients] [-t secs] "
+		"[-x mix] [-f fetch count] [-i idle msecs] [-d delay msecs] "
+		"[-D]");
+}
+
+int main(int argc, char *argv[])
+{
+	struct imapc_client_settings set;
+	struct bench_session **sessionp;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	const char *username = "bench%n", *mix = BENCH_DEFAULT_MIX;
+	unsigned int i, clients = BENCH_DEFAULT_CLIENTS;
+	unsigned int secs = BENCH_DEFAULT_SECS;
+	uint64_t start_usecs, usecs;
+	int c;
+
+	lib_init();
+
+	i_zero(&set);
+	set.host = "127.0.0.1";
+	set.port = 143;
+	set.password = "pass";
+	set.dns_client_socket_path = "";
+	set.temp_path_prefix = "/tmp/bench-imap-";
+	set.rawlog_dir = "";
+	set.max_idle_time = IMAPC_DEFAULT_MAX_IDLE_TIME;
+
+	while ((c = getopt(argc, argv, "h:p:u:w:m:c:t:x:f:i:d:D")) > 0) {
+		switch (c) {
+		case 'h':
+			set.host = optarg;
+			break;
+		case 'p':
+			if (net_str2port(optarg, &set.port) < 0)
+				i_fatal("Invalid port: %s", optarg);
+			break;
+		case 'u':
+			username = optarg;
+			break;
+		case 'w':
+			set.password = optarg;
+			break;
+		case 'm':
+			mailbox = optarg;
+			break;
+		case 'c':
+			if (str_to_uint(optarg, &clients) < 0 || clients == 0)
+				i_fatal("Invalid clients: %s", optarg);
+			break;
+		case 't':
+			if (str_to_uint(optarg, &secs) < 0 || secs == 0)
+				i_fatal("Invalid secs: %s", optarg);
+			break;
+		case 'x':
+			mix = optarg;
+			break;
+		case 'f':
+			if (str_to_uint(optarg, &fetch_count) < 0 ||
+			    fetch_count == 0)
+				i_fatal("Invalid fetch count: %s", optarg);
+			break;
+		case 'i':
+			if (str_to_uint(optarg, &idle_msecs) < 0)
+				i_fatal("Invalid idle msecs: %s", optarg);
+			break;
+		case 'd':
+			if (str_to_uint(optarg, &delay_msecs) < 0)
+				i_fatal("Invalid delay msecs: %s", optarg);
+			break;
+		case 'D':
+			set.debug = TRUE;
+			break;
+		default:
+			bench_usage();
+		}
+	}
+	if (argv[optind] != NULL)
+		bench_usage();
+
+	for (i = 0; i < BENCH_OP_COUNT; i++)
+		i_array_init(&stats[i].latencies, 1024);
+	bench_parse_mix(mix);
+
+	ioloop = io_loop_create();
+	i_array_init(&sessions, clients);
+	start_usecs = i_microseconds();
+	for (i = 1; i <= clients; i++)
+		bench_session_start(&set, username, i);
+
+	to = timeout_add(secs * 1000, bench_stop, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	usecs = i_microseconds() - start_usecs;
+	stopping = TRUE;
+
+	bench_print_results(usecs);
+
+	array_foreach_modifiable(&sessions, sessionp)
+		bench_session_free(*sessionp);
+	array_free(&sessions);
+	for (i = 0; i < BENCH_OP_COUNT; i++)
+		array_free(&stats[i].latencies);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -40,6 +40,7 @@ struct imap_msgpart {
 	/* HEADER.FIELDS[.NOT] (list of headers) */
         struct mailbox_header_lookup_ctx *header_ctx;
 	const char *const *headers;
+	struct header_filter_set *header_filter_set;
 
 	/* which part of the message part to fetch (default: 0..UOFF_T_MAX) */
 	uoff_t partial_offset, partial_size;
@@ -166,8 +167,6 @@ imap_msgpart_get_header_fields(pool_t pool, const char *header_list,
 			value = p_strdup(pool, t_str_ucase(value));
 			array_push_back(fields, &value);
 		}
-		/* istream-header-filter requires headers to be sorted */
-		array_sort(fields, i_strcasecmp_p);
 	} else {
 		result = -1;
 	}
@@ -191,6 +190,9 @@ imap_msgpart_parse_header_fields(struct imap_msgpart *msgpart,
 					   &fields) < 0)
 		return -1;
 
+	msgpart->header_filter_set =
+		header_filter_set_create(array_front(&fields),
+					 array_count(&fields));
 	array_append_zero(&fields);
 	msgpart->headers = array_front(&fields);
 	return 0;
@@ -305,6 +307,7 @@ void imap_msgpart_free(struct imap_msgpart **_msgpart)
 	*_msgpart = NULL;
 
 	imap_msgpart_close_mailbox(msgpart);
+	header_filter_set_unref(&msgpart->header_filter_set);
 	pool_unref(&msgpart->pool);
 }
 
@@ -369,28 +372,22 @@ imap_msgpart_get_partial_header(struct mail *mail, struct istream *mail_input,
 				uoff_t *virtual_size_r, bool *have_crlfs_r,
 				struct imap_msgpart_open_result *result_r)
 {
-	const char *const *hdr_fields = msgpart->headers;
-	unsigned int hdr_count = str_array_length(hdr_fields);
 	struct message_size hdr_size;
 	struct istream *input;
 	bool has_nuls;
 
 	if (msgpart->fetch_type != FETCH_HEADER_FIELDS) {
 		i_assert(msgpart->fetch_type == FETCH_HEADER_FIELDS_NOT);
-		input = i_stream_create_header_filter(mail_input,
-						      HEADER_FILTER_EXCLUDE |
-						      HEADER_FILTER_HIDE_BODY,
-						      hdr_fields, hdr_count,
-						      *null_header_filter_callback,
-						      NULL);
+		input = i_stream_create_header_filter_set(mail_input,
+				HEADER_FILTER_EXCLUDE | HEADER_FILTER_HIDE_BODY,
+				msgpart->header_filter_set,
+				*null_header_filter_callback, NULL);
 	} else if (msgpart->section_number[0] != '\0') {
 		/* fetching partial headers for a message/rfc822 part. */
-		input = i_stream_create_header_filter(mail_input,
-						      HEADER_FILTER_INCLUDE |
-						      HEADER_FILTER_HIDE_BODY,
-						      hdr_fields, hdr_count,
-						      *null_header_filter_callback,
-						      NULL);
+		input = i_stream_create_header_filter_set(mail_input,
+				HEADER_FILTER_INCLUDE | HEADER_FILTER_HIDE_BODY,
+				msgpart->header_filter_set,
+				*null_header_filter_callback, NULL);
 	} else {
 		/* mail_get_header_stream() already filtered out the
 		   unwanted headers. */
@@ -462,6 +459,27 @@ imap_msgpart_crlf_seek(struct mail *mail, struct istream *input,
 	return crlf_input;
 }
 
+static bool imap_msgpart_has_no_nuls(struct mail *mail, struct istream *input)
+{
+	struct message_part *parts;
+	enum mail_lookup_abort orig_lookup_abort;
+
+	if (mail->has_no_nuls || mail->has_nuls)
+		return mail->has_no_nuls;
+	if (!input->readable_fd || i_stream_get_fd(input) == -1)
+		return FALSE;
+
+	/* The input could be sent with sendfile() directly from the file
+	   if it's known not to contain NULs. The NUL state gets updated when
+	   the message parts are found from cache, so try that before falling
+	   back to the slow NUL conversion. */
+	orig_lookup_abort = mail->lookup_abort;
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	(void)mail_get_parts(mail, &parts);
+	mail->lookup_abort = orig_lookup_abort;
+	return mail->has_no_nuls;
+}
+
 static void
 imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 			 bool convert_nuls, bool use_partial_cache,
@@ -502,7 +520,7 @@ imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 		result->size = bytes_left;
 	}
 
-	if (!mail->has_no_nuls && convert_nuls) {
+	if (convert_nuls && !imap_msgpart_has_no_nuls(mail, result->input)) {
 		/* IMAP literals must not contain NULs. change them to
 		   0x80 characters. */
 		input2 = i_stream_create_nonuls(result->input, '\x80');
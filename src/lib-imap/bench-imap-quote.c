@@ -0,0 +1,144 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "imap-quote.h"
+#include "imap-utf7.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* The inputs are similar to what ENVELOPE, header FETCHes and LIST commonly
+   write: mostly plain ASCII subjects and addresses, a few strings that need
+   escaping or literals, and hierarchical mailbox names where only some
+   contain non-ASCII characters. */
+
+/* Each string is processed this many times in a single run, so that a run
+   takes long enough to be timed reliably. */
+#define BENCH_LOOPS_PER_RUN 10000
+
+static const char *bench_strings[] = {
+	"Re: Quarterly meeting moved to next week",
+	"John Smith",
+	"john.smith",
+	"example.com",
+	"<1234567890.abcdef@mail.example.com>",
+	"Tue, 15 Sep 2026 10:11:12 +0300",
+	"\"Smith, John\" <john.smith@example.com>",
+	"Invoice attached for the services rendered during the last month",
+	"Fwd: \xc3\x84rger mit der Lieferung",
+	"a",
+};
+
+static const char *bench_mailbox_names[] = {
+	"INBOX",
+	"INBOX.Sent",
+	"Archive.2026.Projects.Customer reports",
+	"Lists.dovecot",
+	"Shared.Team folders.Engineering.Release notes",
+	"Archive.2026.R\xc3\xa9sum\xc3\xa9s",
+	"Trash",
+	"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",
+};
+
+static uoff_t bench_strings_size(const char *const *strings, unsigned int count)
+{
+	uoff_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		size += strlen(strings[i]);
+	return size * BENCH_LOOPS_PER_RUN;
+}
+
+static void bench_nstring(string_t *str)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_strings); j++) {
+			str_truncate(str, 0);
+			imap_append_nstring(str, bench_strings[j]);
+		}
+	}
+}
+
+static void bench_quoted(string_t *str)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_strings); j++) {
+			str_truncate(str, 0);
+			imap_append_quoted(str, bench_strings[j]);
+		}
+	}
+}
+
+static void bench_utf8_to_utf7(string_t *str)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_mailbox_names); j++) {
+			str_truncate(str, 0);
+			if (imap_utf8_to_utf7(bench_mailbox_names[j], str) < 0)
+				i_unreached();
+		}
+	}
+}
+
+static const char *bench_utf7_names[N_ELEMENTS(bench_mailbox_names)];
+
+static void bench_utf7_to_utf8(string_t *str)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_utf7_names); j++) {
+			str_truncate(str, 0);
+			if (imap_utf7_to_utf8(bench_utf7_names[j], str) < 0)
+				i_unreached();
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	string_t *str;
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 1)
+		i_fatal("Usage: %s", argv[0]);
+
+	str = str_new(default_pool, 1024);
+	test_bench_run("imap_append_nstring",
+		       bench_strings_size(bench_strings,
+					  N_ELEMENTS(bench_strings)),
+		       bench_nstring, str, NULL);
+	test_bench_run("imap_append_quoted",
+		       bench_strings_size(bench_strings,
+					  N_ELEMENTS(bench_strings)),
+		       bench_quoted, str, NULL);
+	test_bench_run("imap_utf8_to_utf7",
+		       bench_strings_size(bench_mailbox_names,
+					  N_ELEMENTS(bench_mailbox_names)),
+		       bench_utf8_to_utf7, str, NULL);
+
+	for (i = 0; i < N_ELEMENTS(bench_mailbox_names); i++) {
+		str_truncate(str, 0);
+		if (imap_utf8_to_utf7(bench_mailbox_names[i], str) < 0)
+			i_unreached();
+		bench_utf7_names[i] = t_strdup(str_c(str));
+	}
+	test_bench_run("imap_utf7_to_utf8",
+		       bench_strings_size(bench_utf7_names,
+					  N_ELEMENTS(bench_utf7_names)),
+		       bench_utf7_to_utf8, str, NULL);
+
+	str_free(&str);
+	lib_deinit();
+	return 0;
+}
@@ -3,7 +3,6 @@
 #include "lib.h"
 #include "istream.h"
 #include "ostream.h"
-#include "strescape.h"
 #include "imap-parser.h"
 
 /* We use this macro to read atoms from input. It should probably contain
@@ -235,11 +234,31 @@ imap_parser_strdup(struct imap_parser *parser,
 	return ret;
 }
 
+static char *
+imap_parser_strdup_unescape(struct imap_parser *parser,
+			    const unsigned char *data, size_t len,
+			    size_t first_escape, size_t *len_r)
+{
+	char *ret;
+	size_t i, dest_len;
+
+	/* copy and remove the escapes in a single pass */
+	ret = p_malloc(parser->pool, len + 1);
+	memcpy(ret, data, first_escape);
+	dest_len = first_escape;
+	for (i = first_escape; i < len; i++) {
+		if (data[i] == '\\' && i+1 < len)
+			i++;
+		ret[dest_len++] = data[i];
+	}
+	*len_r = dest_len;
+	return ret;
+}
+
 static void imap_parser_save_arg(struct imap_parser *parser,
 				 const unsigned char *data, size_t size)
 {
 	struct imap_arg *arg;
-	char *str;
 
 	arg = imap_arg_create(parser);
 
@@ -263,14 +282,16 @@ static void imap_parser_save_arg(struct imap_parser *parser,
 		i_assert(size > 0);
 
 		arg->type = IMAP_ARG_STRING;
-		str = p_strndup(parser->pool, data+1, size-1);
-
-		/* remove the escapes */
-		if (parser->str_first_escape >= 0 &&
-		    (parser->flags & IMAP_PARSE_FLAG_NO_UNESCAPE) == 0)
-			(void)str_unescape(str);
-		arg->_data.str = str;
-		arg->str_len = strlen(str);
+		if (parser->str_first_escape < 0 ||
+		    (parser->flags & IMAP_PARSE_FLAG_NO_UNESCAPE) != 0) {
+			arg->_data.str =
+				imap_parser_strdup(parser, data+1, size-1);
+			arg->str_len = size-1;
+		} else {
+			arg->_data.str = imap_parser_strdup_unescape(parser,
+				data+1, size-1, parser->str_first_escape-1,
+				&arg->str_len);
+		}
 		break;
 	case ARG_PARSE_LITERAL_DATA:
 		if ((parser->flags & IMAP_PARSE_FLAG_LITERAL_SIZE) != 0) {
@@ -397,6 +418,17 @@ static bool imap_parser_read_string(struct imap_parser *parser,
 	return parser->cur_type == ARG_PARSE_NONE;
 }
 
+static void imap_parser_send_continuation(struct imap_parser *parser)
+{
+	o_stream_nsend(parser->output, "+ OK\r\n", 6);
+	if (o_stream_is_corked(parser->output)) {
+		/* make sure this continuation is sent to the client as soon
+		   as possible */
+		o_stream_uncork(parser->output);
+		o_stream_cork(parser->output);
+	}
+}
+
 static bool imap_parser_literal_end(struct imap_parser *parser)
 {
 	if (parser->literal_minus && parser->literal_nonsync &&
@@ -416,15 +448,8 @@ static bool imap_parser_literal_end(struct imap_parser *parser)
 			return FALSE;
 		}
 
-		if (parser->output != NULL && !parser->literal_nonsync) {
-			o_stream_nsend(parser->output, "+ OK\r\n", 6);
-			if (o_stream_is_corked(parser->output)) {
-				/* make sure this continuation is sent to the
-				   client as soon as possible */
-				o_stream_uncork(parser->output);
-				o_stream_cork(parser->output);
-			}
-		}
+		if (parser->output != NULL && !parser->literal_nonsync)
+			imap_parser_send_continuation(parser);
 	}
 
 	parser->cur_type = ARG_PARSE_LITERAL_DATA;
@@ -906,6 +931,24 @@ void imap_parser_read_last_literal(struct imap_parser *parser)
 	parser->literal_size_return = FALSE;
 }
 
+struct istream *
+imap_parser_read_last_literal_stream(struct imap_parser *parser)
+{
+	ARRAY_TYPE(imap_arg_list) *list;
+	struct imap_arg *last_arg;
+
+	i_assert(parser->literal_size_return);
+	i_assert(parser->args_added_extra_eol);
+
+	last_arg = imap_parser_get_last_literal_size(parser, &list);
+	i_assert(last_arg != NULL);
+	i_assert(parser->literal_size == last_arg->_data.literal_size);
+
+	if (last_arg->type == IMAP_ARG_LITERAL_SIZE && parser->output != NULL)
+		imap_parser_send_continuation(parser);
+	return i_stream_create_limit(parser->input, parser->literal_size);
+}
+
 int imap_parser_finish_line(struct imap_parser *parser, unsigned int count,
 			    enum imap_parser_flags flags,
 			    const struct imap_arg **args_r)
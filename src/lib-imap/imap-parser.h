@@ -91,6 +91,15 @@ bool imap_parser_get_literal_size(struct imap_parser *parser, uoff_t *size_r);
    Calling this function causes the literal size to be replaced with the actual
    literal data when continuing argument parsing. */
 void imap_parser_read_last_literal(struct imap_parser *parser);
+/* IMAP_PARSE_FLAG_LITERAL_SIZE is set and last read argument was a literal.
+   Return a stream for reading the literal data directly from the parser's
+   input, without buffering the whole literal in memory. The literal can be
+   any argument, not just APPEND's message. "+ OK" is sent for synchronizing
+   literals. Once the stream has been read to EOF, argument parsing can be
+   continued with imap_parser_read_args(). The literal stays as
+   IMAP_ARG_LITERAL_SIZE* in the returned arguments. */
+struct istream *
+imap_parser_read_last_literal_stream(struct imap_parser *parser);
 
 /* just like imap_parser_read_args(), but assume \n at end of data in
    input stream. */
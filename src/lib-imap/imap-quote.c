@@ -15,6 +15,48 @@
    quoted-specials. */
 #define QUOTED_MAX_ESCAPE_CHARS 4
 
+static inline bool imap_quote_is_special(unsigned char c)
+{
+	return c == '"' || c == '\\' || c == '\r' || c == '\n' || c >= 0x80;
+}
+
+/* Returns the position of the first quoted-special, CR, LF or 8bit byte,
+   or size if there are none. Most strings don't have any, so check 8 bytes
+   at a time. The word check may give false positives, but never false
+   negatives. */
+static size_t imap_quote_find_special(const unsigned char *data, size_t size)
+{
+	const uint64_t ones = 0x0101010101010101ULL, highs = ones << 7;
+	uint64_t v, x, found;
+	size_t i = 0, end;
+
+	while (i + sizeof(v) <= size) {
+		memcpy(&v, data + i, sizeof(v));
+		found = v;
+		x = v ^ (ones * '"');
+		found |= (x - ones) & ~x;
+		x = v ^ (ones * '\\');
+		found |= (x - ones) & ~x;
+		x = v ^ (ones * '\r');
+		found |= (x - ones) & ~x;
+		x = v ^ (ones * '\n');
+		found |= (x - ones) & ~x;
+		if ((found & highs) == 0) {
+			i += sizeof(v);
+			continue;
+		}
+		for (end = i + sizeof(v); i < end; i++) {
+			if (imap_quote_is_special(data[i]))
+				return i;
+		}
+	}
+	for (; i < size; i++) {
+		if (imap_quote_is_special(data[i]))
+			return i;
+	}
+	return size;
+}
+
 void imap_append_string(string_t *dest, const char *src)
 {
 	i_assert(src != NULL);
@@ -42,18 +84,16 @@ void imap_append_astring(string_t *dest, const char *src)
 }
 
 static void
-imap_append_literal(string_t *dest, const char *src, unsigned int pos)
+imap_append_literal(string_t *dest, const char *src, size_t len)
 {
-	size_t full_len = pos + strlen(src+pos);
-
-	str_printfa(dest, "{%zu}\r\n", full_len);
-	buffer_append(dest, src, full_len);
+	str_printfa(dest, "{%zu}\r\n", len);
+	buffer_append(dest, src, len);
 }
 
 void imap_append_nstring(string_t *dest, const char *src)
 {
 	unsigned int escape_count = 0;
-	size_t i;
+	size_t i, len;
 
 	if (src == NULL) {
 		str_append(dest, "NIL");
@@ -68,24 +108,18 @@ void imap_append_nstring(string_t *dest, const char *src)
 	                     "\" quoted-specials
 	   TEXT-CHAR       = <any CHAR except CR and LF>
 	*/
-	for (i = 0; src[i] != '\0'; i++) {
-		switch (src[i]) {
-		case '"':
-		case '\\':
-			if (escape_count++ < QUOTED_MAX_ESCAPE_CHARS)
-				break;
-			/* fall through */
-		case 13:
-		case 10:
-			imap_append_literal(dest, src, i);
-			return;
-		default:
-			if ((unsigned char)src[i] >= 0x80) {
-				imap_append_literal(dest, src, i);
-				return;
-			}
+	len = strlen(src);
+	for (i = 0;; i++) {
+		i += imap_quote_find_special((const unsigned char *)src + i,
+					     len - i);
+		if (i == len)
 			break;
-		}
+		if ((src[i] == '"' || src[i] == '\\') &&
+		    escape_count++ < QUOTED_MAX_ESCAPE_CHARS)
+			continue;
+		/* CR, LF, 8bit or too many quoted-specials */
+		imap_append_literal(dest, src, len);
+		return;
 	}
 	imap_append_quoted(dest, src);
 }
@@ -124,27 +158,28 @@ void imap_append_nstring_nolf(string_t *dest, const char *src)
 
 void imap_append_quoted(string_t *dest, const char *src)
 {
+	size_t pos, len = strlen(src);
+
 	str_append_c(dest, '"');
-	for (; *src != '\0'; src++) {
-		switch (*src) {
-		case 13:
-		case 10:
-			/* not allowed */
+	for (;;) {
+		pos = imap_quote_find_special((const unsigned char *)src, len);
+		str_append_data(dest, src, pos);
+		if (pos == len)
 			break;
+
+		switch (src[pos]) {
 		case '"':
 		case '\\':
 			str_append_c(dest, '\\');
-			str_append_c(dest, *src);
+			str_append_c(dest, src[pos]);
 			break;
 		default:
-			if ((unsigned char)*src >= 0x80) {
-				/* 8bit input not allowed in dquotes */
-				break;
-			}
-
-			str_append_c(dest, *src);
+			/* CR and LF aren't allowed, and neither is 8bit input
+			   in dquotes */
 			break;
 		}
+		src += pos + 1;
+		len -= pos + 1;
 	}
 	str_append_c(dest, '"');
 }
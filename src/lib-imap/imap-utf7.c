@@ -55,16 +55,58 @@ mbase64_encode(string_t *dest, const unsigned char *in, size_t len)
 	str_append_c(dest, '-');
 }
 
+static inline bool imap_utf7_is_special(unsigned char c, char escape_char)
+{
+	return c == '&' || c < 0x20 || c >= 0x7f ||
+		(c == (unsigned char)escape_char && c != '\0');
+}
+
+/* Returns the position of the first '&', escape_char, control or non-ASCII
+   character, or size if there are none. Mailbox names are usually plain
+   ASCII, so check 8 bytes at a time. The word check may give false
+   positives, but never false negatives. */
+static size_t
+imap_utf7_find_special(const char *str, size_t size, char escape_char)
+{
+	const uint64_t ones = 0x0101010101010101ULL, highs = ones << 7;
+	const unsigned char *data = (const unsigned char *)str;
+	uint64_t v, x, found;
+	size_t i = 0, end;
+
+	while (i + sizeof(v) <= size) {
+		memcpy(&v, data + i, sizeof(v));
+		/* bytes >= 0x7f and < 0x20 */
+		found = v | (v + ones);
+		found |= (v - ones * 0x20) & ~v;
+		x = v ^ (ones * '&');
+		found |= (x - ones) & ~x;
+		if (escape_char != '\0') {
+			x = v ^ (ones * (unsigned char)escape_char);
+			found |= (x - ones) & ~x;
+		}
+		if ((found & highs) == 0) {
+			i += sizeof(v);
+			continue;
+		}
+		for (end = i + sizeof(v); i < end; i++) {
+			if (imap_utf7_is_special(data[i], escape_char))
+				return i;
+		}
+	}
+	for (; i < size; i++) {
+		if (imap_utf7_is_special(data[i], escape_char))
+			return i;
+	}
+	return size;
+}
+
 static const char *
 imap_utf8_first_encode_char(const char *str, char escape_char)
 {
-	const char *p;
+	size_t len = strlen(str);
+	size_t pos = imap_utf7_find_special(str, len, escape_char);
 
-	for (p = str; *p != '\0'; p++) {
-		if (*p == '&' || *p < 0x20 || *p >= 0x7f || *p == escape_char)
-			return p;
-	}
-	return NULL;
+	return pos == len ? NULL : str + pos;
 }
 
 int imap_escaped_utf8_hex_to_char(const char *str, unsigned char *chr_r)
@@ -92,7 +134,7 @@ int imap_escaped_utf8_hex_to_char(const char *str, unsigned char *chr_r)
 static int
 imap_utf8_to_utf7_int(const char *src, char escape_char, string_t *dest)
 {
-	const char *p;
+	const char *p, *end;
 	unichar_t chr;
 	uint8_t *utf16, *u;
 	uint16_t u16;
@@ -107,7 +149,8 @@ imap_utf8_to_utf7_int(const char *src, char escape_char, string_t *dest)
 
 	/* at least one encoded character */
 	str_append_data(dest, src, p-src);
-	utf16 = t_malloc0(MALLOC_MULTIPLY(strlen(p), 2));
+	end = p + strlen(p);
+	utf16 = t_malloc0(MALLOC_MULTIPLY(end - p, 2));
 	while (*p != '\0') {
 		if (*p == escape_char &&
 		    imap_escaped_utf8_hex_to_char(p+1, &c) == 0) {
@@ -121,8 +164,11 @@ imap_utf8_to_utf7_int(const char *src, char escape_char, string_t *dest)
 			continue;
 		}
 		if (*p >= 0x20 && *p < 0x7f) {
-			str_append_c(dest, *p);
-			p++;
+			/* append this and the following plain ASCII as-is */
+			size_t len = 1 + imap_utf7_find_special(p + 1,
+						end - (p + 1), escape_char);
+			str_append_data(dest, p, len);
+			p += len;
 			continue;
 		}
 
@@ -301,14 +347,17 @@ imap_utf7_to_utf8_int(const char *src, const char *escape_chars, string_t *dest)
 {
 	const char *p;
 
-	for (p = src; *p != '\0'; p++) {
-		if (*p < 0x20 || *p >= 0x7f) {
-			if (escape_chars[0] == '\0')
-				return -1;
-			break;
+	if (escape_chars[0] == '\0') {
+		p = src + imap_utf7_find_special(src, strlen(src), '\0');
+		if (*p != '\0' && *p != '&')
+			return -1;
+	} else {
+		for (p = src; *p != '\0'; p++) {
+			if (*p < 0x20 || *p >= 0x7f)
+				break;
+			if (*p == '&' || strchr(escape_chars, *p) != NULL)
+				break;
 		}
-		if (*p == '&' || strchr(escape_chars, *p) != NULL)
-			break;
 	}
 	if (*p == '\0') {
 		/* no IMAP-UTF-7 encoded characters */
@@ -361,9 +410,14 @@ void imap_utf7_to_utf8_escaped(const char *src, const char *escape_chars,
 bool imap_utf7_is_valid(const char *src)
 {
 	const char *p;
+	size_t len = strlen(src), pos;
 	int ret;
 
 	for (p = src; *p != '\0'; p++) {
+		pos = imap_utf7_find_special(p, len - (p - src), '\0');
+		p += pos;
+		if (*p == '\0')
+			break;
 		if (*p < 0x20 || *p >= 0x7f)
 			return FALSE;
 		if (*p == '&') {
@@ -4,6 +4,7 @@
 #include "istream.h"
 #include "str.h"
 #include "message-part-data.h"
+#include "message-part-data-serialize.h"
 #include "message-part-serialize.h"
 #include "message-parser.h"
 #include "imap-bodystructure.h"
@@ -452,6 +453,44 @@ static void test_imap_bodystructure_write(void)
 	} T_END;
 }
 
+static void test_imap_bodystructure_write_serialized(void)
+{
+	struct message_part *parts, *parts2;
+	const char *error;
+	unsigned int i;
+
+	for (i = 0; i < parse_tests_count; i++) T_BEGIN {
+		struct parse_test *test = &parse_tests[i];
+		string_t *str = t_str_new(128);
+		buffer_t *parts_buf = t_buffer_create(128);
+		buffer_t *data_buf = t_buffer_create(128);
+		pool_t pool = pool_alloconly_create("imap bodystructure write", 1024);
+
+		test_begin(t_strdup_printf("imap bodystructure write serialized [%u]", i));
+		parts = msg_parse(pool, test->message, 0, 0, TRUE);
+		message_part_serialize(parts, parts_buf);
+		test_assert(message_part_data_serialize(parts, data_buf, &error) == 0);
+
+		parts2 = message_part_deserialize(pool, parts_buf->data,
+						  parts_buf->used, &error);
+		test_assert(parts2 != NULL);
+		test_assert(message_part_data_deserialize(pool, parts2,
+			data_buf->data, data_buf->used, &error) == 0);
+
+		test_assert(imap_bodystructure_write(parts2, str, TRUE, &error) == 0);
+		test_assert_strcmp(str_c(str), test->bodystructure);
+		str_truncate(str, 0);
+		test_assert(imap_bodystructure_write(parts2, str, FALSE, &error) == 0);
+		test_assert_strcmp(str_c(str), test->body);
+
+		/* truncated data must be detected */
+		test_assert(message_part_data_deserialize(pool, parts2,
+			data_buf->data, data_buf->used - 1, &error) < 0);
+		pool_unref(&pool);
+		test_end();
+	} T_END;
+}
+
 static void test_imap_bodystructure_parse(void)
 {
 	struct message_part *parts;
@@ -722,6 +761,7 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_imap_bodystructure_write,
+		test_imap_bodystructure_write_serialized,
 		test_imap_bodystructure_parse,
 		test_imap_bodystructure_parse_invalid,
 		test_imap_bodystructure_normalize,
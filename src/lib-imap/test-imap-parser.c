@@ -79,6 +79,95 @@ static void test_imap_parser_partial_list(void)
 	test_end();
 }
 
+static void test_imap_parser_unescape(void)
+{
+	static const char *test_input =
+		"\"foo\" \"f\\\"o\\\\o\" \"\\\"\" \"\"\r\n";
+	struct istream *input;
+	struct imap_parser *parser;
+	const struct imap_arg *args;
+
+	test_begin("imap parser unescape");
+	input = test_istream_create(test_input);
+	parser = imap_parser_create(input, NULL, 1024);
+
+	(void)i_stream_read(input);
+	test_assert(imap_parser_read_args(parser, 0, 0, &args) == 4);
+	test_assert(args[0].type == IMAP_ARG_STRING &&
+		    strcmp(args[0]._data.str, "foo") == 0 &&
+		    args[0].str_len == 3);
+	test_assert(strcmp(args[1]._data.str, "f\"o\\o") == 0 &&
+		    args[1].str_len == 5);
+	test_assert(strcmp(args[2]._data.str, "\"") == 0 &&
+		    args[2].str_len == 1);
+	test_assert(strcmp(args[3]._data.str, "") == 0 &&
+		    args[3].str_len == 0);
+
+	imap_parser_reset(parser);
+	i_stream_seek(input, 0);
+	(void)i_stream_read(input);
+	test_assert(imap_parser_read_args(parser, 0,
+		IMAP_PARSE_FLAG_NO_UNESCAPE, &args) == 4);
+	test_assert(strcmp(args[1]._data.str, "f\\\"o\\\\o") == 0 &&
+		    args[1].str_len == 7);
+
+	imap_parser_unref(&parser);
+	i_stream_destroy(&input);
+	test_end();
+}
+
+static void test_imap_parser_literal_stream(void)
+{
+	static const char *test_input =
+		"foo ({5}\r\nhello {3+}\r\nbar) baz\r\n";
+	struct istream *input, *literal;
+	struct imap_parser *parser;
+	const struct imap_arg *args, *list;
+	const unsigned char *data;
+	size_t size;
+
+	test_begin("imap parser literal stream");
+	input = test_istream_create(test_input);
+	parser = imap_parser_create(input, NULL, 1024);
+
+	(void)i_stream_read(input);
+	test_assert(imap_parser_read_args(parser, 0,
+		IMAP_PARSE_FLAG_LITERAL_SIZE, &args) == 2);
+	list = imap_arg_as_list(&args[1]);
+	test_assert(list[0].type == IMAP_ARG_LITERAL_SIZE);
+
+	literal = imap_parser_read_last_literal_stream(parser);
+	test_assert(i_stream_read_more(literal, &data, &size) > 0 &&
+		    size == 5 && memcmp(data, "hello", 5) == 0);
+	i_stream_skip(literal, size);
+	test_assert(i_stream_read(literal) == -1 && literal->eof);
+	i_stream_unref(&literal);
+
+	test_assert(imap_parser_read_args(parser, 0,
+		IMAP_PARSE_FLAG_LITERAL_SIZE, &args) == 2);
+	list = imap_arg_as_list(&args[1]);
+	test_assert(list[1].type == IMAP_ARG_LITERAL_SIZE_NONSYNC);
+
+	literal = imap_parser_read_last_literal_stream(parser);
+	test_assert(i_stream_read_more(literal, &data, &size) > 0 &&
+		    size == 3 && memcmp(data, "bar", 3) == 0);
+	i_stream_skip(literal, size);
+	i_stream_unref(&literal);
+
+	test_assert(imap_parser_read_args(parser, 0,
+		IMAP_PARSE_FLAG_LITERAL_SIZE, &args) == 3);
+	test_assert(imap_arg_atom_equals(&args[0], "foo"));
+	list = imap_arg_as_list(&args[1]);
+	test_assert(list[0].type == IMAP_ARG_LITERAL_SIZE &&
+		    list[1].type == IMAP_ARG_LITERAL_SIZE_NONSYNC &&
+		    IMAP_ARG_IS_EOL(&list[2]));
+	test_assert(imap_arg_atom_equals(&args[2], "baz"));
+
+	imap_parser_unref(&parser);
+	i_stream_destroy(&input);
+	test_end();
+}
+
 static void test_imap_parser_read_tag_cmd(void)
 {
 	enum read_type {
@@ -150,6 +239,8 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_imap_parser_crlf,
 		test_imap_parser_partial_list,
+		test_imap_parser_unescape,
+		test_imap_parser_literal_stream,
 		test_imap_parser_read_tag_cmd,
 		NULL
 	};
@@ -112,6 +112,55 @@ static void test_imap_append_nstring(void)
 	test_end();
 }
 
+static void test_imap_append_nstring_positions(void)
+{
+	static const char specials[] = { '"', '\\', '\r', '\n', '\x80', '\xff' };
+	const char *base = "abcdefghijklmnopqrst";
+	string_t *str = t_str_new(128), *expected = t_str_new(128);
+	char input[21];
+	unsigned int i, j;
+
+	test_begin("imap_append_nstring() special positions");
+	for (i = 0; i < N_ELEMENTS(specials); i++) {
+		for (j = 0; j < strlen(base); j++) {
+			memcpy(input, base, strlen(base) + 1);
+			input[j] = specials[i];
+
+			str_truncate(expected, 0);
+			if (i < 2) {
+				str_append_c(expected, '"');
+				str_append_data(expected, input, j);
+				str_append_c(expected, '\\');
+				str_append(expected, input + j);
+				str_append_c(expected, '"');
+			} else {
+				str_printfa(expected, "{%zu}\r\n%s",
+					    strlen(input), input);
+			}
+			str_truncate(str, 0);
+			imap_append_nstring(str, input);
+			test_assert_idx(strcmp(str_c(str), str_c(expected)) == 0,
+					i * 100 + j);
+
+			/* quoted string drops the characters that aren't
+			   allowed in it */
+			if (i >= 2) {
+				str_truncate(expected, 0);
+				str_append_c(expected, '"');
+				str_append_data(expected, input, j);
+				str_append(expected, input + j + 1);
+				str_append_c(expected, '"');
+				str_truncate(str, 0);
+				imap_append_quoted(str, input);
+				test_assert_idx(strcmp(str_c(str),
+						       str_c(expected)) == 0,
+						i * 100 + j);
+			}
+		}
+	}
+	test_end();
+}
+
 static void test_imap_append_nstring_nolf(void)
 {
 	static const struct {
@@ -164,6 +213,7 @@ int main(void)
 		test_imap_append_string_for_humans,
 		test_imap_append_astring,
 		test_imap_append_nstring,
+		test_imap_append_nstring_positions,
 		test_imap_append_nstring_nolf,
 		NULL
 	};
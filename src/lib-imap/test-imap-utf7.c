@@ -202,6 +202,45 @@ static void test_imap_utf7_unnecessary(void)
 	test_end();
 }
 
+static void test_imap_utf7_positions(void)
+{
+	const char *base = "INBOX.abcdefghijklmnop";
+	string_t *utf8 = t_str_new(64), *utf7 = t_str_new(64);
+	string_t *dest = t_str_new(64);
+	unsigned int i, len = strlen(base);
+
+	test_begin("imap mutf7 special positions");
+	for (i = 0; i <= len; i++) {
+		/* non-ASCII character */
+		str_truncate(utf8, 0);
+		str_append_data(utf8, base, i);
+		str_append(utf8, "\xc3\xa4");
+		str_append(utf8, base + i);
+		str_truncate(utf7, 0);
+		str_append_data(utf7, base, i);
+		str_append(utf7, "&AOQ-");
+		str_append(utf7, base + i);
+
+		str_truncate(dest, 0);
+		test_assert_idx(imap_utf8_to_utf7(str_c(utf8), dest) == 0, i);
+		test_assert_idx(strcmp(str_c(dest), str_c(utf7)) == 0, i);
+		str_truncate(dest, 0);
+		test_assert_idx(imap_utf7_to_utf8(str_c(utf7), dest) == 0, i);
+		test_assert_idx(strcmp(str_c(dest), str_c(utf8)) == 0, i);
+		test_assert_idx(imap_utf7_is_valid(str_c(utf7)), i);
+
+		/* control character isn't valid in mUTF-7 */
+		str_truncate(utf7, 0);
+		str_append_data(utf7, base, i);
+		str_append_c(utf7, '\x7f');
+		str_append(utf7, base + i);
+		str_truncate(dest, 0);
+		test_assert_idx(imap_utf7_to_utf8(str_c(utf7), dest) < 0, i);
+		test_assert_idx(!imap_utf7_is_valid(str_c(utf7)), i);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -210,6 +249,7 @@ int main(void)
 		test_imap_utf7_non_utf16,
 		test_imap_utf7_bad_ascii,
 		test_imap_utf7_unnecessary,
+		test_imap_utf7_positions,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,233 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-cache.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+/* The index has the given number of messages, each with a small cached
+   string field. The benchmarked operations are the most commonly used ones:
+   appending messages via the transaction log, syncing flag changes,
+   reopening the index and looking up cache fields. */
+
+#define BENCH_DIR_NAME ".dovecot.bench"
+#define BENCH_INDEX_PREFIX "bench.dovecot.index"
+#define BENCH_APPENDS_PER_TRANSACTION 100
+
+static const struct mail_cache_field bench_cache_field = {
+	.name = "bench",
+	.type = MAIL_CACHE_FIELD_STRING,
+	.decision = MAIL_CACHE_DECISION_YES,
+};
+
+struct bench_index {
+	struct mail_index *index;
+	struct mail_index_view *view;
+	unsigned int cache_field_idx;
+
+	unsigned int message_count;
+	/* Number of bench_sync() runs done so far */
+	unsigned int sync_runs;
+	buffer_t *lookup_buf;
+};
+
+static void bench_index_open(struct bench_index *bi)
+{
+	struct mail_cache_field field = bench_cache_field;
+
+	bi->index = mail_index_alloc(NULL, BENCH_DIR_NAME, BENCH_INDEX_PREFIX);
+	if (mail_index_open_or_create(bi->index,
+				      MAIL_INDEX_OPEN_FLAG_CREATE) < 0)
+		i_fatal("mail_index_open_or_create() failed");
+	mail_cache_register_fields(bi->index->cache, &field, 1);
+	bi->cache_field_idx = field.idx;
+	bi->view = mail_index_view_open(bi->index);
+}
+
+static void bench_index_close(struct bench_index *bi)
+{
+	mail_index_view_close(&bi->view);
+	mail_index_close(bi->index);
+	mail_index_free(&bi->index);
+}
+
+static void bench_index_sync(struct bench_index *bi)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+
+	if (mail_index_sync_begin(bi->index, &sync_ctx, &view, &trans, 0) < 0)
+		i_fatal("mail_index_sync_begin() failed");
+	if (mail_index_sync_commit(&sync_ctx) < 0)
+		i_fatal("mail_index_sync_commit() failed");
+	(void)mail_index_refresh(bi->index);
+	mail_index_view_close(&bi->view);
+	bi->view = mail_index_view_open(bi->index);
+}
+
+static void
+bench_append_transaction(struct bench_index *bi, uint32_t first_uid,
+			 unsigned int count)
+{
+	struct mail_index_transaction *trans;
+	struct mail_index_view *updated_view;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	string_t *value = t_str_new(64);
+	uint32_t seq, uid_validity = 12345;
+
+	trans = mail_index_transaction_begin(bi->view, 0);
+	updated_view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(bi->index->cache, updated_view);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+
+	if (mail_index_get_header(bi->view)->uid_validity == 0) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uint32_t uid = first_uid; uid < first_uid + count; uid++) {
+		mail_index_append(trans, uid, &seq);
+		str_truncate(value, 0);
+		str_printfa(value, "<%u.bench@example.com>", uid);
+		mail_cache_add(cache_trans, seq, bi->cache_field_idx,
+			       str_data(value), str_len(value));
+	}
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&updated_view);
+}
+
+static void bench_index_create(struct bench_index *bi)
+{
+	const char *error;
+
+	(void)unlink_directory(BENCH_DIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+	if (mkdir(BENCH_DIR_NAME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR_NAME);
+	bench_index_open(bi);
+}
+
+static void bench_append(struct bench_index *bi)
+{
+	unsigned int count;
+
+	for (uint32_t uid = 1; uid <= bi->message_count; uid += count) {
+		count = I_MIN(BENCH_APPENDS_PER_TRANSACTION,
+			      bi->message_count - uid + 1);
+		T_BEGIN {
+			bench_append_transaction(bi, uid, count);
+		} T_END;
+		bench_index_sync(bi);
+	}
+}
+
+static void bench_append_run(struct bench_index *bi)
+{
+	bench_index_create(bi);
+	bench_append(bi);
+	bench_index_close(bi);
+}
+
+static void bench_sync(struct bench_index *bi)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t messages_count = mail_index_view_get_messages_count(bi->view);
+	unsigned int i = bi->sync_runs++;
+
+	if (mail_index_sync_begin(bi->index, &sync_ctx, &view, &trans, 0) < 0)
+		i_fatal("mail_index_sync_begin() failed");
+	/* flip \Seen for every other message */
+	for (uint32_t seq = 1 + i % 2; seq <= messages_count; seq += 2) {
+		mail_index_update_flags(trans, seq, i % 4 < 2 ?
+					MODIFY_ADD : MODIFY_REMOVE, MAIL_SEEN);
+	}
+	if (mail_index_sync_commit(&sync_ctx) < 0)
+		i_fatal("mail_index_sync_commit() failed");
+}
+
+static void bench_reopen(struct bench_index *bi)
+{
+	bench_index_close(bi);
+	bench_index_open(bi);
+}
+
+static void bench_cache_lookup(struct bench_index *bi)
+{
+	struct mail_cache_view *cache_view;
+	uint32_t messages_count = mail_index_view_get_messages_count(bi->view);
+
+	cache_view = mail_cache_view_open(bi->index->cache, bi->view);
+	for (uint32_t seq = 1; seq <= messages_count; seq++) {
+		buffer_set_used_size(bi->lookup_buf, 0);
+		if (mail_cache_lookup_field(cache_view, bi->lookup_buf, seq,
+					    bi->cache_field_idx) <= 0)
+			i_fatal("mail_cache_lookup_field(seq=%u) failed", seq);
+	}
+	mail_cache_view_close(&cache_view);
+}
+
+static void bench_memory(struct bench_index *bi)
+{
+	const struct mail_index_map *map = bi->index->map;
+	struct rusage usage;
+
+	printf("map records: %zu bytes (%u records of %u bytes)\n",
+	       (size_t)map->rec_map->records_count * map->hdr.record_size,
+	       map->rec_map->records_count, map->hdr.record_size);
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		printf("max RSS: %ld kB\n", usage.ru_maxrss);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct bench_index bi;
+	const char *error;
+
+	lib_init();
+
+	i_zero(&bi);
+	bi.message_count = 10000;
+	if (argc > 2 || (argc == 2 &&
+			 (str_to_uint(argv[1], &bi.message_count) < 0 ||
+			  bi.message_count == 0))) {
+		i_fatal("Usage: %s [<message count>] "
+			"(default 10000 messages)", argv[0]);
+	}
+	ioloop_time = time(NULL);
+	printf("Index has %u messages\n", bi.message_count);
+
+	bi.lookup_buf = buffer_create_dynamic(default_pool, 64);
+	test_bench_run("mail-index append+sync", 0,
+		       bench_append_run, &bi, NULL);
+
+	bench_index_create(&bi);
+	bench_append(&bi);
+	test_bench_run("mail-index sync flags", 0, bench_sync, &bi, NULL);
+	test_bench_run("mail-index reopen", 0, bench_reopen, &bi, NULL);
+	test_bench_run("mail-cache lookup field", 0,
+		       bench_cache_lookup, &bi, NULL);
+	bench_memory(&bi);
+	bench_index_close(&bi);
+	buffer_free(&bi.lookup_buf);
+
+	(void)unlink_directory(BENCH_DIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+	lib_deinit();
+	return 0;
+}
@@ -157,6 +157,7 @@ void mail_cache_decision_state_update(struct mail_cache_view *view,
 		i_assert(dec == MAIL_CACHE_DECISION_TEMP);
 		cache->fields[field].field.decision = MAIL_CACHE_DECISION_YES;
 		cache->fields[field].decision_dirty = TRUE;
+		cache->fields[field].decision_changed = TRUE;
 		cache->field_header_write_pending = TRUE;
 
 		const char *reason = uid < hdr->day_first_uid[7] ?
@@ -194,8 +195,10 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 	}
 
 	/* field used the first time */
-	if (priv->field.decision == MAIL_CACHE_DECISION_NO)
+	if (priv->field.decision == MAIL_CACHE_DECISION_NO) {
 		priv->field.decision = MAIL_CACHE_DECISION_TEMP;
+		priv->decision_changed = TRUE;
+	}
 	priv->field.last_used = ioloop_time;
 	priv->decision_dirty = TRUE;
 	cache->field_header_write_pending = TRUE;
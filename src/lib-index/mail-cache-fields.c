@@ -206,6 +206,35 @@ mail_cache_register_get_list(struct mail_cache *cache, pool_t pool,
 	return list;
 }
 
+struct mail_cache_field_usage *
+mail_cache_get_field_usage(struct mail_cache *cache, pool_t pool,
+			   unsigned int *count_r)
+{
+	struct mail_cache_field_usage *list;
+	unsigned int i, count = 0;
+
+	list = cache->fields_count == 0 ? NULL :
+		p_new(pool, struct mail_cache_field_usage, cache->fields_count);
+	for (i = 0; i < cache->fields_count; i++) {
+		struct mail_cache_field_private *priv = &cache->fields[i];
+
+		if (priv->lookup_hits == 0 && priv->lookup_misses == 0 &&
+		    !priv->decision_changed)
+			continue;
+		list[count].name = p_strdup(pool, priv->field.name);
+		list[count].decision = priv->field.decision;
+		list[count].lookup_hits = priv->lookup_hits;
+		list[count].lookup_misses = priv->lookup_misses;
+		list[count].decision_changed = priv->decision_changed;
+		count++;
+
+		priv->lookup_hits = priv->lookup_misses = 0;
+		priv->decision_changed = FALSE;
+	}
+	*count_r = count;
+	return list;
+}
+
 static int
 mail_cache_header_fields_get_offset(struct mail_cache *cache,
 				    uint32_t *offset_r,
@@ -6,6 +6,8 @@
 #include "str.h"
 #include "mail-cache-private.h"
 
+#include <fcntl.h>
+
 
 #define CACHE_PREFETCH IO_BLOCK_SIZE
 
@@ -359,6 +361,47 @@ static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 	return ret;
 }
 
+bool mail_cache_prefetch(struct mail_cache_view *view, uint32_t seq)
+{
+/* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	struct mail_cache *cache = view->cache;
+	uint32_t offset, end;
+	int ret;
+
+	if (!cache->opened)
+		(void)mail_cache_open_and_verify(cache);
+	if (MAIL_CACHE_IS_UNUSABLE(cache) || cache->fd == -1 ||
+	    mail_cache_lookup_offset(cache, view->view, seq, &offset) <= 0)
+		return FALSE;
+
+	/* we don't know the record size without reading it, so use the same
+	   guess as mail_cache_get_record() */
+	end = offset + sizeof(struct mail_cache_record) + CACHE_PREFETCH;
+	if (offset >= view->prefetch_offset && end <= view->prefetch_end) {
+		/* already requested - records of adjacent mails are usually
+		   close to each others */
+		return FALSE;
+	}
+	ret = posix_fadvise(cache->fd, offset, end - offset,
+			    POSIX_FADV_WILLNEED);
+	if (ret != 0) {
+		errno = ret;
+		mail_cache_set_syscall_error(cache, "posix_fadvise()");
+		return FALSE;
+	}
+	if (offset == view->prefetch_end)
+		view->prefetch_end = end;
+	else {
+		view->prefetch_offset = offset;
+		view->prefetch_end = end;
+	}
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
 int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 			    unsigned int field)
 {
@@ -425,6 +468,15 @@ mail_cache_lookup_bitmask(struct mail_cache_lookup_iterate_ctx *iter,
 	return ret < 0 ? -1 : (found ? 1 : 0);
 }
 
+/* mail_cache_lookup_field() results in this process */
+static uint64_t mail_cache_lookup_hits = 0, mail_cache_lookup_misses = 0;
+
+void mail_cache_get_lookup_counters(uint64_t *hits_r, uint64_t *misses_r)
+{
+	*hits_r = mail_cache_lookup_hits;
+	*misses_r = mail_cache_lookup_misses;
+}
+
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx)
 {
@@ -435,8 +487,13 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
-	if (ret <= 0)
+	if (ret <= 0) {
+		if (ret == 0) {
+			mail_cache_lookup_misses++;
+			view->cache->fields[field_idx].lookup_misses++;
+		}
 		return ret;
+	}
 
 	lookup_event = mail_cache_lookup_event(view, seq);
 
@@ -463,6 +520,10 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	e_debug(lookup_event, "Looked up field %s from mail cache",
 		view->cache->fields[field_idx].field.name);
 	event_unref(&lookup_event);
+	if (ret > 0) {
+		mail_cache_lookup_hits++;
+		view->cache->fields[field_idx].lookup_hits++;
+	}
 	return ret;
 }
 
@@ -113,12 +113,18 @@ struct mail_cache_field_private {
 	   that doesn't have a local cache. That will result in the caching
 	   decision to change from TEMP to YES. */
 	uint32_t uid_highwater;
+	/* Number of mail_cache_lookup_field() calls that found the field from
+	   cache (hits) or not (misses). Reset by mail_cache_get_field_usage(). */
+	uint32_t lookup_hits, lookup_misses;
 
 	/* Unused fields aren't written to cache file */
 	bool used:1;
 	/* field.decision is pending a write to cache file header. If the
 	   cache header is read from disk, don't overwrite it. */
 	bool decision_dirty:1;
+	/* field.decision was changed by access patterns or purging. Reset by
+	   mail_cache_get_field_usage(). */
+	bool decision_changed:1;
 };
 
 struct mail_cache {
@@ -195,6 +201,8 @@ struct mail_cache {
 	uint32_t need_purge_file_seq;
 	/* Human-readable reason for purging. Used for debugging and events. */
 	char *need_purge_reason;
+	/* Cache file size when purging was requested, 0 if unknown. */
+	uoff_t need_purge_file_size;
 
 	/* Cache has been opened (or it doesn't exist). */
 	bool opened:1;
@@ -264,6 +272,9 @@ struct mail_cache_view {
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
 
+	/* File range already given to mail_cache_prefetch() */
+	uint32_t prefetch_offset, prefetch_end;
+
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
 	bool no_decision_updates:1;
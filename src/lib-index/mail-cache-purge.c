@@ -188,6 +188,8 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 		break;
 	}
 	}
+	if (dec != priv->field.decision)
+		priv->decision_changed = TRUE;
 	priv->field.decision = dec;
 
 	/* drop all fields we don't want */
@@ -374,7 +376,7 @@ mail_cache_purge_write(struct mail_cache *cache,
 	ARRAY_TYPE(uint32_t) ext_offsets;
 	const uint32_t *offsets;
 	uoff_t prev_file_size, file_size;
-	unsigned int i, count, prev_deleted_records;
+	unsigned int i, count, records, prev_deleted_records;
 
 	if (cache->hdr == NULL) {
 		prev_file_seq = 0;
@@ -392,22 +394,33 @@ mail_cache_purge_write(struct mail_cache *cache,
 
 	if (mail_cache_copy(cache, trans, event, fd, reason,
 			    &file_seq, &file_size, &max_uid,
-			    &ext_first_seq, &ext_offsets) < 0)
+			    &ext_first_seq, &ext_offsets) < 0) {
+		event_unref(&event);
 		return -1;
+	}
 
 	if (fstat(fd, &st) < 0) {
 		mail_cache_set_syscall_error(cache, "fstat()");
 		array_free(&ext_offsets);
+		event_unref(&event);
 		return -1;
 	}
 	if (rename(temp_path, cache->filepath) < 0) {
 		mail_cache_set_syscall_error(cache, "rename()");
 		array_free(&ext_offsets);
+		event_unref(&event);
 		return -1;
 	}
 
+	offsets = array_get(&ext_offsets, &count);
+	records = 0;
+	for (i = 0; i < count; i++) {
+		if (offsets[i] != 0)
+			records++;
+	}
 	event_add_int(event, "file_size", file_size);
 	event_add_int(event, "max_uid", max_uid);
+	event_add_int(event, "records", records);
 	event_set_name(event, "mail_cache_purge_finished");
 	e_debug(event, "Purging finished, file_seq changed %u -> %u, "
 		"size=%"PRIuUOFF_T" -> %"PRIuUOFF_T", max_uid=%u",
@@ -417,7 +430,6 @@ mail_cache_purge_write(struct mail_cache *cache,
 	/* once we're sure that the purging was successful,
 	   update the offsets */
 	mail_index_ext_reset(trans, cache->ext_id, file_seq, TRUE);
-	offsets = array_get(&ext_offsets, &count);
 	for (i = 0; i < count; i++) {
 		if (offsets[i] != 0) {
 			mail_index_update_ext(trans, ext_first_seq + i,
@@ -656,6 +668,7 @@ void mail_cache_purge_later(struct mail_cache *cache, const char *reason)
 	i_assert(cache->hdr != NULL);
 
 	cache->need_purge_file_seq = cache->hdr->file_seq;
+	cache->need_purge_file_size = 0;
 	i_free(cache->need_purge_reason);
 	cache->need_purge_reason = i_strdup(reason);
 }
@@ -663,9 +676,18 @@ void mail_cache_purge_later(struct mail_cache *cache, const char *reason)
 void mail_cache_purge_later_reset(struct mail_cache *cache)
 {
 	cache->need_purge_file_seq = 0;
+	cache->need_purge_file_size = 0;
 	i_free(cache->need_purge_reason);
 }
 
+bool mail_cache_purge_is_large(struct mail_cache *cache)
+{
+	uoff_t max_size =
+		cache->index->optimization_set.cache.purge_max_inline_size;
+
+	return max_size != 0 && cache->need_purge_file_size > max_size;
+}
+
 void mail_cache_purge_drop_init(struct mail_cache *cache,
 				const struct mail_index_header *hdr,
 				struct mail_cache_purge_drop_ctx *ctx_r)
@@ -268,8 +268,10 @@ static void mail_cache_update_need_purge(struct mail_cache *cache)
 				mail_cache_set_syscall_error(cache, "fstat()");
 			return;
 		}
-		if ((uoff_t)st.st_size >= set->purge_min_size)
+		if ((uoff_t)st.st_size >= set->purge_min_size) {
 			mail_cache_purge_later(cache, want_purge_reason);
+			cache->need_purge_file_size = st.st_size;
+		}
 	}
 
 }
@@ -585,6 +587,7 @@ mail_cache_open_or_create_path(struct mail_index *index, const char *path)
 	cache->dotlock_settings.timeout =
 		I_MIN(MAIL_CACHE_LOCK_TIMEOUT, index->set.max_lock_timeout_secs);
 	cache->dotlock_settings.stale_timeout = MAIL_CACHE_LOCK_CHANGE_TIMEOUT;
+	cache->dotlock_settings.event = cache->event;
 
 	if (!MAIL_INDEX_IS_IN_MEMORY(index) &&
 	    (index->flags & MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) != 0)
@@ -64,6 +64,16 @@ struct mail_cache_field {
 	time_t last_used;
 };
 
+struct mail_cache_field_usage {
+	const char *name;
+	enum mail_cache_decision_type decision;
+	/* mail_cache_lookup_field() results */
+	uint32_t lookup_hits, lookup_misses;
+	/* The decision was changed because of the access pattern or because
+	   the field was dropped by purging. */
+	bool decision_changed;
+};
+
 struct mail_cache *mail_cache_open_or_create(struct mail_index *index);
 struct mail_cache *
 mail_cache_open_or_create_path(struct mail_index *index, const char *path);
@@ -85,6 +95,11 @@ mail_cache_register_get_field(struct mail_cache *cache, unsigned int field_idx);
 struct mail_cache_field *
 mail_cache_register_get_list(struct mail_cache *cache, pool_t pool,
 			     unsigned int *count_r);
+/* Returns a list of fields that were looked up or whose caching decision
+   was changed since the previous call. The usage counters are reset. */
+struct mail_cache_field_usage *
+mail_cache_get_field_usage(struct mail_cache *cache, pool_t pool,
+			   unsigned int *count_r);
 
 /* Returns TRUE if cache should be purged. */
 bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r);
@@ -92,6 +107,9 @@ bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r);
 void mail_cache_purge_later(struct mail_cache *cache, const char *reason);
 /* Don't try to purge the cache file later after all. */
 void mail_cache_purge_later_reset(struct mail_cache *cache);
+/* Returns TRUE if the cache file that needs purging is larger than
+   purge_max_inline_size. */
+bool mail_cache_purge_is_large(struct mail_cache *cache);
 /* Purge cache file. Offsets are updated to given transaction.
    The transaction log must already be exclusively locked.
 
@@ -166,11 +184,21 @@ mail_cache_field_get_decision(struct mail_cache *cache, unsigned int field_idx);
 void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 			     unsigned int field);
 
+/* Tell the kernel to start reading the message's newest cache record from
+   the cache file, so a following lookup doesn't have to wait for disk I/O.
+   Returns TRUE if read-ahead was started, FALSE if there was nothing to
+   prefetch. */
+bool mail_cache_prefetch(struct mail_cache_view *view, uint32_t seq);
+
 /* Set data_r and size_r to point to wanted field in cache file.
    Returns 1 if field was found, 0 if not, -1 if error. */
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx);
 
+/* Returns how many mail_cache_lookup_field() calls in this process have
+   found the field (hits) or not (misses). */
+void mail_cache_get_lookup_counters(uint64_t *hits_r, uint64_t *misses_r);
+
 /* Return specified cached headers. Returns 1 if all fields were found,
    0 if not, -1 if error. dest is updated only if all fields were found. */
 int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
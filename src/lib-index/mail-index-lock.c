@@ -37,6 +37,7 @@ int mail_index_lock_fd(struct mail_index *index, const char *path, int fd,
 
 	struct file_lock_settings lock_set = {
 		.lock_method = index->set.lock_method,
+		.event = index->event,
 	};
 	ret = file_wait_lock(fd, path, lock_type, &lock_set, timeout_secs,
 			     lock_r, &error);
@@ -27,6 +27,49 @@ static void mail_index_map_copy_hdr(struct mail_index_map *map,
 	map->hdr.unused_old_recent_messages_count = 0;
 }
 
+static int mail_index_mmap_file(struct mail_index_map *map, size_t file_size)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	int fd = map->index->fd;
+#ifdef MAP_ANONYMOUS
+	size_t page_size = mmap_get_page_size();
+	size_t file_map_size, append_size;
+	void *base;
+
+	/* The file is mapped privately, so its pages stay shared with the
+	   page cache (and other processes) until they're modified. Reserve
+	   anonymous memory right after the file's pages, so that new records
+	   can be appended without copying the whole map to memory. */
+	file_map_size = (file_size + page_size - 1) & ~(page_size - 1);
+	append_size = I_MAX(file_size / 16, MAIL_INDEX_MMAP_APPEND_MIN_SIZE);
+	append_size = (append_size + page_size - 1) & ~(page_size - 1);
+	if (file_map_size <= SSIZE_T_MAX - append_size) {
+		base = mmap(NULL, file_map_size + append_size,
+			    PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED) {
+			rec_map->mmap_base = mmap(base, file_size,
+						  PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_FIXED,
+						  fd, 0);
+			if (rec_map->mmap_base != MAP_FAILED) {
+				rec_map->mmap_alloc_size =
+					file_map_size + append_size;
+				return 0;
+			}
+			if (munmap(base, file_map_size + append_size) < 0)
+				i_error("munmap() failed: %m");
+		}
+	}
+#endif
+	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE, fd, 0);
+	if (rec_map->mmap_base == MAP_FAILED)
+		return -1;
+	rec_map->mmap_alloc_size = file_size;
+	return 0;
+}
+
 static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 {
 	struct mail_index *index = map->index;
@@ -44,9 +87,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		return -1;
 	}
 
-	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
-				  MAP_PRIVATE, index->fd, 0);
-	if (rec_map->mmap_base == MAP_FAILED) {
+	if (mail_index_mmap_file(map, file_size) < 0) {
 		rec_map->mmap_base = NULL;
 		if (ioloop_time != index->last_mmap_error_time) {
 			index->last_mmap_error_time = ioloop_time;
@@ -274,7 +274,7 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 		buffer_free(&rec_map->buffer);
 	} else if (rec_map->mmap_base != NULL) {
 		i_assert(rec_map->buffer == NULL);
-		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
+		if (munmap(rec_map->mmap_base, rec_map->mmap_alloc_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
@@ -488,12 +488,26 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 		mail_index_record_map_unlink(map);
 		map->rec_map = new_map;
 	} else {
-		if (munmap(new_map->mmap_base, new_map->mmap_size) < 0)
+		if (munmap(new_map->mmap_base, new_map->mmap_alloc_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		new_map->mmap_base = NULL;
 	}
 }
 
+void *mail_index_map_mmap_append_space(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	size_t append_offset;
+
+	i_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(map));
+
+	append_offset = map->hdr.header_size +
+		rec_map->records_count * map->hdr.record_size;
+	if (append_offset + map->hdr.record_size > rec_map->mmap_alloc_size)
+		return NULL;
+	return PTR_OFFSET(rec_map->mmap_base, append_offset);
+}
+
 bool mail_index_map_get_ext_idx(struct mail_index_map *map,
 				uint32_t ext_id, uint32_t *idx_r)
 {
@@ -593,3 +607,29 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 	}
 	i_assert(*last_seq_r >= *first_seq_r);
 }
+
+void mail_index_map_lookup_columns(struct mail_index_map *map,
+				   uint32_t seq1, uint32_t seq2,
+				   uint32_t *uids_r, uint8_t *flags_r)
+{
+	const struct mail_index_record *rec;
+	uint32_t i, count, record_size;
+
+	i_assert(seq1 > 0 && seq1 <= seq2);
+	i_assert(seq2 <= map->hdr.messages_count);
+	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
+
+	/* walk through the records only once, so the following scans can
+	   go through tightly packed arrays instead of striding over the
+	   whole records. */
+	rec = MAIL_INDEX_REC_AT_SEQ(map, seq1);
+	record_size = map->hdr.record_size;
+	count = seq2 - seq1 + 1;
+	for (i = 0; i < count; i++) {
+		if (uids_r != NULL)
+			uids_r[i] = rec->uid;
+		if (flags_r != NULL)
+			flags_r[i] = rec->flags;
+		rec = CONST_PTR_OFFSET(rec, record_size);
+	}
+}
@@ -7,6 +7,9 @@
 #include "mail-index-sync-private.h"
 #include "mail-index-modseq.h"
 
+/* Number of records summarized by each modseq summary block */
+#define MODSEQ_SUMMARY_BLOCK_SIZE 64
+
 ARRAY_DEFINE_TYPE(modseqs, uint64_t);
 
 enum modseq_metadata_idx {
@@ -27,6 +30,13 @@ struct metadata_modseqs {
 struct mail_index_map_modseq {
 	/* indexes use enum modseq_metadata_idx */
 	ARRAY(struct metadata_modseqs) metadata_modseqs;
+
+	/* Highest modseq of each MODSEQ_SUMMARY_BLOCK_SIZE records. Zero
+	   modseqs are counted as (uint64_t)-1, since they're looked up as
+	   the current highest modseq. The summary covers the records
+	   1..summary_records_count and is extended lazily. */
+	ARRAY_TYPE(modseqs) summary;
+	uint32_t summary_records_count;
 };
 
 struct mail_index_modseq_sync {
@@ -149,6 +159,71 @@ mail_index_map_modseq(struct mail_index_view *view)
 	return mmap;
 }
 
+static void
+modseq_summary_invalidate(struct mail_index_map_modseq *mmap, uint32_t seq)
+{
+	uint32_t block_start = seq - 1 - (seq - 1) % MODSEQ_SUMMARY_BLOCK_SIZE;
+
+	if (mmap->summary_records_count > block_start)
+		mmap->summary_records_count = block_start;
+}
+
+static void
+modseq_summary_update(struct mail_index_map_modseq *mmap, uint32_t seq,
+		      uint64_t modseq)
+{
+	uint64_t *highestp;
+
+	if (seq > mmap->summary_records_count)
+		return;
+	if (modseq == 0)
+		modseq = (uint64_t)-1;
+	highestp = array_idx_modifiable(&mmap->summary,
+					(seq - 1) / MODSEQ_SUMMARY_BLOCK_SIZE);
+	if (*highestp < modseq)
+		*highestp = modseq;
+}
+
+static void
+modseq_summary_extend(struct mail_index_map_modseq *mmap,
+		      struct mail_index_map *map,
+		      const struct mail_index_ext *ext)
+{
+	uint32_t seq, records_count = map->rec_map->records_count;
+	const struct mail_index_record *rec;
+	uint64_t modseq, *highestp = NULL;
+
+	if (mmap->summary_records_count > records_count) {
+		/* records were dropped from the map */
+		modseq_summary_invalidate(mmap, records_count + 1);
+	}
+	if (mmap->summary_records_count == records_count)
+		return;
+
+	if (!array_is_created(&mmap->summary)) {
+		i_array_init(&mmap->summary,
+			     records_count / MODSEQ_SUMMARY_BLOCK_SIZE + 16);
+	}
+	/* recalculate the last partial block and add the new ones */
+	seq = mmap->summary_records_count -
+		mmap->summary_records_count % MODSEQ_SUMMARY_BLOCK_SIZE + 1;
+	for (; seq <= records_count; seq++) {
+		if (highestp == NULL ||
+		    (seq - 1) % MODSEQ_SUMMARY_BLOCK_SIZE == 0) {
+			highestp = array_idx_get_space(&mmap->summary,
+				(seq - 1) / MODSEQ_SUMMARY_BLOCK_SIZE);
+			*highestp = 0;
+		}
+		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		modseq = *(const uint64_t *)CONST_PTR_OFFSET(rec, ext->record_offset);
+		if (modseq == 0)
+			modseq = (uint64_t)-1;
+		if (*highestp < modseq)
+			*highestp = modseq;
+	}
+	mmap->summary_records_count = records_count;
+}
+
 uint64_t mail_index_modseq_lookup(struct mail_index_view *view, uint32_t seq)
 {
 	struct mail_index_map_modseq *mmap = mail_index_map_modseq(view);
@@ -209,10 +284,71 @@ int mail_index_modseq_set(struct mail_index_view *view,
 		return 0;
 	else {
 		*modseqp = min_modseq;
+		modseq_summary_update(mmap, seq, min_modseq);
 		return 1;
 	}
 }
 
+bool mail_index_modseq_find_next(struct mail_index_view *view, uint32_t seq,
+				 uint64_t min_modseq, uint32_t *seq_r)
+{
+	struct mail_index_map_modseq *mmap = mail_index_map_modseq(view);
+	struct mail_index_map *map = view->map;
+	const struct mail_index_ext *ext;
+	const struct mail_index_record *rec;
+	const uint64_t *highest;
+	uint32_t ext_map_idx, block, block_end, messages_count;
+	uint64_t modseq;
+
+	messages_count = mail_index_view_get_messages_count(view);
+	if (seq > messages_count)
+		return FALSE;
+	*seq_r = seq;
+
+	if (mmap == NULL || map != view->index->map ||
+	    !mail_index_map_get_ext_idx(map, view->index->modseq_ext_id,
+					&ext_map_idx)) {
+		/* Modseqs aren't tracked yet, or the view's map is older and
+		   the latest modseqs need to be looked up from the head map.
+		   Any message may match. */
+		return TRUE;
+	}
+	ext = array_idx(&map->extensions, ext_map_idx);
+	modseq_summary_extend(mmap, map, ext);
+
+	highest = array_is_created(&mmap->summary) ?
+		array_front(&mmap->summary) : NULL;
+	while (seq <= map->hdr.messages_count) {
+		block = (seq - 1) / MODSEQ_SUMMARY_BLOCK_SIZE;
+		block_end = I_MIN((block + 1) * MODSEQ_SUMMARY_BLOCK_SIZE,
+				  map->hdr.messages_count);
+		if (highest[block] < min_modseq) {
+			/* nothing changed in this block */
+			seq = block_end + 1;
+			continue;
+		}
+		for (; seq <= block_end; seq++) {
+			rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+			modseq = *(const uint64_t *)
+				CONST_PTR_OFFSET(rec, ext->record_offset);
+			if (modseq == 0 || modseq >= min_modseq) {
+				*seq_r = seq;
+				return TRUE;
+			}
+		}
+	}
+	/* messages not yet in the map (e.g. uncommitted appends) */
+	*seq_r = seq;
+	return seq <= messages_count;
+}
+
+void mail_index_map_modseq_records_changed(struct mail_index_map *map,
+					   uint32_t seq)
+{
+	if (map->rec_map->modseq != NULL)
+		modseq_summary_invalidate(map->rec_map->modseq, seq);
+}
+
 static uint64_t
 modseq_idx_lookup(struct mail_index_map_modseq *mmap,
 		  unsigned int idx, uint32_t seq)
@@ -287,6 +423,7 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 			 uint64_t modseq, bool nonzeros,
 			 uint32_t seq1, uint32_t seq2)
 {
+	struct mail_index_map_modseq *mmap = ctx->view->map->rec_map->modseq;
 	const struct mail_index_ext *ext;
 	struct mail_index_record *rec;
 	uint32_t ext_map_idx;
@@ -301,8 +438,11 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 	for (; seq1 <= seq2; seq1++) {
 		rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq1);
 		modseqp = PTR_OFFSET(rec, ext->record_offset);
-		if (*modseqp == 0 || (nonzeros && *modseqp < modseq))
+		if (*modseqp == 0 || (nonzeros && *modseqp < modseq)) {
 			*modseqp = modseq;
+			if (mmap != NULL)
+				modseq_summary_update(mmap, seq1, modseq);
+		}
 	}
 }
 
@@ -551,6 +691,8 @@ void mail_index_modseq_expunge(struct mail_index_modseq_sync *ctx,
 {
 	struct metadata_modseqs *metadata;
 
+	/* the following records' sequences change */
+	mail_index_map_modseq_records_changed(ctx->view->map, seq1);
 	if (ctx->mmap == NULL)
 		return;
 
@@ -655,6 +797,11 @@ mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap)
 					   &src_metadata[i].modseqs);
 		}
 	}
+	if (array_is_created(&mmap->summary)) {
+		i_array_init(&new_mmap->summary, array_count(&mmap->summary));
+		array_append_array(&new_mmap->summary, &mmap->summary);
+		new_mmap->summary_records_count = mmap->summary_records_count;
+	}
 	return new_mmap;
 }
 
@@ -670,6 +817,7 @@ void mail_index_map_modseq_free(struct mail_index_map_modseq **_mmap)
 			array_free(&metadata->modseqs);
 	}
 	array_free(&mmap->metadata_modseqs);
+	array_free(&mmap->summary);
 	i_free(mmap);
 }
 
@@ -39,6 +39,12 @@ uint64_t mail_index_modseq_lookup_keywords(struct mail_index_view *view,
 					   uint32_t seq);
 int mail_index_modseq_set(struct mail_index_view *view,
 			  uint32_t seq, uint64_t min_modseq);
+/* Find the first message at or after seq whose modseq may be min_modseq or
+   higher. This uses a per-map summary of the highest modseqs, so messages
+   that haven't changed are skipped without looking them up one by one.
+   Returns FALSE if there are no such messages. */
+bool mail_index_modseq_find_next(struct mail_index_view *view, uint32_t seq,
+				 uint64_t min_modseq, uint32_t *seq_r);
 
 struct mail_index_modseq_sync *
 mail_index_modseq_sync_begin(struct mail_index_sync_map_ctx *sync_map_ctx);
@@ -61,6 +67,10 @@ void mail_index_modseq_reset_keywords(struct mail_index_modseq_sync *ctx,
 struct mail_index_map_modseq *
 mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap);
 void mail_index_map_modseq_free(struct mail_index_map_modseq **mmap);
+/* The modseq extension records were changed outside the modseq sync
+   functions starting from seq. */
+void mail_index_map_modseq_records_changed(struct mail_index_map *map,
+					   uint32_t seq);
 
 bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view,
 					   uint64_t modseq, uint32_t *log_seq_r,
@@ -15,6 +15,10 @@ struct mail_index_sync_map_ctx;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
+/* How much anonymous memory to reserve after the mmap()ed index file for
+   appending new records without copying the whole map to memory. The actual
+   reservation is 1/16 of the file size if that's larger. */
+#define MAIL_INDEX_MMAP_APPEND_MIN_SIZE (1024*64)
 /* How many times to retry opening index files if read/fstat returns ESTALE.
    This happens with NFS when the file has been deleted (ie. index file was
    rewritten by another computer than us). */
@@ -118,6 +122,9 @@ struct mail_index_record_map {
 
 	void *mmap_base;
 	size_t mmap_size, mmap_used_size;
+	/* Size of the whole mmap()ed area, including the anonymous memory
+	   reserved for appends after the file's pages. */
+	size_t mmap_alloc_size;
 
 	buffer_t *buffer;
 
@@ -363,6 +370,9 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
 /* If map points to mmap()ed index, copy it to the memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
+/* Returns a pointer where a new record can be appended to a mmap()ed map
+   without moving it to memory, or NULL if there's no space left. */
+void *mail_index_map_mmap_append_space(struct mail_index_map *map);
 
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
 
@@ -382,6 +392,11 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 				     uint32_t first_uid, uint32_t last_uid,
 				     uint32_t *first_seq_r,
 				     uint32_t *last_seq_r);
+/* Copy UIDs and flags of records seq1..seq2 into uids_r[] and flags_r[].
+   Either one of them may be NULL. */
+void mail_index_map_lookup_columns(struct mail_index_map *map,
+				   uint32_t seq1, uint32_t seq2,
+				   uint32_t *uids_r, uint8_t *flags_r);
 
 /* Returns 1 on success, 0 on non-critical errors we want to silently fix,
    -1 if map isn't usable. The caller is responsible for logging the errors
@@ -32,7 +32,21 @@ struct mail_index_strmap_view {
 
 	ARRAY_TYPE(mail_index_strmap_rec) recs;
 	ARRAY(uint32_t) recs_crc32;
-	struct hash2_table *hash;
+	/* Open-addressed hash table of recs indexes, with recs_crc32 as the
+	   hash. Each slot is STRMAP_HASH_SLOT_EMPTY, STRMAP_HASH_SLOT_DELETED
+	   or the recs index + 1. hash_size is a power of two, and collisions
+	   are resolved with triangular probing (which visits all slots).
+	   Only the newest record of each crc32 + str_idx pair is in the table,
+	   so a Message-ID referenced by many mails uses only a single slot. */
+	uint32_t *hash;
+	unsigned int hash_size, hash_used_slots;
+	/* Number of records added to the hash and not removed */
+	unsigned int hash_count;
+	/* recs index + 1 of the previous record with the same crc32 + str_idx
+	   as this record, or 0 if there is none. This chains together all the
+	   records of a string, so when the record in the hash table becomes
+	   expunged, it can be replaced with the next older one. */
+	ARRAY(uint32_t) recs_prev;
 
 	mail_index_strmap_key_cmp_t *key_compare;
 	mail_index_strmap_rec_cmp_t *rec_compare;
@@ -77,6 +91,17 @@ struct mail_index_strmap_hash_key {
 	uint32_t crc32;
 };
 
+struct mail_index_strmap_hash_iter {
+	unsigned int slot, step;
+	bool started;
+	/* the slot was replaced - return it again */
+	bool recheck;
+};
+
+#define STRMAP_HASH_SLOT_EMPTY 0
+#define STRMAP_HASH_SLOT_DELETED ((uint32_t)-1)
+#define STRMAP_HASH_MIN_SIZE 64
+
 /* number of bytes required to store one string idx */
 #define STRMAP_FILE_STRIDX_SIZE (sizeof(uint32_t)*2)
 
@@ -161,21 +186,176 @@ void mail_index_strmap_deinit(struct mail_index_strmap **_strmap)
 	i_free(strmap);
 }
 
-static unsigned int mail_index_strmap_hash_key(const void *_key)
+static void strmap_hash_clear(struct mail_index_strmap_view *view)
+{
+	array_clear(&view->recs_prev);
+	i_free(view->hash);
+	view->hash_size = 0;
+	view->hash_used_slots = 0;
+	view->hash_count = 0;
+}
+
+static void
+strmap_hash_insert_slot(uint32_t *hash, unsigned int hash_size,
+			uint32_t crc32, uint32_t value)
 {
-	const struct mail_index_strmap_hash_key *key = _key;
+	unsigned int slot, step = 0, mask = hash_size - 1;
 
-	return key->crc32;
+	for (slot = crc32 & mask; hash[slot] != STRMAP_HASH_SLOT_EMPTY;
+	     slot = (slot + ++step) & mask) ;
+	hash[slot] = value;
 }
 
-static bool
-mail_index_strmap_hash_cmp(const void *_key, const void *_value, void *context)
+static void strmap_hash_resize(struct mail_index_strmap_view *view)
+{
+	const uint32_t *recs_crc32 = array_front(&view->recs_crc32);
+	uint32_t *old_hash = view->hash;
+	unsigned int i, old_size = view->hash_size, used = 0;
+
+	/* size the table based on the live records, so deleted slots don't
+	   make it grow */
+	for (i = 0; i < old_size; i++) {
+		if (old_hash[i] != STRMAP_HASH_SLOT_EMPTY &&
+		    old_hash[i] != STRMAP_HASH_SLOT_DELETED)
+			used++;
+	}
+	view->hash_size = STRMAP_HASH_MIN_SIZE;
+	while (view->hash_size < (used + 1) * 2)
+		view->hash_size *= 2;
+	view->hash = i_new(uint32_t, view->hash_size);
+	view->hash_used_slots = used;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_hash[i] == STRMAP_HASH_SLOT_EMPTY ||
+		    old_hash[i] == STRMAP_HASH_SLOT_DELETED)
+			continue;
+		strmap_hash_insert_slot(view->hash, view->hash_size,
+					recs_crc32[old_hash[i] - 1],
+					old_hash[i]);
+	}
+	i_free(old_hash);
+}
+
+static struct mail_index_strmap_rec *
+strmap_hash_iterate(struct mail_index_strmap_view *view, uint32_t crc32,
+		    struct mail_index_strmap_hash_iter *iter)
+{
+	const uint32_t *recs_crc32;
+	unsigned int mask = view->hash_size - 1;
+	uint32_t value;
+
+	if (view->hash_size == 0)
+		return NULL;
+
+	recs_crc32 = array_front(&view->recs_crc32);
+	if (!iter->started) {
+		iter->slot = crc32 & mask;
+		iter->started = TRUE;
+	} else if (iter->recheck) {
+		iter->recheck = FALSE;
+	} else {
+		iter->slot = (iter->slot + ++iter->step) & mask;
+	}
+	for (;; iter->slot = (iter->slot + ++iter->step) & mask) {
+		value = view->hash[iter->slot];
+		if (value == STRMAP_HASH_SLOT_EMPTY)
+			return NULL;
+		if (value != STRMAP_HASH_SLOT_DELETED &&
+		    recs_crc32[value - 1] == crc32)
+			return array_idx_modifiable(&view->recs, value - 1);
+	}
+}
+
+static void
+strmap_hash_insert(struct mail_index_strmap_view *view, unsigned int rec_idx)
+{
+	const struct mail_index_strmap_rec *rec, *hash_rec;
+	struct mail_index_strmap_hash_iter iter;
+	uint32_t crc32 = array_idx_elem(&view->recs_crc32, rec_idx);
+
+	view->hash_count++;
+	if (crc32 == 0) {
+		/* unique string - it's never looked up */
+		return;
+	}
+
+	rec = array_idx(&view->recs, rec_idx);
+	i_zero(&iter);
+	while ((hash_rec = strmap_hash_iterate(view, crc32, &iter)) != NULL) {
+		if (hash_rec->str_idx == rec->str_idx) {
+			/* the string is already in the table - replace it with
+			   the newer record, which is less likely to become
+			   expunged. */
+			array_idx_set(&view->recs_prev, rec_idx,
+				      &view->hash[iter.slot]);
+			view->hash[iter.slot] = rec_idx + 1;
+			return;
+		}
+	}
+	array_idx_clear(&view->recs_prev, rec_idx);
+
+	/* keep the table at most half full */
+	if ((view->hash_used_slots + 1) * 2 > view->hash_size)
+		strmap_hash_resize(view);
+	strmap_hash_insert_slot(view->hash, view->hash_size, crc32,
+				rec_idx + 1);
+	view->hash_used_slots++;
+}
+
+static void
+strmap_hash_replace_iter(struct mail_index_strmap_view *view,
+			 struct mail_index_strmap_hash_iter *iter)
+{
+	const struct mail_index_strmap_rec *recs;
+	const uint32_t *recs_prev;
+	unsigned int i, rec_idx;
+
+	i_assert(iter->started);
+
+	/* replace the record with an older record of another mail having
+	   the same string, if there is one */
+	rec_idx = view->hash[iter->slot] - 1;
+	recs = array_front(&view->recs);
+	recs_prev = array_front(&view->recs_prev);
+	i = recs_prev[rec_idx];
+	while (i > 0 && recs[i-1].uid == recs[rec_idx].uid)
+		i = recs_prev[i-1];
+	if (i > 0) {
+		view->hash[iter->slot] = i;
+		iter->recheck = TRUE;
+	} else {
+		view->hash[iter->slot] = STRMAP_HASH_SLOT_DELETED;
+	}
+}
+
+static void
+strmap_hash_remove_iter(struct mail_index_strmap_view *view,
+			struct mail_index_strmap_hash_iter *iter)
 {
-	const struct mail_index_strmap_hash_key *key = _key;
-	const struct mail_index_strmap_rec *rec = _value;
-	struct mail_index_strmap_view *view = context;
+	strmap_hash_replace_iter(view, iter);
+	view->hash_count--;
+}
 
-	return view->key_compare(key->str, rec, view->cb_context);
+static struct mail_index_strmap_rec *
+strmap_hash_lookup(struct mail_index_strmap_view *view,
+		   const struct mail_index_strmap_hash_key *key)
+{
+	struct mail_index_strmap_hash_iter iter;
+	struct mail_index_strmap_rec *rec;
+	uint32_t seq;
+
+	i_zero(&iter);
+	while ((rec = strmap_hash_iterate(view, key->crc32, &iter)) != NULL) {
+		if (view->key_compare(key->str, rec, view->cb_context))
+			return rec;
+		if (!mail_index_lookup_seq(view->view, rec->uid, &seq)) {
+			/* the mail is no longer in our view, so its string
+			   couldn't be compared. try an older mail with the
+			   same string instead. */
+			strmap_hash_replace_iter(view, &iter);
+		}
+	}
+	return NULL;
 }
 
 struct mail_index_strmap_view *
@@ -185,8 +365,7 @@ mail_index_strmap_view_open(struct mail_index_strmap *strmap,
 			    mail_index_strmap_rec_cmp_t *rec_compare_cb,
 			    mail_index_strmap_remap_t *remap_cb,
 			    void *context,
-			    const ARRAY_TYPE(mail_index_strmap_rec) **recs_r,
-			    const struct hash2_table **hash_r)
+			    const ARRAY_TYPE(mail_index_strmap_rec) **recs_r)
 {
 	struct mail_index_strmap_view *view;
 
@@ -201,11 +380,8 @@ mail_index_strmap_view_open(struct mail_index_strmap *strmap,
 
 	i_array_init(&view->recs, 64);
 	i_array_init(&view->recs_crc32, 64);
-	view->hash = hash2_create(0, sizeof(struct mail_index_strmap_rec),
-				  mail_index_strmap_hash_key,
-				  mail_index_strmap_hash_cmp, view);
+	i_array_init(&view->recs_prev, 64);
 	*recs_r = &view->recs;
-	*hash_r = view->hash;
 	return view;
 }
 
@@ -216,7 +392,8 @@ void mail_index_strmap_view_close(struct mail_index_strmap_view **_view)
 	*_view = NULL;
 	array_free(&view->recs);
 	array_free(&view->recs_crc32);
-	hash2_destroy(&view->hash);
+	strmap_hash_clear(view);
+	array_free(&view->recs_prev);
 	i_free(view);
 }
 
@@ -230,7 +407,7 @@ static void mail_index_strmap_view_reset(struct mail_index_strmap_view *view)
 	view->remap_cb(NULL, 0, 0, view->cb_context);
 	array_clear(&view->recs);
 	array_clear(&view->recs_crc32);
-	hash2_clear(view->hash);
+	strmap_hash_clear(view);
 
 	view->last_added_uid = 0;
 	view->lost_expunged_uid = 0;
@@ -611,14 +788,14 @@ strmap_read_block_deinit(struct mail_index_strmap_read_context *ctx, int ret,
 static bool
 strmap_view_sync_handle_conflict(struct mail_index_strmap_read_context *ctx,
 				 const struct mail_index_strmap_rec *hash_rec,
-				 struct hash2_iter *iter)
+				 struct mail_index_strmap_hash_iter *iter)
 {
 	uint32_t seq;
 
 	/* hopefully it's a message that has since been expunged */
 	if (!mail_index_lookup_seq(ctx->view->view, hash_rec->uid, &seq)) {
 		/* message is no longer in our view. remove it completely. */
-		hash2_remove_iter(ctx->view->hash, iter);
+		strmap_hash_remove_iter(ctx->view, iter);
 		return TRUE;
 	}
 	if (mail_index_is_expunged(ctx->view->view, seq)) {
@@ -638,7 +815,7 @@ strmap_view_sync_block_check_conflicts(struct mail_index_strmap_read_context *ct
 				       uint32_t crc32)
 {
 	struct mail_index_strmap_rec *hash_rec;
-	struct hash2_iter iter;
+	struct mail_index_strmap_hash_iter iter;
 
 	if (crc32 == 0) {
 		/* unique string - there are no conflicts */
@@ -656,8 +833,8 @@ strmap_view_sync_block_check_conflicts(struct mail_index_strmap_read_context *ct
 	if we detect such a conflict, we can't continue using the
 	strmap index until X has been expunged. */
 	i_zero(&iter);
-	while ((hash_rec = hash2_iterate(ctx->view->hash,
-					 crc32, &iter)) != NULL &&
+	while ((hash_rec = strmap_hash_iterate(ctx->view,
+					       crc32, &iter)) != NULL &&
 	       hash_rec->str_idx != ctx->rec.str_idx) {
 		/* CRC32 matches, but string index doesn't */
 		if (!strmap_view_sync_handle_conflict(ctx, hash_rec, &iter)) {
@@ -671,7 +848,6 @@ strmap_view_sync_block_check_conflicts(struct mail_index_strmap_read_context *ct
 static int
 mail_index_strmap_view_sync_block(struct mail_index_strmap_read_context *ctx)
 {
-	struct mail_index_strmap_rec *hash_rec;
 	uint32_t crc32, prev_uid = 0;
 	int ret;
 
@@ -695,9 +871,9 @@ mail_index_strmap_view_sync_block(struct mail_index_strmap_read_context *ctx)
 		array_push_back(&ctx->view->recs, &ctx->rec);
 		array_push_back(&ctx->view->recs_crc32, &crc32);
 
-		/* add a separate copy of the record to hash */
-		hash_rec = hash2_insert_hash(ctx->view->hash, crc32);
-		memcpy(hash_rec, &ctx->rec, sizeof(*hash_rec));
+		/* add the record to hash */
+		strmap_hash_insert(ctx->view,
+				   array_count(&ctx->view->recs) - 1);
 	}
 	return strmap_read_block_deinit(ctx, ret, TRUE);
 }
@@ -755,7 +931,7 @@ void mail_index_strmap_view_sync_add(struct mail_index_strmap_view_sync *sync,
 				     const char *key)
 {
 	struct mail_index_strmap_view *view = sync->view;
-	struct mail_index_strmap_rec *rec, *old_rec;
+	struct mail_index_strmap_rec *old_rec, rec;
 	struct mail_index_strmap_hash_key hash_key;
 	uint32_t str_idx;
 
@@ -766,7 +942,7 @@ void mail_index_strmap_view_sync_add(struct mail_index_strmap_view_sync *sync,
 	hash_key.str = key;
 	hash_key.crc32 = crc32_str_nonzero(key);
 
-	old_rec = hash2_lookup(view->hash, &hash_key);
+	old_rec = strmap_hash_lookup(view, &hash_key);
 	if (old_rec != NULL) {
 		/* The string already exists, use the same unique idx */
 		str_idx = old_rec->str_idx;
@@ -776,12 +952,13 @@ void mail_index_strmap_view_sync_add(struct mail_index_strmap_view_sync *sync,
 	}
 	i_assert(str_idx != 0);
 
-	rec = hash2_insert(view->hash, &hash_key);
-	rec->uid = uid;
-	rec->ref_index = ref_index;
-	rec->str_idx = str_idx;
-	array_push_back(&view->recs, rec);
+	i_zero(&rec);
+	rec.uid = uid;
+	rec.ref_index = ref_index;
+	rec.str_idx = str_idx;
+	array_push_back(&view->recs, &rec);
 	array_push_back(&view->recs_crc32, &hash_key.crc32);
+	strmap_hash_insert(view, array_count(&view->recs) - 1);
 
 	view->last_added_uid = uid;
 	view->last_ref_index = ref_index;
@@ -819,7 +996,7 @@ mail_index_strmap_zero_terminate(struct mail_index_strmap_view *view)
 static void mail_index_strmap_view_renumber(struct mail_index_strmap_view *view)
 {
 	struct mail_index_strmap_read_context ctx;
-	struct mail_index_strmap_rec *recs, *hash_rec;
+	struct mail_index_strmap_rec *recs;
 	uint32_t prev_uid, str_idx, *recs_crc32, *renumber_map;
 	unsigned int i, dest, count, count2;
 	int ret;
@@ -872,11 +1049,10 @@ static void mail_index_strmap_view_renumber(struct mail_index_strmap_view *view)
 
 	/* renumber the indexes in-place and recreate the hash */
 	recs = array_get_modifiable(&view->recs, &count);
-	hash2_clear(view->hash);
+	strmap_hash_clear(view);
 	for (i = 0; i < count; i++) {
 		recs[i].str_idx = renumber_map[recs[i].str_idx];
-		hash_rec = hash2_insert_hash(view->hash, recs_crc32[i]);
-		memcpy(hash_rec, &recs[i], sizeof(*hash_rec));
+		strmap_hash_insert(view, i);
 	}
 
 	/* update the new next_str_idx only after remapping */
@@ -1049,6 +1225,7 @@ static int mail_index_strmap_lock(struct mail_index_strmap *strmap)
 
 		struct file_lock_settings lock_set = {
 			.lock_method = strmap->index->set.lock_method,
+			.event = strmap->index->event,
 		};
 		timeout_secs = I_MIN(MAIL_INDEX_STRMAP_TIMEOUT_SECS,
 				     strmap->index->set.max_lock_timeout_secs);
@@ -1191,7 +1368,7 @@ static int mail_index_strmap_write(struct mail_index_strmap_view *view)
 	/* FIXME: this renumbering doesn't work well when running for a long
 	   time since records aren't removed from hash often enough */
 	if (STRIDX_MUST_RENUMBER(view->next_str_idx - 1,
-				 hash2_count(view->hash))) {
+				 view->hash_count)) {
 		mail_index_strmap_view_renumber(view);
 		if (!MAIL_INDEX_IS_IN_MEMORY(view->strmap->index)) {
 			if (mail_index_strmap_recreate(view) < 0) {
@@ -1,8 +1,6 @@
 #ifndef MAIL_INDEX_STRMAP_H
 #define MAIL_INDEX_STRMAP_H
 
-#include "hash2.h"
-
 struct mail_index;
 struct mail_index_view;
 
@@ -43,7 +41,7 @@ struct mail_index_strmap *
 mail_index_strmap_init(struct mail_index *index, const char *suffix);
 void mail_index_strmap_deinit(struct mail_index_strmap **strmap);
 
-/* Returns strmap records and hash that can be used for read-only access.
+/* Returns strmap records that can be used for read-only access.
    The records array always terminates with a record containing zeros (but it's
    not counted in the array count). */
 struct mail_index_strmap_view *
@@ -53,8 +51,7 @@ mail_index_strmap_view_open(struct mail_index_strmap *strmap,
 			    mail_index_strmap_rec_cmp_t *rec_compare_cb,
 			    mail_index_strmap_remap_t *remap_cb,
 			    void *context,
-			    const ARRAY_TYPE(mail_index_strmap_rec) **recs_r,
-			    const struct hash2_table **hash_r);
+			    const ARRAY_TYPE(mail_index_strmap_rec) **recs_r);
 void mail_index_strmap_view_close(struct mail_index_strmap_view **view);
 void mail_index_strmap_view_set_corrupted(struct mail_index_strmap_view *view);
 
@@ -63,7 +60,7 @@ uint32_t mail_index_strmap_view_get_highest_idx(struct mail_index_strmap_view *v
 
 /* Synchronize strmap: Caller adds missing entries, expunged messages may be
    removed internally and the changes are written to disk. Note that the strmap
-   recs/hash shouldn't be used until _sync_commit() is called, because the
+   recs shouldn't be used until _sync_commit() is called, because the
    string indexes may be renumbered if another process had already written the
    same changes as us. */
 struct mail_index_strmap_view_sync *
@@ -534,6 +534,8 @@ static void mail_index_sync_ext_clear(struct mail_index_view *view,
 		memset(PTR_OFFSET(rec, ext->record_offset), 0,
 		       ext->record_size);
 	}
+	if (ext->index_idx == view->index->modseq_ext_id)
+		mail_index_map_modseq_records_changed(view->map, 1);
 }
 
 int mail_index_sync_ext_reset(struct mail_index_sync_map_ctx *ctx,
@@ -634,6 +636,8 @@ mail_index_sync_ext_rec_update(struct mail_index_sync_map_ctx *ctx,
 		memset(PTR_OFFSET(old_data, ctx->cur_ext_record_size), 0,
 		       ext->record_size - ctx->cur_ext_record_size);
 	}
+	if (ext->index_idx == view->index->modseq_ext_id)
+		mail_index_map_modseq_records_changed(view->map, seq);
 	return 1;
 }
 
@@ -731,5 +735,7 @@ mail_index_sync_ext_atomic_inc(struct mail_index_sync_map_ctx *ctx,
 			u->uid, u->diff, orig_num);
 		return -1;
 	}
+	if (ext->index_idx == view->index->modseq_ext_id)
+		mail_index_map_modseq_records_changed(view->map, seq);
 	return 1;
 }
@@ -71,7 +71,7 @@ static void mail_index_sync_replace_map(struct mail_index_sync_map_ctx *ctx,
 }
 
 static struct mail_index_map *
-mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+mail_index_sync_move_to_private(struct mail_index_sync_map_ctx *ctx)
 {
 	struct mail_index_map *map = ctx->view->map;
 
@@ -82,6 +82,13 @@ mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
 		mail_index_sync_replace_map(ctx, map);
 		i_assert(ctx->view->map == map);
 	}
+	return map;
+}
+
+static struct mail_index_map *
+mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map = mail_index_sync_move_to_private(ctx);
 
 	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(ctx->view->map)) {
 		/* map points to mmap()ed area, copy it into memory. */
@@ -307,6 +314,9 @@ static void *sync_append_record(struct mail_index_map *map)
 	size_t append_pos;
 	void *ret;
 
+	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map))
+		return mail_index_map_mmap_append_space(map);
+
 	append_pos = map->rec_map->records_count * map->hdr.record_size;
 	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
 				      map->hdr.record_size);
@@ -392,9 +402,13 @@ static int sync_append(const struct mail_index_record *rec,
 	}
 
 	/* We'll need to append a new record. If map currently points to
-	   mmap()ed index, it first needs to be moved to memory since we can't
-	   write past the mmap()ed memory area. */
-	map = mail_index_sync_move_to_private_memory(ctx);
+	   mmap()ed index, it needs to be moved to memory once the memory
+	   reserved after the mmap()ed file runs out. */
+	map = mail_index_sync_move_to_private(ctx);
+	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map) &&
+	    rec->uid > map->rec_map->last_appended_uid &&
+	    mail_index_map_mmap_append_space(map) == NULL)
+		map = mail_index_sync_move_to_private_memory(ctx);
 
 	if (rec->uid <= map->rec_map->last_appended_uid) {
 		i_assert(map->hdr.messages_count < map->rec_map->records_count);
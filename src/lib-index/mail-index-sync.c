@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "file-lock.h"
 #include "mail-index-view-private.h"
 #include "mail-index-sync-private.h"
 #include "mail-index-transaction-private.h"
@@ -18,6 +19,13 @@ struct mail_index_sync_ctx {
 	enum mail_index_sync_flags flags;
 	char *reason;
 
+	/* "mail_index_sync_finished" event, created before the .log was
+	   locked so its duration includes the lock wait */
+	struct event *event;
+	uint64_t lock_wait_usecs;
+	unsigned int transactions_count;
+	uoff_t log_bytes;
+
 	const struct mail_transaction_header *hdr;
 	const void *data;
 
@@ -194,6 +202,8 @@ mail_index_sync_read_and_sort(struct mail_index_sync_ctx *ctx)
 				ctx->seen_external_expunges = TRUE;
 			continue;
 		}
+		ctx->transactions_count++;
+		ctx->log_bytes += ctx->hdr->size;
 
 		T_BEGIN {
 			if (mail_index_sync_add_transaction(ctx)) {
@@ -245,6 +255,22 @@ mail_index_sync_read_and_sort(struct mail_index_sync_ctx *ctx)
 	return ret;
 }
 
+static bool
+mail_index_sync_want_cache_purge(struct mail_index *index,
+				 enum mail_index_sync_flags flags,
+				 const char **reason_r)
+{
+	if (!mail_cache_need_purge(index->cache, reason_r))
+		return FALSE;
+	if ((flags & MAIL_INDEX_SYNC_FLAG_PURGE_LARGE_CACHE) == 0 &&
+	    mail_cache_purge_is_large(index->cache)) {
+		/* rewriting a large cache file would stall the session.
+		   leave it to a background process (e.g. indexer). */
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static bool
 mail_index_need_sync(struct mail_index *index, enum mail_index_sync_flags flags,
 		     uint32_t log_file_seq, uoff_t log_file_offset)
@@ -278,7 +304,7 @@ mail_index_need_sync(struct mail_index *index, enum mail_index_sync_flags flags,
 
 	/* already synced */
 	const char *reason;
-	return mail_cache_need_purge(index->cache, &reason);
+	return mail_index_sync_want_cache_purge(index, flags, &reason);
 }
 
 static int
@@ -414,6 +440,8 @@ mail_index_sync_begin_to2(struct mail_index *index,
 	struct mail_index_sync_ctx *ctx;
 	struct mail_index_view *sync_view;
 	enum mail_index_transaction_flags trans_flags;
+	struct event *event;
+	uint64_t lock_wait_start;
 	int ret;
 
 	i_assert(!index->syncing);
@@ -429,16 +457,23 @@ mail_index_sync_begin_to2(struct mail_index *index,
 	if (log_file_seq != (uint32_t)-1)
 		flags |= MAIL_INDEX_SYNC_FLAG_REQUIRE_CHANGES;
 
+	event = event_create(index->event);
+	lock_wait_start = file_lock_wait_get_total_usecs();
 	ret = mail_index_sync_begin_init(index, flags, log_file_seq,
 					 log_file_offset);
-	if (ret <= 0)
+	if (ret <= 0) {
+		event_unref(&event);
 		return ret;
+	}
 
 	hdr = &index->map->hdr;
 
 	ctx = i_new(struct mail_index_sync_ctx, 1);
 	ctx->index = index;
 	ctx->flags = flags;
+	ctx->event = event;
+	ctx->lock_wait_usecs = file_lock_wait_get_total_usecs() -
+		lock_wait_start;
 
 	ctx->view = mail_index_view_open(index);
 
@@ -749,7 +784,8 @@ void mail_index_sync_set_reason(struct mail_index_sync_ctx *ctx,
 	ctx->reason = i_strdup(reason);
 }
 
-static void mail_index_sync_end(struct mail_index_sync_ctx **_ctx)
+static void mail_index_sync_end(struct mail_index_sync_ctx **_ctx,
+				const char *result)
 {
         struct mail_index_sync_ctx *ctx = *_ctx;
 	const char *lock_reason;
@@ -758,6 +794,16 @@ static void mail_index_sync_end(struct mail_index_sync_ctx **_ctx)
 
 	*_ctx = NULL;
 
+	event_add_int(ctx->event, "lock_wait_usecs", ctx->lock_wait_usecs);
+	event_add_int(ctx->event, "transactions", ctx->transactions_count);
+	event_add_int(ctx->event, "log_bytes", ctx->log_bytes);
+	event_add_str(ctx->event, "result", result);
+	event_set_name(ctx->event, "mail_index_sync_finished");
+	e_debug(ctx->event, "Sync finished (%s): %u transactions, "
+		"%"PRIuUOFF_T" bytes, lock wait %"PRIu64" usecs", result,
+		ctx->transactions_count, ctx->log_bytes, ctx->lock_wait_usecs);
+	event_unref(&ctx->event);
+
 	ctx->index->syncing = FALSE;
 	if (ctx->no_warning)
 		lock_reason = NULL;
@@ -920,7 +966,7 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 
 	ret2 = mail_index_transaction_commit(&ctx->ext_trans);
 	if (ret2 < 0) {
-		mail_index_sync_end(&ctx);
+		mail_index_sync_end(&ctx, "failed");
 		return -1;
 	}
 
@@ -942,7 +988,8 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 	/* The previously called expunged handlers will update cache's
 	   record_count and deleted_record_count. That also has a side effect
 	   of updating whether cache needs to be purged. */
-	if (ret == 0 && mail_cache_need_purge(index->cache, &reason) &&
+	if (ret == 0 &&
+	    mail_index_sync_want_cache_purge(index, ctx->flags, &reason) &&
 	    !mail_cache_transactions_have_changes(index->cache)) {
 		if (mail_cache_purge(index->cache,
 				     index->cache->need_purge_file_seq,
@@ -974,7 +1021,7 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 		index->index_min_write = FALSE;
 		mail_index_write(index, want_rotate, reason);
 	}
-	mail_index_sync_end(_ctx);
+	mail_index_sync_end(_ctx, ret < 0 ? "failed" : "committed");
 	return ret;
 }
 
@@ -982,7 +1029,7 @@ void mail_index_sync_rollback(struct mail_index_sync_ctx **ctx)
 {
 	if ((*ctx)->ext_trans != NULL)
 		mail_index_transaction_rollback(&(*ctx)->ext_trans);
-	mail_index_sync_end(ctx);
+	mail_index_sync_end(ctx, "rolled_back");
 }
 
 void mail_index_sync_flags_apply(const struct mail_index_sync_rec *sync_rec,
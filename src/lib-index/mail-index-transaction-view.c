@@ -164,6 +164,33 @@ tview_lookup_uid(struct mail_index_view *view, uint32_t seq, uint32_t *uid_r)
 		tview->super->lookup_uid(view, seq, uid_r);
 }
 
+static void tview_lookup_columns(struct mail_index_view *view,
+				 uint32_t seq1, uint32_t seq2,
+				 uint32_t *uids_r, uint8_t *flags_r)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+	const struct mail_index_record *rec;
+	struct mail_index_map *map;
+	uint32_t seq, i;
+
+	if (seq2 < t->first_new_seq &&
+	    (!array_is_created(&t->updates) ||
+	     seq2 < t->min_flagupdate_seq || seq1 > t->max_flagupdate_seq)) {
+		/* no changes in this range by the transaction */
+		tview->super->lookup_columns(view, seq1, seq2, uids_r, flags_r);
+		return;
+	}
+	for (seq = seq1, i = 0; seq <= seq2; seq++, i++) {
+		rec = tview_lookup_full(view, seq, &map, NULL);
+		if (uids_r != NULL)
+			uids_r[i] = rec->uid;
+		if (flags_r != NULL)
+			flags_r[i] = rec->flags;
+	}
+}
+
 static void tview_lookup_seq_range(struct mail_index_view *view,
 				   uint32_t first_uid, uint32_t last_uid,
 				   uint32_t *first_seq_r, uint32_t *last_seq_r)
@@ -502,6 +529,7 @@ static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_get_header,
 	tview_lookup_full,
 	tview_lookup_uid,
+	tview_lookup_columns,
 	tview_lookup_seq_range,
 	tview_lookup_first,
 	tview_lookup_keywords,
@@ -20,6 +20,9 @@ struct mail_index_view_vfuncs {
 			       struct mail_index_map **map_r, bool *expunged_r);
 	void (*lookup_uid)(struct mail_index_view *view, uint32_t seq,
 			   uint32_t *uid_r);
+	void (*lookup_columns)(struct mail_index_view *view,
+			       uint32_t seq1, uint32_t seq2,
+			       uint32_t *uids_r, uint8_t *flags_r);
 	void (*lookup_seq_range)(struct mail_index_view *view,
 				 uint32_t first_uid, uint32_t last_uid,
 				 uint32_t *first_seq_r, uint32_t *last_seq_r);
@@ -240,6 +240,32 @@ static void view_lookup_uid(struct mail_index_view *view, uint32_t seq,
 	*uid_r = MAIL_INDEX_REC_AT_SEQ(view->map, seq)->uid;
 }
 
+static void view_lookup_columns(struct mail_index_view *view,
+				uint32_t seq1, uint32_t seq2,
+				uint32_t *uids_r, uint8_t *flags_r)
+{
+	const struct mail_index_record *rec;
+	struct mail_index_map *map;
+	uint32_t seq, i;
+
+	i_assert(seq2 <= mail_index_view_get_messages_count(view));
+
+	if (view->map == view->index->map) {
+		/* the view is up to date - no need to look for newer flags
+		   from the head map */
+		mail_index_map_lookup_columns(view->map, seq1, seq2,
+					      uids_r, flags_r);
+		return;
+	}
+	for (seq = seq1, i = 0; seq <= seq2; seq++, i++) {
+		rec = view_lookup_full(view, seq, &map, NULL);
+		if (uids_r != NULL)
+			uids_r[i] = rec->uid;
+		if (flags_r != NULL)
+			flags_r[i] = rec->flags;
+	}
+}
+
 static void view_lookup_seq_range(struct mail_index_view *view,
 				  uint32_t first_uid, uint32_t last_uid,
 				  uint32_t *first_seq_r, uint32_t *last_seq_r)
@@ -444,6 +470,15 @@ mail_index_lookup_full(struct mail_index_view *view, uint32_t seq,
 	return view->v.lookup_full(view, seq, map_r, NULL);
 }
 
+void mail_index_lookup_columns(struct mail_index_view *view,
+			       uint32_t seq1, uint32_t seq2,
+			       uint32_t *uids_r, uint8_t *flags_r)
+{
+	i_assert(seq1 > 0 && seq1 <= seq2);
+
+	view->v.lookup_columns(view, seq1, seq2, uids_r, flags_r);
+}
+
 bool mail_index_is_expunged(struct mail_index_view *view, uint32_t seq)
 {
 	struct mail_index_map *map;
@@ -589,6 +624,7 @@ static struct mail_index_view_vfuncs view_vfuncs = {
 	view_get_header,
 	view_lookup_full,
 	view_lookup_uid,
+	view_lookup_columns,
 	view_lookup_seq_range,
 	view_lookup_first,
 	view_lookup_keywords,
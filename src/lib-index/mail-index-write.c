@@ -195,13 +195,26 @@ void mail_index_write(struct mail_index *index, bool want_rotate,
 		/* make sure we don't keep getting back in here */
 		index->reopen_main_index = TRUE;
 	} else {
+		/* the event's duration covers writing the new index */
+		struct event *event = event_create(index->event);
+
 		if (mail_index_recreate(index) < 0) {
+			event_unref(&event);
 			(void)mail_index_move_to_memory(index);
 			return;
 		}
-		event_set_name(index->event, "mail_index_recreated");
-		e_debug(index->event, "Recreated %s (file_seq=%u) because: %s",
+		event_add_int(event, "file_seq", hdr->log_file_seq);
+		event_add_int(event, "messages_count",
+			      index->map->rec_map->records_count);
+		event_add_int(event, "file_size", hdr->header_size +
+			      (uint64_t)index->map->rec_map->records_count *
+			      hdr->record_size);
+		event_add_str(event, "reason", reason);
+		event_add_str(event, "rotated", rotated ? "yes" : "no");
+		event_set_name(event, "mail_index_recreated");
+		e_debug(event, "Recreated %s (file_seq=%u) because: %s",
 			index->filepath, hdr->log_file_seq, reason);
+		event_unref(&event);
 	}
 
 	index->main_index_hdr_log_file_seq = hdr->log_file_seq;
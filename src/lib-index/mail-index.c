@@ -206,6 +206,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->log.min_age_secs = set->log.min_age_secs;
 	if (set->log.log2_max_age_secs != 0)
 		dest->log.log2_max_age_secs = set->log.log2_max_age_secs;
+	if (set->log.group_commit)
+		dest->log.group_commit = TRUE;
 
 	/* cache */
 	if (set->cache.unaccessed_field_drop_secs != 0)
@@ -226,6 +228,9 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 			set->cache.purge_header_continue_count;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.purge_max_inline_size != 0)
+		dest->cache.purge_max_inline_size =
+			set->cache.purge_max_inline_size;
 }
 
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
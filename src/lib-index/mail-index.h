@@ -238,7 +238,10 @@ enum mail_index_sync_flags {
 	MAIL_INDEX_SYNC_FLAG_TRY_DELETING_INDEX	= 0x40,
 	/* Update header's tail_offset to head_offset, even if it's the only
 	   thing we do and there's no strict need for it. */
-	MAIL_INDEX_SYNC_FLAG_UPDATE_TAIL_OFFSET	= 0x80
+	MAIL_INDEX_SYNC_FLAG_UPDATE_TAIL_OFFSET	= 0x80,
+	/* Purge the cache file if needed, even if it's larger than
+	   purge_max_inline_size. */
+	MAIL_INDEX_SYNC_FLAG_PURGE_LARGE_CACHE	= 0x100,
 };
 
 enum mail_index_view_sync_flags {
@@ -323,6 +326,11 @@ struct mail_index_log_optimization_settings {
 	/* Delete .log.2 when it's older than log2_stale_secs. Don't be too
 	   eager, because older files are useful for QRESYNC and dsync. */
 	unsigned int log2_max_age_secs;
+
+	/* fdatasync() the log only after it has been unlocked. This allows
+	   concurrent writers' fdatasync()s to be merged, at the cost of other
+	   processes possibly seeing changes before they are durable. */
+	bool group_commit;
 };
 
 struct mail_index_cache_optimization_settings {
@@ -344,6 +352,10 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* Don't purge files larger than this during a regular index sync,
+	   because rewriting them stalls the session. They're purged only by
+	   syncs with MAIL_INDEX_SYNC_FLAG_PURGE_LARGE_CACHE. 0 = unlimited. */
+	uoff_t purge_max_inline_size;
 };
 
 struct mail_index_optimization_settings {
@@ -587,6 +599,14 @@ mail_index_lookup(struct mail_index_view *view, uint32_t seq);
 const struct mail_index_record *
 mail_index_lookup_full(struct mail_index_view *view, uint32_t seq,
 		       struct mail_index_map **map_r);
+/* Copy the UIDs and flags of messages seq1..seq2 into contiguous uids_r[] and
+   flags_r[] arrays, which must have space for seq2-seq1+1 items. Either one of
+   them may be NULL. The results are the same as what mail_index_lookup()
+   would return, but this is much faster for scanning through a lot of
+   messages. */
+void mail_index_lookup_columns(struct mail_index_view *view,
+			       uint32_t seq1, uint32_t seq2,
+			       uint32_t *uids_r, uint8_t *flags_r);
 /* Returns TRUE if the given message has already been expunged from index. */
 bool mail_index_is_expunged(struct mail_index_view *view, uint32_t seq);
 /* Note that returned keyword indexes aren't sorted. */
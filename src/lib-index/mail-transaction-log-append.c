@@ -91,7 +91,12 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (file->log->index->optimization_set.log.group_commit &&
+		    !file->log->index->log_sync_locked) {
+			/* fdatasync() only after the log is unlocked, so other
+			   processes can append while we're waiting. */
+			ctx->fsync_after_unlock = TRUE;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -242,13 +247,28 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 {
 	struct mail_transaction_log_append_ctx *ctx = *_ctx;
 	struct mail_index *index = ctx->log->index;
+	struct mail_transaction_log_file *file = index->log->head;
 	int ret = 0;
 
 	*_ctx = NULL;
 
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
-		mail_transaction_log_file_unlock(index->log->head, "appending");
+		mail_transaction_log_file_unlock(file, "appending");
+
+	if (ret == 0 && ctx->fsync_after_unlock) {
+		/* Group commit: Other processes that wrote to the log while
+		   we were waiting for the fdatasync() get their data
+		   flushed at the same time, and the kernel can merge their
+		   fdatasync()s with ours. The data is already visible to
+		   others, so a failure can't be undone by moving to memory
+		   anymore. */
+		if (fdatasync(file->fd) < 0) {
+			mail_index_file_set_syscall_error(index, file->filepath,
+							  "fdatasync()");
+			ret = -1;
+		}
+	}
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
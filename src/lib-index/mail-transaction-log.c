@@ -285,6 +285,7 @@ int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 {
 	struct mail_transaction_log_file *file, *old_head;
 	const char *path = log->head->filepath;
+	struct event *event;
 	struct stat st;
 	int ret;
 
@@ -330,8 +331,15 @@ int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 	old_head = log->head;
 	mail_transaction_log_set_head(log, file);
 
-	e_debug(log->index->event, "Rotated transaction log %s (seq=%u, reset=%s)",
+	event = event_create(log->index->event);
+	event_add_int(event, "prev_file_seq", old_head->hdr.file_seq);
+	event_add_int(event, "prev_file_size", old_head->sync_offset);
+	event_add_int(event, "file_seq", file->hdr.file_seq);
+	event_add_str(event, "reset", reset ? "yes" : "no");
+	event_set_name(event, "mail_transaction_log_rotated");
+	e_debug(event, "Rotated transaction log %s (seq=%u, reset=%s)",
 		file->filepath, file->hdr.file_seq, reset ? "yes" : "no");
+	event_unref(&event);
 
 	/* the newly created log file is already locked */
 	mail_transaction_log_file_unlock(old_head,
@@ -661,4 +669,5 @@ void mail_transaction_log_get_dotlock_set(struct mail_transaction_log *log,
 	set_r->nfs_flush = (index->flags & MAIL_INDEX_OPEN_FLAG_NFS_FLUSH) != 0;
 	set_r->use_excl_lock =
 		(index->flags & MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL) != 0;
+	set_r->event = index->event;
 }
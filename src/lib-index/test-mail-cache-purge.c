@@ -1042,6 +1042,53 @@ static void test_mail_cache_update_need_purge_deleted_records2(void)
 	test_end();
 }
 
+static void test_mail_cache_purge_large_deferred(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_min_size = 1,
+			.purge_delete_percentage = 30,
+			.purge_max_inline_size = 1,
+		},
+	};
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct test_mail_cache_ctx ctx;
+	char value[30];
+	uint32_t seq;
+
+	test_begin("mail cache purge large deferred");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+
+	for (seq = 1; seq <= 10; seq++) {
+		i_snprintf(value, sizeof(value), "foo%d", seq);
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, value);
+	}
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	for (seq = 1; seq <= 5; seq++)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	/* a normal sync leaves the large cache file alone */
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->need_purge_file_seq != 0);
+	test_assert(mail_cache_purge_is_large(ctx.cache));
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+
+	/* a background sync purges it */
+	test_assert(mail_index_sync_begin(ctx.index, &sync_ctx, &view, &trans,
+		MAIL_INDEX_SYNC_FLAG_PURGE_LARGE_CACHE) == 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -1070,6 +1117,7 @@ int main(void)
 		test_mail_cache_update_need_purge_continued_records2,
 		test_mail_cache_update_need_purge_deleted_records,
 		test_mail_cache_update_need_purge_deleted_records2,
+		test_mail_cache_purge_large_deferred,
 		NULL
 	};
 	return test_run(test_functions);
@@ -6,6 +6,8 @@
 #include "test-common.h"
 #include "test-mail-cache.h"
 
+#include <fcntl.h>
+
 struct test_header_data {
 	uint32_t line1, line2;
 	uint32_t end_of_lines;
@@ -745,6 +747,77 @@ static void test_mail_cache_size_corruption(void)
 	test_end();
 }
 
+static void test_mail_cache_prefetch(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+
+	test_begin("mail cache prefetch");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "12345678");
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	test_assert(mail_cache_prefetch(cache_view, 1));
+	/* the same record was already prefetched */
+	test_assert(!mail_cache_prefetch(cache_view, 1));
+#endif
+	/* nothing cached for the second mail */
+	test_assert(!mail_cache_prefetch(cache_view, 2));
+
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_field_usage(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	const struct mail_cache_field_usage *usage;
+	unsigned int count;
+	string_t *str = t_str_new(16);
+
+	test_begin("mail cache field usage");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_view_sync(&ctx);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    ctx.cache_field.idx) == 1);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    ctx.cache_field.idx) == 1);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    ctx.cache_field2.idx) == 0);
+	mail_cache_view_close(&cache_view);
+
+	usage = mail_cache_get_field_usage(ctx.cache, pool_datastack_create(),
+					   &count);
+	test_assert(count == 2);
+	for (unsigned int i = 0; i < count; i++) {
+		if (strcmp(usage[i].name, ctx.cache_field.name) == 0) {
+			test_assert(usage[i].lookup_hits == 2);
+			test_assert(usage[i].lookup_misses == 0);
+		} else {
+			test_assert_strcmp(usage[i].name, ctx.cache_field2.name);
+			test_assert(usage[i].lookup_hits == 0);
+			test_assert(usage[i].lookup_misses == 1);
+		}
+		test_assert(!usage[i].decision_changed);
+	}
+	/* the counters were reset */
+	(void)mail_cache_get_field_usage(ctx.cache, pool_datastack_create(),
+					 &count);
+	test_assert(count == 0);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -758,6 +831,8 @@ int main(void)
 		test_mail_cache_lookup_decisions2,
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
+		test_mail_cache_prefetch,
+		test_mail_cache_field_usage,
 		NULL
 	};
 	return test_run(test_functions);
@@ -47,10 +47,55 @@ static void test_mail_index_map_lookup_seq_range(void)
 	test_end();
 }
 
+static void test_mail_index_map_lookup_columns(void)
+{
+	struct mail_index_record_map rec_map;
+	struct mail_index_map map;
+	struct mail_index_record *rec;
+	uint32_t seq, uids[10];
+	uint8_t flags[10];
+
+	test_begin("mail index map lookup columns");
+	i_zero(&map);
+	i_zero(&rec_map);
+	map.rec_map = &rec_map;
+	map.hdr.messages_count = 10;
+	/* records with extension data after them */
+	map.hdr.record_size = sizeof(struct mail_index_record) + 8;
+	rec_map.records_count = map.hdr.messages_count;
+	rec_map.records = i_malloc(map.hdr.record_size *
+				   map.hdr.messages_count);
+
+	for (seq = 1; seq <= map.hdr.messages_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(&map, seq);
+		rec->uid = seq*3;
+		rec->flags = seq;
+		memset(rec + 1, 0xff, 8);
+	}
+
+	mail_index_map_lookup_columns(&map, 1, 10, uids, flags);
+	for (seq = 1; seq <= 10; seq++) {
+		test_assert_idx(uids[seq-1] == seq*3, seq);
+		test_assert_idx(flags[seq-1] == seq, seq);
+	}
+
+	memset(uids, 0, sizeof(uids));
+	memset(flags, 0, sizeof(flags));
+	mail_index_map_lookup_columns(&map, 4, 6, uids, NULL);
+	test_assert(uids[0] == 12 && uids[1] == 15 && uids[2] == 18 &&
+		    uids[3] == 0);
+	mail_index_map_lookup_columns(&map, 10, 10, NULL, flags);
+	test_assert(flags[0] == 10 && flags[1] == 0);
+
+	i_free(rec_map.records);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_lookup_columns,
 		NULL
 	};
 	return test_run(test_functions);
@@ -67,10 +67,75 @@ static void test_mail_index_modseq_get_next_log_offset(void)
 	test_end();
 }
 
+static void test_mail_index_modseq_find_next(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_view *sync_view;
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_ctx *sync_ctx;
+	uint64_t modseq;
+	uint32_t seq, uid;
+
+	test_begin("mail_index_modseq_find_next()");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+	mail_index_modseq_enable(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	uid = 1234;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid, sizeof(uid), TRUE);
+	for (uid = 1; uid <= 200; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	modseq = mail_index_modseq_get_highest(view) + 1;
+	test_assert(!mail_index_modseq_find_next(view, 1, modseq, &seq));
+
+	/* change two messages in different summary blocks */
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags(trans, 10, MODIFY_ADD, MAIL_SEEN);
+	mail_index_update_flags(trans, 150, MODIFY_ADD, MAIL_FLAGGED);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_modseq_find_next(view, 1, modseq, &seq) && seq == 10);
+	test_assert(mail_index_modseq_find_next(view, 10, modseq, &seq) && seq == 10);
+	test_assert(mail_index_modseq_find_next(view, 11, modseq, &seq) && seq == 150);
+	test_assert(!mail_index_modseq_find_next(view, 151, modseq, &seq));
+	test_assert(mail_index_modseq_find_next(view, 1, 1, &seq) && seq == 1);
+
+	/* expunging moves the later messages to earlier blocks */
+	mail_index_view_close(&view);
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &sync_view,
+					  &trans, 0) == 1);
+	for (seq = 1; seq <= 100; seq++) {
+		if (seq != 10)
+			mail_index_expunge(trans, seq);
+	}
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_modseq_find_next(view, 1, modseq, &seq) && seq == 1);
+	test_assert(mail_index_modseq_find_next(view, 2, modseq, &seq) && seq == 51);
+	test_assert(!mail_index_modseq_find_next(view, 52, modseq, &seq));
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_modseq_get_next_log_offset,
+		test_mail_index_modseq_find_next,
 		NULL
 	};
 	return test_run(test_functions);
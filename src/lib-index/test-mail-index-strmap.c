@@ -0,0 +1,464 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "test-common.h"
+#include "test-mail-index.h"
+#include "mail-index-strmap.h"
+
+#define TEST_STRMAP_SUFFIX ".thread"
+
+struct test_strmap_ref {
+	uint32_t uid, ref_index;
+	const char *key;
+};
+
+struct test_strmap {
+	struct mail_index *index;
+	struct mail_index_strmap *strmap;
+	pool_t pool;
+	ARRAY(struct test_strmap_ref) refs;
+
+	struct mail_index_view *view;
+	struct mail_index_strmap_view *strmap_view;
+	const ARRAY_TYPE(mail_index_strmap_rec) *recs;
+	unsigned int remap_count;
+};
+
+static const char *
+test_strmap_ref_key(struct test_strmap *ctx, uint32_t uid, uint32_t ref_index)
+{
+	const struct test_strmap_ref *ref;
+
+	array_foreach(&ctx->refs, ref) {
+		if (ref->uid == uid && ref->ref_index == ref_index)
+			return ref->key;
+	}
+	return NULL;
+}
+
+static const char *
+test_strmap_rec_key(struct test_strmap *ctx,
+		    const struct mail_index_strmap_rec *rec)
+{
+	uint32_t seq;
+
+	/* expunged mails can't be looked up, just like in index-thread */
+	if (!mail_index_lookup_seq(ctx->view, rec->uid, &seq))
+		return NULL;
+	return test_strmap_ref_key(ctx, rec->uid, rec->ref_index);
+}
+
+static bool
+test_strmap_key_cmp(const char *key, const struct mail_index_strmap_rec *rec,
+		    void *context)
+{
+	const char *rec_key = test_strmap_rec_key(context, rec);
+
+	return rec_key != NULL && strcmp(rec_key, key) == 0;
+}
+
+static int
+test_strmap_rec_cmp(const struct mail_index_strmap_rec *rec1,
+		    const struct mail_index_strmap_rec *rec2, void *context)
+{
+	const char *key1 = test_strmap_rec_key(context, rec1);
+	const char *key2 = test_strmap_rec_key(context, rec2);
+
+	if (key1 == NULL || key2 == NULL)
+		return -1;
+	return strcmp(key1, key2) == 0 ? 1 : 0;
+}
+
+static void
+test_strmap_remap(const uint32_t *idx_map ATTR_UNUSED,
+		  unsigned int old_count ATTR_UNUSED,
+		  unsigned int new_count, void *context)
+{
+	struct test_strmap *ctx = context;
+
+	if (new_count > 0)
+		ctx->remap_count++;
+}
+
+static void test_strmap_init(struct test_strmap *ctx)
+{
+	i_zero(ctx);
+	ctx->index = test_mail_index_init();
+	ctx->strmap = mail_index_strmap_init(ctx->index, TEST_STRMAP_SUFFIX);
+	ctx->pool = pool_alloconly_create("test strmap", 1024);
+	p_array_init(&ctx->refs, ctx->pool, 64);
+}
+
+static void test_strmap_deinit(struct test_strmap *ctx)
+{
+	i_assert(ctx->strmap_view == NULL);
+	mail_index_strmap_deinit(&ctx->strmap);
+	test_mail_index_deinit(&ctx->index);
+	pool_unref(&ctx->pool);
+}
+
+static void test_strmap_append(struct test_strmap *ctx, uint32_t last_uid)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, uid_validity = 1234;
+
+	test_assert(mail_index_refresh(ctx->index) == 0);
+	view = mail_index_view_open(ctx->index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	if (mail_index_get_header(view)->uid_validity == 0) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uid = mail_index_get_header(view)->next_uid;
+	     uid <= last_uid; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_strmap_expunge(struct test_strmap *ctx, uint32_t uid)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	test_assert(mail_index_sync_begin(ctx->index, &sync_ctx,
+					  &view, &trans, 0) == 1);
+	test_assert(mail_index_lookup_seq(view, uid, &seq));
+	mail_index_expunge(trans, seq);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_strmap_view_open(struct test_strmap *ctx)
+{
+	test_assert(mail_index_refresh(ctx->index) == 0);
+	ctx->view = mail_index_view_open(ctx->index);
+	ctx->strmap_view =
+		mail_index_strmap_view_open(ctx->strmap, ctx->view,
+					    test_strmap_key_cmp,
+					    test_strmap_rec_cmp,
+					    test_strmap_remap, ctx,
+					    &ctx->recs);
+}
+
+static void test_strmap_view_close(struct test_strmap *ctx)
+{
+	mail_index_strmap_view_close(&ctx->strmap_view);
+	mail_index_view_close(&ctx->view);
+}
+
+static void test_strmap_view_sync(struct test_strmap *ctx)
+{
+	struct mail_index_view_sync_ctx *sync_ctx;
+	struct mail_index_view_sync_rec sync_rec;
+	bool delayed_expunges;
+
+	test_assert(mail_index_refresh(ctx->index) == 0);
+	sync_ctx = mail_index_view_sync_begin(ctx->view, 0);
+	while (mail_index_view_sync_next(sync_ctx, &sync_rec)) ;
+	test_assert(mail_index_view_sync_commit(&sync_ctx,
+						&delayed_expunges) == 0);
+}
+
+static struct mail_index_strmap_view_sync *
+test_strmap_sync_init(struct test_strmap *ctx, uint32_t last_uid)
+{
+	struct mail_index_strmap_view_sync *sync;
+	uint32_t strmap_last_uid;
+
+	test_strmap_append(ctx, last_uid);
+	if (ctx->strmap_view == NULL)
+		test_strmap_view_open(ctx);
+	else
+		test_strmap_view_sync(ctx);
+	sync = mail_index_strmap_view_sync_init(ctx->strmap_view,
+						&strmap_last_uid);
+	return sync;
+}
+
+static void
+test_strmap_add(struct test_strmap *ctx,
+		struct mail_index_strmap_view_sync *sync,
+		uint32_t uid, uint32_t ref_index, const char *key)
+{
+	struct test_strmap_ref *ref;
+
+	ref = array_append_space(&ctx->refs);
+	ref->uid = uid;
+	ref->ref_index = ref_index;
+	ref->key = p_strdup(ctx->pool, key);
+	mail_index_strmap_view_sync_add(sync, uid, ref_index, key);
+}
+
+static uint32_t
+test_strmap_get_str_idx(struct test_strmap *ctx,
+			uint32_t uid, uint32_t ref_index)
+{
+	const struct mail_index_strmap_rec *rec;
+
+	array_foreach(ctx->recs, rec) {
+		if (rec->uid == uid && rec->ref_index == ref_index)
+			return rec->str_idx;
+	}
+	return 0;
+}
+
+static uint32_t test_strmap_highest_idx(struct test_strmap *ctx)
+{
+	return mail_index_strmap_view_get_highest_idx(ctx->strmap_view);
+}
+
+static void test_mail_index_strmap_insert(void)
+{
+	struct test_strmap ctx;
+	struct mail_index_strmap_view_sync *sync;
+	uint32_t idx_a, idx_b, idx_unique;
+
+	test_begin("mail index strmap insert");
+	test_strmap_init(&ctx);
+
+	sync = test_strmap_sync_init(&ctx, 3);
+	test_strmap_add(&ctx, sync, 1, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 1, 2, "<b@example.com>");
+	mail_index_strmap_view_sync_add_unique(sync, 2, 0);
+	test_strmap_add(&ctx, sync, 2, 2, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 3, 0, "<b@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+
+	test_assert(array_count(ctx.recs) == 5);
+	idx_a = test_strmap_get_str_idx(&ctx, 1, 0);
+	idx_b = test_strmap_get_str_idx(&ctx, 1, 2);
+	idx_unique = test_strmap_get_str_idx(&ctx, 2, 0);
+	test_assert(idx_a != 0 && idx_b != 0 && idx_unique != 0);
+	test_assert(idx_a != idx_b && idx_a != idx_unique &&
+		    idx_b != idx_unique);
+	test_assert(test_strmap_get_str_idx(&ctx, 2, 2) == idx_a);
+	test_assert(test_strmap_get_str_idx(&ctx, 3, 0) == idx_b);
+	test_assert(test_strmap_highest_idx(&ctx) == 3);
+	test_strmap_view_close(&ctx);
+
+	/* the records are read back from the file the same */
+	sync = test_strmap_sync_init(&ctx, 4);
+	test_strmap_add(&ctx, sync, 4, 0, "<b@example.com>");
+	test_strmap_add(&ctx, sync, 4, 2, "<c@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(array_count(ctx.recs) == 7);
+	test_assert(test_strmap_get_str_idx(&ctx, 1, 0) == idx_a);
+	test_assert(test_strmap_get_str_idx(&ctx, 4, 0) == idx_b);
+	test_assert(test_strmap_get_str_idx(&ctx, 4, 2) == 4);
+	test_strmap_view_close(&ctx);
+
+	test_strmap_deinit(&ctx);
+	test_end();
+}
+
+static void test_mail_index_strmap_replace(void)
+{
+	struct test_strmap ctx;
+	struct mail_index_strmap_view_sync *sync;
+	uint32_t uid, idx_a;
+
+	test_begin("mail index strmap replace");
+	test_strmap_init(&ctx);
+
+	/* the same string in many mails and multiple times within a mail
+	   keeps the same index, even though only the newest record is in
+	   the hash table */
+	sync = test_strmap_sync_init(&ctx, 10);
+	for (uid = 1; uid <= 10; uid++) {
+		test_strmap_add(&ctx, sync, uid, 0, "<a@example.com>");
+		test_strmap_add(&ctx, sync, uid, 2,
+				t_strdup_printf("<%u@example.com>", uid));
+		test_strmap_add(&ctx, sync, uid, 3, "<a@example.com>");
+	}
+	mail_index_strmap_view_sync_commit(&sync);
+
+	idx_a = test_strmap_get_str_idx(&ctx, 1, 0);
+	for (uid = 1; uid <= 10; uid++) {
+		test_assert_idx(test_strmap_get_str_idx(&ctx, uid, 0) ==
+				idx_a, uid);
+		test_assert_idx(test_strmap_get_str_idx(&ctx, uid, 3) ==
+				idx_a, uid);
+		test_assert_idx(test_strmap_get_str_idx(&ctx, uid, 2) !=
+				idx_a, uid);
+	}
+	test_assert(test_strmap_highest_idx(&ctx) == 11);
+	test_strmap_view_close(&ctx);
+
+	test_strmap_deinit(&ctx);
+	test_end();
+}
+
+static void test_mail_index_strmap_expunge_fallback(void)
+{
+	struct test_strmap ctx;
+	struct mail_index_strmap_view_sync *sync;
+	uint32_t idx_a, idx_b;
+
+	test_begin("mail index strmap expunge fallback");
+	test_strmap_init(&ctx);
+
+	sync = test_strmap_sync_init(&ctx, 4);
+	test_strmap_add(&ctx, sync, 1, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 2, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 2, 2, "<b@example.com>");
+	/* the newest records of both strings are in the same mail */
+	test_strmap_add(&ctx, sync, 3, 0, "<b@example.com>");
+	test_strmap_add(&ctx, sync, 3, 2, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 3, 3, "<a@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+	idx_a = test_strmap_get_str_idx(&ctx, 1, 0);
+	idx_b = test_strmap_get_str_idx(&ctx, 2, 2);
+	/* the initial file creation doesn't leave the file open, so the next
+	   sync re-reads it. do that now so the expunge below isn't noticed
+	   while reading the file. */
+	sync = test_strmap_sync_init(&ctx, 3);
+	mail_index_strmap_view_sync_commit(&sync);
+
+	/* After mail 3 is expunged, its records in the still open view can't
+	   be compared anymore. The lookups must fall back to the older
+	   records of mail 2, skipping the other record of mail 3. */
+	test_strmap_expunge(&ctx, 3);
+	sync = test_strmap_sync_init(&ctx, 4);
+	test_strmap_add(&ctx, sync, 4, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 4, 2, "<b@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(test_strmap_get_str_idx(&ctx, 4, 0) == idx_a);
+	test_assert(test_strmap_get_str_idx(&ctx, 4, 2) == idx_b);
+	test_strmap_view_close(&ctx);
+
+	/* the same when all the older mails are gone except for the first,
+	   and the strmap is read back from the file */
+	test_strmap_expunge(&ctx, 2);
+	test_strmap_expunge(&ctx, 4);
+	sync = test_strmap_sync_init(&ctx, 5);
+	test_strmap_add(&ctx, sync, 5, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 5, 2, "<b@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(test_strmap_get_str_idx(&ctx, 5, 0) == idx_a);
+	/* nothing is left of b, so it's a new string */
+	test_assert(test_strmap_get_str_idx(&ctx, 5, 2) ==
+		    test_strmap_highest_idx(&ctx));
+	test_assert(test_strmap_get_str_idx(&ctx, 5, 2) != idx_a);
+	test_strmap_view_close(&ctx);
+
+	test_strmap_deinit(&ctx);
+	test_end();
+}
+
+/* The file format expects the first reference to be Message-ID (0), followed
+   by References (2..n). */
+static uint32_t test_strmap_nth_ref_index(unsigned int n)
+{
+	return n == 1 ? 0 : n;
+}
+
+static void test_mail_index_strmap_resize(void)
+{
+	struct test_strmap ctx;
+	struct mail_index_strmap_view_sync *sync;
+	const unsigned int count = 1000;
+	unsigned int i;
+
+	test_begin("mail index strmap resize");
+	test_strmap_init(&ctx);
+
+	/* many more strings than fit into the initial hash table */
+	sync = test_strmap_sync_init(&ctx, 2);
+	for (i = 1; i <= count; i++) {
+		test_strmap_add(&ctx, sync, 1, test_strmap_nth_ref_index(i),
+				t_strdup_printf("<%u@example.com>", i));
+	}
+	for (i = 1; i <= count; i++) {
+		test_strmap_add(&ctx, sync, 2, test_strmap_nth_ref_index(i),
+				t_strdup_printf("<%u@example.com>",
+						count + 1 - i));
+	}
+	mail_index_strmap_view_sync_commit(&sync);
+
+	for (i = 1; i <= count; i++) {
+		test_assert_idx(test_strmap_get_str_idx(&ctx, 1,
+				test_strmap_nth_ref_index(i)) == i, i);
+		test_assert_idx(test_strmap_get_str_idx(&ctx, 2,
+				test_strmap_nth_ref_index(i)) ==
+				count + 1 - i, i);
+	}
+	test_assert(test_strmap_highest_idx(&ctx) == count);
+	test_strmap_view_close(&ctx);
+
+	test_strmap_deinit(&ctx);
+	test_end();
+}
+
+static void test_mail_index_strmap_renumber(void)
+{
+	struct test_strmap ctx;
+	struct mail_index_strmap_view_sync *sync;
+	const struct mail_index_strmap_rec *rec;
+	uint32_t uid, i, idx_a, highest_idx;
+
+	test_begin("mail index strmap renumber");
+	test_strmap_init(&ctx);
+
+	sync = test_strmap_sync_init(&ctx, 20);
+	for (uid = 1; uid <= 20; uid++) {
+		test_strmap_add(&ctx, sync, uid, 0, "<a@example.com>");
+		test_strmap_add(&ctx, sync, uid, 2,
+				t_strdup_printf("<%u@example.com>", uid));
+	}
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(ctx.remap_count == 0);
+	test_strmap_view_close(&ctx);
+
+	/* Expunge most of the mails. The new mail has only unique strings,
+	   so the highest string index grows too large compared to the
+	   number of strings in use, and the indexes are renumbered. */
+	for (uid = 2; uid <= 20; uid++)
+		test_strmap_expunge(&ctx, uid);
+	sync = test_strmap_sync_init(&ctx, 21);
+	mail_index_strmap_view_sync_add_unique(sync, 21, 0);
+	for (i = 2; i <= 10; i++)
+		mail_index_strmap_view_sync_add_unique(sync, 21, i);
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(ctx.remap_count == 1);
+
+	/* only mails 1 and 21 are left, with densely numbered strings */
+	array_foreach(ctx.recs, rec)
+		test_assert(rec->uid == 1 || rec->uid == 21);
+	test_assert(array_count(ctx.recs) == 12);
+	highest_idx = test_strmap_highest_idx(&ctx);
+	test_assert(highest_idx == 12);
+	idx_a = test_strmap_get_str_idx(&ctx, 1, 0);
+	test_strmap_view_close(&ctx);
+
+	/* the recreated hash table still finds the strings */
+	sync = test_strmap_sync_init(&ctx, 22);
+	test_strmap_add(&ctx, sync, 22, 0, "<a@example.com>");
+	test_strmap_add(&ctx, sync, 22, 2, "<1@example.com>");
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(test_strmap_get_str_idx(&ctx, 22, 0) == idx_a);
+	test_assert(test_strmap_get_str_idx(&ctx, 22, 2) ==
+		    test_strmap_get_str_idx(&ctx, 1, 2));
+	test_strmap_view_close(&ctx);
+
+	test_strmap_deinit(&ctx);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_index_strmap_insert,
+		test_mail_index_strmap_replace,
+		test_mail_index_strmap_expunge_fallback,
+		test_mail_index_strmap_resize,
+		test_mail_index_strmap_renumber,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -158,11 +158,77 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void test_mail_index_mmap_append_mails(struct mail_index *index,
+					      uint32_t first_uid, uint32_t count)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 12345;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	if (first_uid == 1) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uint32_t uid = first_uid; uid < first_uid + count; uid++)
+		mail_index_append(trans, uid, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_SEEN);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_assert(mail_index_refresh(index) == 0);
+}
+
+static void test_mail_index_mmap_append(void)
+{
+	struct mail_index *index;
+	const struct mail_index_record *rec;
+	uint32_t file_seq, count = MAIL_INDEX_MMAP_MIN_SIZE / 8;
+	uoff_t file_offset;
+
+	test_begin("mail index mmap append");
+	index = test_mail_index_init();
+	test_mail_index_mmap_append_mails(index, 1, count);
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+						   &file_seq, &file_offset) == 0);
+	mail_index_write(index, TRUE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+	test_mail_index_close(&index);
+
+	/* The reopened index is large enough to be mmap()ed. Appending
+	   to it shouldn't move the records to memory. */
+	index = test_mail_index_open();
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index->map));
+	test_mail_index_mmap_append_mails(index, count + 1, 10);
+	test_assert(!MAIL_INDEX_MAP_IS_IN_MEMORY(index->map));
+	test_assert(index->map->hdr.messages_count == count + 10);
+	test_assert(index->map->hdr.seen_messages_count == 2);
+	for (uint32_t seq = 1; seq <= count + 10; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(index->map, seq);
+		test_assert_idx(rec->uid == seq, seq);
+		test_assert_idx(((rec->flags & MAIL_SEEN) != 0) ==
+				(seq == count || seq == count + 10), seq);
+	}
+
+	/* Once the reserved space runs out, the map is moved to memory. */
+	test_mail_index_mmap_append_mails(index, count + 11, count * 2);
+	test_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(index->map));
+	test_assert(index->map->hdr.messages_count == count * 3 + 10);
+	rec = MAIL_INDEX_REC_AT_SEQ(index->map, count * 3 + 10);
+	test_assert(rec->uid == count * 3 + 10);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_mmap_append,
 		NULL
 	};
 	return test_run(test_functions);
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 
 static bool log_lock_failure = FALSE;
+static unsigned int log_unlock_count = 0;
 
 void mail_index_file_set_syscall_error(struct mail_index *index ATTR_UNUSED,
 				       const char *filepath ATTR_UNUSED,
@@ -23,7 +24,10 @@ int mail_transaction_log_lock_head(struct mail_transaction_log *log ATTR_UNUSED,
 }
 
 void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file ATTR_UNUSED,
-				      const char *lock_reason ATTR_UNUSED) {}
+				      const char *lock_reason ATTR_UNUSED)
+{
+	log_unlock_count++;
+}
 
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data ATTR_UNUSED,
@@ -116,6 +120,51 @@ static void test_append_sync_offset(struct mail_transaction_log *log)
 	test_end();
 }
 
+static void
+test_append_group_commit(struct mail_transaction_log *log, int fd)
+{
+	static unsigned int buf[] = { 0x12345678 };
+	struct mail_transaction_log_file *file = log->head;
+	struct mail_transaction_log_append_ctx *ctx;
+	uoff_t old_sync_offset;
+	struct stat st;
+	int fds[2];
+
+	test_begin("transaction log append: group commit");
+	log->index->optimization_set.log.group_commit = TRUE;
+	file->fd = fd;
+	old_sync_offset = file->sync_offset;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf[0], sizeof(buf[0]));
+	ctx->want_fsync = TRUE;
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	if (fstat(fd, &st) < 0) i_fatal("fstat() failed: %m");
+	test_assert(st.st_size > 1);
+	test_assert(file->sync_offset > old_sync_offset);
+
+	/* fdatasync() fails for pipes. The failure is noticed only after
+	   the log was already unlocked. */
+	if (pipe(fds) < 0)
+		i_fatal("pipe() failed: %m");
+	file->fd = fds[1];
+	log_unlock_count = 0;
+	old_sync_offset = file->sync_offset;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&buf[0], sizeof(buf[0]));
+	ctx->want_fsync = TRUE;
+	test_assert(mail_transaction_log_append_commit(&ctx) < 0);
+	test_assert(log_unlock_count == 1);
+	test_assert(file->sync_offset > old_sync_offset);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	file->fd = -1;
+	log->index->optimization_set.log.group_commit = FALSE;
+	test_end();
+}
+
 static void test_mail_transaction_log_append(void)
 {
 	struct mail_transaction_log *log;
@@ -134,6 +183,7 @@ static void test_mail_transaction_log_append(void)
 	log->index = i_new(struct mail_index, 1);
 	log->index->log = log;
 	log->head = file = i_new(struct mail_transaction_log_file, 1);
+	file->log = log;
 	file->fd = -1;
 
 	test_append_expunge(log);
@@ -159,6 +209,8 @@ static void test_mail_transaction_log_append(void)
 	file->fd = -1;
 	test_end();
 
+	test_append_group_commit(log, fd);
+
 	buffer_free(&log->head->buffer);
 	i_free(log->head);
 	i_free(log->index);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "hostpid.h"
+#include "message-header-parser.h"
 #include "settings-parser.h"
 #include "mail-storage-settings.h"
 #include "smtp-submit-settings.h"
@@ -27,6 +28,7 @@ static const struct setting_define lda_setting_defines[] = {
 	DEF(STR, deliver_log_format),
 	DEF(STR, recipient_delimiter),
 	DEF(STR, lda_original_recipient_header),
+	DEF(STR, lda_precache_fields),
 	DEF(BOOL, quota_full_tempfail),
 	DEF(BOOL, lda_mailbox_autocreate),
 	DEF(BOOL, lda_mailbox_autosubscribe),
@@ -42,6 +44,7 @@ static const struct lda_settings lda_default_settings = {
 	.deliver_log_format = "msgid=%m: %$",
 	.recipient_delimiter = "+",
 	.lda_original_recipient_header = "",
+	.lda_precache_fields = "",
 	.quota_full_tempfail = FALSE,
 	.lda_mailbox_autocreate = FALSE,
 	.lda_mailbox_autosubscribe = FALSE
@@ -70,11 +73,23 @@ const struct setting_parser_info lda_setting_parser_info = {
 };
 
 static bool lda_settings_check(void *_set, pool_t pool,
-	const char **error_r ATTR_UNUSED)
+	const char **error_r)
 {
 	struct lda_settings *set = _set;
+	const char *const *arr;
 
 	if (*set->hostname == '\0')
 		set->hostname = p_strdup(pool, my_hostdomain());
+
+	arr = t_strsplit_spaces(set->lda_precache_fields, " ,");
+	for (; *arr != NULL; arr++) {
+		if (strncasecmp(*arr, "hdr.", 4) == 0 &&
+		    !message_header_name_is_valid(*arr + 4)) {
+			*error_r = t_strdup_printf(
+				"Invalid lda_precache_fields: "
+				"%s is not a valid header name", *arr);
+			return FALSE;
+		}
+	}
 	return TRUE;
 }
@@ -10,6 +10,7 @@ struct lda_settings {
 	const char *deliver_log_format;
 	const char *recipient_delimiter;
 	const char *lda_original_recipient_header;
+	const char *lda_precache_fields;
 
 	bool quota_full_tempfail;
 	bool lda_mailbox_autocreate;
@@ -15,6 +15,7 @@
 #include "mail-namespace.h"
 #include "mail-storage-private.h"
 #include "mail-duplicate.h"
+#include "mail-attachment-cache.h"
 #include "mail-deliver.h"
 
 #define DUPLICATE_DB_NAME "lda-dupes"
@@ -52,6 +53,25 @@ static const char *lda_log_wanted_headers[] = {
 };
 static enum mail_fetch_field lda_log_wanted_fetch_fields =
 	MAIL_FETCH_PHYSICAL_SIZE | MAIL_FETCH_VIRTUAL_SIZE;
+/* lda_precache_fields names -> fields. The names are the same as in
+   mail_cache_fields. */
+static const struct {
+	const char *name;
+	enum mail_fetch_field field;
+} lda_precache_field_names[] = {
+	{ "flags", 0 },
+	{ "date.sent", MAIL_FETCH_DATE },
+	{ "date.received", MAIL_FETCH_RECEIVED_DATE },
+	{ "date.save", MAIL_FETCH_SAVE_DATE },
+	{ "size.virtual", MAIL_FETCH_VIRTUAL_SIZE },
+	{ "size.physical", MAIL_FETCH_PHYSICAL_SIZE },
+	{ "mime.parts", MAIL_FETCH_MESSAGE_PARTS },
+	{ "mime.parts.data", MAIL_FETCH_IMAP_BODYSTRUCTURE },
+	{ "imap.body", MAIL_FETCH_IMAP_BODY },
+	{ "imap.bodystructure", MAIL_FETCH_IMAP_BODYSTRUCTURE },
+	{ "imap.envelope", MAIL_FETCH_IMAP_ENVELOPE },
+	{ "body.snippet", MAIL_FETCH_BODY_SNIPPET },
+};
 static MODULE_CONTEXT_DEFINE_INIT(mail_deliver_user_module,
 				  &mail_user_module_register);
 static MODULE_CONTEXT_DEFINE_INIT(mail_deliver_storage_module,
@@ -221,6 +241,7 @@ void mail_deliver_session_deinit(struct mail_deliver_session **_session)
 	struct mail_deliver_session *session = *_session;
 
 	*_session = NULL;
+	mail_attachment_cache_deinit(&session->attachment_cache);
 	pool_unref(&session->pool);
 }
 
@@ -367,6 +388,46 @@ mail_deliver_open_mail(struct mailbox *box, uint32_t uid,
 	return mail;
 }
 
+static void
+mail_deliver_add_precache_fields(struct mail_deliver_context *ctx,
+				 struct mail *dest_mail)
+{
+	struct mailbox_header_lookup_ctx *headers_ctx = NULL;
+	ARRAY_TYPE(const_string) headers;
+	enum mail_fetch_field fields = 0;
+	const char *const *names, *name;
+	unsigned int i;
+
+	t_array_init(&headers, 8);
+	names = t_strsplit_spaces(ctx->set->lda_precache_fields, " ,");
+	for (; *names != NULL; names++) {
+		if (strncasecmp(*names, "hdr.", 4) == 0) {
+			name = *names + 4;
+			array_push_back(&headers, &name);
+			continue;
+		}
+		for (i = 0; i < N_ELEMENTS(lda_precache_field_names); i++) {
+			name = lda_precache_field_names[i].name;
+			if (strcasecmp(*names, name) == 0)
+				break;
+		}
+		if (i == N_ELEMENTS(lda_precache_field_names)) {
+			e_error(ctx->event, "lda_precache_fields: "
+				"Unknown cache field name '%s', ignoring",
+				*names);
+		} else {
+			fields |= lda_precache_field_names[i].field;
+		}
+	}
+	if (array_count(&headers) > 0) {
+		array_append_zero(&headers);
+		headers_ctx = mailbox_header_lookup_init(dest_mail->box,
+							 array_front(&headers));
+	}
+	mail_add_temp_wanted_fields(dest_mail, fields, headers_ctx);
+	mailbox_header_lookup_unref(&headers_ctx);
+}
+
 int mail_deliver_save(struct mail_deliver_context *ctx, const char *mailbox,
 		      enum mail_flags flags, const char *const *keywords,
 		      struct mail_storage **storage_r)
@@ -427,7 +488,13 @@ int mail_deliver_save(struct mail_deliver_context *ctx, const char *mailbox,
 	dest_mail = mailbox_save_get_dest_mail(save_ctx);
 	mail_add_temp_wanted_fields(dest_mail, lda_log_wanted_fetch_fields, NULL);
 	mailbox_header_lookup_unref(&headers_ctx);
+	if (ctx->set->lda_precache_fields[0] != '\0')
+		mail_deliver_add_precache_fields(ctx, dest_mail);
 	mail_deliver_deduplicate_guid_if_needed(ctx->session, save_ctx);
+	if (ctx->session->attachment_cache != NULL) {
+		mailbox_save_set_attachment_cache(save_ctx,
+			ctx->session->attachment_cache);
+	}
 
 	if (mailbox_save_using_mail(&save_ctx, ctx->src_mail) < 0)
 		ret = -1;
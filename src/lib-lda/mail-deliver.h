@@ -31,6 +31,9 @@ struct mail_deliver_session {
 
 	/* List of INBOX GUIDs where this mail has already been saved to */
 	ARRAY(guid_128_t) inbox_guids;
+	/* Attachments extracted while saving this mail to earlier
+	   recipients, or NULL if they aren't reused. */
+	struct mail_attachment_cache *attachment_cache;
 };
 
 struct mail_deliver_input {
@@ -13,6 +13,7 @@ struct dlua_pcall_resume_state {
 	dlua_pcall_yieldable_callback_t *callback;
 	void *context;
 	struct timeout *to;
+	struct event *event;
 	int status;
 };
 
@@ -25,6 +26,9 @@ static void call_resume_callback(lua_State *L)
 
 	dlua_tls_clear(L, PCALL_RESUME_STATE);
 
+	dlua_function_event_end(&state->event, state->status < 0 ?
+				lua_tostring(L, -1) : NULL);
+
 	state->callback(L, state->context, state->status);
 
 	i_free(state);
@@ -174,6 +178,7 @@ int dlua_pcall_yieldable(lua_State *L, const char *func_name, int nargs,
 	state = i_new(struct dlua_pcall_resume_state, 1);
 	state->callback = callback;
 	state->context = context;
+	state->event = dlua_function_event_begin(L, func_name);
 
 	dlua_tls_set_ptr(L, PCALL_RESUME_STATE, state);
 
@@ -195,6 +195,12 @@ int dlua_table_get_by_thread(lua_State *L, int idx, int type);
 int dlua_pcall(lua_State *L, const char *func_name, int nargs, int nresults,
 	       const char **error_r);
 
+/* Create an event for calling func_name. dlua_function_event_end() sends it
+   as "lua_function_finished" with the call's duration, so the time spent in
+   each script function can be tracked with metrics. */
+struct event *dlua_function_event_begin(lua_State *L, const char *func_name);
+void dlua_function_event_end(struct event **event, const char *error);
+
 /* dumps current stack as i_debug lines */
 void dlua_dump_stack(lua_State *L);
 
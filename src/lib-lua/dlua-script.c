@@ -73,11 +73,34 @@ struct dlua_script *dlua_script_from_state(lua_State *L)
 	return script;
 }
 
+struct event *dlua_function_event_begin(lua_State *L, const char *func_name)
+{
+	struct dlua_script *script = dlua_script_from_state(L);
+	struct event *event = event_create(script->event);
+
+	event_add_str(event, "function_name", func_name);
+	return event;
+}
+
+void dlua_function_event_end(struct event **_event, const char *error)
+{
+	struct event *event = *_event;
+
+	*_event = NULL;
+	if (error != NULL)
+		event_add_str(event, "error", error);
+	event_set_name(event, "lua_function_finished");
+	e_debug(event, "Function finished%s%s",
+		error == NULL ? "" : ": ", error == NULL ? "" : error);
+	event_unref(&event);
+}
+
 int dlua_pcall(lua_State *L, const char *func_name, int nargs, int nresults,
 	       const char **error_r)
 {
 	/* record the stack position */
 	int ret = 0, debugh_idx, top = lua_gettop(L) - nargs;
+	struct event *event;
 
 	lua_getglobal(L, func_name);
 
@@ -110,15 +133,18 @@ int dlua_pcall(lua_State *L, const char *func_name, int nargs, int nresults,
 		/* record where traceback is so it's easy to get rid of even
 		   if LUA_MULTRET is used. */
 		debugh_idx = lua_gettop(L) - nargs - 1;
+		event = dlua_function_event_begin(L, func_name);
 		ret = lua_pcall(L, nargs, nresults, -(nargs + 2));
 		if (ret != LUA_OK) {
 			*error_r = t_strdup_printf("lua_pcall(%s, %d, %d) failed: %s",
 						   func_name, nargs, nresults,
 						   lua_tostring(L, -1));
+			dlua_function_event_end(&event, lua_tostring(L, -1));
 			/* Remove error and debug handler */
 			lua_pop(L, 2);
 			ret = -1;
 		} else {
+			dlua_function_event_end(&event, NULL);
 			/* remove debug handler from known location */
 			lua_remove(L, debugh_idx);
 			if (nresults == LUA_MULTRET)
@@ -220,6 +246,11 @@ static struct dlua_script *dlua_create_script(const char *name,
 	event_add_str(script->event, "script", script->filename);
 	event_add_category(script->event, &event_category_lua);
 
+	/* store pointer as light data to registry before calling the script */
+	lua_pushstring(script->L, LUA_SCRIPT_REGISTRY_KEY);
+	lua_pushlightuserdata(script->L, script);
+	lua_settable(script->L, LUA_REGISTRYINDEX);
+
 	dlua_init_thread_table(script);
 
 	DLLIST_PREPEND(&dlua_scripts, script);
@@ -257,11 +288,6 @@ static int dlua_run_script(struct dlua_script *script, const char **error_r)
 static int
 dlua_script_create_finish(struct dlua_script *script, const char **error_r)
 {
-	/* store pointer as light data to registry before calling the script */
-	lua_pushstring(script->L, LUA_SCRIPT_REGISTRY_KEY);
-	lua_pushlightuserdata(script->L, script);
-	lua_settable(script->L, LUA_REGISTRYINDEX);
-
 	if (dlua_run_script(script, error_r) < 0)
 		return -1;
 	i_assert(lua_gettop(script->L) == 0);
@@ -291,11 +317,34 @@ int dlua_script_create_string(const char *str, struct dlua_script **script_r,
 	return -1;
 }
 
+static struct dlua_script *
+dlua_script_find_loaded(const char *file, struct event *event_parent)
+{
+	struct dlua_script *script;
+
+	for (script = dlua_scripts; script != NULL; script = script->next) {
+		if (script->in == NULL && script->filename != NULL &&
+		    strcmp(script->filename, file) == 0 &&
+		    event_get_parent(script->event) == event_parent)
+			return script;
+	}
+	return NULL;
+}
+
 int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 			    struct event *event_parent, const char **error_r)
 {
 	struct dlua_script *script;
 
+	/* Reuse the already loaded script, so e.g. passdb and userdb using
+	   the same file share the same compiled state. The parent event must
+	   match, so scripts aren't shared between different users. */
+	if ((script = dlua_script_find_loaded(file, event_parent)) != NULL) {
+		dlua_script_ref(script);
+		*script_r = script;
+		return 0;
+	}
+
 	/* lua reports file access errors poorly */
 	if (access(file, O_RDONLY) < 0) {
 		if (errno == EACCES)
@@ -4,6 +4,8 @@
 #include "dlua-script-private.h"
 
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 static int dlua_test_assert(lua_State *L)
 {
@@ -461,11 +463,51 @@ static void test_compat_tointegerx_and_isinteger(void)
 	test_end();
 }
 
+static void test_script_reuse(void)
+{
+	static const char *luascript = "function lua_function()\nend\n";
+	const char *path = ".test-lua-reuse.lua";
+	struct dlua_script *script1, *script2, *script3;
+	struct event *event = event_create(NULL);
+	const char *error;
+	int fd;
+
+	test_begin("lua script reuse");
+
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write(fd, luascript, strlen(luascript)) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+
+	test_assert(dlua_script_create_file(path, &script1, NULL, &error) == 0);
+	test_assert(dlua_script_init(script1, &error) == 0);
+	/* the same file is loaded only once */
+	test_assert(dlua_script_create_file(path, &script2, NULL, &error) == 0);
+	test_assert(script1 == script2);
+	test_assert(dlua_script_init(script2, &error) == 0);
+	test_assert(dlua_pcall(script2->L, "lua_function", 0, 0, &error) == 0);
+	/* different parent events don't share the script */
+	test_assert(dlua_script_create_file(path, &script3, event, &error) == 0);
+	test_assert(script3 != script1);
+
+	dlua_script_unref(&script3);
+	dlua_script_unref(&script2);
+	test_assert(dlua_pcall(script1->L, "lua_function", 0, 0, &error) == 0);
+	dlua_script_unref(&script1);
+	event_unref(&event);
+	i_unlink(path);
+
+	test_end();
+}
+
 int main(void) {
 	void (*tests[])(void) = {
 		test_lua,
 		test_tls,
 		test_compat_tointegerx_and_isinteger,
+		test_script_reuse,
 		NULL
 	};
 
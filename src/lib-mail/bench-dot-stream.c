@@ -0,0 +1,134 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "istream-crlf.h"
+#include "ostream.h"
+#include "istream-dot.h"
+#include "ostream-dot.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* Every SMTP/LMTP DATA command and mail delivery passes the message through
+   these streams: ostream-dot (dot-stuffing and LF -> CRLF when sending),
+   istream-dot (removing the dot-stuffing when receiving) and
+   istream-crlf/lf. The input is a synthetic message with typical 70-80 byte
+   lines, some of which begin with a dot. */
+
+#define BENCH_MESSAGE_LINES 20000
+
+struct bench_dot_context {
+	const buffer_t *input;
+	buffer_t *output;
+	bool crlf;
+};
+
+static void bench_create_message(string_t *lf_msg, string_t *crlf_msg)
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_MESSAGE_LINES; i++) {
+		if (i % 50 == 0)
+			str_append(lf_msg, ".");
+		str_printfa(lf_msg, "Line %u of the message body with enough "
+			    "text to look like normal mail content\n", i);
+	}
+	for (i = 0; i < str_len(lf_msg); i++) {
+		if (str_data(lf_msg)[i] == '\n')
+			str_append_c(crlf_msg, '\r');
+		str_append_c(crlf_msg, str_data(lf_msg)[i]);
+	}
+}
+
+static void
+bench_istream_read(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	while (i_stream_read_more(input, &data, &size) > 0)
+		i_stream_skip(input, size);
+	i_assert(input->stream_errno == 0);
+}
+
+static void bench_ostream_dot(struct bench_dot_context *ctx)
+{
+	struct ostream *buf_output, *dot_output;
+
+	buffer_set_used_size(ctx->output, 0);
+	buf_output = o_stream_create_buffer(ctx->output);
+	dot_output = o_stream_create_dot(buf_output, FALSE);
+	o_stream_nsend(dot_output, ctx->input->data, ctx->input->used);
+	if (o_stream_finish(dot_output) < 0)
+		i_unreached();
+	o_stream_unref(&dot_output);
+	o_stream_unref(&buf_output);
+}
+
+static void bench_istream_dot(struct bench_dot_context *ctx)
+{
+	struct istream *input, *dot_input;
+
+	input = i_stream_create_from_data(ctx->input->data, ctx->input->used);
+	dot_input = i_stream_create_dot(input, TRUE);
+	bench_istream_read(dot_input);
+	i_stream_unref(&dot_input);
+	i_stream_unref(&input);
+}
+
+static void bench_istream_crlf(struct bench_dot_context *ctx)
+{
+	struct istream *input, *conv_input;
+
+	input = i_stream_create_from_data(ctx->input->data, ctx->input->used);
+	conv_input = ctx->crlf ? i_stream_create_crlf(input) :
+		i_stream_create_lf(input);
+	bench_istream_read(conv_input);
+	i_stream_unref(&conv_input);
+	i_stream_unref(&input);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_dot_context ctx;
+	string_t *lf_msg, *crlf_msg;
+
+	lib_init();
+
+	if (argc > 1)
+		i_fatal("Usage: %s", argv[0]);
+
+	lf_msg = str_new(default_pool, BENCH_MESSAGE_LINES * 80);
+	crlf_msg = str_new(default_pool, BENCH_MESSAGE_LINES * 82);
+	bench_create_message(lf_msg, crlf_msg);
+	printf("%zu bytes of CRLF input\n", str_len(crlf_msg));
+
+	i_zero(&ctx);
+	ctx.input = crlf_msg;
+	ctx.output = buffer_create_dynamic(default_pool, crlf_msg->used * 2);
+	test_bench_run("ostream-dot", ctx.input->used,
+		       bench_ostream_dot, &ctx, NULL);
+
+	/* istream-dot reads what ostream-dot wrote */
+	ctx.input = ctx.output;
+	test_bench_run("istream-dot", ctx.input->used,
+		       bench_istream_dot, &ctx, NULL);
+
+	ctx.input = lf_msg;
+	ctx.crlf = TRUE;
+	test_bench_run("istream-crlf (LF input)", ctx.input->used,
+		       bench_istream_crlf, &ctx, NULL);
+	ctx.input = crlf_msg;
+	ctx.crlf = FALSE;
+	test_bench_run("istream-lf (CRLF input)", ctx.input->used,
+		       bench_istream_crlf, &ctx, NULL);
+
+	buffer_free(&ctx.output);
+	str_free(&lf_msg);
+	str_free(&crlf_msg);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "message-parser.h"
+#include "message-decoder.h"
+#include "mail-html2text.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* This is the body text extraction pipeline used by FTS indexing:
+   message_parser -> message_decoder (transfer encoding and charset) ->
+   mail_html2text for text/html parts. The default corpus is synthetic
+   newsletter-style multipart/alternative messages with quoted-printable
+   Latin-1 text and markup-heavy HTML parts. */
+
+#define BENCH_SYNTHETIC_MESSAGES 100
+
+struct bench_decoder_context {
+	bool html2text;
+	pool_t pool;
+	struct message_decoder_context *decoder;
+	buffer_t *output;
+	/* Text bytes produced by the last run */
+	uoff_t text_bytes;
+};
+
+static struct test_bench_corpus corpus;
+
+static void bench_add_synthetic_message(unsigned int n)
+{
+	string_t *str = str_new(default_pool, 1024*128);
+	unsigned int i;
+
+	str_printfa(str, "From: <news@example.com>\r\n"
+		    "To: <recipient@example.com>\r\n"
+		    "Subject: Weekly newsletter #%u\r\n"
+		    "MIME-Version: 1.0\r\n"
+		    "Content-Type: multipart/alternative; boundary=\"alt\"\r\n"
+		    "\r\n"
+		    "--alt\r\n"
+		    "Content-Type: text/plain; charset=iso-8859-1\r\n"
+		    "Content-Transfer-Encoding: quoted-printable\r\n"
+		    "\r\n", n);
+	for (i = 0; i < 100; i++) {
+		str_append(str, "Caf=E9 cr=E8me br=FBl=E9e offers this week, "
+			   "don't miss the d=E9j=E0 vu sale at our store=\r\n"
+			   " - read more at https://www.example.com/\r\n");
+	}
+	str_append(str, "--alt\r\n"
+		   "Content-Type: text/html; charset=iso-8859-1\r\n"
+		   "Content-Transfer-Encoding: quoted-printable\r\n"
+		   "\r\n"
+		   "<html><head><style type=3D\"text/css\">\r\n");
+	for (i = 0; i < 50; i++) {
+		str_printfa(str, ".c%u { font-family: Arial, sans-serif; "
+			    "color: #333333; padding: 0 10px; }\r\n", i);
+	}
+	str_append(str, "</style></head><body>\r\n"
+		   "<!-- tracking comment, not indexed -->\r\n");
+	for (i = 0; i < 100; i++) {
+		str_printfa(str, "<table width=3D\"600\" cellpadding=3D\"0\" "
+			    "align=3Dcenter><tr><td class=3D\"c%u\" style=3D\""
+			    "font-size:14px;line-height:20px\">\r\n"
+			    "<a href=3D\"https://www.example.com/item/%u?"
+			    "utm_source=3Dnewsletter&amp;utm_medium=3Demail\">"
+			    "Caf=E9 cr=E8me</a> &amp; br=FBl=E9e &ndash; "
+			    "only &euro;9,90 this week!<br/></td></tr>"
+			    "</table>\r\n", i % 50, i);
+	}
+	str_append(str, "</body></html>\r\n"
+		   "--alt--\r\n");
+	test_bench_corpus_add(&corpus, str);
+}
+
+static void bench_message_decoder_run(struct bench_decoder_context *ctx)
+{
+	struct message_parser_settings parser_set = {
+		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
+	};
+	struct message_parser_ctx *parser;
+	struct message_block raw_block, block;
+	struct message_part *parts, *prev_part;
+	struct mail_html2text *ht = NULL;
+	struct istream *input;
+	buffer_t *buf;
+	int ret;
+
+	ctx->text_bytes = 0;
+	array_foreach_elem(&corpus.items, buf) {
+		input = i_stream_create_from_buffer(buf);
+		parser = message_parser_init(ctx->pool, input, &parser_set);
+		prev_part = NULL;
+		while ((ret = message_parser_parse_next_block(parser,
+							      &raw_block)) > 0) {
+			if (raw_block.part != prev_part) {
+				mail_html2text_deinit(&ht);
+				prev_part = raw_block.part;
+			}
+			if (!message_decoder_decode_next_block(ctx->decoder,
+					&raw_block, &block))
+				continue;
+			if (block.hdr != NULL)
+				continue;
+			if (block.size == 0) {
+				/* end of headers */
+				if (ctx->html2text &&
+				    mail_html2text_content_type_match(
+					message_decoder_current_content_type(ctx->decoder)))
+					ht = mail_html2text_init(0);
+				continue;
+			}
+			if (ht == NULL) {
+				ctx->text_bytes += block.size;
+				continue;
+			}
+			buffer_set_used_size(ctx->output, 0);
+			mail_html2text_more(ht, block.data, block.size,
+					    ctx->output);
+			ctx->text_bytes += ctx->output->used;
+		}
+		i_assert(ret < 0);
+		mail_html2text_deinit(&ht);
+		message_parser_deinit(&parser, &parts);
+		message_decoder_decode_reset(ctx->decoder);
+		i_stream_unref(&input);
+		p_clear(ctx->pool);
+	}
+}
+
+static void bench_message_decoder(const char *name, bool html2text)
+{
+	struct bench_decoder_context ctx = {
+		.html2text = html2text,
+	};
+
+	ctx.pool = pool_alloconly_create("message parser", 10240);
+	ctx.decoder = message_decoder_init(NULL, 0);
+	ctx.output = buffer_create_dynamic(default_pool, 4096);
+	test_bench_run(name, corpus.size, bench_message_decoder_run, &ctx, NULL);
+	printf("%s: %"PRIuUOFF_T" text bytes\n", name, ctx.text_bytes);
+	buffer_free(&ctx.output);
+	message_decoder_deinit(&ctx.decoder);
+	pool_unref(&ctx.pool);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 1 && argv[1][0] == '-')
+		i_fatal("Usage: %s [<message files or maildirs>]", argv[0]);
+	argv++;
+
+	test_bench_corpus_init(&corpus);
+	if (argv[0] == NULL) {
+		for (i = 0; i < BENCH_SYNTHETIC_MESSAGES; i++)
+			bench_add_synthetic_message(i);
+	} else {
+		for (i = 0; argv[i] != NULL; i++)
+			(void)test_bench_corpus_add_path(&corpus, argv[i], FALSE);
+	}
+	printf("%u messages, %"PRIuUOFF_T" bytes\n",
+	       array_count(&corpus.items), corpus.size);
+
+	bench_message_decoder("parser+decoder", FALSE);
+	bench_message_decoder("parser+decoder+html2text", TRUE);
+
+	test_bench_corpus_deinit(&corpus);
+	lib_deinit();
+	return 0;
+}
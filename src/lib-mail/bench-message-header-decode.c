@@ -0,0 +1,117 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "message-header-parser.h"
+#include "message-header-decode.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* message_header_decode_utf8() is used for each header when building the FTS
+   index and the header cache, and when searching headers. The corpus items
+   are single header values, taken from the given messages (e.g. a copy of a
+   real maildir) or a synthetic mix of plain ASCII, raw UTF-8 and RFC 2047
+   encoded headers using a handful of common charsets. Each charset
+   conversion opens an iconv translation, so the results show both the
+   charset_to_utf8_begin() overhead and the UTF-8 validation throughput. */
+
+static struct test_bench_corpus corpus;
+
+static void bench_add_synthetic_headers(void)
+{
+	static const char *headers[] = {
+		"Re: Quarterly meeting moved to next week",
+		"Alice Example <alice@example.com>, bob@example.com",
+		"<20260101120000.12345@mail.example.com>",
+		"Caf\xC3\xA9 cr\xC3\xA8me br\xC3\xBBl\xC3\xA9\x65 - d\xC3\xA9j\xC3\xA0 vu",
+		"=?iso-8859-1?q?Caf=E9_cr=E8me_br=FBl=E9e?=",
+		"=?ISO-8859-1?Q?J=F6rg_M=FCller?= <joerg@example.com>",
+		"=?utf-8?b?w4TDpMOkIMO2w7bDtiDDvMO8w7w=?=",
+		"=?UTF-8?Q?Re:_Tr=C3=A4ffen_n=C3=A4chste_Woche?=",
+		"=?windows-1252?q?=93Quoted=94_offer_=96_=80_9,90?=",
+		"=?koi8-r?b?68/O1sXSxc7DydE=?= =?koi8-r?b?IMvP3MbGyc7J?=",
+		"=?iso-2022-jp?b?GyRCJUYlOSVIGyhC?= Newsletter",
+		"Fwd: =?iso-8859-15?q?Rechnung_=A4_12?= and plain text",
+	};
+	unsigned int i, n;
+
+	for (n = 0; n < 100; n++) {
+		for (i = 0; i < N_ELEMENTS(headers); i++)
+			test_bench_corpus_add_data(&corpus, headers[i],
+						   strlen(headers[i]));
+	}
+}
+
+static void bench_add_message_headers(const buffer_t *msg)
+{
+	struct message_header_parser_ctx *parser;
+	struct message_header_line *hdr;
+	struct istream *input;
+
+	input = i_stream_create_from_buffer(msg);
+	parser = message_parse_header_init(input, NULL,
+		MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE);
+	while (message_parse_header_next(parser, &hdr) > 0) {
+		if (hdr->eoh)
+			break;
+		if (hdr->continues) {
+			hdr->use_full_value = TRUE;
+			continue;
+		}
+		test_bench_corpus_add_data(&corpus, hdr->full_value,
+					   hdr->full_value_len);
+	}
+	message_parse_header_deinit(&parser);
+	i_stream_unref(&input);
+}
+
+static void bench_message_header_decode(buffer_t *output)
+{
+	buffer_t *buf;
+
+	array_foreach_elem(&corpus.items, buf) {
+		buffer_set_used_size(output, 0);
+		message_header_decode_utf8(buf->data, buf->used, output, NULL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_bench_corpus messages;
+	buffer_t *buf;
+
+	lib_init();
+
+	if (argc > 1 && argv[1][0] == '-')
+		i_fatal("Usage: %s [<message files or maildirs>]", argv[0]);
+	argv++;
+
+	test_bench_corpus_init(&corpus);
+	if (argv[0] == NULL)
+		bench_add_synthetic_headers();
+	else {
+		test_bench_corpus_init(&messages);
+		for (; *argv != NULL; argv++)
+			(void)test_bench_corpus_add_path(&messages, *argv, FALSE);
+		array_foreach_elem(&messages.items, buf)
+			bench_add_message_headers(buf);
+		test_bench_corpus_deinit(&messages);
+	}
+	if (array_count(&corpus.items) == 0)
+		i_fatal("No headers found");
+	printf("%u headers, %"PRIuUOFF_T" bytes\n",
+	       array_count(&corpus.items), corpus.size);
+
+	buf = buffer_create_dynamic(default_pool, 1024);
+	test_bench_run("message_header_decode_utf8", corpus.size,
+		       bench_message_header_decode, buf, NULL);
+	buffer_free(&buf);
+
+	test_bench_corpus_deinit(&corpus);
+	lib_deinit();
+	return 0;
+}
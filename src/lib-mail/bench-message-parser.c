@@ -0,0 +1,154 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "message-parser.h"
+#include "message-header-parser.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* Each run parses the whole corpus from memory, so the results don't include
+   any disk I/O. Without any files or maildirs on the command line the corpus
+   is synthetic multipart messages with long body lines, a lot of header
+   lines and nested boundaries. */
+
+#define BENCH_SYNTHETIC_MESSAGES 100
+
+static struct test_bench_corpus corpus;
+
+static const struct message_parser_settings bench_parser_set = {
+	.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
+		MESSAGE_HEADER_PARSER_FLAG_DROP_CR,
+};
+
+static void bench_add_synthetic_message(unsigned int n)
+{
+	string_t *str = str_new(default_pool, 1024*64);
+	unsigned int i, j;
+
+	str_append(str, "From: <sender@example.com>\r\n"
+		   "To: <recipient@example.com>\r\n"
+		   "Subject: benchmark message\r\n");
+	for (i = 0; i < 30; i++) {
+		str_printfa(str, "Received: from host%u.example.com\r\n"
+			    "\tby mx.example.com with ESMTP id %u.%u;\r\n"
+			    "\tMon, 1 Jan 2024 00:00:00 +0000\r\n", i, n, i);
+	}
+	str_append(str, "MIME-Version: 1.0\r\n"
+		   "Content-Type: multipart/mixed; boundary=\"outer\"\r\n"
+		   "\r\n"
+		   "--outer\r\n"
+		   "Content-Type: multipart/alternative; boundary=\"inner\"\r\n"
+		   "\r\n");
+	for (i = 0; i < 2; i++) {
+		str_append(str, "--inner\r\n"
+			   "Content-Type: text/plain; charset=utf-8\r\n"
+			   "\r\n");
+		for (j = 0; j < 200; j++) {
+			str_append(str, "Lorem ipsum dolor sit amet, consectetur "
+				   "adipiscing elit, sed do eiusmod tempor "
+				   "incididunt ut labore et dolore magna "
+				   "aliqua - ut enim ad minim veniam.\r\n");
+		}
+	}
+	str_append(str, "--inner--\r\n"
+		   "--outer\r\n"
+		   "Content-Type: application/octet-stream\r\n"
+		   "Content-Transfer-Encoding: base64\r\n"
+		   "\r\n");
+	for (j = 0; j < 500; j++) {
+		str_append(str, "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaG"
+			   "lqa2xtbm9wcXJzdHV2d3h5ejAxMjM0NTY3\r\n");
+	}
+	str_append(str, "--outer--\r\n");
+	test_bench_corpus_add(&corpus, str);
+}
+
+static void bench_message_parser(pool_t pool)
+{
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct message_part *parts;
+	struct istream *input;
+	buffer_t *buf;
+	int ret;
+
+	array_foreach_elem(&corpus.items, buf) {
+		input = i_stream_create_from_buffer(buf);
+		parser = message_parser_init(pool, input, &bench_parser_set);
+		while ((ret = message_parser_parse_next_block(parser,
+							      &block)) > 0) ;
+		i_assert(ret < 0);
+		message_parser_deinit(&parser, &parts);
+		i_stream_unref(&input);
+		p_clear(pool);
+	}
+}
+
+static void
+bench_header_callback(struct message_header_line *hdr ATTR_UNUSED,
+		      void *context ATTR_UNUSED)
+{
+}
+
+static uoff_t bench_message_header_parser(void *context ATTR_UNUSED)
+{
+	struct message_size hdr_size;
+	struct istream *input;
+	buffer_t *buf;
+	uoff_t total_size = 0;
+
+	array_foreach_elem(&corpus.items, buf) {
+		input = i_stream_create_from_buffer(buf);
+		message_parse_header(input, &hdr_size,
+				     bench_parser_set.hdr_flags,
+				     bench_header_callback, NULL);
+		total_size += hdr_size.physical_size;
+		i_stream_unref(&input);
+	}
+	return total_size;
+}
+
+static void bench_message_header_parser_run(void *context)
+{
+	(void)bench_message_header_parser(context);
+}
+
+int main(int argc, char *argv[])
+{
+	pool_t pool;
+	unsigned int i;
+
+	lib_init();
+
+	if (argc > 1 && argv[1][0] == '-')
+		i_fatal("Usage: %s [<message files or maildirs>]", argv[0]);
+	argv++;
+
+	test_bench_corpus_init(&corpus);
+	if (argv[0] == NULL) {
+		for (i = 0; i < BENCH_SYNTHETIC_MESSAGES; i++)
+			bench_add_synthetic_message(i);
+	} else {
+		for (i = 0; argv[i] != NULL; i++)
+			(void)test_bench_corpus_add_path(&corpus, argv[i], FALSE);
+	}
+	printf("%u messages, %"PRIuUOFF_T" bytes\n",
+	       array_count(&corpus.items), corpus.size);
+
+	pool = pool_alloconly_create("message parser", 10240);
+	test_bench_run("message parser", corpus.size,
+		       bench_message_parser, pool, NULL);
+	pool_unref(&pool);
+	test_bench_run("message header parser",
+		       bench_message_header_parser(NULL),
+		       bench_message_header_parser_run, NULL, NULL);
+
+	test_bench_corpus_deinit(&corpus);
+	lib_deinit();
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include "ostream.h"
 #include "base64.h"
 #include "buffer.h"
+#include "crc32.h"
 #include "str.h"
 #include "hash-format.h"
 #include "rfc822-parser.h"
@@ -42,6 +43,11 @@ struct attachment_istream_part {
 	bool base64_have_crlf; /* CRLF linefeeds */
 	bool base64_failed;
 
+	/* an identical attachment may have been extracted already. only
+	   the crc32 is calculated until it's known for sure. */
+	bool reuse;
+	uint32_t crc32;
+
 	int temp_fd;
 	struct ostream *temp_output;
 	buffer_t *part_buf;
@@ -173,7 +179,7 @@ static int astream_base64_decode_lf(struct attachment_istream_part *part)
 
 static int
 astream_try_base64_decode_char(struct attachment_istream_part *part,
-			       size_t pos, char chr)
+			       uoff_t offset, char chr)
 {
 	switch (part->base64_state) {
 	case BASE64_STATE_0:
@@ -201,7 +207,7 @@ astream_try_base64_decode_char(struct attachment_istream_part *part,
 			return -1;
 		break;
 	case BASE64_STATE_3:
-		part->base64_bytes = part->temp_output->offset + pos + 1;
+		part->base64_bytes = offset + 1;
 		if (base64_is_valid_char(chr)) {
 			part->base64_state = BASE64_STATE_0;
 			part->cur_base64_blocks++;
@@ -234,7 +240,7 @@ astream_try_base64_decode_char(struct attachment_istream_part *part,
 		if (chr != '=')
 			return -1;
 
-		part->base64_bytes = part->temp_output->offset + pos + 1;
+		part->base64_bytes = offset + 1;
 		part->base64_state = BASE64_STATE_EOM;
 		part->cur_base64_blocks++;
 
@@ -251,7 +257,7 @@ astream_try_base64_decode_char(struct attachment_istream_part *part,
 }
 
 static void
-astream_try_base64_decode(struct attachment_istream_part *part,
+astream_try_base64_decode(struct attachment_istream_part *part, uoff_t offset,
 			  const unsigned char *data, size_t size)
 {
 	size_t i;
@@ -261,7 +267,8 @@ astream_try_base64_decode(struct attachment_istream_part *part,
 		return;
 
 	for (i = 0; i < size; i++) {
-		ret = astream_try_base64_decode_char(part, i, (char)data[i]);
+		ret = astream_try_base64_decode_char(part, offset + i,
+						     (char)data[i]);
 		if (ret <= 0) {
 			if (ret < 0)
 				part->base64_failed = TRUE;
@@ -286,6 +293,21 @@ static int astream_open_output(struct attachment_istream *astream)
 	return 0;
 }
 
+static void astream_part_add(struct attachment_istream *astream,
+			     const unsigned char *data, size_t size)
+{
+	struct attachment_istream_part *part = &astream->part;
+
+	if (astream->set.reuse_attachment != NULL)
+		part->crc32 = crc32_data_more(part->crc32, data, size);
+	if (!part->reuse) {
+		astream_try_base64_decode(part, part->temp_output->offset,
+					  data, size);
+		hash_format_loop(astream->set.hash_format, data, size);
+	}
+	o_stream_nsend(part->temp_output, data, size);
+}
+
 static void astream_add_body(struct attachment_istream *astream,
 			     const struct message_block *block)
 {
@@ -321,18 +343,11 @@ static void astream_add_body(struct attachment_istream *astream,
 			break;
 		}
 		part->state = MAIL_ATTACHMENT_STATE_YES;
-		astream_try_base64_decode(part, part_buf->data, part_buf->used);
-		hash_format_loop(astream->set.hash_format,
-				 part_buf->data, part_buf->used);
-		o_stream_nsend(part->temp_output,
-			       part_buf->data, part_buf->used);
+		astream_part_add(astream, part_buf->data, part_buf->used);
 		buffer_set_used_size(part_buf, 0);
 		/* fall through - write the new data to temp file */
 	case MAIL_ATTACHMENT_STATE_YES:
-		astream_try_base64_decode(part, block->data, block->size);
-		hash_format_loop(astream->set.hash_format,
-				 block->data, block->size);
-		o_stream_nsend(part->temp_output, block->data, block->size);
+		astream_part_add(astream, block->data, block->size);
 		break;
 	}
 }
@@ -447,6 +462,65 @@ static int astream_decode_base64(struct attachment_istream *astream,
 	return 0;
 }
 
+static int
+astream_part_try_reuse(struct attachment_istream *astream,
+		       struct istream_attachment_info *info,
+		       const char **error_r)
+{
+	struct attachment_istream_part *part = &astream->part;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	if ((ret = astream->set.reuse_attachment(info, error_r,
+						 astream->context)) <= 0)
+		return ret;
+	i_assert(info->encoded_size <= info->part_size);
+
+	/* add the trailing non-attachment data back to the stream */
+	input = i_stream_create_fd(part->temp_fd, IO_BLOCK_SIZE);
+	i_stream_seek(input, info->encoded_size);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		stream_add_data(astream, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
+}
+
+static int astream_part_rescan(struct attachment_istream *astream,
+			       const char **error_r)
+{
+	struct attachment_istream_part *part = &astream->part;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret = 0;
+
+	/* the attachment couldn't be reused after all. do the base64
+	   validation and hashing that was skipped while reading it. */
+	input = i_stream_create_fd(part->temp_fd, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		astream_try_base64_decode(part, input->v_offset, data, size);
+		hash_format_loop(astream->set.hash_format, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	part->reuse = FALSE;
+	return ret;
+}
+
 static int
 astream_part_finish(struct attachment_istream *astream, const char **error_r)
 {
@@ -469,6 +543,16 @@ astream_part_finish(struct attachment_istream *astream, const char **error_r)
 
 	i_zero(&info);
 	info.start_offset = astream->part.start_offset;
+	info.part_size = part->temp_output->offset;
+	info.part_crc32 = part->crc32;
+	info.part = astream->cur_part;
+	if (part->reuse) {
+		if ((ret = astream_part_try_reuse(astream, &info, error_r)) != 0)
+			return ret < 0 ? -1 : 0;
+		if (astream_part_rescan(astream, error_r) < 0)
+			return -1;
+	}
+
 	/* base64_bytes contains how many valid base64 bytes there are so far.
 	   if the base64 ends properly, it'll specify how much of the MIME part
 	   is saved as an attachment. the rest of the data (typically
@@ -498,7 +582,6 @@ astream_part_finish(struct attachment_istream *astream, const char **error_r)
 	}
 
 	/* open attachment output file */
-	info.part = astream->cur_part;
 	if (!part->base64_failed) {
 		info.base64_blocks_per_line = part->base64_line_blocks;
 		info.base64_have_crlf = part->base64_have_crlf;
@@ -650,6 +733,11 @@ static int astream_read_next(struct attachment_istream *astream, bool *retry_r)
 		if (astream_want_attachment(astream, block.part)) {
 			astream->part.state = MAIL_ATTACHMENT_STATE_MAYBE;
 			astream->part.start_offset = stream->parent->v_offset;
+			astream->part.reuse =
+				astream->set.want_reuse_attachment != NULL &&
+				astream->set.want_reuse_attachment(
+					astream->part.start_offset,
+					astream->context);
 		}
 	} else {
 		astream_add_body(astream, &block);
@@ -706,6 +794,8 @@ i_stream_create_attachment_extractor(struct istream *input,
 	i_assert(set->hash_format != NULL);
 	i_assert(set->open_attachment_ostream != NULL);
 	i_assert(set->close_attachment_ostream != NULL);
+	i_assert(set->want_reuse_attachment == NULL ||
+		 set->reuse_attachment != NULL);
 
 	astream = i_new(struct attachment_istream, 1);
 	astream->part.temp_fd = -1;
@@ -16,6 +16,11 @@ struct istream_attachment_info {
 	unsigned int base64_blocks_per_line;
 	bool base64_have_crlf;
 
+	/* Size and crc32 of the whole MIME part body in the input stream.
+	   Set only when the reuse_attachment() callback is used. */
+	uoff_t part_size;
+	uint32_t part_crc32;
+
 	const struct message_part *part;
 };
 
@@ -47,6 +52,20 @@ struct istream_attachment_settings {
 	   should also set *error. */
 	int (*close_attachment_ostream)(struct ostream *output, bool success,
 					const char **error, void *context);
+
+	/* If non-NULL, called when a wanted MIME part begins. Returns TRUE
+	   if an identical attachment may have already been extracted earlier
+	   at the same start_offset, e.g. when saving the same mail for
+	   another recipient. Such a part's body is only checksummed while
+	   it's read instead of being base64-validated and hashed. */
+	bool (*want_reuse_attachment)(uoff_t start_offset, void *context);
+	/* Called at the end of a part for which want_reuse_attachment()
+	   returned TRUE. info->hash isn't set yet. If the earlier attachment
+	   could be reused, set info->encoded_size to its encoded_size and
+	   return 1. The rest of the part is then added back to the stream.
+	   Return 0 to extract the part normally, -1 on error. */
+	int (*reuse_attachment)(struct istream_attachment_info *info,
+				const char **error_r, void *context);
 };
 
 struct istream *
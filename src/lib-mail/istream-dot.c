@@ -145,6 +145,25 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 
 	data = i_stream_get_data(stream->parent, &size);
 	for (i = 0; i < size && dest < stream->buffer_size; i++) {
+		if (dstream->state == 0 &&
+		    data[i] != '\r' && data[i] != '\n') {
+			/* copy everything until the next LF. CR just before
+			   it (or at the end of the data) is left for the state
+			   machine, other CRs are copied as-is anyway. */
+			const unsigned char *p;
+			size_t len;
+
+			len = I_MIN(size - i, stream->buffer_size - dest);
+			p = memchr(data + i, '\n', len);
+			if (p != NULL)
+				len = p - (data + i);
+			if (data[i + len - 1] == '\r')
+				len--;
+			memcpy(stream->w_buffer + dest, data + i, len);
+			dest += len;
+			i += len - 1;
+			continue;
+		}
 		switch (dstream->state) {
 		case 0:
 			break;
@@ -8,20 +8,35 @@
 #include "istream-private.h"
 #include "istream-header-filter.h"
 
+#include <ctype.h>
+
 struct header_filter_istream_snapshot {
 	struct istream_snapshot snapshot;
 	struct header_filter_istream *mstream;
 	buffer_t *hdr_buf;
 };
 
+struct header_filter_set {
+	pool_t pool;
+	int refcount;
+
+	/* Header names sorted by their length. Headers with the same length
+	   are in names[len_idx[len]..len_idx[len+1]-1]. */
+	const char **names;
+	unsigned int count;
+	unsigned int *len_idx;
+	size_t max_name_len;
+	/* Bitmask of the lowercased first characters of the names */
+	uint8_t first_chars[256 / 8];
+};
+
 struct header_filter_istream {
 	struct istream_private istream;
 	pool_t pool;
 
 	struct message_header_parser_ctx *hdr_ctx;
 
-	const char **headers;
-	unsigned int headers_count;
+	struct header_filter_set *set;
 
 	header_filter_callback *callback;
 	void *context;
@@ -64,6 +79,7 @@ static void i_stream_header_filter_destroy(struct iostream_private *stream)
 
 	if (mstream->hdr_ctx != NULL)
 		message_parse_header_deinit(&mstream->hdr_ctx);
+	header_filter_set_unref(&mstream->set);
 	if (array_is_created(&mstream->match_change_lines))
 		array_free(&mstream->match_change_lines);
 	if (!mstream->snapshot_pending)
@@ -257,14 +273,10 @@ static ssize_t read_header(struct header_filter_istream *mstream)
 			   be very good. However, allow callbacks to modify
 			   the headers in any way they want. */
 			matched = mstream->prev_matched;
-		} else if (mstream->headers_count == 0) {
-			/* no include/exclude headers - default matching */
-			matched = FALSE;
 		} else {
-			matched = i_bsearch(hdr->name, mstream->headers,
-					    mstream->headers_count,
-					    sizeof(*mstream->headers),
-					    bsearch_strcasecmp) != NULL;
+			matched = header_filter_set_match(mstream->set,
+							  hdr->name,
+							  hdr->name_len);
 		}
 		if (mstream->callback == NULL) {
 			/* nothing gets excluded */
@@ -689,17 +701,110 @@ i_stream_header_filter_snapshot(struct istream_private *stream,
 	return &snapshot->snapshot;
 }
 
-#undef i_stream_create_header_filter
+static int header_filter_name_cmp(const char *const *name1,
+				  const char *const *name2)
+{
+	size_t len1 = strlen(*name1), len2 = strlen(*name2);
+
+	if (len1 != len2)
+		return len1 < len2 ? -1 : 1;
+	return strcasecmp(*name1, *name2);
+}
+
+struct header_filter_set *
+header_filter_set_create(const char *const *headers,
+			 unsigned int headers_count)
+{
+	struct header_filter_set *set;
+	const char **names;
+	unsigned int i, j;
+	size_t len;
+	pool_t pool;
+
+	pool = pool_alloconly_create("header filter set", 256);
+	set = p_new(pool, struct header_filter_set, 1);
+	set->pool = pool;
+	set->refcount = 1;
+
+	names = p_new(pool, const char *, I_MAX(headers_count, 1));
+	for (i = 0; i < headers_count; i++)
+		names[i] = p_strdup(pool, headers[i]);
+	i_qsort(names, headers_count, sizeof(*names), header_filter_name_cmp);
+
+	for (i = j = 0; i < headers_count; i++) {
+		if (j > 0 &&
+		    header_filter_name_cmp(&names[j-1], &names[i]) == 0) {
+			/* drop duplicate */
+			continue;
+		}
+		names[j++] = names[i];
+	}
+	set->names = names;
+	set->count = j;
+	set->max_name_len = j == 0 ? 0 : strlen(names[j-1]);
+
+	/* len_idx[len] = index of the first name with at least len chars */
+	set->len_idx = p_new(pool, unsigned int, set->max_name_len + 2);
+	for (i = 0, len = 0; len <= set->max_name_len + 1; len++) {
+		while (i < set->count && strlen(names[i]) < len)
+			i++;
+		set->len_idx[len] = i;
+	}
+	for (i = 0; i < set->count; i++) {
+		unsigned char chr = i_tolower(names[i][0]);
+		set->first_chars[chr / 8] |= 1 << (chr % 8);
+	}
+	return set;
+}
+
+void header_filter_set_ref(struct header_filter_set *set)
+{
+	i_assert(set->refcount > 0);
+	set->refcount++;
+}
+
+void header_filter_set_unref(struct header_filter_set **_set)
+{
+	struct header_filter_set *set = *_set;
+
+	if (set == NULL)
+		return;
+	*_set = NULL;
+
+	i_assert(set->refcount > 0);
+	if (--set->refcount > 0)
+		return;
+	pool_unref(&set->pool);
+}
+
+bool header_filter_set_match(const struct header_filter_set *set,
+			     const char *name, size_t name_len)
+{
+	unsigned char chr;
+	unsigned int i;
+
+	if (name_len > set->max_name_len || name_len == 0)
+		return FALSE;
+	chr = i_tolower(name[0]);
+	if ((set->first_chars[chr / 8] & (1 << (chr % 8))) == 0)
+		return FALSE;
+
+	for (i = set->len_idx[name_len]; i < set->len_idx[name_len+1]; i++) {
+		if (i_memcasecmp(set->names[i], name, name_len) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+#undef i_stream_create_header_filter_set
 struct istream *
-i_stream_create_header_filter(struct istream *input,
-                              enum header_filter_flags flags,
-			      const char *const *headers,
-			      unsigned int headers_count,
-			      header_filter_callback *callback, void *context)
+i_stream_create_header_filter_set(struct istream *input,
+				  enum header_filter_flags flags,
+				  struct header_filter_set *set,
+				  header_filter_callback *callback,
+				  void *context)
 {
 	struct header_filter_istream *mstream;
-	unsigned int i, j;
-	int ret;
 
 	i_assert((flags & (HEADER_FILTER_INCLUDE|HEADER_FILTER_EXCLUDE)) != 0);
 
@@ -708,19 +813,8 @@ i_stream_create_header_filter(struct istream *input,
 					      "header filter stream", 256);
 	mstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
 
-	mstream->headers = headers_count == 0 ? NULL :
-		p_new(mstream->pool, const char *, headers_count);
-	for (i = j = 0; i < headers_count; i++)  {
-		ret = j == 0 ? -1 :
-			strcasecmp(mstream->headers[j-1], headers[i]);
-		if (ret == 0) {
-			/* drop duplicate */
-			continue;
-		} 
-		i_assert(ret < 0);
-		mstream->headers[j++] = p_strdup(mstream->pool, headers[i]);
-	}
-	mstream->headers_count = j;
+	mstream->set = set;
+	header_filter_set_ref(set);
 	mstream->hdr_buf = buffer_create_dynamic(default_pool, 1024);
 
 	mstream->callback = callback;
@@ -753,6 +847,24 @@ i_stream_create_header_filter(struct istream *input,
 	return i_stream_create(&mstream->istream, input, -1, 0);
 }
 
+#undef i_stream_create_header_filter
+struct istream *
+i_stream_create_header_filter(struct istream *input,
+                              enum header_filter_flags flags,
+			      const char *const *headers,
+			      unsigned int headers_count,
+			      header_filter_callback *callback, void *context)
+{
+	struct header_filter_set *set;
+	struct istream *filter;
+
+	set = header_filter_set_create(headers, headers_count);
+	filter = i_stream_create_header_filter_set(input, flags, set,
+						   callback, context);
+	header_filter_set_unref(&set);
+	return filter;
+}
+
 void i_stream_header_filter_add(struct header_filter_istream *input,
 				const void *data, size_t size)
 {
@@ -2,6 +2,7 @@
 #define ISTREAM_HEADER_FILTER_H
 
 struct header_filter_istream;
+struct header_filter_set;
 
 enum header_filter_flags {
 	/* Include only specified headers in output.*/
@@ -29,7 +30,37 @@ typedef void header_filter_callback(struct header_filter_istream *input,
 
 extern header_filter_callback *null_header_filter_callback;
 
-/* NOTE: headers list must be sorted. */
+/* Create a precompiled set of header names (case-insensitive). The same set
+   can be used for creating any number of header filter streams, which avoids
+   setting up the header list separately for each mail. */
+struct header_filter_set *
+header_filter_set_create(const char *const *headers,
+			 unsigned int headers_count);
+void header_filter_set_ref(struct header_filter_set *set);
+void header_filter_set_unref(struct header_filter_set **set);
+/* Returns TRUE if the header name is in the set. */
+bool header_filter_set_match(const struct header_filter_set *set,
+			     const char *name, size_t name_len);
+
+/* Same as i_stream_create_header_filter(), but use a precompiled header set.
+   The stream keeps a reference to the set. */
+struct istream *
+i_stream_create_header_filter_set(struct istream *input,
+				  enum header_filter_flags flags,
+				  struct header_filter_set *set,
+				  header_filter_callback *callback,
+				  void *context)
+	ATTR_NULL(5);
+#define i_stream_create_header_filter_set(input, flags, set, \
+					  callback, context) \
+	  i_stream_create_header_filter_set(input, (flags) - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct header_filter_istream *, \
+			struct message_header_line *, bool *, typeof(context))), \
+		set, (header_filter_callback *)callback, context)
+
+/* Create a header filter stream for the given header names. The names don't
+   need to be sorted. */
 struct istream *
 i_stream_create_header_filter(struct istream *input,
 			      enum header_filter_flags flags,
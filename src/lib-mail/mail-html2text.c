@@ -120,7 +120,10 @@ static bool html_entity_get_unichar(const char *name, unichar_t *chr_r)
 	unichar_t chr;
 
 	for (size_t i = 0; i < N_ELEMENTS(html_entities); i++) {
-		if (strcmp(html_entities[i].name, name) == 0) {
+		/* check the first letter without a function call, since
+		   this is done for each entity in the text */
+		if (html_entities[i].name[0] == name[0] &&
+		    strcmp(html_entities[i].name, name) == 0) {
 			*chr_r = html_entities[i].chr;
 			return TRUE;
 		}
@@ -176,11 +179,33 @@ static void mail_html2text_add_space(buffer_t *output)
 		buffer_append_c(output, ' ');
 }
 
+/* Returns the position just before the next c after data[i], or size-1 if
+   there is none. The parse_data() loop then continues from the c. */
+static size_t
+skip_until(const unsigned char *data, size_t i, size_t size, unsigned char c)
+{
+	const unsigned char *p;
+
+	p = memchr(data + i + 1, c, size - i - 1);
+	return p == NULL ? size - 1 : (size_t)(p - data) - 1;
+}
+
+static size_t
+skip_until2(const unsigned char *data, size_t i, size_t size,
+	    unsigned char c1, unsigned char c2)
+{
+	for (i++; i < size; i++) {
+		if (data[i] == c1 || data[i] == c2)
+			break;
+	}
+	return i - 1;
+}
+
 static size_t
 parse_data(struct mail_html2text *ht,
 	   const unsigned char *data, size_t size, buffer_t *output)
 {
-	size_t i, ret;
+	size_t i, j, ret;
 
 	for (i = 0; i < size; i++) {
 		unsigned char c = data[i];
@@ -201,7 +226,13 @@ parse_data(struct mail_html2text *ht,
 					return i;
 				i += ret - 1;
 			} else {
-				buffer_append_c(output, c);
+				/* copy the whole run of plain text at once */
+				for (j = i + 1; j < size; j++) {
+					if (data[j] == '<' || data[j] == '&')
+						break;
+				}
+				buffer_append(output, data + i, j - i);
+				i = j - 1;
 			}
 			break;
 		case HTML_STATE_TAG:
@@ -219,6 +250,13 @@ parse_data(struct mail_html2text *ht,
 				}
 				ht->add_newline = FALSE;
 				mail_html2text_add_space(output);
+			} else {
+				for (j = i + 1; j < size; j++) {
+					if (data[j] == '"' || data[j] == '\'' ||
+					    data[j] == '>')
+						break;
+				}
+				i = j - 1;
 			}
 			break;
 		case HTML_STATE_TAG_DQUOTED:
@@ -226,6 +264,8 @@ parse_data(struct mail_html2text *ht,
 				ht->state = HTML_STATE_TAG;
 			else if (c == '\\')
 				ht->state = HTML_STATE_TAG_DQUOTED_ESCAPE;
+			else
+				i = skip_until2(data, i, size, '"', '\\');
 			break;
 		case HTML_STATE_TAG_DQUOTED_ESCAPE:
 			ht->state = HTML_STATE_TAG_DQUOTED;
@@ -235,6 +275,8 @@ parse_data(struct mail_html2text *ht,
 				ht->state = HTML_STATE_TAG;
 			else if (c == '\\')
 				ht->state = HTML_STATE_TAG_SQUOTED_ESCAPE;
+			else
+				i = skip_until2(data, i, size, '\'', '\\');
 			break;
 		case HTML_STATE_TAG_SQUOTED_ESCAPE:
 			ht->state = HTML_STATE_TAG_SQUOTED;
@@ -247,6 +289,8 @@ parse_data(struct mail_html2text *ht,
 					ht->state = HTML_STATE_COMMENT_END;
 					i++;
 				}
+			} else {
+				i = skip_until(data, i, size, '-');
 			}
 			break;
 		case HTML_STATE_COMMENT_END:
@@ -266,6 +310,8 @@ parse_data(struct mail_html2text *ht,
 					ht->state = HTML_STATE_TEXT;
 					i += 8;
 				}
+			} else {
+				i = skip_until(data, i, size, '<');
 			}
 			break;
 		case HTML_STATE_STYLE:
@@ -279,6 +325,8 @@ parse_data(struct mail_html2text *ht,
 					ht->state = HTML_STATE_TEXT;
 					i += 7;
 				}
+			} else {
+				i = skip_until(data, i, size, '<');
 			}
 			break;
 		case HTML_STATE_CDATA:
@@ -293,9 +341,11 @@ parse_data(struct mail_html2text *ht,
 					break;
 				}
 			}
+			j = skip_until(data, i, size, ']') + 1;
 			if (ht->quote_level == 0 ||
 			    (ht->flags & MAIL_HTML2TEXT_FLAG_SKIP_QUOTED) == 0)
-				buffer_append_c(output, c);
+				buffer_append(output, data + i, j - i);
+			i = j - 1;
 			break;
 		}
 	}
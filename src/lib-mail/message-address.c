@@ -442,6 +442,83 @@ static int parse_path(struct message_address_parser_context *ctx)
 	return ret;
 }
 
+static const unsigned char *
+simple_atom_end(const unsigned char *p, const unsigned char *end)
+{
+	while (p < end && *p < 0x80 && IS_ATEXT(*p))
+		p++;
+	return p;
+}
+
+static const unsigned char *
+simple_dot_atom_end(const unsigned char *p, const unsigned char *end)
+{
+	const unsigned char *atom_end;
+
+	for (;;) {
+		atom_end = simple_atom_end(p, end);
+		if (atom_end == p)
+			return NULL;
+		if (atom_end == end || *atom_end != '.')
+			return atom_end;
+		p = atom_end + 1;
+	}
+}
+
+/* Parse the common "local@domain", "<local@domain>" and
+   "Name Words <local@domain>" forms consisting only of ASCII atoms separated
+   by single dots and spaces, without going through the generic parser.
+   Returns NULL if the input is anything else, so the full parser must be
+   used. The result is identical to what the full parser would return. */
+static struct message_address *
+message_address_parse_simple(pool_t pool, const unsigned char *data,
+			     size_t size)
+{
+	const unsigned char *p = data, *end = data + size;
+	const unsigned char *name_end = NULL, *local, *at, *domain_end;
+	struct message_address *addr;
+
+	if (size == 0)
+		return NULL;
+	if (*p != '<') {
+		at = simple_dot_atom_end(p, end);
+		if (at != NULL && at < end && *at == '@') {
+			/* addr-spec */
+			domain_end = simple_dot_atom_end(at + 1, end);
+			if (domain_end != end)
+				return NULL;
+			local = p;
+			goto found;
+		}
+		/* display-name followed by angle-addr */
+		for (;;) {
+			name_end = simple_atom_end(p, end);
+			if (name_end == p || end - name_end < 2 ||
+			    *name_end != ' ')
+				return NULL;
+			p = name_end + 1;
+			if (*p == '<')
+				break;
+		}
+	}
+	/* angle-addr */
+	local = ++p;
+	at = simple_dot_atom_end(local, end);
+	if (at == NULL || at == end || *at != '@')
+		return NULL;
+	domain_end = simple_dot_atom_end(at + 1, end);
+	if (domain_end == NULL || end - domain_end != 1 || *domain_end != '>')
+		return NULL;
+
+found:
+	addr = p_new(pool, struct message_address, 1);
+	if (name_end != NULL)
+		addr->name = p_strdup_until(pool, data, name_end);
+	addr->mailbox = p_strdup_until(pool, local, at);
+	addr->domain = p_strdup_until(pool, at + 1, domain_end);
+	return addr;
+}
+
 static struct message_address *
 message_address_parse_real(pool_t pool, const unsigned char *data, size_t size,
 			   unsigned int max_addresses,
@@ -495,6 +572,10 @@ message_address_parse(pool_t pool, const unsigned char *data, size_t size,
 {
 	struct message_address *addr;
 
+	if (max_addresses > 0 &&
+	    (addr = message_address_parse_simple(pool, data, size)) != NULL)
+		return addr;
+
 	if (pool->datastack_pool) {
 		return message_address_parse_real(pool, data, size,
 						  max_addresses, flags);
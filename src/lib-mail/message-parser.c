@@ -61,7 +61,8 @@ static void parse_body_add_block(struct message_parser_ctx *ctx,
 	block->hdr = NULL;
 
 	/* check if we have NULs */
-	if (memchr(data, '\0', block->size) != NULL)
+	if ((ctx->part->flags & MESSAGE_PART_FLAG_HAS_NULS) == 0 &&
+	    memchr(data, '\0', block->size) != NULL)
 		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
 
 	/* count number of lines and missing CRs */
@@ -0,0 +1,386 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "numpack.h"
+#include "message-address.h"
+#include "message-part-data.h"
+#include "message-part-data-serialize.h"
+
+/*
+   unsigned char version
+   part data for each part in the same order as message_part_serialize():
+     string content_type, content_subtype
+     params content_type_params
+     string content_transfer_encoding, content_id, content_description
+     string content_disposition
+     params content_disposition_params
+     string content_md5
+     number content_language count + 1 (0 = NULL)
+       string content_language[]
+     string content_location
+     unsigned char has_envelope
+     (has_envelope)
+       string date, subject
+       addresses from, sender, reply_to, to, cc, bcc
+       string in_reply_to, message_id
+
+   number = numpack encoded integer
+   string = number length + 1 (0 = NULL), followed by the string
+   params = number count, followed by name and value strings
+   addresses = number count, followed by name, route, mailbox and domain
+     strings and unsigned char invalid_syntax for each address
+*/
+
+#define MESSAGE_PART_DATA_SERIALIZE_VERSION 1
+
+struct deserialize_context {
+	pool_t pool;
+	const unsigned char *data, *end;
+	const char *error;
+};
+
+static void serialize_string(buffer_t *dest, const char *str)
+{
+	size_t len;
+
+	if (str == NULL) {
+		numpack_encode(dest, 0);
+		return;
+	}
+	len = strlen(str);
+	numpack_encode(dest, len + 1);
+	buffer_append(dest, str, len);
+}
+
+static void
+serialize_params(buffer_t *dest, const struct message_part_param *params,
+		 unsigned int count)
+{
+	unsigned int i;
+
+	numpack_encode(dest, count);
+	for (i = 0; i < count; i++) {
+		serialize_string(dest, params[i].name);
+		serialize_string(dest, params[i].value);
+	}
+}
+
+static void
+serialize_addresses(buffer_t *dest, const struct message_address *addr)
+{
+	const struct message_address *a;
+	unsigned int count = 0;
+	unsigned char invalid;
+
+	for (a = addr; a != NULL; a = a->next)
+		count++;
+	numpack_encode(dest, count);
+	for (a = addr; a != NULL; a = a->next) {
+		serialize_string(dest, a->name);
+		serialize_string(dest, a->route);
+		serialize_string(dest, a->mailbox);
+		serialize_string(dest, a->domain);
+		invalid = a->invalid_syntax ? 1 : 0;
+		buffer_append_c(dest, invalid);
+	}
+}
+
+static void
+serialize_envelope(buffer_t *dest, const struct message_part_envelope *env)
+{
+	serialize_string(dest, env->date);
+	serialize_string(dest, env->subject);
+	serialize_addresses(dest, env->from);
+	serialize_addresses(dest, env->sender);
+	serialize_addresses(dest, env->reply_to);
+	serialize_addresses(dest, env->to);
+	serialize_addresses(dest, env->cc);
+	serialize_addresses(dest, env->bcc);
+	serialize_string(dest, env->in_reply_to);
+	serialize_string(dest, env->message_id);
+}
+
+static void
+serialize_data(buffer_t *dest, const struct message_part_data *data)
+{
+	unsigned int i, count;
+
+	serialize_string(dest, data->content_type);
+	serialize_string(dest, data->content_subtype);
+	serialize_params(dest, data->content_type_params,
+			 data->content_type_params_count);
+	serialize_string(dest, data->content_transfer_encoding);
+	serialize_string(dest, data->content_id);
+	serialize_string(dest, data->content_description);
+	serialize_string(dest, data->content_disposition);
+	serialize_params(dest, data->content_disposition_params,
+			 data->content_disposition_params_count);
+	serialize_string(dest, data->content_md5);
+	if (data->content_language == NULL)
+		numpack_encode(dest, 0);
+	else {
+		count = str_array_length(data->content_language);
+		numpack_encode(dest, count + 1);
+		for (i = 0; i < count; i++)
+			serialize_string(dest, data->content_language[i]);
+	}
+	serialize_string(dest, data->content_location);
+
+	if (data->envelope == NULL)
+		buffer_append_c(dest, 0);
+	else {
+		buffer_append_c(dest, 1);
+		serialize_envelope(dest, data->envelope);
+	}
+}
+
+static int
+part_data_serialize(const struct message_part *part, buffer_t *dest,
+		    const char **error_r)
+{
+	for (; part != NULL; part = part->next) {
+		if (part->data == NULL) {
+			*error_r = "Message part data is missing";
+			return -1;
+		}
+		serialize_data(dest, part->data);
+		if (part_data_serialize(part->children, dest, error_r) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int message_part_data_serialize(const struct message_part *parts,
+				buffer_t *dest, const char **error_r)
+{
+	buffer_append_c(dest, MESSAGE_PART_DATA_SERIALIZE_VERSION);
+	return part_data_serialize(parts, dest, error_r);
+}
+
+static bool read_number(struct deserialize_context *ctx, uint32_t *num_r)
+{
+	if (numpack_decode32(&ctx->data, ctx->end, num_r) < 0) {
+		ctx->error = "Invalid number";
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static bool read_byte(struct deserialize_context *ctx, unsigned char *byte_r)
+{
+	if (ctx->data == ctx->end) {
+		ctx->error = "Not enough data";
+		return FALSE;
+	}
+	*byte_r = *ctx->data++;
+	return TRUE;
+}
+
+static bool read_string(struct deserialize_context *ctx, const char **str_r)
+{
+	uint32_t len;
+
+	if (!read_number(ctx, &len))
+		return FALSE;
+	if (len == 0) {
+		*str_r = NULL;
+		return TRUE;
+	}
+	len--;
+	if ((size_t)(ctx->end - ctx->data) < len) {
+		ctx->error = "Not enough data for string";
+		return FALSE;
+	}
+	if (memchr(ctx->data, '\0', len) != NULL) {
+		ctx->error = "String contains NUL";
+		return FALSE;
+	}
+	*str_r = p_strndup(ctx->pool, ctx->data, len);
+	ctx->data += len;
+	return TRUE;
+}
+
+static bool
+read_params(struct deserialize_context *ctx,
+	    const struct message_part_param **params_r,
+	    unsigned int *count_r)
+{
+	struct message_part_param *params;
+	uint32_t i, count;
+
+	if (!read_number(ctx, &count))
+		return FALSE;
+	/* each param takes at least two bytes */
+	if (count > (size_t)(ctx->end - ctx->data) / 2) {
+		ctx->error = "Too many parameters";
+		return FALSE;
+	}
+	*count_r = count;
+	if (count == 0) {
+		*params_r = NULL;
+		return TRUE;
+	}
+	params = p_new(ctx->pool, struct message_part_param, count);
+	for (i = 0; i < count; i++) {
+		if (!read_string(ctx, &params[i].name) ||
+		    !read_string(ctx, &params[i].value))
+			return FALSE;
+		if (params[i].name == NULL || params[i].value == NULL) {
+			ctx->error = "NULL parameter";
+			return FALSE;
+		}
+	}
+	*params_r = params;
+	return TRUE;
+}
+
+static bool
+read_addresses(struct deserialize_context *ctx,
+	       struct message_address **addr_r)
+{
+	struct message_address *addr, **next;
+	unsigned char invalid;
+	uint32_t i, count;
+
+	if (!read_number(ctx, &count))
+		return FALSE;
+	*addr_r = NULL;
+	next = addr_r;
+	for (i = 0; i < count; i++) {
+		addr = p_new(ctx->pool, struct message_address, 1);
+		if (!read_string(ctx, &addr->name) ||
+		    !read_string(ctx, &addr->route) ||
+		    !read_string(ctx, &addr->mailbox) ||
+		    !read_string(ctx, &addr->domain) ||
+		    !read_byte(ctx, &invalid))
+			return FALSE;
+		addr->invalid_syntax = invalid != 0;
+		*next = addr;
+		next = &addr->next;
+	}
+	return TRUE;
+}
+
+static bool
+read_envelope(struct deserialize_context *ctx,
+	      struct message_part_envelope **env_r)
+{
+	struct message_part_envelope *env;
+
+	env = p_new(ctx->pool, struct message_part_envelope, 1);
+	if (!read_string(ctx, &env->date) ||
+	    !read_string(ctx, &env->subject) ||
+	    !read_addresses(ctx, &env->from) ||
+	    !read_addresses(ctx, &env->sender) ||
+	    !read_addresses(ctx, &env->reply_to) ||
+	    !read_addresses(ctx, &env->to) ||
+	    !read_addresses(ctx, &env->cc) ||
+	    !read_addresses(ctx, &env->bcc) ||
+	    !read_string(ctx, &env->in_reply_to) ||
+	    !read_string(ctx, &env->message_id))
+		return FALSE;
+	*env_r = env;
+	return TRUE;
+}
+
+static bool
+read_data(struct deserialize_context *ctx, struct message_part_data **data_r)
+{
+	struct message_part_data *data;
+	const char **languages;
+	unsigned char has_envelope;
+	uint32_t i, count;
+
+	data = p_new(ctx->pool, struct message_part_data, 1);
+	if (!read_string(ctx, &data->content_type) ||
+	    !read_string(ctx, &data->content_subtype) ||
+	    !read_params(ctx, &data->content_type_params,
+			 &data->content_type_params_count) ||
+	    !read_string(ctx, &data->content_transfer_encoding) ||
+	    !read_string(ctx, &data->content_id) ||
+	    !read_string(ctx, &data->content_description) ||
+	    !read_string(ctx, &data->content_disposition) ||
+	    !read_params(ctx, &data->content_disposition_params,
+			 &data->content_disposition_params_count) ||
+	    !read_string(ctx, &data->content_md5) ||
+	    !read_number(ctx, &count))
+		return FALSE;
+
+	if (count > 0) {
+		count--;
+		if (count > (size_t)(ctx->end - ctx->data)) {
+			ctx->error = "Too many languages";
+			return FALSE;
+		}
+		languages = p_new(ctx->pool, const char *, count + 1);
+		for (i = 0; i < count; i++) {
+			if (!read_string(ctx, &languages[i]))
+				return FALSE;
+			if (languages[i] == NULL) {
+				ctx->error = "NULL language";
+				return FALSE;
+			}
+		}
+		data->content_language = languages;
+	}
+	if (!read_string(ctx, &data->content_location) ||
+	    !read_byte(ctx, &has_envelope))
+		return FALSE;
+	if (has_envelope != 0) {
+		if (!read_envelope(ctx, &data->envelope))
+			return FALSE;
+	}
+	*data_r = data;
+	return TRUE;
+}
+
+static bool
+part_data_deserialize(struct deserialize_context *ctx,
+		      struct message_part *part)
+{
+	for (; part != NULL; part = part->next) {
+		if (!read_data(ctx, &part->data))
+			return FALSE;
+		if (!part_data_deserialize(ctx, part->children))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static bool
+part_data_deserialize_version(struct deserialize_context *ctx,
+			      unsigned char version, struct message_part *parts)
+{
+	if (version != MESSAGE_PART_DATA_SERIALIZE_VERSION) {
+		ctx->error = "Unsupported version";
+		return FALSE;
+	}
+	if (!part_data_deserialize(ctx, parts))
+		return FALSE;
+	if (ctx->data != ctx->end) {
+		ctx->error = "Too much data";
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int message_part_data_deserialize(pool_t pool, struct message_part *parts,
+				  const void *data, size_t size,
+				  const char **error_r)
+{
+	struct deserialize_context ctx;
+	unsigned char version;
+
+	i_zero(&ctx);
+	ctx.pool = pool;
+	ctx.data = data;
+	ctx.end = ctx.data + size;
+
+	if (!read_byte(&ctx, &version) ||
+	    !part_data_deserialize_version(&ctx, version, parts)) {
+		*error_r = ctx.error;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef MESSAGE_PART_DATA_SERIALIZE_H
+#define MESSAGE_PART_DATA_SERIALIZE_H
+
+struct message_part;
+
+/* Serialize the parsed data (part->data) of all the message parts. The
+   IMAP BODY and BODYSTRUCTURE can be written from it without parsing them
+   from text. Returns -1 if some part is missing its data. */
+int message_part_data_serialize(const struct message_part *parts,
+				buffer_t *dest, const char **error_r);
+
+/* Set part->data for all the message parts from the serialized data. The
+   parts must have the same structure as when they were serialized. Returns
+   -1 and sets error if any problems are detected. Some of the parts may
+   have been updated then. */
+int message_part_data_deserialize(pool_t pool, struct message_part *parts,
+				  const void *data, size_t size,
+				  const char **error_r);
+
+#endif
@@ -35,6 +35,9 @@ struct deserialize_context {
 	pool_t pool;
 	const unsigned char *data, *end;
 
+	/* Preallocated parts in the order they are serialized */
+	struct message_part *parts, *parts_end;
+
 	uoff_t pos;
 	const char *error;
 };
@@ -117,6 +120,59 @@ static bool read_next(struct deserialize_context *ctx,
 	return TRUE;
 }
 
+static bool
+message_part_count_parts(const unsigned char **data,
+			 const unsigned char *end, bool root,
+			 unsigned int siblings, unsigned int *count)
+{
+	enum message_part_flags flags;
+	unsigned int children_count;
+	size_t size;
+
+	while (siblings > 0) {
+		siblings--;
+
+		if ((size_t)(end - *data) < sizeof(flags))
+			return FALSE;
+		memcpy(&flags, *data, sizeof(flags));
+		size = sizeof(flags) + sizeof(uoff_t) * 4;
+		if (root)
+			root = FALSE;
+		else
+			size += sizeof(uoff_t);
+		if ((flags & (MESSAGE_PART_FLAG_TEXT |
+			      MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0)
+			size += sizeof(unsigned int);
+		children_count = 0;
+		if ((flags & (MESSAGE_PART_FLAG_MULTIPART |
+			      MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
+			if ((size_t)(end - *data) < size + sizeof(children_count))
+				return FALSE;
+			memcpy(&children_count, *data + size,
+			       sizeof(children_count));
+			size += sizeof(children_count);
+		}
+		if ((size_t)(end - *data) < size)
+			return FALSE;
+		*data += size;
+		*count += 1;
+
+		if (children_count > 0 &&
+		    !message_part_count_parts(data, end, FALSE,
+					      children_count, count))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static struct message_part *
+message_part_deserialize_alloc(struct deserialize_context *ctx)
+{
+	if (ctx->parts < ctx->parts_end)
+		return ctx->parts++;
+	return p_new(ctx->pool, struct message_part, 1);
+}
+
 static bool ATTR_NULL(2)
 message_part_deserialize_part(struct deserialize_context *ctx,
 			      struct message_part *parent,
@@ -133,7 +189,7 @@ message_part_deserialize_part(struct deserialize_context *ctx,
 	while (siblings > 0) {
 		siblings--;
 
-		part = p_new(ctx->pool, struct message_part, 1);
+		part = message_part_deserialize_alloc(ctx);
 		part->parent = parent;
 		for (p = parent; p != NULL; p = p->parent)
 			p->children_count++;
@@ -249,12 +305,23 @@ message_part_deserialize(pool_t pool, const void *data, size_t size,
 {
 	struct deserialize_context ctx;
         struct message_part *part;
+	const unsigned char *p = data;
+	unsigned int count = 0;
 
 	i_zero(&ctx);
 	ctx.pool = pool;
 	ctx.data = data;
 	ctx.end = ctx.data + size;
 
+	/* Allocate all the parts with a single allocation. This keeps the
+	   parts close to each others in memory in the same depth-first order
+	   as they're walked. If the data is broken, the parts are allocated
+	   separately and the error is found by the actual parsing below. */
+	if (message_part_count_parts(&p, ctx.end, TRUE, 1, &count)) {
+		ctx.parts = p_new(pool, struct message_part, count);
+		ctx.parts_end = ctx.parts + count;
+	}
+
 	if (!message_part_deserialize_part(&ctx, NULL, 1, &part)) {
 		*error_r = ctx.error;
 		return NULL;
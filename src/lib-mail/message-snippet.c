@@ -11,6 +11,11 @@
 
 #include <ctype.h>
 
+/* HTML is converted to text in chunks of this size, so the conversion can
+   stop as soon as the snippet is full instead of converting the whole
+   decoded block. */
+#define SNIPPET_HTML_CHUNK_SIZE 256
+
 enum snippet_state {
 	/* beginning of the line */
 	SNIPPET_STATE_NEWLINE = 0,
@@ -77,20 +82,12 @@ static void snippet_add_content(struct snippet_context *ctx,
 	str_append_data(target->snippet, data, *count_r);
 }
 
-static bool snippet_generate(struct snippet_context *ctx,
-			     const unsigned char *data, size_t size)
+static bool snippet_generate_text(struct snippet_context *ctx,
+				  const unsigned char *data, size_t size)
 {
 	size_t i, count;
 	struct snippet_data *target;
 
-	if (ctx->html2text != NULL) {
-		buffer_set_used_size(ctx->plain_output, 0);
-		mail_html2text_more(ctx->html2text, data, size,
-				    ctx->plain_output);
-		data = ctx->plain_output->data;
-		size = ctx->plain_output->used;
-	}
-
 	if (ctx->state == SNIPPET_STATE_QUOTED)
 		target = &ctx->quoted_snippet;
 	else
@@ -127,6 +124,30 @@ static bool snippet_generate(struct snippet_context *ctx,
 	return TRUE;
 }
 
+static bool snippet_generate(struct snippet_context *ctx,
+			     const unsigned char *data, size_t size)
+{
+	size_t pos, chunk_size;
+
+	if (ctx->html2text == NULL)
+		return snippet_generate_text(ctx, data, size);
+
+	for (pos = 0; pos < size; pos += chunk_size) {
+		/* don't split UTF-8 characters */
+		chunk_size = uni_utf8_data_truncate(data + pos, size - pos,
+						    SNIPPET_HTML_CHUNK_SIZE);
+		if (chunk_size == 0)
+			chunk_size = I_MIN(size - pos, SNIPPET_HTML_CHUNK_SIZE);
+		buffer_set_used_size(ctx->plain_output, 0);
+		mail_html2text_more(ctx->html2text, data + pos, chunk_size,
+				    ctx->plain_output);
+		if (!snippet_generate_text(ctx, ctx->plain_output->data,
+					   ctx->plain_output->used))
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static void snippet_copy(const char *src, string_t *dst)
 {
 	while (*src != '\0' && i_isspace(*src)) src++;
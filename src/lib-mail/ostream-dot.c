@@ -108,6 +108,25 @@ o_stream_dot_sendv(struct ostream_private *stream,
 		for (; p < pend && (size_t)(p-data)+2 < max_bytes; p++) {
 			char add = 0;
 
+			if (dstream->state == STREAM_STATE_NONE) {
+				/* Skip to the next LF. Only the last skipped
+				   byte can change the state. */
+				const char *lf, *limit;
+				size_t left = max_bytes - 2 - (size_t)(p - data);
+
+				limit = (size_t)(pend - p) < left ? pend : p + left;
+				lf = memchr(p, '\n', limit - p);
+				if (lf == NULL)
+					lf = limit;
+				if (lf > p) {
+					if (lf[-1] == '\r')
+						dstream->state = STREAM_STATE_CR;
+					p = lf;
+					if (p == limit)
+						break;
+				}
+			}
+
 			switch (dstream->state) {
 			/* none */
 			case STREAM_STATE_NONE:
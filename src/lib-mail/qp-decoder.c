@@ -48,12 +48,27 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+static inline int qp_hex_value(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	/* lowercase hex isn't strictly valid, but allow */
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
 {
 	size_t i, start = 0, ret = src_size;
+	int hex1, hex2;
 
+	/* Handle the common cases without going through the state machine.
+	   Everything that isn't fully available in this block is left for
+	   it, though. */
 	for (i = 0; i < src_size; i++) {
 		if (src[i] > '=') {
 			/* fast path */
@@ -61,9 +76,36 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		}
 		switch (src[i]) {
 		case '=':
+			if (i + 2 < src_size) {
+				hex1 = qp_hex_value(src[i+1]);
+				hex2 = qp_hex_value(src[i+2]);
+				if (hex1 >= 0 && hex2 >= 0) {
+					/* =<hex><hex> */
+					buffer_append(qp->dest, src+start,
+						      i-start);
+					buffer_append_c(qp->dest,
+							hex1 << 4 | hex2);
+					i += 2;
+					start = i+1;
+					continue;
+				}
+				if (src[i+1] == '\r' && src[i+2] == '\n') {
+					/* soft line break */
+					buffer_append(qp->dest, src+start,
+						      i-start);
+					i += 2;
+					start = i+1;
+					continue;
+				}
+			}
 			qp->state = STATE_EQUALS;
 			break;
 		case '\r':
+			if (i + 1 < src_size && src[i+1] == '\n') {
+				/* CRLF is copied as-is */
+				i++;
+				continue;
+			}
 			qp->state = STATE_CR;
 			break;
 		case '\n':
@@ -74,6 +116,12 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 			continue;
 		case ' ':
 		case '\t':
+			if (i + 1 < src_size &&
+			    !QP_IS_TRAILING_WHITESPACE(src[i+1]) &&
+			    src[i+1] != '\r' && src[i+1] != '\n') {
+				/* whitespace within the line */
+				continue;
+			}
 			i_assert(qp->whitespace->used == 0);
 			qp->state = STATE_WHITESPACE;
 			buffer_append_c(qp->whitespace, src[i]);
@@ -118,6 +118,9 @@ struct attachment {
 	uoff_t start_offset;
 	uoff_t encoded_size, decoded_size;
 	unsigned int base64_blocks_per_line;
+
+	uoff_t part_size;
+	uint32_t part_crc32;
 };
 
 static buffer_t *attachment_data;
@@ -152,6 +155,8 @@ static int test_open_attachment_ostream(struct istream_attachment_info *info,
 	a->start_offset = info->start_offset;
 	a->encoded_size = info->encoded_size;
 	a->base64_blocks_per_line = info->base64_blocks_per_line;
+	a->part_size = info->part_size;
+	a->part_crc32 = info->part_crc32;
 	test_assert(strlen(info->hash) == 160/8*2); /* sha1 size */
 
 	*output_r = o_stream_create_buffer(attachment_data);
@@ -440,6 +445,101 @@ static void test_istream_attachment_extractor_error(void)
 	test_end();
 }
 
+static bool
+test_want_reuse_attachment(uoff_t start_offset ATTR_UNUSED, void *context)
+{
+	const ARRAY_TYPE(uint32_t) *crc_diffs = context;
+
+	return crc_diffs != NULL;
+}
+
+static int
+test_reuse_attachment(struct istream_attachment_info *info,
+		      const char **error_r ATTR_UNUSED, void *context)
+{
+	const ARRAY_TYPE(uint32_t) *crc_diffs = context;
+	const struct attachment *a;
+	unsigned int idx = 0;
+
+	/* crc_diffs is used to simulate attachments that changed */
+	array_foreach(&attachments, a) {
+		if (idx == array_count(crc_diffs))
+			break;
+		if (a->start_offset == info->start_offset &&
+		    a->part_size == info->part_size &&
+		    a->part_crc32 + array_idx_elem(crc_diffs, idx) ==
+		    info->part_crc32) {
+			info->encoded_size = a->encoded_size;
+			return 1;
+		}
+		idx++;
+	}
+	return 0;
+}
+
+static void test_istream_attachment_extractor_reuse(void)
+{
+	struct istream_attachment_settings set;
+	struct istream *datainput, *input;
+	ARRAY_TYPE(uint32_t) crc_diffs;
+	const unsigned char *data;
+	size_t size, used;
+	uint32_t diff;
+	unsigned int i;
+	int ret;
+
+	test_begin("istream attachment extractor reuse");
+	t_array_init(&crc_diffs, 2);
+
+	/* first extract the attachments normally */
+	datainput = i_stream_create_from_data(mail_input, sizeof(mail_input));
+	get_istream_attachment_settings(&set);
+	set.want_reuse_attachment = test_want_reuse_attachment;
+	set.reuse_attachment = test_reuse_attachment;
+	input = i_stream_create_attachment_extractor(datainput, &set, NULL);
+	while ((ret = i_stream_read(input)) > 0) ;
+	test_assert(ret == -1 && input->stream_errno == 0);
+	test_assert(array_count(&attachments) == 2);
+	i_stream_unref(&input);
+	i_stream_unref(&datainput);
+	used = attachment_data->used;
+
+	/* i=0: both attachments are reused,
+	   i=1: the first one is reused, the second one is extracted again */
+	for (i = 0; i < 2; i++) {
+		array_clear(&crc_diffs);
+		diff = 0;
+		array_push_back(&crc_diffs, &diff);
+		diff = i;
+		array_push_back(&crc_diffs, &diff);
+
+		datainput = i_stream_create_from_data(mail_input,
+						      sizeof(mail_input));
+		get_istream_attachment_settings(&set);
+		set.want_reuse_attachment = test_want_reuse_attachment;
+		set.reuse_attachment = test_reuse_attachment;
+		input = i_stream_create_attachment_extractor(datainput, &set,
+							     &crc_diffs);
+		while ((ret = i_stream_read(input)) > 0) ;
+		test_assert_idx(ret == -1 && input->stream_errno == 0, i);
+
+		data = i_stream_get_data(input, &size);
+		test_assert_idx(size == sizeof(mail_output) &&
+				memcmp(data, mail_output, size) == 0, i);
+		test_assert_idx(array_count(&attachments) == 2 + i, i);
+		i_stream_unref(&input);
+		i_stream_unref(&datainput);
+	}
+	/* the re-extracted attachment is the same as the original one */
+	test_assert(attachment_data->used == used + strlen(BINARY_TEXT_SHORT));
+	test_assert(memcmp(CONST_PTR_OFFSET(attachment_data->data, used),
+			   BINARY_TEXT_SHORT, strlen(BINARY_TEXT_SHORT)) == 0);
+
+	buffer_free(&attachment_data);
+	array_free(&attachments);
+	test_end();
+}
+
 static void test_istream_attachment_connector(void)
 {
 	struct istream *input;
@@ -476,6 +576,7 @@ int main(int argc, char *argv[])
 		test_istream_attachment,
 		test_istream_attachment_extractor,
 		test_istream_attachment_extractor_error,
+		test_istream_attachment_extractor_reuse,
 		test_istream_attachment_connector,
 		NULL
 	};
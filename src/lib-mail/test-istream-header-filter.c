@@ -680,6 +680,60 @@ static void test_istream_empty_missing_eoh_callback(void)
 	test_end();
 }
 
+static void test_header_filter_set(void)
+{
+	static const char *headers[] = {
+		"To", "Subject", "from", "X-Foo", "subject", "Cc", "X-Bar"
+	};
+	const char *input = "From: foo\nTo: bar\nSubject: plop\nX-Drop: 1\n"
+		"Cc: baz\nX-Bar: 2\n\nhello world\n";
+	struct header_filter_set *set, *empty_set;
+	struct istream *istream, *filter;
+	string_t *output = t_str_new(128);
+	const unsigned char *data;
+	size_t size;
+	unsigned int i;
+
+	test_begin("header filter set");
+	set = header_filter_set_create(headers, N_ELEMENTS(headers));
+	for (i = 0; i < N_ELEMENTS(headers); i++) {
+		test_assert_idx(header_filter_set_match(set, headers[i],
+							strlen(headers[i])), i);
+	}
+	test_assert(header_filter_set_match(set, "SUBJECT", 7));
+	test_assert(header_filter_set_match(set, "x-foo", 5));
+	test_assert(!header_filter_set_match(set, "X-Baz", 5));
+	test_assert(!header_filter_set_match(set, "Subjec", 6));
+	test_assert(!header_filter_set_match(set, "Subjects", 8));
+	test_assert(!header_filter_set_match(set, "", 0));
+
+	empty_set = header_filter_set_create(NULL, 0);
+	test_assert(!header_filter_set_match(empty_set, "To", 2));
+	header_filter_set_unref(&empty_set);
+
+	/* the same set can be used by multiple streams */
+	for (i = 0; i < 2; i++) {
+		istream = test_istream_create(input);
+		filter = i_stream_create_header_filter_set(istream,
+			HEADER_FILTER_INCLUDE | HEADER_FILTER_NO_CR |
+			HEADER_FILTER_HIDE_BODY, set,
+			*null_header_filter_callback, NULL);
+		str_truncate(output, 0);
+		while (i_stream_read_more(filter, &data, &size) > 0) {
+			str_append_data(output, data, size);
+			i_stream_skip(filter, size);
+		}
+		test_assert_strcmp_idx(str_c(output),
+			"From: foo\nTo: bar\nSubject: plop\nCc: baz\n"
+			"X-Bar: 2\n\n", i);
+		i_stream_unref(&filter);
+		i_stream_unref(&istream);
+	}
+	header_filter_set_unref(&set);
+	test_assert(set == NULL);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -695,6 +749,7 @@ int main(void)
 		test_istream_strip_eoh,
 		test_istream_missing_eoh_callback,
 		test_istream_empty_missing_eoh_callback,
+		test_header_filter_set,
 		NULL
 	};
 	return test_run(test_functions);
@@ -135,9 +135,13 @@ static struct test_case {
 		parts = message_part_deserialize(pool, dest->data, dest->used,
 						 &error);
 		test_assert(parts != NULL);
-		if (parts != NULL)
+		if (parts != NULL) {
 			test_parsed_parts(is, parts);
-		else
+			/* parts are allocated in depth-first order */
+			for (unsigned int j = 0; j <= parts->children_count; j++)
+				test_assert_idx(message_part_by_idx(parts, j) ==
+						parts + j, j);
+		} else
 			i_error("message_part_deserialize: %s", error);
 		i_stream_unref(&is);
 		pool_unref(&pool);
@@ -318,11 +318,44 @@ static void test_message_snippet_nuls(void)
 	test_end();
 }
 
+static void test_message_snippet_html_long(void)
+{
+	string_t *input_text = t_str_new(8192), *expected = t_str_new(512);
+	string_t *str = t_str_new(512);
+	struct istream *input;
+	unsigned int i;
+
+	test_begin("message snippet with long html");
+	/* the html is converted in chunks - make sure entities and UTF-8
+	   characters crossing the chunk boundaries work */
+	str_append(input_text, "Content-Type: text/html; charset=utf-8\n\n"
+		   "<html><head><style>");
+	for (i = 0; i < 50; i++)
+		str_printfa(input_text, ".c%u { color: #333333; }\n", i);
+	str_append(input_text, "</style></head><body>");
+	for (i = 0; i < 100; i++)
+		str_append(input_text, "caf\xC3\xA9 &amp; cr&egrave;me ");
+	str_append(input_text, "</body></html>\n");
+
+	/* 13 characters each, the last whitespace is dropped */
+	for (i = 0; i < 15; i++)
+		str_append(expected, "caf\xC3\xA9 & cr\xC3\xA8me ");
+	str_append(expected, "caf\xC3\xA9");
+
+	input = i_stream_create_from_data(str_data(input_text),
+					  str_len(input_text));
+	test_assert(message_snippet_generate(input, 200, str) == 0);
+	test_assert_strcmp(str_c(str), str_c(expected));
+	i_stream_destroy(&input);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_snippet,
 		test_message_snippet_nuls,
+		test_message_snippet_html_long,
 		NULL
 	};
 	return test_run(test_functions);
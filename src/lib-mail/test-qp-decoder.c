@@ -27,6 +27,8 @@ static void test_qp_decoder(void)
 		{ "foo_bar", "foo_bar", 0, 0 },
 		{ "\n\n", "\r\n\r\n", 0, 0 },
 		{ "\r\n\n\n\r\n", "\r\n\r\n\r\n\r\n", 0, 0 },
+		{ "foo bar=3D\r\nbaz =\r\nqux\tx=\r\n", "foo bar=\r\nbaz qux\tx", 0, 0 },
+		{ "a b\tc =3d=3D\r\n \r\n", "a b\tc ==\r\n\r\n", 0, 0 },
 
 		{ "foo=", "foo=", 4, -1 },
 		{ "foo= =66", "foo= f", 5, -1 },
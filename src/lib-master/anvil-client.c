@@ -21,6 +21,7 @@ struct anvil_client {
 	struct ostream *output;
 	struct io *io;
 	struct timeout *to_query;
+	struct timeout *to_flush;
 
 	struct timeout *to_reconnect;
 	time_t last_reconnect;
@@ -179,6 +180,9 @@ static void anvil_client_disconnect(struct anvil_client *client)
 {
 	anvil_client_cancel_queries(client);
 	if (client->fd != -1) {
+		/* send any pending batched commands before disconnecting */
+		timeout_remove(&client->to_flush);
+		o_stream_uncork(client->output);
 		io_remove(&client->io);
 		i_stream_destroy(&client->input);
 		o_stream_destroy(&client->output);
@@ -198,6 +202,16 @@ static void anvil_client_timeout(struct anvil_client *client)
 	anvil_reconnect(client);
 }
 
+static void anvil_client_flush(struct anvil_client *client)
+{
+	timeout_remove(&client->to_flush);
+	if (o_stream_uncork_flush(client->output) < 0) {
+		i_error("write(%s) failed: %s", client->path,
+			o_stream_get_error(client->output));
+		anvil_reconnect(client);
+	}
+}
+
 static int anvil_client_send(struct anvil_client *client, const char *cmd)
 {
 	struct const_iovec iov[2];
@@ -206,6 +220,12 @@ static int anvil_client_send(struct anvil_client *client, const char *cmd)
 		if (anvil_client_connect(client, FALSE) < 0)
 			return -1;
 	}
+	if ((client->flags & ANVIL_CLIENT_FLAG_BATCH) != 0 &&
+	    client->to_flush == NULL) {
+		o_stream_cork(client->output);
+		client->to_flush = timeout_add_short(0, anvil_client_flush,
+						     client);
+	}
 
 	iov[0].iov_base = cmd;
 	iov[0].iov_len = strlen(cmd);
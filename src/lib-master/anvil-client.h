@@ -3,7 +3,12 @@
 
 enum anvil_client_flags {
 	/* if connect() fails with ENOENT, hide the error */
-	ANVIL_CLIENT_FLAG_HIDE_ENOENT	= 0x01
+	ANVIL_CLIENT_FLAG_HIDE_ENOENT	= 0x01,
+	/* Don't write each query/command immediately. Instead buffer them
+	   and send them all with a single write when the ioloop runs next.
+	   This reduces the number of writes and anvil wakeups when many
+	   queries are sent at the same time. */
+	ANVIL_CLIENT_FLAG_BATCH		= 0x02,
 };
 
 /* reply=NULL if query failed */
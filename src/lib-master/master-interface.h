@@ -43,6 +43,16 @@ enum master_login_state {
 /* getenv(MASTER_SERVICE_NAME) provides the service's name */
 #define MASTER_SERVICE_ENV "SERVICE_NAME"
 
+/* getenv(MASTER_PROFILE_ENV) != NULL if the process should start with the
+   sampling profiler enabled. Afterwards the master toggles it by sending
+   SIGPROF. */
+#define MASTER_PROFILE_ENV "PROFILE"
+
+/* getenv(MASTER_FORK_SERVER_FD_ENV) contains the fd of the fork server
+   connection to master if the process was started as the service's fork
+   server (service { fork_server=yes }). */
+#define MASTER_FORK_SERVER_FD_ENV "FORK_SERVER_FD"
+
 /* getenv(MASTER_CLIENT_LIMIT_ENV) provides maximum
    master_status.available_count as specified in configuration file */
 #define MASTER_CLIENT_LIMIT_ENV "CLIENT_LIMIT"
@@ -0,0 +1,184 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hostpid.h"
+#include "randgen.h"
+#include "env-util.h"
+#include "write-full.h"
+#include "strescape.h"
+#include "stats-client.h"
+#include "master-service-settings.h"
+#include "master-service-private.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* The fork server is started by the master like a normal service process,
+   except with MASTER_FORK_SERVER_FD_ENV set. It runs the service's
+   initialization up to master_service_init_finish(), and then waits for fork
+   requests from the master. Each request is a "<uid>\t<profile>" line.
+
+   For each request it forks an intermediate process, which forks the actual
+   service process, writes its PID to the master and exits. The service
+   process gets orphaned and re-parented to the master (a child subreaper), so
+   the master can wait for it like for the processes it forks itself. The
+   service process then continues from master_service_init_finish(). */
+
+#define FORK_SERVER_MAX_LINE_LEN 128
+
+static void
+master_service_fork_server_prepare(struct master_service *service)
+{
+	/* The forked processes must not share any connections or the ioloop's
+	   kernel handler with each other. The fork server itself won't use
+	   them anymore. */
+	if (service->stats_client != NULL)
+		stats_client_deinit(&service->stats_client);
+	master_service_close_config_fd(service);
+
+	if (io_loop_have_ios(service->ioloop)) {
+		i_fatal("fork_server: Service has already added IOs before "
+			"master_service_init_finish() - fork_server=yes "
+			"isn't supported for it");
+	}
+	io_loop_release_handler(service->ioloop);
+}
+
+static void
+master_service_fork_server_child_init(struct master_service *service,
+				      unsigned int uid, bool profile)
+{
+	const char *value;
+
+	hostpid_refresh_pid();
+	random_reset_after_fork();
+	io_loop_time_refresh();
+
+	service->master_status.pid = getpid();
+	service->master_status.uid = uid;
+	env_put(MASTER_UID_ENV, dec2str(uid));
+	if (profile)
+		env_put(MASTER_PROFILE_ENV, "1");
+	else
+		env_remove(MASTER_PROFILE_ENV);
+	env_remove(MASTER_FORK_SERVER_FD_ENV);
+
+	if (service->log_with_pid)
+		master_service_init_log_with_pid(service);
+
+	/* Reconnect the per-process connections */
+	if ((service->flags & MASTER_SERVICE_FLAG_DONT_SEND_STATS) == 0) {
+		value = getenv(DOVECOT_STATS_WRITER_SOCKET_PATH);
+		if (value != NULL && value[0] != '\0')
+			service->stats_client = stats_client_init(value, FALSE);
+		else if (service->set != NULL)
+			master_service_init_stats_client(service, TRUE);
+	}
+	if ((service->flags & MASTER_SERVICE_FLAG_KEEP_CONFIG_OPEN) != 0)
+		master_service_config_socket_try_open(service);
+}
+
+static int
+master_service_fork_server_read_request(int fd, unsigned int *uid_r,
+					bool *profile_r)
+{
+	char line[FORK_SERVER_MAX_LINE_LEN];
+	const char *const *args;
+	size_t pos = 0;
+	ssize_t ret;
+
+	/* The master sends the next request only after it has received the
+	   reply to the previous one, so there's never more than one line
+	   available. */
+	for (;;) {
+		ret = read(fd, line + pos, 1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			i_error("fork_server: read() failed: %m");
+			return -1;
+		}
+		if (ret == 0) {
+			/* master closed the connection */
+			return 0;
+		}
+		if (line[pos] == '\n')
+			break;
+		if (++pos == sizeof(line)) {
+			i_error("fork_server: Too long request from master");
+			return -1;
+		}
+	}
+	line[pos] = '\0';
+
+	args = t_strsplit_tabescaped(line);
+	if (str_array_length(args) < 2 ||
+	    str_to_uint(args[0], uid_r) < 0) {
+		i_error("fork_server: Invalid request from master: %s", line);
+		return -1;
+	}
+	*profile_r = strcmp(args[1], "1") == 0;
+	return 1;
+}
+
+static void master_service_fork_server_reply(int fd, pid_t pid)
+{
+	const char *reply = t_strdup_printf("%s\n", dec2str(pid));
+
+	if (write_full(fd, reply, strlen(reply)) < 0)
+		i_error("fork_server: write() failed: %m");
+}
+
+void master_service_fork_server_run(struct master_service *service,
+				    const char *fd_str)
+{
+	unsigned int uid;
+	bool profile;
+	pid_t pid, child_pid;
+	int fd, ret, status;
+
+	if (str_to_int(fd_str, &fd) < 0)
+		i_fatal(MASTER_FORK_SERVER_FD_ENV" invalid: %s", fd_str);
+	master_service_fork_server_prepare(service);
+
+	if (write_full(fd, "READY\n", 6) < 0)
+		i_fatal("fork_server: write() failed: %m");
+
+	for (;;) {
+		T_BEGIN {
+			ret = master_service_fork_server_read_request(
+				fd, &uid, &profile);
+		} T_END;
+		if (ret <= 0)
+			lib_exit(ret < 0 ? FATAL_DEFAULT : 0);
+
+		pid = fork();
+		if (pid < 0) {
+			i_error("fork_server: fork() failed: %m");
+			master_service_fork_server_reply(fd, 0);
+			continue;
+		}
+		if (pid == 0) {
+			/* intermediate process */
+			child_pid = fork();
+			if (child_pid == 0) {
+				i_close_fd(&fd);
+				master_service_fork_server_child_init(
+					service, uid, profile);
+				return;
+			}
+			if (child_pid < 0)
+				i_error("fork_server: fork() failed: %m");
+			master_service_fork_server_reply(fd,
+				child_pid < 0 ? 0 : child_pid);
+			_exit(0);
+		}
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				i_error("fork_server: waitpid() failed: %m");
+				break;
+			}
+		}
+	}
+}
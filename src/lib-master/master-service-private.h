@@ -52,6 +52,7 @@ struct master_service {
 	unsigned int last_sent_status_avail_count;
 	time_t last_sent_status_time;
 	struct timeout *to_status;
+	struct timeout *to_callback_stats;
 
 	bool (*idle_die_callback)(void);
 	void (*die_callback)(void);
@@ -87,6 +88,7 @@ struct master_service {
 	bool config_path_from_master:1;
 	bool log_initialized:1;
 	bool init_finished:1;
+	bool log_with_pid:1;
 };
 
 void master_service_io_listeners_add(struct master_service *service);
@@ -105,4 +107,8 @@ void master_service_haproxy_new(struct master_service *service,
 				struct master_service_connection *conn);
 void master_service_haproxy_abort(struct master_service *service);
 
+/* Run the fork server, which returns only in the forked service processes. */
+void master_service_fork_server_run(struct master_service *service,
+				    const char *fd_str);
+
 #endif
@@ -0,0 +1,376 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "str.h"
+#include "fd-util.h"
+#include "lib-signals.h"
+#include "backtrace-string.h"
+#include "master-service-private.h"
+#include "master-service-profile.h"
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#define PROFILE_SAMPLE_INTERVAL_USECS 10000
+#define PROFILE_DRAIN_INTERVAL_MSECS 1000
+#define PROFILE_SEND_INTERVAL_SECS 10
+/* Samples taken between drains. 100 samples/sec are taken at most, unless
+   the process has multiple threads. */
+#define PROFILE_MAX_SAMPLES 256
+#define PROFILE_MAX_FRAMES 32
+/* profile_signal(), lib-signals' sig_handler() and the signal trampoline */
+#define PROFILE_SKIP_FRAMES 3
+#define PROFILE_MAX_LABELS 64
+#define PROFILE_DROPPED_STACK "[dropped]"
+
+struct profile_sample {
+	unsigned int label_idx;
+	unsigned int frame_count;
+	void *frames[PROFILE_MAX_FRAMES];
+};
+
+struct profile_stack {
+	const char *label;
+	const char *stack;
+	unsigned int count;
+};
+
+static struct event_category event_category_profile = {
+	.name = "profile",
+};
+
+/* Written by the signal handler, read by profile_drain() */
+static struct profile_sample profile_samples[PROFILE_MAX_SAMPLES];
+static volatile unsigned int profile_write_idx, profile_read_idx;
+static volatile unsigned int profile_dropped_count;
+static volatile sig_atomic_t profile_sampling;
+static volatile sig_atomic_t profile_label_idx;
+
+static bool profile_initialized;
+static pid_t profile_pid;
+static int profile_toggle_fd[2] = { -1, -1 };
+static struct io *profile_toggle_io;
+static struct timeout *profile_to;
+static time_t profile_last_send;
+static struct event *profile_event;
+
+static pool_t profile_label_pool;
+static ARRAY(const char *) profile_labels;
+/* return address => function name */
+static pool_t profile_symbol_pool;
+static HASH_TABLE(void *, const char *) profile_symbols;
+/* "label\tstack" => struct profile_stack */
+static pool_t profile_stack_pool;
+static HASH_TABLE(const char *, struct profile_stack *) profile_stacks;
+
+static void
+profile_signal(const siginfo_t *si, void *context ATTR_UNUSED)
+{
+	void *frames[PROFILE_SKIP_FRAMES + PROFILE_MAX_FRAMES];
+	struct profile_sample *sample;
+	unsigned int idx;
+	int count;
+	char c = 0;
+
+	/* we're in a signal handler - don't do anything unsafe */
+	if (si->si_code == SI_USER) {
+		/* toggle request from master - handle it in ioloop */
+		if (write(profile_toggle_fd[1], &c, 1) < 0) {
+			/* pipe is full - there are already enough toggles */
+		}
+		return;
+	}
+	if (profile_sampling == 0)
+		return;
+
+	idx = profile_write_idx;
+	if (idx - profile_read_idx >= PROFILE_MAX_SAMPLES) {
+		profile_dropped_count++;
+		return;
+	}
+	count = backtrace_get_addresses(frames, N_ELEMENTS(frames));
+	if (count <= PROFILE_SKIP_FRAMES)
+		return;
+
+	sample = &profile_samples[idx % PROFILE_MAX_SAMPLES];
+	sample->label_idx = profile_label_idx;
+	sample->frame_count = count - PROFILE_SKIP_FRAMES;
+	memcpy(sample->frames, frames + PROFILE_SKIP_FRAMES,
+	       sample->frame_count * sizeof(sample->frames[0]));
+	profile_write_idx = idx + 1;
+}
+
+static const char *profile_symbol_lookup(void *address)
+{
+	const char *name;
+	string_t *str;
+
+	name = hash_table_lookup(profile_symbols, address);
+	if (name == NULL) {
+		str = t_str_new(64);
+		backtrace_append_symbol(str, address);
+		name = p_strdup(profile_symbol_pool, str_c(str));
+		hash_table_insert(profile_symbols, address, name);
+	}
+	return name;
+}
+
+static void
+profile_stack_add(const char *label, const char *stack, unsigned int count)
+{
+	struct profile_stack *pstack;
+	const char *key, *tab;
+
+	key = t_strconcat(label, "\t", stack, NULL);
+	pstack = hash_table_lookup(profile_stacks, key);
+	if (pstack == NULL) {
+		pstack = p_new(profile_stack_pool, struct profile_stack, 1);
+		key = p_strdup(profile_stack_pool, key);
+		tab = strchr(key, '\t');
+		pstack->label = p_strdup_until(profile_stack_pool, key, tab);
+		pstack->stack = tab + 1;
+		hash_table_insert(profile_stacks, key, pstack);
+	}
+	pstack->count += count;
+}
+
+static void profile_sample_add(const struct profile_sample *sample)
+{
+	string_t *stack = t_str_new(256);
+	const char *label;
+	unsigned int i;
+
+	/* folded stacks go from the outermost function to the innermost */
+	for (i = sample->frame_count; i > 0; i--) {
+		if (str_len(stack) > 0)
+			str_append_c(stack, ';');
+		str_append(stack, profile_symbol_lookup(sample->frames[i-1]));
+	}
+	label = sample->label_idx < array_count(&profile_labels) ?
+		array_idx_elem(&profile_labels, sample->label_idx) : "";
+	profile_stack_add(label, str_c(stack), 1);
+}
+
+static void profile_send(void)
+{
+	struct hash_iterate_context *iter;
+	struct profile_stack *pstack;
+	const char *key;
+
+	profile_last_send = ioloop_time;
+
+	iter = hash_table_iterate_init(profile_stacks);
+	while (hash_table_iterate(iter, profile_stacks, &key, &pstack)) {
+		struct event_passthrough *e =
+			event_create_passthrough(profile_event)->
+			set_name("process_profile_samples")->
+			add_str("label", pstack->label)->
+			add_str("stack", pstack->stack)->
+			add_int("samples", pstack->count);
+		e_debug(e->event(), "%u samples (label=%s): %s",
+			pstack->count, pstack->label, pstack->stack);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	hash_table_clear(profile_stacks, TRUE);
+	p_clear(profile_stack_pool);
+}
+
+static void profile_drain(void *context ATTR_UNUSED)
+{
+	unsigned int dropped;
+
+	while (profile_read_idx != profile_write_idx) {
+		T_BEGIN {
+			profile_sample_add(&profile_samples[
+				profile_read_idx % PROFILE_MAX_SAMPLES]);
+		} T_END;
+		profile_read_idx++;
+	}
+	dropped = profile_dropped_count;
+	if (dropped > 0) {
+		profile_dropped_count -= dropped;
+		T_BEGIN {
+			profile_stack_add("", PROFILE_DROPPED_STACK, dropped);
+		} T_END;
+	}
+
+	if (ioloop_time - profile_last_send >= PROFILE_SEND_INTERVAL_SECS)
+		profile_send();
+}
+
+static void profile_start(void)
+{
+	struct itimerval itv;
+	void *frame;
+
+	if (profile_sampling != 0)
+		return;
+
+	/* the first backtrace() call may need to load the unwinder, which
+	   isn't safe to do in the signal handler */
+	if (backtrace_get_addresses(&frame, 1) < 0) {
+		i_warning("Profiling isn't supported on this system");
+		return;
+	}
+
+	i_zero(&itv);
+	itv.it_interval.tv_usec = PROFILE_SAMPLE_INTERVAL_USECS;
+	itv.it_value = itv.it_interval;
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0) {
+		i_error("setitimer(ITIMER_PROF) failed: %m");
+		return;
+	}
+	profile_sampling = 1;
+	profile_last_send = ioloop_time;
+	profile_to = timeout_add_to(io_loop_get_root(),
+				    PROFILE_DRAIN_INTERVAL_MSECS,
+				    profile_drain, NULL);
+	e_debug(profile_event, "Profiling started");
+}
+
+static void profile_stop(void)
+{
+	struct itimerval itv;
+
+	if (profile_sampling == 0)
+		return;
+
+	i_zero(&itv);
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0)
+		i_error("setitimer(ITIMER_PROF) failed: %m");
+	profile_sampling = 0;
+	profile_label_idx = 0;
+	timeout_remove(&profile_to);
+
+	profile_drain(NULL);
+	profile_send();
+	e_debug(profile_event, "Profiling stopped");
+}
+
+static void profile_toggle_input(void *context ATTR_UNUSED)
+{
+	char buf[32];
+	ssize_t ret;
+
+	ret = read(profile_toggle_fd[0], buf, sizeof(buf));
+	if (ret < 0) {
+		if (errno != EAGAIN)
+			i_error("read(profile toggle pipe) failed: %m");
+		return;
+	}
+	if (ret == 0) {
+		i_error("read(profile toggle pipe) failed: EOF");
+		io_remove(&profile_toggle_io);
+		return;
+	}
+	/* the master sends one signal per toggle */
+	if (ret % 2 == 0)
+		;
+	else if (profile_sampling != 0)
+		profile_stop();
+	else
+		profile_start();
+}
+
+void master_service_profile_init(struct master_service *service, bool enable)
+{
+	const char *label = "";
+
+	i_assert(!profile_initialized);
+
+	if (pipe(profile_toggle_fd) < 0) {
+		i_error("pipe() failed: %m");
+		return;
+	}
+	fd_set_nonblock(profile_toggle_fd[0], TRUE);
+	fd_set_nonblock(profile_toggle_fd[1], TRUE);
+	fd_close_on_exec(profile_toggle_fd[0], TRUE);
+	fd_close_on_exec(profile_toggle_fd[1], TRUE);
+	profile_toggle_io = io_add_to(io_loop_get_root(), profile_toggle_fd[0],
+				      IO_READ, profile_toggle_input, NULL);
+
+	profile_initialized = TRUE;
+	profile_pid = getpid();
+	profile_event = event_create(NULL);
+	event_add_category(profile_event, &event_category_profile);
+	event_add_str(profile_event, "service", service->name);
+
+	profile_label_pool = pool_alloconly_create("profile labels", 512);
+	i_array_init(&profile_labels, 16);
+	array_push_back(&profile_labels, &label);
+	profile_symbol_pool = pool_alloconly_create("profile symbols", 4096);
+	hash_table_create_direct(&profile_symbols, default_pool, 0);
+	profile_stack_pool = pool_alloconly_create("profile stacks", 4096);
+	hash_table_create(&profile_stacks, default_pool, 0, str_hash, strcmp);
+
+	lib_signals_set_handler(SIGPROF, LIBSIG_FLAG_RESTART,
+				profile_signal, NULL);
+	if (enable)
+		profile_start();
+}
+
+void master_service_profile_deinit(void)
+{
+	struct itimerval itv;
+
+	if (!profile_initialized)
+		return;
+
+	if (profile_pid == getpid())
+		profile_stop();
+	else {
+		/* forked child - the samples belong to the parent */
+		i_zero(&itv);
+		(void)setitimer(ITIMER_PROF, &itv, NULL);
+		profile_sampling = 0;
+		timeout_remove(&profile_to);
+	}
+	lib_signals_unset_handler(SIGPROF, profile_signal, NULL);
+	io_remove(&profile_toggle_io);
+	i_close_fd(&profile_toggle_fd[0]);
+	i_close_fd(&profile_toggle_fd[1]);
+
+	hash_table_destroy(&profile_stacks);
+	pool_unref(&profile_stack_pool);
+	hash_table_destroy(&profile_symbols);
+	pool_unref(&profile_symbol_pool);
+	array_free(&profile_labels);
+	pool_unref(&profile_label_pool);
+	event_unref(&profile_event);
+	profile_read_idx = profile_write_idx = 0;
+	profile_dropped_count = 0;
+	profile_initialized = FALSE;
+}
+
+void master_service_profile_set_label(const char *label)
+{
+	const char *const *labels;
+	unsigned int i, count;
+
+	if (profile_sampling == 0)
+		return;
+	if (label == NULL) {
+		profile_label_idx = 0;
+		return;
+	}
+
+	labels = array_get(&profile_labels, &count);
+	for (i = 1; i < count; i++) {
+		if (strcmp(labels[i], label) == 0) {
+			profile_label_idx = i;
+			return;
+		}
+	}
+	if (count >= PROFILE_MAX_LABELS) {
+		/* too many different labels - don't grow forever */
+		profile_label_idx = 0;
+		return;
+	}
+	label = p_strdup(profile_label_pool, label);
+	array_push_back(&profile_labels, &label);
+	profile_label_idx = count;
+}
@@ -0,0 +1,21 @@
+#ifndef MASTER_SERVICE_PROFILE_H
+#define MASTER_SERVICE_PROFILE_H
+
+struct master_service;
+
+/* The sampling profiler is toggled by the master process sending SIGPROF
+   (doveadm process profile). While it's enabled, the process's call stack is
+   sampled every 10 ms of used CPU time. The samples are aggregated into
+   folded stacks ("main;func1;func2") and sent every 10 seconds to the stats
+   process as "process_profile_samples" events with service, label, stack and
+   samples fields. */
+
+void master_service_profile_init(struct master_service *service, bool enable);
+void master_service_profile_deinit(void);
+
+/* Set the label for the following samples, for example the name of the IMAP
+   command being run. NULL clears the label. This does nothing unless the
+   profiler is enabled. */
+void master_service_profile_set_label(const char *label);
+
+#endif
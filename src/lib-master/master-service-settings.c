@@ -5,7 +5,9 @@
 #include "event-filter.h"
 #include "path-util.h"
 #include "istream.h"
+#include "istream-concat.h"
 #include "write-full.h"
+#include "fdpass.h"
 #include "str.h"
 #include "strescape.h"
 #include "syslog-util.h"
@@ -13,6 +15,7 @@
 #include "env-util.h"
 #include "execv-const.h"
 #include "settings-parser.h"
+#include "settings-binary.h"
 #include "stats-client.h"
 #include "master-service-private.h"
 #include "master-service-ssl-settings.h"
@@ -27,6 +30,19 @@
 #define DOVECOT_CONFIG_SOCKET_PATH PKG_RUNDIR"/config"
 
 #define CONFIG_READ_TIMEOUT_SECS 10
+#define CONFIG_REPLY_ERROR_PREFIX "\nERROR "
+
+struct config_reply {
+	/* the reply's first line, followed by whatever else was read */
+	char buf[8192];
+	size_t pos, line_len;
+	int snapshot_fd;
+	/* text reply's settings, if the binary snapshot wasn't received */
+	struct istream *input;
+
+	bool binary_requested:1;
+	bool line_read:1;
+};
 #define CONFIG_HANDSHAKE "VERSION\tconfig\t2\t0\n"
 
 #undef DEF
@@ -53,6 +69,8 @@ static const struct setting_define master_service_setting_defines[] = {
 	DEF(BOOL, version_ignore),
 	DEF(BOOL, shutdown_clients),
 	DEF(BOOL, verbose_proctitle),
+	DEF(TIME_MSECS, ioloop_callback_warn_time),
+	DEF(BOOL, log_write_buffering),
 
 	DEF(STR, haproxy_trusted_networks),
 	DEF(TIME, haproxy_timeout),
@@ -90,6 +108,8 @@ static const struct master_service_settings master_service_default_settings = {
 	.version_ignore = FALSE,
 	.shutdown_clients = TRUE,
 	.verbose_proctitle = FALSE,
+	.ioloop_callback_warn_time = 0,
+	.log_write_buffering = FALSE,
 
 	.haproxy_trusted_networks = "",
 	.haproxy_timeout = 3
@@ -351,9 +371,13 @@ master_service_open_config(struct master_service *service,
 
 static void
 config_build_request(struct master_service *service, string_t *str,
-		     const struct master_service_settings_input *input)
+		     const struct master_service_settings_input *input,
+		     bool binary)
 {
 	str_append(str, "REQ");
+	/* old config processes ignore this and send the text reply */
+	if (binary)
+		str_append(str, "\tbinary");
 	if (input->module != NULL)
 		str_printfa(str, "\tmodule=%s", input->module);
 	if (input->extra_modules != NULL) {
@@ -383,7 +407,7 @@ config_build_request(struct master_service *service, string_t *str,
 static int
 config_send_request(struct master_service *service,
 		    const struct master_service_settings_input *input,
-		    int fd, const char *path, const char **error_r)
+		    int fd, const char *path, bool binary, const char **error_r)
 {
 	int ret;
 
@@ -392,7 +416,7 @@ config_send_request(struct master_service *service,
 
 		str = t_str_new(128);
 		str_append(str, CONFIG_HANDSHAKE);
-		config_build_request(service, str, input);
+		config_build_request(service, str, input, binary);
 		ret = write_full(fd, str_data(str), str_len(str));
 	} T_END;
 	if (ret < 0) {
@@ -436,30 +460,77 @@ master_service_apply_config_overrides(struct master_service *service,
 	return 0;
 }
 
+static bool config_reply_get_line_len(struct config_reply *reply)
+{
+	const char *p;
+	size_t n;
+
+	if (reply->buf[0] == '\n') {
+		/* either an empty header line or an error reply */
+		n = I_MIN(reply->pos, strlen(CONFIG_REPLY_ERROR_PREFIX));
+		if (strncmp(reply->buf, CONFIG_REPLY_ERROR_PREFIX, n) != 0) {
+			reply->line_len = 0;
+			return TRUE;
+		}
+		if (n < strlen(CONFIG_REPLY_ERROR_PREFIX))
+			return FALSE;
+		p = strchr(reply->buf + 1, '\n');
+	} else {
+		p = strchr(reply->buf, '\n');
+	}
+	if (p == NULL)
+		return FALSE;
+	reply->line_len = p - reply->buf;
+	return TRUE;
+}
+
 static int
-config_read_reply_header(struct istream *istream, const char *path, pool_t pool,
-			 const struct master_service_settings_input *input,
-			 struct master_service_settings_output *output_r,
-			 const char **error_r)
+config_read_reply_line(int fd, const char *path, struct config_reply *reply,
+		       const char **error_r)
 {
-	const char *line;
+	size_t size = sizeof(reply->buf) - 1;
 	ssize_t ret;
 
-	while ((ret = i_stream_read(istream)) > 0) {
-		line = i_stream_next_line(istream);
-		if (line != NULL)
-			break;
-	}
-	if (ret <= 0) {
-		if (ret == 0)
-			return 1;
-		*error_r = istream->stream_errno != 0 ?
-			t_strdup_printf("read(%s) failed: %s", path,
-					i_stream_get_error(istream)) :
-			t_strdup_printf("read(%s) failed: EOF", path);
-		return -1;
+	for (;;) {
+		/* the snapshot fd is sent along with the beginning of
+		   the reply */
+		if (reply->pos == 0 && reply->binary_requested) {
+			ret = fd_read(fd, reply->buf, size,
+				      &reply->snapshot_fd);
+		} else {
+			ret = read(fd, reply->buf + reply->pos,
+				   size - reply->pos);
+		}
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) {
+				/* most likely timed out. the caller continues
+				   from the same position if there's time. */
+				return 1;
+			}
+			*error_r = ret < 0 ?
+				t_strdup_printf("read(%s) failed: %m", path) :
+				t_strdup_printf("read(%s) failed: EOF", path);
+			return -1;
+		}
+		reply->pos += ret;
+		reply->buf[reply->pos] = '\0';
+		if (config_reply_get_line_len(reply)) {
+			reply->buf[reply->line_len] = '\0';
+			return 0;
+		}
+		if (reply->pos == size) {
+			*error_r = t_strdup_printf(
+				"read(%s) failed: Too long reply", path);
+			return -1;
+		}
 	}
+}
 
+static void
+config_reply_parse_header(pool_t pool, const char *line,
+			  const struct master_service_settings_input *input,
+			  struct master_service_settings_output *output_r)
+{
 	T_BEGIN {
 		const char *const *arg = t_strsplit_tabescaped(line);
 		ARRAY_TYPE(const_string) services;
@@ -484,7 +555,127 @@ config_read_reply_header(struct istream *istream, const char *path, pool_t pool,
 			output_r->specific_services = array_front(&services);
 		}
 	} T_END;
-	return 0;
+}
+
+static int
+config_read_binary_reply(struct master_service *service,
+			 struct config_reply *reply, const char *path,
+			 struct setting_parser_context *parser,
+			 const struct master_service_settings_input *input,
+			 struct master_service_settings_output *output_r,
+			 const char **error_r)
+{
+	struct settings_binary *bin;
+	enum settings_binary_flags flags;
+	int ret;
+
+	ret = settings_binary_init_fd(reply->snapshot_fd, &bin, error_r);
+	i_close_fd(&reply->snapshot_fd);
+	if (ret < 0) {
+		*error_r = t_strdup_printf("%s: %s", path, *error_r);
+		return -1;
+	}
+
+	flags = settings_binary_get_flags(bin);
+	output_r->service_uses_local =
+		(flags & SETTINGS_BINARY_FLAG_SERVICE_USES_LOCAL) != 0;
+	output_r->service_uses_remote =
+		(flags & SETTINGS_BINARY_FLAG_SERVICE_USES_REMOTE) != 0;
+	output_r->used_local =
+		(flags & SETTINGS_BINARY_FLAG_USED_LOCAL) != 0;
+	output_r->used_remote =
+		(flags & SETTINGS_BINARY_FLAG_USED_REMOTE) != 0;
+	if (input->service == NULL) {
+		output_r->specific_services =
+			settings_binary_get_services(bin, service->set_pool);
+	}
+
+	ret = settings_parse_binary(parser, bin);
+	if (ret < 0)
+		*error_r = t_strdup(settings_parser_get_error(parser));
+	settings_binary_deinit(&bin);
+	return ret;
+}
+
+static int
+config_read_reply(struct master_service *service, int fd, const char *path,
+		  struct config_reply *reply,
+		  struct setting_parser_context *parser,
+		  const struct master_service_settings_input *input,
+		  struct master_service_settings_output *output_r,
+		  const char **error_r)
+{
+	struct istream *inputs[3];
+	const char *line;
+	int ret;
+
+	if (!reply->line_read) {
+		ret = config_read_reply_line(fd, path, reply, error_r);
+		if (ret != 0)
+			return ret;
+		reply->line_read = TRUE;
+		line = reply->buf;
+
+		if (str_begins(line, CONFIG_REPLY_ERROR_PREFIX)) {
+			*error_r = t_strdup(line +
+					    strlen(CONFIG_REPLY_ERROR_PREFIX));
+			return -1;
+		}
+		if (str_begins(line, "BIN\t")) {
+			if (reply->snapshot_fd != -1) {
+				return config_read_binary_reply(service, reply,
+					path, parser, input, output_r, error_r);
+			}
+			/* the snapshot fd didn't arrive - ask for the text
+			   reply instead */
+			if (config_send_request(service, input, fd, path,
+						FALSE, error_r) < 0)
+				return -1;
+			reply->binary_requested = FALSE;
+			reply->line_read = FALSE;
+			reply->pos = 0;
+			return config_read_reply(service, fd, path, reply,
+						 parser, input, output_r,
+						 error_r);
+		}
+		/* text reply from a config process that doesn't support
+		   binary snapshots */
+		if (reply->snapshot_fd != -1)
+			i_close_fd(&reply->snapshot_fd);
+		config_reply_parse_header(service->set_pool, line,
+					  input, output_r);
+
+		/* the settings may have been partially read already */
+		inputs[0] = i_stream_create_copy_from_data(
+			reply->buf + reply->line_len + 1,
+			reply->pos - reply->line_len - 1);
+		inputs[1] = i_stream_create_fd(fd, SIZE_MAX);
+		inputs[2] = NULL;
+		reply->input = i_stream_create_concat(inputs);
+		i_stream_set_name(reply->input, path);
+		i_stream_unref(&inputs[0]);
+		i_stream_unref(&inputs[1]);
+	}
+
+	ret = settings_parse_stream_read(parser, reply->input);
+	if (ret < 0)
+		*error_r = t_strdup(settings_parser_get_error(parser));
+	return ret;
+}
+
+static void config_reply_deinit(struct config_reply *reply)
+{
+	if (reply->snapshot_fd != -1)
+		i_close_fd(&reply->snapshot_fd);
+	i_stream_unref(&reply->input);
+}
+
+static bool config_fd_is_socket(int fd)
+{
+	struct stat st;
+
+	/* FIFOs can't pass the snapshot fd */
+	return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
 }
 
 void master_service_config_socket_try_open(struct master_service *service)
@@ -566,13 +757,13 @@ int master_service_settings_read(struct master_service *service,
 	ARRAY(const struct setting_parser_info *) all_roots;
 	const struct setting_parser_info *tmp_root;
 	struct setting_parser_context *parser;
-	struct istream *istream;
+	struct config_reply reply;
 	const char *path = NULL, *error;
 	void **sets;
 	unsigned int i;
 	int ret, fd = -1;
 	time_t now, timeout;
-	bool use_environment, retry;
+	bool use_environment, retry, binary = FALSE;
 
 	i_zero(output_r);
 
@@ -588,8 +779,9 @@ int master_service_settings_read(struct master_service *service,
 				return -1;
 			}
 
+			binary = config_fd_is_socket(fd);
 			if (config_send_request(service, input, fd,
-						path, error_r) == 0)
+						path, binary, error_r) == 0)
 				break;
 			i_close_fd(&fd);
 			if (!retry) {
@@ -629,21 +821,16 @@ int master_service_settings_read(struct master_service *service,
 			SETTINGS_PARSER_FLAG_IGNORE_UNKNOWN_KEYS);
 
 	if (fd != -1) {
-		istream = i_stream_create_fd(fd, SIZE_MAX);
+		i_zero(&reply);
+		reply.snapshot_fd = -1;
+		reply.binary_requested = binary;
 		now = time(NULL);
 		timeout = now + CONFIG_READ_TIMEOUT_SECS;
 		do {
 			alarm(timeout - now);
-			ret = config_read_reply_header(istream, path,
-						       service->set_pool, input,
-						       output_r, error_r);
-			if (ret == 0) {
-				ret = settings_parse_stream_read(parser,
-								 istream);
-				if (ret < 0)
-					*error_r = t_strdup(
-						settings_parser_get_error(parser));
-			}
+			ret = config_read_reply(service, fd, path, &reply,
+						parser, input, output_r,
+						error_r);
 			alarm(0);
 			if (ret <= 0)
 				break;
@@ -653,7 +840,7 @@ int master_service_settings_read(struct master_service *service,
 			   continue */
 			now = time(NULL);
 		} while (now < timeout);
-		i_stream_unref(&istream);
+		config_reply_deinit(&reply);
 
 		if (ret != 0) {
 			if (ret > 0) {
@@ -26,6 +26,8 @@ struct master_service_settings {
 	bool version_ignore;
 	bool shutdown_clients;
 	bool verbose_proctitle;
+	unsigned int ioloop_callback_warn_time;
+	bool log_write_buffering;
 
 	const char *haproxy_trusted_networks;
 	unsigned int haproxy_timeout;
@@ -86,6 +86,7 @@ static const struct setting_define master_service_ssl_server_setting_defines[] =
 	DEF(STR, ssl_alt_key),
 	DEF(STR, ssl_key_password),
 	DEF(STR, ssl_dh),
+	DEF(STR, ssl_session_ticket_key),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -97,6 +98,7 @@ static const struct master_service_ssl_server_settings master_service_ssl_server
 	.ssl_alt_key = "",
 	.ssl_key_password = "",
 	.ssl_dh = "",
+	.ssl_session_ticket_key = "",
 };
 
 static const struct setting_parser_info *master_service_ssl_server_setting_dependencies[] = {
@@ -270,6 +272,8 @@ void master_service_ssl_server_settings_to_iostream_set(
 		set_r->alt_cert.key_password = p_strdup(pool, ssl_server_set->ssl_key_password);
 	}
 	set_r->dh = p_strdup(pool, ssl_server_set->ssl_dh);
+	set_r->session_ticket_key =
+		p_strdup_empty(pool, ssl_server_set->ssl_session_ticket_key);
 	set_r->verify_remote_cert = ssl_set->ssl_verify_client_cert;
 	set_r->allow_invalid_cert = !set_r->verify_remote_cert;
 }
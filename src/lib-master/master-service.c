@@ -19,6 +19,7 @@
 #include "stats-client.h"
 #include "master-instance.h"
 #include "master-login.h"
+#include "master-service-profile.h"
 #include "master-service-ssl.h"
 #include "master-service-private.h"
 #include "master-service-settings.h"
@@ -45,6 +46,10 @@
    force it. */
 #define MASTER_SERVICE_DIE_TIMEOUT_MSECS (30*1000)
 
+/* How often to send ioloop callback stats when ioloop_callback_warn_time is
+   set. */
+#define MASTER_SERVICE_CALLBACK_STATS_INTERVAL_MSECS (60*1000)
+
 struct master_service *master_service;
 
 static struct event_category master_service_category = {
@@ -453,6 +458,10 @@ master_service_try_init_log(struct master_service *service,
 		/* logging via log service */
 		i_set_failure_internal();
 		i_set_failure_prefix("%s", prefix);
+		if (service->set != NULL) {
+			i_set_failure_internal_buffering(
+				service->set->log_write_buffering);
+		}
 		return TRUE;
 	}
 
@@ -525,6 +534,7 @@ void master_service_init_log_with_prefix(struct master_service *service,
 
 void master_service_init_log_with_pid(struct master_service *service)
 {
+	service->log_with_pid = TRUE;
 	master_service_init_log_with_prefix(service, t_strdup_printf(
 		"%s(%s): ", service->configured_name, my_pid));
 }
@@ -651,12 +661,25 @@ static void master_status_error(struct master_service *service)
 	master_service_error(service);
 }
 
+static void master_service_send_callback_stats(struct master_service *service)
+{
+	io_loop_send_callback_stats(service->ioloop);
+}
+
 void master_service_init_finish(struct master_service *service)
 {
 	enum libsig_flags sigint_flags = LIBSIG_FLAG_DELAYED;
+	const char *value;
 	struct stat st;
 
 	i_assert(!service->init_finished);
+
+	if ((service->flags & MASTER_SERVICE_FLAG_STANDALONE) == 0 &&
+	    (value = getenv(MASTER_FORK_SERVER_FD_ENV)) != NULL) {
+		/* Everything until now is shared by all the processes forked
+		   by the fork server. */
+		master_service_fork_server_run(service, value);
+	}
 	service->init_finished = TRUE;
 
 	/* From now on we'll abort() if exit() is called unexpectedly. */
@@ -680,6 +703,16 @@ void master_service_init_finish(struct master_service *service)
 		service->io_status_error = io_add(MASTER_DEAD_FD, IO_ERROR,
 						  master_status_error, service);
 		lib_signals_set_handler(SIGQUIT, 0, sig_close_listeners, service);
+		master_service_profile_init(service,
+					    getenv(MASTER_PROFILE_ENV) != NULL);
+	}
+	if (service->set != NULL &&
+	    service->set->ioloop_callback_warn_time > 0) {
+		io_loop_set_callback_stats(service->ioloop,
+			service->set->ioloop_callback_warn_time);
+		service->to_callback_stats =
+			timeout_add(MASTER_SERVICE_CALLBACK_STATS_INTERVAL_MSECS,
+				    master_service_send_callback_stats, service);
 	}
 	master_service_io_listeners_add(service);
 	if (service->want_ssl_server &&
@@ -1114,6 +1147,11 @@ static void master_service_deinit_real(struct master_service **_service)
 	master_service_io_listeners_remove(service);
 	master_service_ssl_ctx_deinit(service);
 
+	master_service_profile_deinit();
+	if (service->to_callback_stats != NULL) {
+		timeout_remove(&service->to_callback_stats);
+		master_service_send_callback_stats(service);
+	}
 	if (service->stats_client != NULL)
 		stats_client_deinit(&service->stats_client);
 	master_service_close_config_fd(service);
@@ -39,6 +39,7 @@ struct inet_listener_settings {
 	bool ssl;
 	bool reuse_port;
 	bool haproxy;
+	unsigned int reuse_port_shards;
 };
 ARRAY_DEFINE_TYPE(inet_listener_settings, struct inet_listener_settings *);
 
@@ -54,6 +55,7 @@ struct service_settings {
 	const char *chroot;
 
 	bool drop_priv_before_exec;
+	bool fork_server;
 
 	unsigned int process_min_avail;
 	unsigned int process_limit;
@@ -12,12 +12,19 @@
 
 #define STATS_CLIENT_TIMEOUT_MSECS (5*1000)
 #define STATS_CLIENT_RECONNECT_INTERVAL_MSECS (10*1000)
+/* Events are buffered and written in batches at most this much later */
+#define STATS_CLIENT_FLUSH_INTERVAL_MSECS 100
+/* If the stats process isn't reading the events fast enough, drop new events
+   instead of growing the output buffer further. */
+#define STATS_CLIENT_MAX_OUTPUT_BUFFER_SIZE (1024*1024)
 
 struct stats_client {
 	struct connection conn;
 	struct event_filter *filter;
 	struct ioloop *ioloop;
 	struct timeout *to_reconnect;
+	struct timeout *to_flush;
+	unsigned int dropped_events;
 	bool handshaked;
 	bool handshake_received_at_least_once;
 	bool silent_notfound_errors;
@@ -187,12 +194,44 @@ stats_event_write(struct stats_client *client,
 	}
 }
 
+void stats_client_flush(struct stats_client *client)
+{
+	timeout_remove(&client->to_flush);
+	if (client->conn.output != NULL)
+		o_stream_uncork(client->conn.output);
+
+	if (client->dropped_events > 0) {
+		i_warning("stats: Dropped %u events, "
+			  "because the stats process is reading them too slowly",
+			  client->dropped_events);
+		client->dropped_events = 0;
+	}
+}
+
+static void stats_client_delay_flush(struct stats_client *client)
+{
+	if (current_ioloop == NULL) {
+		/* no ioloop to flush the output later */
+		return;
+	}
+	/* Keep the output corked until the flush timeout, so multiple
+	   events get written with a single write(). The output gets flushed
+	   earlier if the buffer reaches the optimal block size. */
+	o_stream_cork(client->conn.output);
+	if (client->to_flush == NULL) {
+		/* Use the root ioloop, because the current ioloop may be a
+		   temporary one that gets destroyed before the timeout. */
+		client->to_flush =
+			timeout_add_short_to(io_loop_get_root(),
+					     STATS_CLIENT_FLUSH_INTERVAL_MSECS,
+					     stats_client_flush, client);
+	}
+}
+
 static void
 stats_client_send_event(struct stats_client *client, struct event *event,
 			const struct failure_context *ctx)
 {
-	static int recursion = 0;
-
 	if (!client->handshaked)
 		return;
 
@@ -200,21 +239,25 @@ stats_client_send_event(struct stats_client *client, struct event *event,
 	    !event_filter_match(client->filter, event, ctx))
 		return;
 
+	if (o_stream_get_buffer_used_size(client->conn.output) >=
+	    STATS_CLIENT_MAX_OUTPUT_BUFFER_SIZE) {
+		/* The stats process is lagging behind. Drop the event instead
+		   of growing the buffer further. None of its parents are sent
+		   either, so they'll be sent along with a later event. */
+		client->dropped_events++;
+		return;
+	}
+
 	/* Need to send the event for stats and/or export */
 	string_t *str = t_str_new(256);
 
-	if (++recursion == 0)
-		o_stream_cork(client->conn.output);
 	struct event *global_event = event_get_global();
 	if (global_event != NULL)
 		stats_event_write(client, global_event, NULL, ctx, str, TRUE);
 
 	stats_event_write(client, event, global_event, ctx, str, FALSE);
 	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
-
-	i_assert(recursion > 0);
-	if (--recursion == 0)
-		o_stream_uncork(client->conn.output);
+	stats_client_delay_flush(client);
 }
 
 static void
@@ -364,6 +407,7 @@ void stats_client_deinit(struct stats_client **_client)
 
 	*_client = NULL;
 
+	stats_client_flush(client);
 	event_filter_unref(&client->filter);
 	connection_deinit(&client->conn);
 	timeout_remove(&client->to_reconnect);
@@ -5,4 +5,8 @@ struct stats_client *
 stats_client_init(const char *path, bool silent_notfound_errors);
 void stats_client_deinit(struct stats_client **client);
 
+/* Write the buffered events to the stats process now. Normally they are
+   written in batches within a short time. */
+void stats_client_flush(struct stats_client *client);
+
 #endif
@@ -0,0 +1,312 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "sort.h"
+#include "mmap-util.h"
+#include "settings-binary.h"
+
+struct settings_binary_writer {
+	pool_t pool;
+	enum settings_binary_flags flags;
+	ARRAY(uint32_t) services;
+	ARRAY(struct settings_binary_record) records;
+	buffer_t *strings;
+};
+
+struct settings_binary {
+	const struct settings_binary_header *hdr;
+	const uint32_t *services;
+	const struct settings_binary_record *records;
+	const uint32_t *sorted_idx;
+	const char *strings;
+
+	void *mmap_base;
+	size_t mmap_size;
+};
+
+struct settings_binary_sort {
+	const char *key;
+	uint32_t idx;
+};
+
+struct settings_binary_writer *settings_binary_writer_init(void)
+{
+	struct settings_binary_writer *writer;
+	pool_t pool;
+
+	pool = pool_alloconly_create("settings binary writer", 1024);
+	writer = p_new(pool, struct settings_binary_writer, 1);
+	writer->pool = pool;
+	p_array_init(&writer->services, pool, 8);
+	p_array_init(&writer->records, pool, 128);
+	writer->strings = buffer_create_dynamic(pool, 4096);
+	return writer;
+}
+
+static uint32_t
+settings_binary_writer_add_string(struct settings_binary_writer *writer,
+				  const char *str)
+{
+	uint32_t offset = writer->strings->used;
+
+	buffer_append(writer->strings, str, strlen(str) + 1);
+	return offset;
+}
+
+void settings_binary_writer_add_flags(struct settings_binary_writer *writer,
+				      enum settings_binary_flags flags)
+{
+	writer->flags |= flags;
+}
+
+void settings_binary_writer_add_service(struct settings_binary_writer *writer,
+					const char *name)
+{
+	uint32_t offset = settings_binary_writer_add_string(writer, name);
+
+	array_push_back(&writer->services, &offset);
+}
+
+void settings_binary_writer_add(struct settings_binary_writer *writer,
+				const char *key, const char *value)
+{
+	struct settings_binary_record *rec;
+
+	rec = array_append_space(&writer->records);
+	rec->key_offset = settings_binary_writer_add_string(writer, key);
+	rec->value_offset = settings_binary_writer_add_string(writer, value);
+}
+
+void settings_binary_writer_deinit(struct settings_binary_writer **_writer)
+{
+	struct settings_binary_writer *writer = *_writer;
+
+	*_writer = NULL;
+	pool_unref(&writer->pool);
+}
+
+static int
+settings_binary_sort_cmp(const struct settings_binary_sort *s1,
+			 const struct settings_binary_sort *s2)
+{
+	int ret = strcmp(s1->key, s2->key);
+
+	if (ret != 0)
+		return ret;
+	return s1->idx < s2->idx ? -1 : (s1->idx > s2->idx ? 1 : 0);
+}
+
+void settings_binary_writer_finish(struct settings_binary_writer **_writer,
+				   buffer_t *dest)
+{
+	struct settings_binary_writer *writer = *_writer;
+	const struct settings_binary_record *records;
+	struct settings_binary_header hdr;
+	struct settings_binary_sort *sort;
+	const uint32_t *services;
+	unsigned int i, count, service_count;
+
+	services = array_get(&writer->services, &service_count);
+	records = array_get(&writer->records, &count);
+	i_zero(&hdr);
+	memcpy(hdr.magic, SETTINGS_BINARY_MAGIC, sizeof(hdr.magic));
+	hdr.version = SETTINGS_BINARY_VERSION;
+	hdr.flags = writer->flags;
+	hdr.service_count = service_count;
+	hdr.setting_count = count;
+	hdr.strings_size = writer->strings->used;
+	buffer_append(dest, &hdr, sizeof(hdr));
+	buffer_append(dest, services, service_count * sizeof(*services));
+	buffer_append(dest, records, count * sizeof(*records));
+
+	sort = p_new(writer->pool, struct settings_binary_sort, count);
+	for (i = 0; i < count; i++) {
+		sort[i].key = CONST_PTR_OFFSET(writer->strings->data,
+					       records[i].key_offset);
+		sort[i].idx = i;
+	}
+	i_qsort(sort, count, sizeof(*sort), settings_binary_sort_cmp);
+	for (i = 0; i < count; i++)
+		buffer_append(dest, &sort[i].idx, sizeof(sort[i].idx));
+
+	buffer_append_buf(dest, writer->strings, 0, SIZE_MAX);
+	settings_binary_writer_deinit(_writer);
+}
+
+static bool
+settings_binary_offset_valid(const struct settings_binary *bin,
+			     uint32_t offset)
+{
+	return offset < bin->hdr->strings_size;
+}
+
+int settings_binary_init(const void *data, size_t size,
+			 struct settings_binary **bin_r,
+			 const char **error_r)
+{
+	const struct settings_binary_header *hdr = data;
+	struct settings_binary *bin;
+	size_t pos, expected_size;
+	unsigned int i;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SETTINGS_BINARY_MAGIC, sizeof(hdr->magic)) != 0) {
+		*error_r = "Not a settings snapshot";
+		return -1;
+	}
+	if (hdr->version != SETTINGS_BINARY_VERSION) {
+		*error_r = t_strdup_printf(
+			"Unsupported settings snapshot version %u",
+			hdr->version);
+		return -1;
+	}
+	expected_size = sizeof(*hdr) +
+		(size_t)hdr->service_count * sizeof(uint32_t) +
+		(size_t)hdr->setting_count *
+		(sizeof(struct settings_binary_record) + sizeof(uint32_t)) +
+		hdr->strings_size;
+	if (size != expected_size) {
+		*error_r = t_strdup_printf(
+			"Settings snapshot size %zu doesn't match "
+			"the expected size %zu", size, expected_size);
+		return -1;
+	}
+
+	bin = i_new(struct settings_binary, 1);
+	bin->hdr = hdr;
+	pos = sizeof(*hdr);
+	bin->services = CONST_PTR_OFFSET(data, pos);
+	pos += hdr->service_count * sizeof(uint32_t);
+	bin->records = CONST_PTR_OFFSET(data, pos);
+	pos += hdr->setting_count * sizeof(struct settings_binary_record);
+	bin->sorted_idx = CONST_PTR_OFFSET(data, pos);
+	pos += hdr->setting_count * sizeof(uint32_t);
+	bin->strings = CONST_PTR_OFFSET(data, pos);
+
+	/* validate once, so lookups don't need to */
+	if (hdr->strings_size > 0 && bin->strings[hdr->strings_size-1] != '\0') {
+		*error_r = "Settings snapshot strings aren't NUL-terminated";
+		i_free(bin);
+		return -1;
+	}
+	for (i = 0; i < hdr->service_count; i++) {
+		if (!settings_binary_offset_valid(bin, bin->services[i]))
+			break;
+	}
+	if (i == hdr->service_count) {
+		for (i = 0; i < hdr->setting_count; i++) {
+			if (!settings_binary_offset_valid(bin, bin->records[i].key_offset) ||
+			    !settings_binary_offset_valid(bin, bin->records[i].value_offset) ||
+			    bin->sorted_idx[i] >= hdr->setting_count)
+				break;
+		}
+		if (i == hdr->setting_count) {
+			*bin_r = bin;
+			return 0;
+		}
+	}
+	*error_r = "Settings snapshot has invalid offsets";
+	i_free(bin);
+	return -1;
+}
+
+int settings_binary_init_fd(int fd, struct settings_binary **bin_r,
+			    const char **error_r)
+{
+	void *base;
+	size_t size;
+
+	base = mmap_ro_file(fd, &size);
+	if (base == MAP_FAILED) {
+		*error_r = t_strdup_printf("mmap(settings snapshot) failed: %m");
+		return -1;
+	}
+	if (base == NULL) {
+		*error_r = "Settings snapshot is empty";
+		return -1;
+	}
+	if (settings_binary_init(base, size, bin_r, error_r) < 0) {
+		if (munmap(base, size) < 0)
+			i_error("munmap(settings snapshot) failed: %m");
+		return -1;
+	}
+	(*bin_r)->mmap_base = base;
+	(*bin_r)->mmap_size = size;
+	return 0;
+}
+
+void settings_binary_deinit(struct settings_binary **_bin)
+{
+	struct settings_binary *bin = *_bin;
+
+	*_bin = NULL;
+	if (bin->mmap_base != NULL) {
+		if (munmap(bin->mmap_base, bin->mmap_size) < 0)
+			i_error("munmap(settings snapshot) failed: %m");
+	}
+	i_free(bin);
+}
+
+enum settings_binary_flags
+settings_binary_get_flags(const struct settings_binary *bin)
+{
+	return bin->hdr->flags;
+}
+
+const char *const *
+settings_binary_get_services(const struct settings_binary *bin, pool_t pool)
+{
+	const char **services;
+	unsigned int i;
+
+	services = p_new(pool, const char *, bin->hdr->service_count + 1);
+	for (i = 0; i < bin->hdr->service_count; i++)
+		services[i] = p_strdup(pool, bin->strings + bin->services[i]);
+	return services;
+}
+
+unsigned int settings_binary_get_count(const struct settings_binary *bin)
+{
+	return bin->hdr->setting_count;
+}
+
+void settings_binary_get_idx(const struct settings_binary *bin,
+			     unsigned int idx,
+			     const char **key_r, const char **value_r)
+{
+	i_assert(idx < bin->hdr->setting_count);
+
+	*key_r = bin->strings + bin->records[idx].key_offset;
+	*value_r = bin->strings + bin->records[idx].value_offset;
+}
+
+const char *settings_binary_lookup(const struct settings_binary *bin,
+				   const char *key)
+{
+	const struct settings_binary_record *rec;
+	unsigned int idx, left = 0, right = bin->hdr->setting_count;
+	int ret;
+
+	/* find the first position where the key >= wanted key */
+	while (left < right) {
+		idx = (left + right) / 2;
+		rec = &bin->records[bin->sorted_idx[idx]];
+		ret = strcmp(bin->strings + rec->key_offset, key);
+		if (ret < 0)
+			left = idx + 1;
+		else
+			right = idx;
+	}
+	/* duplicates are sorted by their parsing order - use the last one */
+	rec = NULL;
+	for (idx = left; idx < bin->hdr->setting_count; idx++) {
+		const struct settings_binary_record *next =
+			&bin->records[bin->sorted_idx[idx]];
+		if (strcmp(bin->strings + next->key_offset, key) != 0)
+			break;
+		rec = next;
+	}
+	return rec == NULL ? NULL : bin->strings + rec->value_offset;
+}
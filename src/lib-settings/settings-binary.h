@@ -0,0 +1,85 @@
+#ifndef SETTINGS_BINARY_H
+#define SETTINGS_BINARY_H
+
+/* Precompiled settings snapshot. The config process renders the settings
+   for each filter once and the processes can mmap() the result directly.
+   The snapshot is only exchanged between processes on the same host, so
+   everything is in host byte order.
+
+   Layout:
+     struct settings_binary_header
+     uint32_t service_offsets[service_count]
+     struct settings_binary_record records[setting_count] (in parsing order)
+     uint32_t sorted_idx[setting_count] (records sorted by key)
+     strings (NUL-terminated, strings_size bytes)
+*/
+
+struct settings_binary;
+
+#define SETTINGS_BINARY_MAGIC "DCFGBIN\n"
+#define SETTINGS_BINARY_VERSION 1
+
+enum settings_binary_flags {
+	SETTINGS_BINARY_FLAG_SERVICE_USES_LOCAL	= 0x01,
+	SETTINGS_BINARY_FLAG_SERVICE_USES_REMOTE	= 0x02,
+	SETTINGS_BINARY_FLAG_USED_LOCAL		= 0x04,
+	SETTINGS_BINARY_FLAG_USED_REMOTE	= 0x08,
+};
+
+struct settings_binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags; /* enum settings_binary_flags */
+	uint32_t service_count;
+	uint32_t setting_count;
+	uint32_t strings_size;
+	uint32_t unused;
+};
+
+struct settings_binary_record {
+	/* offsets to the strings area */
+	uint32_t key_offset;
+	uint32_t value_offset;
+};
+
+struct settings_binary_writer *settings_binary_writer_init(void);
+void settings_binary_writer_add_flags(struct settings_binary_writer *writer,
+				      enum settings_binary_flags flags);
+void settings_binary_writer_add_service(struct settings_binary_writer *writer,
+					const char *name);
+void settings_binary_writer_add(struct settings_binary_writer *writer,
+				const char *key, const char *value);
+void settings_binary_writer_deinit(struct settings_binary_writer **writer);
+/* Append the finished snapshot to dest and free the writer. */
+void settings_binary_writer_finish(struct settings_binary_writer **writer,
+				   buffer_t *dest);
+
+/* Access the snapshot in the given memory area, which must stay valid (and
+   4-byte aligned) until settings_binary_deinit(). Returns 0 if ok, -1 if the
+   data is invalid. */
+int settings_binary_init(const void *data, size_t size,
+			 struct settings_binary **bin_r,
+			 const char **error_r);
+/* Map the snapshot from the fd. The fd can be closed afterwards. */
+int settings_binary_init_fd(int fd, struct settings_binary **bin_r,
+			    const char **error_r);
+void settings_binary_deinit(struct settings_binary **bin);
+
+enum settings_binary_flags
+settings_binary_get_flags(const struct settings_binary *bin);
+/* Returns the NULL-terminated list of services that have more specific
+   settings. */
+const char *const *
+settings_binary_get_services(const struct settings_binary *bin, pool_t pool);
+unsigned int settings_binary_get_count(const struct settings_binary *bin);
+/* Get the idx'th setting in parsing order. */
+void settings_binary_get_idx(const struct settings_binary *bin,
+			     unsigned int idx,
+			     const char **key_r, const char **value_r);
+/* Look up a setting's value by its key with a binary search. Returns NULL if
+   the key isn't found. If the key exists multiple times, the last one
+   (i.e. the one that overrides the others) is returned. */
+const char *settings_binary_lookup(const struct settings_binary *bin,
+				   const char *key);
+
+#endif
@@ -10,6 +10,7 @@
 #include "str.h"
 #include "strescape.h"
 #include "var-expand.h"
+#include "settings-binary.h"
 #include "settings-parser.h"
 
 #include <stdio.h>
@@ -1001,6 +1002,29 @@ int settings_parse_stream(struct setting_parser_context *ctx,
 	return 1;
 }
 
+int settings_parse_binary(struct setting_parser_context *ctx,
+			  const struct settings_binary *bin)
+{
+	bool ignore_unknown_keys =
+		(ctx->flags & SETTINGS_PARSER_FLAG_IGNORE_UNKNOWN_KEYS) != 0;
+	const char *key, *value;
+	unsigned int i, count = settings_binary_get_count(bin);
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		settings_binary_get_idx(bin, i, &key, &value);
+		T_BEGIN {
+			ret = settings_parse_keyvalue(ctx, key, value);
+		} T_END;
+		if (ret < 0 || (ret == 0 && !ignore_unknown_keys)) {
+			ctx->error = p_strdup_printf(ctx->parser_pool,
+				"Setting %s: %s", key, ctx->error);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int settings_parse_stream_read(struct setting_parser_context *ctx,
 			       struct istream *input)
 {
@@ -2,6 +2,7 @@
 #define SETTINGS_PARSER_H
 
 struct var_expand_table;
+struct settings_binary;
 struct var_expand_func_table;
 
 #define SETTINGS_SEPARATOR '/'
@@ -185,6 +186,9 @@ int settings_parse_stream(struct setting_parser_context *ctx,
    0 = done, 1 = not finished yet (stream is non-blocking) */
 int settings_parse_stream_read(struct setting_parser_context *ctx,
          		       struct istream *input);
+/* Parse all settings from a precompiled settings snapshot. */
+int settings_parse_binary(struct setting_parser_context *ctx,
+			  const struct settings_binary *bin);
 /* Open file and parse it. */
 int settings_parse_file(struct setting_parser_context *ctx,
 			const char *path, size_t max_line_length);
@@ -0,0 +1,203 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "settings-parser.h"
+#include "settings-binary.h"
+#include "test-common.h"
+
+struct test_binary_settings {
+	const char *str;
+	unsigned int num;
+	ARRAY_TYPE(const_string) strlist;
+};
+
+#undef DEF
+#define DEF(type, name) \
+	SETTING_DEFINE_STRUCT_##type(#name, name, struct test_binary_settings)
+
+static const struct setting_define test_binary_setting_defines[] = {
+	DEF(STR, str),
+	DEF(UINT, num),
+	{ .type = SET_STRLIST, .key = "strlist",
+	  .offset = offsetof(struct test_binary_settings, strlist) },
+	SETTING_DEFINE_LIST_END
+};
+
+static const struct test_binary_settings test_binary_default_settings = {
+	.str = "",
+	.num = 0,
+};
+
+static const struct setting_parser_info test_binary_setting_parser_info = {
+	.defines = test_binary_setting_defines,
+	.defaults = &test_binary_default_settings,
+
+	.type_offset = SIZE_MAX,
+	.struct_size = sizeof(struct test_binary_settings),
+
+	.parent_offset = SIZE_MAX,
+};
+
+static void test_settings_binary_build(buffer_t *buf)
+{
+	struct settings_binary_writer *writer;
+
+	writer = settings_binary_writer_init();
+	settings_binary_writer_add_flags(writer,
+		SETTINGS_BINARY_FLAG_SERVICE_USES_LOCAL |
+		SETTINGS_BINARY_FLAG_USED_LOCAL);
+	settings_binary_writer_add_service(writer, "imap");
+	settings_binary_writer_add_service(writer, "pop3");
+	settings_binary_writer_add(writer, "str", "first");
+	settings_binary_writer_add(writer, "num", "10");
+	settings_binary_writer_add(writer, "strlist", "");
+	settings_binary_writer_add(writer, "strlist/b", "value\nwith lf");
+	settings_binary_writer_add(writer, "strlist/a", "");
+	settings_binary_writer_add(writer, "str", "second");
+	settings_binary_writer_finish(&writer, buf);
+	test_assert(writer == NULL);
+}
+
+static void test_settings_binary_lookup(void)
+{
+	struct settings_binary *bin;
+	const char *const *services, *key, *value, *error;
+	buffer_t *buf = t_buffer_create(256);
+
+	test_begin("settings binary lookup");
+	test_settings_binary_build(buf);
+	test_assert(settings_binary_init(buf->data, buf->used,
+					 &bin, &error) == 0);
+
+	test_assert(settings_binary_get_flags(bin) ==
+		    (SETTINGS_BINARY_FLAG_SERVICE_USES_LOCAL |
+		     SETTINGS_BINARY_FLAG_USED_LOCAL));
+	services = settings_binary_get_services(bin, pool_datastack_create());
+	test_assert(str_array_length(services) == 2);
+	test_assert_strcmp(services[0], "imap");
+	test_assert_strcmp(services[1], "pop3");
+
+	test_assert(settings_binary_get_count(bin) == 6);
+	settings_binary_get_idx(bin, 0, &key, &value);
+	test_assert_strcmp(key, "str");
+	test_assert_strcmp(value, "first");
+	settings_binary_get_idx(bin, 5, &key, &value);
+	test_assert_strcmp(key, "str");
+	test_assert_strcmp(value, "second");
+
+	/* the last duplicate wins */
+	test_assert_strcmp(settings_binary_lookup(bin, "str"), "second");
+	test_assert_strcmp(settings_binary_lookup(bin, "num"), "10");
+	test_assert_strcmp(settings_binary_lookup(bin, "strlist"), "");
+	test_assert_strcmp(settings_binary_lookup(bin, "strlist/a"), "");
+	test_assert_strcmp(settings_binary_lookup(bin, "strlist/b"),
+			   "value\nwith lf");
+	test_assert(settings_binary_lookup(bin, "") == NULL);
+	test_assert(settings_binary_lookup(bin, "nonexistent") == NULL);
+	test_assert(settings_binary_lookup(bin, "strlist/c") == NULL);
+	test_assert(settings_binary_lookup(bin, "a") == NULL);
+	test_assert(settings_binary_lookup(bin, "zzz") == NULL);
+	settings_binary_deinit(&bin);
+	test_end();
+}
+
+static void test_settings_binary_invalid(void)
+{
+	struct settings_binary_header *hdr;
+	struct settings_binary *bin;
+	const char *error;
+	buffer_t *buf = t_buffer_create(256);
+	unsigned char *data;
+
+	test_begin("settings binary invalid");
+	test_settings_binary_build(buf);
+	data = buffer_get_modifiable_data(buf, NULL);
+	hdr = (void *)data;
+
+	/* truncated */
+	test_assert(settings_binary_init(data, buf->used - 1,
+					 &bin, &error) < 0);
+	test_assert(settings_binary_init(data, sizeof(*hdr) - 1,
+					 &bin, &error) < 0);
+	/* strings not NUL-terminated */
+	data[buf->used - 1] = 'x';
+	test_assert(settings_binary_init(data, buf->used, &bin, &error) < 0);
+	data[buf->used - 1] = '\0';
+	/* invalid offset */
+	((struct settings_binary_record *)(data + sizeof(*hdr) +
+		hdr->service_count * sizeof(uint32_t)))->value_offset =
+		hdr->strings_size;
+	test_assert(settings_binary_init(data, buf->used, &bin, &error) < 0);
+	/* version mismatch */
+	hdr->version++;
+	test_assert(settings_binary_init(data, buf->used, &bin, &error) < 0);
+	/* wrong magic */
+	hdr->magic[0] = 'X';
+	test_assert(settings_binary_init(data, buf->used, &bin, &error) < 0);
+	test_end();
+}
+
+static void test_settings_binary_parse(void)
+{
+	struct setting_parser_context *parser;
+	const struct test_binary_settings *set;
+	struct settings_binary *bin;
+	const char *const *strlist, *error;
+	buffer_t *buf = t_buffer_create(256);
+	pool_t pool;
+
+	test_begin("settings binary parse");
+	test_settings_binary_build(buf);
+	test_assert(settings_binary_init(buf->data, buf->used,
+					 &bin, &error) == 0);
+
+	pool = pool_alloconly_create("test settings binary", 1024);
+	parser = settings_parser_init(pool, &test_binary_setting_parser_info, 0);
+	test_assert(settings_parse_binary(parser, bin) == 0);
+	/* the settings must not point to the snapshot */
+	settings_binary_deinit(&bin);
+	buffer_set_used_size(buf, 0);
+
+	set = settings_parser_get(parser);
+	test_assert_strcmp(set->str, "second");
+	test_assert(set->num == 10);
+	strlist = array_front(&set->strlist);
+	test_assert(array_count(&set->strlist) == 4);
+	test_assert_strcmp(strlist[0], "b");
+	test_assert_strcmp(strlist[1], "value\nwith lf");
+	test_assert_strcmp(strlist[2], "a");
+	test_assert_strcmp(strlist[3], "");
+	settings_parser_deinit(&parser);
+
+	/* unknown settings fail unless they're ignored */
+	buf = t_buffer_create(64);
+	struct settings_binary_writer *writer = settings_binary_writer_init();
+	settings_binary_writer_add(writer, "unknown", "value");
+	settings_binary_writer_finish(&writer, buf);
+	test_assert(settings_binary_init(buf->data, buf->used,
+					 &bin, &error) == 0);
+	parser = settings_parser_init(pool, &test_binary_setting_parser_info, 0);
+	test_assert(settings_parse_binary(parser, bin) < 0);
+	settings_parser_deinit(&parser);
+	parser = settings_parser_init(pool, &test_binary_setting_parser_info,
+				      SETTINGS_PARSER_FLAG_IGNORE_UNKNOWN_KEYS);
+	test_assert(settings_parse_binary(parser, bin) == 0);
+	settings_parser_deinit(&parser);
+	settings_binary_deinit(&bin);
+
+	pool_unref(&pool);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_settings_binary_lookup,
+		test_settings_binary_invalid,
+		test_settings_binary_parse,
+		NULL
+	};
+	return test_run(test_functions);
+}
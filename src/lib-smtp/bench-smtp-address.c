@@ -0,0 +1,128 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "message-address.h"
+#include "smtp-address.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+
+/* lib-smtp parses MAIL FROM/RCPT TO paths and user names in LMTP and
+   submission, and message_address_parse() parses From/To headers for
+   ENVELOPE generation and duplicate checks. The inputs are mostly the common
+   simple forms with a few addresses that need the full parser. */
+
+/* Each address is parsed this many times in a single run, so that a run
+   takes long enough to be timed reliably. */
+#define BENCH_LOOPS_PER_RUN 10000
+
+static const char *bench_paths[] = {
+	"<john.smith@example.com>",
+	"<j@mail.example.org>",
+	"<first.last+tag@sub.domain.example.net>",
+	"<noreply-1234567@bounces.example.com>",
+	"<\"quoted local\"@example.com>",
+	"<@relay.example.com:user@example.com>",
+};
+
+static const char *bench_usernames[] = {
+	"john.smith@example.com",
+	"user",
+	"first.last@sub.domain.example.net",
+};
+
+static const char *bench_headers[] = {
+	"john.smith@example.com",
+	"John Smith <john.smith@example.com>",
+	"<noreply@example.com>",
+	"Example Newsletter <newsletter@lists.example.org>",
+	"\"Smith, John\" <john.smith@example.com>",
+	"user@example.com (John Smith)",
+};
+
+static uoff_t bench_strings_size(const char *const *strings, unsigned int count)
+{
+	uoff_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		size += strlen(strings[i]);
+	return size * BENCH_LOOPS_PER_RUN;
+}
+
+static void bench_smtp_path(pool_t pool)
+{
+	struct smtp_address *address;
+	const char *error;
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_paths); j++) {
+			if (smtp_address_parse_path(pool, bench_paths[j],
+					SMTP_ADDRESS_PARSE_FLAG_PRESERVE_RAW,
+					&address, &error) < 0)
+				i_fatal("%s: %s", bench_paths[j], error);
+		}
+		p_clear(pool);
+	}
+}
+
+static void bench_smtp_username(pool_t pool)
+{
+	struct smtp_address *address;
+	const char *error;
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_usernames); j++) {
+			if (smtp_address_parse_username(pool,
+					bench_usernames[j],
+					&address, &error) < 0)
+				i_fatal("%s: %s", bench_usernames[j], error);
+		}
+		p_clear(pool);
+	}
+}
+
+static void bench_message_address(pool_t pool)
+{
+	struct message_address *addr;
+	unsigned int i, j;
+
+	for (i = 0; i < BENCH_LOOPS_PER_RUN; i++) {
+		for (j = 0; j < N_ELEMENTS(bench_headers); j++) {
+			addr = message_address_parse(pool,
+				(const unsigned char *)bench_headers[j],
+				strlen(bench_headers[j]), UINT_MAX, 0);
+			i_assert(addr != NULL);
+		}
+		p_clear(pool);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	pool_t pool;
+
+	lib_init();
+
+	if (argc > 1)
+		i_fatal("Usage: %s", argv[0]);
+
+	pool = pool_alloconly_create("bench address", 4096);
+	test_bench_run("smtp_address_parse_path",
+		       bench_strings_size(bench_paths, N_ELEMENTS(bench_paths)),
+		       bench_smtp_path, pool, NULL);
+	test_bench_run("smtp_address_parse_username",
+		       bench_strings_size(bench_usernames,
+					  N_ELEMENTS(bench_usernames)),
+		       bench_smtp_username, pool, NULL);
+	test_bench_run("message_address_parse",
+		       bench_strings_size(bench_headers,
+					  N_ELEMENTS(bench_headers)),
+		       bench_message_address, pool, NULL);
+	pool_unref(&pool);
+
+	lib_deinit();
+	return 0;
+}
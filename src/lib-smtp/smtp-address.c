@@ -6,6 +6,8 @@
 #include "smtp-parser.h"
 #include "smtp-address.h"
 
+#include <ctype.h>
+
 /* From RFC 5321:
 
    Reverse-path     = Path / "<>"
@@ -291,6 +293,115 @@ smtp_parse_path(struct smtp_address_parser *aparser,
 	return 1;
 }
 
+/*
+ * Simple address fast path
+ */
+
+static const char *smtp_address_simple_localpart_end(const char *p)
+{
+	const char *begin = p;
+
+	while (smtp_char_is_atext(*p) || *p == '.')
+		p++;
+	return (p == begin ? NULL : p);
+}
+
+static const char *smtp_address_simple_domain_end(const char *p)
+{
+	const char *label;
+
+	for (;;) {
+		label = p;
+		while (i_isalnum(*p) || *p == '-' || *p == '_')
+			p++;
+		if (p == label)
+			return NULL;
+		if (*p != '.')
+			return p;
+		p++;
+	}
+}
+
+/* Parse the common "local@domain" form consisting only of a Dot-string
+   and a plain domain name directly from the input, without the generic
+   parser's intermediate strings. Returns 1 if the address was parsed,
+   0 if the full parser must be used. The parsed address is identical to
+   what the full parser would produce. */
+static int
+smtp_address_parse_simple(pool_t pool, const char *str, bool path,
+			  enum smtp_address_parse_flags flags,
+			  struct smtp_address **address_r, const char **endp_r)
+{
+	const char *localpart, *at, *domain_end, *end;
+	struct smtp_address *address;
+	size_t lpsize, dsize, rsize = 0, size;
+	char *data;
+
+	if (path) {
+		if (*str != '<')
+			return 0;
+		str++;
+	}
+	localpart = str;
+	at = smtp_address_simple_localpart_end(localpart);
+	if (at == NULL)
+		return 0;
+	if (*at == '@') {
+		domain_end = smtp_address_simple_domain_end(at + 1);
+		if (domain_end == NULL)
+			return 0;
+	} else if (!path &&
+		   HAS_ALL_BITS(flags, SMTP_ADDRESS_PARSE_FLAG_ALLOW_LOCALPART)) {
+		domain_end = at;
+	} else {
+		return 0;
+	}
+
+	end = domain_end;
+	if (path) {
+		if (*end != '>')
+			return 0;
+		end++;
+		if (*end != '\0' && (endp_r == NULL || *end != ' '))
+			return 0;
+		if (HAS_ALL_BITS(flags, SMTP_ADDRESS_PARSE_FLAG_PRESERVE_RAW))
+			rsize = domain_end - localpart + 1;
+	} else {
+		if (*end != '\0' ||
+		    HAS_ALL_BITS(flags, SMTP_ADDRESS_PARSE_FLAG_PRESERVE_RAW))
+			return 0;
+	}
+	if (endp_r != NULL)
+		*endp_r = end;
+	if (address_r == NULL)
+		return 1;
+
+	/* @UNSAFE: allocate the same single block as smtp_address_clone() */
+	lpsize = at - localpart + 1;
+	dsize = (domain_end == at ? 0 : domain_end - at);
+	size = MALLOC_ADD(sizeof(*address), lpsize);
+	size = MALLOC_ADD(size, dsize);
+	size = MALLOC_ADD(size, rsize);
+	data = p_malloc(pool, size);
+	address = (struct smtp_address *)data;
+	data += sizeof(*address);
+
+	memcpy(data, localpart, lpsize - 1);
+	address->localpart = data;
+	data += lpsize;
+	if (dsize > 0) {
+		memcpy(data, at + 1, dsize - 1);
+		address->domain = data;
+		data += dsize;
+	}
+	if (rsize > 0) {
+		memcpy(data, localpart, rsize - 1);
+		address->raw = data;
+	}
+	*address_r = address;
+	return 1;
+}
+
 int smtp_address_parse_mailbox(pool_t pool, const char *mailbox,
 			       enum smtp_address_parse_flags flags,
 			       struct smtp_address **address_r,
@@ -318,6 +429,9 @@ int smtp_address_parse_mailbox(pool_t pool, const char *mailbox,
 			*address_r = p_new(pool, struct smtp_address, 1);
 		return 0;
 	}
+	if (smtp_address_parse_simple(pool, mailbox, FALSE, flags,
+				      address_r, NULL) > 0)
+		return 0;
 
 	i_zero(&aparser);
 	smtp_parser_init(&aparser.parser, pool_datastack_create(), mailbox);
@@ -409,6 +523,9 @@ int smtp_address_parse_path_full(pool_t pool, const char *path,
 			*endp_r = path;
 		return 0;
 	}
+	if (smtp_address_parse_simple(pool, path, TRUE, flags,
+				      address_r, endp_r) > 0)
+		return 0;
 
 	i_zero(&aparser);
 	smtp_parser_init(&aparser.parser, pool_datastack_create(), path);
@@ -495,6 +612,9 @@ int smtp_address_parse_username(pool_t pool, const char *username,
 			*error_r = "Username is empty string";
 		return -1;
 	}
+	if (smtp_address_parse_simple(pool, username, FALSE, flags,
+				      address_r, NULL) > 0)
+		return 0;
 
 	i_zero(&aparser);
 	smtp_parser_init(&aparser.parser, pool_datastack_create(), username);
@@ -281,6 +281,14 @@ smtp_client_connection_get_state(struct smtp_client_connection *conn)
 	return conn->state;
 }
 
+bool smtp_client_connection_is_idle(struct smtp_client_connection *conn)
+{
+	return (conn->state == SMTP_CLIENT_CONNECTION_STATE_READY &&
+		conn->transactions_head == NULL &&
+		conn->cmd_send_queue_count == 0 &&
+		conn->cmd_wait_list_count == 0);
+}
+
 static void
 smtp_client_command_timeout(struct smtp_client_connection *conn)
 {
@@ -2271,6 +2279,32 @@ void smtp_client_connection_update_proxy_data(
 	smtp_proxy_data_merge(conn->pool, &conn->set.proxy_data, proxy_data);
 }
 
+void smtp_client_connection_replace_proxy_data(
+	struct smtp_client_connection *conn,
+	const struct smtp_proxy_data *proxy_data)
+{
+	i_zero(&conn->set.proxy_data);
+	smtp_proxy_data_merge(conn->pool, &conn->set.proxy_data, proxy_data);
+
+	if (!conn->xclient_sent)
+		return;
+	conn->xclient_sent = FALSE;
+	if (conn->state != SMTP_CLIENT_CONNECTION_STATE_READY)
+		return;
+	i_assert(conn->transactions_head == NULL);
+
+	/* The server resets the session after XCLIENT. Once the reply is
+	   received, the handshake is repeated and the connection becomes
+	   ready again. Transactions wait until then. */
+	smtp_client_connection_set_state(
+		conn, SMTP_CLIENT_CONNECTION_STATE_AUTHENTICATING);
+	smtp_client_connection_send_xclient(conn);
+	if (conn->xclient_replies_expected == 0) {
+		smtp_client_connection_set_state(
+			conn, SMTP_CLIENT_CONNECTION_STATE_READY);
+	}
+}
+
 void smtp_client_connection_switch_ioloop(struct smtp_client_connection *conn)
 {
 	struct smtp_client_transaction *trans;
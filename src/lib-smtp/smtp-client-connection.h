@@ -65,6 +65,13 @@ void smtp_client_connection_close(struct smtp_client_connection **_conn);
 void smtp_client_connection_update_proxy_data(
 	struct smtp_client_connection *conn,
 	const struct smtp_proxy_data *proxy_data);
+/* Replace the proxy data sent with XCLIENT. If XCLIENT was already sent on
+   an idle ready connection, it is sent again followed by a new handshake, so
+   the server sees the connection as a new proxied session. This allows
+   reusing the connection for a different client session. */
+void smtp_client_connection_replace_proxy_data(
+	struct smtp_client_connection *conn,
+	const struct smtp_proxy_data *proxy_data);
 
 void smtp_client_connection_cork(struct smtp_client_connection *conn);
 void smtp_client_connection_uncork(struct smtp_client_connection *conn);
@@ -89,5 +96,8 @@ smtp_client_connection_get_extra_capability(struct smtp_client_connection *conn,
 
 enum smtp_client_connection_state
 smtp_client_connection_get_state(struct smtp_client_connection *conn);
+/* Returns TRUE if the connection is ready and it has no transactions or
+   commands pending. */
+bool smtp_client_connection_is_idle(struct smtp_client_connection *conn);
 
 #endif
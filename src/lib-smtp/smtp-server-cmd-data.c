@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "array.h"
+#include "ioloop.h"
 #include "istream.h"
 #include "istream-chain.h"
 
@@ -294,6 +295,8 @@ static int cmd_data_do_handle_input(struct smtp_server_cmd_ctx *cmd)
 			!i_stream_have_bytes_left(data_cmd->chunk_input)) {
 			e_debug(cmd->event, "End of chunk");
 			cmd_data_chunk_finish(cmd);
+		} else if (conn->state.data_input_halted) {
+			e_debug(cmd->event, "Data input halted");
 		} else if (i_stream_get_data_size(
 			conn->state.data_input) > 0) {
 			e_debug(cmd->event, "Not all client data read");
@@ -340,6 +343,57 @@ static void cmd_data_input(struct smtp_server_cmd_ctx *cmd)
 	(void)cmd_data_handle_input(cmd);
 }
 
+static struct smtp_server_command *
+cmd_data_find_input_command(struct smtp_server_connection *conn)
+{
+	struct smtp_server_command *command;
+
+	for (command = conn->command_queue_head; command != NULL;
+	     command = command->next) {
+		if (command->input_captured)
+			return command;
+	}
+	return NULL;
+}
+
+bool smtp_server_cmd_data_input_halt(struct smtp_server_cmd_ctx *cmd)
+{
+	struct smtp_server_connection *conn = cmd->conn;
+	struct smtp_server_command *command = cmd->cmd;
+	struct cmd_data_context *data_cmd = command->data;
+
+	i_assert(data_cmd != NULL);
+
+	if (!data_cmd->client_input)
+		return FALSE;
+
+	conn->state.data_input_halted = TRUE;
+	if (command->input_captured) {
+		io_remove(&conn->conn.io);
+		smtp_server_connection_timeout_stop(conn);
+	}
+	return TRUE;
+}
+
+void smtp_server_connection_data_input_resume(
+	struct smtp_server_connection *conn)
+{
+	struct smtp_server_command *command;
+
+	if (!conn->state.data_input_halted)
+		return;
+	conn->state.data_input_halted = FALSE;
+
+	command = cmd_data_find_input_command(conn);
+	if (command == NULL || conn->conn.io != NULL)
+		return;
+	smtp_server_connection_input_capture(conn, cmd_data_input,
+					     &command->context);
+	smtp_server_connection_timeout_start(conn);
+	/* there may be buffered data left that the fd won't notify about */
+	io_set_pending(conn->conn.io);
+}
+
 static void
 cmd_data_next(struct smtp_server_cmd_ctx *cmd,
 	      struct cmd_data_context *data_cmd)
@@ -677,6 +677,16 @@ void smtp_server_cmd_data(struct smtp_server_cmd_ctx *cmd, const char *params);
 void smtp_server_cmd_bdat(struct smtp_server_cmd_ctx *cmd, const char *params);
 
 bool smtp_server_cmd_data_check_size(struct smtp_server_cmd_ctx *cmd);
+/* Stop reading DATA/BDAT message data from the client until
+   smtp_server_connection_data_input_resume() is called. This can be used by
+   the conn_cmd_data_continue() callback when the data is forwarded elsewhere
+   while it is being received and the destination can't take more for now.
+   The callback is not called again while the input is halted. Returns FALSE
+   if the data doesn't come from the client connection (e.g. BURL), in which
+   case reading can't be halted. */
+bool smtp_server_cmd_data_input_halt(struct smtp_server_cmd_ctx *cmd);
+void smtp_server_connection_data_input_resume(
+	struct smtp_server_connection *conn);
 
 /* VRFY */
 
@@ -720,6 +730,10 @@ void smtp_server_reply_set_status(struct smtp_server_reply *reply,
 				  ATTR_NULL(3);
 unsigned int smtp_server_reply_get_status(struct smtp_server_reply *reply,
 					  const char **enh_code_r) ATTR_NULL(3);
+/* Returns the reply text as a single line without the status and enhanced
+   codes. */
+const char *
+smtp_server_reply_get_message(const struct smtp_server_reply *reply);
 
 void smtp_server_reply_add_text(struct smtp_server_reply *reply,
 				const char *line);
@@ -72,6 +72,14 @@ static const char *cassandra_query_type_names[CASSANDRA_QUERY_TYPE_COUNT] = {
 	"read", "read-more", "write", "delete"
 };
 
+/* Upper limits of the query latency histogram buckets. The last bucket
+   contains everything slower. */
+static const unsigned int cassandra_latency_buckets_msecs[] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+#define CASSANDRA_LATENCY_BUCKET_COUNT \
+	(N_ELEMENTS(cassandra_latency_buckets_msecs) + 1)
+
 struct cassandra_callback {
 	unsigned int id;
 	struct timeout *to;
@@ -85,12 +93,15 @@ struct cassandra_db {
 	struct sql_db api;
 
 	char *hosts, *keyspace, *user, *password;
+	char *local_dc;
 	CassConsistency read_consistency, write_consistency, delete_consistency;
 	CassConsistency read_fallback_consistency, write_fallback_consistency;
 	CassConsistency delete_fallback_consistency;
 	CassLogLevel log_level;
 	bool debug_queries;
 	bool latency_aware_routing;
+	bool token_aware_routing;
+	bool page_prefetch;
 	bool init_ssl;
 	unsigned int protocol_version;
 	unsigned int num_threads;
@@ -122,6 +133,8 @@ struct cassandra_db {
 
 	struct timeout *to_metrics;
 	uint64_t counters[CASSANDRA_COUNTER_COUNT];
+	uint64_t latency_histogram[CASSANDRA_QUERY_TYPE_COUNT]
+		[CASSANDRA_LATENCY_BUCKET_COUNT];
 
 	struct timeval primary_query_last_sent[CASSANDRA_QUERY_TYPE_COUNT];
 	time_t last_fallback_warning[CASSANDRA_QUERY_TYPE_COUNT];
@@ -154,6 +167,12 @@ struct cassandra_result {
 	sql_query_callback_t *callback;
 	void *context;
 
+	/* The next page, which is already being fetched while the caller is
+	   iterating this one. */
+	struct cassandra_result *prefetch_result;
+	/* prefetched page is being given to the caller */
+	struct timeout *to_prefetch;
+
 	bool is_prepared:1;
 	bool query_sent:1;
 	bool finished:1;
@@ -258,6 +277,8 @@ prepare_finish_pending_statements(struct cassandra_sql_prepared_statement *prep_
 static void driver_cassandra_result_send_query(struct cassandra_result *result);
 static void driver_cassandra_send_queries(struct cassandra_db *db);
 static void result_finish(struct cassandra_result *result);
+static void exec_callback(struct sql_result *_result, void *context);
+static void driver_cassandra_result_prefetch(struct cassandra_result *result);
 
 static void log_one_line(const CassLogMessage *message,
 			 enum log_type log_type, const char *log_level_str,
@@ -605,6 +626,7 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 	db->connect_timeout_msecs = SQL_CONNECT_TIMEOUT_SECS*1000;
 	db->request_timeout_msecs = SQL_QUERY_TIMEOUT_SECS*1000;
 	db->warn_timeout_msecs = CASS_QUERY_DEFAULT_WARN_TIMEOUT_MSECS;
+	db->token_aware_routing = TRUE;
 
 	args = t_strsplit_spaces(connect_string, " ");
 	for (; *args != NULL; args++) {
@@ -694,6 +716,19 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 			db->debug_queries = TRUE;
 		} else if (strcmp(key, "latency_aware_routing") == 0) {
 			db->latency_aware_routing = TRUE;
+		} else if (strcmp(key, "token_aware_routing") == 0) {
+			if (strcmp(value, "yes") == 0)
+				db->token_aware_routing = TRUE;
+			else if (strcmp(value, "no") == 0)
+				db->token_aware_routing = FALSE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid token_aware_routing: %s", value);
+				return -1;
+			}
+		} else if (strcmp(key, "local_dc") == 0) {
+			i_free(db->local_dc);
+			db->local_dc = i_strdup(value);
 		} else if (strcmp(key, "version") == 0) {
 			if (str_to_uint(value, &db->protocol_version) < 0) {
 				*error_r = t_strdup_printf(
@@ -785,6 +820,16 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 					value);
 				return -1;
 			}
+		} else if (strcmp(key, "page_prefetch") == 0) {
+			if (strcmp(value, "yes") == 0)
+				db->page_prefetch = TRUE;
+			else if (strcmp(value, "no") == 0)
+				db->page_prefetch = FALSE;
+			else {
+				*error_r = t_strdup_printf(
+					"Invalid page_prefetch: %s", value);
+				return -1;
+			}
 		} else if (strcmp(key, "ssl_ca") == 0) {
 			db->ssl_ca_file = i_strdup(value);
 		} else if (strcmp(key, "ssl_cert_file") == 0) {
@@ -836,6 +881,10 @@ static int driver_cassandra_parse_connect_string(struct cassandra_db *db,
 		*error_r = t_strdup_printf("No dbname given in connect string");
 		return -1;
 	}
+	if (db->page_prefetch && db->page_size == 0) {
+		*error_r = "page_prefetch requires page_size";
+		return -1;
+	}
 
 	if ((db->ssl_cert_file != NULL && db->ssl_private_key_file == NULL) ||
 	    (db->ssl_cert_file == NULL && db->ssl_private_key_file != NULL)) {
@@ -894,6 +943,27 @@ driver_cassandra_get_metrics_json(struct cassandra_db *db, string_t *dest)
 			    db->counters[i]);
 	}
 	str_truncate(dest, str_len(dest)-1);
+
+	/* histogram bucket counts are cumulative, similar to Prometheus */
+	str_append(dest, "}, \"latency_msecs\": {");
+	for (unsigned int i = 0; i < CASSANDRA_QUERY_TYPE_COUNT; i++) {
+		uint64_t total = 0;
+
+		str_printfa(dest, "\"%s\": {", cassandra_query_type_names[i]);
+		for (unsigned int j = 0; j < CASSANDRA_LATENCY_BUCKET_COUNT; j++) {
+			total += db->latency_histogram[i][j];
+			if (j < N_ELEMENTS(cassandra_latency_buckets_msecs)) {
+				str_printfa(dest, "\"%u\": ",
+					    cassandra_latency_buckets_msecs[j]);
+			} else {
+				str_append(dest, "\"+Inf\": ");
+			}
+			str_printfa(dest, "%"PRIu64",", total);
+		}
+		str_truncate(dest, str_len(dest)-1);
+		str_append(dest, "},");
+	}
+	str_truncate(dest, str_len(dest)-1);
 	str_append(dest, "}}");
 }
 
@@ -933,6 +1003,7 @@ static void driver_cassandra_free(struct cassandra_db **_db)
 	event_unref(&db->api.event);
 	i_free(db->metrics_path);
 	i_free(db->hosts);
+	i_free(db->local_dc);
 	i_free(db->error);
 	i_free(db->keyspace);
 	i_free(db->user);
@@ -1062,6 +1133,23 @@ static int driver_cassandra_init_full_v(const struct sql_settings *set,
 		cass_cluster_set_num_threads_io(db->cluster, db->num_threads);
 	if (db->latency_aware_routing)
 		cass_cluster_set_latency_aware_routing(db->cluster, cass_true);
+	/* Token-aware routing sends prepared statements directly to the
+	   replicas owning the partition. It wraps the DC-aware policy, so
+	   with local_dc the queries stay in the local datacenter. */
+	cass_cluster_set_token_aware_routing(db->cluster,
+		db->token_aware_routing ? cass_true : cass_false);
+	if (db->local_dc != NULL) {
+		CassError c_err;
+		if ((c_err = cass_cluster_set_load_balance_dc_aware(
+				db->cluster, db->local_dc, 0, cass_false)) != CASS_OK) {
+			*error_r = t_strdup_printf("Invalid local_dc: %s",
+						   cass_error_desc(c_err));
+			cass_cluster_free(db->cluster);
+			cass_timestamp_gen_free(db->timestamp_gen);
+			driver_cassandra_free(&db);
+			return -1;
+		}
+	}
 	if (db->heartbeat_interval_secs != 0)
 		cass_cluster_set_connection_heartbeat_interval(db->cluster,
 			db->heartbeat_interval_secs);
@@ -1131,6 +1219,20 @@ static void driver_cassandra_result_unlink(struct cassandra_db *db,
 	i_unreached();
 }
 
+static void
+driver_cassandra_latency_histogram_add(struct cassandra_db *db,
+				       enum cassandra_query_type query_type,
+				       long long reply_usecs)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(cassandra_latency_buckets_msecs); i++) {
+		if (reply_usecs < cassandra_latency_buckets_msecs[i] * 1000LL)
+			break;
+	}
+	db->latency_histogram[query_type][i]++;
+}
+
 static void driver_cassandra_log_result(struct cassandra_result *result,
 					bool all_pages, long long reply_usecs)
 {
@@ -1139,6 +1241,10 @@ static void driver_cassandra_log_result(struct cassandra_result *result,
 	unsigned int row_count;
 
 	i_gettimeofday(&now);
+	if (!all_pages && result->query_sent) {
+		driver_cassandra_latency_histogram_add(db, result->query_type,
+						       reply_usecs);
+	}
 
 	string_t *str = t_str_new(128);
 	str_printfa(str, "Finished %squery '%s' (",
@@ -1175,6 +1281,19 @@ static void driver_cassandra_log_result(struct cassandra_result *result,
 	}
 }
 
+static void
+driver_cassandra_result_prefetch_abort(struct cassandra_result *result)
+{
+	/* the per-page log message shouldn't be an all-pages summary */
+	result->paging_continues = TRUE;
+	if (result->finished)
+		sql_result_unref(&result->api);
+	else {
+		/* free it once the reply arrives */
+		result->callback = exec_callback;
+	}
+}
+
 static void driver_cassandra_result_free(struct sql_result *_result)
 {
 	struct cassandra_db *db = (struct cassandra_db *)_result->db;
@@ -1186,6 +1305,12 @@ static void driver_cassandra_result_free(struct sql_result *_result)
 
 	if (_result == db->sync_result)
 		db->sync_result = NULL;
+	timeout_remove(&result->to_prefetch);
+	if (result->prefetch_result != NULL) {
+		/* the caller didn't want the prefetched page after all */
+		driver_cassandra_result_prefetch_abort(result->prefetch_result);
+		result->prefetch_result = NULL;
+	}
 
 	reply_usecs = timeval_diff_usecs(&result->finish_time,
 					 &result->start_time);
@@ -1223,6 +1348,13 @@ static void result_finish(struct cassandra_result *result)
 
 	i_assert((result->error != NULL) == (result->iterator == NULL));
 
+	if (result->callback == NULL) {
+		/* Prefetched page arrived before the caller asked for it.
+		   It's given to the caller by driver_cassandra_result_more(). */
+		return;
+	}
+	driver_cassandra_result_prefetch(result);
+
 	result->api.callback = TRUE;
 	T_BEGIN {
 		result->callback(&result->api, result->context);
@@ -1548,6 +1680,52 @@ driver_cassandra_query_init(struct cassandra_db *db, const char *query,
 	return result;
 }
 
+static void driver_cassandra_result_prefetch(struct cassandra_result *result)
+{
+	struct cassandra_db *db = (struct cassandra_db *)result->api.db;
+	struct cassandra_result *next;
+
+	/* paging_continues is set here only for an aborted prefetch */
+	if (!db->page_prefetch || db->ioloop != NULL ||
+	    result->paging_continues ||
+	    result->error != NULL || result->statement == NULL ||
+	    (result->query_type != CASSANDRA_QUERY_TYPE_READ &&
+	     result->query_type != CASSANDRA_QUERY_TYPE_READ_MORE) ||
+	    cass_result_has_more_pages(result->result) == cass_false)
+		return;
+
+	/* Start fetching the next page already while the caller is iterating
+	   this page. It's sent without a callback until the caller asks for
+	   it with sql_result_more(). */
+	next = driver_cassandra_query_init(db, result->query,
+					   CASSANDRA_QUERY_TYPE_READ_MORE,
+					   result->is_prepared, NULL, NULL);
+	next->statement = result->statement;
+	result->statement = NULL;
+	cass_statement_set_paging_state(next->statement, result->result);
+
+	next->timestamp = result->timestamp;
+	next->consistency = result->consistency;
+	next->page_num = result->page_num + 1;
+	next->page0_start_time = result->page0_start_time;
+	result->prefetch_result = next;
+	(void)driver_cassandra_send_query(next);
+}
+
+static void driver_cassandra_prefetch_callback(struct cassandra_result *result)
+{
+	timeout_remove(&result->to_prefetch);
+	/* continue exactly like result_finish() after the callback */
+	driver_cassandra_result_prefetch(result);
+	result->api.callback = TRUE;
+	T_BEGIN {
+		result->callback(&result->api, result->context);
+	} T_END;
+	result->api.callback = FALSE;
+	result->callback = NULL;
+	sql_result_unref(&result->api);
+}
+
 static void
 driver_cassandra_query_full(struct sql_db *_db, const char *query,
 			    enum cassandra_query_type query_type,
@@ -1774,6 +1952,53 @@ static int driver_cassandra_result_next_row(struct sql_result *_result)
 	return ret;
 }
 
+static void
+driver_cassandra_result_more_prefetched(struct sql_result **_result, bool async,
+					sql_query_callback_t *callback,
+					void *context)
+{
+	struct cassandra_db *db = (struct cassandra_db *)(*_result)->db;
+	struct cassandra_result *old_result =
+		(struct cassandra_result *)*_result;
+	struct cassandra_result *new_result = old_result->prefetch_result;
+
+	old_result->prefetch_result = NULL;
+	old_result->paging_continues = TRUE;
+	i_free_and_null(old_result->error);
+	new_result->total_row_count = old_result->total_row_count;
+
+	sql_result_unref(*_result);
+	*_result = NULL;
+
+	if (async) {
+		new_result->callback = callback;
+		new_result->context = context;
+		if (new_result->finished) {
+			/* don't call the callback from within
+			   sql_result_more() */
+			new_result->to_prefetch = timeout_add_short(0,
+				driver_cassandra_prefetch_callback, new_result);
+		}
+		return;
+	}
+
+	new_result->callback = cassandra_query_s_callback;
+	new_result->context = db;
+	if (new_result->finished)
+		db->sync_result = &new_result->api;
+	else {
+		i_assert(db->api.state == SQL_DB_STATE_IDLE);
+		driver_cassandra_sync_init(db);
+		if (new_result->result == NULL && !new_result->finished) {
+			db->io_pipe = io_loop_move_io(&db->io_pipe);
+			io_loop_run(db->ioloop);
+		}
+		driver_cassandra_sync_deinit(db);
+	}
+	new_result->callback = NULL;
+	callback(&new_result->api, context);
+}
+
 static void
 driver_cassandra_result_more(struct sql_result **_result, bool async,
 			     sql_query_callback_t *callback, void *context)
@@ -1783,6 +2008,12 @@ driver_cassandra_result_more(struct sql_result **_result, bool async,
 	struct cassandra_result *old_result =
 		(struct cassandra_result *)*_result;
 
+	if (old_result->prefetch_result != NULL) {
+		driver_cassandra_result_more_prefetched(_result, async,
+							callback, context);
+		return;
+	}
+
 	/* Initialize the next page as a new sql_result */
 	new_result = driver_cassandra_query_init(db, old_result->query,
 						 CASSANDRA_QUERY_TYPE_READ_MORE,
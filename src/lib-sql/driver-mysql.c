@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
+#include "hash.h"
 #include "hex-binary.h"
 #include "str.h"
 #include "net.h"
@@ -27,6 +28,13 @@
 #define MYSQL_DEFAULT_READ_TIMEOUT_SECS 30
 #define MYSQL_DEFAULT_WRITE_TIMEOUT_SECS 30
 
+/* MySQL v8.0.1 replaced my_bool with bool */
+#if defined(MARIADB_BASE_VERSION) || MYSQL_VERSION_ID < 80001
+typedef my_bool mysql_bool_t;
+#else
+typedef bool mysql_bool_t;
+#endif
+
 struct mysql_db {
 	struct sql_db api;
 
@@ -43,6 +51,10 @@ struct mysql_db {
 	MYSQL *mysql;
 	unsigned int next_query_connection;
 
+	/* Read the rows of SELECT results from the server as they're
+	   iterated, instead of storing the whole result in memory first.
+	   The connection is busy until the result is freed. */
+	bool stream_results:1;
 	bool ssl_set:1;
 };
 
@@ -56,6 +68,36 @@ struct mysql_result {
 	unsigned int fields_count;
 
 	my_ulonglong affected_rows;
+
+	/* Prepared statement results: result contains only the metadata.
+	   prep_stmt is NULL if there is no result set, or if the statement
+	   was closed because of a reconnection. */
+	struct mysql_prepared_statement *prep_stmt;
+	MYSQL_BIND *binds;
+	unsigned long *lengths;
+	mysql_bool_t *is_nulls;
+	const char **values;
+	pool_t row_pool;
+	char *error;
+
+	/* connection was set busy for reading the rows */
+	bool streaming:1;
+};
+
+struct mysql_prepared_statement {
+	struct sql_prepared_statement api;
+
+	/* NULL until prepared in the current server connection */
+	MYSQL_STMT *stmt;
+	/* result that is still reading rows from the stmt */
+	struct mysql_result *result;
+};
+
+struct mysql_statement {
+	struct sql_statement api;
+
+	struct mysql_prepared_statement *prep_stmt;
+	ARRAY(MYSQL_BIND) params;
 };
 
 struct mysql_transaction_context {
@@ -72,12 +114,46 @@ struct mysql_transaction_context {
 extern const struct sql_db driver_mysql_db;
 extern const struct sql_result driver_mysql_result;
 extern const struct sql_result driver_mysql_error_result;
+extern const struct sql_result driver_mysql_stmt_result;
+extern const struct sql_result driver_mysql_stmt_error_result;
 
 static struct event_category event_category_mysql = {
 	.parent = &event_category_sql,
 	.name = "mysql"
 };
 
+static void
+driver_mysql_prepared_statement_close(struct mysql_prepared_statement *prep_stmt)
+{
+	if (prep_stmt->result != NULL) {
+		/* detach the result - it can't read any more rows */
+		prep_stmt->result->prep_stmt = NULL;
+		prep_stmt->result = NULL;
+	}
+	if (prep_stmt->stmt != NULL) {
+		(void)mysql_stmt_close(prep_stmt->stmt);
+		prep_stmt->stmt = NULL;
+	}
+}
+
+static void driver_mysql_prepared_statements_close(struct mysql_db *db)
+{
+	struct hash_iterate_context *iter;
+	struct sql_prepared_statement *prep_stmt;
+	char *query;
+
+	if (!hash_table_is_created(db->api.prepared_stmt_hash))
+		return;
+
+	iter = hash_table_iterate_init(db->api.prepared_stmt_hash);
+	while (hash_table_iterate(iter, db->api.prepared_stmt_hash,
+				  &query, &prep_stmt)) {
+		driver_mysql_prepared_statement_close(
+			(struct mysql_prepared_statement *)prep_stmt);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
 static int driver_mysql_connect(struct sql_db *_db)
 {
 	struct mysql_db *db = (struct mysql_db *)_db;
@@ -91,6 +167,9 @@ static int driver_mysql_connect(struct sql_db *_db)
 
 	sql_db_set_state(&db->api, SQL_DB_STATE_CONNECTING);
 
+	/* statements need to be prepared again in the new connection */
+	driver_mysql_prepared_statements_close(db);
+
 	if (mysql_init(db->mysql) == NULL)
 		i_fatal("mysql_init() failed");
 
@@ -257,6 +336,15 @@ static int driver_mysql_parse_connect_string(struct mysql_db *db,
 				*error_r = t_strdup_printf("Invalid boolean: %s", value);
 				return -1;
 			}
+		} else if (strcmp(name, "stream_results") == 0) {
+			if (strcmp(value, "yes") == 0)
+				db->stream_results = TRUE;
+			else if (strcmp(value, "no") == 0)
+				db->stream_results = FALSE;
+			else {
+				*error_r = t_strdup_printf("Invalid boolean: %s", value);
+				return -1;
+			}
 		} else if (strcmp(name, "option_file") == 0)
 			field = &db->option_file;
 		else if (strcmp(name, "option_group") == 0)
@@ -410,6 +498,22 @@ static void driver_mysql_query(struct sql_db *db, const char *query,
 	sql_result_unref(result);
 }
 
+static void driver_mysql_result_stream_start(struct mysql_result *result)
+{
+	struct mysql_db *db = (struct mysql_db *)result->api.db;
+
+	/* don't let sqlpool send other queries to this connection until the
+	   result is freed */
+	result->streaming = TRUE;
+	sql_db_set_state(&db->api, SQL_DB_STATE_BUSY);
+}
+
+static void driver_mysql_result_stream_finish(struct mysql_db *db)
+{
+	if (db->api.state == SQL_DB_STATE_BUSY)
+		sql_db_set_state(&db->api, SQL_DB_STATE_IDLE);
+}
+
 static struct sql_result *
 driver_mysql_query_s(struct sql_db *_db, const char *query)
 {
@@ -424,7 +528,16 @@ driver_mysql_query_s(struct sql_db *_db, const char *query)
 
 	if (driver_mysql_do_query(db, query, event) < 0)
 		result->api = driver_mysql_error_result;
-	else {
+	else if (db->stream_results && mysql_field_count(db->mysql) > 0) {
+		/* read the rows only as they're iterated. the rest of the
+		   results are read when the result is freed. */
+		result->affected_rows = mysql_affected_rows(db->mysql);
+		result->result = mysql_use_result(db->mysql);
+		if (result->result == NULL)
+			result->api = driver_mysql_error_result;
+		else
+			driver_mysql_result_stream_start(result);
+	} else {
 		/* query ok */
 		result->affected_rows = mysql_affected_rows(db->mysql);
 		result->result = mysql_store_result(db->mysql);
@@ -457,6 +570,8 @@ driver_mysql_query_s(struct sql_db *_db, const char *query)
 static void driver_mysql_result_free(struct sql_result *_result)
 {
 	struct mysql_result *result = (struct mysql_result *)_result;
+	struct mysql_db *db = (struct mysql_db *)_result->db;
+	bool streaming = result->streaming;
 
 	i_assert(_result != &sql_not_connected_result);
 	if (_result->callback)
@@ -464,8 +579,17 @@ static void driver_mysql_result_free(struct sql_result *_result)
 
 	if (result->result != NULL)
 		mysql_free_result(result->result);
+#ifdef CLIENT_MULTI_RESULTS
+	if (streaming && db->api.state == SQL_DB_STATE_BUSY) {
+		/* read (ignore) the extra results */
+		while (mysql_next_result(db->mysql) == 0) ;
+	}
+#endif
 	event_unref(&_result->event);
 	i_free(result);
+
+	if (streaming)
+		driver_mysql_result_stream_finish(db);
 }
 
 static int driver_mysql_result_next_row(struct sql_result *_result)
@@ -593,6 +717,385 @@ static const char *driver_mysql_result_get_error(struct sql_result *_result)
 	return errstr;
 }
 
+static struct sql_prepared_statement *
+driver_mysql_prepared_statement_init(struct sql_db *db,
+				     const char *query_template)
+{
+	struct mysql_prepared_statement *prep_stmt;
+
+	prep_stmt = i_new(struct mysql_prepared_statement, 1);
+	prep_stmt->api.db = db;
+	prep_stmt->api.refcount = 1;
+	prep_stmt->api.query_template = i_strdup(query_template);
+	return &prep_stmt->api;
+}
+
+static void
+driver_mysql_prepared_statement_deinit(struct sql_prepared_statement *_prep_stmt)
+{
+	struct mysql_prepared_statement *prep_stmt =
+		(struct mysql_prepared_statement *)_prep_stmt;
+
+	driver_mysql_prepared_statement_close(prep_stmt);
+	i_free(prep_stmt->api.query_template);
+	i_free(prep_stmt);
+}
+
+static struct sql_statement *
+driver_mysql_statement_init(struct sql_db *db ATTR_UNUSED,
+			    const char *query_template ATTR_UNUSED)
+{
+	pool_t pool = pool_alloconly_create("mysql sql statement", 1024);
+	struct mysql_statement *stmt = p_new(pool, struct mysql_statement, 1);
+
+	stmt->api.pool = pool;
+	p_array_init(&stmt->params, pool, 8);
+	return &stmt->api;
+}
+
+static struct sql_statement *
+driver_mysql_statement_init_prepared(struct sql_prepared_statement *_prep_stmt)
+{
+	struct sql_statement *_stmt =
+		driver_mysql_statement_init(_prep_stmt->db,
+					    _prep_stmt->query_template);
+	struct mysql_statement *stmt = (struct mysql_statement *)_stmt;
+
+	_stmt->query_template = p_strdup(_stmt->pool,
+					 _prep_stmt->query_template);
+	stmt->prep_stmt = (struct mysql_prepared_statement *)_prep_stmt;
+	return _stmt;
+}
+
+static void
+driver_mysql_statement_bind_str(struct sql_statement *_stmt,
+				unsigned int column_idx, const char *value)
+{
+	struct mysql_statement *stmt = (struct mysql_statement *)_stmt;
+	MYSQL_BIND *bind = array_idx_get_space(&stmt->params, column_idx);
+
+	i_zero(bind);
+	bind->buffer_type = MYSQL_TYPE_STRING;
+	bind->buffer = p_strdup(_stmt->pool, value);
+	bind->buffer_length = strlen(value);
+}
+
+static void
+driver_mysql_statement_bind_binary(struct sql_statement *_stmt,
+				   unsigned int column_idx, const void *value,
+				   size_t value_size)
+{
+	struct mysql_statement *stmt = (struct mysql_statement *)_stmt;
+	MYSQL_BIND *bind = array_idx_get_space(&stmt->params, column_idx);
+
+	i_zero(bind);
+	bind->buffer_type = MYSQL_TYPE_BLOB;
+	bind->buffer = p_memdup(_stmt->pool, value, value_size);
+	bind->buffer_length = value_size;
+}
+
+static void
+driver_mysql_statement_bind_int64(struct sql_statement *_stmt,
+				  unsigned int column_idx, int64_t value)
+{
+	struct mysql_statement *stmt = (struct mysql_statement *)_stmt;
+	MYSQL_BIND *bind = array_idx_get_space(&stmt->params, column_idx);
+	int64_t *value_dup = p_new(_stmt->pool, int64_t, 1);
+
+	*value_dup = value;
+	i_zero(bind);
+	bind->buffer_type = MYSQL_TYPE_LONGLONG;
+	bind->buffer = value_dup;
+}
+
+static int
+driver_mysql_statement_execute(struct mysql_db *db,
+			       struct mysql_statement *stmt)
+{
+	struct mysql_prepared_statement *prep_stmt = stmt->prep_stmt;
+	const char *query = prep_stmt->api.query_template;
+
+	if (prep_stmt->stmt == NULL) {
+		/* prepare the statement first in this server connection */
+		prep_stmt->stmt = mysql_stmt_init(db->mysql);
+		if (prep_stmt->stmt == NULL)
+			i_fatal_status(FATAL_OUTOFMEM, "mysql_stmt_init() failed");
+		if (mysql_stmt_prepare(prep_stmt->stmt, query,
+				       strlen(query)) != 0)
+			return -1;
+	}
+	i_assert(mysql_stmt_param_count(prep_stmt->stmt) ==
+		 array_count(&stmt->params));
+
+	if (array_count(&stmt->params) > 0 &&
+	    mysql_stmt_bind_param(prep_stmt->stmt,
+				  array_front_modifiable(&stmt->params)) != 0)
+		return -1;
+	if (mysql_stmt_execute(prep_stmt->stmt) != 0)
+		return -1;
+	return 0;
+}
+
+static int
+driver_mysql_stmt_result_init(struct mysql_db *db, struct mysql_result *result,
+			      struct mysql_prepared_statement *prep_stmt)
+{
+	MYSQL_STMT *stmt = prep_stmt->stmt;
+	unsigned int i, count;
+
+	result->affected_rows = mysql_stmt_affected_rows(stmt);
+	result->result = mysql_stmt_result_metadata(stmt);
+	if (result->result == NULL) {
+		/* no result set */
+		return mysql_stmt_errno(stmt) == 0 ? 0 : -1;
+	}
+	if (!db->stream_results && mysql_stmt_store_result(stmt) != 0)
+		return -1;
+
+	/* The values are fetched with mysql_stmt_fetch_column() after their
+	   lengths are known, so no buffers are given here. */
+	count = mysql_num_fields(result->result);
+	result->binds = i_new(MYSQL_BIND, count);
+	result->lengths = i_new(unsigned long, count);
+	result->is_nulls = i_new(mysql_bool_t, count);
+	result->values = i_new(const char *, count + 1);
+	for (i = 0; i < count; i++) {
+		result->binds[i].buffer_type = MYSQL_TYPE_STRING;
+		result->binds[i].length = &result->lengths[i];
+		result->binds[i].is_null = &result->is_nulls[i];
+	}
+	if (mysql_stmt_bind_result(stmt, result->binds) != 0)
+		return -1;
+
+	result->row_pool = pool_alloconly_create("mysql stmt row", 1024);
+	result->prep_stmt = prep_stmt;
+	prep_stmt->result = result;
+	if (db->stream_results)
+		driver_mysql_result_stream_start(result);
+	return 0;
+}
+
+static void
+driver_mysql_stmt_failed(struct mysql_db *db, struct mysql_result *result,
+			 MYSQL_STMT *stmt)
+{
+	unsigned int err = mysql_stmt_errno(stmt);
+
+	result->error = i_strdup(mysql_stmt_error(stmt));
+	switch (err) {
+	case CR_SERVER_GONE_ERROR:
+	case CR_SERVER_LOST:
+		sql_db_set_state(&db->api, SQL_DB_STATE_DISCONNECTED);
+		break;
+	default:
+		break;
+	}
+}
+
+static struct sql_result *
+driver_mysql_statement_query_prepared(struct mysql_statement *stmt)
+{
+	struct mysql_db *db = (struct mysql_db *)stmt->api.db;
+	struct mysql_prepared_statement *prep_stmt = stmt->prep_stmt;
+	struct mysql_result *result;
+	struct event *event;
+	struct event_passthrough *e;
+	/* this also verifies that all the parameters are bound */
+	const char *query = sql_statement_get_query(&stmt->api);
+	int ret, diff;
+
+	event = event_create(db->api.event);
+	result = i_new(struct mysql_result, 1);
+	result->api = driver_mysql_stmt_result;
+
+	ret = driver_mysql_statement_execute(db, stmt);
+	if (ret == 0)
+		ret = driver_mysql_stmt_result_init(db, result, prep_stmt);
+	io_loop_time_refresh();
+	e = sql_query_finished_event(&db->api, event, query, ret == 0, &diff);
+
+	if (ret < 0) {
+		driver_mysql_stmt_failed(db, result, prep_stmt->stmt);
+		e->add_int("error_code", mysql_stmt_errno(prep_stmt->stmt));
+		e->add_str("error", result->error);
+		e_debug(e->event(), SQL_QUERY_FINISHED_FMT": %s", query,
+			diff, result->error);
+		/* prepare again on the next use */
+		driver_mysql_prepared_statement_close(prep_stmt);
+		result->api = driver_mysql_stmt_error_result;
+	} else {
+		db->last_success = ioloop_time;
+		e_debug(e->event(), SQL_QUERY_FINISHED_FMT, query, diff);
+	}
+
+	result->api.db = &db->api;
+	result->api.refcount = 1;
+	result->api.event = event;
+	return &result->api;
+}
+
+static struct sql_result *
+driver_mysql_statement_query_s(struct sql_statement *_stmt)
+{
+	struct mysql_statement *stmt = (struct mysql_statement *)_stmt;
+	struct sql_result *result;
+
+	if (stmt->prep_stmt != NULL && stmt->prep_stmt->result == NULL)
+		result = driver_mysql_statement_query_prepared(stmt);
+	else {
+		/* not a prepared statement, or it's still being used by
+		   another result */
+		result = sql_query_s(_stmt->db,
+				     sql_statement_get_query(_stmt));
+	}
+	pool_unref(&_stmt->pool);
+	return result;
+}
+
+static void
+driver_mysql_statement_query(struct sql_statement *stmt,
+			     sql_query_callback_t *callback, void *context)
+{
+	struct sql_result *result;
+
+	result = driver_mysql_statement_query_s(stmt);
+	result->callback = TRUE;
+	callback(result, context);
+	result->callback = FALSE;
+	sql_result_unref(result);
+}
+
+static void driver_mysql_stmt_result_free(struct sql_result *_result)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+	struct mysql_db *db = (struct mysql_db *)_result->db;
+	bool streaming = result->streaming;
+
+	if (_result->callback)
+		return;
+
+	if (result->prep_stmt != NULL) {
+		/* this also reads the rest of the rows if streaming */
+		(void)mysql_stmt_free_result(result->prep_stmt->stmt);
+		result->prep_stmt->result = NULL;
+	}
+	if (result->result != NULL)
+		mysql_free_result(result->result);
+	pool_unref(&result->row_pool);
+	event_unref(&_result->event);
+	i_free(result->binds);
+	i_free(result->lengths);
+	i_free(result->is_nulls);
+	i_free(result->values);
+	i_free(result->error);
+	i_free(result);
+
+	if (streaming)
+		driver_mysql_result_stream_finish(db);
+}
+
+static int driver_mysql_stmt_result_next_row(struct sql_result *_result)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+	struct mysql_db *db = (struct mysql_db *)_result->db;
+	MYSQL_STMT *stmt;
+	MYSQL_BIND bind;
+	unsigned int i, count;
+	char *value;
+	int ret;
+
+	if (result->result == NULL) {
+		/* no results */
+		return 0;
+	}
+	if (result->prep_stmt == NULL) {
+		i_free(result->error);
+		result->error = i_strdup("Disconnected while reading results");
+		return -1;
+	}
+	stmt = result->prep_stmt->stmt;
+
+	ret = mysql_stmt_fetch(stmt);
+	if (ret == MYSQL_NO_DATA)
+		return 0;
+	if (ret != 0 && ret != MYSQL_DATA_TRUNCATED) {
+		i_free(result->error);
+		driver_mysql_stmt_failed(db, result, stmt);
+		return -1;
+	}
+
+	p_clear(result->row_pool);
+	count = mysql_num_fields(result->result);
+	for (i = 0; i < count; i++) {
+		if (result->is_nulls[i]) {
+			result->values[i] = NULL;
+			continue;
+		}
+		value = p_malloc(result->row_pool, result->lengths[i] + 1);
+		if (result->lengths[i] > 0) {
+			i_zero(&bind);
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = value;
+			bind.buffer_length = result->lengths[i] + 1;
+			if (mysql_stmt_fetch_column(stmt, &bind, i, 0) != 0) {
+				i_free(result->error);
+				driver_mysql_stmt_failed(db, result, stmt);
+				return -1;
+			}
+		}
+		result->values[i] = value;
+	}
+	db->last_success = ioloop_time;
+	return 1;
+}
+
+static const char *
+driver_mysql_stmt_result_get_field_value(struct sql_result *_result,
+					 unsigned int idx)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+
+	return result->values[idx];
+}
+
+static const unsigned char *
+driver_mysql_stmt_result_get_field_value_binary(struct sql_result *_result,
+						unsigned int idx, size_t *size_r)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+
+	*size_r = result->values[idx] == NULL ? 0 : result->lengths[idx];
+	return (const void *)result->values[idx];
+}
+
+static const char *
+driver_mysql_stmt_result_find_field_value(struct sql_result *result,
+					  const char *field_name)
+{
+	int idx;
+
+	idx = driver_mysql_result_find_field(result, field_name);
+	if (idx < 0)
+		return NULL;
+	return driver_mysql_stmt_result_get_field_value(result, idx);
+}
+
+static const char *const *
+driver_mysql_stmt_result_get_values(struct sql_result *_result)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+
+	return result->values;
+}
+
+static const char *
+driver_mysql_stmt_result_get_error(struct sql_result *_result)
+{
+	struct mysql_result *result = (struct mysql_result *)_result;
+
+	return result->error != NULL ? result->error : "(no error set)";
+}
+
 static struct sql_transaction_context *
 driver_mysql_transaction_begin(struct sql_db *db)
 {
@@ -784,6 +1287,16 @@ const struct sql_db driver_mysql_db = {
 		.update = driver_mysql_update,
 
 		.escape_blob = driver_mysql_escape_blob,
+
+		.prepared_statement_init = driver_mysql_prepared_statement_init,
+		.prepared_statement_deinit = driver_mysql_prepared_statement_deinit,
+		.statement_init = driver_mysql_statement_init,
+		.statement_init_prepared = driver_mysql_statement_init_prepared,
+		.statement_bind_str = driver_mysql_statement_bind_str,
+		.statement_bind_binary = driver_mysql_statement_bind_binary,
+		.statement_bind_int64 = driver_mysql_statement_bind_int64,
+		.statement_query = driver_mysql_statement_query,
+		.statement_query_s = driver_mysql_statement_query_s,
 	}
 };
 
@@ -817,6 +1330,30 @@ const struct sql_result driver_mysql_error_result = {
 	.failed_try_retry = TRUE
 };
 
+const struct sql_result driver_mysql_stmt_result = {
+	.v = {
+		.free = driver_mysql_stmt_result_free,
+		.next_row = driver_mysql_stmt_result_next_row,
+		.get_fields_count = driver_mysql_result_get_fields_count,
+		.get_field_name = driver_mysql_result_get_field_name,
+		.find_field = driver_mysql_result_find_field,
+		.get_field_value = driver_mysql_stmt_result_get_field_value,
+		.get_field_value_binary = driver_mysql_stmt_result_get_field_value_binary,
+		.find_field_value = driver_mysql_stmt_result_find_field_value,
+		.get_values = driver_mysql_stmt_result_get_values,
+		.get_error = driver_mysql_stmt_result_get_error,
+	}
+};
+
+const struct sql_result driver_mysql_stmt_error_result = {
+	.v = {
+		.free = driver_mysql_stmt_result_free,
+		.next_row = driver_mysql_result_error_next_row,
+		.get_error = driver_mysql_stmt_result_get_error,
+	},
+	.failed_try_retry = TRUE
+};
+
 const char *driver_mysql_version = DOVECOT_ABI_VERSION;
 
 void driver_mysql_init(void);
@@ -37,6 +37,13 @@ struct pgsql_db {
 	char *error;
 	const char *connect_state;
 
+	/* incremented for each new server connection */
+	unsigned int connect_generation;
+	unsigned int prepared_stmt_counter;
+	/* If non-zero, rows are read in single row mode and returned to the
+	   caller in pages of this many rows. */
+	unsigned int page_size;
+
 	bool fatal_error:1;
 };
 
@@ -61,10 +68,44 @@ struct pgsql_result {
 
 	ARRAY(struct pgsql_binary_value) binary_values;
 
+	/* single row mode: the rows of the current page. pgres points to
+	   the current row. */
+	ARRAY(PGresult *) page_rows;
+
+	/* for prepared statements */
+	struct pgsql_prepared_statement *prep_stmt;
+	const char **params;
+
 	sql_query_callback_t *callback;
 	void *context;
 
 	bool timeout:1;
+	bool preparing:1;
+	/* single row mode: the server has more rows after this page */
+	bool more_rows:1;
+	/* sql_result_more() was called - the query continues in a new
+	   result */
+	bool paging_continues:1;
+};
+
+struct pgsql_prepared_statement {
+	struct sql_prepared_statement api;
+
+	char *name;
+	/* query_template with ? converted to $1, $2, ... */
+	char *pg_query;
+	unsigned int param_count;
+	/* connect_generation where the statement was prepared in */
+	unsigned int prepared_generation;
+};
+
+struct pgsql_statement {
+	struct sql_statement api;
+
+	struct pgsql_prepared_statement *prep_stmt;
+	ARRAY_TYPE(const_string) params;
+	/* binary parameters are sent as part of the query string */
+	bool params_unsupported;
 };
 
 struct pgsql_transaction_context {
@@ -84,6 +125,9 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
+static void get_prepare_result(struct pgsql_result *result);
+static void get_single_row_results(struct pgsql_result *result);
+static void do_query_send(struct pgsql_result *result);
 static void
 transaction_update_callback(struct sql_result *result,
 			    struct sql_transaction_query *query);
@@ -198,6 +242,8 @@ static void connect_callback(struct pgsql_db *db)
 
 	if (io_dir == 0) {
 		db->connect_state = "connected";
+		/* prepared statements need to be prepared again */
+		db->connect_generation++;
 		timeout_remove(&db->to_connect);
 		if (PQserverVersion(db->pg) >= 90500) {
 			/* v9.5+ */
@@ -313,28 +359,53 @@ static enum sql_db_flags driver_pgsql_get_flags(struct sql_db *db)
 }
 
 static int driver_pgsql_init_full_v(const struct sql_settings *set,
-				    struct sql_db **db_r, const char **error_r ATTR_UNUSED)
+				    struct sql_db **db_r, const char **error_r)
 {
 	struct pgsql_db *db;
+	char *error = NULL;
 
 	db = i_new(struct pgsql_db, 1);
-	db->connect_string = i_strdup(set->connect_string);
 	db->api = driver_pgsql_db;
 	db->api.event = event_create(set->event_parent);
 	event_add_category(db->api.event, &event_category_pgsql);
 
 	/* NOTE: Connection string will be parsed by pgsql itself
-		 We only pick the host part here */
+		 We only pick the host part here and remove our own
+		 settings. */
 	T_BEGIN {
-		const char *const *arg = t_strsplit(db->connect_string, " ");
+		const char *const *arg = t_strsplit(set->connect_string, " ");
+		string_t *connect_string = t_str_new(128);
 
 		for (; *arg != NULL; arg++) {
+			if (str_begins(*arg, "page_size=")) {
+				if (str_to_uint(*arg + 10, &db->page_size) < 0) {
+					error = i_strdup_printf(
+						"Invalid page_size: %s", *arg + 10);
+				}
+#ifndef HAVE_PQSETSINGLEROWMODE
+				if (db->page_size > 0) {
+					error = i_strdup(
+						"page_size requires libpq v9.2+");
+				}
+#endif
+				continue;
+			}
 			if (str_begins(*arg, "host="))
 				db->host = i_strdup(*arg + 5);
-
+			if (str_len(connect_string) > 0)
+				str_append_c(connect_string, ' ');
+			str_append(connect_string, *arg);
 		}
+		db->connect_string = i_strdup(str_c(connect_string));
 	} T_END;
 
+	if (error != NULL) {
+		*error_r = t_strdup(error);
+		i_free(error);
+		driver_pgsql_free(&db);
+		return -1;
+	}
+
 	event_set_append_log_prefix(db->api.event, t_strdup_printf("pgsql(%s): ", db->host));
 
 	*db_r = &db->api;
@@ -385,6 +456,15 @@ static void consume_results(struct pgsql_db *db)
 		driver_pgsql_set_idle(db);
 }
 
+static void driver_pgsql_result_free_binary_values(struct pgsql_result *result)
+{
+	struct pgsql_binary_value *value;
+
+	array_foreach_modifiable(&result->binary_values, value)
+		PQfreemem(value->value);
+	array_free(&result->binary_values);
+}
+
 static void driver_pgsql_result_free(struct sql_result *_result)
 {
 	struct pgsql_db *db = (struct pgsql_db *)_result->db;
@@ -397,15 +477,24 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 
 	if (_result == db->sync_result)
 		db->sync_result = NULL;
-	db->cur_result = NULL;
+	if (!result->paging_continues)
+		db->cur_result = NULL;
 
 	success = result->pgres != NULL && !db->fatal_error;
-	if (result->pgres != NULL) {
+	if (array_is_created(&result->page_rows)) {
+		PGresult *pgres;
+
+		array_foreach_elem(&result->page_rows, pgres)
+			PQclear(pgres);
+		array_free(&result->page_rows);
+	} else if (result->pgres != NULL) {
 		PQclear(result->pgres);
-		result->pgres = NULL;
 	}
+	result->pgres = NULL;
 
-	if (success) {
+	if (result->paging_continues) {
+		/* the connection stays busy with the next page */
+	} else if (success) {
 		/* we'll have to read the rest of the results as well */
 		i_assert(db->io == NULL);
 		consume_results(db);
@@ -413,15 +502,11 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 		driver_pgsql_set_idle(db);
 	}
 
-	if (array_is_created(&result->binary_values)) {
-		struct pgsql_binary_value *value;
-
-		array_foreach_modifiable(&result->binary_values, value)
-			PQfreemem(value->value);
-		array_free(&result->binary_values);
-	}
+	if (array_is_created(&result->binary_values))
+		driver_pgsql_result_free_binary_values(result);
 
 	event_unref(&result->api.event);
+	i_free(result->params);
 	i_free(result->query);
 	i_free(result->fields);
 	i_free(result->values);
@@ -500,10 +585,92 @@ static void get_result(struct pgsql_result *result)
 		return;
 	}
 
+	if (result->preparing) {
+		get_prepare_result(result);
+		return;
+	}
+	if (db->page_size > 0) {
+		/* single row mode */
+		get_single_row_results(result);
+		return;
+	}
 	result->pgres = PQgetResult(db->pg);
 	result_finish(result);
 }
 
+static void get_single_row_results(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	PGresult *pgres;
+
+	for (;;) {
+		pgres = PQgetResult(db->pg);
+		if (pgres == NULL ||
+		    PQresultStatus(pgres) != PGRES_SINGLE_TUPLE)
+			break;
+
+		if (!array_is_created(&result->page_rows))
+			i_array_init(&result->page_rows, db->page_size);
+		array_push_back(&result->page_rows, &pgres);
+		if (array_count(&result->page_rows) >= db->page_size) {
+			/* page is full. the rest of the rows are read after
+			   sql_result_more() is called. */
+			result->more_rows = TRUE;
+			result->pgres = pgres;
+			result_finish(result);
+			return;
+		}
+		if (PQisBusy(db->pg) != 0) {
+			/* wait for more rows */
+			get_result(result);
+			return;
+		}
+	}
+
+	if (!array_is_created(&result->page_rows) ||
+	    (pgres != NULL && PQresultStatus(pgres) != PGRES_TUPLES_OK)) {
+		/* no rows, or the query failed after some rows were already
+		   returned. either way return only this result. */
+		if (array_is_created(&result->page_rows)) {
+			array_foreach_elem(&result->page_rows, pgres)
+				PQclear(pgres);
+			array_free(&result->page_rows);
+		}
+		result->pgres = pgres;
+	} else {
+		/* the final PGRES_TUPLES_OK has no rows */
+		PQclear(pgres);
+		result->pgres = array_idx_elem(&result->page_rows, 0);
+	}
+	result_finish(result);
+}
+
+static void get_prepare_result(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	PGresult *pgres;
+
+	pgres = PQgetResult(db->pg);
+	if (pgres == NULL) {
+		/* statement is prepared - run the actual query */
+		result->preparing = FALSE;
+		result->prep_stmt->prepared_generation =
+			db->connect_generation;
+		do_query_send(result);
+		return;
+	}
+	if (PQresultStatus(pgres) != PGRES_COMMAND_OK) {
+		/* failed to prepare */
+		result->preparing = FALSE;
+		result->pgres = pgres;
+		result_finish(result);
+		return;
+	}
+	PQclear(pgres);
+	/* wait for the end of the prepare's results */
+	get_result(result);
+}
+
 static void flush_callback(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
@@ -537,24 +704,35 @@ static void query_timeout(struct pgsql_result *result)
 	result_finish(result);
 }
 
-static void do_query(struct pgsql_result *result, const char *query)
+static void do_query_send(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	struct pgsql_prepared_statement *prep_stmt = result->prep_stmt;
 	int ret;
 
-	i_assert(SQL_DB_IS_READY(&db->api));
-	i_assert(db->cur_result == NULL);
-	i_assert(db->io == NULL);
-
-	driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
-	db->cur_result = result;
-	DLLIST_PREPEND(&db->pending_results, result);
-	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
-				 query_timeout, result);
-	result->query = i_strdup(query);
+	if (prep_stmt == NULL)
+		ret = PQsendQuery(db->pg, result->query);
+	else if (prep_stmt->prepared_generation != db->connect_generation) {
+		/* prepare the statement first in this server connection */
+		result->preparing = TRUE;
+		ret = PQsendPrepare(db->pg, prep_stmt->name,
+				    prep_stmt->pg_query,
+				    prep_stmt->param_count, NULL);
+	} else {
+		ret = PQsendQueryPrepared(db->pg, prep_stmt->name,
+					  prep_stmt->param_count,
+					  result->params, NULL, NULL, 0);
+	}
 
-	if (PQsendQuery(db->pg, query) == 0 ||
-	    (ret = PQflush(db->pg)) < 0) {
+#ifdef HAVE_PQSETSINGLEROWMODE
+	if (ret != 0 && !result->preparing && db->page_size > 0) {
+		/* read the rows one by one, so the whole result doesn't need
+		   to be in memory at once */
+		if (PQsetSingleRowMode(db->pg) == 0)
+			e_warning(db->api.event, "PQsetSingleRowMode() failed");
+	}
+#endif
+	if (ret == 0 || (ret = PQflush(db->pg)) < 0) {
 		/* failed to send query */
 		result_finish(result);
 		return;
@@ -570,6 +748,23 @@ static void do_query(struct pgsql_result *result, const char *query)
 	}
 }
 
+static void do_query(struct pgsql_result *result, const char *query)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+
+	i_assert(SQL_DB_IS_READY(&db->api));
+	i_assert(db->cur_result == NULL);
+	i_assert(db->io == NULL);
+
+	driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
+	db->cur_result = result;
+	DLLIST_PREPEND(&db->pending_results, result);
+	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
+				 query_timeout, result);
+	result->query = i_strdup(query);
+	do_query_send(result);
+}
+
 static const char *
 driver_pgsql_escape_string(struct sql_db *_db, const char *string)
 {
@@ -617,8 +812,9 @@ static void driver_pgsql_exec(struct sql_db *db, const char *query)
 	do_query(result, query);
 }
 
-static void driver_pgsql_query(struct sql_db *db, const char *query,
-			       sql_query_callback_t *callback, void *context)
+static struct pgsql_result *
+driver_pgsql_result_new(struct sql_db *db, sql_query_callback_t *callback,
+			void *context)
 {
 	struct pgsql_result *result;
 
@@ -629,6 +825,15 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	result->api.event = event_create(db->event);
 	result->callback = callback;
 	result->context = context;
+	return result;
+}
+
+static void driver_pgsql_query(struct sql_db *db, const char *query,
+			       sql_query_callback_t *callback, void *context)
+{
+	struct pgsql_result *result;
+
+	result = driver_pgsql_result_new(db, callback, context);
 	do_query(result, query);
 }
 
@@ -722,11 +927,27 @@ driver_pgsql_query_s(struct sql_db *_db, const char *query)
 	return result;
 }
 
+static int driver_pgsql_result_next_page_row(struct pgsql_result *result)
+{
+	if (result->rows >= array_count(&result->page_rows))
+		return result->more_rows ? SQL_RESULT_NEXT_MORE : 0;
+
+	/* each row is in its own PGresult */
+	result->pgres = array_idx_elem(&result->page_rows, result->rows++);
+	result->rownum = 0;
+	if (array_is_created(&result->binary_values))
+		driver_pgsql_result_free_binary_values(result);
+	return 1;
+}
+
 static int driver_pgsql_result_next_row(struct sql_result *_result)
 {
 	struct pgsql_result *result = (struct pgsql_result *)_result;
 	struct pgsql_db *db = (struct pgsql_db *)_result->db;
 
+	if (array_is_created(&result->page_rows))
+		return driver_pgsql_result_next_page_row(result);
+
 	if (result->rows != 0) {
 		/* second time we're here */
 		if (++result->rownum < result->rows)
@@ -895,7 +1116,13 @@ static const char *driver_pgsql_result_get_error(struct sql_result *_result)
 
 	i_free_and_null(db->error);
 
-	if (result->timeout) {
+	if (result->more_rows &&
+	    result->rows >= array_count(&result->page_rows)) {
+		/* callers that don't support sql_result_more() will still get
+		   a useful error message. */
+		db->error = i_strdup(
+			"Paged query has more results, but not supported by the caller");
+	} else if (result->timeout) {
 		db->error = i_strdup("Query timed out");
 	} else if (result->pgres == NULL) {
 		/* connection error */
@@ -913,6 +1140,169 @@ static const char *driver_pgsql_result_get_error(struct sql_result *_result)
 	return db->error;
 }
 
+static void
+driver_pgsql_result_more(struct sql_result **_result, bool async,
+			 sql_query_callback_t *callback, void *context)
+{
+	struct pgsql_result *old_result = (struct pgsql_result *)*_result;
+	struct pgsql_db *db = (struct pgsql_db *)old_result->api.db;
+	struct pgsql_result *result;
+	struct sql_result *sync_result;
+
+	i_assert(old_result->more_rows);
+	i_assert(db->cur_result == old_result);
+
+	/* Continue reading the rows of the same query into a new result.
+	   The connection stays busy until the last page is freed. */
+	result = driver_pgsql_result_new(&db->api, callback, context);
+	result->query = i_strdup(old_result->query);
+	old_result->paging_continues = TRUE;
+	sql_result_unref(*_result);
+	*_result = NULL;
+
+	db->cur_result = result;
+	if (!async) {
+		driver_pgsql_sync_init(db);
+		result->callback = pgsql_query_s_callback;
+		result->context = db;
+	}
+	DLLIST_PREPEND(&db->pending_results, result);
+	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
+				 query_timeout, result);
+	get_result(result);
+	if (async)
+		return;
+
+	if (db->sync_result == NULL)
+		io_loop_run(db->ioloop);
+	sync_result = db->sync_result;
+	if (sync_result == NULL) {
+		sync_result = &sql_not_connected_result;
+		sync_result->refcount++;
+	}
+	driver_pgsql_sync_deinit(db);
+	callback(sync_result, context);
+}
+
+static struct sql_prepared_statement *
+driver_pgsql_prepared_statement_init(struct sql_db *_db,
+				     const char *query_template)
+{
+	struct pgsql_db *db = (struct pgsql_db *)_db;
+	struct pgsql_prepared_statement *prep_stmt;
+	string_t *query = t_str_new(128);
+	unsigned int param_count = 0;
+	const char *p;
+
+	for (p = query_template; *p != '\0'; p++) {
+		if (*p == '?')
+			str_printfa(query, "$%u", ++param_count);
+		else
+			str_append_c(query, *p);
+	}
+
+	prep_stmt = i_new(struct pgsql_prepared_statement, 1);
+	prep_stmt->api.db = _db;
+	prep_stmt->api.refcount = 1;
+	prep_stmt->api.query_template = i_strdup(query_template);
+	prep_stmt->name = i_strdup_printf("dovecot_%u",
+					  ++db->prepared_stmt_counter);
+	prep_stmt->pg_query = i_strdup(str_c(query));
+	prep_stmt->param_count = param_count;
+	return &prep_stmt->api;
+}
+
+static void
+driver_pgsql_prepared_statement_deinit(struct sql_prepared_statement *_prep_stmt)
+{
+	struct pgsql_prepared_statement *prep_stmt =
+		(struct pgsql_prepared_statement *)_prep_stmt;
+
+	i_free(prep_stmt->name);
+	i_free(prep_stmt->pg_query);
+	i_free(prep_stmt->api.query_template);
+	i_free(prep_stmt);
+}
+
+static struct sql_statement *
+driver_pgsql_statement_init(struct sql_db *db ATTR_UNUSED,
+			    const char *query_template ATTR_UNUSED)
+{
+	pool_t pool = pool_alloconly_create("pgsql sql statement", 1024);
+	struct pgsql_statement *stmt = p_new(pool, struct pgsql_statement, 1);
+
+	stmt->api.pool = pool;
+	p_array_init(&stmt->params, pool, 8);
+	return &stmt->api;
+}
+
+static struct sql_statement *
+driver_pgsql_statement_init_prepared(struct sql_prepared_statement *_prep_stmt)
+{
+	struct pgsql_prepared_statement *prep_stmt =
+		(struct pgsql_prepared_statement *)_prep_stmt;
+	struct sql_statement *_stmt =
+		driver_pgsql_statement_init(_prep_stmt->db,
+					    _prep_stmt->query_template);
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	_stmt->query_template = p_strdup(_stmt->pool,
+					 _prep_stmt->query_template);
+	stmt->prep_stmt = prep_stmt;
+	return _stmt;
+}
+
+static void
+driver_pgsql_statement_bind_str(struct sql_statement *_stmt,
+				unsigned int column_idx, const char *value)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	value = p_strdup(_stmt->pool, value);
+	array_idx_set(&stmt->params, column_idx, &value);
+}
+
+static void
+driver_pgsql_statement_bind_binary(struct sql_statement *_stmt,
+				   unsigned int column_idx ATTR_UNUSED,
+				   const void *value ATTR_UNUSED,
+				   size_t value_size ATTR_UNUSED)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+
+	stmt->params_unsupported = TRUE;
+}
+
+static void
+driver_pgsql_statement_bind_int64(struct sql_statement *_stmt,
+				  unsigned int column_idx, int64_t value)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+	const char *value_str = p_strdup_printf(_stmt->pool, "%"PRId64, value);
+
+	array_idx_set(&stmt->params, column_idx, &value_str);
+}
+
+static void
+driver_pgsql_statement_query(struct sql_statement *_stmt,
+			     sql_query_callback_t *callback, void *context)
+{
+	struct pgsql_statement *stmt = (struct pgsql_statement *)_stmt;
+	struct pgsql_result *result;
+	/* this also verifies that all the parameters are bound */
+	const char *query = sql_statement_get_query(_stmt);
+
+	result = driver_pgsql_result_new(_stmt->db, callback, context);
+	if (stmt->prep_stmt != NULL && !stmt->params_unsupported) {
+		array_append_zero(&stmt->params);
+		result->prep_stmt = stmt->prep_stmt;
+		result->params = p_strarray_dup(default_pool,
+						array_front(&stmt->params));
+	}
+	pool_unref(&_stmt->pool);
+	do_query(result, query);
+}
+
 static struct sql_transaction_context *
 driver_pgsql_transaction_begin(struct sql_db *db)
 {
@@ -1308,6 +1698,15 @@ const struct sql_db driver_pgsql_db = {
 		.update = driver_pgsql_update,
 
 		.escape_blob = driver_pgsql_escape_blob,
+
+		.prepared_statement_init = driver_pgsql_prepared_statement_init,
+		.prepared_statement_deinit = driver_pgsql_prepared_statement_deinit,
+		.statement_init = driver_pgsql_statement_init,
+		.statement_init_prepared = driver_pgsql_statement_init_prepared,
+		.statement_bind_str = driver_pgsql_statement_bind_str,
+		.statement_bind_binary = driver_pgsql_statement_bind_binary,
+		.statement_bind_int64 = driver_pgsql_statement_bind_int64,
+		.statement_query = driver_pgsql_statement_query,
 	}
 };
 
@@ -1323,6 +1722,7 @@ const struct sql_result driver_pgsql_result = {
 		.find_field_value = driver_pgsql_result_find_field_value,
 		.get_values = driver_pgsql_result_get_values,
 		.get_error = driver_pgsql_result_get_error,
+		.more = driver_pgsql_result_more,
 	}
 };
 
@@ -4,12 +4,22 @@
 #include "array.h"
 #include "llist.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "sql-api-private.h"
 
 #include <time.h>
+#include <ctype.h>
 
 #define QUERY_TIMEOUT_SECS 6
 
+/* Weight of a new sample in the latency and error rate moving averages is
+   1/SQLPOOL_HOST_EWMA_WEIGHT. */
+#define SQLPOOL_HOST_EWMA_WEIGHT 8
+/* Host is unhealthy when its error rate is at least this (per mille) */
+#define SQLPOOL_HOST_UNHEALTHY_ERROR_RATE 500
+/* Unhealthy host is tried again after it hasn't failed for this long */
+#define SQLPOOL_HOST_RECOVERY_SECS 10
+
 /* sqlpool events are separate from category:sql, because
    they are usually not very interesting, and would only
    make logging too noisy. They can be enabled explicitly.
@@ -20,8 +30,21 @@ static struct event_category event_category_sqlpool = {
 
 struct sqlpool_host {
 	char *connect_string;
+	/* event with the host's name for per-host statistics */
+	struct event *event;
 
 	unsigned int connection_count;
+
+	/* moving averages of query latency and the rate of queries failing
+	   because of connection problems (per mille) */
+	unsigned int latency_ewma_usecs;
+	unsigned int error_rate;
+	time_t last_failure;
+
+	/* read-only replica: only SELECT queries are sent to it */
+	bool replica:1;
+	bool have_latency:1;
+	bool unhealthy:1;
 };
 
 struct sqlpool_connection {
@@ -56,18 +79,37 @@ struct sqlpool_request {
 
 	unsigned int host_idx;
 	unsigned int retry_count;
+	/* when the query was sent to host_idx */
+	struct timeval sent_time;
 
 	struct event *event;
 
 	/* requests are a) queries */
 	char *query;
+	/* query can be sent to a read-only replica */
+	bool read_only;
 	sql_query_callback_t *callback;
 	void *context;
+	/* query template and its unescaped parameters, if the query can be
+	   sent as a prepared statement to the connection */
+	char *prep_query_template;
+	const char **prep_args;
 
 	/* b) transaction waiters */
 	struct sqlpool_transaction_context *trans;
 };
 
+struct sqlpool_statement {
+	struct sql_statement stmt;
+
+	/* unescaped parameters */
+	ARRAY_TYPE(const_string) args;
+	/* created with sql_statement_init_prepared() */
+	bool prepared;
+	/* a parameter can't be given as string */
+	bool args_unsupported;
+};
+
 struct sqlpool_transaction_context {
 	struct sql_transaction_context ctx;
 
@@ -91,6 +133,27 @@ driver_sqlpool_commit_callback(const struct sql_commit_result *result,
 			       struct sqlpool_transaction_context *ctx);
 static void driver_sqlpool_deinit(struct sql_db *_db);
 
+static bool sqlpool_query_is_read_only(const char *query)
+{
+	bool ret;
+
+	while (i_isspace(*query) || *query == '(')
+		query++;
+	if (strncasecmp(query, "SELECT", 6) != 0 ||
+	    i_isalnum(query[6]) || query[6] == '_')
+		return FALSE;
+
+	/* locking reads need to go to the primary */
+	T_BEGIN {
+		const char *lquery = t_str_lcase(query);
+
+		ret = strstr(lquery, " for update") == NULL &&
+			strstr(lquery, " for share") == NULL &&
+			strstr(lquery, " lock in share mode") == NULL;
+	} T_END;
+	return ret;
+}
+
 static struct sqlpool_request * ATTR_NULL(2)
 sqlpool_request_new(struct sqlpool_db *db, const char *query)
 {
@@ -100,10 +163,119 @@ sqlpool_request_new(struct sqlpool_db *db, const char *query)
 	request->db = db;
 	request->created = time(NULL);
 	request->query = i_strdup(query);
+	request->read_only = query != NULL && sqlpool_query_is_read_only(query);
 	request->event = event_create(db->api.event);
 	return request;
 }
 
+static const struct sqlpool_connection *
+sqlpool_connection_find(struct sqlpool_db *db, struct sql_db *conndb)
+{
+	const struct sqlpool_connection *conn;
+
+	array_foreach(&db->all_connections, conn) {
+		if (conn->db == conndb)
+			return conn;
+	}
+	/* the connection is being destroyed */
+	return NULL;
+}
+
+static bool sqlpool_host_is_healthy(const struct sqlpool_host *host)
+{
+	return !host->unhealthy ||
+		host->last_failure + SQLPOOL_HOST_RECOVERY_SECS <= ioloop_time;
+}
+
+/* Returns TRUE if host1 should be preferred over host2 */
+static bool
+sqlpool_host_is_better(const struct sqlpool_host *host1,
+		       const struct sqlpool_host *host2)
+{
+	bool healthy1 = sqlpool_host_is_healthy(host1);
+	bool healthy2 = sqlpool_host_is_healthy(host2);
+
+	if (healthy1 != healthy2)
+		return healthy1;
+	/* prefer hosts without any latency measurements yet, so they
+	   get measured */
+	if (!host1->have_latency || !host2->have_latency)
+		return !host1->have_latency && host2->have_latency;
+	return host1->latency_ewma_usecs < host2->latency_ewma_usecs;
+}
+
+static void
+sqlpool_host_update_health(struct sqlpool_host *host, bool failed)
+{
+	unsigned int sample = failed ? 1000 : 0;
+
+	host->error_rate = (host->error_rate * (SQLPOOL_HOST_EWMA_WEIGHT - 1) +
+			    sample) / SQLPOOL_HOST_EWMA_WEIGHT;
+	if (failed)
+		host->last_failure = ioloop_time;
+
+	if (!host->unhealthy &&
+	    host->error_rate >= SQLPOOL_HOST_UNHEALTHY_ERROR_RATE) {
+		host->unhealthy = TRUE;
+		e_warning(event_create_passthrough(host->event)->
+			  set_name("sql_pool_host_unhealthy")->
+			  add_int("error_rate", host->error_rate)->event(),
+			  "Host is failing (error rate %u.%u%%), "
+			  "preferring other hosts",
+			  host->error_rate / 10, host->error_rate % 10);
+	} else if (host->unhealthy &&
+		   host->error_rate < SQLPOOL_HOST_UNHEALTHY_ERROR_RATE / 2) {
+		host->unhealthy = FALSE;
+		e_info(event_create_passthrough(host->event)->
+		       set_name("sql_pool_host_healthy")->
+		       add_int("error_rate", host->error_rate)->event(),
+		       "Host has recovered");
+	}
+}
+
+static void
+sqlpool_host_query_finished(struct sqlpool_db *db, unsigned int host_idx,
+			    const struct timeval *sent_time,
+			    const struct sql_result *result)
+{
+	struct sqlpool_host *host = array_idx_modifiable(&db->hosts, host_idx);
+	struct timeval now;
+	long long latency;
+	bool failed = result->failed_try_retry ||
+		result == &sql_not_connected_result;
+
+	i_gettimeofday(&now);
+	latency = timeval_diff_usecs(&now, sent_time);
+	if (latency < 0)
+		latency = 0;
+	else if (latency > UINT_MAX)
+		latency = UINT_MAX;
+
+	/* failed queries' latencies aren't comparable to successful ones */
+	if (failed)
+		;
+	else if (!host->have_latency) {
+		host->latency_ewma_usecs = latency;
+		host->have_latency = TRUE;
+	} else {
+		host->latency_ewma_usecs =
+			((unsigned long long)host->latency_ewma_usecs *
+			 (SQLPOOL_HOST_EWMA_WEIGHT - 1) + latency) /
+			SQLPOOL_HOST_EWMA_WEIGHT;
+	}
+	sqlpool_host_update_health(host, failed);
+
+	e_debug(event_create_passthrough(host->event)->
+		set_name("sql_pool_host_query_finished")->
+		add_int("latency_usecs", latency)->
+		add_int("latency_ewma_usecs", host->latency_ewma_usecs)->
+		add_int("error_rate", host->error_rate)->
+		add_int("failed", failed ? 1 : 0)->event(),
+		"Query finished in %lld us (average %u us, error rate %u.%u%%)",
+		latency, host->latency_ewma_usecs,
+		host->error_rate / 10, host->error_rate % 10);
+}
+
 static void
 sqlpool_request_free(struct sqlpool_request **_request)
 {
@@ -113,6 +285,8 @@ sqlpool_request_free(struct sqlpool_request **_request)
 
 	i_assert(request->prev == NULL && request->next == NULL);
 	event_unref(&request->event);
+	i_free(request->prep_args);
+	i_free(request->prep_query_template);
 	i_free(request->query);
 	i_free(request);
 }
@@ -163,21 +337,65 @@ sqlpool_request_handle_transaction(struct sql_db *conndb,
 			       driver_sqlpool_commit_callback, trans);
 }
 
+static void
+sqlpool_request_send_query(struct sqlpool_request *request,
+			   struct sql_db *conndb)
+{
+	const struct sqlpool_connection *conn;
+	struct sql_prepared_statement *prep_stmt;
+	struct sql_statement *stmt;
+	unsigned int i;
+
+	conn = sqlpool_connection_find(request->db, conndb);
+	i_assert(conn != NULL);
+	request->host_idx = conn->host_idx;
+	i_gettimeofday(&request->sent_time);
+
+	if (request->prep_query_template == NULL ||
+	    conndb->v.prepared_statement_init == NULL) {
+		sql_query(conndb, request->query,
+			  driver_sqlpool_query_callback, request);
+		return;
+	}
+
+	/* the connection caches the prepared statement, so this is cheap
+	   after the first query */
+	prep_stmt = sql_prepared_statement_init(conndb,
+						request->prep_query_template);
+	stmt = sql_statement_init_prepared(prep_stmt);
+	sql_prepared_statement_unref(&prep_stmt);
+	for (i = 0; request->prep_args[i] != NULL; i++)
+		sql_statement_bind_str(stmt, i, request->prep_args[i]);
+	sql_statement_query(&stmt, driver_sqlpool_query_callback, request);
+}
+
 static void
 sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 {
+	const struct sqlpool_connection *conn;
+	const struct sqlpool_host *host;
 	struct sqlpool_request *request;
 
 	if (db->requests_head == NULL || !SQL_DB_IS_READY(conndb))
 		return;
 
+	conn = sqlpool_connection_find(db, conndb);
+	if (conn == NULL)
+		return;
+	host = array_idx(&db->hosts, conn->host_idx);
 	request = db->requests_head;
+	if (host->replica) {
+		/* send the oldest request that can go to a replica */
+		while (request != NULL && !request->read_only)
+			request = request->next;
+		if (request == NULL)
+			return;
+	}
 	DLLIST2_REMOVE(&db->requests_head, &db->requests_tail, request);
 	timeout_reset(db->request_to);
 
 	if (request->query != NULL) {
-		sql_query(conndb, request->query,
-			  driver_sqlpool_query_callback, request);
+		sqlpool_request_send_query(request, conndb);
 	} else if (request->trans != NULL) {
 		sqlpool_request_handle_transaction(conndb, request->trans);
 	} else {
@@ -193,6 +411,7 @@ static void sqlpool_reconnect(struct sql_db *conndb)
 
 static struct sqlpool_host *
 sqlpool_find_host_with_least_connections(struct sqlpool_db *db,
+					 bool primary_only,
 					 unsigned int *host_idx_r)
 {
 	struct sqlpool_host *hosts, *min = NULL;
@@ -201,15 +420,17 @@ sqlpool_find_host_with_least_connections(struct sqlpool_db *db,
 	hosts = array_get_modifiable(&db->hosts, &count);
 	i_assert(count > 0);
 
-	min = &hosts[0];
-	*host_idx_r = 0;
-
-	for (i = 1; i < count; i++) {
-		if (min->connection_count > hosts[i].connection_count) {
+	for (i = 0; i < count; i++) {
+		if (primary_only && hosts[i].replica)
+			continue;
+		if (min == NULL ||
+		    min->connection_count > hosts[i].connection_count) {
 			min = &hosts[i];
 			*host_idx_r = i;
 		}
 	}
+	/* parsing guarantees that there is at least one primary host */
+	i_assert(min != NULL);
 	return min;
 }
 
@@ -227,9 +448,16 @@ static bool sqlpool_have_successful_connections(struct sqlpool_db *db)
 static void
 sqlpool_handle_connect_failed(struct sqlpool_db *db, struct sql_db *conndb)
 {
+	const struct sqlpool_connection *conn;
 	struct sqlpool_host *host;
 	unsigned int host_idx;
 
+	conn = sqlpool_connection_find(db, conndb);
+	if (conn != NULL) {
+		sqlpool_host_update_health(
+			array_idx_modifiable(&db->hosts, conn->host_idx), TRUE);
+	}
+
 	if (conndb->connect_failure_count > 0) {
 		/* increase delay between reconnections to this
 		   server */
@@ -247,7 +475,8 @@ sqlpool_handle_connect_failed(struct sqlpool_db *db, struct sql_db *conndb)
 	/* if we have zero successful hosts and there still are hosts
 	   without connections, connect to one of them. */
 	if (!sqlpool_have_successful_connections(db)) {
-		host = sqlpool_find_host_with_least_connections(db, &host_idx);
+		host = sqlpool_find_host_with_least_connections(db, FALSE,
+								&host_idx);
 		if (host->connection_count == 0)
 			(void)sqlpool_add_connection(db, host, host_idx);
 	}
@@ -309,12 +538,13 @@ sqlpool_add_connection(struct sqlpool_db *db, struct sqlpool_host *host,
 }
 
 static struct sqlpool_connection *
-sqlpool_add_new_connection(struct sqlpool_db *db)
+sqlpool_add_new_connection(struct sqlpool_db *db, bool read_only)
 {
 	struct sqlpool_host *host;
 	unsigned int host_idx;
 
-	host = sqlpool_find_host_with_least_connections(db, &host_idx);
+	host = sqlpool_find_host_with_least_connections(db, !read_only,
+							&host_idx);
 	if (host->connection_count >= db->connection_limit)
 		return NULL;
 	else
@@ -324,39 +554,52 @@ sqlpool_add_new_connection(struct sqlpool_db *db)
 static const struct sqlpool_connection *
 sqlpool_find_available_connection(struct sqlpool_db *db,
 				  unsigned int unwanted_host_idx,
-				  bool *all_disconnected_r)
+				  bool read_only, bool *all_disconnected_r)
 {
 	const struct sqlpool_connection *conns;
-	unsigned int i, count;
+	const struct sqlpool_host *hosts, *best_host = NULL;
+	unsigned int i, count, best_idx = 0;
 
 	*all_disconnected_r = TRUE;
 
+	/* Use the ready connection to the healthy host with the lowest
+	   latency. Start from the connection after the previously used one,
+	   so that equally good connections are used round-robin. */
+	hosts = array_front(&db->hosts);
 	conns = array_get(&db->all_connections, &count);
 	for (i = 0; i < count; i++) {
 		unsigned int idx = (i + db->last_query_conn_idx + 1) % count;
+		const struct sqlpool_host *host = &hosts[conns[idx].host_idx];
 		struct sql_db *conndb = conns[idx].db;
 
 		if (conns[idx].host_idx == unwanted_host_idx)
 			continue;
+		if (host->replica && !read_only)
+			continue;
 
 		if (!SQL_DB_IS_READY(conndb) && conndb->to_reconnect == NULL) {
 			/* see if we could reconnect to it immediately */
 			(void)sql_connect(conndb);
 		}
 		if (SQL_DB_IS_READY(conndb)) {
-			db->last_query_conn_idx = idx;
 			*all_disconnected_r = FALSE;
-			return &conns[idx];
-		}
-		if (conndb->state != SQL_DB_STATE_DISCONNECTED)
+			if (best_host == NULL ||
+			    sqlpool_host_is_better(host, best_host)) {
+				best_host = host;
+				best_idx = idx;
+			}
+		} else if (conndb->state != SQL_DB_STATE_DISCONNECTED)
 			*all_disconnected_r = FALSE;
 	}
-	return NULL;
+	if (best_host == NULL)
+		return NULL;
+	db->last_query_conn_idx = best_idx;
+	return &conns[best_idx];
 }
 
 static bool
 driver_sqlpool_get_connection(struct sqlpool_db *db,
-			      unsigned int unwanted_host_idx,
+			      unsigned int unwanted_host_idx, bool read_only,
 			      const struct sqlpool_connection **conn_r)
 {
 	const struct sqlpool_connection *conn, *conns;
@@ -364,10 +607,11 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 	bool all_disconnected;
 
 	conn = sqlpool_find_available_connection(db, unwanted_host_idx,
-						 &all_disconnected);
+						 read_only, &all_disconnected);
 	if (conn == NULL && unwanted_host_idx != UINT_MAX) {
 		/* maybe there are no wanted hosts. use any of them. */
 		conn = sqlpool_find_available_connection(db, UINT_MAX,
+							 read_only,
 							 &all_disconnected);
 	}
 	if (conn == NULL && all_disconnected) {
@@ -381,11 +625,12 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 				conndb->connect_delay = SQL_CONNECT_RESET_DELAY;
 		}
 		conn = sqlpool_find_available_connection(db, UINT_MAX,
+							 read_only,
 							 &all_disconnected);
 	}
 	if (conn == NULL) {
 		/* still nothing. try creating new connections */
-		conn = sqlpool_add_new_connection(db);
+		conn = sqlpool_add_new_connection(db, read_only);
 		if (conn != NULL)
 			(void)sql_connect(conn->db);
 		if (conn == NULL || !SQL_DB_IS_READY(conn->db))
@@ -397,18 +642,25 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 
 static bool
 driver_sqlpool_get_sync_connection(struct sqlpool_db *db,
+				   unsigned int unwanted_host_idx,
+				   bool read_only,
 				   const struct sqlpool_connection **conn_r)
 {
 	const struct sqlpool_connection *conns;
+	const struct sqlpool_host *host;
 	unsigned int i, count;
 
-	if (driver_sqlpool_get_connection(db, UINT_MAX, conn_r))
+	if (driver_sqlpool_get_connection(db, unwanted_host_idx, read_only,
+					  conn_r))
 		return TRUE;
 
 	/* no idling connections, but maybe we can find one that's trying to
 	   connect to server, and we can use it once it's finished */
 	conns = array_get(&db->all_connections, &count);
 	for (i = 0; i < count; i++) {
+		host = array_idx(&db->hosts, conns[i].host_idx);
+		if (host->replica && !read_only)
+			continue;
 		if (conns[i].db->state == SQL_DB_STATE_CONNECTING) {
 			*conn_r = &conns[i];
 			return TRUE;
@@ -442,7 +694,7 @@ static enum sql_db_flags driver_sqlpool_get_flags(struct sql_db *_db)
 	if (driver_sqlpool_get_connected_flags(db, &flags))
 		return flags;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, UINT_MAX, FALSE, &conn)) {
 		/* Failed to connect to database. Just use the first
 		   connection. */
 		conn = array_idx(&db->all_connections, 0);
@@ -456,9 +708,10 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 {
 	const char *const *args, *key, *value, *hostname;
 	struct sqlpool_host *host;
-	ARRAY_TYPE(const_string) hostnames, connect_args;
+	ARRAY_TYPE(const_string) hostnames, replica_hostnames, connect_args;
 
 	t_array_init(&hostnames, 8);
+	t_array_init(&replica_hostnames, 8);
 	t_array_init(&connect_args, 32);
 
 	/* connect string is a space separated list. it may contain
@@ -483,6 +736,8 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 			}
 		} else if (strcmp(key, "host") == 0) {
 			array_push_back(&hostnames, &value);
+		} else if (strcmp(key, "replica_host") == 0) {
+			array_push_back(&replica_hostnames, &value);
 		} else {
 			array_push_back(&connect_args, args);
 		}
@@ -493,9 +748,14 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 	connect_string = t_strarray_join(array_front(&connect_args), " ");
 
 	if (array_count(&hostnames) == 0) {
+		if (array_count(&replica_hostnames) > 0) {
+			*error_r = "replica_host requires also a primary host";
+			return -1;
+		}
 		/* no hosts specified. create a default one. */
 		host = array_append_space(&db->hosts);
 		host->connect_string = i_strdup(connect_string);
+		host->event = event_create(db->api.event);
 	} else {
 		if (*connect_string == '\0')
 			connect_string = NULL;
@@ -505,6 +765,20 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 			host->connect_string =
 				i_strconcat("host=", hostname, " ",
 					    connect_string, NULL);
+			host->event = event_create(db->api.event);
+			event_add_str(host->event, "sql_host", hostname);
+		}
+		array_foreach_elem(&replica_hostnames, hostname) {
+			host = array_append_space(&db->hosts);
+			host->connect_string =
+				i_strconcat("host=", hostname, " ",
+					    connect_string, NULL);
+			host->replica = TRUE;
+			host->event = event_create(db->api.event);
+			event_add_str(host->event, "sql_host", hostname);
+			event_add_str(host->event, "sql_host_role", "replica");
+			event_set_append_log_prefix(host->event,
+				t_strdup_printf("replica %s: ", hostname));
 		}
 	}
 
@@ -519,7 +793,8 @@ static void sqlpool_add_all_once(struct sqlpool_db *db)
 	unsigned int host_idx;
 
 	for (;;) {
-		host = sqlpool_find_host_with_least_connections(db, &host_idx);
+		host = sqlpool_find_host_with_least_connections(db, FALSE,
+								&host_idx);
 		if (host->connection_count > 0)
 			break;
 		(void)sqlpool_add_connection(db, host, host_idx);
@@ -581,8 +856,10 @@ static void driver_sqlpool_deinit(struct sql_db *_db)
 
 	driver_sqlpool_abort_requests(db);
 
-	array_foreach_modifiable(&db->hosts, host)
+	array_foreach_modifiable(&db->hosts, host) {
+		event_unref(&host->event);
 		i_free(host->connect_string);
+	}
 
 	i_assert(array_count(&db->all_connections) == 0);
 	array_free(&db->hosts);
@@ -703,6 +980,11 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	const struct sqlpool_connection *conn = NULL;
 	struct sql_db *conndb;
 
+	if (result != &sql_not_connected_result) {
+		sqlpool_host_query_finished(db, request->host_idx,
+					    &request->sent_time, result);
+	}
+
 	if (result->failed_try_retry &&
 	    request->retry_count < array_count(&db->hosts)) {
 		e_warning(db->api.event, "Query failed, retrying: %s",
@@ -711,10 +993,9 @@ driver_sqlpool_query_callback(struct sql_result *result,
 		driver_sqlpool_prepend_request(db, request);
 
 		if (driver_sqlpool_get_connection(request->db,
-						  request->host_idx, &conn)) {
-			request->host_idx = conn->host_idx;
+						  request->host_idx,
+						  request->read_only, &conn))
 			sqlpool_request_send_next(db, conn->db);
-		}
 	} else {
 		if (result->failed) {
 			e_error(db->api.event, "Query failed, aborting: %s",
@@ -730,25 +1011,30 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	}
 }
 
+static void
+driver_sqlpool_request_send(struct sqlpool_request *request)
+{
+	struct sqlpool_db *db = request->db;
+	const struct sqlpool_connection *conn;
+
+	if (!driver_sqlpool_get_connection(db, UINT_MAX, request->read_only,
+					   &conn))
+		driver_sqlpool_append_request(db, request);
+	else
+		sqlpool_request_send_query(request, conn->db);
+}
+
 static void ATTR_NULL(3, 4)
 driver_sqlpool_query(struct sql_db *_db, const char *query,
 		     sql_query_callback_t *callback, void *context)
 {
         struct sqlpool_db *db = (struct sqlpool_db *)_db;
 	struct sqlpool_request *request;
-	const struct sqlpool_connection *conn;
 
 	request = sqlpool_request_new(db, query);
 	request->callback = callback;
 	request->context = context;
-
-	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
-		driver_sqlpool_append_request(db, request);
-	else {
-		request->host_idx = conn->host_idx;
-		sql_query(conn->db, query, driver_sqlpool_query_callback,
-			  request);
-	}
+	driver_sqlpool_request_send(request);
 }
 
 static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
@@ -756,29 +1042,130 @@ static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
 	driver_sqlpool_query(_db, query, NULL, NULL);
 }
 
+static struct sql_result *
+driver_sqlpool_query_conn_s(struct sqlpool_db *db,
+			    const struct sqlpool_connection *conn,
+			    const char *query)
+{
+	struct sql_result *result;
+	struct timeval sent_time;
+	unsigned int host_idx = conn->host_idx;
+
+	i_gettimeofday(&sent_time);
+	result = sql_query_s(conn->db, query);
+	if (result != &sql_not_connected_result)
+		sqlpool_host_query_finished(db, host_idx, &sent_time, result);
+	return result;
+}
+
 static struct sql_result *
 driver_sqlpool_query_s(struct sql_db *_db, const char *query)
 {
         struct sqlpool_db *db = (struct sqlpool_db *)_db;
 	const struct sqlpool_connection *conn;
 	struct sql_result *result;
+	bool read_only = sqlpool_query_is_read_only(query);
+	unsigned int host_idx;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, UINT_MAX, read_only,
+						&conn)) {
 		sql_not_connected_result.refcount++;
 		return &sql_not_connected_result;
 	}
 
-	result = sql_query_s(conn->db, query);
+	host_idx = conn->host_idx;
+	result = driver_sqlpool_query_conn_s(db, conn, query);
 	if (result->failed_try_retry) {
-		if (!driver_sqlpool_get_sync_connection(db, &conn))
+		if (!driver_sqlpool_get_sync_connection(db, host_idx,
+							read_only, &conn))
 			return result;
 
 		sql_result_unref(result);
-		result = sql_query_s(conn->db, query);
+		result = driver_sqlpool_query_conn_s(db, conn, query);
 	}
 	return result;
 }
 
+static struct sql_statement *
+driver_sqlpool_statement_init(struct sql_db *db ATTR_UNUSED,
+			      const char *query_template ATTR_UNUSED)
+{
+	pool_t pool = pool_alloconly_create("sqlpool sql statement", 1024);
+	struct sqlpool_statement *stmt =
+		p_new(pool, struct sqlpool_statement, 1);
+
+	stmt->stmt.pool = pool;
+	p_array_init(&stmt->args, pool, 8);
+	return &stmt->stmt;
+}
+
+static struct sql_statement *
+driver_sqlpool_statement_init_prepared(struct sql_prepared_statement *prep_stmt)
+{
+	struct sql_statement *_stmt =
+		driver_sqlpool_statement_init(prep_stmt->db,
+					      prep_stmt->query_template);
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+
+	_stmt->query_template = p_strdup(_stmt->pool, prep_stmt->query_template);
+	stmt->prepared = TRUE;
+	return _stmt;
+}
+
+static void
+driver_sqlpool_statement_bind_str(struct sql_statement *_stmt,
+				  unsigned int column_idx, const char *value)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+
+	value = p_strdup(_stmt->pool, value);
+	array_idx_set(&stmt->args, column_idx, &value);
+}
+
+static void
+driver_sqlpool_statement_bind_binary(struct sql_statement *_stmt,
+				     unsigned int column_idx ATTR_UNUSED,
+				     const void *value ATTR_UNUSED,
+				     size_t value_size ATTR_UNUSED)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+
+	stmt->args_unsupported = TRUE;
+}
+
+static void
+driver_sqlpool_statement_bind_int64(struct sql_statement *_stmt,
+				    unsigned int column_idx, int64_t value)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	const char *value_str = p_strdup_printf(_stmt->pool, "%"PRId64, value);
+
+	array_idx_set(&stmt->args, column_idx, &value_str);
+}
+
+static void
+driver_sqlpool_statement_query(struct sql_statement *_stmt,
+			       sql_query_callback_t *callback, void *context)
+{
+	struct sqlpool_statement *stmt = (struct sqlpool_statement *)_stmt;
+	struct sqlpool_db *db = (struct sqlpool_db *)_stmt->db;
+	struct sqlpool_request *request;
+
+	request = sqlpool_request_new(db, sql_statement_get_query(_stmt));
+	request->callback = callback;
+	request->context = context;
+	if (stmt->prepared && !stmt->args_unsupported) {
+		/* sql_statement_get_query() already verified that all the
+		   parameters are bound */
+		array_append_zero(&stmt->args);
+		request->prep_query_template = i_strdup(_stmt->query_template);
+		request->prep_args =
+			p_strarray_dup(default_pool, array_front(&stmt->args));
+	}
+	pool_unref(&_stmt->pool);
+	driver_sqlpool_request_send(request);
+}
+
 static struct sql_transaction_context *
 driver_sqlpool_transaction_begin(struct sql_db *_db)
 {
@@ -827,7 +1214,8 @@ driver_sqlpool_transaction_commit(struct sql_transaction_context *_ctx,
 	ctx->commit_request = sqlpool_request_new(db, NULL);
 	ctx->commit_request->trans = ctx;
 
-	if (driver_sqlpool_get_connection(db, UINT_MAX, &conn))
+	/* transactions are always sent to a primary host */
+	if (driver_sqlpool_get_connection(db, UINT_MAX, FALSE, &conn))
 		sqlpool_request_handle_transaction(conn->db, ctx);
 	else
 		driver_sqlpool_append_request(db, ctx->commit_request);
@@ -846,7 +1234,7 @@ driver_sqlpool_transaction_commit_s(struct sql_transaction_context *_ctx,
 
 	*error_r = NULL;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, UINT_MAX, FALSE, &conn)) {
 		*error_r = SQL_ERRSTR_NOT_CONNECTED;
 		driver_sqlpool_transaction_free(ctx);
 		return -1;
@@ -930,5 +1318,12 @@ struct sql_db driver_sqlpool_db = {
 		.update = driver_sqlpool_update,
 
 		.escape_blob = driver_sqlpool_escape_blob,
+
+		.statement_init = driver_sqlpool_statement_init,
+		.statement_init_prepared = driver_sqlpool_statement_init_prepared,
+		.statement_bind_str = driver_sqlpool_statement_bind_str,
+		.statement_bind_binary = driver_sqlpool_statement_bind_binary,
+		.statement_bind_int64 = driver_sqlpool_statement_bind_int64,
+		.statement_query = driver_sqlpool_statement_query,
 	}
 };
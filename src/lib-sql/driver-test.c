@@ -318,7 +318,10 @@ driver_test_transaction_commit(struct sql_transaction_context *ctx,
 				sql_commit_callback_t *callback, void *context)
 {
 	struct sql_commit_result res;
-	res.error_type = driver_test_transaction_commit_s(ctx, &res.error);
+
+	i_zero(&res);
+	if (driver_test_transaction_commit_s(ctx, &res.error) < 0)
+		res.error_type = SQL_RESULT_ERROR_TYPE_UNKNOWN;
 	callback(&res, context);
 }
 
@@ -241,7 +241,6 @@ void sql_db_set_state(struct sql_db *db, enum sql_db_state state);
 
 void sql_transaction_add_query(struct sql_transaction_context *ctx, pool_t pool,
 			       const char *query, unsigned int *affected_rows);
-const char *sql_statement_get_query(struct sql_statement *stmt);
 
 void sql_connection_log_finished(struct sql_db *db);
 struct event_passthrough *
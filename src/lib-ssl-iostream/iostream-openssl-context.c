@@ -1,6 +1,8 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "buffer.h"
+#include "hex-binary.h"
 #include "safe-memset.h"
 #include "iostream-openssl.h"
 #include "dovecot-openssl-common.h"
@@ -13,6 +15,12 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
 
 #if !defined(OPENSSL_NO_ECDH) && OPENSSL_VERSION_NUMBER >= 0x10000000L
 #  define HAVE_ECDH
@@ -356,6 +364,187 @@ static int ssl_servername_callback(SSL *ssl, int *al ATTR_UNUSED,
 }
 #endif
 
+#if defined(HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB) || \
+    defined(SSL_CTX_set_tlsext_ticket_key_cb)
+#  define HAVE_TICKET_KEY_CB
+static const struct openssl_ticket_key *
+ssl_ticket_key_find(struct ssl_iostream_context *ctx,
+		    const unsigned char *name, bool *renew_r)
+{
+	const struct openssl_ticket_key *key;
+	unsigned int idx;
+
+	array_foreach(&ctx->ticket_keys, key) {
+		idx = array_foreach_idx(&ctx->ticket_keys, key);
+		if (memcmp(key->name, name, sizeof(key->name)) == 0) {
+			/* re-issue tickets encrypted with older keys */
+			*renew_r = idx > 0;
+			return key;
+		}
+	}
+	return NULL;
+}
+
+static const struct openssl_ticket_key *
+ssl_ticket_key_callback_init(SSL *ssl, unsigned char *key_name,
+			     unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+			     int enc, int *ret_r)
+{
+	struct ssl_iostream *ssl_io;
+	const struct openssl_ticket_key *key;
+	const EVP_CIPHER *cipher;
+	bool renew = FALSE;
+
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if (enc == 1) {
+		/* new ticket */
+		key = array_front(&ssl_io->ctx->ticket_keys);
+		cipher = key->key_len == 16 ? EVP_aes_128_cbc() :
+			EVP_aes_256_cbc();
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) <= 0 ||
+		    EVP_EncryptInit_ex(cipher_ctx, cipher, NULL,
+				       key->aes_key, iv) != 1) {
+			*ret_r = -1;
+			return NULL;
+		}
+		memcpy(key_name, key->name, sizeof(key->name));
+	} else {
+		key = ssl_ticket_key_find(ssl_io->ctx, key_name, &renew);
+		if (key == NULL) {
+			/* unknown key, do a full handshake */
+			*ret_r = 0;
+			return NULL;
+		}
+		cipher = key->key_len == 16 ? EVP_aes_128_cbc() :
+			EVP_aes_256_cbc();
+		if (EVP_DecryptInit_ex(cipher_ctx, cipher, NULL,
+				       key->aes_key, iv) != 1) {
+			*ret_r = -1;
+			return NULL;
+		}
+	}
+	*ret_r = renew ? 2 : 1;
+	return key;
+}
+
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+static int
+ssl_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+			EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *hmac_ctx,
+			int enc)
+{
+	const struct openssl_ticket_key *key;
+	OSSL_PARAM params[2];
+	int ret;
+
+	key = ssl_ticket_key_callback_init(ssl, key_name, iv, cipher_ctx,
+					   enc, &ret);
+	if (key == NULL)
+		return ret;
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     "SHA256", 0);
+	params[1] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_init(hmac_ctx, key->hmac_key, key->key_len, params) != 1)
+		return -1;
+	return ret;
+}
+#else
+static int
+ssl_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+			EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx,
+			int enc)
+{
+	const struct openssl_ticket_key *key;
+	int ret;
+
+	key = ssl_ticket_key_callback_init(ssl, key_name, iv, cipher_ctx,
+					   enc, &ret);
+	if (key == NULL)
+		return ret;
+
+	if (HMAC_Init_ex(hmac_ctx, key->hmac_key, key->key_len,
+			 EVP_sha256(), NULL) != 1)
+		return -1;
+	return ret;
+}
+#endif
+#endif
+
+#ifndef HAVE_TICKET_KEY_CB
+static int
+ssl_iostream_context_set_ticket_keys(struct ssl_iostream_context *ctx ATTR_UNUSED,
+				     const char *keys_str ATTR_UNUSED,
+				     const char **error_r)
+{
+	*error_r = "ssl_session_ticket_key isn't supported by the OpenSSL library";
+	return -1;
+}
+#else
+static int
+ssl_iostream_context_set_ticket_keys(struct ssl_iostream_context *ctx,
+				     const char *keys_str,
+				     const char **error_r)
+{
+	const char *const *lines;
+	struct openssl_ticket_key *key;
+	buffer_t *buf;
+	unsigned int len;
+	int ret;
+
+	/* one hex-encoded key per line: 16 bytes name, HMAC key and AES key */
+	p_array_init(&ctx->ticket_keys, ctx->pool, 4);
+	buf = t_buffer_create(OPENSSL_TICKET_KEY_NAME_LEN +
+			      OPENSSL_TICKET_KEY_MAX_LEN*2);
+	lines = t_strsplit_spaces(keys_str, "\r\n");
+	for (; *lines != NULL; lines++) {
+		if (**lines == '#')
+			continue;
+		buffer_set_used_size(buf, 0);
+		if (hex_to_binary(*lines, buf) < 0 ||
+		    (buf->used != OPENSSL_TICKET_KEY_NAME_LEN + 16*2 &&
+		     buf->used != OPENSSL_TICKET_KEY_NAME_LEN + 32*2)) {
+			*error_r = "Invalid ssl_session_ticket_key: "
+				"Expected 48 or 80 bytes of hex per line";
+			safe_memset(buffer_get_modifiable_data(buf, NULL), 0,
+				    buf->used);
+			return -1;
+		}
+		len = (buf->used - OPENSSL_TICKET_KEY_NAME_LEN) / 2;
+		key = array_append_space(&ctx->ticket_keys);
+		key->key_len = len;
+		memcpy(key->name, buf->data, OPENSSL_TICKET_KEY_NAME_LEN);
+		memcpy(key->hmac_key,
+		       CONST_PTR_OFFSET(buf->data, OPENSSL_TICKET_KEY_NAME_LEN),
+		       len);
+		memcpy(key->aes_key,
+		       CONST_PTR_OFFSET(buf->data,
+					OPENSSL_TICKET_KEY_NAME_LEN + len),
+		       len);
+		safe_memset(buffer_get_modifiable_data(buf, NULL), 0,
+			    buf->used);
+	}
+	if (array_count(&ctx->ticket_keys) == 0) {
+		*error_r = "Invalid ssl_session_ticket_key: No keys";
+		return -1;
+	}
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+	ret = SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx->ssl_ctx,
+						   ssl_ticket_key_callback);
+#else
+	ret = SSL_CTX_set_tlsext_ticket_key_cb(ctx->ssl_ctx,
+					       ssl_ticket_key_callback);
+#endif
+	if (ret != 1) {
+		*error_r = t_strdup_printf(
+			"Can't set TLS session ticket key callback: %s",
+			openssl_iostream_error());
+		return -1;
+	}
+	return 0;
+}
+#endif
+
 static int
 ssl_iostream_context_load_ca(struct ssl_iostream_context *ctx,
 			     const struct ssl_iostream_settings *set,
@@ -494,6 +683,12 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 			return -1;
 		}
 	}
+	if (!ctx->client_ctx && set->tickets &&
+	    set->session_ticket_key != NULL) {
+		if (ssl_iostream_context_set_ticket_keys(ctx,
+				set->session_ticket_key, error_r) < 0)
+			return -1;
+	}
 #ifdef HAVE_SSL_GET_SERVERNAME
 	if (!ctx->client_ctx) {
 		if (SSL_CTX_set_tlsext_servername_callback(ctx->ssl_ctx,
@@ -712,6 +907,12 @@ void openssl_iostream_context_unref(struct ssl_iostream_context *ctx)
 		return;
 
 	SSL_CTX_free(ctx->ssl_ctx);
+	if (array_is_created(&ctx->ticket_keys)) {
+		struct openssl_ticket_key *key;
+
+		array_foreach_modifiable(&ctx->ticket_keys, key)
+			safe_memset(key, 0, sizeof(*key));
+	}
 	pool_unref(&ctx->pool);
 	i_free(ctx);
 }
@@ -393,7 +393,7 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 {
 	size_t bytes, max_bytes = 0;
 	ssize_t sent;
-	unsigned char buffer[IO_BLOCK_SIZE];
+	char *data;
 	int result = 0;
 	int ret;
 
@@ -409,18 +409,21 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 			}
 			bytes = max_bytes;
 		}
-		if (bytes > sizeof(buffer))
-			bytes = sizeof(buffer);
+		if (bytes > INT_MAX)
+			bytes = INT_MAX;
 
-		/* BIO_read() is guaranteed to return all the bytes that
-		   BIO_ctrl_pending() returned */
-		ret = BIO_read(ssl_io->bio_ext, buffer, bytes);
-		i_assert(ret == (int)bytes);
+		/* Access the encrypted data directly in the BIO pair's
+		   buffer instead of copying it out with BIO_read() first.
+		   The buffer is a ring, so this may return less than the
+		   pending bytes. The rest is handled on the next loop. */
+		ret = BIO_nread(ssl_io->bio_ext, &data, (int)bytes);
+		i_assert(ret > 0 && (size_t)ret <= bytes);
+		bytes = ret;
 
 		/* we limited number of read bytes to plain_output's
 		   available size. this send() is guaranteed to either
 		   fully succeed or completely fail due to some error. */
-		sent = o_stream_send(ssl_io->plain_output, buffer, bytes);
+		sent = o_stream_send(ssl_io->plain_output, data, bytes);
 		if (sent < 0) {
 			o_stream_uncork(ssl_io->plain_output);
 			return -1;
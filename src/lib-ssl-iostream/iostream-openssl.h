@@ -1,6 +1,7 @@
 #ifndef IOSTREAM_OPENSSL_H
 #define IOSTREAM_OPENSSL_H
 
+#include "array.h"
 #include "iostream-ssl-private.h"
 
 #include <openssl/ssl.h>
@@ -16,6 +17,17 @@ enum openssl_iostream_sync_type {
 	OPENSSL_IOSTREAM_SYNC_TYPE_HANDSHAKE
 };
 
+#define OPENSSL_TICKET_KEY_NAME_LEN 16
+#define OPENSSL_TICKET_KEY_MAX_LEN 32
+
+struct openssl_ticket_key {
+	unsigned char name[OPENSSL_TICKET_KEY_NAME_LEN];
+	unsigned char hmac_key[OPENSSL_TICKET_KEY_MAX_LEN];
+	unsigned char aes_key[OPENSSL_TICKET_KEY_MAX_LEN];
+	/* 16 for AES-128-CBC or 32 for AES-256-CBC */
+	unsigned int key_len;
+};
+
 struct ssl_iostream_context {
 	int refcount;
 	SSL_CTX *ssl_ctx;
@@ -24,6 +36,8 @@ struct ssl_iostream_context {
 	struct ssl_iostream_settings set;
 
 	int username_nid;
+	/* TLS session ticket keys. The first one is used for new tickets. */
+	ARRAY(struct openssl_ticket_key) ticket_keys;
 
 	bool client_ctx:1;
 };
@@ -24,6 +24,9 @@ struct ssl_iostream_settings {
 	struct ssl_iostream_cert cert; /* both */
 	struct ssl_iostream_cert alt_cert; /* both */
 	const char *dh; /* context-only */
+	/* TLS session ticket keys, one hex-encoded key per line. The first
+	   key is used for new tickets. */
+	const char *session_ticket_key; /* context-only */
 	const char *cert_username_field; /* both */
 	const char *crypto_device; /* context-only */
 
@@ -374,6 +374,37 @@ static void test_iostream_ssl_handshake(void)
 							 "127.0.0.1") != 0, idx);
 	idx++;
 
+	/* session ticket keys */
+	ssl_iostream_test_settings_server(&server_set);
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	server_set.tickets = TRUE;
+	server_set.session_ticket_key =
+		"# current key\n"
+		"000102030405060708090a0b0c0d0e0f"
+		"101112131415161718191a1b1c1d1e1f"
+		"202122232425262728292a2b2c2d2e2f"
+		"303132333435363738393a3b3c3d3e3f"
+		"404142434445464748494a4b4c4d4e4f\n"
+		"# previous key\n"
+		"505152535455565758595a5b5c5d5e5f"
+		"606162636465666768696a6b6c6d6e6f"
+		"707172737475767778797a7b7c7d7e7f\n";
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "localhost") == 0, idx);
+	idx++;
+
+	/* invalid session ticket key */
+	ssl_iostream_test_settings_server(&server_set);
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	server_set.tickets = TRUE;
+	server_set.session_ticket_key = "000102030405060708090a0b0c0d0e0f";
+	test_expect_error_string("server: Invalid ssl_session_ticket_key");
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "localhost") != 0, idx);
+	idx++;
+
 	io_loop_destroy(&ioloop);
 
 	test_end();
@@ -569,7 +569,8 @@ int dbox_file_append_flush(struct dbox_file_append_context *ctx)
 		}
 	}
 
-	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER) {
+	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
+	    !ctx->delay_fsync) {
 		if (fdatasync(ctx->file->fd) < 0) {
 			dbox_file_set_syscall_error(ctx->file, "fdatasync()");
 			return -1;
@@ -18,6 +18,8 @@ struct mdbox_map {
 	struct mail_index_view *view;
 
 	uint32_t map_ext_id, ref_ext_id;
+	/* sequence of the previous successful map_uid lookup in view */
+	uint32_t lookup_seq_hint;
 
 	struct mailbox_list *root_list;
 
@@ -55,6 +57,10 @@ struct mdbox_map_atomic_context {
 	bool locked:1;
 	bool success:1;
 	bool failed:1;
+	/* new m.* files were created, fsync their directory after the map
+	   is unlocked */
+	bool fsync_storage_dir:1;
+	bool fsync_alt_storage_dir:1;
 };
 
 int mdbox_map_view_lookup_rec(struct mdbox_map *map,
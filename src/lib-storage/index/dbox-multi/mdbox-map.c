@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "ostream.h"
 #include "mkdir-parents.h"
+#include "fdatasync-path.h"
 #include "unlink-old-files.h"
 #include "mailbox-list-private.h"
 #include "mdbox-storage.h"
@@ -291,14 +292,43 @@ mdbox_map_lookup_seq(struct mdbox_map *map, uint32_t seq,
 	return 0;
 }
 
+static bool
+mdbox_map_lookup_seq_hint(struct mdbox_map *map, uint32_t map_uid,
+			  uint32_t *seq_r)
+{
+	uint32_t seq, uid, messages_count;
+
+	/* Mails are usually read in ascending map_uid order, and map_uids of
+	   mails in the same mailbox are often consecutive. So check the
+	   previously looked up sequence and the one after it before doing a
+	   binary search on the whole map. The hint is verified against the
+	   current view, so it doesn't matter if the view was synced since. */
+	messages_count = mail_index_view_get_messages_count(map->view);
+	for (seq = map->lookup_seq_hint; seq <= map->lookup_seq_hint + 1;
+	     seq++) {
+		if (seq == 0 || seq > messages_count)
+			continue;
+		mail_index_lookup_uid(map->view, seq, &uid);
+		if (uid == map_uid)
+			break;
+	}
+	if (seq > map->lookup_seq_hint + 1) {
+		if (!mail_index_lookup_seq(map->view, map_uid, &seq))
+			return FALSE;
+	}
+	map->lookup_seq_hint = seq;
+	*seq_r = seq;
+	return TRUE;
+}
+
 static int
 mdbox_map_get_seq(struct mdbox_map *map, uint32_t map_uid, uint32_t *seq_r)
 {
-	if (!mail_index_lookup_seq(map->view, map_uid, seq_r)) {
+	if (!mdbox_map_lookup_seq_hint(map, map_uid, seq_r)) {
 		/* not found - try again after a refresh */
 		if (mdbox_map_refresh(map) < 0)
 			return -1;
-		if (!mail_index_lookup_seq(map->view, map_uid, seq_r))
+		if (!mdbox_map_lookup_seq_hint(map, map_uid, seq_r))
 			return 0;
 	}
 	return 1;
@@ -550,6 +580,18 @@ void mdbox_map_atomic_unset_fscked(struct mdbox_map_atomic_context *atomic)
 	mail_index_unset_fscked(atomic->sync_trans);
 }
 
+static int mdbox_map_fsync_dir(struct mdbox_map *map, const char *dir)
+{
+	if (MAP_STORAGE(map)->set->parsed_fsync_mode == FSYNC_MODE_NEVER)
+		return 0;
+	if (fdatasync_path(dir) < 0) {
+		mail_storage_set_critical(MAP_STORAGE(map),
+			"fdatasync_path(%s) failed: %m", dir);
+		return -1;
+	}
+	return 0;
+}
+
 int mdbox_map_atomic_finish(struct mdbox_map_atomic_context **_atomic)
 {
 	struct mdbox_map_atomic_context *atomic = *_atomic;
@@ -569,6 +611,19 @@ int mdbox_map_atomic_finish(struct mdbox_map_atomic_context **_atomic)
 	} else {
 		mail_index_sync_rollback(&atomic->sync_ctx);
 	}
+	/* make sure the new m.* files are permanently visible. this is done
+	   only after the map lock is released to avoid serializing all the
+	   other sessions' map updates behind the fsync. */
+	if (ret == 0 && atomic->success) {
+		struct mdbox_storage *storage = atomic->map->storage;
+
+		if (atomic->fsync_storage_dir &&
+		    mdbox_map_fsync_dir(atomic->map, storage->storage_dir) < 0)
+			ret = -1;
+		if (atomic->fsync_alt_storage_dir &&
+		    mdbox_map_fsync_dir(atomic->map, storage->alt_storage_dir) < 0)
+			ret = -1;
+	}
 	i_free(atomic);
 	return ret;
 }
@@ -1254,6 +1309,10 @@ mdbox_map_assign_file_ids(struct mdbox_map_append_context *ctx,
 		if (mfile->file_id == 0) {
 			if (mdbox_file_assign_file_id(mfile, file_id++) < 0)
 				return -1;
+			if (dbox_file_is_in_alt(&mfile->file))
+				ctx->atomic->fsync_alt_storage_dir = TRUE;
+			else
+				ctx->atomic->fsync_storage_dir = TRUE;
 		}
 	}
 
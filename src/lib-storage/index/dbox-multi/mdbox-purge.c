@@ -6,6 +6,8 @@
 #include "ostream.h"
 #include "str.h"
 #include "hash.h"
+#include "sleep.h"
+#include "time-util.h"
 #include "dbox-attachment.h"
 #include "mdbox-storage.h"
 #include "mdbox-storage-rebuild.h"
@@ -48,6 +50,11 @@ struct mdbox_purge_context {
 
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_append_context *append_ctx;
+
+	/* for mdbox_purge_rate: when purging started and how many bytes
+	   have been read from the purged files since then */
+	struct timeval start_time;
+	uoff_t read_bytes;
 };
 
 static int mdbox_map_file_msg_offset_cmp(const struct mdbox_map_file_msg *m1,
@@ -275,14 +282,18 @@ mdbox_purge_attachments(struct mdbox_purge_context *ctx,
 {
 	struct dbox_storage *storage = &ctx->storage->storage;
 	const struct mail_attachment_extref *extref;
-	int ret = 0;
+	ARRAY_TYPE(const_string) paths;
+	int ret;
 
-	array_foreach(extrefs_arr, extref) {
-		if (index_attachment_delete(&storage->storage,
-					    storage->attachment_fs,
-					    extref->path) < 0)
-			ret = -1;
-	}
+	T_BEGIN {
+		t_array_init(&paths, array_count(extrefs_arr) + 1);
+		array_foreach(extrefs_arr, extref)
+			array_push_back(&paths, &extref->path);
+		array_append_zero(&paths);
+		ret = index_attachment_delete_multi(&storage->storage,
+						    storage->attachment_fs,
+						    array_front(&paths));
+	} T_END;
 	return ret;
 }
 
@@ -375,6 +386,7 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 		}
 		offset = file->input->v_offset;
 	}
+	ctx->read_bytes += offset;
 	if (offset != (uoff_t)st.st_size && ret > 0) {
 		/* file has more messages than what map tells us */
 		dbox_file_set_corrupted(file,
@@ -476,9 +488,27 @@ mdbox_purge_alloc(struct mdbox_storage *storage)
 	i_array_init(&ctx->primary_file_ids, 64);
 	i_array_init(&ctx->purge_file_ids, 64);
 	hash_table_create_direct(&ctx->altmoves, pool, 0);
+	i_gettimeofday(&ctx->start_time);
 	return ctx;
 }
 
+static void mdbox_purge_throttle(struct mdbox_purge_context *ctx)
+{
+	uoff_t rate = ctx->storage->set->mdbox_purge_rate;
+	struct timeval now;
+	long long elapsed_usecs, wanted_usecs;
+
+	if (rate == 0)
+		return;
+
+	/* sleep until the average read rate drops to mdbox_purge_rate */
+	i_gettimeofday(&now);
+	elapsed_usecs = timeval_diff_usecs(&now, &ctx->start_time);
+	wanted_usecs = (long long)(ctx->read_bytes * 1000000 / rate);
+	if (wanted_usecs > elapsed_usecs)
+		i_sleep_usecs(wanted_usecs - elapsed_usecs);
+}
+
 static void mdbox_purge_free(struct mdbox_purge_context **_ctx)
 {
 	struct mdbox_purge_context *ctx = *_ctx;
@@ -669,6 +699,7 @@ int mdbox_purge(struct mail_storage *_storage)
 	seq_range_array_iter_init(&iter, &ctx->purge_file_ids); i = 0;
 	while (ret == 0 &&
 	       seq_range_array_iter_nth(&iter, i++, &file_id)) T_BEGIN {
+		mdbox_purge_throttle(ctx);
 		file = mdbox_file_init(storage, file_id);
 		if (dbox_file_open(file, &deleted) > 0 && !deleted) {
 			if (mdbox_file_purge(ctx, file, file_id) < 0)
@@ -15,6 +15,7 @@ static const struct setting_define mdbox_setting_defines[] = {
 	DEF(BOOL, mdbox_preallocate_space),
 	DEF(SIZE, mdbox_rotate_size),
 	DEF(TIME, mdbox_rotate_interval),
+	DEF(SIZE, mdbox_purge_rate),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -22,7 +23,8 @@ static const struct setting_define mdbox_setting_defines[] = {
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 10*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_purge_rate = 0
 };
 
 static const struct setting_parser_info mdbox_setting_parser_info = {
@@ -5,6 +5,7 @@ struct mdbox_settings {
 	bool mdbox_preallocate_space;
 	uoff_t mdbox_rotate_size;
 	unsigned int mdbox_rotate_interval;
+	uoff_t mdbox_purge_rate;
 };
 
 const struct setting_parser_info *mdbox_get_setting_parser_info(void);
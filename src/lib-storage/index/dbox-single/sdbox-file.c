@@ -403,14 +403,21 @@ sdbox_unlink_attachments(struct sdbox_file *sfile,
 {
 	struct dbox_storage *storage = sfile->file.storage;
 	const struct mail_attachment_extref *extref;
+	ARRAY_TYPE(const_string) paths;
 	const char *path;
-	int ret = 0;
+	int ret;
 
-	array_foreach(extrefs, extref) T_BEGIN {
-		path = sdbox_file_attachment_relpath(sfile, extref->path);
-		if (index_attachment_delete(&storage->storage,
-					    storage->attachment_fs, path) < 0)
-			ret = -1;
+	T_BEGIN {
+		t_array_init(&paths, array_count(extrefs) + 1);
+		array_foreach(extrefs, extref) {
+			path = sdbox_file_attachment_relpath(sfile,
+							     extref->path);
+			array_push_back(&paths, &path);
+		}
+		array_append_zero(&paths);
+		ret = index_attachment_delete_multi(&storage->storage,
+						    storage->attachment_fs,
+						    array_front(&paths));
 	} T_END;
 	return ret;
 }
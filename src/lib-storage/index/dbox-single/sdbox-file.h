@@ -14,6 +14,8 @@ struct sdbox_file {
 	pool_t attachment_pool;
 	ARRAY_TYPE(const_string) attachment_paths;
 	bool written_to_disk;
+	/* saved file hasn't been fdatasync()ed yet */
+	bool fsync_pending;
 };
 
 struct dbox_file *sdbox_file_init(struct sdbox_mailbox *mbox, uint32_t uid);
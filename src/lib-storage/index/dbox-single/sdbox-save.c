@@ -1,5 +1,6 @@
 /* Copyright (c) 2007-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* sync_file_range() */
 #include "lib.h"
 #include "array.h"
 #include "fdatasync-path.h"
@@ -19,6 +20,8 @@
 #include "sdbox-file.h"
 #include "sdbox-sync.h"
 
+#include <fcntl.h>
+
 
 struct sdbox_save_context {
 	struct dbox_save_context ctx;
@@ -106,6 +109,8 @@ int sdbox_save_begin(struct mail_save_context *_ctx, struct istream *input)
 
 	file = sdbox_file_create(ctx->mbox);
 	ctx->append_ctx = dbox_file_append_init(file);
+	/* the files are fdatasync()ed all at once when committing */
+	ctx->append_ctx->delay_fsync = TRUE;
 	ret = dbox_file_get_append_stream(ctx->append_ctx,
 					  &ctx->ctx.dbox_output);
 	if (ret <= 0) {
@@ -171,6 +176,21 @@ static int dbox_save_mail_write_metadata(struct dbox_save_context *ctx,
 	return 0;
 }
 
+static void dbox_save_start_writeback(struct dbox_file *file)
+{
+	struct sdbox_file *sfile = (struct sdbox_file *)file;
+
+	sfile->fsync_pending = TRUE;
+#ifdef SYNC_FILE_RANGE_WRITE
+	/* Start writing the file to disk already. This way the writes of
+	   all the saved files overlap and the fdatasync()s at commit mostly
+	   just wait for them to finish. */
+	if (sync_file_range(file->fd, 0, 0, SYNC_FILE_RANGE_WRITE) < 0 &&
+	    errno != ENOSYS && errno != EINVAL)
+		dbox_file_set_syscall_error(file, "sync_file_range()");
+#endif
+}
+
 static int dbox_save_finish_write(struct mail_save_context *_ctx)
 {
 	struct sdbox_save_context *ctx = (struct sdbox_save_context *)_ctx;
@@ -205,7 +225,12 @@ static int dbox_save_finish_write(struct mail_save_context *_ctx)
 		dbox_file_append_checkpoint(ctx->append_ctx);
 		if (dbox_file_append_commit(&ctx->append_ctx) < 0)
 			ctx->ctx.failed = TRUE;
-		dbox_file_close(*files);
+		else if (_ctx->transaction->box->storage->set->parsed_fsync_mode !=
+			 FSYNC_MODE_NEVER)
+			dbox_save_start_writeback(*files);
+		/* The file is left open for the commit's fdatasync().
+		   sdbox_save_add_file() closes it when the next mail is
+		   saved. */
 	}
 
 	i_stream_unref(&ctx->ctx.input);
@@ -231,6 +256,36 @@ void sdbox_save_cancel(struct mail_save_context *_ctx)
 	(void)sdbox_save_finish(_ctx);
 }
 
+static int dbox_save_fsync_files(struct sdbox_save_context *ctx)
+{
+	struct dbox_file *file;
+	struct sdbox_file *sfile;
+	int fd, ret = 0;
+
+	array_foreach_elem(&ctx->files, file) {
+		sfile = (struct sdbox_file *)file;
+		if (!sfile->fsync_pending)
+			continue;
+
+		if (dbox_file_is_open(file))
+			fd = file->fd;
+		else if ((fd = open(file->cur_path, O_RDONLY)) == -1) {
+			dbox_file_set_syscall_error(file, "open()");
+			return -1;
+		}
+		if (fdatasync(fd) < 0) {
+			dbox_file_set_syscall_error(file, "fdatasync()");
+			ret = -1;
+		}
+		if (fd != file->fd)
+			i_close_fd_path(&fd, file->cur_path);
+		if (ret < 0)
+			break;
+		sfile->fsync_pending = FALSE;
+	}
+	return ret;
+}
+
 static int dbox_save_assign_uids(struct sdbox_save_context *ctx,
 				 const ARRAY_TYPE(seq_range) *uids)
 {
@@ -289,6 +344,12 @@ int sdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 		return 0;
 	}
 
+	/* the mails must be on disk before they become visible */
+	if (dbox_save_fsync_files(ctx) < 0) {
+		sdbox_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	if (sdbox_sync_begin(ctx->mbox, SDBOX_SYNC_FLAG_FORCE |
 			     SDBOX_SYNC_FLAG_FSYNC, &ctx->sync_ctx) < 0) {
 		sdbox_transaction_save_rollback(_ctx);
@@ -139,12 +139,45 @@ headers_merge(pool_t pool, const char *const *h1, const char *const *h2)
 	return array_front(&headers);
 }
 
+static bool
+imapc_mail_try_extend_uidset(string_t *cmd, size_t set_end, uint32_t uid)
+{
+	const char *set = str_c(cmd) + 10, *p, *last;
+	size_t set_len = set_end - 10;
+	uint32_t last_uid;
+
+	/* prefetched mails are usually accessed in ascending UID order.
+	   grow the last range instead of appending a new UID, so the
+	   command stays short even with a large prefetch window. */
+	last = set;
+	for (p = set; p < set + set_len; p++) {
+		if (*p == ',')
+			last = p + 1;
+	}
+	p = memchr(last, ':', set + set_len - last);
+	if (str_to_uint32(t_strdup_until(p == NULL ? last : p + 1,
+					 set + set_len), &last_uid) < 0 ||
+	    last_uid == (uint32_t)-1 || last_uid + 1 != uid)
+		return FALSE;
+
+	if (p == NULL)
+		str_insert(cmd, set_end, t_strdup_printf(":%u", uid));
+	else {
+		size_t pos = p + 1 - str_c(cmd);
+
+		str_delete(cmd, pos, set_end - pos);
+		str_insert(cmd, pos, dec2str(uid));
+	}
+	return TRUE;
+}
+
 static bool
 imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
 {
 	const char *s1 = str_c(str);
 	const char *s2 = str_c(mbox->pending_fetch_cmd);
 	const char *p1, *p2;
+	uint32_t uid;
 
 	i_assert(str_begins(s1, "UID FETCH "));
 	i_assert(str_begins(s2, "UID FETCH "));
@@ -157,6 +190,9 @@ imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
 		return FALSE;
 	/* append the new UID to the pending FETCH UID range */
 	str_truncate(str, p1-s1);
+	if (str_to_uint32(str_c(str) + 10, &uid) == 0 &&
+	    imapc_mail_try_extend_uidset(mbox->pending_fetch_cmd, p2-s2, uid))
+		return TRUE;
 	str_insert(mbox->pending_fetch_cmd, p2-s2, ",");
 	str_insert(mbox->pending_fetch_cmd, p2-s2+1, str_c(str) + 10);
 	return TRUE;
@@ -183,7 +219,7 @@ imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
 
 	if (mbox->to_pending_fetch_send == NULL &&
 	    array_count(&mbox->pending_fetch_request->mails) >
-	    			mbox->box.storage->set->mail_prefetch_count) {
+	    			imapc_mailbox_get_prefetch_count(mbox)) {
 		/* we're now prefetching the maximum number of mails. this
 		   most likely means that we need to flush out the command now
 		   before sending anything else. delay it a little bit though
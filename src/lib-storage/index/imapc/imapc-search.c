@@ -226,6 +226,10 @@ imapc_search_init(struct mailbox_transaction_context *t,
 
 	ctx = index_storage_search_init(t, args, sort_program,
 					wanted_fields, wanted_headers);
+	if (mbox->storage->set->imapc_prefetch_count != 0) {
+		/* pipeline FETCHes for this many of the following mails */
+		ctx->max_mails = mbox->storage->set->imapc_prefetch_count + 1;
+	}
 
 	if (!imapc_build_search_query(mbox, args, &search_query)) {
 		/* can't optimize this with SEARCH */
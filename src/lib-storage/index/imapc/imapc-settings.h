@@ -49,6 +49,7 @@ struct imapc_settings {
 	unsigned int imapc_connection_retry_count;
 	unsigned int imapc_connection_retry_interval;
 	uoff_t imapc_max_line_length;
+	unsigned int imapc_prefetch_count;
 
 	const char *pop3_deleted_flag;
 
@@ -420,7 +420,7 @@ imapc_storage_create(struct mail_storage *_storage,
 	_storage->unique_root_dir = p_strdup_printf(_storage->pool,
 						    "%s%s://(%s|%s):%s@%s:%u/%s mechs:%s features:%s "
 						    "rawlog:%s cmd_timeout:%u maxidle:%u maxline:%zuu "
-						    "pop3delflg:%s root_dir:%s",
+						    "prefetch:%u pop3delflg:%s root_dir:%s",
 						    storage->set->imapc_ssl,
 						    storage->set->imapc_ssl_verify ? "(verify)" : "",
 						    storage->set->imapc_user,
@@ -435,6 +435,7 @@ imapc_storage_create(struct mail_storage *_storage,
 						    storage->set->imapc_cmd_timeout,
 						    storage->set->imapc_max_idle_time,
 						    (size_t) storage->set->imapc_max_line_length,
+						    storage->set->imapc_prefetch_count,
 						    storage->set->pop3_deleted_flag,
 						    ns->list->set.root_dir);
 
@@ -806,6 +807,13 @@ int imapc_mailbox_select(struct imapc_mailbox *mbox)
 	return ctx.ret;
 }
 
+unsigned int imapc_mailbox_get_prefetch_count(struct imapc_mailbox *mbox)
+{
+	if (mbox->storage->set->imapc_prefetch_count != 0)
+		return mbox->storage->set->imapc_prefetch_count;
+	return mbox->box.storage->set->mail_prefetch_count;
+}
+
 static int imapc_mailbox_open(struct mailbox *box)
 {
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(box);
@@ -184,6 +184,8 @@ void imapc_mailbox_run(struct imapc_mailbox *mbox);
 void imapc_mailbox_run_nofetch(struct imapc_mailbox *mbox);
 void imapc_mail_cache_free(struct imapc_mail_cache *cache);
 int imapc_mailbox_select(struct imapc_mailbox *mbox);
+/* Returns the number of mails whose FETCHes can be pipelined. */
+unsigned int imapc_mailbox_get_prefetch_count(struct imapc_mailbox *mbox);
 void imap_mailbox_select_finish(struct imapc_mailbox *mbox);
 
 bool imapc_mailbox_has_modseqs(struct imapc_mailbox *mbox);
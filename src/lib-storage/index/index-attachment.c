@@ -10,11 +10,11 @@
 #include "str.h"
 #include "message-parser.h"
 #include "rfc822-parser.h"
-#include "fs-api.h"
 #include "istream-fs-file.h"
 #include "istream-attachment-connector.h"
 #include "istream-attachment-extractor.h"
 #include "mail-user.h"
+#include "mail-attachment-cache.h"
 #include "index-mail.h"
 #include "index-attachment.h"
 
@@ -31,6 +31,11 @@ struct mail_save_attachment {
 
 	struct fs_file *cur_file;
 	ARRAY_TYPE(mail_attachment_extref) extrefs;
+
+	/* Attachments extracted by earlier saves of the same mail */
+	struct mail_attachment_cache *cache;
+	const char *cache_set_key;
+	struct mail_attachment_cache_entry cur_cache_entry;
 };
 
 static const char *index_attachment_dir_get(struct mail_storage *storage)
@@ -82,6 +87,24 @@ static int index_attachment_open_temp_fd(void *context)
 	return fd;
 }
 
+static const char *
+index_attachment_get_new_path(const char *attachment_dir, const char *digest)
+{
+	guid_128_t guid_128;
+
+	if (strlen(digest) < 4) {
+		/* make sure we can access first 4 bytes without accessing
+		   out of bounds memory */
+		digest = t_strconcat(digest, "\0\0\0\0", NULL);
+	}
+
+	guid_128_generate(guid_128);
+	return t_strdup_printf("%s/%c%c/%c%c/%s-%s", attachment_dir,
+			       digest[0], digest[1],
+			       digest[2], digest[3], digest,
+			       guid_128_to_string(guid_128));
+}
+
 static int
 index_attachment_open_ostream(struct istream_attachment_info *info,
 			      struct ostream **output_r,
@@ -91,27 +114,17 @@ index_attachment_open_ostream(struct istream_attachment_info *info,
 	struct mail_save_attachment *attach = ctx->data.attach;
 	struct mail_storage *storage = ctx->transaction->box->storage;
 	struct mail_attachment_extref *extref;
+	struct mail_attachment_cache_entry *entry;
 	enum fs_open_flags flags = 0;
-	const char *attachment_dir, *path, *digest = info->hash;
-	guid_128_t guid_128;
+	const char *attachment_dir, *path;
 
 	i_assert(attach->cur_file == NULL);
 
 	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER)
 		flags |= FS_OPEN_FLAG_FSYNC;
 
-	if (strlen(digest) < 4) {
-		/* make sure we can access first 4 bytes without accessing
-		   out of bounds memory */
-		digest = t_strconcat(digest, "\0\0\0\0", NULL);
-	}
-
-	guid_128_generate(guid_128);
 	attachment_dir = index_attachment_dir_get(storage);
-	path = t_strdup_printf("%s/%c%c/%c%c/%s-%s", attachment_dir,
-			       digest[0], digest[1],
-			       digest[2], digest[3], digest,
-			       guid_128_to_string(guid_128));
+	path = index_attachment_get_new_path(attachment_dir, info->hash);
 	attach->cur_file = fs_file_init(attach->fs, path,
 					FS_OPEN_MODE_REPLACE | flags);
 
@@ -123,6 +136,20 @@ index_attachment_open_ostream(struct istream_attachment_info *info,
 	extref->base64_blocks_per_line = info->base64_blocks_per_line;
 	extref->base64_have_crlf = info->base64_have_crlf;
 
+	if (attach->cache != NULL) {
+		entry = &attach->cur_cache_entry;
+		i_zero(entry);
+		entry->set_key = attach->cache_set_key;
+		entry->start_offset = info->start_offset;
+		entry->part_size = info->part_size;
+		entry->part_crc32 = info->part_crc32;
+		entry->hash = p_strdup(attach->pool, info->hash);
+		entry->path = extref->path;
+		entry->encoded_size = info->encoded_size;
+		entry->base64_blocks_per_line = info->base64_blocks_per_line;
+		entry->base64_have_crlf = info->base64_have_crlf;
+	}
+
 	*output_r = fs_write_stream(attach->cur_file);
 	return 0;
 }
@@ -149,7 +176,69 @@ index_attachment_close_ostream(struct ostream *output, bool success,
 
 	if (ret < 0) {
 		array_pop_back(&attach->extrefs);
+	} else if (attach->cache != NULL) {
+		mail_attachment_cache_add(attach->cache,
+					  &attach->cur_cache_entry);
+	}
+	return ret;
+}
+
+static bool index_attachment_want_reuse(uoff_t start_offset, void *context)
+{
+	struct mail_save_context *ctx = context;
+	struct mail_save_attachment *attach = ctx->data.attach;
+
+	return mail_attachment_cache_have(attach->cache, attach->cache_set_key,
+					  start_offset);
+}
+
+static int
+index_attachment_reuse(struct istream_attachment_info *info,
+		       const char **error_r ATTR_UNUSED, void *context)
+{
+	struct mail_save_context *ctx = context;
+	struct mail_save_attachment *attach = ctx->data.attach;
+	struct mail_storage *storage = ctx->transaction->box->storage;
+	const struct mail_attachment_cache_entry *entry;
+	struct mail_attachment_extref *extref;
+	struct fs_file *src_file, *dest_file;
+	const char *attachment_dir, *src_path, *dest_path;
+	int ret;
+
+	entry = mail_attachment_cache_lookup(attach->cache,
+					     attach->cache_set_key,
+					     info->start_offset,
+					     info->part_size,
+					     info->part_crc32);
+	if (entry == NULL)
+		return 0;
+
+	/* the same attachment was already written. copy it, which is
+	   usually just a hard link or a server-side copy. */
+	attachment_dir = index_attachment_dir_get(storage);
+	src_path = t_strdup_printf("%s/%s", attachment_dir, entry->path);
+	dest_path = index_attachment_get_new_path(attachment_dir, entry->hash);
+	src_file = fs_file_init(attach->fs, src_path, FS_OPEN_MODE_READONLY);
+	dest_file = fs_file_init(attach->fs, dest_path, FS_OPEN_MODE_READONLY);
+	if (fs_copy(src_file, dest_file) < 0) {
+		/* fallback to extracting it again */
+		e_warning(ctx->transaction->box->event,
+			  "Couldn't reuse attachment %s: %s", src_path,
+			  fs_file_last_error(dest_file));
+		ret = 0;
+	} else {
+		extref = array_append_space(&attach->extrefs);
+		extref->start_offset = info->start_offset;
+		extref->size = entry->encoded_size;
+		extref->path = p_strdup(attach->pool,
+					dest_path + strlen(attachment_dir) + 1);
+		extref->base64_blocks_per_line = entry->base64_blocks_per_line;
+		extref->base64_have_crlf = entry->base64_have_crlf;
+		info->encoded_size = entry->encoded_size;
+		ret = 1;
 	}
+	fs_file_deinit(&src_file);
+	fs_file_deinit(&dest_file);
 	return ret;
 }
 
@@ -184,6 +273,17 @@ void index_attachment_save_begin(struct mail_save_context *ctx,
 	attach = p_new(pool, struct mail_save_attachment, 1);
 	attach->pool = pool;
 	attach->fs = fs;
+	if (ctx->data.attachment_cache != NULL) {
+		set.want_reuse_attachment = index_attachment_want_reuse;
+		set.reuse_attachment = index_attachment_reuse;
+		attach->cache = ctx->data.attachment_cache;
+		attach->cache_set_key = p_strdup_printf(pool,
+			"%s\n%s\n%s\n%"PRIuUOFF_T,
+			index_attachment_dir_get(storage),
+			storage->set->mail_attachment_fs,
+			storage->set->mail_attachment_hash,
+			set.min_size);
+	}
 	attach->input = i_stream_create_attachment_extractor(input, &set, ctx);
 	p_array_init(&attach->extrefs, attach->pool, 8);
 	ctx->data.attach = attach;
@@ -295,6 +395,35 @@ int index_attachment_delete(struct mail_storage *storage,
 	return ret;
 }
 
+static void
+index_attachment_delete_callback(const struct fs_batch_result *result,
+				 struct mail_storage *storage)
+{
+	if (result->ret < 0)
+		mail_storage_set_critical(storage, "%s", result->error);
+}
+
+int index_attachment_delete_multi(struct mail_storage *storage,
+				  struct fs *fs, const char *const *names)
+{
+	struct fs_batch *batch;
+	const char *dir, *error;
+	int ret;
+
+	T_BEGIN {
+		dir = index_attachment_dir_get(storage);
+		batch = fs_batch_begin(fs, 0);
+		for (; *names != NULL; names++) {
+			fs_batch_delete(batch,
+					t_strdup_printf("%s/%s", dir, *names),
+					index_attachment_delete_callback,
+					storage);
+		}
+		ret = fs_batch_end(&batch, &error);
+	} T_END;
+	return ret;
+}
+
 void index_attachment_append_extrefs(string_t *str,
 	const ARRAY_TYPE(mail_attachment_extref) *extrefs)
 {
@@ -36,6 +36,10 @@ index_attachment_save_get_extrefs(struct mail_save_context *ctx);
    (name is same as mail_attachment_extref.name). */
 int index_attachment_delete(struct mail_storage *storage,
 			    struct fs *fs, const char *name);
+/* Delete multiple attachments. With remote filesystems the deletes are done
+   in parallel. Returns 0 if all were deleted, -1 if any failed. */
+int index_attachment_delete_multi(struct mail_storage *storage,
+				  struct fs *fs, const char *const *names);
 
 void index_attachment_append_extrefs(string_t *str,
 	const ARRAY_TYPE(mail_attachment_extref) *extrefs);
@@ -4,6 +4,7 @@
 #include "istream.h"
 #include "array.h"
 #include "buffer.h"
+#include "hash.h"
 #include "str.h"
 #include "message-date.h"
 #include "message-part-data.h"
@@ -140,6 +141,17 @@ static void index_mail_parse_header_finish(struct index_mail *mail)
 		}
 	}
 
+	if (mail->data.save_header_offsets) {
+		if (mail->data.header_offsets_complete) {
+			const struct index_mail_header_offset *offsets =
+				array_get(&mail->header_offsets, &count);
+			index_mail_cache_add_idx(mail,
+				mail->ibox->cache_fields[MAIL_CACHE_HEADER_OFFSETS].idx,
+				offsets, count * sizeof(*offsets));
+		}
+		mail->data.save_header_offsets = FALSE;
+	}
+
 	mail->data.dont_cache_field_idx = UINT_MAX;
 	index_mail_parse_header_deinit(mail);
 }
@@ -264,6 +276,21 @@ void index_mail_parse_header_init(struct index_mail *mail,
 		array_idx_set(&mail->header_match, field_idx,
 			      &mail->header_match_value);
 	}
+
+	/* remember where each header is, so later lookups for headers that
+	   aren't in cache don't need to parse the whole header again */
+	data->save_header_offsets =
+		mail_cache_field_want_add(mail->mail.mail.transaction->cache_trans,
+			data->seq,
+			mail->ibox->cache_fields[MAIL_CACHE_HEADER_OFFSETS].idx);
+	data->header_offsets_complete = FALSE;
+	if (!data->save_header_offsets)
+		;
+	else if (!array_is_created(&mail->header_offsets))
+		i_array_init(&mail->header_offsets, 32);
+	else
+		array_clear(&mail->header_offsets);
+
 	mail->data.header_parser_initialized = TRUE;
 	mail->data.parse_line_num = 0;
 	i_zero(&mail->data.parse_line);
@@ -288,6 +315,39 @@ static void index_mail_parse_finish_imap_envelope(struct index_mail *mail)
 	}
 }
 
+static void
+index_mail_parse_header_offset(struct index_mail *mail,
+			       const struct message_header_line *hdr)
+{
+	struct index_mail_header_offset *offset;
+
+	if (hdr->continued)
+		return;
+
+	/* the previous header ends where this one begins */
+	if (array_count(&mail->header_offsets) > 0) {
+		offset = array_back_modifiable(&mail->header_offsets);
+		offset->size = hdr->name_offset - offset->offset;
+	}
+	if (hdr->eoh) {
+		mail->data.header_offsets_complete = TRUE;
+		return;
+	}
+	if (hdr->name_offset > UINT32_MAX) {
+		mail->data.save_header_offsets = FALSE;
+		return;
+	}
+	if (hdr->name_len == 0) {
+		/* not a valid header line. it can't be looked up, so just
+		   leave it out. */
+		return;
+	}
+	offset = array_append_space(&mail->header_offsets);
+	offset->name_hash = strcase_hash(hdr->name);
+	offset->offset = hdr->name_offset;
+	offset->line_num = mail->data.parse_line_num;
+}
+
 void index_mail_parse_header(struct message_part *part,
 			     struct message_header_line *hdr,
 			     struct index_mail *mail)
@@ -301,6 +361,9 @@ void index_mail_parse_header(struct message_part *part,
 
         data->parse_line_num++;
 
+	if (data->save_header_offsets && hdr != NULL)
+		index_mail_parse_header_offset(mail, hdr);
+
 	if (data->save_bodystructure_header &&
 	    !data->parsed_bodystructure_header) {
 		i_assert(part != NULL);
@@ -395,6 +458,12 @@ index_mail_cache_parse_init(struct mail *_mail, struct istream *input)
 	mail->data.save_sent_date = TRUE;
 	mail->data.save_bodystructure_header = TRUE;
 	mail->data.save_bodystructure_body = TRUE;
+	/* Fields explicitly wanted for the mail being saved are cached even
+	   if the caching decision doesn't want them yet. Message parts, BODY,
+	   BODYSTRUCTURE and headers already check wanted_fields/headers. */
+	mail->data.cache_fetch_fields |= mail->data.wanted_fields &
+		(MAIL_FETCH_DATE | MAIL_FETCH_RECEIVED_DATE |
+		 MAIL_FETCH_SAVE_DATE | MAIL_FETCH_BODY_SNIPPET);
 	/* Don't unnecessarily waste time generating a snippet, since it's
 	   not as cheap as the others to generate. */
 	if (index_mail_want_cache(mail, MAIL_CACHE_BODY_SNIPPET))
@@ -405,6 +474,9 @@ index_mail_cache_parse_init(struct mail *_mail, struct istream *input)
 	input2 = tee_i_stream_create_child(mail->data.tee_stream);
 
 	index_mail_parse_header_init(mail, NULL);
+	/* the offsets in the input being saved don't necessarily match the
+	   offsets in the saved mail */
+	mail->data.save_header_offsets = FALSE;
 	mail->data.parser_input = input;
 	mail->data.parser_ctx =
 		message_parser_init(mail->mail.data_pool, input,
@@ -650,19 +722,228 @@ index_mail_get_parsed_header(struct index_mail *mail, unsigned int field_idx)
 	return array_front(&header_values);
 }
 
+struct index_mail_offset_match {
+	unsigned int header_idx;
+	uint32_t line_num;
+	size_t start_pos, end_pos;
+};
+
+/* Returns 1 if the header at the given offset is one of the wanted headers
+   and it was appended to dest, 0 if it wasn't wanted after all (name hash
+   collision), -1 if the offset doesn't point to a valid header and -2 if
+   the header couldn't be read. */
+static int
+index_mail_read_header_at(struct istream *input,
+			  const struct index_mail_header_offset *offset,
+			  struct mailbox_header_lookup_ctx *headers,
+			  string_t *dest, unsigned int *header_idx_r)
+{
+	const unsigned char *data, *p;
+	size_t size, name_len, i, start;
+	unsigned int j;
+	int ret;
+
+	if (offset->size == 0)
+		return -1;
+	i_stream_seek(input, offset->offset);
+	if ((ret = i_stream_read_bytes(input, &data, &size, offset->size)) <= 0)
+		return ret == -2 || input->stream_errno != 0 ? -2 : -1;
+	if (data[offset->size-1] != '\n')
+		return -1;
+
+	p = memchr(data, ':', offset->size);
+	if (p == NULL)
+		return -1;
+	name_len = p - data;
+	while (name_len > 0 && IS_LWSP(data[name_len-1]))
+		name_len--;
+	for (j = 0; j < headers->count; j++) {
+		if (strlen(headers->name[j]) == name_len &&
+		    i_memcasecmp(headers->name[j], data, name_len) == 0)
+			break;
+	}
+	if (j == headers->count)
+		return 0;
+
+	/* use the same format as in the cache, i.e. without CRs */
+	for (i = start = 0; i < offset->size; i++) {
+		if (data[i] == '\r' && i+1 < offset->size &&
+		    data[i+1] == '\n') {
+			str_append_data(dest, data + start, i - start);
+			start = i + 1;
+		}
+	}
+	str_append_data(dest, data + start, offset->size - start);
+	*header_idx_r = j;
+	return 1;
+}
+
+static void
+index_mail_cache_add_offset_headers(struct index_mail *mail,
+				    struct mailbox_header_lookup_ctx *headers,
+				    const struct index_mail_offset_match *matches,
+				    unsigned int match_count, const string_t *dest)
+{
+	struct mail *_mail = &mail->mail.mail;
+	buffer_t *buf = t_buffer_create(256);
+	unsigned int i, j;
+
+	/* add the headers to cache the same way as
+	   index_mail_parse_header_finish() would have */
+	for (i = 0; i < headers->count; i++) {
+		if (!mail_cache_field_can_add(_mail->transaction->cache_trans,
+					      _mail->seq, headers->idx[i]))
+			continue;
+
+		buffer_set_used_size(buf, 0);
+		for (j = 0; j < match_count; j++) {
+			if (matches[j].header_idx == i)
+				buffer_append(buf, &matches[j].line_num,
+					      sizeof(matches[j].line_num));
+		}
+		if (buf->used == 0) {
+			/* this header doesn't exist. remember that. */
+			index_mail_cache_add_idx(mail, headers->idx[i], "", 0);
+			continue;
+		}
+		buffer_append_zero(buf, sizeof(uint32_t));
+		for (j = 0; j < match_count; j++) {
+			if (matches[j].header_idx == i) {
+				buffer_append(buf, str_data(dest) +
+					      matches[j].start_pos,
+					      matches[j].end_pos -
+					      matches[j].start_pos);
+			}
+		}
+		index_mail_cache_add_idx(mail, headers->idx[i],
+					 buf->data, buf->used);
+	}
+}
+
+/* Read the wanted headers directly from the mail using the cached header
+   offsets. Returns 1 if the offsets were cached and dest now contains the
+   headers in the same format as mail_cache_lookup_headers() returns them,
+   0 if the headers need to be parsed, -1 on error. */
+static int
+index_mail_get_headers_from_offsets(struct index_mail *mail,
+				    struct mailbox_header_lookup_ctx *headers,
+				    const char *reason, string_t *dest)
+{
+	struct mail *_mail = &mail->mail.mail;
+	const struct index_mail_header_offset *offsets;
+	ARRAY(struct index_mail_offset_match) matches;
+	struct index_mail_offset_match *match;
+	struct istream *input;
+	unsigned int *hashes, i, j, count, header_idx;
+	uoff_t old_offset;
+	buffer_t *buf;
+	size_t size, start_pos;
+	int ret = 1;
+
+	buf = t_buffer_create(64 * sizeof(*offsets));
+	if (mail_cache_lookup_field(_mail->transaction->cache_view, buf,
+			_mail->seq,
+			mail->ibox->cache_fields[MAIL_CACHE_HEADER_OFFSETS].idx) <= 0)
+		return 0;
+	offsets = buffer_get_data(buf, &size);
+	if (size % sizeof(*offsets) != 0) {
+		mail_set_mail_cache_corrupted(_mail,
+			"Broken header offsets size %zu", size);
+		return 0;
+	}
+	count = size / sizeof(*offsets);
+
+	hashes = t_new(unsigned int, headers->count);
+	for (j = 0; j < headers->count; j++)
+		hashes[j] = strcase_hash(headers->name[j]);
+
+	if (mail_get_hdr_stream_because(_mail, NULL, reason, &input) < 0)
+		return -1;
+	old_offset = input->v_offset;
+	t_array_init(&matches, 8);
+	for (i = 0; i < count && ret >= 0; i++) {
+		for (j = 0; j < headers->count; j++) {
+			if (offsets[i].name_hash == hashes[j])
+				break;
+		}
+		if (j == headers->count)
+			continue;
+
+		start_pos = str_len(dest);
+		ret = index_mail_read_header_at(input, &offsets[i], headers,
+						dest, &header_idx);
+		if (ret > 0) {
+			match = array_append_space(&matches);
+			match->header_idx = header_idx;
+			match->line_num = offsets[i].line_num;
+			match->start_pos = start_pos;
+			match->end_pos = str_len(dest);
+		}
+	}
+	i_stream_seek(input, old_offset);
+	if (ret < 0) {
+		if (ret == -1) {
+			mail_set_mail_cache_corrupted(_mail,
+				"Broken header offset %u",
+				offsets[i-1].offset);
+		}
+		/* fallback to parsing the header. it also handles any
+		   stream errors. */
+		str_truncate(dest, 0);
+		return 0;
+	}
+	match = array_get_modifiable(&matches, &count);
+	index_mail_cache_add_offset_headers(mail, headers, match, count, dest);
+	return 1;
+}
+
+static const char *const *
+index_mail_headers_from_cache_data(struct index_mail *mail,
+				   string_t *dest)
+{
+	const unsigned char *data;
+	const char *value;
+	size_t i, len, len2;
+	ARRAY(const char *) header_values;
+
+	data = buffer_get_data(dest, &len);
+	if (len == 0) {
+		/* cached as nonexistent. */
+		return p_new(mail->mail.data_pool, const char *, 1);
+	}
+
+	p_array_init(&header_values, mail->mail.data_pool, 4);
+
+	/* cached. skip "header name: " parts in dest. */
+	for (i = 0; i < len; i++) {
+		if (data[i] == ':') {
+			i++;
+			while (i < len && IS_LWSP(data[i])) i++;
+
+			/* @UNSAFE */
+			len2 = get_header_size(dest, i);
+			value = message_header_strdup(mail->mail.data_pool,
+						     data + i, len2);
+			i += len2 + 1;
+
+			array_push_back(&header_values, &value);
+		}
+	}
+
+	array_append_zero(&header_values);
+	return array_front(&header_values);
+}
+
 static int
 index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 			   const char *const **value_r)
 {
 	struct mail *_mail = &mail->mail.mail;
-	const char *headers[2], *value;
+	const char *headers[2];
 	struct mailbox_header_lookup_ctx *headers_ctx;
-	const unsigned char *data;
 	unsigned int field_idx;
 	string_t *dest;
-	size_t i, len, len2;
 	int ret;
-	ARRAY(const char *) header_values;
 
 	i_assert(field != NULL);
 
@@ -689,10 +970,21 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 			headers[0] = field; headers[1] = NULL;
 			headers_ctx = mailbox_header_lookup_init(_mail->box,
 								 headers);
-			ret = index_mail_parse_headers(mail, headers_ctx, reason);
+			dest = t_str_new(128);
+			ret = index_mail_get_headers_from_offsets(mail,
+						headers_ctx, reason, dest);
+			if (ret == 0) {
+				ret = index_mail_parse_headers(mail,
+						headers_ctx, reason);
+			}
 			mailbox_header_lookup_unref(&headers_ctx);
 			if (ret < 0)
 				return -1;
+			if (ret > 0) {
+				*value_r = index_mail_headers_from_cache_data(
+					mail, dest);
+				return 0;
+			}
 		}
 
 		if ((ret = index_mail_header_is_parsed(mail, field_idx)) <= 0) {
@@ -705,34 +997,7 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 		return 0;
 	}
 	_mail->transaction->stats.cache_hit_count++;
-	data = buffer_get_data(dest, &len);
-
-	if (len == 0) {
-		/* cached as nonexistent. */
-		*value_r = p_new(mail->mail.data_pool, const char *, 1);
-		return 0;
-	}
-
-	p_array_init(&header_values, mail->mail.data_pool, 4);
-
-	/* cached. skip "header name: " parts in dest. */
-	for (i = 0; i < len; i++) {
-		if (data[i] == ':') {
-			i++;
-			while (i < len && IS_LWSP(data[i])) i++;
-
-			/* @UNSAFE */
-			len2 = get_header_size(dest, i);
-			value = message_header_strdup(mail->mail.data_pool,
-						     data + i, len2);
-			i += len2 + 1;
-
-			array_push_back(&header_values, &value);
-		}
-	}
-
-	array_append_zero(&header_values);
-	*value_r = array_front(&header_values);
+	*value_r = index_mail_headers_from_cache_data(mail, dest);
 	return 0;
 }
 
@@ -974,17 +1239,32 @@ int index_mail_get_header_stream(struct mail *_mail,
 			not_found_count, headers->count, headers->name[first_not_found]));
 	}
 	mail->data.access_reason_code = "mail:header_fields";
+	dest = str_new(mail->mail.data_pool, 256);
+	int ret = index_mail_get_headers_from_offsets(mail, headers,
+						      reason, dest);
+	if (ret < 0)
+		return -1;
+	if (ret > 0) {
+		str_append(dest, "\n");
+		mail->data.filter_stream =
+			i_stream_create_from_data(str_data(dest),
+						  str_len(dest));
+		*stream_r = mail->data.filter_stream;
+		return 0;
+	}
+	p_free(mail->mail.data_pool, dest);
+
 	if (mail_get_hdr_stream_because(_mail, NULL, reason, &input) < 0)
 		return -1;
 
 	index_mail_parse_header_init(mail, headers);
 	mail->data.filter_stream =
-		i_stream_create_header_filter(mail->data.stream,
-					      HEADER_FILTER_INCLUDE |
-					      HEADER_FILTER_ADD_MISSING_EOH |
-					      HEADER_FILTER_HIDE_BODY,
-					      headers->name, headers->count,
-					      header_cache_callback, mail);
+		i_stream_create_header_filter_set(mail->data.stream,
+						  HEADER_FILTER_INCLUDE |
+						  HEADER_FILTER_ADD_MISSING_EOH |
+						  HEADER_FILTER_HIDE_BODY,
+						  headers->filter_set,
+						  header_cache_callback, mail);
 	*stream_r = mail->data.filter_stream;
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include "mailbox-recent-flags.h"
 #include "message-date.h"
 #include "message-part-data.h"
+#include "message-part-data-serialize.h"
 #include "message-part-serialize.h"
 #include "message-parser.h"
 #include "message-snippet.h"
@@ -63,6 +64,10 @@ struct mail_cache_field global_cache_fields[MAIL_INDEX_CACHE_FIELD_COUNT] = {
 	{ .name = "binary.parts",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
 	{ .name = "body.snippet",
+	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
+	{ .name = "header.offsets",
+	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
+	{ .name = "mime.parts.data",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE }
 	/* FIXME: for now need to update get_metadata_precache_fields() in
 	   index-status.c when adding more fields. those fields should probably
@@ -357,6 +362,11 @@ int index_mail_get_parts(struct mail *_mail, struct message_part **parts_r)
 		*parts_r = data->parts;
 		return 0;
 	}
+	if (_mail->lookup_abort != MAIL_LOOKUP_ABORT_NEVER) {
+		/* don't continue parsing an already opened stream either */
+		mail_set_aborted(_mail);
+		return -1;
+	}
 
 	if (data->parser_ctx == NULL) {
 		const char *reason =
@@ -823,6 +833,63 @@ index_mail_write_bodystructure(struct index_mail *mail, string_t *str,
 	return 0;
 }
 
+static bool
+index_mail_body_parsed_cache_part_data(struct index_mail *mail,
+				       enum index_cache_field field)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_data *data = &mail->data;
+	const unsigned int cache_field_parts =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS].idx;
+	const unsigned int cache_field_part_data =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PART_DATA].idx;
+	buffer_t *buffer;
+	const char *error;
+	bool cache_part_data;
+	int ret;
+
+	if (mail_cache_field_exists(_mail->transaction->cache_view,
+				    _mail->seq, cache_field_part_data) > 0)
+		return TRUE;
+
+	if (field == MAIL_CACHE_IMAP_BODY ||
+	    field == MAIL_CACHE_IMAP_BODYSTRUCTURE ||
+	    (data->wanted_fields & (MAIL_FETCH_IMAP_BODY |
+				    MAIL_FETCH_IMAP_BODYSTRUCTURE)) != 0) {
+		cache_part_data =
+			mail_cache_field_can_add(_mail->transaction->cache_trans,
+				_mail->seq, cache_field_part_data);
+	} else {
+		cache_part_data =
+			mail_cache_field_want_add(_mail->transaction->cache_trans,
+				_mail->seq, cache_field_part_data);
+	}
+	if (!cache_part_data)
+		return FALSE;
+
+	/* the part data is useless without the message parts */
+	data->save_message_parts = TRUE;
+	index_mail_body_parsed_cache_message_parts(mail);
+	if (!data->messageparts_saved_to_cache &&
+	    mail_cache_field_exists(_mail->transaction->cache_view,
+				    _mail->seq, cache_field_parts) <= 0)
+		return FALSE;
+
+	T_BEGIN {
+		buffer = t_buffer_create(1024);
+		ret = message_part_data_serialize(data->parts, buffer, &error);
+		if (ret == 0) {
+			index_mail_cache_add_idx(mail, cache_field_part_data,
+						 buffer->data, buffer->used);
+		} else {
+			mail_set_mail_cache_corrupted(_mail,
+				"Failed to serialize mime.parts.data: %s",
+				error);
+		}
+	} T_END;
+	return ret == 0;
+}
+
 static void
 index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 					   enum index_cache_field field)
@@ -839,6 +906,7 @@ index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 	string_t *str;
 	bool bodystructure_cached = FALSE;
 	bool plain_bodystructure = FALSE;
+	bool part_data_cached = FALSE;
 	bool cache_bodystructure, cache_body;
 
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0) {
@@ -854,10 +922,21 @@ index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 		return;
 	i_assert(data->parts != NULL);
 
+	/* Both BODY and BODYSTRUCTURE can be written from the binary
+	   mime.parts.data without parsing the message. Prefer it over the
+	   text versions. */
+	if (!plain_bodystructure)
+		part_data_cached =
+			index_mail_body_parsed_cache_part_data(mail, field);
+
 	/* If BODY is fetched first but BODYSTRUCTURE is also wanted, we don't
 	   normally want to first cache BODY and then BODYSTRUCTURE. So check
 	   the wanted_fields also in here. */
-	if (plain_bodystructure)
+	dec = mail_cache_field_get_decision(_mail->box->cache,
+					    cache_field_bodystructure);
+	if (plain_bodystructure ||
+	    (part_data_cached &&
+	     (dec != (MAIL_CACHE_DECISION_FORCED | MAIL_CACHE_DECISION_YES))))
 		cache_bodystructure = FALSE;
 	else if (field == MAIL_CACHE_IMAP_BODYSTRUCTURE ||
 		 (data->wanted_fields & MAIL_FETCH_IMAP_BODYSTRUCTURE) != 0) {
@@ -878,7 +957,7 @@ index_mail_body_parsed_cache_bodystructure(struct index_mail *mail,
 			bodystructure_cached = TRUE;
 		}
 	} else {
-		bodystructure_cached =
+		bodystructure_cached = part_data_cached ||
 			mail_cache_field_exists(_mail->transaction->cache_view,
 				_mail->seq, cache_field_bodystructure) > 0;
 	}
@@ -1591,6 +1670,58 @@ index_mail_fetch_body_snippet(struct index_mail *mail, const char **value_r)
 	return 0;
 }
 
+static bool
+index_mail_get_cached_part_data_real(struct index_mail *mail, string_t *str,
+				     bool extended)
+{
+	const unsigned int cache_field =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PART_DATA].idx;
+	struct message_part *parts;
+	buffer_t *data_buf, *part_buf;
+	pool_t pool;
+	const char *error;
+
+	data_buf = t_buffer_create(256);
+	if (index_mail_cache_lookup_field(mail, data_buf, cache_field) <= 0)
+		return FALSE;
+	if (get_serialized_parts(mail, &part_buf) <= 0)
+		return FALSE;
+
+	/* Use a separate copy of the parts, so the part data doesn't get
+	   mixed into data->parts, which may still be used for parsing the
+	   message headers. */
+	pool = pool_datastack_create();
+	parts = message_part_deserialize(pool, part_buf->data, part_buf->used,
+					 &error);
+	if (parts == NULL) {
+		mail_set_mail_cache_corrupted(&mail->mail.mail,
+			"Corrupted cached mime.parts data: %s", error);
+		return FALSE;
+	}
+	if (message_part_data_deserialize(pool, parts, data_buf->data,
+					  data_buf->used, &error) < 0 ||
+	    imap_bodystructure_write(parts, str, extended, &error) < 0) {
+		mail_set_mail_cache_corrupted(&mail->mail.mail,
+			"Corrupted cached mime.parts.data: %s", error);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static bool
+index_mail_get_cached_part_data(struct index_mail *mail, string_t *str,
+				bool extended)
+{
+	bool ret;
+
+	T_BEGIN {
+		ret = index_mail_get_cached_part_data_real(mail, str, extended);
+	} T_END;
+	if (!ret)
+		str_truncate(str, 0);
+	return ret;
+}
+
 bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 {
 	const struct mail_cache_field *cache_fields = mail->ibox->cache_fields;
@@ -1620,7 +1751,12 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 		*value_r = data->body = str_c(str);
 		return TRUE;
 	}
-	/* 3) get it using BODYSTRUCTURE if it exists */
+	/* 3) write it from the cached part data */
+	if (index_mail_get_cached_part_data(mail, str, FALSE)) {
+		*value_r = data->body = str_c(str);
+		return TRUE;
+	}
+	/* 4) get it using BODYSTRUCTURE if it exists */
 	if (index_mail_cache_lookup_field(mail, str, bodystructure_cache_field) > 0) {
 		data->bodystructure =
 			p_strdup(mail->mail.data_pool, str_c(str));
@@ -1661,7 +1797,8 @@ bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
 	    get_cached_parts(mail))
 		index_mail_get_plain_bodystructure(mail, str, TRUE);
-	else if (index_mail_cache_lookup_field(mail, str,
+	else if (!index_mail_get_cached_part_data(mail, str, TRUE) &&
+		 index_mail_cache_lookup_field(mail, str,
 			bodystructure_cache_field) <= 0) {
 		str_free(&str);
 		return FALSE;
@@ -2204,13 +2341,18 @@ bool index_mail_prefetch(struct mail *_mail)
 	off_t len;
 	int fd;
 
+	/* start reading the cache record also when the message itself is
+	   needed, since cached fields are looked up in any case */
+	if (mail_cache_prefetch(_mail->transaction->cache_view, _mail->seq))
+		mail->data.prefetch_sent = TRUE;
+
 	if ((storage->class_flags & MAIL_STORAGE_CLASS_FLAG_FILE_PER_MSG) == 0) {
 		/* we're handling only file-per-msg storages for now. */
-		return TRUE;
+		return !mail->data.prefetch_sent;
 	}
 	if (mail->data.access_part == 0) {
 		/* everything we need is cached */
-		return TRUE;
+		return !mail->data.prefetch_sent;
 	}
 
 	if (mail->data.stream == NULL) {
@@ -2310,6 +2452,8 @@ void index_mail_free(struct mail *_mail)
 		array_free(&mail->header_match);
 	if (array_is_created(&mail->header_match_lines))
 		array_free(&mail->header_match_lines);
+	if (array_is_created(&mail->header_offsets))
+		array_free(&mail->header_offsets);
 
 	mailbox_header_lookup_unref(&mail->data.wanted_headers);
 	mailbox_header_lookup_unref(&mail->mail.wanted_headers);
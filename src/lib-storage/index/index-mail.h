@@ -24,6 +24,8 @@ enum index_cache_field {
 	MAIL_CACHE_MESSAGE_PARTS,
 	MAIL_CACHE_BINARY_PARTS,
 	MAIL_CACHE_BODY_SNIPPET,
+	MAIL_CACHE_HEADER_OFFSETS,
+	MAIL_CACHE_MESSAGE_PART_DATA,
 
 	MAIL_INDEX_CACHE_FIELD_COUNT
 };
@@ -71,6 +73,20 @@ struct index_mail_line {
 	uint32_t line_num;
 };
 
+/* MAIL_CACHE_HEADER_OFFSETS contains an array of these, one for each header
+   in the message's root header in the order they appear. */
+struct index_mail_header_offset {
+	/* strcase_hash() of the header name */
+	uint32_t name_hash;
+	/* Offset of the header from the beginning of the message */
+	uint32_t offset;
+	/* Size of the header, including its continuation lines and the
+	   final newline */
+	uint32_t size;
+	/* Same as index_mail_line.line_num */
+	uint32_t line_num;
+};
+
 struct message_header_line;
 
 struct index_mail_data {
@@ -132,6 +148,8 @@ struct index_mail_data {
 	bool destroy_callback_set:1;
 	bool prefetch_sent:1;
 	bool header_parser_initialized:1;
+	bool save_header_offsets:1;
+	bool header_offsets_complete:1;
 	/* virtual_size and physical_size may not match the stream size.
 	   Try to avoid trusting them too much. */
 	bool inexact_total_sizes:1;
@@ -155,6 +173,7 @@ struct index_mail {
 	ARRAY(uint8_t) header_match;
 	ARRAY(unsigned int) header_match_lines;
 	uint8_t header_match_value;
+	ARRAY(struct index_mail_header_offset) header_offsets;
 
 	bool pop3_state_set:1;
 	/* close() is being called from mail_free() */
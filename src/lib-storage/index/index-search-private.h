@@ -19,6 +19,19 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* UIDs and flags for messages columns_seq1..columns_seq2, copied from
+	   the index in batches for matching the index args. */
+	uint32_t columns_seq1, columns_seq2;
+	uint32_t *column_uids;
+	uint8_t *column_flags;
+	/* Root level args that can be matched against the columns directly.
+	   Messages whose bit isn't set in column_candidates can't match. */
+	ARRAY(struct mail_search_arg *) column_args;
+	uint64_t *column_candidates;
+	/* Root level MODSEQ args require at least this modseq. Messages
+	   that haven't changed since then are skipped. */
+	uint64_t min_modseq;
+
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
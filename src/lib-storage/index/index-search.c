@@ -36,6 +36,8 @@
 #define SEARCH_MAX_NONBLOCK_USECS 250000
 #define SEARCH_INITIAL_MAX_COST 30000
 #define SEARCH_RECALC_MIN_USECS 50000
+/* How many messages' UIDs and flags to copy from index at a time */
+#define SEARCH_INDEX_COLUMNS_COUNT 1024
 
 struct search_header_context {
         struct index_search_context *index_ctx;
@@ -249,13 +251,203 @@ static int search_arg_match_index(struct index_search_context *ctx,
 	}
 }
 
+static bool search_arg_is_column_matchable(struct index_search_context *ctx,
+					   const struct mail_search_arg *arg)
+{
+	enum mail_flags pvt_flags_mask;
+
+	switch (arg->type) {
+	case SEARCH_UIDSET:
+		return TRUE;
+	case SEARCH_FLAGS:
+		/* \Recent and private flags don't come from the index
+		   record */
+		if ((arg->value.flags & MAIL_RECENT) != 0)
+			return FALSE;
+		pvt_flags_mask = ctx->box->view_pvt == NULL ? 0 :
+			mailbox_get_private_flags_mask(ctx->box);
+		return (arg->value.flags & pvt_flags_mask) == 0;
+	default:
+		return FALSE;
+	}
+}
+
+static void search_init_column_args(struct index_search_context *ctx,
+				    struct mail_search_arg *args)
+{
+	/* The root level args are ANDed together, so any of them not
+	   matching is enough to drop the message. */
+	for (; args != NULL; args = args->next) {
+		if (!search_arg_is_column_matchable(ctx, args))
+			continue;
+		if (!array_is_created(&ctx->column_args))
+			i_array_init(&ctx->column_args, 4);
+		array_push_back(&ctx->column_args, &args);
+	}
+	if (array_is_created(&ctx->column_args)) {
+		ctx->column_candidates =
+			i_new(uint64_t, SEARCH_INDEX_COLUMNS_COUNT / 64);
+	}
+}
+
+static void search_init_min_modseq(struct index_search_context *ctx,
+				   const struct mail_search_arg *args)
+{
+	/* Flag and keyword specific modseqs are never higher than the
+	   message's modseq, so it can be used to skip messages for all of
+	   them. */
+	for (; args != NULL; args = args->next) {
+		if (args->type == SEARCH_MODSEQ && !args->match_not &&
+		    ctx->min_modseq < args->value.modseq->modseq)
+			ctx->min_modseq = args->value.modseq->modseq;
+	}
+}
+
+static inline uint64_t search_columns_load8(const uint8_t *p)
+{
+	/* compilers turn this into a single load on little endian CPUs */
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static void
+search_columns_match_flags(struct index_search_context *ctx,
+			   const struct mail_search_arg *arg,
+			   unsigned int count)
+{
+	const uint64_t mask8 = 0x0101010101010101ULL * (uint8_t)arg->value.flags;
+	const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t x, bits, *candidates = ctx->column_candidates;
+	unsigned int i;
+
+	/* Match 8 messages at a time. A byte becomes zero when the message
+	   has all the wanted flags. Set the byte's high bit for such
+	   messages and gather the high bits into a bitmask. */
+	for (i = 0; i < count; i += 8) {
+		x = (search_columns_load8(ctx->column_flags + i) & mask8) ^
+			mask8;
+		x = ~(((x & low7) + low7) | x) & ~low7;
+		bits = ((x >> 7) * 0x0102040810204080ULL) >> 56;
+		if (arg->match_not)
+			bits = ~bits & 0xff;
+		candidates[i / 64] &= ~((uint64_t)(~bits & 0xff) << (i % 64));
+	}
+}
+
+static void
+search_columns_match_uidset(struct index_search_context *ctx,
+			    const struct mail_search_arg *arg,
+			    unsigned int count)
+{
+	const struct seq_range *range;
+	unsigned int i, r, range_count;
+	uint32_t uid;
+	bool match;
+
+	range = array_get(&arg->value.seqset, &range_count);
+	for (i = r = 0; i < count; i++) {
+		uid = ctx->column_uids[i];
+		while (r < range_count && range[r].seq2 < uid)
+			r++;
+		match = r < range_count && range[r].seq1 <= uid;
+		if (match == arg->match_not)
+			ctx->column_candidates[i / 64] &= ~(1ULL << (i % 64));
+	}
+}
+
+static void search_columns_match(struct index_search_context *ctx)
+{
+	struct mail_search_arg *arg;
+	unsigned int count = ctx->columns_seq2 - ctx->columns_seq1 + 1;
+
+	/* the flags of messages past count are zero, but they're never
+	   looked up */
+	memset(ctx->column_candidates, 0xff,
+	       sizeof(uint64_t) * SEARCH_INDEX_COLUMNS_COUNT / 64);
+	array_foreach_elem(&ctx->column_args, arg) {
+		switch (arg->type) {
+		case SEARCH_FLAGS:
+			search_columns_match_flags(ctx, arg, count);
+			break;
+		case SEARCH_UIDSET:
+			search_columns_match_uidset(ctx, arg, count);
+			break;
+		default:
+			i_unreached();
+		}
+	}
+}
+
+static void
+search_index_fill_columns(struct index_search_context *ctx, uint32_t seq)
+{
+	if (seq >= ctx->columns_seq1 && seq <= ctx->columns_seq2)
+		return;
+
+	if (ctx->column_uids == NULL) {
+		ctx->column_uids = i_new(uint32_t, SEARCH_INDEX_COLUMNS_COUNT);
+		ctx->column_flags = i_new(uint8_t, SEARCH_INDEX_COLUMNS_COUNT);
+	}
+	i_assert(seq <= ctx->seq2);
+	ctx->columns_seq1 = seq;
+	ctx->columns_seq2 = I_MIN(ctx->seq2,
+				  seq + SEARCH_INDEX_COLUMNS_COUNT - 1);
+	/* clear the unused tail, so matching can always look at full
+	   8 message blocks */
+	memset(ctx->column_flags, 0, SEARCH_INDEX_COLUMNS_COUNT);
+	mail_index_lookup_columns(ctx->view, ctx->columns_seq1,
+				  ctx->columns_seq2, ctx->column_uids,
+				  ctx->column_flags);
+	if (ctx->column_candidates != NULL)
+		search_columns_match(ctx);
+}
+
+/* Returns the first sequence >= seq that may match the column args, or
+   seq2+1 if there are none. */
+static uint32_t
+search_index_next_candidate(struct index_search_context *ctx, uint32_t seq)
+{
+	unsigned int idx;
+	uint64_t word;
+
+	while (seq <= ctx->seq2) {
+		search_index_fill_columns(ctx, seq);
+		idx = seq - ctx->columns_seq1;
+		word = ctx->column_candidates[idx / 64] >> (idx % 64);
+		if (word != 0) {
+			/* found one in this word */
+			seq += bits_required64(word & -word) - 1;
+			return I_MIN(seq, ctx->seq2 + 1);
+		}
+		/* skip to the next word */
+		seq += 64 - idx % 64;
+	}
+	return seq;
+}
+
+static void
+search_index_lookup_rec(struct index_search_context *ctx,
+			struct mail_index_record *rec_r)
+{
+	uint32_t seq = ctx->mail_ctx.seq;
+	unsigned int idx;
+
+	search_index_fill_columns(ctx, seq);
+	idx = seq - ctx->columns_seq1;
+	i_zero(rec_r);
+	rec_r->uid = ctx->column_uids[idx];
+	rec_r->flags = ctx->column_flags[idx];
+}
+
 static void search_index_arg(struct mail_search_arg *arg,
 			     struct index_search_context *ctx)
 {
-	const struct mail_index_record *rec;
+	struct mail_index_record rec;
 
-	rec = mail_index_lookup(ctx->view, ctx->mail_ctx.seq);
-	switch (search_arg_match_index(ctx, arg, rec)) {
+	search_index_lookup_rec(ctx, &rec);
+	switch (search_arg_match_index(ctx, arg, &rec)) {
 	case -1:
 		/* unknown */
 		break;
@@ -1285,6 +1477,7 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 {
 	struct index_search_context *ctx;
 	struct mailbox_status status;
+	unsigned int prefetch_count;
 
 	ctx = i_new(struct index_search_context, 1);
 	ctx->mail_ctx.transaction = t;
@@ -1294,7 +1487,13 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 	ctx->mail_ctx.args = args;
 	ctx->mail_ctx.sort_program = index_sort_program_init(t, sort_program);
 
-	ctx->mail_ctx.max_mails = t->box->storage->set->mail_prefetch_count + 1;
+	/* Only mails whose contents need to be read by the search are
+	   prefetched, so searching can use a deeper prefetch queue than
+	   fetching. */
+	prefetch_count = t->box->storage->set->mail_search_prefetch_count;
+	if (prefetch_count == 0)
+		prefetch_count = t->box->storage->set->mail_prefetch_count;
+	ctx->mail_ctx.max_mails = prefetch_count + 1;
 	if (ctx->mail_ctx.max_mails == 0)
 		ctx->mail_ctx.max_mails = UINT_MAX;
 	ctx->next_time_check_cost = SEARCH_INITIAL_MAX_COST;
@@ -1328,6 +1527,8 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 
 	search_get_seqset(ctx, status.messages, args->args);
 	(void)mail_search_args_foreach(args->args, search_init_arg, ctx);
+	search_init_column_args(ctx, args->args);
+	search_init_min_modseq(ctx, args->args);
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
@@ -1383,6 +1584,11 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	if (ctx->failed)
 		mail_storage_last_error_pop(ctx->box->storage);
 	array_free(&ctx->mail_ctx.mails);
+	if (array_is_created(&ctx->column_args))
+		array_free(&ctx->column_args);
+	i_free(ctx->column_uids);
+	i_free(ctx->column_flags);
+	i_free(ctx->column_candidates);
 	i_free(ctx);
 	return ret;
 }
@@ -1885,6 +2091,25 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (ctx->min_modseq != 0) {
+			/* skip over messages that haven't changed */
+			if (!mail_index_modseq_find_next(ctx->view, _ctx->seq,
+							 ctx->min_modseq,
+							 &_ctx->seq)) {
+				_ctx->seq = ctx->seq2 + 1;
+				break;
+			}
+			if (_ctx->seq > ctx->seq2)
+				break;
+		}
+		if (ctx->column_candidates != NULL) {
+			/* skip quickly over messages whose flags or UIDs
+			   can't match */
+			_ctx->seq = search_index_next_candidate(ctx,
+								_ctx->seq);
+			if (_ctx->seq > ctx->seq2)
+				break;
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
@@ -13,6 +13,9 @@ struct mail_search_sort_program {
 			      struct mail *mail);
 	void (*sort_list_finish)(struct mail_search_sort_program *program);
 	void *context;
+	/* "sort-*" index extension containing the primary sort key + 1 for
+	   number based sorts, or 0 if the key isn't known yet. */
+	uint32_t ext_id;
 
 	ARRAY_TYPE(uint32_t) seqs;
 	unsigned int iter_idx;
@@ -71,17 +71,65 @@ index_sort_program_set_date_failed(struct mail_search_sort_program *program,
 	}
 }
 
+static void
+index_sort_ext_register(struct mail_search_sort_program *program,
+			const char *name)
+{
+	program->ext_id = mail_index_ext_register(program->t->box->index,
+						  name, 0, sizeof(uint64_t),
+						  sizeof(uint64_t));
+}
+
+static bool
+index_sort_ext_lookup(struct mail_search_sort_program *program,
+		      uint32_t seq, uint64_t *key_r)
+{
+	struct mail_index_map *map;
+	const void *data;
+	uint64_t value;
+	bool expunged;
+
+	mail_index_lookup_ext_full(program->t->view, seq, program->ext_id,
+				   &map, &data, &expunged);
+	if (data == NULL)
+		return FALSE;
+	memcpy(&value, data, sizeof(value));
+	if (value == 0)
+		return FALSE;
+	*key_r = value - 1;
+	return TRUE;
+}
+
+static void
+index_sort_ext_update(struct mail_search_sort_program *program,
+		      struct mail *mail, uint64_t key)
+{
+	uint64_t value = key + 1;
+
+	/* the keys never change for a message, so once they're written
+	   the following sorts don't need to look them up from cache */
+	if (mail->expunged || value == 0)
+		return;
+	mail_index_update_ext(program->t->itrans, mail->seq, program->ext_id,
+			      &value, NULL);
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	uint64_t key;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_received_date(mail, &node->date) < 0)
+	if (index_sort_ext_lookup(program, mail->seq, &key))
+		node->date = key;
+	else if (mail_get_received_date(mail, &node->date) < 0)
 		node->date = index_sort_program_set_date_failed(program, mail);
+	else if (node->date > 0)
+		index_sort_ext_update(program, mail, node->date);
 }
 
 static void
@@ -90,16 +138,27 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	uint64_t key;
 	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
+	if (index_sort_ext_lookup(program, mail->seq, &key)) {
+		node->date = key;
+		return;
+	}
+	if (mail_get_date(mail, &node->date, &tz) < 0) {
 		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
+		return;
+	}
+	if (node->date == 0) {
+		if (mail_get_received_date(mail, &node->date) < 0) {
 			node->date = index_sort_program_set_date_failed(program, mail);
+			return;
+		}
 	}
+	if (node->date > 0)
+		index_sort_ext_update(program, mail, node->date);
 }
 
 static void
@@ -108,12 +167,17 @@ index_sort_list_add_size(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
 	struct mail_sort_node_size *node;
+	uint64_t key;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_virtual_size(mail, &node->size) < 0) {
+	if (index_sort_ext_lookup(program, mail->seq, &key))
+		node->size = key;
+	else if (mail_get_virtual_size(mail, &node->size) < 0) {
 		index_sort_program_set_mail_failed(program, mail);
 		node->size = 0;
+	} else {
+		index_sort_ext_update(program, mail, node->size);
 	}
 }
 
@@ -412,10 +476,13 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 		i_array_init(nodes, 128);
 
 		if ((program->sort_program[0] &
-		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL)
+		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL) {
 			program->sort_list_add = index_sort_list_add_arrival;
-		else
+			index_sort_ext_register(program, "sort-arrival");
+		} else {
 			program->sort_list_add = index_sort_list_add_date;
+			index_sort_ext_register(program, "sort-date");
+		}
 		program->sort_list_finish = index_sort_list_finish_date;
 		program->context = nodes;
 		break;
@@ -428,6 +495,7 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 		program->sort_list_add = index_sort_list_add_size;
 		program->sort_list_finish = index_sort_list_finish_size;
 		program->context = nodes;
+		index_sort_ext_register(program, "sort-size");
 		break;
 	}
 	case MAIL_SORT_CC:
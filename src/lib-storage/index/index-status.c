@@ -229,10 +229,12 @@ static void get_metadata_precache_fields(struct mailbox *box,
 		const char *name = fields[i].name;
 
 		if (str_begins(name, "hdr.") ||
+		    strcmp(name, "header.offsets") == 0 ||
 		    strcmp(name, "date.sent") == 0 ||
 		    strcmp(name, "imap.envelope") == 0)
 			cache |= MAIL_FETCH_STREAM_HEADER;
 		else if (strcmp(name, "mime.parts") == 0 ||
+			 strcmp(name, "mime.parts.data") == 0 ||
 			 strcmp(name, "binary.parts") == 0 ||
 			 strcmp(name, "imap.body") == 0 ||
 			 strcmp(name, "imap.bodystructure") == 0 ||
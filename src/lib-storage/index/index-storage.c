@@ -15,6 +15,7 @@
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mailbox-log.h"
+#include "mailbox-cache-decisions.h"
 #include "mailbox-list-private.h"
 #include "mail-search-build.h"
 #include "index-storage.h"
@@ -284,6 +285,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.max_size = set->mail_index_log_rotate_max_size,
 			.min_age_secs = set->mail_index_log_rotate_min_age,
 			.log2_max_age_secs = set->mail_index_log2_max_age,
+			.group_commit = set->mail_fsync_group_commit,
 		},
 		.cache = {
 			.unaccessed_field_drop_secs = set->mail_cache_unaccessed_field_drop,
@@ -293,6 +295,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.purge_max_inline_size = set->mail_cache_purge_max_inline_size,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -423,6 +426,9 @@ void index_storage_mailbox_alloc(struct mailbox *box, const char *vname,
 	ibox->next_lock_notify = time(NULL) + LOCK_NOTIFY_INTERVAL;
 	MODULE_CONTEXT_SET(box, index_storage_module, ibox);
 
+	box->mail_index_flag_updates =
+		box->mail_vfuncs->update_flags == index_mail_update_flags &&
+		box->mail_vfuncs->update_keywords == index_mail_update_keywords;
 	box->inbox_user = strcmp(box->name, "INBOX") == 0 &&
 		(box->list->ns->flags & NAMESPACE_FLAG_INBOX_USER) != 0;
 	box->inbox_any = strcmp(box->name, "INBOX") == 0 &&
@@ -452,6 +458,7 @@ void index_storage_mailbox_close(struct mailbox *box)
 	if (box->index_pvt != NULL)
 		mail_index_close(box->index_pvt);
 	if (box->view != NULL) {
+		mailbox_cache_decisions_learn(box);
 		mail_index_view_close(&box->view);
 		mail_index_close(box->index);
 	}
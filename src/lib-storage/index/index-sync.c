@@ -19,6 +19,8 @@ enum mail_index_sync_flags index_storage_get_sync_flags(struct mailbox *box)
 
 	if ((box->flags & MAILBOX_FLAG_DROP_RECENT) != 0)
 		sync_flags |= MAIL_INDEX_SYNC_FLAG_DROP_RECENT;
+	if ((box->flags & MAILBOX_FLAG_BACKGROUND_SESSION) != 0)
+		sync_flags |= MAIL_INDEX_SYNC_FLAG_PURGE_LARGE_CACHE;
 	if (box->deleting) {
 		sync_flags |= box->delete_sync_check ?
 			MAIL_INDEX_SYNC_FLAG_TRY_DELETING_INDEX :
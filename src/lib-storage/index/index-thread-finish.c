@@ -10,6 +10,8 @@
 
 struct mail_thread_shadow_node {
 	uint32_t first_child_idx, next_sibling_idx;
+	/* children are already linked in their sorted order */
+	bool children_sorted;
 };
 
 struct mail_thread_root_node {
@@ -170,15 +172,16 @@ static void
 thread_sort_children(struct thread_finish_context *ctx, uint32_t parent_idx,
 		     ARRAY_TYPE(mail_thread_child_node) *sorted_children)
 {
-	const struct mail_thread_shadow_node *shadows;
+	struct mail_thread_shadow_node *shadows;
 	struct mail_thread_child_node child;
-	unsigned int count;
+	const struct mail_thread_child_node *children;
+	unsigned int i, count;
 
 	i_zero(&child);
 	array_clear(sorted_children);
 
 	/* add all child indexes to the array */
-	shadows = array_get(&ctx->shadow_nodes, &count);
+	shadows = array_get_modifiable(&ctx->shadow_nodes, &count);
 	child.idx = shadows[parent_idx].first_child_idx;
 	i_assert(child.idx != 0);
 	if (shadows[child.idx].next_sibling_idx == 0) {
@@ -188,6 +191,15 @@ thread_sort_children(struct thread_finish_context *ctx, uint32_t parent_idx,
 		array_push_back(sorted_children, &child);
 		return;
 	}
+	if (shadows[parent_idx].children_sorted) {
+		/* sorted already while iterating a cached thread tree */
+		while (child.idx != 0) {
+			child.uid = thread_lookup_existing(ctx, child.idx);
+			array_push_back(sorted_children, &child);
+			child.idx = shadows[child.idx].next_sibling_idx;
+		}
+		return;
+	}
 	while (child.idx != 0) {
 		thread_child_node_fill(ctx, &child);
 
@@ -197,6 +209,15 @@ thread_sort_children(struct thread_finish_context *ctx, uint32_t parent_idx,
 
 	/* sort the children */
 	array_sort(sorted_children, mail_thread_child_node_cmp);
+
+	/* relink them in the sorted order, so the dates don't need to be
+	   looked up again if the tree is iterated again */
+	children = array_get(sorted_children, &count);
+	shadows[parent_idx].first_child_idx = children[0].idx;
+	for (i = 1; i < count; i++)
+		shadows[children[i-1].idx].next_sibling_idx = children[i].idx;
+	shadows[children[count-1].idx].next_sibling_idx = 0;
+	shadows[parent_idx].children_sorted = TRUE;
 }
 
 static void gather_base_subjects(struct thread_finish_context *ctx)
@@ -610,6 +631,34 @@ mail_thread_iterate_children(struct mail_thread_iterate_context *parent_iter,
 	return child_iter;
 }
 
+static void thread_finish_context_unref(struct thread_finish_context **_ctx)
+{
+	struct thread_finish_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	if (--ctx->refcount > 0) {
+		if (ctx->refcount == 1 && ctx->cache->finish_ctx == ctx) {
+			/* only the cache refers to us anymore, and the mail
+			   is going to be freed */
+			ctx->tmp_mail = NULL;
+		}
+		return;
+	}
+	array_free(&ctx->roots);
+	array_free(&ctx->shadow_nodes);
+	i_free(ctx);
+}
+
+void mail_thread_cache_finish_free(struct mail_thread_cache *cache)
+{
+	struct thread_finish_context *ctx = cache->finish_ctx;
+
+	if (ctx == NULL)
+		return;
+	cache->finish_ctx = NULL;
+	thread_finish_context_unref(&ctx);
+}
+
 struct mail_thread_iterate_context *
 mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 			      struct mail *tmp_mail,
@@ -619,16 +668,30 @@ mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 	struct mail_thread_iterate_context *iter;
 	struct thread_finish_context *ctx;
 
-	iter = i_new(struct mail_thread_iterate_context, 1);
-	ctx = iter->ctx = i_new(struct thread_finish_context, 1);
-	ctx->refcount = 1;
-	ctx->cache = cache;
-	ctx->tmp_mail = tmp_mail;
-	ctx->return_seqs = return_seqs;
-
 	struct event_reason *reason = event_reason_begin("mailbox:thread");
-	mail_thread_finish(ctx, thread_type);
+	if (cache->finish_ctx != NULL &&
+	    cache->finish_thread_type == thread_type) {
+		/* nothing has changed since the tree was last built */
+		ctx = cache->finish_ctx;
+		ctx->refcount++;
+		ctx->tmp_mail = tmp_mail;
+		ctx->return_seqs = return_seqs;
+	} else {
+		mail_thread_cache_finish_free(cache);
+		ctx = i_new(struct thread_finish_context, 1);
+		/* referenced by both the cache and the iterator */
+		ctx->refcount = 2;
+		ctx->cache = cache;
+		ctx->tmp_mail = tmp_mail;
+		ctx->return_seqs = return_seqs;
+		mail_thread_finish(ctx, thread_type);
+
+		cache->finish_ctx = ctx;
+		cache->finish_thread_type = thread_type;
+	}
 
+	iter = i_new(struct mail_thread_iterate_context, 1);
+	iter->ctx = ctx;
 	mail_thread_iterate_fill_root(iter);
 	if (return_seqs)
 		nodes_change_uids_to_seqs(iter, TRUE);
@@ -671,11 +734,7 @@ int mail_thread_iterate_deinit(struct mail_thread_iterate_context **_iter)
 
 	*_iter = NULL;
 
-	if (--iter->ctx->refcount == 0) {
-		array_free(&iter->ctx->roots);
-		array_free(&iter->ctx->shadow_nodes);
-		i_free(iter->ctx);
-	}
+	thread_finish_context_unref(&iter->ctx);
 	array_free(&iter->children);
 	i_free(iter);
 	return 0;
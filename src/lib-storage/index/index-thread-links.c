@@ -152,6 +152,8 @@ void mail_thread_add(struct mail_thread_cache *cache,
 	i_assert(msgid_map->ref_index == MAIL_THREAD_NODE_REF_MSGID);
 	i_assert(cache->last_uid <= msgid_map->uid);
 
+	mail_thread_cache_finish_free(cache);
+
 	cache->last_uid = msgid_map->uid;
 
 	idx = thread_msg_add(cache, msgid_map->uid, msgid_map->str_idx);
@@ -203,6 +205,7 @@ bool mail_thread_remove(struct mail_thread_cache *cache,
 	idx = msgid_map->str_idx;
 	i_assert(idx != 0);
 
+	mail_thread_cache_finish_free(cache);
 	if (msgid_map->uid > cache->last_uid) {
 		/* this message was never added to the cache, skip */
 		while (msgid_map[count].uid == msgid_map->uid)
@@ -56,6 +56,12 @@ struct mail_thread_cache {
 
 	/* indexed by mail_index_strmap_rec.str_idx */
 	ARRAY_TYPE(mail_thread_node) thread_nodes;
+
+	/* Finished thread tree built by the previous
+	   mail_thread_iterate_init_full(). It's reused until the thread nodes
+	   change. */
+	struct thread_finish_context *finish_ctx;
+	enum mail_thread_type finish_thread_type;
 };
 
 static inline uint32_t crc32_str_nonzero(const char *str)
@@ -71,6 +77,10 @@ bool mail_thread_remove(struct mail_thread_cache *cache,
 			const struct mail_index_strmap_rec *msgid_map,
 			unsigned int *msgid_map_idx);
 
+/* Drop the cached finished thread tree. This must be called whenever
+   thread_nodes change. */
+void mail_thread_cache_finish_free(struct mail_thread_cache *cache);
+
 struct mail_thread_iterate_context *
 mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 			      struct mail *tmp_mail,
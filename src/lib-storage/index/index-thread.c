@@ -5,7 +5,6 @@
 #include "lib.h"
 #include "array.h"
 #include "bsearch-insert-pos.h"
-#include "hash2.h"
 #include "message-id.h"
 #include "mail-search.h"
 #include "mail-search-build.h"
@@ -42,7 +41,6 @@ struct mail_thread_mailbox {
 	struct mail_index_strmap_view *strmap_view;
 	/* sorted by UID, ref_index */
 	const ARRAY_TYPE(mail_index_strmap_rec) *msgid_map;
-	const struct hash2_table *msgid_hash;
 
 	/* set only temporarily while needed */
 	struct mail_thread_context *ctx;
@@ -223,6 +221,7 @@ static void mail_thread_strmap_remap(const uint32_t *idx_map,
 	cache->next_invalid_msgid_str_idx = new_first_invalid + invalid_count;
 
 	/* replace the old nodes with the renumbered ones */
+	mail_thread_cache_finish_free(cache);
 	array_free(&cache->thread_nodes);
 	cache->thread_nodes = new_nodes;
 }
@@ -315,8 +314,7 @@ static int mail_thread_index_map_build(struct mail_thread_context *ctx)
 						    mail_thread_hash_key_cmp,
 						    mail_thread_hash_rec_cmp,
 						    mail_thread_strmap_remap,
-						    tbox, &tbox->msgid_map,
-						    &tbox->msgid_hash);
+						    tbox, &tbox->msgid_map);
 	}
 
 	headers_ctx = mailbox_header_lookup_init(ctx->box, wanted_headers);
@@ -468,6 +466,7 @@ mail_thread_cache_fix_invalid_indexes(struct mail_thread_mailbox *tbox)
 			cache->next_invalid_msgid_str_idx = new_first_idx;
 	} else if (highest_idx >= cache->first_invalid_msgid_str_idx) {
 		/* conflict - move the invalid indexes forward */
+		mail_thread_cache_finish_free(cache);
 		array_copy(&cache->thread_nodes.arr, new_first_idx,
 			   &cache->thread_nodes.arr,
 			   cache->first_invalid_msgid_str_idx, count);
@@ -518,6 +517,7 @@ static void mail_thread_cache_sync_add(struct mail_thread_mailbox *tbox,
 	cache->first_invalid_msgid_str_idx = cache->next_invalid_msgid_str_idx =
 		mail_index_strmap_view_get_highest_idx(tbox->strmap_view) + 1 +
 		THREAD_INVALID_MSGID_STR_IDX_SKIP_COUNT;
+	mail_thread_cache_finish_free(cache);
 	array_clear(&cache->thread_nodes);
 
 	cache->search_result =
@@ -627,6 +627,7 @@ static void mail_thread_mailbox_close(struct mailbox *box)
 		mail_index_strmap_view_close(&tbox->strmap_view);
 	if (tbox->cache->search_result != NULL)
 		mailbox_search_result_free(&tbox->cache->search_result);
+	mail_thread_cache_finish_free(tbox->cache);
 	tbox->module_ctx.super.close(box);
 }
 
@@ -637,6 +638,7 @@ static void mail_thread_mailbox_free(struct mailbox *box)
 	mail_index_strmap_deinit(&tbox->strmap);
 	tbox->module_ctx.super.free(box);
 
+	mail_thread_cache_finish_free(tbox->cache);
 	array_free(&tbox->cache->thread_nodes);
 	i_free(tbox->cache);
 	i_free(tbox);
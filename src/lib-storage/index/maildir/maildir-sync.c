@@ -191,18 +191,6 @@
 
 #define MAILDIR_FILENAME_FLAG_FOUND 128
 
-/* When rename()ing many files from new/ to cur/, it's possible that next
-   readdir() skips some files. we don't of course wish to lose them, so we
-   go and rescan the new/ directory again from beginning until no files are
-   left. This value is just an optimization to avoid checking the directory
-   twice needlessly. usually only NFS is the problem case. 1 is the safest
-   bet here, but I guess 5 will do just fine too. */
-#define MAILDIR_RENAME_RESCAN_COUNT 5
-
-/* This is mostly to avoid infinite looping when rename() destination already
-   exists as the hard link of the file itself. */
-#define MAILDIR_SCAN_DIR_MAX_COUNT 5
-
 #define DUPE_LINKS_DELETE_SECS 30
 
 enum maildir_scan_why {
@@ -400,16 +388,60 @@ maildir_stat(struct maildir_mailbox *mbox, const char *path, struct stat *st_r)
 }
 
 static int
-maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
+maildir_read_new_dir(struct maildir_sync_context *ctx, DIR *dirp,
+		     pool_t pool, ARRAY_TYPE(const_string) *fnames)
+{
+	struct dirent *dp;
+	const char *fname;
+
+	errno = 0;
+	for (; (dp = readdir(dirp)) != NULL; errno = 0) {
+		if (dp->d_name[0] == '.')
+			continue;
+		fname = p_strdup(pool, dp->d_name);
+		array_push_back(fnames, &fname);
+	}
+	if (errno != 0) {
+		mailbox_set_critical(&ctx->mbox->box,
+				     "readdir(%s) failed: %m", ctx->new_dir);
+		return -1;
+	}
+	return 0;
+}
+
+static const char *
+maildir_scan_dir_next(DIR *dirp, const ARRAY_TYPE(const_string) *fnames,
+		      unsigned int *idx)
+{
+	struct dirent *dp;
+
+	errno = 0;
+	if (dirp == NULL) {
+		if (*idx == array_count(fnames))
+			return NULL;
+		return array_idx_elem(fnames, (*idx)++);
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] != '.')
+			return dp->d_name;
+		errno = 0;
+	}
+	return NULL;
+}
+
+static int
+maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir,
 		 enum maildir_scan_why why)
 {
-	const char *path;
+	const char *path, *fname;
 	DIR *dirp;
 	string_t *src, *dest;
-	struct dirent *dp;
 	struct stat st;
 	enum maildir_uidlist_rec_flag flags;
-	unsigned int time_diff, i, readdir_count = 0, move_count = 0;
+	pool_t fnames_pool = NULL;
+	ARRAY_TYPE(const_string) fnames = ARRAY_INIT;
+	unsigned int time_diff, i, fname_idx = 0;
+	unsigned int readdir_count = 0, move_count = 0;
 	time_t start_time;
 	int ret = 1;
 	bool move_new, dir_changed = FALSE;
@@ -468,28 +500,47 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 		((ctx->mbox->box.flags & MAILBOX_FLAG_DROP_RECENT) != 0 ||
 		 ctx->mbox->storage->set->maildir_empty_new);
 
-	errno = 0;
-	for (; (dp = readdir(dirp)) != NULL; errno = 0) {
-		if (dp->d_name[0] == '.')
-			continue;
+	if (move_new) {
+		/* read the whole new/ directory before rename()ing anything
+		   out of it. rename()s done in the middle of readdir() could
+		   cause the following readdir()s to skip files, which would
+		   then require rescanning the directory. */
+		fnames_pool = pool_alloconly_create("maildir new/ filenames",
+						    4096);
+		p_array_init(&fnames, fnames_pool, 64);
+		ret = maildir_read_new_dir(ctx, dirp, fnames_pool, &fnames);
+		if (closedir(dirp) < 0) {
+			mailbox_set_critical(&ctx->mbox->box,
+					     "closedir(%s) failed: %m", path);
+			ret = -1;
+		}
+		dirp = NULL;
+		if (ret < 0) {
+			pool_unref(&fnames_pool);
+			return -1;
+		}
+		ret = 1;
+	}
 
-		if (dp->d_name[0] == MAILDIR_INFO_SEP) {
+	while ((fname = maildir_scan_dir_next(dirp, &fnames,
+					      &fname_idx)) != NULL) {
+		if (fname[0] == MAILDIR_INFO_SEP) {
 			/* don't even try to use file with empty base name */
 			if (maildir_rename_empty_basename(ctx, path,
-							  dp->d_name) < 0)
+							  fname) < 0)
 				break;
 			continue;
 		}
 
 		flags = 0;
 		if (move_new) {
-			i_assert(dp->d_name[0] != '\0');
+			i_assert(fname[0] != '\0');
 
 			str_truncate(src, 0);
 			str_truncate(dest, 0);
-			str_printfa(src, "%s/%s", ctx->new_dir, dp->d_name);
-			str_printfa(dest, "%s/%s", ctx->cur_dir, dp->d_name);
-			if (strchr(dp->d_name, MAILDIR_INFO_SEP) == NULL) {
+			str_printfa(src, "%s/%s", ctx->new_dir, fname);
+			str_printfa(dest, "%s/%s", ctx->cur_dir, fname);
+			if (strchr(fname, MAILDIR_INFO_SEP) == NULL) {
 				str_append(dest, MAILDIR_FLAGS_FULL_SEP);
 			}
 			if (rename(str_c(src), str_c(dest)) == 0) {
@@ -527,40 +578,34 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 			maildir_sync_notify(ctx);
 
 		ret = maildir_uidlist_sync_next(ctx->uidlist_sync_ctx,
-						dp->d_name, flags);
+						fname, flags);
 		if (ret <= 0) {
 			if (ret < 0)
 				break;
 
 			/* possibly duplicate - try fixing it */
 			T_BEGIN {
-				ret = maildir_fix_duplicate(ctx, path,
-							    dp->d_name);
+				ret = maildir_fix_duplicate(ctx, path, fname);
 			} T_END;
 			if (ret < 0)
 				break;
 		}
 	}
 
-#ifdef __APPLE__
-	if (errno == EINVAL && move_count > 0 && !final) {
-		/* OS X HFS+: readdir() fails sometimes when rename()
-		   have been done. */
-		move_count = MAILDIR_RENAME_RESCAN_COUNT + 1;
-	} else
-#endif
-
-	if (errno != 0) {
-		mailbox_set_critical(&ctx->mbox->box,
-				     "readdir(%s) failed: %m", path);
-		ret = -1;
-	}
+	if (dirp != NULL) {
+		if (errno != 0) {
+			mailbox_set_critical(&ctx->mbox->box,
+					     "readdir(%s) failed: %m", path);
+			ret = -1;
+		}
 
-	if (closedir(dirp) < 0) {
-		mailbox_set_critical(&ctx->mbox->box,
-				     "closedir(%s) failed: %m", path);
-		ret = -1;
+		if (closedir(dirp) < 0) {
+			mailbox_set_critical(&ctx->mbox->box,
+					     "closedir(%s) failed: %m", path);
+			ret = -1;
+		}
 	}
+	pool_unref(&fnames_pool);
 
 	if (dir_changed) {
 		/* save the exact new times. the new mtimes should be >=
@@ -587,9 +632,7 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 			  "(%u readdir()s, %u rename()s to cur/, why=0x%x)",
 			  path, time_diff, readdir_count, move_count, why);
 	}
-
-	return ret < 0 ? -1 :
-		(move_count <= MAILDIR_RENAME_RESCAN_COUNT || final ? 0 : 1);
+	return ret < 0 ? -1 : 0;
 }
 
 static void maildir_sync_get_header(struct maildir_mailbox *mbox)
@@ -915,21 +958,11 @@ maildir_sync_context(struct maildir_sync_context *ctx, bool forced,
 	if (new_changed || cur_changed) {
 		/* if we're going to check cur/ dir our current logic requires
 		   that new/ dir is checked as well. it's a good idea anyway. */
-		unsigned int count = 0;
-		bool final = FALSE;
-
-		while ((ret = maildir_scan_dir(ctx, TRUE, final, why)) > 0) {
-			/* rename()d at least some files, which might have
-			   caused some other files to be missed. check again
-			   (see MAILDIR_RENAME_RESCAN_COUNT). */
-			if (++count >= MAILDIR_SCAN_DIR_MAX_COUNT)
-				final = TRUE;
-		}
-		if (ret < 0)
+		if (maildir_scan_dir(ctx, TRUE, why) < 0)
 			return -1;
 
 		if (cur_changed) {
-			if (maildir_scan_dir(ctx, FALSE, TRUE, why) < 0)
+			if (maildir_scan_dir(ctx, FALSE, why) < 0)
 				return -1;
 		}
 
@@ -46,6 +46,9 @@
 
 #define UIDLIST_VERSION 3
 #define UIDLIST_COMPRESS_PERCENTAGE 75
+/* Used for estimating the number of records in a uidlist file from its size
+   when sizing the filename hash table. Lines are usually a bit longer. */
+#define UIDLIST_ESTIMATED_LINE_LEN 64
 
 #define UIDLIST_IS_LOCKED(uidlist) \
 	((uidlist)->lock_count > 0)
@@ -495,7 +498,15 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 
 	while (*line == ' ') line++;
 
-	if (uidlist->version == UIDLIST_VERSION) {
+	if (uidlist->version == UIDLIST_VERSION && *line == ':') {
+		/* no extended fields - the common case */
+		if (line[1] == '\0') {
+			maildir_uidlist_set_corrupted(uidlist,
+				"Invalid extended fields: %s", line);
+			return FALSE;
+		}
+		line++;
+	} else if (uidlist->version == UIDLIST_VERSION) {
 		/* read extended fields */
 		bool ret;
 
@@ -760,6 +771,19 @@ maildir_uidlist_update_read(struct maildir_uidlist *uidlist,
 							    st.st_size/8));
 	}
 
+	if (last_read_offset == 0 && hash_table_count(uidlist->files) == 0 &&
+	    st.st_size / UIDLIST_ESTIMATED_LINE_LEN > 4096) {
+		/* reading a large uidlist from scratch. size the hash table
+		   for all of its records immediately instead of growing and
+		   rehashing it over and over again while reading. */
+		hash_table_destroy(&uidlist->files);
+		hash_table_create(&uidlist->files, default_pool,
+				  (unsigned int)(st.st_size /
+						 UIDLIST_ESTIMATED_LINE_LEN),
+				  maildir_filename_base_hash,
+				  maildir_filename_base_cmp);
+	}
+
 	input = i_stream_create_fd(fd, SIZE_MAX);
 	i_stream_seek(input, last_read_offset);
 
@@ -1652,9 +1676,13 @@ int maildir_uidlist_sync_init(struct maildir_uidlist *uidlist,
 	}
 	i_assert(uidlist->locked_refresh);
 
+	/* size the hash table for all the existing files, so it doesn't
+	   need to be rehashed over and over again while a large maildir is
+	   being scanned */
 	ctx->record_pool = pool_alloconly_create(MEMPOOL_GROWING
 						 "maildir_uidlist_sync", 16384);
-	hash_table_create(&ctx->files, ctx->record_pool, 4096,
+	hash_table_create(&ctx->files, ctx->record_pool,
+			  I_MAX(array_count(&uidlist->records), 4096U),
 			  maildir_filename_base_hash,
 			  maildir_filename_base_cmp);
 
@@ -1594,6 +1594,27 @@ static void mbox_sync_restart(struct mbox_sync_context *sync_ctx)
 	sync_ctx->errors = FALSE;
 }
 
+static void mbox_sync_advise_sequential(struct mbox_sync_context *sync_ctx)
+{
+/* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+	int ret;
+
+	/* Full syncs read the whole file from beginning to end. With large
+	   mboxes this is mostly waiting for disk reads, so ask the kernel to
+	   read ahead more aggressively. Partial syncs only seek to the mails
+	   that have changes, so they're left alone. */
+	if (sync_ctx->mbox->mbox_fd == -1)
+		return;
+	ret = posix_fadvise(sync_ctx->mbox->mbox_fd, 0, 0,
+			    POSIX_FADV_SEQUENTIAL);
+	if (ret != 0) {
+		errno = ret;
+		mbox_set_syscall_error(sync_ctx->mbox, "posix_fadvise()");
+	}
+#endif
+}
+
 static int mbox_sync_do(struct mbox_sync_context *sync_ctx,
 			enum mbox_sync_flags flags)
 {
@@ -1641,6 +1662,9 @@ static int mbox_sync_do(struct mbox_sync_context *sync_ctx,
 		sync_ctx->mbox->mbox_hdr.dirty_flag = 1;
 	}
 
+	if (!partial)
+		mbox_sync_advise_sequential(sync_ctx);
+
 	mbox_sync_restart(sync_ctx);
 	for (i = 0;;) {
 		ret = mbox_sync_loop(sync_ctx, &mail_ctx, partial);
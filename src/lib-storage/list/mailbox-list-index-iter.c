@@ -1,6 +1,7 @@
 /* Copyright (c) 2006-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "imap-match.h"
 #include "mail-storage.h"
@@ -32,6 +33,119 @@ static bool iter_use_index(struct mailbox_list *list,
 	return TRUE;
 }
 
+static void
+mailbox_list_get_escaped_mailbox_name(struct mailbox_list *list,
+				      const char *raw_name,
+				      string_t *escaped_name)
+{
+	const char escape_chars[] = {
+		list->set.storage_name_escape_char,
+		mailbox_list_get_hierarchy_sep(list),
+		'\0'
+	};
+	mailbox_list_name_escape(raw_name, escape_chars, escaped_name);
+}
+
+static void
+mailbox_list_index_iter_append_path(struct mailbox_list_index_iterate_context *ctx,
+				    const struct mailbox_list_index_node *node)
+{
+	if (node->parent != NULL) {
+		mailbox_list_index_iter_append_path(ctx, node->parent);
+		str_append_c(ctx->path,
+			     mailbox_list_get_hierarchy_sep(ctx->ctx.list));
+	}
+	mailbox_list_get_escaped_mailbox_name(ctx->ctx.list, node->raw_name,
+					      ctx->path);
+}
+
+static void
+mailbox_list_index_iter_set_next(struct mailbox_list_index_iterate_context *ctx,
+				 struct mailbox_list_index_node *node)
+{
+	/* start listing from the node instead of the root */
+	str_truncate(ctx->path, 0);
+	if (node->parent != NULL)
+		mailbox_list_index_iter_append_path(ctx, node->parent);
+	ctx->parent_len = str_len(ctx->path);
+	ctx->next_node = node;
+}
+
+static const char *
+iter_patterns_get_parent(const char *const *patterns, char ns_sep)
+{
+	const char *parent = NULL;
+	size_t len;
+	unsigned int i;
+
+	/* Get the mailbox that all the patterns' matches are under, i.e. the
+	   common non-wildcard prefix up to the last separator. */
+	for (i = 0; patterns[i] != NULL; i++) {
+		len = strcspn(patterns[i], "*%");
+		while (len > 0 && patterns[i][len-1] != ns_sep)
+			len--;
+		if (len <= 1)
+			return NULL;
+		if (parent == NULL)
+			parent = t_strndup(patterns[i], len - 1);
+		else if (strlen(parent) != len - 1 ||
+			 strncmp(parent, patterns[i], len - 1) != 0)
+			return NULL;
+	}
+	return parent;
+}
+
+static void
+mailbox_list_index_iter_init_subtree(struct mailbox_list_index_iterate_context *ctx,
+				     const char *const *patterns, char ns_sep)
+{
+	struct mail_namespace *ns = ctx->ctx.list->ns;
+	struct mailbox_list_index_node *node;
+	const char *vname, *name;
+
+	vname = iter_patterns_get_parent(patterns, ns_sep);
+	if (vname == NULL || strncmp(vname, ns->prefix, ns->prefix_len) != 0 ||
+	    vname[ns->prefix_len] == '\0' ||
+	    strncasecmp(vname + ns->prefix_len, "INBOX", 5) == 0) {
+		/* INBOX needs special handling with namespace prefixes */
+		return;
+	}
+	/* Everything that can match is under this mailbox, so there's no
+	   need to walk through all the other mailboxes. */
+	name = mailbox_list_get_storage_name(ctx->ctx.list, vname);
+	node = mailbox_list_index_lookup(ctx->ctx.list, name);
+	if (node == NULL)
+		ctx->next_node = NULL;
+	else {
+		mailbox_list_index_iter_set_next(ctx, node);
+		ctx->subtree_root = node;
+	}
+}
+
+static void
+mailbox_list_index_iter_init_special_use(struct mailbox_list_index_iterate_context *ctx)
+{
+	struct mail_namespace *ns = ctx->ctx.list->ns;
+	struct mailbox_list_index_node *node;
+	struct mailbox_settings *box_set;
+	const char *name;
+
+	/* Only mailboxes with special_use setting can match, so look them up
+	   directly instead of going through all the mailboxes. */
+	p_array_init(&ctx->select_nodes, ctx->ctx.pool, 8);
+	if (!ns->special_use_mailboxes)
+		return;
+	array_foreach_elem(&ns->set->mailboxes, box_set) {
+		if (*box_set->special_use == '\0' || *box_set->name == '\0')
+			continue;
+		name = mailbox_list_get_storage_name(ctx->ctx.list,
+			t_strconcat(ns->prefix, box_set->name, NULL));
+		node = mailbox_list_index_lookup(ctx->ctx.list, name);
+		if (node != NULL)
+			array_push_back(&ctx->select_nodes, &node);
+	}
+}
+
 struct mailbox_list_iterate_context *
 mailbox_list_index_iter_init(struct mailbox_list *list,
 			     const char *const *patterns,
@@ -63,20 +177,16 @@ mailbox_list_index_iter_init(struct mailbox_list *list,
 	ctx->next_node = ilist->mailbox_tree;
 	ctx->mailbox_pool = ilist->mailbox_pool;
 	pool_ref(ctx->mailbox_pool);
-	return &ctx->ctx;
-}
 
-static void
-mailbox_list_get_escaped_mailbox_name(struct mailbox_list *list,
-				      const char *raw_name,
-				      string_t *escaped_name)
-{
-	const char escape_chars[] = {
-		list->set.storage_name_escape_char,
-		mailbox_list_get_hierarchy_sep(list),
-		'\0'
-	};
-	mailbox_list_name_escape(raw_name, escape_chars, escaped_name);
+	T_BEGIN {
+		if ((flags & (MAILBOX_LIST_ITER_SELECT_SPECIALUSE |
+			      MAILBOX_LIST_ITER_SELECT_RECURSIVEMATCH)) ==
+		    MAILBOX_LIST_ITER_SELECT_SPECIALUSE)
+			mailbox_list_index_iter_init_special_use(ctx);
+		else
+			mailbox_list_index_iter_init_subtree(ctx, patterns, ns_sep);
+	} T_END;
+	return &ctx->ctx;
 }
 
 static void
@@ -158,7 +268,7 @@ mailbox_list_index_update_next(struct mailbox_list_index_iterate_context *ctx,
 		ctx->parent_len = str_len(ctx->path);
 		ctx->next_node = node->children;
 	} else {
-		while (node->next == NULL) {
+		while (node != ctx->subtree_root && node->next == NULL) {
 			node = node->parent;
 			if (node != NULL) {
 				/* The storage name kept in the iteration context
@@ -180,6 +290,11 @@ mailbox_list_index_update_next(struct mailbox_list_index_iterate_context *ctx,
 				return;
 			}
 		}
+		if (node == ctx->subtree_root) {
+			/* the whole subtree was listed */
+			ctx->next_node = NULL;
+			return;
+		}
 		ctx->next_node = node->next;
 	}
 }
@@ -213,6 +328,20 @@ mailbox_list_index_iter_next(struct mailbox_list_iterate_context *_ctx)
 	bool follow_children;
 	enum imap_match_result match;
 
+	if (array_is_created(&ctx->select_nodes)) {
+		/* listing only the selected mailboxes */
+		while (ctx->select_idx < array_count(&ctx->select_nodes)) {
+			mailbox_list_index_iter_set_next(ctx,
+				array_idx_elem(&ctx->select_nodes,
+					       ctx->select_idx++));
+			mailbox_list_index_update_info(ctx);
+			if (imap_match(_ctx->glob, ctx->info.vname) == IMAP_MATCH_YES &&
+			    iter_subscriptions_ok(ctx))
+				return &ctx->info;
+		}
+		return mailbox_list_iter_default_next(_ctx);
+	}
+
 	/* listing mailboxes from index */
 	while (ctx->next_node != NULL) {
 		mailbox_list_index_update_info(ctx);
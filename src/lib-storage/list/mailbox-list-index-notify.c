@@ -56,6 +56,7 @@ struct mailbox_list_notify_index {
 	unsigned int rename_idx, subscription_idx, unsubscription_idx;
 
 	struct mailbox_list_notify_rec notify_rec;
+	struct mailbox_status notify_status;
 	string_t *rec_name;
 
 	char *list_log_path, *inbox_log_path;
@@ -65,6 +66,8 @@ struct mailbox_list_notify_index {
 	bool initialized:1;
 	bool read_failed:1;
 	bool inbox_event_pending:1;
+	/* the last notify_lookup_guid() found all the wanted status items */
+	bool status_found:1;
 };
 
 static const enum mailbox_status_items notify_status_items =
@@ -230,8 +233,9 @@ notify_lookup_guid(struct mailbox_list_notify_index *inotify,
 	/* get GUID */
 	i_zero(status_r);
 	memset(guid_r, 0, GUID_128_SIZE);
-	(void)mailbox_list_index_status(inotify->notify.list, view, seq,
-					items, status_r, guid_r, NULL);
+	inotify->status_found =
+		mailbox_list_index_status(inotify->notify.list, view, seq,
+					  items, status_r, guid_r, NULL);
 	return index_node;
 }
 
@@ -765,6 +769,12 @@ mailbox_list_index_notify_change(struct mailbox_list_notify_index *inotify,
 	rec->events |= mailbox_list_index_get_changed_events(nnode, &status);
 	/* update internal state */
 	mailbox_notify_node_update_status(nnode, &status);
+	if (inotify->status_found) {
+		/* the caller can use this status instead of opening the
+		   mailbox */
+		inotify->notify_status = status;
+		rec->status = &inotify->notify_status;
+	}
 	return rec->events != 0;
 }
 
@@ -809,9 +819,10 @@ mailbox_list_index_notify_try_next(struct mailbox_list_notify_index *inotify)
 }
 
 static enum mailbox_list_notify_event
-mailbox_list_notify_inbox_get_events(struct mailbox_list_notify_index *inotify)
+mailbox_list_notify_inbox_get_events(struct mailbox_list_notify_index *inotify,
+				     struct mailbox_status *new_status_r)
 {
-	struct mailbox_status old_status, new_status;
+	struct mailbox_status old_status;
 	struct mailbox_notify_node old_nnode;
 
 	mailbox_get_open_status(inotify->inbox, notify_status_items, &old_status);
@@ -821,10 +832,11 @@ mailbox_list_notify_inbox_get_events(struct mailbox_list_notify_index *inotify)
 			mailbox_get_last_internal_error(inotify->inbox, NULL));
 		return 0;
 	}
-	mailbox_get_open_status(inotify->inbox, notify_status_items, &new_status);
+	mailbox_get_open_status(inotify->inbox, notify_status_items,
+				new_status_r);
 
 	mailbox_notify_node_update_status(&old_nnode, &old_status);
-	return mailbox_list_index_get_changed_events(&old_nnode, &new_status);
+	return mailbox_list_index_get_changed_events(&old_nnode, new_status_r);
 }
 
 int mailbox_list_index_notify_next(struct mailbox_list_notify *notify,
@@ -852,7 +864,10 @@ int mailbox_list_index_notify_next(struct mailbox_list_notify *notify,
 		inotify->notify_rec.vname = "INBOX";
 		inotify->notify_rec.storage_name = "INBOX";
 		inotify->notify_rec.events =
-			mailbox_list_notify_inbox_get_events(inotify);
+			mailbox_list_notify_inbox_get_events(inotify,
+				&inotify->notify_status);
+		if (inotify->notify_rec.events != 0)
+			inotify->notify_rec.status = &inotify->notify_status;
 		*rec_r = &inotify->notify_rec;
 		return 1;
 	}
@@ -11,6 +11,11 @@ struct index_list_mailbox {
 
 	uint32_t pre_sync_log_file_seq;
 	uoff_t pre_sync_log_file_head_offset;
+	/* ioloop_timeval when list_index_has_changed() last said that the
+	   mailbox's list index record is up-to-date. The check isn't repeated
+	   until the ioloop is run again, so e.g. STATUS looking up both the
+	   status and the metadata stat()s the mailbox index only once. */
+	struct timeval last_unchanged_check;
 
 	bool have_backend:1;
 };
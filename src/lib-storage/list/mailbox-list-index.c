@@ -4,7 +4,9 @@
 #include "ioloop.h"
 #include "hash.h"
 #include "str.h"
+#include "time-util.h"
 #include "mail-index-view-private.h"
+#include "mail-transaction-log.h"
 #include "mail-storage-hooks.h"
 #include "mail-storage-private.h"
 #include "mailbox-list-index-storage.h"
@@ -473,6 +475,126 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 	return *error_r == NULL ? 0 : -1;
 }
 
+static bool
+mailbox_list_index_is_list_ext_intro(struct mailbox_list_index *ilist,
+				     struct mail_index_view *view,
+				     const struct mail_transaction_ext_intro *intro)
+{
+	const struct mail_index_registered_ext *rext =
+		array_idx(&ilist->index->extensions, ilist->ext_id);
+	const struct mail_index_ext *ext;
+
+	if (intro->name_size > 0) {
+		return intro->name_size == strlen(rext->name) &&
+			memcmp(intro + 1, rext->name, intro->name_size) == 0;
+	}
+	if (!array_is_created(&view->map->extensions) ||
+	    intro->ext_id >= array_count(&view->map->extensions)) {
+		/* unknown - assume it's the list extension */
+		return TRUE;
+	}
+	ext = array_idx(&view->map->extensions, intro->ext_id);
+	return ext->index_idx == ilist->ext_id;
+}
+
+static bool
+mailbox_list_index_update_flags(struct mailbox_list_index *ilist,
+				struct mail_index_view *view,
+				const struct mail_transaction_flag_update *u)
+{
+	struct mailbox_list_index_node *node;
+	const struct mail_index_record *rec;
+	uint32_t seq, seq1, seq2;
+
+	if (!mail_index_lookup_seq_range(view, u->uid1, u->uid2, &seq1, &seq2))
+		return TRUE;
+	for (seq = seq1; seq <= seq2; seq++) {
+		rec = mail_index_lookup(view, seq);
+		node = mailbox_list_index_lookup_uid(ilist, rec->uid);
+		if (node == NULL)
+			return FALSE;
+		node->flags = rec->flags;
+	}
+	return TRUE;
+}
+
+static bool
+mailbox_list_index_parse_log_changes(struct mailbox_list_index *ilist,
+				     struct mail_index_view *view,
+				     const struct mail_index_header *hdr)
+{
+	struct mail_transaction_log_view *log_view;
+	const struct mail_transaction_header *thdr;
+	const void *tdata;
+	const char *reason;
+	bool reset, list_ext = FALSE, ret = TRUE;
+
+	if (ilist->mailbox_tree == NULL || ilist->sync_log_file_seq == 0)
+		return FALSE;
+
+	/* Most of the list index changes are mailbox status updates, which
+	   don't affect the mailbox tree. Reparsing all the records for them
+	   is slow with a lot of mailboxes, so look at the transaction log to
+	   see if anything else changed. */
+	log_view = mail_transaction_log_view_open(ilist->index->log);
+	if (mail_transaction_log_view_set(log_view,
+					  ilist->sync_log_file_seq,
+					  ilist->sync_log_file_offset,
+					  hdr->log_file_seq,
+					  hdr->log_file_head_offset,
+					  &reset, &reason) <= 0 || reset) {
+		mail_transaction_log_view_close(&log_view);
+		return FALSE;
+	}
+	while (ret && mail_transaction_log_view_next(log_view, &thdr,
+						     &tdata) > 0) {
+		switch (thdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+		case MAIL_TRANSACTION_FLAG_UPDATE: {
+			const struct mail_transaction_flag_update *rec, *end;
+
+			/* without a backing store the flags may have been
+			   fixed while parsing */
+			if (!ilist->has_backing_store) {
+				ret = FALSE;
+				break;
+			}
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; ret && rec < end; rec++)
+				ret = mailbox_list_index_update_flags(ilist, view, rec);
+			break;
+		}
+		case MAIL_TRANSACTION_EXT_INTRO:
+			list_ext = mailbox_list_index_is_list_ext_intro(ilist,
+								view, tdata);
+			break;
+		case MAIL_TRANSACTION_EXT_RESET:
+		case MAIL_TRANSACTION_EXT_HDR_UPDATE:
+		case MAIL_TRANSACTION_EXT_HDR_UPDATE32:
+		case MAIL_TRANSACTION_EXT_REC_UPDATE:
+		case MAIL_TRANSACTION_EXT_ATOMIC_INC:
+			/* names and parents are in the list extension */
+			if (list_ext)
+				ret = FALSE;
+			break;
+		case MAIL_TRANSACTION_HEADER_UPDATE:
+		case MAIL_TRANSACTION_KEYWORD_UPDATE:
+		case MAIL_TRANSACTION_KEYWORD_RESET:
+		case MAIL_TRANSACTION_MODSEQ_UPDATE:
+		case MAIL_TRANSACTION_INDEX_DELETED:
+		case MAIL_TRANSACTION_INDEX_UNDELETED:
+		case MAIL_TRANSACTION_BOUNDARY:
+		case MAIL_TRANSACTION_ATTRIBUTE_UPDATE:
+			break;
+		default:
+			/* appends, expunges, etc. */
+			ret = FALSE;
+			break;
+		}
+	}
+	mail_transaction_log_view_close(&log_view);
+	return ret;
+}
+
 int mailbox_list_index_parse(struct mailbox_list *list,
 			     struct mail_index_view *view, bool force)
 {
@@ -492,6 +614,12 @@ int mailbox_list_index_parse(struct mailbox_list *list,
 			"Mailbox list index was marked as fsck'd %s", ilist->path);
 		ilist->call_corruption_callback = TRUE;
 	}
+	if (!force && mailbox_list_index_parse_log_changes(ilist, view, hdr)) {
+		/* mailbox tree didn't change */
+		ilist->sync_log_file_seq = hdr->log_file_seq;
+		ilist->sync_log_file_offset = hdr->log_file_head_offset;
+		return 0;
+	}
 
 	mailbox_list_index_reset(ilist);
 	ilist->sync_log_file_seq = hdr->log_file_seq;
@@ -731,6 +859,7 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 				 uint32_t *seq_r)
 {
 	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT(box->list);
+	struct index_list_mailbox *ibox;
 	struct mailbox_list_index_node *node;
 	struct mail_index_view *view;
 	uint32_t seq;
@@ -740,6 +869,7 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 		/* mailbox list indexes aren't enabled */
 		return 0;
 	}
+	ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 	if (MAILBOX_IS_NEVER_IN_INDEX(box) && require_refreshed) {
 		/* Optimization: Caller wants the list index to be up-to-date
 		   for this mailbox, but this mailbox isn't updated to the list
@@ -768,9 +898,15 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 	} else if (!require_refreshed) {
 		/* this operation doesn't need the index to be up-to-date */
 		ret = 0;
+	} else if (timeval_cmp(&ibox->last_unchanged_check,
+			       &ioloop_timeval) == 0) {
+		/* already checked since the last ioloop run */
+		ret = 0;
 	} else T_BEGIN {
 		ret = box->v.list_index_has_changed == NULL ? 0 :
 			box->v.list_index_has_changed(box, view, seq, FALSE);
+		if (ret == 0)
+			ibox->last_unchanged_check = ioloop_timeval;
 	} T_END;
 
 	if (ret != 0) {
@@ -1089,6 +1225,8 @@ mailbox_list_index_sync_init(struct mailbox *box,
 {
 	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
 
+	/* syncing may change the list index record */
+	i_zero(&ibox->last_unchanged_check);
 	mailbox_list_index_status_sync_init(box);
 	if (!ibox->have_backend)
 		mailbox_list_index_backend_sync_init(box, flags);
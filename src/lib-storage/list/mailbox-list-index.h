@@ -144,6 +144,11 @@ struct mailbox_list_index_iterate_context {
 	size_t parent_len;
 	string_t *path;
 	struct mailbox_list_index_node *next_node;
+	/* If non-NULL, list only this node and its children */
+	struct mailbox_list_index_node *subtree_root;
+	/* If created, list only these nodes (SPECIAL-USE selection) */
+	ARRAY(struct mailbox_list_index_node *) select_nodes;
+	unsigned int select_idx;
 
 	bool failed:1;
 	bool prefix_inbox_list:1;
@@ -0,0 +1,84 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "mail-attachment-cache.h"
+
+struct mail_attachment_cache {
+	pool_t pool;
+	/* Mails typically have only a few attachments, so there's no need
+	   for anything fancier than an array. */
+	ARRAY(struct mail_attachment_cache_entry) entries;
+};
+
+struct mail_attachment_cache *mail_attachment_cache_init(void)
+{
+	struct mail_attachment_cache *cache;
+	pool_t pool;
+
+	pool = pool_alloconly_create("mail attachment cache", 1024);
+	cache = p_new(pool, struct mail_attachment_cache, 1);
+	cache->pool = pool;
+	p_array_init(&cache->entries, pool, 8);
+	return cache;
+}
+
+void mail_attachment_cache_deinit(struct mail_attachment_cache **_cache)
+{
+	struct mail_attachment_cache *cache = *_cache;
+
+	if (cache == NULL)
+		return;
+	*_cache = NULL;
+	pool_unref(&cache->pool);
+}
+
+static const struct mail_attachment_cache_entry *
+mail_attachment_cache_find(struct mail_attachment_cache *cache,
+			   const char *set_key, uoff_t start_offset)
+{
+	const struct mail_attachment_cache_entry *entry;
+
+	array_foreach(&cache->entries, entry) {
+		if (entry->start_offset == start_offset &&
+		    strcmp(entry->set_key, set_key) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+bool mail_attachment_cache_have(struct mail_attachment_cache *cache,
+				const char *set_key, uoff_t start_offset)
+{
+	return mail_attachment_cache_find(cache, set_key, start_offset) != NULL;
+}
+
+const struct mail_attachment_cache_entry *
+mail_attachment_cache_lookup(struct mail_attachment_cache *cache,
+			     const char *set_key, uoff_t start_offset,
+			     uoff_t part_size, uint32_t part_crc32)
+{
+	const struct mail_attachment_cache_entry *entry;
+
+	entry = mail_attachment_cache_find(cache, set_key, start_offset);
+	if (entry == NULL || entry->part_size != part_size ||
+	    entry->part_crc32 != part_crc32)
+		return NULL;
+	return entry;
+}
+
+void mail_attachment_cache_add(struct mail_attachment_cache *cache,
+			       const struct mail_attachment_cache_entry *entry)
+{
+	struct mail_attachment_cache_entry *new_entry;
+
+	if (mail_attachment_cache_have(cache, entry->set_key,
+				       entry->start_offset))
+		return;
+
+	new_entry = array_append_space(&cache->entries);
+	*new_entry = *entry;
+	new_entry->set_key = p_strdup(cache->pool, entry->set_key);
+	new_entry->hash = p_strdup(cache->pool, entry->hash);
+	new_entry->path = p_strdup(cache->pool, entry->path);
+}
@@ -0,0 +1,48 @@
+#ifndef MAIL_ATTACHMENT_CACHE_H
+#define MAIL_ATTACHMENT_CACHE_H
+
+/* Remembers the attachments that were extracted while saving a mail, so that
+   saving the same mail again (e.g. for another LMTP recipient) can reuse the
+   already written attachment files instead of base64-decoding, hashing and
+   writing them again. */
+
+struct mail_attachment_cache_entry {
+	/* Attachment settings (attachment_dir, fs, hash format, min_size)
+	   that were used to extract the attachment. The attachment can be
+	   reused only with identical settings. */
+	const char *set_key;
+
+	/* Offset of the MIME part body within the saved mail */
+	uoff_t start_offset;
+	/* Size and crc32 of the MIME part body */
+	uoff_t part_size;
+	uint32_t part_crc32;
+
+	/* Extraction result - see struct mail_attachment_extref */
+	const char *hash;
+	/* Path without attachment_dir/ prefix */
+	const char *path;
+	uoff_t encoded_size;
+	unsigned int base64_blocks_per_line;
+	bool base64_have_crlf;
+};
+
+struct mail_attachment_cache *mail_attachment_cache_init(void);
+void mail_attachment_cache_deinit(struct mail_attachment_cache **cache);
+
+/* Returns TRUE if there is an attachment starting at start_offset that was
+   extracted with the same settings. */
+bool mail_attachment_cache_have(struct mail_attachment_cache *cache,
+				const char *set_key, uoff_t start_offset);
+/* Returns the attachment matching all the given parameters, or NULL if it
+   isn't found. */
+const struct mail_attachment_cache_entry *
+mail_attachment_cache_lookup(struct mail_attachment_cache *cache,
+			     const char *set_key, uoff_t start_offset,
+			     uoff_t part_size, uint32_t part_crc32);
+/* Add a new extracted attachment to the cache. If there's already an
+   attachment at the same offset, the old one is kept. */
+void mail_attachment_cache_add(struct mail_attachment_cache *cache,
+			       const struct mail_attachment_cache_entry *entry);
+
+#endif
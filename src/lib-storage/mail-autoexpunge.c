@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "imap-match.h"
 #include "mailbox-list-iter.h"
 #include "mail-storage-private.h"
 #include "mail-namespace.h"
@@ -121,19 +122,14 @@ mailbox_autoexpunge_batch(struct mailbox *box,
 	return (done || count == 0) ? 0 : 1;
 }
 
+/* Returns 1 if the mailbox may have mails to autoexpunge, 0 if not,
+   -1 on error. */
 static int
-mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
-		    unsigned int max_mails, unsigned int *expunged_count)
+mailbox_autoexpunge_want(struct mailbox *box, unsigned int interval_time,
+			 unsigned int max_mails, time_t expire_time)
 {
 	struct mailbox_metadata metadata;
 	struct mailbox_status status;
-	time_t expire_time;
-	int ret;
-
-	if ((unsigned int)ioloop_time < interval_time)
-		expire_time = 0;
-	else
-		expire_time = ioloop_time - interval_time;
 
 	/* first try to check quickly from mailbox list index if we should
 	   bother opening this mailbox. */
@@ -155,6 +151,26 @@ mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
 		    metadata.first_save_date > expire_time)
 			return 0;
 	}
+	return 1;
+}
+
+static time_t mailbox_autoexpunge_get_expire_time(unsigned int interval_time)
+{
+	if ((unsigned int)ioloop_time < interval_time)
+		return 0;
+	return ioloop_time - interval_time;
+}
+
+static int
+mailbox_autoexpunge(struct mailbox *box, unsigned int interval_time,
+		    unsigned int max_mails, unsigned int *expunged_count)
+{
+	time_t expire_time = mailbox_autoexpunge_get_expire_time(interval_time);
+	int ret;
+
+	if ((ret = mailbox_autoexpunge_want(box, interval_time, max_mails,
+					    expire_time)) <= 0)
+		return ret;
 
 	if (mailbox_sync(box, MAILBOX_SYNC_FLAG_FAST) < 0)
 		return -1;
@@ -174,13 +190,33 @@ mailbox_autoexpunge_set(struct mail_namespace *ns, const char *vname,
 			unsigned int *expunged_count)
 {
 	struct mailbox *box;
+	const char *error;
+	int ret;
 
 	/* autoexpunge is configured by admin, so we can safely ignore
 	   any ACLs the user might normally have against expunging in
 	   the mailbox. */
 	box = mailbox_alloc(ns->list, vname, MAILBOX_FLAG_IGNORE_ACLS);
-	if (mailbox_autoexpunge(box, autoexpunge, autoexpunge_max_mails,
-				expunged_count) < 0) {
+	if (box->storage->set->mail_autoexpunge_background) {
+		/* Only check from the mailbox list index whether there's
+		   anything to do. The indexer does the actual expunging. */
+		ret = mailbox_autoexpunge_want(box, autoexpunge,
+			autoexpunge_max_mails,
+			mailbox_autoexpunge_get_expire_time(autoexpunge));
+		if (ret > 0 && mailbox_notify_indexer(box, &error) < 0) {
+			e_error(box->event, "autoexpunge: "
+				"Can't expunge in background: %s", error);
+			/* do it now instead */
+			ret = mailbox_autoexpunge(box, autoexpunge,
+						  autoexpunge_max_mails,
+						  expunged_count);
+		}
+	} else {
+		ret = mailbox_autoexpunge(box, autoexpunge,
+					  autoexpunge_max_mails,
+					  expunged_count);
+	}
+	if (ret < 0) {
 		e_error(box->event, "Failed to autoexpunge: %s",
 			mailbox_get_last_internal_error(box, NULL));
 	}
@@ -213,6 +249,16 @@ mailbox_autoexpunge_wildcards(struct mail_namespace *ns,
 	}
 }
 
+static const char *
+mailbox_autoexpunge_get_vname(struct mail_namespace *ns,
+			      const struct mailbox_settings *box_set)
+{
+	if (box_set->name[0] == '\0' && ns->prefix_len > 0 &&
+	    ns->prefix[ns->prefix_len-1] == mail_namespace_get_sep(ns))
+		return t_strndup(ns->prefix, ns->prefix_len - 1);
+	return t_strconcat(ns->prefix, box_set->name, NULL);
+}
+
 static bool
 mail_namespace_autoexpunge(struct mail_namespace *ns, struct file_lock **lock,
 			   unsigned int *expunged_count)
@@ -234,11 +280,7 @@ mail_namespace_autoexpunge(struct mail_namespace *ns, struct file_lock **lock,
 		if (strpbrk(box_set->name, "*?") != NULL)
 			mailbox_autoexpunge_wildcards(ns, box_set, expunged_count);
 		else {
-			if (box_set->name[0] == '\0' && ns->prefix_len > 0 &&
-			    ns->prefix[ns->prefix_len-1] == mail_namespace_get_sep(ns))
-				vname = t_strndup(ns->prefix, ns->prefix_len - 1);
-			else
-				vname = t_strconcat(ns->prefix, box_set->name, NULL);
+			vname = mailbox_autoexpunge_get_vname(ns, box_set);
 			mailbox_autoexpunge_set(ns, vname, box_set->autoexpunge,
 						box_set->autoexpunge_max_mails,
 						expunged_count);
@@ -265,3 +307,67 @@ unsigned int mail_user_autoexpunge(struct mail_user *user)
 	file_lock_free(&lock);
 	return expunged_count;
 }
+
+static const struct mailbox_settings *
+mailbox_autoexpunge_find_set(struct mailbox *box)
+{
+	struct mail_namespace *ns = mailbox_get_namespace(box);
+	const struct mailbox_settings *box_set;
+	struct imap_match_glob *glob;
+
+	if (!array_is_created(&ns->set->mailboxes))
+		return NULL;
+
+	array_foreach_elem(&ns->set->mailboxes, box_set) {
+		if (box_set->autoexpunge == 0 &&
+		    box_set->autoexpunge_max_mails == 0)
+			continue;
+
+		if (strpbrk(box_set->name, "*?") != NULL) {
+			/* same matching as mailbox_list_iter_init() */
+			glob = imap_match_init(pool_datastack_create(),
+				t_strconcat(ns->prefix, box_set->name, NULL),
+				TRUE, mail_namespace_get_sep(ns));
+			if (imap_match(glob, box->vname) == IMAP_MATCH_YES)
+				return box_set;
+		} else if (strcmp(mailbox_autoexpunge_get_vname(ns, box_set),
+				  box->vname) == 0)
+			return box_set;
+	}
+	return NULL;
+}
+
+unsigned int mailbox_autoexpunge_background(struct mailbox *box)
+{
+	const struct mailbox_settings *box_set;
+	struct mailbox *expunge_box;
+	struct file_lock *lock = NULL;
+	unsigned int expunged_count = 0;
+
+	if (!box->storage->set->mail_autoexpunge_background)
+		return 0;
+	if ((box_set = mailbox_autoexpunge_find_set(box)) == NULL)
+		return 0;
+	if (!mailbox_autoexpunge_lock(box->storage->user, &lock)) {
+		/* someone else is already autoexpunging */
+		return 0;
+	}
+
+	struct event_reason *reason =
+		event_reason_begin("storage:autoexpunge");
+	/* Use a separate mailbox to ignore ACLs, the same as
+	   mailbox_autoexpunge_set() does. */
+	expunge_box = mailbox_alloc(box->list, box->vname,
+				    MAILBOX_FLAG_IGNORE_ACLS |
+				    MAILBOX_FLAG_BACKGROUND_SESSION);
+	if (mailbox_autoexpunge(expunge_box, box_set->autoexpunge,
+				box_set->autoexpunge_max_mails,
+				&expunged_count) < 0) {
+		e_error(expunge_box->event, "Failed to autoexpunge: %s",
+			mailbox_get_last_internal_error(expunge_box, NULL));
+	}
+	mailbox_free(&expunge_box);
+	event_reason_end(&reason);
+	file_lock_free(&lock);
+	return expunged_count;
+}
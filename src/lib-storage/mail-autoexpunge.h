@@ -4,5 +4,10 @@
 /* Perform autoexpunging for all the user's mailboxes that have autoexpunging
    configured. Returns number of mails that were autoexpunged. */
 unsigned int mail_user_autoexpunge(struct mail_user *user);
+/* With mail_autoexpunge_background=yes mail_user_autoexpunge() only asks the
+   indexer to process the mailboxes that have something to expunge. The
+   indexer calls this to do the expunging. Returns number of mails that were
+   autoexpunged. */
+unsigned int mailbox_autoexpunge_background(struct mailbox *box);
 
 #endif
@@ -6,10 +6,14 @@
 #include "mkdir-parents.h"
 #include "istream.h"
 #include "ostream.h"
+#include "buffer.h"
 #include "time-util.h"
 #include "home-expand.h"
 #include "file-create-locked.h"
 #include "file-dotlock.h"
+#include "file-lock.h"
+#include "mmap-util.h"
+#include "write-full.h"
 #include "md5.h"
 #include "hash.h"
 #include "mail-user.h"
@@ -19,9 +23,27 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#define COMPRESS_PERCENTAGE 10
 #define DUPLICATE_BUFSIZE 4096
-#define DUPLICATE_VERSION 2
+#define DUPLICATE_LEGACY_VERSION 2
+#define DUPLICATE_VERSION 3
+
+/* Minimum number of hash buckets in a compacted file */
+#define DUPLICATE_HASH_MIN_BUCKETS 1024
+/* Compact the file when it has this many records per bucket */
+#define DUPLICATE_HASH_MAX_LOAD 2
+/* Compact the file at least this often to drop the expired records */
+#define DUPLICATE_COMPACT_INTERVAL_SECS (60*60*24)
+/* Offsets are 32bit. Compact well before reaching the limit. */
+#define DUPLICATE_MAX_FILE_SIZE ((uint32_t)-1 / 2)
+/* How many times to retry locking the file if it keeps getting replaced */
+#define DUPLICATE_FILE_LOCK_MAX_RETRIES 10
+
+#define DUPLICATE_BUCKET_OFFSET(idx) \
+	(sizeof(struct mail_duplicate_hash_header) + (idx) * sizeof(uint32_t))
+#define DUPLICATE_RECORDS_OFFSET(hdr) \
+	DUPLICATE_BUCKET_OFFSET((hdr)->bucket_count)
+#define DUPLICATE_RECORD_PADDING(size) \
+	((4 - ((size) % 4)) % 4)
 
 #define DUPLICATE_LOCK_FNAME_PREFIX "duplicate.lock."
 
@@ -55,7 +77,11 @@ struct mail_duplicate {
 	bool marked:1;
 	bool changed:1;
 };
+HASH_TABLE_DEFINE_TYPE(mail_duplicate, struct mail_duplicate *,
+		       struct mail_duplicate *);
 
+/* The legacy (version 2) file is a file header followed by records:
+   <record header> <id> <user> */
 struct mail_duplicate_file_header {
 	uint32_t version;
 };
@@ -66,13 +92,37 @@ struct mail_duplicate_record_header {
 	uint32_t user_size;
 };
 
+/* The hashed (version 3) file has a header, followed by bucket_count 32bit
+   offsets to the newest record with the hash, followed by the appended
+   records: <hash record> <id> <user> <padding to 32bit>. Each record
+   points to the previous record in the same bucket, so the first match
+   found in the chain is the newest one. Zero offset ends the chain.
+
+   New records are appended while holding a write lock on the file. The
+   record is written before the bucket is updated to point to it, so readers
+   don't need to lock. Compaction writes a new file and renames it over the
+   old one. */
+struct mail_duplicate_hash_header {
+	uint32_t version;
+	uint32_t bucket_count;
+	uint32_t record_count;
+	uint32_t last_compact_stamp;
+};
+
+struct mail_duplicate_hash_record {
+	uint32_t next_offset;
+	uint32_t hash;
+	uint32_t stamp;
+	uint32_t id_size;
+	uint32_t user_size;
+};
+
 struct mail_duplicate_transaction {
 	pool_t pool;
 	struct mail_duplicate_db *db;
-	ino_t db_ino;
 	struct event *event;
 
-	HASH_TABLE(struct mail_duplicate *, struct mail_duplicate *) hash;
+	HASH_TABLE_TYPE(mail_duplicate) hash;
 	const char *path;
 	unsigned int id_lock_count;
 
@@ -85,8 +135,18 @@ struct mail_duplicate_db {
 	char *path;
 	char *lock_dir;
 	struct dotlock_settings dotlock_set;
+	struct file_lock_settings lock_set;
+
+	/* The opened hashed database file */
+	int fd;
+	ino_t ino;
+	void *mmap_base;
+	size_t mmap_size;
+	buffer_t *read_buf;
 
 	unsigned int transaction_count;
+
+	bool mmap_disable:1;
 };
 
 static const struct dotlock_settings default_mail_duplicate_dotlock_set = {
@@ -250,14 +310,13 @@ mail_duplicate_unlock(struct mail_duplicate_transaction *trans,
 static int
 mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 			    struct istream *input,
-			    unsigned int record_size)
+			    unsigned int record_size, pool_t pool,
+			    HASH_TABLE_TYPE(mail_duplicate) hash)
 {
 	const unsigned char *data;
 	struct mail_duplicate_record_header hdr;
 	size_t size;
-	unsigned int change_count;
 
-	change_count = 0;
 	while (i_stream_read_bytes(input, &data, &size, record_size) > 0) {
 		if (record_size == sizeof(hdr))
 			memcpy(&hdr, data, sizeof(hdr));
@@ -298,24 +357,22 @@ mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 		dup_q.id_size = hdr.id_size;
 		dup_q.user = t_strndup(data + hdr.id_size, hdr.user_size);
 
-		dup = hash_table_lookup(trans->hash, &dup_q);
+		dup = hash_table_lookup(hash, &dup_q);
 		if ((time_t)hdr.stamp < ioloop_time) {
-                        change_count++;
 			if (dup != NULL && !dup->changed)
 				dup->marked = FALSE;
 		} else {
 			if (dup == NULL) {
 				void *new_id;
 
-				new_id = p_malloc(trans->pool, hdr.id_size);
+				new_id = p_malloc(pool, hdr.id_size);
 				memcpy(new_id, data, hdr.id_size);
 
-				dup = p_new(trans->pool,
-					    struct mail_duplicate, 1);
+				dup = p_new(pool, struct mail_duplicate, 1);
 				dup->id = new_id;
 				dup->id_size = hdr.id_size;
-				dup->user = p_strdup(trans->pool, dup_q.user);
-				hash_table_update(trans->hash, dup, dup);
+				dup->user = p_strdup(pool, dup_q.user);
+				hash_table_update(hash, dup, dup);
 			}
 			if (!dup->changed) {
 				dup->marked = TRUE;
@@ -324,30 +381,19 @@ mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 		}
 		i_stream_skip(input, hdr.id_size + hdr.user_size);
 	}
-
-	if (hash_table_count(trans->hash) *
-	    COMPRESS_PERCENTAGE / 100 > change_count)
-		trans->changed = TRUE;
 	return 0;
 }
 
 static int
-mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd)
+mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd,
+			       pool_t pool, HASH_TABLE_TYPE(mail_duplicate) hash)
 {
 	struct istream *input;
 	struct mail_duplicate_file_header hdr;
 	const unsigned char *data;
 	size_t size;
-	struct stat st;
 	unsigned int record_size = 0;
 
-	if (fstat(fd, &st) < 0) {
-		e_error(trans->event,
-			"stat(%s) failed: %m", trans->path);
-		return -1;
-	}
-	trans->db_ino = st.st_ino;
-
 	/* <timestamp> <id_size> <user_size> <id> <user> */
 	input = i_stream_create_fd(fd, DUPLICATE_BUFSIZE);
 	if (i_stream_read_bytes(input, &data, &size, sizeof(hdr)) > 0) {
@@ -355,7 +401,7 @@ mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd)
 		if (hdr.version == 0 || hdr.version > DUPLICATE_VERSION + 10) {
 			/* FIXME: backwards compatibility with v1.0 */
 			record_size = sizeof(time_t) + sizeof(uint32_t)*2;
-		} else if (hdr.version == DUPLICATE_VERSION) {
+		} else if (hdr.version == DUPLICATE_LEGACY_VERSION) {
 			record_size = sizeof(struct mail_duplicate_record_header);
 			i_stream_skip(input, sizeof(hdr));
 		}
@@ -364,7 +410,8 @@ mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd)
 	if (record_size == 0)
 		i_unlink_if_exists(trans->path);
 	else T_BEGIN {
-		if (mail_duplicate_read_records(trans, input, record_size) < 0)
+		if (mail_duplicate_read_records(trans, input, record_size,
+						pool, hash) < 0)
 			i_unlink_if_exists(trans->path);
 	} T_END;
 
@@ -387,7 +434,8 @@ static int mail_duplicate_read_db_file(struct mail_duplicate_transaction *trans)
 		return -1;
 	}
 
-	ret = mail_duplicate_read_db_from_fd(trans, fd);
+	ret = mail_duplicate_read_db_from_fd(trans, fd, trans->pool,
+					     trans->hash);
 
 	if (close(fd) < 0) {
 		e_error(trans->event,
@@ -420,31 +468,576 @@ static void mail_duplicate_read(struct mail_duplicate_transaction *trans)
 		file_dotlock_delete(&dotlock);
 }
 
-static void mail_duplicate_update(struct mail_duplicate_transaction *trans)
+static void mail_duplicate_file_unmap(struct mail_duplicate_db *db)
+{
+	if (db->mmap_base == NULL)
+		return;
+	if (munmap(db->mmap_base, db->mmap_size) < 0)
+		e_error(db->event, "munmap(%s) failed: %m", db->path);
+	db->mmap_base = NULL;
+	db->mmap_size = 0;
+}
+
+static void mail_duplicate_file_close(struct mail_duplicate_db *db)
+{
+	mail_duplicate_file_unmap(db);
+	if (db->fd != -1) {
+		if (close(db->fd) < 0)
+			e_error(db->event, "close(%s) failed: %m", db->path);
+		db->fd = -1;
+	}
+}
+
+/* Open the database file, or reopen it if it was replaced after it was
+   opened. Returns 1 if opened, 0 if the file doesn't exist and create=FALSE,
+   -1 on error. */
+static int mail_duplicate_file_open(struct mail_duplicate_db *db, bool create)
 {
 	struct stat st;
 
-	if (stat(trans->path, &st) < 0) {
-		if (errno == ENOENT) {
-			e_debug(trans->event, "DB file not created yet");
-		} else {
+	if (db->fd != -1) {
+		if (stat(db->path, &st) == 0 && st.st_ino == db->ino)
+			return 1;
+		/* compacted or deleted */
+		mail_duplicate_file_close(db);
+	}
+
+	db->fd = open(db->path, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (db->fd == -1) {
+		if (errno == ENOENT && !create)
+			return 0;
+		e_error(db->event, "open(%s) failed: %m", db->path);
+		return -1;
+	}
+	if (fstat(db->fd, &st) < 0) {
+		e_error(db->event, "fstat(%s) failed: %m", db->path);
+		mail_duplicate_file_close(db);
+		return -1;
+	}
+	db->ino = st.st_ino;
+	return 1;
+}
+
+static void
+mail_duplicate_file_set_broken(struct mail_duplicate_db *db,
+			       const char *reason)
+{
+	e_error(db->event, "Broken duplicate database file %s: %s",
+		db->path, reason);
+	i_unlink_if_exists(db->path);
+	mail_duplicate_file_close(db);
+}
+
+/* Returns 1 and the data if the whole range exists in the file, 0 if it
+   doesn't, -1 on I/O error. The returned data is valid until the next
+   read. */
+static int
+mail_duplicate_file_read(struct mail_duplicate_db *db, uoff_t offset,
+			 size_t size, const void **data_r)
+{
+	ssize_t ret;
+
+	if (db->mmap_disable) {
+		buffer_set_used_size(db->read_buf, 0);
+		ret = pread(db->fd, buffer_append_space_unsafe(db->read_buf,
+							       size),
+			    size, offset);
+		if (ret < 0) {
+			e_error(db->event, "pread(%s) failed: %m", db->path);
+			return -1;
+		}
+		if ((size_t)ret < size)
+			return 0;
+		*data_r = db->read_buf->data;
+		return 1;
+	}
+
+	if (offset + size > db->mmap_size) {
+		/* the file may have grown since it was mapped */
+		mail_duplicate_file_unmap(db);
+		db->mmap_base = mmap_ro_file(db->fd, &db->mmap_size);
+		if (db->mmap_base == MAP_FAILED) {
+			db->mmap_base = NULL;
+			db->mmap_size = 0;
+			e_error(db->event, "mmap(%s) failed: %m", db->path);
+			return -1;
+		}
+		if (offset + size > db->mmap_size)
+			return 0;
+	}
+	*data_r = CONST_PTR_OFFSET(db->mmap_base, offset);
+	return 1;
+}
+
+/* Returns 1 if the file is in the hashed format, 0 if it's empty or in the
+   legacy format, -1 on I/O error. */
+static int
+mail_duplicate_file_read_header(struct mail_duplicate_db *db,
+				struct mail_duplicate_hash_header *hdr_r,
+				bool *legacy_r)
+{
+	const void *data;
+	struct stat st;
+	int ret;
+
+	*legacy_r = FALSE;
+	if ((ret = mail_duplicate_file_read(db, 0, sizeof(*hdr_r), &data)) <= 0) {
+		if (ret < 0)
+			return -1;
+		if (fstat(db->fd, &st) < 0) {
+			e_error(db->event, "fstat(%s) failed: %m", db->path);
+			return -1;
+		}
+		*legacy_r = st.st_size > 0;
+		return 0;
+	}
+	memcpy(hdr_r, data, sizeof(*hdr_r));
+	if (hdr_r->version != DUPLICATE_VERSION ||
+	    hdr_r->bucket_count == 0) {
+		*legacy_r = TRUE;
+		return 0;
+	}
+	return 1;
+}
+
+static int
+mail_duplicate_file_read_bucket(struct mail_duplicate_db *db,
+				unsigned int idx, uint32_t *offset_r)
+{
+	const void *data;
+	int ret;
+
+	if ((ret = mail_duplicate_file_read(db, DUPLICATE_BUCKET_OFFSET(idx),
+					    sizeof(*offset_r), &data)) <= 0) {
+		if (ret == 0)
+			mail_duplicate_file_set_broken(db, "Truncated buckets");
+		return -1;
+	}
+	memcpy(offset_r, data, sizeof(*offset_r));
+	return 0;
+}
+
+/* Read the record at the offset. The id and the user are returned in the
+   same data, which is valid until the next read. Returns 0 if ok, -1 if the
+   file is broken or on I/O error. */
+static int
+mail_duplicate_file_read_record(struct mail_duplicate_db *db,
+				const struct mail_duplicate_hash_header *hdr,
+				uint32_t offset,
+				struct mail_duplicate_hash_record *rec_r,
+				const unsigned char **data_r)
+{
+	const void *data;
+	int ret;
+
+	if (offset < DUPLICATE_RECORDS_OFFSET(hdr)) {
+		mail_duplicate_file_set_broken(db, t_strdup_printf(
+			"Invalid record offset %u", offset));
+		return -1;
+	}
+	if ((ret = mail_duplicate_file_read(db, offset, sizeof(*rec_r),
+					    &data)) <= 0) {
+		if (ret == 0)
+			mail_duplicate_file_set_broken(db, "Truncated record");
+		return -1;
+	}
+	memcpy(rec_r, data, sizeof(*rec_r));
+	if (rec_r->next_offset >= offset ||
+	    rec_r->id_size == 0 || rec_r->id_size > DUPLICATE_BUFSIZE ||
+	    rec_r->user_size == 0 || rec_r->user_size > DUPLICATE_BUFSIZE) {
+		mail_duplicate_file_set_broken(db, t_strdup_printf(
+			"Invalid record at offset %u", offset));
+		return -1;
+	}
+	if ((ret = mail_duplicate_file_read(db, offset + sizeof(*rec_r),
+					    rec_r->id_size + rec_r->user_size,
+					    &data)) <= 0) {
+		if (ret == 0)
+			mail_duplicate_file_set_broken(db, "Truncated record");
+		return -1;
+	}
+	*data_r = data;
+	return 0;
+}
+
+/* Find the newest record for the duplicate from the hashed file. Returns 1
+   if found, 0 if not, -1 on I/O error. */
+static int
+mail_duplicate_file_lookup(struct mail_duplicate_transaction *trans,
+			   const struct mail_duplicate *dup, time_t *stamp_r)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct mail_duplicate_hash_header hdr;
+	struct mail_duplicate_hash_record rec;
+	const unsigned char *data;
+	size_t user_size = strlen(dup->user);
+	unsigned int hash;
+	uint32_t offset;
+	bool legacy;
+	int ret;
+
+	if ((ret = mail_duplicate_file_open(db, FALSE)) <= 0)
+		return ret;
+	if ((ret = mail_duplicate_file_read_header(db, &hdr, &legacy)) <= 0)
+		return ret;
+
+	hash = mail_duplicate_hash(dup);
+	if (mail_duplicate_file_read_bucket(db, hash % hdr.bucket_count,
+					    &offset) < 0)
+		return db->fd == -1 ? 0 : -1;
+	while (offset != 0) {
+		if (mail_duplicate_file_read_record(db, &hdr, offset,
+						    &rec, &data) < 0)
+			return db->fd == -1 ? 0 : -1;
+		if (rec.hash == hash && rec.id_size == dup->id_size &&
+		    rec.user_size == user_size &&
+		    memcmp(data, dup->id, dup->id_size) == 0 &&
+		    strncasecmp((const char *)data + rec.id_size,
+				dup->user, user_size) == 0) {
+			*stamp_r = rec.stamp;
+			return 1;
+		}
+		offset = rec.next_offset;
+	}
+	return 0;
+}
+
+/* Add all the unexpired records from the hashed file to the hash table. */
+static int
+mail_duplicate_file_read_all(struct mail_duplicate_transaction *trans,
+			     const struct mail_duplicate_hash_header *hdr,
+			     pool_t pool, HASH_TABLE_TYPE(mail_duplicate) hash)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct mail_duplicate_hash_record rec;
+	struct mail_duplicate dup_q, *dup;
+	const unsigned char *data;
+	unsigned int i;
+	uint32_t offset;
+
+	for (i = 0; i < hdr->bucket_count; i++) {
+		if (mail_duplicate_file_read_bucket(db, i, &offset) < 0)
+			return db->fd == -1 ? 0 : -1;
+		while (offset != 0) {
+			if (mail_duplicate_file_read_record(db, hdr, offset,
+							    &rec, &data) < 0)
+				return db->fd == -1 ? 0 : -1;
+			offset = rec.next_offset;
+			if ((time_t)rec.stamp < ioloop_time)
+				continue;
+
+			dup_q.id = data;
+			dup_q.id_size = rec.id_size;
+			dup_q.user = t_strndup(data + rec.id_size,
+					       rec.user_size);
+			if (hash_table_lookup(hash, &dup_q) != NULL) {
+				/* older record */
+				continue;
+			}
+			dup = p_new(pool, struct mail_duplicate, 1);
+			dup->id = p_memdup(pool, data, rec.id_size);
+			dup->id_size = rec.id_size;
+			dup->user = p_strdup(pool, dup_q.user);
+			dup->time = rec.stamp;
+			dup->marked = TRUE;
+			hash_table_insert(hash, dup, dup);
+		}
+	}
+	return 0;
+}
+
+static void
+mail_duplicate_record_append(buffer_t *buf, const struct mail_duplicate *dup,
+			     uint32_t next_offset)
+{
+	struct mail_duplicate_hash_record rec;
+	size_t size;
+
+	i_zero(&rec);
+	rec.next_offset = next_offset;
+	rec.hash = mail_duplicate_hash(dup);
+	rec.stamp = dup->time;
+	rec.id_size = dup->id_size;
+	rec.user_size = strlen(dup->user);
+
+	size = sizeof(rec) + rec.id_size + rec.user_size;
+	buffer_append(buf, &rec, sizeof(rec));
+	buffer_append(buf, dup->id, rec.id_size);
+	buffer_append(buf, dup->user, rec.user_size);
+	buffer_append_zero(buf, DUPLICATE_RECORD_PADDING(size));
+}
+
+static int
+mail_duplicate_file_write(struct mail_duplicate_transaction *trans, int fd,
+			  const char *path,
+			  HASH_TABLE_TYPE(mail_duplicate) hash)
+{
+	struct mail_duplicate_hash_header hdr;
+	struct hash_iterate_context *iter;
+	struct mail_duplicate *key, *d;
+	buffer_t *buf;
+	uint32_t offset, next_offset;
+	size_t bucket_offset;
+	int ret = 0;
+
+	i_zero(&hdr);
+	hdr.version = DUPLICATE_VERSION;
+	hdr.bucket_count = I_MAX(hash_table_count(hash),
+				 DUPLICATE_HASH_MIN_BUCKETS);
+	hdr.last_compact_stamp = ioloop_time;
+
+	buf = buffer_create_dynamic(default_pool,
+				    DUPLICATE_RECORDS_OFFSET(&hdr) +
+				    hash_table_count(hash) * 128);
+	buffer_append_zero(buf, DUPLICATE_RECORDS_OFFSET(&hdr));
+
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &d)) {
+		if (!d->marked)
+			continue;
+
+		bucket_offset = DUPLICATE_BUCKET_OFFSET(
+			mail_duplicate_hash(d) % hdr.bucket_count);
+		memcpy(&next_offset, CONST_PTR_OFFSET(buf->data, bucket_offset),
+		       sizeof(next_offset));
+		offset = buf->used;
+		mail_duplicate_record_append(buf, d, next_offset);
+		buffer_write(buf, bucket_offset, &offset, sizeof(offset));
+		hdr.record_count++;
+	}
+	hash_table_iterate_deinit(&iter);
+	buffer_write(buf, 0, &hdr, sizeof(hdr));
+
+	if (write_full(fd, buf->data, buf->used) < 0) {
+		e_error(trans->event, "write(%s) failed: %m", path);
+		ret = -1;
+	}
+	buffer_free(&buf);
+	return ret;
+}
+
+/* Write a new hashed file containing the unexpired records from the old
+   file and the records marked in this transaction. */
+static int
+mail_duplicate_file_compact(struct mail_duplicate_transaction *trans,
+			    const struct mail_duplicate_hash_header *old_hdr,
+			    bool legacy)
+{
+	struct mail_duplicate_db *db = trans->db;
+	HASH_TABLE_TYPE(mail_duplicate) hash;
+	struct hash_iterate_context *iter;
+	struct mail_duplicate *key, *d;
+	struct dotlock *dotlock;
+	pool_t pool;
+	int fd, ret = 0;
+
+	e_debug(trans->event, "Compacting %s", trans->path);
+
+	fd = file_dotlock_open(&db->dotlock_set, trans->path, 0, &dotlock);
+	if (fd != -1)
+		;
+	else if (errno != EAGAIN) {
+		e_error(trans->event,
+			"file_dotlock_open(%s) failed: %m", trans->path);
+		return -1;
+	} else {
+		e_error(trans->event,
+			"Creating lock file for %s timed out in %u secs",
+			trans->path, db->dotlock_set.timeout);
+		return -1;
+	}
+
+	pool = pool_alloconly_create("mail_duplicate compact", 10240);
+	hash_table_create(&hash, pool, 0,
+			  mail_duplicate_hash, mail_duplicate_cmp);
+
+	T_BEGIN {
+		if (legacy) {
+			/* convert the old format */
+			(void)mail_duplicate_read_db_from_fd(trans, db->fd,
+							     pool, hash);
+		} else if (old_hdr != NULL) {
+			ret = mail_duplicate_file_read_all(trans, old_hdr,
+							   pool, hash);
+		}
+	} T_END;
+
+	iter = hash_table_iterate_init(trans->hash);
+	while (hash_table_iterate(iter, trans->hash, &key, &d)) {
+		if (d->changed)
+			hash_table_update(hash, d, d);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	if (ret == 0)
+		ret = mail_duplicate_file_write(trans, fd, trans->path, hash);
+	hash_table_destroy(&hash);
+	pool_unref(&pool);
+
+	if (ret < 0)
+		file_dotlock_delete(&dotlock);
+	else if (file_dotlock_replace(&dotlock, 0) < 0) {
+		e_error(trans->event,
+			"file_dotlock_replace(%s) failed: %m", trans->path);
+		ret = -1;
+	}
+	mail_duplicate_file_close(db);
+	return ret;
+}
+
+/* Append the records marked in this transaction to the hashed file. */
+static int
+mail_duplicate_file_append(struct mail_duplicate_transaction *trans,
+			   struct mail_duplicate_hash_header *hdr,
+			   uoff_t file_size)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct hash_iterate_context *iter;
+	struct mail_duplicate *key, *d;
+	buffer_t *buf;
+	uint32_t offset, next_offset;
+	uoff_t bucket_offset;
+	ssize_t ret;
+	int result = 0;
+
+	/* skip over any partially written record */
+	offset = file_size + DUPLICATE_RECORD_PADDING(file_size);
+
+	buf = t_buffer_create(256);
+	iter = hash_table_iterate_init(trans->hash);
+	while (hash_table_iterate(iter, trans->hash, &key, &d)) {
+		if (!d->changed)
+			continue;
+
+		bucket_offset = DUPLICATE_BUCKET_OFFSET(
+			mail_duplicate_hash(d) % hdr->bucket_count);
+		ret = pread(db->fd, &next_offset, sizeof(next_offset),
+			    bucket_offset);
+		if (ret != sizeof(next_offset)) {
+			if (ret < 0) {
+				e_error(trans->event,
+					"pread(%s) failed: %m", trans->path);
+			} else {
+				mail_duplicate_file_set_broken(db,
+					"Truncated buckets");
+			}
+			result = -1;
+			break;
+		}
+
+		buffer_set_used_size(buf, 0);
+		mail_duplicate_record_append(buf, d, next_offset);
+		if (pwrite_full(db->fd, buf->data, buf->used, offset) < 0 ||
+		    pwrite_full(db->fd, &offset, sizeof(offset),
+				bucket_offset) < 0) {
 			e_error(trans->event,
-				"stat(%s) failed: %m", trans->path);
+				"pwrite(%s) failed: %m", trans->path);
+			result = -1;
+			break;
 		}
-	} else if (trans->db_ino == st.st_ino) {
-		e_debug(trans->event, "DB file not changed");
+		offset += buf->used;
+		hdr->record_count++;
+	}
+	hash_table_iterate_deinit(&iter);
+
+	if (result == 0 &&
+	    pwrite_full(db->fd, hdr, sizeof(*hdr), 0) < 0) {
+		e_error(trans->event, "pwrite(%s) failed: %m", trans->path);
+		result = -1;
+	}
+	return result;
+}
+
+static bool
+mail_duplicate_file_need_compact(const struct mail_duplicate_hash_header *hdr,
+				 uoff_t file_size)
+{
+	if (hdr->record_count / DUPLICATE_HASH_MAX_LOAD >= hdr->bucket_count)
+		return TRUE;
+	if ((time_t)hdr->last_compact_stamp +
+	    DUPLICATE_COMPACT_INTERVAL_SECS <= ioloop_time)
+		return TRUE;
+	return file_size > DUPLICATE_MAX_FILE_SIZE;
+}
+
+static int
+mail_duplicate_file_lock(struct mail_duplicate_transaction *trans,
+			 struct file_lock **lock_r)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct stat st;
+	const char *error;
+	unsigned int i;
+	int ret;
+
+	for (i = 0;; i++) {
+		if (mail_duplicate_file_open(db, TRUE) < 0)
+			return -1;
+		ret = file_wait_lock(db->fd, trans->path, F_WRLCK,
+				     &db->lock_set, db->dotlock_set.timeout,
+				     lock_r, &error);
+		if (ret <= 0) {
+			e_error(trans->event, "%s", error);
+			return -1;
+		}
+		if (stat(trans->path, &st) == 0 && st.st_ino == db->ino)
+			return 0;
+
+		/* the file was compacted while we were waiting for the
+		   lock */
+		file_unlock(lock_r);
+		if (i == DUPLICATE_FILE_LOCK_MAX_RETRIES) {
+			e_error(trans->event,
+				"%s keeps getting replaced", trans->path);
+			return -1;
+		}
+	}
+}
+
+static int
+mail_duplicate_file_commit(struct mail_duplicate_transaction *trans)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct mail_duplicate_hash_header hdr;
+	struct file_lock *lock;
+	struct stat st;
+	bool legacy;
+	int ret;
+
+	if (mail_duplicate_file_lock(trans, &lock) < 0)
+		return -1;
+
+	if (fstat(db->fd, &st) < 0) {
+		e_error(trans->event, "fstat(%s) failed: %m", trans->path);
+		ret = -1;
+	} else if ((ret = mail_duplicate_file_read_header(db, &hdr,
+							  &legacy)) < 0)
+		;
+	else if (ret == 0) {
+		/* new or legacy file */
+		ret = mail_duplicate_file_compact(trans, NULL, legacy);
+	} else if (mail_duplicate_file_need_compact(&hdr, st.st_size)) {
+		ret = mail_duplicate_file_compact(trans, &hdr, FALSE);
 	} else {
-		e_debug(trans->event, "DB file changed: "
-			"Updating duplicate records from DB file");
+		e_debug(trans->event, "Commit; append to %s", trans->path);
+		ret = mail_duplicate_file_append(trans, &hdr, st.st_size);
+	}
 
-		mail_duplicate_read(trans);
+	if (db->fd == -1) {
+		/* closed already after compaction */
+		file_lock_free(&lock);
+	} else {
+		file_unlock(&lock);
 	}
+	return ret;
 }
 
 struct mail_duplicate_transaction *
 mail_duplicate_transaction_begin(struct mail_duplicate_db *db)
 {
 	struct mail_duplicate_transaction *trans;
+	struct mail_duplicate_hash_header hdr;
+	bool legacy;
 	pool_t pool;
 
 	db->transaction_count++;
@@ -464,14 +1057,19 @@ mail_duplicate_transaction_begin(struct mail_duplicate_db *db)
 		return trans;
 	}
 
-	e_debug(trans->event, "Transaction begin; lock %s", db->path);
+	e_debug(trans->event, "Transaction begin (%s)", db->path);
 
 	trans->path = p_strdup(pool, db->path);
 	hash_table_create(&trans->hash, pool, 0,
 			  mail_duplicate_hash, mail_duplicate_cmp);
 
-	mail_duplicate_read(trans);
-
+	if (mail_duplicate_file_open(db, FALSE) > 0 &&
+	    mail_duplicate_file_read_header(db, &hdr, &legacy) == 0 &&
+	    legacy) {
+		/* Read the old format file fully. It's converted to the
+		   hashed format by the next commit. */
+		mail_duplicate_read(trans);
+	}
 	return trans;
 }
 
@@ -563,7 +1161,21 @@ mail_duplicate_check(struct mail_duplicate_transaction *trans,
 		return MAIL_DUPLICATE_CHECK_RESULT_DEADLOCK;
 	}
 
-	mail_duplicate_update(trans);
+	if (!dup->marked) {
+		time_t stamp;
+		int ret;
+
+		ret = mail_duplicate_file_lookup(trans, dup, &stamp);
+		if (ret < 0) {
+			e_debug(trans->event,
+				"Check ID: I/O error occurred while reading");
+			return MAIL_DUPLICATE_CHECK_RESULT_IO_ERROR;
+		}
+		if (ret > 0 && stamp >= ioloop_time) {
+			dup->marked = TRUE;
+			dup->time = stamp;
+		}
+	}
 	if (dup->marked) {
 		e_debug(trans->event, "Check ID: found");
 		return MAIL_DUPLICATE_CHECK_RESULT_EXISTS;
@@ -603,13 +1215,6 @@ void mail_duplicate_transaction_commit(
 	struct mail_duplicate_transaction **_trans)
 {
 	struct mail_duplicate_transaction *trans = *_trans;
-	struct mail_duplicate_file_header hdr;
-	struct mail_duplicate_record_header rec;
-	struct ostream *output;
-        struct hash_iterate_context *iter;
-	struct mail_duplicate *d;
-	int new_fd;
-	struct dotlock *dotlock;
 
 	if (trans == NULL)
 		return;
@@ -626,69 +1231,7 @@ void mail_duplicate_transaction_commit(
 		return;
 	}
 
-	struct mail_duplicate_db *db = trans->db;
-
-	i_assert(trans->path != NULL);
-	e_debug(trans->event, "Commit; overwrite %s", trans->path);
-
-	new_fd = file_dotlock_open(&db->dotlock_set, trans->path, 0, &dotlock);
-	if (new_fd != -1)
-		;
-	else if (errno != EAGAIN) {
-		e_error(trans->event,
-			"file_dotlock_open(%s) failed: %m",
-			trans->path);
-		mail_duplicate_transaction_free(&trans);
-		return;
-	} else {
-		e_error(trans->event,
-			"Creating lock file for %s timed out in %u secs",
-			trans->path, db->dotlock_set.timeout);
-		mail_duplicate_transaction_free(&trans);
-		return;
-	}
-
-	i_zero(&hdr);
-	hdr.version = DUPLICATE_VERSION;
-
-	output = o_stream_create_fd_file(new_fd, 0, FALSE);
-	o_stream_cork(output);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	i_zero(&rec);
-	iter = hash_table_iterate_init(trans->hash);
-	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
-		if (d->marked) {
-			rec.stamp = d->time;
-			rec.id_size = d->id_size;
-			rec.user_size = strlen(d->user);
-
-			o_stream_nsend(output, &rec, sizeof(rec));
-			o_stream_nsend(output, d->id, rec.id_size);
-			o_stream_nsend(output, d->user, rec.user_size);
-		}
-	}
-	hash_table_iterate_deinit(&iter);
-
-	if (o_stream_finish(output) < 0) {
-		e_error(trans->event, "write(%s) failed: %s",
-			trans->path, o_stream_get_error(output));
-		o_stream_unref(&output);
-		mail_duplicate_transaction_free(&trans);
-		return;
-	}
-	o_stream_unref(&output);
-
-	if (file_dotlock_replace(&dotlock, 0) < 0) {
-		e_error(trans->event,
-			"file_dotlock_replace(%s) failed: %m", trans->path);
-	}
-
-	iter = hash_table_iterate_init(trans->hash);
-	while (hash_table_iterate(iter, trans->hash, &d, &d))
-		mail_duplicate_unlock(trans, d);
-	hash_table_iterate_deinit(&iter);
-
+	(void)mail_duplicate_file_commit(trans);
 	mail_duplicate_transaction_free(&trans);
 }
 
@@ -721,6 +1264,7 @@ mail_duplicate_db_init(struct mail_user *user, const char *name)
 
 	db->event = event_create(user->event);
 	event_set_append_log_prefix(db->event, "duplicate db: ");
+	db->fd = -1;
 
 	e_debug(db->event, "Initialize");
 
@@ -746,6 +1290,11 @@ mail_duplicate_db_init(struct mail_user *user, const char *name)
 	mail_set = mail_user_set_get_storage_set(user);
 	db->dotlock_set.use_excl_lock = mail_set->dotlock_use_excl;
 	db->dotlock_set.nfs_flush = mail_set->mail_nfs_storage;
+	db->lock_set.lock_method = mail_set->parsed_lock_method;
+	db->mmap_disable = mail_set->mmap_disable ||
+		mail_set->mail_nfs_storage;
+	if (db->mmap_disable)
+		db->read_buf = buffer_create_dynamic(default_pool, 256);
 
 	return db;
 }
@@ -760,6 +1309,8 @@ void mail_duplicate_db_deinit(struct mail_duplicate_db **_db)
 
 	i_assert(db->transaction_count == 0);
 
+	mail_duplicate_file_close(db);
+	buffer_free(&db->read_buf);
 	event_unref(&db->event);
 	i_free(db->path);
 	i_free(db->lock_dir);
@@ -488,6 +488,10 @@ struct mailbox {
 	bool synced:1;
 	/* Updating cache file is disabled */
 	bool mail_cache_disabled:1;
+	/* mail_vfuncs' update_flags() and update_keywords() only add the
+	   changes to the index transaction, so mailbox_update_flags_range()
+	   can add them directly for whole ranges. */
+	bool mail_index_flag_updates:1;
 	/* Update first_saved field to mailbox list index. */
 	bool update_first_saved:1;
 	/* mailbox_verify_create_name() only checks for mailbox_verify_name() */
@@ -711,6 +715,7 @@ struct mail_save_data {
 
 	struct ostream *output;
 	struct mail_save_attachment *attach;
+	struct mail_attachment_cache *attachment_cache;
 };
 
 struct mail_save_context {
@@ -761,6 +766,8 @@ struct mailbox_header_lookup_ctx {
 	unsigned int count;
 	const char *const *name;
 	unsigned int *idx;
+	/* Precompiled headers for the header filter stream */
+	struct header_filter_set *filter_set;
 };
 
 /* Modules should use do "my_id = mail_storage_module_id++" and
@@ -864,6 +871,10 @@ bool mailbox_is_autocreated(struct mailbox *box);
 /* Returns TRUE if mailbox is autosubscribed. */
 bool mailbox_is_autosubscribed(struct mailbox *box);
 
+/* Ask the indexer process to index the mailbox in the background.
+   Returns 0 if the request was sent, -1 if not. */
+int mailbox_notify_indexer(struct mailbox *box, const char **error_r);
+
 /* Returns -1 if error, 0 if failed with EEXIST, 1 if ok */
 int mailbox_create_fd(struct mailbox *box, const char *path, int flags,
 		      int *fd_r);
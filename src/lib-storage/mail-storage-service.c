@@ -38,6 +38,9 @@
 /* If time moves backwards more than this, kill ourself instead of sleeping. */
 #define MAX_TIME_BACKWARDS_SLEEP_MSECS  (5*1000)
 #define MAX_NOWARN_FORWARD_MSECS        (10*1000)
+/* Number of users whose userdb lookups are done ahead of time while
+   iterating through all users. */
+#define ALL_USERS_PREFETCH_COUNT 100
 
 #define ERRSTR_INVALID_USER_SETTINGS \
 	"Invalid user settings. Refer to server log for more information."
@@ -67,6 +70,13 @@ struct mail_storage_service_ctx {
 	pool_t userdb_next_pool;
 	const char *const **userdb_next_fieldsp;
 
+	/* Users returned by the userdb iteration and their pipelined userdb
+	   lookup results. */
+	pool_t all_prefetch_pool;
+	struct auth_master_user_lookup_result *all_prefetch_results;
+	unsigned int all_prefetch_count, all_prefetch_idx;
+	int all_iter_ret;
+
 	bool debug:1;
 	bool log_initialized:1;
 	bool config_permission_denied:1;
@@ -316,6 +326,28 @@ user_reply_handle(struct mail_storage_service_ctx *ctx,
 	return ret;
 }
 
+static const struct auth_master_user_lookup_result *
+mail_storage_service_all_get_prefetched(struct mail_storage_service_ctx *ctx,
+					const char *username,
+					const struct auth_user_info *info)
+{
+	const struct auth_master_user_lookup_result *result;
+
+	if (ctx->all_prefetch_idx == 0)
+		return NULL;
+	result = &ctx->all_prefetch_results[ctx->all_prefetch_idx - 1];
+	if (strcmp(result->user, username) != 0)
+		return NULL;
+
+	/* the prefetched lookup was done without any connection info */
+	if (strcmp(info->service, ctx->service->name) != 0 ||
+	    info->local_ip.family != 0 || info->remote_ip.family != 0 ||
+	    info->local_port != 0 || info->remote_port != 0 ||
+	    info->forward_fields != NULL || info->debug != ctx->debug)
+		return NULL;
+	return result;
+}
+
 static int
 service_auth_userdb_lookup(struct mail_storage_service_ctx *ctx,
 			   const struct mail_storage_service_input *input,
@@ -323,6 +355,7 @@ service_auth_userdb_lookup(struct mail_storage_service_ctx *ctx,
 			   const char *const **fields_r,
 			   const char **error_r)
 {
+	const struct auth_master_user_lookup_result *result;
 	struct auth_user_info info;
 	const char *new_username;
 	int ret;
@@ -337,8 +370,17 @@ service_auth_userdb_lookup(struct mail_storage_service_ctx *ctx,
 	info.forward_fields = input->forward_fields;
 	info.debug = input->debug;
 
-	ret = auth_master_user_lookup(ctx->conn, *user, &info, pool,
-				      &new_username, fields_r);
+	result = mail_storage_service_all_get_prefetched(ctx, *user, &info);
+	if (result != NULL) {
+		ret = result->ret;
+		new_username = result->username == NULL ? *user :
+			p_strdup(pool, result->username);
+		*fields_r = result->fields == NULL ? p_new(pool, const char *, 1) :
+			p_strarray_dup(pool, result->fields);
+	} else {
+		ret = auth_master_user_lookup(ctx->conn, *user, &info, pool,
+					      &new_username, fields_r);
+	}
 	if (ret > 0) {
 		if (strcmp(*user, new_username) != 0) {
 			if (ctx->debug)
@@ -1155,6 +1197,7 @@ mail_storage_service_load_modules(struct mail_storage_service_ctx *ctx,
 	mod_set.setting_name = "mail_plugins";
 	mod_set.require_init_funcs = TRUE;
 	mod_set.debug = mail_user_set_get_mail_debug(user_info, user_set);
+	mod_set.lazy_binding = user_set->mail_plugins_lazy_binding;
 
 	return module_dir_try_load_missing(&mail_storage_service_modules,
 					   user_set->mail_plugin_dir,
@@ -1212,6 +1255,23 @@ mail_storage_service_generate_session_id(pool_t pool, const char *prefix)
 
 }
 
+static void
+mail_storage_service_user_init_event(struct mail_storage_service_user *user,
+				     struct event *event_parent)
+{
+	/* Create an event that will be used as the default event for logging.
+	   This event won't be a parent to any other events - mail_user.event
+	   will be used for that. */
+	user->event = event_create(event_parent);
+	event_set_forced_debug(user->event, user->service_ctx->debug ||
+		(user->flags & MAIL_STORAGE_SERVICE_FLAG_DEBUG) != 0);
+	event_add_fields(user->event, (const struct event_add_field []){
+		{ .key = "user", .value = user->input.username },
+		{ .key = "session", .value = user->input.session_id },
+		{ .key = NULL }
+	});
+}
+
 static int
 mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 				 const struct mail_storage_service_input *input,
@@ -1325,17 +1385,7 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 	user->ssl_set = master_service_ssl_settings_get_from_parser(user->set_parser);
 	user->gid_source = "mail_gid setting";
 	user->uid_source = "mail_uid setting";
-	/* Create an event that will be used as the default event for logging.
-	   This event won't be a parent to any other events - mail_user.event
-	   will be used for that. */
-	user->event = event_create(input->event_parent);
-	event_set_forced_debug(user->event,
-			       user->service_ctx->debug || (flags & MAIL_STORAGE_SERVICE_FLAG_DEBUG) != 0);
-	event_add_fields(user->event, (const struct event_add_field []){
-		{ .key = "user", .value = user->input.username },
-		{ .key = "session", .value = user->input.session_id },
-		{ .key = NULL }
-	});
+	mail_storage_service_user_init_event(user, input->event_parent);
 
 	if ((flags & MAIL_STORAGE_SERVICE_FLAG_DEBUG) != 0)
 		(void)settings_parse_line(user->set_parser, "mail_debug=yes");
@@ -1390,6 +1440,31 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 	return ret;
 }
 
+void mail_storage_service_user_set_session(
+	struct mail_storage_service_user *user,
+	const struct mail_storage_service_input *input)
+{
+	user->input.local_ip = input->local_ip;
+	user->input.remote_ip = input->remote_ip;
+	user->input.local_port = input->local_port;
+	user->input.remote_port = input->remote_port;
+	user->input.conn_secured = input->conn_secured;
+	user->input.conn_ssl_secured = input->conn_ssl_secured;
+	user->input.session_create_time = input->session_create_time;
+	if (input->session_id != NULL) {
+		user->input.session_id =
+			p_strdup(user->pool, input->session_id);
+	} else {
+		user->input.session_id =
+			mail_storage_service_generate_session_id(user->pool,
+				input->session_id_prefix);
+	}
+	user->session_id_counter = 0;
+
+	event_unref(&user->event);
+	mail_storage_service_user_init_event(user, input->event_parent);
+}
+
 int mail_storage_service_lookup(struct mail_storage_service_ctx *ctx,
 				const struct mail_storage_service_input *input,
 				struct mail_storage_service_user **user_r,
@@ -1678,12 +1753,65 @@ mail_storage_service_all_iter_deinit(struct mail_storage_service_ctx *ctx)
 	return ret;
 }
 
+static void
+mail_storage_service_all_prefetch_clear(struct mail_storage_service_ctx *ctx)
+{
+	ctx->all_prefetch_results = NULL;
+	ctx->all_prefetch_count = 0;
+	ctx->all_prefetch_idx = 0;
+	if (ctx->all_prefetch_pool != NULL)
+		p_clear(ctx->all_prefetch_pool);
+}
+
+static int
+mail_storage_service_all_prefetch(struct mail_storage_service_ctx *ctx)
+{
+	ARRAY_TYPE(const_string) users;
+	struct auth_user_info info;
+	const char *username = NULL;
+
+	mail_storage_service_all_prefetch_clear(ctx);
+	if (ctx->auth_list == NULL)
+		return ctx->all_iter_ret;
+
+	if (ctx->all_prefetch_pool == NULL) {
+		ctx->all_prefetch_pool =
+			pool_alloconly_create("userdb prefetch", 4096);
+	}
+	p_array_init(&users, ctx->all_prefetch_pool,
+		     ALL_USERS_PREFETCH_COUNT + 1);
+	while (array_count(&users) < ALL_USERS_PREFETCH_COUNT &&
+	       (username = auth_master_user_list_next(ctx->auth_list)) != NULL) {
+		username = p_strdup(ctx->all_prefetch_pool, username);
+		array_push_back(&users, &username);
+	}
+	if (username == NULL)
+		ctx->all_iter_ret = mail_storage_service_all_iter_deinit(ctx);
+	if (array_count(&users) == 0)
+		return ctx->all_iter_ret;
+	ctx->all_prefetch_count = array_count(&users);
+	array_append_zero(&users);
+
+	/* Look up all the users at once. This way the auth process can do
+	   the userdb lookups in parallel instead of the lookups being done
+	   one user at a time. */
+	i_zero(&info);
+	info.service = ctx->service->name;
+	info.debug = ctx->debug;
+	auth_master_user_lookup_multi(ctx->conn, array_front(&users), &info,
+				      ctx->all_prefetch_pool,
+				      &ctx->all_prefetch_results);
+	return 1;
+}
+
 void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 					const char *user_mask_hint)
 {
 	enum auth_master_flags flags = 0;
 
 	(void)mail_storage_service_all_iter_deinit(ctx);
+	mail_storage_service_all_prefetch_clear(ctx);
+	ctx->all_iter_ret = 0;
 	mail_storage_service_init_settings(ctx, NULL);
 
 	/* create a new connection, because the iteration might take a while
@@ -1700,12 +1828,18 @@ void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 int mail_storage_service_all_next(struct mail_storage_service_ctx *ctx,
 				  const char **username_r)
 {
+	int ret;
+
 	i_assert((ctx->flags & MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP) != 0);
 
-	*username_r = auth_master_user_list_next(ctx->auth_list);
-	if (*username_r != NULL)
-		return 1;
-	return mail_storage_service_all_iter_deinit(ctx);
+	if (ctx->all_prefetch_idx == ctx->all_prefetch_count) {
+		if ((ret = mail_storage_service_all_prefetch(ctx)) <= 0) {
+			*username_r = NULL;
+			return ret;
+		}
+	}
+	*username_r = ctx->all_prefetch_results[ctx->all_prefetch_idx++].user;
+	return 1;
 }
 
 void mail_storage_service_deinit(struct mail_storage_service_ctx **_ctx)
@@ -1714,6 +1848,7 @@ void mail_storage_service_deinit(struct mail_storage_service_ctx **_ctx)
 
 	*_ctx = NULL;
 	(void)mail_storage_service_all_iter_deinit(ctx);
+	pool_unref(&ctx->all_prefetch_pool);
 	if (ctx->conn != NULL) {
 		if (mail_user_auth_master_conn == ctx->conn)
 			mail_user_auth_master_conn = NULL;
@@ -126,6 +126,13 @@ int mail_storage_service_lookup_next(struct mail_storage_service_ctx *ctx,
 				     struct mail_storage_service_user **user_r,
 				     struct mail_user **mail_user_r,
 				     const char **error_r);
+/* Replace the session specific parts of the user's input (session ID, IPs,
+   ports, connection security and event parent) with the ones in the given
+   input. This allows the same looked up user to be used for another session
+   without a new userdb lookup. */
+void mail_storage_service_user_set_session(
+	struct mail_storage_service_user *user,
+	const struct mail_storage_service_input *input);
 void mail_storage_service_user_ref(struct mail_storage_service_user *user);
 void mail_storage_service_user_unref(struct mail_storage_service_user **user);
 /* Initialize iterating through all users. */
@@ -136,7 +143,10 @@ void mail_storage_service_all_init(struct mail_storage_service_ctx *ctx);
 void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 					const char *user_mask_hint);
 /* Iterate through all usernames. Returns 1 if username was returned, 0 if
-   there are no more users, -1 if error. */
+   there are no more users, -1 if error. The userdb lookups for the returned
+   users are done ahead of time in batches, so the following
+   mail_storage_service_lookup*() for the same user (without IPs or forward
+   fields) doesn't need to wait for the auth process. */
 int mail_storage_service_all_next(struct mail_storage_service_ctx *ctx,
 				  const char **username_r);
 void mail_storage_service_deinit(struct mail_storage_service_ctx **ctx);
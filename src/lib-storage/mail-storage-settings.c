@@ -39,6 +39,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(STR, mail_attachment_detection_options),
 	DEF(STR_VARS, mail_attribute_dict),
 	DEF(UINT, mail_prefetch_count),
+	DEF(UINT, mail_search_prefetch_count),
 	DEF(STR, mail_cache_fields),
 	DEF(STR, mail_always_cache_fields),
 	DEF(STR, mail_never_cache_fields),
@@ -52,6 +53,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(SIZE_HIDDEN, mail_cache_purge_max_inline_size),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
@@ -64,8 +66,11 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(TIME, mail_temp_scan_interval),
 	DEF(UINT, mail_vsize_bg_after_count),
 	DEF(UINT, mail_sort_max_read_count),
+	DEF(BOOL, mail_cache_learn_decisions),
+	DEF(BOOL, mail_autoexpunge_background),
 	DEF(BOOL, mail_save_crlf),
 	DEF(ENUM, mail_fsync),
+	DEF(BOOL, mail_fsync_group_commit),
 	DEF(BOOL, mmap_disable),
 	DEF(BOOL, dotlock_use_excl),
 	DEF(BOOL, mail_nfs_storage),
@@ -95,6 +100,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_detection_options = "",
 	.mail_attribute_dict = "",
 	.mail_prefetch_count = 0,
+	.mail_search_prefetch_count = 0,
 	.mail_cache_fields = "flags",
 	.mail_always_cache_fields = "",
 	.mail_never_cache_fields = "imap.envelope",
@@ -108,6 +114,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_purge_max_inline_size = 0,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
@@ -120,8 +127,11 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_temp_scan_interval = 7*24*60*60,
 	.mail_vsize_bg_after_count = 0,
 	.mail_sort_max_read_count = 0,
+	.mail_cache_learn_decisions = FALSE,
+	.mail_autoexpunge_background = FALSE,
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
+	.mail_fsync_group_commit = FALSE,
 	.mmap_disable = FALSE,
 	.dotlock_use_excl = TRUE,
 	.mail_nfs_storage = FALSE,
@@ -289,6 +299,7 @@ static const struct setting_define mail_user_setting_defines[] = {
 
 	DEF(STR, mail_plugins),
 	DEF(STR, mail_plugin_dir),
+	DEF(BOOL, mail_plugins_lazy_binding),
 
 	DEF(STR, mail_log_prefix),
 
@@ -322,6 +333,7 @@ static const struct mail_user_settings mail_user_default_settings = {
 
 	.mail_plugins = "",
 	.mail_plugin_dir = MODULEDIR,
+	.mail_plugins_lazy_binding = FALSE,
 
 	.mail_log_prefix = "%s(%u)<%{pid}><%{session}>: ",
 
@@ -20,6 +20,7 @@ struct mail_storage_settings {
 	uoff_t mail_attachment_min_size;
 	const char *mail_attribute_dict;
 	unsigned int mail_prefetch_count;
+	unsigned int mail_search_prefetch_count;
 	const char *mail_cache_fields;
 	const char *mail_always_cache_fields;
 	const char *mail_never_cache_fields;
@@ -33,6 +34,7 @@ struct mail_storage_settings {
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
+	uoff_t mail_cache_purge_max_inline_size;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
 	uoff_t mail_index_log_rotate_min_size;
@@ -45,8 +47,11 @@ struct mail_storage_settings {
 	unsigned int mail_temp_scan_interval;
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
+	bool mail_cache_learn_decisions;
+	bool mail_autoexpunge_background;
 	bool mail_save_crlf;
 	const char *mail_fsync;
+	bool mail_fsync_group_commit;
 	bool mmap_disable;
 	bool dotlock_use_excl;
 	bool mail_nfs_storage;
@@ -128,6 +133,7 @@ struct mail_user_settings {
 
 	const char *mail_plugins;
 	const char *mail_plugin_dir;
+	bool mail_plugins_lazy_binding;
 
 	const char *mail_log_prefix;
 
@@ -7,6 +7,9 @@
 #include "mail-storage.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "strescape.h"
+#include "net.h"
+#include "write-full.h"
 #include "sha1.h"
 #include "unichar.h"
 #include "hex-binary.h"
@@ -34,9 +37,14 @@
 #include "mail-search-mime-register.h"
 #include "mailbox-search-result-private.h"
 #include "mailbox-guid-cache.h"
+#include "mailbox-cache-decisions.h"
 #include "mail-cache.h"
 
 #include <ctype.h>
+#include <fcntl.h>
+
+#define MAILBOX_INDEXER_SOCKET_NAME "indexer"
+#define MAILBOX_INDEXER_HANDSHAKE "VERSION\tindexer\t1\t0\n"
 
 #define MAILBOX_DELETE_RETRY_SECS 30
 #define MAILBOX_MAX_HIERARCHY_NAME_LENGTH 255
@@ -1554,6 +1562,34 @@ int mailbox_open(struct mailbox *box)
 	return 0;
 }
 
+void mailbox_prefetch_index_files(struct mailbox *box)
+{
+/* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	static const char *const suffixes[] = { "", ".log", ".cache" };
+	const char *index_dir;
+	unsigned int i;
+	int fd;
+
+	if (box->opened || (box->flags & MAILBOX_FLAG_NO_INDEX_FILES) != 0 ||
+	    mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&index_dir) <= 0)
+		return;
+
+	for (i = 0; i < N_ELEMENTS(suffixes); i++) T_BEGIN {
+		const char *path = t_strconcat(index_dir, "/", box->index_prefix,
+					       suffixes[i], NULL);
+
+		/* errors are ignored here - mailbox_open() handles them */
+		fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			i_close_fd(&fd);
+		}
+	} T_END;
+#endif
+}
+
 static int mailbox_alloc_index_pvt(struct mailbox *box)
 {
 	const char *index_dir;
@@ -1705,10 +1741,18 @@ static void mailbox_copy_cache_decisions_from_inbox(struct mailbox *box)
 {
 	struct mail_namespace *ns =
 		mail_namespace_find_inbox(box->storage->user->namespaces);
-	struct mailbox *inbox =
-		mailbox_alloc(ns->list, "INBOX", MAILBOX_FLAG_READONLY);
+	struct mailbox *inbox;
 	enum mailbox_existence existence;
 
+	if (box->storage->set->mail_cache_learn_decisions &&
+	    mailbox_cache_decisions_apply(box) != 0) {
+		/* the decisions learned from all the mailboxes are used
+		   instead of INBOX's */
+		return;
+	}
+
+	inbox = mailbox_alloc(ns->list, "INBOX", MAILBOX_FLAG_READONLY);
+
 	/* this should be NoSelect but since inbox can never be
 	   NoSelect we use EXISTENCE_NONE to avoid creating inbox by accident */
 	if (mailbox_exists(inbox, FALSE, &existence) == 0 &&
@@ -1750,7 +1794,12 @@ int mailbox_create(struct mailbox *box, const struct mailbox_update *update,
 	mailbox_list_unlock(box->list);
 
 	if (ret == 0) {
-		box->list->guid_cache_updated = TRUE;
+		if (update != NULL && !guid_128_is_empty(update->mailbox_guid)) {
+			mailbox_guid_cache_add(box->list, update->mailbox_guid,
+					       box->vname);
+		} else {
+			box->list->guid_cache_updated = TRUE;
+		}
 		if (!box->inbox_any) T_BEGIN {
 			mailbox_copy_cache_decisions_from_inbox(box);
 		} T_END;
@@ -1778,8 +1827,14 @@ int mailbox_update(struct mailbox *box, const struct mailbox_update *update)
 
 	struct event_reason *reason = event_reason_begin("mailbox:update");
 	ret = box->v.update_box(box, update);
-	if (!guid_128_is_empty(update->mailbox_guid))
-		box->list->guid_cache_invalidated = TRUE;
+	if (!guid_128_is_empty(update->mailbox_guid)) {
+		if (ret == 0) {
+			mailbox_guid_cache_add(box->list, update->mailbox_guid,
+					       box->vname);
+		} else {
+			box->list->guid_cache_invalidated = TRUE;
+		}
+	}
 	event_reason_end(&reason);
 	return ret;
 }
@@ -1880,6 +1935,8 @@ static int mailbox_delete_real(struct mailbox *box)
 	}
 	if (list_locked)
 		mailbox_list_unlock(box->list);
+	if (ret == 0)
+		mailbox_guid_cache_remove(box->list, box->vname);
 
 	box->deleting = FALSE;
 	mailbox_close(box);
@@ -2059,8 +2116,8 @@ static int mailbox_rename_real(struct mailbox *src, struct mailbox *dest)
 	mailbox_list_unlock(dest->list);
 	if (ret < 0)
 		return -1;
-	src->list->guid_cache_invalidated = TRUE;
-	dest->list->guid_cache_invalidated = TRUE;
+	mailbox_guid_cache_rename(src->list, src->vname,
+				  dest->list, dest->vname);
 	return 0;
 }
 
@@ -2513,6 +2570,81 @@ mailbox_transaction_get_mailbox(const struct mailbox_transaction_context *t)
 	return t->box;
 }
 
+static bool
+mailbox_update_flags_can_use_ranges(struct mailbox_transaction_context *t,
+				    struct mail *mail)
+{
+	struct mail_private *p = (struct mail_private *)mail;
+
+	/* plugins may hook into the flag updates of each mail, and private
+	   flags are written to a separate index */
+	return t->box->mail_index_flag_updates && t->box->view_pvt == NULL &&
+		p->v.update_flags == t->box->mail_vfuncs->update_flags &&
+		p->v.update_keywords == t->box->mail_vfuncs->update_keywords;
+}
+
+void mailbox_update_flags_range(struct mailbox_transaction_context *t,
+				const ARRAY_TYPE(seq_range) *seqs,
+				enum modify_type modify_type,
+				enum mail_flags flags,
+				struct mail_keywords *keywords)
+{
+	const struct seq_range *range;
+	struct mail *mail;
+	uint32_t seq;
+	bool update_flags = modify_type == MODIFY_REPLACE || flags != 0;
+
+	mail = mail_alloc(t, 0, NULL);
+	if (!mailbox_update_flags_can_use_ranges(t, mail)) {
+		array_foreach(seqs, range) {
+			for (seq = range->seq1; seq <= range->seq2; seq++) {
+				mail_set_seq(mail, seq);
+				if (update_flags)
+					mail_update_flags(mail, modify_type, flags);
+				if (keywords != NULL) {
+					mail_update_keywords(mail, modify_type,
+							     keywords);
+				}
+			}
+		}
+		mail_free(&mail);
+		return;
+	}
+	mail_free(&mail);
+
+	flags &= MAIL_FLAGS_NONRECENT | MAIL_INDEX_MAIL_FLAG_BACKEND;
+	array_foreach(seqs, range) {
+		if (update_flags) {
+			mail_index_update_flags_range(t->itrans, range->seq1,
+						      range->seq2, modify_type,
+						      flags);
+		}
+		if (keywords == NULL)
+			continue;
+		for (seq = range->seq1; seq <= range->seq2; seq++) {
+			mail_index_update_keywords(t->itrans, seq,
+						   modify_type, keywords);
+		}
+	}
+}
+
+void mailbox_expunge_range(struct mailbox_transaction_context *t,
+			   const ARRAY_TYPE(seq_range) *seqs)
+{
+	const struct seq_range *range;
+	struct mail *mail;
+	uint32_t seq;
+
+	mail = mail_alloc(t, 0, NULL);
+	array_foreach(seqs, range) {
+		for (seq = range->seq1; seq <= range->seq2; seq++) {
+			mail_set_seq(mail, seq);
+			mail_expunge(mail);
+		}
+	}
+	mail_free(&mail);
+}
+
 static void mailbox_save_dest_mail_close(struct mail_save_context *ctx)
 {
 	struct mail_private *mail = (struct mail_private *)ctx->dest_mail;
@@ -2637,6 +2769,12 @@ void mailbox_save_set_pop3_order(struct mail_save_context *ctx,
 	ctx->data.pop3_order = order;
 }
 
+void mailbox_save_set_attachment_cache(struct mail_save_context *ctx,
+				       struct mail_attachment_cache *cache)
+{
+	ctx->data.attachment_cache = cache;
+}
+
 struct mail *mailbox_save_get_dest_mail(struct mail_save_context *ctx)
 {
 	return ctx->dest_mail;
@@ -2974,6 +3112,35 @@ void mailbox_refresh_permissions(struct mailbox *box)
 	(void)mailbox_get_permissions(box);
 }
 
+int mailbox_notify_indexer(struct mailbox *box, const char **error_r)
+{
+	string_t *str = t_str_new(256);
+	const char *path;
+	int fd, ret = 0;
+
+	path = t_strconcat(box->storage->user->set->base_dir,
+			   "/"MAILBOX_INDEXER_SOCKET_NAME, NULL);
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("net_connect_unix(%s) failed: %m",
+					   path);
+		return -1;
+	}
+	str_append(str, MAILBOX_INDEXER_HANDSHAKE);
+	str_append(str, "APPEND\t0\t");
+	str_append_tabescaped(str, box->storage->user->username);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, box->vname);
+	str_append_c(str, '\n');
+
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", path);
+		ret = -1;
+	}
+	i_close_fd(&fd);
+	return ret;
+}
+
 int mailbox_create_fd(struct mailbox *box, const char *path, int flags,
 		      int *fd_r)
 {
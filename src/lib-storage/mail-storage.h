@@ -75,6 +75,11 @@ enum mailbox_flags {
 	   plugin to determine correctly whether the mailbox should be allowed
 	   to be opened. */
 	MAILBOX_FLAG_ATTRIBUTE_SESSION	= 0x10000,
+	/* Mailbox is accessed by a background process (e.g. indexer), which
+	   can do slow maintenance work without stalling a user session.
+	   This currently means purging large cache files (see
+	   mail_cache_purge_max_inline_size). */
+	MAILBOX_FLAG_BACKGROUND_SESSION	= 0x20000,
 };
 
 enum mailbox_feature {
@@ -243,6 +248,7 @@ struct mail_storage;
 struct mail_search_args;
 struct mail_search_result;
 struct mail_keywords;
+struct mail_attachment_cache;
 struct mail_save_context;
 struct mailbox;
 struct mailbox_transaction_context;
@@ -537,6 +543,10 @@ int mailbox_exists(struct mailbox *box, bool auto_boxes,
 /* Open the mailbox. If this function isn't called explicitly, it's also called
    internally by lib-storage when necessary. */
 int mailbox_open(struct mailbox *box);
+/* Ask the kernel to start reading the mailbox's index files, if the
+   mailbox isn't opened yet. This is only a hint to be called right before
+   mailbox_open(), which can then read the files in parallel. */
+void mailbox_prefetch_index_files(struct mailbox *box);
 /* Open mailbox as read-only using the given stream as input. */
 int mailbox_open_stream(struct mailbox *box, struct istream *input);
 /* Close mailbox. Same as if mailbox was freed and re-allocated. */
@@ -684,6 +694,23 @@ struct mailbox *
 mailbox_transaction_get_mailbox(const struct mailbox_transaction_context *t)
 	ATTR_PURE;
 
+/* Update flags and keywords for all the messages in seqs. This works the
+   same as calling mail_update_flags() and mail_update_keywords() for each
+   message, but if nothing hooks into the flag updates the changes are added
+   to the transaction as ranges without setting up the mails. Flags are
+   updated if modify_type is MODIFY_REPLACE or flags is non-zero. Keywords
+   are updated only if keywords is non-NULL. */
+void mailbox_update_flags_range(struct mailbox_transaction_context *t,
+				const ARRAY_TYPE(seq_range) *seqs,
+				enum modify_type modify_type,
+				enum mail_flags flags,
+				struct mail_keywords *keywords);
+/* Expunge all the messages in seqs. This is the same as calling
+   mail_expunge() for each message, but a single mail is reused for all
+   of them. */
+void mailbox_expunge_range(struct mailbox_transaction_context *t,
+			   const ARRAY_TYPE(seq_range) *seqs);
+
 /* Convert uid range to sequence range. */
 void mailbox_get_seq_range(struct mailbox *box, uint32_t uid1, uint32_t uid2,
 			   uint32_t *seq1_r, uint32_t *seq2_r);
@@ -825,6 +852,11 @@ void mailbox_save_set_pop3_uidl(struct mail_save_context *ctx,
    of the mailbox. Not all backends support this. */
 void mailbox_save_set_pop3_order(struct mail_save_context *ctx,
 				 unsigned int order);
+/* Reuse attachments that were already extracted while saving the same mail
+   earlier with the same cache. The extracted attachments are also added to
+   the cache. Only backends that support mail_attachment_dir use this. */
+void mailbox_save_set_attachment_cache(struct mail_save_context *ctx,
+				       struct mail_attachment_cache *cache);
 /* Returns the destination mail */
 struct mail *mailbox_save_get_dest_mail(struct mail_save_context *ctx);
 /* Begin saving the message. All mail_save_set_*() calls must have been called
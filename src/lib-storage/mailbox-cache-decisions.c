@@ -0,0 +1,313 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "str.h"
+#include "strescape.h"
+#include "istream.h"
+#include "ostream.h"
+#include "nfs-workarounds.h"
+#include "file-dotlock.h"
+#include "mail-namespace.h"
+#include "mail-storage-private.h"
+#include "mailbox-list-private.h"
+#include "mailbox-cache-decisions.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#define MAILBOX_CACHE_DECISIONS_LOCK_TIMEOUT 10
+#define MAILBOX_CACHE_DECISIONS_CHANGE_TIMEOUT 30
+
+static const char *
+mailbox_cache_decision_to_str(enum mail_cache_decision_type decision)
+{
+	switch (decision & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) {
+	case MAIL_CACHE_DECISION_NO:
+		return "no";
+	case MAIL_CACHE_DECISION_TEMP:
+		return "temp";
+	case MAIL_CACHE_DECISION_YES:
+		return "yes";
+	}
+	i_unreached();
+}
+
+static bool
+mailbox_cache_decision_parse(const char *str,
+			     enum mail_cache_decision_type *decision_r)
+{
+	if (strcmp(str, "no") == 0)
+		*decision_r = MAIL_CACHE_DECISION_NO;
+	else if (strcmp(str, "temp") == 0)
+		*decision_r = MAIL_CACHE_DECISION_TEMP;
+	else if (strcmp(str, "yes") == 0)
+		*decision_r = MAIL_CACHE_DECISION_YES;
+	else
+		return FALSE;
+	return TRUE;
+}
+
+static bool
+mailbox_cache_decisions_get_path(struct mail_user *user,
+				 struct mail_namespace **ns_r,
+				 const char **path_r)
+{
+	struct mail_namespace *ns = mail_namespace_find_inbox(user->namespaces);
+	const char *dir;
+
+	if (!mailbox_list_get_root_path(ns->list, MAILBOX_LIST_PATH_TYPE_INDEX,
+					&dir))
+		return FALSE;
+	*ns_r = ns;
+	*path_r = t_strconcat(dir, "/"MAILBOX_CACHE_DECISIONS_FNAME, NULL);
+	return TRUE;
+}
+
+static int
+mailbox_cache_decisions_read_path(const char *path, pool_t pool,
+				  ARRAY_TYPE(mailbox_cache_learned_field) *fields,
+				  const char **error_r)
+{
+	struct mailbox_cache_learned_field *field;
+	struct istream *input;
+	enum mail_cache_decision_type decision;
+	const char *line, *const *args;
+	uint64_t hits, misses;
+	int fd, ret = 1;
+
+	fd = nfs_safe_open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		/* <name> <decision> <lookup hits> <lookup misses> */
+		args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) < 4 || args[0][0] == '\0' ||
+		    !mailbox_cache_decision_parse(args[1], &decision) ||
+		    str_to_uint64(args[2], &hits) < 0 ||
+		    str_to_uint64(args[3], &misses) < 0) {
+			/* the file is only a hint - ignore broken lines */
+			continue;
+		}
+		field = array_append_space(fields);
+		field->name = p_strdup(pool, args[0]);
+		field->decision = decision;
+		field->lookup_hits = hits;
+		field->lookup_misses = misses;
+	}
+	if (input->stream_errno != 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %s", path,
+					   i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
+}
+
+int mailbox_cache_decisions_read(struct mail_user *user, pool_t pool,
+				 ARRAY_TYPE(mailbox_cache_learned_field) *fields,
+				 const char **error_r)
+{
+	struct mail_namespace *ns;
+	const char *path;
+
+	if (!mailbox_cache_decisions_get_path(user, &ns, &path))
+		return 0;
+	return mailbox_cache_decisions_read_path(path, pool, fields, error_r);
+}
+
+static struct mailbox_cache_learned_field *
+mailbox_cache_decisions_find(ARRAY_TYPE(mailbox_cache_learned_field) *fields,
+			     const char *name)
+{
+	struct mailbox_cache_learned_field *field;
+
+	array_foreach_modifiable(fields, field) {
+		if (strcmp(field->name, name) == 0)
+			return field;
+	}
+	return NULL;
+}
+
+static void
+mailbox_cache_decisions_merge(ARRAY_TYPE(mailbox_cache_learned_field) *fields,
+			      const struct mail_cache_field_usage *usage,
+			      unsigned int usage_count)
+{
+	struct mailbox_cache_learned_field *field;
+	unsigned int i;
+
+	/* There shouldn't be many fields, so don't worry about O(n^2). */
+	for (i = 0; i < usage_count; i++) {
+		field = mailbox_cache_decisions_find(fields, usage[i].name);
+		if (field == NULL) {
+			field = array_append_space(fields);
+			field->name = usage[i].name;
+			field->decision = usage[i].decision &
+				ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
+		} else if (usage[i].decision_changed &&
+			   (usage[i].decision & MAIL_CACHE_DECISION_FORCED) == 0) {
+			/* Only a decision that the access pattern changed is
+			   learned. Otherwise e.g. INBOX's TEMP decision would
+			   override a YES decision learned elsewhere. */
+			field->decision = usage[i].decision;
+		}
+		field->lookup_hits += usage[i].lookup_hits;
+		field->lookup_misses += usage[i].lookup_misses;
+	}
+}
+
+static int
+mailbox_cache_decisions_write(struct mailbox *box, struct mail_namespace *ns,
+			      const char *path,
+			      const struct mail_cache_field_usage *usage,
+			      unsigned int usage_count)
+{
+	const struct mail_storage_settings *mail_set = box->storage->set;
+	ARRAY_TYPE(mailbox_cache_learned_field) fields;
+	const struct mailbox_cache_learned_field *field;
+	struct dotlock_settings dotlock_set;
+	struct dotlock *dotlock;
+	struct mailbox_permissions perm;
+	struct ostream *output;
+	const char *error;
+	string_t *str;
+	int fd, ret = 0;
+
+	i_zero(&dotlock_set);
+	dotlock_set.use_excl_lock = mail_set->dotlock_use_excl;
+	dotlock_set.nfs_flush = mail_set->mail_nfs_storage;
+	dotlock_set.temp_prefix = mailbox_list_get_temp_prefix(ns->list);
+	dotlock_set.timeout = MAILBOX_CACHE_DECISIONS_LOCK_TIMEOUT;
+	dotlock_set.stale_timeout = MAILBOX_CACHE_DECISIONS_CHANGE_TIMEOUT;
+
+	mailbox_list_get_root_permissions(ns->list, &perm);
+	fd = file_dotlock_open_group(&dotlock_set, path, 0,
+				     perm.file_create_mode,
+				     perm.file_create_gid,
+				     perm.file_create_gid_origin, &dotlock);
+	if (fd == -1) {
+		if (errno == ENOENT) {
+			/* index root directory hasn't been created yet */
+			return 0;
+		}
+		if (errno == EAGAIN) {
+			e_warning(box->event, "Timeout waiting for lock %s - "
+				  "not updating learned cache decisions", path);
+			return 0;
+		}
+		e_error(box->event, "file_dotlock_open(%s) failed: %m", path);
+		return -1;
+	}
+
+	t_array_init(&fields, 32);
+	if (mailbox_cache_decisions_read_path(path, pool_datastack_create(),
+					      &fields, &error) < 0) {
+		e_error(box->event, "%s", error);
+		file_dotlock_delete(&dotlock);
+		return -1;
+	}
+	mailbox_cache_decisions_merge(&fields, usage, usage_count);
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	str = t_str_new(128);
+	array_foreach(&fields, field) {
+		str_truncate(str, 0);
+		str_append_tabescaped(str, field->name);
+		str_printfa(str, "\t%s\t%"PRIu64"\t%"PRIu64"\n",
+			    mailbox_cache_decision_to_str(field->decision),
+			    field->lookup_hits, field->lookup_misses);
+		o_stream_nsend(output, str_data(str), str_len(str));
+	}
+	if (o_stream_finish(output) < 0) {
+		e_error(box->event, "write(%s) failed: %s", path,
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (ret < 0)
+		file_dotlock_delete(&dotlock);
+	else if (file_dotlock_replace(&dotlock,
+				      DOTLOCK_REPLACE_FLAG_VERIFY_OWNER) < 0) {
+		e_error(box->event, "file_dotlock_replace(%s) failed: %m",
+			path);
+		ret = -1;
+	}
+	return ret;
+}
+
+void mailbox_cache_decisions_learn(struct mailbox *box)
+{
+	const struct mail_cache_field_usage *usage;
+	struct mail_namespace *ns;
+	const char *path;
+	unsigned int count;
+
+	if (!box->storage->set->mail_cache_learn_decisions ||
+	    box->cache == NULL ||
+	    box->list->ns->type != MAIL_NAMESPACE_TYPE_PRIVATE)
+		return;
+
+	T_BEGIN {
+		usage = mail_cache_get_field_usage(box->cache,
+			pool_datastack_create(), &count);
+		if (count > 0 &&
+		    mailbox_cache_decisions_get_path(box->storage->user,
+						     &ns, &path))
+			(void)mailbox_cache_decisions_write(box, ns, path,
+							    usage, count);
+	} T_END;
+}
+
+int mailbox_cache_decisions_apply(struct mailbox *box)
+{
+	ARRAY_TYPE(mailbox_cache_learned_field) fields;
+	ARRAY_TYPE(mailbox_cache_field) updates;
+	const struct mailbox_cache_learned_field *field;
+	struct mailbox_cache_field *update;
+	struct mailbox_update box_update;
+	const char *error;
+	int ret;
+
+	t_array_init(&fields, 32);
+	ret = mailbox_cache_decisions_read(box->storage->user,
+					   pool_datastack_create(),
+					   &fields, &error);
+	if (ret < 0) {
+		e_error(box->event, "%s", error);
+		return -1;
+	}
+	if (ret == 0 || array_count(&fields) == 0)
+		return 0;
+
+	/* Fields that were dropped from caching elsewhere are left out,
+	   so they won't be cached here either. */
+	t_array_init(&updates, array_count(&fields) + 1);
+	array_foreach(&fields, field) {
+		if (field->decision == MAIL_CACHE_DECISION_NO)
+			continue;
+		update = array_append_space(&updates);
+		update->name = field->name;
+		update->decision = field->decision;
+		update->last_used = ioloop_time;
+	}
+	array_append_zero(&updates);
+
+	i_zero(&box_update);
+	box_update.cache_updates = array_front(&updates);
+	if (mailbox_update(box, &box_update) < 0)
+		return -1;
+	/* Write the decisions to the cache file immediately, the same way as
+	   when copying them from INBOX. */
+	if (mail_cache_purge(box->cache, 0, "learned cache decisions") < 0)
+		return -1;
+	return 1;
+}
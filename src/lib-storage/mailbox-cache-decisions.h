@@ -0,0 +1,35 @@
+#ifndef MAILBOX_CACHE_DECISIONS_H
+#define MAILBOX_CACHE_DECISIONS_H
+
+#include "mail-cache.h"
+
+struct mail_user;
+struct mailbox;
+
+/* Caching decisions learned across all of the user's mailboxes. They are
+   stored in the INBOX namespace's index root directory. */
+#define MAILBOX_CACHE_DECISIONS_FNAME "dovecot.cache-decisions"
+
+struct mailbox_cache_learned_field {
+	const char *name;
+	enum mail_cache_decision_type decision;
+	/* Accumulated mail_cache_lookup_field() results */
+	uint64_t lookup_hits, lookup_misses;
+};
+ARRAY_DEFINE_TYPE(mailbox_cache_learned_field,
+		  struct mailbox_cache_learned_field);
+
+/* Read the user's learned caching decisions. Returns 1 if they were read,
+   0 if nothing has been learned yet, -1 on error. */
+int mailbox_cache_decisions_read(struct mail_user *user, pool_t pool,
+				 ARRAY_TYPE(mailbox_cache_learned_field) *fields,
+				 const char **error_r);
+/* Merge the mailbox's cache field usage into the user's learned decisions.
+   Called when the mailbox is closed. */
+void mailbox_cache_decisions_learn(struct mailbox *box);
+/* Initialize a newly created mailbox's caching decisions from the learned
+   decisions. Returns 1 if they were applied, 0 if nothing has been learned
+   yet, -1 on error. */
+int mailbox_cache_decisions_apply(struct mailbox *box);
+
+#endif
@@ -118,3 +118,82 @@ void mailbox_guid_cache_refresh(struct mailbox_list *list)
 	if (mailbox_list_iter_deinit(&ctx) < 0)
 		list->guid_cache_errors = TRUE;
 }
+
+static bool mailbox_guid_cache_is_usable(struct mailbox_list *list)
+{
+	return hash_table_is_created(list->guid_cache) &&
+		!list->guid_cache_invalidated;
+}
+
+void mailbox_guid_cache_add(struct mailbox_list *list, const guid_128_t guid,
+			    const char *vname)
+{
+	struct mailbox_guid_cache_rec *rec;
+	const uint8_t *guid_p = guid;
+	uint8_t *new_guid_p;
+
+	if (!mailbox_guid_cache_is_usable(list))
+		return;
+
+	/* the mailbox may have had a different GUID earlier */
+	mailbox_guid_cache_remove(list, vname);
+	rec = hash_table_lookup(list->guid_cache, guid_p);
+	if (rec == NULL) {
+		rec = p_new(list->guid_cache_pool,
+			    struct mailbox_guid_cache_rec, 1);
+		memcpy(rec->guid, guid, sizeof(rec->guid));
+		new_guid_p = rec->guid;
+		hash_table_insert(list->guid_cache, new_guid_p, rec);
+	}
+	rec->vname = p_strdup(list->guid_cache_pool, vname);
+}
+
+void mailbox_guid_cache_remove(struct mailbox_list *list, const char *vname)
+{
+	struct hash_iterate_context *iter;
+	struct mailbox_guid_cache_rec *rec;
+	uint8_t *guid_p;
+
+	if (!mailbox_guid_cache_is_usable(list))
+		return;
+
+	iter = hash_table_iterate_init(list->guid_cache);
+	while (hash_table_iterate(iter, list->guid_cache, &guid_p, &rec)) {
+		if (strcmp(rec->vname, vname) == 0)
+			hash_table_remove(list->guid_cache, guid_p);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+void mailbox_guid_cache_rename(struct mailbox_list *src_list,
+			       const char *src_vname,
+			       struct mailbox_list *dest_list,
+			       const char *dest_vname)
+{
+	struct hash_iterate_context *iter;
+	struct mailbox_guid_cache_rec *rec;
+	uint8_t *guid_p;
+	size_t src_len = strlen(src_vname);
+	char sep = mail_namespace_get_sep(src_list->ns);
+
+	if (src_list != dest_list) {
+		/* the renamed mailboxes are moved to another list */
+		src_list->guid_cache_invalidated = TRUE;
+		dest_list->guid_cache_invalidated = TRUE;
+		return;
+	}
+	if (!mailbox_guid_cache_is_usable(src_list))
+		return;
+
+	/* rename the mailbox and all of its children */
+	iter = hash_table_iterate_init(src_list->guid_cache);
+	while (hash_table_iterate(iter, src_list->guid_cache, &guid_p, &rec)) {
+		if (strncmp(rec->vname, src_vname, src_len) != 0 ||
+		    (rec->vname[src_len] != '\0' &&
+		     rec->vname[src_len] != sep))
+			continue;
+		rec->vname = p_strconcat(src_list->guid_cache_pool, dest_vname,
+					 rec->vname + src_len, NULL);
+	}
+	hash_table_iterate_deinit(&iter);
+}
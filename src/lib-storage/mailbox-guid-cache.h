@@ -5,4 +5,15 @@ int mailbox_guid_cache_find(struct mailbox_list *list, const guid_128_t guid,
 			    const char **vname_r);
 void mailbox_guid_cache_refresh(struct mailbox_list *list);
 
+/* Update an already built cache after a mailbox was created with a known
+   GUID, deleted or renamed. These avoid having to refresh the whole cache
+   by opening all the mailboxes again. */
+void mailbox_guid_cache_add(struct mailbox_list *list, const guid_128_t guid,
+			    const char *vname);
+void mailbox_guid_cache_remove(struct mailbox_list *list, const char *vname);
+void mailbox_guid_cache_rename(struct mailbox_list *src_list,
+			       const char *src_vname,
+			       struct mailbox_list *dest_list,
+			       const char *dest_vname);
+
 #endif
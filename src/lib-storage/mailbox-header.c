@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "sort.h"
 #include "mail-cache.h"
+#include "istream-header-filter.h"
 #include "mail-storage-private.h"
 
 
@@ -58,6 +59,7 @@ mailbox_header_lookup_init_real(struct mailbox *box,
 		dest_name[i] = p_strdup(pool, fields[i].name + strlen("hdr."));
 	}
 	ctx->name = dest_name;
+	ctx->filter_set = header_filter_set_create(ctx->name, ctx->count);
 	return ctx;
 }
 
@@ -91,6 +93,7 @@ void mailbox_header_lookup_unref(struct mailbox_header_lookup_ctx **_ctx)
 	if (--ctx->refcount > 0)
 		return;
 
+	header_filter_set_unref(&ctx->filter_set);
 	pool_unref(&ctx->pool);
 }
 
@@ -4,6 +4,7 @@
 #include "guid.h"
 
 struct mailbox_list_notify;
+struct mailbox_status;
 
 enum mailbox_list_notify_event {
 	MAILBOX_LIST_NOTIFY_CREATE		= 0x01,
@@ -40,6 +41,12 @@ struct mailbox_list_notify_rec {
 
 	/* For rename: */
 	const char *old_vname;
+
+	/* For status changes: The mailbox's STATUS_UIDVALIDITY,
+	   STATUS_UIDNEXT, STATUS_MESSAGES, STATUS_UNSEEN and
+	   STATUS_HIGHESTMODSEQ as seen by the change, or NULL if they aren't
+	   known. Using these avoids opening the mailbox. */
+	const struct mailbox_status *status;
 };
 
 typedef void mailbox_list_notify_callback_t(void *);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "test-common.h"
 #include "istream.h"
+#include "seq-range-array.h"
 #include "master-service.h"
 #include "message-size.h"
 #include "test-mail-storage-common.h"
@@ -437,12 +438,224 @@ static void test_bodystructure_reparsing(void)
 	test_end();
 }
 
+static void test_header_offsets(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_cache_fields=header.offsets",
+			NULL
+		},
+	};
+	const char *const *values, *value;
+
+	test_begin("mail header offsets");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+
+	test_mail_save(box,
+		       "From: <test1@example.com>\r\n"
+		       "To: <test2@example.com>,\r\n"
+		       "  <test3@example.com>\r\n"
+		       "X-Foo: first\r\n"
+		       "Subject: test\r\n"
+		       "x-foo : second\r\n"
+		       "\tfolded\r\n"
+		       "\r\n"
+		       "test body\n");
+
+	/* parse the header and cache the header offsets */
+	struct mailbox_transaction_context *trans =
+		mailbox_transaction_begin(box, 0, __func__);
+	struct mail *mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_first_header(mail, "Subject", &value) == 1 &&
+		    strcmp(value, "test") == 0);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	/* look up uncached headers via the offsets */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_headers(mail, "X-Foo", &values) == 1);
+	test_assert(str_array_length(values) == 2 &&
+		    strcmp(values[0], "first") == 0 &&
+		    strcmp(values[1], "second\n\tfolded") == 0);
+	test_assert(mail_get_first_header(mail, "X-Missing", &value) == 0);
+
+	const char *hdr_names[] = { "To", "X-Foo", NULL };
+	struct mailbox_header_lookup_ctx *headers =
+		mailbox_header_lookup_init(box, hdr_names);
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	const char *expected =
+		"To: <test2@example.com>,\n"
+		"  <test3@example.com>\n"
+		"X-Foo: first\n"
+		"x-foo : second\n"
+		"\tfolded\n"
+		"\n";
+	test_assert(mail_get_header_stream(mail, headers, &input) == 0);
+	test_assert(i_stream_read_more(input, &data, &size) == 1);
+	test_assert(size == strlen(expected) &&
+		    memcmp(data, expected, size) == 0);
+	mailbox_header_lookup_unref(&headers);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_save_wanted_fields_cached(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	const char *const hdr_names[] = { "Subject", NULL };
+	const char *mail_input =
+		"From: <test1@example.com>\r\n"
+		"Subject: test\r\n"
+		"Date: Thu, 15 Oct 2026 10:00:00 +0000\r\n"
+		"\r\n"
+		"test body\n";
+	const char *value;
+	time_t date;
+	int tz;
+
+	test_begin("mail save caches wanted fields");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+
+	struct istream *input =
+		i_stream_create_from_data(mail_input, strlen(mail_input));
+	struct mailbox_transaction_context *trans =
+		mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	struct mail_save_context *save_ctx = mailbox_save_alloc(trans);
+	struct mailbox_header_lookup_ctx *headers =
+		mailbox_header_lookup_init(box, hdr_names);
+	mail_add_temp_wanted_fields(mailbox_save_get_dest_mail(save_ctx),
+				    MAIL_FETCH_DATE | MAIL_FETCH_BODY_SNIPPET |
+				    MAIL_FETCH_IMAP_BODYSTRUCTURE, headers);
+	mailbox_header_lookup_unref(&headers);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	while (i_stream_read(input) > 0)
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	i_stream_unref(&input);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	/* everything must be found from cache without opening the mail */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	struct mail *mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	test_assert(mail_get_date(mail, &date, &tz) == 0 && date != 0);
+	test_assert(mail_get_special(mail, MAIL_FETCH_BODY_SNIPPET,
+				     &value) == 0);
+	test_assert(mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
+				     &value) == 0);
+	test_assert(mail_get_first_header(mail, "Subject", &value) == 1 &&
+		    strcmp(value, "test") == 0);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_update_flags_range(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	const char *const keywords_list[] = { "foo", NULL };
+	const char *const *keywords;
+	struct mail_keywords *kw;
+	struct mailbox_status status;
+	ARRAY_TYPE(seq_range) seqs;
+	uint32_t seq;
+
+	test_begin("mailbox_update_flags_range()");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	for (seq = 1; seq <= 5; seq++)
+		test_mail_save(box, "Subject: test\n\nbody\n");
+
+	t_array_init(&seqs, 2);
+	seq_range_array_add_range(&seqs, 2, 3);
+	seq_range_array_add(&seqs, 5);
+
+	struct mailbox_transaction_context *trans =
+		mailbox_transaction_begin(box, 0, __func__);
+	test_assert(mailbox_keywords_create(box, keywords_list, &kw) == 0);
+	mailbox_update_flags_range(trans, &seqs, MODIFY_ADD, MAIL_SEEN, kw);
+	mailbox_keywords_unref(&kw);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	struct mail *mail = mail_alloc(trans, 0, NULL);
+	for (seq = 1; seq <= 5; seq++) {
+		bool updated = seq_range_exists(&seqs, seq);
+
+		mail_set_seq(mail, seq);
+		test_assert_idx(((mail_get_flags(mail) & MAIL_SEEN) != 0) ==
+				updated, seq);
+		keywords = mail_get_keywords(mail);
+		test_assert_idx(str_array_length(keywords) ==
+				(updated ? 1 : 0), seq);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+
+	/* expunge the same messages */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mailbox_expunge_range(trans, &seqs);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	test_assert(status.messages == 2);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
 		test_mail_random_access,
 		test_attachment_flags_during_header_fetch,
 		test_bodystructure_reparsing,
+		test_header_offsets,
+		test_save_wanted_fields_cached,
+		test_update_flags_range,
 		NULL
 	};
 	int ret;
@@ -0,0 +1,319 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Files larger than this aren't sensible benchmark input */
+#define TEST_BENCH_CORPUS_MAX_FILE_SIZE (256*1024*1024)
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define HAVE_TEST_BENCH_TSC
+#endif
+
+static unsigned int test_bench_allocs;
+
+static const char *pool_counting_get_name(pool_t pool ATTR_UNUSED)
+{
+	return "bench counting";
+}
+
+static void pool_counting_ref(pool_t pool ATTR_UNUSED)
+{
+}
+
+static void pool_counting_unref(pool_t *pool)
+{
+	*pool = NULL;
+}
+
+static void *pool_counting_malloc(pool_t pool ATTR_UNUSED, size_t size)
+{
+	test_bench_allocs++;
+	return p_malloc(system_pool, size);
+}
+
+static void pool_counting_free(pool_t pool ATTR_UNUSED, void *mem)
+{
+	p_free(system_pool, mem);
+}
+
+static void *pool_counting_realloc(pool_t pool ATTR_UNUSED, void *mem,
+				   size_t old_size, size_t new_size)
+{
+	test_bench_allocs++;
+	return p_realloc(system_pool, mem, old_size, new_size);
+}
+
+static void pool_counting_clear(pool_t pool ATTR_UNUSED)
+{
+	i_panic("pool_counting_clear(): Not supported");
+}
+
+static size_t pool_counting_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+static struct pool_vfuncs counting_pool_vfuncs = {
+	pool_counting_get_name,
+
+	pool_counting_ref,
+	pool_counting_unref,
+
+	pool_counting_malloc,
+	pool_counting_free,
+
+	pool_counting_realloc,
+
+	pool_counting_clear,
+	pool_counting_get_max_easy_alloc_size
+};
+
+/* Memory allocated from this pool may be freed after the benchmark has
+   finished, so it must stay valid for the process lifetime. */
+static struct pool counting_pool = {
+	.v = &counting_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+static unsigned int
+test_bench_getenv_uint(const char *name, unsigned int default_value)
+{
+	const char *value = getenv(name);
+	unsigned int num;
+
+	if (value == NULL)
+		return default_value;
+	if (str_to_uint(value, &num) < 0)
+		i_fatal("Invalid %s: %s", name, value);
+	return num;
+}
+
+static inline uint64_t test_bench_tsc(void)
+{
+#ifdef HAVE_TEST_BENCH_TSC
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+struct test_bench_sample {
+	uint64_t nsecs;
+	uint64_t cycles;
+};
+
+static int
+test_bench_sample_cmp(const struct test_bench_sample *s1,
+		      const struct test_bench_sample *s2)
+{
+	if (s1->nsecs < s2->nsecs)
+		return -1;
+	if (s1->nsecs > s2->nsecs)
+		return 1;
+	return 0;
+}
+
+#undef test_bench_run
+void test_bench_run(const char *name, uoff_t bytes,
+		    test_bench_func_t *func, void *context,
+		    struct test_bench_result *result_r)
+{
+	ARRAY(struct test_bench_sample) samples;
+	struct test_bench_sample *sample;
+	const struct test_bench_sample *sorted;
+	struct test_bench_result result;
+	unsigned int i, runs, warmup_runs, p99_idx;
+	pool_t prev_default_pool;
+	uint64_t ts_0, tsc_0;
+
+	warmup_runs = test_bench_getenv_uint("BENCH_WARMUP_RUNS",
+					     TEST_BENCH_DEFAULT_WARMUP_RUNS);
+	runs = test_bench_getenv_uint("BENCH_RUNS", TEST_BENCH_DEFAULT_RUNS);
+	if (runs == 0)
+		runs = 1;
+
+	for (i = 0; i < warmup_runs; i++) T_BEGIN {
+		func(context);
+	} T_END;
+
+	i_array_init(&samples, runs);
+	prev_default_pool = default_pool;
+	default_pool = &counting_pool;
+	test_bench_allocs = 0;
+	for (i = 0; i < runs; i++) {
+		sample = array_append_space(&samples);
+		T_BEGIN {
+			ts_0 = i_nanoseconds();
+			tsc_0 = test_bench_tsc();
+			func(context);
+			sample->cycles = test_bench_tsc() - tsc_0;
+			sample->nsecs = i_nanoseconds() - ts_0;
+		} T_END;
+	}
+	default_pool = prev_default_pool;
+
+	array_sort(&samples, test_bench_sample_cmp);
+	sorted = array_front(&samples);
+	p99_idx = (runs * 99 + 99) / 100 - 1;
+
+	i_zero(&result);
+	result.runs = runs;
+	result.min_nsecs = sorted[0].nsecs;
+	result.median_nsecs = sorted[runs / 2].nsecs;
+	result.p99_nsecs = sorted[I_MIN(p99_idx, runs - 1)].nsecs;
+	result.max_nsecs = sorted[runs - 1].nsecs;
+	result.allocs_per_run = (double)test_bench_allocs / runs;
+	if (bytes > 0 && result.median_nsecs > 0) {
+		result.mb_per_sec = (double)bytes / 1024.0 / 1024.0 /
+			((double)result.median_nsecs / 1000000000.0);
+		result.cycles_per_byte =
+			(double)sorted[runs / 2].cycles / bytes;
+	}
+	array_free(&samples);
+
+	printf("bench %s: runs=%u median_ns=%"PRIu64" p99_ns=%"PRIu64
+	       " min_ns=%"PRIu64" max_ns=%"PRIu64, name, result.runs,
+	       result.median_nsecs, result.p99_nsecs,
+	       result.min_nsecs, result.max_nsecs);
+	if (result.mb_per_sec > 0) {
+		printf(" mb_per_sec=%.03f", result.mb_per_sec);
+		if (result.cycles_per_byte > 0)
+			printf(" cycles_per_byte=%.03f",
+			       result.cycles_per_byte);
+	}
+	printf(" allocs_per_run=%.01f\n", result.allocs_per_run);
+	fflush(stdout);
+
+	if (result_r != NULL)
+		*result_r = result;
+}
+
+void test_bench_corpus_init(struct test_bench_corpus *corpus)
+{
+	i_zero(corpus);
+	i_array_init(&corpus->items, 128);
+}
+
+void test_bench_corpus_deinit(struct test_bench_corpus *corpus)
+{
+	buffer_t **bufp;
+
+	array_foreach_modifiable(&corpus->items, bufp)
+		buffer_free(bufp);
+	array_free(&corpus->items);
+}
+
+void test_bench_corpus_add(struct test_bench_corpus *corpus, buffer_t *buf)
+{
+	array_push_back(&corpus->items, &buf);
+	corpus->size += buf->used;
+}
+
+void test_bench_corpus_add_data(struct test_bench_corpus *corpus,
+				const void *data, size_t size)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, size);
+
+	buffer_append(buf, data, size);
+	test_bench_corpus_add(corpus, buf);
+}
+
+static void
+test_bench_corpus_add_file(struct test_bench_corpus *corpus, const char *path)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, 4096);
+	const char *error;
+
+	if (buffer_append_full_file(buf, path, TEST_BENCH_CORPUS_MAX_FILE_SIZE,
+				    &error) != BUFFER_APPEND_OK)
+		i_fatal("%s: %s", path, error);
+	test_bench_corpus_add(corpus, buf);
+}
+
+static void
+test_bench_corpus_add_dir(struct test_bench_corpus *corpus, const char *path)
+{
+	DIR *dir;
+	struct dirent *d;
+	struct stat st;
+	const char *subpath;
+
+	if ((dir = opendir(path)) == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL) T_BEGIN {
+		/* skip ".", "..", dotfiles and maildir's tmp/ and dovecot*
+		   files */
+		if (d->d_name[0] != '.' && strcmp(d->d_name, "tmp") != 0 &&
+		    !str_begins(d->d_name, "dovecot")) {
+			subpath = t_strconcat(path, "/", d->d_name, NULL);
+			if (stat(subpath, &st) < 0)
+				i_fatal("stat(%s) failed: %m", subpath);
+			if (S_ISDIR(st.st_mode))
+				test_bench_corpus_add_dir(corpus, subpath);
+			else if (S_ISREG(st.st_mode) && st.st_size > 0)
+				test_bench_corpus_add_file(corpus, subpath);
+		}
+	} T_END;
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+}
+
+bool test_bench_corpus_add_path(struct test_bench_corpus *corpus,
+				const char *path, bool missing_ok)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		if (errno == ENOENT && missing_ok)
+			return FALSE;
+		i_fatal("stat(%s) failed: %m", path);
+	}
+	if (S_ISDIR(st.st_mode))
+		test_bench_corpus_add_dir(corpus, path);
+	else
+		test_bench_corpus_add_file(corpus, path);
+	return TRUE;
+}
+
+void test_bench_corpus_add_mbox(struct test_bench_corpus *corpus,
+				const char *path)
+{
+	buffer_t *mbox = buffer_create_dynamic(default_pool, 1024*1024);
+	const unsigned char *data, *p, *end, *mail_start = NULL;
+	const char *error;
+
+	if (buffer_append_full_file(mbox, path, SIZE_MAX, &error) !=
+	    BUFFER_APPEND_OK)
+		i_fatal("%s: %s", path, error);
+	data = mbox->data;
+	end = data + mbox->used;
+	for (p = data; p < end; ) {
+		const unsigned char *lf = memchr(p, '\n', end - p);
+		const unsigned char *next = lf == NULL ? end : lf + 1;
+
+		if (end - p >= 5 && memcmp(p, "From ", 5) == 0) {
+			/* the mail doesn't include the From_ line or the
+			   empty line before the next one */
+			if (mail_start != NULL && p - mail_start > 1) {
+				test_bench_corpus_add_data(corpus, mail_start,
+							   p - mail_start - 1);
+			}
+			mail_start = next;
+		}
+		p = next;
+	}
+	if (mail_start != NULL && end > mail_start)
+		test_bench_corpus_add_data(corpus, mail_start, end - mail_start);
+	buffer_free(&mbox);
+}
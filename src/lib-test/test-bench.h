@@ -0,0 +1,70 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+/* Default number of untimed warmup runs and timed runs. These can be
+   overridden with BENCH_WARMUP_RUNS and BENCH_RUNS environment variables. */
+#define TEST_BENCH_DEFAULT_WARMUP_RUNS 2
+#define TEST_BENCH_DEFAULT_RUNS 10
+
+struct test_bench_result {
+	unsigned int runs;
+	uint64_t min_nsecs, median_nsecs, p99_nsecs, max_nsecs;
+	/* Average number of default_pool allocations (malloc + realloc)
+	   per run. Allocations from other pools, e.g. data stack and
+	   alloconly pools' internal blocks, aren't counted. */
+	double allocs_per_run;
+	/* Median run's MB/s, or 0 if the processed size isn't known. */
+	double mb_per_sec;
+	/* Median run's CPU timestamp counter cycles per byte. 0 if the
+	   processed size isn't known or there's no TSC (non-x86 CPUs). */
+	double cycles_per_byte;
+};
+
+typedef void test_bench_func_t(void *context);
+
+/* Call func() first for the warmup runs, then for the timed runs, and print
+   a single result line in a stable key=value format, so the results can be
+   easily compared between builds:
+
+   bench <name>: runs=<n> median_ns=<n> p99_ns=<n> min_ns=<n> max_ns=<n>
+     [mb_per_sec=<n> [cycles_per_byte=<n>]] allocs_per_run=<n>
+
+   bytes is the amount of data processed by a single run, or 0 if it's not
+   relevant. If result_r isn't NULL, the results are returned there also. */
+void test_bench_run(const char *name, uoff_t bytes,
+		    test_bench_func_t *func, void *context,
+		    struct test_bench_result *result_r);
+#define test_bench_run(name, bytes, func, context, result_r) \
+	test_bench_run(name, bytes, (test_bench_func_t *)(func), \
+		TRUE ? (context) : \
+		CALLBACK_TYPECHECK(func, void (*)(typeof(context))), result_r)
+
+/* Input data for benchmarks, e.g. a set of mails. All the benchmark programs
+   that take files from the command line load them with this, so they all
+   accept the same kind of input. */
+struct test_bench_corpus {
+	ARRAY(buffer_t *) items;
+	/* Total size of all the items */
+	uoff_t size;
+};
+
+void test_bench_corpus_init(struct test_bench_corpus *corpus);
+void test_bench_corpus_deinit(struct test_bench_corpus *corpus);
+
+/* Add buf as a new item. The corpus takes the ownership of buf. */
+void test_bench_corpus_add(struct test_bench_corpus *corpus, buffer_t *buf);
+/* Add a copy of the data as a new item. */
+void test_bench_corpus_add_data(struct test_bench_corpus *corpus,
+				const void *data, size_t size);
+/* Add the file as a new item. If path is a directory, all the non-empty
+   files in it are added recursively. Dotfiles and maildir's tmp/ and
+   dovecot* files are skipped, so a maildir can be given directly. Returns
+   FALSE if path doesn't exist and missing_ok=TRUE. Other errors are fatal. */
+bool test_bench_corpus_add_path(struct test_bench_corpus *corpus,
+				const char *path, bool missing_ok);
+/* Add each mail in the mbox file as a new item. The From_ lines and the
+   empty lines separating the mails aren't included. */
+void test_bench_corpus_add_mbox(struct test_bench_corpus *corpus,
+				const char *path);
+
+#endif
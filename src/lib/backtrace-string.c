@@ -89,6 +89,39 @@ static int backtrace_append_libc(string_t *str)
 	free(strings);
 	return 0;
 }
+
+int backtrace_get_addresses(void **stack, unsigned int count)
+{
+	return backtrace(stack, count);
+}
+
+void backtrace_append_symbol(string_t *str, void *address)
+{
+	const char *p, *name, *end;
+	char **strings;
+
+	/* the format is "path(function+0xoffset) [0xaddress]" */
+	strings = backtrace_symbols(&address, 1);
+	if (strings == NULL ||
+	    (p = strchr(strings[0], '(')) == NULL ||
+	    (end = strpbrk(p + 1, "+)")) == NULL) {
+		str_printfa(str, "0x%p", address);
+	} else if (end > p + 1) {
+		str_append_data(str, p + 1, end - (p + 1));
+	} else {
+		/* unknown function - use the binary's name and offset */
+		name = strings[0];
+		for (const char *q = strings[0]; q < p; q++) {
+			if (*q == '/')
+				name = q + 1;
+		}
+		str_append_data(str, name, p - name);
+		end = strchr(end, ')');
+		if (end != NULL)
+			str_append_data(str, p + 1, end - (p + 1));
+	}
+	free(strings);
+}
 #elif defined(HAVE_WALKCONTEXT) && defined(HAVE_UCONTEXT_H)
 /* Solaris */
 #include <ucontext.h>
@@ -123,13 +156,28 @@ static int backtrace_append_libc(string_t *str)
 	walkcontext(&uc, walk_callback, &ctx);
 	return 0;
 }
-#else
+#endif
+
+#if !defined(HAVE_BACKTRACE_SYMBOLS) || !defined(HAVE_EXECINFO_H)
+#if !defined(HAVE_WALKCONTEXT) || !defined(HAVE_UCONTEXT_H)
 static int backtrace_append_libc(string_t *str ATTR_UNUSED)
 {
 	return -1;
 }
 #endif
 
+int backtrace_get_addresses(void **stack ATTR_UNUSED,
+			    unsigned int count ATTR_UNUSED)
+{
+	return -1;
+}
+
+void backtrace_append_symbol(string_t *str, void *address)
+{
+	str_printfa(str, "0x%p", address);
+}
+#endif
+
 int backtrace_append(string_t *str)
 {
 #if defined(HAVE_LIBUNWIND)
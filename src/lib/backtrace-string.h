@@ -5,4 +5,14 @@
 int backtrace_append(string_t *str);
 int backtrace_get(const char **backtrace_r);
 
+/* Store up to count return addresses of the current call stack to stack.
+   Returns the number of stored addresses, or -1 if not supported. This may be
+   called from a signal handler, but only after it has been called once
+   outside it (libc may load its unwinder on the first call). */
+int backtrace_get_addresses(void **stack, unsigned int count);
+/* Append the function name containing the address returned by
+   backtrace_get_addresses() to str. If the name isn't known, append
+   "binary+0xoffset" instead. */
+void backtrace_append_symbol(string_t *str, void *address);
+
 #endif
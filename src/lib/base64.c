@@ -599,6 +599,51 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+static size_t
+base64_decode_bulk(const struct base64_scheme *b64, bool skip_crlf,
+		   const unsigned char *src_c, size_t src_size,
+		   size_t *dst_avail, buffer_t *dest)
+{
+	const unsigned char *decmap = b64->decmap;
+	unsigned char *start, *ptr, *end;
+	unsigned char a, b, c, d;
+	size_t groups, src_pos = 0;
+
+	/* Decode full 4-character groups directly into the destination
+	   buffer, skipping CRLFs between them. Stop at the first group
+	   containing anything else than base64 characters (other
+	   whitespace, padding, invalid input) and let the caller handle it
+	   one character at a time. */
+	groups = I_MIN(src_size / 4, *dst_avail / 3);
+	if (groups == 0)
+		return 0;
+	start = ptr = buffer_append_space_unsafe(dest, groups * 3);
+	end = start + groups * 3;
+	while (ptr < end && src_size - src_pos >= 4) {
+		a = decmap[src_c[src_pos]];
+		b = decmap[src_c[src_pos+1]];
+		c = decmap[src_c[src_pos+2]];
+		d = decmap[src_c[src_pos+3]];
+		/* valid characters are 0..63, others are 0xff */
+		if (unlikely(((a | b | c | d) & 0xc0) != 0)) {
+			if (skip_crlf && src_c[src_pos] == '\r' &&
+			    src_c[src_pos+1] == '\n') {
+				src_pos += 2;
+				continue;
+			}
+			break;
+		}
+		ptr[0] = (a << 2) | (b >> 4);
+		ptr[1] = (b << 4) | (c >> 2);
+		ptr[2] = (c << 6) | d;
+		ptr += 3;
+		src_pos += 4;
+	}
+	buffer_set_used_size(dest, dest->used - (end - ptr));
+	*dst_avail -= ptr - start;
+	return src_pos;
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -661,6 +706,15 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
+		if (dec->sub_pos == 0) {
+			src_pos += base64_decode_bulk(b64, !no_whitespace,
+						      src_c + src_pos,
+						      src_size - src_pos,
+						      &dst_avail, dest);
+			if (src_pos == src_size)
+				break;
+		}
+
 		unsigned char in = src_c[src_pos];
 		unsigned char dm = b64->decmap[in];
 
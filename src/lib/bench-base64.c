@@ -0,0 +1,118 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "strnum.h"
+#include "base64.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* Both MIME style (76 character CRLF-terminated lines) and unbroken base64
+   are used. The data is processed in IO_BLOCK_SIZE blocks, the same way as
+   the istreams and message-decoder process message bodies. */
+
+#define BENCH_DATA_SIZE_DEFAULT (16*1024*1024)
+
+struct bench_base64_context {
+	enum base64_encode_flags flags;
+	size_t max_line_len;
+	const buffer_t *data;
+	buffer_t *encoded, *decoded;
+};
+
+static void bench_base64_encode(struct bench_base64_context *ctx)
+{
+	struct base64_encoder enc;
+	size_t pos, block_size, src_pos;
+
+	buffer_set_used_size(ctx->encoded, 0);
+	base64_encode_init(&enc, &base64_scheme, ctx->flags,
+			   ctx->max_line_len);
+	for (pos = 0; pos < ctx->data->used; pos += block_size) {
+		block_size = I_MIN(ctx->data->used - pos, IO_BLOCK_SIZE);
+		if (!base64_encode_more(&enc,
+					CONST_PTR_OFFSET(ctx->data->data, pos),
+					block_size, &src_pos, ctx->encoded))
+			i_unreached();
+		i_assert(src_pos == block_size);
+	}
+	if (!base64_encode_finish(&enc, ctx->encoded))
+		i_unreached();
+}
+
+static void bench_base64_decode(struct bench_base64_context *ctx)
+{
+	struct base64_decoder dec;
+	size_t pos, block_size, src_pos;
+
+	buffer_set_used_size(ctx->decoded, 0);
+	base64_decode_init(&dec, &base64_scheme, 0);
+	for (pos = 0; pos < ctx->encoded->used; pos += block_size) {
+		block_size = I_MIN(ctx->encoded->used - pos, IO_BLOCK_SIZE);
+		if (base64_decode_more(&dec,
+				       CONST_PTR_OFFSET(ctx->encoded->data, pos),
+				       block_size, &src_pos, ctx->decoded) < 0)
+			i_unreached();
+		i_assert(src_pos == block_size);
+	}
+	if (base64_decode_finish(&dec) < 0)
+		i_unreached();
+}
+
+static void
+bench_base64(const char *name, enum base64_encode_flags flags,
+	     size_t max_line_len, const buffer_t *data)
+{
+	struct bench_base64_context ctx = {
+		.flags = flags,
+		.max_line_len = max_line_len,
+		.data = data,
+	};
+
+	ctx.encoded = buffer_create_dynamic(default_pool,
+		MALLOC_ADD(data->used / 3 * 4 + data->used / 38, 1024));
+	ctx.decoded = buffer_create_dynamic(default_pool, data->used + 1024);
+
+	test_bench_run(t_strconcat("base64 ", name, " encode", NULL),
+		       data->used, bench_base64_encode, &ctx, NULL);
+	test_bench_run(t_strconcat("base64 ", name, " decode", NULL),
+		       ctx.encoded->used, bench_base64_decode, &ctx, NULL);
+	i_assert(buffer_cmp(data, ctx.decoded));
+
+	buffer_free(&ctx.encoded);
+	buffer_free(&ctx.decoded);
+}
+
+int main(int argc, char *argv[])
+{
+	buffer_t *data;
+	unsigned int i, size = BENCH_DATA_SIZE_DEFAULT;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "s:")) > 0) {
+		switch (c) {
+		case 's':
+			if (str_to_uint(optarg, &size) < 0 || size == 0)
+				i_fatal("Invalid data size: %s", optarg);
+			break;
+		default:
+			i_fatal("Usage: %s [-s <data size>]", argv[0]);
+		}
+	}
+
+	data = buffer_create_dynamic(default_pool, size);
+	for (i = 0; i < size; i++)
+		buffer_append_c(data, i_rand_limit(256));
+	printf("%u bytes of data\n", size);
+
+	bench_base64("mime", BASE64_ENCODE_FLAG_CRLF, 76, data);
+	bench_base64("unbroken", 0, SIZE_MAX, data);
+
+	buffer_free(&data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "strnum.h"
+#include "randgen.h"
+#include "crc32.h"
+#include "hash-method.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* crc32 and all the registered hash methods are run both over a single large
+   buffer and over many GUID/header sized (64 byte) inputs, since the latter
+   is the common case in index and dsync code. */
+
+#define BENCH_DATA_SIZE_DEFAULT (16*1024*1024)
+#define BENCH_SMALL_INPUT_SIZE 64
+
+struct bench_hash_method_context {
+	/* NULL = crc32 */
+	const struct hash_method *meth;
+	const unsigned char *data;
+	size_t size;
+	volatile uint32_t crc;
+};
+
+static void bench_crc32_large(struct bench_hash_method_context *ctx)
+{
+	ctx->crc = crc32_data(ctx->data, ctx->size);
+}
+
+static void bench_crc32_small(struct bench_hash_method_context *ctx)
+{
+	size_t pos;
+
+	for (pos = 0; pos + BENCH_SMALL_INPUT_SIZE <= ctx->size;
+	     pos += BENCH_SMALL_INPUT_SIZE)
+		ctx->crc = crc32_data(ctx->data + pos, BENCH_SMALL_INPUT_SIZE);
+}
+
+static void bench_hash_method_large(struct bench_hash_method_context *ctx)
+{
+	const struct hash_method *meth = ctx->meth;
+	unsigned char hctx[meth->context_size];
+	unsigned char digest[meth->digest_size];
+
+	meth->init(hctx);
+	meth->loop(hctx, ctx->data, ctx->size);
+	meth->result(hctx, digest);
+}
+
+static void bench_hash_method_small(struct bench_hash_method_context *ctx)
+{
+	const struct hash_method *meth = ctx->meth;
+	unsigned char hctx[meth->context_size];
+	unsigned char digest[meth->digest_size];
+	size_t pos;
+
+	for (pos = 0; pos + BENCH_SMALL_INPUT_SIZE <= ctx->size;
+	     pos += BENCH_SMALL_INPUT_SIZE) {
+		meth->init(hctx);
+		meth->loop(hctx, ctx->data + pos, BENCH_SMALL_INPUT_SIZE);
+		meth->result(hctx, digest);
+	}
+}
+
+static void
+bench_hash_method(const struct hash_method *meth,
+		  const unsigned char *data, size_t size)
+{
+	struct bench_hash_method_context ctx = {
+		.meth = meth,
+		.data = data,
+		.size = size,
+	};
+	const char *name = meth == NULL ? "crc32" : meth->name;
+
+	if (meth == NULL) {
+		test_bench_run(t_strconcat(name, " large", NULL), size,
+			       bench_crc32_large, &ctx, NULL);
+		test_bench_run(t_strconcat(name, " small", NULL), size,
+			       bench_crc32_small, &ctx, NULL);
+	} else {
+		test_bench_run(t_strconcat(name, " large", NULL), size,
+			       bench_hash_method_large, &ctx, NULL);
+		test_bench_run(t_strconcat(name, " small", NULL), size,
+			       bench_hash_method_small, &ctx, NULL);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *data;
+	unsigned int i, size = BENCH_DATA_SIZE_DEFAULT;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "s:")) > 0) {
+		switch (c) {
+		case 's':
+			if (str_to_uint(optarg, &size) < 0 || size == 0)
+				i_fatal("Invalid data size: %s", optarg);
+			break;
+		default:
+			i_fatal("Usage: %s [-s <data size>]", argv[0]);
+		}
+	}
+
+	data = i_malloc(size);
+	random_fill(data, size);
+	printf("%u bytes of data\n", size);
+
+	bench_hash_method(NULL, data, size);
+	for (i = 0; hash_methods[i] != NULL; i++) {
+		if (strcmp(hash_methods[i]->name, "size") != 0)
+			bench_hash_method(hash_methods[i], data, size);
+	}
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
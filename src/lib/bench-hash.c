@@ -0,0 +1,172 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "hash.h"
+#include "strnum.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+/* Compare the chained and the open addressing (HASH_TABLE_FLAG_OPEN_ADDRESSING)
+   hash table implementations with the same set of string keys. The memory
+   usage is the growth of the malloc heap after all the keys are inserted,
+   excluding the keys themselves. */
+
+#define BENCH_KEYS_DEFAULT 1000000
+
+struct bench_hash_context {
+	enum hash_table_flags flags;
+	char *const *keys, *const *missing_keys;
+	unsigned int count;
+
+	HASH_TABLE(char *, char *) hash;
+};
+
+static size_t bench_heap_used(void)
+{
+#if defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static void bench_hash_fill(struct bench_hash_context *ctx)
+{
+	unsigned int i;
+
+	hash_table_create_full(&ctx->hash, default_pool, 0, str_hash, strcmp,
+			       ctx->flags);
+	for (i = 0; i < ctx->count; i++)
+		hash_table_insert(ctx->hash, ctx->keys[i], ctx->keys[i]);
+}
+
+static void bench_hash_insert(struct bench_hash_context *ctx)
+{
+	bench_hash_fill(ctx);
+	hash_table_destroy(&ctx->hash);
+}
+
+static void bench_hash_insert_remove(struct bench_hash_context *ctx)
+{
+	unsigned int i;
+
+	bench_hash_fill(ctx);
+	for (i = 0; i < ctx->count; i++)
+		hash_table_remove(ctx->hash, ctx->keys[i]);
+	hash_table_destroy(&ctx->hash);
+}
+
+static void bench_hash_lookup(struct bench_hash_context *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->count; i++) {
+		if (hash_table_lookup(ctx->hash, ctx->keys[i]) == NULL)
+			i_unreached();
+	}
+}
+
+static void bench_hash_lookup_missing(struct bench_hash_context *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->count; i++) {
+		if (hash_table_lookup(ctx->hash, ctx->missing_keys[i]) != NULL)
+			i_unreached();
+	}
+}
+
+static void bench_hash_iterate(struct bench_hash_context *ctx)
+{
+	struct hash_iterate_context *iter;
+	char *key, *value;
+	unsigned int found = 0;
+
+	iter = hash_table_iterate_init(ctx->hash);
+	while (hash_table_iterate(iter, ctx->hash, &key, &value))
+		found++;
+	hash_table_iterate_deinit(&iter);
+	i_assert(found == ctx->count);
+}
+
+static void
+bench_hash(const char *name, enum hash_table_flags flags,
+	   char *const *keys, char *const *missing_keys, unsigned int count)
+{
+	struct bench_hash_context ctx = {
+		.flags = flags,
+		.keys = keys,
+		.missing_keys = missing_keys,
+		.count = count,
+	};
+	size_t heap_used;
+
+	test_bench_run(t_strconcat(name, " insert", NULL), 0,
+		       bench_hash_insert, &ctx, NULL);
+	test_bench_run(t_strconcat(name, " insert+remove", NULL), 0,
+		       bench_hash_insert_remove, &ctx, NULL);
+
+	heap_used = bench_heap_used();
+	bench_hash_fill(&ctx);
+	if (heap_used != 0) {
+		heap_used = bench_heap_used() - heap_used;
+		printf("%s memory: %zu kB, %.01f bytes/entry\n", name,
+		       heap_used / 1024, (double)heap_used / count);
+	}
+	test_bench_run(t_strconcat(name, " lookup", NULL), 0,
+		       bench_hash_lookup, &ctx, NULL);
+	test_bench_run(t_strconcat(name, " lookup missing", NULL), 0,
+		       bench_hash_lookup_missing, &ctx, NULL);
+	test_bench_run(t_strconcat(name, " iterate", NULL), 0,
+		       bench_hash_iterate, &ctx, NULL);
+	hash_table_destroy(&ctx.hash);
+}
+
+int main(int argc, char *argv[])
+{
+	char **keys, **missing_keys;
+	unsigned int i, count = BENCH_KEYS_DEFAULT;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "n:")) > 0) {
+		switch (c) {
+		case 'n':
+			if (str_to_uint(optarg, &count) < 0 || count == 0)
+				i_fatal("Invalid key count: %s", optarg);
+			break;
+		default:
+			i_fatal("Usage: %s [-n <key count>]", argv[0]);
+		}
+	}
+
+	keys = i_new(char *, count);
+	missing_keys = i_new(char *, count);
+	for (i = 0; i < count; i++) {
+		keys[i] = i_strdup_printf("user%u@example.com", i);
+		missing_keys[i] = i_strdup_printf("user%u@example.org", i);
+	}
+	printf("%u keys\n", count);
+
+	bench_hash("chained", 0, keys, missing_keys, count);
+	bench_hash("open addressing", HASH_TABLE_FLAG_OPEN_ADDRESSING,
+		   keys, missing_keys, count);
+
+	for (i = 0; i < count; i++) {
+		i_free(keys[i]);
+		i_free(missing_keys[i]);
+	}
+	i_free(keys);
+	i_free(missing_keys);
+	lib_deinit();
+	return 0;
+}
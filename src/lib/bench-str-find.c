@@ -0,0 +1,102 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "str-find.h"
+#include "test-bench.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* str_find_more() is used here the way message-search uses it for unindexed
+   BODY/TEXT searches: the text is fed in IO_BLOCK_SIZE blocks and the key is
+   never found, so the whole text is scanned. The text is uppercased
+   English-like prose, similar to the normalized message body text that the
+   search keys are matched against. */
+
+#define BENCH_TEXT_SIZE_DEFAULT (16*1024*1024)
+
+static const char *bench_keys[] = {
+	"J", "QZ", "XYZ", "MEAT", "THEQ", "REPORTER", "MEETINGS", "NEWSLETTER",
+	"QUARTERLY MEET", "INVOICE ATTACHED", "PLEASE FIND THE ATTACHED",
+	"THE QUICK BROWN FOX JUMPS OVER THE LAZY CAT",
+};
+
+static string_t *bench_text_create(size_t size)
+{
+	static const char *words[] = {
+		"THE", "MEETING", "IS", "MOVED", "TO", "NEXT", "WEEK", "PLEASE",
+		"SEE", "ATTACHED", "DOCUMENT", "FOR", "DETAILS", "AND", "LET",
+		"ME", "KNOW", "IF", "YOU", "HAVE", "ANY", "QUESTIONS", "ABOUT",
+		"REPORTS", "OR", "INVOICES", "REGARDS",
+	};
+	string_t *str = str_new(default_pool, size + 64);
+	unsigned int i = 0;
+
+	while (str_len(str) < size) {
+		str_append(str, words[(i * 7 + i / 5) % N_ELEMENTS(words)]);
+		str_append_c(str, (++i % 12) == 0 ? '\n' : ' ');
+	}
+	return str;
+}
+
+struct bench_str_find_context {
+	const char *key;
+	const string_t *text;
+};
+
+static void bench_str_find_run(struct bench_str_find_context *ctx)
+{
+	const unsigned char *data = str_data(ctx->text);
+	size_t size = str_len(ctx->text), pos, block_size;
+	struct str_find_context *fctx;
+
+	fctx = str_find_init(default_pool, ctx->key);
+	for (pos = 0; pos < size; pos += block_size) {
+		block_size = I_MIN(size - pos, IO_BLOCK_SIZE);
+		if (str_find_more(fctx, data + pos, block_size))
+			i_unreached();
+	}
+	str_find_deinit(&fctx);
+}
+
+static void bench_str_find(const char *key, const string_t *text)
+{
+	struct bench_str_find_context ctx = {
+		.key = key,
+		.text = text,
+	};
+
+	test_bench_run(t_strdup_printf("str_find %s", key), str_len(text),
+		       bench_str_find_run, &ctx, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	string_t *text;
+	unsigned int i, size = BENCH_TEXT_SIZE_DEFAULT;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "s:")) > 0) {
+		switch (c) {
+		case 's':
+			if (str_to_uint(optarg, &size) < 0 || size == 0)
+				i_fatal("Invalid text size: %s", optarg);
+			break;
+		default:
+			i_fatal("Usage: %s [-s <text size>]", argv[0]);
+		}
+	}
+
+	text = bench_text_create(size);
+	printf("%zu bytes of text\n", str_len(text));
+	for (i = 0; i < N_ELEMENTS(bench_keys); i++)
+		bench_str_find(bench_keys[i], text);
+
+	str_free(&text);
+	lib_deinit();
+	return 0;
+}
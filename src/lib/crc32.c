@@ -58,6 +58,26 @@ static uint32_t crc32tab[256] = {
 	0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
+/* Slicing-by-8 tables: crc32tab_slice[n-1][i] is the CRC of byte i followed
+   by n zero bytes. These are generated from crc32tab on first use. */
+static uint32_t crc32tab_slice[7][256];
+static bool crc32tab_slice_initialized = FALSE;
+
+static void crc32tab_slice_init(void)
+{
+	uint32_t crc;
+	unsigned int i, n;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32tab[i];
+		for (n = 0; n < 7; n++) {
+			crc = (crc >> 8) ^ crc32tab[crc & 0xff];
+			crc32tab_slice[n][i] = crc;
+		}
+	}
+	crc32tab_slice_initialized = TRUE;
+}
+
 uint32_t crc32_data(const void *data, size_t size)
 {
 	return crc32_data_more(0, data, size);
@@ -68,6 +88,23 @@ uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 	const uint8_t *p = data, *end = p + size;
 
 	crc ^= 0xffffffff;
+	if (size >= 16) {
+		if (unlikely(!crc32tab_slice_initialized))
+			crc32tab_slice_init();
+		/* process 8 bytes at a time */
+		for (; end - p >= 8; p += 8) {
+			crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+				((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+			crc = crc32tab_slice[6][crc & 0xff] ^
+				crc32tab_slice[5][(crc >> 8) & 0xff] ^
+				crc32tab_slice[4][(crc >> 16) & 0xff] ^
+				crc32tab_slice[3][crc >> 24] ^
+				crc32tab_slice[2][p[4]] ^
+				crc32tab_slice[1][p[5]] ^
+				crc32tab_slice[0][p[6]] ^
+				crc32tab[p[7]];
+		}
+	}
 	for (; p != end; p++)
 		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
 	crc ^= 0xffffffff;
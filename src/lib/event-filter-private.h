@@ -17,12 +17,25 @@ enum event_filter_node_op {
 	EVENT_FILTER_OP_NOT,
 };
 
+enum event_filter_log_type {
+	EVENT_FILTER_LOG_TYPE_DEBUG	= BIT(0),
+	EVENT_FILTER_LOG_TYPE_INFO	= BIT(1),
+	EVENT_FILTER_LOG_TYPE_WARNING	= BIT(2),
+	EVENT_FILTER_LOG_TYPE_ERROR	= BIT(3),
+	EVENT_FILTER_LOG_TYPE_FATAL	= BIT(4),
+	EVENT_FILTER_LOG_TYPE_PANIC	= BIT(5),
+
+	EVENT_FILTER_LOG_TYPE_ALL	= 0xff,
+};
+
 struct event_filter {
 	struct event_filter *prev, *next;
 
 	pool_t pool;
 	int refcount;
 	ARRAY(struct event_filter_query_internal) queries;
+	/* Union of all the queries' log_types */
+	enum event_filter_log_type log_types;
 
 	bool fragment;
 	bool named_queries_only;
@@ -41,17 +54,6 @@ enum event_filter_node_type {
 	EVENT_FILTER_NODE_TYPE_EVENT_FIELD_WILDCARD, /* field */
 };
 
-enum event_filter_log_type {
-	EVENT_FILTER_LOG_TYPE_DEBUG	= BIT(0),
-	EVENT_FILTER_LOG_TYPE_INFO	= BIT(1),
-	EVENT_FILTER_LOG_TYPE_WARNING	= BIT(2),
-	EVENT_FILTER_LOG_TYPE_ERROR	= BIT(3),
-	EVENT_FILTER_LOG_TYPE_FATAL	= BIT(4),
-	EVENT_FILTER_LOG_TYPE_PANIC	= BIT(5),
-
-	EVENT_FILTER_LOG_TYPE_ALL	= 0xff,
-};
-
 struct event_filter_node {
 	enum event_filter_node_type type;
 	enum event_filter_node_op op;
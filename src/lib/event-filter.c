@@ -37,6 +37,11 @@ static const struct log_type_map {
 struct event_filter_query_internal {
 	struct event_filter_node *expr;
 	void *context;
+
+	/* Log types that the expression can match. This is recalculated
+	   whenever expr changes, so that e.g. category=error queries can be
+	   skipped for debug messages without evaluating them. */
+	enum event_filter_log_type log_types;
 };
 
 static struct event_filter *event_filters = NULL;
@@ -155,6 +160,44 @@ static bool filter_node_requires_event_name(struct event_filter_node *node)
 	}
 }
 
+static enum event_filter_log_type
+filter_node_log_types(struct event_filter_node *node)
+{
+	struct event_filter_node *child;
+
+	switch (node->op) {
+	case EVENT_FILTER_OP_NOT:
+		child = node->children[0];
+		if (child->type == EVENT_FILTER_NODE_TYPE_EVENT_CATEGORY &&
+		    child->category.name == NULL)
+			return EVENT_FILTER_LOG_TYPE_ALL & ~child->category.log_type;
+		return EVENT_FILTER_LOG_TYPE_ALL;
+	case EVENT_FILTER_OP_AND:
+		return filter_node_log_types(node->children[0]) &
+			filter_node_log_types(node->children[1]);
+	case EVENT_FILTER_OP_OR:
+		return filter_node_log_types(node->children[0]) |
+			filter_node_log_types(node->children[1]);
+	default:
+		if (node->type == EVENT_FILTER_NODE_TYPE_EVENT_CATEGORY &&
+		    node->category.name == NULL)
+			return node->category.log_type;
+		return EVENT_FILTER_LOG_TYPE_ALL;
+	}
+}
+
+static void event_filter_recalculate(struct event_filter *filter)
+{
+	struct event_filter_query_internal *query;
+
+	filter->log_types = 0;
+	array_foreach_modifiable(&filter->queries, query) {
+		query->log_types = query->expr == NULL ? 0 :
+			filter_node_log_types(query->expr);
+		filter->log_types |= query->log_types;
+	}
+}
+
 int event_filter_parse(const char *str, struct event_filter *filter,
 		       const char **error_r)
 {
@@ -186,6 +229,7 @@ int event_filter_parse(const char *str, struct event_filter *filter,
 
 		filter->named_queries_only = filter->named_queries_only &&
 			filter_node_requires_event_name(state.output);
+		event_filter_recalculate(filter);
 	} else if (ret != 0) {
 		/* error */
 		i_assert(state.error != NULL);
@@ -271,6 +315,7 @@ event_filter_merge_with_context_internal(struct event_filter *dest,
 			 clone_expr(dest->pool, int_query->expr),
 			 EVENT_FILTER_OP_OR);
 	} T_END;
+	event_filter_recalculate(dest);
 }
 
 bool event_filter_remove_queries_with_context(struct event_filter *filter,
@@ -283,6 +328,7 @@ bool event_filter_remove_queries_with_context(struct event_filter *filter,
 		if (int_query->context == context) {
 			idx = array_foreach_idx(&filter->queries, int_query);
 			array_delete(&filter->queries, idx, 1);
+			event_filter_recalculate(filter);
 			return TRUE;
 		}
 	}
@@ -694,12 +740,15 @@ event_filter_query_match(const struct event_filter_query_internal *query,
 	i_assert(ctx->type < N_ELEMENTS(event_filter_log_type_map));
 	log_type = event_filter_log_type_map[ctx->type].log_type;
 
+	if ((query->log_types & log_type) == 0)
+		return FALSE;
 	return event_filter_query_match_eval(query->expr, event, source_filename,
 					     source_linenum, log_type);
 }
 
 static bool
-event_filter_match_fastpath(struct event_filter *filter, struct event *event)
+event_filter_match_fastpath(struct event_filter *filter, struct event *event,
+			    const struct failure_context *ctx)
 {
 	if (filter->named_queries_only && event->sending_name == NULL) {
 		/* No debug logging is enabled. Only named events may be wanted
@@ -707,6 +756,12 @@ event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 		   to check any further. */
 		return FALSE;
 	}
+	i_assert(ctx->type < N_ELEMENTS(event_filter_log_type_map));
+	if ((filter->log_types & event_filter_log_type_map[ctx->type].log_type) == 0) {
+		/* None of the queries can match this log type
+		   (e.g. category=error for a debug message). */
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -726,7 +781,7 @@ bool event_filter_match_source(struct event_filter *filter, struct event *event,
 
 	i_assert(!filter->fragment);
 
-	if (!event_filter_match_fastpath(filter, event))
+	if (!event_filter_match_fastpath(filter, event, ctx))
 		return FALSE;
 
 	array_foreach(&filter->queries, query) {
@@ -756,7 +811,7 @@ event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 	iter->filter = filter;
 	iter->event = event;
 	iter->failure_ctx = ctx;
-	if (!event_filter_match_fastpath(filter, event))
+	if (!event_filter_match_fastpath(filter, event, ctx))
 		iter->idx = UINT_MAX;
 	return iter;
 }
@@ -301,10 +301,26 @@ bool event_want_level(struct event *event, enum log_type level,
 	if (global_debug_send_filter != NULL) {
 		struct failure_context ctx = { .type = LOG_TYPE_DEBUG };
 
-		if (event_filter_match_source(global_debug_send_filter, event,
-					      source_filename, source_linenum,
-					      &ctx))
-			return TRUE;
+		if (event->debug_send_checked_filter_counter ==
+			event_filter_replace_counter &&
+		    event->debug_send_checked_change_id == event->change_id &&
+		    event->debug_send_checked_source_filename == source_filename &&
+		    event->debug_send_checked_source_linenum == source_linenum) {
+			/* Same e_debug() call for an unchanged event and
+			   unchanged filters. Changes to parent events aren't
+			   noticed, similarly to sending_debug_log. */
+			return event->sending_debug_send;
+		}
+		event->sending_debug_send =
+			event_filter_match_source(global_debug_send_filter, event,
+						  source_filename, source_linenum,
+						  &ctx);
+		event->debug_send_checked_filter_counter =
+			event_filter_replace_counter;
+		event->debug_send_checked_change_id = event->change_id;
+		event->debug_send_checked_source_filename = source_filename;
+		event->debug_send_checked_source_linenum = source_linenum;
+		return event->sending_debug_send;
 	}
 	return FALSE;
 }
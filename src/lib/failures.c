@@ -59,10 +59,17 @@ static char *log_prefix = NULL;
 static char *log_stamp_format = NULL, *log_stamp_format_suffix = NULL;
 static bool failure_ignore_errors = FALSE, log_prefix_sent = FALSE;
 static bool coredump_on_error = FALSE;
+/* Debug and info lines buffered with internal logging. The buffer is written
+   with a single write(), so it's never larger than PIPE_BUF. */
+static bool internal_buffering = FALSE;
+static unsigned char internal_buf[PIPE_BUF];
+static size_t internal_buf_used = 0;
+static pid_t internal_buf_pid;
 static void log_timestamp_add(const struct failure_context *ctx, string_t *str);
 static void log_prefix_add(const struct failure_context *ctx, string_t *str);
 static void i_failure_send_option_forced(const char *key, const char *value);
 static int internal_send_split(string_t *full_str, size_t prefix_len);
+static int internal_buf_flush(void);
 
 static string_t * ATTR_FORMAT(3, 0) default_format(const struct failure_context *ctx,
 						   size_t *prefix_len_r ATTR_UNUSED,
@@ -207,13 +214,35 @@ static string_t * ATTR_FORMAT(3, 0) internal_format(const struct failure_context
 	return str;
 }
 
-static int internal_write(enum log_type type ATTR_UNUSED, string_t *data, size_t prefix_len)
+static int internal_write(enum log_type type, string_t *data, size_t prefix_len)
 {
 	if (str_len(data)+1 <= PIPE_BUF) {
 		str_append_c(data, '\n');
-		return log_fd_write(STDERR_FILENO,
-				    str_data(data), str_len(data));
+		if (!internal_buffering) {
+			return log_fd_write(STDERR_FILENO,
+					    str_data(data), str_len(data));
+		}
+		if (internal_buf_used > 0 && internal_buf_pid != getpid()) {
+			/* forked after buffering - the parent writes these */
+			internal_buf_used = 0;
+		}
+		if (internal_buf_used + str_len(data) > PIPE_BUF) {
+			if (internal_buf_flush() < 0)
+				return -1;
+		}
+		if (internal_buf_used == 0)
+			internal_buf_pid = getpid();
+		memcpy(internal_buf + internal_buf_used,
+		       str_data(data), str_len(data));
+		internal_buf_used += str_len(data);
+		if (type == LOG_TYPE_DEBUG || type == LOG_TYPE_INFO)
+			return 0;
+		/* write warnings and errors immediately, together with
+		   whatever was buffered before them */
+		return internal_buf_flush();
 	}
+	if (internal_buf_flush() < 0)
+		return -1;
 	return internal_send_split(data, prefix_len);
 }
 
@@ -306,6 +335,8 @@ void failure_exit(int status)
 {
 	static bool recursed = FALSE;
 
+	(void)internal_buf_flush();
+
 	if (failure_exit_callback != NULL && !recursed) {
 		recursed = TRUE;
 		failure_exit_callback(&status);
@@ -724,6 +755,8 @@ static void i_failure_send_option_forced(const char *key, const char *value)
 {
 	const char *str;
 
+	/* the options apply only to the lines logged after them */
+	(void)internal_buf_flush();
 	str = t_strdup_printf("\001%c%s %s=%s\n", LOG_TYPE_OPTION+1,
 			      my_pid, key, value);
 	(void)write_full(STDERR_FILENO, str, strlen(str));
@@ -799,6 +832,28 @@ static int internal_send_split(string_t *full_str, size_t prefix_len)
 }
 
 
+static int internal_buf_flush(void)
+{
+	size_t size = internal_buf_used;
+
+	if (size == 0)
+		return 0;
+	internal_buf_used = 0;
+	if (internal_buf_pid != getpid()) {
+		/* forked after buffering - the parent writes these */
+		return 0;
+	}
+	return log_fd_write(STDERR_FILENO, internal_buf, size);
+}
+
+void i_failure_flush(void)
+{
+	if (internal_buf_used == 0)
+		return;
+	if (internal_buf_flush() < 0 && !failure_ignore_errors)
+		failure_exit(FATAL_LOGERROR);
+}
+
 static bool line_parse_prefix(const char *line, enum log_type *log_type_r,
 			      bool *replace_prefix_r, bool *have_prefix_len_r)
 {
@@ -892,6 +947,13 @@ void i_set_failure_internal(void)
 	i_set_debug_handler(i_internal_error_handler);
 }
 
+void i_set_failure_internal_buffering(bool set)
+{
+	internal_buffering = set;
+	if (!set)
+		i_failure_flush();
+}
+
 bool i_failure_handler_is_internal(failure_callback_t *const callback)
 {
 	return callback == i_internal_fatal_handler ||
@@ -958,6 +1020,10 @@ void i_set_failure_exit_callback(void (*callback)(int *status))
 
 void failures_deinit(void)
 {
+	/* lib_deinit() already flushed the buffer */
+	internal_buffering = FALSE;
+	internal_buf_used = 0;
+
 	if (log_debug_fd == log_info_fd || log_debug_fd == log_fd)
 		log_debug_fd = STDERR_FILENO;
 
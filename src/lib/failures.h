@@ -115,6 +115,15 @@ void i_set_failure_file(const char *path, const char *prefix);
 
 /* Send errors to stderr using internal error protocol. */
 void i_set_failure_internal(void);
+/* Buffer debug and info lines sent using the internal error protocol, so
+   that multiple lines are sent to the log process with a single write().
+   The buffer is flushed when it's full, when a warning or a more severe
+   message is logged, before the ioloop waits for events and at exit. Lines
+   are lost if the process crashes without going through the fatal handler. */
+void i_set_failure_internal_buffering(bool set);
+/* Write out any buffered log lines. This must be called before exiting
+   with _exit(), which skips the flush done by lib_exit(). */
+void i_failure_flush(void);
 /* Returns TRUE if the given callback handler was set via
    i_set_failure_internal(). */
 bool i_failure_handler_is_internal(failure_callback_t *const callback);
@@ -6,6 +6,7 @@
 #include "hex-binary.h"
 #include "hostpid.h"
 #include "file-lock.h"
+#include "time-util.h"
 #include "eacces-error.h"
 #include "write-full.h"
 #include "safe-mkstemp.h"
@@ -50,6 +51,8 @@ struct dotlock {
 	int fd;
 
 	time_t lock_time;
+	/* Set when the dotlock was created, for the release event */
+	struct timeval locked_time;
 };
 
 struct file_change_info {
@@ -88,6 +91,8 @@ file_dotlock_alloc(const struct dotlock_settings *settings, const char *path)
 		dotlock->settings.lock_suffix = DEFAULT_LOCK_SUFFIX;
 	dotlock->path = i_strdup(path);
 	dotlock->fd = -1;
+	if (dotlock->settings.event != NULL)
+		event_ref(dotlock->settings.event);
 
 	return dotlock;
 }
@@ -477,6 +482,7 @@ dotlock_create(struct dotlock *dotlock, enum dotlock_create_flags flags,
 	time_t now, max_wait_time, last_notify;
 	time_t prev_last_change = 0, prev_wait_update = 0;
 	string_t *tmp_path;
+	uint64_t wait_usecs;
 	int ret;
 	bool do_wait;
 
@@ -564,7 +570,15 @@ dotlock_create(struct dotlock *dotlock, enum dotlock_create_flags flags,
 		do_wait = TRUE;
 		now = time(NULL);
 	} while (now < max_wait_time);
-	file_lock_wait_end(dotlock->path);
+	wait_usecs = file_lock_wait_end(dotlock->path);
+
+	if ((flags & DOTLOCK_CREATE_FLAG_CHECKONLY) == 0) {
+		/* do_wait is set only after the first attempt failed */
+		file_lock_send_wait_event(set->event, FILE_LOCK_METHOD_DOTLOCK,
+			dotlock->path, F_WRLCK, do_wait, wait_usecs,
+			ret > 0 ? NULL : ret == 0 ? "Timed out" :
+			t_strdup_printf("Locking failed: %m"));
+	}
 
 	if (ret > 0) {
 		i_assert(lock_info.fd != -1);
@@ -578,6 +592,7 @@ dotlock_create(struct dotlock *dotlock, enum dotlock_create_flags flags,
 
 			dotlock->fd = lock_info.fd;
                         dotlock->lock_time = now;
+			i_gettimeofday(&dotlock->locked_time);
 			lock_info.fd = -1;
 
 			if (st.st_ctime + MAX_TIME_DIFF < now ||
@@ -608,10 +623,18 @@ dotlock_create(struct dotlock *dotlock, enum dotlock_create_flags flags,
 static void file_dotlock_free(struct dotlock **_dotlock)
 {
 	struct dotlock *dotlock = *_dotlock;
+	struct timeval now;
 	int old_errno;
 
 	*_dotlock = NULL;
 
+	if (dotlock->locked_time.tv_sec != 0) {
+		i_gettimeofday(&now);
+		file_lock_send_release_event(dotlock->settings.event,
+			FILE_LOCK_METHOD_DOTLOCK, dotlock->path, F_WRLCK,
+			timeval_diff_usecs(&now, &dotlock->locked_time));
+	}
+
 	if (dotlock->fd != -1) {
 		old_errno = errno;
 		if (close(dotlock->fd) < 0)
@@ -620,6 +643,7 @@ static void file_dotlock_free(struct dotlock **_dotlock)
 		errno = old_errno;
 	}
 
+	event_unref(&dotlock->settings.event);
 	i_free(dotlock->path);
 	i_free(dotlock->lock_path);
 	i_free(dotlock);
@@ -27,6 +27,10 @@ struct dotlock_settings {
 	bool (*callback)(unsigned int secs_left, bool stale, void *context);
 	void *context;
 
+	/* Parent event for the lock events (see file-lock.h). NULL sends them
+	   without a parent. */
+	struct event *event;
+
 	/* Rely on O_EXCL locking to work instead of using hardlinks.
 	   It's faster, but doesn't work with all NFS implementations. */
 	bool use_excl_lock:1;
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream.h"
+#include "crc32.h"
 #include "file-lock.h"
 #include "file-dotlock.h"
 #include "time-util.h"
@@ -23,6 +24,10 @@ struct file_lock {
 	int lock_type;
 };
 
+static struct event_category event_category_lock = {
+	.name = "lock",
+};
+
 static struct timeval lock_wait_start;
 static uint64_t file_lock_wait_usecs = 0;
 static long long file_lock_slow_warning_usecs = -1;
@@ -160,18 +165,18 @@ static bool err_is_lock_timeout(time_t started, unsigned int timeout_secs)
 
 static int file_lock_do(int fd, const char *path, int lock_type,
 			const struct file_lock_settings *set,
-			unsigned int timeout_secs, const char **error_r)
+			unsigned int timeout_secs, bool *contended_r,
+			uint64_t *wait_usecs_r, const char **error_r)
 {
 	const char *lock_type_str;
 	time_t started = time(NULL);
+	bool waited = FALSE;
 	int ret;
 
 	i_assert(fd != -1);
 
-	if (timeout_secs != 0) {
-		alarm(timeout_secs);
-		file_lock_wait_start();
-	}
+	*contended_r = FALSE;
+	*wait_usecs_r = 0;
 
 	lock_type_str = lock_type == F_UNLCK ? "unlock" :
 		(lock_type == F_RDLCK ? "read-lock" : "write-lock");
@@ -190,10 +195,19 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 		fl.l_start = 0;
 		fl.l_len = 0;
 
-		ret = fcntl(fd, timeout_secs != 0 ? F_SETLKW : F_SETLK, &fl);
-		if (timeout_secs != 0) {
-			alarm(0);
-			file_lock_wait_end(path);
+		/* Try without waiting first, so we know whether the lock was
+		   contended. */
+		ret = fcntl(fd, F_SETLK, &fl);
+		if (ret < 0 && (errno == EACCES || errno == EAGAIN)) {
+			*contended_r = TRUE;
+			if (timeout_secs != 0) {
+				waited = TRUE;
+				alarm(timeout_secs);
+				file_lock_wait_start();
+				ret = fcntl(fd, F_SETLKW, &fl);
+				alarm(0);
+				*wait_usecs_r = file_lock_wait_end(path);
+			}
 		}
 
 		if (ret == 0)
@@ -219,7 +233,7 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 			return 0;
 		}
 		*error_r = t_strdup_printf("fcntl(%s, %s, %s) locking failed: %m",
-			path, lock_type_str, timeout_secs == 0 ? "F_SETLK" : "F_SETLKW");
+			path, lock_type_str, waited ? "F_SETLKW" : "F_SETLK");
 		if (errno == EDEADLK && !set->allow_deadlock) {
 			i_panic("%s%s", *error_r,
 				file_lock_find(fd, set->lock_method,
@@ -234,7 +248,7 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 			"Can't lock file %s: flock() not supported", path);
 		return -1;
 #else
-		int operation = timeout_secs != 0 ? 0 : LOCK_NB;
+		int operation = LOCK_NB;
 
 		switch (lock_type) {
 		case F_RDLCK:
@@ -248,10 +262,18 @@ static int file_lock_do(int fd, const char *path, int lock_type,
 			break;
 		}
 
+		/* Try without waiting first, so we know whether the lock was
+		   contended. */
 		ret = flock(fd, operation);
-		if (timeout_secs != 0) {
-			alarm(0);
-			file_lock_wait_end(path);
+		if (ret < 0 && errno == EWOULDBLOCK) {
+			*contended_r = TRUE;
+			if (timeout_secs != 0) {
+				alarm(timeout_secs);
+				file_lock_wait_start();
+				ret = flock(fd, operation & ~LOCK_NB);
+				alarm(0);
+				*wait_usecs_r = file_lock_wait_end(path);
+			}
 		}
 
 		if (ret == 0)
@@ -297,14 +319,22 @@ int file_wait_lock(int fd, const char *path, int lock_type,
 		   struct file_lock **lock_r, const char **error_r)
 {
 	struct file_lock *lock;
+	uint64_t wait_usecs;
+	bool contended;
 	int ret;
 
-	ret = file_lock_do(fd, path, lock_type, set, timeout_secs, error_r);
+	ret = file_lock_do(fd, path, lock_type, set, timeout_secs,
+			   &contended, &wait_usecs, error_r);
+	file_lock_send_wait_event(set->event, set->lock_method, path,
+				  lock_type, contended, wait_usecs,
+				  ret > 0 ? NULL : *error_r);
 	if (ret <= 0)
 		return ret;
 
 	lock = i_new(struct file_lock, 1);
 	lock->set = *set;
+	if (lock->set.event != NULL)
+		event_ref(lock->set.event);
 	lock->fd = fd;
 	lock->path = i_strdup(path);
 	lock->lock_type = lock_type;
@@ -316,10 +346,12 @@ int file_wait_lock(int fd, const char *path, int lock_type,
 int file_lock_try_update(struct file_lock *lock, int lock_type)
 {
 	const char *error;
+	uint64_t wait_usecs;
+	bool contended;
 	int ret;
 
 	ret = file_lock_do(lock->fd, lock->path, lock_type, &lock->set, 0,
-			   &error);
+			   &contended, &wait_usecs, &error);
 	if (ret <= 0)
 		return ret;
 	file_lock_log_warning_if_slow(lock);
@@ -356,9 +388,11 @@ struct file_lock *file_lock_from_dotlock(struct dotlock **dotlock)
 static void file_unlock_real(struct file_lock *lock)
 {
 	const char *error;
+	uint64_t wait_usecs;
+	bool contended;
 
 	if (file_lock_do(lock->fd, lock->path, F_UNLCK, &lock->set, 0,
-			 &error) == 0) {
+			 &contended, &wait_usecs, &error) == 0) {
 		/* this shouldn't happen */
 		i_error("file_unlock(%s) failed: %m", lock->path);
 	}
@@ -418,12 +452,21 @@ static void file_try_unlink_locked(struct file_lock *lock)
 void file_lock_free(struct file_lock **_lock)
 {
 	struct file_lock *lock = *_lock;
+	struct timeval now;
 
 	if (lock == NULL)
 		return;
 
 	*_lock = NULL;
 
+	if (lock->set.lock_method != FILE_LOCK_METHOD_DOTLOCK) {
+		/* dotlocks send their own event when they're deleted */
+		i_gettimeofday(&now);
+		file_lock_send_release_event(lock->set.event,
+			lock->set.lock_method, lock->path, lock->lock_type,
+			timeval_diff_usecs(&now, &lock->locked_time));
+	}
+
 	if (lock->dotlock != NULL)
 		file_dotlock_delete(&lock->dotlock);
 	if (lock->set.unlink_on_free)
@@ -432,6 +475,7 @@ void file_lock_free(struct file_lock **_lock)
 		i_close_fd(&lock->fd);
 
 	file_lock_log_warning_if_slow(lock);
+	event_unref(&lock->set.event);
 	i_free(lock->path);
 	i_free(lock);
 }
@@ -499,7 +543,7 @@ static void file_lock_log_warning_if_slow(struct file_lock *lock)
 	}
 }
 
-void file_lock_wait_end(const char *lock_name)
+uint64_t file_lock_wait_end(const char *lock_name)
 {
 	struct timeval now;
 
@@ -522,9 +566,77 @@ void file_lock_wait_end(const char *lock_name)
 	}
 	file_lock_wait_usecs += diff;
 	lock_wait_start.tv_sec = 0;
+	return diff;
 }
 
 uint64_t file_lock_wait_get_total_usecs(void)
 {
 	return file_lock_wait_usecs;
 }
+
+static struct event *
+file_lock_event_create(struct event *parent, const char *name,
+		       enum file_lock_method lock_method, const char *path,
+		       int lock_type)
+{
+	struct event *event = event_create(parent);
+	const char *p;
+
+	event_add_category(event, &event_category_lock);
+	event_set_name(event, name);
+	event_add_str(event, "lock_method",
+		      file_lock_method_to_str(lock_method));
+	event_add_str(event, "lock_type",
+		      lock_type == F_RDLCK ? "shared" : "exclusive");
+	/* The file name tells the kind of the lock (e.g. dovecot.index.log or
+	   dovecot.map.index.log), while the directory's hash allows finding
+	   the hot spots without logging user-specific paths. */
+	p = strrchr(path, '/');
+	event_add_str(event, "lock_name", p == NULL ? path : p + 1);
+	event_add_str(event, "lock_dir_hash", t_strdup_printf("%08x",
+		p == NULL ? 0 : crc32_data(path, p - path)));
+	return event;
+}
+
+void file_lock_send_wait_event(struct event *parent,
+			       enum file_lock_method lock_method,
+			       const char *path, int lock_type, bool contended,
+			       uint64_t wait_usecs, const char *error)
+{
+	struct event *event;
+	int old_errno = errno;
+
+	event = file_lock_event_create(parent, "file_lock_wait_finished",
+				       lock_method, path, lock_type);
+	event_add_int(event, "contended", contended ? 1 : 0);
+	event_add_int(event, "wait_usecs", wait_usecs);
+	if (error != NULL) {
+		event_add_str(event, "error", error);
+		e_debug(event, "Locking %s failed: %s", path, error);
+	} else {
+		e_debug(event, "Locked %s (waited %"PRIu64" usecs)",
+			path, wait_usecs);
+	}
+	event_unref(&event);
+	errno = old_errno;
+}
+
+void file_lock_send_release_event(struct event *parent,
+				  enum file_lock_method lock_method,
+				  const char *path, int lock_type,
+				  long long hold_usecs)
+{
+	struct event *event;
+	int old_errno = errno;
+
+	if (hold_usecs < 0) {
+		/* time moved backwards */
+		hold_usecs = 0;
+	}
+	event = file_lock_event_create(parent, "file_lock_released",
+				       lock_method, path, lock_type);
+	event_add_int(event, "hold_usecs", hold_usecs);
+	e_debug(event, "Unlocked %s (held %lld usecs)", path, hold_usecs);
+	event_unref(&event);
+	errno = old_errno;
+}
@@ -17,6 +17,9 @@ enum file_lock_method {
 
 struct file_lock_settings {
 	enum file_lock_method lock_method;
+	/* Parent event for the lock's events. NULL sends them without a
+	   parent. */
+	struct event *event;
 
 	/* When the lock is freed, close the fd automatically. This can
 	   be useful for files that are only created to exist as lock files. */
@@ -78,10 +81,30 @@ void file_lock_set_path(struct file_lock *lock, const char *path);
 const char *file_lock_find(int lock_fd, enum file_lock_method lock_method,
 			   int lock_type);
 
-/* Track the duration of a lock wait. */
+/* Track the duration of a lock wait. Returns the waited microseconds. */
 void file_lock_wait_start(void);
-void file_lock_wait_end(const char *lock_name);
+uint64_t file_lock_wait_end(const char *lock_name);
 /* Return how many microseconds has been spent on lock waiting. */
 uint64_t file_lock_wait_get_total_usecs(void);
 
+/* Send the lock events. These are used by file locks and dotlocks:
+
+   "file_lock_wait_finished" is sent after each locking attempt. contended=1
+   if the lock was held by someone else, wait_usecs tells how long was waited
+   for it and error is set if the lock wasn't acquired.
+
+   "file_lock_released" is sent when the lock is freed, with hold_usecs.
+
+   Both have lock_method, lock_type (shared/exclusive), lock_name (the file's
+   name without the directory) and lock_dir_hash (hash of the directory)
+   fields. */
+void file_lock_send_wait_event(struct event *parent,
+			       enum file_lock_method lock_method,
+			       const char *path, int lock_type, bool contended,
+			       uint64_t wait_usecs, const char *error);
+void file_lock_send_release_event(struct event *parent,
+				  enum file_lock_method lock_method,
+				  const char *path, int lock_type,
+				  long long hold_usecs);
+
 #endif
@@ -9,9 +9,20 @@
 #include <ctype.h>
 
 #define HASH_TABLE_MIN_SIZE 67
+/* Minimum number of entries allocated for HASH_TABLE_FLAG_OPEN_ADDRESSING */
+#define HASH_OPEN_MIN_ENTRIES 8
+/* Open addressing index slot isn't used */
+#define HASH_OPEN_TAG_EMPTY 0x00
+/* Open addressing index slot pointed to a removed entry */
+#define HASH_OPEN_TAG_DELETED 0x01
+/* Used slots have this bit set in the tag, with the rest of the bits taken
+   from the hash. */
+#define HASH_OPEN_TAG_USED 0x80
 
 #undef hash_table_create
+#undef hash_table_create_full
 #undef hash_table_create_direct
+#undef hash_table_create_direct_full
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,8 +43,16 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_open_entry {
+	/* NULL if the entry has been removed */
+	void *key;
+	void *value;
+	unsigned int hash;
+};
+
 struct hash_table {
 	pool_t node_pool;
+	enum hash_table_flags flags;
 
 	int frozen;
 	unsigned int initial_size, nodes_count, removed_count;
@@ -42,6 +61,20 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* HASH_TABLE_FLAG_OPEN_ADDRESSING: Entries are stored in insertion
+	   order to the entries array, which makes iteration stable even if
+	   the index is rebuilt. The index is a linear probing table of
+	   entry positions. Each index slot has also a one byte tag, which
+	   tells whether the slot is used and contains 7 bits of the hash,
+	   so the probing rarely needs to access the entries themselves.
+	   removed_count is the number of removed entries that haven't yet
+	   been compacted out of the array. */
+	struct hash_open_entry *entries;
+	unsigned int entries_used, entries_alloc;
+	uint32_t *index;
+	uint8_t *index_tags;
+	unsigned int index_bits, index_used;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
 };
@@ -59,27 +92,47 @@ enum hash_table_operation{
 };
 
 static bool hash_table_resize(struct hash_table *table, bool grow);
+static void hash_open_rebuild_index(struct hash_table *table);
 
-void hash_table_create(struct hash_table **table_r, pool_t node_pool,
-		       unsigned int initial_size, hash_callback_t *hash_cb,
-		       hash_cmp_callback_t *key_compare_cb)
+void hash_table_create_full(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size, hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb,
+			    enum hash_table_flags flags)
 {
 	struct hash_table *table;
 
 	pool_ref(node_pool);
 	table = i_new(struct hash_table, 1);
 	table->node_pool = node_pool;
-	table->initial_size =
-		I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
+	table->flags = flags;
 
 	table->hash_cb = hash_cb;
 	table->key_compare_cb = key_compare_cb;
 
-	table->size = table->initial_size;
-	table->nodes = i_new(struct hash_node, table->size);
+	if ((flags & HASH_TABLE_FLAG_OPEN_ADDRESSING) != 0) {
+		table->initial_size =
+			I_MAX(initial_size, HASH_OPEN_MIN_ENTRIES);
+		table->entries_alloc = table->initial_size;
+		table->entries = i_new(struct hash_open_entry,
+				       table->entries_alloc);
+		hash_open_rebuild_index(table);
+	} else {
+		table->initial_size =
+			I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
+		table->size = table->initial_size;
+		table->nodes = i_new(struct hash_node, table->size);
+	}
 	*table_r = table;
 }
 
+void hash_table_create(struct hash_table **table_r, pool_t node_pool,
+		       unsigned int initial_size, hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb)
+{
+	hash_table_create_full(table_r, node_pool, initial_size,
+			       hash_cb, key_compare_cb, 0);
+}
+
 static unsigned int direct_hash(const void *p)
 {
 	/* NOTE: may truncate the value, but that doesn't matter. */
@@ -98,6 +151,202 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+void hash_table_create_direct_full(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size,
+				   enum hash_table_flags flags)
+{
+	hash_table_create_full(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp, flags);
+}
+
+static inline bool hash_table_is_open(const struct hash_table *table)
+{
+	return (table->flags & HASH_TABLE_FLAG_OPEN_ADDRESSING) != 0;
+}
+
+static inline unsigned int ATTR_NO_SANITIZE_INTEGER
+hash_open_slot(const struct hash_table *table, unsigned int hash)
+{
+	/* Fibonacci hashing: the hash callbacks (especially direct_hash())
+	   often have poor low bits, so mix all of them into the top bits. */
+	return (uint32_t)(hash * 2654435769U) >> (32 - table->index_bits);
+}
+
+static inline uint8_t ATTR_NO_SANITIZE_INTEGER
+hash_open_tag(unsigned int hash)
+{
+	/* use a different multiplier than for the slot, so the tag bits are
+	   independent of the slot position */
+	return HASH_OPEN_TAG_USED | ((uint32_t)(hash * 2246822519U) >> 25);
+}
+
+static void
+hash_open_index_add(struct hash_table *table, unsigned int entry_idx)
+{
+	unsigned int mask = (1U << table->index_bits) - 1;
+	unsigned int hash, slot;
+
+	hash = table->entries[entry_idx].hash;
+	slot = hash_open_slot(table, hash);
+	while ((table->index_tags[slot] & HASH_OPEN_TAG_USED) != 0)
+		slot = (slot + 1) & mask;
+	if (table->index_tags[slot] == HASH_OPEN_TAG_EMPTY)
+		table->index_used++;
+	table->index_tags[slot] = hash_open_tag(hash);
+	table->index[slot] = entry_idx;
+}
+
+static void hash_open_rebuild_index(struct hash_table *table)
+{
+	unsigned int i, bits = 3;
+
+	/* keep the index at most half full */
+	while ((1U << bits) < table->entries_alloc * 2U) {
+		i_assert(bits < 31);
+		bits++;
+	}
+	i_free(table->index);
+	i_free(table->index_tags);
+	table->index_bits = bits;
+	table->index = i_new(uint32_t, 1U << bits);
+	table->index_tags = i_new(uint8_t, 1U << bits);
+	table->index_used = 0;
+
+	for (i = 0; i < table->entries_used; i++) {
+		if (table->entries[i].key != NULL)
+			hash_open_index_add(table, i);
+	}
+}
+
+static void
+hash_open_compact(struct hash_table *table, unsigned int new_alloc)
+{
+	unsigned int i, j;
+
+	i_assert(table->frozen == 0);
+	i_assert(new_alloc >= table->nodes_count);
+
+	for (i = j = 0; i < table->entries_used; i++) {
+		if (table->entries[i].key != NULL)
+			table->entries[j++] = table->entries[i];
+	}
+	i_assert(j == table->nodes_count);
+	table->entries_used = j;
+	table->removed_count = 0;
+
+	if (new_alloc != table->entries_alloc) {
+		table->entries = i_realloc_type(table->entries,
+						struct hash_open_entry,
+						table->entries_alloc,
+						new_alloc);
+		table->entries_alloc = new_alloc;
+	}
+	hash_open_rebuild_index(table);
+}
+
+static void hash_open_compact_removed(struct hash_table *table)
+{
+	unsigned int new_alloc = table->entries_alloc;
+
+	if (table->removed_count <= table->entries_used / 2)
+		return;
+
+	while (new_alloc / 2 >= table->initial_size &&
+	       table->nodes_count * 4 < new_alloc)
+		new_alloc /= 2;
+	hash_open_compact(table, new_alloc);
+}
+
+static struct hash_open_entry *
+hash_open_lookup_entry(const struct hash_table *table, const void *key,
+		       unsigned int hash, unsigned int *slot_r)
+{
+	unsigned int mask = (1U << table->index_bits) - 1;
+	struct hash_open_entry *entry;
+	unsigned int slot;
+	uint8_t tag, wanted_tag = hash_open_tag(hash);
+
+	slot = hash_open_slot(table, hash);
+	while ((tag = table->index_tags[slot]) != HASH_OPEN_TAG_EMPTY) {
+		if (tag == wanted_tag) {
+			entry = &table->entries[table->index[slot]];
+			if (entry->hash == hash &&
+			    table->key_compare_cb(entry->key, key) == 0) {
+				*slot_r = slot;
+				return entry;
+			}
+		}
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+static void
+hash_open_insert(struct hash_table *table, void *key, void *value,
+		 enum hash_table_operation opcode)
+{
+	struct hash_open_entry *entry;
+	unsigned int hash, slot;
+
+	i_assert(table->nodes_count < UINT_MAX);
+	i_assert(key != NULL);
+
+	hash = table->hash_cb(key);
+	entry = hash_open_lookup_entry(table, key, hash, &slot);
+	if (entry != NULL) {
+		i_assert(opcode == HASH_TABLE_OP_UPDATE);
+		entry->value = value;
+		return;
+	}
+
+	if (table->entries_used == table->entries_alloc) {
+		if (table->frozen == 0 &&
+		    table->removed_count >= table->entries_alloc / 4)
+			hash_open_compact(table, table->entries_alloc);
+		else {
+			i_assert(table->entries_alloc < UINT_MAX / 4);
+			table->entries = i_realloc_type(table->entries,
+				struct hash_open_entry, table->entries_alloc,
+				table->entries_alloc * 2);
+			table->entries_alloc *= 2;
+			hash_open_rebuild_index(table);
+		}
+	}
+
+	entry = &table->entries[table->entries_used];
+	entry->key = key;
+	entry->value = value;
+	entry->hash = hash;
+	if ((table->index_used + 1) * 4 > (3U << table->index_bits)) {
+		/* too many removed slots in the index */
+		table->entries_used++;
+		hash_open_rebuild_index(table);
+	} else {
+		hash_open_index_add(table, table->entries_used++);
+	}
+	table->nodes_count++;
+}
+
+static bool hash_open_try_remove(struct hash_table *table, const void *key)
+{
+	struct hash_open_entry *entry;
+	unsigned int slot;
+
+	entry = hash_open_lookup_entry(table, key, table->hash_cb(key), &slot);
+	if (unlikely(entry == NULL))
+		return FALSE;
+
+	entry->key = NULL;
+	entry->value = NULL;
+	table->index_tags[slot] = HASH_OPEN_TAG_DELETED;
+	table->nodes_count--;
+	table->removed_count++;
+
+	if (table->frozen == 0)
+		hash_open_compact_removed(table);
+	return TRUE;
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,13 +388,17 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (!hash_table_is_open(table) &&
+	    !table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
 
 	pool_unref(&table->node_pool);
 	i_free(table->nodes);
+	i_free(table->entries);
+	i_free(table->index);
+	i_free(table->index_tags);
 	i_free(table);
 }
 
@@ -153,6 +406,16 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (hash_table_is_open(table)) {
+		table->entries_used = 0;
+		table->nodes_count = 0;
+		table->removed_count = 0;
+		table->index_used = 0;
+		memset(table->index_tags, HASH_OPEN_TAG_EMPTY,
+		       1U << table->index_bits);
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +454,15 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (hash_table_is_open(table)) {
+		const struct hash_open_entry *entry;
+		unsigned int slot;
+
+		entry = hash_open_lookup_entry(table, key,
+					       table->hash_cb(key), &slot);
+		return entry != NULL ? entry->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +473,20 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (hash_table_is_open(table)) {
+		const struct hash_open_entry *entry;
+		unsigned int slot;
+
+		entry = hash_open_lookup_entry(table, lookup_key,
+					       table->hash_cb(lookup_key),
+					       &slot);
+		if (entry == NULL)
+			return FALSE;
+		*orig_key = entry->key;
+		*value = entry->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +583,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (hash_table_is_open(table))
+		hash_open_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (hash_table_is_open(table))
+		hash_open_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +639,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (hash_table_is_open(table))
+		return hash_open_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,7 +671,8 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (!hash_table_is_open(table))
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -403,6 +699,21 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (hash_table_is_open(ctx->table)) {
+		const struct hash_table *table = ctx->table;
+
+		for (; ctx->pos < table->entries_used; ctx->pos++) {
+			if (table->entries[ctx->pos].key != NULL) {
+				*key_r = table->entries[ctx->pos].key;
+				*value_r = table->entries[ctx->pos].value;
+				ctx->pos++;
+				return TRUE;
+			}
+		}
+		*key_r = *value_r = NULL;
+		return FALSE;
+	}
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -441,6 +752,10 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (hash_table_is_open(table)) {
+		hash_open_compact_removed(table);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -9,6 +9,15 @@ struct hash_table;
 #  define HASH_VALUE_CAST(table)
 #endif
 
+enum hash_table_flags {
+	/* Store the entries in a flat array with an open addressing index
+	   instead of node_pool allocated collision lists. This uses less
+	   memory and avoids pointer chasing on collisions, which makes
+	   lookups and especially iteration faster for large tables.
+	   node_pool isn't used for allocations. */
+	HASH_TABLE_FLAG_OPEN_ADDRESSING	= 0x01,
+};
+
 /* Returns hash code. */
 typedef unsigned int hash_callback_t(const void *p);
 /* Returns 0 if the pointers are equal. */
@@ -22,8 +31,7 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size,
 		       hash_callback_t *hash_cb,
 		       hash_cmp_callback_t *key_compare_cb);
-#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
-	TYPE_CHECKS(void, \
+#define HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb) \
 	COMPILE_ERROR_IF_TRUE( \
 		sizeof((*table)._key) != sizeof(void *) || \
 		sizeof((*table)._value) != sizeof(void *)) || \
@@ -36,10 +44,25 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
 			unsigned int (*)(typeof((*table)._key))) && \
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
-		unsigned int (*)(typeof((*table)._const_key)))), \
+		unsigned int (*)(typeof((*table)._const_key))))
+#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
 	hash_table_create(&(*table)._table, pool, size, \
 		(hash_callback_t *)hash_cb, \
 		(hash_cmp_callback_t *)key_cmp_cb))
+/* Same as hash_table_create(), but with flags. */
+void hash_table_create_full(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb,
+			    enum hash_table_flags flags);
+#define hash_table_create_full(table, pool, size, hash_cb, key_cmp_cb, flags) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
+	hash_table_create_full(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb, flags))
 
 /* Create hash table where comparisons are done directly with the pointers. */
 void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
@@ -50,6 +73,15 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 		sizeof((*table)._key) != sizeof(void *) || \
 		sizeof((*table)._value) != sizeof(void *)), \
 	hash_table_create_direct(&(*table)._table, pool, size))
+void hash_table_create_direct_full(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size,
+				   enum hash_table_flags flags);
+#define hash_table_create_direct_full(table, pool, size, flags) \
+	TYPE_CHECKS(void, \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)), \
+	hash_table_create_direct_full(&(*table)._table, pool, size, flags))
 
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
@@ -13,10 +13,10 @@ const char *my_pid = NULL;
 
 static char *my_hostname_dup = NULL;
 static char *my_domain = NULL;
+static char my_pid_buf[MAX_INT_STRLEN];
 
 void hostpid_init(void)
 {
-	static char pid[MAX_INT_STRLEN];
 	char hostname[256];
 	const char *value;
 
@@ -38,8 +38,14 @@ void hostpid_init(void)
 	my_hostname_dup = i_strdup(value);
 	my_hostname = my_hostname_dup;
 
-	i_snprintf(pid, sizeof(pid), "%lld", (long long)getpid());
-	my_pid = pid;
+	hostpid_refresh_pid();
+}
+
+void hostpid_refresh_pid(void)
+{
+	i_snprintf(my_pid_buf, sizeof(my_pid_buf), "%lld",
+		   (long long)getpid());
+	my_pid = my_pid_buf;
 }
 
 void hostpid_deinit(void)
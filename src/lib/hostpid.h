@@ -12,6 +12,8 @@ extern const char *my_pid;
 /* Initializes my_hostname and my_pid. */
 void hostpid_init(void);
 void hostpid_deinit(void);
+/* Update my_pid after fork(). */
+void hostpid_refresh_pid(void);
 
 /* Returns the current host+domain, or if it fails fallback to returning
    hostname. */
@@ -4,11 +4,22 @@
 #include "priorityq.h"
 #include "ioloop.h"
 #include "array-decl.h"
+#include "hash-decl.h"
 
 #ifndef IOLOOP_INITIAL_FD_COUNT
 #  define IOLOOP_INITIAL_FD_COUNT 128
 #endif
 
+/* Repeating timeouts with at least this many milliseconds are kept in a
+   timer wheel with one second slots instead of the priority queue. This
+   makes timeout_reset() O(1) for the typical idle/keepalive timeouts. The
+   timeouts are moved to the priority queue when their slot comes up, so
+   they're still triggered at the exact time. */
+#define IOLOOP_TIMEOUT_WHEEL_MIN_MSECS 1000
+/* Number of one second slots in the timer wheel. Timeouts further in the
+   future wrap around and are skipped until their time comes. */
+#define IOLOOP_TIMEOUT_WHEEL_SIZE 1024
+
 struct ioloop {
         struct ioloop *prev;
 
@@ -18,6 +29,13 @@ struct ioloop {
 	struct io_file *next_io_file;
 	struct priorityq *timeouts;
 	ARRAY(struct timeout *) timeouts_new;
+	/* IOLOOP_TIMEOUT_WHEEL_SIZE linked lists, allocated on first use */
+	struct timeout **timeout_wheel;
+	unsigned int timeout_wheel_count;
+	/* Slots before this second have already been handled */
+	time_t timeout_wheel_time;
+	/* None of the timeouts in the wheel expire before this second */
+	time_t timeout_wheel_next;
 	struct io_wait_timer *wait_timers;
 
         struct ioloop_handler_context *handler_context;
@@ -25,12 +43,19 @@ struct ioloop {
 	unsigned int max_fd_count;
 
 	io_loop_time_moved_callback_t *time_moved_callback;
+	ARRAY(struct ioloop_run_end_callback) run_end_callbacks;
 	struct timeval next_max_time;
 	uint64_t ioloop_wait_usecs;
 	struct timeval wait_started;
 
 	unsigned int io_pending_count;
 
+	/* io/timeout callback durations by source file:line, if enabled with
+	   io_loop_set_callback_stats() */
+	HASH_TABLE(struct io_loop_callback_stats *,
+		   struct io_loop_callback_stats *) callback_stats;
+	unsigned int callback_warn_usecs;
+
 	bool running:1;
 	bool iolooping:1;
 	bool stop_after_run_loop:1;
@@ -81,7 +106,11 @@ struct timeout {
 	struct ioloop *ioloop;
 	struct ioloop_context *ctx;
 
+	/* timer wheel slot list, if in_wheel=TRUE */
+	struct timeout *wheel_prev, *wheel_next;
+
 	bool one_shot:1;
+	bool in_wheel:1;
 };
 
 struct io_wait_timer {
@@ -93,6 +122,11 @@ struct io_wait_timer {
 	uint64_t usecs;
 };
 
+struct ioloop_run_end_callback {
+	io_callback_t *callback;
+	void *context;
+};
+
 struct ioloop_context_callback {
 	io_callback_t *activate;
 	io_callback_t *deactivate;
@@ -0,0 +1,480 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+/* Linux io_uring based ioloop handler. Each fd with registered IOs has a
+   single one-shot IORING_OP_POLL_ADD request in flight. All poll (re)arms
+   and cancellations that accumulate during one ioloop iteration are
+   submitted with the same io_uring_enter() call that waits for the next
+   completions, so a busy process does one syscall per iteration instead of
+   an epoll_ctl() per changed fd plus epoll_wait(). */
+
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define IOLOOP_URING_MIN_ENTRIES 64
+#define IOLOOP_URING_MAX_ENTRIES 4096
+
+/* user_data for requests whose completions are ignored */
+#define IOLOOP_URING_USER_DATA_IGNORE 0
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct uring_fd {
+	struct io_list list;
+	int fd;
+	/* Generation of the currently armed poll request. Completions for
+	   older generations are stale and get ignored. Never 0. */
+	uint32_t gen;
+	/* Poll mask of the request currently in flight, 0 if none */
+	unsigned int armed_events;
+	bool dirty;
+};
+
+struct uring_ready {
+	struct uring_fd *ufd;
+	unsigned int revents;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+
+	void *ring_ptr;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int sq_entries;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* number of SQEs queued, but not yet submitted to kernel */
+	unsigned int sq_pending;
+
+	ARRAY(struct uring_fd *) fd_index;
+	ARRAY(struct uring_fd *) dirty;
+	ARRAY(struct uring_ready) ready;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+static void uring_map_rings(struct ioloop_handler_context *ctx,
+			    const struct io_uring_params *p)
+{
+	size_t sq_size, cq_size;
+	unsigned char *ptr;
+
+	sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	ctx->ring_size = I_MAX(sq_size, cq_size);
+
+	/* IORING_FEAT_SINGLE_MMAP is required, so SQ and CQ rings share
+	   the same mapping. */
+	ctx->ring_ptr = mmap(NULL, ctx->ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			     IORING_OFF_SQ_RING);
+	if (ctx->ring_ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring rings) failed: %m");
+	ctx->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			 IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED)
+		i_fatal("mmap(io_uring sqes) failed: %m");
+
+	ptr = ctx->ring_ptr;
+	ctx->sq_head = (void *)(ptr + p->sq_off.head);
+	ctx->sq_tail = (void *)(ptr + p->sq_off.tail);
+	ctx->sq_mask = (void *)(ptr + p->sq_off.ring_mask);
+	ctx->sq_array = (void *)(ptr + p->sq_off.array);
+	ctx->sq_entries = p->sq_entries;
+	ctx->cq_head = (void *)(ptr + p->cq_off.head);
+	ctx->cq_tail = (void *)(ptr + p->cq_off.tail);
+	ctx->cq_mask = (void *)(ptr + p->cq_off.ring_mask);
+	ctx->cqes = (void *)(ptr + p->cq_off.cqes);
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+	struct io_uring_params params;
+	unsigned int entries;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->dirty, initial_fd_count);
+	i_array_init(&ctx->ready, initial_fd_count);
+
+	entries = I_MAX(initial_fd_count, IOLOOP_URING_MIN_ENTRIES);
+	entries = I_MIN(entries, IOLOOP_URING_MAX_ENTRIES);
+
+	i_zero(&params);
+	ctx->ring_fd = sys_io_uring_setup(entries, &params);
+	if (ctx->ring_fd < 0) {
+		if (errno != EMFILE && errno != ENOMEM)
+			i_fatal("io_uring_setup(): %m");
+		else {
+			i_fatal("io_uring_setup(): %m (you may need to increase "
+				"the locked memory limit)");
+		}
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+
+	/* NODROP guarantees that completions aren't lost even if there are
+	   more poll requests in flight than the CQ ring can hold. */
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+	    (params.features & IORING_FEAT_NODROP) == 0 ||
+	    (params.features & IORING_FEAT_EXT_ARG) == 0)
+		i_fatal("io_uring: Kernel is too old (need v5.11 or later)");
+	uring_map_rings(ctx, &params);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct uring_fd **list;
+	unsigned int i, count;
+
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (munmap(ctx->ring_ptr, ctx->ring_size) < 0)
+		i_error("munmap(io_uring rings) failed: %m");
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	array_free(&ctx->fd_index);
+	array_free(&ctx->dirty);
+	array_free(&ctx->ready);
+	i_free(ctx);
+}
+
+static int uring_submit(struct ioloop_handler_context *ctx,
+			unsigned int min_complete, int msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = IORING_ENTER_EXT_ARG;
+	int ret;
+
+	i_zero(&arg);
+	arg.sigmask_sz = _NSIG / 8;
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (msecs >= 0) {
+			ts.tv_sec = msecs / 1000;
+			ts.tv_nsec = (msecs % 1000) * 1000000LL;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+
+	ret = sys_io_uring_enter(ctx->ring_fd, ctx->sq_pending, min_complete,
+				 flags, &arg, sizeof(arg));
+	if (ret < 0) {
+		/* ETIME = wait timed out, EBUSY = CQ overflow is being
+		   flushed. Both are fine, we'll try again. */
+		if (errno != EINTR && errno != ETIME && errno != EBUSY &&
+		    errno != EAGAIN)
+			i_fatal("io_uring_enter(): %m");
+		return -1;
+	}
+	i_assert((unsigned int)ret <= ctx->sq_pending);
+	ctx->sq_pending -= ret;
+	return 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ctx->sq_tail;
+	head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+	while (tail - head >= ctx->sq_entries) {
+		/* SQ ring is full - submit what we have so far */
+		(void)uring_submit(ctx, 0, 0);
+		head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	idx = tail & *ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ctx->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void uring_commit_sqe(struct ioloop_handler_context *ctx)
+{
+	__atomic_store_n(ctx->sq_tail, *ctx->sq_tail + 1, __ATOMIC_RELEASE);
+	ctx->sq_pending++;
+}
+
+static uint64_t uring_fd_user_data(const struct uring_fd *ufd)
+{
+	return ((uint64_t)(unsigned int)ufd->fd << 32) | ufd->gen;
+}
+
+static void uring_poll_add(struct ioloop_handler_context *ctx,
+			   struct uring_fd *ufd, unsigned int events)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = ufd->fd;
+	sqe->poll32_events = events;
+	sqe->user_data = uring_fd_user_data(ufd);
+	uring_commit_sqe(ctx);
+	ufd->armed_events = events;
+}
+
+static void uring_poll_remove(struct ioloop_handler_context *ctx,
+			      struct uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ctx);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_fd_user_data(ufd);
+	sqe->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+	uring_commit_sqe(ctx);
+
+	/* the cancelled request's own completion becomes stale */
+	if (++ufd->gen == 0)
+		ufd->gen++;
+	ufd->armed_events = 0;
+}
+
+static unsigned int uring_event_mask(const struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static void uring_fd_set_dirty(struct ioloop_handler_context *ctx,
+			       struct uring_fd *ufd)
+{
+	if (ufd->dirty)
+		return;
+	ufd->dirty = TRUE;
+	array_push_back(&ctx->dirty, &ufd);
+}
+
+static void uring_flush_dirty(struct ioloop_handler_context *ctx)
+{
+	struct uring_fd *ufd;
+	unsigned int events;
+
+	array_foreach_elem(&ctx->dirty, ufd) {
+		ufd->dirty = FALSE;
+		events = uring_event_mask(&ufd->list);
+		if (ufd->armed_events == events)
+			continue;
+		if (ufd->armed_events != 0)
+			uring_poll_remove(ctx, ufd);
+		if (events != 0)
+			uring_poll_add(ctx, ufd, events);
+	}
+	array_clear(&ctx->dirty);
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd **ufdp;
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL) {
+		*ufdp = i_new(struct uring_fd, 1);
+		(*ufdp)->fd = io->fd;
+		(*ufdp)->gen = 1;
+	}
+
+	(void)ioloop_iolist_add(&(*ufdp)->list, io);
+	uring_fd_set_dirty(ctx, *ufdp);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed ATTR_UNUSED)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_fd **ufdp;
+	bool last;
+
+	ufdp = array_idx_modifiable(&ctx->fd_index, io->fd);
+	last = ioloop_iolist_del(&(*ufdp)->list, io);
+	if (last && (*ufdp)->armed_events != 0) {
+		/* The fd is likely going to be closed (or was already), but
+		   the in-flight poll request still holds a reference to the
+		   file. Cancel it now, so the fd number can be reused
+		   without the old request being mistaken for the new one. */
+		uring_poll_remove(ctx, *ufdp);
+	} else {
+		uring_fd_set_dirty(ctx, *ufdp);
+	}
+	i_free(io);
+}
+
+static void uring_reap_completions(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct uring_fd *const *ufdp, *ufd;
+	struct uring_ready *ready;
+	unsigned int head, tail;
+	int fd;
+
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & *ctx->cq_mask];
+		if (cqe->user_data == IOLOOP_URING_USER_DATA_IGNORE)
+			continue;
+
+		fd = (int)(cqe->user_data >> 32);
+		ufdp = array_idx(&ctx->fd_index, fd);
+		ufd = *ufdp;
+		if (ufd->gen != (uint32_t)cqe->user_data)
+			continue;
+
+		/* the one-shot poll request is finished, re-arm it on the
+		   next iteration if there are still IOs for the fd */
+		ufd->armed_events = 0;
+		uring_fd_set_dirty(ctx, ufd);
+
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			i_panic("io_uring poll(%d) failed: %m", fd);
+		}
+		ready = array_append_space(&ctx->ready);
+		ready->ufd = ufd;
+		ready->revents = cqe->res;
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int uring_ready_cmp(const struct uring_ready *r1,
+			   const struct uring_ready *r2)
+{
+	if (r1->ufd->fd < r2->ufd->fd)
+		return -1;
+	return r1->ufd->fd > r2->ufd->fd ? 1 : 0;
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct uring_ready *ready;
+	struct io_list *list;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, count;
+	int msecs, j;
+	bool call;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	uring_flush_dirty(ctx);
+	if (ioloop->io_files != NULL) {
+		/* submit all poll changes and wait for events in the same
+		   syscall */
+		(void)uring_submit(ctx, 1, msecs);
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		if (ctx->sq_pending > 0)
+			(void)uring_submit(ctx, 0, 0);
+		i_sleep_intr_msecs(msecs);
+	}
+	uring_reap_completions(ctx);
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running) {
+		array_clear(&ctx->ready);
+		return;
+	}
+
+	/* Polls that were already ready when armed complete in submission
+	   order. Dispatch them in fd order instead, the same as the poll and
+	   select handlers do, so the callback order doesn't depend on the
+	   order in which the IOs were added. */
+	array_sort(&ctx->ready, uring_ready_cmp);
+	count = array_count(&ctx->ready);
+	for (i = 0; i < count; i++) {
+		ready = array_idx(&ctx->ready, i);
+		list = &ready->ufd->list;
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = list->ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((ready->revents & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (ready->revents & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (ready->revents & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (ready->revents & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					break;
+			}
+		}
+		if (!ioloop->running)
+			break;
+	}
+	array_clear(&ctx->ready);
+}
+
+#endif	/* IOLOOP_URING */
@@ -3,8 +3,11 @@
 #include "lib.h"
 #include "array.h"
 #include "backtrace-string.h"
+#include "hash.h"
 #include "llist.h"
+#include "str.h"
 #include "time-util.h"
+#include "stats-hist.h"
 #include "istream-private.h"
 #include "ioloop-private.h"
 
@@ -254,6 +257,114 @@ static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 	}
 }
 
+static bool timeout_use_wheel(const struct timeout *timeout)
+{
+	return !timeout->one_shot &&
+		timeout->msecs >= IOLOOP_TIMEOUT_WHEEL_MIN_MSECS;
+}
+
+static struct timeout **
+timeout_wheel_slot(struct ioloop *ioloop, const struct timeout *timeout)
+{
+	return &ioloop->timeout_wheel[timeout->next_run.tv_sec %
+				      IOLOOP_TIMEOUT_WHEEL_SIZE];
+}
+
+static void timeout_wheel_add(struct ioloop *ioloop, struct timeout *timeout)
+{
+	if (ioloop->timeout_wheel == NULL) {
+		ioloop->timeout_wheel =
+			i_new(struct timeout *, IOLOOP_TIMEOUT_WHEEL_SIZE);
+	}
+	DLLIST_PREPEND_FULL(timeout_wheel_slot(ioloop, timeout), timeout,
+			    wheel_prev, wheel_next);
+	timeout->in_wheel = TRUE;
+	if (ioloop->timeout_wheel_count++ == 0 ||
+	    timeout->next_run.tv_sec < ioloop->timeout_wheel_next)
+		ioloop->timeout_wheel_next = timeout->next_run.tv_sec;
+}
+
+static void
+timeout_wheel_remove(struct ioloop *ioloop, struct timeout *timeout)
+{
+	i_assert(ioloop->timeout_wheel_count > 0);
+
+	DLLIST_REMOVE_FULL(timeout_wheel_slot(ioloop, timeout), timeout,
+			   wheel_prev, wheel_next);
+	timeout->in_wheel = FALSE;
+	ioloop->timeout_wheel_count--;
+}
+
+static void timeout_queue(struct timeout *timeout)
+{
+	struct ioloop *ioloop = timeout->ioloop;
+
+	/* Timeouts whose slot has already been handled (e.g. because time
+	   moved) go directly to the priority queue. */
+	if (timeout_use_wheel(timeout) &&
+	    timeout->next_run.tv_sec >= ioloop->timeout_wheel_time)
+		timeout_wheel_add(ioloop, timeout);
+	else
+		priorityq_add(ioloop->timeouts, &timeout->item);
+}
+
+static void timeout_dequeue(struct timeout *timeout)
+{
+	if (timeout->in_wheel)
+		timeout_wheel_remove(timeout->ioloop, timeout);
+	else
+		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+}
+
+static bool timeout_is_queued(const struct timeout *timeout)
+{
+	return timeout->item.idx != UINT_MAX || timeout->in_wheel;
+}
+
+static void
+timeout_wheel_run(struct ioloop *ioloop, const struct timeval *tv_now)
+{
+	struct timeout *timeout, *next;
+	time_t secs, end_secs;
+	unsigned int i;
+
+	if (ioloop->timeout_wheel_count == 0 ||
+	    ioloop->timeout_wheel_next > tv_now->tv_sec) {
+		if (ioloop->timeout_wheel_time <= tv_now->tv_sec)
+			ioloop->timeout_wheel_time = tv_now->tv_sec + 1;
+		return;
+	}
+
+	/* move all the timeouts expiring within this second to the priority
+	   queue. If we've been away for a long time, go through the whole
+	   wheel once. */
+	secs = I_MAX(ioloop->timeout_wheel_time, ioloop->timeout_wheel_next);
+	end_secs = tv_now->tv_sec;
+	if (end_secs - secs >= IOLOOP_TIMEOUT_WHEEL_SIZE)
+		secs = end_secs - IOLOOP_TIMEOUT_WHEEL_SIZE + 1;
+	for (; secs <= end_secs; secs++) {
+		timeout = ioloop->timeout_wheel[secs % IOLOOP_TIMEOUT_WHEEL_SIZE];
+		for (; timeout != NULL; timeout = next) {
+			next = timeout->wheel_next;
+			if (timeout->next_run.tv_sec <= end_secs) {
+				timeout_wheel_remove(ioloop, timeout);
+				priorityq_add(ioloop->timeouts, &timeout->item);
+			}
+		}
+	}
+	ioloop->timeout_wheel_time = end_secs + 1;
+
+	/* find the next non-empty slot */
+	for (i = 0; i < IOLOOP_TIMEOUT_WHEEL_SIZE; i++) {
+		secs = ioloop->timeout_wheel_time + i;
+		if (ioloop->timeout_wheel[secs % IOLOOP_TIMEOUT_WHEEL_SIZE] != NULL)
+			break;
+	}
+	i_assert(i < IOLOOP_TIMEOUT_WHEEL_SIZE ||
+		 ioloop->timeout_wheel_count == 0);
+	ioloop->timeout_wheel_next = ioloop->timeout_wheel_time + i;
+}
+
 static struct timeout *
 timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 		   unsigned int source_linenum,
@@ -377,8 +488,8 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (timeout_is_queued(old_to))
+		timeout_queue(new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_push_back(&new_to->ioloop->timeouts_new, &new_to);
@@ -405,8 +516,8 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout_is_queued(timeout))
+		timeout_dequeue(timeout);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		struct timeout *const *to_idx;
 		array_foreach(&ioloop->timeouts_new, to_idx) {
@@ -423,9 +534,10 @@ void timeout_remove(struct timeout **_timeout)
 static void ATTR_NULL(2)
 timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
+	if (!timeout_is_queued(timeout))
 		return;
 
+	timeout_dequeue(timeout);
 	timeout_update_next(timeout, tv_now);
 	/* If we came here from io_loop_handle_timeouts_real(), next_run must
 	   be larger than tv_now or it can go to infinite loop. This would
@@ -440,8 +552,7 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 		timeout->next_run = *tv_now;
 		timeval_add_usecs(&timeout->next_run, 1);
 	}
-	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_queue(timeout);
 }
 
 void timeout_reset(struct timeout *timeout)
@@ -450,8 +561,9 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
-				 struct timeval *tv_now, bool in_timeout_loop)
+static int timeval_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r, struct timeval *tv_now,
+				 bool in_timeout_loop)
 {
 	int ret;
 
@@ -461,10 +573,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -491,20 +603,39 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	return ret;
 }
 
+static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
+				 struct timeval *tv_now, bool in_timeout_loop)
+{
+	return timeval_get_wait_time(&timeout->next_run, tv_r, tv_now,
+				     in_timeout_loop);
+}
+
 static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
-	struct timeval tv_now;
+	struct timeval tv_now, tv_wheel;
 	struct priorityq_item *item;
 	struct timeout *timeout;
+	const struct timeval *next_run = NULL;
 	int msecs;
 
 	item = priorityq_peek(ioloop->timeouts);
 	timeout = (struct timeout *)item;
+	if (timeout != NULL)
+		next_run = &timeout->next_run;
+	if (ioloop->timeout_wheel_count > 0) {
+		/* wake up when the next wheel slot needs to be handled */
+		tv_wheel.tv_sec = ioloop->timeout_wheel_next;
+		tv_wheel.tv_usec = 0;
+		if (next_run == NULL || timeval_cmp(&tv_wheel, next_run) < 0) {
+			next_run = &tv_wheel;
+			timeout = NULL;
+		}
+	}
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
 	   processed without delay */
-	if (timeout == NULL && ioloop->io_pending_count == 0) {
+	if (next_run == NULL && ioloop->io_pending_count == 0) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -521,7 +652,7 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		tv_r->tv_usec = 0;
 	} else {
 		tv_now.tv_sec = 0;
-		msecs = timeout_get_wait_time(timeout, tv_r, &tv_now, FALSE);
+		msecs = timeval_get_wait_time(next_run, tv_r, &tv_now, FALSE);
 	}
 	ioloop->next_max_time = tv_now;
 	timeval_add_msecs(&ioloop->next_max_time, msecs);
@@ -531,7 +662,8 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 	   ioloop and after that we update ioloop_timeval immediately again. */
 	ioloop_timeval = tv_now;
 	ioloop_time = tv_now.tv_sec;
-	i_assert(msecs == 0 || timeout->msecs > 0 || timeout->one_shot);
+	i_assert(msecs == 0 || timeout == NULL ||
+		 timeout->msecs > 0 || timeout->one_shot);
 	return msecs;
 }
 
@@ -587,7 +719,7 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_queue(timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
@@ -595,17 +727,36 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 {
 	struct priorityq_item *const *items;
+	struct timeout *to, *wheel_list = NULL;
 	unsigned int i, count;
 
 	count = priorityq_count(ioloop->timeouts);
 	items = priorityq_items(ioloop->timeouts);
 	for (i = 0; i < count; i++) {
-		struct timeout *to = (struct timeout *)items[i];
+		to = (struct timeout *)items[i];
+		if (diff_usecs > 0)
+			timeval_add_usecs(&to->next_run, diff_usecs);
+		else
+			timeval_sub_usecs(&to->next_run, -diff_usecs);
+	}
 
+	/* the wheel slots depend on next_run, so re-add the timeouts */
+	for (i = 0; i < IOLOOP_TIMEOUT_WHEEL_SIZE &&
+	     ioloop->timeout_wheel_count > 0; i++) {
+		while ((to = ioloop->timeout_wheel[i]) != NULL) {
+			timeout_wheel_remove(ioloop, to);
+			DLLIST_PREPEND_FULL(&wheel_list, to,
+					    wheel_prev, wheel_next);
+		}
+	}
+	ioloop->timeout_wheel_time = ioloop_timeval.tv_sec;
+	while ((to = wheel_list) != NULL) {
+		DLLIST_REMOVE_FULL(&wheel_list, to, wheel_prev, wheel_next);
 		if (diff_usecs > 0)
 			timeval_add_usecs(&to->next_run, diff_usecs);
 		else
 			timeval_sub_usecs(&to->next_run, -diff_usecs);
+		timeout_queue(to);
 	}
 }
 
@@ -635,12 +786,171 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 		timer->usecs += diff;
 }
 
+struct io_loop_callback_stats {
+	const char *source_filename;
+	unsigned int source_linenum;
+
+	struct stats_hist *hist;
+	time_t last_warning;
+	unsigned int suppressed_warnings;
+};
+
+static unsigned int
+io_loop_callback_stats_hash(const struct io_loop_callback_stats *stats)
+{
+	return str_hash(stats->source_filename) ^ stats->source_linenum;
+}
+
+static int
+io_loop_callback_stats_cmp(const struct io_loop_callback_stats *stats1,
+			   const struct io_loop_callback_stats *stats2)
+{
+	if (stats1->source_linenum != stats2->source_linenum)
+		return stats1->source_linenum < stats2->source_linenum ? -1 : 1;
+	return strcmp(stats1->source_filename, stats2->source_filename);
+}
+
+static void
+io_loop_callback_warn(struct io_loop_callback_stats *stats,
+		      const struct timeval *tv_end, long long usecs)
+{
+	struct event *event;
+	string_t *str;
+
+	if (stats->last_warning == tv_end->tv_sec) {
+		stats->suppressed_warnings++;
+		return;
+	}
+	stats->last_warning = tv_end->tv_sec;
+
+	str = t_str_new(128);
+	str_printfa(str, "ioloop callback %s:%u took %lld.%03lld ms",
+		    stats->source_filename, stats->source_linenum,
+		    usecs / 1000, usecs % 1000);
+	if (stats->suppressed_warnings > 0) {
+		str_printfa(str, " (%u more slow calls suppressed)",
+			    stats->suppressed_warnings);
+		stats->suppressed_warnings = 0;
+	}
+
+	event = event_create(NULL);
+	event_set_name(event, "ioloop_callback_slow");
+	event_add_str(event, "source_filename", stats->source_filename);
+	event_add_int(event, "source_linenum", stats->source_linenum);
+	event_add_int(event, "duration_usecs", usecs);
+	e_warning(event, "%s", str_c(str));
+	event_unref(&event);
+}
+
+static void
+io_loop_callback_finished(struct ioloop *ioloop, const char *source_filename,
+			  unsigned int source_linenum,
+			  const struct timeval *tv_start)
+{
+	struct io_loop_callback_stats lookup, *stats;
+	struct timeval tv_end;
+	long long usecs;
+
+	i_gettimeofday(&tv_end);
+	usecs = timeval_diff_usecs(&tv_end, tv_start);
+	if (usecs < 0) {
+		/* time moved backwards */
+		usecs = 0;
+	}
+
+	i_zero(&lookup);
+	lookup.source_filename = source_filename;
+	lookup.source_linenum = source_linenum;
+	stats = hash_table_lookup(ioloop->callback_stats, &lookup);
+	if (stats == NULL) {
+		stats = i_new(struct io_loop_callback_stats, 1);
+		*stats = lookup;
+		stats->hist = stats_hist_init();
+		hash_table_insert(ioloop->callback_stats, stats, stats);
+	}
+	stats_hist_add(stats->hist, usecs);
+
+	if (ioloop->callback_warn_usecs > 0 &&
+	    usecs >= ioloop->callback_warn_usecs) T_BEGIN {
+		io_loop_callback_warn(stats, &tv_end, usecs);
+	} T_END;
+}
+
+void io_loop_set_callback_stats(struct ioloop *ioloop, unsigned int warn_msecs)
+{
+	if (!hash_table_is_created(ioloop->callback_stats)) {
+		hash_table_create(&ioloop->callback_stats, default_pool, 0,
+				  io_loop_callback_stats_hash,
+				  io_loop_callback_stats_cmp);
+	}
+	ioloop->callback_warn_usecs = warn_msecs * 1000;
+}
+
+void io_loop_send_callback_stats(struct ioloop *ioloop)
+{
+	struct hash_iterate_context *iter;
+	struct io_loop_callback_stats *key, *stats;
+
+	if (!hash_table_is_created(ioloop->callback_stats))
+		return;
+
+	iter = hash_table_iterate_init(ioloop->callback_stats);
+	while (hash_table_iterate(iter, ioloop->callback_stats,
+				  &key, &stats)) {
+		if (stats_hist_get_count(stats->hist) == 0)
+			continue;
+		struct event *event = event_create(NULL);
+		event_set_name(event, "ioloop_callback_stats");
+		event_add_str(event, "source_filename", stats->source_filename);
+		event_add_int(event, "source_linenum", stats->source_linenum);
+		event_add_int(event, "count",
+			      stats_hist_get_count(stats->hist));
+		event_add_int(event, "total_usecs",
+			      stats_hist_get_sum(stats->hist));
+		event_add_int(event, "p50_usecs",
+			      stats_hist_get_percentile(stats->hist, 0.50));
+		event_add_int(event, "p95_usecs",
+			      stats_hist_get_percentile(stats->hist, 0.95));
+		event_add_int(event, "p99_usecs",
+			      stats_hist_get_percentile(stats->hist, 0.99));
+		event_add_int(event, "max_usecs",
+			      stats_hist_get_max(stats->hist));
+		e_debug(event, "ioloop callback %s:%u: %"PRIu64" calls",
+			stats->source_filename, stats->source_linenum,
+			stats_hist_get_count(stats->hist));
+		event_unref(&event);
+		stats_hist_reset(stats->hist);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static void io_loop_callback_stats_free(struct ioloop *ioloop)
+{
+	struct hash_iterate_context *iter;
+	struct io_loop_callback_stats *key, *stats;
+
+	if (!hash_table_is_created(ioloop->callback_stats))
+		return;
+
+	iter = hash_table_iterate_init(ioloop->callback_stats);
+	while (hash_table_iterate(iter, ioloop->callback_stats,
+				  &key, &stats)) {
+		stats_hist_deinit(&stats->hist);
+		i_free(stats);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ioloop->callback_stats);
+}
+
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
 	struct priorityq_item *item;
-	struct timeval tv_old, tv, tv_call;
+	struct timeval tv_old, tv, tv_call, tv_start;
+	const char *source_filename;
+	unsigned int source_linenum;
 	long long diff_usecs;
 	data_stack_frame_t t_id;
+	bool measure;
 
 	tv_old = ioloop_timeval;
 	i_gettimeofday(&ioloop_timeval);
@@ -669,6 +979,7 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
 
+	timeout_wheel_run(ioloop, &tv_call);
 	while (ioloop->running &&
 	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
 		struct timeout *timeout = (struct timeout *)item;
@@ -688,6 +999,12 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 
 		if (timeout->ctx != NULL)
 			io_loop_context_activate(timeout->ctx);
+		/* the timeout may be freed by the callback */
+		source_filename = timeout->source_filename;
+		source_linenum = timeout->source_linenum;
+		measure = hash_table_is_created(ioloop->callback_stats);
+		if (measure)
+			i_gettimeofday(&tv_start);
 		t_id = t_push_named("ioloop timeout handler %p",
 				    (void *)timeout->callback);
 		timeout->callback(timeout->context);
@@ -695,6 +1012,10 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 			i_panic("Leaked a t_pop() call in timeout handler %p",
 				(void *)timeout->callback);
 		}
+		if (measure) {
+			io_loop_callback_finished(ioloop, source_filename,
+						  source_linenum, &tv_start);
+		}
 		if (ioloop->cur_ctx != NULL)
 			io_loop_context_deactivate(ioloop->cur_ctx);
 		i_assert(ioloop == current_ioloop);
@@ -722,7 +1043,12 @@ void io_loop_handle_timeouts(struct ioloop *ioloop)
 void io_loop_call_io(struct io *io)
 {
 	struct ioloop *ioloop = io->ioloop;
+	/* the io may be freed by the callback */
+	const char *source_filename = io->source_filename;
+	unsigned int source_linenum = io->source_linenum;
+	struct timeval tv_start;
 	data_stack_frame_t t_id;
+	bool measure;
 
 	if (io->pending) {
 		i_assert(ioloop->io_pending_count > 0);
@@ -732,6 +1058,9 @@ void io_loop_call_io(struct io *io)
 
 	if (io->ctx != NULL)
 		io_loop_context_activate(io->ctx);
+	measure = hash_table_is_created(ioloop->callback_stats);
+	if (measure)
+		i_gettimeofday(&tv_start);
 	t_id = t_push_named("ioloop handler %p",
 			    (void *)io->callback);
 	io->callback(io->context);
@@ -739,6 +1068,10 @@ void io_loop_call_io(struct io *io)
 		i_panic("Leaked a t_pop() call in I/O handler %p",
 			(void *)io->callback);
 	}
+	if (measure) {
+		io_loop_callback_finished(ioloop, source_filename,
+					  source_linenum, &tv_start);
+	}
 	if (ioloop->cur_ctx != NULL)
 		io_loop_context_deactivate(ioloop->cur_ctx);
 	i_assert(ioloop == current_ioloop);
@@ -780,14 +1113,48 @@ static void io_loop_call_pending(struct ioloop *ioloop)
 	}
 }
 
+static void io_loop_call_run_end_callbacks(struct ioloop *ioloop)
+{
+	struct ioloop_run_end_callback cb;
+	unsigned int i;
+
+	if (!array_is_created(&ioloop->run_end_callbacks))
+		return;
+
+	/* the callbacks may add more callbacks, which are called as well */
+	for (i = 0; i < array_count(&ioloop->run_end_callbacks); i++) {
+		cb = *array_idx(&ioloop->run_end_callbacks, i);
+		T_BEGIN {
+			cb.callback(cb.context);
+		} T_END;
+	}
+	array_clear(&ioloop->run_end_callbacks);
+}
+
+#undef io_loop_add_run_end_callback
+void io_loop_add_run_end_callback(struct ioloop *ioloop,
+				  io_callback_t *callback, void *context)
+{
+	struct ioloop_run_end_callback *cb;
+
+	if (!array_is_created(&ioloop->run_end_callbacks))
+		i_array_init(&ioloop->run_end_callbacks, 8);
+	cb = array_append_space(&ioloop->run_end_callbacks);
+	cb->callback = callback;
+	cb->context = context;
+}
+
 void io_loop_handler_run(struct ioloop *ioloop)
 {
 	i_assert(ioloop == current_ioloop);
 
 	io_loop_timeouts_start_new(ioloop);
 	ioloop->wait_started = ioloop_timeval;
+	/* don't keep the buffered log lines while we might be sleeping */
+	i_failure_flush();
 	io_loop_handler_run_internal(ioloop);
 	io_loop_call_pending(ioloop);
+	io_loop_call_run_end_callbacks(ioloop);
 	if (ioloop->stop_after_run_loop)
 		io_loop_stop(ioloop);
 
@@ -842,6 +1209,7 @@ struct ioloop *io_loop_create(void)
         ioloop = i_new(struct ioloop, 1);
 	ioloop->timeouts = priorityq_init(timeout_cmp, 32);
 	i_array_init(&ioloop->timeouts_new, 8);
+	ioloop->timeout_wheel_time = ioloop_time;
 
 	ioloop->time_moved_callback = current_ioloop != NULL ?
 		current_ioloop->time_moved_callback :
@@ -852,6 +1220,19 @@ struct ioloop *io_loop_create(void)
         return ioloop;
 }
 
+static void timeout_leaked(struct timeout *to)
+{
+	const char *error = t_strdup_printf(
+		"Timeout leak: %p (%s:%u)", (void *)to->callback,
+		to->source_filename, to->source_linenum);
+
+	if (panic_on_leak)
+		i_panic("%s", error);
+	else
+		i_warning("%s", error);
+	timeout_free(to);
+}
+
 void io_loop_destroy(struct ioloop **_ioloop)
 {
 	struct ioloop *ioloop = *_ioloop;
@@ -863,6 +1244,8 @@ void io_loop_destroy(struct ioloop **_ioloop)
 
 	/* ->prev won't work unless loops are destroyed in create order */
         i_assert(ioloop == current_ioloop);
+	io_loop_call_run_end_callbacks(ioloop);
+	array_free(&ioloop->run_end_callbacks);
 	if (array_is_created(&io_destroy_callbacks)) {
 		io_destroy_callback_t *callback;
 		array_foreach_elem(&io_destroy_callbacks, callback) T_BEGIN {
@@ -894,36 +1277,27 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	i_assert(ioloop->io_pending_count == 0);
 
 	array_foreach_elem(&ioloop->timeouts_new, to) {
-		const char *error = t_strdup_printf(
-			"Timeout leak: %p (%s:%u)", (void *)to->callback,
-			to->source_filename,
-			to->source_linenum);
-
-		if (panic_on_leak)
-			i_panic("%s", error);
-		else
-			i_warning("%s", error);
-		timeout_free(to);
+		timeout_leaked(to);
 		leaks = TRUE;
 	}
 	array_free(&ioloop->timeouts_new);
 
 	while ((item = priorityq_pop(ioloop->timeouts)) != NULL) {
-		struct timeout *to = (struct timeout *)item;
-		const char *error = t_strdup_printf(
-			"Timeout leak: %p (%s:%u)", (void *)to->callback,
-			to->source_filename,
-			to->source_linenum);
-
-		if (panic_on_leak)
-			i_panic("%s", error);
-		else
-			i_warning("%s", error);
-		timeout_free(to);
+		timeout_leaked((struct timeout *)item);
 		leaks = TRUE;
 	}
 	priorityq_deinit(&ioloop->timeouts);
 
+	for (unsigned int i = 0; i < IOLOOP_TIMEOUT_WHEEL_SIZE &&
+	     ioloop->timeout_wheel_count > 0; i++) {
+		while ((to = ioloop->timeout_wheel[i]) != NULL) {
+			timeout_wheel_remove(ioloop, to);
+			timeout_leaked(to);
+			leaks = TRUE;
+		}
+	}
+	i_free(ioloop->timeout_wheel);
+
 	while (ioloop->wait_timers != NULL) {
 		struct io_wait_timer *timer = ioloop->wait_timers;
 		const char *error = t_strdup_printf(
@@ -949,6 +1323,7 @@ void io_loop_destroy(struct ioloop **_ioloop)
 		io_loop_handler_deinit(ioloop);
 	if (ioloop->cur_ctx != NULL)
 		io_loop_context_unref(&ioloop->cur_ctx);
+	io_loop_callback_stats_free(ioloop);
 	i_free(ioloop);
 }
 
@@ -1292,6 +1667,20 @@ bool io_loop_have_ios(struct ioloop *ioloop)
 	return ioloop->io_files != NULL;
 }
 
+void io_loop_release_handler(struct ioloop *ioloop)
+{
+	i_assert(ioloop->io_files == NULL);
+
+	if (ioloop->notify_handler_context != NULL) {
+		io_loop_notify_handler_deinit(ioloop);
+		ioloop->notify_handler_context = NULL;
+	}
+	if (ioloop->handler_context != NULL) {
+		io_loop_handler_deinit(ioloop);
+		ioloop->handler_context = NULL;
+	}
+}
+
 bool io_loop_have_immediate_timeouts(struct ioloop *ioloop)
 {
 	struct timeval tv;
@@ -1303,6 +1692,7 @@ bool io_loop_is_empty(struct ioloop *ioloop)
 {
 	return ioloop->io_files == NULL &&
 		priorityq_count(ioloop->timeouts) == 0 &&
+		ioloop->timeout_wheel_count == 0 &&
 		array_count(&ioloop->timeouts_new) == 0;
 }
 
@@ -204,6 +204,16 @@ void io_loop_destroy(struct ioloop **ioloop);
 void io_loop_set_time_moved_callback(struct ioloop *ioloop,
 				     io_loop_time_moved_callback_t *callback);
 
+/* Call the callback once after the current io_loop_handler_run() pass has
+   called all of its IO and timeout callbacks. If the ioloop is destroyed
+   before that, the callback is called by io_loop_destroy(). */
+void io_loop_add_run_end_callback(struct ioloop *ioloop,
+				  io_callback_t *callback, void *context);
+#define io_loop_add_run_end_callback(ioloop, callback, context) \
+	io_loop_add_run_end_callback(ioloop, (io_callback_t *)callback, \
+		TRUE ? context : \
+		CALLBACK_TYPECHECK(callback, void (*)(typeof(context))))
+
 /* Change the current_ioloop. */
 void io_loop_set_current(struct ioloop *ioloop);
 /* Return the root ioloop. */
@@ -309,6 +319,11 @@ struct timeout *io_loop_move_timeout_to(struct ioloop *ioloop,
 struct timeout *io_loop_move_timeout(struct timeout **timeout);
 /* Returns TRUE if any IOs have been added to the ioloop. */
 bool io_loop_have_ios(struct ioloop *ioloop);
+/* Release the ioloop's kernel handler (e.g. the epoll fd). A new one is
+   created when the next IO is added. This is needed before fork() when the
+   parent and the child processes must not share it. The ioloop must not have
+   any IOs. */
+void io_loop_release_handler(struct ioloop *ioloop);
 /* Returns TRUE if there is a pending timeout that is going to be run
    immediately. */
 bool io_loop_have_immediate_timeouts(struct ioloop *ioloop);
@@ -316,6 +331,16 @@ bool io_loop_have_immediate_timeouts(struct ioloop *ioloop);
 bool io_loop_is_empty(struct ioloop *ioloop);
 /* Returns number of microseconds spent on the ioloop waiting itself. */
 uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
+/* Start tracking how long the ioloop's io and timeout callbacks take, grouped
+   by the source file:line where the io/timeout was added. If a callback takes
+   at least warn_msecs (0 = never), log a warning with "ioloop_callback_slow"
+   event. The warnings are throttled to one per second per source. */
+void io_loop_set_callback_stats(struct ioloop *ioloop, unsigned int warn_msecs);
+/* Send "ioloop_callback_stats" debug event for each callback source that was
+   called since the previous call. The events contain count and
+   total/p50/p95/p99/max duration fields in microseconds. The stats are
+   reset afterwards. */
+void io_loop_send_callback_stats(struct ioloop *ioloop);
 /* Return all io conditions added for the given fd. This needs to scan through
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
@@ -5,6 +5,7 @@
 #include "str.h"
 #include "safe-mkstemp.h"
 #include "write-full.h"
+#include "mmap-util.h"
 #include "istream-private.h"
 #include "ostream-private.h"
 #include "iostream-temp.h"
@@ -46,6 +47,19 @@ o_stream_temp_close(struct iostream_private *stream,
 	i_free(tstream->name);
 }
 
+static int o_stream_temp_create_memfd(struct temp_ostream *tstream)
+{
+#ifdef HAVE_MEMFD_CREATE
+	tstream->fd = memfd_create("dovecot-iostream-temp", MFD_CLOEXEC);
+	if (tstream->fd != -1)
+		return 0;
+	if (errno != ENOSYS && errno != EINVAL)
+		i_error("memfd_create() failed: %m");
+#endif
+	tstream->flags &= ENUM_NEGATE(IOSTREAM_TEMP_FLAG_MEMFD);
+	return -1;
+}
+
 static int o_stream_temp_move_to_fd(struct temp_ostream *tstream)
 {
 	string_t *path;
@@ -56,14 +70,20 @@ static int o_stream_temp_move_to_fd(struct temp_ostream *tstream)
 
 	path = t_str_new(128);
 	str_append(path, tstream->temp_path_prefix);
-	tstream->fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
-	if (tstream->fd == -1) {
-		i_error("safe_mkstemp(%s) failed: %m", str_c(path));
-		return -1;
-	}
-	if (i_unlink(str_c(path)) < 0) {
-		i_close_fd(&tstream->fd);
-		return -1;
+	if ((tstream->flags & IOSTREAM_TEMP_FLAG_MEMFD) != 0 &&
+	    o_stream_temp_create_memfd(tstream) == 0)
+		str_append(path, "(memfd)");
+	else {
+		tstream->fd = safe_mkstemp_hostpid(path, 0600,
+						   (uid_t)-1, (gid_t)-1);
+		if (tstream->fd == -1) {
+			i_error("safe_mkstemp(%s) failed: %m", str_c(path));
+			return -1;
+		}
+		if (i_unlink(str_c(path)) < 0) {
+			i_close_fd(&tstream->fd);
+			return -1;
+		}
 	}
 	if (write_full(tstream->fd, tstream->buf->data, tstream->buf->used) < 0) {
 		i_error("write(%s) failed: %m", str_c(path));
@@ -340,11 +360,56 @@ struct ostream *iostream_temp_create_sized(const char *temp_path_prefix,
 	return output;
 }
 
+struct temp_mmap {
+	void *base;
+	size_t size;
+};
+
 static void iostream_temp_buf_destroyed(buffer_t *buf)
 {
 	buffer_free(&buf);
 }
 
+static void iostream_temp_mmap_destroyed(struct temp_mmap *tmmap)
+{
+	if (munmap(tmmap->base, tmmap->size) < 0)
+		i_error("iostream-temp: munmap() failed: %m");
+	i_free(tmmap);
+}
+
+static struct istream *
+iostream_temp_mmap_finish(struct temp_ostream *tstream, const char *for_path)
+{
+	struct temp_mmap *tmmap;
+	struct istream *input;
+	void *base;
+
+	if (tstream->fd_size == 0 || tstream->fd_size > SIZE_MAX)
+		return NULL;
+	base = mmap(NULL, tstream->fd_size, PROT_READ, MAP_PRIVATE,
+		    tstream->fd, 0);
+	if (base == MAP_FAILED) {
+		/* fallback to reading the fd */
+		i_error("iostream-temp %s: mmap(%s*) failed: %m",
+			o_stream_get_name(&tstream->ostream.ostream),
+			tstream->temp_path_prefix);
+		return NULL;
+	}
+	/* the mapping stays valid after the fd is closed */
+	i_close_fd(&tstream->fd);
+
+	tmmap = i_new(struct temp_mmap, 1);
+	tmmap->base = base;
+	tmmap->size = tstream->fd_size;
+	input = i_stream_create_from_data(base, tmmap->size);
+	i_stream_set_name(input, t_strdup_printf(
+		"(Temp file mmap in %s%s, %zu bytes)",
+		tstream->temp_path_prefix, for_path, tmmap->size));
+	i_stream_add_destroy_callback(input, iostream_temp_mmap_destroyed,
+				      tmmap);
+	return input;
+}
+
 struct istream *iostream_temp_finish(struct ostream **output,
 				     size_t max_buffer_size)
 {
@@ -383,6 +448,10 @@ struct istream *iostream_temp_finish(struct ostream **output,
 	} else if (tstream->dupstream != NULL) {
 		/* return the original failed stream. */
 		input = tstream->dupstream;
+	} else if (tstream->fd != -1 &&
+		   (tstream->flags & IOSTREAM_TEMP_FLAG_MMAP) != 0 &&
+		   (input = iostream_temp_mmap_finish(tstream, for_path)) != NULL) {
+		/* reading directly from the mmaped temp file */
 	} else if (tstream->fd != -1) {
 		int fd = tstream->fd;
 		input = i_stream_create_fd_autoclose(&tstream->fd, max_buffer_size);
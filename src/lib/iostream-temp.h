@@ -5,7 +5,18 @@ enum iostream_temp_flags {
 	/* if o_stream_send_istream() is called with a readable fd, don't
 	   actually copy the input stream, just have iostream_temp_finish()
 	   return a new iostream pointing to the fd dup()ed */
-	IOSTREAM_TEMP_FLAG_TRY_FD_DUP	= 0x01
+	IOSTREAM_TEMP_FLAG_TRY_FD_DUP	= 0x01,
+	/* if the data was written to a temporary file, have
+	   iostream_temp_finish() mmap() it and return an istream reading
+	   directly from the mapped memory. This avoids read() syscalls and
+	   copying when the returned stream is seeked and read many times. */
+	IOSTREAM_TEMP_FLAG_MMAP		= 0x02,
+	/* create the temporary file with memfd_create() instead of under
+	   temp_path_prefix, so the data is kept in anonymous memory that can
+	   be swapped out instead of being written to and read back from disk.
+	   Falls back to a normal temporary file if memfd_create() isn't
+	   supported. */
+	IOSTREAM_TEMP_FLAG_MEMFD	= 0x04,
 };
 
 /* Start writing to given output stream. The data is initially written to
@@ -46,6 +46,14 @@ static int i_stream_file_open(struct istream_private *stream)
 	return 0;
 }
 
+/* bytes read from regular files by all file istreams */
+static uint64_t i_stream_file_total_read_bytes = 0;
+
+uint64_t i_stream_file_get_total_read_bytes(void)
+{
+	return i_stream_file_total_read_bytes;
+}
+
 ssize_t i_stream_file_read(struct istream_private *stream)
 {
 	struct file_istream *fstream =
@@ -68,6 +76,8 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 	if (fstream->file) {
 		ret = pread(stream->fd, stream->w_buffer + stream->pos,
 			    size, offset);
+		if (ret > 0)
+			i_stream_file_total_read_bytes += ret;
 	} else if (fstream->seen_eof) {
 		/* don't try to read() again. EOF from keyboard (^D)
 		   requires this to work right. */
@@ -63,6 +63,10 @@ struct istream_private {
 	struct timeval last_read_timeval;
 
 	string_t *line_str; /* for i_stream_next_line() if w_buffer == NULL */
+	/* i_stream_next_line() has already searched the data up to this
+	   offset without finding LF. This avoids rescanning the beginning of
+	   a long line every time more of it is read. */
+	uoff_t line_nolf_offset;
 	bool line_crlf:1;
 	bool return_nolf_line:1;
 	bool stream_size_passthrough:1; /* stream is parent's size */
@@ -501,6 +501,7 @@ void i_stream_seek(struct istream *stream, uoff_t v_offset)
 			return;
 		}
 		stream->eof = FALSE;
+		_stream->line_nolf_offset = 0;
 		_stream->seek(_stream, v_offset, FALSE);
 	}
 	i_stream_update(_stream);
@@ -514,6 +515,7 @@ void i_stream_seek_mark(struct istream *stream, uoff_t v_offset)
 		return;
 
 	stream->eof = FALSE;
+	_stream->line_nolf_offset = 0;
 	_stream->seek(_stream, v_offset, TRUE);
 	i_stream_update(_stream);
 }
@@ -525,6 +527,7 @@ void i_stream_sync(struct istream *stream)
 	if (unlikely(stream->closed || stream->stream_errno != 0))
 		return;
 
+	_stream->line_nolf_offset = 0;
 	if (_stream->sync != NULL) {
 		_stream->sync(_stream);
 		i_stream_update(_stream);
@@ -631,16 +634,25 @@ char *i_stream_next_line(struct istream *stream)
 {
 	struct istream_private *_stream = stream->real_stream;
 	const unsigned char *pos;
+	size_t scan_start = _stream->skip;
 
 	if (_stream->skip >= _stream->pos)
 		return NULL;
 
-	pos = memchr(_stream->buffer + _stream->skip, '\n',
-		     _stream->pos - _stream->skip);
+	if (_stream->line_nolf_offset > stream->v_offset &&
+	    _stream->line_nolf_offset - stream->v_offset <=
+	    _stream->pos - _stream->skip) {
+		/* the beginning of the line was already searched */
+		scan_start += _stream->line_nolf_offset - stream->v_offset;
+	}
+	pos = memchr(_stream->buffer + scan_start, '\n',
+		     _stream->pos - scan_start);
 	if (pos != NULL) {
 		return i_stream_next_line_finish(_stream,
 						 pos - _stream->buffer);
 	} else {
+		_stream->line_nolf_offset = stream->v_offset +
+			(_stream->pos - _stream->skip);
 		return i_stream_last_line(_stream);
 	}
 }
@@ -32,6 +32,12 @@ struct event {
 	/* sending_debug_log can be used if this value matches
 	   event_filter_replace_counter. */
 	unsigned int debug_level_checked_filter_counter;
+	/* sending_debug_send is the cached result of matching the global
+	   debug send filter. It can be used if all of these still match. */
+	unsigned int debug_send_checked_filter_counter;
+	uint32_t debug_send_checked_change_id;
+	const char *debug_send_checked_source_filename;
+	unsigned int debug_send_checked_source_linenum;
 	event_log_prefix_callback_t *log_prefix_callback;
 	void *log_prefix_callback_context;
 	event_log_message_callback_t *log_message_callback;
@@ -47,6 +53,7 @@ struct event {
 	bool forced_debug:1;
 	bool always_log_source:1;
 	bool sending_debug_log:1;
+	bool sending_debug_send:1;
 
 /* Fields that are exported & imported: */
 	struct timeval tv_created_ioloop;
@@ -110,6 +117,8 @@ static inline void event_recalculate_debug_level(struct event *event)
 {
 	event->debug_level_checked_filter_counter =
 		event_filter_replace_counter - 1;
+	event->debug_send_checked_filter_counter =
+		event_filter_replace_counter - 1;
 }
 
 #endif
@@ -57,6 +57,12 @@ struct event_internal_category {
 	int refcount;
 };
 
+/* Initial pool size for events. This fits the struct event and its typical
+   fields and categories, so most events need only a single memory block. */
+#define EVENT_POOL_INITIAL_SIZE 2048
+/* Maximum number of freed events' pools kept for reuse */
+#define EVENT_POOL_FREELIST_MAX_COUNT 32
+
 struct event_reason {
 	struct event *event;
 };
@@ -71,6 +77,8 @@ static ARRAY(event_category_callback_t *) event_category_callbacks;
 static ARRAY(struct event_internal_category *) event_registered_categories_internal;
 static ARRAY(struct event_category *) event_registered_categories_representative;
 static ARRAY(struct event *) global_event_stack;
+/* Cleared pools of freed events, waiting to be reused by new events */
+static ARRAY(pool_t) event_pool_freelist;
 static uint64_t event_id_counter = 0;
 
 static void get_self_rusage(struct rusage *ru_r)
@@ -386,12 +394,44 @@ struct event *event_minimize(struct event *event)
 	return new_event;
 }
 
+static pool_t event_pool_get(void)
+{
+	pool_t pool;
+
+	if (array_is_created(&event_pool_freelist) &&
+	    array_not_empty(&event_pool_freelist)) {
+		pool = array_idx_elem(&event_pool_freelist,
+				      array_count(&event_pool_freelist) - 1);
+		array_pop_back(&event_pool_freelist);
+		return pool;
+	}
+	return pool_alloconly_create(MEMPOOL_GROWING"event",
+				     EVENT_POOL_INITIAL_SIZE);
+}
+
+static void event_pool_put(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+
+	*_pool = NULL;
+	if (!array_is_created(&event_pool_freelist) ||
+	    array_count(&event_pool_freelist) >= EVENT_POOL_FREELIST_MAX_COUNT) {
+		pool_unref(&pool);
+		return;
+	}
+	/* This frees all but the pool's first block. Events are created
+	   and freed all the time, so keeping it avoids most of the
+	   malloc()/free() calls. */
+	p_clear(pool);
+	array_push_back(&event_pool_freelist, &pool);
+}
+
 static struct event *
 event_create_internal(struct event *parent, const char *source_filename,
 		      unsigned int source_linenum)
 {
 	struct event *event;
-	pool_t pool = pool_alloconly_create(MEMPOOL_GROWING"event", 64);
+	pool_t pool = event_pool_get();
 
 	event = p_new(pool, struct event, 1);
 	event->event_passthrough = event_passthrough_vfuncs;
@@ -483,7 +523,7 @@ void event_unref(struct event **_event)
 	event_unref(&event->parent);
 
 	DLLIST_REMOVE(&events, event);
-	pool_unref(&event->pool);
+	event_pool_put(&event->pool);
 }
 
 struct event *events_get_head(void)
@@ -693,6 +733,8 @@ event_set_name(struct event *event, const char *name)
 {
 	i_free(event->sending_name);
 	event->sending_name = i_strdup(name);
+	/* the name may affect whether filters match */
+	event_recalculate_debug_level(event);
 	return event;
 }
 
@@ -1728,11 +1770,13 @@ void lib_event_init(void)
 	i_array_init(&event_category_callbacks, 4);
 	i_array_init(&event_registered_categories_internal, 16);
 	i_array_init(&event_registered_categories_representative, 16);
+	i_array_init(&event_pool_freelist, EVENT_POOL_FREELIST_MAX_COUNT);
 }
 
 void lib_event_deinit(void)
 {
 	struct event_internal_category *internal;
+	pool_t *pool;
 
 	event_unset_global_debug_log_filter();
 	event_unset_global_debug_send_filter();
@@ -1752,4 +1796,7 @@ void lib_event_deinit(void)
 	array_free(&event_registered_categories_internal);
 	array_free(&event_registered_categories_representative);
 	array_free(&global_event_stack);
+	array_foreach_modifiable(&event_pool_freelist, pool)
+		pool_unref(pool);
+	array_free(&event_pool_freelist);
 }
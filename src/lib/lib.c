@@ -197,7 +197,9 @@ void lib_deinit(void)
 	lib_event_deinit();
 	restrict_access_deinit();
 	i_close_fd(&dev_null_fd);
+	i_failure_flush();
 	data_stack_deinit();
+	pool_alloconly_free_cached_blocks();
 	failures_deinit();
 	process_title_deinit();
 	random_deinit();
@@ -2,7 +2,9 @@
 
 /* @UNSAFE: whole file */
 #include "lib.h"
+#include "bits.h"
 #include "safe-memset.h"
+#include "mmap-util.h"
 #include "mempool.h"
 
 /*
@@ -149,6 +151,19 @@ struct pool_block {
 
 #define DEFAULT_BASE_SIZE MEM_ALIGN(sizeof(struct alloconly_pool))
 
+/* Freed blocks with a power-of-2 size within these limits are kept in
+   block_cache for reuse by other pools, up to BLOCK_CACHE_MAX_TOTAL_SIZE
+   bytes. Pools are grown with power-of-2 sized blocks, so this catches
+   most of the short-lived pools' blocks. */
+#define BLOCK_CACHE_MIN_SIZE_BITS 10
+#define BLOCK_CACHE_MAX_SIZE_BITS 20
+#define BLOCK_CACHE_MAX_TOTAL_SIZE (4*1024*1024)
+/* Hint the kernel to use transparent huge pages for blocks at least this
+   large. These are typically pools growing to contain e.g. large search
+   results, which otherwise take a lot of page faults. */
+#define BLOCK_HUGEPAGE_MIN_SIZE (4*1024*1024)
+#define BLOCK_HUGEPAGE_SIZE (2*1024*1024)
+
 #ifdef DEBUG
 #  define CLEAR_CHR 0xde
 #  define SENTRY_COUNT 8
@@ -168,6 +183,11 @@ static void pool_alloconly_clear(pool_t pool);
 static size_t pool_alloconly_get_max_easy_alloc_size(pool_t pool);
 
 static void block_alloc(struct alloconly_pool *pool, size_t size);
+static void block_free(struct pool_block *block);
+
+/* Linked lists of unused zero-filled blocks, one for each size */
+static struct pool_block *block_cache[BLOCK_CACHE_MAX_SIZE_BITS + 1];
+static size_t block_cache_total_size = 0;
 
 static const struct pool_vfuncs static_alloconly_pool_vfuncs = {
 	pool_alloconly_get_name,
@@ -291,14 +311,16 @@ static void pool_alloconly_destroy(struct alloconly_pool *apool)
 	block = apool->block;
 #ifdef DEBUG
 	safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + apool->block->size);
+	free(block);
 #else
 	if (apool->clean_frees) {
 		safe_memset(block, CLEAR_CHR,
 			    SIZEOF_POOLBLOCK + apool->block->size);
+		free(block);
+	} else {
+		block_free(block);
 	}
 #endif
-
-	free(block);
 }
 
 static const char *pool_alloconly_get_name(pool_t pool ATTR_UNUSED)
@@ -336,6 +358,80 @@ static void pool_alloconly_unref(pool_t *pool)
 	pool_alloconly_destroy(apool);
 }
 
+static int block_cache_idx(size_t size)
+{
+	int bits;
+
+	if ((size & (size - 1)) != 0)
+		return -1;
+	bits = bits_required64(size) - 1;
+	if (bits < BLOCK_CACHE_MIN_SIZE_BITS || bits > BLOCK_CACHE_MAX_SIZE_BITS)
+		return -1;
+	return bits;
+}
+
+static struct pool_block *block_cache_get(size_t size)
+{
+	struct pool_block *block;
+	int idx = block_cache_idx(size);
+
+	if (idx < 0 || block_cache[idx] == NULL)
+		return NULL;
+	block = block_cache[idx];
+	block_cache[idx] = block->prev;
+	block_cache_total_size -= size;
+	block->prev = NULL;
+	return block;
+}
+
+static void block_free(struct pool_block *block)
+{
+	size_t size = SIZEOF_POOLBLOCK + block->size;
+	int idx = block_cache_idx(size);
+
+	if (idx < 0 || !lib_is_initialized() ||
+	    block_cache_total_size + size > BLOCK_CACHE_MAX_TOTAL_SIZE) {
+		free(block);
+		return;
+	}
+	/* The rest of the block is still zero-filled, as it was when it was
+	   calloc()ed. */
+	memset(POOL_BLOCK_DATA(block), 0, block->size - block->left);
+	block->last_alloc_size = 0;
+	block->prev = block_cache[idx];
+	block_cache[idx] = block;
+	block_cache_total_size += size;
+}
+
+static void
+block_hint_hugepages(void *mem ATTR_UNUSED, size_t size ATTR_UNUSED)
+{
+#ifdef MADV_HUGEPAGE
+	uintptr_t start = ((uintptr_t)mem + BLOCK_HUGEPAGE_SIZE - 1) &
+		~(uintptr_t)(BLOCK_HUGEPAGE_SIZE - 1);
+	uintptr_t end = ((uintptr_t)mem + size) &
+		~(uintptr_t)(BLOCK_HUGEPAGE_SIZE - 1);
+
+	if (start < end)
+		(void)madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+void pool_alloconly_free_cached_blocks(void)
+{
+	struct pool_block *block;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(block_cache); i++) {
+		while (block_cache[i] != NULL) {
+			block = block_cache[i];
+			block_cache[i] = block->prev;
+			free(block);
+		}
+	}
+	block_cache_total_size = 0;
+}
+
 static void block_alloc(struct alloconly_pool *apool, size_t size)
 {
 	struct pool_block *block;
@@ -365,10 +461,15 @@ static void block_alloc(struct alloconly_pool *apool, size_t size)
 #endif
 	}
 
-	block = calloc(size, 1);
-	if (unlikely(block == NULL)) {
-		i_fatal_status(FATAL_OUTOFMEM, "block_alloc(%zu"
-			       "): Out of memory", size);
+	block = block_cache_get(size);
+	if (block == NULL) {
+		block = calloc(size, 1);
+		if (unlikely(block == NULL)) {
+			i_fatal_status(FATAL_OUTOFMEM, "block_alloc(%zu"
+				       "): Out of memory", size);
+		}
+		if (size >= BLOCK_HUGEPAGE_MIN_SIZE)
+			block_hint_hugepages(block, size);
 	}
 	block->prev = apool->block;
 	apool->block = block;
@@ -486,13 +587,16 @@ static void pool_alloconly_clear(pool_t pool)
 
 #ifdef DEBUG
 		safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + block->size);
+		free(block);
 #else
 		if (apool->clean_frees) {
 			safe_memset(block, CLEAR_CHR,
 				    SIZEOF_POOLBLOCK + block->size);
+			free(block);
+		} else {
+			block_free(block);
 		}
 #endif
-		free(block);
 	}
 
 	/* clear the first block */
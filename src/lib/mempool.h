@@ -67,6 +67,9 @@ pool_t pool_alloconly_create(const char *name, size_t size);
    pool, and be sure that it gets cleared from the memory when it's no longer
    needed. */
 pool_t pool_alloconly_create_clean(const char *name, size_t size);
+/* Alloconly pools keep a limited number of freed memory blocks for reuse.
+   Free them. This is called by lib_deinit(). */
+void pool_alloconly_free_cached_blocks(void);
 
 /* When allocating memory from returned pool, the data stack frame must be
    the same as it was when calling this function. pool_unref() also checks
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "str.h"
 #include "sort.h"
+#include "time-util.h"
 #include "module-dir.h"
 
 #ifdef HAVE_MODULES
@@ -21,6 +22,10 @@
 #  define RTLD_NOW 0
 #endif
 
+static struct event_category event_category_module = {
+	.name = "module",
+};
+
 static const char *module_name_drop_suffix(const char *name);
 
 void *module_get_symbol_quiet(struct module *module, const char *symbol)
@@ -189,12 +194,19 @@ module_load(const char *path, const char *name,
 	struct module *module;
 	const char *const *module_version;
 	void (*preinit)(void);
+	int dlopen_flags = RTLD_GLOBAL | RTLD_NOW;
+	uint64_t start_usecs = i_microseconds();
 
 	*module_r = NULL;
 	*error_r = NULL;
 
+#ifdef RTLD_LAZY
+	if (set->lazy_binding)
+		dlopen_flags = RTLD_GLOBAL | RTLD_LAZY;
+#endif
+
 	if (set->ignore_dlopen_errors) {
-		handle = quiet_dlopen(path, RTLD_GLOBAL | RTLD_NOW);
+		handle = quiet_dlopen(path, dlopen_flags);
 		if (handle == NULL) {
 			if (set->debug) {
 				i_debug("Skipping module %s, "
@@ -206,7 +218,7 @@ module_load(const char *path, const char *name,
 			return 0;
 		}
 	} else {
-		handle = dlopen(path, RTLD_GLOBAL | RTLD_NOW);
+		handle = dlopen(path, dlopen_flags);
 		if (handle == NULL) {
 			*error_r = t_strdup_printf("dlopen() failed: %s",
 						   dlerror());
@@ -269,8 +281,11 @@ module_load(const char *path, const char *name,
 		return -1;
 	}
 
-	if (set->debug)
-		i_debug("Module loaded: %s", path);
+	module->load_usecs = i_microseconds() - start_usecs;
+	if (set->debug) {
+		i_debug("Module loaded: %s (%"PRIu64" us)",
+			path, module->load_usecs);
+	}
 	*module_r = module;
 	return 1;
 }
@@ -534,6 +549,28 @@ module_dir_load_missing(struct module *old_modules,
 	return new_modules;
 }
 
+static void module_init(struct module *module)
+{
+	struct event *event;
+	uint64_t start_usecs = i_microseconds();
+
+	T_BEGIN {
+		module->init(module);
+	} T_END;
+	module->init_usecs = i_microseconds() - start_usecs;
+
+	event = event_create(NULL);
+	event_add_category(event, &event_category_module);
+	event_set_name(event, "module_init_finished");
+	event_add_str(event, "module", module->name);
+	event_add_int(event, "load_usecs", module->load_usecs);
+	event_add_int(event, "init_usecs", module->init_usecs);
+	e_debug(event, "Module %s initialized (load %"PRIu64" us, "
+		"init %"PRIu64" us)", module->name,
+		module->load_usecs, module->init_usecs);
+	event_unref(&event);
+}
+
 void module_dir_init(struct module *modules)
 {
 	struct module *module;
@@ -541,9 +578,8 @@ void module_dir_init(struct module *modules)
 	for (module = modules; module != NULL; module = module->next) {
 		if (!module->initialized) {
 			module->initialized = TRUE;
-			if (module->init != NULL) T_BEGIN {
-				module->init(module);
-			} T_END;
+			if (module->init != NULL)
+				module_init(module);
 		}
 	}
 }
@@ -25,6 +25,11 @@ struct module_dir_load_settings {
 	bool ignore_dlopen_errors:1;
 	/* Don't fail if some specified modules weren't found */
 	bool ignore_missing:1;
+	/* Resolve the modules' function symbols only when they're first called
+	   (RTLD_LAZY) instead of in dlopen(). This makes loading faster, but
+	   a missing symbol kills the process only when it's called, instead
+	   of failing the load. */
+	bool lazy_binding:1;
 };
 
 struct module {
@@ -34,6 +39,9 @@ struct module {
 	void (*init)(struct module *module);
 	void (*deinit)(void);
 
+	/* Time spent in dlopen() and in init() */
+	uint64_t load_usecs, init_usecs;
+
 	bool initialized:1;
 
         struct module *next;
@@ -56,7 +64,8 @@ int module_dir_try_load_missing(struct module **modules,
 				const struct module_dir_load_settings *set,
 				const char **error_r)
 	ATTR_NULL(1, 3);
-/* Call init() in all modules */
+/* Call init() in all modules. A "module_init_finished" event is sent for
+   each initialized module with module, load_usecs and init_usecs fields. */
 void module_dir_init(struct module *modules);
 /* Call deinit() in all modules and mark them NULL so module_dir_unload()
    won't do it again. */
@@ -42,6 +42,9 @@ struct ostream_private {
 	void *context;
 
 	bool corked:1;
+	bool auto_cork:1;
+	/* uncorking is scheduled at the end of the ioloop run */
+	bool auto_corked:1;
 	bool finished:1;
 	bool closing:1;
 	bool last_errors_not_checked:1;
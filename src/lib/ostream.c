@@ -185,6 +185,40 @@ bool o_stream_is_corked(struct ostream *stream)
 	return _stream->corked;
 }
 
+static void o_stream_auto_uncork(struct ostream_private *_stream)
+{
+	struct ostream *stream = &_stream->ostream;
+
+	i_assert(_stream->auto_corked);
+	_stream->auto_corked = FALSE;
+
+	o_stream_uncork(stream);
+	if (stream->closed)
+		o_stream_ignore_last_errors(stream);
+	o_stream_unref(&stream);
+}
+
+static void o_stream_auto_cork(struct ostream_private *_stream)
+{
+	if (current_ioloop == NULL)
+		return;
+
+	o_stream_cork(&_stream->ostream);
+	if (!_stream->auto_corked) {
+		/* uncork at the end of the ioloop run that is currently
+		   running, which isn't necessarily the stream's own ioloop */
+		_stream->auto_corked = TRUE;
+		o_stream_ref(&_stream->ostream);
+		io_loop_add_run_end_callback(current_ioloop,
+					     o_stream_auto_uncork, _stream);
+	}
+}
+
+void o_stream_set_auto_cork(struct ostream *stream, bool set)
+{
+	stream->real_stream->auto_cork = set;
+}
+
 int o_stream_flush(struct ostream *stream)
 {
 	struct ostream_private *_stream = stream->real_stream;
@@ -281,6 +315,8 @@ o_stream_sendv_int(struct ostream *stream, const struct const_iovec *iov,
 		return 0;
 
 	i_assert(!_stream->finished);
+	if (unlikely(_stream->auto_cork) && !_stream->corked)
+		o_stream_auto_cork(_stream);
 	ret = _stream->sendv(_stream, iov, iov_count);
 	if (ret > 0)
 		stream->real_stream->last_write_timeval = ioloop_timeval;
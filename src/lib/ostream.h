@@ -153,6 +153,12 @@ void o_stream_cork(struct ostream *stream);
    ignores errors. */
 void o_stream_uncork(struct ostream *stream);
 bool o_stream_is_corked(struct ostream *stream);
+/* Automatically cork the stream when sending data and uncork it after the
+   current ioloop's io_loop_handler_run() pass has finished. This way all
+   the small writes done by one ioloop iteration's callbacks are sent with
+   a single write()/writev(). The stream is uncorked at the end of the pass
+   even if it was explicitly corked. */
+void o_stream_set_auto_cork(struct ostream *stream, bool set);
 /* Try to flush the output stream. If o_stream_nsend*() had been used and
    the stream had overflown, return error. Returns 1 if all data is sent,
    0 there's still buffered data, -1 if error. */
@@ -1,6 +1,7 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "safe-memset.h"
 #include "randgen.h"
 #include <unistd.h>
 #include <fcntl.h>
@@ -214,6 +215,20 @@ normal_exit:
 	srand(seed);
 }
 
+void random_reset_after_fork(void)
+{
+	unsigned int seed;
+
+	i_assert(init_refcount > 0);
+
+#if defined(USE_GETRANDOM) || defined(USE_RANDOM_DEV)
+	safe_memset(random_next, 0, sizeof(random_next));
+	random_next_pos = random_next_size = 0;
+#endif
+	random_fill(&seed, sizeof(seed));
+	srand(seed);
+}
+
 void random_deinit(void)
 {
 	if (--init_refcount > 0)
@@ -8,6 +8,9 @@ void random_fill(void *buf, size_t size);
    and are called by default in lib_init */
 void random_init(void);
 void random_deinit(void);
+/* Call in the child process after fork(), so it won't return the same
+   buffered randomness as its parent. */
+void random_reset_after_fork(void);
 
 #ifdef DEBUG
 /* Debug helper to make random tests reproduceable. 0=got seed, -1=failure. */
@@ -0,0 +1,190 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "sha-x86.h"
+
+#ifdef HAVE_SHA_X86
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_X86_TARGET __attribute__((target("sha,sse4.1")))
+
+static const uint32_t sha256_x86_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+bool sha_x86_is_supported(void)
+{
+	static int supported = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (supported >= 0)
+		return supported != 0;
+
+	supported = 0;
+	if (__get_cpuid_max(0, NULL) >= 7 &&
+	    __get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0 &&
+	    (ecx & bit_SSSE3) != 0 && (ecx & bit_SSE4_1) != 0) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		/* CPUID.(EAX=07H, ECX=0):EBX.SHA[bit 29] */
+		if ((ebx & (1U << 29)) != 0)
+			supported = 1;
+	}
+	return supported != 0;
+}
+
+SHA_X86_TARGET void
+sha1_x86_transf(uint32_t state[STATIC_ARRAY 5],
+		const unsigned char *data, size_t block_nb)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1, msg[4];
+	unsigned int i;
+
+	abcd = _mm_loadu_si128((const __m128i *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; block_nb > 0; block_nb--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* 20 groups of 4 rounds. Each group also computes parts of
+		   the message schedule for the following groups. The loop
+		   needs to be unrolled for the conditions to be resolved at
+		   compile time. */
+#pragma GCC unroll 20
+		for (i = 0; i < 20; i++) {
+			if (i < 4) {
+				msg[i] = _mm_loadu_si128(
+					(const __m128i *)(data + i*16));
+				msg[i] = _mm_shuffle_epi8(msg[i], mask);
+			}
+			if (i == 0) {
+				e0 = _mm_add_epi32(e0, msg[0]);
+				e1 = abcd;
+			} else if (i % 2 == 0) {
+				e0 = _mm_sha1nexte_epu32(e0, msg[i % 4]);
+				e1 = abcd;
+			} else {
+				e1 = _mm_sha1nexte_epu32(e1, msg[i % 4]);
+				e0 = abcd;
+			}
+			if (i >= 3 && i <= 18) {
+				msg[(i+1) % 4] = _mm_sha1msg2_epu32(
+					msg[(i+1) % 4], msg[i % 4]);
+			}
+			/* the rounds function must be an immediate */
+			switch (i / 5) {
+			case 0:
+				abcd = _mm_sha1rnds4_epu32(abcd,
+					i % 2 == 0 ? e0 : e1, 0);
+				break;
+			case 1:
+				abcd = _mm_sha1rnds4_epu32(abcd,
+					i % 2 == 0 ? e0 : e1, 1);
+				break;
+			case 2:
+				abcd = _mm_sha1rnds4_epu32(abcd,
+					i % 2 == 0 ? e0 : e1, 2);
+				break;
+			default:
+				abcd = _mm_sha1rnds4_epu32(abcd,
+					i % 2 == 0 ? e0 : e1, 3);
+				break;
+			}
+			if (i >= 1 && i <= 16) {
+				msg[(i+3) % 4] = _mm_sha1msg1_epu32(
+					msg[(i+3) % 4], msg[i % 4]);
+			}
+			if (i >= 2 && i <= 17) {
+				msg[(i+2) % 4] = _mm_xor_si128(
+					msg[(i+2) % 4], msg[i % 4]);
+			}
+		}
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+SHA_X86_TARGET void
+sha256_x86_transf(uint32_t state[STATIC_ARRAY 8],
+		  const unsigned char *data, size_t block_nb)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save, tmp, m, msg[4];
+	unsigned int i;
+
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1); /* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1b); /* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8); /* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0); /* CDGH */
+
+	for (; block_nb > 0; block_nb--, data += 64) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		/* 16 groups of 4 rounds. Each group also computes parts of
+		   the message schedule for the following groups. */
+#pragma GCC unroll 16
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				msg[i] = _mm_loadu_si128(
+					(const __m128i *)(data + i*16));
+				msg[i] = _mm_shuffle_epi8(msg[i], mask);
+			}
+			m = _mm_add_epi32(msg[i % 4], _mm_loadu_si128(
+				(const __m128i *)&sha256_x86_k[i*4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+			if (i >= 3 && i <= 14) {
+				tmp = _mm_alignr_epi8(msg[i % 4],
+						      msg[(i+3) % 4], 4);
+				msg[(i+1) % 4] = _mm_add_epi32(
+					msg[(i+1) % 4], tmp);
+				msg[(i+1) % 4] = _mm_sha256msg2_epu32(
+					msg[(i+1) % 4], msg[i % 4]);
+			}
+			m = _mm_shuffle_epi32(m, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+			if (i >= 1 && i <= 12) {
+				msg[(i+3) % 4] = _mm_sha256msg1_epu32(
+					msg[(i+3) % 4], msg[i % 4]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b); /* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1); /* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0); /* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8); /* ABEF */
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
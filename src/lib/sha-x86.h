@@ -0,0 +1,21 @@
+#ifndef SHA_X86_H
+#define SHA_X86_H
+
+/* SHA-1 and SHA-256 block functions using the x86 SHA extensions. They're
+   compiled in whenever the compiler supports them, but can be used only
+   after sha_x86_is_supported() has returned TRUE. */
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define HAVE_SHA_X86
+
+bool sha_x86_is_supported(void);
+
+/* Process the given number of 64 byte blocks. The state is the hash's
+   intermediate state words in host byte order. */
+void sha1_x86_transf(uint32_t state[STATIC_ARRAY 5],
+		     const unsigned char *data, size_t block_nb);
+void sha256_x86_transf(uint32_t state[STATIC_ARRAY 8],
+		       const unsigned char *data, size_t block_nb);
+#endif
+
+#endif
@@ -37,6 +37,7 @@
 #include "lib.h"
 #include "sha1.h"
 #include "safe-memset.h"
+#include "sha-x86.h"
 
 /* constant table */
 static uint32_t SHA1_K[] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
@@ -80,6 +81,14 @@ sha1_step(struct sha1_ctxt *ctxt)
 	size_t t, s;
 	uint32_t	tmp;
 
+#ifdef HAVE_SHA_X86
+	if (sha_x86_is_supported()) {
+		sha1_x86_transf(ctxt->h.b32, ctxt->m.b8, 1);
+		memset(&ctxt->m.b8[0], 0, 64);
+		return;
+	}
+#endif
+
 #ifndef WORDS_BIGENDIAN
 	struct sha1_ctxt tctxt;
 	memmove(&tctxt.m.b8[0], &ctxt->m.b8[0], 64);
@@ -217,6 +226,19 @@ sha1_loop(struct sha1_ctxt *ctxt, const void *input, size_t len)
 		gapstart = COUNT % 64;
 		gaplen = 64 - gapstart;
 
+#ifdef HAVE_SHA_X86
+		if (gapstart == 0 && len - off >= 64 &&
+		    sha_x86_is_supported()) {
+			/* process full blocks directly from input */
+			copysiz = (len - off) & ~(size_t)63;
+			sha1_x86_transf(ctxt->h.b32, &input_c[off],
+					copysiz / 64);
+			ctxt->c.b64[0] += copysiz * 8;
+			off += copysiz;
+			continue;
+		}
+#endif
+
 		copysiz = (gaplen < len - off) ? gaplen : len - off;
 		memmove(&ctxt->m.b8[gapstart], &input_c[off], copysiz);
 		COUNT += copysiz;
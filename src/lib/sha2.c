@@ -33,6 +33,7 @@
 
 #include "lib.h"
 #include "sha2.h"
+#include "sha-x86.h"
 
 #define SHFR(x, n)    (x >> n)
 #define ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
@@ -202,6 +203,12 @@ sha256_transf(struct sha256_ctx *ctx, const unsigned char *data,
 	const unsigned char *sub_block;
 	int i,j;
 
+#ifdef HAVE_SHA_X86
+	if (sha_x86_is_supported()) {
+		sha256_x86_transf(ctx->h, data, block_nb);
+		return;
+	}
+#endif
 
 	for (i = 0; i < (int) block_nb; i++) {
 		sub_block = data + (i << 6);
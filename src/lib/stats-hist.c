@@ -0,0 +1,209 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "bits.h"
+#include "stats-hist.h"
+
+/* Group 0 contains the exact values [0, STATS_HIST_SUB_BUCKETS). Group N>0
+   contains the values with the highest bit at STATS_HIST_SUB_BUCKETS_BITS+N-1,
+   each bucket being 2^(N-1) values wide. */
+#define STATS_HIST_GROUP_COUNT (64 - STATS_HIST_SUB_BUCKETS_BITS + 1)
+#define STATS_HIST_BUCKET_COUNT \
+	(STATS_HIST_GROUP_COUNT * STATS_HIST_SUB_BUCKETS)
+
+struct stats_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	/* STATS_HIST_SUB_BUCKETS counters per group, NULL if the group has
+	   no events. */
+	uint64_t *groups[STATS_HIST_GROUP_COUNT];
+};
+
+static unsigned int stats_hist_bucket_idx(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < STATS_HIST_SUB_BUCKETS)
+		return value;
+	shift = bits_required64(value) - 1 - STATS_HIST_SUB_BUCKETS_BITS;
+	return (shift + 1) * STATS_HIST_SUB_BUCKETS +
+		((value >> shift) - STATS_HIST_SUB_BUCKETS);
+}
+
+static void
+stats_hist_bucket_range(unsigned int idx, uint64_t *min_r, uint64_t *max_r)
+{
+	unsigned int group = idx / STATS_HIST_SUB_BUCKETS;
+	unsigned int sub = idx % STATS_HIST_SUB_BUCKETS;
+
+	if (group == 0) {
+		*min_r = *max_r = sub;
+		return;
+	}
+	*min_r = (uint64_t)(STATS_HIST_SUB_BUCKETS + sub) << (group - 1);
+	*max_r = *min_r + ((1ULL << (group - 1)) - 1);
+}
+
+struct stats_hist *stats_hist_init(void)
+{
+	return i_new(struct stats_hist, 1);
+}
+
+void stats_hist_deinit(struct stats_hist **_hist)
+{
+	struct stats_hist *hist = *_hist;
+
+	if (hist == NULL)
+		return;
+	*_hist = NULL;
+
+	stats_hist_reset(hist);
+	i_free(hist);
+}
+
+void stats_hist_reset(struct stats_hist *hist)
+{
+	unsigned int i;
+
+	for (i = 0; i < STATS_HIST_GROUP_COUNT; i++)
+		i_free(hist->groups[i]);
+	i_zero(hist);
+}
+
+static void
+stats_hist_add_count(struct stats_hist *hist, unsigned int idx,
+		     uint64_t count)
+{
+	unsigned int group = idx / STATS_HIST_SUB_BUCKETS;
+
+	if (hist->groups[group] == NULL) {
+		hist->groups[group] =
+			i_new(uint64_t, STATS_HIST_SUB_BUCKETS);
+	}
+	hist->groups[group][idx % STATS_HIST_SUB_BUCKETS] += count;
+}
+
+void stats_hist_add(struct stats_hist *hist, uint64_t value)
+{
+	stats_hist_add_count(hist, stats_hist_bucket_idx(value), 1);
+
+	if (hist->count == 0 || hist->min > value)
+		hist->min = value;
+	if (hist->max < value)
+		hist->max = value;
+	hist->count++;
+	hist->sum += value;
+}
+
+void stats_hist_merge(struct stats_hist *dest, const struct stats_hist *src)
+{
+	unsigned int i, j;
+
+	if (src->count == 0)
+		return;
+
+	for (i = 0; i < STATS_HIST_GROUP_COUNT; i++) {
+		if (src->groups[i] == NULL)
+			continue;
+		for (j = 0; j < STATS_HIST_SUB_BUCKETS; j++) {
+			if (src->groups[i][j] == 0)
+				continue;
+			stats_hist_add_count(dest,
+				i * STATS_HIST_SUB_BUCKETS + j,
+				src->groups[i][j]);
+		}
+	}
+
+	if (dest->count == 0 || dest->min > src->min)
+		dest->min = src->min;
+	if (dest->max < src->max)
+		dest->max = src->max;
+	dest->count += src->count;
+	dest->sum += src->sum;
+}
+
+uint64_t stats_hist_get_count(const struct stats_hist *hist)
+{
+	return hist->count;
+}
+
+uint64_t stats_hist_get_sum(const struct stats_hist *hist)
+{
+	return hist->sum;
+}
+
+uint64_t stats_hist_get_min(const struct stats_hist *hist)
+{
+	return hist->min;
+}
+
+uint64_t stats_hist_get_max(const struct stats_hist *hist)
+{
+	return hist->max;
+}
+
+uint64_t stats_hist_get_percentile(const struct stats_hist *hist,
+				   double fraction)
+{
+	struct stats_hist_bucket bucket;
+	unsigned int idx = 0;
+	uint64_t rank, seen = 0;
+
+	if (hist->count == 0)
+		return 0;
+
+	/* The rank is ceil(count * fraction). Like stats_dist, include a small
+	   amount of fuzz so exact boundaries belong to the range below. */
+	if (fraction >= 1.)
+		rank = hist->count;
+	else if (fraction <= 0.)
+		rank = 1;
+	else {
+		double rank_float = hist->count * fraction;
+
+		rank = rank_float;
+		if (rank_float - rank >= 1e-8 * hist->count)
+			rank++;
+		if (rank == 0)
+			rank = 1;
+	}
+
+	while (stats_hist_bucket_next(hist, &idx, &bucket)) {
+		seen += bucket.count;
+		if (seen >= rank) {
+			if (bucket.max > hist->max)
+				return hist->max;
+			if (bucket.max < hist->min)
+				return hist->min;
+			return bucket.max;
+		}
+	}
+	i_unreached();
+}
+
+bool stats_hist_bucket_next(const struct stats_hist *hist, unsigned int *idx,
+			    struct stats_hist_bucket *bucket_r)
+{
+	unsigned int i = *idx, group;
+
+	while (i < STATS_HIST_BUCKET_COUNT) {
+		group = i / STATS_HIST_SUB_BUCKETS;
+		if (hist->groups[group] == NULL) {
+			i = (group + 1) * STATS_HIST_SUB_BUCKETS;
+			continue;
+		}
+		if (hist->groups[group][i % STATS_HIST_SUB_BUCKETS] != 0) {
+			bucket_r->count =
+				hist->groups[group][i % STATS_HIST_SUB_BUCKETS];
+			stats_hist_bucket_range(i, &bucket_r->min,
+						&bucket_r->max);
+			*idx = i + 1;
+			return TRUE;
+		}
+		i++;
+	}
+	*idx = i;
+	return FALSE;
+}
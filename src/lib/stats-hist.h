@@ -0,0 +1,54 @@
+#ifndef STATS_HIST_H
+#define STATS_HIST_H
+
+/* Log-linear histogram: each power of two is split into
+   STATS_HIST_SUB_BUCKETS linearly sized buckets, so the relative error of
+   a value's bucket is at most 1/STATS_HIST_SUB_BUCKETS. Values below
+   STATS_HIST_SUB_BUCKETS have their own exact buckets. The bucket
+   boundaries are the same for all histograms, so histograms can be merged
+   without losing any accuracy. The buckets are allocated lazily in groups
+   of one power of two, so the memory usage depends only on the range of
+   the added values, not on how many were added. */
+#define STATS_HIST_SUB_BUCKETS_BITS 4
+#define STATS_HIST_SUB_BUCKETS (1U << STATS_HIST_SUB_BUCKETS_BITS)
+
+struct stats_hist_bucket {
+	/* Smallest and largest value that belongs to this bucket */
+	uint64_t min, max;
+	/* Number of events in this bucket */
+	uint64_t count;
+};
+
+struct stats_hist *stats_hist_init(void);
+void stats_hist_deinit(struct stats_hist **hist);
+
+/* Reset all events. */
+void stats_hist_reset(struct stats_hist *hist);
+
+/* Add a new event. */
+void stats_hist_add(struct stats_hist *hist, uint64_t value);
+/* Add all events from src to dest. */
+void stats_hist_merge(struct stats_hist *dest, const struct stats_hist *src);
+
+/* Returns number of events added. */
+uint64_t stats_hist_get_count(const struct stats_hist *hist);
+/* Returns the sum of all events. */
+uint64_t stats_hist_get_sum(const struct stats_hist *hist);
+/* Returns events' minimum. */
+uint64_t stats_hist_get_min(const struct stats_hist *hist);
+/* Returns events' maximum. */
+uint64_t stats_hist_get_max(const struct stats_hist *hist);
+/* Returns events' approximate percentile. The returned value is the upper
+   bound of the bucket containing the percentile, limited to the events'
+   [min, max]. fraction parameter is in the range (0., 1.], so 95th %-ile is
+   0.95. */
+uint64_t stats_hist_get_percentile(const struct stats_hist *hist,
+				   double fraction);
+
+/* Iterate through the non-empty buckets in ascending order. *idx must be
+   initialized to 0 before the first call. Returns FALSE when there are no
+   more buckets. */
+bool stats_hist_bucket_next(const struct stats_hist *hist, unsigned int *idx,
+			    struct stats_hist_bucket *bucket_r);
+
+#endif
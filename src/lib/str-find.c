@@ -5,6 +5,11 @@
 #include "lib.h"
 #include "str-find.h"
 
+/* Keys up to this length are searched by first filtering the candidate
+   positions by the key's first and last bytes, 8 positions at a time.
+   Longer keys use Boyer-Moore, which can skip more with its tables. */
+#define STR_FIND_FILTER_MAX_KEY_LEN 64
+
 struct str_find_context {
 	pool_t pool;
 	unsigned char *key;
@@ -96,6 +101,52 @@ struct str_find_context *str_find_init(pool_t pool, const char *key)
 	return ctx;
 }
 
+static inline bool
+str_find_match_at(struct str_find_context *ctx, const unsigned char *data)
+{
+	unsigned int len_1 = ctx->key_len - 1;
+
+	return data[0] == ctx->key[0] && data[len_1] == ctx->key[len_1] &&
+		(len_1 <= 1 || memcmp(data + 1, ctx->key + 1, len_1 - 1) == 0);
+}
+
+static bool
+str_find_filtered(struct str_find_context *ctx,
+		  const unsigned char *data, size_t size, size_t *pos_r)
+{
+	const uint64_t ones = 0x0101010101010101ULL, highs = ones << 7;
+	unsigned int len_1 = ctx->key_len - 1;
+	uint64_t first_mask = ones * ctx->key[0];
+	uint64_t last_mask = ones * ctx->key[len_1];
+	uint64_t first, last, v;
+	size_t j = 0, k;
+
+	for (; j + sizeof(v) + len_1 <= size; j += sizeof(v)) {
+		memcpy(&first, data + j, sizeof(first));
+		memcpy(&last, data + j + len_1, sizeof(last));
+		/* v has a zero byte at each position where both the first and
+		   the last byte match. The check may give false positives,
+		   but never false negatives. */
+		v = (first ^ first_mask) | (last ^ last_mask);
+		if (((v - ones) & ~v & highs) == 0)
+			continue;
+		for (k = j; k < j + sizeof(v); k++) {
+			if (str_find_match_at(ctx, data + k)) {
+				ctx->match_end_pos = k + ctx->key_len;
+				return TRUE;
+			}
+		}
+	}
+	for (; j + ctx->key_len <= size; j++) {
+		if (str_find_match_at(ctx, data + j)) {
+			ctx->match_end_pos = j + ctx->key_len;
+			return TRUE;
+		}
+	}
+	*pos_r = j;
+	return FALSE;
+}
+
 void str_find_deinit(struct str_find_context **_ctx)
 {
 	struct str_find_context *ctx = *_ctx;
@@ -111,6 +162,7 @@ bool str_find_more(struct str_find_context *ctx,
 {
 	unsigned int key_len = ctx->key_len;
 	unsigned int i, j, a, b;
+	size_t pos;
 	int bad_value;
 
 	for (i = j = 0; i < ctx->match_count; i++) {
@@ -140,6 +192,11 @@ bool str_find_more(struct str_find_context *ctx,
 		i_assert(j + size < key_len);
 		ctx->match_count = j;
 		j = 0;
+	} else if (key_len <= STR_FIND_FILTER_MAX_KEY_LEN) {
+		if (str_find_filtered(ctx, data, size, &pos))
+			return TRUE;
+		j = pos;
+		ctx->match_count = 0;
 	} else {
 		/* Boyer-Moore searching */
 		j = 0;
@@ -10,5 +10,21 @@ void test_crc32(void)
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	test_assert(crc32_str("123456789") == 0xcbf43926);
+	test_end();
+
+	/* the bulk code path must give the same result as the bytewise */
+	unsigned char data[1000];
+	uint32_t crc = 0;
+	unsigned int i;
+
+	test_begin("crc32 long data");
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = i_rand_limit(256);
+		crc = crc32_data_more(crc, &data[i], 1);
+	}
+	test_assert(crc32_data(data, sizeof(data)) == crc);
+	test_assert(crc32_data_more(crc32_data(data, 123), data + 123,
+				    sizeof(data) - 123) == crc);
 	test_end();
 }
@@ -581,6 +581,45 @@ static void test_event_filter_named_separate_from_str(void)
 	test_end();
 }
 
+static void test_event_filter_log_types(void)
+{
+	struct event_filter *filter;
+	const char *error;
+	const struct failure_context debug_ctx = { .type = LOG_TYPE_DEBUG };
+	const struct failure_context info_ctx = { .type = LOG_TYPE_INFO };
+	const struct failure_context error_ctx = { .type = LOG_TYPE_ERROR };
+
+	test_begin("event filter: log type queries");
+
+	struct event *e = event_create(NULL);
+	event_add_str(e, "str", "value");
+
+	filter = event_filter_create();
+	test_assert(event_filter_parse("category=error", filter, &error) == 0);
+	test_assert(!event_filter_match(filter, e, &debug_ctx));
+	test_assert(event_filter_match(filter, e, &error_ctx));
+	test_assert(event_filter_parse("category=debug AND str=value", filter, &error) == 0);
+	test_assert(event_filter_match(filter, e, &debug_ctx));
+	test_assert(!event_filter_match(filter, e, &info_ctx));
+	test_assert(event_filter_match(filter, e, &error_ctx));
+	event_filter_unref(&filter);
+
+	filter = event_filter_create();
+	test_assert(event_filter_parse("NOT category=debug AND str=value", filter, &error) == 0);
+	test_assert(!event_filter_match(filter, e, &debug_ctx));
+	test_assert(event_filter_match(filter, e, &info_ctx));
+	event_filter_unref(&filter);
+
+	filter = event_filter_create();
+	test_assert(event_filter_parse("NOT (category=debug AND str=value)", filter, &error) == 0);
+	test_assert(!event_filter_match(filter, e, &debug_ctx));
+	test_assert(event_filter_match(filter, e, &info_ctx));
+	event_filter_unref(&filter);
+
+	event_unref(&e);
+	test_end();
+}
+
 void test_event_filter(void)
 {
 	test_event_filter_override_parent_fields();
@@ -595,4 +634,5 @@ void test_event_filter(void)
 	test_event_filter_named_and_str();
 	test_event_filter_named_or_str();
 	test_event_filter_named_separate_from_str();
+	test_event_filter_log_types();
 }
@@ -3,6 +3,7 @@
 #include "test-lib.h"
 #include "ioloop.h"
 #include "str.h"
+#include "event-filter.h"
 #include "failures-private.h"
 
 #include <unistd.h>
@@ -2520,9 +2521,49 @@ static void test_event_log_level(void)
 	test_end();
 }
 
+static void test_event_want_debug_send_filter(void)
+{
+	struct event_filter *filter;
+	const char *error;
+
+	test_begin("event want debug: send filter");
+
+	struct event *event = event_create(NULL);
+	filter = event_filter_create();
+	test_assert(event_filter_parse("source_location=test.c:1 OR str=value",
+				       filter, &error) == 0);
+	event_set_global_debug_send_filter(filter);
+
+	/* the results are cached per source location and event change */
+	event_set_source(event, "test.c", 1, TRUE);
+	test_assert((event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 1));
+	test_assert((event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 1));
+	event_set_source(event, "test.c", 2, TRUE);
+	test_assert(!(event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+	test_assert(!(event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+	event_add_str(event, "str", "value");
+	test_assert((event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+	event_add_str(event, "str", "other");
+	test_assert(!(event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+
+	/* replacing the filter invalidates the cache */
+	event_filter_unref(&filter);
+	filter = event_filter_create();
+	test_assert(event_filter_parse("str=other", filter, &error) == 0);
+	event_set_global_debug_send_filter(filter);
+	test_assert((event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+	event_unset_global_debug_send_filter();
+	test_assert(!(event_want_level)(event, LOG_TYPE_DEBUG, "test.c", 2));
+
+	event_filter_unref(&filter);
+	event_unref(&event);
+	test_end();
+}
+
 void test_event_log(void)
 {
 	test_event_log_message();
 	test_event_duration();
 	test_event_log_level();
+	test_event_want_debug_send_filter();
 }
@@ -140,6 +140,16 @@ static void test_hash_methods_fips() {
 			"\xe5\x46\x70\xf1",
 			160 / 8
 		},
+		{ "sha1",
+			"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+			"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+			100,
+			10000,
+			"\x34\xaa\x97\x3c\xd4\xc4\xda\xa4"
+			"\xf6\x1e\xeb\x2b\xdb\xad\x27\x31"
+			"\x65\x34\x01\x6f",
+			160 / 8
+		},
 		{ "sha256",
 			"",
 			0,
@@ -170,6 +180,17 @@ static void test_hash_methods_fips() {
 			"\xf6\xec\xed\xd4\x19\xdb\x06\xc1",
 			256 / 8
 		},
+		{ "sha256",
+			"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+			"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+			100,
+			10000,
+			"\xcd\xc7\x6e\x5c\x99\x14\xfb\x92"
+			"\x81\xa1\xc7\xe2\x84\xd7\x3e\x67"
+			"\xf1\x80\x9a\x48\xa4\x97\x20\x0e"
+			"\x04\x6d\x39\xcc\xc7\x11\x2c\xd0",
+			256 / 8
+		},
 		{ "sha384",
 			"",
 			0,
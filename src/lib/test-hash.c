@@ -2,9 +2,11 @@
 
 #include "test-lib.h"
 #include "hash.h"
+#include "strnum.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void
+test_hash_random_pool(pool_t pool, enum hash_table_flags flags)
 {
 #define KEYMAX 100000
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +14,7 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, KEYMAX); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	hash_table_create_direct_full(&hash, pool, 0, flags);
 	for (i = 0; i < KEYMAX; i++) {
 		key = (i_rand_limit(KEYMAX)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -35,13 +37,82 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_iterate(enum hash_table_flags flags)
+{
+	HASH_TABLE(const char *, const char *) hash;
+	struct hash_iterate_context *iter;
+	const char *key, *value, *keys[1000];
+	unsigned int i, count = 0, seen[N_ELEMENTS(keys)];
+
+	test_begin(flags == 0 ? "hash iterate" :
+		   "hash iterate (open addressing)");
+	hash_table_create_full(&hash, default_pool, 0, str_hash, strcmp,
+			       flags);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		keys[i] = t_strdup_printf("key%u", i);
+		hash_table_insert(hash, keys[i], keys[i]);
+	}
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys));
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		const char *lookup_key = t_strdup_printf("key%u", i);
+
+		test_assert_idx(hash_table_lookup(hash, lookup_key) == keys[i], i);
+	}
+	key = "key1000";
+	test_assert(hash_table_lookup(hash, key) == NULL);
+
+	/* remove every other key and add new ones while iterating. each of the
+	   original keys must be seen exactly once. */
+	memset(seen, 0, sizeof(seen));
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		test_assert(key == value);
+		if (str_begins(key, "new"))
+			continue;
+		if (str_to_uint(key + 3, &i) < 0 || i >= N_ELEMENTS(keys)) {
+			test_assert(FALSE);
+			continue;
+		}
+		seen[i]++;
+		if (i % 2 == 0)
+			hash_table_remove(hash, key);
+		if (count < 200) {
+			const char *new_key = t_strdup_printf("new%u", count++);
+			hash_table_insert(hash, new_key, new_key);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	for (i = 0; i < N_ELEMENTS(keys); i++)
+		test_assert_idx(seen[i] == 1, i);
+	test_assert(hash_table_count(hash) == N_ELEMENTS(keys) / 2 + count);
+
+	hash_table_update(hash, keys[1], keys[3]);
+	test_assert(hash_table_lookup(hash, keys[1]) == keys[3]);
+	test_assert(hash_table_lookup(hash, keys[0]) == NULL);
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, keys[1]) == NULL);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, 0);
+	test_hash_random_pool(default_pool, HASH_TABLE_FLAG_OPEN_ADDRESSING);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, 0);
+	test_hash_random_pool(pool, HASH_TABLE_FLAG_OPEN_ADDRESSING);
 	pool_unref(&pool);
+
+	T_BEGIN {
+		test_hash_iterate(0);
+	} T_END;
+	T_BEGIN {
+		test_hash_iterate(HASH_TABLE_FLAG_OPEN_ADDRESSING);
+	} T_END;
 }
@@ -3,6 +3,7 @@
 #include "test-lib.h"
 #include "net.h"
 #include "time-util.h"
+#include "sleep.h"
 #include "ioloop.h"
 #include "istream.h"
 
@@ -132,6 +133,59 @@ static void test_ioloop_timeout(void)
 	test_end();
 }
 
+struct timeout_reset_ctx {
+	struct timeout *to_long, *to_short;
+	struct timeval tv_reset, tv_callback;
+	unsigned int long_count, reset_count;
+};
+
+static void timeout_reset_long_callback(struct timeout_reset_ctx *ctx)
+{
+	i_gettimeofday(&ctx->tv_callback);
+	if (++ctx->long_count == 2)
+		io_loop_stop(current_ioloop);
+}
+
+static void timeout_reset_short_callback(struct timeout_reset_ctx *ctx)
+{
+	timeout_reset(ctx->to_long);
+	i_gettimeofday(&ctx->tv_reset);
+	if (++ctx->reset_count == 5)
+		timeout_remove(&ctx->to_short);
+}
+
+static void test_ioloop_timeout_reset(void)
+{
+	struct timeout_reset_ctx ctx;
+	struct ioloop *ioloop;
+	struct timeout *to_idle;
+
+	test_begin("ioloop timeout reset");
+	i_zero(&ctx);
+	ioloop = io_loop_create();
+	/* long timeouts that are never triggered */
+	to_idle = timeout_add(3600*1000, timeout_reset_long_callback, &ctx);
+	ctx.to_long = timeout_add(1000, timeout_reset_long_callback, &ctx);
+	ctx.to_short = timeout_add_short(100, timeout_reset_short_callback,
+					 &ctx);
+	i_gettimeofday(&ctx.tv_reset);
+	io_loop_run(ioloop);
+
+	/* the long timeout was run twice after the last reset. The timeout
+	   times are truncated to milliseconds, so allow a bit of slack. */
+	test_assert(ctx.reset_count == 5);
+	test_assert(ctx.long_count == 2);
+	test_assert(timeval_diff_msecs(&ctx.tv_callback, &ctx.tv_reset) >= 1995);
+	test_assert(timeval_diff_msecs(&ctx.tv_callback, &ctx.tv_reset) < 2500);
+
+	test_assert(!io_loop_is_empty(ioloop));
+	timeout_remove(&to_idle);
+	timeout_remove(&ctx.to_long);
+	test_assert(io_loop_is_empty(ioloop));
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void zero_timeout_callback(unsigned int *counter)
 {
 	*counter += 1;
@@ -296,6 +350,36 @@ static void test_ioloop_pending_io(void)
 	test_end();
 }
 
+static void test_ioloop_callback_stats_slow(void *context ATTR_UNUSED)
+{
+	i_sleep_msecs(20);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_callback_stats(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+
+	test_begin("ioloop callback stats");
+	ioloop = io_loop_create();
+	io_loop_set_callback_stats(ioloop, 10);
+	to = timeout_add_short(0, test_ioloop_callback_stats_slow, NULL);
+	test_expect_error_string("test-ioloop.c:");
+	io_loop_run(ioloop);
+	test_expect_no_more_errors();
+	timeout_remove(&to);
+
+	/* a fast callback doesn't warn */
+	to = timeout_add_short(0, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	io_loop_send_callback_stats(ioloop);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void test_ioloop_context_callback(struct ioloop_context *ctx)
 {
 	test_assert(io_loop_get_current_context(current_ioloop) == ctx);
@@ -394,10 +478,12 @@ static void test_ioloop_context_events(void)
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
+	test_ioloop_timeout_reset();
 	test_ioloop_zero_timeout();
 	test_ioloop_zero_timeout_recreate();
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
+	test_ioloop_callback_stats();
 	test_ioloop_fd();
 	test_ioloop_context();
 	test_ioloop_context_events();
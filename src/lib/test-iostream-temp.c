@@ -141,10 +141,75 @@ static void test_iostream_temp_istream(void)
 	test_end();
 }
 
+#ifdef HAVE_MEMFD_CREATE
+static void test_iostream_temp_memfd(void)
+{
+	struct ostream *output;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	test_begin("iostream_temp memfd");
+	/* the prefix directory doesn't exist, so this works only if memfd
+	   is used */
+	output = iostream_temp_create_sized("./nonexistent/",
+					    IOSTREAM_TEMP_FLAG_MEMFD |
+					    IOSTREAM_TEMP_FLAG_MMAP, "test", 4);
+	test_assert(o_stream_send_str(output, "12345") == 5);
+	test_assert(o_stream_get_fd(output) != -1);
+	test_assert(o_stream_send_str(output, "67890") == 5);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_more(input, &data, &size) == 1 &&
+		    size == 10 && memcmp(data, "1234567890", 10) == 0);
+	i_stream_unref(&input);
+	test_end();
+}
+#endif
+
+static void test_iostream_temp_mmap(void)
+{
+	struct ostream *output;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	test_begin("iostream_temp mmap");
+	output = iostream_temp_create_sized(".", IOSTREAM_TEMP_FLAG_MMAP,
+					    "test", 4);
+	test_assert(o_stream_send_str(output, "12345") == 5);
+	test_assert(o_stream_get_fd(output) != -1);
+	test_assert(o_stream_send_str(output, "67890") == 5);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_get_fd(input) == -1);
+	test_assert(i_stream_read_more(input, &data, &size) == 1 &&
+		    size == 10 && memcmp(data, "1234567890", 10) == 0);
+	i_stream_seek(input, 4);
+	test_assert(i_stream_read_more(input, &data, &size) == 1 &&
+		    size == 6 && memcmp(data, "567890", 6) == 0);
+	i_stream_skip(input, size);
+	test_assert(i_stream_read(input) == -1 && input->eof &&
+		    input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	/* data kept in memory isn't affected */
+	output = iostream_temp_create_sized(".", IOSTREAM_TEMP_FLAG_MMAP,
+					    "test", 4);
+	test_assert(o_stream_send_str(output, "123") == 3);
+	input = iostream_temp_finish(&output, 128);
+	test_assert(i_stream_read_more(input, &data, &size) == 1 &&
+		    size == 3 && memcmp(data, "123", 3) == 0);
+	i_stream_unref(&input);
+	test_end();
+}
+
 void test_iostream_temp(void)
 {
 	test_iostream_temp_create_sized_memory();
 	test_iostream_temp_create_sized_disk();
 	test_iostream_temp_create_write_error();
 	test_iostream_temp_istream();
+	test_iostream_temp_mmap();
+#ifdef HAVE_MEMFD_CREATE
+	test_iostream_temp_memfd();
+#endif
 }
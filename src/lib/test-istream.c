@@ -373,9 +373,39 @@ static void test_istream_read_next_line(void)
 	test_end();
 }
 
+static void test_istream_next_line_partial(void)
+{
+	static const char data[] = "first line\nlong line without lf";
+	struct istream *input;
+	size_t i;
+
+	test_begin("i_stream_next_line() partial lines");
+	input = test_istream_create(data);
+	for (i = 1; i <= strlen(data); i++) {
+		test_istream_set_size(input, i);
+		(void)i_stream_read(input);
+		if (i == 11) {
+			test_assert_strcmp(i_stream_next_line(input),
+					   "first line");
+		}
+		test_assert(i_stream_next_line(input) == NULL);
+	}
+	/* seeking back must not use the already searched offsets */
+	i_stream_seek(input, 0);
+	test_assert(i_stream_read(input) > 0);
+	test_assert_strcmp(i_stream_next_line(input), "first line");
+	test_assert(i_stream_next_line(input) == NULL);
+	test_assert(i_stream_read(input) == -1);
+	i_stream_set_return_partial_line(input, TRUE);
+	test_assert_strcmp(i_stream_next_line(input), "long line without lf");
+	i_stream_unref(&input);
+	test_end();
+}
+
 void test_istream(void)
 {
 	test_istream_children();
 	test_istream_next_line();
 	test_istream_read_next_line();
+	test_istream_next_line_partial();
 }
@@ -39,10 +39,36 @@ static void test_lib_event_reason_code(void)
 	test_end();
 }
 
+static void test_lib_event_reuse(void)
+{
+	struct event_category category = { .name = "reuse" };
+	struct event *e;
+	unsigned int i, count;
+
+	test_begin("event reuse");
+	for (i = 0; i < 100; i++) {
+		e = event_create(NULL);
+		/* freed events' memory is reused - nothing must be left over
+		   from the earlier events */
+		test_assert(event_find_field_nonrecursive(e, "key") == NULL);
+		(void)event_get_categories(e, &count);
+		test_assert(count == 0);
+		event_add_category(e, &category);
+		event_add_int(e, "key", i);
+		/* grow the pool beyond its initial block */
+		for (unsigned int j = 0; j < 100; j++)
+			event_add_str(e, t_strdup_printf("key%u", j), "value");
+		test_assert(event_find_field_nonrecursive(e, "key")->value.intmax == i);
+		event_unref(&e);
+	}
+	test_end();
+}
+
 void test_lib_event(void)
 {
 	test_event_strlist();
 	test_lib_event_reason_code();
+	test_lib_event_reuse();
 }
 
 enum fatal_test_state fatal_lib_event(unsigned int stage)
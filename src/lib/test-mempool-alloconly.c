@@ -14,6 +14,33 @@ static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
 	return TRUE;
 }
 
+static void test_mempool_alloconly_reuse(void)
+{
+	pool_t pool;
+	unsigned int i, j;
+	void *mem;
+
+	test_begin("mempool_alloconly block reuse");
+	for (i = 0; i < 100; i++) {
+		pool = pool_alloconly_create("test", 1024);
+		/* freed blocks may be reused by the next pool, but
+		   p_malloc() must still return zero-filled memory */
+		for (j = 0; j < 50; j++) {
+			mem = p_malloc(pool, 100 + i);
+			test_assert(mem_has_bytes(mem, 100 + i, 0));
+			memset(mem, 0xff, 100 + i);
+		}
+		if (i % 2 == 0) {
+			p_clear(pool);
+			mem = p_malloc(pool, 900);
+			test_assert(mem_has_bytes(mem, 900, 0));
+			memset(mem, 0xff, 900);
+		}
+		pool_unref(&pool);
+	}
+	test_end();
+}
+
 void test_mempool_alloconly(void)
 {
 #define SENTRY_SIZE 32
@@ -51,6 +78,8 @@ void test_mempool_alloconly(void)
 		}
 	}
 	test_end();
+
+	test_mempool_alloconly_reuse();
 }
 
 enum fatal_test_state fatal_mempool_alloconly(unsigned int stage)
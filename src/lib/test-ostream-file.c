@@ -181,9 +181,73 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static int test_auto_cork_fds[2];
+
+static void test_ostream_file_auto_cork_send(struct ostream *output)
+{
+	char buf[1];
+	unsigned int i;
+
+	for (i = 0; i < 100; i++)
+		o_stream_nsend(output, "x", 1);
+	test_assert(o_stream_is_corked(output));
+	/* nothing is written before the ioloop run ends */
+	test_assert(recv(test_auto_cork_fds[1], buf, sizeof(buf),
+			 MSG_DONTWAIT) < 0 && errno == EAGAIN);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ostream_file_auto_cork_destroy(struct ostream *output)
+{
+	o_stream_nsend(output, "y", 1);
+	test_assert(o_stream_is_corked(output));
+	test_assert(o_stream_finish(output) > 0);
+	o_stream_destroy(&output);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ostream_file_auto_cork(void)
+{
+	struct ioloop *ioloop;
+	struct ostream *output;
+	struct timeout *to;
+	char buf[200];
+
+	test_begin("ostream file auto cork");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, test_auto_cork_fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(test_auto_cork_fds[0], TRUE);
+	ioloop = io_loop_create();
+
+	output = o_stream_create_fd(test_auto_cork_fds[0], 1024);
+	o_stream_set_auto_cork(output, TRUE);
+	to = timeout_add_short(0, test_ostream_file_auto_cork_send, output);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	/* everything got sent once the ioloop run ended */
+	test_assert(!o_stream_is_corked(output));
+	test_assert(recv(test_auto_cork_fds[1], buf, sizeof(buf),
+			 MSG_DONTWAIT) == 100);
+	test_assert(o_stream_flush(output) > 0);
+
+	/* destroying the stream before the ioloop run ends */
+	to = timeout_add_short(0, test_ostream_file_auto_cork_destroy, output);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	test_assert(recv(test_auto_cork_fds[1], buf, sizeof(buf),
+			 MSG_DONTWAIT) == 1);
+
+	io_loop_destroy(&ioloop);
+	i_close_fd(&test_auto_cork_fds[0]);
+	i_close_fd(&test_auto_cork_fds[1]);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_auto_cork();
 }
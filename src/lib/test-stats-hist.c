@@ -0,0 +1,130 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "stats-hist.h"
+
+static void test_stats_hist_buckets(void)
+{
+	struct stats_hist *hist;
+	struct stats_hist_bucket bucket;
+	unsigned int idx = 0, bucket_count = 0;
+	uint64_t prev_max = 0, total = 0;
+
+	test_begin("stats_hist buckets");
+	hist = stats_hist_init();
+	for (uint64_t value = 0; value < 100000; value++)
+		stats_hist_add(hist, value);
+	stats_hist_add(hist, UINT64_MAX);
+
+	while (stats_hist_bucket_next(hist, &idx, &bucket)) {
+		test_assert(bucket.min <= bucket.max);
+		if (bucket.min <= 99999) {
+			/* buckets are contiguous and ascending */
+			test_assert(bucket.min == (bucket_count == 0 ? 0 :
+						   prev_max + 1));
+			/* relative error is bounded by the sub-buckets */
+			test_assert((bucket.max - bucket.min) *
+				    STATS_HIST_SUB_BUCKETS <= bucket.min);
+		}
+		if (bucket.max <= 99999)
+			test_assert(bucket.count == bucket.max - bucket.min + 1);
+		prev_max = bucket.max;
+		total += bucket.count;
+		bucket_count++;
+	}
+	test_assert(total == 100001);
+	test_assert(prev_max == UINT64_MAX);
+	test_assert(stats_hist_get_count(hist) == 100001);
+	test_assert(stats_hist_get_min(hist) == 0);
+	test_assert(stats_hist_get_max(hist) == UINT64_MAX);
+
+	stats_hist_reset(hist);
+	idx = 0;
+	test_assert(!stats_hist_bucket_next(hist, &idx, &bucket));
+	test_assert(stats_hist_get_count(hist) == 0);
+	test_assert(stats_hist_get_sum(hist) == 0);
+	test_assert(stats_hist_get_max(hist) == 0);
+	test_assert(stats_hist_get_percentile(hist, 0.5) == 0);
+	stats_hist_deinit(&hist);
+	test_end();
+}
+
+static void test_stats_hist_percentile(void)
+{
+	struct stats_hist *hist;
+	uint64_t value;
+
+	test_begin("stats_hist percentile");
+	hist = stats_hist_init();
+	for (unsigned int i = 1; i <= 10; i++)
+		stats_hist_add(hist, i);
+	/* small values are exact */
+	test_assert(stats_hist_get_percentile(hist, 0.5) == 5);
+	test_assert(stats_hist_get_percentile(hist, 0.95) == 10);
+	test_assert(stats_hist_get_percentile(hist, 1.0) == 10);
+	test_assert(stats_hist_get_percentile(hist, 0.0) == 1);
+	stats_hist_reset(hist);
+
+	for (unsigned int i = 1; i <= 100000; i++)
+		stats_hist_add(hist, i * 10);
+	test_assert(stats_hist_get_sum(hist) == 10ULL * 100000 * 100001 / 2);
+	value = stats_hist_get_percentile(hist, 0.5);
+	test_assert(value >= 500000 && value <= 500000 + 500000 / 16);
+	value = stats_hist_get_percentile(hist, 0.99);
+	test_assert(value >= 990000 && value <= 990000 + 990000 / 16);
+	test_assert(stats_hist_get_percentile(hist, 1.0) == 1000000);
+	stats_hist_deinit(&hist);
+	test_end();
+}
+
+static void test_stats_hist_merge(void)
+{
+	struct stats_hist *hist1, *hist2, *all;
+	struct stats_hist_bucket bucket1, bucket2;
+	unsigned int idx1 = 0, idx2 = 0;
+	uint64_t value;
+
+	test_begin("stats_hist merge");
+	hist1 = stats_hist_init();
+	hist2 = stats_hist_init();
+	all = stats_hist_init();
+	for (unsigned int i = 0; i < 5000; i++) {
+		value = (i * 7919ULL) % 100003;
+		stats_hist_add(i % 3 == 0 ? hist1 : hist2, value);
+		stats_hist_add(all, value);
+	}
+	stats_hist_add(hist2, 12345678901ULL);
+	stats_hist_add(all, 12345678901ULL);
+
+	stats_hist_merge(hist1, hist2);
+	test_assert(stats_hist_get_count(hist1) == stats_hist_get_count(all));
+	test_assert(stats_hist_get_sum(hist1) == stats_hist_get_sum(all));
+	test_assert(stats_hist_get_min(hist1) == stats_hist_get_min(all));
+	test_assert(stats_hist_get_max(hist1) == stats_hist_get_max(all));
+	while (stats_hist_bucket_next(all, &idx2, &bucket2)) {
+		test_assert(stats_hist_bucket_next(hist1, &idx1, &bucket1));
+		test_assert(bucket1.min == bucket2.min &&
+			    bucket1.max == bucket2.max &&
+			    bucket1.count == bucket2.count);
+	}
+	test_assert(!stats_hist_bucket_next(hist1, &idx1, &bucket1));
+
+	/* merging into an empty histogram copies it */
+	stats_hist_reset(hist2);
+	stats_hist_merge(hist2, all);
+	test_assert(stats_hist_get_min(hist2) == stats_hist_get_min(all));
+	test_assert(stats_hist_get_percentile(hist2, 0.9) ==
+		    stats_hist_get_percentile(all, 0.9));
+
+	stats_hist_deinit(&hist1);
+	stats_hist_deinit(&hist2);
+	stats_hist_deinit(&all);
+	test_end();
+}
+
+void test_stats_hist(void)
+{
+	test_stats_hist_buckets();
+	test_stats_hist_percentile();
+	test_stats_hist_merge();
+}
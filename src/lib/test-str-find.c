@@ -51,6 +51,57 @@ static bool test_str_find_substring(const char *key, int expected_pos)
 	return TRUE;
 }
 
+static void test_str_find_long(void)
+{
+	unsigned char text[512];
+	struct str_find_context *ctx;
+	const char *key, *p;
+	unsigned int i, len, block_size, pos, block_len, expected_pos;
+	bool found;
+
+	test_begin("str_find() long text");
+	/* mostly 'a' with a few 'b's, so there are plenty of partial
+	   matches for the first and last bytes */
+	for (i = 0; i < sizeof(text) - 1; i++)
+		text[i] = i_rand_limit(8) == 0 ? 'b' : 'a';
+	text[sizeof(text) - 1] = '\0';
+
+	for (len = 1; len <= 80; len++) {
+		key = t_strndup(text + i_rand_limit(sizeof(text) - len), len);
+		p = strstr((const char *)text, key);
+		i_assert(p != NULL);
+		expected_pos = p - (const char *)text;
+
+		ctx = str_find_init(pool_datastack_create(), key);
+		for (block_size = 1; block_size <= 70;
+		     block_size += i_rand_minmax(1, 7)) {
+			str_find_reset(ctx);
+			found = FALSE;
+			for (pos = 0; pos < sizeof(text) - 1; pos += block_len) {
+				block_len = I_MIN(block_size,
+						  sizeof(text) - 1 - pos);
+				if (str_find_more(ctx, text + pos, block_len)) {
+					found = TRUE;
+					break;
+				}
+			}
+			test_assert_idx(found, len);
+			test_assert_idx(pos + str_find_get_match_end_pos(ctx) -
+					len == expected_pos, len);
+		}
+		str_find_deinit(&ctx);
+
+		/* the key is not found when changing its last byte */
+		ctx = str_find_init(pool_datastack_create(),
+				    t_strconcat(t_strndup(key, len - 1),
+						"c", NULL));
+		test_assert_idx(!str_find_more(ctx, text, sizeof(text) - 1),
+				len);
+		str_find_deinit(&ctx);
+	}
+	test_end();
+}
+
 struct str_find_input {
 	const char *str;
 	int pos;
@@ -83,4 +134,6 @@ void test_str_find(void)
 	for (i = 0; i < N_ELEMENTS(fail_input) && success; i++)
 		success = test_str_find_substring(fail_input[i], -1);
 	test_out("str_find()", success);
+
+	test_str_find_long();
 }
@@ -121,6 +121,33 @@ static void test_unichar_surrogates(void)
 	test_end();
 }
 
+static void test_unichar_valid_data_ascii(void)
+{
+	unsigned char data[64];
+	unsigned int i, j;
+
+	test_begin("unichar valid data with long ASCII runs");
+	memset(data, 'a', sizeof(data));
+	for (i = 0; i <= sizeof(data); i++)
+		test_assert_idx(uni_utf8_data_is_valid(data, i), i);
+
+	/* invalid and valid non-ASCII bytes at all word offsets */
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = 0xff;
+		for (j = i + 1; j <= sizeof(data); j++)
+			test_assert_idx(!uni_utf8_data_is_valid(data, j), i);
+		test_assert_idx(uni_utf8_data_is_valid(data, i), i);
+		data[i] = 'a';
+	}
+	for (i = 0; i + 1 < sizeof(data); i++) {
+		data[i] = 0xc3; data[i+1] = 0xa4;
+		test_assert_idx(uni_utf8_data_is_valid(data, sizeof(data)), i);
+		test_assert_idx(!uni_utf8_data_is_valid(data, i + 1), i);
+		data[i] = 'a'; data[i+1] = 'a';
+	}
+	test_end();
+}
+
 void test_unichar(void)
 {
 	static const char overlong_utf8[] = "\xf8\x80\x95\x81\xa1";
@@ -182,4 +209,5 @@ void test_unichar(void)
 	test_unichar_uni_utf8_partial_strlen_n();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
+	test_unichar_valid_data_ascii();
 }
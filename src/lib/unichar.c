@@ -370,9 +370,19 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 
 	/* find the first invalid utf8 sequence */
 	for (i = 0; i < size;) {
-		if (input[i] < 0x80)
+		if (input[i] < 0x80) {
+			/* Most of the input is usually ASCII. Skip it 8 bytes
+			   at a time until a byte with the high bit set. */
 			i++;
-		else {
+			while (size - i >= sizeof(uint64_t)) {
+				uint64_t word;
+
+				memcpy(&word, input + i, sizeof(word));
+				if ((word & 0x8080808080808080ULL) != 0)
+					break;
+				i += sizeof(word);
+			}
+		} else {
 			len = is_valid_utf8_seq(input + i, size-i);
 			if (unlikely(len == 0)) {
 				*pos_r = i;
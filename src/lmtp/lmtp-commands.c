@@ -275,14 +275,17 @@ int cmd_data_begin(void *conn_ctx,
 		   struct istream *data_input)
 {
 	struct client *client = (struct client *)conn_ctx;
+	enum iostream_temp_flags flags = IOSTREAM_TEMP_FLAG_MMAP;
 	string_t *path;
 
 	i_assert(client->state.mail_data_output == NULL);
 
+	if (client->lmtp_set->lmtp_data_memfd)
+		flags |= IOSTREAM_TEMP_FLAG_MEMFD;
 	path = t_str_new(256);
 	mail_user_set_get_temp_prefix(path, client->raw_mail_user->set);
 	client->state.mail_data_output = 
-		iostream_temp_create_named(str_c(path), 0, "(lmtp data)");
+		iostream_temp_create_named(str_c(path), flags, "(lmtp data)");
 
 	client->state.data_input = data_input;
 	return 0;
@@ -2,8 +2,11 @@
 
 #include "lmtp-common.h"
 #include "str.h"
+#include "strnum.h"
 #include "istream.h"
 #include "strescape.h"
+#include "str-sanitize.h"
+#include "write-full.h"
 #include "time-util.h"
 #include "hostpid.h"
 #include "var-expand.h"
@@ -15,6 +18,7 @@
 #include "mail-namespace.h"
 #include "mail-deliver.h"
 #include "mail-autoexpunge.h"
+#include "mail-attachment-cache.h"
 #include "index/raw/raw-storage.h"
 #include "smtp-common.h"
 #include "smtp-params.h"
@@ -23,8 +27,12 @@
 #include "lda-settings.h"
 #include "lmtp-settings.h"
 #include "lmtp-recipient.h"
+#include "lmtp-user-cache.h"
 #include "lmtp-local.h"
 
+#include <unistd.h>
+#include <sys/wait.h>
+
 struct lmtp_local_recipient {
 	struct lmtp_recipient *rcpt;
 
@@ -33,11 +41,22 @@ struct lmtp_local_recipient {
 	struct mail_storage_service_user *service_user;
 	struct anvil_query *anvil_query;
 
+	/* Set if the service_user can be put to the user cache afterwards */
+	const char *cache_key;
+	time_t cache_lookup_time;
+
 	struct lmtp_local_recipient *duplicate;
+	/* Delivery worker process handling this recipient */
+	unsigned int worker_idx;
 
 	bool anvil_connect_sent:1;
 };
 
+struct lmtp_local_worker {
+	pid_t pid;
+	int fd;
+};
+
 struct lmtp_local {
 	struct client *client;
 
@@ -45,6 +64,11 @@ struct lmtp_local {
 
 	struct mail *raw_mail, *first_saved_mail;
 	struct mail_user *rcpt_user;
+
+	/* Set in a delivery worker process, which delivers only the
+	   recipients with the matching worker_idx. */
+	unsigned int worker_idx;
+	bool worker:1;
 };
 
 /*
@@ -111,7 +135,14 @@ lmtp_local_rcpt_destroy(struct smtp_server_recipient *rcpt ATTR_UNUSED,
 	if (llrcpt->anvil_query != NULL)
 		anvil_client_query_abort(anvil, &llrcpt->anvil_query);
 	lmtp_local_rcpt_anvil_disconnect(llrcpt);
-	mail_storage_service_user_unref(&llrcpt->service_user);
+	if (llrcpt->cache_key == NULL)
+		mail_storage_service_user_unref(&llrcpt->service_user);
+	else {
+		lmtp_user_cache_put(llrcpt->rcpt->client->lmtp_set,
+				    llrcpt->cache_key,
+				    llrcpt->cache_lookup_time,
+				    &llrcpt->service_user);
+	}
 }
 
 static void
@@ -291,8 +322,9 @@ int lmtp_local_rcpt(struct client *client,
 	struct smtp_server_recipient *rcpt = lrcpt->rcpt;
 	struct lmtp_local_recipient *llrcpt;
 	struct mail_storage_service_input input;
-	struct mail_storage_service_user *service_user;
-	const char *error = NULL;
+	struct mail_storage_service_user *service_user = NULL;
+	const char *cache_key, *error = NULL;
+	time_t cache_lookup_time = ioloop_time;
 	int ret = 0;
 
 	i_zero(&input);
@@ -310,8 +342,20 @@ int lmtp_local_rcpt(struct client *client,
 	input.forward_fields = lrcpt->forward_fields;
 	input.event_parent = rcpt->event;
 
-	ret = mail_storage_service_lookup(storage_service, &input,
-					  &service_user, &error);
+	cache_key = lmtp_user_cache_get_key(client->lmtp_set, &input);
+	if (cache_key != NULL) {
+		service_user = lmtp_user_cache_get(client->lmtp_set, cache_key,
+						   &cache_lookup_time);
+	}
+	if (service_user != NULL) {
+		e_debug(rcpt->event, "Using cached user lookup for %s",
+			username);
+		mail_storage_service_user_set_session(service_user, &input);
+		ret = 1;
+	} else {
+		ret = mail_storage_service_lookup(storage_service, &input,
+						  &service_user, &error);
+	}
 	if (ret < 0) {
 		e_error(rcpt->event, "Failed to lookup user %s: %s",
 			username, error);
@@ -333,6 +377,8 @@ int lmtp_local_rcpt(struct client *client,
 	llrcpt->rcpt = lrcpt;
 	llrcpt->detail = p_strdup(rcpt->pool, detail);
 	llrcpt->service_user = service_user;
+	llrcpt->cache_key = p_strdup(rcpt->pool, cache_key);
+	llrcpt->cache_lookup_time = cache_lookup_time;
 
 	lrcpt->type = LMTP_RECIPIENT_TYPE_LOCAL;
 	lrcpt->backend_context = llrcpt;
@@ -446,6 +492,8 @@ lmtp_local_deliver(struct lmtp_local *local,
 				       proxy_data.timeout_secs-1);
 		if (settings_parse_line(set_parser, line) < 0)
 			i_unreached();
+		/* the changed setting is specific to this session */
+		llrcpt->cache_key = NULL;
 	}
 
 	i_zero(&lldctx);
@@ -460,6 +508,7 @@ lmtp_local_deliver(struct lmtp_local *local,
 	client_update_data_state(client, username);
 	if (mail_storage_service_next(storage_service, service_user,
 				      &rcpt_user, &error) < 0) {
+		llrcpt->cache_key = NULL;
 		e_error(rcpt->event, "Failed to initialize user: %s", error);
 		smtp_server_recipient_reply(rcpt, 451, "4.3.0",
 					    "Temporary internal error");
@@ -471,6 +520,15 @@ lmtp_local_deliver(struct lmtp_local *local,
 	var_table = mail_user_var_expand_table(rcpt_user);
 	smtp_set = sets[1];
 	lda_set = sets[2];
+	if (llrcpt->cache_key != NULL) {
+		/* the service_user is reused later, so the settings must not
+		   be expanded in place with values from this session's
+		   pool. */
+		smtp_set = settings_dup(&smtp_submit_setting_parser_info,
+					smtp_set, client->pool);
+		lda_set = settings_dup(&lda_setting_parser_info,
+				       lda_set, client->pool);
+	}
 	ret = settings_var_expand(
 		&smtp_submit_setting_parser_info,
 		smtp_set, client->pool, var_table,
@@ -614,6 +672,17 @@ int lmtp_local_default_deliver(struct client *client,
 	return ret;
 }
 
+static bool
+lmtp_local_rcpt_is_ours(struct lmtp_local *local,
+			struct lmtp_local_recipient *llrcpt)
+{
+	if (!local->worker)
+		return TRUE;
+	/* duplicates are replied to by the parent process */
+	return llrcpt->duplicate == NULL &&
+		llrcpt->worker_idx == local->worker_idx;
+}
+
 static uid_t
 lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 			    struct smtp_server_cmd_ctx *cmd,
@@ -624,15 +693,21 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 	uid_t first_uid = (uid_t)-1;
 	struct mail *src_mail;
 	struct lmtp_local_recipient *const *llrcpts;
-	unsigned int count, i;
+	unsigned int count, last, i;
 	int ret;
 
 	src_mail = local->raw_mail;
 	llrcpts = array_get(&local->rcpt_to, &count);
-	for (i = 0; i < count; i++) {
+	for (last = count; last > 0; last--) {
+		if (lmtp_local_rcpt_is_ours(local, llrcpts[last-1]))
+			break;
+	}
+	for (i = 0; i < last; i++) {
 		struct lmtp_local_recipient *llrcpt = llrcpts[i];
 		struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
 
+		if (!lmtp_local_rcpt_is_ours(local, llrcpt))
+			continue;
 		if (llrcpt->duplicate != NULL) {
 			struct smtp_server_recipient *drcpt =
 				llrcpt->duplicate->rcpt->rcpt;
@@ -652,7 +727,7 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 		      local->first_saved_mail == src_mail)) ||
 		    /* failed. try the next one. */
 		    (ret != 0 && local->rcpt_user != NULL)) {
-			if (i == (count - 1))
+			if (i == (last - 1))
 				mail_user_autoexpunge(local->rcpt_user);
 			mail_storage_service_io_deactivate_user(local->rcpt_user->_service_user);
 			mail_user_deinit(&local->rcpt_user);
@@ -673,6 +748,271 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 	return first_uid;
 }
 
+static void
+lmtp_local_free_first_saved_mail(struct lmtp_local *local,
+				 uid_t old_uid, uid_t first_uid)
+{
+	struct mail *mail = local->first_saved_mail;
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+	struct mail_user *user;
+
+	if (mail == NULL)
+		return;
+	local->first_saved_mail = NULL;
+
+	trans = mail->transaction;
+	box = trans->box;
+	user = box->storage->user;
+
+	/* just in case these functions are going to write anything,
+	   change uid back to user's own one */
+	if (first_uid != old_uid) {
+		if (seteuid(0) < 0)
+			i_fatal("seteuid(0) failed: %m");
+		if (seteuid(first_uid) < 0)
+			i_fatal("seteuid() failed: %m");
+	}
+
+	mail_storage_service_io_activate_user(user->_service_user);
+	mail_free(&mail);
+	mailbox_transaction_rollback(&trans);
+	mailbox_free(&box);
+	mail_user_autoexpunge(user);
+	mail_storage_service_io_deactivate_user(user->_service_user);
+	mail_user_deinit(&user);
+}
+
+/*
+ * Parallel delivery
+ */
+
+static unsigned int lmtp_local_get_worker_count(struct lmtp_local *local)
+{
+	struct lmtp_local_recipient *const *llrcpts;
+	unsigned int count, i, unique_count = 0;
+
+	if (local->client->lmtp_set->lmtp_local_delivery_workers <= 1)
+		return 0;
+
+	llrcpts = array_get(&local->rcpt_to, &count);
+	for (i = 0; i < count; i++) {
+		if (llrcpts[i]->duplicate == NULL)
+			unique_count++;
+	}
+	if (unique_count <= 1)
+		return 0;
+	return I_MIN(unique_count,
+		     local->client->lmtp_set->lmtp_local_delivery_workers);
+}
+
+static void ATTR_NORETURN
+lmtp_local_worker_run(struct lmtp_local *local,
+		      struct smtp_server_cmd_ctx *cmd,
+		      struct smtp_server_transaction *trans,
+		      struct mail_deliver_session *session,
+		      unsigned int worker_idx, int fd)
+{
+	struct lmtp_local_recipient *const *llrcpts;
+	struct smtp_server_reply *reply;
+	const char *enh_code;
+	unsigned int count, i, status;
+	uid_t old_uid, first_uid;
+	string_t *str;
+
+	local->worker = TRUE;
+	local->worker_idx = worker_idx;
+
+	/* the parent process sends the anvil disconnects */
+	llrcpts = array_get(&local->rcpt_to, &count);
+	for (i = 0; i < count; i++)
+		llrcpts[i]->anvil_connect_sent = FALSE;
+
+	old_uid = geteuid();
+	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session);
+	lmtp_local_free_first_saved_mail(local, old_uid, first_uid);
+
+	/* <index> <status> <enhanced code> <message> for each of our
+	   recipients. The replies were only submitted to this process's copy
+	   of the DATA command, which never gets all of its replies here, so
+	   nothing was sent to the client. */
+	str = t_str_new(256);
+	for (i = 0; i < count; i++) {
+		if (!lmtp_local_rcpt_is_ours(local, llrcpts[i]))
+			continue;
+		reply = smtp_server_recipient_get_reply(llrcpts[i]->rcpt->rcpt);
+		if (reply == NULL)
+			continue;
+		status = smtp_server_reply_get_status(reply, &enh_code);
+		str_printfa(str, "%u\t%u\t", i, status);
+		if (enh_code != NULL)
+			str_append_tabescaped(str, enh_code);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str,
+			smtp_server_reply_get_message(reply));
+		str_append_c(str, '\n');
+	}
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		i_error("write(delivery worker pipe) failed: %m");
+		_exit(FATAL_DEFAULT);
+	}
+	/* don't run any deinitialization, which would disconnect the
+	   parent's client and service connections. Buffered log lines
+	   would be lost by _exit(), so write them out first. */
+	i_failure_flush();
+	_exit(0);
+}
+
+static void
+lmtp_local_worker_read_replies(struct lmtp_local *local,
+			       struct smtp_server_cmd_ctx *cmd,
+			       unsigned int worker_idx,
+			       struct lmtp_local_worker *worker)
+{
+	struct client *client = local->client;
+	struct lmtp_local_recipient *const *llrcpts;
+	struct smtp_server_recipient *rcpt;
+	struct istream *input;
+	const char *line, *const *args;
+	unsigned int count, idx, status;
+	int wstatus;
+
+	llrcpts = array_get(&local->rcpt_to, &count);
+	input = i_stream_create_fd(worker->fd, SIZE_MAX);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) != 4 ||
+		    str_to_uint(args[0], &idx) < 0 || idx >= count ||
+		    llrcpts[idx]->duplicate != NULL ||
+		    llrcpts[idx]->worker_idx != worker_idx ||
+		    str_to_uint(args[1], &status) < 0 ||
+		    status < 200 || status >= 560) {
+			e_error(client->event,
+				"Delivery worker sent invalid reply: %s",
+				str_sanitize(line, 256));
+			continue;
+		}
+		rcpt = llrcpts[idx]->rcpt->rcpt;
+		if (smtp_server_recipient_get_reply(rcpt) != NULL)
+			continue;
+		/* the message already has the recipient path prefixed
+		   where necessary */
+		smtp_server_reply_index(cmd, rcpt->index, status,
+					args[2][0] == '\0' ? NULL : args[2],
+					"%s", args[3]);
+	}
+	if (input->stream_errno != 0) {
+		e_error(client->event, "read(delivery worker pipe) failed: %s",
+			i_stream_get_error(input));
+	}
+	i_stream_destroy(&input);
+	i_close_fd(&worker->fd);
+
+	while (waitpid(worker->pid, &wstatus, 0) < 0) {
+		if (errno != EINTR) {
+			e_error(client->event, "waitpid(%s) failed: %m",
+				dec2str(worker->pid));
+			return;
+		}
+	}
+	if (WIFSIGNALED(wstatus)) {
+		e_error(client->event,
+			"Delivery worker process %s killed with signal %d",
+			dec2str(worker->pid), WTERMSIG(wstatus));
+	} else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0) {
+		e_error(client->event,
+			"Delivery worker process %s returned status %d",
+			dec2str(worker->pid), WEXITSTATUS(wstatus));
+	}
+}
+
+static uid_t
+lmtp_local_deliver_parallel(struct lmtp_local *local,
+			    struct smtp_server_cmd_ctx *cmd,
+			    struct smtp_server_transaction *trans,
+			    struct mail_deliver_session *session,
+			    unsigned int worker_count)
+{
+	struct client *client = local->client;
+	struct lmtp_local_recipient *const *llrcpts;
+	struct lmtp_local_worker *workers;
+	unsigned int count, i, n, started;
+	uid_t first_uid = (uid_t)-1;
+	int fd[2];
+	pid_t pid;
+
+	/* spread the unique recipients evenly to the workers */
+	llrcpts = array_get(&local->rcpt_to, &count);
+	for (i = n = 0; i < count; i++) {
+		if (llrcpts[i]->duplicate == NULL)
+			llrcpts[i]->worker_idx = n++ % worker_count;
+	}
+
+	workers = t_new(struct lmtp_local_worker, worker_count);
+	for (started = 0; started < worker_count; started++) {
+		if (pipe(fd) < 0) {
+			e_error(client->event, "pipe() failed: %m");
+			break;
+		}
+		if ((pid = fork()) == (pid_t)-1) {
+			e_error(client->event, "fork() failed: %m");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			break;
+		}
+		if (pid == 0) {
+			/* child */
+			for (i = 0; i < started; i++)
+				i_close_fd(&workers[i].fd);
+			i_close_fd(&fd[0]);
+			lmtp_local_worker_run(local, cmd, trans, session,
+					      started, fd[1]);
+		}
+		i_close_fd(&fd[1]);
+		workers[started].pid = pid;
+		workers[started].fd = fd[0];
+	}
+
+	if (started < worker_count) {
+		/* deliver the recipients of the workers that couldn't be
+		   started in this process while the others are running */
+		for (i = 0; i < count; i++) {
+			if (llrcpts[i]->worker_idx > started)
+				llrcpts[i]->worker_idx = started;
+		}
+		local->worker = TRUE;
+		local->worker_idx = started;
+		first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans,
+							session);
+		local->worker = FALSE;
+	}
+
+	for (i = 0; i < started; i++)
+		lmtp_local_worker_read_replies(local, cmd, i, &workers[i]);
+	client_update_data_state(client, NULL);
+
+	for (i = 0; i < count; i++) {
+		struct lmtp_local_recipient *llrcpt = llrcpts[i];
+		struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
+
+		if (llrcpt->duplicate != NULL) {
+			struct smtp_server_recipient *drcpt =
+				llrcpt->duplicate->rcpt->rcpt;
+			/* don't deliver more than once to the same recipient */
+			smtp_server_reply_submit_duplicate(cmd, rcpt->index,
+							   drcpt->index);
+			continue;
+		}
+		if (smtp_server_recipient_get_reply(rcpt) == NULL) {
+			/* the worker failed before replying */
+			smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+						    "Temporary internal error");
+		}
+		lmtp_local_rcpt_anvil_disconnect(llrcpt);
+	}
+	return first_uid;
+}
+
 static int
 lmtp_local_open_raw_mail(struct lmtp_local *local,
 			 struct smtp_server_transaction *trans,
@@ -715,39 +1055,29 @@ void lmtp_local_data(struct client *client,
 {
 	struct lmtp_local *local = client->local;
 	struct mail_deliver_session *session;
+	unsigned int worker_count;
 	uid_t old_uid, first_uid;
 
 	if (lmtp_local_open_raw_mail(local, trans, input) < 0)
 		return;
 
 	session = mail_deliver_session_init();
+	if (array_count(&local->rcpt_to) > 1) {
+		/* extract attachments only once for all the recipients */
+		session->attachment_cache = mail_attachment_cache_init();
+	}
 	old_uid = geteuid();
-	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session);
+	worker_count = lmtp_local_get_worker_count(local);
+	if (worker_count > 1) {
+		first_uid = lmtp_local_deliver_parallel(local, cmd, trans,
+							session, worker_count);
+	} else {
+		first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans,
+							session);
+	}
 	mail_deliver_session_deinit(&session);
 
-	if (local->first_saved_mail != NULL) {
-		struct mail *mail = local->first_saved_mail;
-		struct mailbox_transaction_context *trans = mail->transaction;
-		struct mailbox *box = trans->box;
-		struct mail_user *user = box->storage->user;
-
-		/* just in case these functions are going to write anything,
-		   change uid back to user's own one */
-		if (first_uid != old_uid) {
-			if (seteuid(0) < 0)
-				i_fatal("seteuid(0) failed: %m");
-			if (seteuid(first_uid) < 0)
-				i_fatal("seteuid() failed: %m");
-		}
-
-		mail_storage_service_io_activate_user(user->_service_user);
-		mail_free(&mail);
-		mailbox_transaction_rollback(&trans);
-		mailbox_free(&box);
-		mail_user_autoexpunge(user);
-		mail_storage_service_io_deactivate_user(user->_service_user);
-		mail_user_deinit(&user);
-	}
+	lmtp_local_free_first_saved_mail(local, old_uid, first_uid);
 
 	if (old_uid == 0) {
 		/* switch back to running as root, since that's what we're
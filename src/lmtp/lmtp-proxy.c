@@ -23,6 +23,9 @@
 
 #define LMTP_MAX_REPLY_SIZE 4096
 #define LMTP_PROXY_DEFAULT_TIMEOUT_MSECS (1000*125)
+/* Each reuse allocates the new XCLIENT data from the connection's pool, so
+   don't reuse the same connection forever. */
+#define LMTP_PROXY_POOL_MAX_REUSE_COUNT 1000
 
 enum lmtp_proxy_ssl_flags {
 	/* Use SSL/TLS enabled */
@@ -67,9 +70,26 @@ struct lmtp_proxy_connection {
 	struct smtp_client_transaction *lmtp_trans;
 	struct istream *data_input;
 	struct timeout *to;
+	unsigned int reuse_count;
 
 	bool finished:1;
 	bool failed:1;
+	bool pooled:1;
+};
+
+/* Idle backend connection kept for reuse by later sessions */
+struct lmtp_proxy_pool_connection {
+	struct lmtp_proxy_pool_backend *backend;
+	struct smtp_client_connection *lmtp_conn;
+	struct timeout *to_idle;
+	unsigned int reuse_count;
+};
+
+struct lmtp_proxy_pool_backend {
+	struct lmtp_proxy_rcpt_settings set;
+	char *host;
+
+	ARRAY(struct lmtp_proxy_pool_connection *) idle_conns;
 };
 
 struct lmtp_proxy {
@@ -78,6 +98,7 @@ struct lmtp_proxy {
 	struct smtp_server_transaction *trans;
 
 	struct smtp_client *lmtp_client;
+	struct smtp_proxy_data proxy_data;
 
 	ARRAY(struct lmtp_proxy_connection *) connections;
 	ARRAY(struct lmtp_proxy_recipient *) rcpt_to;
@@ -91,10 +112,172 @@ struct lmtp_proxy {
 	bool finished:1;
 };
 
+static ARRAY(struct lmtp_proxy_pool_backend *) lmtp_proxy_pool_backends;
+static struct smtp_client *lmtp_proxy_pool_client;
+
 static void
 lmtp_proxy_data_cb(const struct smtp_reply *reply,
 		   struct lmtp_proxy_recipient *lprcpt);
 
+/*
+ * Backend connection pool
+ */
+
+static bool
+lmtp_proxy_rcpt_settings_equal(const struct lmtp_proxy_rcpt_settings *set1,
+			       const struct lmtp_proxy_rcpt_settings *set2)
+{
+	return set1->protocol == set2->protocol &&
+		set1->port == set2->port &&
+		strcmp(set1->host, set2->host) == 0 &&
+		net_ip_compare(&set1->hostip, &set2->hostip) &&
+		net_ip_compare(&set1->source_ip, &set2->source_ip) &&
+		set1->ssl_flags == set2->ssl_flags;
+}
+
+static struct lmtp_proxy_pool_backend *
+lmtp_proxy_pool_backend_get(const struct lmtp_proxy_rcpt_settings *set)
+{
+	struct lmtp_proxy_pool_backend *backend;
+
+	if (!array_is_created(&lmtp_proxy_pool_backends))
+		i_array_init(&lmtp_proxy_pool_backends, 8);
+	array_foreach_elem(&lmtp_proxy_pool_backends, backend) {
+		if (lmtp_proxy_rcpt_settings_equal(&backend->set, set))
+			return backend;
+	}
+
+	backend = i_new(struct lmtp_proxy_pool_backend, 1);
+	backend->set.protocol = set->protocol;
+	backend->set.hostip = set->hostip;
+	backend->host = i_strdup(set->host);
+	backend->set.host = backend->host;
+	backend->set.source_ip = set->source_ip;
+	backend->set.port = set->port;
+	backend->set.ssl_flags = set->ssl_flags;
+	i_array_init(&backend->idle_conns, 4);
+	array_push_back(&lmtp_proxy_pool_backends, &backend);
+	return backend;
+}
+
+static void
+lmtp_proxy_pool_connection_free(struct lmtp_proxy_pool_connection *pconn)
+{
+	timeout_remove(&pconn->to_idle);
+	smtp_client_connection_close(&pconn->lmtp_conn);
+	i_free(pconn);
+}
+
+static void
+lmtp_proxy_pool_connection_remove(struct lmtp_proxy_pool_connection *pconn)
+{
+	struct lmtp_proxy_pool_connection *const *pconns;
+	unsigned int i, count;
+
+	pconns = array_get(&pconn->backend->idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (pconns[i] == pconn) {
+			array_delete(&pconn->backend->idle_conns, i, 1);
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void
+lmtp_proxy_pool_connection_idle_timeout(struct lmtp_proxy_pool_connection *pconn)
+{
+	lmtp_proxy_pool_connection_remove(pconn);
+	lmtp_proxy_pool_connection_free(pconn);
+}
+
+static struct smtp_client_connection *
+lmtp_proxy_pool_get(struct lmtp_proxy *proxy,
+		    const struct lmtp_proxy_rcpt_settings *set,
+		    unsigned int *reuse_count_r)
+{
+	struct lmtp_proxy_pool_backend *backend;
+	struct lmtp_proxy_pool_connection *pconn;
+	struct smtp_client_connection *lmtp_conn;
+
+	backend = lmtp_proxy_pool_backend_get(set);
+	while (array_count(&backend->idle_conns) > 0) {
+		/* use the most recently used connection */
+		pconn = array_idx_elem(&backend->idle_conns,
+				       array_count(&backend->idle_conns) - 1);
+		array_pop_back(&backend->idle_conns);
+
+		if (smtp_client_connection_get_state(pconn->lmtp_conn) !=
+		    SMTP_CLIENT_CONNECTION_STATE_READY) {
+			/* server disconnected us */
+			lmtp_proxy_pool_connection_free(pconn);
+			continue;
+		}
+		lmtp_conn = pconn->lmtp_conn;
+		pconn->lmtp_conn = NULL;
+		*reuse_count_r = pconn->reuse_count + 1;
+		lmtp_proxy_pool_connection_free(pconn);
+
+		e_debug(proxy->client->event,
+			"Reusing pooled connection to %s:%u",
+			set->host, set->port);
+		smtp_client_connection_replace_proxy_data(lmtp_conn,
+							  &proxy->proxy_data);
+		return lmtp_conn;
+	}
+	*reuse_count_r = 0;
+	return NULL;
+}
+
+static void
+lmtp_proxy_pool_put(struct lmtp_proxy_connection *conn)
+{
+	const struct lmtp_settings *lmtp_set = conn->proxy->client->lmtp_set;
+	struct lmtp_proxy_pool_backend *backend;
+	struct lmtp_proxy_pool_connection *pconn;
+
+	backend = lmtp_proxy_pool_backend_get(&conn->set);
+	if (conn->failed ||
+	    conn->reuse_count >= LMTP_PROXY_POOL_MAX_REUSE_COUNT ||
+	    array_count(&backend->idle_conns) >=
+	    lmtp_set->lmtp_proxy_pool_max_connections ||
+	    smtp_client_connection_get_state(conn->lmtp_conn) !=
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		smtp_client_connection_close(&conn->lmtp_conn);
+		return;
+	}
+
+	pconn = i_new(struct lmtp_proxy_pool_connection, 1);
+	pconn->backend = backend;
+	pconn->lmtp_conn = conn->lmtp_conn;
+	pconn->reuse_count = conn->reuse_count;
+	pconn->to_idle = timeout_add(
+		lmtp_set->lmtp_proxy_pool_idle_timeout * 1000,
+		lmtp_proxy_pool_connection_idle_timeout, pconn);
+	array_push_back(&backend->idle_conns, &pconn);
+	conn->lmtp_conn = NULL;
+}
+
+void lmtp_proxy_pool_deinit(void)
+{
+	struct lmtp_proxy_pool_backend *backend;
+	struct lmtp_proxy_pool_connection *pconn;
+
+	if (!array_is_created(&lmtp_proxy_pool_backends))
+		return;
+
+	array_foreach_elem(&lmtp_proxy_pool_backends, backend) {
+		array_foreach_elem(&backend->idle_conns, pconn)
+			lmtp_proxy_pool_connection_free(pconn);
+		array_free(&backend->idle_conns);
+		i_free(backend->host);
+		i_free(backend);
+	}
+	array_free(&lmtp_proxy_pool_backends);
+	if (lmtp_proxy_pool_client != NULL)
+		smtp_client_deinit(&lmtp_proxy_pool_client);
+}
+
 /*
  * LMTP proxy
  */
@@ -123,16 +306,27 @@ lmtp_proxy_init(struct client *client,
 	lmtp_set.rawlog_dir = client->lmtp_set->lmtp_proxy_rawlog_dir;
 
 	smtp_server_connection_get_proxy_data(client->conn,
-					      &lmtp_set.proxy_data);
-	lmtp_set.proxy_data.source_ip = client->remote_ip;
-	lmtp_set.proxy_data.source_port = client->remote_port;
-	lmtp_set.proxy_data.session = trans->id;
-	if (lmtp_set.proxy_data.ttl_plus_1 == 0)
-		lmtp_set.proxy_data.ttl_plus_1 = LMTP_PROXY_DEFAULT_TTL + 1;
+					      &proxy->proxy_data);
+	proxy->proxy_data.source_ip = client->remote_ip;
+	proxy->proxy_data.source_port = client->remote_port;
+	proxy->proxy_data.session = trans->id;
+	if (proxy->proxy_data.ttl_plus_1 == 0)
+		proxy->proxy_data.ttl_plus_1 = LMTP_PROXY_DEFAULT_TTL + 1;
 	else
-		lmtp_set.proxy_data.ttl_plus_1--;
-	lmtp_set.event_parent = client->event;
+		proxy->proxy_data.ttl_plus_1--;
+
+	if (client->lmtp_set->lmtp_proxy_pool_max_connections > 0) {
+		/* Pooled connections outlive this session, so they're
+		   created with a process-wide client that has no session
+		   specific settings. The proxy data is given to each
+		   connection separately. */
+		if (lmtp_proxy_pool_client == NULL)
+			lmtp_proxy_pool_client = smtp_client_init(&lmtp_set);
+		return proxy;
+	}
 
+	lmtp_set.proxy_data = proxy->proxy_data;
+	lmtp_set.event_parent = client->event;
 	proxy->lmtp_client = smtp_client_init(&lmtp_set);
 
 	return proxy;
@@ -141,8 +335,13 @@ lmtp_proxy_init(struct client *client,
 static void
 lmtp_proxy_connection_deinit(struct lmtp_proxy_connection *conn)
 {
-	if (conn->lmtp_trans != NULL)
+	if (conn->lmtp_trans != NULL) {
+		/* unfinished transaction - don't reuse the connection */
 		smtp_client_transaction_destroy(&conn->lmtp_trans);
+		conn->failed = TRUE;
+	}
+	if (conn->lmtp_conn != NULL && conn->pooled)
+		lmtp_proxy_pool_put(conn);
 	if (conn->lmtp_conn != NULL)
 		smtp_client_connection_close(&conn->lmtp_conn);
 	timeout_remove(&conn->to);
@@ -161,7 +360,8 @@ void lmtp_proxy_deinit(struct lmtp_proxy **_proxy)
 	array_foreach_elem(&proxy->connections, conn)
 		lmtp_proxy_connection_deinit(conn);
 
-	smtp_client_deinit(&proxy->lmtp_client);
+	if (proxy->lmtp_client != NULL)
+		smtp_client_deinit(&proxy->lmtp_client);
 	i_stream_unref(&proxy->data_input);
 	timeout_remove(&proxy->to_finish);
 	array_free(&proxy->rcpt_to);
@@ -209,6 +409,12 @@ lmtp_proxy_connection_init_ssl(struct lmtp_proxy_connection *conn,
 		*ssl_mode_r = SMTP_CLIENT_SSL_MODE_STARTTLS;
 }
 
+static struct smtp_client *lmtp_proxy_get_client(struct lmtp_proxy *proxy)
+{
+	return proxy->lmtp_client != NULL ?
+		proxy->lmtp_client : lmtp_proxy_pool_client;
+}
+
 static bool
 lmtp_proxy_connection_has_rcpt_forward(struct lmtp_proxy_connection *conn)
 {
@@ -238,12 +444,7 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	i_assert(set->timeout_msecs > 0);
 
 	array_foreach_elem(&proxy->connections, conn) {
-		if (conn->set.protocol == set->protocol &&
-		    conn->set.port == set->port &&
-		    strcmp(conn->set.host, set->host) == 0 &&
-		    net_ip_compare(&conn->set.hostip, &set->hostip) &&
-		    net_ip_compare(&conn->set.source_ip, &set->source_ip) &&
-		    conn->set.ssl_flags == set->ssl_flags)
+		if (lmtp_proxy_rcpt_settings_equal(&conn->set, set))
 			return conn;
 	}
 
@@ -268,19 +469,30 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	lmtp_set.forced_capabilities = SMTP_CAPABILITY__ORCPT;
 	lmtp_set.mail_send_broken_path = TRUE;
 
-	if (conn->set.hostip.family != 0) {
+	if (proxy->lmtp_client == NULL) {
+		conn->pooled = TRUE;
+		conn->lmtp_conn = lmtp_proxy_pool_get(proxy, set,
+						      &conn->reuse_count);
+		lmtp_set.proxy_data = proxy->proxy_data;
+	}
+
+	if (conn->lmtp_conn != NULL) {
+		/* reusing a pooled connection */
+	} else if (conn->set.hostip.family != 0) {
 		conn->lmtp_conn = smtp_client_connection_create_ip(
-			proxy->lmtp_client, set->protocol,
+			lmtp_proxy_get_client(proxy), set->protocol,
 			&conn->set.hostip, conn->set.port,
 			conn->set.host, ssl_mode, &lmtp_set);
+		smtp_client_connection_accept_extra_capability(
+			conn->lmtp_conn, &cap_rcpt_forward);
 	} else {
 		conn->lmtp_conn = smtp_client_connection_create(
-			proxy->lmtp_client, set->protocol,
+			lmtp_proxy_get_client(proxy), set->protocol,
 			conn->set.host, conn->set.port,
 			ssl_mode, &lmtp_set);
+		smtp_client_connection_accept_extra_capability(
+			conn->lmtp_conn, &cap_rcpt_forward);
 	}
-	smtp_client_connection_accept_extra_capability(conn->lmtp_conn,
-						       &cap_rcpt_forward);
 	smtp_client_connection_connect(conn->lmtp_conn, NULL, NULL);
 
 	conn->lmtp_trans = smtp_client_transaction_create(
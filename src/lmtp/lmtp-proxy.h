@@ -15,6 +15,8 @@ struct lmtp_proxy;
 struct client;
 
 void lmtp_proxy_deinit(struct lmtp_proxy **proxy);
+/* Close all the idle pooled backend connections. */
+void lmtp_proxy_pool_deinit(void);
 
 int lmtp_proxy_rcpt(struct client *client,
 		    struct smtp_server_cmd_ctx *cmd,
@@ -63,7 +63,13 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(BOOL, lmtp_save_to_detail_mailbox),
 	DEF(BOOL, lmtp_rcpt_check_quota),
 	DEF(BOOL, lmtp_add_received_header),
+	DEF(BOOL, lmtp_data_memfd),
 	DEF(UINT, lmtp_user_concurrency_limit),
+	DEF(UINT, lmtp_local_delivery_workers),
+	DEF(UINT, lmtp_proxy_pool_max_connections),
+	DEF(TIME, lmtp_proxy_pool_idle_timeout),
+	DEF(UINT, lmtp_user_cache_size),
+	DEF(TIME, lmtp_user_cache_ttl),
 	DEF(ENUM, lmtp_hdr_delivery_address),
 	DEF(STR_VARS, lmtp_rawlog_dir),
 	DEF(STR_VARS, lmtp_proxy_rawlog_dir),
@@ -84,7 +90,13 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_save_to_detail_mailbox = FALSE,
 	.lmtp_rcpt_check_quota = FALSE,
 	.lmtp_add_received_header = TRUE,
+	.lmtp_data_memfd = FALSE,
 	.lmtp_user_concurrency_limit = 0,
+	.lmtp_local_delivery_workers = 0,
+	.lmtp_proxy_pool_max_connections = 0,
+	.lmtp_proxy_pool_idle_timeout = 30,
+	.lmtp_user_cache_size = 0,
+	.lmtp_user_cache_ttl = 60,
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.lmtp_rawlog_dir = "",
 	.lmtp_proxy_rawlog_dir = "",
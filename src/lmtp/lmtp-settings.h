@@ -23,7 +23,13 @@ struct lmtp_settings {
 	bool lmtp_save_to_detail_mailbox;
 	bool lmtp_rcpt_check_quota;
 	bool lmtp_add_received_header;
+	bool lmtp_data_memfd;
 	unsigned int lmtp_user_concurrency_limit;
+	unsigned int lmtp_local_delivery_workers;
+	unsigned int lmtp_proxy_pool_max_connections;
+	unsigned int lmtp_proxy_pool_idle_timeout;
+	unsigned int lmtp_user_cache_size;
+	unsigned int lmtp_user_cache_ttl;
 	const char *lmtp_hdr_delivery_address;
 	const char *lmtp_rawlog_dir;
 	const char *lmtp_proxy_rawlog_dir;
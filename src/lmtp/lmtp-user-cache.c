@@ -0,0 +1,142 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lmtp-common.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "hash.h"
+#include "mail-storage-settings.h"
+#include "mail-storage-service.h"
+#include "lmtp-user-cache.h"
+
+struct lmtp_user_cache_entry {
+	struct lmtp_user_cache_entry *prev, *next;
+
+	char *key;
+	time_t lookup_time;
+	struct mail_storage_service_user *user;
+};
+
+static HASH_TABLE(const char *, struct lmtp_user_cache_entry *) user_cache;
+/* Least recently put entries first */
+static struct lmtp_user_cache_entry *user_cache_head, *user_cache_tail;
+static unsigned int user_cache_count;
+
+static void lmtp_user_cache_entry_free(struct lmtp_user_cache_entry *entry)
+{
+	hash_table_remove(user_cache, entry->key);
+	DLLIST2_REMOVE(&user_cache_head, &user_cache_tail, entry);
+	user_cache_count--;
+
+	mail_storage_service_user_unref(&entry->user);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void lmtp_user_cache_expire(const struct lmtp_settings *set)
+{
+	while (user_cache_head != NULL &&
+	       (user_cache_count > set->lmtp_user_cache_size ||
+		user_cache_head->lookup_time +
+		(time_t)set->lmtp_user_cache_ttl <= ioloop_time))
+		lmtp_user_cache_entry_free(user_cache_head);
+}
+
+const char *
+lmtp_user_cache_get_key(const struct lmtp_settings *set,
+			const struct mail_storage_service_input *input)
+{
+	if (set->lmtp_user_cache_size == 0 || set->lmtp_user_cache_ttl == 0)
+		return NULL;
+	/* forward fields can change the userdb lookup result in ways that
+	   can't be compared */
+	if (input->forward_fields != NULL)
+		return NULL;
+
+	/* The userdb lookup result may depend on the IPs, but not on the
+	   ports. */
+	return t_strconcat(input->username, "\t",
+			   net_ip2addr(&input->local_ip), "\t",
+			   net_ip2addr(&input->remote_ip), NULL);
+}
+
+struct mail_storage_service_user *
+lmtp_user_cache_get(const struct lmtp_settings *set, const char *key,
+		    time_t *lookup_time_r)
+{
+	struct lmtp_user_cache_entry *entry;
+	struct mail_storage_service_user *user;
+
+	if (!hash_table_is_created(user_cache))
+		return NULL;
+	lmtp_user_cache_expire(set);
+
+	entry = hash_table_lookup(user_cache, key);
+	if (entry == NULL)
+		return NULL;
+
+	user = entry->user;
+	*lookup_time_r = entry->lookup_time;
+	mail_storage_service_user_ref(user);
+	lmtp_user_cache_entry_free(entry);
+	return user;
+}
+
+static bool lmtp_user_cache_can_cache(struct mail_storage_service_user *user)
+{
+	const struct mail_user_settings *user_set =
+		mail_storage_service_user_get_set(user)[0];
+
+	/* mail_storage_service_next() modifies the home directory when
+	   chrooting, so it can't be done more than once. */
+	return *user_set->mail_chroot == '\0';
+}
+
+void lmtp_user_cache_put(const struct lmtp_settings *set, const char *key,
+			 time_t lookup_time,
+			 struct mail_storage_service_user **_user)
+{
+	struct mail_storage_service_user *user = *_user;
+	struct lmtp_user_cache_entry *entry;
+
+	*_user = NULL;
+
+	if (set->lmtp_user_cache_size == 0 ||
+	    lookup_time + (time_t)set->lmtp_user_cache_ttl <= ioloop_time ||
+	    !lmtp_user_cache_can_cache(user)) {
+		mail_storage_service_user_unref(&user);
+		return;
+	}
+
+	if (!hash_table_is_created(user_cache))
+		hash_table_create(&user_cache, default_pool, 0, str_hash, strcmp);
+	entry = hash_table_lookup(user_cache, key);
+	if (entry != NULL) {
+		/* the same user was looked up again while this one was in
+		   use. keep the newer lookup. */
+		if (entry->lookup_time >= lookup_time) {
+			mail_storage_service_user_unref(&user);
+			return;
+		}
+		lmtp_user_cache_entry_free(entry);
+	}
+
+	entry = i_new(struct lmtp_user_cache_entry, 1);
+	entry->key = i_strdup(key);
+	entry->lookup_time = lookup_time;
+	entry->user = user;
+	hash_table_insert(user_cache, entry->key, entry);
+	DLLIST2_APPEND(&user_cache_head, &user_cache_tail, entry);
+	user_cache_count++;
+
+	lmtp_user_cache_expire(set);
+}
+
+void lmtp_user_cache_deinit(void)
+{
+	if (!hash_table_is_created(user_cache))
+		return;
+
+	while (user_cache_head != NULL)
+		lmtp_user_cache_entry_free(user_cache_head);
+	hash_table_destroy(&user_cache);
+}
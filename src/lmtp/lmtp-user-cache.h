@@ -0,0 +1,29 @@
+#ifndef LMTP_USER_CACHE_H
+#define LMTP_USER_CACHE_H
+
+struct mail_storage_service_input;
+struct mail_storage_service_user;
+struct lmtp_settings;
+
+/* Returns the cache key for the lookup input, or NULL if the lookup result
+   can't be cached. */
+const char *
+lmtp_user_cache_get_key(const struct lmtp_settings *set,
+			const struct mail_storage_service_input *input);
+
+/* Returns a previously looked up user for the key, or NULL if there is no
+   unexpired one. The user is removed from the cache, so it's never used by
+   two recipients at the same time. lookup_time_r is set to when the userdb
+   lookup was done. */
+struct mail_storage_service_user *
+lmtp_user_cache_get(const struct lmtp_settings *set, const char *key,
+		    time_t *lookup_time_r);
+/* Put the user (back) to the cache. If the user can't be cached, it's
+   unreferenced instead. */
+void lmtp_user_cache_put(const struct lmtp_settings *set, const char *key,
+			 time_t lookup_time,
+			 struct mail_storage_service_user **user);
+
+void lmtp_user_cache_deinit(void);
+
+#endif
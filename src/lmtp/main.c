@@ -12,6 +12,8 @@
 #include "mail-storage-service.h"
 #include "smtp-submit-settings.h"
 #include "lda-settings.h"
+#include "lmtp-proxy.h"
+#include "lmtp-user-cache.h"
 
 #include <unistd.h>
 
@@ -106,6 +108,8 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	clients_destroy();
+	lmtp_proxy_pool_deinit();
+	lmtp_user_cache_deinit();
 	if (anvil != NULL)
 		anvil_client_deinit(&anvil);
 	i_free(dns_client_socket_path);
@@ -125,6 +125,10 @@ static void client_idle_disconnect_timeout(struct client *client)
 static void client_open_streams(struct client *client)
 {
 	client->input = i_stream_create_fd(client->fd, LOGIN_MAX_INBUF_SIZE);
+	/* Most clients are idle most of the time. Start with a small buffer
+	   and free it whenever all of its data has been processed. */
+	i_stream_set_init_buffer_size(client->input, LOGIN_INIT_INBUF_SIZE);
+	i_stream_set_persistent_buffers(client->input, FALSE);
 	client->output = o_stream_create_fd(client->fd, LOGIN_MAX_OUTBUF_SIZE);
 	o_stream_set_no_error_handling(client->output, TRUE);
 
@@ -274,6 +278,8 @@ void client_disconnect(struct client *client, const char *reason,
 		struct event *event = client->login_proxy == NULL ?
 			client->event :
 			login_proxy_get_event(client->login_proxy);
+		event_add_int(event, "memory_used",
+			      client_get_memory_usage(client));
 		if (add_disconnected_prefix)
 			e_info(event, "Disconnected: %s", reason);
 		else
@@ -1144,6 +1150,15 @@ void client_send_raw(struct client *client, const char *data)
 	client_send_raw_data(client, data, strlen(data));
 }
 
+size_t client_get_memory_usage(struct client *client)
+{
+	size_t size = pool_alloconly_get_total_alloc_size(client->pool);
+
+	if (client->preproxy_pool != NULL)
+		size += pool_alloconly_get_total_alloc_size(client->preproxy_pool);
+	return size;
+}
+
 bool client_read(struct client *client)
 {
 	switch (i_stream_read(client->input)) {
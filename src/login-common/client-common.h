@@ -21,6 +21,9 @@ struct module;
 #define LOGIN_MAX_INBUF_SIZE \
 	(MASTER_AUTH_MAX_DATA_SIZE - LOGIN_MAX_MASTER_PREFIX_LEN - \
 	 LOGIN_MAX_SESSION_ID_LEN)
+/* Initial size of the input buffer. Most pre-login commands are short, so
+   the buffer grows up to LOGIN_MAX_INBUF_SIZE only when needed. */
+#define LOGIN_INIT_INBUF_SIZE 512
 /* max. size of output buffer. if it gets full, the client is disconnected.
    SASL authentication gives the largest output. */
 #define LOGIN_MAX_OUTBUF_SIZE 4096
@@ -308,6 +311,8 @@ void client_add_forward_field(struct client *client, const char *key,
 			      const char *value);
 void client_set_title(struct client *client);
 const char *client_get_extra_disconnect_reason(struct client *client);
+/* Returns the number of bytes allocated for the client's pools. */
+size_t client_get_memory_usage(struct client *client);
 
 void client_auth_respond(struct client *client, const char *response);
 void client_auth_abort(struct client *client);
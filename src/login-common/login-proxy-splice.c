@@ -0,0 +1,208 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#define _GNU_SOURCE /* splice() */
+#include "lib.h"
+#include "ioloop.h"
+#include "fd-util.h"
+#include "login-proxy-splice.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+
+/* How much data to move through the pipe at once */
+#define LOGIN_PROXY_SPLICE_MAX_SIZE (64*1024)
+
+struct login_proxy_splice_dir {
+	struct login_proxy_splice *splice;
+	enum iostream_proxy_side side;
+	int in_fd, out_fd;
+	int pipe_fd[2];
+	/* number of bytes in the pipe, not yet written to out_fd */
+	size_t pipe_used;
+	uoff_t offset;
+	struct io *io_in, *io_out;
+};
+
+struct login_proxy_splice {
+	struct login_proxy_splice_dir dirs[2];
+	time_t last_io;
+
+	login_proxy_splice_callback_t *callback;
+	void *context;
+};
+
+#undef login_proxy_splice_create
+#ifdef HAVE_SPLICE
+static void login_proxy_splice_input(struct login_proxy_splice_dir *dir);
+
+static void
+login_proxy_splice_finish(struct login_proxy_splice_dir *dir,
+			  enum iostream_proxy_status status, const char *error)
+{
+	io_remove(&dir->io_in);
+	io_remove(&dir->io_out);
+	dir->splice->callback(dir->side, status, error, dir->splice->context);
+}
+
+static void login_proxy_splice_output(struct login_proxy_splice_dir *dir)
+{
+	ssize_t ret;
+
+	while (dir->pipe_used > 0) {
+		ret = splice(dir->pipe_fd[0], NULL, dir->out_fd, NULL,
+			     dir->pipe_used, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno != EAGAIN) {
+				login_proxy_splice_finish(dir,
+					IOSTREAM_PROXY_STATUS_OTHER_SIDE_OUTPUT_ERROR,
+					t_strdup_printf("splice() failed: %m"));
+				return;
+			}
+			/* wait until the other side is writable again, and
+			   stop reading more until then. */
+			io_remove(&dir->io_in);
+			if (dir->io_out == NULL) {
+				dir->io_out = io_add(dir->out_fd, IO_WRITE,
+						     login_proxy_splice_output,
+						     dir);
+			}
+			return;
+		}
+		i_assert((size_t)ret <= dir->pipe_used);
+		dir->pipe_used -= ret;
+		dir->offset += ret;
+		dir->splice->last_io = ioloop_time;
+	}
+
+	io_remove(&dir->io_out);
+	if (dir->io_in == NULL) {
+		dir->io_in = io_add(dir->in_fd, IO_READ,
+				    login_proxy_splice_input, dir);
+	}
+}
+
+static void login_proxy_splice_input(struct login_proxy_splice_dir *dir)
+{
+	ssize_t ret;
+
+	i_assert(dir->pipe_used == 0);
+
+	ret = splice(dir->in_fd, NULL, dir->pipe_fd[1], NULL,
+		     LOGIN_PROXY_SPLICE_MAX_SIZE,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (ret == 0) {
+		/* all the input was already written to the other side */
+		login_proxy_splice_finish(dir, IOSTREAM_PROXY_STATUS_INPUT_EOF,
+					  "");
+		return;
+	}
+	if (ret < 0) {
+		if (errno == EAGAIN)
+			return;
+		login_proxy_splice_finish(dir,
+			IOSTREAM_PROXY_STATUS_INPUT_ERROR,
+			errno == ECONNRESET ? "Connection reset by peer" :
+			t_strdup_printf("splice() failed: %m"));
+		return;
+	}
+	dir->pipe_used = ret;
+	dir->splice->last_io = ioloop_time;
+	login_proxy_splice_output(dir);
+}
+
+static int
+login_proxy_splice_dir_init(struct login_proxy_splice *splice,
+			    enum iostream_proxy_side side,
+			    int in_fd, int out_fd, const char **error_r)
+{
+	struct login_proxy_splice_dir *dir = &splice->dirs[side];
+
+	dir->splice = splice;
+	dir->side = side;
+	dir->in_fd = in_fd;
+	dir->out_fd = out_fd;
+	if (pipe(dir->pipe_fd) < 0) {
+		dir->pipe_fd[0] = dir->pipe_fd[1] = -1;
+		*error_r = t_strdup_printf("pipe() failed: %m");
+		return -1;
+	}
+	fd_close_on_exec(dir->pipe_fd[0], TRUE);
+	fd_close_on_exec(dir->pipe_fd[1], TRUE);
+	fd_set_nonblock(dir->pipe_fd[0], TRUE);
+	fd_set_nonblock(dir->pipe_fd[1], TRUE);
+	dir->io_in = io_add(in_fd, IO_READ, login_proxy_splice_input, dir);
+	return 0;
+}
+
+struct login_proxy_splice *
+login_proxy_splice_create(int left_fd, int right_fd,
+			  login_proxy_splice_callback_t *callback,
+			  void *context, const char **error_r)
+{
+	struct login_proxy_splice *splice;
+
+	splice = i_new(struct login_proxy_splice, 1);
+	splice->dirs[IOSTREAM_PROXY_SIDE_LEFT].pipe_fd[0] = -1;
+	splice->dirs[IOSTREAM_PROXY_SIDE_LEFT].pipe_fd[1] = -1;
+	splice->dirs[IOSTREAM_PROXY_SIDE_RIGHT].pipe_fd[0] = -1;
+	splice->dirs[IOSTREAM_PROXY_SIDE_RIGHT].pipe_fd[1] = -1;
+	splice->last_io = ioloop_time;
+	splice->callback = callback;
+	splice->context = context;
+
+	if (login_proxy_splice_dir_init(splice, IOSTREAM_PROXY_SIDE_LEFT,
+					left_fd, right_fd, error_r) < 0 ||
+	    login_proxy_splice_dir_init(splice, IOSTREAM_PROXY_SIDE_RIGHT,
+					right_fd, left_fd, error_r) < 0) {
+		login_proxy_splice_destroy(&splice);
+		return NULL;
+	}
+	return splice;
+}
+#else
+struct login_proxy_splice *
+login_proxy_splice_create(int left_fd ATTR_UNUSED, int right_fd ATTR_UNUSED,
+			  login_proxy_splice_callback_t *callback ATTR_UNUSED,
+			  void *context ATTR_UNUSED, const char **error_r)
+{
+	*error_r = "splice() not supported";
+	return NULL;
+}
+#endif
+
+void login_proxy_splice_destroy(struct login_proxy_splice **_splice)
+{
+	struct login_proxy_splice *splice = *_splice;
+	unsigned int i;
+
+	if (splice == NULL)
+		return;
+	*_splice = NULL;
+
+	for (i = 0; i < N_ELEMENTS(splice->dirs); i++) {
+		struct login_proxy_splice_dir *dir = &splice->dirs[i];
+
+		io_remove(&dir->io_in);
+		io_remove(&dir->io_out);
+		i_close_fd(&dir->pipe_fd[0]);
+		i_close_fd(&dir->pipe_fd[1]);
+	}
+	i_free(splice);
+}
+
+uoff_t login_proxy_splice_get_offset(struct login_proxy_splice *splice,
+				     enum iostream_proxy_side side)
+{
+	return splice->dirs[side].offset;
+}
+
+time_t login_proxy_splice_get_last_io(struct login_proxy_splice *splice)
+{
+	return splice->last_io;
+}
+
+bool login_proxy_splice_is_waiting_output(struct login_proxy_splice *splice,
+					  enum iostream_proxy_side side)
+{
+	return splice->dirs[side].pipe_used > 0;
+}
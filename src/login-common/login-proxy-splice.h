@@ -0,0 +1,41 @@
+#ifndef LOGIN_PROXY_SPLICE_H
+#define LOGIN_PROXY_SPLICE_H
+
+#include "iostream-proxy.h"
+
+/* Proxy data between two plain (non-TLS) sockets with splice() through
+   kernel pipes, so the data never gets copied into userspace buffers. The
+   sides are the same as with iostream-proxy. The callback has the same
+   semantics as iostream_proxy_callback_t, except that the error string is
+   given directly. */
+typedef void login_proxy_splice_callback_t(enum iostream_proxy_side side,
+					   enum iostream_proxy_status status,
+					   const char *error, void *context);
+
+/* Returns NULL and error_r if splice()ing isn't possible. */
+struct login_proxy_splice *
+login_proxy_splice_create(int left_fd, int right_fd,
+			  login_proxy_splice_callback_t *callback,
+			  void *context, const char **error_r);
+#define login_proxy_splice_create(left_fd, right_fd, callback, context, \
+				  error_r) \
+	login_proxy_splice_create(left_fd, right_fd, \
+		(login_proxy_splice_callback_t *)callback, \
+		TRUE ? context : \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			enum iostream_proxy_side, enum iostream_proxy_status, \
+			const char *, typeof(context))), error_r)
+void login_proxy_splice_destroy(struct login_proxy_splice **splice);
+
+/* Returns the number of bytes read from the given side and written to the
+   other side. */
+uoff_t login_proxy_splice_get_offset(struct login_proxy_splice *splice,
+				     enum iostream_proxy_side side);
+/* Returns the last time when data was transferred. */
+time_t login_proxy_splice_get_last_io(struct login_proxy_splice *splice);
+/* Returns TRUE if the data read from the given side is waiting for the
+   other side to become writable. */
+bool login_proxy_splice_is_waiting_output(struct login_proxy_splice *splice,
+					  enum iostream_proxy_side side);
+
+#endif
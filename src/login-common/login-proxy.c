@@ -19,6 +19,7 @@
 #include "mail-user-hash.h"
 #include "client-common.h"
 #include "login-proxy-state.h"
+#include "login-proxy-splice.h"
 #include "login-proxy.h"
 
 
@@ -53,6 +54,7 @@ struct login_proxy {
 	struct istream *client_input, *server_input;
 	struct ostream *client_output, *server_output;
 	struct iostream_proxy *iostream_proxy;
+	struct login_proxy_splice *splice;
 	struct ssl_iostream *server_ssl_iostream;
 
 	struct timeval created;
@@ -99,12 +101,25 @@ login_proxy_free_full(struct login_proxy **_proxy, const char *reason,
 static time_t proxy_last_io(struct login_proxy *proxy)
 {
 	struct timeval tv1, tv2, tv3, tv4;
+	time_t last_io;
 
 	i_stream_get_last_read_time(proxy->client_input, &tv1);
 	i_stream_get_last_read_time(proxy->server_input, &tv2);
 	o_stream_get_last_write_time(proxy->client_output, &tv3);
 	o_stream_get_last_write_time(proxy->server_output, &tv4);
-	return I_MAX(tv1.tv_sec, I_MAX(tv2.tv_sec, I_MAX(tv3.tv_sec, tv4.tv_sec)));
+	last_io = I_MAX(tv1.tv_sec, I_MAX(tv2.tv_sec, I_MAX(tv3.tv_sec, tv4.tv_sec)));
+	if (proxy->splice != NULL)
+		last_io = I_MAX(last_io, login_proxy_splice_get_last_io(proxy->splice));
+	return last_io;
+}
+
+static bool
+proxy_is_waiting_output(struct login_proxy *proxy,
+			enum iostream_proxy_side side)
+{
+	if (proxy->splice != NULL)
+		return login_proxy_splice_is_waiting_output(proxy->splice, side);
+	return iostream_proxy_is_waiting_output(proxy->iostream_proxy, side);
 }
 
 static void login_proxy_free_errstr(struct login_proxy **_proxy,
@@ -112,23 +127,30 @@ static void login_proxy_free_errstr(struct login_proxy **_proxy,
 {
 	struct login_proxy *proxy = *_proxy;
 	string_t *reason = t_str_new(128);
+	uoff_t in_offset, out_offset;
 
 	str_printfa(reason, "Disconnected by %s", server ? "server" : "client");
 	if (errstr[0] != '\0')
 		str_printfa(reason, ": %s", errstr);
 
+	in_offset = proxy->server_output->offset;
+	out_offset = proxy->client_output->offset;
+	if (proxy->splice != NULL) {
+		in_offset += login_proxy_splice_get_offset(proxy->splice,
+						LOGIN_PROXY_SIDE_CLIENT);
+		out_offset += login_proxy_splice_get_offset(proxy->splice,
+						LOGIN_PROXY_SIDE_SERVER);
+	}
 	str_printfa(reason, " (%ds idle, in=%"PRIuUOFF_T", out=%"PRIuUOFF_T,
 		    (int)(ioloop_time - proxy_last_io(proxy)),
-		    proxy->server_output->offset, proxy->client_output->offset);
+		    in_offset, out_offset);
 	if (o_stream_get_buffer_used_size(proxy->client_output) > 0) {
 		str_printfa(reason, "+%zu",
 			    o_stream_get_buffer_used_size(proxy->client_output));
 	}
-	if (iostream_proxy_is_waiting_output(proxy->iostream_proxy,
-					     LOGIN_PROXY_SIDE_SERVER))
+	if (proxy_is_waiting_output(proxy, LOGIN_PROXY_SIDE_SERVER))
 		str_append(reason, ", client output blocked");
-	if (iostream_proxy_is_waiting_output(proxy->iostream_proxy,
-					     LOGIN_PROXY_SIDE_CLIENT))
+	if (proxy_is_waiting_output(proxy, LOGIN_PROXY_SIDE_CLIENT))
 		str_append(reason, ", server output blocked");
 
 	str_append_c(reason, ')');
@@ -429,6 +451,7 @@ static void login_proxy_disconnect(struct login_proxy *proxy)
 	}
 
 	iostream_proxy_unref(&proxy->iostream_proxy);
+	login_proxy_splice_destroy(&proxy->splice);
 	ssl_iostream_destroy(&proxy->server_ssl_iostream);
 
 	io_remove(&proxy->server_io);
@@ -730,6 +753,58 @@ login_proxy_finished(enum iostream_proxy_side side,
 	login_proxy_free_errstr(&proxy, errstr, server_side);
 }
 
+static void
+login_proxy_splice_finished(enum iostream_proxy_side side,
+			    enum iostream_proxy_status status,
+			    const char *errstr, struct login_proxy *proxy)
+{
+	bool server_side;
+
+	server_side = side == LOGIN_PROXY_SIDE_SERVER;
+	if (status == IOSTREAM_PROXY_STATUS_OTHER_SIDE_OUTPUT_ERROR)
+		server_side = !server_side;
+	login_proxy_free_errstr(&proxy, errstr, server_side);
+}
+
+static bool login_proxy_can_splice(struct login_proxy *proxy)
+{
+	struct client *client = proxy->client;
+
+	if (!client->set->login_proxy_splice)
+		return FALSE;
+	/* the data must not need any processing in userspace */
+	if (client->ssl_iostream != NULL ||
+	    proxy->server_ssl_iostream != NULL ||
+	    login_rawlog_dir != NULL || proxy->rawlog_dir != NULL)
+		return FALSE;
+	/* everything that was already read or is waiting to be written must
+	   go through the streams */
+	return i_stream_get_data_size(proxy->client_input) == 0 &&
+		i_stream_get_data_size(proxy->server_input) == 0 &&
+		o_stream_get_buffer_used_size(proxy->client_output) == 0 &&
+		o_stream_get_buffer_used_size(proxy->server_output) == 0;
+}
+
+static bool login_proxy_start_splice(struct login_proxy *proxy)
+{
+	const char *error;
+
+	if (!login_proxy_can_splice(proxy))
+		return FALSE;
+
+	proxy->splice = login_proxy_splice_create(proxy->client->fd,
+						  proxy->server_fd,
+						  login_proxy_splice_finished,
+						  proxy, &error);
+	if (proxy->splice == NULL) {
+		e_error(proxy->event,
+			"Failed to start splice()ing, falling back to "
+			"normal proxying: %s", error);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static void login_proxy_notify(struct login_proxy *proxy)
 {
 	login_proxy_state_notify(proxy_state, proxy->client->proxy_user);
@@ -757,12 +832,17 @@ void login_proxy_detach(struct login_proxy *proxy)
 	client->output = NULL;
 
 	/* from now on, just do dummy proxying */
-	proxy->iostream_proxy =
-		iostream_proxy_create(proxy->client_input, proxy->client_output,
-				      proxy->server_input, proxy->server_output);
-	iostream_proxy_set_completion_callback(proxy->iostream_proxy,
-					       login_proxy_finished, proxy);
-	iostream_proxy_start(proxy->iostream_proxy);
+	if (!login_proxy_start_splice(proxy)) {
+		proxy->iostream_proxy =
+			iostream_proxy_create(proxy->client_input,
+					      proxy->client_output,
+					      proxy->server_input,
+					      proxy->server_output);
+		iostream_proxy_set_completion_callback(proxy->iostream_proxy,
+						       login_proxy_finished,
+						       proxy);
+		iostream_proxy_start(proxy->iostream_proxy);
+	}
 
 	if (proxy->notify_refresh_secs != 0) {
 		proxy->to_notify =
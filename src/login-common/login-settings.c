@@ -33,6 +33,7 @@ static const struct setting_define login_setting_defines[] = {
 	DEF(UINT, login_proxy_max_reconnects),
 	DEF(TIME, login_proxy_max_disconnect_delay),
 	DEF(STR, login_proxy_rawlog_dir),
+	DEF(BOOL, login_proxy_splice),
 	DEF(STR, director_username_hash),
 
 	DEF(BOOL, auth_ssl_require_client_cert),
@@ -62,6 +63,7 @@ static const struct login_settings login_default_settings = {
 	.login_proxy_max_reconnects = 3,
 	.login_proxy_max_disconnect_delay = 0,
 	.login_proxy_rawlog_dir = "",
+	.login_proxy_splice = FALSE,
 	.director_username_hash = "%Lu",
 
 	.auth_ssl_require_client_cert = FALSE,
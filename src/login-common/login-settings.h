@@ -27,6 +27,7 @@ struct login_settings {
 	bool auth_debug;
 	bool auth_debug_passwords;
 	bool verbose_proctitle;
+	bool login_proxy_splice;
 
 	unsigned int mail_max_userip_connections;
 
@@ -315,7 +315,8 @@ void login_anvil_init(void)
 	if (anvil != NULL)
 		return;
 
-	anvil = anvil_client_init("anvil", anvil_reconnect_callback, 0);
+	anvil = anvil_client_init("anvil", anvil_reconnect_callback,
+				  ANVIL_CLIENT_FLAG_BATCH);
 	if (anvil_client_connect(anvil, TRUE) < 0)
 		i_fatal("Couldn't connect to anvil");
 }
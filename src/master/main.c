@@ -670,6 +670,9 @@ static void print_build_options(void)
 #ifdef IOLOOP_KQUEUE
 		" ioloop=kqueue"
 #endif
+#ifdef IOLOOP_URING
+		" ioloop=uring"
+#endif
 #ifdef IOLOOP_POLL
 		" ioloop=poll"
 #endif
@@ -102,6 +102,37 @@ master_client_stop(struct master_client *client, const char *const *args)
 	return 1;
 }
 
+static int
+master_client_profile(struct master_client *client, const char *const *args)
+{
+	struct service *service;
+	struct service_process *p;
+	const char *reply = "+\n";
+	bool enable;
+
+	if (args[0] == NULL ||
+	    (strcmp(args[0], "on") != 0 && strcmp(args[0], "off") != 0)) {
+		i_error("%s: PROFILE: Invalid parameters", client->conn.name);
+		return -1;
+	}
+	enable = strcmp(args[0], "on") == 0;
+	args++;
+
+	for (unsigned int i = 0; args[i] != NULL; i++) {
+		if (service_lookup(services, args[i]) == NULL)
+			reply = t_strdup_printf("-Unknown service: %s\n", args[i]);
+	}
+	array_foreach_elem(&services->services, service) {
+		if (args[0] != NULL && !str_array_find(args, service->set->name))
+			continue;
+		service->profile = enable;
+		for (p = service->processes; p != NULL; p = p->next)
+			service_process_profile_update(p);
+	}
+	o_stream_nsend_str(client->conn.output, reply);
+	return 1;
+}
+
 static int
 master_client_input_args(struct connection *conn, const char *const *args)
 {
@@ -120,6 +151,8 @@ master_client_input_args(struct connection *conn, const char *const *args)
 		return master_client_process_status(client, args);
 	if (strcmp(cmd, "STOP") == 0)
 		return master_client_stop(client, args);
+	if (strcmp(cmd, "PROFILE") == 0)
+		return master_client_profile(client, args);
 	i_error("%s: Unknown command: %s", conn->name, cmd);
 	return -1;
 }
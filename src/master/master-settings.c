@@ -18,6 +18,12 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#  include <sys/prctl.h>
+#endif
+
+/* Each shard is a listening socket kept open by the master process */
+#define MASTER_INET_LISTENER_MAX_SHARDS 256
 
 static bool master_settings_verify(void *_set, pool_t pool,
 				   const char **error_r);
@@ -66,6 +72,7 @@ static const struct setting_define inet_listener_setting_defines[] = {
 	DEF(BOOL, ssl),
 	DEF(BOOL, reuse_port),
 	DEF(BOOL, haproxy),
+	DEF(UINT, reuse_port_shards),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -76,7 +83,8 @@ static const struct inet_listener_settings inet_listener_default_settings = {
 	.port = 0,
 	.ssl = FALSE,
 	.reuse_port = FALSE,
-	.haproxy = FALSE
+	.haproxy = FALSE,
+	.reuse_port_shards = 0
 };
 
 static const struct setting_parser_info inet_listener_setting_parser_info = {
@@ -111,6 +119,7 @@ static const struct setting_define service_setting_defines[] = {
 	DEF(STR, chroot),
 
 	DEF(BOOL, drop_priv_before_exec),
+	DEF(BOOL, fork_server),
 
 	DEF(UINT, process_min_avail),
 	DEF(UINT, process_limit),
@@ -141,6 +150,7 @@ static const struct service_settings service_default_settings = {
 	.chroot = "",
 
 	.drop_priv_before_exec = FALSE,
+	.fork_server = FALSE,
 
 	.process_min_avail = 0,
 	.process_limit = 0,
@@ -328,6 +338,34 @@ static void add_inet_listeners(ARRAY_TYPE(inet_listener_settings) *l,
 	}
 }
 
+static bool
+check_inet_listener_shards(const struct service_settings *service,
+			   const char **error_r)
+{
+	struct inet_listener_settings *set;
+
+	if (!array_is_created(&service->inet_listeners))
+		return TRUE;
+
+	array_foreach_elem(&service->inet_listeners, set) {
+		if (set->reuse_port_shards > 0 && !set->reuse_port) {
+			*error_r = t_strdup_printf("service(%s): "
+				"inet_listener(%s): reuse_port_shards "
+				"requires reuse_port=yes",
+				service->name, set->name);
+			return FALSE;
+		}
+		if (set->reuse_port_shards > MASTER_INET_LISTENER_MAX_SHARDS) {
+			*error_r = t_strdup_printf("service(%s): "
+				"inet_listener(%s): reuse_port_shards "
+				"can't be higher than %u", service->name,
+				set->name, MASTER_INET_LISTENER_MAX_SHARDS);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 static bool master_settings_parse_type(struct service_settings *set,
 				       const char **error_r)
 {
@@ -552,6 +590,30 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 				"vsz_limit is too low", service->name);
 			return FALSE;
 		}
+		if (service->fork_server) {
+#ifndef PR_SET_CHILD_SUBREAPER
+			*error_r = t_strdup_printf("service(%s): "
+				"fork_server=yes isn't supported by this OS",
+				service->name);
+			return FALSE;
+#endif
+			switch (service->parsed_type) {
+			case SERVICE_TYPE_UNKNOWN:
+			case SERVICE_TYPE_LOGIN:
+			case SERVICE_TYPE_WORKER:
+				break;
+			case SERVICE_TYPE_LOG:
+			case SERVICE_TYPE_CONFIG:
+			case SERVICE_TYPE_ANVIL:
+			case SERVICE_TYPE_STARTUP:
+				*error_r = t_strdup_printf("service(%s): "
+					"fork_server=yes can't be used with "
+					"type=%s", service->name, service->type);
+				return FALSE;
+			}
+		}
+		if (!check_inet_listener_shards(service, error_r))
+			return FALSE;
 
 #ifdef CONFIG_BINARY
 		default_service =
@@ -0,0 +1,249 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "common.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "fd-util.h"
+#include "write-full.h"
+#include "service.h"
+#include "service-process.h"
+#include "service-fork-server.h"
+
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#  include <sys/prctl.h>
+#endif
+
+/* How long to wait for the fork server to reply to a fork request. Forking
+   is done synchronously, just like when the master forks by itself. */
+#define SERVICE_FORK_SERVER_REPLY_TIMEOUT_MSECS 1000
+/* Wait this long before restarting a fork server that failed */
+#define SERVICE_FORK_SERVER_RETRY_SECS 60
+
+struct service_fork_server {
+	struct service_fork_server *prev, *next;
+	/* NULL after the fork server was stopped */
+	struct service *service;
+
+	pid_t pid;
+	int fd;
+	/* waiting for the READY line */
+	struct io *io;
+	bool ready:1;
+};
+
+/* Fork servers that haven't been waitpid()ed yet */
+static struct service_fork_server *fork_servers = NULL;
+static bool fork_server_subreaper_set = FALSE;
+
+static bool service_fork_server_set_subreaper(void)
+{
+#ifdef PR_SET_CHILD_SUBREAPER
+	/* The processes forked by the fork servers are re-parented to us */
+	if (!fork_server_subreaper_set) {
+		if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0) {
+			i_error("prctl(PR_SET_CHILD_SUBREAPER) failed: %m");
+			return FALSE;
+		}
+		fork_server_subreaper_set = TRUE;
+	}
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void service_fork_server_failed(struct service *service)
+{
+	service->fork_server_retry_time =
+		ioloop_time + SERVICE_FORK_SERVER_RETRY_SECS;
+	service_fork_server_stop(service);
+}
+
+static void service_fork_server_input(struct service_fork_server *fs)
+{
+	char buf[7];
+	ssize_t ret;
+
+	ret = read(fs->fd, buf, sizeof(buf));
+	if (ret == 6 && memcmp(buf, "READY\n", 6) == 0) {
+		fs->ready = TRUE;
+		io_remove(&fs->io);
+		return;
+	}
+
+	if (ret < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		service_error(fs->service, "read(fork server) failed: %m");
+	} else if (ret == 0) {
+		service_error(fs->service,
+			      "Fork server died during initialization");
+	} else {
+		service_error(fs->service, "Fork server sent invalid data");
+	}
+	service_fork_server_failed(fs->service);
+}
+
+static void service_fork_server_start(struct service *service)
+{
+	struct service_fork_server *fs;
+	int fds[2];
+	pid_t pid;
+
+	if (!service_fork_server_set_subreaper()) {
+		service->fork_server_retry_time =
+			ioloop_time + SERVICE_FORK_SERVER_RETRY_SECS;
+		return;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		service_error(service, "socketpair() failed: %m");
+		return;
+	}
+	fd_close_on_exec(fds[0], TRUE);
+	fd_close_on_exec(fds[1], TRUE);
+
+	pid = service_process_spawn_fork_server(service, fds[1]);
+	i_close_fd(&fds[1]);
+	if (pid < 0) {
+		i_close_fd(&fds[0]);
+		return;
+	}
+
+	fs = i_new(struct service_fork_server, 1);
+	fs->service = service;
+	fs->pid = pid;
+	fs->fd = fds[0];
+	fs->io = io_add(fs->fd, IO_READ, service_fork_server_input, fs);
+	DLLIST_PREPEND(&fork_servers, fs);
+	service->fork_server = fs;
+}
+
+static int
+service_fork_server_read_reply(struct service_fork_server *fs, pid_t *pid_r)
+{
+	struct pollfd pfd = { .fd = fs->fd, .events = POLLIN };
+	char buf[MAX_INT_STRLEN + 1];
+	size_t pos = 0;
+	ssize_t ret;
+
+	while (pos == 0 || buf[pos-1] != '\n') {
+		if (pos == sizeof(buf)) {
+			service_error(fs->service,
+				      "Fork server sent too long reply");
+			return -1;
+		}
+		ret = poll(&pfd, 1, SERVICE_FORK_SERVER_REPLY_TIMEOUT_MSECS);
+		if (ret == 0) {
+			service_error(fs->service, "Fork server didn't reply "
+				      "in %u msecs",
+				      SERVICE_FORK_SERVER_REPLY_TIMEOUT_MSECS);
+			return -1;
+		}
+		if (ret > 0)
+			ret = read(fs->fd, buf + pos, sizeof(buf) - pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			service_error(fs->service,
+				      "read(fork server) failed: %m");
+			return -1;
+		}
+		if (ret == 0) {
+			service_error(fs->service,
+				      "Fork server disconnected");
+			return -1;
+		}
+		pos += ret;
+	}
+	buf[pos-1] = '\0';
+	if (str_to_pid(buf, pid_r) < 0) {
+		service_error(fs->service, "Fork server sent invalid reply: %s",
+			      buf);
+		return -1;
+	}
+	return 0;
+}
+
+pid_t service_fork_server_fork(struct service *service, unsigned int uid)
+{
+	struct service_fork_server *fs = service->fork_server;
+	const char *request;
+	pid_t pid;
+
+	if (fs == NULL) {
+		/* start the fork server for the following processes */
+		if (service->fork_server_retry_time <= ioloop_time)
+			service_fork_server_start(service);
+		return 0;
+	}
+	if (!fs->ready)
+		return 0;
+
+	request = t_strdup_printf("%u\t%d\n", uid, service->profile ? 1 : 0);
+	if (write_full(fs->fd, request, strlen(request)) < 0) {
+		service_error(service, "write(fork server) failed: %m");
+		service_fork_server_failed(service);
+		return 0;
+	}
+	if (service_fork_server_read_reply(fs, &pid) < 0) {
+		service_fork_server_failed(service);
+		return 0;
+	}
+	/* 0 = fork() failed, which the fork server already logged */
+	return pid;
+}
+
+void service_fork_server_stop(struct service *service)
+{
+	struct service_fork_server *fs = service->fork_server;
+
+	if (fs == NULL)
+		return;
+
+	/* The fork server would exit after seeing the disconnection, but
+	   kill it so it closes the listener fds as soon as possible. */
+	service->fork_server = NULL;
+	fs->service = NULL;
+	io_remove(&fs->io);
+	i_close_fd(&fs->fd);
+	if (kill(fs->pid, SIGTERM) < 0 && errno != ESRCH) {
+		i_error("kill(%s, SIGTERM) failed: %m",
+			dec2str(fs->pid));
+	}
+}
+
+bool service_fork_server_reaped(pid_t pid, int status)
+{
+	struct service_fork_server *fs;
+	struct service *service;
+
+	for (fs = fork_servers; fs != NULL; fs = fs->next) {
+		if (fs->pid == pid)
+			break;
+	}
+	if (fs == NULL)
+		return FALSE;
+
+	service = fs->service;
+	if (service != NULL) {
+		/* not stopped by us */
+		if (WIFSIGNALED(status)) {
+			service_error(service, "Fork server %s killed with "
+				      "signal %d", dec2str(pid),
+				      WTERMSIG(status));
+		} else {
+			service_error(service, "Fork server %s exited with "
+				      "status %d", dec2str(pid),
+				      WEXITSTATUS(status));
+		}
+		service_fork_server_failed(service);
+	}
+	DLLIST_REMOVE(&fork_servers, fs);
+	i_free(fs);
+	return TRUE;
+}
@@ -0,0 +1,15 @@
+#ifndef SERVICE_FORK_SERVER_H
+#define SERVICE_FORK_SERVER_H
+
+/* Create a new process for the service using its fork server. The fork server
+   is started if it's not running yet. Returns the new process's PID, or 0 if
+   the fork server can't be used right now, in which case the caller should
+   fork() the process itself. */
+pid_t service_fork_server_fork(struct service *service, unsigned int uid);
+/* Stop the service's fork server, if it's running. */
+void service_fork_server_stop(struct service *service);
+
+/* Returns TRUE if the waitpid()ed PID was a fork server. */
+bool service_fork_server_reaped(pid_t pid, int status);
+
+#endif
@@ -14,6 +14,7 @@
 #include "service-process-notify.h"
 #include "service-anvil.h"
 #include "service-log.h"
+#include "service-fork-server.h"
 #include "service-monitor.h"
 
 #include <unistd.h>
@@ -155,7 +156,11 @@ service_status_input_one(struct service *service,
 	process->last_status_update = ioloop_time;
 
 	/* first status notification */
-	timeout_remove(&process->to_status);
+	if (process->to_status != NULL) {
+		timeout_remove(&process->to_status);
+		/* profiling may have been toggled while it was starting */
+		service_process_profile_update(process);
+	}
 
 	if (process->available_count != status->available_count) {
 		if (process->available_count > status->available_count) {
@@ -576,6 +581,7 @@ void service_monitor_stop(struct service *service)
 
 	timeout_remove(&service->to_throttle);
 	timeout_remove(&service->to_prefork);
+	service_fork_server_stop(service);
 }
 
 void service_monitor_stop_close(struct service *service)
@@ -718,6 +724,8 @@ void services_monitor_reap_children(void)
 	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
 		process = hash_table_lookup(service_pids, POINTER_CAST(pid));
 		if (process == NULL) {
+			if (service_fork_server_reaped(pid, status))
+				continue;
 			i_error("waitpid() returned unknown PID %s",
 				dec2str(pid));
 			continue;
@@ -24,6 +24,7 @@
 #include "service-anvil.h"
 #include "service-listen.h"
 #include "service-log.h"
+#include "service-fork-server.h"
 #include "service-process-notify.h"
 #include "service-process.h"
 
@@ -41,7 +42,8 @@ static void service_reopen_inet_listeners(struct service *service)
 
 	listeners = array_get(&service->listeners, &count);
 	for (i = 0; i < count; i++) {
-		if (!listeners[i]->reuse_port || listeners[i]->fd == -1)
+		if (!listeners[i]->reuse_port || listeners[i]->fd == -1 ||
+		    listeners[i]->shard_count > 0)
 			continue;
 
 		old_fd = listeners[i]->fd;
@@ -51,8 +53,49 @@ static void service_reopen_inet_listeners(struct service *service)
 	}
 }
 
+static void service_select_listener_shards(struct service *service)
+{
+	struct service_listener *const *listeners, *best = NULL;
+	unsigned int i, count;
+
+	/* the shards of the same listener are next to each other, starting
+	   from shard_idx=0. Select the one with the fewest processes. */
+	listeners = array_get(&service->listeners, &count);
+	for (i = 0; i < count; i++) {
+		struct service_listener *l = listeners[i];
+
+		if (l->shard_count == 0)
+			continue;
+		if (l->shard_idx == 0)
+			best = NULL;
+		l->shard_selected = FALSE;
+		if (l->fd != -1 &&
+		    (best == NULL ||
+		     l->shard_process_count < best->shard_process_count))
+			best = l;
+		if (l->shard_idx + 1 == l->shard_count && best != NULL)
+			best->shard_selected = TRUE;
+	}
+}
+
+static void
+service_process_add_listener_shards(struct service_process *process)
+{
+	struct service_listener *l;
+
+	array_foreach_elem(&process->service->listeners, l) {
+		if (!l->shard_selected)
+			continue;
+		if (!array_is_created(&process->listener_shards))
+			i_array_init(&process->listener_shards, 4);
+		array_push_back(&process->listener_shards, &l);
+		l->shard_process_count++;
+		l->shard_selected = FALSE;
+	}
+}
+
 static void
-service_dup_fds(struct service *service)
+service_dup_fds(struct service *service, int fork_server_fd)
 {
 	struct service_listener *const *listeners;
 	ARRAY_TYPE(dup2) dups;
@@ -94,6 +137,10 @@ service_dup_fds(struct service *service)
 	/* add listeners */
 	listener_settings = t_str_new(256);
 	for (i = 0; i < count; i++) {
+		/* the fork server passes all the shards to its processes */
+		if (listeners[i]->shard_count > 0 &&
+		    !listeners[i]->shard_selected && fork_server_fd == -1)
+			continue;
 		if (listeners[i]->fd != -1) {
 			str_truncate(listener_settings, 0);
 			str_append_tabescaped(listener_settings, listeners[i]->name);
@@ -113,6 +160,11 @@ service_dup_fds(struct service *service)
 			socket_listener_count++;
 		}
 	}
+	if (fork_server_fd != -1) {
+		/* the fd after the listeners, not counted in SOCKET_COUNT */
+		dup2_append(&dups, fork_server_fd, fd);
+		env_put(MASTER_FORK_SERVER_FD_ENV, dec2str(fd));
+	}
 
 	if (service->login_notify_fd != -1) {
 		dup2_append(&dups, service->login_notify_fd,
@@ -284,6 +336,8 @@ service_process_setup_environment(struct service *service, unsigned int uid,
 	    service_anvil_global->restarted)
 		env_put("ANVIL_RESTARTED", "1");
 	env_put(DOVECOT_LOG_DEBUG_ENV, service_set->log_debug);
+	if (service->profile)
+		env_put(MASTER_PROFILE_ENV, "1");
 }
 
 static void service_process_status_timeout(struct service_process *process)
@@ -328,7 +382,12 @@ struct service_process *service_process_create(struct service *service)
 		pid = service_anvil_global->pid;
 		uid = service_anvil_global->uid;
 		process_forked = FALSE;
+	} else if (service->set->fork_server &&
+		   (pid = service_fork_server_fork(service, uid)) > 0) {
+		process_forked = TRUE;
+		service->list->fork_counter++;
 	} else {
+		service_select_listener_shards(service);
 		pid = fork();
 		process_forked = TRUE;
 		service->list->fork_counter++;
@@ -352,7 +411,7 @@ struct service_process *service_process_create(struct service *service)
 		/* child */
 		service_process_setup_environment(service, uid, hostdomain);
 		service_reopen_inet_listeners(service);
-		service_dup_fds(service);
+		service_dup_fds(service, -1);
 		drop_privileges(service);
 		process_exec(service->executable);
 	}
@@ -363,6 +422,8 @@ struct service_process *service_process_create(struct service *service)
 	process->refcount = 1;
 	process->pid = pid;
 	process->uid = uid;
+	process->profiling = service->profile;
+	service_process_add_listener_shards(process);
 	if (process_forked) {
 		process->to_status =
 			timeout_add(SERVICE_FIRST_STATUS_TIMEOUT_SECS * 1000,
@@ -383,6 +444,26 @@ struct service_process *service_process_create(struct service *service)
 	return process;
 }
 
+pid_t service_process_spawn_fork_server(struct service *service, int fd)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		service_error(service, "fork() failed: %m");
+		return -1;
+	}
+	if (pid == 0) {
+		/* child - uid=0 is never used for the actual processes */
+		service_process_setup_environment(service, 0, my_hostdomain());
+		service_dup_fds(service, fd);
+		drop_privileges(service);
+		process_exec(service->executable);
+	}
+	service->list->fork_counter++;
+	return pid;
+}
+
 void service_process_destroy(struct service_process *process)
 {
 	struct service *service = process->service;
@@ -396,6 +477,16 @@ void service_process_destroy(struct service_process *process)
 	service->process_count--;
 	i_assert(service->process_avail <= service->process_count);
 
+	if (array_is_created(&process->listener_shards)) {
+		struct service_listener *l;
+
+		array_foreach_elem(&process->listener_shards, l) {
+			i_assert(l->shard_process_count > 0);
+			l->shard_process_count--;
+		}
+		array_free(&process->listener_shards);
+	}
+
 	timeout_remove(&process->to_status);
 	timeout_remove(&process->to_idle);
 	if (service->list->log_byes != NULL)
@@ -429,6 +520,24 @@ void service_process_unref(struct service_process *process)
 	i_free(process);
 }
 
+void service_process_profile_update(struct service_process *process)
+{
+	if (process->profiling == process->service->profile ||
+	    !SERVICE_PROCESS_IS_INITIALIZED(process) || process->destroyed)
+		return;
+
+	/* the process toggles its profiler on each SIGPROF */
+	if (kill(process->pid, SIGPROF) < 0) {
+		if (errno != ESRCH) {
+			service_error(process->service,
+				      "kill(%s, SIGPROF) failed: %m",
+				      dec2str(process->pid));
+		}
+		return;
+	}
+	process->profiling = process->service->profile;
+}
+
 static const char *
 get_exit_status_message(struct service *service, enum fatal_exit_status status)
 {
@@ -31,19 +31,31 @@ struct service_process {
 
 	/* kill the process if it doesn't send initial status notification */
 	struct timeout *to_status;
+	/* reuse_port_shards listeners given to this process */
+	ARRAY(struct service_listener *) listener_shards;
 
 	bool destroyed:1;
+	/* process's sampling profiler is enabled */
+	bool profiling:1;
 };
 
 #define SERVICE_PROCESS_IS_INITIALIZED(process) \
 	((process)->to_status == NULL)
 
 struct service_process *service_process_create(struct service *service);
+/* Fork and exec a fork server for the service. fd is passed to it as the
+   connection to the master. Returns the fork server's PID, or -1 on error. */
+pid_t service_process_spawn_fork_server(struct service *service, int fd);
 void service_process_destroy(struct service_process *process);
 
 void service_process_ref(struct service_process *process);
 void service_process_unref(struct service_process *process);
 
+/* Send SIGPROF to the process if its profiler state differs from the
+   service's. Uninitialized processes are skipped, since they haven't yet
+   set up the signal handler. */
+void service_process_profile_update(struct service_process *process);
+
 void service_process_log_status_error(struct service_process *process,
 				      int status);
 
@@ -129,6 +129,7 @@ service_create_one_inet_listener(struct service *service,
 	l->set.inetset.ip = *ip;
 	l->inet_address = p_strdup(service->list->pool, address);
 	l->name = set->name;
+	l->shard_count = set->reuse_port_shards;
 
 	return l;
 }
@@ -141,7 +142,7 @@ service_create_inet_listeners(struct service *service,
 	static struct service_listener *l;
 	const char *const *tmp, *addresses;
 	const struct ip_addr *ips;
-	unsigned int i, ips_count;
+	unsigned int i, j, ips_count;
 	bool ssl_disabled = strcmp(service->set->master_set->ssl, "no") == 0;
 
 	if (set->port == 0) {
@@ -170,6 +171,13 @@ service_create_inet_listeners(struct service *service,
 			l = service_create_one_inet_listener(service, set,
 							     address, &ips[i]);
 			array_push_back(&service->listeners, &l);
+			for (j = 1; j < set->reuse_port_shards; j++) {
+				l = service_create_one_inet_listener(service,
+						set, address, &ips[i]);
+				l->shard_idx = j;
+				l->shard_count = set->reuse_port_shards;
+				array_push_back(&service->listeners, &l);
+			}
 		}
 		service->have_inet_listeners = TRUE;
 	}
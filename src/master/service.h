@@ -40,6 +40,15 @@ struct service_listener {
 	} set;
 
 	bool reuse_port;
+
+	/* reuse_port_shards: this listener is shard number shard_idx of
+	   shard_count SO_REUSEPORT sockets for the same address. Each process
+	   is given only one of the shards. shard_count=0 if not sharded. */
+	unsigned int shard_idx, shard_count;
+	/* number of processes currently using this shard */
+	unsigned int shard_process_count;
+	/* shard selected for the process being created */
+	bool shard_selected;
 };
 
 struct service {
@@ -115,6 +124,11 @@ struct service {
 	/* Last time a "dropping client connections" warning was logged */
 	time_t last_drop_warning;
 
+	/* fork_server=yes: the running fork server, or NULL */
+	struct service_fork_server *fork_server;
+	/* Don't try to start a new fork server before this time */
+	time_t fork_server_retry_time;
+
 	/* all processes are in use and new connections are coming */
 	bool listen_pending:1;
 	/* service is currently listening for new connections */
@@ -127,6 +141,8 @@ struct service {
 	bool have_successful_exits:1;
 	/* service was stopped via doveadm */
 	bool doveadm_stop:1;
+	/* sampling profiler was enabled via doveadm */
+	bool profile:1;
 };
 
 struct service_list {
@@ -10,6 +10,8 @@
 #include "acl-global-file.h"
 #include "acl-cache.h"
 #include "acl-api-private.h"
+#include "acl-lookup-dict.h"
+#include "acl-plugin.h"
 
 struct acl_letter_map {
 	char letter;
@@ -158,10 +160,26 @@ int acl_object_last_changed(struct acl_object *aclobj, time_t *last_changed_r)
 	return aclobj->backend->v.last_changed(aclobj, last_changed_r);
 }
 
+static void acl_object_rights_changed(struct acl_object *aclobj)
+{
+	struct mail_namespace *ns = aclobj->backend->list->ns;
+	struct acl_user *auser = ACL_USER_CONTEXT(ns->user);
+
+	if (ns->owner == NULL || auser == NULL)
+		return;
+	acl_lookup_dict_rights_changed(auser->acl_lookup_dict,
+				       ns->owner->username);
+}
+
 int acl_object_update(struct acl_object *aclobj,
 		      const struct acl_rights_update *update)
 {
-	return aclobj->backend->v.object_update(aclobj, update);
+	int ret;
+
+	ret = aclobj->backend->v.object_update(aclobj, update);
+	if (ret >= 0)
+		acl_object_rights_changed(aclobj);
+	return ret;
 }
 
 struct acl_object_list_iter *acl_object_list_init(struct acl_object *aclobj)
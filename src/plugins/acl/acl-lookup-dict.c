@@ -1,9 +1,14 @@
 /* Copyright (c) 2008-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
+#include "guid.h"
+#include "strescape.h"
 #include "dict.h"
+#include "settings-parser.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
 #include "acl-api-private.h"
@@ -13,10 +18,27 @@
 
 
 #define DICT_SHARED_BOXES_PATH "shared-boxes/"
+#define DICT_RIGHTS_CACHE_PATH "acl-rights/"
+#define DICT_RIGHTS_CACHE_GENERATION_KEY "generation"
 
 struct acl_lookup_dict {
 	struct mail_user *user;
 	struct dict *dict;
+	/* acl_shared_rights_cache_ttl, 0 = cache is disabled */
+	unsigned int rights_cache_ttl_secs;
+};
+
+struct acl_lookup_dict_rights_cache {
+	pool_t pool;
+	struct acl_lookup_dict *dict;
+	/* shared/acl-rights/<owner>/ */
+	const char *prefix;
+	const char *idset;
+	const char *generation;
+
+	/* mailbox name -> space-separated rights */
+	HASH_TABLE(const char *, const char *) rights;
+	struct dict_transaction_context *trans;
 };
 
 struct acl_lookup_dict_iter {
@@ -48,6 +70,15 @@ struct acl_lookup_dict *acl_lookup_dict_init(struct mail_user *user)
 		dict_set.event_parent = user->event;
 		if (dict_init(uri, &dict_set, &dict->dict, &error) < 0)
 			i_error("acl: dict_init(%s) failed: %s", uri, error);
+
+		const char *value = mail_user_plugin_getenv(user,
+			"acl_shared_rights_cache_ttl");
+		if (value != NULL &&
+		    settings_get_time(value, &dict->rights_cache_ttl_secs,
+				      &error) < 0) {
+			i_error("acl: Invalid acl_shared_rights_cache_ttl "
+				"setting: %s", error);
+		}
 	} else {
 		e_debug(user->event, "acl: No acl_shared_dict setting - "
 			"shared mailbox listing is disabled");
@@ -261,6 +292,8 @@ int acl_lookup_dict_rebuild(struct acl_lookup_dict *dict)
 	   but we can't remove any existing ones */
 	if (acl_lookup_dict_rebuild_update(dict, &ids_arr, ret < 0) < 0)
 		ret = -1;
+	/* the ACLs may have been changed outside Dovecot */
+	acl_lookup_dict_rights_changed(dict, dict->user->username);
 	return ret;
 }
 
@@ -371,3 +404,182 @@ int acl_lookup_dict_iterate_visible_deinit(struct acl_lookup_dict_iter **_iter)
 	pool_unref(&iter->pool);
 	return ret;
 }
+
+static const char *
+acl_lookup_dict_rights_cache_prefix(const char *owner)
+{
+	return t_strconcat(DICT_PATH_SHARED DICT_RIGHTS_CACHE_PATH,
+			   owner, "/", NULL);
+}
+
+static bool
+acl_lookup_dict_rights_cache_value_parse(const char *value,
+					 const char *generation,
+					 const char **rights_r)
+{
+	const char *const *args = t_strsplit_tabescaped(value);
+	time_t expire;
+
+	/* <generation> TAB <expire timestamp> TAB <rights> */
+	if (str_array_length(args) != 3 ||
+	    strcmp(args[0], generation) != 0 ||
+	    str_to_time(args[1], &expire) < 0 || expire <= ioloop_time)
+		return FALSE;
+	*rights_r = args[2];
+	return TRUE;
+}
+
+static void
+acl_lookup_dict_rights_cache_read(struct acl_lookup_dict_rights_cache *cache)
+{
+	const struct dict_op_settings *set =
+		mail_user_get_dict_op_settings(cache->dict->user);
+	struct dict_iterate_context *iter;
+	ARRAY_TYPE(const_string) keys, values;
+	const char *key, *value, *rights, *error;
+	size_t prefix_len = strlen(cache->prefix);
+	size_t idset_len = strlen(cache->idset);
+	unsigned int i, count;
+
+	/* read everything first, since the generation could be returned
+	   after the rights */
+	t_array_init(&keys, 64);
+	t_array_init(&values, 64);
+	iter = dict_iterate_init(cache->dict->dict, set, cache->prefix,
+				 DICT_ITERATE_FLAG_RECURSE);
+	while (dict_iterate(iter, &key, &value)) {
+		i_assert(str_begins(key, cache->prefix));
+		key += prefix_len;
+		if (strcmp(key, DICT_RIGHTS_CACHE_GENERATION_KEY) == 0) {
+			cache->generation = p_strdup(cache->pool, value);
+			continue;
+		}
+		key = t_strdup(key);
+		value = t_strdup(value);
+		array_push_back(&keys, &key);
+		array_push_back(&values, &value);
+	}
+	if (dict_iterate_deinit(&iter, &error) < 0) {
+		i_error("acl: dict iteration failed: %s - "
+			"not using the rights cache", error);
+		array_clear(&keys);
+	}
+
+	count = array_count(&keys);
+	for (i = 0; i < count; i++) {
+		key = array_idx_elem(&keys, i);
+		value = array_idx_elem(&values, i);
+		if (!acl_lookup_dict_rights_cache_value_parse(value,
+				cache->generation, &rights)) {
+			/* expired or the ACLs have changed since. drop it for
+			   all identifier sets, so stale entries don't pile
+			   up. */
+			if (cache->trans == NULL) {
+				cache->trans = dict_transaction_begin(
+					cache->dict->dict, set);
+			}
+			dict_unset(cache->trans,
+				   t_strconcat(cache->prefix, key, NULL));
+		} else if (strncmp(key, cache->idset, idset_len) == 0 &&
+			   key[idset_len] == '/') {
+			hash_table_insert(cache->rights,
+				p_strdup(cache->pool, key + idset_len + 1),
+				p_strdup(cache->pool, rights));
+		}
+	}
+}
+
+struct acl_lookup_dict_rights_cache *
+acl_lookup_dict_rights_cache_init(struct acl_lookup_dict *dict,
+				  const char *owner, const char *idset)
+{
+	struct acl_lookup_dict_rights_cache *cache;
+	pool_t pool;
+
+	if (dict->dict == NULL || dict->rights_cache_ttl_secs == 0)
+		return NULL;
+
+	pool = pool_alloconly_create("acl rights cache", 1024);
+	cache = p_new(pool, struct acl_lookup_dict_rights_cache, 1);
+	cache->pool = pool;
+	cache->dict = dict;
+	cache->prefix = p_strdup(pool, acl_lookup_dict_rights_cache_prefix(owner));
+	cache->idset = p_strdup(pool, idset);
+	cache->generation = "";
+	hash_table_create(&cache->rights, pool, 0, str_hash, strcmp);
+	T_BEGIN {
+		acl_lookup_dict_rights_cache_read(cache);
+	} T_END;
+	return cache;
+}
+
+bool acl_lookup_dict_rights_cache_lookup(struct acl_lookup_dict_rights_cache *cache,
+					 const char *name,
+					 const char *const **rights_r)
+{
+	const char *rights;
+
+	rights = hash_table_lookup(cache->rights, name);
+	if (rights == NULL)
+		return FALSE;
+	*rights_r = t_strsplit_spaces(rights, " ");
+	return TRUE;
+}
+
+void acl_lookup_dict_rights_cache_add(struct acl_lookup_dict_rights_cache *cache,
+				      const char *name,
+				      const char *const *rights)
+{
+	const char *key, *value;
+
+	if (cache->trans == NULL) {
+		cache->trans = dict_transaction_begin(cache->dict->dict,
+			mail_user_get_dict_op_settings(cache->dict->user));
+	}
+	key = t_strconcat(cache->prefix, cache->idset, "/", name, NULL);
+	value = t_strdup_printf("%s\t%ld\t%s",
+		str_tabescape(cache->generation),
+		(long)(ioloop_time + cache->dict->rights_cache_ttl_secs),
+		t_strarray_join(rights, " "));
+	dict_set(cache->trans, key, value);
+	hash_table_update(cache->rights, p_strdup(cache->pool, name),
+			  p_strdup(cache->pool, t_strarray_join(rights, " ")));
+}
+
+void acl_lookup_dict_rights_cache_deinit(struct acl_lookup_dict_rights_cache **_cache)
+{
+	struct acl_lookup_dict_rights_cache *cache = *_cache;
+	const char *error;
+
+	*_cache = NULL;
+	if (cache->trans != NULL &&
+	    dict_transaction_commit(&cache->trans, &error) < 0)
+		i_error("acl: dict commit failed: %s", error);
+	hash_table_destroy(&cache->rights);
+	pool_unref(&cache->pool);
+}
+
+void acl_lookup_dict_rights_changed(struct acl_lookup_dict *dict,
+				    const char *owner)
+{
+	struct dict_transaction_context *trans;
+	const char *error;
+	guid_128_t guid;
+
+	if (dict->dict == NULL || dict->rights_cache_ttl_secs == 0)
+		return;
+
+	/* a new generation invalidates all the cached rights of the owner's
+	   mailboxes */
+	guid_128_generate(guid);
+	trans = dict_transaction_begin(dict->dict,
+		mail_user_get_dict_op_settings(dict->user));
+	T_BEGIN {
+		dict_set(trans, t_strconcat(
+			acl_lookup_dict_rights_cache_prefix(owner),
+			DICT_RIGHTS_CACHE_GENERATION_KEY, NULL),
+			guid_128_to_string(guid));
+	} T_END;
+	if (dict_transaction_commit(&trans, &error) < 0)
+		i_error("acl: dict commit failed: %s", error);
+}
@@ -14,4 +14,24 @@ const char *
 acl_lookup_dict_iterate_visible_next(struct acl_lookup_dict_iter *iter);
 int acl_lookup_dict_iterate_visible_deinit(struct acl_lookup_dict_iter **iter);
 
+/* Cache of the resolved rights to the owner's mailboxes, shared between all
+   sessions via acl_shared_dict. idset identifies the ACL username and
+   groups that the rights were resolved for. Returns NULL if
+   acl_shared_rights_cache_ttl isn't set. */
+struct acl_lookup_dict_rights_cache *
+acl_lookup_dict_rights_cache_init(struct acl_lookup_dict *dict,
+				  const char *owner, const char *idset);
+/* Returns TRUE and the rights if the mailbox's rights were cached. */
+bool acl_lookup_dict_rights_cache_lookup(struct acl_lookup_dict_rights_cache *cache,
+					 const char *name,
+					 const char *const **rights_r);
+void acl_lookup_dict_rights_cache_add(struct acl_lookup_dict_rights_cache *cache,
+				      const char *name,
+				      const char *const *rights);
+/* Write the added rights to the dict. */
+void acl_lookup_dict_rights_cache_deinit(struct acl_lookup_dict_rights_cache **cache);
+/* Invalidate all the cached rights for the owner's mailboxes. */
+void acl_lookup_dict_rights_changed(struct acl_lookup_dict *dict,
+				    const char *owner);
+
 #endif
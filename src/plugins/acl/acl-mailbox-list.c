@@ -3,6 +3,8 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "hex-binary.h"
+#include "sha1.h"
 #include "imap-match.h"
 #include "wildcard-match.h"
 #include "mailbox-tree.h"
@@ -10,6 +12,7 @@
 #include "mailbox-list-iter-private.h"
 #include "acl-api-private.h"
 #include "acl-cache.h"
+#include "acl-lookup-dict.h"
 #include "acl-shared-storage.h"
 #include "acl-plugin.h"
 
@@ -19,6 +22,7 @@ struct acl_mailbox_list_iterate_context {
 	union mailbox_list_iterate_module_context module_ctx;
 
 	struct mailbox_tree_context *lookup_boxes;
+	struct acl_lookup_dict_rights_cache *rights_cache;
 	struct mailbox_info info;
 
 	char sep;
@@ -147,6 +151,81 @@ acl_mailbox_try_list_fast(struct mailbox_list_iterate_context *_ctx)
 		mailbox_tree_deinit(&update_ctx.tree_ctx);
 }
 
+static const char *acl_backend_get_idset(struct acl_backend *backend)
+{
+	struct sha1_ctxt sha1;
+	unsigned char digest[SHA1_RESULTLEN];
+	unsigned int i;
+
+	/* the groups are already sorted */
+	sha1_init(&sha1);
+	if (backend->username != NULL)
+		sha1_loop(&sha1, backend->username, strlen(backend->username));
+	for (i = 0; i < backend->group_count; i++) {
+		sha1_loop(&sha1, "", 1);
+		sha1_loop(&sha1, backend->groups[i],
+			  strlen(backend->groups[i]));
+	}
+	sha1_result(&sha1, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+static void
+acl_mailbox_list_rights_cache_init(struct mailbox_list_iterate_context *_ctx)
+{
+	struct acl_mailbox_list_iterate_context *ctx =
+		ACL_LIST_ITERATE_CONTEXT(_ctx);
+	struct acl_mailbox_list *alist = ACL_LIST_CONTEXT_REQUIRE(_ctx->list);
+	struct mail_namespace *ns = _ctx->list->ns;
+	struct acl_user *auser = ACL_USER_CONTEXT(ns->user);
+
+	/* Listing other users' shared mailboxes needs to read their ACL
+	   files, which is slow with a lot of shared mailboxes. Their
+	   resolved rights can be cached in the shared dict. */
+	if (ns->type != MAIL_NAMESPACE_TYPE_SHARED || ns->owner == NULL ||
+	    auser == NULL || alist->ignore_acls ||
+	    (_ctx->flags & MAILBOX_LIST_ITER_RAW_LIST) != 0)
+		return;
+
+	ctx->rights_cache =
+		acl_lookup_dict_rights_cache_init(auser->acl_lookup_dict,
+			ns->owner->username,
+			acl_backend_get_idset(alist->rights.backend));
+}
+
+static int
+acl_mailbox_list_iter_have_lookup_right(struct mailbox_list_iterate_context *_ctx,
+					const char *name)
+{
+	struct acl_mailbox_list_iterate_context *ctx =
+		ACL_LIST_ITERATE_CONTEXT(_ctx);
+	struct acl_object *aclobj;
+	const char *const *rights;
+	int ret;
+
+	if (ctx->rights_cache == NULL) {
+		return acl_mailbox_list_have_right(_ctx->list, name, FALSE,
+						   ACL_STORAGE_RIGHT_LOOKUP,
+						   NULL);
+	}
+
+	if (!acl_lookup_dict_rights_cache_lookup(ctx->rights_cache, name,
+						 &rights)) {
+		aclobj = acl_object_init_from_name(
+			acl_mailbox_list_get_backend(_ctx->list), name);
+		ret = acl_object_get_my_rights(aclobj, pool_datastack_create(),
+					       &rights);
+		acl_object_deinit(&aclobj);
+		if (ret < 0) {
+			mailbox_list_set_internal_error(_ctx->list);
+			return -1;
+		}
+		acl_lookup_dict_rights_cache_add(ctx->rights_cache,
+						 name, rights);
+	}
+	return str_array_find(rights, MAIL_ACL_LOOKUP) ? 1 : 0;
+}
+
 static struct mailbox_list_iterate_context *
 acl_mailbox_list_iter_init_shared(struct mailbox_list *list,
 				  const char *const *patterns,
@@ -208,6 +287,7 @@ acl_mailbox_list_iter_init(struct mailbox_list *list,
 	   couldn't get such a list, we'll go through all mailboxes. */
 	T_BEGIN {
 		acl_mailbox_try_list_fast(_ctx);
+		acl_mailbox_list_rights_cache_init(_ctx);
 	} T_END;
 
 	return _ctx;
@@ -366,9 +446,7 @@ acl_mailbox_list_info_is_visible(struct mailbox_list_iterate_context *_ctx)
 	}
 
 	acl_name = acl_mailbox_list_iter_get_name(_ctx, info->vname);
-	ret = acl_mailbox_list_have_right(_ctx->list, acl_name, FALSE,
-					  ACL_STORAGE_RIGHT_LOOKUP,
-					  NULL);
+	ret = acl_mailbox_list_iter_have_lookup_right(_ctx, acl_name);
 	if (ret != 0) {
 		if ((_ctx->flags & MAILBOX_LIST_ITER_RETURN_NO_FLAGS) != 0) {
 			/* don't waste time checking if there are visible
@@ -439,9 +517,7 @@ acl_mailbox_list_iter_check_autocreate_acls(struct mailbox_list_iterate_context
 	for (i = 0; i < count; ) {
 		const char *acl_name =
 			acl_mailbox_list_iter_get_name(_ctx, box_sets[i]->name);
-		ret = acl_mailbox_list_have_right(_ctx->list, acl_name, FALSE,
-						  ACL_STORAGE_RIGHT_LOOKUP,
-						  NULL);
+		ret = acl_mailbox_list_iter_have_lookup_right(_ctx, acl_name);
 		if (ret < 0)
 			return -1;
 		if (ret > 0)
@@ -499,6 +575,8 @@ acl_mailbox_list_iter_deinit(struct mailbox_list_iterate_context *_ctx)
 
         if (ctx->lookup_boxes != NULL)
                 mailbox_tree_deinit(&ctx->lookup_boxes);
+	if (ctx->rights_cache != NULL)
+		acl_lookup_dict_rights_cache_deinit(&ctx->rights_cache);
 	if (alist->module_ctx.super.iter_deinit(_ctx) < 0)
 		ret = -1;
 	return ret;
@@ -0,0 +1,171 @@
+#ifndef FS_S3_PRIVATE_H
+#define FS_S3_PRIVATE_H
+
+#include "fs-api-private.h"
+#include "http-client.h"
+#include "s3-auth.h"
+
+#define S3_DEFAULT_RANGE_SIZE (8*1024*1024)
+#define S3_DEFAULT_MAX_PARALLEL_RANGES 4
+/* S3 requires all parts except the last one to be at least 5 MB */
+#define S3_MIN_MULTIPART_SIZE (5*1024*1024)
+#define S3_DEFAULT_MULTIPART_SIZE (16*1024*1024)
+#define S3_DEFAULT_MAX_PARALLEL_PARTS 4
+#define S3_DEFAULT_MAX_CONNECTIONS 8
+#define S3_DEFAULT_TIMEOUT_MSECS (30*1000)
+#define S3_DEFAULT_MAX_ATTEMPTS 3
+/* Keep idle connections open for reuse this long */
+#define S3_MAX_IDLE_TIME_MSECS (60*1000)
+/* Maximum size of a response body that is parsed (XML listings etc.) */
+#define S3_MAX_RESPONSE_BODY_SIZE (4*1024*1024)
+
+enum s3_fs_op {
+	S3_FS_OP_NONE,
+	S3_FS_OP_HEAD,
+	S3_FS_OP_DELETE,
+	S3_FS_OP_WRITE,
+};
+
+struct s3_fs_payload;
+struct s3_fs_iter_response;
+
+struct s3_fs {
+	struct fs fs;
+	pool_t pool;
+	struct http_client *client;
+	struct s3_auth_settings auth;
+
+	const struct http_url *url;
+	/* host[:port] as sent in the Host header */
+	const char *authority;
+	/* "/" or "/bucket/" for path-style requests */
+	const char *bucket_path;
+	/* Prefix prepended to all object keys */
+	const char *key_prefix;
+
+	uoff_t range_size, multipart_size;
+	unsigned int max_parallel_ranges, max_parallel_parts;
+
+	/* Number of requests and payloads that haven't finished yet */
+	unsigned int pending_count;
+	struct s3_fs_payload *payloads;
+};
+
+struct s3_fs_file {
+	struct fs_file file;
+	pool_t pool;
+	/* Full object key including the key_prefix */
+	const char *key;
+	enum fs_open_mode open_mode;
+
+	fs_file_async_callback_t *async_callback;
+	void *async_context;
+
+	struct istream *prefetch_input;
+
+	/* Currently running (or finished, but not yet returned) operation */
+	enum s3_fs_op op;
+	struct http_client_request *op_req;
+	int op_ret, op_errno;
+	const char *op_error;
+	bool op_finished;
+
+	/* Results of the last successful HEAD */
+	uoff_t size;
+	time_t mtime;
+	bool head_done;
+
+	struct ostream *temp_output;
+	struct s3_fs_upload *upload;
+};
+
+struct s3_fs_iter {
+	struct fs_iter iter;
+	pool_t pool;
+	/* Full key prefix that is listed */
+	const char *prefix;
+	char *continuation_token;
+	struct http_client_request *req;
+	struct s3_fs_iter_response *response;
+
+	ARRAY_TYPE(const_string) names;
+	unsigned int name_idx;
+
+	int errno_err;
+	const char *error;
+	bool finished;
+};
+
+#define S3_FS(ptr) container_of((ptr), struct s3_fs, fs)
+#define S3_FILE(ptr) container_of((ptr), struct s3_fs_file, file)
+#define S3_ITER(ptr) container_of((ptr), struct s3_fs_iter, iter)
+
+/* Called with finished=FALSE whenever more data was appended to the buffer,
+   and once with finished=TRUE when the payload has been fully read or it
+   failed (error != NULL). */
+typedef void
+s3_fs_payload_callback_t(const char *error, bool finished, void *context);
+
+extern const struct fs fs_class_s3;
+
+/* Create a new signed request for the given object key. The key is URI-encoded
+   by this function. query is an already encoded query string or NULL. The
+   headers are added to the request and signed. If payload is TRUE, the
+   request will have an unsigned payload. */
+struct http_client_request *
+s3_fs_request_init(struct s3_fs *fs, const char *method, const char *key,
+		   const char *query, const struct s3_auth_header *headers,
+		   unsigned int headers_count, bool payload,
+		   http_client_request_callback_t *callback, void *context);
+#define s3_fs_request_init(fs, method, key, query, headers, headers_count, \
+			   payload, callback, context) \
+	s3_fs_request_init(fs, method, key, query, headers, headers_count, \
+		payload - CALLBACK_TYPECHECK(callback, void (*)( \
+			const struct http_response *response, \
+			typeof(context))), \
+		(http_client_request_callback_t *)callback, context)
+void s3_fs_request_submit(struct s3_fs *fs, struct http_client_request *req);
+/* Must be called by all request callbacks. */
+void s3_fs_request_finished(struct s3_fs *fs);
+/* Abort a submitted request if it's not NULL. The callback isn't called. */
+void s3_fs_request_abort(struct s3_fs *fs, struct http_client_request **req);
+
+/* Returns errno matching the HTTP response status */
+int s3_fs_response_errno(const struct http_response *response);
+const char *s3_fs_response_error(const struct http_response *response);
+
+/* Read the payload asynchronously into buf. The payload can be aborted with
+   s3_fs_payload_abort() until the callback is called with finished=TRUE. */
+struct s3_fs_payload *
+s3_fs_payload_read(struct s3_fs *fs, struct istream *input, buffer_t *buf,
+		   size_t max_size, s3_fs_payload_callback_t *callback,
+		   void *context);
+#define s3_fs_payload_read(fs, input, buf, max_size, callback, context) \
+	s3_fs_payload_read(fs, input, buf, max_size - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			const char *, bool, typeof(context))), \
+		(s3_fs_payload_callback_t *)callback, context)
+void s3_fs_payload_abort(struct s3_fs_payload **payload);
+
+/* Wake up fs_wait_async() after some operation made progress. */
+void s3_fs_progress(struct s3_fs *fs);
+/* Run the ioloop until some pending operation makes progress. */
+void s3_fs_wait_async(struct fs *fs);
+
+void s3_fs_file_op_finish(struct s3_fs_file *file, int ret, int op_errno,
+			  const char *error);
+/* Returns the operation's result, waiting for it if the file isn't
+   asynchronous. Returns -1 with errno=EAGAIN if it hasn't finished yet.
+   The operation is reset after a result is returned. */
+int s3_fs_file_op_result(struct s3_fs_file *file, enum s3_fs_op op);
+
+/* Find the next <tag>value</tag> after *pos and return its unescaped value.
+   *pos is moved after the closing tag. Returns NULL if not found. */
+const char *s3_xml_find_value(const char **pos, const char *tag);
+
+struct istream *i_stream_create_s3(struct s3_fs_file *file);
+
+void s3_fs_upload_start(struct s3_fs_file *file, struct istream *input);
+void s3_fs_upload_abort(struct s3_fs_file *file);
+
+#endif
@@ -0,0 +1,397 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "http-response.h"
+#include "fs-s3-private.h"
+
+/* Objects smaller than multipart_size are uploaded with a single PUT.
+   Larger objects are uploaded with a multipart upload, which sends up to
+   max_parallel_parts parts at the same time. The parts are read directly
+   from the (seekable) temporary file, so the whole object isn't kept in
+   memory. */
+
+struct s3_fs_upload_part {
+	struct s3_fs_upload *upload;
+	unsigned int number;
+	uoff_t offset, size;
+	struct http_client_request *req;
+	const char *etag;
+};
+
+struct s3_fs_upload {
+	pool_t pool;
+	struct s3_fs_file *file;
+	struct s3_fs *fs;
+	struct istream *input;
+	uoff_t size;
+
+	/* PUT, initiate or complete request */
+	struct http_client_request *req;
+	struct s3_fs_payload *payload;
+	buffer_t *body;
+
+	const char *upload_id;
+	ARRAY(struct s3_fs_upload_part) parts;
+	unsigned int next_part, parts_done;
+
+	bool finished:1;
+	bool completed:1;
+};
+
+ARRAY_DEFINE_TYPE(s3_auth_header_array, struct s3_auth_header);
+
+static void s3_fs_upload_send_part(struct s3_fs_upload *upload);
+
+static void
+s3_fs_upload_get_headers(struct s3_fs_upload *upload,
+			 ARRAY_TYPE(s3_auth_header_array) *headers)
+{
+	struct s3_fs_file *file = upload->file;
+	const struct fs_metadata *md;
+	struct s3_auth_header *header;
+
+	if (file->open_mode == FS_OPEN_MODE_CREATE) {
+		/* fail with 412 if the object already exists */
+		header = array_append_space(headers);
+		header->name = "if-none-match";
+		header->value = "*";
+	}
+	if (!array_is_created(&file->file.metadata))
+		return;
+	array_foreach(&file->file.metadata, md) {
+		if (str_begins(md->key, FS_METADATA_INTERNAL_PREFIX))
+			continue;
+		header = array_append_space(headers);
+		header->name = t_strconcat("x-amz-meta-",
+					   t_str_lcase(md->key), NULL);
+		header->value = md->value;
+	}
+}
+
+static void
+s3_fs_upload_finish(struct s3_fs_upload *upload, int ret, int op_errno,
+		    const char *error)
+{
+	if (upload->finished)
+		return;
+	upload->finished = TRUE;
+	s3_fs_file_op_finish(upload->file, ret, op_errno, error);
+}
+
+static void
+s3_fs_upload_fail(struct s3_fs_upload *upload,
+		  const struct http_response *response)
+{
+	s3_fs_upload_finish(upload, -1, s3_fs_response_errno(response),
+			    s3_fs_response_error(response));
+}
+
+static void
+s3_fs_upload_put_response(const struct http_response *response,
+			  struct s3_fs_upload *upload)
+{
+	upload->req = NULL;
+	s3_fs_request_finished(upload->fs);
+
+	if (!http_response_is_success(response))
+		s3_fs_upload_fail(upload, response);
+	else {
+		upload->completed = TRUE;
+		s3_fs_upload_finish(upload, 1, 0, NULL);
+	}
+}
+
+static void s3_fs_upload_put(struct s3_fs_upload *upload)
+{
+	ARRAY_TYPE(s3_auth_header_array) headers;
+
+	t_array_init(&headers, 8);
+	s3_fs_upload_get_headers(upload, &headers);
+	upload->req = s3_fs_request_init(upload->fs, "PUT", upload->file->key,
+					 NULL, array_front(&headers),
+					 array_count(&headers), TRUE,
+					 s3_fs_upload_put_response, upload);
+	http_client_request_set_payload(upload->req, upload->input, FALSE);
+	s3_fs_request_submit(upload->fs, upload->req);
+}
+
+static void
+s3_fs_upload_complete_payload(const char *error, bool finished,
+			      struct s3_fs_upload *upload)
+{
+	if (!finished)
+		return;
+	upload->payload = NULL;
+
+	/* CompleteMultipartUpload may fail even after returning 200 */
+	if (error != NULL)
+		s3_fs_upload_finish(upload, -1, EIO, error);
+	else if (strstr(str_c(upload->body), "<Error>") != NULL) {
+		const char *pos = str_c(upload->body);
+		const char *message = s3_xml_find_value(&pos, "Message");
+
+		s3_fs_upload_finish(upload, -1, EIO, t_strdup_printf(
+			"CompleteMultipartUpload failed: %s",
+			message == NULL ? "(unknown error)" : message));
+	} else {
+		upload->completed = TRUE;
+		s3_fs_upload_finish(upload, 1, 0, NULL);
+	}
+}
+
+static void
+s3_fs_upload_complete_response(const struct http_response *response,
+			       struct s3_fs_upload *upload)
+{
+	upload->req = NULL;
+	s3_fs_request_finished(upload->fs);
+
+	if (!http_response_is_success(response)) {
+		s3_fs_upload_fail(upload, response);
+		return;
+	}
+	if (response->payload == NULL) {
+		upload->completed = TRUE;
+		s3_fs_upload_finish(upload, 1, 0, NULL);
+		return;
+	}
+	buffer_set_used_size(upload->body, 0);
+	upload->payload = s3_fs_payload_read(upload->fs, response->payload,
+		upload->body, S3_MAX_RESPONSE_BODY_SIZE,
+		s3_fs_upload_complete_payload, upload);
+}
+
+static void s3_fs_upload_complete(struct s3_fs_upload *upload)
+{
+	const struct s3_fs_upload_part *part;
+	string_t *query, *body;
+
+	body = t_str_new(128 + array_count(&upload->parts) * 96);
+	str_append(body, "<CompleteMultipartUpload>");
+	array_foreach(&upload->parts, part) {
+		str_printfa(body, "<Part><PartNumber>%u</PartNumber>"
+			    "<ETag>%s</ETag></Part>", part->number, part->etag);
+	}
+	str_append(body, "</CompleteMultipartUpload>");
+
+	query = t_str_new(64);
+	str_append(query, "uploadId=");
+	s3_uri_encode(query, upload->upload_id, TRUE);
+	upload->req = s3_fs_request_init(upload->fs, "POST", upload->file->key,
+					 str_c(query), NULL, 0, TRUE,
+					 s3_fs_upload_complete_response,
+					 upload);
+	http_client_request_add_header(upload->req, "Content-Type",
+				       "application/xml");
+	http_client_request_set_payload_data(upload->req, body->data,
+					     body->used);
+	s3_fs_request_submit(upload->fs, upload->req);
+}
+
+static void
+s3_fs_upload_part_response(const struct http_response *response,
+			   struct s3_fs_upload_part *part)
+{
+	struct s3_fs_upload *upload = part->upload;
+	const char *etag;
+
+	part->req = NULL;
+	s3_fs_request_finished(upload->fs);
+
+	if (!http_response_is_success(response)) {
+		s3_fs_upload_fail(upload, response);
+		return;
+	}
+	etag = http_response_header_get(response, "ETag");
+	if (etag == NULL) {
+		s3_fs_upload_finish(upload, -1, EIO, t_strdup_printf(
+			"UploadPart %u response is missing ETag",
+			part->number));
+		return;
+	}
+	part->etag = p_strdup(upload->pool, etag);
+
+	if (++upload->parts_done == array_count(&upload->parts))
+		s3_fs_upload_complete(upload);
+	else
+		s3_fs_upload_send_part(upload);
+}
+
+static void s3_fs_upload_send_part(struct s3_fs_upload *upload)
+{
+	struct s3_fs_upload_part *part;
+	struct istream *input;
+	string_t *query;
+
+	if (upload->finished ||
+	    upload->next_part == array_count(&upload->parts))
+		return;
+	part = array_idx_modifiable(&upload->parts, upload->next_part++);
+
+	query = t_str_new(64);
+	str_printfa(query, "partNumber=%u&uploadId=", part->number);
+	s3_uri_encode(query, upload->upload_id, TRUE);
+	part->req = s3_fs_request_init(upload->fs, "PUT", upload->file->key,
+				       str_c(query), NULL, 0, TRUE,
+				       s3_fs_upload_part_response, part);
+	input = i_stream_create_range(upload->input, part->offset, part->size);
+	http_client_request_set_payload(part->req, input, FALSE);
+	i_stream_unref(&input);
+	s3_fs_request_submit(upload->fs, part->req);
+}
+
+static void s3_fs_upload_init_parts(struct s3_fs_upload *upload)
+{
+	struct s3_fs_upload_part *part;
+	uoff_t offset, part_size = upload->fs->multipart_size;
+	unsigned int i;
+
+	p_array_init(&upload->parts, upload->pool,
+		     upload->size / part_size + 1);
+	for (offset = 0; offset < upload->size; offset += part_size) {
+		part = array_append_space(&upload->parts);
+		part->upload = upload;
+		part->number = array_count(&upload->parts);
+		part->offset = offset;
+		part->size = I_MIN(part_size, upload->size - offset);
+	}
+	for (i = 0; i < upload->fs->max_parallel_parts; i++)
+		s3_fs_upload_send_part(upload);
+}
+
+static void
+s3_fs_upload_initiate_payload(const char *error, bool finished,
+			      struct s3_fs_upload *upload)
+{
+	const char *pos, *upload_id;
+
+	if (!finished)
+		return;
+	upload->payload = NULL;
+
+	if (error != NULL) {
+		s3_fs_upload_finish(upload, -1, EIO, error);
+		return;
+	}
+	pos = str_c(upload->body);
+	upload_id = s3_xml_find_value(&pos, "UploadId");
+	if (upload_id == NULL) {
+		s3_fs_upload_finish(upload, -1, EIO,
+			"CreateMultipartUpload response is missing UploadId");
+		return;
+	}
+	upload->upload_id = p_strdup(upload->pool, upload_id);
+	s3_fs_upload_init_parts(upload);
+}
+
+static void
+s3_fs_upload_initiate_response(const struct http_response *response,
+			       struct s3_fs_upload *upload)
+{
+	upload->req = NULL;
+	s3_fs_request_finished(upload->fs);
+
+	if (!http_response_is_success(response)) {
+		s3_fs_upload_fail(upload, response);
+		return;
+	}
+	if (response->payload == NULL) {
+		s3_fs_upload_finish(upload, -1, EIO,
+			"CreateMultipartUpload response is empty");
+		return;
+	}
+	upload->payload = s3_fs_payload_read(upload->fs, response->payload,
+		upload->body, S3_MAX_RESPONSE_BODY_SIZE,
+		s3_fs_upload_initiate_payload, upload);
+}
+
+static void s3_fs_upload_initiate(struct s3_fs_upload *upload)
+{
+	ARRAY_TYPE(s3_auth_header_array) headers;
+
+	t_array_init(&headers, 8);
+	s3_fs_upload_get_headers(upload, &headers);
+	upload->body = str_new(upload->pool, 1024);
+	upload->req = s3_fs_request_init(upload->fs, "POST", upload->file->key,
+					 "uploads", array_front(&headers),
+					 array_count(&headers), FALSE,
+					 s3_fs_upload_initiate_response,
+					 upload);
+	s3_fs_request_submit(upload->fs, upload->req);
+}
+
+void s3_fs_upload_start(struct s3_fs_file *file, struct istream *input)
+{
+	struct s3_fs_upload *upload;
+	pool_t pool;
+	int ret;
+
+	i_assert(file->upload == NULL);
+
+	pool = pool_alloconly_create("fs s3 upload", 1024);
+	upload = p_new(pool, struct s3_fs_upload, 1);
+	upload->pool = pool;
+	upload->file = file;
+	upload->fs = S3_FS(file->file.fs);
+	upload->input = input;
+	i_stream_ref(input);
+	file->upload = upload;
+
+	if ((ret = i_stream_get_size(input, TRUE, &upload->size)) <= 0) {
+		s3_fs_upload_finish(upload, -1, input->stream_errno != 0 ?
+				    input->stream_errno : EIO,
+				    t_strdup_printf("i_stream_get_size(%s) failed: %s",
+						    i_stream_get_name(input),
+						    i_stream_get_error(input)));
+	} else if (upload->size < upload->fs->multipart_size)
+		s3_fs_upload_put(upload);
+	else
+		s3_fs_upload_initiate(upload);
+}
+
+static void
+s3_fs_upload_abort_response(const struct http_response *response,
+			    struct s3_fs *fs)
+{
+	s3_fs_request_finished(fs);
+	if (!http_response_is_success(response)) {
+		e_warning(fs->fs.event,
+			  "AbortMultipartUpload failed: %s",
+			  http_response_get_message(response));
+	}
+}
+
+void s3_fs_upload_abort(struct s3_fs_file *file)
+{
+	struct s3_fs_upload *upload = file->upload;
+	struct s3_fs_upload_part *part;
+	struct http_client_request *req;
+
+	if (upload == NULL)
+		return;
+	file->upload = NULL;
+
+	s3_fs_request_abort(upload->fs, &upload->req);
+	s3_fs_payload_abort(&upload->payload);
+	if (array_is_created(&upload->parts)) {
+		array_foreach_modifiable(&upload->parts, part)
+			s3_fs_request_abort(upload->fs, &part->req);
+	}
+	if (upload->upload_id != NULL && !upload->completed) {
+		/* remove the already uploaded parts */
+		string_t *query = t_str_new(64);
+		str_append(query, "uploadId=");
+		s3_uri_encode(query, upload->upload_id, TRUE);
+		req = s3_fs_request_init(upload->fs, "DELETE", file->key,
+					 str_c(query), NULL, 0, FALSE,
+					 s3_fs_upload_abort_response,
+					 upload->fs);
+		s3_fs_request_submit(upload->fs, req);
+	}
+	i_stream_unref(&upload->input);
+	pool_unref(&upload->pool);
+}
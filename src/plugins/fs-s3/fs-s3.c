@@ -0,0 +1,1080 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "guid.h"
+#include "llist.h"
+#include "str.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-temp.h"
+#include "http-url.h"
+#include "http-date.h"
+#include "http-response.h"
+#include "settings-parser.h"
+#include "fs-s3-private.h"
+
+#include <sys/stat.h>
+
+#define S3_METADATA_HEADER_PREFIX "x-amz-meta-"
+
+struct s3_fs_payload {
+	struct s3_fs_payload *prev, *next;
+
+	struct s3_fs *fs;
+	struct istream *input;
+	struct io *io;
+	buffer_t *buf;
+	size_t max_size;
+
+	s3_fs_payload_callback_t *callback;
+	void *context;
+};
+
+static struct fs *fs_s3_alloc(void)
+{
+	struct s3_fs *fs;
+
+	fs = i_new(struct s3_fs, 1);
+	fs->fs = fs_class_s3;
+	fs->pool = pool_alloconly_create("fs s3", 1024);
+	return &fs->fs;
+}
+
+static int
+fs_s3_parse_size(const char *value, uoff_t *size_r, const char **error_r)
+{
+	if (settings_get_size(value, size_r, error_r) < 0)
+		return -1;
+	if (*size_r == 0) {
+		*error_r = "Size must be larger than 0";
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_s3_init(struct fs *_fs, const char *args, const struct fs_settings *set,
+	   const char **error_r)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	struct http_client_settings http_set;
+	struct http_url *url = NULL;
+	const char *const *tmp, *bucket = NULL, *error;
+	unsigned int max_connections = S3_DEFAULT_MAX_CONNECTIONS;
+	unsigned int timeout_msecs = S3_DEFAULT_TIMEOUT_MSECS;
+	unsigned int max_attempts = S3_DEFAULT_MAX_ATTEMPTS;
+
+	fs->range_size = S3_DEFAULT_RANGE_SIZE;
+	fs->max_parallel_ranges = S3_DEFAULT_MAX_PARALLEL_RANGES;
+	fs->multipart_size = S3_DEFAULT_MULTIPART_SIZE;
+	fs->max_parallel_parts = S3_DEFAULT_MAX_PARALLEL_PARTS;
+	fs->auth.region = "us-east-1";
+
+	tmp = t_strsplit_spaces(args, " ");
+	for (; *tmp != NULL; tmp++) {
+		const char *arg = *tmp;
+		const char *value = strchr(arg, '=');
+		int ret = 0;
+
+		if (value == NULL) {
+			*error_r = t_strdup_printf("Unknown arg '%s'", arg);
+			return -1;
+		}
+		value++;
+
+		if (str_begins(arg, "url=")) {
+			if (http_url_parse(value, NULL, 0, fs->pool,
+					   &url, &error) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid url '%s': %s", value, error);
+				return -1;
+			}
+		} else if (str_begins(arg, "bucket=")) {
+			bucket = value;
+		} else if (str_begins(arg, "prefix=")) {
+			fs->key_prefix = p_strdup(fs->pool, value);
+		} else if (str_begins(arg, "access_key=")) {
+			fs->auth.access_key = value;
+		} else if (str_begins(arg, "secret_key=")) {
+			fs->auth.secret_key = value;
+		} else if (str_begins(arg, "region=")) {
+			fs->auth.region = value;
+		} else if (str_begins(arg, "range_size=")) {
+			ret = fs_s3_parse_size(value, &fs->range_size, &error);
+		} else if (str_begins(arg, "max_parallel_ranges=")) {
+			if (str_to_uint(value, &fs->max_parallel_ranges) < 0 ||
+			    fs->max_parallel_ranges == 0) {
+				error = "Invalid number";
+				ret = -1;
+			}
+		} else if (str_begins(arg, "multipart_size=")) {
+			ret = fs_s3_parse_size(value, &fs->multipart_size,
+					       &error);
+			if (ret == 0 &&
+			    fs->multipart_size < S3_MIN_MULTIPART_SIZE) {
+				error = "Parts must be at least 5 MB";
+				ret = -1;
+			}
+		} else if (str_begins(arg, "max_parallel_parts=")) {
+			if (str_to_uint(value, &fs->max_parallel_parts) < 0 ||
+			    fs->max_parallel_parts == 0) {
+				error = "Invalid number";
+				ret = -1;
+			}
+		} else if (str_begins(arg, "max_connections=")) {
+			if (str_to_uint(value, &max_connections) < 0 ||
+			    max_connections == 0) {
+				error = "Invalid number";
+				ret = -1;
+			}
+		} else if (str_begins(arg, "timeout_msecs=")) {
+			if (str_to_uint(value, &timeout_msecs) < 0) {
+				error = "Invalid number";
+				ret = -1;
+			}
+		} else if (str_begins(arg, "max_attempts=")) {
+			if (str_to_uint(value, &max_attempts) < 0 ||
+			    max_attempts == 0) {
+				error = "Invalid number";
+				ret = -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Unknown arg '%s'", arg);
+			return -1;
+		}
+		if (ret < 0) {
+			*error_r = t_strdup_printf("Invalid %s: %s", arg, error);
+			return -1;
+		}
+	}
+	if (url == NULL) {
+		*error_r = "url parameter missing";
+		return -1;
+	}
+	if (fs->auth.access_key == NULL || fs->auth.secret_key == NULL) {
+		*error_r = "access_key and secret_key parameters are required";
+		return -1;
+	}
+	fs->auth.access_key = p_strdup(fs->pool, fs->auth.access_key);
+	fs->auth.secret_key = p_strdup(fs->pool, fs->auth.secret_key);
+	fs->auth.region = p_strdup(fs->pool, fs->auth.region);
+
+	fs->url = url;
+	fs->authority = p_strdup(fs->pool, http_url_create_authority(url));
+	/* With bucket=name the requests are path-style, otherwise the bucket
+	   is expected to be part of the hostname. */
+	fs->bucket_path = bucket == NULL ? "/" :
+		p_strdup_printf(fs->pool, "/%s/", bucket);
+	if (fs->key_prefix == NULL)
+		fs->key_prefix = "";
+
+	i_zero(&http_set);
+	http_set.dns_client = set->dns_client;
+	if (http_set.dns_client == NULL && set->base_dir != NULL) {
+		http_set.dns_client_socket_path =
+			t_strconcat(set->base_dir, "/dns-client", NULL);
+	}
+	http_set.ssl = set->ssl_client_set;
+	http_set.max_idle_time_msecs = S3_MAX_IDLE_TIME_MSECS;
+	http_set.max_parallel_connections = max_connections;
+	http_set.max_pipelined_requests = 1;
+	http_set.max_attempts = max_attempts;
+	http_set.request_timeout_msecs = timeout_msecs;
+	http_set.connect_timeout_msecs = timeout_msecs;
+	http_set.event_parent = _fs->event;
+	http_set.debug = set->debug;
+	fs->client = http_client_init(&http_set);
+	return 0;
+}
+
+static void fs_s3_deinit(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+
+	/* files and iterators have already been closed */
+	i_assert(fs->payloads == NULL);
+	if (fs->client != NULL)
+		http_client_deinit(&fs->client);
+}
+
+static void fs_s3_free(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+
+	pool_unref(&fs->pool);
+	i_free(fs);
+}
+
+static enum fs_properties fs_s3_get_properties(struct fs *fs ATTR_UNUSED)
+{
+	return FS_PROPERTY_METADATA | FS_PROPERTY_STAT | FS_PROPERTY_ITER |
+		FS_PROPERTY_RELIABLEITER | FS_PROPERTY_ASYNC;
+}
+
+static void fs_s3_switch_payload_ios(struct s3_fs *fs)
+{
+	struct s3_fs_payload *payload;
+
+	for (payload = fs->payloads; payload != NULL; payload = payload->next) {
+		if (payload->io != NULL) {
+			payload->io = io_loop_move_io(&payload->io);
+			/* the pending state isn't moved with the io */
+			i_stream_set_input_pending(payload->input, TRUE);
+		}
+	}
+}
+
+static bool fs_s3_switch_ioloop(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+
+	(void)http_client_switch_ioloop(fs->client);
+	fs_s3_switch_payload_ios(fs);
+	return fs->pending_count > 0;
+}
+
+void s3_fs_progress(struct s3_fs *fs)
+{
+	if (fs->fs.wait_ioloop != NULL)
+		io_loop_stop(fs->fs.wait_ioloop);
+}
+
+void s3_fs_wait_async(struct fs *_fs)
+{
+	struct s3_fs *fs = S3_FS(_fs);
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	if (fs->pending_count == 0)
+		return;
+
+	i_assert(fs->fs.wait_ioloop == NULL);
+	fs->fs.wait_ioloop = io_loop_create();
+	(void)fs_s3_switch_ioloop(_fs);
+	io_loop_run(fs->fs.wait_ioloop);
+
+	io_loop_set_current(prev_ioloop);
+	(void)fs_s3_switch_ioloop(_fs);
+	io_loop_set_current(fs->fs.wait_ioloop);
+	io_loop_destroy(&fs->fs.wait_ioloop);
+}
+
+void s3_fs_request_submit(struct s3_fs *fs, struct http_client_request *req)
+{
+	fs->pending_count++;
+	http_client_request_submit(req);
+}
+
+void s3_fs_request_finished(struct s3_fs *fs)
+{
+	i_assert(fs->pending_count > 0);
+	fs->pending_count--;
+	s3_fs_progress(fs);
+}
+
+void s3_fs_request_abort(struct s3_fs *fs, struct http_client_request **req)
+{
+	if (*req == NULL)
+		return;
+	http_client_request_abort(req);
+	s3_fs_request_finished(fs);
+}
+
+int s3_fs_response_errno(const struct http_response *response)
+{
+	switch (response->status) {
+	case 404:
+		return ENOENT;
+	case 401:
+	case 403:
+		return EACCES;
+	case 412:
+		return EEXIST;
+	default:
+		return EIO;
+	}
+}
+
+const char *s3_fs_response_error(const struct http_response *response)
+{
+	return t_strdup_printf("S3 request failed: %s",
+			       http_response_get_message(response));
+}
+
+static void s3_fs_payload_free(struct s3_fs_payload **_payload)
+{
+	struct s3_fs_payload *payload = *_payload;
+	struct s3_fs *fs = payload->fs;
+
+	*_payload = NULL;
+	DLLIST_REMOVE(&fs->payloads, payload);
+	io_remove(&payload->io);
+	i_stream_unref(&payload->input);
+	i_free(payload);
+
+	i_assert(fs->pending_count > 0);
+	fs->pending_count--;
+}
+
+static void s3_fs_payload_input(struct s3_fs_payload *payload)
+{
+	struct s3_fs *fs = payload->fs;
+	s3_fs_payload_callback_t *callback = payload->callback;
+	void *context = payload->context;
+	const unsigned char *data;
+	const char *error = NULL;
+	size_t size;
+	bool appended = FALSE;
+	ssize_t ret;
+
+	while ((ret = i_stream_read_more(payload->input, &data, &size)) > 0) {
+		if (payload->buf->used + size > payload->max_size) {
+			error = t_strdup_printf(
+				"Response body larger than %zu bytes",
+				payload->max_size);
+			break;
+		}
+		buffer_append(payload->buf, data, size);
+		i_stream_skip(payload->input, size);
+		appended = TRUE;
+	}
+	if (ret == 0) {
+		if (appended)
+			callback(NULL, FALSE, context);
+		s3_fs_progress(fs);
+		return;
+	}
+	if (error == NULL && payload->input->stream_errno != 0) {
+		error = t_strdup_printf("read(%s) failed: %s",
+					i_stream_get_name(payload->input),
+					i_stream_get_error(payload->input));
+	}
+	s3_fs_payload_free(&payload);
+	callback(error, TRUE, context);
+	s3_fs_progress(fs);
+}
+
+void s3_fs_payload_abort(struct s3_fs_payload **_payload)
+{
+	struct s3_fs_payload *payload = *_payload;
+
+	if (payload == NULL)
+		return;
+	struct s3_fs *fs = payload->fs;
+	s3_fs_payload_free(_payload);
+	s3_fs_progress(fs);
+}
+
+static void s3_xml_unescape(string_t *dest, const char *src, size_t len)
+{
+	static const struct {
+		const char *name;
+		char chr;
+	} entities[] = {
+		{ "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' },
+		{ "&quot;", '"' }, { "&apos;", '\'' },
+	};
+	const char *end = src + len;
+	unsigned int i;
+
+	while (src < end) {
+		if (*src == '&') {
+			for (i = 0; i < N_ELEMENTS(entities); i++) {
+				size_t elen = strlen(entities[i].name);
+				if ((size_t)(end - src) >= elen &&
+				    strncmp(src, entities[i].name, elen) == 0)
+					break;
+			}
+			if (i < N_ELEMENTS(entities)) {
+				str_append_c(dest, entities[i].chr);
+				src += strlen(entities[i].name);
+				continue;
+			}
+		}
+		str_append_c(dest, *src++);
+	}
+}
+
+const char *s3_xml_find_value(const char **pos, const char *tag)
+{
+	const char *start_tag = t_strdup_printf("<%s>", tag);
+	const char *end_tag = t_strdup_printf("</%s>", tag);
+	const char *start, *end;
+	string_t *value;
+
+	start = strstr(*pos, start_tag);
+	if (start == NULL)
+		return NULL;
+	start += strlen(start_tag);
+	end = strstr(start, end_tag);
+	if (end == NULL)
+		return NULL;
+	*pos = end + strlen(end_tag);
+
+	value = t_str_new(end - start + 1);
+	s3_xml_unescape(value, start, end - start);
+	return str_c(value);
+}
+
+static struct fs_file *fs_s3_file_alloc(void)
+{
+	struct s3_fs_file *file;
+	pool_t pool;
+
+	pool = pool_alloconly_create("fs s3 file", 256);
+	file = p_new(pool, struct s3_fs_file, 1);
+	file->pool = pool;
+	return &file->file;
+}
+
+static void
+fs_s3_file_init(struct fs_file *_file, const char *path,
+		enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs *fs = S3_FS(_file->fs);
+	guid_128_t guid;
+
+	i_assert(mode != FS_OPEN_MODE_APPEND); /* not supported */
+
+	if (mode != FS_OPEN_MODE_CREATE_UNIQUE_128)
+		file->file.path = p_strdup(file->pool, path);
+	else {
+		guid_128_generate(guid);
+		file->file.path = p_strdup_printf(file->pool, "%s/%s", path,
+						  guid_128_to_string(guid));
+	}
+	file->file.flags = flags;
+	file->open_mode = mode;
+	/* object keys don't begin with '/' */
+	file->key = p_strconcat(file->pool, fs->key_prefix,
+				file->file.path + strspn(file->file.path, "/"),
+				NULL);
+}
+
+static void fs_s3_file_close(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs *fs = S3_FS(_file->fs);
+
+	s3_fs_request_abort(fs, &file->op_req);
+	s3_fs_upload_abort(file);
+	i_stream_unref(&file->prefetch_input);
+	file->op = S3_FS_OP_NONE;
+}
+
+static void fs_s3_file_deinit(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	i_assert(_file->output == NULL);
+
+	fs_s3_file_close(_file);
+	o_stream_unref(&file->temp_output);
+	fs_file_free(_file);
+	pool_unref(&file->pool);
+}
+
+static void
+fs_s3_set_async_callback(struct fs_file *_file,
+			 fs_file_async_callback_t *callback, void *context)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	file->async_callback = callback;
+	file->async_context = context;
+}
+
+void s3_fs_file_op_finish(struct s3_fs_file *file, int ret, int op_errno,
+			  const char *error)
+{
+	file->op_finished = TRUE;
+	file->op_ret = ret;
+	file->op_errno = op_errno;
+	file->op_error = error == NULL ? NULL : p_strdup(file->pool, error);
+	if (file->async_callback != NULL)
+		file->async_callback(file->async_context);
+}
+
+int s3_fs_file_op_result(struct s3_fs_file *file, enum s3_fs_op op)
+{
+	i_assert(file->op == op);
+
+	if (!file->op_finished) {
+		if ((file->file.flags & FS_OPEN_FLAG_ASYNC) != 0) {
+			fs_file_set_error_async(&file->file);
+			return -1;
+		}
+		while (!file->op_finished)
+			s3_fs_wait_async(file->file.fs);
+	}
+	file->op = S3_FS_OP_NONE;
+	file->op_finished = FALSE;
+	if (file->op_ret < 0) {
+		fs_set_error(file->file.event, file->op_errno, "%s",
+			     file->op_error);
+	}
+	return file->op_ret;
+}
+
+static void
+fs_s3_head_set_metadata(struct s3_fs_file *file,
+			const struct http_response *response)
+{
+	const ARRAY_TYPE(http_header_field) *fields;
+	const struct http_header_field *field;
+	const size_t prefix_len = strlen(S3_METADATA_HEADER_PREFIX);
+
+	fs_metadata_init_or_clear(&file->file);
+	fields = http_response_header_get_fields(response);
+	if (fields == NULL)
+		return;
+	array_foreach(fields, field) {
+		if (strncasecmp(field->name, S3_METADATA_HEADER_PREFIX,
+				prefix_len) == 0) {
+			fs_default_set_metadata(&file->file,
+				field->name + prefix_len, field->value);
+		}
+	}
+}
+
+static void
+fs_s3_head_response(const struct http_response *response,
+		    struct s3_fs_file *file)
+{
+	const char *value;
+	uoff_t size = 0;
+
+	file->op_req = NULL;
+	s3_fs_request_finished(S3_FS(file->file.fs));
+
+	if (response->status == 404) {
+		s3_fs_file_op_finish(file, 0, 0, NULL);
+		return;
+	}
+	if (!http_response_is_success(response)) {
+		s3_fs_file_op_finish(file, -1, s3_fs_response_errno(response),
+				     s3_fs_response_error(response));
+		return;
+	}
+	value = http_response_header_get(response, "Content-Length");
+	if (value != NULL && str_to_uoff(value, &size) < 0) {
+		s3_fs_file_op_finish(file, -1, EIO, t_strdup_printf(
+			"Invalid Content-Length: %s", value));
+		return;
+	}
+	file->size = size;
+	file->mtime = response->date;
+	value = http_response_header_get(response, "Last-Modified");
+	if (value != NULL)
+		(void)http_date_parse((const unsigned char *)value,
+				      strlen(value), &file->mtime);
+	fs_s3_head_set_metadata(file, response);
+	file->head_done = TRUE;
+	s3_fs_file_op_finish(file, 1, 0, NULL);
+}
+
+/* Returns 1 if object exists, 0 if not, -1 on error. */
+static int fs_s3_head(struct s3_fs_file *file)
+{
+	struct s3_fs *fs = S3_FS(file->file.fs);
+
+	if (file->op == S3_FS_OP_NONE) {
+		file->op = S3_FS_OP_HEAD;
+		file->op_req = s3_fs_request_init(fs, "HEAD", file->key, NULL,
+						  NULL, 0, FALSE,
+						  fs_s3_head_response, file);
+		s3_fs_request_submit(fs, file->op_req);
+	}
+	return s3_fs_file_op_result(file, S3_FS_OP_HEAD);
+}
+
+static int
+fs_s3_get_metadata(struct fs_file *_file, enum fs_get_metadata_flags flags,
+		   const ARRAY_TYPE(fs_metadata) **metadata_r)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	int ret;
+
+	if (!file->head_done &&
+	    (flags & FS_GET_METADATA_FLAG_LOADED_ONLY) == 0) {
+		if ((ret = fs_s3_head(file)) < 0)
+			return -1;
+		if (ret == 0) {
+			fs_set_error(_file->event, ENOENT,
+				     "Object %s doesn't exist", file->key);
+			return -1;
+		}
+	}
+	fs_metadata_init(_file);
+	*metadata_r = &_file->metadata;
+	return 0;
+}
+
+static bool fs_s3_prefetch(struct fs_file *_file, uoff_t length ATTR_UNUSED)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	/* start the GET already, it's returned by the following
+	   read_stream() */
+	if (file->prefetch_input == NULL)
+		file->prefetch_input = i_stream_create_s3(file);
+	return FALSE;
+}
+
+static struct istream *
+fs_s3_read_stream(struct fs_file *_file, size_t max_buffer_size ATTR_UNUSED)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct istream *input;
+
+	if (file->prefetch_input != NULL) {
+		input = file->prefetch_input;
+		file->prefetch_input = NULL;
+		return input;
+	}
+	return i_stream_create_s3(file);
+}
+
+static void fs_s3_write_stream(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+
+	i_assert(_file->output == NULL);
+
+	file->temp_output =
+		iostream_temp_create_named(_file->fs->temp_path_prefix, 0,
+					   fs_file_path(_file));
+	_file->output = file->temp_output;
+	o_stream_ref(_file->output);
+}
+
+static void fs_s3_write_rename_if_needed(struct s3_fs_file *file)
+{
+	struct s3_fs *fs = S3_FS(file->file.fs);
+	const char *new_fname;
+
+	new_fname = fs_metadata_find(&file->file.metadata,
+				     FS_METADATA_WRITE_FNAME);
+	if (new_fname == NULL)
+		return;
+
+	file->file.path = p_strdup(file->pool, new_fname);
+	file->key = p_strconcat(file->pool, fs->key_prefix,
+				new_fname + strspn(new_fname, "/"), NULL);
+}
+
+static int fs_s3_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct istream *input;
+	int ret;
+
+	if (file->op == S3_FS_OP_WRITE) {
+		/* continuing an async upload */
+		ret = s3_fs_file_op_result(file, S3_FS_OP_WRITE);
+		if (ret < 0 && errno == EAGAIN)
+			return 0;
+		s3_fs_upload_abort(file);
+		return ret < 0 ? -1 : 1;
+	}
+
+	if (_file->output != NULL)
+		o_stream_unref(&_file->output);
+	if (!success) {
+		o_stream_abort(file->temp_output);
+		o_stream_unref(&file->temp_output);
+		return -1;
+	}
+
+	fs_s3_write_rename_if_needed(file);
+	input = iostream_temp_finish(&file->temp_output, IO_BLOCK_SIZE);
+	if (input->stream_errno != 0) {
+		fs_set_error(_file->event, input->stream_errno,
+			     "read(%s) failed: %s", i_stream_get_name(input),
+			     i_stream_get_error(input));
+		i_stream_unref(&input);
+		return -1;
+	}
+	file->op = S3_FS_OP_WRITE;
+	s3_fs_upload_start(file, input);
+	i_stream_unref(&input);
+
+	ret = s3_fs_file_op_result(file, S3_FS_OP_WRITE);
+	if (ret < 0 && errno == EAGAIN)
+		return 0;
+	s3_fs_upload_abort(file);
+	return ret < 0 ? -1 : 1;
+}
+
+static int fs_s3_exists(struct fs_file *_file)
+{
+	return fs_s3_head(S3_FILE(_file));
+}
+
+static int fs_s3_stat(struct fs_file *_file, struct stat *st_r)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	int ret;
+
+	if ((ret = fs_s3_head(file)) < 0)
+		return -1;
+	if (ret == 0) {
+		fs_set_error(_file->event, ENOENT,
+			     "Object %s doesn't exist", file->key);
+		return -1;
+	}
+	i_zero(st_r);
+	st_r->st_mode = S_IFREG | 0600;
+	st_r->st_nlink = 1;
+	st_r->st_size = file->size;
+	st_r->st_mtime = file->mtime;
+	return 0;
+}
+
+static void
+fs_s3_delete_response(const struct http_response *response,
+		      struct s3_fs_file *file)
+{
+	file->op_req = NULL;
+	s3_fs_request_finished(S3_FS(file->file.fs));
+
+	if (!http_response_is_success(response)) {
+		s3_fs_file_op_finish(file, -1, s3_fs_response_errno(response),
+				     s3_fs_response_error(response));
+	} else {
+		file->head_done = FALSE;
+		s3_fs_file_op_finish(file, 0, 0, NULL);
+	}
+}
+
+static int fs_s3_delete(struct fs_file *_file)
+{
+	struct s3_fs_file *file = S3_FILE(_file);
+	struct s3_fs *fs = S3_FS(_file->fs);
+
+	if (file->op == S3_FS_OP_NONE) {
+		file->op = S3_FS_OP_DELETE;
+		file->op_req = s3_fs_request_init(fs, "DELETE", file->key,
+						  NULL, NULL, 0, FALSE,
+						  fs_s3_delete_response, file);
+		s3_fs_request_submit(fs, file->op_req);
+	}
+	return s3_fs_file_op_result(file, S3_FS_OP_DELETE);
+}
+
+static struct fs_iter *fs_s3_iter_alloc(void)
+{
+	struct s3_fs_iter *iter = i_new(struct s3_fs_iter, 1);
+	return &iter->iter;
+}
+
+static void fs_s3_iter_parse(struct s3_fs_iter *iter, const char *body)
+{
+	bool dirs = (iter->iter.flags & FS_ITER_FLAG_DIRS) != 0;
+	const char *pos, *section, *name, *value;
+	const size_t prefix_len = strlen(iter->prefix);
+
+	/* <ListBucketResult>
+	     <IsTruncated>true</IsTruncated>
+	     <Contents><Key>prefix/name</Key>...</Contents>
+	     <CommonPrefixes><Prefix>prefix/dir/</Prefix></CommonPrefixes>
+	     <NextContinuationToken>...</NextContinuationToken>
+	   </ListBucketResult> */
+	section = dirs ? "CommonPrefixes" : "Contents";
+	pos = body;
+	while ((value = s3_xml_find_value(&pos, section)) != NULL) {
+		const char *p = value;
+
+		name = s3_xml_find_value(&p, dirs ? "Prefix" : "Key");
+		if (name == NULL || strncmp(name, iter->prefix, prefix_len) != 0)
+			continue;
+		name += prefix_len;
+		if (dirs)
+			name = t_strcut(name, '/');
+		if (name[0] == '\0')
+			continue;
+		name = p_strdup(iter->pool, name);
+		array_push_back(&iter->names, &name);
+	}
+
+	i_free(iter->continuation_token);
+	pos = body;
+	value = s3_xml_find_value(&pos, "IsTruncated");
+	if (value != NULL && strcmp(value, "true") == 0) {
+		pos = body;
+		value = s3_xml_find_value(&pos, "NextContinuationToken");
+		if (value != NULL)
+			iter->continuation_token = i_strdup(value);
+	}
+	if (iter->continuation_token == NULL)
+		iter->finished = TRUE;
+}
+
+struct s3_fs_iter_response {
+	struct s3_fs_iter *iter;
+	struct s3_fs_payload *payload;
+	buffer_t *body;
+};
+
+static void fs_s3_iter_async_callback(struct s3_fs_iter *iter)
+{
+	if (iter->iter.async_callback != NULL)
+		iter->iter.async_callback(iter->iter.async_context);
+}
+
+static void
+fs_s3_iter_payload_callback(const char *error, bool finished,
+			    struct s3_fs_iter *iter)
+{
+	if (!finished)
+		return;
+
+	if (error != NULL) {
+		iter->errno_err = EIO;
+		iter->error = p_strdup(iter->pool, error);
+		iter->finished = TRUE;
+	} else T_BEGIN {
+		fs_s3_iter_parse(iter, str_c(iter->response->body));
+	} T_END;
+	buffer_free(&iter->response->body);
+	i_free(iter->response);
+	fs_s3_iter_async_callback(iter);
+}
+
+static void
+fs_s3_iter_response(const struct http_response *response,
+		    struct s3_fs_iter *iter)
+{
+	struct s3_fs *fs = S3_FS(iter->iter.fs);
+
+	iter->req = NULL;
+	s3_fs_request_finished(fs);
+
+	if (!http_response_is_success(response) || response->payload == NULL) {
+		iter->errno_err = s3_fs_response_errno(response);
+		iter->error = p_strdup(iter->pool,
+				       s3_fs_response_error(response));
+		iter->finished = TRUE;
+		fs_s3_iter_async_callback(iter);
+		return;
+	}
+	iter->response = i_new(struct s3_fs_iter_response, 1);
+	iter->response->body = buffer_create_dynamic(default_pool, 4096);
+	iter->response->payload =
+		s3_fs_payload_read(fs, response->payload, iter->response->body,
+				   S3_MAX_RESPONSE_BODY_SIZE,
+				   fs_s3_iter_payload_callback, iter);
+}
+
+static void fs_s3_iter_request(struct s3_fs_iter *iter)
+{
+	struct s3_fs *fs = S3_FS(iter->iter.fs);
+	string_t *query = t_str_new(128);
+
+	/* the query parameters are in sorted order already */
+	if (iter->continuation_token != NULL) {
+		str_append(query, "continuation-token=");
+		s3_uri_encode(query, iter->continuation_token, TRUE);
+		str_append_c(query, '&');
+	}
+	str_append(query, "delimiter=%2F&list-type=2&prefix=");
+	s3_uri_encode(query, iter->prefix, TRUE);
+
+	iter->req = s3_fs_request_init(fs, "GET", "", str_c(query), NULL, 0,
+				       FALSE, fs_s3_iter_response, iter);
+	s3_fs_request_submit(fs, iter->req);
+}
+
+static void
+fs_s3_iter_init(struct fs_iter *_iter, const char *path,
+		enum fs_iter_flags flags ATTR_UNUSED)
+{
+	struct s3_fs_iter *iter = S3_ITER(_iter);
+	struct s3_fs *fs = S3_FS(_iter->fs);
+
+	iter->pool = pool_alloconly_create("fs s3 iter", 1024);
+	path += strspn(path, "/");
+	if (path[0] != '\0' && path[strlen(path)-1] != '/')
+		path = t_strconcat(path, "/", NULL);
+	iter->prefix = p_strconcat(iter->pool, fs->key_prefix, path, NULL);
+	p_array_init(&iter->names, iter->pool, 64);
+	fs_s3_iter_request(iter);
+}
+
+static const char *fs_s3_iter_next(struct fs_iter *_iter)
+{
+	struct s3_fs_iter *iter = S3_ITER(_iter);
+	const char *const *names;
+	unsigned int count;
+
+	for (;;) {
+		names = array_get(&iter->names, &count);
+		if (iter->name_idx < count) {
+			_iter->async_have_more = TRUE;
+			return names[iter->name_idx++];
+		}
+		array_clear(&iter->names);
+		iter->name_idx = 0;
+
+		if (iter->req == NULL && iter->response == NULL) {
+			if (iter->finished)
+				break;
+			/* request the next page */
+			fs_s3_iter_request(iter);
+		}
+		if ((_iter->flags & FS_ITER_FLAG_ASYNC) != 0) {
+			_iter->async_have_more = TRUE;
+			return NULL;
+		}
+		s3_fs_wait_async(_iter->fs);
+	}
+	_iter->async_have_more = FALSE;
+	return NULL;
+}
+
+static int fs_s3_iter_deinit(struct fs_iter *_iter)
+{
+	struct s3_fs_iter *iter = S3_ITER(_iter);
+	struct s3_fs *fs = S3_FS(_iter->fs);
+	int ret = 0;
+
+	s3_fs_request_abort(fs, &iter->req);
+	if (iter->response != NULL) {
+		s3_fs_payload_abort(&iter->response->payload);
+		buffer_free(&iter->response->body);
+		i_free(iter->response);
+	}
+	if (iter->error != NULL) {
+		fs_set_error(_iter->event, iter->errno_err,
+			     "List %s failed: %s", iter->prefix, iter->error);
+		ret = -1;
+	}
+	i_free(iter->continuation_token);
+	pool_unref(&iter->pool);
+	return ret;
+}
+
+#undef s3_fs_request_init
+struct http_client_request *
+s3_fs_request_init(struct s3_fs *fs, const char *method, const char *key,
+		   const char *query, const struct s3_auth_header *headers,
+		   unsigned int headers_count, bool payload,
+		   http_client_request_callback_t *callback, void *context)
+{
+	struct http_client_request *req;
+	ARRAY(struct s3_auth_header) all_headers;
+	struct s3_auth_header *header;
+	struct s3_auth_request auth_req;
+	string_t *path, *target;
+	unsigned int i;
+
+	path = t_str_new(128);
+	s3_uri_encode(path, fs->bucket_path, FALSE);
+	s3_uri_encode(path, key, FALSE);
+	target = t_str_new(str_len(path) + 64);
+	str_append_str(target, path);
+	if (query != NULL)
+		str_printfa(target, "?%s", query);
+
+	i_zero(&auth_req);
+	auth_req.method = method;
+	auth_req.path = str_c(path);
+	auth_req.query = query;
+	auth_req.payload_sha256 = payload ? S3_AUTH_UNSIGNED_PAYLOAD :
+		S3_AUTH_EMPTY_PAYLOAD_SHA256;
+	auth_req.timestamp = ioloop_time;
+
+	t_array_init(&all_headers, headers_count + 3);
+	header = array_append_space(&all_headers);
+	header->name = "host";
+	header->value = fs->authority;
+	header = array_append_space(&all_headers);
+	header->name = "x-amz-date";
+	header->value = s3_auth_get_date(auth_req.timestamp);
+	header = array_append_space(&all_headers);
+	header->name = "x-amz-content-sha256";
+	header->value = auth_req.payload_sha256;
+	array_append(&all_headers, headers, headers_count);
+	auth_req.headers = array_get(&all_headers, &auth_req.headers_count);
+
+	req = http_client_request(fs->client, method, fs->url->host.name,
+				  str_c(target), callback, context);
+	if (fs->url->port != 0)
+		http_client_request_set_port(req, fs->url->port);
+	http_client_request_set_ssl(req, fs->url->have_ssl);
+	/* host is added by lib-http */
+	for (i = 1; i < auth_req.headers_count; i++) {
+		http_client_request_add_header(req, auth_req.headers[i].name,
+					       auth_req.headers[i].value);
+	}
+	http_client_request_add_header(req, "Authorization",
+		s3_auth_get_authorization(&fs->auth, &auth_req));
+	return req;
+}
+
+#undef s3_fs_payload_read
+struct s3_fs_payload *
+s3_fs_payload_read(struct s3_fs *fs, struct istream *input, buffer_t *buf,
+		   size_t max_size, s3_fs_payload_callback_t *callback,
+		   void *context)
+{
+	struct s3_fs_payload *payload;
+
+	payload = i_new(struct s3_fs_payload, 1);
+	payload->fs = fs;
+	payload->input = input;
+	payload->buf = buf;
+	payload->max_size = max_size;
+	payload->callback = callback;
+	payload->context = context;
+	i_stream_ref(input);
+	DLLIST_PREPEND(&fs->payloads, payload);
+	fs->pending_count++;
+
+	/* don't call the callback before returning */
+	payload->io = io_add_istream(input, s3_fs_payload_input, payload);
+	i_stream_set_input_pending(input, TRUE);
+	return payload;
+}
+
+const struct fs fs_class_s3 = {
+	.name = "s3",
+	.v = {
+		fs_s3_alloc,
+		fs_s3_init,
+		fs_s3_deinit,
+		fs_s3_free,
+		fs_s3_get_properties,
+		fs_s3_file_alloc,
+		fs_s3_file_init,
+		fs_s3_file_deinit,
+		fs_s3_file_close,
+		NULL,
+		fs_s3_set_async_callback,
+		s3_fs_wait_async,
+		fs_default_set_metadata,
+		fs_s3_get_metadata,
+		fs_s3_prefetch,
+		NULL,
+		fs_s3_read_stream,
+		NULL,
+		fs_s3_write_stream,
+		fs_s3_write_stream_finish,
+		NULL,
+		NULL,
+		fs_s3_exists,
+		fs_s3_stat,
+		fs_default_copy,
+		NULL,
+		fs_s3_delete,
+		fs_s3_iter_alloc,
+		fs_s3_iter_init,
+		fs_s3_iter_next,
+		fs_s3_iter_deinit,
+		fs_s3_switch_ioloop,
+		NULL
+	}
+};
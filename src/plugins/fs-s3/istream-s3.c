@@ -0,0 +1,309 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "istream-private.h"
+#include "http-response.h"
+#include "fs-s3-private.h"
+
+/* Reads the object with parallel range GETs. The first request fetches the
+   first range_size bytes and returns the object's total size. After that up
+   to max_parallel_ranges ranges are being fetched at the same time. The ranges
+   are buffered in memory and returned in order. */
+
+struct s3_istream_range {
+	struct s3_istream *sstream;
+	uoff_t offset, size;
+
+	struct http_client_request *req;
+	struct s3_fs_payload *payload;
+	buffer_t *buf;
+	size_t read_pos;
+	bool finished;
+};
+
+struct s3_istream {
+	struct istream_private istream;
+	struct s3_fs *fs;
+	char *key;
+
+	/* Ranges being fetched, in offset order */
+	ARRAY(struct s3_istream_range *) ranges;
+	/* Offset of the next range that hasn't been requested yet */
+	uoff_t next_offset;
+	uoff_t size;
+	bool size_known;
+};
+
+static void i_stream_s3_request_range(struct s3_istream *sstream);
+
+static void
+i_stream_s3_set_error(struct s3_istream *sstream, int stream_errno,
+		      const char *error)
+{
+	if (sstream->istream.istream.stream_errno != 0)
+		return;
+	sstream->istream.istream.stream_errno = stream_errno;
+	io_stream_set_error(&sstream->istream.iostream, "%s", error);
+}
+
+static void i_stream_s3_range_free(struct s3_istream_range **_range)
+{
+	struct s3_istream_range *range = *_range;
+
+	*_range = NULL;
+	s3_fs_request_abort(range->sstream->fs, &range->req);
+	s3_fs_payload_abort(&range->payload);
+	buffer_free(&range->buf);
+	i_free(range);
+}
+
+static void i_stream_s3_wakeup(struct s3_istream *sstream)
+{
+	i_stream_set_input_pending(&sstream->istream.istream, TRUE);
+	s3_fs_progress(sstream->fs);
+}
+
+static void i_stream_s3_fill_ranges(struct s3_istream *sstream)
+{
+	if (sstream->istream.istream.stream_errno != 0)
+		return;
+	while (sstream->size_known &&
+	       sstream->next_offset < sstream->size &&
+	       array_count(&sstream->ranges) < sstream->fs->max_parallel_ranges)
+		i_stream_s3_request_range(sstream);
+}
+
+static void
+i_stream_s3_payload_callback(const char *error, bool finished,
+			     struct s3_istream_range *range)
+{
+	struct s3_istream *sstream = range->sstream;
+
+	if (finished) {
+		range->payload = NULL;
+		range->finished = TRUE;
+		if (error != NULL)
+			i_stream_s3_set_error(sstream, EIO, error);
+		else if (sstream->size_known &&
+			 range->buf->used != range->size) {
+			i_stream_s3_set_error(sstream, EIO, t_strdup_printf(
+				"Range %"PRIuUOFF_T"-%"PRIuUOFF_T" truncated: "
+				"got only %zu bytes", range->offset,
+				range->offset + range->size - 1,
+				range->buf->used));
+		}
+	}
+	i_stream_s3_wakeup(sstream);
+}
+
+static int
+i_stream_s3_parse_content_range(const char *value, uoff_t *size_r)
+{
+	const char *p;
+
+	/* bytes <start>-<end>/<size> */
+	if (value == NULL || !str_begins(value, "bytes "))
+		return -1;
+	p = strchr(value, '/');
+	if (p == NULL || str_to_uoff(p + 1, size_r) < 0)
+		return -1;
+	return 0;
+}
+
+static void
+i_stream_s3_range_response(const struct http_response *response,
+			   struct s3_istream_range *range)
+{
+	struct s3_istream *sstream = range->sstream;
+	const char *value;
+	uoff_t size;
+
+	range->req = NULL;
+	s3_fs_request_finished(sstream->fs);
+
+	if (response->status == 416 && range->offset == 0) {
+		/* empty object */
+		sstream->size = 0;
+		sstream->size_known = TRUE;
+		range->size = 0;
+		range->finished = TRUE;
+		i_stream_s3_wakeup(sstream);
+		return;
+	}
+	if (!http_response_is_success(response)) {
+		i_stream_s3_set_error(sstream, s3_fs_response_errno(response),
+				      s3_fs_response_error(response));
+		range->finished = TRUE;
+		i_stream_s3_wakeup(sstream);
+		return;
+	}
+
+	if (response->status != 206) {
+		/* the server returned the whole object */
+		if (range->offset != 0) {
+			i_stream_s3_set_error(sstream, EIO,
+				"Server ignored the Range header");
+			range->finished = TRUE;
+			i_stream_s3_wakeup(sstream);
+			return;
+		}
+		value = http_response_header_get(response, "Content-Length");
+		if (value == NULL || str_to_uoff(value, &size) < 0) {
+			/* size isn't known - read until EOF */
+			size = UOFF_T_MAX;
+		}
+		range->size = size;
+		sstream->size = size;
+		sstream->size_known = size != UOFF_T_MAX;
+		sstream->next_offset = size;
+	} else if (!sstream->size_known) {
+		value = http_response_header_get(response, "Content-Range");
+		if (i_stream_s3_parse_content_range(value, &size) < 0) {
+			i_stream_s3_set_error(sstream, EIO, t_strdup_printf(
+				"Invalid Content-Range: %s",
+				value == NULL ? "(missing)" : value));
+			range->finished = TRUE;
+			i_stream_s3_wakeup(sstream);
+			return;
+		}
+		sstream->size = size;
+		sstream->size_known = TRUE;
+		range->size = I_MIN(range->size, size);
+		sstream->next_offset = range->size;
+	}
+
+	if (response->payload == NULL) {
+		range->finished = TRUE;
+		i_stream_s3_wakeup(sstream);
+	} else {
+		range->payload = s3_fs_payload_read(sstream->fs,
+			response->payload, range->buf, SIZE_MAX,
+			i_stream_s3_payload_callback, range);
+	}
+	i_stream_s3_fill_ranges(sstream);
+}
+
+static void i_stream_s3_request_range(struct s3_istream *sstream)
+{
+	struct s3_istream_range *range;
+	struct s3_auth_header header;
+
+	range = i_new(struct s3_istream_range, 1);
+	range->sstream = sstream;
+	range->offset = sstream->next_offset;
+	range->size = sstream->fs->range_size;
+	if (sstream->size_known)
+		range->size = I_MIN(range->size, sstream->size - range->offset);
+	range->buf = buffer_create_dynamic(default_pool,
+					   I_MIN(range->size, IO_BLOCK_SIZE));
+	sstream->next_offset += range->size;
+	array_push_back(&sstream->ranges, &range);
+
+	header.name = "range";
+	header.value = t_strdup_printf("bytes=%"PRIuUOFF_T"-%"PRIuUOFF_T,
+				       range->offset,
+				       range->offset + range->size - 1);
+	range->req = s3_fs_request_init(sstream->fs, "GET", sstream->key, NULL,
+					&header, 1, FALSE,
+					i_stream_s3_range_response, range);
+	s3_fs_request_submit(sstream->fs, range->req);
+}
+
+static ssize_t i_stream_s3_read(struct istream_private *stream)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream);
+	struct s3_istream_range *range;
+	size_t avail, size;
+	unsigned char *dest;
+
+	for (;;) {
+		if (stream->istream.stream_errno != 0)
+			return -1;
+		if (array_count(&sstream->ranges) == 0) {
+			stream->istream.eof = TRUE;
+			return -1;
+		}
+		range = array_idx_elem(&sstream->ranges, 0);
+		if (range->read_pos < range->buf->used)
+			break;
+		if (!range->finished)
+			return 0;
+		/* this range is fully read */
+		array_pop_front(&sstream->ranges);
+		i_stream_s3_range_free(&range);
+		i_stream_s3_fill_ranges(sstream);
+	}
+
+	if (!i_stream_try_alloc(stream, 1, &avail))
+		return -2;
+	size = I_MIN(avail, range->buf->used - range->read_pos);
+	dest = stream->w_buffer + stream->pos;
+	memcpy(dest, CONST_PTR_OFFSET(range->buf->data, range->read_pos), size);
+	range->read_pos += size;
+	stream->pos += size;
+	return size;
+}
+
+static int
+i_stream_s3_get_size(struct istream_private *stream,
+		     bool exact ATTR_UNUSED, uoff_t *size_r)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream);
+
+	if (!sstream->size_known)
+		return 0;
+	*size_r = sstream->size;
+	return 1;
+}
+
+static void i_stream_s3_close(struct iostream_private *stream,
+			      bool close_parent ATTR_UNUSED)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream.iostream);
+	struct s3_istream_range *range;
+
+	array_foreach_elem(&sstream->ranges, range)
+		i_stream_s3_range_free(&range);
+	array_clear(&sstream->ranges);
+}
+
+static void i_stream_s3_destroy(struct iostream_private *stream)
+{
+	struct s3_istream *sstream =
+		container_of(stream, struct s3_istream, istream.iostream);
+
+	i_stream_s3_close(stream, FALSE);
+	array_free(&sstream->ranges);
+	i_stream_free_buffer(&sstream->istream);
+	i_free(sstream->key);
+}
+
+struct istream *i_stream_create_s3(struct s3_fs_file *file)
+{
+	struct s3_istream *sstream;
+	struct istream *input;
+
+	sstream = i_new(struct s3_istream, 1);
+	sstream->fs = S3_FS(file->file.fs);
+	sstream->key = i_strdup(file->key);
+	i_array_init(&sstream->ranges, sstream->fs->max_parallel_ranges);
+
+	sstream->istream.iostream.close = i_stream_s3_close;
+	sstream->istream.iostream.destroy = i_stream_s3_destroy;
+	sstream->istream.max_buffer_size = IO_BLOCK_SIZE;
+	sstream->istream.read = i_stream_s3_read;
+	sstream->istream.get_size = i_stream_s3_get_size;
+
+	input = i_stream_create(&sstream->istream, NULL, -1, 0);
+	input->blocking = FALSE;
+	i_stream_set_name(input, file->key);
+
+	/* the first request finds out the object size */
+	i_stream_s3_request_range(sstream);
+	return input;
+}
@@ -0,0 +1,138 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "hmac.h"
+#include "sha2.h"
+#include "sort.h"
+#include "time-util.h"
+#include "s3-auth.h"
+
+#include <ctype.h>
+
+#define S3_AUTH_ALGORITHM "AWS4-HMAC-SHA256"
+#define S3_AUTH_SERVICE "s3"
+
+const char *s3_auth_get_date(time_t timestamp)
+{
+	return t_strfgmtime("%Y%m%dT%H%M%SZ", timestamp);
+}
+
+void s3_uri_encode(string_t *dest, const char *src, bool encode_slash)
+{
+	for (; *src != '\0'; src++) {
+		if (i_isalnum(*src) || *src == '-' || *src == '_' ||
+		    *src == '.' || *src == '~' ||
+		    (*src == '/' && !encode_slash))
+			str_append_c(dest, *src);
+		else
+			str_printfa(dest, "%%%02X", (unsigned char)*src);
+	}
+}
+
+static int
+s3_auth_header_cmp(const struct s3_auth_header *h1,
+		   const struct s3_auth_header *h2)
+{
+	return strcmp(h1->name, h2->name);
+}
+
+static void
+s3_auth_append_canonical_query(string_t *dest, const char *query)
+{
+	const char **params;
+	unsigned int i, count;
+
+	if (query == NULL || query[0] == '\0')
+		return;
+
+	params = t_strsplit(query, "&");
+	count = str_array_length(params);
+	i_qsort(params, count, sizeof(*params), i_strcmp_p);
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append_c(dest, '&');
+		str_append(dest, params[i]);
+		/* parameters without a value still need the '=' */
+		if (strchr(params[i], '=') == NULL)
+			str_append_c(dest, '=');
+	}
+}
+
+static const char *
+s3_auth_get_canonical_request(const struct s3_auth_request *request,
+			      const char **signed_headers_r)
+{
+	struct s3_auth_header *headers;
+	string_t *str, *signed_headers;
+	unsigned int i;
+
+	headers = t_new(struct s3_auth_header, request->headers_count);
+	memcpy(headers, request->headers,
+	       sizeof(*headers) * request->headers_count);
+	i_qsort(headers, request->headers_count, sizeof(*headers),
+		s3_auth_header_cmp);
+
+	str = t_str_new(256);
+	signed_headers = t_str_new(64);
+	str_printfa(str, "%s\n%s\n", request->method, request->path);
+	s3_auth_append_canonical_query(str, request->query);
+	str_append_c(str, '\n');
+	for (i = 0; i < request->headers_count; i++) {
+		str_printfa(str, "%s:%s\n", headers[i].name,
+			    t_str_trim(headers[i].value, " \t"));
+		if (i > 0)
+			str_append_c(signed_headers, ';');
+		str_append(signed_headers, headers[i].name);
+	}
+	str_printfa(str, "\n%s\n%s", str_c(signed_headers),
+		    request->payload_sha256);
+	*signed_headers_r = str_c(signed_headers);
+	return str_c(str);
+}
+
+static void
+s3_auth_hmac(const unsigned char *key, size_t key_size, const char *data,
+	     unsigned char digest[STATIC_ARRAY SHA256_RESULTLEN])
+{
+	struct hmac_context ctx;
+
+	hmac_init(&ctx, key, key_size, &hash_method_sha256);
+	hmac_update(&ctx, data, strlen(data));
+	hmac_final(&ctx, digest);
+}
+
+const char *s3_auth_get_authorization(const struct s3_auth_settings *set,
+				      const struct s3_auth_request *request)
+{
+	unsigned char digest[SHA256_RESULTLEN], key[SHA256_RESULTLEN];
+	const char *date, *day, *scope, *canonical_request, *signed_headers;
+	const char *string_to_sign, *secret;
+
+	date = s3_auth_get_date(request->timestamp);
+	day = t_strndup(date, 8);
+	scope = t_strdup_printf("%s/%s/%s/aws4_request",
+				day, set->region, S3_AUTH_SERVICE);
+
+	canonical_request =
+		s3_auth_get_canonical_request(request, &signed_headers);
+	sha256_get_digest(canonical_request, strlen(canonical_request),
+			  digest);
+	string_to_sign = t_strdup_printf("%s\n%s\n%s\n%s", S3_AUTH_ALGORITHM,
+					 date, scope,
+					 binary_to_hex(digest, sizeof(digest)));
+
+	/* derive the signing key */
+	secret = t_strconcat("AWS4", set->secret_key, NULL);
+	s3_auth_hmac((const unsigned char *)secret, strlen(secret), day, key);
+	s3_auth_hmac(key, sizeof(key), set->region, key);
+	s3_auth_hmac(key, sizeof(key), S3_AUTH_SERVICE, key);
+	s3_auth_hmac(key, sizeof(key), "aws4_request", key);
+
+	s3_auth_hmac(key, sizeof(key), string_to_sign, digest);
+	return t_strdup_printf("%s Credential=%s/%s, SignedHeaders=%s, "
+			       "Signature=%s", S3_AUTH_ALGORITHM,
+			       set->access_key, scope, signed_headers,
+			       binary_to_hex(digest, sizeof(digest)));
+}
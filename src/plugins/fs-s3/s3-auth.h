@@ -0,0 +1,50 @@
+#ifndef S3_AUTH_H
+#define S3_AUTH_H
+
+/* SHA256 of an empty payload */
+#define S3_AUTH_EMPTY_PAYLOAD_SHA256 \
+	"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+/* Payload isn't included in the signature. This is used for streamed
+   payloads, which can't be hashed before they're sent. */
+#define S3_AUTH_UNSIGNED_PAYLOAD "UNSIGNED-PAYLOAD"
+
+struct s3_auth_settings {
+	const char *access_key;
+	const char *secret_key;
+	const char *region;
+};
+
+struct s3_auth_header {
+	/* Header name in lowercase */
+	const char *name;
+	const char *value;
+};
+
+struct s3_auth_request {
+	const char *method;
+	/* URI-encoded absolute path */
+	const char *path;
+	/* Query string parameters as name=value pairs joined with '&'.
+	   Both names and values must already be URI-encoded. May be NULL. */
+	const char *query;
+	/* Headers to sign. The "host", "x-amz-date" and
+	   "x-amz-content-sha256" headers must be included. */
+	const struct s3_auth_header *headers;
+	unsigned int headers_count;
+	/* Lowercase hex SHA256 of the payload or S3_AUTH_UNSIGNED_PAYLOAD */
+	const char *payload_sha256;
+	time_t timestamp;
+};
+
+/* Returns the x-amz-date header value for the timestamp. */
+const char *s3_auth_get_date(time_t timestamp);
+/* Returns the AWS Signature Version 4 Authorization header value for the
+   request. */
+const char *s3_auth_get_authorization(const struct s3_auth_settings *set,
+				      const struct s3_auth_request *request);
+
+/* URI-encode the string in the way AWS expects it for the canonical
+   request. If encode_slash is FALSE, '/' is kept as-is (for paths). */
+void s3_uri_encode(string_t *dest, const char *src, bool encode_slash);
+
+#endif
@@ -18,6 +18,9 @@ struct fts_lucene_settings {
 	bool no_snowball;
 	bool mime_parts;
 	bool use_libfts;
+	/* Each process writes to its own partial index, which allows
+	   indexing several mailboxes of the same user in parallel. */
+	bool parallel_writers;
 };
 
 struct fts_lucene_user {
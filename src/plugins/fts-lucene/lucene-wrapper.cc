@@ -6,6 +6,7 @@ extern "C" {
 #include "unichar.h"
 #include "hash.h"
 #include "hex-binary.h"
+#include "hostpid.h"
 #include "ioloop.h"
 #include "unlink-directory.h"
 #include "ioloop.h"
@@ -18,6 +19,8 @@ extern "C" {
 #include "fts-lucene-plugin.h"
 #include "lucene-wrapper.h"
 
+#include <dirent.h>
+#include <signal.h>
 #include <sys/stat.h>
 #ifdef HAVE_LIBEXTTEXTCAT_TEXTCAT_H
 #  include <libexttextcat/textcat.h>
@@ -37,6 +40,10 @@ extern "C" {
 #define FTS_LUCENE_MAX_SEARCH_TERMS 1000
 
 #define LUCENE_LOCK_OVERRIDE_SECS 60
+/* With parallel_writers each process writes to its own
+   <path>.partial.<hostname>.<pid> index, which is merged into the main
+   index after the writer process has exited. */
+#define LUCENE_PARTIAL_INDEX_INFIX ".partial."
 #define LUCENE_INDEX_CLOSE_TIMEOUT_MSECS (120*1000)
 
 using namespace lucene::document;
@@ -59,7 +66,7 @@ struct lucene_analyzer {
 };
 
 struct lucene_index {
-	char *path;
+	char *path, *partial_path;
 	struct mailbox_list *list;
 	struct fts_lucene_settings set;
 	normalizer_func_t *normalizer;
@@ -192,6 +199,7 @@ void lucene_index_deinit(struct lucene_index *index)
 	_CLDELETE(index->default_analyzer);
 	if (index->normalizer_buf != NULL)
 		buffer_free(&index->normalizer_buf);
+	i_free(index->partial_path);
 	i_free(index->path);
 	i_free(index);
 }
@@ -280,22 +288,169 @@ static void lucene_handle_error(struct lucene_index *index, CLuceneError &err,
 	}
 }
 
-static int lucene_index_open(struct lucene_index *index)
+static bool lucene_index_is_locked(const char *path)
 {
+	const char *lock_path;
+	struct stat st;
+
+	lock_path = t_strdup_printf("%s/write.lock", path);
+	return stat(lock_path, &st) == 0;
+}
+
+static void lucene_index_unlink_stale_lock(const char *path)
+{
+	const char *lock_path;
+	struct stat st;
+
+	lock_path = t_strdup_printf("%s/write.lock", path);
+	if (stat(lock_path, &st) == 0 &&
+	    st.st_mtime < time(NULL) - LUCENE_LOCK_OVERRIDE_SECS) {
+		if (unlink(lock_path) < 0)
+			i_error("unlink(%s) failed: %m", lock_path);
+	}
+}
+
+static bool
+lucene_partial_index_is_active(struct lucene_index *index,
+			       const char *hostpid)
+{
+	const char *p;
+	pid_t pid;
+
+	/* <hostname>.<pid> - the hostname may contain dots */
+	p = strrchr(hostpid, '.');
+	if (p == NULL || str_to_pid(p + 1, &pid) < 0)
+		return FALSE;
+	if (strcmp(t_strdup_until(hostpid, p), my_hostname) != 0) {
+		/* can't check processes on other hosts. leave the merge to
+		   the writer itself. */
+		return TRUE;
+	}
+	if (pid == getpid())
+		return index->writer != NULL;
+	/* the writer keeps the index until it's merged, so it's stale only
+	   after the process has died. an idle writer's write.lock can be
+	   arbitrarily old. */
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static const char *lucene_index_get_partial_path(struct lucene_index *index)
+{
+	if (index->partial_path == NULL) {
+		index->partial_path =
+			i_strdup_printf("%s"LUCENE_PARTIAL_INDEX_INFIX"%s.%s",
+					index->path, my_hostname, my_pid);
+	}
+	return index->partial_path;
+}
+
+static int
+lucene_index_get_partials(struct lucene_index *index, bool inactive_only,
+			  ARRAY_TYPE(const_string) *paths)
+{
+	const char *p, *dir, *prefix, *path;
+	struct dirent *d;
+	DIR *dirp;
+	size_t prefix_len;
+	int ret = 0;
+
+	p = strrchr(index->path, '/');
+	i_assert(p != NULL);
+	dir = t_strdup_until(index->path, p);
+	prefix = t_strconcat(p + 1, LUCENE_PARTIAL_INDEX_INFIX, NULL);
+	prefix_len = strlen(prefix);
+
+	dirp = opendir(dir);
+	if (dirp == NULL) {
+		if (errno == ENOENT)
+			return 0;
+		i_error("opendir(%s) failed: %m", dir);
+		return -1;
+	}
+	for (errno = 0; (d = readdir(dirp)) != NULL; errno = 0) {
+		if (strncmp(d->d_name, prefix, prefix_len) != 0)
+			continue;
+		if (inactive_only &&
+		    lucene_partial_index_is_active(index, d->d_name + prefix_len))
+			continue;
+		path = t_strconcat(dir, "/", d->d_name, NULL);
+		if (IndexReader::indexExists(path))
+			array_push_back(paths, &path);
+	}
+	if (errno != 0) {
+		i_error("readdir(%s) failed: %m", dir);
+		ret = -1;
+	}
+	if (closedir(dirp) < 0)
+		i_error("closedir(%s) failed: %m", dir);
+	return ret;
+}
+
+static int lucene_index_open_partials(struct lucene_index *index)
+{
+	ARRAY_TYPE(const_string) paths;
+	const char *path = index->path;
+	unsigned int i, count;
+
+	t_array_init(&paths, 8);
+	if (IndexReader::indexExists(path))
+		array_push_back(&paths, &path);
+	if (lucene_index_get_partials(index, FALSE, &paths) < 0)
+		return -1;
+	count = array_count(&paths);
+	if (count == 0)
+		return 0;
+
+	CL_NS(util)::ValueArray<IndexReader *> readers(count);
+	for (i = 0; i < count; i++) {
+		path = array_idx_elem(&paths, i);
+		try {
+			readers.values[i] = IndexReader::open(path);
+		} catch (CLuceneError &err) {
+			lucene_handle_error(index, err, "IndexReader::open()");
+			while (i > 0) {
+				i--;
+				readers.values[i]->close();
+				_CLDELETE(readers.values[i]);
+			}
+			return -1;
+		}
+	}
+	if (count == 1)
+		index->reader = readers.values[0];
+	else {
+		/* the subreaders are closed together with the MultiReader */
+		index->reader = _CLNEW MultiReader(&readers, true);
+	}
+	return 1;
+}
+
+static int lucene_index_open(struct lucene_index *index, bool with_partials)
+{
+	int ret;
+
 	if (index->reader != NULL) {
 		i_assert(index->to_close != NULL);
 		timeout_reset(index->to_close);
 		return 1;
 	}
 
-	if (!IndexReader::indexExists(index->path))
-		return 0;
+	if (with_partials && index->set.parallel_writers) {
+		T_BEGIN {
+			ret = lucene_index_open_partials(index);
+		} T_END;
+		if (ret <= 0)
+			return ret;
+	} else {
+		if (!IndexReader::indexExists(index->path))
+			return 0;
 
-	try {
-		index->reader = IndexReader::open(index->path);
-	} catch (CLuceneError &err) {
-		lucene_handle_error(index, err, "IndexReader::open()");
-		return -1;
+		try {
+			index->reader = IndexReader::open(index->path);
+		} catch (CLuceneError &err) {
+			lucene_handle_error(index, err, "IndexReader::open()");
+			return -1;
+		}
 	}
 	i_assert(index->to_close == NULL);
 	index->to_close = timeout_add(LUCENE_INDEX_CLOSE_TIMEOUT_MSECS,
@@ -303,14 +458,15 @@ static int lucene_index_open(struct lucene_index *index)
 	return 1;
 }
 
-static int lucene_index_open_search(struct lucene_index *index)
+static int
+lucene_index_open_search(struct lucene_index *index, bool with_partials)
 {
 	int ret;
 
 	if (index->searcher != NULL)
 		return 1;
 
-	if ((ret = lucene_index_open(index)) <= 0)
+	if ((ret = lucene_index_open(index, with_partials)) <= 0)
 		return ret;
 
 	index->searcher = _CLNEW IndexSearcher(index->reader);
@@ -359,7 +515,7 @@ int lucene_index_get_last_uid(struct lucene_index *index, uint32_t *last_uid_r)
 
 	*last_uid_r = 0;
 
-	if ((ret = lucene_index_open_search(index)) <= 0)
+	if ((ret = lucene_index_open_search(index, TRUE)) <= 0)
 		return ret;
 
 	Term mailbox_term(_T("box"), index->mailbox_guid);
@@ -396,7 +552,7 @@ int lucene_index_get_doc_count(struct lucene_index *index, uint32_t *count_r)
 
 	if (index->reader == NULL) {
 		lucene_index_close(index);
-		if ((ret = lucene_index_open(index)) < 0)
+		if ((ret = lucene_index_open(index, TRUE)) < 0)
 			return -1;
 		if (ret == 0) {
 			*count_r = 0;
@@ -432,24 +588,28 @@ static int lucene_settings_check(struct lucene_index *index)
 
 int lucene_index_build_init(struct lucene_index *index)
 {
-	const char *lock_path;
-	struct stat st;
+	const char *path = index->set.parallel_writers ?
+		lucene_index_get_partial_path(index) : index->path;
 
 	lucene_index_close(index);
 
-	lock_path = t_strdup_printf("%s/write.lock", index->path);
-	if (stat(lock_path, &st) == 0 &&
-	    st.st_mtime < time(NULL) - LUCENE_LOCK_OVERRIDE_SECS) {
-		if (unlink(lock_path) < 0)
+	if (!index->set.parallel_writers)
+		lucene_index_unlink_stale_lock(path);
+	else {
+		/* the partial index is named after this process, so any
+		   lock in it was left behind by an earlier process with
+		   the same PID */
+		const char *lock_path = t_strdup_printf("%s/write.lock", path);
+		if (unlink(lock_path) < 0 && errno != ENOENT)
 			i_error("unlink(%s) failed: %m", lock_path);
 	}
 
 	if (lucene_settings_check(index) < 0)
 		return -1;
 
-	bool exists = IndexReader::indexExists(index->path);
+	bool exists = IndexReader::indexExists(path);
 	try {
-		index->writer = _CLNEW IndexWriter(index->path,
+		index->writer = _CLNEW IndexWriter(path,
 						   index->default_analyzer,
 						   !exists);
 	} catch (CLuceneError &err) {
@@ -881,7 +1041,12 @@ int lucene_index_rescan(struct lucene_index *index)
 
 	i_assert(index->list != NULL);
 
-	if ((ret = lucene_index_open_search(index)) < 0)
+	/* documents are deleted only from the main index, so get the
+	   partial indexes merged first */
+	if (lucene_index_merge_partials(index) < 0)
+		return -1;
+	lucene_index_close(index);
+	if ((ret = lucene_index_open_search(index, FALSE)) < 0)
 		return ret;
 
 	Term term(_T("box"), _T("*"));
@@ -971,7 +1136,7 @@ lucene_index_expunge_record(struct lucene_index *index,
 {
 	int ret;
 
-	if ((ret = lucene_index_open_search(index)) <= 0)
+	if ((ret = lucene_index_open_search(index, FALSE)) <= 0)
 		return ret;
 
 	BooleanQuery query;
@@ -1012,6 +1177,10 @@ int lucene_index_expunge_from_log(struct lucene_index *index,
 	const struct fts_expunge_log_read_record *rec;
 	int ret = 0, ret2;
 
+	if (lucene_index_merge_partials(index) < 0)
+		return -1;
+	lucene_index_close(index);
+
 	ctx = fts_expunge_log_read_begin(log);
 	while ((rec = fts_expunge_log_read_next(ctx)) != NULL) {
 		if (lucene_index_expunge_record(index, rec) < 0) {
@@ -1028,10 +1197,78 @@ int lucene_index_expunge_from_log(struct lucene_index *index,
 	return ret2;
 }
 
+int lucene_index_merge_partials(struct lucene_index *index)
+{
+	ARRAY_TYPE(const_string) paths;
+	const char *path, *error;
+	unsigned int i, count;
+	int ret = 0;
+
+	t_array_init(&paths, 8);
+	if (lucene_index_get_partials(index, TRUE, &paths) < 0)
+		return -1;
+	count = array_count(&paths);
+	if (count == 0)
+		return 0;
+	if (lucene_index_is_locked(index->path)) {
+		/* the main index is being written to. merge the partial
+		   indexes on the next optimization. */
+		return 0;
+	}
+	lucene_index_close(index);
+
+	CL_NS(util)::ValueArray<CL_NS(store)::Directory *> dirs(count);
+	for (i = 0; i < count; i++) {
+		path = array_idx_elem(&paths, i);
+		dirs.values[i] = CL_NS(store)::FSDirectory::getDirectory(path);
+	}
+
+	bool exists = IndexReader::indexExists(index->path);
+	IndexWriter *writer = NULL;
+	try {
+		writer = _CLNEW IndexWriter(index->path, index->default_analyzer,
+					    !exists);
+		writer->setMaxFieldLength(MAX_TERMS_PER_DOCUMENT);
+		writer->addIndexesNoOptimize(dirs);
+	} catch (CLuceneError &err) {
+		lucene_handle_error(index, err,
+				    "IndexWriter::addIndexesNoOptimize()");
+		ret = -1;
+	}
+	if (writer != NULL) {
+		try {
+			writer->close();
+		} catch (CLuceneError &err) {
+			lucene_handle_error(index, err, "IndexWriter::close()");
+			ret = -1;
+		}
+		_CLDELETE(writer);
+	}
+	for (i = 0; i < count; i++) {
+		dirs.values[i]->close();
+		_CLDECDELETE(dirs.values[i]);
+	}
+	if (ret < 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		path = array_idx_elem(&paths, i);
+		if (unlink_directory(path, UNLINK_DIRECTORY_FLAG_RMDIR,
+				     &error) < 0) {
+			/* the documents would be merged again */
+			i_error("unlink_directory(%s) failed: %s", path, error);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 int lucene_index_optimize(struct lucene_index *index)
 {
 	int ret = 0;
 
+	if (lucene_index_merge_partials(index) < 0)
+		return -1;
 	if (!IndexReader::indexExists(index->path))
 		return 0;
 	if (IndexReader::isLocked(index->path))
@@ -1402,7 +1639,7 @@ int lucene_index_lookup(struct lucene_index *index,
 {
 	struct mail_search_arg *arg;
 
-	if (lucene_index_open_search(index) <= 0)
+	if (lucene_index_open_search(index, TRUE) <= 0)
 		return -1;
 
 	ARRAY_TYPE(lucene_query) def_queries;
@@ -1534,7 +1771,7 @@ int lucene_index_lookup_multi(struct lucene_index *index,
 {
 	struct mail_search_arg *arg;
 
-	if (lucene_index_open_search(index) <= 0)
+	if (lucene_index_open_search(index, TRUE) <= 0)
 		return -1;
 
 	ARRAY_TYPE(lucene_query) def_queries;
@@ -1578,7 +1815,7 @@ lucene_index_iter_init(struct lucene_index *index)
 
 	iter = i_new(struct lucene_index_iter, 1);
 	iter->index = index;
-	if ((ret = lucene_index_open_search(index)) <= 0) {
+	if ((ret = lucene_index_open_search(index, TRUE)) <= 0) {
 		if (ret < 0)
 			iter->failed = true;
 		return iter;
@@ -39,6 +39,9 @@ void lucene_index_close(struct lucene_index *index);
 int lucene_index_rescan(struct lucene_index *index);
 int lucene_index_expunge_from_log(struct lucene_index *index,
 				  struct fts_expunge_log *log);
+/* Merge the partial indexes written with parallel_writers into the main
+   index. Indexes that are still being written to are skipped. */
+int lucene_index_merge_partials(struct lucene_index *index);
 int lucene_index_optimize(struct lucene_index *index);
 
 int lucene_index_lookup(struct lucene_index *index, 
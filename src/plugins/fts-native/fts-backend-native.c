@@ -0,0 +1,646 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "file-lock.h"
+#include "mail-user.h"
+#include "mail-namespace.h"
+#include "mail-storage-private.h"
+#include "mail-search-build.h"
+#include "mailbox-list-iter.h"
+#include "fts-native-index.h"
+#include "fts-native-plugin.h"
+
+#define FTS_NATIVE_FILE_PREFIX "dovecot.fts.native"
+#define FTS_NATIVE_LOCK_FNAME FTS_NATIVE_FILE_PREFIX".lock"
+#define FTS_NATIVE_LOCK_TIMEOUT_SECS 60
+
+#define FTS_NATIVE_FIELD_HDR "hdr"
+#define FTS_NATIVE_FIELD_BODY "body"
+
+struct native_fts_backend {
+	struct fts_backend backend;
+
+	struct mailbox *box;
+	struct fts_native_index *index;
+	bool refresh;
+};
+
+struct native_fts_backend_update_context {
+	struct fts_backend_update_context ctx;
+	struct fts_native_index_update *update;
+
+	const char *field;
+	/* lowercased header name for the headers that are indexed
+	   separately, or NULL */
+	char *hdr_field;
+	uint32_t uid, last_uid;
+};
+
+static struct fts_backend *fts_backend_native_alloc(void)
+{
+	struct native_fts_backend *backend;
+
+	backend = i_new(struct native_fts_backend, 1);
+	backend->backend = fts_backend_native;
+	return &backend->backend;
+}
+
+static int
+fts_backend_native_init(struct fts_backend *_backend, const char **error_r)
+{
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT(_backend->ns->user);
+
+	if (fuser == NULL) {
+		/* invalid settings */
+		*error_r = "Invalid fts_native settings";
+		return -1;
+	}
+	return 0;
+}
+
+static void
+fts_backend_native_unset_box(struct native_fts_backend *backend)
+{
+	if (backend->index != NULL)
+		fts_native_index_deinit(&backend->index);
+	backend->box = NULL;
+}
+
+static void fts_backend_native_deinit(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	fts_backend_native_unset_box(backend);
+	i_free(backend);
+}
+
+static int
+fts_backend_native_refresh_index(struct native_fts_backend *backend)
+{
+	const char *error;
+
+	if (fts_native_index_refresh(backend->index, &error) < 0) {
+		mailbox_set_critical(backend->box, "fts-native: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fts_backend_native_set_box(struct native_fts_backend *backend,
+			   struct mailbox *box)
+{
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT_REQUIRE(backend->backend.ns->user);
+	const struct mailbox_permissions *perm;
+	struct mail_storage *storage;
+	struct mailbox_status status;
+	struct fts_native_index_settings set;
+	const char *path;
+
+	if (backend->box == box) {
+		if (backend->refresh && box != NULL) {
+			if (fts_backend_native_refresh_index(backend) < 0)
+				return -1;
+			backend->refresh = FALSE;
+		}
+		return 0;
+	}
+	fts_backend_native_unset_box(backend);
+	backend->refresh = FALSE;
+	if (box == NULL)
+		return 0;
+
+	perm = mailbox_get_permissions(box);
+	storage = mailbox_get_storage(box);
+	if (mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX, &path) <= 0)
+		i_unreached(); /* fts already checked this */
+	mailbox_get_open_status(box, STATUS_UIDVALIDITY, &status);
+
+	i_zero(&set);
+	set.path = t_strconcat(path, "/"FTS_NATIVE_FILE_PREFIX, NULL);
+	set.uid_validity = status.uidvalidity;
+	set.mode = perm->file_create_mode;
+	set.gid = perm->file_create_gid;
+	set.gid_origin = perm->file_create_gid_origin;
+	set.max_segments = fuser->set.max_segments;
+	set.mmap_disable = storage->set->mmap_disable;
+	set.fsync = storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER;
+
+	backend->index = fts_native_index_init(&set);
+	backend->box = box;
+	return fts_backend_native_refresh_index(backend);
+}
+
+static int
+fts_backend_native_get_last_uid(struct fts_backend *_backend,
+				struct mailbox *box, uint32_t *last_uid_r)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		return -1;
+	*last_uid_r = fts_native_index_get_last_uid(backend->index);
+	return 0;
+}
+
+static int
+fts_backend_native_lock(struct native_fts_backend *backend,
+			struct file_lock **lock_r)
+{
+	const char *error;
+	int ret;
+
+	ret = mailbox_lock_file_create(backend->box, FTS_NATIVE_LOCK_FNAME,
+				       FTS_NATIVE_LOCK_TIMEOUT_SECS,
+				       lock_r, &error);
+	if (ret <= 0) {
+		mailbox_set_critical(backend->box, "fts-native: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fts_backend_native_commit(struct native_fts_backend *backend,
+			  struct fts_native_index_update **update,
+			  uint32_t last_uid)
+{
+	struct file_lock *lock;
+	const char *error;
+	int ret = 0;
+
+	if (fts_backend_native_lock(backend, &lock) < 0) {
+		fts_native_index_update_rollback(update);
+		return -1;
+	}
+	if (fts_native_index_update_commit(update, last_uid, &error) < 0) {
+		mailbox_set_critical(backend->box, "fts-native: %s", error);
+		ret = -1;
+	}
+	file_lock_free(&lock);
+	return ret;
+}
+
+static struct fts_backend_update_context *
+fts_backend_native_update_init(struct fts_backend *_backend)
+{
+	struct native_fts_backend_update_context *ctx;
+
+	ctx = i_new(struct native_fts_backend_update_context, 1);
+	ctx->ctx.backend = _backend;
+	return &ctx->ctx;
+}
+
+static int
+fts_backend_native_update_finish(struct native_fts_backend_update_context *ctx)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+
+	if (ctx->update == NULL)
+		return 0;
+	if (ctx->ctx.failed) {
+		fts_native_index_update_rollback(&ctx->update);
+		return -1;
+	}
+	return fts_backend_native_commit(backend, &ctx->update, ctx->last_uid);
+}
+
+static int
+fts_backend_native_update_deinit(struct fts_backend_update_context *_ctx)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	int ret = _ctx->failed ? -1 : 0;
+
+	if (fts_backend_native_update_finish(ctx) < 0)
+		ret = -1;
+	i_free(ctx->hdr_field);
+	i_free(ctx);
+	return ret;
+}
+
+static void
+fts_backend_native_update_set_mailbox(struct fts_backend_update_context *_ctx,
+				      struct mailbox *box)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+
+	if (fts_backend_native_update_finish(ctx) < 0)
+		_ctx->failed = TRUE;
+	ctx->uid = ctx->last_uid = 0;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		_ctx->failed = TRUE;
+	else if (box != NULL)
+		ctx->update = fts_native_index_update_begin(backend->index);
+}
+
+static void
+fts_backend_native_update_expunge(struct fts_backend_update_context *_ctx,
+				  uint32_t uid)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+
+	if (ctx->update != NULL)
+		fts_native_index_update_expunge(ctx->update, uid);
+}
+
+static bool
+fts_backend_native_update_set_build_key(struct fts_backend_update_context *_ctx,
+					const struct fts_backend_build_key *key)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)ctx->ctx.backend;
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT_REQUIRE(backend->backend.ns->user);
+
+	if (_ctx->failed || ctx->update == NULL)
+		return FALSE;
+
+	if (key->uid != ctx->last_uid) {
+		i_assert(key->uid > ctx->last_uid);
+		if (ctx->last_uid != 0 &&
+		    fts_native_index_update_get_memory(ctx->update) >=
+		    fuser->set.max_build_memory) {
+			/* all the previous mails are fully built. write them
+			   to a segment before this update grows too large. */
+			if (fts_backend_native_commit(backend, &ctx->update,
+						      ctx->last_uid) < 0) {
+				_ctx->failed = TRUE;
+				return FALSE;
+			}
+			ctx->update = fts_native_index_update_begin(backend->index);
+		}
+		ctx->last_uid = key->uid;
+	}
+
+	switch (key->type) {
+	case FTS_BACKEND_BUILD_KEY_HDR:
+	case FTS_BACKEND_BUILD_KEY_MIME_HDR:
+		i_assert(key->hdr_name != NULL);
+
+		ctx->field = FTS_NATIVE_FIELD_HDR;
+		i_free(ctx->hdr_field);
+		if (fts_header_want_indexed(key->hdr_name))
+			ctx->hdr_field = i_strdup(t_str_lcase(key->hdr_name));
+		break;
+	case FTS_BACKEND_BUILD_KEY_BODY_PART:
+		ctx->field = FTS_NATIVE_FIELD_BODY;
+		i_free_and_null(ctx->hdr_field);
+		break;
+	case FTS_BACKEND_BUILD_KEY_BODY_PART_BINARY:
+		i_unreached();
+	}
+	ctx->uid = key->uid;
+	return TRUE;
+}
+
+static void
+fts_backend_native_update_unset_build_key(struct fts_backend_update_context *_ctx)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+
+	ctx->uid = 0;
+	ctx->field = NULL;
+	i_free_and_null(ctx->hdr_field);
+}
+
+static int
+fts_backend_native_update_build_more(struct fts_backend_update_context *_ctx,
+				     const unsigned char *data, size_t size)
+{
+	struct native_fts_backend_update_context *ctx =
+		(struct native_fts_backend_update_context *)_ctx;
+
+	i_assert(ctx->uid != 0);
+
+	if (_ctx->failed)
+		return -1;
+
+	fts_native_index_update_add(ctx->update, ctx->field, data, size,
+				    ctx->uid);
+	if (ctx->hdr_field != NULL) {
+		fts_native_index_update_add(ctx->update, ctx->hdr_field,
+					    data, size, ctx->uid);
+	}
+	return 0;
+}
+
+static int fts_backend_native_refresh(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	backend->refresh = TRUE;
+	return 0;
+}
+
+static int
+fts_backend_native_expunge_missing(struct native_fts_backend *backend,
+				   struct fts_native_index_update *update)
+{
+	struct mailbox_transaction_context *t;
+	struct mail_search_context *search_ctx;
+	struct mail_search_args *search_args;
+	struct mail *mail;
+	ARRAY_TYPE(seq_range) missing_uids;
+	struct seq_range_iter iter;
+	uint32_t last_uid, uid;
+	unsigned int n = 0;
+	int ret;
+
+	last_uid = fts_native_index_get_last_uid(backend->index);
+	if (last_uid == 0)
+		return 0;
+
+	i_array_init(&missing_uids, 128);
+	seq_range_array_add_range(&missing_uids, 1, last_uid);
+
+	t = mailbox_transaction_begin(backend->box, 0, __func__);
+	search_args = mail_search_build_init();
+	mail_search_build_add_all(search_args);
+	search_ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(search_ctx, &mail))
+		seq_range_array_remove(&missing_uids, mail->uid);
+	ret = mailbox_search_deinit(&search_ctx);
+	(void)mailbox_transaction_commit(&t);
+
+	if (ret == 0) {
+		seq_range_array_iter_init(&iter, &missing_uids);
+		while (seq_range_array_iter_nth(&iter, n++, &uid))
+			fts_native_index_update_expunge(update, uid);
+	}
+	array_free(&missing_uids);
+	return ret;
+}
+
+static int
+fts_backend_native_optimize_box(struct native_fts_backend *backend,
+				struct mailbox *box, bool rescan)
+{
+	struct fts_native_index_update *update;
+	struct file_lock *lock;
+	const char *error;
+	int ret = 0;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		return -1;
+	if (fts_native_index_get_last_uid(backend->index) == 0)
+		return 0;
+	if (fts_backend_native_lock(backend, &lock) < 0)
+		return -1;
+
+	if (rescan) {
+		update = fts_native_index_update_begin(backend->index);
+		if (fts_backend_native_expunge_missing(backend, update) < 0) {
+			fts_native_index_update_rollback(&update);
+			ret = -1;
+		} else if (fts_native_index_update_commit(&update, 0,
+							  &error) < 0) {
+			mailbox_set_critical(box, "fts-native: %s", error);
+			ret = -1;
+		}
+	}
+	if (ret == 0 && fts_native_index_optimize(backend->index, &error) < 0) {
+		mailbox_set_critical(box, "fts-native: %s", error);
+		ret = -1;
+	}
+	file_lock_free(&lock);
+	return ret;
+}
+
+static int
+fts_backend_native_optimize_all(struct native_fts_backend *backend,
+				bool rescan)
+{
+	struct mailbox_list_iterate_context *iter;
+	const struct mailbox_info *info;
+	struct mailbox *box;
+	int ret = 0;
+
+	iter = mailbox_list_iter_init(backend->backend.ns->list, "*",
+				      MAILBOX_LIST_ITER_SKIP_ALIASES |
+				      MAILBOX_LIST_ITER_NO_AUTO_BOXES |
+				      MAILBOX_LIST_ITER_RETURN_NO_FLAGS);
+	while ((info = mailbox_list_iter_next(iter)) != NULL) {
+		if ((info->flags &
+		     (MAILBOX_NONEXISTENT | MAILBOX_NOSELECT)) != 0)
+			continue;
+
+		box = mailbox_alloc(info->ns->list, info->vname, 0);
+		if (mailbox_open(box) == 0) T_BEGIN {
+			if (fts_backend_native_optimize_box(backend, box,
+							    rescan) < 0)
+				ret = -1;
+		} T_END;
+		(void)fts_backend_native_set_box(backend, NULL);
+		mailbox_free(&box);
+	}
+	if (mailbox_list_iter_deinit(&iter) < 0)
+		ret = -1;
+	return ret;
+}
+
+static int fts_backend_native_rescan(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	return fts_backend_native_optimize_all(backend, TRUE);
+}
+
+static int fts_backend_native_optimize(struct fts_backend *_backend)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+
+	return fts_backend_native_optimize_all(backend, FALSE);
+}
+
+static int
+native_lookup_arg(struct native_fts_backend *backend,
+		  struct mail_search_arg *arg, bool and_args,
+		  ARRAY_TYPE(seq_range) *definite_uids,
+		  ARRAY_TYPE(seq_range) *maybe_uids)
+{
+	struct fts_native_user *fuser =
+		FTS_NATIVE_USER_CONTEXT_REQUIRE(backend->backend.ns->user);
+	bool prefix = fuser->set.prefix_search;
+	ARRAY_TYPE(seq_range) tmp_definite_uids, tmp_maybe_uids;
+	ARRAY_TYPE(seq_range) *uids = &tmp_definite_uids;
+	const char *error;
+	uint32_t last_uid;
+	int ret = 0;
+
+	if (arg->no_fts)
+		return 0;
+
+	t_array_init(&tmp_definite_uids, 128);
+	t_array_init(&tmp_maybe_uids, 128);
+
+	switch (arg->type) {
+	case SEARCH_TEXT:
+		ret = fts_native_index_lookup(backend->index,
+			FTS_NATIVE_FIELD_HDR, arg->value.str, prefix,
+			uids, &error);
+		if (ret == 0) {
+			ret = fts_native_index_lookup(backend->index,
+				FTS_NATIVE_FIELD_BODY, arg->value.str, prefix,
+				uids, &error);
+		}
+		break;
+	case SEARCH_BODY:
+		ret = fts_native_index_lookup(backend->index,
+			FTS_NATIVE_FIELD_BODY, arg->value.str, prefix,
+			uids, &error);
+		break;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		if (*arg->value.str == '\0') {
+			/* only checking the header's existence */
+			return 0;
+		}
+		if (fts_header_want_indexed(arg->hdr_field_name)) {
+			ret = fts_native_index_lookup(backend->index,
+				t_str_lcase(arg->hdr_field_name),
+				arg->value.str, prefix, uids, &error);
+			break;
+		}
+		if (arg->match_not) {
+			/* the maybe-matches can't be negated */
+			return 0;
+		}
+		/* we can check if the search key exists in some header and
+		   filter out the messages that have no chance of matching */
+		uids = &tmp_maybe_uids;
+		ret = fts_native_index_lookup(backend->index,
+			FTS_NATIVE_FIELD_HDR, arg->value.str, prefix,
+			uids, &error);
+		break;
+	default:
+		return 0;
+	}
+	if (ret < 0) {
+		mailbox_set_critical(backend->box, "fts-native: %s", error);
+		return -1;
+	}
+
+	if (arg->match_not) {
+		/* definite -> non-match
+		   non-match -> definite */
+		last_uid = fts_native_index_get_last_uid(backend->index);
+		if (last_uid > 0)
+			seq_range_array_add_range(&tmp_maybe_uids, 1, last_uid);
+		seq_range_array_remove_seq_range(&tmp_maybe_uids,
+						 &tmp_definite_uids);
+		array_clear(&tmp_definite_uids);
+		array_append_array(&tmp_definite_uids, &tmp_maybe_uids);
+		array_clear(&tmp_maybe_uids);
+	}
+
+	if (and_args) {
+		/* AND:
+		   definite && definite -> definite
+		   definite && maybe -> maybe
+		   maybe && maybe -> maybe */
+
+		/* put definites among maybies, so they can be intersected */
+		seq_range_array_merge(maybe_uids, definite_uids);
+		seq_range_array_merge(&tmp_maybe_uids, &tmp_definite_uids);
+
+		seq_range_array_intersect(maybe_uids, &tmp_maybe_uids);
+		seq_range_array_intersect(definite_uids, &tmp_definite_uids);
+		/* remove duplicate maybies that are also definites */
+		seq_range_array_remove_seq_range(maybe_uids, definite_uids);
+	} else {
+		/* OR:
+		   definite || definite -> definite
+		   definite || maybe -> definite
+		   maybe || maybe -> maybe */
+
+		/* remove maybies that are now definites */
+		seq_range_array_remove_seq_range(&tmp_maybe_uids,
+						 definite_uids);
+		seq_range_array_remove_seq_range(maybe_uids,
+						 &tmp_definite_uids);
+
+		seq_range_array_merge(definite_uids, &tmp_definite_uids);
+		seq_range_array_merge(maybe_uids, &tmp_maybe_uids);
+	}
+	return 1;
+}
+
+static int
+fts_backend_native_lookup(struct fts_backend *_backend, struct mailbox *box,
+			  struct mail_search_arg *args,
+			  enum fts_lookup_flags flags,
+			  struct fts_result *result)
+{
+	struct native_fts_backend *backend =
+		(struct native_fts_backend *)_backend;
+	bool and_args = (flags & FTS_LOOKUP_FLAG_AND_ARGS) != 0;
+	bool first = TRUE;
+	int ret;
+
+	if (fts_backend_native_set_box(backend, box) < 0)
+		return -1;
+
+	for (; args != NULL; args = args->next) {
+		T_BEGIN {
+			ret = native_lookup_arg(backend, args,
+						first ? FALSE : and_args,
+						&result->definite_uids,
+						&result->maybe_uids);
+		} T_END;
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			args->match_always = TRUE;
+			first = FALSE;
+		}
+	}
+	return 0;
+}
+
+struct fts_backend fts_backend_native = {
+	.name = "native",
+	.flags = FTS_BACKEND_FLAG_TOKENIZED_INPUT,
+
+	{
+		fts_backend_native_alloc,
+		fts_backend_native_init,
+		fts_backend_native_deinit,
+		fts_backend_native_get_last_uid,
+		fts_backend_native_update_init,
+		fts_backend_native_update_deinit,
+		fts_backend_native_update_set_mailbox,
+		fts_backend_native_update_expunge,
+		fts_backend_native_update_set_build_key,
+		fts_backend_native_update_unset_build_key,
+		fts_backend_native_update_build_more,
+		fts_backend_native_refresh,
+		fts_backend_native_rescan,
+		fts_backend_native_optimize,
+		fts_backend_default_can_lookup,
+		fts_backend_native_lookup,
+		NULL,
+		NULL
+	}
+};
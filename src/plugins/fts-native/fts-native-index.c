@@ -0,0 +1,1261 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "hash.h"
+#include "str.h"
+#include "strnum.h"
+#include "sort.h"
+#include "numpack.h"
+#include "eacces-error.h"
+#include "mmap-util.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "ostream.h"
+#include "fts-native-index.h"
+
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FTS_NATIVE_MANIFEST_VERSION 1
+#define FTS_NATIVE_SEGMENT_VERSION 1
+/* How many times to retry reading the manifest if a segment listed in it
+   was deleted by a merge before we managed to open it. */
+#define FTS_NATIVE_REFRESH_RETRIES 3
+
+struct fts_native_manifest_header {
+	uint8_t version;
+	uint8_t unused[3];
+	uint32_t uid_validity;
+	uint32_t last_uid;
+	uint32_t next_segment_id;
+	uint32_t segments_count;
+	uint32_t expunged_count;
+	/* uint32_t segment_ids[segments_count];
+	   struct seq_range expunged[expunged_count]; */
+};
+
+struct fts_native_segment_header {
+	uint8_t version;
+	uint8_t unused[3];
+	uint32_t terms_count;
+	/* Offset to uint32_t term_offsets[terms_count]. The term records are
+	   before it in ascending key order:
+
+	   numpack key_size, key[key_size], numpack uids_size, uids[uids_size]
+
+	   The UIDs are numpack-encoded deltas to the previous UID. */
+	uint32_t term_index_offset;
+	uint32_t first_uid, last_uid;
+};
+
+struct fts_native_segment {
+	uint32_t id;
+
+	void *mmap_base;
+	buffer_t *buf;
+	const unsigned char *data;
+	size_t size;
+
+	const struct fts_native_segment_header *hdr;
+	const uint32_t *term_offsets;
+};
+
+struct fts_native_term_rec {
+	const unsigned char *key;
+	size_t key_size;
+	const unsigned char *uids;
+	size_t uids_size;
+};
+
+struct fts_native_index {
+	struct fts_native_index_settings set;
+	char *path, *gid_origin;
+
+	bool have_manifest_st;
+	struct stat manifest_st;
+
+	struct fts_native_manifest_header hdr;
+	ARRAY(struct fts_native_segment *) segments;
+	ARRAY_TYPE(seq_range) expunged;
+	/* Segments listed in a manifest with a different UIDVALIDITY.
+	   They're deleted on the next commit. */
+	ARRAY_TYPE(uint32_t) stale_segment_ids;
+};
+
+struct fts_native_term {
+	const char *key;
+	ARRAY_TYPE(uint32_t) uids;
+};
+
+struct fts_native_index_update {
+	struct fts_native_index *index;
+	pool_t pool;
+
+	HASH_TABLE(const char *, struct fts_native_term *) terms;
+	ARRAY_TYPE(seq_range) expunged;
+	string_t *key;
+	size_t memory_used;
+};
+
+struct fts_native_segment_writer {
+	struct fts_native_index *index;
+	const char *path, *temp_path;
+	int fd;
+	struct ostream *output;
+
+	struct fts_native_segment_header hdr;
+	ARRAY_TYPE(uint32_t) term_offsets;
+	buffer_t *buf;
+};
+
+struct fts_native_index *
+fts_native_index_init(const struct fts_native_index_settings *set)
+{
+	struct fts_native_index *index;
+
+	index = i_new(struct fts_native_index, 1);
+	index->set = *set;
+	index->set.path = index->path = i_strdup(set->path);
+	index->set.gid_origin = index->gid_origin = i_strdup(set->gid_origin);
+	if (index->set.max_segments == 0)
+		index->set.max_segments = FTS_NATIVE_INDEX_DEFAULT_MAX_SEGMENTS;
+	i_array_init(&index->segments, 8);
+	i_array_init(&index->expunged, 8);
+	i_array_init(&index->stale_segment_ids, 8);
+	return index;
+}
+
+static void fts_native_segment_free(struct fts_native_segment **_seg)
+{
+	struct fts_native_segment *seg = *_seg;
+
+	*_seg = NULL;
+	if (seg->mmap_base != NULL) {
+		if (munmap(seg->mmap_base, seg->size) < 0)
+			i_error("munmap(fts segment %u) failed: %m", seg->id);
+	}
+	buffer_free(&seg->buf);
+	i_free(seg);
+}
+
+static void fts_native_index_close(struct fts_native_index *index)
+{
+	struct fts_native_segment **segp;
+
+	array_foreach_modifiable(&index->segments, segp)
+		fts_native_segment_free(segp);
+	array_clear(&index->segments);
+	array_clear(&index->expunged);
+	array_clear(&index->stale_segment_ids);
+	i_zero(&index->hdr);
+	index->have_manifest_st = FALSE;
+}
+
+void fts_native_index_deinit(struct fts_native_index **_index)
+{
+	struct fts_native_index *index = *_index;
+
+	*_index = NULL;
+	fts_native_index_close(index);
+	array_free(&index->segments);
+	array_free(&index->expunged);
+	array_free(&index->stale_segment_ids);
+	i_free(index->path);
+	i_free(index->gid_origin);
+	i_free(index);
+}
+
+static const char *
+fts_native_segment_path(struct fts_native_index *index, uint32_t id)
+{
+	return t_strdup_printf("%s.%u", index->set.path, id);
+}
+
+static void
+fts_native_index_set_corrupted(struct fts_native_index *index,
+			       const char *path, const char *reason,
+			       const char **error_r)
+{
+	*error_r = t_strdup_printf("Corrupted fts index file %s: %s",
+				   path, reason);
+	/* delete the manifest, so the mailbox gets reindexed. the leftover
+	   segment files get overwritten or deleted by optimize. */
+	if (unlink(index->set.path) < 0 && errno != ENOENT)
+		i_error("unlink(%s) failed: %m", index->set.path);
+	fts_native_index_close(index);
+}
+
+static int
+fts_native_segment_get_term(struct fts_native_segment *seg, unsigned int idx,
+			    struct fts_native_term_rec *rec_r)
+{
+	const unsigned char *p, *end;
+	uint64_t num;
+
+	i_assert(idx < seg->hdr->terms_count);
+
+	if (seg->term_offsets[idx] < sizeof(*seg->hdr) ||
+	    seg->term_offsets[idx] >= seg->hdr->term_index_offset)
+		return -1;
+	p = seg->data + seg->term_offsets[idx];
+	end = seg->data + seg->hdr->term_index_offset;
+
+	if (numpack_decode(&p, end, &num) < 0 || num > (size_t)(end - p))
+		return -1;
+	rec_r->key = p;
+	rec_r->key_size = num;
+	p += num;
+	if (numpack_decode(&p, end, &num) < 0 || num > (size_t)(end - p))
+		return -1;
+	rec_r->uids = p;
+	rec_r->uids_size = num;
+	return 0;
+}
+
+static int
+fts_native_term_rec_cmp(const struct fts_native_term_rec *rec,
+			const unsigned char *key, size_t key_size)
+{
+	int ret;
+
+	ret = memcmp(rec->key, key, I_MIN(rec->key_size, key_size));
+	if (ret != 0)
+		return ret;
+	return rec->key_size < key_size ? -1 :
+		(rec->key_size > key_size ? 1 : 0);
+}
+
+static int
+fts_native_term_rec_get_uids(const struct fts_native_term_rec *rec,
+			     ARRAY_TYPE(uint32_t) *uids)
+{
+	const unsigned char *p = rec->uids, *end = rec->uids + rec->uids_size;
+	uint32_t delta, uid = 0;
+
+	while (p < end) {
+		if (numpack_decode32(&p, end, &delta) < 0 || delta == 0 ||
+		    delta > (uint32_t)-1 - uid)
+			return -1;
+		uid += delta;
+		array_push_back(uids, &uid);
+	}
+	return 0;
+}
+
+/* Returns 1 if ok, 0 if the segment doesn't exist, -1 if error, -2 if the
+   segment is corrupted (error_r contains the reason). */
+static int
+fts_native_segment_open(struct fts_native_index *index, uint32_t id,
+			struct fts_native_segment **seg_r, const char **error_r)
+{
+	struct fts_native_segment *seg;
+	const struct fts_native_segment_header *hdr;
+	const char *path = fts_native_segment_path(index, id);
+	struct stat st;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+
+	seg = i_new(struct fts_native_segment, 1);
+	seg->id = id;
+	if (index->set.mmap_disable) {
+		if (fstat(fd, &st) < 0) {
+			*error_r = t_strdup_printf("fstat(%s) failed: %m", path);
+			ret = -1;
+		} else {
+			seg->buf = buffer_create_dynamic(default_pool,
+							 st.st_size);
+			ret = read_full(fd, buffer_append_space_unsafe(seg->buf,
+					st.st_size), st.st_size);
+			if (ret < 0) {
+				*error_r = t_strdup_printf(
+					"read(%s) failed: %m", path);
+			} else if (ret == 0) {
+				*error_r = t_strdup_printf(
+					"read(%s) failed: Unexpected EOF", path);
+				ret = -1;
+			}
+			seg->data = seg->buf->data;
+			seg->size = seg->buf->used;
+		}
+	} else {
+		seg->mmap_base = mmap_ro_file(fd, &seg->size);
+		if (seg->mmap_base == MAP_FAILED) {
+			seg->mmap_base = NULL;
+			*error_r = t_strdup_printf("mmap(%s) failed: %m", path);
+			ret = -1;
+		} else {
+			seg->data = seg->mmap_base;
+			ret = 1;
+		}
+	}
+	i_close_fd(&fd);
+	if (ret < 0) {
+		fts_native_segment_free(&seg);
+		return -1;
+	}
+
+	hdr = (const void *)seg->data;
+	if (seg->size < sizeof(*hdr)) {
+		fts_native_segment_free(&seg);
+		*error_r = "File too small";
+		return -2;
+	}
+	if (hdr->version != FTS_NATIVE_SEGMENT_VERSION ||
+	    hdr->term_index_offset < sizeof(*hdr) ||
+	    hdr->term_index_offset % sizeof(uint32_t) != 0 ||
+	    hdr->term_index_offset > seg->size ||
+	    (seg->size - hdr->term_index_offset) / sizeof(uint32_t) <
+	    hdr->terms_count) {
+		fts_native_segment_free(&seg);
+		*error_r = "Invalid header";
+		return -2;
+	}
+	seg->hdr = hdr;
+	seg->term_offsets = CONST_PTR_OFFSET(seg->data, hdr->term_index_offset);
+	*seg_r = seg;
+	return 1;
+}
+
+static struct fts_native_segment *
+fts_native_index_find_segment(struct fts_native_index *index, uint32_t id)
+{
+	struct fts_native_segment *seg;
+
+	array_foreach_elem(&index->segments, seg) {
+		if (seg->id == id)
+			return seg;
+	}
+	return NULL;
+}
+
+static int
+fts_native_index_parse_manifest(struct fts_native_index *index,
+				const buffer_t *buf, const char **error_r)
+{
+	const struct fts_native_manifest_header *hdr = buf->data;
+	ARRAY(struct fts_native_segment *) new_segments;
+	struct fts_native_segment *seg, **segp;
+	const uint32_t *ids;
+	const struct seq_range *expunged;
+	unsigned int i;
+	uint32_t bad_id = 0;
+	int ret = 1;
+
+	if (buf->used < sizeof(*hdr) ||
+	    hdr->version != FTS_NATIVE_MANIFEST_VERSION ||
+	    (buf->used - sizeof(*hdr)) / sizeof(uint32_t) < hdr->segments_count ||
+	    (buf->used - sizeof(*hdr) - hdr->segments_count * sizeof(uint32_t)) /
+	    sizeof(struct seq_range) != hdr->expunged_count) {
+		fts_native_index_set_corrupted(index, index->set.path,
+					       "Invalid header", error_r);
+		return -1;
+	}
+	ids = CONST_PTR_OFFSET(buf->data, sizeof(*hdr));
+	expunged = (const void *)(ids + hdr->segments_count);
+
+	array_clear(&index->stale_segment_ids);
+	if (hdr->uid_validity != index->set.uid_validity) {
+		/* mailbox was recreated - the old index is useless */
+		array_foreach_modifiable(&index->segments, segp)
+			fts_native_segment_free(segp);
+		array_clear(&index->segments);
+		array_clear(&index->expunged);
+		array_append(&index->stale_segment_ids, ids,
+			     hdr->segments_count);
+		index->hdr = *hdr;
+		index->hdr.last_uid = 0;
+		index->hdr.segments_count = 0;
+		index->hdr.expunged_count = 0;
+		return 1;
+	}
+
+	/* keep the already opened segments that are still valid */
+	i_array_init(&new_segments, hdr->segments_count + 1);
+	for (i = 0; i < hdr->segments_count; i++) {
+		seg = fts_native_index_find_segment(index, ids[i]);
+		if (seg != NULL) {
+			array_push_back(&new_segments, &seg);
+			continue;
+		}
+		ret = fts_native_segment_open(index, ids[i], &seg, error_r);
+		if (ret <= 0) {
+			bad_id = ids[i];
+			break;
+		}
+		array_push_back(&new_segments, &seg);
+	}
+	if (ret <= 0) {
+		/* free the segments that we just opened */
+		array_foreach_modifiable(&new_segments, segp) {
+			if (fts_native_index_find_segment(index, (*segp)->id) == NULL)
+				fts_native_segment_free(segp);
+		}
+		array_free(&new_segments);
+		if (ret == -2) {
+			fts_native_index_set_corrupted(index,
+				fts_native_segment_path(index, bad_id),
+				*error_r, error_r);
+			return -1;
+		}
+		return ret;
+	}
+	array_foreach_modifiable(&index->segments, segp) {
+		for (i = 0; i < hdr->segments_count; i++) {
+			if (ids[i] == (*segp)->id)
+				break;
+		}
+		if (i == hdr->segments_count)
+			fts_native_segment_free(segp);
+	}
+	array_clear(&index->segments);
+	array_append_array(&index->segments, &new_segments);
+	array_free(&new_segments);
+
+	array_clear(&index->expunged);
+	array_append(&index->expunged, expunged, hdr->expunged_count);
+	index->hdr = *hdr;
+	return 1;
+}
+
+static int
+fts_native_index_read_manifest(struct fts_native_index *index,
+			       const char **error_r)
+{
+	buffer_t *buf;
+	struct stat st;
+	int fd, ret;
+
+	fd = open(index->set.path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			*error_r = t_strdup_printf("open(%s) failed: %m",
+						   index->set.path);
+			return -1;
+		}
+		/* no index yet */
+		fts_native_index_close(index);
+		return 1;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m",
+					   index->set.path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	if (index->have_manifest_st &&
+	    st.st_ino == index->manifest_st.st_ino &&
+	    CMP_DEV_T(st.st_dev, index->manifest_st.st_dev) &&
+	    st.st_size == index->manifest_st.st_size &&
+	    st.st_mtime == index->manifest_st.st_mtime &&
+	    ST_MTIME_NSEC(st) == ST_MTIME_NSEC(index->manifest_st)) {
+		/* unchanged */
+		i_close_fd(&fd);
+		return 1;
+	}
+
+	buf = t_buffer_create(st.st_size);
+	ret = read_full(fd, buffer_append_space_unsafe(buf, st.st_size),
+			st.st_size);
+	i_close_fd(&fd);
+	if (ret < 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %m",
+					   index->set.path);
+		return -1;
+	}
+	if (ret == 0) {
+		/* replaced while we were reading it */
+		return 0;
+	}
+	if ((ret = fts_native_index_parse_manifest(index, buf, error_r)) <= 0)
+		return ret;
+	index->manifest_st = st;
+	index->have_manifest_st = TRUE;
+	return 1;
+}
+
+int fts_native_index_refresh(struct fts_native_index *index,
+			     const char **error_r)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < FTS_NATIVE_REFRESH_RETRIES; i++) {
+		T_BEGIN {
+			ret = fts_native_index_read_manifest(index, error_r);
+			if (ret < 0)
+				*error_r = t_strdup(*error_r);
+		} T_END_PASS_STR_IF(ret < 0, error_r);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+	}
+	*error_r = t_strdup_printf("%s keeps changing while it's being read",
+				   index->set.path);
+	return -1;
+}
+
+uint32_t fts_native_index_get_last_uid(struct fts_native_index *index)
+{
+	return index->hdr.last_uid;
+}
+
+static int
+fts_native_segment_lookup(struct fts_native_index *index,
+			  struct fts_native_segment *seg,
+			  const unsigned char *key, size_t key_size,
+			  bool prefix, ARRAY_TYPE(uint32_t) *uids,
+			  const char **error_r)
+{
+	struct fts_native_term_rec rec;
+	unsigned int idx, left_idx, right_idx;
+
+	/* find the first term >= key */
+	left_idx = 0; right_idx = seg->hdr->terms_count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (fts_native_segment_get_term(seg, idx, &rec) < 0)
+			goto corrupted;
+		if (fts_native_term_rec_cmp(&rec, key, key_size) < 0)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+
+	for (idx = left_idx; idx < seg->hdr->terms_count; idx++) {
+		if (fts_native_segment_get_term(seg, idx, &rec) < 0)
+			goto corrupted;
+		if (rec.key_size < key_size ||
+		    memcmp(rec.key, key, key_size) != 0)
+			break;
+		if (!prefix && rec.key_size != key_size)
+			break;
+		if (fts_native_term_rec_get_uids(&rec, uids) < 0)
+			goto corrupted;
+		if (!prefix)
+			break;
+	}
+	return 0;
+
+corrupted:
+	fts_native_index_set_corrupted(index,
+		fts_native_segment_path(index, seg->id),
+		"Broken term record", error_r);
+	return -1;
+}
+
+int fts_native_index_lookup(struct fts_native_index *index,
+			    const char *field, const char *term, bool prefix,
+			    ARRAY_TYPE(seq_range) *uids, const char **error_r)
+{
+	struct fts_native_segment *seg;
+	ARRAY_TYPE(seq_range) found_uids;
+	ARRAY_TYPE(uint32_t) seg_uids;
+	const char *key = t_strconcat(field, ":", term, NULL);
+	const uint32_t *uidp;
+	int ret = 0;
+
+	t_array_init(&found_uids, 128);
+	t_array_init(&seg_uids, 128);
+	array_foreach_elem(&index->segments, seg) {
+		array_clear(&seg_uids);
+		if (fts_native_segment_lookup(index, seg,
+					      (const unsigned char *)key,
+					      strlen(key), prefix, &seg_uids,
+					      error_r) < 0) {
+			ret = -1;
+			break;
+		}
+		array_foreach(&seg_uids, uidp)
+			seq_range_array_add(&found_uids, *uidp);
+	}
+	if (ret < 0)
+		return -1;
+	seq_range_array_remove_seq_range(&found_uids, &index->expunged);
+	seq_range_array_merge(uids, &found_uids);
+	return 0;
+}
+
+struct fts_native_index_update *
+fts_native_index_update_begin(struct fts_native_index *index)
+{
+	struct fts_native_index_update *update;
+	pool_t pool;
+
+	pool = pool_alloconly_create("fts native update", 1024*32);
+	update = p_new(pool, struct fts_native_index_update, 1);
+	update->index = index;
+	update->pool = pool;
+	hash_table_create(&update->terms, pool, 1024, str_hash, strcmp);
+	p_array_init(&update->expunged, pool, 16);
+	update->key = str_new(default_pool, 128);
+	return update;
+}
+
+void fts_native_index_update_add(struct fts_native_index_update *update,
+				 const char *field, const unsigned char *term,
+				 size_t term_size, uint32_t uid)
+{
+	struct fts_native_term *fterm;
+	const uint32_t *last_uidp;
+	string_t *key = update->key;
+
+	i_assert(uid > 0);
+
+	if (term_size == 0 || memchr(term, '\0', term_size) != NULL) {
+		/* these can't be searched anyway */
+		return;
+	}
+
+	str_truncate(key, 0);
+	str_append(key, field);
+	str_append_c(key, ':');
+	str_append_data(key, term, term_size);
+
+	fterm = hash_table_lookup(update->terms, str_c(key));
+	if (fterm == NULL) {
+		fterm = p_new(update->pool, struct fts_native_term, 1);
+		fterm->key = p_strdup(update->pool, str_c(key));
+		i_array_init(&fterm->uids, 4);
+		hash_table_insert(update->terms, fterm->key, fterm);
+		update->memory_used += sizeof(*fterm) + str_len(key) + 1 +
+			sizeof(uint32_t) * 4;
+	} else {
+		last_uidp = array_back(&fterm->uids);
+		i_assert(*last_uidp <= uid);
+		if (*last_uidp == uid)
+			return;
+	}
+	array_push_back(&fterm->uids, &uid);
+	update->memory_used += sizeof(uint32_t);
+}
+
+void fts_native_index_update_expunge(struct fts_native_index_update *update,
+				     uint32_t uid)
+{
+	seq_range_array_add(&update->expunged, uid);
+}
+
+size_t fts_native_index_update_get_memory(struct fts_native_index_update *update)
+{
+	return update->memory_used;
+}
+
+static void
+fts_native_index_update_free(struct fts_native_index_update **_update)
+{
+	struct fts_native_index_update *update = *_update;
+	struct hash_iterate_context *iter;
+	const char *key;
+	struct fts_native_term *fterm;
+
+	*_update = NULL;
+	iter = hash_table_iterate_init(update->terms);
+	while (hash_table_iterate(iter, update->terms, &key, &fterm))
+		array_free(&fterm->uids);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&update->terms);
+	str_free(&update->key);
+	pool_unref(&update->pool);
+}
+
+static int
+fts_native_index_create_file(struct fts_native_index *index, const char *path,
+			     int *fd_r, const char **error_r)
+{
+	mode_t old_mask;
+	int fd;
+
+	old_mask = umask(0);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, index->set.mode);
+	umask(old_mask);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("open(%s, O_CREAT) failed: %m", path);
+		return -1;
+	}
+	if (index->set.gid != (gid_t)-1 &&
+	    fchown(fd, (uid_t)-1, index->set.gid) < 0) {
+		if (errno == EPERM) {
+			*error_r = eperm_error_get_chgrp("fchown", path,
+							 index->set.gid,
+							 index->set.gid_origin);
+		} else {
+			*error_r = t_strdup_printf(
+				"fchown(%s, -1, %ld) failed: %m",
+				path, (long)index->set.gid);
+		}
+		i_close_fd(&fd);
+		i_unlink(path);
+		return -1;
+	}
+	*fd_r = fd;
+	return 0;
+}
+
+static int
+fts_native_index_finish_file(struct fts_native_index *index, int *fd,
+			     const char *temp_path, const char *path,
+			     const char **error_r)
+{
+	int ret = 0;
+
+	if (index->set.fsync && fdatasync(*fd) < 0) {
+		*error_r = t_strdup_printf("fdatasync(%s) failed: %m",
+					   temp_path);
+		ret = -1;
+	}
+	if (close(*fd) < 0 && ret == 0) {
+		*error_r = t_strdup_printf("close(%s) failed: %m", temp_path);
+		ret = -1;
+	}
+	*fd = -1;
+	if (ret == 0 && rename(temp_path, path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0)
+		i_unlink_if_exists(temp_path);
+	return ret;
+}
+
+static int
+fts_native_segment_writer_init(struct fts_native_index *index, uint32_t id,
+			       struct fts_native_segment_writer **writer_r,
+			       const char **error_r)
+{
+	struct fts_native_segment_writer *writer;
+	const char *path, *temp_path;
+	int fd;
+
+	path = fts_native_segment_path(index, id);
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	if (fts_native_index_create_file(index, temp_path, &fd, error_r) < 0)
+		return -1;
+
+	writer = i_new(struct fts_native_segment_writer, 1);
+	writer->index = index;
+	writer->path = path;
+	writer->temp_path = temp_path;
+	writer->fd = fd;
+	writer->output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(writer->output);
+	writer->hdr.version = FTS_NATIVE_SEGMENT_VERSION;
+	i_array_init(&writer->term_offsets, 1024);
+	writer->buf = buffer_create_dynamic(default_pool, 256);
+
+	/* header is rewritten once we know the term index offset */
+	o_stream_nsend(writer->output, &writer->hdr, sizeof(writer->hdr));
+	*writer_r = writer;
+	return 0;
+}
+
+static void
+fts_native_segment_writer_add(struct fts_native_segment_writer *writer,
+			      const unsigned char *key, size_t key_size,
+			      const uint32_t *uids, unsigned int count)
+{
+	uint32_t offset, prev_uid = 0;
+	unsigned int i;
+
+	if (count == 0)
+		return;
+	if (writer->output->offset > (uint32_t)-1) {
+		/* too large - caught by _finish() */
+		return;
+	}
+	offset = writer->output->offset;
+	array_push_back(&writer->term_offsets, &offset);
+
+	if (writer->hdr.first_uid == 0 || uids[0] < writer->hdr.first_uid)
+		writer->hdr.first_uid = uids[0];
+	if (uids[count-1] > writer->hdr.last_uid)
+		writer->hdr.last_uid = uids[count-1];
+
+	buffer_set_used_size(writer->buf, 0);
+	for (i = 0; i < count; i++) {
+		i_assert(uids[i] > prev_uid);
+		numpack_encode(writer->buf, uids[i] - prev_uid);
+		prev_uid = uids[i];
+	}
+	T_BEGIN {
+		buffer_t *prefix = t_buffer_create(16);
+
+		numpack_encode(prefix, key_size);
+		o_stream_nsend(writer->output, prefix->data, prefix->used);
+		o_stream_nsend(writer->output, key, key_size);
+		buffer_set_used_size(prefix, 0);
+		numpack_encode(prefix, writer->buf->used);
+		o_stream_nsend(writer->output, prefix->data, prefix->used);
+	} T_END;
+	o_stream_nsend(writer->output, writer->buf->data, writer->buf->used);
+}
+
+static void
+fts_native_segment_writer_free(struct fts_native_segment_writer **_writer)
+{
+	struct fts_native_segment_writer *writer = *_writer;
+
+	*_writer = NULL;
+	o_stream_destroy(&writer->output);
+	i_close_fd(&writer->fd);
+	array_free(&writer->term_offsets);
+	buffer_free(&writer->buf);
+	i_free(writer);
+}
+
+static void
+fts_native_segment_writer_abort(struct fts_native_segment_writer **_writer)
+{
+	struct fts_native_segment_writer *writer = *_writer;
+
+	o_stream_abort(writer->output);
+	i_unlink_if_exists(writer->temp_path);
+	fts_native_segment_writer_free(_writer);
+}
+
+static int
+fts_native_segment_writer_finish(struct fts_native_segment_writer **_writer,
+				 const char **error_r)
+{
+	struct fts_native_segment_writer *writer = *_writer;
+	static const unsigned char zeros[sizeof(uint32_t)] = { 0, };
+	size_t pad;
+	int ret = 0;
+
+	pad = writer->output->offset % sizeof(uint32_t);
+	if (pad != 0)
+		o_stream_nsend(writer->output, zeros, sizeof(uint32_t) - pad);
+	writer->hdr.term_index_offset = writer->output->offset;
+	writer->hdr.terms_count = array_count(&writer->term_offsets);
+	o_stream_nsend(writer->output, array_front(&writer->term_offsets),
+		       array_count(&writer->term_offsets) * sizeof(uint32_t));
+
+	if (writer->output->offset > (uint32_t)-1) {
+		*error_r = t_strdup_printf("%s: Segment grew too large",
+					   writer->temp_path);
+		ret = -1;
+	} else if (o_stream_finish(writer->output) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %s",
+			writer->temp_path, o_stream_get_error(writer->output));
+		ret = -1;
+	} else if (pwrite_full(writer->fd, &writer->hdr,
+			       sizeof(writer->hdr), 0) < 0) {
+		*error_r = t_strdup_printf("pwrite(%s) failed: %m",
+					   writer->temp_path);
+		ret = -1;
+	}
+	if (ret < 0) {
+		fts_native_segment_writer_abort(_writer);
+		return -1;
+	}
+	o_stream_destroy(&writer->output);
+	ret = fts_native_index_finish_file(writer->index, &writer->fd,
+					   writer->temp_path, writer->path,
+					   error_r);
+	fts_native_segment_writer_free(_writer);
+	return ret;
+}
+
+static int fts_native_term_cmp(struct fts_native_term *const *t1,
+			       struct fts_native_term *const *t2)
+{
+	return strcmp((*t1)->key, (*t2)->key);
+}
+
+static int
+fts_native_index_write_update(struct fts_native_index_update *update,
+			      uint32_t id, const char **error_r)
+{
+	struct fts_native_segment_writer *writer;
+	struct hash_iterate_context *iter;
+	ARRAY(struct fts_native_term *) sorted_terms;
+	struct fts_native_term *fterm;
+	const char *key;
+
+	if (fts_native_segment_writer_init(update->index, id,
+					   &writer, error_r) < 0)
+		return -1;
+
+	i_array_init(&sorted_terms, hash_table_count(update->terms));
+	iter = hash_table_iterate_init(update->terms);
+	while (hash_table_iterate(iter, update->terms, &key, &fterm))
+		array_push_back(&sorted_terms, &fterm);
+	hash_table_iterate_deinit(&iter);
+	array_sort(&sorted_terms, fts_native_term_cmp);
+
+	array_foreach_elem(&sorted_terms, fterm) {
+		fts_native_segment_writer_add(writer,
+			(const unsigned char *)fterm->key, strlen(fterm->key),
+			array_front(&fterm->uids), array_count(&fterm->uids));
+	}
+	array_free(&sorted_terms);
+	return fts_native_segment_writer_finish(&writer, error_r);
+}
+
+static int
+fts_native_index_write_manifest(struct fts_native_index *index,
+				const struct fts_native_manifest_header *hdr,
+				const uint32_t *ids,
+				const ARRAY_TYPE(seq_range) *expunged,
+				const char **error_r)
+{
+	struct fts_native_manifest_header new_hdr = *hdr;
+	const char *temp_path;
+	buffer_t *buf;
+	int fd;
+
+	new_hdr.version = FTS_NATIVE_MANIFEST_VERSION;
+	new_hdr.uid_validity = index->set.uid_validity;
+	new_hdr.expunged_count = array_count(expunged);
+
+	buf = t_buffer_create(sizeof(new_hdr) +
+			      new_hdr.segments_count * sizeof(uint32_t));
+	buffer_append(buf, &new_hdr, sizeof(new_hdr));
+	buffer_append(buf, ids, new_hdr.segments_count * sizeof(uint32_t));
+	if (new_hdr.expunged_count > 0) {
+		buffer_append(buf, array_front(expunged),
+			      new_hdr.expunged_count * sizeof(struct seq_range));
+	}
+
+	temp_path = t_strconcat(index->set.path, ".tmp", NULL);
+	if (fts_native_index_create_file(index, temp_path, &fd, error_r) < 0)
+		return -1;
+	if (write_full(fd, buf->data, buf->used) < 0) {
+		*error_r = t_strdup_printf("write(%s) failed: %m", temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return -1;
+	}
+	return fts_native_index_finish_file(index, &fd, temp_path,
+					    index->set.path, error_r);
+}
+
+static void
+fts_native_index_unlink_segments(struct fts_native_index *index,
+				 const uint32_t *ids, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		i_unlink_if_exists(fts_native_segment_path(index, ids[i]));
+}
+
+static int
+fts_native_index_merge_segments(struct fts_native_index *index,
+				unsigned int first_idx, uint32_t new_id,
+				unsigned int *terms_count_r,
+				const char **error_r)
+{
+	struct fts_native_segment *const *segs;
+	struct fts_native_segment_writer *writer;
+	struct fts_native_term_rec *recs, min_rec;
+	unsigned int *term_idx;
+	ARRAY_TYPE(uint32_t) uids;
+	uint32_t *uidp;
+	unsigned int i, j, count, seg_count, uids_count, bad_idx = 0;
+	bool sorted;
+	int ret = 0;
+
+	segs = array_get(&index->segments, &count);
+	segs += first_idx;
+	seg_count = count - first_idx;
+	i_assert(seg_count > 0);
+
+	if (fts_native_segment_writer_init(index, new_id, &writer, error_r) < 0)
+		return -1;
+
+	recs = t_new(struct fts_native_term_rec, seg_count);
+	term_idx = t_new(unsigned int, seg_count);
+	t_array_init(&uids, 1024);
+	for (i = 0; i < seg_count; i++) {
+		if (segs[i]->hdr->terms_count > 0 &&
+		    fts_native_segment_get_term(segs[i], 0, &recs[i]) < 0) {
+			bad_idx = i;
+			ret = -1;
+			break;
+		}
+	}
+
+	while (ret == 0) {
+		/* find the smallest key among the segments */
+		i_zero(&min_rec);
+		for (i = 0; i < seg_count; i++) {
+			if (term_idx[i] >= segs[i]->hdr->terms_count)
+				continue;
+			if (min_rec.key == NULL ||
+			    fts_native_term_rec_cmp(&recs[i], min_rec.key,
+						    min_rec.key_size) < 0)
+				min_rec = recs[i];
+		}
+		if (min_rec.key == NULL)
+			break;
+
+		/* concatenate its UIDs from all the segments */
+		array_clear(&uids);
+		for (i = 0; i < seg_count && ret == 0; i++) {
+			if (term_idx[i] >= segs[i]->hdr->terms_count ||
+			    fts_native_term_rec_cmp(&recs[i], min_rec.key,
+						    min_rec.key_size) != 0)
+				continue;
+			if (fts_native_term_rec_get_uids(&recs[i], &uids) < 0 ||
+			    (++term_idx[i] < segs[i]->hdr->terms_count &&
+			     fts_native_segment_get_term(segs[i], term_idx[i],
+							 &recs[i]) < 0)) {
+				bad_idx = i;
+				ret = -1;
+			}
+		}
+		if (ret < 0)
+			break;
+
+		/* drop expunged UIDs. segments are normally in ascending UID
+		   order, but don't trust that. */
+		sorted = TRUE;
+		uidp = array_get_modifiable(&uids, &uids_count);
+		for (i = j = 0; i < uids_count; i++) {
+			if (seq_range_exists(&index->expunged, uidp[i]))
+				continue;
+			if (j > 0 && uidp[j-1] >= uidp[i])
+				sorted = FALSE;
+			uidp[j++] = uidp[i];
+		}
+		if (!sorted) {
+			i_qsort(uidp, j, sizeof(*uidp), uint32_cmp);
+			uids_count = j;
+			for (i = j = 0; i < uids_count; i++) {
+				if (j == 0 || uidp[j-1] != uidp[i])
+					uidp[j++] = uidp[i];
+			}
+		}
+		fts_native_segment_writer_add(writer, min_rec.key,
+					      min_rec.key_size, uidp, j);
+	}
+	if (ret < 0) {
+		fts_native_segment_writer_abort(&writer);
+		fts_native_index_set_corrupted(index,
+			fts_native_segment_path(index, segs[bad_idx]->id),
+			"Broken term record", error_r);
+		return -1;
+	}
+	*terms_count_r = array_count(&writer->term_offsets);
+	return fts_native_segment_writer_finish(&writer, error_r);
+}
+
+static int
+fts_native_index_merge(struct fts_native_index *index, unsigned int first_idx,
+		       const char **error_r)
+{
+	struct fts_native_manifest_header hdr = index->hdr;
+	struct fts_native_segment *const *segs;
+	ARRAY_TYPE(uint32_t) ids, old_ids;
+	ARRAY_TYPE(seq_range) empty_expunged;
+	const ARRAY_TYPE(seq_range) *expunged = &index->expunged;
+	unsigned int i, count, terms_count;
+	uint32_t new_id = hdr.next_segment_id;
+
+	segs = array_get(&index->segments, &count);
+	if (fts_native_index_merge_segments(index, first_idx, new_id,
+					    &terms_count, error_r) < 0)
+		return -1;
+
+	t_array_init(&ids, count);
+	t_array_init(&old_ids, count);
+	for (i = 0; i < count; i++) {
+		if (i < first_idx)
+			array_push_back(&ids, &segs[i]->id);
+		else
+			array_push_back(&old_ids, &segs[i]->id);
+	}
+	if (terms_count > 0)
+		array_push_back(&ids, &new_id);
+	else
+		i_unlink(fts_native_segment_path(index, new_id));
+	if (first_idx == 0) {
+		/* all the expunged UIDs are now gone from the index */
+		t_array_init(&empty_expunged, 1);
+		expunged = &empty_expunged;
+	}
+	hdr.next_segment_id++;
+	hdr.segments_count = array_count(&ids);
+	if (fts_native_index_write_manifest(index, &hdr, array_front(&ids),
+					    expunged, error_r) < 0) {
+		i_unlink_if_exists(fts_native_segment_path(index, new_id));
+		return -1;
+	}
+	fts_native_index_unlink_segments(index, array_front(&old_ids),
+					 array_count(&old_ids));
+	return fts_native_index_refresh(index, error_r);
+}
+
+static unsigned int
+fts_native_index_auto_merge_first_idx(struct fts_native_index *index)
+{
+	struct fts_native_segment *const *segs;
+	unsigned int count, n;
+	uoff_t merge_size;
+
+	/* Merge the newest segments as long as the next older segment isn't
+	   larger than all of them together. This keeps the amount of data
+	   rewritten on each merge proportional to the amount of new data. */
+	segs = array_get(&index->segments, &count);
+	i_assert(count >= 2);
+	merge_size = segs[count-1]->size + segs[count-2]->size;
+	for (n = 2; n < count; n++) {
+		if (segs[count-n-1]->size > merge_size)
+			break;
+		merge_size += segs[count-n-1]->size;
+	}
+	return count - n;
+}
+
+int fts_native_index_update_commit(struct fts_native_index_update **_update,
+				   uint32_t last_uid, const char **error_r)
+{
+	struct fts_native_index_update *update = *_update;
+	struct fts_native_index *index = update->index;
+	struct fts_native_manifest_header hdr;
+	ARRAY_TYPE(uint32_t) ids;
+	ARRAY_TYPE(seq_range) expunged;
+	struct fts_native_segment *seg;
+	unsigned int stale_count;
+	uint32_t new_id = 0;
+	int ret = 0;
+
+	if (fts_native_index_refresh(index, error_r) < 0) {
+		fts_native_index_update_free(_update);
+		return -1;
+	}
+	stale_count = array_count(&index->stale_segment_ids);
+	if (hash_table_count(update->terms) == 0 &&
+	    array_count(&update->expunged) == 0 &&
+	    last_uid <= index->hdr.last_uid && stale_count == 0) {
+		/* nothing changed */
+		fts_native_index_update_free(_update);
+		return 0;
+	}
+
+	hdr = index->hdr;
+	if (hdr.next_segment_id == 0)
+		hdr.next_segment_id = 1;
+	hdr.last_uid = I_MAX(hdr.last_uid, last_uid);
+
+	t_array_init(&ids, array_count(&index->segments) + 1);
+	array_foreach_elem(&index->segments, seg)
+		array_push_back(&ids, &seg->id);
+	if (hash_table_count(update->terms) > 0) {
+		new_id = hdr.next_segment_id++;
+		if (fts_native_index_write_update(update, new_id, error_r) < 0)
+			ret = -1;
+		else
+			array_push_back(&ids, &new_id);
+	}
+	t_array_init(&expunged, array_count(&index->expunged) + 1);
+	array_append_array(&expunged, &index->expunged);
+	seq_range_array_merge(&expunged, &update->expunged);
+	fts_native_index_update_free(_update);
+	if (ret < 0)
+		return -1;
+
+	hdr.segments_count = array_count(&ids);
+	if (fts_native_index_write_manifest(index, &hdr, array_front(&ids),
+					    &expunged, error_r) < 0) {
+		if (new_id != 0)
+			i_unlink_if_exists(fts_native_segment_path(index, new_id));
+		return -1;
+	}
+	if (stale_count > 0) {
+		fts_native_index_unlink_segments(index,
+			array_front(&index->stale_segment_ids), stale_count);
+	}
+	if (fts_native_index_refresh(index, error_r) < 0)
+		return -1;
+
+	if (array_count(&index->segments) > index->set.max_segments) {
+		return fts_native_index_merge(index,
+			fts_native_index_auto_merge_first_idx(index), error_r);
+	}
+	return 0;
+}
+
+void fts_native_index_update_rollback(struct fts_native_index_update **update)
+{
+	fts_native_index_update_free(update);
+}
+
+static bool
+fts_native_index_is_segment_fname(struct fts_native_index *index,
+				  const char *prefix, const char *fname,
+				  uint32_t *id_r)
+{
+	struct fts_native_segment *seg;
+	const char *p, *suffix;
+
+	if (!str_begins(fname, prefix))
+		return FALSE;
+	p = fname + strlen(prefix);
+	suffix = strchr(p, '.');
+	if (strcmp(p, "tmp") == 0 ||
+	    (suffix != NULL && strcmp(suffix, ".tmp") == 0)) {
+		/* leftover temp file */
+		*id_r = 0;
+		return TRUE;
+	}
+	if (str_to_uint32(p, id_r) < 0 || *id_r == 0)
+		return FALSE;
+	array_foreach_elem(&index->segments, seg) {
+		if (seg->id == *id_r)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void fts_native_index_unlink_leftovers(struct fts_native_index *index)
+{
+	const char *dir, *prefix, *p;
+	struct dirent *d;
+	uint32_t id;
+	DIR *dirp;
+
+	p = strrchr(index->set.path, '/');
+	dir = p == NULL ? "." : t_strdup_until(index->set.path, p);
+	prefix = t_strconcat(p == NULL ? index->set.path : p + 1, ".", NULL);
+
+	dirp = opendir(dir);
+	if (dirp == NULL) {
+		i_error("opendir(%s) failed: %m", dir);
+		return;
+	}
+	while ((d = readdir(dirp)) != NULL) {
+		if (fts_native_index_is_segment_fname(index, prefix,
+						      d->d_name, &id))
+			i_unlink_if_exists(t_strconcat(dir, "/", d->d_name, NULL));
+	}
+	if (closedir(dirp) < 0)
+		i_error("closedir(%s) failed: %m", dir);
+}
+
+int fts_native_index_optimize(struct fts_native_index *index,
+			      const char **error_r)
+{
+	if (fts_native_index_refresh(index, error_r) < 0)
+		return -1;
+	if (array_count(&index->segments) > 1 ||
+	    (array_count(&index->segments) == 1 &&
+	     array_count(&index->expunged) > 0)) {
+		if (fts_native_index_merge(index, 0, error_r) < 0)
+			return -1;
+	}
+	fts_native_index_unlink_leftovers(index);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef FTS_NATIVE_INDEX_H
+#define FTS_NATIVE_INDEX_H
+
+#include "seq-range-array.h"
+
+/* Per-mailbox inverted index. The index consists of a small manifest file
+   listing the currently valid segments and a number of immutable segment
+   files. Each segment is a sorted dictionary of "field:term" keys, each
+   pointing to a numpack-encoded list of delta-compressed UIDs. Segments are
+   mmap()ed for lookups. Each update commit writes a new segment, and the
+   segments are merged together once there are too many of them. */
+
+#define FTS_NATIVE_INDEX_DEFAULT_MAX_SEGMENTS 8
+
+struct fts_native_index_settings {
+	/* Path prefix for the index files. The manifest is written to
+	   <path>, segments to <path>.<id> */
+	const char *path;
+	/* UIDVALIDITY of the mailbox. If the index has a different
+	   UIDVALIDITY, it's treated as if it were empty and its old segments
+	   are dropped on the next commit. */
+	uint32_t uid_validity;
+
+	mode_t mode;
+	gid_t gid;
+	const char *gid_origin;
+
+	/* Merge segments after a commit when there are more than this
+	   many. */
+	unsigned int max_segments;
+
+	bool mmap_disable;
+	bool fsync;
+};
+
+struct fts_native_index *
+fts_native_index_init(const struct fts_native_index_settings *set);
+void fts_native_index_deinit(struct fts_native_index **index);
+
+/* Re-read the manifest if it has changed. Returns 0 on success, -1 if
+   error. A corrupted index is deleted and -1 is returned. */
+int fts_native_index_refresh(struct fts_native_index *index,
+			     const char **error_r);
+/* Returns the highest UID that has been indexed, or 0 if nothing. */
+uint32_t fts_native_index_get_last_uid(struct fts_native_index *index);
+
+/* Add UIDs containing the given term in the given field to uids. If prefix
+   is TRUE, all terms beginning with the term are matched. Expunged UIDs are
+   never returned. Returns 0 on success, -1 if error. */
+int fts_native_index_lookup(struct fts_native_index *index,
+			    const char *field, const char *term, bool prefix,
+			    ARRAY_TYPE(seq_range) *uids, const char **error_r);
+
+/* Build a new segment in memory. Terms must be added with non-decreasing
+   UIDs. */
+struct fts_native_index_update *
+fts_native_index_update_begin(struct fts_native_index *index);
+void fts_native_index_update_add(struct fts_native_index_update *update,
+				 const char *field, const unsigned char *term,
+				 size_t term_size, uint32_t uid);
+void fts_native_index_update_expunge(struct fts_native_index_update *update,
+				     uint32_t uid);
+/* Returns the approximate amount of memory used by the update. */
+size_t fts_native_index_update_get_memory(struct fts_native_index_update *update);
+/* Write the segment and add it to the manifest with last_uid as the new
+   last indexed UID. The segments are merged if there are too many of
+   them. The caller must be holding the index lock. Returns 0 on success,
+   -1 if error. */
+int fts_native_index_update_commit(struct fts_native_index_update **update,
+				   uint32_t last_uid, const char **error_r);
+void fts_native_index_update_rollback(struct fts_native_index_update **update);
+
+/* Merge all the segments into one, dropping the expunged UIDs. Also
+   delete any leftover segment files not listed in the manifest. The caller
+   must be holding the index lock. Returns 0 on success, -1 if error. */
+int fts_native_index_optimize(struct fts_native_index *index,
+			      const char **error_r);
+
+#endif
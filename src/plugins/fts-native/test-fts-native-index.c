@@ -0,0 +1,297 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "unlink-directory.h"
+#include "fts-native-index.h"
+#include "test-common.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TESTDIR_NAME ".dovecot.test"
+#define TEST_INDEX_PATH TESTDIR_NAME"/dovecot.fts.native"
+
+static struct fts_native_index_settings test_set = {
+	.path = TEST_INDEX_PATH,
+	.uid_validity = 12345,
+	.mode = 0600,
+	.gid = (gid_t)-1,
+	.gid_origin = "",
+	.max_segments = 100,
+};
+
+static void test_dir_init(void)
+{
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TESTDIR_NAME);
+}
+
+static void test_dir_deinit(void)
+{
+	const char *error;
+
+	(void)unlink_directory(TESTDIR_NAME, UNLINK_DIRECTORY_FLAG_RMDIR,
+			       &error);
+}
+
+static unsigned int test_count_segment_files(void)
+{
+	struct dirent *d;
+	unsigned int count = 0;
+	DIR *dirp;
+
+	dirp = opendir(TESTDIR_NAME);
+	if (dirp == NULL)
+		i_fatal("opendir(%s) failed: %m", TESTDIR_NAME);
+	while ((d = readdir(dirp)) != NULL) {
+		if (str_begins(d->d_name, "dovecot.fts.native."))
+			count++;
+	}
+	(void)closedir(dirp);
+	return count;
+}
+
+static void test_create_file(const char *path)
+{
+	int fd;
+
+	fd = creat(path, 0600);
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void test_add(struct fts_native_index_update *update,
+		     const char *field, const char *term, uint32_t uid)
+{
+	fts_native_index_update_add(update, field,
+				    (const unsigned char *)term, strlen(term),
+				    uid);
+}
+
+static void test_commit(struct fts_native_index_update **update,
+			uint32_t last_uid)
+{
+	const char *error;
+
+	if (fts_native_index_update_commit(update, last_uid, &error) < 0)
+		i_fatal("fts_native_index_update_commit() failed: %s", error);
+}
+
+static const char *
+test_lookup(struct fts_native_index *index, const char *field,
+	    const char *term, bool prefix)
+{
+	ARRAY_TYPE(seq_range) uids;
+	const struct seq_range *range;
+	const char *error;
+	string_t *str = t_str_new(64);
+
+	t_array_init(&uids, 8);
+	if (fts_native_index_lookup(index, field, term, prefix,
+				    &uids, &error) < 0)
+		return t_strconcat("error: ", error, NULL);
+	array_foreach(&uids, range) {
+		if (str_len(str) > 0)
+			str_append_c(str, ',');
+		if (range->seq1 == range->seq2)
+			str_printfa(str, "%u", range->seq1);
+		else
+			str_printfa(str, "%u:%u", range->seq1, range->seq2);
+	}
+	return str_c(str);
+}
+
+static void test_fts_native_index_lookup(void)
+{
+	struct fts_native_index *index;
+	struct fts_native_index_update *update;
+	const char *error;
+
+	test_begin("fts native index lookup");
+	test_dir_init();
+	index = fts_native_index_init(&test_set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index) == 0);
+	test_assert_strcmp(test_lookup(index, "body", "hello", FALSE), "");
+
+	update = fts_native_index_update_begin(index);
+	test_add(update, "body", "hello", 1);
+	test_add(update, "body", "hello", 1);
+	test_add(update, "body", "world", 1);
+	test_add(update, "hdr", "hello", 2);
+	test_add(update, "body", "hello", 3);
+	test_add(update, "body", "help", 4);
+	test_add(update, "body", "hel", 5);
+	/* terms with NULs are ignored */
+	fts_native_index_update_add(update, "body",
+				    (const unsigned char *)"he\0llo", 6, 6);
+	test_assert(fts_native_index_update_get_memory(update) > 0);
+	test_commit(&update, 6);
+	test_assert(fts_native_index_get_last_uid(index) == 6);
+
+	test_assert_strcmp(test_lookup(index, "body", "hello", FALSE), "1,3");
+	test_assert_strcmp(test_lookup(index, "hdr", "hello", FALSE), "2");
+	test_assert_strcmp(test_lookup(index, "body", "hel", FALSE), "5");
+	test_assert_strcmp(test_lookup(index, "body", "hel", TRUE), "1,3:5");
+	test_assert_strcmp(test_lookup(index, "body", "he", FALSE), "");
+	test_assert_strcmp(test_lookup(index, "body", "wor", TRUE), "1");
+	test_assert_strcmp(test_lookup(index, "body", "zzz", TRUE), "");
+	/* field names don't leak into other fields with prefix lookups */
+	test_assert_strcmp(test_lookup(index, "bod", "hello", TRUE), "");
+
+	/* another instance sees the same data */
+	struct fts_native_index *index2 = fts_native_index_init(&test_set);
+	test_assert(fts_native_index_refresh(index2, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index2) == 6);
+	test_assert_strcmp(test_lookup(index2, "body", "hel", TRUE), "1,3:5");
+	fts_native_index_deinit(&index2);
+
+	fts_native_index_deinit(&index);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fts_native_index_merge(void)
+{
+	struct fts_native_index_settings set = test_set;
+	struct fts_native_index *index;
+	struct fts_native_index_update *update;
+	const char *error;
+	uint32_t uid;
+
+	test_begin("fts native index merge");
+	test_dir_init();
+	set.max_segments = 3;
+	index = fts_native_index_init(&set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+
+	for (uid = 1; uid <= 10; uid++) {
+		update = fts_native_index_update_begin(index);
+		test_add(update, "body", "all", uid);
+		test_add(update, "body", uid % 2 == 0 ? "even" : "odd", uid);
+		test_commit(&update, uid);
+		/* segments are merged automatically */
+		test_assert(test_count_segment_files() <= 3);
+	}
+	test_assert(fts_native_index_get_last_uid(index) == 10);
+	test_assert_strcmp(test_lookup(index, "body", "all", FALSE), "1:10");
+	test_assert_strcmp(test_lookup(index, "body", "even", FALSE),
+			   "2,4,6,8,10");
+
+	/* expunges are hidden from lookups immediately */
+	update = fts_native_index_update_begin(index);
+	fts_native_index_update_expunge(update, 2);
+	fts_native_index_update_expunge(update, 3);
+	test_commit(&update, 0);
+	test_assert(fts_native_index_get_last_uid(index) == 10);
+	test_assert_strcmp(test_lookup(index, "body", "all", FALSE), "1,4:10");
+
+	/* leftover files are deleted by optimize */
+	test_create_file(TEST_INDEX_PATH".999");
+	test_create_file(TEST_INDEX_PATH".5.tmp");
+	test_assert(fts_native_index_optimize(index, &error) == 0);
+	test_assert(test_count_segment_files() == 1);
+	test_assert_strcmp(test_lookup(index, "body", "all", FALSE), "1,4:10");
+	test_assert_strcmp(test_lookup(index, "body", "odd", FALSE), "1,5,7,9");
+
+	/* an update with no changes doesn't write anything */
+	update = fts_native_index_update_begin(index);
+	test_commit(&update, 5);
+	test_assert(test_count_segment_files() == 1);
+
+	fts_native_index_deinit(&index);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fts_native_index_uidvalidity(void)
+{
+	struct fts_native_index_settings set = test_set;
+	struct fts_native_index *index;
+	struct fts_native_index_update *update;
+	const char *error;
+
+	test_begin("fts native index uidvalidity change");
+	test_dir_init();
+	index = fts_native_index_init(&set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	update = fts_native_index_update_begin(index);
+	test_add(update, "body", "foo", 1);
+	test_commit(&update, 1);
+	fts_native_index_deinit(&index);
+
+	set.uid_validity++;
+	index = fts_native_index_init(&set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index) == 0);
+	test_assert_strcmp(test_lookup(index, "body", "foo", FALSE), "");
+
+	update = fts_native_index_update_begin(index);
+	test_add(update, "body", "bar", 1);
+	test_commit(&update, 1);
+	test_assert_strcmp(test_lookup(index, "body", "foo", FALSE), "");
+	test_assert_strcmp(test_lookup(index, "body", "bar", FALSE), "1");
+	/* the old segment was deleted */
+	test_assert(test_count_segment_files() == 1);
+
+	fts_native_index_deinit(&index);
+	test_dir_deinit();
+	test_end();
+}
+
+static void test_fts_native_index_corrupted(void)
+{
+	struct fts_native_index *index;
+	struct fts_native_index_update *update;
+	const char *error;
+	int fd;
+
+	test_begin("fts native index corrupted");
+	test_dir_init();
+	index = fts_native_index_init(&test_set);
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	update = fts_native_index_update_begin(index);
+	test_add(update, "body", "foo", 1);
+	test_commit(&update, 1);
+	fts_native_index_deinit(&index);
+
+	/* break the segment's header */
+	fd = open(TEST_INDEX_PATH".1", O_WRONLY);
+	if (fd == -1)
+		i_fatal("open() failed: %m");
+	if (pwrite(fd, "\xff", 1, 0) != 1)
+		i_fatal("pwrite() failed: %m");
+	i_close_fd(&fd);
+
+	index = fts_native_index_init(&test_set);
+	test_assert(fts_native_index_refresh(index, &error) < 0);
+	test_assert(strstr(error, "Corrupted") != NULL);
+	/* the index was reset */
+	test_assert(fts_native_index_refresh(index, &error) == 0);
+	test_assert(fts_native_index_get_last_uid(index) == 0);
+	fts_native_index_deinit(&index);
+
+	test_dir_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fts_native_index_lookup,
+		test_fts_native_index_merge,
+		test_fts_native_index_uidvalidity,
+		test_fts_native_index_corrupted,
+		NULL
+	};
+	return test_run(test_functions);
+}
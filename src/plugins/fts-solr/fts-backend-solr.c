@@ -29,9 +29,19 @@
 
 #define SOLR_QUERY_MAX_MAILBOX_COUNT 10
 
+struct solr_fts_multi_lookup {
+	struct solr_connection_select *select;
+	HASH_TABLE(char *, struct mailbox *) mailboxes;
+	enum fts_lookup_flags flags;
+	struct fts_multi_result *result;
+	bool search_all_mailboxes;
+};
+
 struct solr_fts_backend {
 	struct fts_backend backend;
 	struct solr_connection *solr_conn;
+	/* submitted lookup_multi() waiting for its result */
+	struct solr_fts_multi_lookup *multi_lookup;
 };
 
 struct solr_fts_field {
@@ -45,6 +55,7 @@ struct solr_fts_backend_update_context {
 	struct mailbox *cur_box;
 	char box_guid[MAILBOX_GUID_HEX_LENGTH+1];
 
+	/* current batch is streamed, because it grew over batch_bytes */
 	struct solr_connection_post *post;
 	uint32_t prev_uid;
 	string_t *cmd, *cur_value, *cur_value2;
@@ -55,6 +66,7 @@ struct solr_fts_backend_update_context {
 	unsigned int mails_since_flush;
 
 	bool tokenized_input:1;
+	bool adding:1;
 	bool last_indexed_uid_set:1;
 	bool body_open:1;
 	bool documents_added:1;
@@ -203,6 +215,7 @@ static void fts_backend_solr_deinit(struct fts_backend *_backend)
 {
 	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
 
+	i_assert(backend->multi_lookup == NULL);
 	solr_connection_deinit(&backend->solr_conn);
 	i_free(backend);
 }
@@ -354,20 +367,74 @@ fts_backend_solr_doc_close(struct solr_fts_backend_update_context *ctx)
 	str_append(ctx->cmd, "</doc>");
 }
 
+static void
+fts_backend_solr_cmd_begin(struct solr_fts_backend_update_context *ctx,
+			   string_t *cmd, const char *name)
+{
+	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
+
+	if (fuser->set.commit_within_msecs == 0)
+		str_printfa(cmd, "<%s>", name);
+	else {
+		str_printfa(cmd, "<%s commitWithin=\"%u\">", name,
+			    fuser->set.commit_within_msecs);
+	}
+}
+
+static int
+fts_backend_solr_post(struct solr_fts_backend_update_context *ctx,
+		      string_t *cmd)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
+	int ret;
+
+	/* keep at most max_parallel_posts requests in flight, including
+	   this one */
+	ret = solr_connection_post_wait(backend->solr_conn,
+					fuser->set.max_parallel_posts - 1);
+	solr_connection_post_async(backend->solr_conn,
+				   str_data(cmd), str_len(cmd));
+	str_truncate(cmd, 0);
+	return ret;
+}
+
+static void
+fts_backend_solr_stream_begin(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+
+	i_assert(ctx->post == NULL);
+
+	/* the batch is too large to buffer. send it using a streamed
+	   request after the already submitted ones have finished. */
+	if (solr_connection_post_wait(backend->solr_conn, 0) < 0)
+		ctx->ctx.failed = TRUE;
+	ctx->post = solr_connection_post_begin(backend->solr_conn);
+	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
+				  str_len(ctx->cmd));
+	str_truncate(ctx->cmd, 0);
+}
+
 static int
 fts_backed_solr_build_flush(struct solr_fts_backend_update_context *ctx)
 {
-	if (ctx->post == NULL)
+	if (!ctx->adding)
 		return 0;
 
 	fts_backend_solr_doc_close(ctx);
 	str_append(ctx->cmd, "</add>");
 	ctx->mails_since_flush = 0;
-
-	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-				  str_len(ctx->cmd));
-	str_truncate(ctx->cmd, 0);
-	return solr_connection_post_end(&ctx->post);
+	ctx->adding = FALSE;
+	if (ctx->post != NULL) {
+		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
+					  str_len(ctx->cmd));
+		str_truncate(ctx->cmd, 0);
+		return solr_connection_post_end(&ctx->post);
+	}
+	return fts_backend_solr_post(ctx, ctx->cmd);
 }
 
 static void
@@ -376,10 +443,15 @@ fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 	struct solr_fts_backend *backend =
 		(struct solr_fts_backend *)ctx->ctx.backend;
 
+	/* the expunged mails may be among the documents that are still
+	   being added */
+	if (solr_connection_post_wait(backend->solr_conn, 0) < 0)
+		ctx->ctx.failed = TRUE;
+
 	str_append(ctx->cmd_expunge, "</delete>");
 	(void)solr_connection_post(backend->solr_conn, str_c(ctx->cmd_expunge));
 	str_truncate(ctx->cmd_expunge, 0);
-	str_append(ctx->cmd_expunge, "<delete>");
+	fts_backend_solr_cmd_begin(ctx, ctx->cmd_expunge, "delete");
 }
 
 static int
@@ -392,17 +464,22 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(_ctx->backend->ns->user);
 	struct solr_fts_field *field;
 	const char *str;
-	int ret = _ctx->failed ? -1 : 0;
+	int ret;
 
 	if (fts_backed_solr_build_flush(ctx) < 0)
-		ret = -1;
+		_ctx->failed = TRUE;
+	if (solr_connection_post_wait(backend->solr_conn, 0) < 0)
+		_ctx->failed = TRUE;
+	ret = _ctx->failed ? -1 : 0;
 
 	if (ctx->documents_added || ctx->expunges) {
-		/* commit and wait until the documents we just indexed are
-		   visible to the following search */
 		if (ctx->expunges)
 			fts_backend_solr_expunge_flush(ctx);
-		if (fuser->set.soft_commit) {
+		/* commit and wait until the documents we just indexed are
+		   visible to the following search. With commit_within Solr
+		   commits them on its own schedule instead. */
+		if (fuser->set.soft_commit &&
+		    fuser->set.commit_within_msecs == 0) {
 			str = t_strdup_printf("<commit softCommit=\"true\" waitSearcher=\"%s\"/>",
 					      ctx->documents_added ? "true" : "false");
 			if (solr_connection_post(backend->solr_conn, str) < 0)
@@ -427,6 +504,8 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)_ctx->backend;
 	const char *box_guid;
 
 	if (ctx->prev_uid != 0) {
@@ -436,7 +515,9 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 		   last_uid before we know it has succeeded */
 		if (fts_backed_solr_build_flush(ctx) < 0)
 			_ctx->failed = TRUE;
-		else if (!_ctx->failed)
+		if (solr_connection_post_wait(backend->solr_conn, 0) < 0)
+			_ctx->failed = TRUE;
+		if (!_ctx->failed)
 			fts_index_set_last_uid(ctx->cur_box, ctx->prev_uid);
 		ctx->prev_uid = 0;
 	}
@@ -477,7 +558,7 @@ fts_backend_solr_update_expunge(struct fts_backend_update_context *_ctx,
 	if (!ctx->expunges) {
 		ctx->expunges = TRUE;
 		ctx->cmd_expunge = str_new(default_pool, 1024);
-		str_append(ctx->cmd_expunge, "<delete>");
+		fts_backend_solr_cmd_begin(ctx, ctx->cmd_expunge, "delete");
 	}
 
 	if (str_len(ctx->cmd_expunge) >= SOLR_CMDBUF_FLUSH_SIZE)
@@ -492,20 +573,20 @@ static void
 fts_backend_solr_uid_changed(struct solr_fts_backend_update_context *ctx,
 			     uint32_t uid)
 {
-	struct solr_fts_backend *backend =
-		(struct solr_fts_backend *)ctx->ctx.backend;
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
 
-	if (ctx->mails_since_flush >= fuser->set.batch_size) {
+	if (ctx->mails_since_flush >= fuser->set.batch_size ||
+	    ctx->post != NULL ||
+	    (ctx->cmd != NULL && str_len(ctx->cmd) >= fuser->set.batch_bytes)) {
 		if (fts_backed_solr_build_flush(ctx) < 0)
 			ctx->ctx.failed = TRUE;
 	}
 	ctx->mails_since_flush++;
-	if (ctx->post == NULL) {
+	if (!ctx->adding) {
 		if (ctx->cmd == NULL)
 			ctx->cmd = str_new(default_pool, SOLR_CMDBUF_SIZE);
-		ctx->post = solr_connection_post_begin(backend->solr_conn);
-		str_append(ctx->cmd, "<add>");
+		fts_backend_solr_cmd_begin(ctx, ctx->cmd, "add");
+		ctx->adding = TRUE;
 	} else {
 		fts_backend_solr_doc_close(ctx);
 	}
@@ -572,15 +653,19 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
+	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(_ctx->backend->ns->user);
 	size_t len;
 
 	if (_ctx->failed)
 		return -1;
 
 	if (ctx->cur_value2 == NULL && ctx->cur_value == ctx->cmd) {
-		/* we're writing to message body. if size is huge,
-		   flush it once in a while */
-		while (size >= SOLR_CMDBUF_FLUSH_SIZE) {
+		/* we're writing to message body. if the batch grows too
+		   large, stream it and flush the body once in a while. */
+		if (ctx->post == NULL &&
+		    str_len(ctx->cmd) + size >= fuser->set.batch_bytes)
+			fts_backend_solr_stream_begin(ctx);
+		while (ctx->post != NULL && size >= SOLR_CMDBUF_FLUSH_SIZE) {
 			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
 				solr_connection_post_more(ctx->post,
 							  str_data(ctx->cmd),
@@ -613,7 +698,7 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 		}
 	}
 
-	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
+	if (ctx->post != NULL && str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
 		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
 					  str_len(ctx->cmd));
 		str_truncate(ctx->cmd, 0);
@@ -858,21 +943,23 @@ fts_backend_solr_lookup(struct fts_backend *_backend, struct mailbox *box,
 	return 0;
 }
 
-static int
-solr_search_multi(struct fts_backend *_backend, string_t *str,
-		  struct mailbox *const boxes[], enum fts_lookup_flags flags,
-		  struct fts_multi_result *result)
+static void
+solr_search_multi_submit(struct fts_backend *_backend, string_t *str,
+			 struct mailbox *const boxes[],
+			 enum fts_lookup_flags flags,
+			 struct fts_multi_result *result)
 {
 	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
-	struct solr_result **solr_results;
-	struct fts_result *fts_result;
-	ARRAY(struct fts_result) fts_results;
-	HASH_TABLE(char *, struct mailbox *) mailboxes;
-	struct mailbox *box;
+	struct solr_fts_multi_lookup *lookup;
 	const char *box_guid;
 	unsigned int i;
 	size_t len;
-	bool search_all_mailboxes;
+
+	i_assert(backend->multi_lookup == NULL);
+
+	lookup = i_new(struct solr_fts_multi_lookup, 1);
+	lookup->flags = flags;
+	lookup->result = result;
 
 	/* use a separate filter query for selecting the mailbox. it shouldn't
 	   affect the score and there could be some caching benefits too. */
@@ -882,10 +969,11 @@ solr_search_multi(struct fts_backend *_backend, string_t *str,
 	else
 		str_append(str, "%22%22");
 
-	hash_table_create(&mailboxes, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&lookup->mailboxes, default_pool, 0,
+			  str_hash, strcmp);
 	for (i = 0; boxes[i] != NULL; i++) ;
-	search_all_mailboxes = i > SOLR_QUERY_MAX_MAILBOX_COUNT;
-	if (!search_all_mailboxes)
+	lookup->search_all_mailboxes = i > SOLR_QUERY_MAX_MAILBOX_COUNT;
+	if (!lookup->search_all_mailboxes)
 		str_append(str, "+%2B(");
 	len = str_len(str);
 
@@ -893,28 +981,39 @@ solr_search_multi(struct fts_backend *_backend, string_t *str,
 		if (fts_mailbox_get_guid(boxes[i], &box_guid) < 0)
 			continue;
 
-		if (!search_all_mailboxes) {
+		if (!lookup->search_all_mailboxes) {
 			if (str_len(str) != len)
 				str_append(str, "+OR+");
 			str_printfa(str, "box:%s", box_guid);
 		}
-		hash_table_insert(mailboxes, t_strdup_noconst(box_guid),
-				  boxes[i]);
+		hash_table_insert(lookup->mailboxes,
+				  p_strdup(result->pool, box_guid), boxes[i]);
 	}
-	if (!search_all_mailboxes)
+	if (!lookup->search_all_mailboxes)
 		str_append_c(str, ')');
 
-	if (solr_connection_select(backend->solr_conn, str_c(str),
-				   result->pool, &solr_results) < 0) {
-		hash_table_destroy(&mailboxes);
-		return -1;
-	}
+	lookup->select = solr_connection_select_submit(backend->solr_conn,
+						       str_c(str),
+						       result->pool);
+	backend->multi_lookup = lookup;
+}
+
+static void
+solr_search_multi_results(struct solr_fts_multi_lookup *lookup,
+			  struct solr_result **solr_results)
+{
+	struct fts_multi_result *result = lookup->result;
+	struct fts_result *fts_result;
+	ARRAY(struct fts_result) fts_results;
+	struct mailbox *box;
+	unsigned int i;
 
 	p_array_init(&fts_results, result->pool, 32);
 	for (i = 0; solr_results[i] != NULL; i++) {
-		box = hash_table_lookup(mailboxes, solr_results[i]->box_id);
+		box = hash_table_lookup(lookup->mailboxes,
+					solr_results[i]->box_id);
 		if (box == NULL) {
-			if (!search_all_mailboxes) {
+			if (!lookup->search_all_mailboxes) {
 				i_warning("fts_solr: Lookup returned unexpected mailbox "
 					  "with guid=%s", solr_results[i]->box_id);
 			}
@@ -922,7 +1021,7 @@ solr_search_multi(struct fts_backend *_backend, string_t *str,
 		}
 		fts_result = array_append_space(&fts_results);
 		fts_result->box = box;
-		if ((flags & FTS_LOOKUP_FLAG_NO_AUTO_FUZZY) == 0)
+		if ((lookup->flags & FTS_LOOKUP_FLAG_NO_AUTO_FUZZY) == 0)
 			fts_result->definite_uids = solr_results[i]->uids;
 		else
 			fts_result->maybe_uids = solr_results[i]->uids;
@@ -931,16 +1030,35 @@ solr_search_multi(struct fts_backend *_backend, string_t *str,
 	}
 	array_append_zero(&fts_results);
 	result->box_results = array_front_modifiable(&fts_results);
-	hash_table_destroy(&mailboxes);
-	return 0;
+}
+
+static int fts_backend_solr_lookup_multi_wait(struct fts_backend *_backend)
+{
+	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
+	struct solr_fts_multi_lookup *lookup = backend->multi_lookup;
+	struct solr_result **solr_results;
+	int ret;
+
+	if (lookup == NULL) {
+		/* nothing was submitted */
+		return 0;
+	}
+	backend->multi_lookup = NULL;
+
+	ret = solr_connection_select_finish(&lookup->select, &solr_results);
+	if (ret == 0)
+		solr_search_multi_results(lookup, solr_results);
+	hash_table_destroy(&lookup->mailboxes);
+	i_free(lookup);
+	return ret;
 }
 
 static int
-fts_backend_solr_lookup_multi(struct fts_backend *backend,
-			      struct mailbox *const boxes[],
-			      struct mail_search_arg *args,
-			      enum fts_lookup_flags flags,
-			      struct fts_multi_result *result)
+fts_backend_solr_lookup_multi_submit(struct fts_backend *backend,
+				     struct mailbox *const boxes[],
+				     struct mail_search_arg *args,
+				     enum fts_lookup_flags flags,
+				     struct fts_multi_result *result)
 {
 	bool and_args = (flags & FTS_LOOKUP_FLAG_AND_ARGS) != 0;
 	string_t *str;
@@ -949,14 +1067,25 @@ fts_backend_solr_lookup_multi(struct fts_backend *backend,
 	str_printfa(str, "wt=xml&fl=box,uid,score&rows=%u&sort=box+asc,uid+asc&q=%%7b!lucene+q.op%%3dAND%%7d",
 		    SOLR_MAX_MULTI_ROWS);
 
-	if (solr_add_definite_query_args(str, args, and_args)) {
-		if (solr_search_multi(backend, str, boxes, flags, result) < 0)
-			return -1;
-	}
+	if (solr_add_definite_query_args(str, args, and_args))
+		solr_search_multi_submit(backend, str, boxes, flags, result);
 	/* FIXME: maybe_uids could be handled also with some more work.. */
 	return 0;
 }
 
+static int
+fts_backend_solr_lookup_multi(struct fts_backend *backend,
+			      struct mailbox *const boxes[],
+			      struct mail_search_arg *args,
+			      enum fts_lookup_flags flags,
+			      struct fts_multi_result *result)
+{
+	if (fts_backend_solr_lookup_multi_submit(backend, boxes, args,
+						 flags, result) < 0)
+		return -1;
+	return fts_backend_solr_lookup_multi_wait(backend);
+}
+
 struct fts_backend fts_backend_solr = {
 	.name = "solr",
 	.flags = FTS_BACKEND_FLAG_FUZZY_SEARCH,
@@ -979,6 +1108,8 @@ struct fts_backend fts_backend_solr = {
 		fts_backend_default_can_lookup,
 		fts_backend_solr_lookup,
 		fts_backend_solr_lookup_multi,
-		NULL
+		NULL,
+		fts_backend_solr_lookup_multi_submit,
+		fts_backend_solr_lookup_multi_wait
 	}
 };
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "http-client.h"
+#include "settings-parser.h"
 #include "mail-user.h"
 #include "mail-storage-hooks.h"
 #include "solr-connection.h"
@@ -10,6 +11,9 @@
 #include "fts-solr-plugin.h"
 
 #define DEFAULT_SOLR_BATCH_SIZE 1000
+#define DEFAULT_SOLR_BATCH_BYTES (4*1024*1024)
+#define DEFAULT_SOLR_MAX_PARALLEL_POSTS 1
+#define DEFAULT_SOLR_MAX_PARALLEL_LOOKUPS 4
 
 const char *fts_solr_plugin_version = DOVECOT_ABI_VERSION;
 struct http_client *solr_http_client = NULL;
@@ -21,12 +25,16 @@ static int
 fts_solr_plugin_init_settings(struct mail_user *user,
 			      struct fts_solr_settings *set, const char *str)
 {
-	const char *const *tmp;
+	const char *const *tmp, *error;
+	uoff_t size;
 
 	if (str == NULL)
 		str = "";
 
 	set->batch_size = DEFAULT_SOLR_BATCH_SIZE;
+	set->batch_bytes = DEFAULT_SOLR_BATCH_BYTES;
+	set->max_parallel_posts = DEFAULT_SOLR_MAX_PARALLEL_POSTS;
+	set->max_parallel_lookups = DEFAULT_SOLR_MAX_PARALLEL_LOOKUPS;
 	set->soft_commit = TRUE;
 
 	for (tmp = t_strsplit_spaces(str, " "); *tmp != NULL; tmp++) {
@@ -47,6 +55,42 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 				i_error("fts_solr: batch_size must be a positive integer");
 					return -1;
 			}
+		} else if (str_begins(*tmp, "batch_bytes=")) {
+			if (settings_get_size(*tmp + 12, &size, &error) < 0) {
+				i_error("fts_solr: Invalid batch_bytes: %s", error);
+				return -1;
+			}
+			if (size == 0 || size > SSIZE_T_MAX) {
+				i_error("fts_solr: Invalid batch_bytes: %s",
+					*tmp + 12);
+				return -1;
+			}
+			set->batch_bytes = size;
+		} else if (str_begins(*tmp, "max_parallel_posts=")) {
+			if (str_to_uint(*tmp + 19, &set->max_parallel_posts) < 0 ||
+			    set->max_parallel_posts == 0) {
+				i_error("fts_solr: max_parallel_posts must be a positive integer");
+				return -1;
+			}
+		} else if (str_begins(*tmp, "max_parallel_lookups=")) {
+			if (str_to_uint(*tmp + 21, &set->max_parallel_lookups) < 0 ||
+			    set->max_parallel_lookups == 0) {
+				i_error("fts_solr: max_parallel_lookups must be a positive integer");
+				return -1;
+			}
+		} else if (str_begins(*tmp, "compress=")) {
+			if (strcmp(*tmp + 9, "gzip") != 0) {
+				i_error("fts_solr: Invalid setting for compress: %s", *tmp + 9);
+				return -1;
+			}
+			set->compress = p_strdup(user->pool, *tmp + 9);
+		} else if (str_begins(*tmp, "commit_within=")) {
+			if (settings_get_time_msecs(*tmp + 14,
+						    &set->commit_within_msecs,
+						    &error) < 0) {
+				i_error("fts_solr: Invalid commit_within: %s", error);
+				return -1;
+			}
 		} else if (str_begins(*tmp, "soft_commit=")) {
 			if (strcmp(*tmp + 12, "yes") == 0) {
 				set->soft_commit = TRUE;
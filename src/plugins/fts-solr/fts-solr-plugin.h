@@ -12,7 +12,20 @@
 
 struct fts_solr_settings {
 	const char *url, *default_ns_prefix, *rawlog_dir;
+	/* Send the added documents once this many mails or bytes have been
+	   buffered. The buffered batch may exceed batch_bytes by one mail. */
 	unsigned int batch_size;
+	size_t batch_bytes;
+	/* Maximum number of update requests in flight at the same time */
+	unsigned int max_parallel_posts;
+	/* Maximum number of lookups to different namespaces running at the
+	   same time */
+	unsigned int max_parallel_lookups;
+	/* Content-Encoding of the update request bodies ("gzip"), or NULL */
+	const char *compress;
+	/* If non-zero, let Solr commit the updates within this many
+	   milliseconds instead of committing at the end of each update. */
+	unsigned int commit_within_msecs;
 	bool use_libfts;
 	bool debug;
 	bool soft_commit;
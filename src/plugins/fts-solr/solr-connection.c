@@ -7,6 +7,8 @@
 #include "strescape.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "ostream.h"
+#include "compression.h"
 #include "http-url.h"
 #include "http-client.h"
 #include "fts-solr-plugin.h"
@@ -14,7 +16,7 @@
 
 #include <expat.h>
 
-struct solr_lookup_context {
+struct solr_connection_select {
 	pool_t result_pool;
 	struct istream *payload;
 	struct io *io;
@@ -23,6 +25,8 @@ struct solr_lookup_context {
 
 	struct solr_response_parser *parser;
 	struct solr_result **results;
+
+	bool finished:1;
 };
 
 struct solr_connection_post {
@@ -43,8 +47,15 @@ struct solr_connection {
 	char *http_user;
 	char *http_password;
 
+	/* asynchronous update requests */
+	const struct compression_handler *compress_handler;
+	char *content_encoding;
+	unsigned int pending_posts;
+	struct ioloop *wait_ioloop;
+
 	bool debug:1;
 	bool posting:1;
+	bool async_post_failed:1;
 	bool http_ssl:1;
 };
 
@@ -94,10 +105,29 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 
 	conn->debug = solr_set->debug;
 
+	if (solr_set->compress != NULL) {
+		/* only gzip is supported for now, since lib-compression's
+		   "deflate" is the raw format, not HTTP's zlib format */
+		i_assert(strcmp(solr_set->compress, "gzip") == 0);
+		if (compression_lookup_handler("gz",
+					       &conn->compress_handler) <= 0) {
+			*error_r = t_strdup_printf(
+				"fts_solr: Compression '%s' is not supported",
+				solr_set->compress);
+			solr_connection_deinit(&conn);
+			return -1;
+		}
+		conn->content_encoding = i_strdup(solr_set->compress);
+	}
+
 	if (solr_http_client == NULL) {
 		i_zero(&http_set);
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		/* update requests are limited to max_parallel_posts by the
+		   backend, so this mainly limits the parallel lookups */
+		http_set.max_parallel_connections =
+			I_MAX(solr_set->max_parallel_posts,
+			      solr_set->max_parallel_lookups);
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
@@ -126,7 +156,10 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	struct solr_connection *conn = *_conn;
 
 	*_conn = NULL;
+	i_assert(conn->pending_posts == 0);
+
 	event_unref(&conn->event);
+	i_free(conn->content_encoding);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
 	i_free(conn->http_user);
@@ -134,7 +167,7 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	i_free(conn);
 }
 
-static void solr_connection_payload_input(struct solr_lookup_context *lctx)
+static void solr_connection_payload_input(struct solr_connection_select *lctx)
 {
 	int ret;
 
@@ -154,23 +187,26 @@ static void solr_connection_payload_input(struct solr_lookup_context *lctx)
 			lctx->request_status = -1;
 		solr_response_parser_deinit(&lctx->parser);
 		io_remove(&lctx->io);
+		lctx->finished = TRUE;
 	}
 }
 
 static void
 solr_connection_select_response(const struct http_response *response,
-				struct solr_lookup_context *lctx)
+				struct solr_connection_select *lctx)
 {
 	if (response->status / 100 != 2) {
 		i_error("fts_solr: Lookup failed: %s",
 			http_response_get_message(response));
 		lctx->request_status = -1;
+		lctx->finished = TRUE;
 		return;
 	}
 
 	if (response->payload == NULL) {
 		i_error("fts_solr: Lookup failed: Empty response payload");
 		lctx->request_status = -1;
+		lctx->finished = TRUE;
 		return;
 	}
 
@@ -182,15 +218,16 @@ solr_connection_select_response(const struct http_response *response,
 	solr_connection_payload_input(lctx);
 }
 
-int solr_connection_select(struct solr_connection *conn, const char *query,
-			   pool_t pool, struct solr_result ***box_results_r)
+struct solr_connection_select *
+solr_connection_select_submit(struct solr_connection *conn, const char *query,
+			      pool_t pool)
 {
-	struct solr_lookup_context lctx;
+	struct solr_connection_select *lctx;
 	struct http_client_request *http_req;
 	const char *url;
 
-	i_zero(&lctx);
-	lctx.result_pool = pool;
+	lctx = i_new(struct solr_connection_select, 1);
+	lctx->result_pool = pool;
 
 	i_free_and_null(conn->http_failure);
 	url = t_strconcat(conn->http_base_url, "select?", query, NULL);
@@ -198,7 +235,7 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	http_req = http_client_request(solr_http_client, "GET",
 				       conn->http_host, url,
 				       solr_connection_select_response,
-				       &lctx);
+				       lctx);
 	if (conn->http_user != NULL) {
 		http_client_request_set_auth_simple(
 			http_req, conn->http_user, conn->http_password);
@@ -206,15 +243,42 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	http_client_request_set_port(http_req, conn->http_port);
 	http_client_request_set_ssl(http_req, conn->http_ssl);
 	http_client_request_submit(http_req);
+	return lctx;
+}
 
-	lctx.request_status = 0;
-	http_client_wait(solr_http_client);
+int solr_connection_select_finish(struct solr_connection_select **_lctx,
+				  struct solr_result ***box_results_r)
+{
+	struct solr_connection_select *lctx = *_lctx;
+	int ret;
 
-	if (lctx.request_status < 0)
-		return -1;
+	*_lctx = NULL;
 
-	*box_results_r = lctx.results;
-	return 0;
+	/* this finishes also all the other pending requests */
+	if (!lctx->finished)
+		http_client_wait(solr_http_client);
+	if (!lctx->finished) {
+		i_error("fts_solr: Lookup failed: Response payload not finished");
+		if (lctx->parser != NULL)
+			solr_response_parser_deinit(&lctx->parser);
+		io_remove(&lctx->io);
+		lctx->request_status = -1;
+	}
+
+	ret = lctx->request_status;
+	if (ret == 0)
+		*box_results_r = lctx->results;
+	i_free(lctx);
+	return ret;
+}
+
+int solr_connection_select(struct solr_connection *conn, const char *query,
+			   pool_t pool, struct solr_result ***box_results_r)
+{
+	struct solr_connection_select *lctx;
+
+	lctx = solr_connection_select_submit(conn, query, pool);
+	return solr_connection_select_finish(&lctx, box_results_r);
 }
 
 static void
@@ -325,3 +389,111 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	return post.request_status;
 }
+
+static void
+solr_connection_async_post_response(const struct http_response *response,
+				    struct solr_connection *conn)
+{
+	i_assert(conn->pending_posts > 0);
+	conn->pending_posts--;
+
+	if (response->status / 100 != 2) {
+		i_error("fts_solr: Indexing failed: %s",
+			http_response_get_message(response));
+		conn->async_post_failed = TRUE;
+	}
+	if (conn->wait_ioloop != NULL)
+		io_loop_stop(conn->wait_ioloop);
+}
+
+static struct istream *
+solr_connection_compress(struct solr_connection *conn,
+			 const unsigned char *data, size_t size)
+{
+	const struct compression_handler *handler = conn->compress_handler;
+	struct ostream *output, *zoutput;
+	struct istream *input;
+	buffer_t *buf;
+
+	buf = buffer_create_dynamic(default_pool, size/4 + 128);
+	output = o_stream_create_buffer(buf);
+	zoutput = handler->create_ostream(output,
+					  handler->get_default_level());
+	o_stream_nsend(zoutput, data, size);
+	if (o_stream_finish(zoutput) < 0) {
+		/* writing to a buffer can't really fail */
+		i_panic("fts_solr: %s compression failed: %s", handler->name,
+			o_stream_get_error(zoutput));
+	}
+	o_stream_destroy(&zoutput);
+	o_stream_destroy(&output);
+
+	input = i_stream_create_copy_from_buffer(buf);
+	buffer_free(&buf);
+	return input;
+}
+
+void solr_connection_post_async(struct solr_connection *conn,
+				const unsigned char *data, size_t size)
+{
+	struct http_client_request *http_req;
+	struct istream *post_payload;
+	const char *url;
+
+	i_assert(!conn->posting);
+
+	url = t_strconcat(conn->http_base_url, "update", NULL);
+	http_req = http_client_request(solr_http_client, "POST",
+				       conn->http_host, url,
+				       solr_connection_async_post_response,
+				       conn);
+	if (conn->http_user != NULL) {
+		http_client_request_set_auth_simple(
+			http_req, conn->http_user, conn->http_password);
+	}
+	http_client_request_set_port(http_req, conn->http_port);
+	http_client_request_set_ssl(http_req, conn->http_ssl);
+	http_client_request_add_header(http_req, "Content-Type", "text/xml");
+
+	if (conn->compress_handler == NULL)
+		post_payload = i_stream_create_copy_from_data(data, size);
+	else {
+		http_client_request_add_header(http_req, "Content-Encoding",
+					       conn->content_encoding);
+		post_payload = solr_connection_compress(conn, data, size);
+	}
+	http_client_request_set_payload(http_req, post_payload, TRUE);
+	i_stream_unref(&post_payload);
+
+	conn->pending_posts++;
+	http_client_request_submit(http_req);
+}
+
+int solr_connection_post_wait(struct solr_connection *conn,
+			      unsigned int max_pending)
+{
+	struct ioloop *prev_ioloop;
+	int ret;
+
+	if (max_pending == 0)
+		http_client_wait(solr_http_client);
+	else if (conn->pending_posts > max_pending) {
+		/* same as http_client_wait(), but stop as soon as enough
+		   of the requests have finished */
+		prev_ioloop = current_ioloop;
+		conn->wait_ioloop = io_loop_create();
+		(void)http_client_switch_ioloop(solr_http_client);
+		while (conn->pending_posts > max_pending)
+			io_loop_run(conn->wait_ioloop);
+
+		io_loop_set_current(prev_ioloop);
+		(void)http_client_switch_ioloop(solr_http_client);
+		io_loop_set_current(conn->wait_ioloop);
+		io_loop_destroy(&conn->wait_ioloop);
+	}
+	i_assert(conn->pending_posts <= max_pending);
+
+	ret = conn->async_post_failed ? -1 : 0;
+	conn->async_post_failed = FALSE;
+	return ret;
+}
@@ -4,6 +4,7 @@
 #include "solr-response.h"
 
 struct solr_connection;
+struct solr_connection_select;
 struct fts_solr_settings;
 
 int solr_connection_init(const struct fts_solr_settings *solr_set,
@@ -15,6 +16,15 @@ void solr_connection_deinit(struct solr_connection **conn);
 
 int solr_connection_select(struct solr_connection *conn, const char *query,
 			   pool_t pool, struct solr_result ***box_results_r);
+/* Submit a lookup without waiting for it to finish. Multiple lookups can
+   be running in parallel. */
+struct solr_connection_select *
+solr_connection_select_submit(struct solr_connection *conn, const char *query,
+			      pool_t pool);
+/* Wait for the submitted lookup to finish. Returns 0 and the results if
+   ok, -1 if the lookup failed. */
+int solr_connection_select_finish(struct solr_connection_select **select,
+				  struct solr_result ***box_results_r);
 int solr_connection_post(struct solr_connection *conn, const char *cmd);
 
 struct solr_connection_post *
@@ -23,4 +33,14 @@ void solr_connection_post_more(struct solr_connection_post *post,
 			       const unsigned char *data, size_t size);
 int solr_connection_post_end(struct solr_connection_post **post);
 
+/* Submit an update request without waiting for it to finish. The data is
+   copied (and compressed, if enabled), so it can be freed immediately. */
+void solr_connection_post_async(struct solr_connection *conn,
+				const unsigned char *data, size_t size);
+/* Wait until at most max_pending asynchronous update requests are still
+   running. Returns -1 if any of the requests finished since the previous
+   call have failed, 0 otherwise. */
+int solr_connection_post_wait(struct solr_connection *conn,
+			      unsigned int max_pending);
+
 #endif
@@ -8,6 +8,7 @@
 #include "mail-namespace.h"
 #include "mail-storage-private.h"
 #include "mail-search-build.h"
+#include "settings-parser.h"
 #include "squat-trie.h"
 #include "fts-squat-plugin.h"
 
@@ -21,6 +22,8 @@ struct squat_fts_backend {
 	struct squat_trie *trie;
 
 	unsigned int partial_len, full_len;
+	uoff_t build_memory_limit;
+	bool build_memory_limit_set;
 	bool refresh;
 };
 
@@ -49,8 +52,9 @@ fts_backend_squat_init(struct fts_backend *_backend, const char **error_r)
 {
 	struct squat_fts_backend *backend =
 		(struct squat_fts_backend *)_backend;
-	const char *const *tmp, *env;
+	const char *const *tmp, *env, *error;
 	unsigned int len;
+	uoff_t size;
 
 	env = mail_user_plugin_getenv(_backend->ns->user, "fts_squat");
 	if (env == NULL)
@@ -71,6 +75,15 @@ fts_backend_squat_init(struct fts_backend *_backend, const char **error_r)
 				return -1;
 			}
 			backend->full_len = len;
+		} else if (str_begins(*tmp, "build_mem=")) {
+			if (settings_get_size(*tmp + 10, &size, &error) < 0 ||
+			    size > SSIZE_T_MAX) {
+				*error_r = t_strdup_printf(
+					"Invalid build_mem: %s", *tmp + 10);
+				return -1;
+			}
+			backend->build_memory_limit = size;
+			backend->build_memory_limit_set = TRUE;
 		} else {
 			*error_r = t_strdup_printf("Invalid setting: %s", *tmp);
 			return -1;
@@ -146,6 +159,10 @@ fts_backend_squat_set_box(struct squat_fts_backend *backend,
 		squat_trie_set_partial_len(backend->trie, backend->partial_len);
 	if (backend->full_len != 0)
 		squat_trie_set_full_len(backend->trie, backend->full_len);
+	if (backend->build_memory_limit_set) {
+		squat_trie_set_build_memory_limit(backend->trie,
+						  backend->build_memory_limit);
+	}
 	backend->box = box;
 	return squat_trie_open(backend->trie);
 }
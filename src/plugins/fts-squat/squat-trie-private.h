@@ -4,9 +4,10 @@
 #include "file-dotlock.h"
 #include "squat-trie.h"
 
-#define SQUAT_TRIE_VERSION 2
+#define SQUAT_TRIE_VERSION 3
 #define SQUAT_TRIE_LOCK_TIMEOUT 60
 #define SQUAT_TRIE_DOTLOCK_STALE_TIMEOUT (15*60)
+#define SQUAT_TRIE_DEFAULT_BUILD_MEMORY_LIMIT (1024*1024*16)
 
 struct squat_file_header {
 	uint8_t version;
@@ -137,6 +138,7 @@ struct squat_trie {
 	unsigned char default_normalize_map[256];
 	unsigned int default_partial_len;
 	unsigned int default_full_len;
+	size_t build_memory_limit;
 
 	bool corrupted:1;
 };
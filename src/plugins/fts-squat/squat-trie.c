@@ -40,6 +40,10 @@ struct squat_trie_build_context {
 
 	uint32_t first_uid;
 	bool compress_nodes:1;
+	/* The trie is being written to a new file. Nodes are dropped from
+	   memory as soon as they're written, so memory usage stays bounded
+	   by the trie depth instead of the whole trie. */
+	bool unmap_written_nodes:1;
 };
 
 struct squat_trie_iterate_node {
@@ -112,7 +116,8 @@ static void node_free(struct squat_trie *trie, struct squat_node *node)
 	if (node->leaf_string_length > 0) {
 		if (NODE_IS_DYNAMIC_LEAF(node))
 			i_free(node->children.leaf_string);
-	} else if (!node->children_not_mapped) {
+	} else if (!node->children_not_mapped &&
+		   node->children.data != NULL) {
 		children = NODE_CHILDREN_NODES(node);
 
 		trie->node_alloc_size -=
@@ -149,6 +154,7 @@ squat_trie_init(const char *path, uint32_t uidvalidity,
 	trie->dotlock_set.stale_timeout = SQUAT_TRIE_DOTLOCK_STALE_TIMEOUT;
 	trie->default_partial_len = DEFAULT_PARTIAL_LEN;
 	trie->default_full_len = DEFAULT_FULL_LEN;
+	trie->build_memory_limit = SQUAT_TRIE_DEFAULT_BUILD_MEMORY_LIMIT;
 	return trie;
 }
 
@@ -200,6 +206,11 @@ void squat_trie_set_full_len(struct squat_trie *trie, unsigned int len)
 	trie->default_full_len = len;
 }
 
+void squat_trie_set_build_memory_limit(struct squat_trie *trie, size_t limit)
+{
+	trie->build_memory_limit = limit;
+}
+
 static void squat_trie_header_init(struct squat_trie *trie)
 {
 	i_zero(&trie->hdr);
@@ -440,7 +451,7 @@ node_read_children(struct squat_trie *trie, struct squat_node *node, int level)
 	uoff_t node_offset;
 	unsigned int i, child_idx, child_count;
 	uoff_t base_offset;
-	uint32_t num;
+	uint32_t num, parent_uid_count;
 
 	i_assert(node->children_not_mapped);
 	i_assert(!node->have_sequential);
@@ -470,6 +481,8 @@ node_read_children(struct squat_trie *trie, struct squat_node *node, int level)
 	if (child_count == 0)
 		return 0;
 
+	/* children's UIDs are relative to ours */
+	parent_uid_count = node->next_uid - node->unused_uids;
 	child_chars = data;
 	data += child_count;
 
@@ -518,7 +531,15 @@ node_read_children(struct squat_trie *trie, struct squat_node *node, int level)
 		}
 		if (!UIDLIST_IS_SINGLETON(child->uid_list_idx)) {
 			/* 3) next uid */
-			child->next_uid = squat_unpack_num(&data, end) + 1;
+			num = squat_unpack_num(&data, end);
+			if ((num & 1) != 0)
+				child->next_uid = (num >> 1) + 1;
+			else if ((num >> 1) <= parent_uid_count)
+				child->next_uid = parent_uid_count - (num >> 1);
+			else {
+				squat_trie_set_corrupted(trie);
+				return -1;
+			}
 		} else {
 			uint32_t idx = child->uid_list_idx;
 
@@ -587,10 +608,12 @@ node_write_children(struct squat_trie_build_context *ctx,
 	const unsigned char *chars;
 	uint8_t child_count, buf[SQUAT_PACK_MAX_SIZE * 5], *bufp;
 	uoff_t base_offset;
+	uint32_t parent_uid_count;
 	unsigned int i;
 
 	chars = NODE_CHILDREN_CHARS(node);
 	children = NODE_CHILDREN_NODES(node);
+	parent_uid_count = node->next_uid - node->unused_uids;
 
 	base_offset = ctx->output->offset;
 	child_count = node->child_count;
@@ -615,8 +638,16 @@ node_write_children(struct squat_trie_build_context *ctx,
 		/* 2) uidlist */
 		squat_pack_num(&bufp, children[i].uid_list_idx);
 		if (!UIDLIST_IS_SINGLETON(children[i].uid_list_idx)) {
-			/* 3) next uid */
-			squat_pack_num(&bufp, children[i].next_uid - 1);
+			/* 3) next uid. It's usually the same or only a bit
+			   smaller than the parent's UID count, so write it
+			   as the difference to that. */
+			if (children[i].next_uid <= parent_uid_count) {
+				squat_pack_num(&bufp, (parent_uid_count -
+						       children[i].next_uid) << 1);
+			} else {
+				squat_pack_num(&bufp,
+					((children[i].next_uid - 1) << 1) | 1);
+			}
 		}
 
 		if (children[i].leaf_string_length == 0) {
@@ -971,6 +1002,14 @@ int squat_trie_build_more(struct squat_trie_build_context *ctx,
 	if (size != 0) T_BEGIN {
 		ret = squat_trie_build_more_real(ctx, uid, type, input, size);
 	} T_END;
+
+	if (ctx->trie->build_memory_limit > 0 &&
+	    squat_uidlist_build_get_memory(ctx->uidlist_build_ctx) >
+	    ctx->trie->build_memory_limit) {
+		/* Write the uidlists built so far. The following UIDs are
+		   linked to them. */
+		squat_uidlist_build_flush(ctx->uidlist_build_ctx);
+	}
 	return ret;
 }
 
@@ -990,6 +1029,8 @@ node_drop_unused_children(struct squat_trie *trie, struct squat_node *node)
 			chars[j++] = chars[i];
 	}
 	node->child_count = j;
+	trie->node_alloc_size -= NODE_CHILDREN_ALLOC_SIZE(orig_child_count) -
+		NODE_CHILDREN_ALLOC_SIZE(j);
 
 	/* move children. note that children_dest may point to different
 	   location than children_src, although they both point to the
@@ -1049,6 +1090,20 @@ squat_write_node(struct squat_trie_build_context *ctx, struct squat_node *node,
 
 	*node_offset_r = ctx->output->offset;
 	node_write_children(ctx, node, node_offsets);
+
+	if (ctx->unmap_written_nodes) {
+		/* the children can be read back from the new file */
+		for (i = 0; i < child_count; i++) {
+			if (children[i].children_not_mapped)
+				trie->unmapped_child_count--;
+		}
+		node_free(trie, node);
+		node->child_count = 0;
+		node->want_sequential = level < MAX_FAST_LEVEL;
+		node->children_not_mapped = TRUE;
+		node->children.offset = *node_offset_r;
+		trie->unmapped_child_count++;
+	}
 	return 0;
 }
 
@@ -1483,6 +1538,25 @@ static int squat_trie_map_header(struct squat_trie *trie)
 	return squat_trie_check_header(trie) ? 1 : 0;
 }
 
+static void squat_trie_root_reset(struct squat_trie *trie)
+{
+	node_free(trie, &trie->root);
+	i_zero(&trie->root);
+	trie->root.want_sequential = TRUE;
+	trie->root.unused_uids = trie->hdr.root_unused_uids;
+	trie->root.next_uid = trie->hdr.root_next_uid;
+	trie->root.uid_list_idx = trie->hdr.root_uidlist_idx;
+	trie->root.children.offset = trie->hdr.root_offset;
+
+	if (trie->hdr.root_offset == 0) {
+		trie->unmapped_child_count = 0;
+		trie->root.children_not_mapped = FALSE;
+	} else {
+		trie->unmapped_child_count = 1;
+		trie->root.children_not_mapped = TRUE;
+	}
+}
+
 static int squat_trie_map(struct squat_trie *trie, bool building)
 {
 	struct file_lock *file_lock = NULL;
@@ -1510,23 +1584,8 @@ static int squat_trie_map(struct squat_trie *trie, bool building)
 	}
 	changed = trie->root.children.offset != trie->hdr.root_offset;
 
-	if (changed || trie->hdr.root_offset == 0) {
-		node_free(trie, &trie->root);
-		i_zero(&trie->root);
-		trie->root.want_sequential = TRUE;
-		trie->root.unused_uids = trie->hdr.root_unused_uids;
-		trie->root.next_uid = trie->hdr.root_next_uid;
-		trie->root.uid_list_idx = trie->hdr.root_uidlist_idx;
-		trie->root.children.offset = trie->hdr.root_offset;
-
-		if (trie->hdr.root_offset == 0) {
-			trie->unmapped_child_count = 0;
-			trie->root.children_not_mapped = FALSE;
-		} else {
-			trie->unmapped_child_count = 1;
-			trie->root.children_not_mapped = TRUE;
-		}
-	}
+	if (changed || trie->hdr.root_offset == 0)
+		squat_trie_root_reset(trie);
 
 	if (ret >= 0 && !building) {
 		/* do this while we're still locked */
@@ -1624,6 +1683,8 @@ static int squat_trie_write(struct squat_trie_build_context *ctx)
 	    trie->unmapped_child_count < trie->hdr.node_count/4) || 1) {
 		/* we might as well recreate the file */
 		ctx->compress_nodes = TRUE;
+		ctx->unmap_written_nodes = TRUE;
+		trie->hdr.node_count = 0;
 
 		path = t_strconcat(trie->path, ".tmp", NULL);
 		fd = squat_trie_create_fd(trie, path, O_TRUNC);
@@ -1671,6 +1732,7 @@ static int squat_trie_write(struct squat_trie_build_context *ctx)
 	ctx->output = output;
 	ret = squat_write_nodes(ctx);
 	ctx->output = NULL;
+	ctx->unmap_written_nodes = FALSE;
 
 	/* write 1 byte guard at the end of file, so that we can verify broken
 	   squat_unpack_num() input by checking if data==end */
@@ -1711,12 +1773,20 @@ static int squat_trie_write(struct squat_trie_build_context *ctx)
 	if (ret < 0) {
 		i_unlink_if_exists(path);
 		file_lock_free(&file_lock);
+		/* the written nodes were already dropped from memory,
+		   go back to using the old file */
+		if (squat_trie_map_header(trie) <= 0)
+			squat_trie_set_corrupted(trie);
+		squat_trie_root_reset(trie);
 	} else {
 		squat_trie_close_fd(trie);
 		trie->fd = fd;
 		trie->locked_file_size = trie->hdr.used_file_size;
 		if (trie->file_cache != NULL)
 			file_cache_set_fd(trie->file_cache, trie->fd);
+		/* the written nodes are read back from the new file */
+		if (squat_trie_map_header(trie) <= 0)
+			ret = -1;
 
 		file_lock_free(&ctx->file_lock);
 		ctx->file_lock = file_lock;
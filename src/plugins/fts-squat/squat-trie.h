@@ -25,6 +25,10 @@ void squat_trie_deinit(struct squat_trie **trie);
 
 void squat_trie_set_partial_len(struct squat_trie *trie, unsigned int len);
 void squat_trie_set_full_len(struct squat_trie *trie, unsigned int len);
+/* While building, write the new uidlists to disk whenever they use more
+   than this many bytes of memory. 0 = keep them in memory until the build
+   is finished. */
+void squat_trie_set_build_memory_limit(struct squat_trie *trie, size_t limit);
 
 int squat_trie_open(struct squat_trie *trie);
 int squat_trie_refresh(struct squat_trie *trie);
@@ -854,6 +854,11 @@ void squat_uidlist_build_flush(struct squat_uidlist_build_context *ctx)
 	array_clear(&ctx->block_end_indexes);
 }
 
+size_t squat_uidlist_build_get_memory(struct squat_uidlist_build_context *ctx)
+{
+	return ctx->lists.arr.buffer->used;
+}
+
 int squat_uidlist_build_finish(struct squat_uidlist_build_context *ctx)
 {
 	if (ctx->uidlist->corrupted)
@@ -41,6 +41,8 @@ int squat_uidlist_build_init(struct squat_uidlist *uidlist,
 uint32_t squat_uidlist_build_add_uid(struct squat_uidlist_build_context *ctx,
 				     uint32_t uid_list_idx, uint32_t uid);
 void squat_uidlist_build_flush(struct squat_uidlist_build_context *ctx);
+/* Returns number of bytes used by the uidlists that haven't been flushed. */
+size_t squat_uidlist_build_get_memory(struct squat_uidlist_build_context *ctx);
 int squat_uidlist_build_finish(struct squat_uidlist_build_context *ctx);
 void squat_uidlist_build_deinit(struct squat_uidlist_build_context **ctx);
 
@@ -50,6 +50,15 @@ struct fts_backend_vfuncs {
 			    enum fts_lookup_flags flags,
 			    struct fts_multi_result *result);
 	void (*lookup_done)(struct fts_backend *backend);
+
+	/* Optional: Start lookup_multi() without waiting for it. The result
+	   is filled by lookup_multi_wait(). */
+	int (*lookup_multi_submit)(struct fts_backend *backend,
+				   struct mailbox *const boxes[],
+				   struct mail_search_arg *args,
+				   enum fts_lookup_flags flags,
+				   struct fts_multi_result *result);
+	int (*lookup_multi_wait)(struct fts_backend *backend);
 };
 
 enum fts_backend_flags {
@@ -401,6 +401,36 @@ int fts_backend_lookup_multi(struct fts_backend *backend,
 	return 0;
 }
 
+int fts_backend_lookup_multi_submit(struct fts_backend *backend,
+				    struct mailbox *const boxes[],
+				    struct mail_search_arg *args,
+				    enum fts_lookup_flags flags,
+				    struct fts_multi_result *result)
+{
+	i_assert(boxes[0] != NULL);
+
+	if (backend->v.lookup_multi_submit == NULL) {
+		return fts_backend_lookup_multi(backend, boxes, args,
+						flags, result);
+	}
+	return backend->v.lookup_multi_submit(backend, boxes, args,
+					      flags, result);
+}
+
+int fts_backend_lookup_multi_wait(struct fts_backend *backend,
+				  struct fts_multi_result *result)
+{
+	if (backend->v.lookup_multi_submit == NULL) {
+		/* the lookup was already done by submit */
+		return 0;
+	}
+	if (backend->v.lookup_multi_wait(backend) < 0)
+		return -1;
+	if (result->box_results == NULL)
+		result->box_results = p_new(result->pool, struct fts_result, 1);
+	return 0;
+}
+
 void fts_backend_lookup_done(struct fts_backend *backend)
 {
 	if (backend->v.lookup_done != NULL)
@@ -147,6 +147,20 @@ int fts_backend_lookup_multi(struct fts_backend *backend,
 			     struct mail_search_arg *args,
 			     enum fts_lookup_flags flags,
 			     struct fts_multi_result *result);
+/* Same as fts_backend_lookup_multi(), but if the backend supports it, only
+   start the lookup without waiting for it to finish. This allows lookups to
+   multiple backends to run in parallel. fts_backend_lookup_multi_wait() must
+   be called afterwards, even if this function fails, and result can't be
+   used before it returns. */
+int fts_backend_lookup_multi_submit(struct fts_backend *backend,
+				    struct mailbox *const boxes[],
+				    struct mail_search_arg *args,
+				    enum fts_lookup_flags flags,
+				    struct fts_multi_result *result);
+/* Wait for fts_backend_lookup_multi_submit() to finish. Returns 0 if ok,
+   -1 if the lookup failed. */
+int fts_backend_lookup_multi_wait(struct fts_backend *backend,
+				  struct fts_multi_result *result);
 /* Called after the lookups are done. The next lookup will be preceded by a
    refresh. */
 void fts_backend_lookup_done(struct fts_backend *backend);
@@ -33,6 +33,8 @@ struct fts_mail_build_context {
 	struct fts_parser *body_parser;
 
 	buffer_t *word_buf, *pending_input;
+	/* reused for filtering each token */
+	string_t *token_buf;
 	struct fts_user_language *cur_user_lang;
 };
 
@@ -261,10 +263,19 @@ fts_build_add_tokens_with_filter(struct fts_mail_build_context *ctx,
 	const char *token, *error;
 	int ret = 1, ret2;
 
+	if (ctx->token_buf == NULL)
+		ctx->token_buf = str_new(default_pool, 128);
 	while (ret > 0) T_BEGIN {
 		ret = ret2 = fts_tokenizer_next(tokenizer, data, size, &token, &error);
-		if (ret2 > 0 && filter != NULL)
-			ret2 = fts_filter_filter(filter, &token, &error);
+		str_truncate(ctx->token_buf, 0);
+		if (ret2 > 0) {
+			str_append(ctx->token_buf, token);
+			if (filter != NULL) {
+				ret2 = fts_filter_filter_buf(filter,
+							     ctx->token_buf,
+							     &error);
+			}
+		}
 		if (ret2 < 0) {
 			mail_set_critical(ctx->mail,
 				"fts: Couldn't create indexable tokens: %s",
@@ -272,8 +283,8 @@ fts_build_add_tokens_with_filter(struct fts_mail_build_context *ctx,
 		}
 		if (ret2 > 0) {
 			if (fts_backend_update_build_more(ctx->update_ctx,
-							  (const void *)token,
-							  strlen(token)) < 0) {
+							  str_data(ctx->token_buf),
+							  str_len(ctx->token_buf)) < 0) {
 				mail_storage_set_internal_error(ctx->mail->box->storage);
 				ret = -1;
 			}
@@ -609,6 +620,7 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	i_free(ctx.content_disposition);
 	buffer_free(&ctx.word_buf);
 	buffer_free(&ctx.pending_input);
+	str_free(&ctx.token_buf);
 	return ret < 0 ? -1 : 1;
 }
 
@@ -2,11 +2,17 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "str.h"
+#include "hex-binary.h"
+#include "sha2.h"
 #include "istream.h"
+#include "ostream.h"
+#include "iostream-temp.h"
 #include "module-context.h"
 #include "iostream-ssl.h"
 #include "http-url.h"
 #include "http-client.h"
+#include "fs-api.h"
 #include "message-parser.h"
 #include "mail-user.h"
 #include "fts-parser.h"
@@ -17,24 +23,68 @@
 struct fts_parser_tika_user {
 	union mail_user_module_context module_ctx;
 	struct http_url *http_url;
+	/* fts_tika_cache is set */
+	bool cache_enabled;
 };
 
 struct tika_fts_parser {
 	struct fts_parser parser;
 	struct mail_user *user;
+	struct http_url *http_url;
 	struct http_client_request *http_req;
 
 	struct ioloop *ioloop;
 	struct io *io;
 	struct istream *payload;
 
+	/* With fts_tika_cache the attachment is first written to a temp
+	   stream while it's being hashed. Tika is contacted only if the
+	   cache doesn't already have the extracted text. */
+	struct fs *cache_fs;
+	char *content_type, *content_disposition;
+	struct sha256_ctx hash_ctx;
+	struct ostream *temp_output;
+	char *cache_path;
+	struct fs_file *cache_file;
+	struct ostream *cache_output;
+
 	bool failed;
+	/* Tika's response can be cached */
+	bool cacheable;
 };
 
 static struct http_client *tika_http_client = NULL;
+static struct fs *tika_cache_fs = NULL;
 static MODULE_CONTEXT_DEFINE_INIT(fts_parser_tika_user_module,
 				  &mail_user_module_register);
 
+static void
+tika_cache_init(struct mail_user *user, struct fts_parser_tika_user *tuser)
+{
+	struct fs_settings fs_set;
+	struct ssl_iostream_settings ssl_set;
+	const char *str, *error;
+
+	str = mail_user_plugin_getenv(user, "fts_tika_cache");
+	if (str == NULL || str[0] == '\0')
+		return;
+
+	/* Like the HTTP client, the cache is shared by all the users in
+	   the process, so attachments sent to multiple users are extracted
+	   only once. */
+	if (tika_cache_fs == NULL) {
+		i_zero(&fs_set);
+		mail_user_init_fs_settings(user, &fs_set, &ssl_set);
+		if (fs_init_from_string(str, &fs_set, &tika_cache_fs,
+					&error) < 0) {
+			i_error("fts_tika: Failed to initialize "
+				"fts_tika_cache=%s: %s", str, error);
+			return;
+		}
+	}
+	tuser->cache_enabled = TRUE;
+}
+
 static int
 tika_get_http_client_url(struct mail_user *user, struct http_url **http_url_r)
 {
@@ -62,6 +112,7 @@ tika_get_http_client_url(struct mail_user *user, struct http_url **http_url_r)
 		i_error("fts_tika: Failed to parse HTTP url %s: %s", url, error);
 		return -1;
 	}
+	tika_cache_init(user, tuser);
 
 	if (tika_http_client == NULL) {
 		mail_user_init_ssl_client_settings(user, &ssl_set);
@@ -105,6 +156,7 @@ fts_tika_parser_response(const struct http_response *response,
 			i_stream_ref(response->payload);
 			parser->payload = response->payload;
 		}
+		parser->cacheable = TRUE;
 		break;
 	case 204: /* empty response */
 	case 415: /* Unsupported Media Type */
@@ -113,6 +165,7 @@ fts_tika_parser_response(const struct http_response *response,
 			mail_user_plugin_getenv(parser->user, "fts_tika"),
 			http_response_get_message(response));
 		parser->payload = i_stream_create_from_data("", 0);
+		parser->cacheable = TRUE;
 		break;
 	default:
 		if (response->status / 100 == 5) {
@@ -139,40 +192,155 @@ fts_tika_parser_response(const struct http_response *response,
 	io_loop_stop(current_ioloop);
 }
 
+static struct http_client_request *
+fts_parser_tika_request_init(struct tika_fts_parser *parser,
+			     const char *content_type,
+			     const char *content_disposition)
+{
+	struct http_url *http_url = parser->http_url;
+	struct http_client_request *http_req;
+
+	http_req = http_client_request(tika_http_client, "PUT",
+			http_url->host.name,
+			t_strconcat(http_url->path, http_url->enc_query, NULL),
+			fts_tika_parser_response, parser);
+	http_client_request_set_port(http_req, http_url->port);
+	http_client_request_set_ssl(http_req, http_url->have_ssl);
+	if (content_type != NULL)
+		http_client_request_add_header(http_req, "Content-Type",
+					       content_type);
+	if (content_disposition != NULL)
+		http_client_request_add_header(http_req, "Content-Disposition",
+					       content_disposition);
+	http_client_request_add_header(http_req, "Accept", "text/plain");
+	return http_req;
+}
+
+static void
+fts_parser_tika_hash_str(struct tika_fts_parser *parser, const char *str)
+{
+	if (str != NULL)
+		sha256_loop(&parser->hash_ctx, str, strlen(str));
+	sha256_loop(&parser->hash_ctx, "", 1);
+}
+
 static struct fts_parser *
 fts_parser_tika_try_init(struct fts_parser_context *parser_context)
 {
+	struct fts_parser_tika_user *tuser;
 	struct tika_fts_parser *parser;
 	struct http_url *http_url;
-	struct http_client_request *http_req;
+	string_t *temp_prefix;
 
 	if (tika_get_http_client_url(parser_context->user, &http_url) < 0)
 		return NULL;
 	if (http_url->path == NULL)
 		http_url->path = "/";
+	tuser = TIKA_USER_CONTEXT(parser_context->user);
 
 	parser = i_new(struct tika_fts_parser, 1);
 	parser->parser.v = fts_parser_tika;
 	parser->user = parser_context->user;
+	parser->http_url = http_url;
 
-	http_req = http_client_request(tika_http_client, "PUT",
-			http_url->host.name,
-			t_strconcat(http_url->path, http_url->enc_query, NULL),
-			fts_tika_parser_response, parser);
-	http_client_request_set_port(http_req, http_url->port);
-	http_client_request_set_ssl(http_req, http_url->have_ssl);
-	if (parser_context->content_type != NULL)
-		http_client_request_add_header(http_req, "Content-Type",
-					       parser_context->content_type);
-	if (parser_context->content_disposition != NULL)
-		http_client_request_add_header(http_req, "Content-Disposition",
-					       parser_context->content_disposition);
-	http_client_request_add_header(http_req, "Accept", "text/plain");
+	if (!tuser->cache_enabled) {
+		parser->http_req = fts_parser_tika_request_init(parser,
+			parser_context->content_type,
+			parser_context->content_disposition);
+		return &parser->parser;
+	}
+
+	/* The same attachment is often sent to a lot of recipients. Hash
+	   the attachment with its headers so the text extracted from it can
+	   be looked up from the cache. */
+	parser->cache_fs = tika_cache_fs;
+	parser->content_type = i_strdup(parser_context->content_type);
+	parser->content_disposition =
+		i_strdup(parser_context->content_disposition);
+	sha256_init(&parser->hash_ctx);
+	fts_parser_tika_hash_str(parser, parser->content_type);
+	fts_parser_tika_hash_str(parser, parser->content_disposition);
 
-	parser->http_req = http_req;
+	temp_prefix = t_str_new(128);
+	mail_user_set_get_temp_prefix(temp_prefix, parser->user->set);
+	parser->temp_output = iostream_temp_create(str_c(temp_prefix), 0);
 	return &parser->parser;
 }
 
+static void fts_parser_tika_wait_response(struct tika_fts_parser *parser)
+{
+	struct ioloop *prev_ioloop = current_ioloop;
+	struct ioloop *ioloop;
+
+	/* http_client_wait() can't be used, because the request isn't
+	   finished until its payload has been read. */
+	ioloop = io_loop_create();
+	(void)http_client_switch_ioloop(tika_http_client);
+	while (!parser->failed && parser->payload == NULL)
+		io_loop_run(ioloop);
+	io_loop_set_current(prev_ioloop);
+	(void)http_client_switch_ioloop(tika_http_client);
+	io_loop_set_current(ioloop);
+	io_loop_destroy(&ioloop);
+}
+
+static void fts_parser_tika_cache_lookup(struct tika_fts_parser *parser)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+	struct istream *input;
+	const char *hash;
+	int ret;
+
+	sha256_result(&parser->hash_ctx, digest);
+	hash = binary_to_hex(digest, sizeof(digest));
+	parser->cache_path = i_strdup_printf("%c%c/%s",
+					     hash[0], hash[1], hash);
+
+	parser->cache_file = fs_file_init(parser->cache_fs, parser->cache_path,
+					  FS_OPEN_MODE_READONLY);
+	ret = fs_exists(parser->cache_file);
+	if (ret > 0) {
+		/* extracted text found from cache */
+		parser->payload = fs_read_stream(parser->cache_file,
+						 IO_BLOCK_SIZE);
+		o_stream_destroy(&parser->temp_output);
+		return;
+	}
+	if (ret < 0) {
+		i_error("fts_tika: fs_exists(%s) failed: %s",
+			parser->cache_path,
+			fs_file_last_error(parser->cache_file));
+	}
+	fs_file_deinit(&parser->cache_file);
+
+	/* send the buffered attachment to Tika */
+	input = iostream_temp_finish(&parser->temp_output, IO_BLOCK_SIZE);
+	parser->http_req = fts_parser_tika_request_init(parser,
+		parser->content_type, parser->content_disposition);
+	http_client_request_set_payload(parser->http_req, input, FALSE);
+	i_stream_unref(&input);
+	http_client_request_submit(parser->http_req);
+	fts_parser_tika_wait_response(parser);
+}
+
+static void fts_parser_tika_cache_write_begin(struct tika_fts_parser *parser)
+{
+	parser->cache_file = fs_file_init(parser->cache_fs, parser->cache_path,
+					  FS_OPEN_MODE_REPLACE);
+	parser->cache_output = fs_write_stream(parser->cache_file);
+}
+
+static void fts_parser_tika_cache_write_finish(struct tika_fts_parser *parser)
+{
+	if (fs_write_stream_finish(parser->cache_file,
+				   &parser->cache_output) < 0) {
+		i_error("fts_tika: Failed to write cache file %s: %s",
+			parser->cache_path,
+			fs_file_last_error(parser->cache_file));
+	}
+	fs_file_deinit(&parser->cache_file);
+}
+
 static void fts_parser_tika_more(struct fts_parser *_parser,
 				 struct message_block *block)
 {
@@ -183,26 +351,37 @@ static void fts_parser_tika_more(struct fts_parser *_parser,
 	ssize_t ret;
 
 	if (block->size > 0) {
-		/* first we'll send everything to Tika */
-		if (!parser->failed &&
-		    http_client_request_send_payload(&parser->http_req,
-						     block->data,
-						     block->size) < 0)
+		if (parser->temp_output != NULL) {
+			/* hash and buffer the attachment for cache lookup */
+			sha256_loop(&parser->hash_ctx, block->data,
+				    block->size);
+			o_stream_nsend(parser->temp_output, block->data,
+				       block->size);
+		} else if (!parser->failed &&
+			   http_client_request_send_payload(&parser->http_req,
+							    block->data,
+							    block->size) < 0) {
+			/* first we'll send everything to Tika */
 			parser->failed = TRUE;
+		}
 		block->size = 0;
 		return;
 	}
 
 	if (parser->payload == NULL) {
-		/* read the result from Tika */
-		if (!parser->failed &&
-		    http_client_request_finish_payload(&parser->http_req) < 0)
+		/* read the result from the cache or Tika */
+		if (parser->temp_output != NULL)
+			fts_parser_tika_cache_lookup(parser);
+		else if (!parser->failed &&
+			 http_client_request_finish_payload(&parser->http_req) < 0)
 			parser->failed = TRUE;
 		if (!parser->failed && parser->payload == NULL)
 			http_client_wait(tika_http_client);
 		if (parser->failed)
 			return;
 		i_assert(parser->payload != NULL);
+		if (parser->cacheable && parser->cache_path != NULL)
+			fts_parser_tika_cache_write_begin(parser);
 	}
 	/* continue returning data from Tika. we'll create a new ioloop just
 	   for reading this one payload. */
@@ -228,6 +407,8 @@ static void fts_parser_tika_more(struct fts_parser *_parser,
 		i_assert(ret > 0);
 		block->data = data;
 		block->size = size;
+		if (parser->cache_output != NULL)
+			o_stream_nsend(parser->cache_output, data, size);
 		i_stream_skip(parser->payload, size);
 	} else {
 		/* finished */
@@ -237,6 +418,8 @@ static void fts_parser_tika_more(struct fts_parser *_parser,
 				i_stream_get_name(parser->payload),
 				i_stream_get_error(parser->payload));
 			parser->failed = TRUE;
+		} else if (parser->cache_output != NULL) {
+			fts_parser_tika_cache_write_finish(parser);
 		}
 	}
 }
@@ -256,6 +439,16 @@ static int fts_parser_tika_deinit(struct fts_parser *_parser, const char **retri
 	i_stream_unref(&parser->payload);
 	io_remove(&parser->io);
 	http_client_request_abort(&parser->http_req);
+	if (parser->cache_output != NULL) {
+		fs_write_stream_abort_error(parser->cache_file,
+					    &parser->cache_output,
+					    "Parsing aborted");
+	}
+	fs_file_deinit(&parser->cache_file);
+	o_stream_destroy(&parser->temp_output);
+	i_free(parser->cache_path);
+	i_free(parser->content_type);
+	i_free(parser->content_disposition);
 	if (parser->ioloop != NULL) {
 		io_loop_set_current(parser->ioloop);
 		io_loop_destroy(&parser->ioloop);
@@ -268,6 +461,7 @@ static void fts_parser_tika_unload(void)
 {
 	if (tika_http_client != NULL)
 		http_client_deinit(&tika_http_client);
+	fs_unref(&tika_cache_fs);
 }
 
 struct fts_parser_vfuncs fts_parser_tika = {
@@ -48,13 +48,7 @@ struct fts_parser *fts_parser_text_init(void)
 
 static bool data_has_nuls(const unsigned char *data, size_t size)
 {
-	size_t i;
-
-	for (i = 0; i < size; i++) {
-		if (data[i] == '\0')
-			return TRUE;
-	}
-	return FALSE;
+	return memchr(data, '\0', size) != NULL;
 }
 
 static void replace_nul_bytes(buffer_t *buf)
@@ -104,15 +104,11 @@ mailbox_cmp_fts_backend(struct mailbox *const *m1, struct mailbox *const *m2)
 	return 0;
 }
 
-static int
-multi_add_lookup_result(struct fts_search_context *fctx,
-			struct fts_search_level *level,
-			struct mail_search_arg *args,
-			struct fts_multi_result *result)
+static void
+multi_add_lookup_args(struct fts_search_level *level,
+		      struct mail_search_arg *args)
 {
-	ARRAY_TYPE(seq_range) vuids;
 	size_t orig_size;
-	unsigned int i;
 
 	orig_size = level->args_matches->used;
 	fts_search_serialize(level->args_matches, args);
@@ -124,6 +120,15 @@ multi_add_lookup_result(struct fts_search_context *fctx,
 			i_panic("incompatible fts backends for namespaces");
 		buffer_set_used_size(level->args_matches, orig_size);
 	}
+}
+
+static void
+multi_add_lookup_result(struct fts_search_context *fctx,
+			struct fts_search_level *level,
+			struct fts_multi_result *result)
+{
+	ARRAY_TYPE(seq_range) vuids;
+	unsigned int i;
 
 	t_array_init(&vuids, 64);
 	for (i = 0; result->box_results[i].box != NULL; i++) {
@@ -146,9 +151,13 @@ multi_add_lookup_result(struct fts_search_context *fctx,
 		if (array_is_created(&br->scores))
 			level_scores_add_vuids(fctx->box, level, br);
 	}
-	return 0;
 }
 
+struct fts_search_multi_lookup {
+	struct fts_backend *backend;
+	struct fts_multi_result result;
+};
+
 static int fts_search_lookup_level_multi(struct fts_search_context *fctx,
 					 struct mail_search_arg *args,
 					 bool and_args)
@@ -156,26 +165,29 @@ static int fts_search_lookup_level_multi(struct fts_search_context *fctx,
 	enum fts_lookup_flags flags = fctx->flags |
 		(and_args ? FTS_LOOKUP_FLAG_AND_ARGS : 0);
 	ARRAY_TYPE(mailboxes) mailboxes_arr, tmp_mailboxes;
+	ARRAY(struct fts_search_multi_lookup) lookups;
+	struct fts_search_multi_lookup *lookup;
 	struct mailbox *const *mailboxes;
 	struct fts_backend *backend;
 	struct fts_search_level *level;
-	struct fts_multi_result result;
 	unsigned int i, j, mailbox_count;
+	int ret = 0;
 
 	p_array_init(&mailboxes_arr, fctx->result_pool, 8);
 	fctx->box->virtual_vfuncs->get_virtual_backend_boxes(fctx->box,
 		&mailboxes_arr, TRUE);
 	array_sort(&mailboxes_arr, mailbox_cmp_fts_backend);
 
-	i_zero(&result);
-	result.pool = fctx->result_pool;
-
 	level = array_append_space(&fctx->levels);
 	level->args_matches = buffer_create_dynamic(fctx->result_pool, 16);
 	p_array_init(&level->score_map, fctx->result_pool, 1);
 
+	/* Start the lookups for all the backends first, so the ones that
+	   support it (e.g. remote backends) can run in parallel. The backend
+	   marks the args it's going to handle already while submitting. */
 	mailboxes = array_get(&mailboxes_arr, &mailbox_count);
 	t_array_init(&tmp_mailboxes, mailbox_count);
+	t_array_init(&lookups, 4);
 	for (i = 0; i < mailbox_count; i = j) {
 		array_clear(&tmp_mailboxes);
 		array_push_back(&tmp_mailboxes, &mailboxes[i]);
@@ -188,16 +200,30 @@ static int fts_search_lookup_level_multi(struct fts_search_context *fctx,
 		}
 		array_append_zero(&tmp_mailboxes);
 
+		lookup = array_append_space(&lookups);
+		lookup->backend = backend;
+		lookup->result.pool = fctx->result_pool;
+
 		mail_search_args_reset(args, TRUE);
-		if (fts_backend_lookup_multi(backend,
-					     array_front(&tmp_mailboxes),
-					     args, flags, &result) < 0)
-			return -1;
+		if (fts_backend_lookup_multi_submit(backend,
+						    array_front(&tmp_mailboxes),
+						    args, flags,
+						    &lookup->result) < 0) {
+			ret = -1;
+			break;
+		}
+		multi_add_lookup_args(level, args);
+	}
 
-		if (multi_add_lookup_result(fctx, level, args, &result) < 0)
-			return -1;
+	/* wait for all the submitted lookups, even after a failure */
+	array_foreach_modifiable(&lookups, lookup) {
+		if (fts_backend_lookup_multi_wait(lookup->backend,
+						  &lookup->result) < 0)
+			ret = -1;
+		else if (ret == 0)
+			multi_add_lookup_result(fctx, level, &lookup->result);
 	}
-	return 0;
+	return ret;
 }
 
 static int fts_search_lookup_level(struct fts_search_context *fctx,
@@ -411,13 +411,36 @@ int fts_mail_user_init(struct mail_user *user, bool initialize_libfts,
 	return 0;
 }
 
+static void
+fts_user_log_filter_cache_stats(struct mail_user *user, struct fts_user *fuser)
+{
+	struct fts_user_language *user_lang;
+	uint64_t hits, misses;
+
+	if (!array_is_created(&fuser->languages))
+		return;
+	array_foreach_elem(&fuser->languages, user_lang) {
+		if (user_lang->filter == NULL)
+			continue;
+		fts_filter_get_cache_stats(user_lang->filter, &hits, &misses);
+		if (hits + misses == 0)
+			continue;
+		e_debug(user->event, "fts: Filter cache for language %s: "
+			"%"PRIu64" hits, %"PRIu64" misses (%u%% hit rate)",
+			user_lang->lang->name, hits, misses,
+			(unsigned int)(hits * 100 / (hits + misses)));
+	}
+}
+
 void fts_mail_user_deinit(struct mail_user *user)
 {
 	struct fts_user *fuser = FTS_USER_CONTEXT(user);
 
 	if (fuser != NULL) {
 		i_assert(fuser->refcount > 0);
-		if (--fuser->refcount == 0)
+		if (--fuser->refcount == 0) {
+			fts_user_log_filter_cache_stats(user, fuser);
 			fts_user_free(fuser);
+		}
 	}
 }
@@ -7,10 +7,13 @@
 #include "module-context.h"
 #include "imap-commands.h"
 #include "compression.h"
+#include "ostream-zlib.h"
 #include "imap-zlib-plugin.h"
 
 
 #define IMAP_COMPRESS_DEFAULT_LEVEL 6
+/* A command that has sent this many bytes is sending a bulk response */
+#define IMAP_COMPRESS_BULK_MIN_BYTES (64*1024)
 
 #define IMAP_ZLIB_IMAP_CONTEXT(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, imap_zlib_imap_module)
@@ -20,7 +23,15 @@ struct zlib_client {
 
 	int (*next_state_export)(struct client *client, bool internal,
 				 buffer_t *dest, const char **error_r);
+	void (*next_destroy)(struct client *client, const char *reason);
 	const struct compression_handler *handler;
+
+	/* the uncompressed output */
+	struct ostream *raw_output;
+	uoff_t start_offset, raw_start_offset;
+	/* level for interactive use and for bulk responses */
+	int level, bulk_level;
+	bool bulk:1;
 };
 
 const char *imap_zlib_plugin_version = DOVECOT_ABI_VERSION;
@@ -62,6 +73,69 @@ static void client_update_imap_parser_streams(struct client *client)
 	}
 }
 
+static int
+imap_zlib_get_level(struct client *client,
+		    const struct compression_handler *handler,
+		    const char *setting, int default_level)
+{
+	const char *value;
+	int level;
+
+	value = mail_user_plugin_getenv(client->user, setting);
+	if (value == NULL)
+		return default_level;
+	if (str_to_int(value, &level) < 0 ||
+	    level < handler->get_min_level() ||
+	    level > handler->get_max_level()) {
+		i_error("%s: Level must be between %d..%d",
+			setting,
+			handler->get_min_level(),
+			handler->get_max_level());
+		return default_level;
+	}
+	return level;
+}
+
+static void
+imap_zlib_set_bulk(struct client *client, struct zlib_client *zclient,
+		   bool bulk)
+{
+	zclient->bulk = bulk;
+	(void)o_stream_zlib_set_level(client->output, bulk ?
+				      zclient->bulk_level : zclient->level);
+	/* the client is waiting for the whole response anyway, so avoid
+	   the overhead of flushing the compression in the middle of it */
+	o_stream_zlib_set_flush_deferred(client->output, bulk);
+	if (!bulk)
+		o_stream_set_flush_pending(client->output, TRUE);
+}
+
+static void imap_zlib_command_pre(struct client_command_context *cmd ATTR_UNUSED)
+{
+}
+
+static void imap_zlib_command_post(struct client_command_context *cmd)
+{
+	struct client *client = cmd->client;
+	struct zlib_client *zclient =
+		MODULE_CONTEXT(client, imap_zlib_imap_module);
+	uoff_t bytes_out;
+
+	if (zclient == NULL || zclient->handler == NULL ||
+	    zclient->bulk_level == zclient->level)
+		return;
+
+	if (cmd->state != CLIENT_COMMAND_STATE_DONE) {
+		bytes_out = cmd->stats.bytes_out +
+			(client->output->offset - cmd->stats_start.bytes_out);
+		if (!zclient->bulk && bytes_out >= IMAP_COMPRESS_BULK_MIN_BYTES)
+			imap_zlib_set_bulk(client, zclient, TRUE);
+	} else if (zclient->bulk && client->command_queue_size <= 1) {
+		/* the last running command finished */
+		imap_zlib_set_bulk(client, zclient, FALSE);
+	}
+}
+
 static bool cmd_compress(struct client_command_context *cmd)
 {
 	struct client *client = cmd->client;
@@ -70,8 +144,7 @@ static bool cmd_compress(struct client_command_context *cmd)
 	const struct imap_arg *args;
 	struct istream *old_input;
 	struct ostream *old_output;
-	const char *mechanism, *value;
-	int level;
+	const char *mechanism;
 	int ret;
 
 	/* <mechanism> */
@@ -102,29 +175,31 @@ static bool cmd_compress(struct client_command_context *cmd)
 	client_skip_line(client);
 	client_send_tagline(cmd, "OK Begin compression.");
 
-	const char *setting = t_strdup_printf("imap_compress_%s_level",
-					      handler->name);
-	value = mail_user_plugin_getenv(client->user, setting);
-	if (value == NULL) {
-		level = handler->get_default_level();
-	} else if (str_to_int(value, &level) < 0 ||
-		   level < handler->get_min_level() ||
-		   level > handler->get_max_level()) {
-		i_error("%s: Level must be between %d..%d",
-			setting,
-			handler->get_min_level(),
-			handler->get_max_level());
-		level = handler->get_default_level();
-	}
+	zclient->level = imap_zlib_get_level(client, handler,
+		t_strdup_printf("imap_compress_%s_level", handler->name),
+		handler->get_default_level());
+	zclient->bulk_level = imap_zlib_get_level(client, handler,
+		t_strdup_printf("imap_compress_%s_bulk_level", handler->name),
+		zclient->level);
+
 	old_input = client->input;
 	old_output = client->output;
 	client->input = handler->create_istream(old_input);
-	client->output = handler->create_ostream(old_output, level);
+	client->output = handler->create_ostream(old_output, zclient->level);
+	/* Auto-cork the compressed stream instead of the raw one. Otherwise
+	   each send would be flushed separately by the compression. Corking
+	   the compressed stream corks the raw stream as well, so the raw
+	   stream's cork state stays the same as client->output's. */
+	o_stream_set_auto_cork(old_output, FALSE);
+	o_stream_set_auto_cork(client->output, TRUE);
 	/* preserve output offset so that the bytes out counter in logout
 	   message doesn't get reset here */
 	client->output->offset = old_output->offset;
 	i_stream_unref(&old_input);
-	o_stream_unref(&old_output);
+
+	zclient->raw_output = old_output;
+	zclient->start_offset = client->output->offset;
+	zclient->raw_start_offset = old_output->offset;
 
 	client_update_imap_parser_streams(client);
 	zclient->handler = handler;
@@ -144,6 +219,26 @@ imap_zlib_state_export(struct client *client, bool internal,
 	return zclient->next_state_export(client, internal, dest, error_r);
 }
 
+static void imap_zlib_client_destroy(struct client *client, const char *reason)
+{
+	struct zlib_client *zclient = IMAP_ZLIB_IMAP_CONTEXT(client);
+	uoff_t bytes, raw_bytes;
+
+	if (zclient->handler != NULL) {
+		bytes = client->output->offset - zclient->start_offset;
+		raw_bytes = zclient->raw_output->offset -
+			zclient->raw_start_offset;
+		e_debug(client->event, "COMPRESS=%s: "
+			"%"PRIuUOFF_T" bytes compressed to %"PRIuUOFF_T
+			" bytes (%u%%) in %"PRIu64" ms",
+			t_str_ucase(zclient->handler->name), bytes, raw_bytes,
+			bytes == 0 ? 100 : (unsigned int)(raw_bytes * 100 / bytes),
+			o_stream_zlib_get_compress_usecs(client->output) / 1000);
+		o_stream_unref(&zclient->raw_output);
+	}
+	zclient->next_destroy(client, reason);
+}
+
 static void imap_zlib_client_created(struct client **clientp)
 {
 	struct client *client = *clientp;
@@ -157,6 +252,8 @@ static void imap_zlib_client_created(struct client **clientp)
 
 		zclient->next_state_export = (*clientp)->v.state_export;
 		(*clientp)->v.state_export = imap_zlib_state_export;
+		zclient->next_destroy = (*clientp)->v.destroy;
+		(*clientp)->v.destroy = imap_zlib_client_destroy;
 
 		client_add_capability(*clientp, "COMPRESS=DEFLATE");
 	}
@@ -168,6 +265,7 @@ static void imap_zlib_client_created(struct client **clientp)
 void imap_zlib_plugin_init(struct module *module)
 {
 	command_register("COMPRESS", cmd_compress, 0);
+	command_hook_register(imap_zlib_command_pre, imap_zlib_command_post);
 
 	imap_zlib_module = module;
 	next_hook_client_created =
@@ -177,6 +275,7 @@ void imap_zlib_plugin_init(struct module *module)
 void imap_zlib_plugin_deinit(void)
 {
 	command_unregister("COMPRESS");
+	command_hook_unregister(imap_zlib_command_pre, imap_zlib_command_post);
 
 	imap_client_created_hook_set(next_hook_client_created);
 }
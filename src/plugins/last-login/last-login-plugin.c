@@ -2,7 +2,9 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "hash.h"
 #include "dict.h"
+#include "settings-parser.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
 #include "mail-storage-private.h"
@@ -13,13 +15,19 @@
 	MODULE_CONTEXT_REQUIRE(obj, last_login_user_module)
 
 #define LAST_LOGIN_DEFAULT_KEY_PREFIX "last-login/"
+#define LAST_LOGIN_WRITES_MAX_COUNT 1000
 
 struct last_login_user {
 	union mail_user_module_context module_ctx;
 	struct dict *dict;
 	struct timeout *to;
+	/* key in last_login_writes, if last_login_interval is set */
+	const char *write_key;
 };
 
+/* dict + key -> time of the last successful write by this process */
+static HASH_TABLE(char *, void *) last_login_writes;
+
 const char *last_login_plugin_version = DOVECOT_ABI_VERSION;
 
 static MODULE_CONTEXT_DEFINE_INIT(last_login_user_module,
@@ -46,6 +54,55 @@ static void last_login_user_deinit(struct mail_user *user)
 	luser->module_ctx.super.deinit(user);
 }
 
+static bool last_login_write_is_recent(const char *key, unsigned int interval)
+{
+	void *value;
+
+	if (!hash_table_is_created(last_login_writes))
+		return FALSE;
+	value = hash_table_lookup(last_login_writes, key);
+	return value != NULL &&
+		ioloop_time - (time_t)POINTER_CAST_TO(value, uintptr_t) <
+		(time_t)interval;
+}
+
+static void last_login_writes_clear(void)
+{
+	struct hash_iterate_context *iter;
+	char *key;
+	void *value;
+
+	iter = hash_table_iterate_init(last_login_writes);
+	while (hash_table_iterate(iter, last_login_writes, &key, &value)) {
+		hash_table_remove(last_login_writes, key);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static void last_login_writes_update(const char *key)
+{
+	char *orig_key;
+	void *value;
+
+	if (!hash_table_is_created(last_login_writes)) {
+		hash_table_create(&last_login_writes, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (hash_table_lookup_full(last_login_writes, key, &orig_key, &value)) {
+		hash_table_update(last_login_writes, orig_key,
+				  POINTER_CAST(ioloop_time));
+		return;
+	}
+	if (hash_table_count(last_login_writes) >= LAST_LOGIN_WRITES_MAX_COUNT) {
+		/* This process serves many users. Just start over, the
+		   worst case is an extra write. */
+		last_login_writes_clear();
+	}
+	hash_table_insert(last_login_writes, i_strdup(key),
+			  POINTER_CAST(ioloop_time));
+}
+
 static void
 last_login_dict_commit(const struct dict_commit_result *result,
 		       struct mail_user *user)
@@ -55,6 +112,8 @@ last_login_dict_commit(const struct dict_commit_result *result,
 	switch(result->ret) {
 	case DICT_COMMIT_RET_OK:
 	case DICT_COMMIT_RET_NOTFOUND:
+		if (luser->write_key != NULL)
+			last_login_writes_update(luser->write_key);
 		break;
 	case DICT_COMMIT_RET_FAILED:
 		i_error("last_login_dict: Failed to write value: %s",
@@ -78,6 +137,8 @@ static void last_login_mail_user_created(struct mail_user *user)
 	struct dict_settings set;
 	struct dict_transaction_context *trans;
 	const char *dict_value, *key_name, *precision, *error;
+	const char *interval_str, *write_key = NULL;
+	unsigned int interval;
 
 	if (user->autocreated) {
 		/* we want to handle only logged in users,
@@ -93,6 +154,28 @@ static void last_login_mail_user_created(struct mail_user *user)
 	if (dict_value == NULL || dict_value[0] == '\0')
 		return;
 
+	key_name = mail_user_plugin_getenv(user, "last_login_key");
+	if (key_name == NULL) {
+		key_name = t_strdup_printf(LAST_LOGIN_DEFAULT_KEY_PREFIX"%s",
+					   user->username);
+	}
+	key_name = t_strconcat(DICT_PATH_SHARED, key_name, NULL);
+
+	interval_str = mail_user_plugin_getenv(user, "last_login_interval");
+	if (interval_str != NULL && interval_str[0] != '\0') {
+		if (settings_get_time(interval_str, &interval, &error) < 0) {
+			i_error("last_login_dict: "
+				"Invalid last_login_interval '%s': %s",
+				interval_str, error);
+		} else if (interval > 0) {
+			/* The user logged in recently via this process - the
+			   timestamp doesn't need to be that accurate. */
+			write_key = t_strconcat(dict_value, "\n", key_name, NULL);
+			if (last_login_write_is_recent(write_key, interval))
+				return;
+		}
+	}
+
 	i_zero(&set);
 	set.base_dir = user->set->base_dir;
 	set.event_parent = user->event;
@@ -108,15 +191,9 @@ static void last_login_mail_user_created(struct mail_user *user)
 	v->deinit = last_login_user_deinit;
 
 	luser->dict = dict;
+	luser->write_key = p_strdup(user->pool, write_key);
 	MODULE_CONTEXT_SET(user, last_login_user_module, luser);
 
-	key_name = mail_user_plugin_getenv(user, "last_login_key");
-	if (key_name == NULL) {
-		key_name = t_strdup_printf(LAST_LOGIN_DEFAULT_KEY_PREFIX"%s",
-					   user->username);
-	}
-	key_name = t_strconcat(DICT_PATH_SHARED, key_name, NULL);
-
 	precision = mail_user_plugin_getenv(user, "last_login_precision");
 
 	const struct dict_op_settings *dset = mail_user_get_dict_op_settings(user);
@@ -154,4 +231,8 @@ void last_login_plugin_init(struct module *module)
 void last_login_plugin_deinit(void)
 {
 	mail_storage_hooks_remove(&last_login_mail_storage_hooks);
+	if (hash_table_is_created(last_login_writes)) {
+		last_login_writes_clear();
+		hash_table_destroy(&last_login_writes);
+	}
 }
@@ -19,6 +19,10 @@
 #include <dirent.h>
 #include <time.h>
 
+/* Default number of mails to move to the expunge mailbox in one
+   transaction. */
+#define LAZY_EXPUNGE_DEFAULT_BATCH_SIZE 1000
+
 #define LAZY_EXPUNGE_CONTEXT(obj) \
 	MODULE_CONTEXT(obj, lazy_expunge_mail_storage_module)
 #define LAZY_EXPUNGE_CONTEXT_REQUIRE(obj) \
@@ -47,6 +51,7 @@ struct lazy_expunge_mail_user {
 	struct mailbox_match_plugin *excludes;
 	const char *lazy_mailbox_vname;
 	const char *env;
+	unsigned int batch_size;
 	bool copy_only_last_instance;
 };
 
@@ -62,6 +67,9 @@ struct lazy_expunge_transaction {
 
 	struct mailbox *dest_box;
 	struct mailbox_transaction_context *dest_trans;
+	/* number of mails moved in dest_trans */
+	unsigned int dest_count;
+	unsigned int batch_size;
 
 	pool_t pool;
 	HASH_TABLE(const char *, void *) guids;
@@ -292,6 +300,34 @@ static void lazy_expunge_set_error(struct lazy_expunge_transaction *lt,
 		i_strdup(mail_storage_get_last_internal_error(storage, NULL));
 }
 
+static void lazy_expunge_dest_trans_begin(struct lazy_expunge_transaction *lt)
+{
+	lt->dest_trans = mailbox_transaction_begin(lt->dest_box,
+				  MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+				  "lazy_expunge_mail_expunge_move");
+	lt->dest_count = 0;
+}
+
+static void
+lazy_expunge_dest_trans_commit_batch(struct lazy_expunge_transaction *lt,
+				     struct mail *_mail)
+{
+	/* Commit large moves in batches, so e.g. emptying a large Trash
+	   doesn't hold the mdbox map lock for a long time. The mails stay in
+	   the source mailbox until its transaction is committed, so a failure
+	   can only cause them to be copied again on the next attempt. */
+	if (lt->batch_size == 0 || ++lt->dest_count < lt->batch_size)
+		return;
+
+	if (mailbox_transaction_commit(&lt->dest_trans) < 0) {
+		mail_set_critical(_mail,
+			"lazy_expunge: Couldn't commit expunge mailbox batch");
+		lazy_expunge_set_error(lt, lt->dest_box->storage);
+		return;
+	}
+	lazy_expunge_dest_trans_begin(lt);
+}
+
 static void lazy_expunge_mail_expunge_move(struct mail *_mail)
 {
 	struct mail_namespace *ns = _mail->box->list->ns;
@@ -322,10 +358,7 @@ static void lazy_expunge_mail_expunge_move(struct mail *_mail)
 			mailbox_free(&lt->dest_box);
 			return;
 		}
-
-		lt->dest_trans = mailbox_transaction_begin(lt->dest_box,
-					  MAILBOX_TRANSACTION_FLAG_EXTERNAL,
-					  __func__);
+		lazy_expunge_dest_trans_begin(lt);
 	}
 
 	save_ctx = mailbox_save_alloc(lt->dest_trans);
@@ -333,8 +366,12 @@ static void lazy_expunge_mail_expunge_move(struct mail *_mail)
 	save_ctx->data.flags &= ENUM_NEGATE(MAIL_DELETED);
 
 	mmail->recursing = TRUE;
-	if (mailbox_move(&save_ctx, _mail) < 0 && !_mail->expunged)
-		lazy_expunge_set_error(lt, lt->dest_box->storage);
+	if (mailbox_move(&save_ctx, _mail) < 0) {
+		if (!_mail->expunged)
+			lazy_expunge_set_error(lt, lt->dest_box->storage);
+	} else {
+		lazy_expunge_dest_trans_commit_batch(lt, _mail);
+	}
 	mmail->recursing = FALSE;
 }
 
@@ -424,6 +461,7 @@ lazy_expunge_transaction_begin(struct mailbox *box,
 	t = mbox->super.transaction_begin(box, flags, reason);
 	lt = i_new(struct lazy_expunge_transaction, 1);
 	lt->copy_only_last_instance = luser->copy_only_last_instance;
+	lt->batch_size = luser->batch_size;
 
 	MODULE_CONTEXT_SET(t, lazy_expunge_mail_storage_module, lt);
 	return t;
@@ -627,6 +665,13 @@ static void lazy_expunge_mail_user_created(struct mail_user *user)
 		luser->copy_only_last_instance =
 			mail_user_plugin_getenv_bool(user, "lazy_expunge_only_last_instance");
 		luser->excludes = mailbox_match_plugin_init(user, "lazy_expunge_exclude");
+		luser->batch_size = LAZY_EXPUNGE_DEFAULT_BATCH_SIZE;
+		env = mail_user_plugin_getenv(user, "lazy_expunge_batch_size");
+		if (env != NULL && str_to_uint(env, &luser->batch_size) < 0) {
+			e_error(user->event, "lazy_expunge: "
+				"Invalid lazy_expunge_batch_size: %s", env);
+			luser->batch_size = LAZY_EXPUNGE_DEFAULT_BATCH_SIZE;
+		}
 
 		MODULE_CONTEXT_SET(user, lazy_expunge_mail_user_module, luser);
 	} else {
@@ -342,12 +342,21 @@ int mail_crypt_user_get_private_key(struct mail_user *user, const char *pubid,
 				    struct dcrypt_private_key **key_r,
 				    const char **error_r)
 {
-	struct mail_namespace *ns = mail_namespace_find_inbox(user->namespaces);
-	struct mailbox *box = mailbox_alloc(ns->list, "INBOX",
-					    MAILBOX_FLAG_READONLY);
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+	struct mail_namespace *ns;
+	struct mailbox *box;
 	struct mail_attribute_value value;
 	int ret;
 
+	/* Folder keys are usually encrypted with the user key. Avoid opening
+	   INBOX for each of them when the user key is already unwrapped. */
+	if (pubid != NULL &&
+	    mail_crypt_get_key_cache(muser->key_cache, pubid, key_r, NULL) > 0)
+		return 1;
+
+	ns = mail_namespace_find_inbox(user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", MAILBOX_FLAG_READONLY);
+
 	/* try retrieve currently active user key */
 	if (mailbox_open(box) < 0) {
 		*error_r = t_strdup_printf("mailbox_open(%s) failed: %s",
@@ -92,6 +92,10 @@ struct mail_log_message {
 struct mail_log_mail_txn_context {
 	pool_t pool;
 	struct mail_log_message *messages, *messages_tail;
+
+	/* wanted headers for wanted_headers_box, reused for all the mails */
+	struct mailbox *wanted_headers_box;
+	struct mailbox_header_lookup_ctx *wanted_headers;
 };
 
 static MODULE_CONTEXT_DEFINE_INIT(mail_log_user_module,
@@ -205,14 +209,20 @@ mail_log_append_uid(struct mail_log_mail_txn_context *ctx,
 	}
 }
 
-static void
-mail_log_update_wanted_fields(struct mail *mail, enum mail_log_field fields)
+static struct mailbox_header_lookup_ctx *
+mail_log_get_wanted_headers(struct mail_log_mail_txn_context *ctx,
+			    struct mailbox *box, enum mail_log_field fields)
 {
-	enum mail_fetch_field wanted_fields = 0;
-	struct mailbox_header_lookup_ctx *wanted_headers = NULL;
 	const char *headers[4];
 	unsigned int hdr_idx = 0;
 
+	/* Bulk operations log many mails in the same mailbox, so create the
+	   header lookup context only once per mailbox. */
+	if (ctx->wanted_headers_box == box)
+		return ctx->wanted_headers;
+	mailbox_header_lookup_unref(&ctx->wanted_headers);
+	ctx->wanted_headers_box = box;
+
 	if ((fields & MAIL_LOG_FIELD_MSGID) != 0)
 		headers[hdr_idx++] = "Message-ID";
 	if ((fields & MAIL_LOG_FIELD_FROM) != 0)
@@ -222,8 +232,19 @@ mail_log_update_wanted_fields(struct mail *mail, enum mail_log_field fields)
 	if (hdr_idx > 0) {
 		i_assert(hdr_idx < N_ELEMENTS(headers));
 		headers[hdr_idx] = NULL;
-		wanted_headers = mailbox_header_lookup_init(mail->box, headers);
+		ctx->wanted_headers = mailbox_header_lookup_init(box, headers);
 	}
+	return ctx->wanted_headers;
+}
+
+static void
+mail_log_update_wanted_fields(struct mail_log_mail_txn_context *ctx,
+			      struct mail *mail, enum mail_log_field fields)
+{
+	enum mail_fetch_field wanted_fields = 0;
+	struct mailbox_header_lookup_ctx *wanted_headers;
+
+	wanted_headers = mail_log_get_wanted_headers(ctx, mail->box, fields);
 
 	if ((fields & MAIL_LOG_FIELD_PSIZE) != 0)
 		wanted_fields |= MAIL_FETCH_PHYSICAL_SIZE;
@@ -231,7 +252,6 @@ mail_log_update_wanted_fields(struct mail *mail, enum mail_log_field fields)
 		wanted_fields |= MAIL_FETCH_VIRTUAL_SIZE;
 
 	mail_add_temp_wanted_fields(mail, wanted_fields, wanted_headers);
-	mailbox_header_lookup_unref(&wanted_headers);
 }
 
 static void
@@ -248,7 +268,7 @@ mail_log_append_mail_message_real(struct mail_log_mail_txn_context *ctx,
 	msg = p_new(ctx->pool, struct mail_log_message, 1);
 
 	/* avoid parsing through the message multiple times */
-	mail_log_update_wanted_fields(mail, muser->fields);
+	mail_log_update_wanted_fields(ctx, mail, muser->fields);
 
 	text = t_str_new(128);
 	str_append(text, desc);
@@ -463,6 +483,7 @@ mail_log_mail_transaction_commit(void *txn,
 	}
 	i_assert(!seq_range_array_iter_nth(&iter, n, &uid));
 
+	mailbox_header_lookup_unref(&ctx->wanted_headers);
 	pool_unref(&ctx->pool);
 }
 
@@ -471,6 +492,7 @@ static void mail_log_mail_transaction_rollback(void *txn)
 	struct mail_log_mail_txn_context *ctx =
 		(struct mail_log_mail_txn_context *)txn;
 
+	mailbox_header_lookup_unref(&ctx->wanted_headers);
 	pool_unref(&ctx->pool);
 }
 
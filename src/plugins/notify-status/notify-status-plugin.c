@@ -246,39 +246,22 @@ static void notify_status_mailbox_rename(struct mailbox *src, struct mailbox *de
 		notify_update_mailbox_status(dest);
 }
 
-static void notify_status_mail_save(void *t, struct mail *mail ATTR_UNUSED)
-{
-	struct notify_status_mail_txn *txn = (struct notify_status_mail_txn *)t;
-	txn->changed = TRUE;
-}
-
-static void notify_status_mail_copy(void *t, struct mail *src ATTR_UNUSED,
-				    struct mail *dst ATTR_UNUSED)
+static void
+notify_status_mail_transaction_changes(void *t,
+				       const struct notify_mail_changes *changes)
 {
 	struct notify_status_mail_txn *txn = (struct notify_status_mail_txn *)t;
-	txn->changed = TRUE;
-}
 
-static void notify_status_mail_expunge(void *t, struct mail *mail ATTR_UNUSED)
-{
-	struct notify_status_mail_txn *txn = (struct notify_status_mail_txn *)t;
-	txn->changed = TRUE;
-}
-static void notify_status_mail_update_flags(void *t, struct mail *mail,
-					    enum mail_flags old_flags)
-{
-	struct notify_status_mail_txn *txn = (struct notify_status_mail_txn *)t;
-	if ((old_flags & MAIL_SEEN) != (mail_get_flags(mail) & MAIL_SEEN))
+	if (changes->saved_count > 0 || changes->copied_count > 0 ||
+	    array_is_created(&changes->expunged_uids) ||
+	    (changes->changed_flags & MAIL_SEEN) != 0)
 		txn->changed = TRUE;
 }
 
 static const struct notify_vfuncs notify_vfuncs =
 {
 	.mail_transaction_begin = notify_status_mail_transaction_begin,
-	.mail_save = notify_status_mail_save,
-	.mail_copy = notify_status_mail_copy,
-	.mail_expunge = notify_status_mail_expunge,
-	.mail_update_flags = notify_status_mail_update_flags,
+	.mail_transaction_changes = notify_status_mail_transaction_changes,
 	.mail_transaction_commit = notify_status_mail_transaction_commit,
 	.mail_transaction_rollback = notify_status_mail_transaction_rollback,
 	.mailbox_create = notify_status_mailbox_create,
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "llist.h"
 #include "mail-storage.h"
 #include "notify-plugin-private.h"
@@ -11,6 +12,8 @@ struct notify_mail_txn {
 	struct mailbox_transaction_context *parent_mailbox_txn;
 	struct mail *tmp_mail;
 	void *txn;
+	/* used if the context has mail_transaction_changes() */
+	struct notify_mail_changes changes;
 };
 
 struct notify_context {
@@ -36,6 +39,25 @@ notify_context_find_mail_txn(struct notify_context *ctx,
 	i_panic("no notify_mail_txn found");
 }
 
+static void
+notify_mail_changes_add_uid(ARRAY_TYPE(seq_range) *uids, uint32_t uid)
+{
+	if (!array_is_created(uids))
+		i_array_init(uids, 8);
+	seq_range_array_add(uids, uid);
+}
+
+static void notify_mail_txn_free(struct notify_mail_txn **_mail_txn)
+{
+	struct notify_mail_txn *mail_txn = *_mail_txn;
+
+	*_mail_txn = NULL;
+	array_free(&mail_txn->changes.expunged_uids);
+	array_free(&mail_txn->changes.flag_changed_uids);
+	array_free(&mail_txn->changes.keyword_changed_uids);
+	i_free(mail_txn);
+}
+
 void notify_contexts_mail_transaction_begin(struct mailbox_transaction_context *t)
 {
 	struct notify_context *ctx;
@@ -56,10 +78,14 @@ void notify_contexts_mail_save(struct mail *mail)
 	struct notify_mail_txn *mail_txn;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_save == NULL)
+		if (ctx->v.mail_save == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_save(mail_txn->txn, mail);
+		if (ctx->v.mail_transaction_changes != NULL)
+			mail_txn->changes.saved_count++;
+		if (ctx->v.mail_save != NULL)
+			ctx->v.mail_save(mail_txn->txn, mail);
 	}
 }
 
@@ -69,10 +95,18 @@ void notify_contexts_mail_copy(struct mail *src, struct mail *dst)
 	struct notify_mail_txn *mail_txn;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_copy == NULL)
+		if (ctx->v.mail_copy == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, dst->transaction);
-		ctx->v.mail_copy(mail_txn->txn, src, dst);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			mail_txn->changes.copied_count++;
+			if (mailbox_get_storage(src->box) !=
+			    mailbox_get_storage(dst->box))
+				mail_txn->changes.copied_from_other_storage_count++;
+		}
+		if (ctx->v.mail_copy != NULL)
+			ctx->v.mail_copy(mail_txn->txn, src, dst);
 	}
 }
 
@@ -82,10 +116,16 @@ void notify_contexts_mail_expunge(struct mail *mail)
 	struct notify_mail_txn *mail_txn;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_expunge == NULL)
+		if (ctx->v.mail_expunge == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_expunge(mail_txn->txn, mail);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			notify_mail_changes_add_uid(
+				&mail_txn->changes.expunged_uids, mail->uid);
+		}
+		if (ctx->v.mail_expunge != NULL)
+			ctx->v.mail_expunge(mail_txn->txn, mail);
 	}
 }
 
@@ -99,10 +139,18 @@ void notify_contexts_mail_update_flags(struct mail *mail,
 		return;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_update_flags == NULL)
+		if (ctx->v.mail_update_flags == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_update_flags(mail_txn->txn, mail, old_flags);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			notify_mail_changes_add_uid(
+				&mail_txn->changes.flag_changed_uids, mail->uid);
+			mail_txn->changes.changed_flags |=
+				old_flags ^ mail_get_flags(mail);
+		}
+		if (ctx->v.mail_update_flags != NULL)
+			ctx->v.mail_update_flags(mail_txn->txn, mail, old_flags);
 	}
 }
 
@@ -116,10 +164,19 @@ void notify_contexts_mail_update_keywords(struct mail *mail,
 		return;
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
-		if (ctx->v.mail_update_keywords == NULL)
+		if (ctx->v.mail_update_keywords == NULL &&
+		    ctx->v.mail_transaction_changes == NULL)
 			continue;
 		mail_txn = notify_context_find_mail_txn(ctx, mail->transaction);
-		ctx->v.mail_update_keywords(mail_txn->txn, mail, old_keywords);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			notify_mail_changes_add_uid(
+				&mail_txn->changes.keyword_changed_uids,
+				mail->uid);
+		}
+		if (ctx->v.mail_update_keywords != NULL) {
+			ctx->v.mail_update_keywords(mail_txn->txn, mail,
+						    old_keywords);
+		}
 	}
 }
 
@@ -131,10 +188,14 @@ void notify_contexts_mail_transaction_commit(struct mailbox_transaction_context
 
 	for (ctx = ctx_list; ctx != NULL; ctx = ctx->next) {
 		mail_txn = notify_context_find_mail_txn(ctx, t);
+		if (ctx->v.mail_transaction_changes != NULL) {
+			ctx->v.mail_transaction_changes(mail_txn->txn,
+							&mail_txn->changes);
+		}
 		if (ctx->v.mail_transaction_commit != NULL)
 			ctx->v.mail_transaction_commit(mail_txn->txn, changes);
 		DLLIST_REMOVE(&ctx->mail_txn_list, mail_txn);
-		i_free(mail_txn);
+		notify_mail_txn_free(&mail_txn);
 	}
 }
 
@@ -148,7 +209,7 @@ void notify_contexts_mail_transaction_rollback(struct mailbox_transaction_contex
 		if (ctx->v.mail_transaction_rollback != NULL)
 			ctx->v.mail_transaction_rollback(mail_txn->txn);
 		DLLIST_REMOVE(&ctx->mail_txn_list, mail_txn);
-		i_free(mail_txn);
+		notify_mail_txn_free(&mail_txn);
 	}
 }
 
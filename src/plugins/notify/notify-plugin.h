@@ -2,6 +2,7 @@
 #define NOTIFY_PLUGIN_H
 
 #include "mail-types.h"
+#include "seq-range-array.h"
 
 struct mail;
 struct mail_transaction_commit_changes;
@@ -12,6 +13,25 @@ struct mailbox;
 struct notify_context;
 struct module;
 
+/* Summary of the mail changes done in a transaction */
+struct notify_mail_changes {
+	/* Number of saved mails. Their UIDs are in the commit changes. */
+	unsigned int saved_count;
+	/* Number of copied mails, and how many of those were copied from
+	   another storage (e.g. mail delivery). */
+	unsigned int copied_count;
+	unsigned int copied_from_other_storage_count;
+
+	/* UIDs of the expunged mails */
+	ARRAY_TYPE(seq_range) expunged_uids;
+	/* UIDs of the mails whose flags changed, and the flags that changed
+	   in any of them. */
+	ARRAY_TYPE(seq_range) flag_changed_uids;
+	enum mail_flags changed_flags;
+	/* UIDs of the mails whose keywords changed */
+	ARRAY_TYPE(seq_range) keyword_changed_uids;
+};
+
 struct notify_vfuncs {
 	void *(*mail_transaction_begin)(struct mailbox_transaction_context *t);
 	void (*mail_save)(void *txn, struct mail *mail);
@@ -21,6 +41,13 @@ struct notify_vfuncs {
 				  enum mail_flags old_flags);
 	void (*mail_update_keywords)(void *txn, struct mail *mail,
 				     const char *const *old_keywords);
+	/* Alternative to the per-mail hooks above for plugins that don't need
+	   to access the individual mails: The changes are collected and this
+	   is called once just before mail_transaction_commit(). With bulk
+	   operations this avoids calling the plugin for each mail. The
+	   arrays in changes are created only if they're non-empty. */
+	void (*mail_transaction_changes)(void *txn,
+			const struct notify_mail_changes *changes);
 	void (*mail_transaction_commit)(void *txn,
 			struct mail_transaction_commit_changes *changes);
 	void (*mail_transaction_rollback)(void *txn);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
 #include "istream.h"
 #include "istream-header-filter.h"
 #include "str.h"
@@ -107,40 +108,19 @@ static int imap_msg_map_uid_cmp(const struct imap_msg_map *map1,
 	return 0;
 }
 
-static int pop3_uidl_map_pop3_seq_cmp(const struct pop3_uidl_map *map1,
-				      const struct pop3_uidl_map *map2)
+static unsigned int hdr_sha1_hash(const unsigned char *sha1)
 {
-	if (map1->pop3_seq < map2->pop3_seq)
-		return -1;
-	if (map1->pop3_seq > map2->pop3_seq)
-		return 1;
-	return 0;
-}
+	uint32_t hash;
 
-static int pop3_uidl_map_uidl_cmp(const struct pop3_uidl_map *map1,
-				  const struct pop3_uidl_map *map2)
-{
-	return strcmp(map1->pop3_uidl, map2->pop3_uidl);
+	/* SHA1 is already evenly distributed */
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
 }
 
-static int imap_msg_map_uidl_cmp(const struct imap_msg_map *map1,
-				 const struct imap_msg_map *map2)
+static int hdr_sha1_cmp(const unsigned char *sha1_1,
+			const unsigned char *sha1_2)
 {
-	return null_strcmp(map1->pop3_uidl, map2->pop3_uidl);
-}
-
-static int pop3_uidl_map_hdr_cmp(const struct pop3_uidl_map *map1,
-				 const struct pop3_uidl_map *map2)
-{
-	return memcmp(map1->common.hdr_sha1, map2->common.hdr_sha1,
-		      sizeof(map1->common.hdr_sha1));
-}
-
-static int imap_msg_map_hdr_cmp(const struct imap_msg_map *map1,
-				const struct imap_msg_map *map2)
-{
-	return memcmp(map1->common.hdr_sha1, map2->common.hdr_sha1,
-		      sizeof(map1->common.hdr_sha1));
+	return memcmp(sha1_1, sha1_2, SHA1_RESULTLEN);
 }
 
 struct pop3_hdr_context {
@@ -618,36 +598,42 @@ static void pop3_uidl_assign_cached(struct mailbox *box)
 		POP3_MIGRATION_CONTEXT_REQUIRE(box->storage);
 	struct pop3_uidl_map *pop3_map;
 	struct imap_msg_map *imap_map;
+	HASH_TABLE(const char *, void *) pop3_uidls;
 	unsigned int imap_idx, pop3_idx, pop3_count, imap_count;
-	int ret;
+	void *value;
 
 	if (mstorage->skip_uidl_cache)
 		return;
 
-	array_sort(&mstorage->pop3_uidl_map, pop3_uidl_map_uidl_cmp);
-	array_sort(&mbox->imap_msg_map, imap_msg_map_uidl_cmp);
-
 	pop3_map = array_get_modifiable(&mstorage->pop3_uidl_map, &pop3_count);
 	imap_map = array_get_modifiable(&mbox->imap_msg_map, &imap_count);
 
-	/* see if we can match the messages using sizes */
-	for (imap_idx = pop3_idx = 0; imap_idx < imap_count; imap_idx++) {
+	/* map POP3 UIDLs to their indexes+1 */
+	hash_table_create(&pop3_uidls, default_pool, pop3_count,
+			  str_hash, strcmp);
+	for (pop3_idx = 0; pop3_idx < pop3_count; pop3_idx++) {
+		if (hash_table_lookup(pop3_uidls,
+				      pop3_map[pop3_idx].pop3_uidl) == NULL) {
+			hash_table_insert(pop3_uidls,
+					  pop3_map[pop3_idx].pop3_uidl,
+					  POINTER_CAST(pop3_idx + 1));
+		}
+	}
+
+	for (imap_idx = 0; imap_idx < imap_count; imap_idx++) {
 		if (imap_map[imap_idx].pop3_uidl == NULL)
 			continue;
 
-		ret = 1;
-		for (; pop3_idx < pop3_count; pop3_idx++) {
-			ret = strcmp(imap_map[imap_idx].pop3_uidl,
-				     pop3_map[pop3_idx].pop3_uidl);
-			if (ret >= 0)
-				break;
-		}
-		if (ret == 0) {
+		value = hash_table_lookup(pop3_uidls,
+					  imap_map[imap_idx].pop3_uidl);
+		if (value != NULL) {
+			pop3_idx = POINTER_CAST_TO(value, unsigned int) - 1;
 			imap_map[imap_idx].pop3_seq =
 				pop3_map[pop3_idx].pop3_seq;
 			pop3_map[pop3_idx].imap_uid = imap_map[imap_idx].uid;
 		}
 	}
+	hash_table_destroy(&pop3_uidls);
 }
 
 static bool pop3_uidl_assign_by_size(struct mailbox *box)
@@ -703,49 +689,64 @@ pop3_uidl_assign_by_hdr_hash(struct mailbox *box, struct mailbox *pop3_box)
 	struct pop3_migration_mailbox *mbox = POP3_MIGRATION_CONTEXT_REQUIRE(box);
 	struct pop3_uidl_map *pop3_map;
 	struct imap_msg_map *imap_map;
+	HASH_TABLE(const unsigned char *, void *) pop3_hashes;
 	unsigned int pop3_idx, imap_idx, pop3_count, imap_count;
-	unsigned int first_seq, missing_uids_count;
+	unsigned int first_seq, missing_uids_count, *pop3_next_idx;
 	uint32_t first_missing_idx = 0, first_missing_seq = (uint32_t)-1;
-	int ret;
+	void *value;
 
 	first_seq = mbox->first_unfound_idx+1;
 	if (pop3_map_read_hdr_hashes(box->storage, pop3_box, first_seq) < 0 ||
 	    imap_map_read_hdr_hashes(box) < 0)
 		return -1;
 
-	array_sort(&mstorage->pop3_uidl_map, pop3_uidl_map_hdr_cmp);
-	array_sort(&mbox->imap_msg_map, imap_msg_map_hdr_cmp);
-
 	pop3_map = array_get_modifiable(&mstorage->pop3_uidl_map, &pop3_count);
 	imap_map = array_get_modifiable(&mbox->imap_msg_map, &imap_count);
 
-	pop3_idx = imap_idx = 0;
-	while (pop3_idx < pop3_count && imap_idx < imap_count) {
-		if (!pop3_map[pop3_idx].common.hdr_sha1_set ||
-		    pop3_map[pop3_idx].imap_uid != 0) {
-			pop3_idx++;
+	/* Map the unmatched POP3 mails' header hashes to their indexes+1.
+	   Mails with the same headers are chained via pop3_next_idx[] in
+	   POP3 sequence order, so they're matched in the same order as the
+	   IMAP UIDs. */
+	hash_table_create(&pop3_hashes, default_pool, pop3_count,
+			  hdr_sha1_hash, hdr_sha1_cmp);
+	pop3_next_idx = i_new(unsigned int, pop3_count + 1);
+	for (pop3_idx = pop3_count; pop3_idx > 0; pop3_idx--) {
+		struct pop3_uidl_map *map = &pop3_map[pop3_idx-1];
+
+		if (!map->common.hdr_sha1_set || map->imap_uid != 0)
 			continue;
-		}
+		value = hash_table_lookup(pop3_hashes, map->common.hdr_sha1);
+		pop3_next_idx[pop3_idx] = POINTER_CAST_TO(value, unsigned int);
+		hash_table_update(pop3_hashes, map->common.hdr_sha1,
+				  POINTER_CAST(pop3_idx));
+	}
+
+	for (imap_idx = 0; imap_idx < imap_count; imap_idx++) {
 		if (!imap_map[imap_idx].common.hdr_sha1_set ||
-		    imap_map[imap_idx].pop3_uidl != NULL) {
-			imap_idx++;
+		    imap_map[imap_idx].pop3_uidl != NULL)
 			continue;
+		value = hash_table_lookup(pop3_hashes,
+					  imap_map[imap_idx].common.hdr_sha1);
+		if (value == NULL)
+			continue;
+
+		pop3_idx = POINTER_CAST_TO(value, unsigned int);
+		if (pop3_next_idx[pop3_idx] == 0) {
+			hash_table_remove(pop3_hashes,
+					  imap_map[imap_idx].common.hdr_sha1);
+		} else {
+			hash_table_update(pop3_hashes,
+				imap_map[imap_idx].common.hdr_sha1,
+				POINTER_CAST(pop3_next_idx[pop3_idx]));
 		}
-		ret = memcmp(pop3_map[pop3_idx].common.hdr_sha1,
-			     imap_map[imap_idx].common.hdr_sha1,
-			     sizeof(pop3_map[pop3_idx].common.hdr_sha1));
-		if (ret < 0)
-			pop3_idx++;
-		else if (ret > 0)
-			imap_idx++;
-		else {
-			pop3_map[pop3_idx].imap_uid = imap_map[imap_idx].uid;
-			imap_map[imap_idx].pop3_uidl =
-				pop3_map[pop3_idx].pop3_uidl;
-			imap_map[imap_idx].pop3_seq =
-				pop3_map[pop3_idx].pop3_seq;
-		}
+		pop3_idx--;
+		pop3_map[pop3_idx].imap_uid = imap_map[imap_idx].uid;
+		imap_map[imap_idx].pop3_uidl = pop3_map[pop3_idx].pop3_uidl;
+		imap_map[imap_idx].pop3_seq = pop3_map[pop3_idx].pop3_seq;
 	}
+	hash_table_destroy(&pop3_hashes);
+	i_free(pop3_next_idx);
+
 	missing_uids_count = 0;
 	for (pop3_idx = 0; pop3_idx < pop3_count; pop3_idx++) {
 		if (pop3_map[pop3_idx].imap_uid != 0) {
@@ -787,8 +788,6 @@ pop3_uidl_assign_by_hdr_hash(struct mailbox *box, struct mailbox *pop3_box)
 		i_warning("%s", str_c(str));
 	} else
 		e_debug(box->event, "pop3_migration: %u mails matched by headers", pop3_count);
-	array_sort(&mstorage->pop3_uidl_map, pop3_uidl_map_pop3_seq_cmp);
-	array_sort(&mbox->imap_msg_map, imap_msg_map_uid_cmp);
 	return 0;
 }
 
@@ -842,9 +841,6 @@ static int pop3_migration_uidl_sync(struct mailbox *box)
 
 	pop3_uidl_assign_cached(box);
 
-	array_sort(&mstorage->pop3_uidl_map, pop3_uidl_map_pop3_seq_cmp);
-	array_sort(&mbox->imap_msg_map, imap_msg_map_uid_cmp);
-
 	if (!pop3_uidl_assign_by_size(box)) {
 		/* everything wasn't assigned, figure out the rest with
 		   header hashes */
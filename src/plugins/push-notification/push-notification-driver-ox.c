@@ -54,6 +54,11 @@ struct push_notification_driver_ox_config {
 /* This is data specific to an OX driver transaction. */
 struct push_notification_driver_ox_txn {
 	const char *unsafe_user;
+
+	/* The mailbox status is looked up once per transaction */
+	struct mailbox_status box_status;
+	bool box_status_looked_up;
+	bool box_status_success;
 };
 
 static void
@@ -67,12 +72,14 @@ push_notification_driver_ox_init_global(
 	if (ox_global->http_client == NULL) {
 		/* This is going to use the first user's settings, but these are
 		   unlikely to change between users so it shouldn't matter much.
+		   The client is kept for the rest of the process' lifetime, so
+		   it must not be tied to the user's event. The requests use the
+		   transaction's event instead.
 		 */
 		i_zero(&http_set);
 		http_set.debug = user->mail_debug;
 		http_set.max_attempts = config->http_max_retries+1;
 		http_set.request_timeout_msecs = config->http_timeout_msecs;
-		http_set.event_parent = user->event;
 		mail_user_init_ssl_client_settings(user, &ssl_set);
 		http_set.ssl = &ssl_set;
 
@@ -291,26 +298,32 @@ push_notification_driver_ox_begin_txn(struct push_notification_driver_txn *dtxn)
 	return TRUE;
 }
 
+/* The request may finish after the user is already deinitialized, so only
+   the (referenced) event is used as the callback context. */
 static void
 push_notification_driver_ox_http_callback(
-	const struct http_response *response,
-	struct push_notification_driver_ox_config *dconfig)
+	const struct http_response *response, struct event *event)
 {
 	switch (response->status / 100) {
 	case 2:
 		// Success.
-		e_debug(dconfig->event, "Notification sent successfully: %s",
+		e_debug(event, "Notification sent successfully: %s",
 			http_response_get_message(response));
 		break;
 
 	default:
 		// Error.
-		e_error(dconfig->event, "Error when sending notification: %s",
+		e_error(event, "Error when sending notification: %s",
 			http_response_get_message(response));
 		break;
 	}
 }
 
+static void push_notification_driver_ox_http_destroyed(struct event *event)
+{
+	event_unref(&event);
+}
+
 /* Callback needed for i_stream_add_destroy_callback() in
    push_notification_driver_ox_process_msg. */
 static void str_free_i(string_t *str)
@@ -369,23 +382,28 @@ push_notification_driver_ox_process_msg(
 	struct push_notification_driver_ox_txn *txn =
 		(struct push_notification_driver_ox_txn *)dtxn->context;
 	struct mail_user *user = dtxn->ptxn->muser;
-	struct mailbox_status box_status;
-	bool status_success = TRUE;
-
-	if (push_notification_driver_ox_get_mailbox_status(
-		dtxn, &box_status) < 0) {
-		status_success = FALSE;
-	}
 
 	messagenew = push_notification_txn_msg_get_eventdata(msg, "MessageNew");
 	if (messagenew == NULL)
 		return;
 
+	/* All the messages are in the same mailbox, so the status needs to
+	   be looked up only once. */
+	if (!txn->box_status_looked_up) {
+		txn->box_status_success =
+			push_notification_driver_ox_get_mailbox_status(
+				dtxn, &txn->box_status) == 0;
+		txn->box_status_looked_up = TRUE;
+	}
+
 	push_notification_driver_ox_init_global(user, dconfig);
 
 	http_req = http_client_request_url(
 		ox_global->http_client, "PUT", dconfig->http_url,
-		push_notification_driver_ox_http_callback, dconfig);
+		push_notification_driver_ox_http_callback, dconfig->event);
+	event_ref(dconfig->event);
+	http_client_request_set_destroy_callback(http_req,
+		push_notification_driver_ox_http_destroyed, dconfig->event);
 	http_client_request_set_event(http_req, dtxn->ptxn->event);
 	http_client_request_add_header(http_req, "Content-Type",
 				       "application/json; charset=utf-8");
@@ -413,8 +431,8 @@ push_notification_driver_ox_process_msg(
 		json_append_escaped(str, messagenew->snippet);
 		str_append(str, "\"");
 	}
-	if (status_success) {
-		str_printfa(str, ",\"unseen\":%u", box_status.unseen);
+	if (txn->box_status_success) {
+		str_printfa(str, ",\"unseen\":%u", txn->box_status.unseen);
 	}
 	str_append(str, "}");
 
@@ -435,9 +453,10 @@ push_notification_driver_ox_deinit(
 	struct push_notification_driver_ox_config *dconfig = duser->context;
 
 	i_free(dconfig->cached_ox_metadata);
+	/* Don't wait for the user's notifications to be sent. They're
+	   finished in the background by the process-wide HTTP client, so e.g.
+	   lmtp can continue delivering to the next recipient. */
 	if (ox_global != NULL) {
-		if (ox_global->http_client != NULL)
-			http_client_wait(ox_global->http_client);
 		i_assert(ox_global->refcount > 0);
 		--ox_global->refcount;
 	}
@@ -448,6 +467,8 @@ static void push_notification_driver_ox_cleanup(void)
 {
 	if ((ox_global != NULL) && (ox_global->refcount <= 0)) {
 		if (ox_global->http_client != NULL) {
+			/* finish sending the pending notifications */
+			http_client_wait(ox_global->http_client);
 			http_client_deinit(&ox_global->http_client);
 		}
 		i_free_and_null(ox_global);
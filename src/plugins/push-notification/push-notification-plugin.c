@@ -309,11 +309,12 @@ static void push_notification_user_deinit(struct mail_user *user)
 	 */
 	io_loop_set_current(main_ioloop);
 
+	/* The drivers' global resources (e.g. the OX driver's HTTP client)
+	   are kept until the plugin is unloaded, so that the following users
+	   in this process can reuse them and their idle connections. */
 	array_foreach_elem(&dlist->drivers, duser) {
 		if (duser->driver->v.deinit != NULL)
 			duser->driver->v.deinit(duser);
-		if (duser->driver->v.cleanup != NULL)
-			duser->driver->v.cleanup();
 	}
 	io_loop_set_current(prev_ioloop);
 
@@ -381,6 +382,7 @@ void push_notification_plugin_init(struct module *module)
 
 void push_notification_plugin_deinit(void)
 {
+	push_notification_driver_cleanup_all();
 	push_notification_driver_unregister(&push_notification_driver_dlog);
 	push_notification_driver_unregister(&push_notification_driver_ox);
 
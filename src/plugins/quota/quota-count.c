@@ -10,6 +10,11 @@ struct count_quota_root {
 
 	struct timeval cache_timeval;
 	uint64_t cached_bytes, cached_count;
+
+	/* With cache-secs the counted usage is kept for this long, and the
+	   quota updates are applied to it instead of counting again. */
+	unsigned int cache_secs;
+	const char *invalid_cache_secs;
 };
 
 struct quota_mailbox_iter {
@@ -202,6 +207,18 @@ int quota_count(struct quota_root *root, uint64_t *bytes_r, uint64_t *count_r,
 	return ret;
 }
 
+static bool quota_count_cache_is_valid(struct count_quota_root *root)
+{
+	if (root->cache_timeval.tv_sec == 0)
+		return FALSE;
+	if (root->cache_secs > 0) {
+		return root->cache_timeval.tv_sec +
+			(time_t)root->cache_secs > ioloop_time;
+	}
+	return root->cache_timeval.tv_usec == ioloop_timeval.tv_usec &&
+		root->cache_timeval.tv_sec == ioloop_timeval.tv_sec;
+}
+
 static enum quota_get_result
 quota_count_cached(struct count_quota_root *root,
 		   uint64_t *bytes_r, uint64_t *count_r,
@@ -209,9 +226,7 @@ quota_count_cached(struct count_quota_root *root,
 {
 	int ret;
 
-	if (root->cache_timeval.tv_usec == ioloop_timeval.tv_usec &&
-	    root->cache_timeval.tv_sec == ioloop_timeval.tv_sec &&
-	    ioloop_timeval.tv_sec != 0) {
+	if (quota_count_cache_is_valid(root)) {
 		*bytes_r = root->cached_bytes;
 		*count_r = root->cached_count;
 		return QUOTA_GET_RESULT_LIMITED;
@@ -237,17 +252,40 @@ static struct quota_root *count_quota_alloc(void)
 	return &root->root;
 }
 
-static int count_quota_init(struct quota_root *root, const char *args,
+static void handle_cache_secs_param(struct quota_root *_root, const char *param_value)
+{
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+
+	if (str_to_uint(param_value, &root->cache_secs) < 0)
+		root->invalid_cache_secs = p_strdup(_root->pool, param_value);
+}
+
+static int count_quota_init(struct quota_root *_root, const char *args,
 			    const char **error_r)
 {
-	if (!root->quota->set->vsizes) {
+	struct count_quota_root *root = (struct count_quota_root *)_root;
+	const struct quota_param_parser count_params[] = {
+		{.param_name = "cache-secs=", .param_handler = handle_cache_secs_param},
+		quota_param_hidden, quota_param_ignoreunlimited,
+		quota_param_noenforcing, quota_param_ns,
+		{.param_name = NULL}
+	};
+
+	if (!_root->quota->set->vsizes) {
 		*error_r = "quota count backend requires quota_vsizes=yes";
 		return -1;
 	}
-	event_set_append_log_prefix(root->backend.event, "quota-count: ");
+	event_set_append_log_prefix(_root->backend.event, "quota-count: ");
 
-	root->auto_updating = TRUE;
-	return quota_root_default_init(root, args, error_r);
+	_root->auto_updating = TRUE;
+	if (quota_parse_parameters(_root, &args, error_r, count_params, TRUE) < 0)
+		return -1;
+	if (root->invalid_cache_secs != NULL) {
+		*error_r = t_strdup_printf("Invalid cache-secs value: %s",
+					   root->invalid_cache_secs);
+		return -1;
+	}
+	return 0;
 }
 
 static void count_quota_deinit(struct quota_root *_root)
@@ -378,6 +416,19 @@ count_quota_update(struct quota_root *root,
 {
 	struct count_quota_root *croot = (struct count_quota_root *)root;
 
+	if (croot->cache_secs > 0 && ctx->recalculate == QUOTA_RECALCULATE_DONT &&
+	    quota_count_cache_is_valid(croot)) {
+		/* The cached usage was counted before this transaction's
+		   changes were committed, so update it incrementally. */
+		croot->cached_bytes = ctx->bytes_used < 0 &&
+			(uint64_t)-ctx->bytes_used > croot->cached_bytes ? 0 :
+			croot->cached_bytes + ctx->bytes_used;
+		croot->cached_count = ctx->count_used < 0 &&
+			(uint64_t)-ctx->count_used > croot->cached_count ? 0 :
+			croot->cached_count + ctx->count_used;
+		return 0;
+	}
+
 	croot->cache_timeval.tv_sec = 0;
 	if (ctx->recalculate == QUOTA_RECALCULATE_FORCED) {
 		if (quota_count_recalculate(root, error_r) < 0)
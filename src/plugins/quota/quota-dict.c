@@ -17,11 +17,21 @@ struct dict_quota_root {
 	struct quota_root root;
 	struct dict *dict;
 	struct timeout *to_update;
+
+	/* With write-delay the usage changes are coalesced and written to
+	   the dict only after the delay. */
+	unsigned int write_delay_msecs;
+	const char *invalid_write_delay;
+	struct timeout *to_write;
+	int64_t pending_bytes, pending_count;
+
 	bool disable_unset;
 };
 
 extern struct quota_backend quota_backend_dict;
 
+static void dict_quota_write_pending(struct dict_quota_root *root);
+
 static struct quota_root *dict_quota_alloc(void)
 {
 	struct dict_quota_root *root;
@@ -35,6 +45,14 @@ static void handle_nounset_param(struct quota_root *_root, const char *param_val
 	((struct dict_quota_root *)_root)->disable_unset = TRUE;
 }
 
+static void handle_write_delay_param(struct quota_root *_root, const char *param_value)
+{
+	struct dict_quota_root *root = (struct dict_quota_root *)_root;
+
+	if (str_to_uint(param_value, &root->write_delay_msecs) < 0)
+		root->invalid_write_delay = p_strdup(_root->pool, param_value);
+}
+
 static int dict_quota_init(struct quota_root *_root, const char *args,
 			   const char **error_r)
 {
@@ -46,6 +64,7 @@ static int dict_quota_init(struct quota_root *_root, const char *args,
 
 	const struct quota_param_parser dict_params[] = {
 		{.param_name = "no-unset", .param_handler = handle_nounset_param},
+		{.param_name = "write-delay=", .param_handler = handle_write_delay_param},
 		quota_param_hidden, quota_param_ignoreunlimited, quota_param_noenforcing, quota_param_ns,
 		{.param_name = NULL}
 	};
@@ -61,12 +80,19 @@ static int dict_quota_init(struct quota_root *_root, const char *args,
 
 	if (quota_parse_parameters(_root, &args, error_r, dict_params, FALSE) < 0)
 		i_unreached();
+	if (root->invalid_write_delay != NULL) {
+		*error_r = t_strdup_printf("Invalid write-delay value: %s",
+					   root->invalid_write_delay);
+		return -1;
+	}
 
 	if (*username == '\0')
 		username = _root->quota->user->username;
 
-	e_debug(_root->backend.event, "user=%s, uri=%s, noenforcing=%d",
-		username, args, _root->no_enforcing ? 1 : 0);
+	e_debug(_root->backend.event,
+		"user=%s, uri=%s, noenforcing=%d, write-delay=%u",
+		username, args, _root->no_enforcing ? 1 : 0,
+		root->write_delay_msecs);
 
 	/* FIXME: we should use 64bit integer as datatype instead but before
 	   it can actually be used don't bother */
@@ -86,6 +112,9 @@ static void dict_quota_deinit(struct quota_root *_root)
 
 	i_assert(root->to_update == NULL);
 
+	/* write the delayed changes before the dict is deinitialized */
+	dict_quota_write_pending(root);
+
 	if (root->dict != NULL) {
 		dict_wait(root->dict);
 		dict_deinit(&root->dict);
@@ -120,6 +149,10 @@ dict_quota_count(struct dict_quota_root *root,
 	if (ret < 0)
 		return error_res;
 
+	/* the recount already includes the delayed changes */
+	timeout_remove(&root->to_write);
+	root->pending_bytes = root->pending_count = 0;
+
 	set = mail_user_get_dict_op_settings(root->root.quota->user);
 	dt = dict_transaction_begin(root->dict, set);
 	/* these unsets are mainly necessary for pgsql, because its
@@ -178,9 +211,11 @@ dict_quota_get_resource(struct quota_root *_root,
 	/* recalculate quota if it's negative or if it wasn't found */
 	if (ret == 0 || str_to_intmax(value, &tmp) < 0)
 		tmp = -1;
-	if (tmp >= 0)
-		*value_r = tmp;
-	else
+	if (tmp >= 0) {
+		/* include the changes that aren't written yet */
+		tmp += want_bytes ? root->pending_bytes : root->pending_count;
+		*value_r = tmp < 0 ? 0 : tmp;
+	} else
 		return dict_quota_count(root, want_bytes, value_r, error_r);
 	return QUOTA_GET_RESULT_LIMITED;
 }
@@ -211,34 +246,57 @@ static void dict_quota_update_callback(const struct dict_commit_result *result,
 	}
 }
 
+static void
+dict_quota_write(struct dict_quota_root *root, int64_t bytes, int64_t count)
+{
+	struct dict_transaction_context *dt;
+	const struct dict_op_settings *set;
+
+	set = mail_user_get_dict_op_settings(root->root.quota->user);
+	dt = dict_transaction_begin(root->dict, set);
+	if (bytes != 0)
+		dict_atomic_inc(dt, DICT_QUOTA_CURRENT_BYTES_PATH, bytes);
+	if (count != 0)
+		dict_atomic_inc(dt, DICT_QUOTA_CURRENT_COUNT_PATH, count);
+	dict_transaction_no_slowness_warning(dt);
+	dict_transaction_commit_async(&dt, dict_quota_update_callback, root);
+}
+
+static void dict_quota_write_pending(struct dict_quota_root *root)
+{
+	timeout_remove(&root->to_write);
+	if (root->pending_bytes == 0 && root->pending_count == 0)
+		return;
+
+	e_debug(root->root.backend.event, "Writing delayed quota changes: "
+		"count=%+"PRId64" bytes=%+"PRId64,
+		root->pending_count, root->pending_bytes);
+	dict_quota_write(root, root->pending_bytes, root->pending_count);
+	root->pending_bytes = root->pending_count = 0;
+}
+
 static int
 dict_quota_update(struct quota_root *_root, 
 		  struct quota_transaction_context *ctx,
 		  const char **error_r)
 {
 	struct dict_quota_root *root = (struct dict_quota_root *) _root;
-	struct dict_transaction_context *dt;
 	uint64_t value;
-	const struct dict_op_settings *set;
 
 	if (ctx->recalculate != QUOTA_RECALCULATE_DONT) {
 		if (dict_quota_count(root, TRUE, &value, error_r)
 		    <= QUOTA_GET_RESULT_INTERNAL_ERROR)
 			return -1;
+	} else if (root->write_delay_msecs == 0) {
+		dict_quota_write(root, ctx->bytes_used, ctx->count_used);
 	} else {
-		set = mail_user_get_dict_op_settings(root->root.quota->user);
-		dt = dict_transaction_begin(root->dict, set);
-		if (ctx->bytes_used != 0) {
-			dict_atomic_inc(dt, DICT_QUOTA_CURRENT_BYTES_PATH,
-					ctx->bytes_used);
-		}
-		if (ctx->count_used != 0) {
-			dict_atomic_inc(dt, DICT_QUOTA_CURRENT_COUNT_PATH,
-					ctx->count_used);
+		root->pending_bytes += ctx->bytes_used;
+		root->pending_count += ctx->count_used;
+		if (root->to_write == NULL) {
+			root->to_write = timeout_add(root->write_delay_msecs,
+						     dict_quota_write_pending,
+						     root);
 		}
-		dict_transaction_no_slowness_warning(dt);
-		dict_transaction_commit_async(&dt, dict_quota_update_callback,
-					      root);
 	}
 	return 0;
 }
@@ -247,6 +305,9 @@ static void dict_quota_flush(struct quota_root *_root)
 {
 	struct dict_quota_root *root = (struct dict_quota_root *)_root;
 
+	/* Delayed changes are written by the timeout or at deinit. Writing
+	   them here would defeat the coalescing, since this is called
+	   whenever a mailbox is closed. */
 	dict_wait(root->dict);
 	if (root->to_update != NULL) {
 		dict_quota_recalc_timeout(root);
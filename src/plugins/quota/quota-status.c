@@ -1,8 +1,11 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "time-util.h"
 #include "ostream.h"
 #include "connection.h"
 #include "restrict-access.h"
@@ -18,6 +21,9 @@
 #include "quota-plugin.h"
 #include "quota-status-settings.h"
 
+/* Maximum number of users in the reply cache */
+#define QUOTA_STATUS_CACHE_MAX_USERS 10000
+
 enum quota_protocol {
 	QUOTA_PROTOCOL_UNKNOWN = 0,
 	QUOTA_PROTOCOL_POSTFIX
@@ -35,6 +41,20 @@ struct quota_client {
 	bool warned_bad_state:1;
 };
 
+struct quota_status_cache_entry {
+	char *username;
+	struct timeval expire_time;
+
+	/* Reply for an unknown user */
+	char *nouser_reply;
+	/* Largest mail size known to fit into the quota and its reply */
+	char *ok_reply;
+	uoff_t ok_size;
+	/* Mail size that didn't fit into the quota and its reply */
+	char *reject_reply;
+	uoff_t reject_size;
+};
+
 static struct event_category event_category_quota_status = {
 	.name = "quota-status"
 };
@@ -45,6 +65,8 @@ static enum quota_protocol protocol;
 static struct mail_storage_service_ctx *storage_service;
 static struct connection_list *clients;
 static char *nouser_reply;
+static unsigned int cache_ttl_msecs;
+static HASH_TABLE(char *, struct quota_status_cache_entry *) reply_cache;
 
 static void client_connected(struct master_service_connection *conn)
 {
@@ -68,6 +90,137 @@ static void client_reset(struct quota_client *client)
 	i_free(client->recipient);
 }
 
+static void
+quota_status_cache_entry_free(struct quota_status_cache_entry *entry)
+{
+	i_free(entry->username);
+	i_free(entry->nouser_reply);
+	i_free(entry->ok_reply);
+	i_free(entry->reject_reply);
+	i_free(entry);
+}
+
+static void quota_status_cache_clear(bool only_expired)
+{
+	struct hash_iterate_context *iter;
+	struct quota_status_cache_entry *entry;
+	char *username;
+
+	iter = hash_table_iterate_init(reply_cache);
+	while (hash_table_iterate(iter, reply_cache, &username, &entry)) {
+		if (!only_expired ||
+		    timeval_cmp(&entry->expire_time, &ioloop_timeval) <= 0) {
+			hash_table_remove(reply_cache, username);
+			quota_status_cache_entry_free(entry);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static const char *
+quota_status_cache_lookup(const char *username, uoff_t size)
+{
+	struct quota_status_cache_entry *entry;
+
+	if (cache_ttl_msecs == 0)
+		return NULL;
+	entry = hash_table_lookup(reply_cache, username);
+	if (entry == NULL)
+		return NULL;
+	if (timeval_cmp(&entry->expire_time, &ioloop_timeval) <= 0) {
+		hash_table_remove(reply_cache, username);
+		quota_status_cache_entry_free(entry);
+		return NULL;
+	}
+
+	if (entry->nouser_reply != NULL)
+		return entry->nouser_reply;
+	/* A smaller mail fits if a larger one did. The reject reply depends
+	   on the exact size, since a larger mail may get a different reply
+	   (e.g. quota_status_toolarge). */
+	if (entry->ok_reply != NULL && size <= entry->ok_size)
+		return entry->ok_reply;
+	if (entry->reject_reply != NULL && size == entry->reject_size)
+		return entry->reject_reply;
+	return NULL;
+}
+
+static struct quota_status_cache_entry *
+quota_status_cache_get(const char *username)
+{
+	struct quota_status_cache_entry *entry;
+
+	entry = hash_table_lookup(reply_cache, username);
+	if (entry == NULL) {
+		if (hash_table_count(reply_cache) >=
+		    QUOTA_STATUS_CACHE_MAX_USERS)
+			quota_status_cache_clear(TRUE);
+		if (hash_table_count(reply_cache) >=
+		    QUOTA_STATUS_CACHE_MAX_USERS) {
+			/* nothing expired - start from scratch */
+			quota_status_cache_clear(FALSE);
+		}
+		entry = i_new(struct quota_status_cache_entry, 1);
+		entry->username = i_strdup(username);
+		hash_table_insert(reply_cache, entry->username, entry);
+	} else if (timeval_cmp(&entry->expire_time, &ioloop_timeval) <= 0) {
+		/* expired - forget the old replies */
+		i_free(entry->nouser_reply);
+		i_free(entry->ok_reply);
+		i_free(entry->reject_reply);
+	} else {
+		/* keep the original expire time, so the cached quota
+		   state isn't extended by new replies */
+		return entry;
+	}
+	entry->expire_time = ioloop_timeval;
+	timeval_add_msecs(&entry->expire_time, cache_ttl_msecs);
+	return entry;
+}
+
+static void
+quota_status_cache_add(const char *username, enum quota_alloc_result qret,
+		       uoff_t size, const char *reply)
+{
+	struct quota_status_cache_entry *entry;
+
+	if (cache_ttl_msecs == 0)
+		return;
+
+	entry = quota_status_cache_get(username);
+	switch (qret) {
+	case QUOTA_ALLOC_RESULT_OK:
+		if (entry->ok_reply == NULL || size > entry->ok_size) {
+			i_free(entry->ok_reply);
+			entry->ok_reply = i_strdup(reply);
+			entry->ok_size = size;
+		}
+		break;
+	case QUOTA_ALLOC_RESULT_OVER_MAXSIZE:
+	case QUOTA_ALLOC_RESULT_OVER_QUOTA_LIMIT:
+	case QUOTA_ALLOC_RESULT_OVER_QUOTA:
+		i_free(entry->reject_reply);
+		entry->reject_reply = i_strdup(reply);
+		entry->reject_size = size;
+		break;
+	case QUOTA_ALLOC_RESULT_TEMPFAIL:
+	case QUOTA_ALLOC_RESULT_BACKGROUND_CALC:
+		break;
+	}
+}
+
+static void quota_status_cache_add_nouser(const char *username)
+{
+	struct quota_status_cache_entry *entry;
+
+	if (cache_ttl_msecs == 0)
+		return;
+
+	entry = quota_status_cache_get(username);
+	i_free(entry->nouser_reply);
+	entry->nouser_reply = i_strdup(nouser_reply);
+}
+
 static enum quota_alloc_result
 quota_check(struct mail_user *user, uoff_t mail_size, const char **error_r)
 {
@@ -149,12 +302,23 @@ static void client_handle_request(struct quota_client *client)
 	smtp_address_detail_parse_temp(quota_status_settings->recipient_delimiter,
 				       rcpt, &input.username, &delim,
 				       &detail);
-	ret = mail_storage_service_lookup_next(storage_service, &input,
-					       &service_user, &user, &error);
-	restrict_access_allow_coredumps(TRUE);
-	if (ret == 0) {
+	value = quota_status_cache_lookup(input.username, client->size);
+	if (value != NULL) {
+		e_debug(client->event, "Using cached reply for user `%s'",
+			input.username);
+		ret = 1;
+	} else {
+		ret = mail_storage_service_lookup_next(storage_service, &input,
+						       &service_user, &user,
+						       &error);
+		restrict_access_allow_coredumps(TRUE);
+	}
+	if (value != NULL) {
+		/* cached */
+	} else if (ret == 0) {
 		e_debug(client->event, "User `%s' not found", input.username);
 		value = nouser_reply;
+		quota_status_cache_add_nouser(input.username);
 	} else if (ret > 0) {
 		enum quota_alloc_result qret = quota_check(user, client->size,
 							   &error);
@@ -192,6 +356,10 @@ static void client_handle_request(struct quota_client *client)
 			break;
 		}
 		value = t_strdup(value); /* user's pool is being freed */
+		if (ret > 0) {
+			quota_status_cache_add(input.username, qret,
+					       client->size, value);
+		}
 		mail_user_deinit(&user);
 		mail_storage_service_user_unref(&service_user);
 	} else {
@@ -314,11 +482,18 @@ static void main_init(void)
 	value = mail_user_set_plugin_getenv(user_set, "quota_status_nouser");
 	nouser_reply = p_strdup(quota_status_pool,
 				value != NULL ? value : "REJECT Unknown user");
+	value = mail_user_set_plugin_getenv(user_set, "quota_status_cache_ttl");
+	if (value != NULL &&
+	    settings_get_time_msecs(value, &cache_ttl_msecs, &error) < 0)
+		i_fatal("quota_status_cache_ttl: %s", error);
+	hash_table_create(&reply_cache, default_pool, 0, str_hash, strcmp);
 	pool_unref(&pool);
 }
 
 static void main_deinit(void)
 {
+	quota_status_cache_clear(FALSE);
+	hash_table_destroy(&reply_cache);
 	pool_unref(&quota_status_pool);
 	connection_list_deinit(&clients);
 	mail_storage_service_deinit(&storage_service);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "llist.h"
 #include "str.h"
 #include "strescape.h"
 #include "ioloop.h"
@@ -25,10 +26,11 @@
 
 struct replication_user {
 	union mail_user_module_context module_ctx;
+	struct replication_user *prev, *next;
+	struct mail_user *user;
 
 	const char *socket_path;
 
-	struct timeout *to;
 	enum replication_priority priority;
 	unsigned int sync_secs;
 };
@@ -45,12 +47,23 @@ static MODULE_CONTEXT_DEFINE_INIT(replication_user_module,
 static int fifo_fd;
 static bool fifo_failed;
 static char *fifo_path;
+/* Users with a pending notification. They're all sent together once the
+   notify timeout triggers. */
+static struct replication_user *pending_users;
+static struct timeout *to_notify;
 
-static int
-replication_fifo_notify(struct mail_user *user,
-			enum replication_priority priority)
+static void
+replication_notify_append(string_t *str, struct replication_user *ruser)
+{
+	/* <username> \t <priority> */
+	i_assert(ruser->priority == REPLICATION_PRIORITY_LOW ||
+		 ruser->priority == REPLICATION_PRIORITY_HIGH);
+	str_append_tabescaped(str, ruser->user->username);
+	str_printfa(str, "\t%s\n", replicator_priority_to_str(ruser->priority));
+}
+
+static int replication_fifo_write(const string_t *str)
 {
-	string_t *str;
 	ssize_t ret;
 
 	if (fifo_failed)
@@ -63,22 +76,6 @@ replication_fifo_notify(struct mail_user *user,
 			return -1;
 		}
 	}
-	/* <username> \t <priority> */
-	str = t_str_new(256);
-	str_append_tabescaped(str, user->username);
-	str_append_c(str, '\t');
-	switch (priority) {
-	case REPLICATION_PRIORITY_NONE:
-	case REPLICATION_PRIORITY_SYNC:
-		i_unreached();
-	case REPLICATION_PRIORITY_LOW:
-		str_append(str, "low");
-		break;
-	case REPLICATION_PRIORITY_HIGH:
-		str_append(str, "high");
-		break;
-	}
-	str_append_c(str, '\n');
 	ret = write(fifo_fd, str_data(str), str_len(str));
 	i_assert(ret != 0);
 	if (ret != (ssize_t)str_len(str)) {
@@ -101,23 +98,58 @@ replication_fifo_notify(struct mail_user *user,
 	return 1;
 }
 
-static void replication_notify_now(struct mail_user *user)
+static int replication_fifo_notify(const string_t *str)
 {
-	struct replication_user *ruser = REPLICATION_USER_CONTEXT(user);
 	int ret;
 
-	i_assert(ruser != NULL);
-	i_assert(ruser->priority != REPLICATION_PRIORITY_NONE);
-	i_assert(ruser->priority != REPLICATION_PRIORITY_SYNC);
-
-	if ((ret = replication_fifo_notify(user, ruser->priority)) < 0 &&
-	    !fifo_failed) {
+	if ((ret = replication_fifo_write(str)) < 0 && !fifo_failed) {
 		/* retry once, in case replication server was restarted */
-		ret = replication_fifo_notify(user, ruser->priority);
+		ret = replication_fifo_write(str);
 	}
-	if (ret != 0) {
-		timeout_remove(&ruser->to);
-		ruser->priority = REPLICATION_PRIORITY_NONE;
+	return ret;
+}
+
+static void replication_notify_done(struct replication_user *ruser)
+{
+	if (ruser->priority == REPLICATION_PRIORITY_NONE)
+		return;
+	DLLIST_REMOVE(&pending_users, ruser);
+	ruser->priority = REPLICATION_PRIORITY_NONE;
+	if (pending_users == NULL)
+		timeout_remove(&to_notify);
+}
+
+static void replication_notify_now(void *context ATTR_UNUSED)
+{
+	struct replication_user *ruser, *next;
+	string_t *str = t_str_new(256);
+	unsigned int i, count;
+	size_t len;
+	int ret = 1;
+
+	while (pending_users != NULL && ret != 0) {
+		/* Send as many users as possible with a single write, but
+		   keep the writes small enough to be atomic. Otherwise lines
+		   from different processes could get mixed up in the fifo. */
+		str_truncate(str, 0);
+		count = 0;
+		for (ruser = pending_users; ruser != NULL; ruser = ruser->next) {
+			len = str_len(str);
+			replication_notify_append(str, ruser);
+			if (str_len(str) > PIPE_BUF && count > 0) {
+				str_truncate(str, len);
+				break;
+			}
+			count++;
+		}
+		/* On failure the notifications are dropped. If the fifo is
+		   busy they're tried again later. */
+		ret = replication_fifo_notify(str);
+		for (i = 0; i < count && ret != 0; i++) {
+			next = pending_users->next;
+			replication_notify_done(pending_users);
+			i_assert(pending_users == next);
+		}
 	}
 }
 
@@ -195,19 +227,20 @@ static void replication_notify(struct mail_namespace *ns,
 
 	if (priority == REPLICATION_PRIORITY_SYNC) {
 		if (replication_notify_sync(ns->user) == 0) {
-			timeout_remove(&ruser->to);
-			ruser->priority = REPLICATION_PRIORITY_NONE;
+			replication_notify_done(ruser);
 			return;
 		}
 		/* sync replication failed, try as "high" via fifo */
 		priority = REPLICATION_PRIORITY_HIGH;
 	}
 
+	if (ruser->priority == REPLICATION_PRIORITY_NONE)
+		DLLIST_PREPEND(&pending_users, ruser);
 	if (ruser->priority < priority)
 		ruser->priority = priority;
-	if (ruser->to == NULL) {
-		ruser->to = timeout_add_short(REPLICATION_NOTIFY_DELAY_MSECS,
-					      replication_notify_now, ns->user);
+	if (to_notify == NULL) {
+		to_notify = timeout_add_short(REPLICATION_NOTIFY_DELAY_MSECS,
+					      replication_notify_now, NULL);
 	}
 }
 
@@ -226,28 +259,20 @@ replication_mail_transaction_begin(struct mailbox_transaction_context *t)
 	return ctx;
 }
 
-static void replication_mail_save(void *txn, struct mail *mail ATTR_UNUSED)
-{
-	struct replication_mail_txn_context *ctx =
-		(struct replication_mail_txn_context *)txn;
-
-	ctx->new_messages = TRUE;
-}
-
-static void replication_mail_copy(void *txn, struct mail *src,
-				  struct mail *dst)
+static void
+replication_mail_transaction_changes(void *txn,
+				     const struct notify_mail_changes *changes)
 {
 	struct replication_mail_txn_context *ctx =
 		(struct replication_mail_txn_context *)txn;
 
-	if (src->box->storage != dst->box->storage) {
-		/* copy between storages, e.g. new mail delivery */
+	/* Copies within storage aren't as high priority since the mail
+	   already exists. And especially copies to Trash or to lazy-expunge
+	   namespace are pretty low priority. Copies between storages are
+	   e.g. new mail deliveries. */
+	if (changes->saved_count > 0 ||
+	    changes->copied_from_other_storage_count > 0)
 		ctx->new_messages = TRUE;
-	} else {
-		/* copy within storage, which isn't as high priority since the
-		   mail already exists. and especially copies to Trash or to
-		   lazy-expunge namespace is pretty low priority. */
-	}
 }
 
 static bool
@@ -315,14 +340,16 @@ static void replication_user_deinit(struct mail_user *user)
 
 	i_assert(ruser != NULL);
 
-	if (ruser->to != NULL) {
-		replication_notify_now(user);
-		if (ruser->to != NULL) {
+	if (ruser->priority != REPLICATION_PRIORITY_NONE) T_BEGIN {
+		string_t *str = t_str_new(256);
+
+		replication_notify_append(str, ruser);
+		if (replication_fifo_notify(str) == 0) {
 			i_warning("%s: Couldn't send final notification "
 				  "due to fifo being busy", fifo_path);
-			timeout_remove(&ruser->to);
 		}
-	}
+		replication_notify_done(ruser);
+	} T_END;
 
 	ruser->module_ctx.super.deinit(user);
 }
@@ -347,6 +374,7 @@ static void replication_user_created(struct mail_user *user)
 	}
 
 	ruser = p_new(user->pool, struct replication_user, 1);
+	ruser->user = user;
 	ruser->module_ctx.super = *v;
 	user->vlast = &ruser->module_ctx.super;
 	v->deinit = replication_user_deinit;
@@ -370,8 +398,7 @@ static void replication_user_created(struct mail_user *user)
 
 static const struct notify_vfuncs replication_vfuncs = {
 	.mail_transaction_begin = replication_mail_transaction_begin,
-	.mail_save = replication_mail_save,
-	.mail_copy = replication_mail_copy,
+	.mail_transaction_changes = replication_mail_transaction_changes,
 	.mail_transaction_commit = replication_mail_transaction_commit,
 	.mailbox_create = replication_mailbox_create,
 	.mailbox_delete_commit = replication_mailbox_delete_commit,
@@ -394,6 +421,8 @@ void replication_plugin_init(struct module *module)
 
 void replication_plugin_deinit(void)
 {
+	i_assert(pending_users == NULL);
+	timeout_remove(&to_notify);
 	i_close_fd_path(&fifo_fd, fifo_path);
 	i_free_and_null(fifo_path);
 
@@ -32,6 +32,8 @@ struct trash_mailbox {
 	struct mailbox_transaction_context *trans;
 	struct mail_search_context *search_ctx;
 	struct mail *mail;
+	/* received date of mail, if it's needed for ordering */
+	time_t mail_received;
 };
 
 struct trash_user {
@@ -50,9 +52,11 @@ static enum quota_alloc_result (*trash_next_quota_test_alloc)(
 		struct quota_transaction_context *, uoff_t,
 		const char **error_r);
 
-static int trash_clean_mailbox_open(struct trash_mailbox *trash)
+static int trash_clean_mailbox_open(struct trash_mailbox *trash,
+				    bool want_received)
 {
 	struct mail_search_args *search_args;
+	enum mail_fetch_field wanted_fields = MAIL_FETCH_PHYSICAL_SIZE;
 
 	trash->box = mailbox_alloc(trash->ns->list, trash->name, 0);
 	if (mailbox_open(trash->box) < 0) {
@@ -67,35 +71,50 @@ static int trash_clean_mailbox_open(struct trash_mailbox *trash)
 
 	search_args = mail_search_build_init();
 	mail_search_build_add_all(search_args);
+	if (want_received)
+		wanted_fields |= MAIL_FETCH_RECEIVED_DATE;
 	trash->search_ctx = mailbox_search_init(trash->trans,
 						search_args, NULL,
-						MAIL_FETCH_PHYSICAL_SIZE |
-						MAIL_FETCH_RECEIVED_DATE, NULL);
+						wanted_fields, NULL);
 	mail_search_args_unref(&search_args);
 
 	return mailbox_search_next(trash->search_ctx, &trash->mail) ? 1 : 0;
 }
 
 static int trash_clean_mailbox_get_next(struct trash_mailbox *trash,
+					bool want_received,
 					time_t *received_time_r)
 {
 	int ret;
 
-	if (trash->mail == NULL) {
-		if (trash->box == NULL)
-			ret = trash_clean_mailbox_open(trash);
-		else {
-			ret = mailbox_search_next(trash->search_ctx,
-						  &trash->mail) ? 1 : 0;
-		}
-		if (ret <= 0) {
-			*received_time_r = 0;
-			return ret;
-		}
+	if (trash->mail != NULL) {
+		/* still the same mail as in the previous call */
+		*received_time_r = trash->mail_received;
+		return 1;
+	}
+
+	if (trash->box == NULL)
+		ret = trash_clean_mailbox_open(trash, want_received);
+	else {
+		ret = mailbox_search_next(trash->search_ctx,
+					  &trash->mail) ? 1 : 0;
+	}
+	if (ret <= 0) {
+		*received_time_r = 0;
+		return ret;
 	}
 
-	if (mail_get_received_date(trash->mail, received_time_r) < 0)
+	/* The received date is needed only for choosing between mailboxes
+	   that have the same priority. Within a mailbox the mails are
+	   expunged in UID order, so with a single mailbox looking it up
+	   would only be wasted work (e.g. a stat() per mail with maildir). */
+	trash->mail_received = 0;
+	if (want_received &&
+	    mail_get_received_date(trash->mail, &trash->mail_received) < 0) {
+		trash->mail = NULL;
 		return -1;
+	}
+	*received_time_r = trash->mail_received;
 	return 1;
 }
 
@@ -106,7 +125,7 @@ static int trash_try_clean_mails(struct quota_transaction_context *ctx,
 	struct trash_user *tuser = TRASH_USER_CONTEXT_REQUIRE(ctx->quota->user);
 	struct trash_mailbox *trashes;
 	struct event_reason *reason;
-	unsigned int i, j, count, oldest_idx;
+	unsigned int i, j, count, oldest_idx, group_end;
 	time_t oldest, received = 0;
 	uint64_t size, size_expunged = 0;
 	unsigned int expunged_count = 0;
@@ -118,13 +137,16 @@ static int trash_try_clean_mails(struct quota_transaction_context *ctx,
 	for (i = 0; i < count; ) {
 		/* expunge oldest mails first in all trash boxes with
 		   same priority */
-		oldest_idx = count;
-		oldest = (time_t)-1;
-		for (j = i; j < count; j++) {
-			if (trashes[j].priority != trashes[i].priority)
+		for (group_end = i + 1; group_end < count; group_end++) {
+			if (trashes[group_end].priority != trashes[i].priority)
 				break;
+		}
 
+		oldest_idx = count;
+		oldest = (time_t)-1;
+		for (j = i; j < group_end; j++) {
 			ret = trash_clean_mailbox_get_next(&trashes[j],
+							   group_end - i > 1,
 							   &received);
 			if (ret < 0)
 				goto err;
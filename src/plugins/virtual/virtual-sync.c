@@ -6,6 +6,7 @@
 #include "ioloop.h"
 #include "str.h"
 #include "mail-index-modseq.h"
+#include "mail-transaction-log.h"
 #include "mail-search-build.h"
 #include "mailbox-search-result-private.h"
 #include "mailbox-recent-flags.h"
@@ -882,6 +883,131 @@ virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 	virtual_sync_bbox_uids_sort(bbox);
 }
 
+static void
+virtual_sync_add_changed_uids(struct mail_index_view *view,
+			      const struct seq_range *uids, unsigned int count,
+			      uint32_t old_msg_count,
+			      ARRAY_TYPE(seq_range) *changed_uids)
+{
+	uint32_t seq, seq1, seq2, uid;
+	unsigned int i;
+
+	/* add only the old messages that still exist */
+	for (i = 0; i < count; i++) {
+		if (!mail_index_lookup_seq_range(view, uids[i].seq1,
+						 uids[i].seq2, &seq1, &seq2))
+			continue;
+		if (seq2 > old_msg_count)
+			seq2 = old_msg_count;
+		for (seq = seq1; seq <= seq2; seq++) {
+			mail_index_lookup_uid(view, seq, &uid);
+			seq_range_array_add(changed_uids, uid);
+		}
+	}
+}
+
+static bool
+virtual_sync_backend_get_log_changes(struct virtual_backend_box *bbox,
+				     uint32_t old_msg_count,
+				     ARRAY_TYPE(seq_range) *changed_uids)
+{
+	struct mail_index_view *view = bbox->box->view;
+	struct mail_transaction_log_view *log_view;
+	const struct mail_transaction_header *thdr;
+	const void *tdata;
+	const char *reason;
+	uint32_t log_seq;
+	uoff_t log_offset;
+	const unsigned int modseq_ext_len = strlen(MAIL_INDEX_MODSEQ_EXT_NAME);
+	unsigned int seqset_offset;
+	bool reset, modseq_ext = FALSE, ret = TRUE;
+
+	/* Find the messages whose modseq changed after the last sync from
+	   the transaction log. This avoids looking up the modseqs of all the
+	   messages in large backend mailboxes. */
+	if (!mail_index_modseq_get_next_log_offset(view,
+			bbox->sync_highest_modseq, &log_seq, &log_offset))
+		return FALSE;
+
+	log_view = mail_transaction_log_view_open(bbox->box->index->log);
+	if (mail_transaction_log_view_set(log_view, log_seq, log_offset,
+					  view->log_file_head_seq,
+					  view->log_file_head_offset,
+					  &reset, &reason) <= 0 || reset) {
+		mail_transaction_log_view_close(&log_view);
+		return FALSE;
+	}
+	while (ret && mail_transaction_log_view_next(log_view, &thdr,
+						     &tdata) > 0) {
+		switch (thdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+		case MAIL_TRANSACTION_FLAG_UPDATE: {
+			const struct mail_transaction_flag_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; rec < end; rec++) {
+				const struct seq_range range = {
+					rec->uid1, rec->uid2
+				};
+				virtual_sync_add_changed_uids(view, &range, 1,
+					old_msg_count, changed_uids);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_KEYWORD_UPDATE: {
+			const struct mail_transaction_keyword_update *rec = tdata;
+
+			seqset_offset = sizeof(*rec) + rec->name_size;
+			if ((seqset_offset % 4) != 0)
+				seqset_offset += 4 - (seqset_offset % 4);
+			virtual_sync_add_changed_uids(view,
+				CONST_PTR_OFFSET(tdata, seqset_offset),
+				(thdr->size - seqset_offset) /
+				sizeof(struct seq_range),
+				old_msg_count, changed_uids);
+			break;
+		}
+		case MAIL_TRANSACTION_KEYWORD_RESET:
+			virtual_sync_add_changed_uids(view, tdata,
+				thdr->size /
+				sizeof(struct mail_transaction_keyword_reset),
+				old_msg_count, changed_uids);
+			break;
+		case MAIL_TRANSACTION_MODSEQ_UPDATE: {
+			const struct mail_transaction_modseq_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(tdata, thdr->size);
+			for (rec = tdata; rec < end; rec++) {
+				const struct seq_range range = {
+					rec->uid, rec->uid
+				};
+				virtual_sync_add_changed_uids(view, &range, 1,
+					old_msg_count, changed_uids);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_EXT_INTRO: {
+			const struct mail_transaction_ext_intro *intro = tdata;
+
+			modseq_ext = intro->name_size == modseq_ext_len &&
+				memcmp(intro + 1, MAIL_INDEX_MODSEQ_EXT_NAME,
+				       modseq_ext_len) == 0;
+			break;
+		}
+		case MAIL_TRANSACTION_EXT_RESET:
+			/* modseqs were reset */
+			if (modseq_ext)
+				ret = FALSE;
+			break;
+		default:
+			/* appends and expunges are handled separately, the
+			   rest don't change message modseqs */
+			break;
+		}
+	}
+	mail_transaction_log_view_close(&log_view);
+	return ret;
+}
+
 static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 					     struct virtual_backend_box *bbox)
 {
@@ -924,7 +1050,11 @@ static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 	old_highest_modseq = mail_index_modseq_get_highest(view);
 
 	t_array_init(&flag_update_uids, I_MIN(128, old_msg_count));
-	if (bbox->sync_highest_modseq < old_highest_modseq) {
+	if (bbox->sync_highest_modseq < old_highest_modseq &&
+	    !virtual_sync_backend_get_log_changes(bbox, old_msg_count,
+						  &flag_update_uids)) {
+		/* the log is no longer available - scan all the messages */
+		array_clear(&flag_update_uids);
 		for (seq = 1; seq <= old_msg_count; seq++) {
 			modseq = mail_index_modseq_lookup(view, seq);
 			if (modseq > bbox->sync_highest_modseq) {
@@ -6,10 +6,13 @@
 #include "istream-seekable.h"
 #include "ostream.h"
 #include "str.h"
+#include "settings-parser.h"
 #include "mail-user.h"
 #include "index-storage.h"
 #include "index-mail.h"
 #include "compression.h"
+#include "ostream-zlib.h"
+#include "zstd-dict.h"
 #include "zlib-plugin.h"
 
 #include <fcntl.h>
@@ -23,6 +26,8 @@
 
 #define MAX_INBUF_SIZE (1024*1024)
 #define ZLIB_MAIL_CACHE_EXPIRE_MSECS (60*1000)
+/* Default for zlib_save_zstd_workers_min_size */
+#define ZLIB_SAVE_ZSTD_WORKERS_MIN_SIZE_DEFAULT (4*1024*1024)
 
 struct zlib_mail {
 	union mail_module_context module_ctx;
@@ -44,6 +49,12 @@ struct zlib_user {
 
 	const struct compression_handler *save_handler;
 	int save_level;
+	/* zstd dictionary to use for saving, 0 if none */
+	unsigned int save_zstd_dict_id;
+	/* number of zstd worker threads to use for saving mails that are at
+	   least save_zstd_workers_min_size bytes, 0 if disabled */
+	unsigned int save_zstd_workers;
+	uoff_t save_zstd_workers_min_size;
 };
 
 const char *zlib_plugin_version = DOVECOT_ABI_VERSION;
@@ -150,8 +161,12 @@ static int zlib_istream_opened(struct mail *_mail, struct istream **stream)
 		input = *stream;
 		*stream = handler->create_istream(input);
 		i_stream_unref(&input);
-		/* dont cache the stream if _mail->uid is 0 */
-		*stream = zlib_mail_cache_open(zuser, _mail, *stream, (_mail->uid > 0));
+		/* dont cache the stream if _mail->uid is 0. seekable formats
+		   don't need the temporary seekable stream at all. */
+		if (!handler->seekable) {
+			*stream = zlib_mail_cache_open(zuser, _mail, *stream,
+						       (_mail->uid > 0));
+		}
 	}
 	return zmail->module_ctx.super.istream_opened(_mail, stream);
 }
@@ -227,10 +242,29 @@ zlib_mail_save_compress_begin(struct mail_save_context *ctx,
 	struct zlib_user *zuser = ZLIB_USER_CONTEXT(box->storage->user);
 	union mailbox_module_context *zbox = ZLIB_CONTEXT(box);
 	struct ostream *output;
+#ifdef HAVE_ZSTD
+	uoff_t size;
+#endif
 
 	if (zbox->super.save_begin(ctx, input) < 0)
 		return -1;
 
+#ifdef HAVE_ZSTD
+	if (zuser->save_zstd_workers > 0 &&
+	    i_stream_get_size(input, FALSE, &size) > 0 &&
+	    size >= zuser->save_zstd_workers_min_size) {
+		/* large mail - don't stall the session while it's being
+		   compressed */
+		output = o_stream_create_zstd_workers(ctx->data.output,
+						      zuser->save_level,
+						      zuser->save_zstd_dict_id,
+						      zuser->save_zstd_workers);
+	} else if (zuser->save_zstd_dict_id != 0) {
+		output = o_stream_create_zstd_dict(ctx->data.output,
+						   zuser->save_level,
+						   zuser->save_zstd_dict_id);
+	} else
+#endif
 	output = zuser->save_handler->create_ostream(ctx->data.output,
 						     zuser->save_level);
 	o_stream_unref(&ctx->data.output);
@@ -331,6 +365,70 @@ static void zlib_mail_user_deinit(struct mail_user *user)
 	zuser->module_ctx.super.deinit(user);
 }
 
+static void zlib_zstd_dicts_init(struct zlib_user *zuser,
+				 struct mail_user *user)
+{
+	const char *const *paths, *path, *error;
+	unsigned int dict_id;
+
+	/* Dictionaries that are only used for reading mails saved with
+	   older dictionaries. */
+	path = mail_user_plugin_getenv(user, "zlib_zstd_dicts");
+	if (path != NULL && path[0] != '\0') {
+		paths = t_strsplit_spaces(path, " ");
+		for (; *paths != NULL; paths++) {
+			if (zstd_dict_register_file(*paths, &dict_id,
+						    &error) < 0)
+				i_error("zlib_zstd_dicts: %s", error);
+		}
+	}
+
+	path = zuser->save_handler == NULL ? NULL :
+		mail_user_plugin_getenv(user, "zlib_save_zstd_dict");
+	if (path == NULL || path[0] == '\0')
+		return;
+	if (strcmp(zuser->save_handler->name, "zstd") != 0) {
+		i_error("zlib_save_zstd_dict: zlib_save=%s isn't zstd",
+			zuser->save_handler->name);
+	} else if (zstd_dict_register_file(path, &dict_id, &error) < 0) {
+		i_error("zlib_save_zstd_dict: %s", error);
+	} else {
+		zuser->save_zstd_dict_id = dict_id;
+	}
+}
+
+static void zlib_zstd_workers_init(struct zlib_user *zuser,
+				   struct mail_user *user)
+{
+	const char *value, *error;
+
+	value = zuser->save_handler == NULL ? NULL :
+		mail_user_plugin_getenv(user, "zlib_save_zstd_workers");
+	if (value == NULL || value[0] == '\0')
+		return;
+	if (strcmp(zuser->save_handler->name, "zstd") != 0) {
+		i_error("zlib_save_zstd_workers: zlib_save=%s isn't zstd",
+			zuser->save_handler->name);
+		return;
+	}
+	if (str_to_uint(value, &zuser->save_zstd_workers) < 0) {
+		i_error("zlib_save_zstd_workers: Invalid number: %s", value);
+		zuser->save_zstd_workers = 0;
+		return;
+	}
+
+	zuser->save_zstd_workers_min_size =
+		ZLIB_SAVE_ZSTD_WORKERS_MIN_SIZE_DEFAULT;
+	value = mail_user_plugin_getenv(user, "zlib_save_zstd_workers_min_size");
+	if (value != NULL && value[0] != '\0' &&
+	    settings_get_size(value, &zuser->save_zstd_workers_min_size,
+			      &error) < 0) {
+		i_error("zlib_save_zstd_workers_min_size: %s", error);
+		zuser->save_zstd_workers_min_size =
+			ZLIB_SAVE_ZSTD_WORKERS_MIN_SIZE_DEFAULT;
+	}
+}
+
 static void zlib_mail_user_created(struct mail_user *user)
 {
 	struct mail_user_vfuncs *v = user->vlast;
@@ -368,6 +466,8 @@ static void zlib_mail_user_created(struct mail_user *user)
 	} else if (zuser->save_handler != NULL) {
 		zuser->save_level = zuser->save_handler->get_default_level();
 	}
+	zlib_zstd_dicts_init(zuser, user);
+	zlib_zstd_workers_init(zuser, user);
 	MODULE_CONTEXT_SET(user, zlib_user_module, zuser);
 }
 
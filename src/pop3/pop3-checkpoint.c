@@ -0,0 +1,167 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "pop3-common.h"
+#include "array.h"
+#include "str.h"
+#include "strescape.h"
+#include "istream.h"
+#include "ostream.h"
+#include "safe-mkstemp.h"
+#include "mail-storage-private.h"
+#include "pop3-checkpoint.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define POP3_CHECKPOINT_FNAME "dovecot-pop3-checkpoint"
+#define POP3_CHECKPOINT_VERSION 1
+
+static const char *pop3_checkpoint_get_path(struct client *client)
+{
+	const char *dir;
+
+	if (mailbox_get_path_to(client->mailbox, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&dir) <= 0)
+		return NULL;
+	return t_strconcat(dir, "/"POP3_CHECKPOINT_FNAME, NULL);
+}
+
+static void
+pop3_checkpoint_append_header(struct client *client,
+			      const struct mailbox_status *status,
+			      string_t *str)
+{
+	/* the settings that affect the message list are included, so changing
+	   them invalidates the checkpoint */
+	str_printfa(str, "%u\t%u\t%u\t%"PRIu64"\t%u\t%d\t",
+		    POP3_CHECKPOINT_VERSION, status->uidvalidity,
+		    status->uidnext, status->highest_modseq, status->messages,
+		    client->set->pop3_fast_size_lookups ? 1 : 0);
+	str_append_tabescaped(str, client->set->pop3_deleted_flag);
+}
+
+static bool
+pop3_checkpoint_parse_mail(const char *line, uint32_t messages_count,
+			   struct pop3_checkpoint_mail *mail_r)
+{
+	const char *const *args = t_strsplit_tabescaped(line);
+
+	/* <seq> <seen> <size> */
+	i_zero(mail_r);
+	if (str_array_length(args) < 3 ||
+	    str_to_uint32(args[0], &mail_r->seq) < 0 ||
+	    mail_r->seq == 0 || mail_r->seq > messages_count ||
+	    str_to_uoff(args[2], &mail_r->size) < 0)
+		return FALSE;
+	mail_r->seen = strcmp(args[1], "1") == 0;
+	return TRUE;
+}
+
+int pop3_checkpoint_read(struct client *client,
+			 const struct mailbox_status *status,
+			 ARRAY_TYPE(pop3_checkpoint_mail) *mails)
+{
+	struct pop3_checkpoint_mail mail;
+	struct istream *input;
+	const char *path, *line;
+	string_t *hdr;
+	int fd, ret = 1;
+
+	/* without permanent modseqs flag changes can't be noticed */
+	if (status->no_modseq_tracking || status->nonpermanent_modseqs)
+		return 0;
+	if ((path = pop3_checkpoint_get_path(client)) == NULL)
+		return 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			i_error("open(%s) failed: %m", path);
+		return 0;
+	}
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+
+	hdr = t_str_new(128);
+	pop3_checkpoint_append_header(client, status, hdr);
+	line = i_stream_read_next_line(input);
+	if (line == NULL || strcmp(line, str_c(hdr)) != 0) {
+		/* mailbox has changed */
+		ret = 0;
+	}
+	while (ret > 0 && (line = i_stream_read_next_line(input)) != NULL) {
+		if (array_count(mails) == status->messages ||
+		    !pop3_checkpoint_parse_mail(line, status->messages,
+						&mail)) {
+			i_error("%s: Corrupted checkpoint line: %s",
+				path, line);
+			ret = 0;
+			break;
+		}
+		array_push_back(mails, &mail);
+	}
+	if (input->stream_errno != 0) {
+		i_error("read(%s) failed: %s", path, i_stream_get_error(input));
+		ret = 0;
+	}
+	i_stream_destroy(&input);
+	if (ret == 0)
+		array_clear(mails);
+	return ret;
+}
+
+void pop3_checkpoint_write(struct client *client,
+			   const struct mailbox_status *status,
+			   const ARRAY_TYPE(pop3_checkpoint_mail) *mails)
+{
+	const struct mailbox_permissions *perm =
+		mailbox_get_permissions(client->mailbox);
+	const struct pop3_checkpoint_mail *mail;
+	struct ostream *output;
+	const char *path;
+	string_t *temp_path, *str;
+	int fd;
+
+	if (status->no_modseq_tracking || status->nonpermanent_modseqs)
+		return;
+	if ((path = pop3_checkpoint_get_path(client)) == NULL)
+		return;
+
+	temp_path = t_str_new(256);
+	str_append(temp_path, path);
+	fd = safe_mkstemp_hostpid_group(temp_path, perm->file_create_mode,
+					perm->file_create_gid,
+					perm->file_create_gid_origin);
+	if (fd == -1) {
+		i_error("safe_mkstemp(%s) failed: %m", str_c(temp_path));
+		return;
+	}
+
+	output = o_stream_create_fd_file(fd, 0, FALSE);
+	o_stream_cork(output);
+	str = t_str_new(128);
+	pop3_checkpoint_append_header(client, status, str);
+	str_append_c(str, '\n');
+	o_stream_nsend(output, str_data(str), str_len(str));
+	array_foreach(mails, mail) {
+		str_truncate(str, 0);
+		str_printfa(str, "%u\t%d\t%"PRIuUOFF_T"\n",
+			    mail->seq, mail->seen ? 1 : 0, mail->size);
+		o_stream_nsend(output, str_data(str), str_len(str));
+	}
+	if (o_stream_finish(output) < 0) {
+		i_error("write(%s) failed: %s", str_c(temp_path),
+			o_stream_get_error(output));
+		o_stream_destroy(&output);
+		i_close_fd(&fd);
+		i_unlink(str_c(temp_path));
+		return;
+	}
+	o_stream_destroy(&output);
+	i_close_fd(&fd);
+
+	if (rename(str_c(temp_path), path) < 0) {
+		i_error("rename(%s, %s) failed: %m", str_c(temp_path), path);
+		i_unlink(str_c(temp_path));
+	}
+}
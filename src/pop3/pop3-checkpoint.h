@@ -0,0 +1,26 @@
+#ifndef POP3_CHECKPOINT_H
+#define POP3_CHECKPOINT_H
+
+struct mailbox_status;
+
+/* POP3 message list state saved at the end of the previous login. It's
+   valid as long as the mailbox hasn't changed since, which is verified
+   with UIDVALIDITY, UIDNEXT, HIGHESTMODSEQ and the message count. */
+struct pop3_checkpoint_mail {
+	uint32_t seq;
+	bool seen;
+	uoff_t size;
+};
+ARRAY_DEFINE_TYPE(pop3_checkpoint_mail, struct pop3_checkpoint_mail);
+
+/* Read the checkpoint in POP3 message order. Returns 1 if it was read,
+   0 if it doesn't exist or is outdated. */
+int pop3_checkpoint_read(struct client *client,
+			 const struct mailbox_status *status,
+			 ARRAY_TYPE(pop3_checkpoint_mail) *mails);
+/* Write a new checkpoint for the mailbox state described by status. */
+void pop3_checkpoint_write(struct client *client,
+			   const struct mailbox_status *status,
+			   const ARRAY_TYPE(pop3_checkpoint_mail) *mails);
+
+#endif
@@ -19,6 +19,7 @@
 #include "mail-storage-service.h"
 #include "mail-autoexpunge.h"
 #include "pop3-commands.h"
+#include "pop3-checkpoint.h"
 #include "mail-search-build.h"
 #include "mail-namespace.h"
 
@@ -122,12 +123,12 @@ pop3_mail_get_size(struct client *client, struct mail *mail, uoff_t *size_r)
 
 static void
 msgnum_to_seq_map_add(ARRAY_TYPE(uint32_t) *msgnum_to_seq_map,
-		      struct client *client, struct mail *mail,
+		      struct client *client, uint32_t mail_seq,
 		      unsigned int msgnum)
 {
 	uint32_t seq;
 
-	if (mail->seq == msgnum+1)
+	if (mail_seq == msgnum+1)
 		return;
 
 	if (!array_is_created(msgnum_to_seq_map))
@@ -138,38 +139,46 @@ msgnum_to_seq_map_add(ARRAY_TYPE(uint32_t) *msgnum_to_seq_map,
 	seq = array_count(msgnum_to_seq_map) + 1;
 	for (; seq <= msgnum; seq++)
 		array_push_back(msgnum_to_seq_map, &seq);
-	array_push_back(msgnum_to_seq_map, &mail->seq);
+	array_push_back(msgnum_to_seq_map, &mail_seq);
 }
 
-static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
+static void
+read_mailbox_add(struct client *client, ARRAY_TYPE(uint32_t) *msgnum_to_seq_map,
+		 uoff_t *message_sizes, unsigned int msgnum,
+		 const struct pop3_checkpoint_mail *mail)
+{
+	if (array_is_created(&client->all_seqs))
+		seq_range_array_add(&client->all_seqs, mail->seq);
+	msgnum_to_seq_map_add(msgnum_to_seq_map, client, mail->seq, msgnum);
+
+	if (mail->seen)
+		client->last_seen_pop3_msn = msgnum + 1;
+	client->total_size += mail->size;
+	if (client->highest_seq < mail->seq)
+		client->highest_seq = mail->seq;
+
+	message_sizes[msgnum] = mail->size;
+}
+
+static int
+read_mailbox_search(struct client *client, struct mailbox_transaction_context *t,
+		    ARRAY_TYPE(pop3_checkpoint_mail) *mails,
+		    uint32_t *failed_uid_r)
 {
-        struct mailbox_status status;
-        struct mailbox_transaction_context *t;
 	struct mail_search_args *search_args;
 	struct mail_search_arg *sarg;
 	struct mail_search_context *ctx;
+	struct pop3_checkpoint_mail *cmail;
 	struct mail *mail;
 	uoff_t size;
-	ARRAY(uoff_t) message_sizes;
-	ARRAY_TYPE(uint32_t) msgnum_to_seq_map = ARRAY_INIT;
-	unsigned int msgnum;
 	int ret = 1;
 
-	*failed_uid_r = 0;
-
-	mailbox_get_open_status(client->mailbox, STATUS_UIDVALIDITY, &status);
-	client->uid_validity = status.uidvalidity;
-	client->messages_count = status.messages;
-
-	t = mailbox_transaction_begin(client->mailbox, 0, __func__);
-
 	search_args = mail_search_build_init();
 	if (client->deleted_kw != NULL) {
 		sarg = mail_search_build_add(search_args, SEARCH_KEYWORDS);
 		sarg->match_not = TRUE;
 		sarg->value.str = p_strdup(search_args->pool,
 					   client->set->pop3_deleted_flag);
-		i_array_init(&client->all_seqs, 32);
 	} else {
 		mail_search_build_add_all(search_args);
 	}
@@ -180,43 +189,74 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 				  MAIL_FETCH_VIRTUAL_SIZE, NULL);
 	mail_search_args_unref(&search_args);
 
-	client->last_seen_pop3_msn = 0;
-	client->total_size = 0;
-	i_array_init(&message_sizes, client->messages_count);
-
-	msgnum = 0;
 	while (mailbox_search_next(ctx, &mail)) {
 		if (pop3_mail_get_size(client, mail, &size) < 0) {
 			ret = mail->expunged ? 0 : -1;
 			*failed_uid_r = mail->uid;
 			break;
 		}
-		if (array_is_created(&client->all_seqs))
-			seq_range_array_add(&client->all_seqs, mail->seq);
-		msgnum_to_seq_map_add(&msgnum_to_seq_map, client, mail, msgnum);
-
-		if ((mail_get_flags(mail) & MAIL_SEEN) != 0)
-			client->last_seen_pop3_msn = msgnum + 1;
-		client->total_size += size;
-		if (client->highest_seq < mail->seq)
-			client->highest_seq = mail->seq;
-
-		array_push_back(&message_sizes, &size);
-		msgnum++;
+		cmail = array_append_space(mails);
+		cmail->seq = mail->seq;
+		cmail->seen = (mail_get_flags(mail) & MAIL_SEEN) != 0;
+		cmail->size = size;
 	}
 
 	if (mailbox_search_deinit(&ctx) < 0)
 		ret = -1;
+	return ret;
+}
+
+static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
+{
+        struct mailbox_status status;
+        struct mailbox_transaction_context *t;
+	ARRAY_TYPE(pop3_checkpoint_mail) mails;
+	const struct pop3_checkpoint_mail *mail;
+	ARRAY_TYPE(uint32_t) msgnum_to_seq_map = ARRAY_INIT;
+	unsigned int msgnum;
+	bool checkpoint_used = FALSE;
+	int ret = 1;
+
+	*failed_uid_r = 0;
+
+	mailbox_get_open_status(client->mailbox, STATUS_UIDVALIDITY |
+				STATUS_UIDNEXT | STATUS_HIGHESTMODSEQ, &status);
+	client->uid_validity = status.uidvalidity;
+	client->messages_count = status.messages;
+
+	t = mailbox_transaction_begin(client->mailbox, 0, __func__);
+
+	i_array_init(&mails, client->messages_count);
+	if (client->set->pop3_checkpoint &&
+	    pop3_checkpoint_read(client, &status, &mails) > 0)
+		checkpoint_used = TRUE;
+	else
+		ret = read_mailbox_search(client, t, &mails, failed_uid_r);
 
 	if (ret <= 0) {
 		/* commit the transaction instead of rolling back to make sure
 		   we don't lose data (virtual sizes) added to cache file */
 		(void)mailbox_transaction_commit(&t);
-		array_free(&message_sizes);
-		if (array_is_created(&msgnum_to_seq_map))
-			array_free(&msgnum_to_seq_map);
+		array_free(&mails);
 		return ret;
 	}
+
+	client->last_seen_pop3_msn = 0;
+	client->total_size = 0;
+	client->message_sizes = i_new(uoff_t, array_count(&mails));
+	if (client->deleted_kw != NULL)
+		i_array_init(&client->all_seqs, 32);
+
+	msgnum = 0;
+	array_foreach(&mails, mail) {
+		read_mailbox_add(client, &msgnum_to_seq_map,
+				 client->message_sizes, msgnum, mail);
+		msgnum++;
+	}
+	if (client->set->pop3_checkpoint && !checkpoint_used)
+		pop3_checkpoint_write(client, &status, &mails);
+	array_free(&mails);
+
 	i_assert(msgnum <= client->messages_count);
 	client->messages_count = msgnum;
 
@@ -226,8 +266,6 @@ static int read_mailbox(struct client *client, uint32_t *failed_uid_r)
 	}
 
 	client->trans = t;
-	client->message_sizes =
-		array_free_without_data(&message_sizes);
 	if (array_is_created(&msgnum_to_seq_map)) {
 		client->msgnum_to_seq_map_count =
 			array_count(&msgnum_to_seq_map);
@@ -463,6 +501,16 @@ int client_init_mailbox(struct client *client, const char **error_r)
 		client_send_storage_error(client);
 		return -1;
 	}
+	if (client->set->pop3_checkpoint) {
+		/* flag changes are noticed via HIGHESTMODSEQ */
+		if (mailbox_enable(client->mailbox,
+				   MAILBOX_FEATURE_CONDSTORE) < 0) {
+			*error_r = t_strdup_printf("Couldn't open INBOX: %s",
+				mailbox_get_last_internal_error(client->mailbox, NULL));
+			client_send_storage_error(client);
+			return -1;
+		}
+	}
 
 	if (init_pop3_deleted_flag(client, &errmsg) < 0 ||
 	    init_mailbox(client, &errmsg) < 0) {
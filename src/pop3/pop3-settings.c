@@ -70,6 +70,7 @@ static const struct setting_define pop3_setting_defines[] = {
 	DEF(BOOL, pop3_save_uidl),
 	DEF(BOOL, pop3_lock_session),
 	DEF(BOOL, pop3_fast_size_lookups),
+	DEF(BOOL, pop3_checkpoint),
 	DEF(STR, pop3_client_workarounds),
 	DEF(STR, pop3_logout_format),
 	DEF(ENUM, pop3_uidl_duplicates),
@@ -89,6 +90,7 @@ static const struct pop3_settings pop3_default_settings = {
 	.pop3_save_uidl = FALSE,
 	.pop3_lock_session = FALSE,
 	.pop3_fast_size_lookups = FALSE,
+	.pop3_checkpoint = FALSE,
 	.pop3_client_workarounds = "",
 	.pop3_logout_format = "top=%t/%p, retr=%r/%b, del=%d/%m, size=%s",
 	.pop3_uidl_duplicates = "allow:rename",
@@ -25,6 +25,7 @@ struct pop3_settings {
 	bool pop3_save_uidl;
 	bool pop3_lock_session;
 	bool pop3_fast_size_lookups;
+	bool pop3_checkpoint;
 	const char *pop3_client_workarounds;
 	const char *pop3_logout_format;
 	const char *pop3_uidl_duplicates;
@@ -15,6 +15,7 @@
 #define REPLICATOR_RECONNECT_MSECS 5000
 #define REPLICATOR_MEMBUF_MAX_SIZE 1024*1024
 #define REPLICATOR_HANDSHAKE "VERSION\treplicator-notify\t1\t0\n"
+#define REPLICATOR_NOTIFY_FLUSH_MSECS 100
 
 struct replicator_connection {
 	char *path;
@@ -29,6 +30,10 @@ struct replicator_connection {
 	struct timeout *to;
 
 	buffer_t *queue[REPLICATION_PRIORITY_SYNC + 1];
+	/* username => highest requested priority. Notifications for the
+	   same user are merged until they're flushed to the queue. */
+	HASH_TABLE(char *, void *) notify_users;
+	struct timeout *to_notify;
 
 	HASH_TABLE(void *, void *) requests;
 	unsigned int request_id_counter;
@@ -202,6 +207,19 @@ static void replicator_connection_disconnect(struct replicator_connection *conn)
 	conn->fd = -1;
 }
 
+static void replicator_notify_users_clear(struct replicator_connection *conn)
+{
+	struct hash_iterate_context *iter;
+	char *username;
+	void *value;
+
+	iter = hash_table_iterate_init(conn->notify_users);
+	while (hash_table_iterate(iter, conn->notify_users, &username, &value))
+		i_free(username);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(conn->notify_users, TRUE);
+}
+
 static struct replicator_connection *replicator_connection_create(void)
 {
 	struct replicator_connection *conn;
@@ -210,6 +228,8 @@ static struct replicator_connection *replicator_connection_create(void)
 	conn = i_new(struct replicator_connection, 1);
 	conn->fd = -1;
 	hash_table_create_direct(&conn->requests, default_pool, 0);
+	hash_table_create(&conn->notify_users, default_pool, 0,
+			  str_hash, strcmp);
 	for (i = REPLICATION_PRIORITY_LOW; i <= REPLICATION_PRIORITY_SYNC; i++)
 		conn->queue[i] = buffer_create_dynamic(default_pool, 1024);
 	return conn;
@@ -255,6 +275,9 @@ void replicator_connection_destroy(struct replicator_connection **_conn)
 		buffer_free(&conn->queue[i]);
 
 	timeout_remove(&conn->to);
+	timeout_remove(&conn->to_notify);
+	replicator_notify_users_clear(conn);
+	hash_table_destroy(&conn->notify_users);
 	hash_table_destroy(&conn->requests);
 	i_free(conn);
 }
@@ -280,39 +303,76 @@ replicator_send(struct replicator_connection *conn,
 	}
 }
 
-void replicator_connection_notify(struct replicator_connection *conn,
-				  const char *username,
-				  enum replication_priority priority)
+static void replicator_notify_flush(struct replicator_connection *conn)
 {
-	const char *priority_str = "";
+	struct hash_iterate_context *iter;
+	char *username;
+	void *value;
+	enum replication_priority priority;
 
+	timeout_remove(&conn->to_notify);
 	replicator_connection_connect(conn);
 
-	switch (priority) {
-	case REPLICATION_PRIORITY_NONE:
-	case REPLICATION_PRIORITY_SYNC:
-		i_unreached();
-	case REPLICATION_PRIORITY_LOW:
-		priority_str = "low";
-		break;
-	case REPLICATION_PRIORITY_HIGH:
-		priority_str = "high";
-		break;
+	if (conn->output != NULL)
+		o_stream_cork(conn->output);
+	iter = hash_table_iterate_init(conn->notify_users);
+	while (hash_table_iterate(iter, conn->notify_users, &username, &value)) {
+		priority = POINTER_CAST_TO(value, unsigned int);
+		T_BEGIN {
+			replicator_send(conn, priority, t_strdup_printf(
+				"U\t%s\t%s\n", str_tabescape(username),
+				replicator_priority_to_str(priority)));
+		} T_END;
 	}
+	hash_table_iterate_deinit(&iter);
+	if (conn->output != NULL)
+		o_stream_uncork(conn->output);
+	replicator_notify_users_clear(conn);
+}
 
-	T_BEGIN {
-		replicator_send(conn, priority, t_strdup_printf(
-			"U\t%s\t%s\n", str_tabescape(username), priority_str));
-	} T_END;
+void replicator_connection_notify(struct replicator_connection *conn,
+				  const char *username,
+				  enum replication_priority priority)
+{
+	char *orig_username;
+	void *value;
+
+	i_assert(priority == REPLICATION_PRIORITY_LOW ||
+		 priority == REPLICATION_PRIORITY_HIGH);
+
+	/* Busy users can cause a lot of notifications from many processes.
+	   Merge them for a moment and send only the highest priority for
+	   each user. */
+	if (!hash_table_lookup_full(conn->notify_users, username,
+				    &orig_username, &value)) {
+		hash_table_insert(conn->notify_users, i_strdup(username),
+				  POINTER_CAST(priority));
+	} else if (POINTER_CAST_TO(value, unsigned int) < priority) {
+		hash_table_update(conn->notify_users, orig_username,
+				  POINTER_CAST(priority));
+	}
+	if (conn->to_notify == NULL) {
+		conn->to_notify = timeout_add_short(REPLICATOR_NOTIFY_FLUSH_MSECS,
+						    replicator_notify_flush, conn);
+	}
 }
 
 void replicator_connection_notify_sync(struct replicator_connection *conn,
 				       const char *username, void *context)
 {
+	char *orig_username;
+	void *value;
 	unsigned int id;
 
 	replicator_connection_connect(conn);
 
+	/* the sync replaces any pending notification for the user */
+	if (hash_table_lookup_full(conn->notify_users, username,
+				   &orig_username, &value)) {
+		hash_table_remove(conn->notify_users, username);
+		i_free(orig_username);
+	}
+
 	id = ++conn->request_id_counter;
 	if (id == 0) id++;
 	hash_table_insert(conn->requests, POINTER_CAST(id), context);
@@ -10,9 +10,13 @@
 #include "hash.h"
 #include "replicator-queue.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+/* Don't compact the state log until it has at least this many records */
+#define REPLICATOR_QUEUE_LOG_MIN_COMPACT_RECORDS 1000
+
 struct replicator_sync_lookup {
 	struct replicator_user *user;
 
@@ -28,6 +32,12 @@ struct replicator_queue {
 	HASH_TABLE(char *, struct replicator_user *) user_hash;
 
 	ARRAY(struct replicator_sync_lookup) sync_lookups;
+	/* users changed since the last time the state was written */
+	ARRAY(struct replicator_user *) changed_users;
+	/* number of records in the state log since the last full export */
+	unsigned int log_records;
+	/* a user was removed, so the state log can't be just appended to */
+	bool compact_needed;
 
 	unsigned int full_sync_interval;
 	unsigned int failure_resync_interval;
@@ -91,9 +101,31 @@ replicator_queue_init(unsigned int full_sync_interval,
 	hash_table_create(&queue->user_hash, default_pool, 1024,
 			  str_hash, strcmp);
 	i_array_init(&queue->sync_lookups, 32);
+	i_array_init(&queue->changed_users, 128);
 	return queue;
 }
 
+static void replicator_queue_set_changed(struct replicator_queue *queue,
+					 struct replicator_user *user)
+{
+	if (user->changed)
+		return;
+	user->changed = TRUE;
+	replicator_user_ref(user);
+	array_push_back(&queue->changed_users, &user);
+}
+
+static void replicator_queue_clear_changed(struct replicator_queue *queue)
+{
+	struct replicator_user *user;
+
+	array_foreach_elem(&queue->changed_users, user) {
+		user->changed = FALSE;
+		replicator_user_unref(&user);
+	}
+	array_clear(&queue->changed_users);
+}
+
 void replicator_queue_deinit(struct replicator_queue **_queue)
 {
 	struct replicator_queue *queue = *_queue;
@@ -110,10 +142,12 @@ void replicator_queue_deinit(struct replicator_queue **_queue)
 		replicator_queue_remove(queue, &user);
 	}
 
+	replicator_queue_clear_changed(queue);
 	priorityq_deinit(&queue->user_queue);
 	hash_table_destroy(&queue->user_hash);
 	i_assert(array_count(&queue->sync_lookups) == 0);
 	array_free(&queue->sync_lookups);
+	array_free(&queue->changed_users);
 	i_free(queue);
 }
 
@@ -174,6 +208,7 @@ replicator_queue_add_int(struct replicator_queue *queue, const char *username,
 	}
 	user->priority = priority;
 	user->last_update = ioloop_time;
+	replicator_queue_set_changed(queue, user);
 
 	if (!user->popped)
 		priorityq_add(queue->user_queue, &user->item);
@@ -223,6 +258,8 @@ void replicator_queue_remove(struct replicator_queue *queue,
 		priorityq_remove(queue->user_queue, &user->item);
 	hash_table_remove(queue->user_hash, user->username);
 	replicator_user_unref(&user);
+	/* the removal can't be written to the state log */
+	queue->compact_needed = TRUE;
 
 	if (queue->change_callback != NULL)
 		queue->change_callback(queue->change_context);
@@ -310,6 +347,7 @@ void replicator_queue_push(struct replicator_queue *queue,
 
 	priorityq_add(queue->user_queue, &user->item);
 	user->popped = FALSE;
+	replicator_queue_set_changed(queue, user);
 
 	T_BEGIN {
 		replicator_queue_handle_sync_lookups(queue, user);
@@ -317,7 +355,8 @@ void replicator_queue_push(struct replicator_queue *queue,
 }
 
 static int
-replicator_queue_import_line(struct replicator_queue *queue, const char *line)
+replicator_queue_import_line(struct replicator_queue *queue, const char *line,
+			     bool log_record)
 {
 	const char *const *args, *username, *state;
 	unsigned int priority;
@@ -350,7 +389,7 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 
 	user = hash_table_lookup(queue->user_hash, username);
-	if (user != NULL) {
+	if (user != NULL && !log_record) {
 		if (user->last_update > tmp_user.last_update) {
 			/* we already have a newer state */
 			return 0;
@@ -364,6 +403,14 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 	user = replicator_queue_add(queue, username,
 				    tmp_user.priority);
+	/* the fields affect the user's position in the queue */
+	if (!user->popped)
+		priorityq_remove(queue->user_queue, &user->item);
+	if (log_record) {
+		/* state log records are in the order they were written, so
+		   the latest one is always the correct state */
+		user->priority = tmp_user.priority;
+	}
 	user->last_update = tmp_user.last_update;
 	user->last_fast_sync = tmp_user.last_fast_sync;
 	user->last_full_sync = tmp_user.last_full_sync;
@@ -371,15 +418,20 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	user->last_sync_failed = tmp_user.last_sync_failed;
 	i_free(user->state);
 	user->state = i_strdup(state);
+	if (!user->popped)
+		priorityq_add(queue->user_queue, &user->item);
 	return 0;
 }
 
-int replicator_queue_import(struct replicator_queue *queue, const char *path)
+static int
+replicator_queue_import_file(struct replicator_queue *queue, const char *path,
+			     bool log, unsigned int *records_r)
 {
 	struct istream *input;
 	const char *line;
 	int fd, ret = 0;
 
+	*records_r = 0;
 	fd = open(path, O_RDONLY);
 	if (fd == -1) {
 		if (errno == ENOENT)
@@ -391,13 +443,14 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		T_BEGIN {
-			ret = replicator_queue_import_line(queue, line);
+			ret = replicator_queue_import_line(queue, line, log);
 		} T_END;
 		if (ret < 0) {
 			i_error("Corrupted replicator record in %s: %s",
 				path, line);
 			break;
 		}
+		*records_r += 1;
 	}
 	if (input->stream_errno != 0) {
 		i_error("read(%s) failed: %s", path, i_stream_get_error(input));
@@ -407,6 +460,22 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	return ret;
 }
 
+int replicator_queue_import(struct replicator_queue *queue, const char *path)
+{
+	unsigned int records;
+	int ret;
+
+	ret = replicator_queue_import_file(queue, path, FALSE, &records);
+	if (ret == 0) {
+		ret = replicator_queue_import_file(queue,
+			t_strconcat(path, ".log", NULL), TRUE, &records);
+		queue->log_records += records;
+	}
+	/* everything imported is already written */
+	replicator_queue_clear_changed(queue);
+	return ret;
+}
+
 static void
 replicator_queue_export_user(struct replicator_user *user, string_t *str)
 {
@@ -426,12 +495,16 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	struct replicator_queue_iter *iter;
 	struct replicator_user *user;
 	struct ostream *output;
+	const char *temp_path, *log_path;
 	string_t *str;
 	int fd, ret = 0;
 
-	fd = creat(path, 0600);
+	/* write to a temporary file first, so a crash in the middle doesn't
+	   lose the existing state */
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	fd = creat(temp_path, 0600);
 	if (fd == -1) {
-		i_error("creat(%s) failed: %m", path);
+		i_error("creat(%s) failed: %m", temp_path);
 		return -1;
 	}
 	output = o_stream_create_fd_file_autoclose(&fd, 0);
@@ -447,8 +520,82 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	}
 	replicator_queue_iter_deinit(&iter);
 	if (o_stream_finish(output) < 0) {
-		i_error("write(%s) failed: %s", path, o_stream_get_error(output));
+		i_error("write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (ret < 0)
+		i_unlink(temp_path);
+	else if (rename(temp_path, path) < 0) {
+		i_error("rename(%s, %s) failed: %m", temp_path, path);
+		i_unlink(temp_path);
+		ret = -1;
+	} else {
+		/* the state log is now fully contained in the exported
+		   file */
+		log_path = t_strconcat(path, ".log", NULL);
+		i_unlink_if_exists(log_path);
+		queue->log_records = 0;
+		queue->compact_needed = FALSE;
+		replicator_queue_clear_changed(queue);
+	}
+	return ret;
+}
+
+static bool replicator_queue_want_compact(struct replicator_queue *queue)
+{
+	unsigned int records;
+
+	if (queue->compact_needed)
+		return TRUE;
+	/* compact once the log has grown to be as large as the exported
+	   state would be */
+	records = queue->log_records + array_count(&queue->changed_users);
+	return records >= REPLICATOR_QUEUE_LOG_MIN_COMPACT_RECORDS &&
+		records >= hash_table_count(queue->user_hash);
+}
+
+int replicator_queue_flush_changes(struct replicator_queue *queue,
+				   const char *path)
+{
+	struct replicator_user *user;
+	struct ostream *output;
+	const char *log_path;
+	string_t *str;
+	int fd, ret = 0;
+
+	if (replicator_queue_want_compact(queue))
+		return replicator_queue_export(queue, path);
+	if (array_count(&queue->changed_users) == 0)
+		return 0;
+
+	log_path = t_strconcat(path, ".log", NULL);
+	fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if (fd == -1) {
+		i_error("open(%s) failed: %m", log_path);
+		return -1;
+	}
+	output = o_stream_create_fd_autoclose(&fd, 0);
+	o_stream_cork(output);
+
+	str = t_str_new(128);
+	array_foreach_elem(&queue->changed_users, user) {
+		str_truncate(str, 0);
+		replicator_queue_export_user(user, str);
+		if (o_stream_send(output, str_data(str), str_len(str)) < 0)
+			break;
+	}
+	if (o_stream_finish(output) < 0) {
+		i_error("write(%s) failed: %s", log_path,
+			o_stream_get_error(output));
+		/* the log may now have a partially written record */
+		queue->compact_needed = TRUE;
 		ret = -1;
+	} else {
+		queue->log_records += array_count(&queue->changed_users);
+		replicator_queue_clear_changed(queue);
 	}
 	o_stream_destroy(&output);
 	return ret;
@@ -23,6 +23,8 @@ struct replicator_user {
 	bool last_sync_failed:1;
 	/* Force a full sync on the next replication */
 	bool force_full_sync:1;
+	/* User has changes that haven't been written to the state log */
+	bool changed:1;
 };
 
 typedef void replicator_sync_callback_t(bool success, void *context);
@@ -69,8 +71,15 @@ replicator_queue_pop(struct replicator_queue *queue,
 void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user);
 
+/* Import users from the state file and the <path>.log state log. */
 int replicator_queue_import(struct replicator_queue *queue, const char *path);
+/* Write the full state to the state file and remove the state log. */
 int replicator_queue_export(struct replicator_queue *queue, const char *path);
+/* Append the users changed since the last write to the <path>.log state
+   log. The full state is exported instead when the log has grown large or
+   users have been removed. */
+int replicator_queue_flush_changes(struct replicator_queue *queue,
+				   const char *path);
 
 /* Returns TRUE if user replication can be started now, FALSE if not. When
    returning FALSE, next_secs_r is set to user's next replication time. */
@@ -12,7 +12,9 @@
 #include "replicator-queue.h"
 #include "replicator-settings.h"
 
-#define REPLICATOR_DB_DUMP_INTERVAL_MSECS (1000*60*15)
+/* write the changed users to the state log this often. the full state is
+   written only when the log grows large. */
+#define REPLICATOR_DB_FLUSH_INTERVAL_MSECS (1000*60)
 /* if syncing fails, try again in 5 minutes */
 #define REPLICATOR_FAILURE_RESYNC_INTERVAL_SECS (60*5)
 #define REPLICATOR_DB_FNAME "replicator.db"
@@ -21,7 +23,7 @@ static struct replicator_queue *queue;
 static struct replicator_brain *brain;
 static const struct master_service_settings *service_set;
 static const struct replicator_settings *set;
-static struct timeout *to_dump;
+static struct timeout *to_flush;
 
 static void client_connected(struct master_service_connection *conn)
 {
@@ -44,12 +46,12 @@ static void replication_add_users(struct replicator_queue *queue)
 }
 
 static void ATTR_NULL(1)
-replicator_dump_timeout(void *context ATTR_UNUSED)
+replicator_flush_timeout(void *context ATTR_UNUSED)
 {
 	const char *path;
 
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
-	(void)replicator_queue_export(queue, path);
+	(void)replicator_queue_flush_changes(queue, path);
 }
 
 static void main_init(void)
@@ -63,8 +65,8 @@ static void main_init(void)
 	queue = replicator_queue_init(set->replication_full_sync_interval,
 				      REPLICATOR_FAILURE_RESYNC_INTERVAL_SECS);
 	replication_add_users(queue);
-	to_dump = timeout_add(REPLICATOR_DB_DUMP_INTERVAL_MSECS,
-			      replicator_dump_timeout, NULL);
+	to_flush = timeout_add(REPLICATOR_DB_FLUSH_INTERVAL_MSECS,
+			       replicator_flush_timeout, NULL);
 	brain = replicator_brain_init(queue, set);
 	doveadm_connections_init();
 }
@@ -76,9 +78,9 @@ static void main_deinit(void)
 	doveadm_connections_deinit();
 	notify_connections_destroy_all();
 	replicator_brain_deinit(&brain);
-	timeout_remove(&to_dump);
+	timeout_remove(&to_flush);
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
-	(void)replicator_queue_export(queue, path);
+	(void)replicator_queue_flush_changes(queue, path);
 	replicator_queue_deinit(&queue);
 }
 
@@ -170,6 +170,8 @@ reader_client_input_metrics_add(struct reader_client *client,
 		.filter = args[4],
 		.exporter = args[5],
 		.exporter_include = args[6],
+		.exporter_sampling = "",
+		.exporter_sampling_key = "",
 	};
 	o_stream_cork(client->conn.output);
 	if (stats_metrics_add_dynamic(stats_metrics, &set, &error)) {
@@ -1,29 +1,65 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "ioloop.h"
 #include "str.h"
+#include "ostream.h"
+#include "compression.h"
 #include "event-exporter.h"
 #include "http-client.h"
 #include "iostream-ssl.h"
 #include "master-service.h"
 #include "master-service-ssl-settings.h"
 
+/* Number of parallel connections to each exporter's HTTP server, so a slow
+   request doesn't hold back the following ones. */
+#define EXPORTER_HTTP_MAX_PARALLEL_CONNECTIONS 4
+
+struct http_post_exporter {
+	const struct exporter *exporter;
+
+	/* events waiting to be sent */
+	buffer_t *batch;
+	unsigned int batch_events;
+	struct timeout *to_batch;
+
+	unsigned int pending_requests;
+	unsigned int dropped_events;
+	time_t last_drop_log;
+};
+
 /* the http client used to export all events with exporter=http-post */
 static struct http_client *exporter_http_client;
+static ARRAY(struct http_post_exporter *) http_post_exporters;
 
 void event_export_transport_http_post_deinit(void)
 {
+	struct http_post_exporter *hexp;
+
+	/* aborts the pending requests, which still refer to the exporters */
 	if (exporter_http_client != NULL)
 		http_client_deinit(&exporter_http_client);
+
+	if (!array_is_created(&http_post_exporters))
+		return;
+	array_foreach_elem(&http_post_exporters, hexp) {
+		timeout_remove(&hexp->to_batch);
+		buffer_free(&hexp->batch);
+		i_free(hexp);
+	}
+	array_free(&http_post_exporters);
 }
 
 static void response_fxn(const struct http_response *response,
-			 void *context ATTR_UNUSED)
+			 struct http_post_exporter *hexp)
 {
 	static time_t last_log;
 	static unsigned suppressed;
 
+	i_assert(hexp->pending_requests > 0);
+	hexp->pending_requests--;
+
 	if (http_response_is_success(response))
 		return;
 
@@ -43,34 +79,169 @@ static void response_fxn(const struct http_response *response,
 	suppressed = 0;
 }
 
-void event_export_transport_http_post(const struct exporter *exporter,
-				      const buffer_t *buf)
+static struct http_post_exporter *
+http_post_exporter_get(const struct exporter *exporter)
+{
+	struct http_post_exporter *hexp;
+
+	if (!array_is_created(&http_post_exporters))
+		i_array_init(&http_post_exporters, 4);
+	array_foreach_elem(&http_post_exporters, hexp) {
+		if (hexp->exporter == exporter)
+			return hexp;
+	}
+
+	hexp = i_new(struct http_post_exporter, 1);
+	hexp->exporter = exporter;
+	array_push_back(&http_post_exporters, &hexp);
+	return hexp;
+}
+
+static void http_post_client_init(void)
+{
+	const struct master_service_ssl_settings *master_ssl_set =
+		master_service_ssl_settings_get(master_service);
+	struct ssl_iostream_settings ssl_set;
+
+	struct http_client_settings set = {
+		.dns_client_socket_path = "dns-client",
+		.max_parallel_connections =
+			EXPORTER_HTTP_MAX_PARALLEL_CONNECTIONS,
+	};
+	if (master_ssl_set != NULL) {
+		master_service_ssl_client_settings_to_iostream_set(
+			master_ssl_set, pool_datastack_create(),
+			&ssl_set);
+		set.ssl = &ssl_set;
+	}
+	exporter_http_client = http_client_init(&set);
+}
+
+static const char *
+http_post_content_encoding(const struct compression_handler *handler)
+{
+	if (strcmp(handler->name, "gz") == 0)
+		return "gzip";
+	return handler->name;
+}
+
+static bool
+http_post_compress(const struct compression_handler *handler,
+		   const buffer_t *buf, buffer_t *dest)
+{
+	struct ostream *output, *comp_output;
+	bool ret = TRUE;
+
+	output = o_stream_create_buffer(dest);
+	comp_output = handler->create_ostream(output,
+					      handler->get_default_level());
+	o_stream_nsend(comp_output, buf->data, buf->used);
+	if (o_stream_finish(comp_output) < 0) {
+		i_error("Failed to compress exported events: %s",
+			o_stream_get_error(comp_output));
+		ret = FALSE;
+	}
+	o_stream_unref(&comp_output);
+	o_stream_unref(&output);
+	return ret;
+}
+
+static void
+http_post_drop(struct http_post_exporter *hexp, unsigned int events)
+{
+	hexp->dropped_events += events;
+	if (hexp->last_drop_log == ioloop_time)
+		return; /* don't spam the log */
+
+	i_warning("event_exporter %s: Dropped %u events, because %u HTTP POST "
+		  "requests are still waiting for a response",
+		  hexp->exporter->name, hexp->dropped_events,
+		  hexp->pending_requests);
+	hexp->last_drop_log = ioloop_time;
+	hexp->dropped_events = 0;
+}
+
+static void
+http_post_send(struct http_post_exporter *hexp, const buffer_t *buf,
+	       unsigned int events)
 {
+	const struct exporter *exporter = hexp->exporter;
 	struct http_client_request *req;
+	buffer_t *compressed = NULL;
 
-	if (exporter_http_client == NULL) {
-		const struct master_service_ssl_settings *master_ssl_set =
-			master_service_ssl_settings_get(master_service);
-		struct ssl_iostream_settings ssl_set;
-
-		struct http_client_settings set = {
-			.dns_client_socket_path = "dns-client",
-		};
-		if (master_ssl_set != NULL) {
-			master_service_ssl_client_settings_to_iostream_set(
-				master_ssl_set, pool_datastack_create(),
-				&ssl_set);
-			set.ssl = &ssl_set;
-		}
-		exporter_http_client = http_client_init(&set);
+	if (exporter->transport_max_pending_requests > 0 &&
+	    hexp->pending_requests >= exporter->transport_max_pending_requests) {
+		http_post_drop(hexp, events);
+		return;
 	}
 
+	if (exporter_http_client == NULL)
+		http_post_client_init();
+
 	req = http_client_request_url_str(exporter_http_client, "POST",
 					  exporter->transport_args,
-					  response_fxn, NULL);
+					  response_fxn, hexp);
 	http_client_request_add_header(req, "Content-Type", exporter->format_mime_type);
+	if (exporter->transport_compression != NULL) {
+		compressed = t_buffer_create(buf->used / 2 + 64);
+		if (http_post_compress(exporter->transport_compression,
+				       buf, compressed)) {
+			http_client_request_add_header(req, "Content-Encoding",
+				http_post_content_encoding(
+					exporter->transport_compression));
+			buf = compressed;
+		}
+	}
 	http_client_request_set_payload_data(req, buf->data, buf->used);
 
 	http_client_request_set_timeout_msecs(req, exporter->transport_timeout);
 	http_client_request_submit(req);
+	hexp->pending_requests++;
+}
+
+static void http_post_batch_flush(struct http_post_exporter *hexp)
+{
+	timeout_remove(&hexp->to_batch);
+	if (hexp->batch_events == 0)
+		return;
+
+	T_BEGIN {
+		http_post_send(hexp, hexp->batch, hexp->batch_events);
+	} T_END;
+	buffer_set_used_size(hexp->batch, 0);
+	hexp->batch_events = 0;
+}
+
+void event_export_transport_http_post(const struct exporter *exporter,
+				      const buffer_t *buf)
+{
+	struct http_post_exporter *hexp = http_post_exporter_get(exporter);
+
+	if (exporter->transport_batch_max_events <= 1) {
+		http_post_send(hexp, buf, 1);
+		return;
+	}
+
+	/* Add the event to the batch, one event per line. The batch is sent
+	   when it's full or when the batch interval has passed. */
+	if (hexp->batch == NULL) {
+		hexp->batch = buffer_create_dynamic(default_pool,
+			I_MIN(exporter->transport_batch_max_size, 1024*64));
+	}
+	if (hexp->batch->used > 0 &&
+	    hexp->batch->used + buf->used + 1 >
+	    exporter->transport_batch_max_size)
+		http_post_batch_flush(hexp);
+
+	buffer_append_buf(hexp->batch, buf, 0, SIZE_MAX);
+	buffer_append_c(hexp->batch, '\n');
+	hexp->batch_events++;
+
+	if (hexp->batch_events >= exporter->transport_batch_max_events ||
+	    hexp->batch->used >= exporter->transport_batch_max_size)
+		http_post_batch_flush(hexp);
+	else if (hexp->to_batch == NULL) {
+		hexp->to_batch = timeout_add(exporter->transport_batch_interval,
+					     http_post_batch_flush, hexp);
+	}
 }
@@ -70,7 +70,7 @@ static void main_init(void)
 	client_readers_init();
 	client_writers_init();
 	client_http_init(stats_settings);
-	stats_services_init();
+	stats_services_init(stats_settings);
 }
 
 static void main_deinit(void)
@@ -4,13 +4,17 @@
 #include "array.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "ioloop.h"
+#include "byteorder.h"
 #include "stats-dist.h"
+#include "stats-hist.h"
 #include "time-util.h"
 #include "event-filter.h"
 #include "event-exporter.h"
 #include "stats-settings.h"
 #include "stats-metrics.h"
 #include "settings-parser.h"
+#include "compression.h"
 
 #include <ctype.h>
 
@@ -23,6 +27,15 @@ struct stats_metrics {
 	ARRAY(struct metric *) metrics;
 };
 
+struct exporter_rate_limit {
+	unsigned int rate, burst;
+	double tokens;
+	struct timeval last_refill;
+
+	unsigned int dropped_events;
+	time_t last_drop_log;
+};
+
 static void
 stats_metric_event(struct metric *metric, struct event *event, pool_t pool);
 static struct metric *
@@ -37,7 +50,29 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 	exporter->name = p_strdup(metrics->pool, set->name);
 	exporter->transport_args = p_strdup(metrics->pool, set->transport_args);
 	exporter->transport_timeout = set->transport_timeout;
+	exporter->transport_batch_max_events = set->transport_batch_max_events;
+	exporter->transport_batch_max_size = set->transport_batch_max_size;
+	exporter->transport_batch_interval = set->transport_batch_interval;
+	exporter->transport_max_pending_requests =
+		set->transport_max_pending_requests;
 	exporter->time_format = set->parsed_time_format;
+	if (set->rate_limit > 0) {
+		exporter->rate_limit = p_new(metrics->pool,
+					     struct exporter_rate_limit, 1);
+		exporter->rate_limit->rate = set->rate_limit;
+		exporter->rate_limit->burst = set->rate_limit_burst > 0 ?
+			set->rate_limit_burst : set->rate_limit;
+		exporter->rate_limit->tokens = exporter->rate_limit->burst;
+		exporter->rate_limit->last_refill = ioloop_timeval;
+	}
+
+	if (set->transport_compression[0] != '\0' &&
+	    compression_lookup_handler(set->transport_compression,
+				       &exporter->transport_compression) <= 0) {
+		i_fatal("event_exporter %s: transport_compression=%s "
+			"support not compiled in", set->name,
+			set->transport_compression);
+	}
 
 	/* TODO: The following should be plugable.
 	 *
@@ -49,7 +84,10 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 		exporter->format_mime_type = "application/octet-stream";
 	} else if (strcmp(set->format, "json") == 0) {
 		exporter->format = event_export_fmt_json;
-		exporter->format_mime_type = "application/json";
+		/* batches have one JSON object per line */
+		exporter->format_mime_type =
+			exporter->transport_batch_max_events > 1 ?
+			"application/x-ndjson" : "application/json";
 	} else if (strcmp(set->format, "tab-text") == 0) {
 		exporter->format = event_export_fmt_tabescaped_text;
 		exporter->format_mime_type = "text/plain";
@@ -88,6 +126,8 @@ stats_metric_alloc(pool_t pool, const char *name,
 	metric->name = p_strdup(pool, name);
 	metric->set = set;
 	metric->duration_stats = stats_dist_init();
+	if (set->duration_histogram)
+		metric->duration_hist = stats_hist_init();
 	metric->fields_count = str_array_length(fields);
 	if (metric->fields_count > 0) {
 	    metric->fields = p_new(pool, struct metric_field,
@@ -169,6 +209,9 @@ stats_metric_settings_dup(pool_t pool, const struct stats_metric_settings *src)
 	set->filter = p_strdup(pool, src->filter);
 	set->exporter = p_strdup(pool, src->exporter);
 	set->exporter_include = p_strdup(pool, src->exporter_include);
+	set->exporter_sampling = p_strdup(pool, src->exporter_sampling);
+	set->exporter_sampling_key = p_strdup(pool, src->exporter_sampling_key);
+	set->duration_histogram = src->duration_histogram;
 
 	return set;
 }
@@ -263,6 +306,7 @@ static void stats_metric_free(struct metric *metric)
 {
 	struct metric *sub_metric;
 	stats_dist_deinit(&metric->duration_stats);
+	stats_hist_deinit(&metric->duration_hist);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_dist_deinit(&metric->fields[i].stats);
 	if (!array_is_created(&metric->sub_metrics))
@@ -297,6 +341,8 @@ static void stats_metric_reset(struct metric *metric)
 {
 	struct metric *sub_metric;
 	stats_dist_reset(metric->duration_stats);
+	if (metric->duration_hist != NULL)
+		stats_hist_reset(metric->duration_hist);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_dist_reset(metric->fields[i].stats);
 	if (!array_is_created(&metric->sub_metrics))
@@ -607,7 +653,7 @@ stats_metric_group_by(struct metric *metric, struct event *event, pool_t pool)
 
 static void
 stats_metric_event_field(struct event *event, const char *fieldname,
-			 struct stats_dist *stats)
+			 struct stats_dist *stats, struct stats_hist *hist)
 {
 	const struct event_field *field =
 		event_find_field_recursive(event, fieldname);
@@ -630,6 +676,8 @@ stats_metric_event_field(struct event *event, const char *fieldname,
 	}
 
 	stats_dist_add(stats, num);
+	if (hist != NULL)
+		stats_hist_add(hist, num);
 }
 
 static void
@@ -637,17 +685,74 @@ stats_metric_event(struct metric *metric, struct event *event, pool_t pool)
 {
 	/* duration is special - we always add it */
 	stats_metric_event_field(event, STATS_EVENT_FIELD_NAME_DURATION,
-				 metric->duration_stats);
+				 metric->duration_stats,
+				 metric->duration_hist);
 
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_metric_event_field(event,
 					 metric->fields[i].field_key,
-					 metric->fields[i].stats);
+					 metric->fields[i].stats, NULL);
 
 	if (metric->group_by != NULL)
 		stats_metric_group_by(metric, event, pool);
 }
 
+static bool
+stats_export_event_sampled(const struct metric *metric, struct event *event)
+{
+	const struct stats_metric_settings *set = metric->set;
+	unsigned char digest[SHA1_RESULTLEN];
+	const char *value = NULL;
+	uint32_t hash;
+
+	if (set->parsed_sampling_threshold > UINT32_MAX)
+		return TRUE;
+
+	if (set->exporter_sampling_key[0] != '\0') {
+		value = event_find_field_recursive_str(event,
+						       set->exporter_sampling_key);
+	}
+	if (value == NULL)
+		hash = i_rand();
+	else {
+		sha1_get_digest(value, strlen(value), digest);
+		hash = be32_to_cpu_unaligned(digest);
+	}
+	return hash < set->parsed_sampling_threshold;
+}
+
+static bool stats_export_event_rate_limit(const struct exporter *exporter)
+{
+	struct exporter_rate_limit *limit = exporter->rate_limit;
+	long long usecs;
+
+	if (limit == NULL)
+		return TRUE;
+
+	/* refill the bucket */
+	usecs = timeval_diff_usecs(&ioloop_timeval, &limit->last_refill);
+	if (usecs > 0) {
+		limit->tokens += (double)usecs * limit->rate / 1000000;
+		if (limit->tokens > limit->burst)
+			limit->tokens = limit->burst;
+		limit->last_refill = ioloop_timeval;
+	}
+	if (limit->tokens >= 1) {
+		limit->tokens--;
+		return TRUE;
+	}
+
+	limit->dropped_events++;
+	if (limit->last_drop_log != ioloop_time) {
+		i_warning("event_exporter %s: rate_limit=%u/s reached - "
+			  "dropped %u events", exporter->name, limit->rate,
+			  limit->dropped_events);
+		limit->last_drop_log = ioloop_time;
+		limit->dropped_events = 0;
+	}
+	return FALSE;
+}
+
 static void
 stats_export_event(struct metric *metric, struct event *oldevent)
 {
@@ -657,6 +762,13 @@ stats_export_event(struct metric *metric, struct event *oldevent)
 
 	i_assert(exporter != NULL);
 
+	/* Decide before the (relatively expensive) flattening and
+	   formatting */
+	if (!stats_export_event_sampled(metric, oldevent))
+		return;
+	if (!stats_export_event_rate_limit(exporter))
+		return;
+
 	event = event_flatten(oldevent);
 
 	T_BEGIN {
@@ -8,6 +8,8 @@
 
 struct metric;
 struct stats_metrics;
+struct compression_handler;
+struct exporter_rate_limit;
 
 struct exporter {
 	const char *name;
@@ -35,6 +37,18 @@ struct exporter {
 	 */
 	const char *transport_args;
 	unsigned int transport_timeout;
+	/* batching of multiple events into one transport call */
+	unsigned int transport_batch_max_events;
+	size_t transport_batch_max_size;
+	unsigned int transport_batch_interval;
+	/* compression for the transport, NULL if none */
+	const struct compression_handler *transport_compression;
+	/* max number of transport requests waiting for a response */
+	unsigned int transport_max_pending_requests;
+
+	/* token bucket limiting the exported events per second,
+	   NULL if unlimited */
+	struct exporter_rate_limit *rate_limit;
 
 	/* function to send the event */
 	void (*transport)(const struct exporter *, const buffer_t *);
@@ -92,6 +106,8 @@ struct metric {
 
 	/* Timing for how long the event existed */
 	struct stats_dist *duration_stats;
+	/* Histogram of the durations, if duration_histogram is set */
+	struct stats_hist *duration_hist;
 
 	unsigned int fields_count;
 	struct metric_field *fields;
@@ -6,8 +6,10 @@
 #include "array.h"
 #include "json-parser.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "ostream.h"
 #include "stats-dist.h"
+#include "stats-hist.h"
 #include "http-server.h"
 #include "client-http.h"
 #include "stats-settings.h"
@@ -15,6 +17,13 @@
 #include "stats-service-private.h"
 
 #define OPENMETRICS_CONTENT_VERSION "0.0.1"
+#define OPENMETRICS_CONTENT_TYPE \
+	"application/openmetrics-text; version="OPENMETRICS_CONTENT_VERSION"; " \
+	"charset=utf-8"
+
+/* Number of (sub-)metrics rendered into the snapshot per ioloop run, so
+   event ingestion isn't blocked for long by the rendering. */
+#define OPENMETRICS_SNAPSHOT_RENDER_STEPS 100
 
 #ifdef DOVECOT_REVISION
 #define OPENMETRICS_BUILD_INFO \
@@ -28,6 +37,7 @@
 enum openmetrics_metric_type {
 	OPENMETRICS_METRIC_TYPE_COUNT,
 	OPENMETRICS_METRIC_TYPE_DURATION,
+	OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM,
 	OPENMETRICS_METRIC_TYPE_HISTOGRAM,
 };
 
@@ -60,6 +70,23 @@ struct openmetrics_request {
 	bool has_submetric:1;
 };
 
+/* With stats_openmetrics_cache_interval set, scrapes are served from a
+   pre-rendered snapshot. The next snapshot is rendered in the background in
+   small steps, and it replaces the previous one only once it's complete. */
+struct openmetrics_snapshot {
+	/* Last complete rendering, NULL until the first one finishes */
+	buffer_t *data;
+	struct timeval rendered_time;
+
+	/* Rendering in progress */
+	struct openmetrics_request render;
+	buffer_t *render_data;
+	struct timeout *to_render;
+};
+
+static unsigned int openmetrics_cache_interval_msecs;
+static struct openmetrics_snapshot openmetrics_snapshot;
+
 /* https://prometheus.io/docs/concepts/data_model/#metric-names-and-labels:
 
    Every time series is uniquely identified by its metric name and optional
@@ -134,6 +161,7 @@ openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 		else
 			str_append(out, "_duration_seconds_total");
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		i_unreached();
 	}
@@ -154,6 +182,7 @@ openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 		str_printfa(out, " %.6f\n",
 			    stats_dist_get_sum(metric->duration_stats)/1e6F);
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		i_unreached();
 	}
@@ -266,6 +295,63 @@ openmetrics_export_histogram(struct openmetrics_request *req, string_t *out,
 	str_printfa(out, " %"PRIu64"\n", count);
 }
 
+static void
+openmetrics_export_duration_histogram_name(struct openmetrics_request *req,
+					   string_t *out,
+					   const struct metric *metric,
+					   const char *suffix, const char *le)
+{
+	/* Metric name */
+	str_append(out, "dovecot_");
+	str_append(out, metric->name);
+	str_append(out, "_duration_histogram_seconds");
+	str_append(out, suffix);
+	/* Labels */
+	if (str_len(req->labels) == 0 && le == NULL)
+		return;
+	str_append_c(out, '{');
+	str_append_str(out, req->labels);
+	if (le != NULL) {
+		if (str_len(req->labels) > 0)
+			str_append_c(out, ',');
+		str_printfa(out, "le=\"%s\"", le);
+	}
+	str_append_c(out, '}');
+}
+
+static void
+openmetrics_export_duration_histogram(struct openmetrics_request *req,
+				      string_t *out,
+				      const struct metric *metric)
+{
+	const struct stats_hist *hist = metric->duration_hist;
+	struct stats_hist_bucket bucket;
+	unsigned int idx = 0;
+	uint64_t count = 0;
+
+	/* Buckets. Only the non-empty ones are exported. The bucket
+	   boundaries are the same for all metrics and don't change over time,
+	   so the series can be aggregated. */
+	while (stats_hist_bucket_next(hist, &idx, &bucket)) {
+		count += bucket.count;
+		/* Convert from microseconds to seconds */
+		openmetrics_export_duration_histogram_name(req, out, metric,
+			"_bucket", t_strdup_printf("%.6f", bucket.max/1e6));
+		str_printfa(out, " %"PRIu64"\n", count);
+	}
+	openmetrics_export_duration_histogram_name(req, out, metric,
+						   "_bucket", "+Inf");
+	str_printfa(out, " %"PRIu64"\n", count);
+	/* Sum */
+	openmetrics_export_duration_histogram_name(req, out, metric,
+						   "_sum", NULL);
+	str_printfa(out, " %.6f\n", stats_hist_get_sum(hist)/1e6);
+	/* Count */
+	openmetrics_export_duration_histogram_name(req, out, metric,
+						   "_count", NULL);
+	str_printfa(out, " %"PRIu64"\n", count);
+}
+
 static void
 openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 {
@@ -281,6 +367,9 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	case OPENMETRICS_METRIC_TYPE_DURATION:
 		str_append(out, "_duration_seconds Total duration of all events of this kind");
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
+		str_append(out, "_duration_histogram_seconds Histogram of the durations of all events of this kind");
+		break;
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		str_append(out, " Histogram");
 		break;
@@ -300,6 +389,9 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	case OPENMETRICS_METRIC_TYPE_DURATION:
 		str_append(out, "_duration_seconds counter\n");
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
+		str_append(out, "_duration_histogram_seconds histogram\n");
+		break;
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		str_append(out, " histogram\n");
 		break;
@@ -326,6 +418,10 @@ openmetrics_export_submetric(struct openmetrics_request *req, string_t *out,
 		openmetrics_export_histogram(req, out, metric);
 		return;
 	}
+	if (req->metric_type == OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM) {
+		openmetrics_export_duration_histogram(req, out, metric);
+		return;
+	}
 
 	openmetrics_export_metric_value(req, out, metric);
 
@@ -540,11 +636,18 @@ static void openmetrics_export_next(struct openmetrics_request *req)
 			/* Continue with histogram output for this metric. */
 			req->metric_type = OPENMETRICS_METRIC_TYPE_HISTOGRAM;
 			req->state = OPENMETRICS_REQUEST_STATE_METRIC_HEADER;
+		} else if (req->metric->duration_hist != NULL) {
+			/* Continue with duration histogram output for this
+			   metric. */
+			req->metric_type =
+				OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM;
+			req->state = OPENMETRICS_REQUEST_STATE_METRIC_HEADER;
 		} else {
 			/* No histogram; continue with next metric */
 			req->state = OPENMETRICS_REQUEST_STATE_METRIC;
 		}
 		break;
+	case OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM:
 	case OPENMETRICS_METRIC_TYPE_HISTOGRAM:
 		/* Continue with next metric */
 		req->state = OPENMETRICS_REQUEST_STATE_METRIC;
@@ -612,7 +715,11 @@ openmetrics_export_continue(struct openmetrics_request *req, string_t *out)
 		str_truncate(req->labels, req->labels_pos);
 		if (req->metric_type == OPENMETRICS_METRIC_TYPE_HISTOGRAM)
 			openmetrics_export_histogram(req, out, req->metric);
-		else
+		else if (req->metric_type ==
+			 OPENMETRICS_METRIC_TYPE_DURATION_HISTOGRAM) {
+			openmetrics_export_duration_histogram(req, out,
+							      req->metric);
+		} else
 			openmetrics_export_metric_body(req, out);
 		openmetrics_export_next(req);
 		break;
@@ -713,6 +820,63 @@ static void openmetrics_request_destroy(struct openmetrics_request *req)
 	openmetrics_request_deinit(req);
 }
 
+static void openmetrics_snapshot_render(struct openmetrics_snapshot *snapshot)
+{
+	struct openmetrics_request *req = &snapshot->render;
+	buffer_t *prev_data;
+	unsigned int i;
+
+	for (i = 0; i < OPENMETRICS_SNAPSHOT_RENDER_STEPS; i++) {
+		openmetrics_export_continue(req, snapshot->render_data);
+		if (req->state == OPENMETRICS_REQUEST_STATE_FINISHED)
+			break;
+	}
+	if (req->state != OPENMETRICS_REQUEST_STATE_FINISHED)
+		return;
+
+	openmetrics_export_eof(snapshot->render_data);
+	openmetrics_request_deinit(req);
+	i_zero(req);
+	timeout_remove(&snapshot->to_render);
+
+	/* Replace the previous snapshot. Its buffer is reused for the next
+	   rendering. */
+	prev_data = snapshot->data;
+	snapshot->data = snapshot->render_data;
+	snapshot->render_data = prev_data;
+	snapshot->rendered_time = ioloop_timeval;
+}
+
+static void openmetrics_snapshot_refresh(struct openmetrics_snapshot *snapshot)
+{
+	if (snapshot->to_render != NULL) {
+		/* already rendering */
+		return;
+	}
+	if (snapshot->data != NULL &&
+	    timeval_diff_msecs(&ioloop_timeval, &snapshot->rendered_time) <
+	    (int)openmetrics_cache_interval_msecs)
+		return;
+
+	if (snapshot->render_data == NULL)
+		snapshot->render_data = buffer_create_dynamic(default_pool, 4096);
+	else
+		buffer_set_used_size(snapshot->render_data, 0);
+	snapshot->to_render = timeout_add_short(0, openmetrics_snapshot_render,
+						snapshot);
+}
+
+static void openmetrics_snapshot_deinit(struct openmetrics_snapshot *snapshot)
+{
+	if (snapshot->to_render != NULL) {
+		openmetrics_request_deinit(&snapshot->render);
+		timeout_remove(&snapshot->to_render);
+	}
+	buffer_free(&snapshot->data);
+	buffer_free(&snapshot->render_data);
+	i_zero(snapshot);
+}
+
 static void
 stats_service_openmetrics_request(void *context ATTR_UNUSED,
 				  struct http_server_request *hsreq,
@@ -738,6 +902,24 @@ stats_service_openmetrics_request(void *context ATTR_UNUSED,
 		return;
 	}
 
+	if (openmetrics_cache_interval_msecs > 0) {
+		openmetrics_snapshot_refresh(&openmetrics_snapshot);
+		if (openmetrics_snapshot.data != NULL) {
+			/* Serve the last snapshot without rendering anything
+			   for this request. */
+			hsresp = http_server_response_create(hsreq, 200, "OK");
+			http_server_response_add_header(
+				hsresp, "Content-Type", OPENMETRICS_CONTENT_TYPE);
+			http_server_response_set_payload_data(
+				hsresp, openmetrics_snapshot.data->data,
+				openmetrics_snapshot.data->used);
+			http_server_response_submit(hsresp);
+			return;
+		}
+		/* The first snapshot isn't ready yet - render this request
+		   the usual way. */
+	}
+
 	pool = http_server_request_get_pool(hsreq);
 	req = p_new(pool, struct openmetrics_request, 1);
 
@@ -745,10 +927,8 @@ stats_service_openmetrics_request(void *context ATTR_UNUSED,
 		hsreq, openmetrics_request_destroy, req);
 
 	hsresp = http_server_response_create(hsreq, 200, "OK");
-	http_server_response_add_header(
-		hsresp, "Content-Type",
-		"application/openmetrics-text; version="OPENMETRICS_CONTENT_VERSION"; "
-		"charset=utf-8");
+	http_server_response_add_header(hsresp, "Content-Type",
+					OPENMETRICS_CONTENT_TYPE);
 
 	req->output = http_server_response_get_payload_output(
 		hsresp, SIZE_MAX, FALSE);
@@ -757,11 +937,14 @@ stats_service_openmetrics_request(void *context ATTR_UNUSED,
 	o_stream_set_flush_pending(req->output, TRUE);
 }
 
-void stats_service_openmetrics_init(void)
+void stats_service_openmetrics_init(const struct stats_settings *set)
 {
 	struct stats_metrics_iter *iter;
 	const struct metric *metric;
 
+	openmetrics_cache_interval_msecs =
+		set->stats_openmetrics_cache_interval;
+
 	iter = stats_metrics_iterate_init(stats_metrics);
 	while ((metric = stats_metrics_iterate(iter)) != NULL) {
 		if (!openmetrics_check_name(metric->name)) {
@@ -777,3 +960,8 @@ void stats_service_openmetrics_init(void)
 	stats_http_resource_add("/metrics", "OpenMetrics",
 				stats_service_openmetrics_request, NULL);
 }
+
+void stats_service_openmetrics_deinit(void)
+{
+	openmetrics_snapshot_deinit(&openmetrics_snapshot);
+}
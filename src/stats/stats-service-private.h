@@ -3,6 +3,7 @@
 
 #include "stats-service.h"
 
-void stats_service_openmetrics_init(void);
+void stats_service_openmetrics_init(const struct stats_settings *set);
+void stats_service_openmetrics_deinit(void);
 
 #endif
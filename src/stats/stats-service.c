@@ -4,12 +4,12 @@
 #include "http-server.h"
 #include "stats-service-private.h"
 
-void stats_services_init(void)
+void stats_services_init(const struct stats_settings *set)
 {
-	 stats_service_openmetrics_init();
+	 stats_service_openmetrics_init(set);
 }
 
 void stats_services_deinit(void)
 {
-	/* Nothing yet */
+	stats_service_openmetrics_deinit();
 }
@@ -1,7 +1,9 @@
 #ifndef STATS_SERVICE_H
 #define STATS_SERVICE_H
 
-void stats_services_init(void);
+struct stats_settings;
+
+void stats_services_init(const struct stats_settings *set);
 void stats_services_deinit(void);
 
 #endif
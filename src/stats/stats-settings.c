@@ -70,6 +70,13 @@ static const struct setting_define stats_exporter_setting_defines[] = {
 	DEF(STR, transport),
 	DEF(STR, transport_args),
 	DEF(TIME_MSECS, transport_timeout),
+	DEF(UINT, transport_batch_max_events),
+	DEF(SIZE, transport_batch_max_size),
+	DEF(TIME_MSECS, transport_batch_interval),
+	DEF(STR, transport_compression),
+	DEF(UINT, transport_max_pending_requests),
+	DEF(UINT, rate_limit),
+	DEF(UINT, rate_limit_burst),
 	DEF(STR, format),
 	DEF(STR, format_args),
 	SETTING_DEFINE_LIST_END
@@ -80,6 +87,13 @@ static const struct stats_exporter_settings stats_exporter_default_settings = {
 	.transport = "",
 	.transport_args = "",
 	.transport_timeout = 250, /* ms */
+	.transport_batch_max_events = 1,
+	.transport_batch_max_size = 64*1024,
+	.transport_batch_interval = 1000, /* ms */
+	.transport_compression = "",
+	.transport_max_pending_requests = 0,
+	.rate_limit = 0,
+	.rate_limit_burst = 0,
 	.format = "",
 	.format_args = "",
 };
@@ -110,7 +124,10 @@ static const struct setting_define stats_metric_setting_defines[] = {
 	DEF(STR, filter),
 	DEF(STR, exporter),
 	DEF(STR, exporter_include),
+	DEF(STR, exporter_sampling),
+	DEF(STR, exporter_sampling_key),
 	DEF(STR, description),
+	DEF(BOOL, duration_histogram),
 	SETTING_DEFINE_LIST_END
 };
 
@@ -121,7 +138,10 @@ static const struct stats_metric_settings stats_metric_default_settings = {
 	.exporter = "",
 	.group_by = "",
 	.exporter_include = STATS_METRIC_SETTINGS_DEFAULT_EXPORTER_INCLUDE,
+	.exporter_sampling = "",
+	.exporter_sampling_key = "",
 	.description = "",
+	.duration_histogram = FALSE,
 };
 
 const struct setting_parser_info stats_metric_setting_parser_info = {
@@ -150,6 +170,7 @@ const struct setting_parser_info stats_metric_setting_parser_info = {
 
 static const struct setting_define stats_setting_defines[] = {
 	DEF(STR, stats_http_rawlog_dir),
+	DEF(TIME_MSECS, stats_openmetrics_cache_interval),
 
 	DEFLIST_UNIQUE(metrics, "metric", &stats_metric_setting_parser_info),
 	DEFLIST_UNIQUE(exporters, "event_exporter", &stats_exporter_setting_parser_info),
@@ -158,6 +179,7 @@ static const struct setting_define stats_setting_defines[] = {
 
 const struct stats_settings stats_default_settings = {
 	.stats_http_rawlog_dir = "",
+	.stats_openmetrics_cache_interval = 0,
 
 	.metrics = ARRAY_INIT,
 	.exporters = ARRAY_INIT,
@@ -278,6 +300,18 @@ static bool stats_exporter_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		return FALSE;
 	}
 
+	if (set->transport_compression[0] != '\0' &&
+	    strcmp(set->transport_compression, "gz") != 0 &&
+	    strcmp(set->transport_compression, "zstd") != 0) {
+		*error_r = t_strdup_printf("Unknown transport_compression '%s'",
+					   set->transport_compression);
+		return FALSE;
+	}
+	if (set->transport_batch_max_events == 0) {
+		*error_r = "transport_batch_max_events must not be 0";
+		return FALSE;
+	}
+
 	if (!parse_format_args(set, error_r))
 		return FALSE;
 
@@ -475,6 +509,37 @@ static bool parse_metric_group_by(struct stats_metric_settings *set,
 	return TRUE;
 }
 
+static bool parse_metric_exporter_sampling(struct stats_metric_settings *set,
+					   const char **error_r)
+{
+	const char *str = set->exporter_sampling;
+	char *end;
+	double ratio;
+
+	if (str[0] == '\0') {
+		/* export everything */
+		set->parsed_sampling_threshold = (uint64_t)UINT32_MAX + 1;
+		return TRUE;
+	}
+
+	errno = 0;
+	ratio = strtod(str, &end);
+	if (end != str && *end == '%') {
+		ratio /= 100;
+		end++;
+	}
+	if (errno != 0 || end == str || *end != '\0' ||
+	    !(ratio >= 0 && ratio <= 1)) {
+		*error_r = t_strdup_printf("metric %s { exporter_sampling=%s } "
+			"must be a fraction between 0 and 1 or a percentage",
+			set->metric_name, str);
+		return FALSE;
+	}
+	set->parsed_sampling_threshold =
+		(uint64_t)(ratio * ((uint64_t)UINT32_MAX + 1));
+	return TRUE;
+}
+
 static bool stats_metric_settings_check(void *_set, pool_t pool, const char **error_r)
 {
 	struct stats_metric_settings *set = _set;
@@ -497,6 +562,9 @@ static bool stats_metric_settings_check(void *_set, pool_t pool, const char **er
 	if (!parse_metric_group_by(set, pool, error_r))
 		return FALSE;
 
+	if (!parse_metric_exporter_sampling(set, error_r))
+		return FALSE;
+
 	return TRUE;
 }
 
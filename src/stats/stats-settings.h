@@ -65,6 +65,15 @@ struct stats_exporter_settings {
 	const char *transport;
 	const char *transport_args;
 	unsigned int transport_timeout;
+	/* http-post batching: send up to this many events in one request */
+	unsigned int transport_batch_max_events;
+	uoff_t transport_batch_max_size;
+	unsigned int transport_batch_interval;
+	const char *transport_compression;
+	unsigned int transport_max_pending_requests;
+	/* max number of events exported per second, 0 = unlimited */
+	unsigned int rate_limit;
+	unsigned int rate_limit_burst;
 	const char *format;
 	const char *format_args;
 
@@ -110,10 +119,25 @@ struct stats_metric_settings {
 	/* exporter related fields */
 	const char *exporter;
 	const char *exporter_include;
+	/* Fraction of the events to export, e.g. "1%" or "0.01". If
+	   exporter_sampling_key is set, the decision is made by hashing the
+	   key field's value, so e.g. all events of a session are either
+	   exported or not. */
+	const char *exporter_sampling;
+	const char *exporter_sampling_key;
+
+	/* Events whose sampling hash is below this are exported.
+	   > UINT32_MAX exports everything. */
+	uint64_t parsed_sampling_threshold;
+
+	/* Keep a log-linear histogram of the event durations and export it
+	   via OpenMetrics */
+	bool duration_histogram;
 };
 
 struct stats_settings {
 	const char *stats_http_rawlog_dir;
+	unsigned int stats_openmetrics_cache_interval;
 
 	ARRAY(struct stats_exporter_settings *) exporters;
 	ARRAY(struct stats_metric_settings *) metrics;
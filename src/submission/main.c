@@ -25,6 +25,7 @@
 #include "smtp-client.h"
 
 #include "submission-commands.h"
+#include "submission-backend-relay.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -422,6 +423,7 @@ int main(int argc, char *argv[])
 		master_service_run(master_service, client_connected);
 	clients_destroy_all();
 
+	submission_backend_relay_pool_deinit();
 	smtp_client_deinit(&smtp_client);
 	smtp_server_deinit(&smtp_server);
 
@@ -2,9 +2,12 @@
 
 #include "submission-common.h"
 #include "str.h"
+#include "array.h"
 #include "str-sanitize.h"
+#include "strescape.h"
 #include "mail-user.h"
 #include "iostream-ssl.h"
+#include "dsasl-client.h"
 #include "smtp-client.h"
 #include "smtp-client-connection.h"
 #include "smtp-client-transaction.h"
@@ -13,18 +16,44 @@
 #include "submission-recipient.h"
 #include "submission-backend-relay.h"
 
+/* Each reuse allocates the new XCLIENT data from the connection's pool, so
+   don't reuse the same connection forever. */
+#define RELAY_POOL_MAX_REUSE_COUNT 1000
+
 struct submission_backend_relay {
 	struct submission_backend backend;
 
 	struct smtp_client_connection *conn;
 	struct smtp_client_transaction *trans;
 
+	/* Set if the connection can be pooled after the session */
+	const char *pool_key;
+	unsigned int pool_max_connections;
+	unsigned int pool_idle_timeout_secs;
+	unsigned int reuse_count;
+
 	bool trans_started:1;
 	bool trusted:1;
 };
 
+/* Idle relay connection kept for reuse by later sessions */
+struct relay_pool_connection {
+	struct relay_pool_target *target;
+	struct smtp_client_connection *conn;
+	struct timeout *to_idle;
+	unsigned int reuse_count;
+};
+
+/* Idle connections with identical relay settings */
+struct relay_pool_target {
+	char *key;
+	ARRAY(struct relay_pool_connection *) idle_conns;
+};
+
 static struct submission_backend_vfuncs backend_relay_vfuncs;
 
+static ARRAY(struct relay_pool_target *) relay_pool_targets;
+
 /*
  * Common
  */
@@ -1031,12 +1060,171 @@ backend_relay_cmd_quit(struct submission_backend *_backend,
 	smtp_server_command_add_hook(cmd->cmd, SMTP_SERVER_COMMAND_HOOK_DESTROY,
 				     relay_cmd_quit_destroy, quit_cmd);
 
+	if (backend->pool_key != NULL) {
+		/* The relay connection is kept open for reuse by other
+		   sessions. */
+		smtp_server_reply_quit(cmd);
+		return 0;
+	}
+
 	if (smtp_client_connection_get_state(backend->conn)
 		>= SMTP_CLIENT_CONNECTION_STATE_READY)
 		relay_cmd_quit_relay(quit_cmd);
 	return 0;
 }
 
+/*
+ * Relay connection pool
+ */
+
+static const char *
+relay_pool_get_key(const struct submision_backend_relay_settings *set)
+{
+	string_t *key = t_str_new(256);
+
+	str_printfa(key, "%d\t%s\t%u\t%d\t%d\t%d\t",
+		    set->protocol, net_ip2addr(&set->ip), set->port,
+		    set->ssl_mode, set->ssl_verify ? 1 : 0,
+		    set->trusted ? 1 : 0);
+	str_append_tabescaped(key, set->path == NULL ? "" : set->path);
+	str_append_c(key, '\t');
+	str_append_tabescaped(key, set->host == NULL ? "" : set->host);
+	str_append_c(key, '\t');
+	str_append_tabescaped(key, set->my_hostname);
+	str_append_c(key, '\t');
+	str_append_tabescaped(key, set->user == NULL ? "" : set->user);
+	str_append_c(key, '\t');
+	str_append_tabescaped(key, set->master_user == NULL ?
+			      "" : set->master_user);
+	str_append_c(key, '\t');
+	str_append_tabescaped(key, set->password == NULL ? "" : set->password);
+	str_append_c(key, '\t');
+	if (set->sasl_mech != NULL)
+		str_append(key, dsasl_client_mech_get_name(set->sasl_mech));
+	if (set->extra_capabilities != NULL) {
+		str_append_c(key, '\t');
+		str_append_tabescaped(key, t_strarray_join(
+			set->extra_capabilities, " "));
+	}
+	return str_c(key);
+}
+
+static struct relay_pool_target *relay_pool_target_get(const char *key)
+{
+	struct relay_pool_target *target;
+
+	if (!array_is_created(&relay_pool_targets))
+		i_array_init(&relay_pool_targets, 4);
+	array_foreach_elem(&relay_pool_targets, target) {
+		if (strcmp(target->key, key) == 0)
+			return target;
+	}
+
+	target = i_new(struct relay_pool_target, 1);
+	target->key = i_strdup(key);
+	i_array_init(&target->idle_conns, 4);
+	array_push_back(&relay_pool_targets, &target);
+	return target;
+}
+
+static void relay_pool_connection_free(struct relay_pool_connection *pconn)
+{
+	timeout_remove(&pconn->to_idle);
+	if (pconn->conn != NULL)
+		smtp_client_connection_close(&pconn->conn);
+	i_free(pconn);
+}
+
+static void relay_pool_connection_idle_timeout(struct relay_pool_connection *pconn)
+{
+	struct relay_pool_connection *const *pconns;
+	unsigned int i, count;
+
+	pconns = array_get(&pconn->target->idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (pconns[i] == pconn) {
+			array_delete(&pconn->target->idle_conns, i, 1);
+			break;
+		}
+	}
+	i_assert(i < count);
+	relay_pool_connection_free(pconn);
+}
+
+static struct smtp_client_connection *
+relay_pool_get(struct submission_backend_relay *backend,
+	       const struct smtp_proxy_data *proxy_data)
+{
+	struct relay_pool_target *target;
+	struct relay_pool_connection *pconn;
+	struct smtp_client_connection *conn;
+
+	target = relay_pool_target_get(backend->pool_key);
+	while (array_count(&target->idle_conns) > 0) {
+		/* use the most recently used connection */
+		pconn = array_idx_elem(&target->idle_conns,
+				       array_count(&target->idle_conns) - 1);
+		array_pop_back(&target->idle_conns);
+
+		if (!smtp_client_connection_is_idle(pconn->conn)) {
+			/* relay server disconnected us */
+			relay_pool_connection_free(pconn);
+			continue;
+		}
+		conn = pconn->conn;
+		pconn->conn = NULL;
+		backend->reuse_count = pconn->reuse_count + 1;
+		relay_pool_connection_free(pconn);
+
+		if (backend->trusted) {
+			/* send XCLIENT for this session */
+			smtp_client_connection_replace_proxy_data(conn,
+								  proxy_data);
+		}
+		return conn;
+	}
+	return NULL;
+}
+
+static void relay_pool_put(struct submission_backend_relay *backend)
+{
+	struct relay_pool_target *target;
+	struct relay_pool_connection *pconn;
+
+	target = relay_pool_target_get(backend->pool_key);
+	if (backend->reuse_count >= RELAY_POOL_MAX_REUSE_COUNT ||
+	    array_count(&target->idle_conns) >= backend->pool_max_connections ||
+	    !smtp_client_connection_is_idle(backend->conn))
+		return;
+
+	pconn = i_new(struct relay_pool_connection, 1);
+	pconn->target = target;
+	pconn->conn = backend->conn;
+	pconn->reuse_count = backend->reuse_count;
+	pconn->to_idle = timeout_add(backend->pool_idle_timeout_secs * 1000,
+				     relay_pool_connection_idle_timeout, pconn);
+	array_push_back(&target->idle_conns, &pconn);
+	backend->conn = NULL;
+}
+
+void submission_backend_relay_pool_deinit(void)
+{
+	struct relay_pool_target *target;
+	struct relay_pool_connection *pconn;
+
+	if (!array_is_created(&relay_pool_targets))
+		return;
+
+	array_foreach_elem(&relay_pool_targets, target) {
+		array_foreach_elem(&target->idle_conns, pconn)
+			relay_pool_connection_free(pconn);
+		array_free(&target->idle_conns);
+		i_free(target->key);
+		i_free(target);
+	}
+	array_free(&relay_pool_targets);
+}
+
 /*
  * Relay backend
  */
@@ -1099,7 +1287,17 @@ submission_backend_relay_create(
 	smtp_set.connect_timeout_msecs = set->connect_timeout_msecs;
 	smtp_set.command_timeout_msecs = set->command_timeout_msecs;
 
-	if (set->path != NULL) {
+	if (set->pool_max_connections > 0 &&
+	    (set->rawlog_dir == NULL || set->rawlog_dir[0] == '\0')) {
+		backend->pool_key = p_strdup(pool, relay_pool_get_key(set));
+		backend->pool_max_connections = set->pool_max_connections;
+		backend->pool_idle_timeout_secs = set->max_idle_time;
+		backend->conn = relay_pool_get(backend, &smtp_set.proxy_data);
+	}
+
+	if (backend->conn != NULL) {
+		/* reusing a pooled connection */
+	} else if (set->path != NULL) {
 		backend->conn = smtp_client_connection_create_unix(
 			smtp_client, set->protocol, set->path, &smtp_set);
 	} else if (set->ip.family == 0) {
@@ -1142,6 +1340,8 @@ static void backend_relay_destroy(struct submission_backend *_backend)
 
 	if (backend->trans != NULL)
 		smtp_client_transaction_destroy(&backend->trans);
+	if (backend->conn != NULL && backend->pool_key != NULL)
+		relay_pool_put(backend);
 	if (backend->conn != NULL)
 		smtp_client_connection_close(&backend->conn);
 }
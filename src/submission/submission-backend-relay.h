@@ -27,6 +27,9 @@ struct submision_backend_relay_settings {
 
 	const char *rawlog_dir;
 	unsigned int max_idle_time;
+	/* Maximum number of idle connections kept for reuse by later
+	   sessions. 0 disables pooling. */
+	unsigned int pool_max_connections;
 
 	unsigned int connect_timeout_msecs;
 	unsigned int command_timeout_msecs;
@@ -39,6 +42,8 @@ struct submission_backend_relay *
 submission_backend_relay_create(
 	struct client *client,
 	const struct submision_backend_relay_settings *set);
+/* Close all the idle pooled relay connections. */
+void submission_backend_relay_pool_deinit(void);
 
 /* Returns the base backend object for this relay backend */
 struct submission_backend *
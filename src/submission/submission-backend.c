@@ -399,6 +399,22 @@ int submission_backends_cmd_data(struct client *client,
 	return ret;
 }
 
+int submission_backends_cmd_data_stream(struct client *client,
+					struct smtp_server_cmd_ctx *cmd,
+					struct smtp_server_transaction *trans,
+					struct istream *data_input)
+{
+	struct submission_backend *backend;
+
+	i_assert(array_count(&client->rcpt_backends) == 1);
+	backend = array_idx_elem(&client->rcpt_backends, 0);
+
+	backend->data_input = data_input;
+	i_stream_ref(data_input);
+	backend->data_size = 0;
+	return submission_backend_cmd_data(backend, cmd, trans);
+}
+
 int submission_backend_cmd_vrfy(struct submission_backend *backend,
 				struct smtp_server_cmd_ctx *cmd,
 				const char *param)
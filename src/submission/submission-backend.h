@@ -157,6 +157,13 @@ int submission_backends_cmd_data(struct client *client,
 				 struct smtp_server_cmd_ctx *cmd,
 				 struct smtp_server_transaction *trans,
 				 struct istream *data_input, uoff_t data_size);
+/* Same as submission_backends_cmd_data(), but the transaction has only one
+   backend and data_input is a non-blocking stream that is still being filled
+   while the backend reads it. Its size isn't known yet. */
+int submission_backends_cmd_data_stream(struct client *client,
+					struct smtp_server_cmd_ctx *cmd,
+					struct smtp_server_transaction *trans,
+					struct istream *data_input);
 
 int submission_backend_cmd_vrfy(struct submission_backend *backend,
 				struct smtp_server_cmd_ctx *cmd,
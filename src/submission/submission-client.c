@@ -137,6 +137,8 @@ client_create_backend_default(struct client *client,
 	relay_set.password = set->submission_relay_password;
 	relay_set.rawlog_dir = set->submission_relay_rawlog_dir;
 	relay_set.max_idle_time = set->submission_relay_max_idle_time;
+	relay_set.pool_max_connections =
+		set->submission_relay_pool_max_connections;
 	relay_set.connect_timeout_msecs = set->submission_relay_connect_timeout;
 	relay_set.command_timeout_msecs = set->submission_relay_command_timeout;
 	relay_set.trusted = set->submission_relay_trusted;
@@ -279,6 +281,7 @@ client_create(int fd_in, int fd_out, struct mail_user *user,
 
 static void client_state_reset(struct client *client)
 {
+	submission_data_stream_detach(client);
 	i_free(client->state.args);
 	i_stream_unref(&client->state.data_input);
 	pool_unref(&client->state.pool);
@@ -307,6 +310,7 @@ client_default_destroy(struct client *client)
 		return;
 	client->destroyed = TRUE;
 
+	submission_data_stream_detach(client);
 	submission_backends_destroy_all(client);
 	array_free(&client->pending_backends);
 	array_free(&client->rcpt_to);
@@ -371,6 +375,7 @@ client_default_trans_free(struct client *client,
 {
 	array_clear(&client->rcpt_to);
 
+	submission_data_stream_detach(client);
 	submission_backends_trans_free(client, trans);
 	client_state_reset(client);
 }
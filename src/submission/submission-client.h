@@ -8,6 +8,7 @@ struct smtp_reply;
 struct submission_recipient;
 struct submission_backend;
 struct submission_backend_relay;
+struct submission_data_stream;
 struct client;
 
 struct client_state {
@@ -18,6 +19,8 @@ struct client_state {
 	struct submission_backend *backend;
 	struct istream *data_input;
 	uoff_t data_size;
+	/* Message data relayed while it is still being received */
+	struct submission_data_stream *data_stream;
 
 	bool anonymous_allowed:1;
 };
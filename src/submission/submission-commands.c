@@ -3,6 +3,7 @@
 #include "submission-common.h"
 #include "str.h"
 #include "istream.h"
+#include "istream-chain.h"
 #include "istream-concat.h"
 #include "istream-seekable.h"
 #include "mail-storage.h"
@@ -210,6 +211,184 @@ int client_default_cmd_rset(struct client *client,
  * DATA/BDAT commands
  */
 
+struct submission_data_stream {
+	int refcount;
+	/* NULL once the transaction has ended */
+	struct client *client;
+
+	struct istream *input;
+	struct istream_chain *chain;
+	/* Amount of data appended to the chain that isn't read yet */
+	size_t buffered;
+};
+
+struct submission_data_stream_block {
+	struct submission_data_stream *stream;
+	size_t size;
+};
+
+static void
+submission_data_stream_unref(struct submission_data_stream **_stream)
+{
+	struct submission_data_stream *stream = *_stream;
+
+	*_stream = NULL;
+
+	i_assert(stream->refcount > 0);
+	if (--stream->refcount > 0)
+		return;
+	i_assert(stream->input == NULL);
+	i_free(stream);
+}
+
+static void
+submission_data_stream_block_destroyed(
+	struct submission_data_stream_block *block)
+{
+	struct submission_data_stream *stream = block->stream;
+
+	/* the chain stream has read this block entirely */
+	i_assert(stream->buffered >= block->size);
+	stream->buffered -= block->size;
+	if (stream->client != NULL &&
+	    stream->buffered < SUBMISSION_MAIL_DATA_MAX_STREAM_BUFFER_SIZE)
+		smtp_server_connection_data_input_resume(stream->client->conn);
+
+	submission_data_stream_unref(&block->stream);
+	i_free(block);
+}
+
+static void
+submission_data_stream_append(struct submission_data_stream *stream,
+			      const unsigned char *data, size_t size)
+{
+	struct submission_data_stream_block *block;
+	struct istream *input;
+
+	block = i_new(struct submission_data_stream_block, 1);
+	block->stream = stream;
+	block->size = size;
+	stream->refcount++;
+	stream->buffered += size;
+
+	input = i_stream_create_copy_from_data(data, size);
+	i_stream_add_destroy_callback(
+		input, submission_data_stream_block_destroyed, block);
+	i_stream_chain_append(stream->chain, input);
+	i_stream_unref(&input);
+}
+
+void submission_data_stream_detach(struct client *client)
+{
+	struct submission_data_stream *stream = client->state.data_stream;
+
+	if (stream == NULL)
+		return;
+	client->state.data_stream = NULL;
+
+	/* The blocks still in the chain keep the stream allocated until the
+	   backend drops its reference to the chain. */
+	stream->client = NULL;
+	i_stream_unref(&stream->input);
+	submission_data_stream_unref(&stream);
+}
+
+static bool cmd_data_can_stream(struct client *client,
+				struct smtp_server_cmd_ctx *cmd)
+{
+	struct submission_backend *backend;
+
+	if (!client->set->submission_relay_streaming)
+		return FALSE;
+	/* With BDAT the chunks are replied separately, while the relay
+	   server replies only once for the whole message. */
+	if (strcmp(cmd->name, "DATA") != 0)
+		return FALSE;
+	/* A plugin may want to see the whole message first */
+	if (client->v.cmd_data != client_default_cmd_data)
+		return FALSE;
+
+	if (client->backend_default_relay == NULL ||
+	    array_count(&client->rcpt_backends) != 1)
+		return FALSE;
+	backend = array_idx_elem(&client->rcpt_backends, 0);
+	return (backend ==
+		submission_backend_relay_get(client->backend_default_relay));
+}
+
+static int
+cmd_data_begin_stream(struct client *client, struct smtp_server_cmd_ctx *cmd,
+		      struct smtp_server_transaction *trans,
+		      struct istream *data_input)
+{
+	struct submission_data_stream *stream;
+	string_t *added_headers;
+
+	stream = i_new(struct submission_data_stream, 1);
+	stream->refcount = 1;
+	stream->client = client;
+	stream->input = i_stream_create_chain(&stream->chain, IO_BLOCK_SIZE);
+	i_stream_set_name(stream->input, "<submission DATA>");
+	client->state.data_stream = stream;
+
+	client->state.data_input = data_input;
+	i_stream_ref(data_input);
+
+	/* prepend our own headers */
+	added_headers = t_str_new(200);
+	smtp_server_transaction_write_trace_record(
+		added_headers, trans, SMTP_SERVER_TRACE_RCPT_TO_ADDRESS_FINAL);
+	submission_data_stream_append(stream, str_data(added_headers),
+				      str_len(added_headers));
+
+	/* Start relaying right away. The rest of the message is appended to
+	   the stream while it is received from the client. */
+	if (submission_backends_cmd_data_stream(client, cmd, trans,
+						stream->input) < 0)
+		return -1;
+	return 0;
+}
+
+static int
+cmd_data_continue_stream(struct client *client,
+			 struct smtp_server_cmd_ctx *cmd)
+{
+	struct submission_data_stream *stream = client->state.data_stream;
+	struct istream *data_input = client->state.data_input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	for (;;) {
+		if (stream->buffered >=
+			SUBMISSION_MAIL_DATA_MAX_STREAM_BUFFER_SIZE &&
+		    smtp_server_cmd_data_input_halt(cmd)) {
+			/* relay server is behind; continue once it has read
+			   more of the buffered data */
+			return 0;
+		}
+		if ((ret = i_stream_read_more(data_input, &data, &size)) <= 0)
+			break;
+		submission_data_stream_append(stream, data, size);
+		i_stream_skip(data_input, size);
+		if (!smtp_server_cmd_data_check_size(cmd))
+			return -1;
+	}
+
+	if (ret == 0)
+		return 0;
+	if (ret < 0 && data_input->stream_errno != 0)
+		return -1;
+
+	/* Done reading DATA stream */
+	client->state.data_size = data_input->v_offset;
+	i_stream_unref(&client->state.data_input);
+
+	/* the reply is sent once the relay server has replied */
+	i_stream_chain_append_eof(stream->chain);
+	return 0;
+}
+
 int cmd_data_continue(void *conn_ctx, struct smtp_server_cmd_ctx *cmd,
 		      struct smtp_server_transaction *trans)
 {
@@ -222,6 +401,9 @@ int cmd_data_continue(void *conn_ctx, struct smtp_server_cmd_ctx *cmd,
 	size_t size;
 	int ret;
 
+	if (client->state.data_stream != NULL)
+		return cmd_data_continue_stream(client, cmd);
+
 	while ((ret = i_stream_read_more(data_input, &data, &size)) > 0) {
 		i_stream_skip(data_input, size);
 		if (!smtp_server_cmd_data_check_size(cmd))
@@ -265,8 +447,8 @@ int cmd_data_continue(void *conn_ctx, struct smtp_server_cmd_ctx *cmd,
 }
 
 int cmd_data_begin(void *conn_ctx,
-		   struct smtp_server_cmd_ctx *cmd ATTR_UNUSED,
-		   struct smtp_server_transaction *trans ATTR_UNUSED,
+		   struct smtp_server_cmd_ctx *cmd,
+		   struct smtp_server_transaction *trans,
 		   struct istream *data_input)
 {
 	struct client *client = conn_ctx;
@@ -279,6 +461,9 @@ int cmd_data_begin(void *conn_ctx,
 		return -1;
 	}
 
+	if (cmd_data_can_stream(client, cmd))
+		return cmd_data_begin_stream(client, cmd, trans, data_input);
+
 	inputs[0] = data_input;
 	inputs[1] = NULL;
 
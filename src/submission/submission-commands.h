@@ -61,6 +61,10 @@ int client_default_cmd_data(struct client *client,
 			    struct smtp_server_transaction *trans,
 			    struct istream *data_input, uoff_t data_size);
 
+/* Stop feeding the message data that is being relayed while it's received
+   (submission_relay_streaming). */
+void submission_data_stream_detach(struct client *client);
+
 /*
  * BURL command
  */
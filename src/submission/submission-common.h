@@ -15,6 +15,11 @@
    calculate the SIZE capability based on what the backend server states. */
 #define SUBMISSION_MAX_ADDITIONAL_MAIL_SIZE 1024
 #define SUBMISSION_MAIL_DATA_MAX_INMEMORY_SIZE (1024*128)
+/* Maximum amount of message data received from the client that the relay
+   server hasn't read yet when the message is streamed to it
+   (submission_relay_streaming). Reading from the client is paused until the
+   relay catches up. */
+#define SUBMISSION_MAIL_DATA_MAX_STREAM_BUFFER_SIZE (1024*128)
 
 /* Maximum time to wait for QUIT reply from relay server */
 #define SUBMISSION_MAX_WAIT_QUIT_REPLY_MSECS 2000
@@ -87,6 +87,8 @@ static const struct setting_define submission_setting_defines[] = {
 
 	DEF(STR_VARS, submission_relay_rawlog_dir),
 	DEF(TIME, submission_relay_max_idle_time),
+	DEF(UINT, submission_relay_pool_max_connections),
+	DEF(BOOL, submission_relay_streaming),
 
 	DEF(TIME_MSECS, submission_relay_connect_timeout),
 	DEF(TIME_MSECS, submission_relay_command_timeout),
@@ -128,6 +130,8 @@ static const struct submission_settings submission_default_settings = {
 
 	.submission_relay_rawlog_dir = "",
 	.submission_relay_max_idle_time = 60*29,
+	.submission_relay_pool_max_connections = 0,
+	.submission_relay_streaming = FALSE,
 
 	.submission_relay_connect_timeout = 30*1000,
 	.submission_relay_command_timeout = 60*5*1000,
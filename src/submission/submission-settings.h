@@ -44,6 +44,8 @@ struct submission_settings {
 
 	const char *submission_relay_rawlog_dir;
 	unsigned int submission_relay_max_idle_time;
+	unsigned int submission_relay_pool_max_connections;
+	bool submission_relay_streaming;
 
 	unsigned int submission_relay_connect_timeout;
 	unsigned int submission_relay_command_timeout;
@@ -7,11 +7,14 @@
 #include "env-util.h"
 #include "execv-const.h"
 #include "write-full.h"
+#include "child-wait.h"
 #include "restrict-access.h"
 #include "master-interface.h"
 #include "master-service.h"
 
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
@@ -22,20 +25,24 @@
 static ARRAY_TYPE(const_string) exec_args;
 static const char **accepted_envs;
 static bool passthrough = FALSE;
+static struct child_wait *noreply_wait;
 
-static void script_verify_version(const char *line)
+static bool script_verify_version(const char *line)
 {
 	if (line == NULL ||
 	    !version_string_verify(line, "script", SCRIPT_MAJOR_VERSION)) {
-		i_fatal("Client not compatible with this binary "
+		i_error("Client not compatible with this binary "
 			"(connecting to wrong socket?)");
+		return FALSE;
 	}
+	return TRUE;
 }
 
 
 static void
 exec_child(struct master_service_connection *conn,
-	const char *const *args, const char *const *envs)
+	const char *const *args, const char *const *envs,
+	unsigned int alarm_secs)
 {
 	unsigned int i, socket_count;
 
@@ -65,18 +72,24 @@ exec_child(struct master_service_connection *conn,
 	if (envs != NULL)
 		env_put_array(envs);
 
+	/* the alarm is kept over exec(), while the ignoring signal handler
+	   is reset. so the client's alarm terminates the script itself. */
+	alarm(alarm_secs);
+
 	args = array_front(&exec_args);
 	execvp_const(args[0], args);
 }
 
-static bool
+static int
 parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
-	struct master_service_connection* conn, ssize_t *output_r)
+	struct master_service_connection* conn, bool *noreply_r,
+	unsigned int *alarm_secs_r)
 {
 	string_t *input;
 	void *buf;
 	size_t prev_size, scanpos;
-	bool header_complete = FALSE, noreply = FALSE;
+	ssize_t ret;
+	bool header_complete = FALSE;
 
 	input = t_buffer_create(IO_BLOCK_SIZE);
 
@@ -95,7 +108,13 @@ parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
 	   This is quite a horrible protocol. If alarm is specified, it MUST be
 	   before "noreply". If "noreply" isn't given, something other string
 	   (typically "-") must be given which is eaten away.
-	*/		
+
+	   Errors only fail this connection, since the process continues
+	   serving the following clients. SIGALRM interrupts a blocking
+	   recv() with EINTR.
+	*/
+	*noreply_r = FALSE;
+	*alarm_secs_r = 0;
 	alarm(SCRIPT_READ_TIMEOUT_SECS);
 	scanpos = 1;
 	while (!header_complete) {
@@ -105,21 +124,26 @@ parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
 		buf = buffer_append_space_unsafe(input, IO_BLOCK_SIZE);
 
 		/* peek in socket input buffer */
-		*output_r = recv(conn->fd, buf, IO_BLOCK_SIZE, MSG_PEEK);
-		if (*output_r <= 0) {
+		ret = recv(conn->fd, buf, IO_BLOCK_SIZE, MSG_PEEK);
+		if (ret <= 0) {
+			alarm(0);
 			buffer_set_used_size(input, prev_size);
-			if (strchr(str_c(input), '\n') != NULL)
-				script_verify_version(t_strcut(str_c(input), '\n'));
-
-			if (*output_r < 0)
-				i_fatal("recv(MSG_PEEK) failed: %m");
-
-			i_fatal("recv(MSG_PEEK) failed: disconnected");
+			if (strchr(str_c(input), '\n') != NULL &&
+			    !script_verify_version(t_strcut(str_c(input), '\n')))
+				return -1;
+
+			if (ret < 0 && errno == EINTR)
+				i_error("recv(MSG_PEEK) failed: Timed out");
+			else if (ret < 0)
+				i_error("recv(MSG_PEEK) failed: %m");
+			else
+				i_error("recv(MSG_PEEK) failed: disconnected");
+			return -1;
 		}
 
 		/* scan for final \n\n */
 		pos = CONST_PTR_OFFSET(input->data, scanpos);
-		end = CONST_PTR_OFFSET(input->data, prev_size + *output_r);
+		end = CONST_PTR_OFFSET(input->data, prev_size + ret);
 		for (; pos < end; pos++) {
 			if (pos[-1] == '\n' && pos[0] == '\n') {
 				header_complete = TRUE;
@@ -130,13 +154,16 @@ parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
 		scanpos = pos - (const unsigned char *)input->data;
 
 		/* read data for real (up to and including \n\n) */
-		*output_r = recv(conn->fd, buf, scanpos-prev_size, 0);
-		if (prev_size+(*output_r) != scanpos) {
-			if (*output_r < 0)
-				i_fatal("recv() failed: %m");
-			if (*output_r == 0)
-				i_fatal("recv() failed: disconnected");
-			i_fatal("recv() failed: size of definitive recv() differs from peek");
+		ret = recv(conn->fd, buf, scanpos-prev_size, 0);
+		if (prev_size+ret != scanpos) {
+			alarm(0);
+			if (ret < 0)
+				i_error("recv() failed: %m");
+			else if (ret == 0)
+				i_error("recv() failed: disconnected");
+			else
+				i_error("recv() failed: size of definitive recv() differs from peek");
+			return -1;
 		}
 		buffer_set_used_size(input, scanpos);
 	}
@@ -146,15 +173,17 @@ parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
 	buffer_set_used_size(input, scanpos-2);
 
 	*args_r = t_strsplit(str_c(input), "\n");
-	script_verify_version(**args_r); (*args_r)++;
+	if (!script_verify_version(**args_r))
+		return -1;
+	(*args_r)++;
 	if (**args_r != NULL) {
 		const char *p;
 
 		if (str_begins(**args_r, "alarm=")) {
-			unsigned int seconds;
-			if (str_to_uint((**args_r) + 6, &seconds) < 0)
-				i_fatal("invalid alarm option");
-			alarm(seconds);
+			if (str_to_uint((**args_r) + 6, alarm_secs_r) < 0) {
+				i_error("invalid alarm option");
+				return -1;
+			}
 			(*args_r)++;
 		}
 		while (str_begins(**args_r, "env_")) {
@@ -162,45 +191,102 @@ parse_input(ARRAY_TYPE(const_string)* envs, const char *const **args_r,
 
 			env = t_str_tabunescape((**args_r)+4);
 			p = strchr(env, '=');
-			if (p == NULL)
-				i_fatal("invalid environment variable");
+			if (p == NULL) {
+				i_error("invalid environment variable");
+				return -1;
+			}
 			envname = t_strdup_until((**args_r)+4, p);
 
 			if (str_array_find(accepted_envs, envname))
 				array_push_back(envs, &env);
 			(*args_r)++;
 		}
+		if (**args_r == NULL) {
+			i_error("missing options");
+			return -1;
+		}
 		if (strcmp(**args_r, "noreply") == 0) {
-			noreply = TRUE;
+			*noreply_r = TRUE;
+		}
+		if (***args_r == '\0') {
+			i_error("empty options");
+			return -1;
 		}
-		if (***args_r == '\0')
-			i_fatal("empty options");
 		(*args_r)++;
 	}
 	array_append_zero(envs);
+	return 0;
+}
 
-	return noreply;
+static int script_wait(pid_t pid, unsigned int alarm_secs, int *status_r)
+{
+	time_t deadline = alarm_secs == 0 ? 0 : time(NULL) + alarm_secs;
+	bool killed = FALSE;
+
+	/* The script has the same alarm, which normally terminates it. If it
+	   ignores SIGALRM, kill it when our own alarm interrupts waitpid(). */
+	if (alarm_secs > 0)
+		alarm(alarm_secs);
+	while (waitpid(pid, status_r, 0) < 0) {
+		if (errno != EINTR) {
+			i_error("waitpid() failed: %m");
+			alarm(0);
+			return -1;
+		}
+		if (deadline == 0 || killed)
+			continue;
+		if (time(NULL) < deadline) {
+			alarm(deadline - time(NULL) + 1);
+			continue;
+		}
+		i_error("Script timed out after %u seconds, killing it",
+			alarm_secs);
+		if (kill(pid, SIGKILL) < 0 && errno != ESRCH)
+			i_error("kill(%ld) failed: %m", (long)pid);
+		killed = TRUE;
+	}
+	alarm(0);
+	return 0;
 }
 
-static bool client_exec_script(struct master_service_connection *conn)
+static void
+script_noreply_exited(const struct child_wait_status *status,
+		      void *context ATTR_UNUSED)
+{
+	if (WIFEXITED(status->status)) {
+		if (WEXITSTATUS(status->status) != 0) {
+			i_error("Script terminated abnormally, exit status %d",
+				WEXITSTATUS(status->status));
+		}
+	} else if (WIFSIGNALED(status->status)) {
+		i_error("Script terminated abnormally, signal %d",
+			WTERMSIG(status->status));
+	}
+}
+
+static bool
+client_exec_script(struct master_service_connection *conn, bool *noreply_r)
 {
 	ARRAY_TYPE(const_string) envs;
 	const char *const *args = NULL;
-	ssize_t ret;
-	int status;
+	unsigned int alarm_secs = 0;
+	int ret, status;
 	pid_t pid;
 
 	t_array_init(&envs, 16);
 
 	net_set_nonblock(conn->fd, FALSE);
 
-	if (!passthrough && parse_input(&envs, &args, conn, &ret)) {
-		/* parse_input returns TRUE if noreply is set in the input.
-		 * In that case there is no need to fork and check exit
-		 * status. Parsing the input must only happen if passthrough
-		 * is not enabled. */
-		exec_child(conn, args, array_front(&envs));
-		i_unreached();
+	/* Parsing the input must only happen if passthrough is not enabled.
+	   parse_input() sets noreply if it is set in the input. The
+	   script is still run in a child process, so this process can
+	   continue serving the following clients. */
+	*noreply_r = FALSE;
+	if (!passthrough &&
+	    parse_input(&envs, &args, conn, noreply_r, &alarm_secs) < 0) {
+		/* the protocol state is unknown - just disconnect */
+		*noreply_r = TRUE;
+		return FALSE;
 	}
 
 	if ((pid = fork()) == (pid_t)-1) {
@@ -211,32 +297,37 @@ static bool client_exec_script(struct master_service_connection *conn)
 	if (pid == 0) {
 		/* child */
 		if (!passthrough)
-			exec_child(conn, args, array_front(&envs));
+			exec_child(conn, args, array_front(&envs), alarm_secs);
 		else
-			exec_child(conn, NULL, NULL);
+			exec_child(conn, NULL, NULL, 0);
 		i_unreached();
 	}
 
 	/* parent */
+	if (*noreply_r) {
+		/* nobody is waiting for the result, so don't wait for the
+		   script either. it's reaped when it exits. */
+		child_wait_add_pid(noreply_wait, pid);
+		return TRUE;
+	}
 
 	/* check script exit status */
-	if (waitpid(pid, &status, 0) < 0) {
-		i_error("waitpid() failed: %m");
+	if (script_wait(pid, alarm_secs, &status) < 0) {
 		return FALSE;
 	} else if (WIFEXITED(status)) {
 		ret = WEXITSTATUS(status);
 		if (ret != 0) {
-			i_error("Script terminated abnormally, exit status %d", (int)ret);
+			i_error("Script terminated abnormally, exit status %d", ret);
 			return FALSE;
 		}
 	} else if (WIFSIGNALED(status)) {
 		i_error("Script terminated abnormally, signal %d", WTERMSIG(status));
 		return FALSE;
 	} else if (WIFSTOPPED(status)) {
-		i_fatal("Script stopped, signal %d", WSTOPSIG(status));
+		i_error("Script stopped, signal %d", WSTOPSIG(status));
 		return FALSE;
 	} else {
-		i_fatal("Script terminated abnormally, return status %d", status);
+		i_error("Script terminated abnormally, return status %d", status);
 		return FALSE;
 	}
 	return TRUE;
@@ -244,16 +335,18 @@ static bool client_exec_script(struct master_service_connection *conn)
 
 static void client_connected(struct master_service_connection *conn)
 {
-	if (!passthrough) {
+	T_BEGIN {
 		char response[2];
-
-		response[0] = client_exec_script(conn) ? '+' : '-';
-		response[1] = '\n';
-		if (write_full(conn->fd, &response, 2) < 0)
-			i_error("write(response) failed: %m");
-	} else {
-		client_exec_script(conn);
-	}
+		bool noreply, success;
+
+		success = client_exec_script(conn, &noreply);
+		if (!passthrough && !noreply) {
+			response[0] = success ? '+' : '-';
+			response[1] = '\n';
+			if (write_full(conn->fd, &response, 2) < 0)
+				i_error("write(response) failed: %m");
+		}
+	} T_END;
 }
 
 int main(int argc, char *argv[])
@@ -297,8 +390,15 @@ int main(int argc, char *argv[])
 	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
 	restrict_access_allow_coredumps(TRUE);
 
+	/* Scripts are always executed in a child process, so the same
+	   process can keep serving clients instead of a new script process
+	   being created for each connection. Waiting for a script blocks the
+	   process, so handle only one client at a time to make the master
+	   create more processes for concurrent clients. */
 	master_service_init_finish(master_service);
-	master_service_set_service_count(master_service, 1);
+	master_service_set_client_limit(master_service, 1);
+	child_wait_init();
+	noreply_wait = child_wait_new(script_noreply_exited, NULL);
 
 	if (argv[0][0] == '/')
 		binary = argv[0];
@@ -314,6 +414,8 @@ int main(int argc, char *argv[])
 	}
 
 	master_service_run(master_service, client_connected);
+	child_wait_free(&noreply_wait);
+	child_wait_deinit();
 	array_free(&exec_args);
 	i_free(accepted_envs);
 	master_service_deinit(&master_service);